@@ -0,0 +1,125 @@
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include "bench_common.h"
+
+static void usage(const char *prog)
+{
+    fprintf(stderr, "Usage: %s [-n ROWS] [-o RESULTS-FILE] [NAME-PREFIX]\n", prog);
+    exit(1);
+}
+
+/* Parses the options of a benchmark program: -n sets the number of rows,
+ * -o the file results are appended to, and an argument runs only the
+ * benchmarks whose name starts with it */
+void bench_parse(bench_options_t *opts, int argc, char **argv, long default_rows)
+{
+    int opt;
+    char *end;
+
+    opts->rows = default_rows;
+    opts->only = NULL;
+    opts->out = stdout;
+
+    while ((opt = getopt(argc, argv, "n:o:h")) != -1)
+    {
+        switch (opt)
+        {
+        case 'n':
+            opts->rows = strtol(optarg, &end, 10);
+            if (*end != '\0' || opts->rows <= 0)
+                usage(argv[0]);
+            break;
+        case 'o':
+            if ((opts->out = fopen(optarg, "a")) == NULL)
+            {
+                perror(optarg);
+                exit(1);
+            }
+            break;
+        default:
+            usage(argv[0]);
+        }
+    }
+
+    if (optind < argc)
+        opts->only = argv[optind++];
+    if (optind < argc)
+        usage(argv[0]);
+}
+
+bool bench_wanted(bench_options_t *opts, const char *name)
+{
+    return opts->only == NULL || strncmp(name, opts->only, strlen(opts->only)) == 0;
+}
+
+/* Monotonic time, in seconds */
+double bench_now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+void bench_report(bench_options_t *opts, const char *name, uint64_t ops, double seconds)
+{
+    fprintf(opts->out, "{\"suite\": \"%s\", \"name\": \"%s\", \"rows\": %ld, \"ops\": %llu, "
+            "\"seconds\": %.6f, \"ns_per_op\": %.1f, \"ops_per_sec\": %.0f}\n",
+            opts->suite, name, opts->rows, (unsigned long long) ops, seconds,
+           ops ? seconds * 1e9 / ops : 0.0, seconds > 0 ? ops / seconds : 0.0);
+    fflush(opts->out);
+}
+
+/* Creates an empty temporary file. Free it with bench_delete_file. */
+char *bench_tmp_file(void)
+{
+    const char *dir = getenv("CHIDB_BENCH_DIR");
+    char *template;
+
+    if (dir == NULL)
+        dir = "/tmp";
+    template = malloc(strlen(dir) + strlen("/chidb-bench-XXXXXX") + 1);
+    sprintf(template, "%s/chidb-bench-XXXXXX", dir);
+
+    int fd = mkstemp(template);
+    if (fd == -1)
+    {
+        perror(template);
+        exit(1);
+    }
+    close(fd);
+
+    return template;
+}
+
+void bench_delete_file(char *f)
+{
+    size_t len = strlen(f);
+    char *journal = malloc(len + 9);
+
+    /* Along with whatever the database left next to it */
+    sprintf(journal, "%s-journal", f);
+    remove(journal);
+    sprintf(journal, "%s-wal", f);
+    remove(journal);
+    free(journal);
+
+    remove(f);
+    free(f);
+}
+
+/* xorshift64*, so that runs are repeatable */
+uint64_t bench_random(uint64_t *state)
+{
+    uint64_t x = *state;
+
+    x ^= x >> 12;
+    x ^= x << 25;
+    x ^= x >> 27;
+    *state = x;
+
+    return x * 0x2545F4914F6CDD1DULL;
+}
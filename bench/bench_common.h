@@ -0,0 +1,34 @@
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdio.h>
+
+/* Benchmarks print one line per result, as a JSON object, e.g.
+ *
+ *   {"suite": "micro", "name": "btree_find", "rows": 100000,
+ *    "ops": 100000, "seconds": 0.052, "ns_per_op": 520.1, "ops_per_sec": 1922703}
+ *
+ * so that results can be collected (e.g., with jq) and compared across
+ * releases. They are appended to the file given with -o, or printed to
+ * stdout (along with anything the library itself prints) without it.
+ *
+ * Database files are created in $CHIDB_BENCH_DIR (/tmp by default). */
+
+/* Options common to all the benchmark programs */
+typedef struct bench_options
+{
+    const char *suite;  // name of the benchmark program
+    long rows;          // number of rows (or entries) of the data sets
+    const char *only;   // if not NULL, only run benchmarks with this prefix
+    FILE *out;          // where results are written
+} bench_options_t;
+
+void bench_parse(bench_options_t *opts, int argc, char **argv, long default_rows);
+bool bench_wanted(bench_options_t *opts, const char *name);
+
+double bench_now(void);
+void bench_report(bench_options_t *opts, const char *name, uint64_t ops, double seconds);
+
+char *bench_tmp_file(void);
+void bench_delete_file(char *f);
+
+uint64_t bench_random(uint64_t *state);
@@ -0,0 +1,274 @@
+/*
+ * Microbenchmarks of the layers under the DBM: the pager, the B-Tree,
+ * cursors and records. Each one runs over a table of -n entries (100000
+ * by default), built with the B-Tree module directly.
+ *
+ *   make bench                        # everything, with BENCH_ROWS rows
+ *   bench/bench_micro -n 10000 btree  # only the btree_* benchmarks
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <chidb/chidb.h>
+#include "libchidb/btree.h"
+#include "libchidb/pager.h"
+#include "libchidb/record.h"
+#include "libchidb/dbm-cursor.h"
+#include "bench_common.h"
+
+#define ROW_TEXT_LEN (40)
+
+/* Makes the record of the row with the given key: (key, text, key * 2) */
+static uint8_t *make_record(chidb_key_t key, uint32_t *size)
+{
+    DBRecordBuffer dbrb;
+    DBRecord *dbr;
+    uint8_t *record;
+    char text[ROW_TEXT_LEN + 1];
+
+    for (int i = 0; i < ROW_TEXT_LEN; i++)
+        text[i] = 'a' + (key + i) % 26;
+    text[ROW_TEXT_LEN] = '\0';
+
+    chidb_DBRecord_create_empty(&dbrb, 3);
+    chidb_DBRecord_appendInt32(&dbrb, (int32_t) key);
+    chidb_DBRecord_appendString(&dbrb, text);
+    chidb_DBRecord_appendInt32(&dbrb, (int32_t) key * 2);
+    chidb_DBRecord_finalize(&dbrb, &dbr);
+    chidb_DBRecord_pack(dbr, &record);
+    *size = dbr->packed_len;
+    chidb_DBRecord_destroy(dbr);
+
+    return record;
+}
+
+static chidb *open_btree(const char *fname)
+{
+    chidb *db = calloc(1, sizeof(chidb));
+
+    if (chidb_Btree_open(fname, db, &db->bt) != CHIDB_OK)
+    {
+        fprintf(stderr, "Could not open %s\n", fname);
+        exit(1);
+    }
+
+    return db;
+}
+
+static void close_btree(chidb *db)
+{
+    chidb_Btree_close(db->bt);
+    free(db);
+}
+
+static void check(int rc, int expected, const char *what)
+{
+    if (rc != expected)
+    {
+        fprintf(stderr, "%s: returned %i, expected %i\n", what, rc, expected);
+        exit(1);
+    }
+}
+
+/* Inserts keys 1..n into the table at page 1, in order or shuffled */
+static double insert_rows(chidb *db, long n, bool shuffled)
+{
+    chidb_key_t *keys = malloc(n * sizeof(chidb_key_t));
+    uint64_t seed = 42;
+
+    for (long i = 0; i < n; i++)
+        keys[i] = i + 1;
+    for (long i = n - 1; shuffled && i > 0; i--)
+    {
+        long j = bench_random(&seed) % (i + 1);
+        chidb_key_t k = keys[i];
+        keys[i] = keys[j];
+        keys[j] = k;
+    }
+
+    double start = bench_now();
+    for (long i = 0; i < n; i++)
+    {
+        uint32_t size;
+        uint8_t *record = make_record(keys[i], &size);
+
+        check(chidb_Btree_insertInTable(db->bt, 1, keys[i], record, size), CHIDB_OK, "insertInTable");
+        free(record);
+    }
+    double t = bench_now() - start;
+
+    free(keys);
+    return t;
+}
+
+static void bench_insert(bench_options_t *opts, const char *name, bool shuffled)
+{
+    char *fname = bench_tmp_file();
+    chidb *db = open_btree(fname);
+
+    bench_report(opts, name, opts->rows, insert_rows(db, opts->rows, shuffled));
+
+    close_btree(db);
+    bench_delete_file(fname);
+}
+
+static void bench_find(bench_options_t *opts, chidb *db)
+{
+    uint64_t seed = 7;
+    uint8_t *data;
+    uint32_t size;
+
+    double start = bench_now();
+    for (long i = 0; i < opts->rows; i++)
+    {
+        chidb_key_t key = bench_random(&seed) % opts->rows + 1;
+
+        check(chidb_Btree_find(db->bt, 1, key, &data, &size), CHIDB_OK, "find");
+        free(data);
+    }
+    bench_report(opts, "btree_find", opts->rows, bench_now() - start);
+}
+
+static void bench_read_page(bench_options_t *opts, chidb *db)
+{
+    Pager *pager = db->bt->pager;
+    uint64_t seed = 11;
+    MemPage *page;
+
+    double start = bench_now();
+    for (long i = 0; i < opts->rows; i++)
+    {
+        npage_t npage = bench_random(&seed) % pager->n_pages + 1;
+
+        check(chidb_Pager_readPage(pager, npage, &page), CHIDB_OK, "readPage");
+        check(chidb_Pager_releaseMemPage(pager, page), CHIDB_OK, "releaseMemPage");
+    }
+    bench_report(opts, "pager_readPage", opts->rows, bench_now() - start);
+}
+
+static void bench_scan(bench_options_t *opts, chidb *db)
+{
+    chidb_dbm_cursor_t c;
+    long n = 1;
+    int rc;
+
+    double start = bench_now();
+    memset(&c, 0, sizeof(c));
+    check(chidb_dbm_cursor_init(db->bt, &c, 1, 3), CHIDB_OK, "cursor_init");
+    c.type = CURSOR_READ;
+    check(chidb_dbm_cursor_reset(db->bt, &c), CHIDB_OK, "cursor_reset");
+    c.trail[0].n_current_cell = 0;
+    chidb_dbm_cursorTable_fwdDwn(db->bt, &c);
+    while ((rc = chidb_dbm_cursor_fwd(db->bt, &c)) == CHIDB_OK)
+        n++;
+    chidb_dbm_cursor_destroy(db->bt, &c);
+    double t = bench_now() - start;
+
+    check(rc, CHIDB_CURSORCANTMOVE, "cursor_fwd");
+    check(n, opts->rows, "rows scanned");
+    bench_report(opts, "cursor_scan", n, t);
+}
+
+static void bench_records(bench_options_t *opts)
+{
+    uint32_t size;
+    uint8_t *raw = make_record(12345, &size), *packed;
+    DBRecord *dbr;
+
+    double start = bench_now();
+    for (long i = 0; i < opts->rows; i++)
+    {
+        check(chidb_DBRecord_unpack(&dbr, raw), CHIDB_OK, "unpack");
+        chidb_DBRecord_destroy(dbr);
+    }
+    bench_report(opts, "record_unpack", opts->rows, bench_now() - start);
+
+    chidb_DBRecord_unpack(&dbr, raw);
+    start = bench_now();
+    for (long i = 0; i < opts->rows; i++)
+    {
+        check(chidb_DBRecord_pack(dbr, &packed), CHIDB_OK, "pack");
+        free(packed);
+    }
+    bench_report(opts, "record_pack", opts->rows, bench_now() - start);
+
+    chidb_DBRecord_destroy(dbr);
+    free(raw);
+}
+
+/* Decodes the header of a wide record: mostly integers, with a text
+ * field every so often */
+static void bench_wide_header(bench_options_t *opts)
+{
+    DBRecordBuffer dbrb;
+    DBRecord *dbr, wide;
+    uint32_t types[DBRECORD_MAX_FIELDS], offsets[DBRECORD_MAX_FIELDS];
+    uint8_t *raw;
+    uint32_t sum = 0;
+    int nfields = 64;
+
+    chidb_DBRecord_create_empty(&dbrb, nfields);
+    for (int i = 0; i < nfields; i++)
+    {
+        if (i % 16 == 15)
+            chidb_DBRecord_appendString(&dbrb, "text");
+        else
+            chidb_DBRecord_appendInt32(&dbrb, i);
+    }
+    chidb_DBRecord_finalize(&dbrb, &dbr);
+    chidb_DBRecord_pack(dbr, &raw);
+    chidb_DBRecord_destroy(dbr);
+
+    wide.types = types;
+    wide.offsets = offsets;
+    double start = bench_now();
+    for (long i = 0; i < opts->rows; i++)
+    {
+        chidb_DBRecord_unpackHeader(&wide, raw);
+        sum += wide.offsets[nfields - 1];
+    }
+    double t = bench_now() - start;
+
+    check(wide.nfields, nfields, "fields");
+    check(sum / opts->rows, wide.offsets[nfields - 1], "offsets");
+    bench_report(opts, "record_header_wide", opts->rows, t);
+
+    free(raw);
+}
+
+int main(int argc, char **argv)
+{
+    bench_options_t opts = { .suite = "micro" };
+
+    bench_parse(&opts, argc, argv, 100000);
+
+    if (bench_wanted(&opts, "btree_insert_seq"))
+        bench_insert(&opts, "btree_insert_seq", false);
+    if (bench_wanted(&opts, "btree_insert_random"))
+        bench_insert(&opts, "btree_insert_random", true);
+
+    if (bench_wanted(&opts, "btree_find") || bench_wanted(&opts, "pager_readPage") ||
+        bench_wanted(&opts, "cursor_scan"))
+    {
+        char *fname = bench_tmp_file();
+        chidb *db = open_btree(fname);
+
+        insert_rows(db, opts.rows, true);
+        if (bench_wanted(&opts, "pager_readPage"))
+            bench_read_page(&opts, db);
+        if (bench_wanted(&opts, "btree_find"))
+            bench_find(&opts, db);
+        if (bench_wanted(&opts, "cursor_scan"))
+            bench_scan(&opts, db);
+
+        close_btree(db);
+        bench_delete_file(fname);
+    }
+
+    if (bench_wanted(&opts, "record_unpack") || bench_wanted(&opts, "record_pack"))
+        bench_records(&opts);
+    if (bench_wanted(&opts, "record_header_wide"))
+        bench_wide_header(&opts);
+
+    return 0;
+}
@@ -0,0 +1,239 @@
+/*
+ * SQL workloads, run through the public API over tables of -n rows
+ * (10^6 by default):
+ *
+ *   sql_insert_bulk     INSERTs of rows with bound parameters, in a transaction
+ *   sql_point_select    SELECTs of a random row by its primary key
+ *   sql_range_scan      SELECTs of (up to) 100 consecutive rows, from a random id
+ *   sql_full_scan       a SELECT with a filter that reads the whole table
+ *   sql_natural_join    a NATURAL JOIN of the table with one a tenth its size
+ *   sql_export_rows     every value of the table, read with chidb_step and
+ *                       chidb_column_*
+ *   sql_export_batch    the same, read with chidb_step_batch
+ *
+ * ops is the number of statements run, except for the scans, the join and
+ * the exports, where it is the number of rows read.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <chidb/chidb.h>
+#include "bench_common.h"
+
+#define RANGE_ROWS (100)
+
+static void check(int rc, int expected, const char *what)
+{
+    if (rc != expected)
+    {
+        fprintf(stderr, "%s: returned %i, expected %i\n", what, rc, expected);
+        exit(1);
+    }
+}
+
+static void exec_sql(chidb *db, const char *sql)
+{
+    chidb_stmt *stmt;
+    int rc;
+
+    check(chidb_prepare(db, sql, &stmt), CHIDB_OK, sql);
+    while ((rc = chidb_step(stmt)) == CHIDB_ROW)
+        ;
+    check(rc, CHIDB_DONE, sql);
+    check(chidb_finalize(stmt), CHIDB_OK, sql);
+}
+
+/* Runs a query and returns the number of rows it returned */
+static long count_rows(chidb_stmt *stmt)
+{
+    long n = 0;
+    int rc;
+
+    while ((rc = chidb_step(stmt)) == CHIDB_ROW)
+        n++;
+    check(rc, CHIDB_DONE, "step");
+    check(chidb_reset(stmt), CHIDB_OK, "reset");
+
+    return n;
+}
+
+/* Inserts rows (id, g, name, v) with ids 1..n into t, with g = id % 10
+ * (the key of u) */
+static double insert_rows(chidb *db, long n)
+{
+    chidb_stmt *stmt;
+    char name[32];
+
+    double start = bench_now();
+    exec_sql(db, "BEGIN;");
+    check(chidb_prepare(db, "INSERT INTO t VALUES (?, ?, ?, ?);", &stmt), CHIDB_OK, "prepare");
+    for (long i = 1; i <= n; i++)
+    {
+        sprintf(name, "row-%ld", i);
+        chidb_bind_int64(stmt, 1, i);
+        chidb_bind_int64(stmt, 2, i % (n / 10 + 1));
+        chidb_bind_text(stmt, 3, name);
+        chidb_bind_int64(stmt, 4, i * 3);
+        check(chidb_step(stmt), CHIDB_DONE, "INSERT");
+        check(chidb_reset(stmt), CHIDB_OK, "reset");
+    }
+    check(chidb_finalize(stmt), CHIDB_OK, "finalize");
+    exec_sql(db, "COMMIT;");
+
+    return bench_now() - start;
+}
+
+static void bench_point_select(bench_options_t *opts, chidb *db)
+{
+    chidb_stmt *stmt;
+    uint64_t seed = 3;
+    long n = opts->rows < 100000 ? opts->rows : 100000;
+
+    check(chidb_prepare(db, "SELECT name, v FROM t WHERE id = ?;", &stmt), CHIDB_OK, "prepare");
+    double start = bench_now();
+    for (long i = 0; i < n; i++)
+    {
+        chidb_bind_int64(stmt, 1, bench_random(&seed) % opts->rows + 1);
+        check(count_rows(stmt), 1, "point select");
+    }
+    bench_report(opts, "sql_point_select", n, bench_now() - start);
+    chidb_finalize(stmt);
+}
+
+static void bench_range_scan(bench_options_t *opts, chidb *db)
+{
+    chidb_stmt *stmt;
+    uint64_t seed = 5;
+    long n = opts->rows < 10000 ? opts->rows : 10000, nrows = 0;
+
+    char sql[64];
+
+    sprintf(sql, "SELECT name, v FROM t WHERE id > ? LIMIT %i;", RANGE_ROWS);
+    check(chidb_prepare(db, sql, &stmt), CHIDB_OK, "prepare");
+    double start = bench_now();
+    for (long i = 0; i < n; i++)
+    {
+        chidb_bind_int64(stmt, 1, bench_random(&seed) % opts->rows);
+        nrows += count_rows(stmt);
+    }
+    bench_report(opts, "sql_range_scan", nrows, bench_now() - start);
+    chidb_finalize(stmt);
+}
+
+static void bench_full_scan(bench_options_t *opts, chidb *db)
+{
+    chidb_stmt *stmt;
+
+    check(chidb_prepare(db, "SELECT id, name FROM t WHERE v < 0;", &stmt), CHIDB_OK, "prepare");
+    double start = bench_now();
+    check(count_rows(stmt), 0, "full scan");
+    bench_report(opts, "sql_full_scan", opts->rows, bench_now() - start);
+    chidb_finalize(stmt);
+}
+
+static void bench_join(bench_options_t *opts, chidb *db)
+{
+    chidb_stmt *stmt;
+    char row[64];
+    const char *rows[1];
+    long nu = opts->rows / 10 + 1;
+
+    exec_sql(db, "CREATE TABLE u(g INTEGER PRIMARY KEY, w INTEGER);");
+    exec_sql(db, "BEGIN;");
+    for (long i = 0; i < nu; i++)
+    {
+        sprintf(row, "%ld|%ld", i, i * 7);
+        rows[0] = row;
+        check(chidb_insert_rows(db, "u", rows, 1), CHIDB_OK, "insert_rows");
+    }
+    exec_sql(db, "COMMIT;");
+
+    check(chidb_prepare(db, "SELECT id, w FROM t NATURAL JOIN u;", &stmt), CHIDB_OK, "prepare");
+    double start = bench_now();
+    check(count_rows(stmt), opts->rows, "join");
+    bench_report(opts, "sql_natural_join", opts->rows, bench_now() - start);
+    chidb_finalize(stmt);
+}
+
+#define EXPORT_SQL "SELECT id, g, name, v FROM t;"
+#define EXPORT_BATCH (1024)
+
+static void bench_export_rows(bench_options_t *opts, chidb *db)
+{
+    chidb_stmt *stmt;
+    long n = 0, sum = 0;
+    int rc;
+
+    check(chidb_prepare(db, EXPORT_SQL, &stmt), CHIDB_OK, "prepare");
+    double start = bench_now();
+    while ((rc = chidb_step(stmt)) == CHIDB_ROW)
+    {
+        sum += chidb_column_int(stmt, 0) + chidb_column_int(stmt, 1) + chidb_column_int(stmt, 3);
+        sum += strlen(chidb_column_text(stmt, 2));
+        n++;
+    }
+    check(rc, CHIDB_DONE, "step");
+    check(n, opts->rows, "export");
+    check(sum > 0, 1, "export values");
+    bench_report(opts, "sql_export_rows", n, bench_now() - start);
+    chidb_finalize(stmt);
+}
+
+static void bench_export_batch(bench_options_t *opts, chidb *db)
+{
+    chidb_stmt *stmt;
+    chidb_batch *batch = NULL;
+    long n = 0, sum = 0;
+    int rc;
+
+    check(chidb_prepare(db, EXPORT_SQL, &stmt), CHIDB_OK, "prepare");
+    double start = bench_now();
+    while ((rc = chidb_step_batch(stmt, EXPORT_BATCH, &batch)) == CHIDB_ROW)
+    {
+        for (int r = 0; r < batch->nrows; r++)
+            sum += batch->cols[0].ints[r] + batch->cols[1].ints[r] + batch->cols[3].ints[r]
+                   + batch->cols[2].lengths[r];
+        n += batch->nrows;
+    }
+    check(rc, CHIDB_DONE, "step_batch");
+    check(n, opts->rows, "export");
+    check(sum > 0, 1, "export values");
+    bench_report(opts, "sql_export_batch", n, bench_now() - start);
+    chidb_batch_free(batch);
+    chidb_finalize(stmt);
+}
+
+int main(int argc, char **argv)
+{
+    bench_options_t opts = { .suite = "sql" };
+    chidb *db;
+
+    bench_parse(&opts, argc, argv, 1000000);
+
+    char *fname = bench_tmp_file();
+    check(chidb_open(fname, &db), CHIDB_OK, "open");
+    exec_sql(db, "CREATE TABLE t(id INTEGER PRIMARY KEY, g INTEGER, name TEXT, v INTEGER);");
+
+    /* All the other workloads need the rows, so they are always inserted */
+    double t = insert_rows(db, opts.rows);
+    if (bench_wanted(&opts, "sql_insert_bulk"))
+        bench_report(&opts, "sql_insert_bulk", opts.rows, t);
+
+    if (bench_wanted(&opts, "sql_point_select"))
+        bench_point_select(&opts, db);
+    if (bench_wanted(&opts, "sql_range_scan"))
+        bench_range_scan(&opts, db);
+    if (bench_wanted(&opts, "sql_full_scan"))
+        bench_full_scan(&opts, db);
+    if (bench_wanted(&opts, "sql_natural_join"))
+        bench_join(&opts, db);
+    if (bench_wanted(&opts, "sql_export_rows"))
+        bench_export_rows(&opts, db);
+    if (bench_wanted(&opts, "sql_export_batch"))
+        bench_export_batch(&opts, db);
+
+    chidb_close(db);
+    bench_delete_file(fname);
+
+    return 0;
+}
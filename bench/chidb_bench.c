@@ -0,0 +1,556 @@
+/*
+ * chidb-bench: a load generator. Runs a mix of SQL statements from a
+ * number of client threads against a database, and reports the
+ * throughput and the latency percentiles of the statements.
+ *
+ *   bench/chidb-bench -c 8                         # synthetic mix, 8 clients
+ *   bench/chidb-bench -c 4 -w mix.sql my.cdb       # a mix of your own
+ *   bench/chidb-bench -c 4 -r -w trace.sql my.cdb  # replay a recorded trace
+ *
+ * A workload file has one SQL statement per line (blank lines and lines
+ * that start with "--" are skipped). By default, each client runs
+ * statements picked at random from it, so a statement that appears
+ * twice is run twice as often. With -r, the statements are run once, in
+ * order, and split between the clients (client i runs statements i,
+ * i + c, i + 2c, ...). Every ? is bound to a random integer from 1 to
+ * -k KEYS, except for the first ? of an INSERT, which is bound to a new
+ * key (one past the largest used so far), so that inserted rows do not
+ * collide.
+ *
+ * Without -w, the synthetic mix runs over a table
+ *
+ *   t(id INTEGER PRIMARY KEY, g INTEGER, name TEXT, v INTEGER)
+ *
+ * of -R rows (10000 by default), which is created in the database (a
+ * temporary file, if none is given): 90% of the statements are SELECTs
+ * of a row by its id, 9% are scans of 20 rows, and 1% are INSERTs.
+ *
+ * The clients share one handle (see chidb_set_threadsafe), which -W puts
+ * in WAL mode. With -H, each client opens a handle of its own, as
+ * separate processes would, and the database is put in WAL mode. A
+ * statement that fails with CHIDB_EBUSY is run again (and counted as
+ * busy); other errors (e.g., a constraint violation) are counted, and
+ * the client goes on.
+ *
+ * Each client stops after -n statements (10000 by default), or once -d
+ * seconds have gone by. The result is one JSON line, like those of the
+ * other benchmarks, e.g.
+ *
+ *   {"suite": "load", "name": "synthetic", "clients": 4, "ops": 40000,
+ *    "rows": 75512, "errors": 0, "busy": 0, "seconds": 0.410,
+ *    "ops_per_sec": 97561, "p50_us": 31.2, "p90_us": 48.9,
+ *    "p99_us": 120.4, "p999_us": 410.7, "max_us": 2015.0}
+ *
+ * With -s, the counters of the handles (see chidb_stats) are added to
+ * it, as "counters".
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <ctype.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sched.h>
+#include <chidb/chidb.h>
+#include "bench_common.h"
+
+#define SYNTHETIC_ROWS (10000)
+#define SYNTHETIC_SCAN (20)
+#define MAX_SQL_LEN (4096)
+
+/* A statement of the workload */
+typedef struct load_sql
+{
+    char *sql;
+    int nparams;
+    bool insert;        // the first parameter is a new key
+} load_sql_t;
+
+typedef struct load_options
+{
+    int clients;
+    bool own_handles;   // -H
+    bool wal;           // -W (or -H)
+    bool replay;        // -r
+    bool counters;      // -s
+    long statements;    // per client
+    double seconds;     // 0 if there is no time limit
+    long keys;
+    long rows;          // of the synthetic table
+    const char *name;   // of the workload
+    FILE *out;
+} load_options_t;
+
+/* What is shared by the clients */
+typedef struct load
+{
+    load_options_t *opts;
+    const char *file;
+    chidb *db;          // NULL if each client has a handle of its own
+    load_sql_t *sqls;   // the distinct statements
+    int nsqls;
+    int *mix;           // the workload, as indexes into sqls
+    long nmix;
+    int64_t next_key;   // next key an INSERT gets (updated atomically)
+    double stop;        // when the clients stop (0 if they do not)
+} load_t;
+
+typedef struct load_client
+{
+    load_t *load;
+    int id;
+    pthread_t thread;
+    chidb *db;
+
+    uint64_t *latencies;    // of every statement, in nanoseconds
+    long nlatencies;
+    long rows, errors, busy;
+    chidb_counters_t counters;
+} load_client_t;
+
+static void usage(const char *prog)
+{
+    fprintf(stderr, "Usage: %s [-c CLIENTS] [-n STATEMENTS] [-d SECONDS] [-w WORKLOAD-FILE] [-r]\n"
+            "       [-k KEYS] [-R ROWS] [-H] [-W] [-s] [-o RESULTS-FILE] [DATABASE]\n", prog);
+    exit(1);
+}
+
+static void check(int rc, int expected, const char *what)
+{
+    if (rc != expected)
+    {
+        fprintf(stderr, "%s: returned %i, expected %i\n", what, rc, expected);
+        exit(1);
+    }
+}
+
+static void exec_sql(chidb *db, const char *sql)
+{
+    chidb_stmt *stmt;
+    int rc;
+
+    check(chidb_prepare(db, sql, &stmt), CHIDB_OK, sql);
+    while ((rc = chidb_step(stmt)) == CHIDB_ROW)
+        ;
+    check(rc, CHIDB_DONE, sql);
+    check(chidb_finalize(stmt), CHIDB_OK, sql);
+}
+
+static long parse_long(const char *arg, const char *prog)
+{
+    char *end;
+    long n = strtol(arg, &end, 10);
+
+    if (*end != '\0' || n <= 0)
+        usage(prog);
+
+    return n;
+}
+
+static void add_sql(load_t *load, const char *sql)
+{
+    load_sql_t *s;
+    bool quoted = false;
+    const char *p = sql;
+    int i;
+
+    /* Each client prepares a statement once, however often it is run */
+    for (i = 0; i < load->nsqls; i++)
+        if (strcmp(load->sqls[i].sql, sql) == 0)
+            break;
+    load->mix = realloc(load->mix, (load->nmix + 1) * sizeof(int));
+    load->mix[load->nmix++] = i;
+    if (i < load->nsqls)
+        return;
+
+    load->sqls = realloc(load->sqls, (load->nsqls + 1) * sizeof(load_sql_t));
+    s = &load->sqls[load->nsqls++];
+    s->sql = strdup(sql);
+    s->nparams = 0;
+    for (; *p != '\0'; p++)
+    {
+        if (*p == '\'')
+            quoted = !quoted;
+        else if (*p == '?' && !quoted)
+            s->nparams++;
+    }
+    while (isspace((unsigned char) *sql))
+        sql++;
+    s->insert = strncasecmp(sql, "INSERT", 6) == 0 && s->nparams > 0;
+}
+
+/* Reads a workload file: one statement per line */
+static void read_workload(load_t *load, const char *file)
+{
+    char line[MAX_SQL_LEN];
+    FILE *f;
+
+    if ((f = fopen(file, "r")) == NULL)
+    {
+        perror(file);
+        exit(1);
+    }
+    while (fgets(line, sizeof(line), f) != NULL)
+    {
+        char *p = line, *end = line + strlen(line);
+
+        while (end > p && isspace((unsigned char) end[-1]))
+            *--end = '\0';
+        while (isspace((unsigned char) *p))
+            p++;
+        if (*p != '\0' && strncmp(p, "--", 2) != 0)
+            add_sql(load, p);
+    }
+    fclose(f);
+
+    if (load->nmix == 0)
+    {
+        fprintf(stderr, "%s: no statements\n", file);
+        exit(1);
+    }
+}
+
+/* Creates the table of the synthetic mix, and its mix of statements */
+static void make_synthetic(load_t *load, chidb *db)
+{
+    chidb_stmt *stmt;
+    char name[32], scan[64];
+    long n = load->opts->rows;
+
+    exec_sql(db, "CREATE TABLE t(id INTEGER PRIMARY KEY, g INTEGER, name TEXT, v INTEGER);");
+    exec_sql(db, "BEGIN;");
+    check(chidb_prepare(db, "INSERT INTO t VALUES (?, ?, ?, ?);", &stmt), CHIDB_OK, "prepare");
+    for (long i = 1; i <= n; i++)
+    {
+        sprintf(name, "row-%ld", i);
+        chidb_bind_int64(stmt, 1, i);
+        chidb_bind_int64(stmt, 2, i % 10);
+        chidb_bind_text(stmt, 3, name);
+        chidb_bind_int64(stmt, 4, i * 3);
+        check(chidb_step(stmt), CHIDB_DONE, "INSERT");
+        check(chidb_reset(stmt), CHIDB_OK, "reset");
+    }
+    check(chidb_finalize(stmt), CHIDB_OK, "finalize");
+    exec_sql(db, "COMMIT;");
+
+    sprintf(scan, "SELECT id, v FROM t WHERE id > ? LIMIT %i;", SYNTHETIC_SCAN);
+    for (int i = 0; i < 90; i++)
+        add_sql(load, "SELECT name, v FROM t WHERE id = ?;");
+    for (int i = 0; i < 9; i++)
+        add_sql(load, scan);
+    add_sql(load, "INSERT INTO t VALUES (?, ?, ?, ?);");
+}
+
+static void record_latency(load_client_t *c, uint64_t ns)
+{
+    if ((c->nlatencies & (c->nlatencies - 1)) == 0)
+    {
+        c->latencies = realloc(c->latencies, (c->nlatencies ? c->nlatencies * 2 : 1) * sizeof(uint64_t));
+        if (c->latencies == NULL)
+        {
+            fprintf(stderr, "out of memory\n");
+            exit(1);
+        }
+    }
+    c->latencies[c->nlatencies++] = ns;
+}
+
+/* Runs one statement to completion, again if the database is busy */
+static void run_stmt(load_client_t *c, load_sql_t *s, chidb_stmt *stmt, uint64_t *seed)
+{
+    load_t *load = c->load;
+    int rc;
+
+    for (int p = 1; p <= s->nparams; p++)
+    {
+        if (p == 1 && s->insert)
+            chidb_bind_int64(stmt, p, __atomic_fetch_add(&load->next_key, 1, __ATOMIC_RELAXED));
+        else
+            chidb_bind_int64(stmt, p, bench_random(seed) % load->opts->keys + 1);
+    }
+
+    double start = bench_now();
+    for (;;)
+    {
+        while ((rc = chidb_step(stmt)) == CHIDB_ROW)
+            c->rows++;
+        chidb_reset(stmt);
+        if (rc != CHIDB_EBUSY)
+            break;
+        c->busy++;
+        sched_yield();
+    }
+    record_latency(c, (uint64_t) ((bench_now() - start) * 1e9));
+
+    if (rc != CHIDB_DONE)
+        c->errors++;
+}
+
+static void *client_main(void *arg)
+{
+    load_client_t *c = arg;
+    load_t *load = c->load;
+    load_options_t *opts = load->opts;
+    chidb_stmt **stmts = calloc(load->nsqls, sizeof(chidb_stmt *));
+    uint64_t seed = 0x9E3779B97F4A7C15ULL * (c->id + 1);
+    int rc;
+
+    c->db = load->db;
+    if (c->db == NULL)
+        check(chidb_open(load->file, &c->db), CHIDB_OK, "open");
+
+    /* Each client has statements of its own, prepared up front */
+    for (int i = 0; i < load->nsqls; i++)
+    {
+        while ((rc = chidb_prepare(c->db, load->sqls[i].sql, &stmts[i])) == CHIDB_EBUSY)
+            sched_yield();
+        check(rc, CHIDB_OK, load->sqls[i].sql);
+    }
+
+    for (long n = 0; opts->replay || n < opts->statements; n++)
+    {
+        int i;
+
+        if (load->stop > 0 && bench_now() >= load->stop)
+            break;
+        if (opts->replay)
+        {
+            if (c->id + n * opts->clients >= load->nmix)
+                break;
+            i = load->mix[c->id + n * opts->clients];
+        }
+        else
+            i = load->mix[bench_random(&seed) % load->nmix];
+
+        run_stmt(c, &load->sqls[i], stmts[i], &seed);
+    }
+
+    for (int i = 0; i < load->nsqls; i++)
+        chidb_finalize(stmts[i]);
+    free(stmts);
+
+    if (load->db == NULL)
+    {
+        if (opts->counters)
+            chidb_stats(c->db, &c->counters, 0);
+        chidb_close(c->db);
+    }
+
+    return NULL;
+}
+
+static int compare_latencies(const void *a, const void *b)
+{
+    uint64_t x = *(const uint64_t *) a, y = *(const uint64_t *) b;
+
+    return x < y ? -1 : x > y;
+}
+
+/* The latency below which a fraction q of the statements ran, in microseconds */
+static double percentile(uint64_t *latencies, long n, double q)
+{
+    long i = (long) (q * n);
+
+    if (n == 0)
+        return 0;
+
+    return latencies[i < n ? i : n - 1] / 1e3;
+}
+
+#define ADD_COUNTER(field) total.field += clients[i].counters.field
+
+static void report(load_t *load, load_client_t *clients, double seconds)
+{
+    load_options_t *opts = load->opts;
+    long n = 0, rows = 0, errors = 0, busy = 0;
+    chidb_counters_t total;
+    uint64_t *latencies;
+
+    for (int i = 0; i < opts->clients; i++)
+        n += clients[i].nlatencies;
+    latencies = malloc((n ? n : 1) * sizeof(uint64_t));
+    n = 0;
+    memset(&total, 0, sizeof(total));
+    for (int i = 0; i < opts->clients; i++)
+    {
+        memcpy(latencies + n, clients[i].latencies, clients[i].nlatencies * sizeof(uint64_t));
+        n += clients[i].nlatencies;
+        rows += clients[i].rows;
+        errors += clients[i].errors;
+        busy += clients[i].busy;
+        ADD_COUNTER(page_reads);
+        ADD_COUNTER(page_writes);
+        ADD_COUNTER(cache_hits);
+        ADD_COUNTER(cache_misses);
+        ADD_COUNTER(bytes_read);
+        ADD_COUNTER(bytes_written);
+        ADD_COUNTER(splits);
+        ADD_COUNTER(pages_allocated);
+        ADD_COUNTER(cursor_seeks);
+        ADD_COUNTER(cursor_steps);
+        ADD_COUNTER(records_packed);
+        ADD_COUNTER(records_unpacked);
+    }
+    qsort(latencies, n, sizeof(uint64_t), compare_latencies);
+
+    fprintf(opts->out, "{\"suite\": \"load\", \"name\": \"%s\", \"clients\": %i, \"ops\": %ld, "
+            "\"rows\": %ld, \"errors\": %ld, \"busy\": %ld, \"seconds\": %.6f, \"ops_per_sec\": %.0f, "
+            "\"p50_us\": %.1f, \"p90_us\": %.1f, \"p99_us\": %.1f, \"p999_us\": %.1f, \"max_us\": %.1f",
+            opts->name, opts->clients, n, rows, errors, busy, seconds, seconds > 0 ? n / seconds : 0.0,
+            percentile(latencies, n, 0.5), percentile(latencies, n, 0.9), percentile(latencies, n, 0.99),
+            percentile(latencies, n, 0.999), n ? latencies[n - 1] / 1e3 : 0.0);
+    if (opts->counters)
+        fprintf(opts->out, ", \"counters\": {\"page_reads\": %llu, \"page_writes\": %llu, "
+                "\"cache_hits\": %llu, \"cache_misses\": %llu, \"bytes_read\": %llu, "
+                "\"bytes_written\": %llu, \"splits\": %llu, \"pages_allocated\": %llu, "
+                "\"cursor_seeks\": %llu, \"cursor_steps\": %llu, \"records_packed\": %llu, "
+                "\"records_unpacked\": %llu}",
+                (unsigned long long) total.page_reads, (unsigned long long) total.page_writes,
+                (unsigned long long) total.cache_hits, (unsigned long long) total.cache_misses,
+                (unsigned long long) total.bytes_read, (unsigned long long) total.bytes_written,
+                (unsigned long long) total.splits, (unsigned long long) total.pages_allocated,
+                (unsigned long long) total.cursor_seeks, (unsigned long long) total.cursor_steps,
+                (unsigned long long) total.records_packed, (unsigned long long) total.records_unpacked);
+    fprintf(opts->out, "}\n");
+    fflush(opts->out);
+
+    free(latencies);
+}
+
+int main(int argc, char **argv)
+{
+    load_options_t opts = { 1, false, false, false, false, 10000, 0, 0, SYNTHETIC_ROWS, "synthetic", stdout };
+    load_t load;
+    load_client_t *clients;
+    const char *workload = NULL;
+    char *tmp = NULL;
+    chidb_counters_t clients_counters;
+    chidb *db;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "c:n:d:w:rk:R:HWso:h")) != -1)
+    {
+        switch (opt)
+        {
+        case 'c':
+            opts.clients = parse_long(optarg, argv[0]);
+            break;
+        case 'n':
+            opts.statements = parse_long(optarg, argv[0]);
+            break;
+        case 'd':
+            opts.seconds = parse_long(optarg, argv[0]);
+            break;
+        case 'w':
+            workload = optarg;
+            break;
+        case 'r':
+            opts.replay = true;
+            break;
+        case 'k':
+            opts.keys = parse_long(optarg, argv[0]);
+            break;
+        case 'R':
+            opts.rows = parse_long(optarg, argv[0]);
+            break;
+        case 'H':
+            opts.own_handles = true;
+            opts.wal = true;
+            break;
+        case 'W':
+            opts.wal = true;
+            break;
+        case 's':
+            opts.counters = true;
+            break;
+        case 'o':
+            if ((opts.out = fopen(optarg, "a")) == NULL)
+            {
+                perror(optarg);
+                exit(1);
+            }
+            break;
+        default:
+            usage(argv[0]);
+        }
+    }
+    if (optind < argc)
+        load.file = argv[optind++];
+    else
+        load.file = tmp = bench_tmp_file();
+    if (optind < argc || (opts.replay && workload == NULL))
+        usage(argv[0]);
+
+    load.opts = &opts;
+    load.sqls = NULL;
+    load.nsqls = 0;
+    load.mix = NULL;
+    load.nmix = 0;
+
+    check(chidb_open(load.file, &db), CHIDB_OK, "open");
+    if (opts.wal)
+        check(chidb_set_journal_mode(db, CHIDB_JOURNAL_WAL), CHIDB_OK, "set_journal_mode");
+    if (workload != NULL)
+    {
+        const char *base = strrchr(workload, '/');
+
+        read_workload(&load, workload);
+        opts.name = base != NULL ? base + 1 : workload;
+        if (opts.keys == 0)
+            opts.keys = 1000;
+    }
+    else
+    {
+        make_synthetic(&load, db);
+        if (opts.keys == 0)
+            opts.keys = opts.rows;
+    }
+    load.next_key = opts.keys + 1;
+
+    if (opts.own_handles)
+    {
+        check(chidb_close(db), CHIDB_OK, "close");
+        load.db = NULL;
+    }
+    else
+    {
+        check(chidb_set_threadsafe(db, 1), CHIDB_OK, "set_threadsafe");
+        chidb_stats(db, &clients_counters, 1);
+        load.db = db;
+    }
+
+    clients = calloc(opts.clients, sizeof(load_client_t));
+    double start = bench_now();
+    load.stop = opts.seconds > 0 ? start + opts.seconds : 0;
+    for (int i = 0; i < opts.clients; i++)
+    {
+        clients[i].load = &load;
+        clients[i].id = i;
+        check(pthread_create(&clients[i].thread, NULL, client_main, &clients[i]), 0, "pthread_create");
+    }
+    for (int i = 0; i < opts.clients; i++)
+        pthread_join(clients[i].thread, NULL);
+    double seconds = bench_now() - start;
+
+    /* A shared handle has the counters of every client */
+    if (load.db != NULL)
+    {
+        if (opts.counters)
+            chidb_stats(load.db, &clients[0].counters, 0);
+        chidb_close(load.db);
+    }
+    report(&load, clients, seconds);
+
+    for (int i = 0; i < opts.clients; i++)
+        free(clients[i].latencies);
+    free(clients);
+    for (int i = 0; i < load.nsqls; i++)
+        free(load.sqls[i].sql);
+    free(load.sqls);
+    free(load.mix);
+    if (tmp != NULL)
+        bench_delete_file(tmp);
+
+    return 0;
+}
@@ -21,6 +21,7 @@
  * From the API's perspective's, these are opaque data types. */
 typedef struct chidb_stmt chidb_stmt;
 typedef struct chidb chidb;
+typedef struct chidb_backup chidb_backup;
 
 /* API return codes */
 #define CHIDB_OK (0)
@@ -32,16 +33,22 @@ typedef struct chidb chidb;
 #define CHIDB_EMISMATCH (6)
 #define CHIDB_EIO (7)
 #define CHIDB_EMISUSE (8)
+#define CHIDB_EBUSY (12) // 9-11 are taken by internal return codes
 
 #define CHIDB_ROW (100)
 #define CHIDB_DONE (101)
+#define CHIDB_PENDING (102)
 
 /* Opens a chidb file.
  *
  * If the file does not exist, it will be created
  *
+ * If the filename is ":memory:", a new, empty database is created in
+ * memory instead. Nothing is ever written to disk, and the database is
+ * gone once it is closed. Each such handle is a separate database.
+ *
  * Parameters
- * - file: Filename of the chidb file to open/create
+ * - file: Filename of the chidb file to open/create, or ":memory:"
  * - db: Out parameter. Returns a pointer to a chidb struct. The chidb
  *       struct is an opaque type representing a chidb database. In
  *       other words, an API user should not be concerned with what
@@ -60,6 +67,20 @@ int chidb_open(const char *file, chidb **db);
 
 
 /* Prepares a SQL statement for execution
+ *
+ * A statement that starts with EXPLAIN ANALYZE is run to the end on its
+ * first step (so EXPLAIN ANALYZE INSERT does insert), and then yields
+ * its program like EXPLAIN does, with four more columns: how many times
+ * each instruction ran ("count"), the time spent in it ("time_ns"), the
+ * pages it read ("pages"), and the cursor it works on, if any ("cursor").
+ *
+ * ATTACH 'file' AS name opens another database file, with its own
+ * buffer pool, whose tables can then be read as name.table (and their
+ * columns as name.table.column) until DETACH name. Attached databases
+ * are only read from: statements that would change one are not valid.
+ * Running ATTACH with a name that is already in use, or main, returns
+ * CHIDB_EMISUSE, as does running DETACH while a statement that has not
+ * been finalized or reset is reading the database.
  *
  * Parameters
  * - db: chidb database
@@ -90,12 +111,21 @@ int chidb_prepare(chidb *db, const char *sql, chidb_stmt **stmt);
  * results, then CHIDB_DONE is returned (note that this function does
  * not return CHIDB_OK).
  *
+ * A statement that changes the database either changes it completely,
+ * or not at all: if it fails partway (e.g., a multi-row INSERT whose
+ * third tuple has a primary key that is already in the table), the
+ * tuples it inserted until then are taken out again. Inside a
+ * transaction (BEGIN), they stay until the transaction is committed or
+ * rolled back.
+ *
  * Parameters
  * - stmt: Prepared SQL statement
  *
  * Return
  * - CHIDB_ROW: Statement returned a row.
  * - CHIDB_DONE: Statement has finished executing.
+ * - CHIDB_ECONSTRAINT: A constraint (e.g., a unique primary key) would be
+ *   violated, and the statement was stopped.
  */
 int chidb_step(chidb_stmt *stmt);
 
@@ -112,6 +142,63 @@ int chidb_step(chidb_stmt *stmt);
 int chidb_finalize(chidb_stmt *stmt);
 
 
+/* Resets a SQL statement, so it can be run again
+ *
+ * The statement goes back to the state it was in right after it was
+ * prepared, except that the values bound to its parameters are kept.
+ * A statement can be reset at any time, even if it has not run to
+ * completion. This is much faster than preparing the statement again.
+ *
+ * Parameters
+ * - stmt: Prepared SQL statement
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ */
+int chidb_reset(chidb_stmt *stmt);
+
+
+/* Unbinds all the parameters of a SQL statement
+ *
+ * All the parameters go back to being NULL.
+ *
+ * Parameters
+ * - stmt: Prepared SQL statement
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_EMISUSE: The statement has been stepped, but not reset
+ */
+int chidb_clear_bindings(chidb_stmt *stmt);
+
+
+/* Binds a value to a parameter of a SQL statement
+ *
+ * A SQL statement can have ? placeholders instead of literal values.
+ * These are its parameters, numbered from 1 in the order they appear
+ * in the statement. Parameters that have not been bound are NULL.
+ * Values can only be bound before the statement is first stepped, or
+ * after it is reset.
+ *
+ * chidb_bind_text makes its own copy of the string. chidb_bind_int64
+ * binds integers that do not fit in an int.
+ *
+ * Parameters
+ * - stmt: Prepared SQL statement
+ * - param: Parameter (parameters are numbered from 1)
+ * - value: Value to bind to the parameter
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_EMISUSE: The parameter does not exist, or the statement has
+ *                  been stepped, but not reset
+ * - CHIDB_ENOMEM: Could not allocate memory
+ */
+int chidb_bind_int(chidb_stmt *stmt, int param, int value);
+int chidb_bind_int64(chidb_stmt *stmt, int param, int64_t value);
+int chidb_bind_text(chidb_stmt *stmt, int param, const char *value);
+
+
 /* Returns the number of columns returned by a SQL statement
  *
  * Parameters
@@ -152,6 +239,9 @@ const char *chidb_column_name(chidb_stmt* stmt, int col);
 
 
 /* Returns the value of a column of integer type
+ *
+ * Integers of type SQL_INTEGER_8BYTE do not fit in an int, and are
+ * truncated by chidb_column_int. chidb_column_int64 returns any of them.
  *
  * Parameters
  * - stmt: Prepared SQL statement
@@ -161,6 +251,7 @@ const char *chidb_column_name(chidb_stmt* stmt, int col);
  * - Integer value
  */
 int chidb_column_int(chidb_stmt *stmt, int col);
+int64_t chidb_column_int64(chidb_stmt *stmt, int col);
 
 
 /* Returns the value of a column of string type
@@ -178,6 +269,804 @@ int chidb_column_int(chidb_stmt *stmt, int col);
 const char *chidb_column_text(chidb_stmt *stmt, int col);
 
 
+/* The values of one column of a batch of rows (see chidb_step_batch).
+ * Arrays have one entry per row of the batch. Bitmaps have one bit per
+ * row: row r is bit (r % 8) of byte r / 8. */
+typedef struct chidb_batch_column
+{
+    int64_t *ints;      /* Value, if the row's value is an integer */
+    uint32_t *offsets;  /* Where the row's text starts in the batch's text */
+    uint32_t *lengths;  /* Length of the row's text (without terminator) */
+    uint8_t *nulls;     /* Bitmap of the rows whose value is NULL */
+    uint8_t *texts;     /* Bitmap of the rows whose value is text */
+} chidb_batch_column;
+
+/* A batch of result rows, stored column by column */
+typedef struct chidb_batch
+{
+    int nrows;                  /* Rows in the batch */
+    int ncols;                  /* Columns of each row */
+    chidb_batch_column *cols;   /* ncols columns */
+    char *text;                 /* Texts of the batch, each null-terminated */
+
+    /* Private: room in the arrays and in text */
+    int capacity;
+    uint32_t text_size;
+    uint32_t text_used;
+} chidb_batch;
+
+#define CHIDB_BATCH_IS_SET(bitmap, row) (((bitmap)[(row) / 8] >> ((row) % 8)) & 1)
+
+/* Runs a statement for up to n rows at once
+ *
+ * The rows are copied, column by column, into a batch, instead of
+ * being read one value at a time after each chidb_step. The statement
+ * is only entered (and, on a shared handle, locked) once per batch.
+ *
+ * Parameters
+ * - stmt: Prepared SQL statement (not an EXPLAIN)
+ * - n: Maximum number of rows in the batch
+ * - batch: In/out parameter. If *batch is NULL, a batch is allocated;
+ *          otherwise, the rows in *batch are replaced (and the memory
+ *          of the batch reused). Free it with chidb_batch_free.
+ *
+ * Return
+ * - CHIDB_ROW: The batch has at least one row. If it has fewer than
+ *              n, the statement may have finished (the next call
+ *              returns CHIDB_DONE).
+ * - CHIDB_DONE: The statement has finished, and the batch is empty
+ * - CHIDB_EMISUSE: n is not positive, or stmt is an EXPLAIN
+ * - CHIDB_ENOMEM: Could not allocate memory
+ * - Anything chidb_step returns. The rows up to the error are in
+ *   the batch.
+ */
+int chidb_step_batch(chidb_stmt *stmt, int n, chidb_batch **batch);
+
+/* Frees a batch allocated by chidb_step_batch */
+void chidb_batch_free(chidb_batch *batch);
+
+
+/* What a statement suspended by chidb_step_async is waiting for */
+typedef uint32_t chidb_io_token;
+
+/* Steps through a statement without waiting for the disk
+ *
+ * Same as chidb_step, except that when the statement would have to
+ * wait for a page to be read from the file, the read is started in the
+ * background and the statement is suspended instead: CHIDB_PENDING is
+ * returned, along with a token for the read. Once chidb_io_poll says
+ * the read has completed, calling chidb_step_async again resumes the
+ * statement where it left off. Nothing else can be done with the
+ * statement in the meantime (other than resetting or finalizing it).
+ *
+ * Only reads that move a cursor, or read from it, are suspended. Other
+ * instructions, such as writes, and every read made on a handle shared
+ * between threads, or with an I/O backend that cannot read in the
+ * background (see chidb_set_io_backend), wait for the disk as they do
+ * in chidb_step.
+ *
+ * Parameters
+ * - stmt: Prepared SQL statement
+ * - token: Out parameter. Set to the read the statement is waiting for
+ *          when CHIDB_PENDING is returned.
+ *
+ * Return
+ * - CHIDB_PENDING: The statement is waiting for a read
+ * - Anything chidb_step returns
+ */
+int chidb_step_async(chidb_stmt *stmt, chidb_io_token *token);
+
+/* Checks whether a read started by chidb_step_async has completed
+ *
+ * Parameters
+ * - db: chidb database
+ * - token: Token returned by chidb_step_async
+ * - wait: If non-zero, wait for the read to complete
+ *
+ * Return
+ * - CHIDB_OK: The read has completed (the statement can be resumed)
+ * - CHIDB_PENDING: The read has not completed yet (and wait is zero)
+ * - CHIDB_EIO: An I/O error has occurred when waiting for the read
+ */
+int chidb_io_poll(chidb *db, chidb_io_token token, int wait);
+
+
+/* Called by chidb_exec with each result row of a script. row is the
+ * number of the row in the results of its statement (starting at 0).
+ * Anything other than CHIDB_OK stops the script. */
+typedef int (*chidb_exec_callback)(void *arg, chidb_stmt *stmt, int row);
+
+/* Runs the SQL statements of a script, one after the other
+ *
+ * The statements are separated by semicolons. Each is prepared and run
+ * to completion before the next, and its result rows are passed to the
+ * callback. Statements that write are run in one transaction, which
+ * is begun before the first of them (unless a transaction is already
+ * open), and committed after the last, so that the file is written and
+ * synced once, not once per statement. The script can also begin and
+ * end its own transactions: the implicit one is committed before a
+ * statement that does so (or that cannot run in a transaction, such as
+ * VACUUM), and begun again after it.
+ *
+ * If a statement fails, or the callback stops the script, the rest of
+ * the script is not run, and the implicit transaction is rolled back.
+ *
+ * Parameters
+ * - db: chidb database
+ * - sql: The statements
+ * - callback: Function the result rows are passed to (or NULL)
+ * - arg: First argument of the callback
+ *
+ * Return
+ * - CHIDB_OK: Every statement has run
+ * - Anything chidb_prepare or chidb_step returns for the statement that
+ *   failed, or the callback returns
+ */
+int chidb_exec(chidb *db, const char *sql, chidb_exec_callback callback, void *arg);
+
+/* Saves the compiled programs of recently prepared statements to a file
+ *
+ * Each database handle keeps the programs of the statements it has
+ * prepared most recently, so that preparing the same SQL again does not
+ * parse and compile it again. chidb_save_programs writes those programs
+ * (and the SQL they were compiled from) to a file, which another handle
+ * can load with chidb_load_programs. Statements it then prepares with
+ * the same SQL use the loaded programs, without being parsed or compiled.
+ *
+ * Programs are compiled against a schema (e.g., they hold the root pages
+ * of the tables they use), so they can only be loaded into a database
+ * with the same schema. Statements that change the schema (CREATE) and
+ * EXPLAIN statements are never kept, nor saved.
+ *
+ * Parameters
+ * - db: chidb database
+ * - filename: File to write (it is replaced if it exists)
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_ECANTOPEN: Unable to create the file
+ * - CHIDB_ENOMEM: Could not allocate memory
+ * - CHIDB_EIO: An I/O error has occurred when writing the file
+ */
+int chidb_save_programs(chidb *db, const char *filename);
+
+/* Loads the programs saved by chidb_save_programs
+ *
+ * The file is read at once, and each program is checked before it is
+ * kept, as if it had just been compiled. A handle only keeps so many
+ * programs (64), so loading more than that only keeps the last ones
+ * saved. Programs for SQL the handle already has a program for are
+ * skipped.
+ *
+ * Parameters
+ * - db: chidb database
+ * - filename: File written by chidb_save_programs
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_ECANTOPEN: Unable to open the file
+ * - CHIDB_ECORRUPT: The file is not well-formed
+ * - CHIDB_EMISMATCH: The file was saved by a different version of
+ *                    chidb, or from a database with a different schema
+ * - CHIDB_ENOMEM: Could not allocate memory
+ * - CHIDB_EIO: An I/O error has occurred when reading the file
+ */
+int chidb_load_programs(chidb *db, const char *filename);
+
+
+/* Loads rows from a file into an empty table
+ *
+ * Each line of the file contains one row, with its values separated
+ * by | (the same format the shell uses to print query results), and
+ * with the primary key as the first value. The rows do not have to be
+ * sorted: they are read into memory and sorted by primary key, and the
+ * table B-Tree is then built bottom-up, which is much faster than
+ * inserting the rows one at a time. If the load fails, the table is
+ * left empty.
+ *
+ * Parameters
+ * - db: chidb database
+ * - table: Name of the table. The table must be empty.
+ * - file: File with the rows to load
+ * - fill_factor: Percentage (1-100) of each leaf page to fill, leaving
+ *                room for future insertions. If 0, a default is used.
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_EINVALIDSQL: The table does not exist
+ * - CHIDB_ECANTOPEN: Unable to open the file
+ * - CHIDB_EMISMATCH: A row does not match the columns of the table
+ * - CHIDB_ECONSTRAINT: Two rows have the same primary key
+ * - CHIDB_EMISUSE: The table is not empty, or fill_factor is invalid
+ * - CHIDB_ENOMEM: Could not allocate memory
+ * - CHIDB_EIO: An I/O error has occurred when accessing the file
+ */
+int chidb_load(chidb *db, const char *table, const char *file, uint8_t fill_factor);
+
+
+/* Inserts rows into a table
+ *
+ * The rows are in the same format chidb_load reads (values separated by
+ * |, with the primary key first), but the table does not have to be
+ * empty and the rows are inserted one at a time, the same way INSERT
+ * does. All of them go through the same cursor, so rows given in
+ * primary key order (and with larger keys than the ones already in the
+ * table) are added to the last leaf without starting from the root every
+ * time. If a row cannot be inserted, the rows before it stay in the table.
+ *
+ * Parameters
+ * - db: chidb database
+ * - table: Name of the table
+ * - rows: Rows to insert
+ * - nrows: Number of rows
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_EINVALIDSQL: The table does not exist
+ * - CHIDB_EMISMATCH: A row does not match the columns of the table
+ * - CHIDB_ECONSTRAINT: A row has the same primary key as another one
+ * - CHIDB_ENOMEM: Could not allocate memory
+ * - CHIDB_EIO: An I/O error has occurred when accessing the file
+ */
+int chidb_insert_rows(chidb *db, const char *table, const char **rows, int nrows);
+
+/* Imports the rows of a CSV or TSV file into a table
+ *
+ * Each line of the file is a row, with its values separated by sep and
+ * the primary key first. A value may be quoted ("..."), with "" for a
+ * quote inside it; an empty value that is not quoted is NULL. The file
+ * is read one line at a time, and each row is made into a record and
+ * inserted the same way chidb_insert_rows does, without going through
+ * the SQL parser. The table does not have to be empty, and the indexes
+ * on it get an entry for each row. If a row cannot be inserted, the
+ * rows before it stay in the table.
+ *
+ * Parameters
+ * - db: chidb database
+ * - table: Name of the table
+ * - file: File with the rows to import
+ * - sep: Value separator (',' for CSV, '\t' for TSV)
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_EINVALIDSQL: The table does not exist
+ * - CHIDB_ECANTOPEN: Unable to open the file
+ * - CHIDB_EMISMATCH: A row does not match the columns of the table
+ * - CHIDB_ECONSTRAINT: A row has the same primary key as another one,
+ *                      or the same key in an INTEGER index
+ * - CHIDB_EMISUSE: sep is not a valid separator
+ * - CHIDB_ENOMEM: Could not allocate memory
+ * - CHIDB_EIO: An I/O error has occurred when accessing the file
+ */
+int chidb_import(chidb *db, const char *table, const char *file, char sep);
+
+/* Sets how much memory an ORDER BY may sort in
+ *
+ * Rows being sorted are kept in memory until they take up more than
+ * this many bytes. They are then written out, sorted, to temporary
+ * files, which are merged once all the rows are in. Statements that
+ * are already running keep the budget they were started with.
+ *
+ * Parameters
+ * - db: chidb database
+ * - bytes: Memory budget, in bytes (4MB by default)
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_EMISUSE: bytes is 0
+ */
+int chidb_set_sort_budget(chidb *db, size_t bytes);
+
+/* Sets how many threads a table scan may be split between
+ *
+ * A SELECT on a single table with a WHERE clause (and no ORDER BY,
+ * GROUP BY, aggregates or LIMIT) reads the whole table. If the table
+ * spans more than one node, the subtrees of its root are scanned by up
+ * to this many threads at once, and the rows they return are kept until
+ * the whole table has been scanned. The rows are still returned in the
+ * same order. A value of 1 scans every table from a single thread.
+ *
+ * Parameters
+ * - db: chidb database
+ * - nthreads: Number of threads (the number of processors by default)
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_EMISUSE: nthreads is less than 1
+ */
+int chidb_set_scan_threads(chidb *db, int nthreads);
+
+/* Sets how much memory the results of read-only statements may be kept in
+ *
+ * A statement that only reads, and was prepared from the statement
+ * cache, keeps the rows it returns. When the same SQL is run again with
+ * the same bound parameters, and none of the tables and indexes it reads
+ * has been written to through this handle since, the rows are returned
+ * again without running it. The least recently used results are dropped
+ * to make room for new ones, and a result larger than the whole budget
+ * is not kept. Writes made by other processes are not noticed, so only
+ * use it on files no one else writes to.
+ *
+ * Parameters
+ * - db: chidb database
+ * - bytes: Memory budget, in bytes (0, which keeps no results, by default)
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ */
+int chidb_set_result_cache(chidb *db, size_t bytes);
+
+/* Sets how much memory a database handle may use
+ *
+ * The buffer pool, the rows being sorted and hashed by running
+ * statements, and the result cache all count against the limit. The
+ * buffer pool is shrunk to half of it, if it is larger. When a sorter or
+ * a hash table needs more memory than is left, the least recently used
+ * results are dropped to make room; if that is not enough, a sorter
+ * spills its rows to disk early (whatever its budget, see
+ * chidb_set_sort_budget), and a hash table fails with CHIDB_ENOMEM.
+ * Tables are not joined with a hash table that is not expected to fit,
+ * and results are not kept if they do not.
+ *
+ * Parameters
+ * - db: chidb database
+ * - bytes: Memory limit, in bytes (0, for no limit, by default)
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_EMISUSE: The buffer pool is in use by a statement that has
+ *                  not been reset or finalized
+ */
+int chidb_set_memory_limit(chidb *db, size_t bytes);
+
+/* Sets how many pages the buffer pool of a database handle holds
+ *
+ * Pages that are read are kept in the pool until room is needed for
+ * others, so a pool that holds the pages a workload keeps going back to
+ * (the upper levels of its trees, say) saves reading them again. Pages
+ * are found in the pool by their number, whatever its size. The pool is
+ * emptied and allocated again with the new size on the next read.
+ *
+ * Parameters
+ * - db: chidb database
+ * - npages: Number of pages (128 by default). 0
+ *           reads every page from the file.
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_EMISUSE: npages is negative, the pool would take up more than
+ *                  half of the memory limit (see chidb_set_memory_limit),
+ *                  or it is in use by a statement that has not been reset
+ *                  or finalized
+ */
+int chidb_set_cache_size(chidb *db, int npages);
+
+/* Memory a database handle uses (see chidb_memory_status) */
+typedef struct chidb_memory_status
+{
+    size_t limit;           /* See chidb_set_memory_limit (0 if there is none) */
+    size_t used;            /* Bytes in use, by all of the following */
+    size_t peak;            /* Most bytes in use at once */
+    size_t page_cache;      /* Buffer pool */
+    size_t sorters;         /* Rows of ORDER BY (and other sorts) in memory */
+    size_t hash_tables;     /* Rows of hash joins and GROUP BY */
+    size_t results;         /* Result cache (see chidb_set_result_cache) */
+} chidb_memory_status_t;
+
+/* Reads how much memory a database handle uses
+ *
+ * Parameters
+ * - db: chidb database
+ * - status: Out parameter. Returns the memory used.
+ * - reset: Non-zero to start the peak over from what is used now
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ */
+int chidb_memory_status(chidb *db, chidb_memory_status_t *status, int reset);
+
+
+/* Sets the page size of a new database
+ *
+ * Pages are DEFAULT_PAGE_SIZE (1024) bytes by default. Larger pages
+ * make for shallower trees and fewer reads on large tables. The page
+ * size is stored in the file, and can only be changed while the
+ * database is empty (before any table is created). The same can be
+ * done with the statement PRAGMA page_size = N.
+ *
+ * Parameters
+ * - db: chidb database
+ * - size: Page size. A power of two from 512 to 65536.
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_EMISUSE: Invalid size, the database is not empty, it is in
+ *                  WAL mode, or there is an open transaction
+ * - CHIDB_ENOMEM: Could not allocate memory
+ * - CHIDB_EIO: An I/O error has occurred when accessing the file
+ */
+int chidb_set_page_size(chidb *db, int size);
+
+
+/* Stores the pages of a new database compressed
+ *
+ * Each page is compressed when it is written to the file, and
+ * decompressed when it is read into the buffer pool, so the file takes
+ * up less room (databases of text often shrink 3-4 times), and reading
+ * a table from disk reads fewer bytes. The pages are where they fit in
+ * the file, and a table in the file keeps track of where each one is.
+ *
+ * Whether a database is compressed is stored in the file. It can only
+ * be changed while the database is empty (before any table is created).
+ * Compressed databases cannot be in WAL mode, and cannot be memory-mapped,
+ * and they can only be opened by one handle at a time.
+ *
+ * Parameters
+ * - db: chidb database
+ * - on: Non-zero to compress the pages, zero to store them as they are
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_EMISUSE: The database is not empty, it is in WAL mode, or
+ *                  there is an open transaction
+ * - CHIDB_ENOMEM: Could not allocate memory
+ * - CHIDB_EIO: An I/O error has occurred when accessing the file
+ */
+int chidb_set_compression(chidb *db, int on);
+
+
+/* Journal modes (see chidb_set_journal_mode) */
+#define CHIDB_JOURNAL_ROLLBACK (0)
+#define CHIDB_JOURNAL_WAL (1)
+
+/* Sets how changes are made durable
+ *
+ * In rollback journal mode (the default), pages are written to the
+ * database file, and the original pages are saved in a journal during
+ * a transaction. In WAL mode, pages are appended to a write-ahead log
+ * (the file with "-wal" appended to its name) instead, and copied back
+ * into the database file by checkpoints. Readers then never wait for
+ * the writer: each statement (or transaction) reads from a snapshot of
+ * the database taken when it started. Only one handle can write at a
+ * time; the others get CHIDB_EBUSY.
+ *
+ * The log is checkpointed after a commit once it has 1000 pages in it,
+ * if no other handle is reading it at the time, and when the database
+ * is closed.
+ *
+ * The mode is stored in the file, so the database is opened in the
+ * same mode from then on. No other handle may have the file open when
+ * leaving WAL mode.
+ *
+ * Parameters
+ * - db: chidb database
+ * - mode: CHIDB_JOURNAL_ROLLBACK or CHIDB_JOURNAL_WAL
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_EMISUSE: Invalid mode, there is an open transaction, or the
+ *                  database is compressed (see chidb_set_compression)
+ * - CHIDB_EBUSY: Another handle is using the write-ahead log
+ * - CHIDB_ENOMEM: Could not allocate memory
+ * - CHIDB_EIO: An I/O error has occurred when accessing the file
+ */
+int chidb_set_journal_mode(chidb *db, int mode);
+
+
+/* Checkpoints the write-ahead log
+ *
+ * Copies the pages in the write-ahead log back into the database file,
+ * and empties the log. Does nothing in rollback journal mode.
+ *
+ * Parameters
+ * - db: chidb database
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_EMISUSE: There is an open transaction
+ * - CHIDB_EBUSY: Another handle is writing, or reading from the log
+ * - CHIDB_ENOMEM: Could not allocate memory
+ * - CHIDB_EIO: An I/O error has occurred when accessing the file
+ */
+int chidb_checkpoint(chidb *db);
+
+
+/* Gives the free pages at the end of the file back
+ *
+ * Pages freed by DELETE are reused before the file grows again, but
+ * the file does not shrink on its own. This moves pages in use from the
+ * end of the file into free pages, and then truncates the file (in WAL
+ * mode, the file is truncated by the next checkpoint). Root pages are
+ * not moved.
+ *
+ * Parameters
+ * - db: chidb database
+ * - npages: Most pages to remove. If 0 or less, as many as possible.
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_EMISUSE: There is an open transaction, or there are statements
+ *                  that have not been finalized or reset
+ * - CHIDB_ECORRUPT: The file is not well-formed
+ * - CHIDB_ENOMEM: Could not allocate memory
+ * - CHIDB_EIO: An I/O error has occurred when accessing the file
+ */
+int chidb_incremental_vacuum(chidb *db, int npages);
+
+
+/* Starts an online backup of a database
+ *
+ * The backup copies the pages of the database, a few at a time (see
+ * chidb_backup_step), into another file, while the database is still in
+ * use. Pages that are written through the handle after they have been
+ * copied are copied again, so the copy is complete once a step returns
+ * CHIDB_DONE. Writes made through other handles on the same file are
+ * not seen. There can only be one backup of a handle at a time, and it
+ * must be finished (see chidb_backup_finish) before the handle is closed.
+ *
+ * Parameters
+ * - src: chidb database to back up
+ * - file: File to copy it into. It is created if it does not exist, and
+ *         emptied if it does.
+ * - backup: Out parameter. Returns the backup.
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_EMISUSE: The file is the database's own, or there is already
+ *                  a backup of this handle
+ * - CHIDB_ENOMEM: Could not allocate memory
+ * - CHIDB_EIO: An I/O error has occurred when accessing the file
+ */
+int chidb_backup_init(chidb *src, const char *file, chidb_backup **backup);
+
+/* Copies some of the pages of a database into its backup
+ *
+ * The pages that were copied in earlier steps and have been written
+ * since are copied again first, and then the pages that have not been
+ * copied yet, in order. The handle is only held while the pages are
+ * copied, so calling this often, with a small npages, lets statements
+ * run in between. If a step fails, the next one starts over.
+ *
+ * Parameters
+ * - backup: A backup (see chidb_backup_init)
+ * - npages: Most pages to copy. If 0 or less, all of them.
+ *
+ * Return
+ * - CHIDB_OK: Pages were copied, and there are more to copy
+ * - CHIDB_DONE: The file is a complete copy of the database (and has
+ *               been synced to disk)
+ * - CHIDB_EBUSY: The database is in a transaction, so nothing was copied
+ * - CHIDB_ENOMEM: Could not allocate memory
+ * - CHIDB_EIO: An I/O error has occurred when accessing either file
+ */
+int chidb_backup_step(chidb_backup *backup, int npages);
+
+/* Counts the pages a backup still has to copy (or copy again)
+ *
+ * Parameters
+ * - backup: A backup (see chidb_backup_init)
+ *
+ * Return
+ * - The number of pages
+ */
+int chidb_backup_remaining(chidb_backup *backup);
+
+/* Ends a backup
+ *
+ * If the last step did not return CHIDB_DONE, the file is not a usable
+ * copy of the database.
+ *
+ * Parameters
+ * - backup: A backup (see chidb_backup_init)
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_EIO: An I/O error has occurred when accessing the file
+ */
+int chidb_backup_finish(chidb_backup *backup);
+
+
+/* Shares a database handle between threads
+ *
+ * By default, a handle (and the statements prepared on it) must only
+ * be used by one thread at a time. Once shared, any thread can call
+ * the functions in this file on it, and on its statements. The handle
+ * has one buffer pool, which all the threads use.
+ *
+ * Statements that only read the database (e.g., SELECT) can run at
+ * the same time, each in its own thread: chidb_step on one of them
+ * does not wait for chidb_step on another. Anything else (preparing,
+ * resetting or finalizing a statement, stepping a statement that
+ * writes, loading rows, checkpointing) waits for every chidb_step in
+ * progress, and runs on its own. Note that this is per call: a SELECT
+ * may see rows inserted by another thread between two of its steps.
+ *
+ * A given statement must still not be used by two threads at once.
+ * This must be called before the handle is shared, and it must be
+ * closed after every thread is done with it.
+ *
+ * In WAL mode (see chidb_set_journal_mode), a statement that writes
+ * outside of a transaction appends its pages to the log, and lets the
+ * other threads go on before it waits for the log to be synced. The
+ * commits that threads make while the log is being synced are then
+ * synced together, with a single fsync (see chidb_set_commit_delay).
+ * Other threads can read a commit before its chidb_step has returned.
+ *
+ * Parameters
+ * - db: chidb database
+ * - on: Non-zero to share the handle, zero to stop sharing it
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ */
+int chidb_set_threadsafe(chidb *db, int on);
+
+/* Sets how long the commits of a shared handle wait for each other
+ *
+ * The first commit that needs the log to be synced waits this long
+ * before syncing it, so that the commits made by other threads in the
+ * meantime are synced along with it (see chidb_set_threadsafe). Longer
+ * delays mean fewer syncs, but slower commits. The default is 0: the
+ * log is synced at once, and only the commits made while a sync is in
+ * progress share the next one.
+ *
+ * Parameters
+ * - db: chidb database
+ * - usec: Delay, in microseconds
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_EMISUSE: usec is negative
+ */
+int chidb_set_commit_delay(chidb *db, int usec);
+
+
+/* I/O backends (see chidb_set_io_backend) */
+#define CHIDB_IO_STDIO (0)
+#define CHIDB_IO_URING (1)
+
+/* Sets how the database file is read and written
+ *
+ * With the stdio backend (the default), each page is read or written
+ * with its own blocking system call. With the io_uring backend (only
+ * on Linux), the pages written back at the end of a statement are all
+ * submitted at once, and the pages a table scan is about to read are
+ * read ahead asynchronously into the page cache, so that many requests
+ * can be in flight at a time.
+ *
+ * Parameters
+ * - db: chidb database
+ * - backend: CHIDB_IO_STDIO or CHIDB_IO_URING
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_EMISUSE: Invalid backend, or the database is compressed (see
+ *                  chidb_set_compression)
+ * - CHIDB_ENOMEM: Could not allocate memory
+ * - CHIDB_EIO: The backend is not available on this system (the
+ *              current one is kept), or an I/O error has occurred
+ *              when accessing the file
+ */
+int chidb_set_io_backend(chidb *db, int backend);
+
+/* Sets how much disk space is reserved ahead of the database file
+ *
+ * When the file needs a new page past the space already reserved, the
+ * next extent of the file is reserved at once, so that a table or index
+ * built in bulk takes up a few large extents on disk instead of one per
+ * page. Extents grow with the file (a quarter of its size, up to 16 MB),
+ * and are never smaller than npages pages. The size of the file does
+ * not change until its pages are written. This is only done where the
+ * file system can reserve space that way (on Linux); elsewhere, and in
+ * memory or compressed databases, the setting has no effect. The
+ * default is 64 pages.
+ *
+ * Parameters
+ * - db: chidb database
+ * - npages: Pages in the smallest extent (0 disables preallocation)
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_EMISUSE: npages is negative
+ */
+int chidb_set_preallocation(chidb *db, int npages);
+
+
+/* What a database handle has done (see chidb_stats) */
+typedef struct chidb_counters
+{
+    uint64_t page_reads;        /* Pages requested from the buffer pool */
+    uint64_t page_writes;       /* Pages written to the file (or to the log) */
+    uint64_t cache_hits;        /* Page reads served from the buffer pool */
+    uint64_t cache_misses;      /* Page reads that had to load the page */
+    uint64_t bytes_read;        /* Bytes read from the file */
+    uint64_t bytes_written;     /* Bytes written to the file (or to the log) */
+    uint64_t splits;            /* B-Tree nodes split */
+    uint64_t pages_allocated;   /* Pages allocated, from the free list or not */
+    uint64_t cursor_seeks;      /* Cursors moved to a key */
+    uint64_t cursor_steps;      /* Cursors moved to the next or previous entry */
+    uint64_t records_packed;    /* Records made */
+    uint64_t records_unpacked;  /* Records decoded */
+} chidb_counters_t;
+
+/* Reads the counters of a database handle
+ *
+ * The counters are kept per handle, from the time it was opened or
+ * its counters were last reset. Keeping them costs an addition each.
+ *
+ * Parameters
+ * - db: chidb database
+ * - counters: Out parameter. Returns the counters.
+ * - reset: Non-zero to start the counters over from zero (after they
+ *          are read)
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ */
+int chidb_stats(chidb *db, chidb_counters_t *counters, int reset);
+
+
+/* Kinds of statements whose latency is kept apart (see
+ * chidb_latency_snapshot). EXPLAIN, DELETE, UPDATE, transactions and
+ * everything else are CHIDB_LATENCY_OTHER. */
+#define CHIDB_LATENCY_SELECT (0)
+#define CHIDB_LATENCY_INSERT (1)
+#define CHIDB_LATENCY_CREATE (2)
+#define CHIDB_LATENCY_OTHER  (3)
+#define CHIDB_LATENCY_KINDS  (4)
+
+/* Calls that are timed */
+#define CHIDB_LATENCY_PREPARE   (0) /* chidb_prepare (when successful) */
+#define CHIDB_LATENCY_FIRST_ROW (1) /* First chidb_step after chidb_prepare or chidb_reset */
+#define CHIDB_LATENCY_NEXT_ROW  (2) /* Every other chidb_step */
+#define CHIDB_LATENCY_FINALIZE  (3) /* chidb_finalize */
+#define CHIDB_LATENCY_PHASES    (4)
+
+/* Latencies are counted in buckets whose width is an eighth of the
+ * power of two they are in (so that they are kept to within 12.5%),
+ * from 1 ns up to over an hour */
+#define CHIDB_LATENCY_BUCKETS (320)
+
+/* Histogram of the latencies of one call, for one kind of statement */
+typedef struct chidb_latency
+{
+    uint64_t count;     /* Calls timed */
+    uint64_t total_ns;  /* Time taken by all of them */
+    uint64_t max_ns;    /* Longest call */
+    uint64_t buckets[CHIDB_LATENCY_BUCKETS];
+} chidb_latency_t;
+
+/* Reads the latency histograms of a database handle
+ *
+ * Statements are timed from the time the handle was opened, or its
+ * histograms were last reset. Timing a call costs reading the clock
+ * twice.
+ *
+ * Parameters
+ * - db: chidb database
+ * - latency: Out parameter. Returns a histogram per kind of statement
+ *            (CHIDB_LATENCY_SELECT, ...) and call (CHIDB_LATENCY_PREPARE,
+ *            ...)
+ * - reset: Non-zero to start the histograms over (after they are read)
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ */
+int chidb_latency_snapshot(chidb *db, chidb_latency_t latency[CHIDB_LATENCY_KINDS][CHIDB_LATENCY_PHASES], int reset);
+
+/* Estimates a percentile of a latency histogram
+ *
+ * Parameters
+ * - latency: Histogram (see chidb_latency_snapshot)
+ * - p: Percentile, from 0 to 100 (e.g., 99 for the p99 latency)
+ *
+ * Return
+ * - The upper end of the bucket the percentile falls in (but no more
+ *   than the longest call), in nanoseconds. 0 if nothing was timed.
+ */
+uint64_t chidb_latency_percentile(const chidb_latency_t *latency, double p);
+
+
 /* Closes a chidb database
  *
  * Parameters
@@ -13,6 +13,20 @@ typedef enum {
 } loglevel_t;
 
 
+/* Messages less severe than CHILOG_MAXLEVEL are compiled out, so they
+ * cost nothing at all, not even a check of the logging level. It is set
+ * with the --with-log-level option of configure. By default, all
+ * messages are compiled in. */
+#ifndef CHILOG_MAXLEVEL
+#define CHILOG_MAXLEVEL TRACE
+#endif
+
+/* Current logging level. Use chilog_setloglevel to change it. */
+extern loglevel_t __chilog_level;
+
+#define chilog_enabled(level) ((level) <= CHILOG_MAXLEVEL && (level) <= __chilog_level)
+
+
 /*
  * chilog_setloglevel - Sets the logging level
  *
@@ -36,9 +50,13 @@ void chilog_setloglevel(loglevel_t level);
  *
  * ...: Extra parameters if needed by fmt
  *
+ * The logging level is checked before the message is formatted, or any
+ * of its parameters are evaluated.
+ *
  * Returns: nothing.
  */
-#define chilog(level, fmt, ...) __chilog(level, __FILE__,  __LINE__, fmt, ##__VA_ARGS__)
+#define chilog(level, fmt, ...) \
+    do { if (chilog_enabled(level)) __chilog(level, __FILE__,  __LINE__, fmt, ##__VA_ARGS__); } while (0)
 void __chilog(loglevel_t level, char *file, int line, char *fmt, ...);
 
 /*
@@ -52,7 +70,8 @@ void __chilog(loglevel_t level, char *file, int line, char *fmt, ...);
  *
  * Returns: nothing.
  */
-#define chilog_hex(level, data, len) __chilog_hex(level, __FILE__,  __LINE__, data, len)
+#define chilog_hex(level, data, len) \
+    do { if (chilog_enabled(level)) __chilog_hex(level, __FILE__,  __LINE__, data, len); } while (0)
 void __chilog_hex (loglevel_t level, char *file, int fline, void *data, int len);
 
 
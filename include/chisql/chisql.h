@@ -7,29 +7,35 @@
 #include "insert.h"
 #include "sra.h"
 #include "delete.h"
+#include "update.h"
 
 #define SQL_NOTVALID (-1)
 #define SQL_NULL (0)
 #define SQL_INTEGER_1BYTE (1)
 #define SQL_INTEGER_2BYTE (2)
 #define SQL_INTEGER_4BYTE (4)
+#define SQL_INTEGER_6BYTE (5)
+#define SQL_INTEGER_8BYTE (6)
 #define SQL_TEXT (13)
 
 #define STMT_CREATE (0)
 #define STMT_SELECT (1)
 #define STMT_INSERT (2)
 #define STMT_DELETE (3)
+#define STMT_UPDATE (4)
 
 typedef struct chisql_statement
 {
     bool explain;
     char *text;
     uint8_t type;
+    int nparams;    /* Number of ? placeholders */
     union {
         Create_t *create;
         SRA_t    *select;
         Insert_t *insert;
         Delete_t *delete;
+        Update_t *update;
     } stmt;
 } chisql_statement_t;
 
@@ -29,7 +29,8 @@ enum data_type {
    TYPE_INT,
    TYPE_DOUBLE,
    TYPE_CHAR,
-   TYPE_TEXT
+   TYPE_TEXT,
+   TYPE_PARAM  /* ? placeholder, bound when the statement runs */
 };
 
 typedef struct StrList_t {
@@ -9,10 +9,14 @@ typedef struct Insert_s {
    char *table_name;
    StrList_t *col_names;
    Literal_t *values;
+   struct Insert_s *next; /* next tuple of an INSERT ... VALUES (...), (...) */
 } Insert_t;
 
 Insert_t *Insert_make(const char *table_name, StrList_t *opt_col_names, Literal_t *values);
 void Insert_print(Insert_t *insert);
 void Insert_free(Insert_t *insert);
 
+/* INSERT statements with several VALUES tuples are split before they are parsed */
+int Insert_split(const char *sql, char ***split);
+
 #endif
@@ -20,6 +20,7 @@ Literal_t *litInt(int i);
 Literal_t *litDouble(double d);
 Literal_t *litChar(char c);
 Literal_t *litText(char *str);
+Literal_t *litParam(int n);
 Literal_t *Literal_append(Literal_t *val, Literal_t *toAppend);
 
 void Literal_free(Literal_t *lval);
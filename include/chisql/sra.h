@@ -83,6 +83,7 @@ typedef struct SRA_Project_s {
    int distinct;
    enum OrderBy asc_desc;
    Expression_t *group_by;
+   int limit, offset; /* -1 and 0 without LIMIT and OFFSET */
 } SRA_Project_t;
 
 typedef struct SRA_Select_s {
@@ -147,6 +148,12 @@ SRA_t *SRAIntersect(SRA_t *sra1, SRA_t *sra2);
 /* the folloing two only work on SRAProject */
 SRA_t *SRA_applyOption(SRA_t *sra, ProjectOption_t *option);
 SRA_t *SRA_makeDistinct(SRA_t *sra);
+SRA_t *SRA_applyLimit(SRA_t *sra, int limit, int offset);
+
+/* LIMIT and OFFSET are taken off the end of a statement before it is parsed */
+int SRA_stripLimit(char *sql, int *limit, int *offset);
+/* Whether word (in any case) starts at p in sql, and is not part of a longer word */
+int SRA_isWord(const char *sql, const char *p, const char *word);
 
 ProjectOption_t *OrderBy_make(Expression_t *expr, enum OrderBy o);
 ProjectOption_t *GroupBy_make(Expression_t *expr);
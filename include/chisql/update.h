@@ -0,0 +1,22 @@
+#ifndef __UPDATE_H_
+#define __UPDATE_H_
+
+#include "common.h"
+#include "expression.h"
+#include "condition.h"
+#include "sra.h"
+
+typedef struct Update_s {
+   char *table_name;
+   StrList_t *col_names;  /* columns that are SET */
+   Expression_t *values;  /* their new values, in the same order */
+   Condition_t *where;
+} Update_t;
+
+/* The grammar does not have UPDATE, so it is parsed as a SELECT of the new values */
+int Update_rewrite(const char *sql, char **select, StrList_t **col_names);
+Update_t *Update_make(SRA_t *select, StrList_t *col_names);
+void Update_print(Update_t *update);
+void Update_free(Update_t *update);
+
+#endif
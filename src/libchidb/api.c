@@ -41,12 +41,29 @@
  */
 
 
+#include <errno.h>
+#include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <ctype.h>
+#include <unistd.h>
+#include <sys/stat.h>
 #include <chidb/chidb.h>
 #include "dbm.h"
 #include "btree.h"
+#include "pager.h"
 #include "record.h"
 #include "util.h"
+#include "stmt-cache.h"
+#include "result-cache.h"
+#include "catalog.h"
+#include "stats.h"
+#include "latency.h"
+#include "memory.h"
+#include "dbm-sorter.h"
+#include "dbm-cursor.h"
+#include "dbm-parallel.h"
 #include "../simclist/simclist.h"
 
 
@@ -58,69 +75,447 @@ int chidb_stmt_optimize(chidb *db,
             chisql_statement_t *sql_stmt, 
             chisql_statement_t **sql_stmt_opt);
 
-/* aux function to load schema table into in-mem rep */
-int load_schema(chidb *db, npage_t nroot)
+/* Loads the schema table entries in the subtree rooted at npage that
+ * have a key greater than db->schema_last_key. Entries are only loaded
+ * as stubs: their SQL is parsed the first time it is needed. */
+static int load_schema_node(chidb *db, npage_t npage)
 {
-    BTree *bt = db->bt;
-    
     BTreeNode *btn;
+    BTreeCell cell;
+    int status = CHIDB_OK;
 
-    int i;
-    int status;
-
-    // get BTree Node
-    if ((status = chidb_Btree_getNodeByPage(bt, nroot, &btn)) != CHIDB_OK)
+    if ((status = chidb_Btree_getNodeByPage(db->bt, npage, &btn)) != CHIDB_OK)
         return status;
-    for (i = 0; i < btn->n_cells; i++) {
-        BTreeCell *cell = malloc(sizeof(BTreeCell));
-        if(chidb_Btree_getCell(btn, i, cell) != CHIDB_OK)
-            return CHIDB_ECELLNO;
 
-        // if we are at an internal node
-        if(btn->type == PGTYPE_TABLE_INTERNAL) {
+    for (ncell_t i = 0; i < btn->n_cells && status == CHIDB_OK; i++) {
+        if ((status = chidb_Btree_getCell(btn, i, &cell)) != CHIDB_OK)
+            break;
 
-            return load_schema(db, cell->fields.tableInternal.child_page);
+        // Cells in an internal node have the largest key of their child,
+        // so children that were already loaded can be skipped altogether
+        if (cell.key <= db->schema_last_key)
+            continue;
 
-        } else if(btn->type == PGTYPE_TABLE_LEAF) {
+        if (btn->type == PGTYPE_TABLE_INTERNAL) {
+            status = load_schema_node(db, cell.fields.tableInternal.child_page);
+        } else {
             DBRecord *dbr;
-            char *sql;
-            chidb_DBRecord_unpack(&dbr, cell->fields.tableLeaf.data);
+            uint8_t *buf;
+            chidb_sql_schema_t *schema = calloc(1, sizeof(chidb_sql_schema_t));
+
+            if (schema == NULL) {
+                status = CHIDB_ENOMEM;
+                break;
+            }
 
-            chidb_sql_schema_t *schema = malloc(sizeof(chidb_sql_schema_t));
+            // a long CREATE statement can spill into overflow pages
+            if ((status = chidb_Btree_loadPayload(db->bt, &cell, &buf)) != CHIDB_OK) {
+                free(schema);
+                break;
+            }
+            chidb_DBRecord_unpack(&dbr, cell.fields.tableLeaf.data);
+            free(buf);
+            chidb_DBRecord_getString(dbr, 0, &schema->type);
+            chidb_DBRecord_getString(dbr, 1, &schema->name);
+            chidb_DBRecord_getString(dbr, 2, &schema->assoc);
+            chidb_DBRecord_getInt32(dbr, 3, &schema->rpage);
+            chidb_DBRecord_getString(dbr, 4, &schema->sql);
+            chidb_DBRecord_destroy(dbr);
 
-            
-            chidb_DBRecord_getString(dbr, 0, &(schema)->type);
-            chidb_DBRecord_getString(dbr, 1, &(schema)->name);
-            chidb_DBRecord_getString(dbr, 2, &(schema)->assoc);
-            chidb_DBRecord_getInt32(dbr, 3, &(schema)->rpage);
-            chidb_DBRecord_getString(dbr, 4, &sql);
+            list_append(&db->schemas, schema);
+            status = chidb_catalog_add(db, schema);
+            db->schema_last_key = cell.key;
+        }
+    }
 
-            chisql_statement_t *stmt;
-            chisql_parser(sql, &stmt);
+    if (status == CHIDB_OK && btn->type == PGTYPE_TABLE_INTERNAL)
+        status = load_schema_node(db, btn->right_page);
 
-            schema->stmt = stmt;
+    chidb_Btree_freeMemNode(db->bt, btn);
 
-            list_append(&db->schemas, schema);
+    return status;
+}
 
-            free(sql);
-            chidb_DBRecord_destroy(dbr);
+/* Load the schema table into its in-memory representation
+ *
+ * Only the entries that have not been loaded yet are read, so this can
+ * be called again to pick up the tables and indexes created since.
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_ENOMEM: Could not allocate memory
+ * - Any error from reading the schema table B-Tree
+ */
+int load_schema(chidb *db, npage_t nroot)
+{
+    return load_schema_node(db, nroot);
+}
+
+/* Free the in-memory representation of the schema table */
+static void free_schema(chidb *db)
+{
+    chidb_catalog_clear(db);
+    while(!list_empty(&db->schemas))
+    {
+    	chidb_sql_schema_t *next = (chidb_sql_schema_t *) list_fetch(&db->schemas);
+    	if(next->stmt)
+    	    chisql_statement_free(next->stmt);
+    	free(next->sql);
+    	free(next->type);
+    	free(next->name);
+    	free(next->assoc);
+    	free(next);
+    }
+    db->schema_last_key = 0;
+}
+
+/* Load the schema table again from scratch
+ *
+ * Needed when entries may have been removed from the schema table
+ * (i.e., when a transaction that created tables is rolled back).
+ *
+ * Return
+ * - Same as load_schema
+ */
+int reload_schema(chidb *db)
+{
+    free_schema(db);
+    return load_schema(db, 1);
+}
+
+/* Recognize a transaction statement
+ *
+ * BEGIN, COMMIT (or END) and ROLLBACK, each optionally followed by
+ * TRANSACTION, are not part of the SQL grammar.
+ *
+ * Return
+ * - The kind of statement (see chidb_dbm_txn_t), or -1 if sql is
+ *   not a transaction statement
+ */
+static int transaction_kind(const char *sql)
+{
+    static const struct { const char *word; int kind; } words[] =
+    {
+        {"BEGIN", TXN_BEGIN}, {"COMMIT", TXN_COMMIT},
+        {"END", TXN_COMMIT}, {"ROLLBACK", TXN_ROLLBACK}
+    };
+    int kind = -1;
+
+    while (isspace((unsigned char) *sql))
+        sql++;
+    for (int i = 0; i < sizeof(words) / sizeof(words[0]) && kind < 0; i++)
+    {
+        size_t len = strlen(words[i].word);
+        if (strncasecmp(sql, words[i].word, len) == 0
+                && (sql[len] == '\0' || sql[len] == ';' || isspace((unsigned char) sql[len])))
+        {
+            kind = words[i].kind;
+            sql += len;
         }
+    }
+    if (kind < 0)
+        return -1;
+
+    while (isspace((unsigned char) *sql))
+        sql++;
+    if (strncasecmp(sql, "TRANSACTION", 11) == 0)
+        sql += 11;
+    while (isspace((unsigned char) *sql))
+        sql++;
+    if (*sql == ';')
+        sql++;
+    while (isspace((unsigned char) *sql))
+        sql++;
+
+    return *sql == '\0' ? kind : -1;
+}
+
+/* Recognize VACUUM (optionally followed by a semicolon), which is not
+ * part of the SQL grammar either */
+static bool is_vacuum(const char *sql)
+{
+    while (isspace((unsigned char) *sql))
+        sql++;
+    if (strncasecmp(sql, "VACUUM", 6) != 0)
+        return false;
+    sql += 6;
+    while (isspace((unsigned char) *sql))
+        sql++;
+    if (*sql == ';')
+        sql++;
+    while (isspace((unsigned char) *sql))
+        sql++;
+
+    return *sql == '\0';
+}
+
+/* Recognize EXPLAIN ANALYZE, which the SQL grammar does not know
+ * about: the statement after it is prepared as usual, and profiled
+ * (see chidb_step)
+ *
+ * Return
+ * - The statement after EXPLAIN ANALYZE, or NULL if sql does not
+ *   start with it
+ */
+static const char *explain_analyze(const char *sql)
+{
+    while (isspace((unsigned char) *sql))
+        sql++;
+    if (strncasecmp(sql, "EXPLAIN", 7) != 0 || !isspace((unsigned char) sql[7]))
+        return NULL;
+    sql += 7;
+    while (isspace((unsigned char) *sql))
+        sql++;
+    if (strncasecmp(sql, "ANALYZE", 7) != 0 || !isspace((unsigned char) sql[7]))
+        return NULL;
+
+    return sql + 7;
+}
+
+/* Recognize PRAGMA page_size = N (see chidb_set_page_size)
+ *
+ * Return
+ * - N, or 0 if it is not a number, or -1 if sql is not that statement
+ */
+static int pragma_page_size(const char *sql)
+{
+    char *end;
+    long n;
 
-        free(cell);
+    while (isspace((unsigned char) *sql))
+        sql++;
+    if (strncasecmp(sql, "PRAGMA", 6) != 0 || !isspace((unsigned char) sql[6]))
+        return -1;
+    sql += 6;
+    while (isspace((unsigned char) *sql))
+        sql++;
+    if (strncasecmp(sql, "page_size", 9) != 0)
+        return -1;
+    sql += 9;
+    while (isspace((unsigned char) *sql))
+        sql++;
+    if (*sql++ != '=')
+        return -1;
+
+    n = strtol(sql, &end, 10);
+    if (end == sql || n <= 0 || n > MAX_PAGE_SIZE)
+        return 0;
+    sql = end;
+    while (isspace((unsigned char) *sql))
+        sql++;
+    if (*sql == ';')
+        sql++;
+    while (isspace((unsigned char) *sql))
+        sql++;
+
+    return *sql == '\0' ? n : 0;
+}
+
+/* Is a name one that a database can be attached as? It must look like
+ * a table name, without two underscores in a row or one at the end, so
+ * that schema__table can only be split one way (see
+ * chidb_catalog_database). */
+static bool attach_name_valid(const char *name, size_t len)
+{
+    if (len == 0 || !isalpha((unsigned char) name[0]) || name[len - 1] == '_')
+        return false;
+
+    for (size_t i = 0; i < len; i++)
+        if ((!isalnum((unsigned char) name[i]) && name[i] != '_')
+                || (name[i] == '_' && i > 0 && name[i - 1] == '_'))
+            return false;
+
+    return true;
+}
+
+/* Recognize ATTACH [DATABASE] 'file' AS name and DETACH [DATABASE] name
+ * (either one optionally followed by a semicolon), which are not part
+ * of the SQL grammar either
+ *
+ * Parameters
+ * - sql: SQL statement
+ * - file: Out parameter. A copy of the file to attach (NULL for DETACH)
+ * - name: Out parameter. A copy of the name it is attached as
+ *
+ * Return
+ * - CHIDB_OK: sql is one of them
+ * - CHIDB_ENOTFOUND: sql is neither
+ * - CHIDB_EINVALIDSQL: sql starts like one of them, but is not valid
+ * - CHIDB_ENOMEM: Could not allocate memory
+ */
+static int attach_statement(const char *sql, char **file, char **name)
+{
+    const char *fstart = NULL, *nstart;
+    size_t flen = 0, nlen;
+    bool attach;
+
+    while (isspace((unsigned char) *sql))
+        sql++;
+    if (strncasecmp(sql, "ATTACH", 6) == 0)
+        attach = true;
+    else if (strncasecmp(sql, "DETACH", 6) == 0)
+        attach = false;
+    else
+        return CHIDB_ENOTFOUND;
+    if (!isspace((unsigned char) sql[6]))
+        return CHIDB_ENOTFOUND;
+    sql += 6;
+    while (isspace((unsigned char) *sql))
+        sql++;
+    if (strncasecmp(sql, "DATABASE", 8) == 0 && isspace((unsigned char) sql[8]))
+        sql += 8;
+    while (isspace((unsigned char) *sql))
+        sql++;
+
+    if (attach)
+    {
+        char quote = *sql;
+
+        if (quote != '\'' && quote != '"')
+            return CHIDB_EINVALIDSQL;
+        fstart = ++sql;
+        while (*sql != '\0' && *sql != quote)
+            sql++;
+        if (*sql == '\0' || sql == fstart)
+            return CHIDB_EINVALIDSQL;
+        flen = sql++ - fstart;
+
+        while (isspace((unsigned char) *sql))
+            sql++;
+        if (strncasecmp(sql, "AS", 2) != 0 || !isspace((unsigned char) sql[2]))
+            return CHIDB_EINVALIDSQL;
+        sql += 2;
+        while (isspace((unsigned char) *sql))
+            sql++;
+    }
+
+    nstart = sql;
+    while (isalnum((unsigned char) *sql) || *sql == '_')
+        sql++;
+    nlen = sql - nstart;
+    while (isspace((unsigned char) *sql))
+        sql++;
+    if (*sql == ';')
+        sql++;
+    while (isspace((unsigned char) *sql))
+        sql++;
+    if (*sql != '\0' || !attach_name_valid(nstart, nlen))
+        return CHIDB_EINVALIDSQL;
+
+    *file = NULL;
+    if (attach && (*file = strndup(fstart, flen)) == NULL)
+        return CHIDB_ENOMEM;
+    if ((*name = strndup(nstart, nlen)) == NULL)
+    {
+        free(*file);
+        return CHIDB_ENOMEM;
     }
 
-    // If we are at an internal node, traverse right page
-    if (btn->type != PGTYPE_TABLE_LEAF) {
-        i = btn->right_page;
+    return CHIDB_OK;
+}
+
+/* Rewrite the tables of attached databases, schema.table, as
+ * schema__table, which is how the catalog knows them (see
+ * chidb_catalog_database): the grammar has no qualified names. The
+ * schema is matched without regard to case, and main.table is table.
+ * Nothing in quotes is changed.
+ *
+ * Parameters
+ * - db: chidb database
+ * - sql: SQL statement
+ * - qualified: Out parameter. The rewritten statement, or NULL if there
+ *              was nothing to rewrite
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_ENOMEM: Could not allocate memory
+ */
+static int qualify_names(chidb *db, const char *sql, char **qualified)
+{
+    char *out = NULL, *o = NULL, quote = '\0';
+    const char *s = sql;
+
+    *qualified = NULL;
+    while (*s != '\0')
+    {
+        const char *word = s, *schema = NULL;
+        size_t len;
+
+        if (quote != '\0' || !(isalpha((unsigned char) *s) || *s == '_'))
+        {
+            if (*s == quote)
+                quote = '\0';
+            else if (quote == '\0' && (*s == '\'' || *s == '"'))
+                quote = *s;
+            if (o != NULL)
+                *o++ = *s;
+            s++;
+            continue;
+        }
+
+        while (isalnum((unsigned char) *s) || *s == '_')
+            s++;
+        len = s - word;
+
+        if (*s == '.' && (isalpha((unsigned char) s[1]) || s[1] == '_'))
+        {
+            if (len == 4 && strncasecmp(word, "main", 4) == 0)
+                schema = "";
+            for (uint32_t i = 0; i < db->nattached && schema == NULL; i++)
+                if (strlen(db->attached[i].name) == len && strncasecmp(word, db->attached[i].name, len) == 0)
+                    schema = db->attached[i].name;
+        }
+
+        if (schema != NULL && out == NULL)
+        {
+            // schema__ is one character longer than schema., at most once per dot
+            if ((out = malloc(strlen(sql) * 2 + 1)) == NULL)
+                return CHIDB_ENOMEM;
+            memcpy(out, sql, word - sql);
+            o = out + (word - sql);
+        }
 
-        return load_schema(db, i);
+        if (schema != NULL)
+        {
+            o = stpcpy(o, schema);
+            if (*schema != '\0')
+                o = stpcpy(o, CATALOG_SCHEMA_SEPARATOR);
+            s++;
+        }
+        else if (o != NULL)
+        {
+            memcpy(o, word, len);
+            o += len;
+        }
     }
 
-	chidb_Btree_freeMemNode(bt, btn);
+    if (out != NULL)
+        *o = '\0';
+    *qualified = out;
 
     return CHIDB_OK;
 }
 
+/* On a shared handle (see chidb_set_threadsafe), statements that only
+ * read hold the handle shared, so they can run at the same time.
+ * Everything else has the handle to itself. */
+static void lock_db(chidb *db, bool shared)
+{
+    if (!db->threadsafe)
+        return;
+
+    if (shared)
+        pthread_rwlock_rdlock(&db->lock);
+    else
+        pthread_rwlock_wrlock(&db->lock);
+}
+
+static void unlock_db(chidb *db)
+{
+    if (db->threadsafe)
+        pthread_rwlock_unlock(&db->lock);
+}
+
 int chidb_open(const char *file, chidb **db)
 {
     *db = malloc(sizeof(chidb));
@@ -133,11 +528,26 @@ int chidb_open(const char *file, chidb **db)
 
     // initialize list of schema structs
     list_init(&(*db)->schemas);
+    (*db)->schema_last_key = 0;
+    (*db)->txn_schema_key = 0;
+    if((ret = chidb_catalog_init(*db)) != CHIDB_OK)
+        return ret;
 
     if((ret = load_schema(*db, 1)) != CHIDB_OK)
         return ret;
 
     (*db)->need_refresh = 0;
+    (*db)->stats = NULL;
+    (*db)->sort_budget = SORTER_DEFAULT_BUDGET;
+    (*db)->scan_threads = sysconf(_SC_NPROCESSORS_ONLN) > 1 ? sysconf(_SC_NPROCESSORS_ONLN) : 1;
+    (*db)->threadsafe = false;
+    pthread_rwlock_init(&(*db)->lock, NULL);
+    memset((*db)->latency, 0, sizeof((*db)->latency));
+    memset(&(*db)->memory, 0, sizeof((*db)->memory));
+    chidb_stmt_cache_init(&(*db)->stmt_cache, DEFAULT_STMT_CACHE_SIZE);
+    chidb_result_cache_init(&(*db)->result_cache);
+    (*db)->attached = NULL;
+    (*db)->nattached = 0;
     //print_schema_list((*db)->schemas);
 
 
@@ -146,29 +556,65 @@ int chidb_open(const char *file, chidb **db)
 
 int chidb_close(chidb *db)
 {
-    chidb_Btree_close(db->bt);
-
-    while(!list_empty(&db->schemas))
+    for (uint32_t i = 0; i < db->nattached; i++)
     {
-    	chidb_sql_schema_t *next = (chidb_sql_schema_t *) list_fetch(&db->schemas);
-    	chisql_statement_free(next->stmt);
-    	free(next->type);
-    	free(next->name);
-    	free(next->assoc);
-    	free(next);
+        chidb_close(db->attached[i].db);
+        free(db->attached[i].name);
     }
+    free(db->attached);
+
+    chidb_result_cache_free(&db->result_cache);
+    chidb_stmt_cache_clear(&db->stmt_cache);
+    chidb_Btree_close(db->bt);
+
+    free_schema(db);
+    chidb_catalog_free(db);
+    chidb_stats_free(db);
 
     list_destroy(&db->schemas);
 
+    pthread_rwlock_destroy(&db->lock);
     free(db);
 
     return CHIDB_OK;
 }
 
-int chidb_prepare(chidb *db, const char *sql, chidb_stmt **stmt)
+static int prepare(chidb *db, const char *sql, chidb_stmt **stmt)
 {
     int rc;
     chisql_statement_t *sql_stmt, *sql_stmt_opt;
+    const char *analyzed;
+
+    /* EXPLAIN ANALYZE lists the program of the statement after it,
+     * with what each instruction did when the program was run */
+    if((analyzed = explain_analyze(sql)) != NULL)
+    {
+        if((rc = prepare(db, analyzed, stmt)) != CHIDB_OK)
+            return rc;
+        if((*stmt)->explain)
+        {
+            chidb_stmt_free(*stmt);
+            return CHIDB_EINVALIDSQL;
+        }
+        (*stmt)->profile = calloc((*stmt)->endOp + 1, sizeof(chidb_dbm_profile_t));
+        if((*stmt)->profile == NULL)
+        {
+            chidb_stmt_free(*stmt);
+            return CHIDB_ENOMEM;
+        }
+        (*stmt)->explain = true;
+        (*stmt)->kind = CHIDB_LATENCY_OTHER;
+        return CHIDB_OK;
+    }
+
+    /* Cached programs are only valid for the schema they were
+     * compiled against */
+    if(db->need_refresh)
+        chidb_stmt_cache_clear(&db->stmt_cache);
+
+    rc = chidb_stmt_cache_lookup(db, sql, stmt);
+    if(rc != CHIDB_ENOTFOUND)
+        return rc;
 
     *stmt = malloc(sizeof(chidb_stmt));
 
@@ -180,7 +626,93 @@ int chidb_prepare(chidb *db, const char *sql, chidb_stmt **stmt)
         return rc;
     }
 
-    rc = chisql_parser(sql, &sql_stmt);
+    /* ANALYZE is not part of the SQL grammar, so it is compiled here.
+     * Like CREATE, it is not cached. */
+    if(chidb_stats_is_analyze(sql))
+    {
+        chidb_dbm_op_t analyze = {Op_Analyze, 0, 0, 0, NULL};
+        chidb_dbm_op_t halt = {Op_Halt, 0, 0, 0, NULL};
+
+        if((rc = chidb_stmt_set_op(*stmt, &analyze, 0)) == CHIDB_OK
+                && (rc = chidb_stmt_set_op(*stmt, &halt, 1)) == CHIDB_OK)
+            rc = chidb_stmt_verify(*stmt);
+        return rc;
+    }
+
+    /* Nor is VACUUM, which is compiled (and not cached) the same way */
+    if(is_vacuum(sql))
+    {
+        chidb_dbm_op_t vacuum = {Op_Vacuum, 0, 0, 0, NULL};
+        chidb_dbm_op_t halt = {Op_Halt, 0, 0, 0, NULL};
+
+        if((rc = chidb_stmt_set_op(*stmt, &vacuum, 0)) == CHIDB_OK
+                && (rc = chidb_stmt_set_op(*stmt, &halt, 1)) == CHIDB_OK)
+            rc = chidb_stmt_verify(*stmt);
+        return rc;
+    }
+
+    /* Nor is PRAGMA page_size */
+    int page_size = pragma_page_size(sql);
+    if(page_size >= 0)
+    {
+        chidb_dbm_op_t set = {Op_SetPageSize, page_size, 0, 0, NULL};
+        chidb_dbm_op_t halt = {Op_Halt, 0, 0, 0, NULL};
+
+        if((rc = chidb_stmt_set_op(*stmt, &set, 0)) == CHIDB_OK
+                && (rc = chidb_stmt_set_op(*stmt, &halt, 1)) == CHIDB_OK)
+            rc = chidb_stmt_verify(*stmt);
+        return rc;
+    }
+
+    /* Nor are ATTACH and DETACH. The file to attach is opened when the
+     * statement is run. */
+    char *file, *name;
+    if((rc = attach_statement(sql, &file, &name)) != CHIDB_ENOTFOUND)
+    {
+        if(rc != CHIDB_OK)
+        {
+            free(*stmt);
+            return rc;
+        }
+
+        chidb_dbm_op_t string = {Op_String, file ? strlen(file) : 0, 0, 0, file};
+        chidb_dbm_op_t attach = {file ? Op_Attach : Op_Detach, 0, 0, 0, name};
+        chidb_dbm_op_t halt = {Op_Halt, 0, 0, 0, NULL};
+        uint32_t pos = 0;
+
+        if((file == NULL || (rc = chidb_stmt_set_op(*stmt, &string, pos++)) == CHIDB_OK)
+                && (rc = chidb_stmt_set_op(*stmt, &attach, pos++)) == CHIDB_OK
+                && (rc = chidb_stmt_set_op(*stmt, &halt, pos)) == CHIDB_OK)
+            rc = chidb_stmt_verify(*stmt);
+        free(file);
+        free(name);
+        return rc;
+    }
+
+    /* Neither are transaction statements. They are not cached either,
+     * because they have no program to speak of. */
+    int txn = transaction_kind(sql);
+    if(txn >= 0)
+    {
+        chidb_dbm_op_t transaction = {Op_Transaction, txn, 0, 0, NULL};
+        chidb_dbm_op_t halt = {Op_Halt, 0, 0, 0, NULL};
+
+        if((rc = chidb_stmt_set_op(*stmt, &transaction, 0)) == CHIDB_OK
+                && (rc = chidb_stmt_set_op(*stmt, &halt, 1)) == CHIDB_OK)
+            rc = chidb_stmt_verify(*stmt);
+        return rc;
+    }
+
+    /* Tables of attached databases are qualified with their names */
+    char *qualified;
+    if((rc = qualify_names(db, sql, &qualified)) != CHIDB_OK)
+    {
+        free(*stmt);
+        return rc;
+    }
+
+    rc = chisql_parser(qualified != NULL ? qualified : sql, &sql_stmt);
+    free(qualified);
 
     if(rc != CHIDB_OK)
     {
@@ -201,14 +733,69 @@ int chidb_prepare(chidb *db, const char *sql, chidb_stmt **stmt)
     free(sql_stmt_opt);
 
     (*stmt)->explain = sql_stmt->explain;
+    (*stmt)->kind = sql_stmt->explain ? CHIDB_LATENCY_OTHER : chidb_latency_kind(sql_stmt->type);
+
+    if(rc == CHIDB_OK && sql_stmt->nparams > 0)
+        rc = realloc_params(*stmt, sql_stmt->nparams);
+
+    /* Check the program once here, instead of on every instruction */
+    if(rc == CHIDB_OK && !(*stmt)->explain)
+        rc = chidb_stmt_verify(*stmt);
+
+    /* CREATE changes the schema, so it is not worth caching. Failing
+     * to cache a statement is not an error. */
+    if(rc == CHIDB_OK && !(*stmt)->explain && sql_stmt->type != STMT_CREATE)
+        chidb_stmt_cache_insert(db, sql, *stmt);
 
     return rc;
 }
 
-int chidb_step(chidb_stmt *stmt)
+int chidb_prepare(chidb *db, const char *sql, chidb_stmt **stmt)
+{
+    uint64_t start = chidb_latency_now();
+    int rc;
+
+    CHIDB_PROBE(stmt__prepare, sql);
+    lock_db(db, false);
+    rc = prepare(db, sql, stmt);
+    unlock_db(db);
+    CHIDB_PROBE(stmt__prepare__done, sql, rc, rc == CHIDB_OK && *stmt != NULL ? (*stmt)->endOp : 0);
+
+    if (rc == CHIDB_OK && *stmt != NULL)
+        chidb_latency_add(db, (*stmt)->kind, CHIDB_LATENCY_PREPARE, start);
+
+    return rc;
+}
+
+/* Run the program of an EXPLAIN ANALYZE statement to the end, throwing
+ * away its rows, so that its profile can be listed */
+static int analyze_program(chidb_stmt *stmt)
+{
+    int rc;
+
+    stmt->explain = false;
+    lock_db(stmt->db, stmt->readonly);
+    while((rc = chidb_stmt_exec(stmt)) == CHIDB_ROW)
+        ;
+    chidb_stmt_reset(stmt);
+    unlock_db(stmt->db);
+    rc = chidb_stmt_sync(stmt, rc);
+    stmt->explain = true;
+    stmt->analyzed = true;
+
+    return rc == CHIDB_DONE ? CHIDB_OK : rc;
+}
+
+static int step(chidb_stmt *stmt)
 {
+    int rc;
+
     if(stmt->explain)
     {
+        if(stmt->profile != NULL && !stmt->analyzed
+                && (rc = analyze_program(stmt)) != CHIDB_OK)
+            return rc;
+
         if(stmt->pc == stmt->endOp)
             return CHIDB_DONE;
         else
@@ -217,68 +804,367 @@ int chidb_step(chidb_stmt *stmt)
             return CHIDB_ROW;
         }
     }
-    else
-        return chidb_stmt_exec(stmt);
+
+    CHIDB_PROBE(stmt__step, stmt, stmt->pc);
+    lock_db(stmt->db, stmt->verified && stmt->readonly);
+    /* The rows may be cached. If not, a filtered scan of a large
+     * table is split between threads. */
+    chidb_result_cache_start(stmt);
+    if ((rc = chidb_dbm_scan_start(stmt)) == CHIDB_OK)
+        rc = chidb_stmt_exec(stmt);
+    unlock_db(stmt->db);
+    rc = chidb_stmt_sync(stmt, rc);
+    CHIDB_PROBE(stmt__step__done, stmt, rc, stmt->pc);
+
+    return rc;
 }
 
-int chidb_finalize(chidb_stmt *stmt)
+int chidb_step(chidb_stmt *stmt)
 {
-    return chidb_stmt_free(stmt);
+    uint64_t start = chidb_latency_now();
+    int rc;
+
+    rc = step(stmt);
+    chidb_latency_add(stmt->db, stmt->kind, stmt->started ? CHIDB_LATENCY_NEXT_ROW : CHIDB_LATENCY_FIRST_ROW, start);
+    stmt->started = true;
+
+    return rc;
 }
 
-int chidb_column_count(chidb_stmt *stmt)
+int chidb_step_async(chidb_stmt *stmt, chidb_io_token *token)
 {
+    int rc;
+
+    /* EXPLAIN is never waiting for the disk, and EXPLAIN ANALYZE runs
+     * the whole program at once */
     if(stmt->explain)
-        return 6;
-    else
-        return stmt->nCols;
+        return chidb_step(stmt);
+
+    lock_db(stmt->db, stmt->verified && stmt->readonly);
+    chidb_result_cache_start(stmt);
+    stmt->nowait = true;
+    rc = chidb_stmt_exec(stmt);
+    stmt->nowait = false;
+    if (rc == CHIDB_PENDING)
+        *token = stmt->db->bt->pager->wait_page;
+    unlock_db(stmt->db);
+    rc = chidb_stmt_sync(stmt, rc);
+    stmt->started = true;
+
+    return rc;
 }
 
-int chidb_column_type(chidb_stmt *stmt, int col)
+int chidb_io_poll(chidb *db, chidb_io_token token, int wait)
 {
-    if(stmt->explain)
-    {
-        chidb_dbm_op_t *op = &stmt->ops[stmt->pc - 1];
+    int rc;
 
-        switch(col)
+    lock_db(db, false);
+    rc = chidb_Pager_poll(db->bt->pager, token, wait != 0);
+    unlock_db(db);
+
+    return rc;
+}
+
+/* Does a statement of a script begin or end a transaction, or have to
+ * run outside of one (see chidb_exec)? */
+static bool exec_outside_txn(chidb_stmt *stmt)
+{
+    for (uint32_t i = 0; i < stmt->endOp; i++)
+        switch (stmt->ops[i].opcode)
         {
-        case 0:
-            return SQL_INTEGER_4BYTE;
-        case 1:
-            return 2 * strlen(opcode_to_str(op->opcode)) + SQL_TEXT;
-        case 2:
-        case 3:
-        case 4:
-            return SQL_INTEGER_4BYTE;
-        case 5:
-            if(op->p4 == NULL)
-                return SQL_NULL;
-            else
-                return 2 * strlen(op->p4) + SQL_TEXT;
+        case Op_Transaction:
+        case Op_Vacuum:
+        case Op_SetPageSize:
+            return true;
         default:
-            return SQL_NOTVALID;
+            break;
         }
-    }
-    else
-    {
-        if(col < 0 || col >= stmt->nCols)
-            return SQL_NOTVALID;
-        else
-        {
-            chidb_dbm_register_t *r = &stmt->reg[stmt->startRR + col];
 
-            switch(r->type)
-            {
-            case REG_UNSPECIFIED:
-            case REGISTER_BINARY:
-                return SQL_NOTVALID;
-                break;
-            case REG_NULL:
+    return false;
+}
+
+/* Runs a statement with no result rows (see chidb_exec) */
+static int exec_simple(chidb *db, const char *sql)
+{
+    chidb_stmt *stmt;
+    int rc;
+
+    if ((rc = chidb_prepare(db, sql, &stmt)) != CHIDB_OK)
+        return rc;
+
+    rc = chidb_step(stmt);
+    chidb_finalize(stmt);
+
+    return rc == CHIDB_DONE ? CHIDB_OK : rc;
+}
+
+/* The semicolon that ends the statement starting at sql (outside of
+ * quotes), or the end of the script */
+static const char *exec_next(const char *sql)
+{
+    char quote = '\0';
+
+    for (; *sql != '\0'; sql++)
+    {
+        if (quote != '\0')
+        {
+            if (*sql == quote)
+                quote = '\0';
+        }
+        else if (*sql == '\'' || *sql == '"')
+            quote = *sql;
+        else if (*sql == ';')
+            break;
+    }
+
+    return sql;
+}
+
+int chidb_exec(chidb *db, const char *sql, chidb_exec_callback callback, void *arg)
+{
+    const char *start, *end;
+    bool implicit = false;
+    char *buf;
+    int rc = CHIDB_OK;
+
+    // each statement is copied here, with its semicolon
+    if ((buf = malloc(strlen(sql) + 2)) == NULL)
+        return CHIDB_ENOMEM;
+
+    for (start = sql; rc == CHIDB_OK && *start != '\0'; start = *end == ';' ? end + 1 : end)
+    {
+        chidb_stmt *stmt;
+        const char *p;
+        int row = 0;
+
+        end = exec_next(start);
+        for (p = start; p < end && isspace((unsigned char) *p); p++)
+            ;
+        if (p == end)
+            continue;
+
+        memcpy(buf, p, end - p);
+        strcpy(buf + (end - p), ";");
+        if ((rc = chidb_prepare(db, buf, &stmt)) != CHIDB_OK)
+            break;
+
+        if (!stmt->verified)
+            rc = chidb_stmt_verify(stmt);
+
+        if (rc != CHIDB_OK)
+            ;
+        else if (exec_outside_txn(stmt))
+        {
+            if (implicit)
+            {
+                implicit = false;
+                rc = exec_simple(db, "COMMIT;");
+            }
+        }
+        else if (!stmt->readonly && !db->bt->pager->in_txn)
+        {
+            if ((rc = exec_simple(db, "BEGIN;")) == CHIDB_OK)
+                implicit = true;
+        }
+
+        while (rc == CHIDB_OK && (rc = chidb_step(stmt)) == CHIDB_ROW)
+            rc = callback != NULL ? callback(arg, stmt, row++) : CHIDB_OK;
+        if (rc == CHIDB_DONE)
+            rc = CHIDB_OK;
+
+        chidb_finalize(stmt);
+    }
+
+    free(buf);
+
+    if (implicit)
+    {
+        int end_rc = exec_simple(db, rc == CHIDB_OK ? "COMMIT;" : "ROLLBACK;");
+        if (rc == CHIDB_OK)
+            rc = end_rc;
+    }
+
+    return rc;
+}
+
+int chidb_save_programs(chidb *db, const char *filename)
+{
+    int rc;
+
+    lock_db(db, false);
+    rc = chidb_stmt_cache_save(db, filename);
+    unlock_db(db);
+
+    return rc;
+}
+
+int chidb_load_programs(chidb *db, const char *filename)
+{
+    int rc;
+
+    lock_db(db, false);
+    rc = chidb_stmt_cache_load(db, filename);
+    unlock_db(db);
+
+    return rc;
+}
+
+int chidb_finalize(chidb_stmt *stmt)
+{
+    uint64_t start = chidb_latency_now();
+    chidb *db = stmt->db;
+    int kind = stmt->kind;
+    int rc;
+
+    CHIDB_PROBE(stmt__finalize, stmt, stmt->endOp);
+    lock_db(db, false);
+    rc = chidb_stmt_free(stmt);
+    unlock_db(db);
+    chidb_latency_add(db, kind, CHIDB_LATENCY_FINALIZE, start);
+
+    return rc;
+}
+
+int chidb_reset(chidb_stmt *stmt)
+{
+    int rc;
+
+    lock_db(stmt->db, false);
+    rc = chidb_stmt_reset(stmt);
+    unlock_db(stmt->db);
+    stmt->started = false;
+
+    return rc;
+}
+
+int chidb_clear_bindings(chidb_stmt *stmt)
+{
+    if(stmt->pc != 0)
+        return CHIDB_EMISUSE;
+
+    return chidb_stmt_clear_params(stmt);
+}
+
+/* Returns the parameter that a value can be bound to, or NULL if
+ * the parameter does not exist or the statement is running */
+static chidb_dbm_register_t *chidb_bind_param(chidb_stmt *stmt, int param)
+{
+    if(stmt->pc != 0 || param < 1 || param > stmt->nParams)
+        return NULL;
+
+    chidb_dbm_register_t *r = &stmt->params[param - 1];
+
+    if(r->type == REG_STRING)
+        free(r->value.s);
+    r->type = REG_NULL;
+
+    return r;
+}
+
+int chidb_bind_int(chidb_stmt *stmt, int param, int value)
+{
+    chidb_dbm_register_t *r = chidb_bind_param(stmt, param);
+
+    if(r == NULL)
+        return CHIDB_EMISUSE;
+
+    r->type = REG_INT32;
+    r->value.i = value;
+
+    return CHIDB_OK;
+}
+
+int chidb_bind_int64(chidb_stmt *stmt, int param, int64_t value)
+{
+    chidb_dbm_register_t *r = chidb_bind_param(stmt, param);
+
+    if(r == NULL)
+        return CHIDB_EMISUSE;
+
+    r->type = ((int32_t) value == value) ? REG_INT32 : REG_INT64;
+    r->value.i = value;
+
+    return CHIDB_OK;
+}
+
+int chidb_bind_text(chidb_stmt *stmt, int param, const char *value)
+{
+    chidb_dbm_register_t *r = chidb_bind_param(stmt, param);
+
+    if(r == NULL)
+        return CHIDB_EMISUSE;
+
+    if((r->value.s = strdup(value)) == NULL)
+        return CHIDB_ENOMEM;
+    r->type = REG_STRING;
+
+    return CHIDB_OK;
+}
+
+int chidb_column_count(chidb_stmt *stmt)
+{
+    if(stmt->explain)
+        return stmt->profile != NULL ? 10 : 6;
+    else
+        return stmt->nCols;
+}
+
+int chidb_column_type(chidb_stmt *stmt, int col)
+{
+    if(stmt->explain)
+    {
+        chidb_dbm_op_t *op = &stmt->ops[stmt->pc - 1];
+
+        switch(col)
+        {
+        case 0:
+            return SQL_INTEGER_4BYTE;
+        case 1:
+            return 2 * strlen(opcode_to_str(op->opcode)) + SQL_TEXT;
+        case 2:
+        case 3:
+        case 4:
+            return SQL_INTEGER_4BYTE;
+        case 5:
+            if(op->p4 == NULL)
+                return SQL_NULL;
+            else
+                return 2 * strlen(op->p4) + SQL_TEXT;
+        case 6:
+        case 7:
+        case 8:
+            return stmt->profile != NULL ? SQL_INTEGER_8BYTE : SQL_NOTVALID;
+        case 9:
+            if(stmt->profile == NULL)
+                return SQL_NOTVALID;
+            return chidb_stmt_op_cursor(op) < 0 ? SQL_NULL : SQL_INTEGER_4BYTE;
+        default:
+            return SQL_NOTVALID;
+        }
+    }
+    else
+    {
+        if(col < 0 || col >= stmt->nCols)
+            return SQL_NOTVALID;
+        else
+        {
+            chidb_dbm_register_t *r = &stmt->reg[stmt->startRR + col];
+
+            switch(r->type)
+            {
+            case REG_UNSPECIFIED:
+            case REGISTER_BINARY:
+                return SQL_NOTVALID;
+                break;
+            case REG_NULL:
                 return SQL_NULL;
                 break;
             case REG_INT32:
                 return SQL_INTEGER_4BYTE;
                 break;
+            case REG_INT64:
+                return SQL_INTEGER_8BYTE;
+                break;
             case REG_STRING:
                 return 2 * strlen(r->value.s) + SQL_TEXT;
                 break;
@@ -307,6 +1193,14 @@ const char *chidb_column_name(chidb_stmt* stmt, int col)
             return "p3";
         case 5:
             return "p4";
+        case 6:
+            return stmt->profile != NULL ? "count" : NULL;
+        case 7:
+            return stmt->profile != NULL ? "time_ns" : NULL;
+        case 8:
+            return stmt->profile != NULL ? "pages" : NULL;
+        case 9:
+            return stmt->profile != NULL ? "cursor" : NULL;
         default:
             return NULL;
         }
@@ -321,6 +1215,11 @@ const char *chidb_column_name(chidb_stmt* stmt, int col)
 }
 
 int chidb_column_int(chidb_stmt *stmt, int col)
+{
+    return (int) chidb_column_int64(stmt, col);
+}
+
+int64_t chidb_column_int64(chidb_stmt *stmt, int col)
 {
     if(stmt->explain)
     {
@@ -340,6 +1239,14 @@ int chidb_column_int(chidb_stmt *stmt, int col)
             return op->p3;
         case 5:
             return 0; /* Undefined */
+        case 6:
+            return stmt->profile != NULL ? stmt->profile[stmt->pc - 1].count : 0;
+        case 7:
+            return stmt->profile != NULL ? stmt->profile[stmt->pc - 1].ns : 0;
+        case 8:
+            return stmt->profile != NULL ? stmt->profile[stmt->pc - 1].pages : 0;
+        case 9:
+            return stmt->profile != NULL ? chidb_stmt_op_cursor(op) : 0;
         default:
             return 0; /* Undefined */
         }
@@ -355,7 +1262,7 @@ int chidb_column_int(chidb_stmt *stmt, int col)
         {
             chidb_dbm_register_t *r = &stmt->reg[stmt->startRR + col];
 
-            if(r->type != REG_INT32)
+            if(!IS_INT_REG(r->type))
             {
                 /* Undefined behaviour */
                 return 0;
@@ -415,3 +1322,1250 @@ const char *chidb_column_text(chidb_stmt *stmt, int col)
         }
     }
 }
+
+
+static void batch_free_cols(chidb_batch *b)
+{
+    for(int i = 0; i < b->ncols; i++)
+    {
+        free(b->cols[i].ints);
+        free(b->cols[i].offsets);
+        free(b->cols[i].lengths);
+        free(b->cols[i].nulls);
+        free(b->cols[i].texts);
+    }
+    free(b->cols);
+}
+
+/* Make room in a batch for n rows of ncols columns, and empty it */
+static int batch_reserve(chidb_batch *b, int ncols, int n)
+{
+    if(b->ncols != ncols || b->cols == NULL)
+    {
+        batch_free_cols(b);
+        b->ncols = 0;
+        b->capacity = 0;
+        if((b->cols = calloc(ncols > 0 ? ncols : 1, sizeof(chidb_batch_column))) == NULL)
+            return CHIDB_ENOMEM;
+        b->ncols = ncols;
+    }
+
+    for(int i = 0; i < ncols && b->capacity < n; i++)
+    {
+        chidb_batch_column *col = &b->cols[i];
+        void *p;
+
+        if((p = realloc(col->ints, n * sizeof(int64_t))) == NULL)
+            return CHIDB_ENOMEM;
+        col->ints = p;
+        if((p = realloc(col->offsets, n * sizeof(uint32_t))) == NULL)
+            return CHIDB_ENOMEM;
+        col->offsets = p;
+        if((p = realloc(col->lengths, n * sizeof(uint32_t))) == NULL)
+            return CHIDB_ENOMEM;
+        col->lengths = p;
+        if((p = realloc(col->nulls, (n + 7) / 8)) == NULL)
+            return CHIDB_ENOMEM;
+        col->nulls = p;
+        if((p = realloc(col->texts, (n + 7) / 8)) == NULL)
+            return CHIDB_ENOMEM;
+        col->texts = p;
+    }
+    if(b->capacity < n)
+        b->capacity = n;
+
+    for(int i = 0; i < ncols; i++)
+    {
+        memset(b->cols[i].nulls, 0, (n + 7) / 8);
+        memset(b->cols[i].texts, 0, (n + 7) / 8);
+    }
+    b->nrows = 0;
+    b->text_used = 0;
+
+    return CHIDB_OK;
+}
+
+/* Copy the result row of a statement into the next row of a batch */
+static int batch_add_row(chidb_batch *b, chidb_stmt *stmt)
+{
+    int row = b->nrows;
+    uint8_t bit = 1 << (row % 8);
+
+    for(int i = 0; i < b->ncols; i++)
+    {
+        chidb_dbm_register_t *r = &stmt->reg[stmt->startRR + i];
+        chidb_batch_column *col = &b->cols[i];
+
+        col->ints[row] = 0;
+        col->offsets[row] = 0;
+        col->lengths[row] = 0;
+
+        if(IS_INT_REG(r->type))
+            col->ints[row] = r->value.i;
+        else if(r->type == REG_STRING)
+        {
+            uint32_t len = strlen(r->value.s);
+
+            if(b->text_used + len + 1 > b->text_size)
+            {
+                uint32_t size = b->text_size ? b->text_size : 1024;
+                char *text;
+
+                while(size < b->text_used + len + 1)
+                    size *= 2;
+                if((text = realloc(b->text, size)) == NULL)
+                    return CHIDB_ENOMEM;
+                b->text = text;
+                b->text_size = size;
+            }
+            memcpy(b->text + b->text_used, r->value.s, len + 1);
+            col->offsets[row] = b->text_used;
+            col->lengths[row] = len;
+            col->texts[row / 8] |= bit;
+            b->text_used += len + 1;
+        }
+        else
+            col->nulls[row / 8] |= bit;
+    }
+    b->nrows++;
+
+    return CHIDB_OK;
+}
+
+int chidb_step_batch(chidb_stmt *stmt, int n, chidb_batch **batch)
+{
+    chidb_batch *b = *batch;
+    int rc;
+
+    if(n <= 0 || stmt->explain)
+        return CHIDB_EMISUSE;
+
+    if(b == NULL && (b = *batch = calloc(1, sizeof(chidb_batch))) == NULL)
+        return CHIDB_ENOMEM;
+    if((rc = batch_reserve(b, stmt->nCols, n)) != CHIDB_OK)
+        return rc;
+
+    lock_db(stmt->db, stmt->verified && stmt->readonly);
+    chidb_result_cache_start(stmt);
+    if ((rc = chidb_dbm_scan_start(stmt)) == CHIDB_OK)
+    {
+        while(b->nrows < n && (rc = chidb_stmt_exec(stmt)) == CHIDB_ROW)
+        {
+            if((rc = batch_add_row(b, stmt)) != CHIDB_OK)
+                break;
+        }
+    }
+    unlock_db(stmt->db);
+    rc = chidb_stmt_sync(stmt, rc);
+
+    if(rc == CHIDB_OK || (rc == CHIDB_DONE && b->nrows > 0))
+        return CHIDB_ROW;
+
+    return rc;
+}
+
+void chidb_batch_free(chidb_batch *batch)
+{
+    if(batch == NULL)
+        return;
+
+    batch_free_cols(batch);
+    free(batch->text);
+    free(batch);
+}
+
+
+/* A row read by chidb_load, already packed as a record */
+struct load_row
+{
+    chidb_key_t key;
+    uint8_t *data;
+    uint32_t size;
+};
+
+struct load_rows
+{
+    struct load_row *rows;
+    int nrows;
+    int next;
+};
+
+static int load_row_cmp(const void *a, const void *b)
+{
+    chidb_key_t ka = ((const struct load_row *) a)->key;
+    chidb_key_t kb = ((const struct load_row *) b)->key;
+
+    return (ka > kb) - (ka < kb);
+}
+
+/* bulkLoad source that returns the (sorted) rows one at a time */
+static int load_row_next(void *ctx, BTreeCell *btc)
+{
+    struct load_rows *rows = ctx;
+
+    if (rows->next == rows->nrows)
+        return CHIDB_DONE;
+
+    struct load_row *row = &rows->rows[rows->next++];
+
+    btc->type = PGTYPE_TABLE_LEAF;
+    btc->key = row->key;
+    btc->fields.tableLeaf.data = row->data;
+    btc->fields.tableLeaf.data_size = row->size;
+
+    return CHIDB_OK;
+}
+
+/* Appends the value of column col of a row read from a file to its
+ * record, or NULL if field is NULL. The primary key is kept in row->key,
+ * and a NULL takes its place in the record, as in the ones produced by
+ * INSERT. */
+static int load_append_value(DBRecordBuffer *dbrb, const char *field, int col, int type, struct load_row *row)
+{
+    char *end;
+    long long v;
+
+    if (field == NULL)
+    {
+        /* The primary key cannot be NULL */
+        if (col == 0)
+            return CHIDB_EMISMATCH;
+        return chidb_DBRecord_appendNull(dbrb);
+    }
+
+    if (type != TYPE_INT)
+        return chidb_DBRecord_appendString(dbrb, (char *) field);
+
+    errno = 0;
+    v = strtoll(field, &end, 10);
+    if (*field == '\0' || *end != '\0' || errno == ERANGE)
+        return CHIDB_EMISMATCH;
+
+    if (col == 0)
+    {
+        row->key = (chidb_key_t) v;
+        return chidb_DBRecord_appendNull(dbrb);
+    }
+    else if (v >= INT32_MIN && v <= INT32_MAX)
+        return chidb_DBRecord_appendInt32(dbrb, (int32_t) v);
+    else if (v >= -((int64_t) 1 << 47) && v < ((int64_t) 1 << 47))
+        return chidb_DBRecord_appendInt48(dbrb, v);
+    else
+        return chidb_DBRecord_appendInt64(dbrb, v);
+}
+
+/* Packs the record of a row once all its values have been appended (or
+ * frees it, if rc is an error) */
+static int load_finish_row(DBRecordBuffer *dbrb, int rc, struct load_row *row)
+{
+    DBRecord *dbr;
+
+    chidb_DBRecord_finalize(dbrb, &dbr);
+
+    if (rc == CHIDB_OK)
+    {
+        row->size = dbr->packed_len;
+        rc = chidb_DBRecord_pack(dbr, &row->data);
+    }
+    chidb_DBRecord_destroy(dbr);
+
+    return rc;
+}
+
+/* Parses a line of the form "pk|value|value|..." into a record laid out
+ * the same way as the ones produced by INSERT (i.e., with a NULL in place
+ * of the primary key) */
+static int load_parse_row(char *line, int ncols, int *types, struct load_row *row)
+{
+    DBRecordBuffer dbrb;
+    char *field = line;
+    int rc = CHIDB_OK;
+
+    chidb_DBRecord_create_empty(&dbrb, (uint8_t) ncols);
+
+    for (int i = 0; i < ncols && rc == CHIDB_OK; i++)
+    {
+        char *sep;
+
+        if (field == NULL)
+        {
+            rc = CHIDB_EMISMATCH;
+            break;
+        }
+
+        if ((sep = strchr(field, '|')) != NULL)
+            *sep = '\0';
+
+        rc = load_append_value(&dbrb, field, i, types[i], row);
+
+        field = (sep != NULL) ? sep + 1 : NULL;
+    }
+
+    /* Too many values */
+    if (rc == CHIDB_OK && field != NULL)
+        rc = CHIDB_EMISMATCH;
+
+    return load_finish_row(&dbrb, rc, row);
+}
+
+/* Looks up the types of the columns of a table that rows are loaded into */
+static int load_column_types(chidb *db, const char *table, int *ncols, int **types)
+{
+    list_t cnames;
+    int rc;
+
+    /* Pick up tables created since the schema was last read. The flag
+     * is left set, so that the statement cache is still cleared. */
+    if (db->need_refresh && (rc = load_schema(db, 1)) != CHIDB_OK)
+        return rc;
+
+    if (chidb_table_exists(db, (char *) table) != CHIDB_OK)
+        return CHIDB_EINVALIDSQL;
+
+    *ncols = chidb_columns_total(db, (char *) table);
+    if (!(*types = malloc(*ncols * sizeof(int))))
+        return CHIDB_ENOMEM;
+
+    list_init(&cnames);
+    chidb_column_names(db, (char *) table, &cnames);
+    for (int i = 0; i < *ncols; i++)
+        (*types)[i] = chidb_column_get_type(db, (char *) table, (char *) list_get_at(&cnames, i));
+    list_destroy(&cnames);
+
+    /* The primary key is the first column */
+    if ((*types)[0] != TYPE_INT)
+    {
+        free(*types);
+        return CHIDB_EMISMATCH;
+    }
+
+    return CHIDB_OK;
+}
+
+static int load(chidb *db, const char *table, const char *file, uint8_t fill_factor)
+{
+    struct load_rows rows = {NULL, 0, 0};
+    int ncols, nroot, rc = CHIDB_OK, allocated = 0;
+    int *types;
+    char *line = NULL;
+    size_t linecap = 0;
+    ssize_t len;
+    FILE *f;
+
+    if ((rc = load_column_types(db, table, &ncols, &types)) != CHIDB_OK)
+        return rc;
+
+    nroot = chidb_get_root(db, (char *) table);
+
+    if (!(f = fopen(file, "r")))
+    {
+        free(types);
+        return CHIDB_ECANTOPEN;
+    }
+
+    while (rc == CHIDB_OK && (len = getline(&line, &linecap, f)) != -1)
+    {
+        while (len > 0 && (line[len - 1] == '\n' || line[len - 1] == '\r'))
+            line[--len] = '\0';
+
+        if (len == 0)
+            continue;
+
+        if (rows.nrows == allocated)
+        {
+            struct load_row *r;
+
+            allocated = allocated ? allocated * 2 : 256;
+            if (!(r = realloc(rows.rows, allocated * sizeof(struct load_row))))
+            {
+                rc = CHIDB_ENOMEM;
+                break;
+            }
+            rows.rows = r;
+        }
+
+        if ((rc = load_parse_row(line, ncols, types, &rows.rows[rows.nrows])) == CHIDB_OK)
+            rows.nrows++;
+    }
+
+    free(line);
+    free(types);
+    fclose(f);
+
+    if (rc == CHIDB_OK)
+    {
+        qsort(rows.rows, rows.nrows, sizeof(struct load_row), load_row_cmp);
+
+        /* Checked here because bulkLoad reports duplicates with
+         * CHIDB_EDUPLICATE, which has the same value as CHIDB_EMISUSE */
+        for (int i = 1; i < rows.nrows && rc == CHIDB_OK; i++)
+            if (rows.rows[i].key == rows.rows[i - 1].key)
+                rc = CHIDB_ECONSTRAINT;
+    }
+
+    if (rc == CHIDB_OK)
+    {
+        chidb_result_cache_written(db, nroot);
+        rc = chidb_Btree_bulkLoad(db->bt, nroot, load_row_next, &rows, fill_factor);
+        if (rc == CHIDB_OK && !db->bt->pager->in_txn && chidb_Pager_flush(db->bt->pager) != CHIDB_OK)
+            rc = CHIDB_EIO;
+    }
+
+    for (int i = 0; i < rows.nrows; i++)
+        free(rows.rows[i].data);
+    free(rows.rows);
+
+    return rc;
+}
+
+int chidb_load(chidb *db, const char *table, const char *file, uint8_t fill_factor)
+{
+    int rc;
+
+    lock_db(db, false);
+    rc = load(db, table, file, fill_factor);
+    unlock_db(db);
+
+    return rc;
+}
+
+static int insert_rows(chidb *db, const char *table, const char **rows, int nrows)
+{
+    chidb_dbm_cursor_t c;
+    struct load_row row;
+    BTreeCell btc;
+    int ncols, rc;
+    int *types;
+    char *line;
+
+    if ((rc = load_column_types(db, table, &ncols, &types)) != CHIDB_OK)
+        return rc;
+
+    if ((rc = chidb_dbm_cursor_init(db->bt, &c, chidb_get_root(db, (char *) table), ncols)) != CHIDB_OK)
+    {
+        free(types);
+        return rc;
+    }
+    chidb_result_cache_written(db, c.root_page);
+
+    for (int i = 0; i < nrows && rc == CHIDB_OK; i++)
+    {
+        if (!(line = strdup(rows[i])))
+            rc = CHIDB_ENOMEM;
+        else if ((rc = load_parse_row(line, ncols, types, &row)) == CHIDB_OK)
+        {
+            btc.type = PGTYPE_TABLE_LEAF;
+            btc.key = row.key;
+            btc.fields.tableLeaf.data = row.data;
+            btc.fields.tableLeaf.data_size = row.size;
+
+            /* Through one cursor, so that rows in key order are appended
+             * to the last leaf without going down the tree every time */
+            rc = chidb_dbm_cursor_insert(db->bt, &c, &btc);
+            if (rc == CHIDB_EDUPLICATE)
+                rc = CHIDB_ECONSTRAINT;
+            free(row.data);
+        }
+        free(line);
+    }
+
+    chidb_dbm_cursor_destroy(db->bt, &c);
+    free(types);
+
+    if (!db->bt->pager->in_txn && chidb_Pager_flush(db->bt->pager) != CHIDB_OK && rc == CHIDB_OK)
+        rc = CHIDB_EIO;
+
+    return rc;
+}
+
+int chidb_insert_rows(chidb *db, const char *table, const char **rows, int nrows)
+{
+    int rc;
+
+    lock_db(db, false);
+    rc = insert_rows(db, table, rows, nrows);
+    unlock_db(db);
+
+    return rc;
+}
+
+/* Splits a line of a CSV or TSV file into the ncols values of a row, in
+ * place. A value may be quoted ("..."), with "" standing for a quote,
+ * so that it can have separators in it. An empty value that is not
+ * quoted is NULL. */
+static int import_split(char *line, char sep, char **fields, int ncols)
+{
+    char *in = line, *out = line;
+
+    for (int i = 0; i < ncols; i++)
+    {
+        char *start = out, next;
+        bool quoted = (*in == '"');
+
+        if (quoted)
+        {
+            for (in++; *in != '"' || in[1] == '"'; in++)
+            {
+                if (*in == '\0')
+                    return CHIDB_EMISMATCH;
+                if (*in == '"')
+                    in++;
+                *out++ = *in;
+            }
+            if (*++in != sep && *in != '\0')
+                return CHIDB_EMISMATCH;
+        }
+        else
+        {
+            while (*in != sep && *in != '\0')
+                *out++ = *in++;
+        }
+
+        next = *in++;
+        *out++ = '\0';
+        fields[i] = (quoted || out - 1 != start) ? start : NULL;
+
+        if (next == '\0')
+            return (i == ncols - 1) ? CHIDB_OK : CHIDB_EMISMATCH;
+    }
+
+    /* Too many values */
+    return CHIDB_EMISMATCH;
+}
+
+/* An index that imported rows are added to */
+struct import_index
+{
+    npage_t root;
+    int col;
+    bool text;
+};
+
+static int import_add_entries(BTree *bt, struct import_index *indexes, int nindexes,
+                              char **fields, chidb_key_t pk)
+{
+    int rc = CHIDB_OK;
+
+    for (int i = 0; i < nindexes && rc == CHIDB_OK; i++)
+    {
+        const char *field = fields[indexes[i].col];
+
+        if (field == NULL)
+            continue;
+        if (indexes[i].text)
+            rc = chidb_Btree_insertInTextIndex(bt, indexes[i].root, (const uint8_t *) field, strlen(field), pk);
+        else
+            rc = chidb_Btree_insertInIndex(bt, indexes[i].root, (chidb_key_t) strtoll(field, NULL, 10), pk);
+    }
+
+    return (rc == CHIDB_EDUPLICATE) ? CHIDB_ECONSTRAINT : rc;
+}
+
+static int import(chidb *db, const char *table, const char *file, char sep)
+{
+    struct import_index *indexes = NULL;
+    chidb_dbm_cursor_t c;
+    struct load_row row;
+    DBRecordBuffer dbrb;
+    BTreeCell btc;
+    int ncols, nindexes = 0, rc;
+    int *types;
+    char **fields = NULL, *line = NULL;
+    size_t linecap = 0;
+    ssize_t len;
+    list_t cnames;
+    FILE *f;
+
+    if ((rc = load_column_types(db, table, &ncols, &types)) != CHIDB_OK)
+        return rc;
+
+    if (!(f = fopen(file, "r")))
+    {
+        free(types);
+        return CHIDB_ECANTOPEN;
+    }
+
+    if (!(fields = malloc(ncols * sizeof(char *))) || !(indexes = malloc(ncols * sizeof(struct import_index))))
+        rc = CHIDB_ENOMEM;
+
+    /* The indexes on the table get an entry for each row, as with INSERT */
+    list_init(&cnames);
+    chidb_column_names(db, (char *) table, &cnames);
+    for (int i = 1; i < ncols && rc == CHIDB_OK; i++)
+    {
+        chidb_sql_schema_t *index = chidb_catalog_column_index(db, table, list_get_at(&cnames, i));
+
+        if (index == NULL)
+            continue;
+        indexes[nindexes].root = index->rpage;
+        indexes[nindexes].col = i;
+        indexes[nindexes].text = (types[i] == TYPE_TEXT);
+        nindexes++;
+    }
+    list_destroy(&cnames);
+
+    if (rc == CHIDB_OK)
+        rc = chidb_dbm_cursor_init(db->bt, &c, chidb_get_root(db, (char *) table), ncols);
+    if (rc != CHIDB_OK)
+    {
+        fclose(f);
+        free(fields);
+        free(indexes);
+        free(types);
+        return rc;
+    }
+    chidb_result_cache_written(db, c.root_page);
+    for (int i = 0; i < nindexes; i++)
+        chidb_result_cache_written(db, indexes[i].root);
+
+    /* One line at a time, through the same buffer */
+    while (rc == CHIDB_OK && (len = getline(&line, &linecap, f)) != -1)
+    {
+        while (len > 0 && (line[len - 1] == '\n' || line[len - 1] == '\r'))
+            line[--len] = '\0';
+
+        if (len == 0)
+            continue;
+
+        if ((rc = import_split(line, sep, fields, ncols)) != CHIDB_OK)
+            break;
+
+        chidb_DBRecord_create_empty(&dbrb, (uint8_t) ncols);
+        for (int i = 0; i < ncols && rc == CHIDB_OK; i++)
+            rc = load_append_value(&dbrb, fields[i], i, types[i], &row);
+        if ((rc = load_finish_row(&dbrb, rc, &row)) != CHIDB_OK)
+            break;
+
+        btc.type = PGTYPE_TABLE_LEAF;
+        btc.key = row.key;
+        btc.fields.tableLeaf.data = row.data;
+        btc.fields.tableLeaf.data_size = row.size;
+
+        /* Through one cursor, like chidb_insert_rows */
+        rc = chidb_dbm_cursor_insert(db->bt, &c, &btc);
+        if (rc == CHIDB_EDUPLICATE)
+            rc = CHIDB_ECONSTRAINT;
+        free(row.data);
+
+        if (rc == CHIDB_OK && nindexes > 0)
+            rc = import_add_entries(db->bt, indexes, nindexes, fields, row.key);
+    }
+
+    chidb_dbm_cursor_destroy(db->bt, &c);
+    free(line);
+    free(fields);
+    free(indexes);
+    free(types);
+    fclose(f);
+
+    if (!db->bt->pager->in_txn && chidb_Pager_flush(db->bt->pager) != CHIDB_OK && rc == CHIDB_OK)
+        rc = CHIDB_EIO;
+
+    return rc;
+}
+
+int chidb_import(chidb *db, const char *table, const char *file, char sep)
+{
+    int rc;
+
+    if (sep == '\0' || sep == '"' || sep == '\n' || sep == '\r')
+        return CHIDB_EMISUSE;
+
+    lock_db(db, false);
+    rc = import(db, table, file, sep);
+    unlock_db(db);
+
+    return rc;
+}
+
+int chidb_set_sort_budget(chidb *db, size_t bytes)
+{
+    if (bytes == 0)
+        return CHIDB_EMISUSE;
+
+    db->sort_budget = bytes;
+
+    return CHIDB_OK;
+}
+
+int chidb_set_scan_threads(chidb *db, int nthreads)
+{
+    if (nthreads < 1)
+        return CHIDB_EMISUSE;
+
+    db->scan_threads = nthreads;
+
+    return CHIDB_OK;
+}
+
+int chidb_set_result_cache(chidb *db, size_t bytes)
+{
+    lock_db(db, false);
+    chidb_result_cache_resize(&db->result_cache, bytes);
+    unlock_db(db);
+
+    return CHIDB_OK;
+}
+
+int chidb_set_memory_limit(chidb *db, size_t bytes)
+{
+    Pager *pager = db->bt->pager;
+    size_t used;
+    int rc = CHIDB_OK;
+
+    lock_db(db, false);
+
+    if (bytes != 0 && (size_t) pager->cache_size * pager->page_size > bytes / 2)
+        rc = chidb_Pager_setCacheSize(pager, bytes / 2 / pager->page_size);
+    if (rc == CHIDB_OK)
+    {
+        db->memory.limit = bytes;
+        used = chidb_memory_used(db, NULL, NULL);
+        if (bytes != 0 && used > bytes)
+            chidb_result_cache_trim(&db->result_cache, used - bytes);
+    }
+
+    unlock_db(db);
+
+    return rc;
+}
+
+int chidb_set_cache_size(chidb *db, int npages)
+{
+    Pager *pager = db->bt->pager;
+    int rc;
+
+    if (npages < 0)
+        return CHIDB_EMISUSE;
+
+    lock_db(db, false);
+    if (db->memory.limit != 0 && (size_t) npages * pager->page_size > db->memory.limit / 2)
+        rc = CHIDB_EMISUSE;
+    else
+        rc = chidb_Pager_setCacheSize(pager, (uint32_t) npages);
+    unlock_db(db);
+
+    return rc;
+}
+
+int chidb_set_page_size(chidb *db, int size)
+{
+    int rc;
+
+    if (size <= 0)
+        return CHIDB_EMISUSE;
+
+    lock_db(db, false);
+    rc = chidb_Btree_setPageSize(db->bt, size);
+    unlock_db(db);
+
+    return rc;
+}
+
+int chidb_set_compression(chidb *db, int on)
+{
+    int rc;
+
+    lock_db(db, false);
+    rc = chidb_Pager_setCompression(db->bt->pager, on != 0);
+    unlock_db(db);
+
+    return rc;
+}
+
+int chidb_set_journal_mode(chidb *db, int mode)
+{
+    if (mode != CHIDB_JOURNAL_ROLLBACK && mode != CHIDB_JOURNAL_WAL)
+        return CHIDB_EMISUSE;
+    if (db->bt->pager->in_txn)
+        return CHIDB_EMISUSE;
+
+    return chidb_Btree_setWal(db->bt, mode == CHIDB_JOURNAL_WAL);
+}
+
+int chidb_checkpoint(chidb *db)
+{
+    int rc;
+
+    lock_db(db, false);
+    rc = chidb_Pager_checkpoint(db->bt->pager);
+    unlock_db(db);
+
+    return rc;
+}
+
+int chidb_incremental_vacuum(chidb *db, int npages)
+{
+    npage_t *roots;
+    uint32_t nroots = 0, nremoved;
+    int rc = CHIDB_OK;
+
+    lock_db(db, false);
+
+    if (db->bt->pager->in_txn)
+        rc = CHIDB_EMISUSE;
+    else if (db->need_refresh)
+        rc = load_schema(db, 1);
+
+    // The schema table, and every table and index in it
+    if (rc == CHIDB_OK && (roots = malloc((list_size(&db->schemas) + 1) * sizeof(npage_t))) == NULL)
+        rc = CHIDB_ENOMEM;
+    if (rc == CHIDB_OK)
+    {
+        roots[nroots++] = 1;
+        list_iterator_start(&db->schemas);
+        while (list_iterator_hasnext(&db->schemas))
+            roots[nroots++] = ((chidb_sql_schema_t *) list_iterator_next(&db->schemas))->rpage;
+        list_iterator_stop(&db->schemas);
+
+        rc = chidb_Btree_vacuum(db->bt, roots, nroots, npages > 0 ? npages : 0, &nremoved);
+        free(roots);
+        chidb_result_cache_written_all(db);
+    }
+
+    unlock_db(db);
+
+    return rc;
+}
+
+/* Rebuild the file (the VACUUM statement)
+ *
+ * Every table and index is copied, in key order, into a new file (see
+ * chidb_Btree_copy), along with a schema table that refers to the new
+ * roots. The new file is then copied over the old one, in a transaction,
+ * and the old one is cut down to size. Called by Op_Vacuum, with the
+ * handle already locked.
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_EMISUSE: There is an open transaction, or there are statements
+ *                  that have not been finalized or reset
+ * - CHIDB_ECANTOPEN: The new file could not be created
+ * - Any error from reading the old file or writing either file
+ */
+int vacuum_database(chidb *db)
+{
+    Pager *pager = db->bt->pager;
+    chidb tmp;
+    BTree *newbt;
+    char *fname;
+    chidb_key_t key = 0;
+    int rc = CHIDB_OK;
+
+    if (pager->in_txn || chidb_Pager_hasPinnedFrames(pager))
+        return CHIDB_EMISUSE;
+    if (db->need_refresh && (rc = load_schema(db, 1)) != CHIDB_OK)
+        return rc;
+
+    // an in-memory database is copied into another one
+    if ((fname = malloc(strlen(pager->filename) + sizeof("-vacuum"))) == NULL)
+        return CHIDB_ENOMEM;
+    sprintf(fname, "%s%s", pager->filename, pager->memory ? "" : "-vacuum");
+    if (!pager->memory)
+        unlink(fname);
+
+    if ((rc = chidb_Btree_open(fname, &tmp, &newbt)) != CHIDB_OK)
+    {
+        free(fname);
+        return rc;
+    }
+    rc = chidb_Btree_setPageSize(newbt, pager->page_size);
+
+    list_iterator_start(&db->schemas);
+    while (rc == CHIDB_OK && list_iterator_hasnext(&db->schemas))
+    {
+        chidb_sql_schema_t *schema = list_iterator_next(&db->schemas);
+        DBRecordBuffer dbrb;
+        DBRecord *dbr;
+        uint8_t *data;
+        npage_t nroot;
+
+        if ((rc = chidb_Btree_copy(db->bt, schema->rpage, newbt, &nroot)) != CHIDB_OK)
+            break;
+
+        chidb_DBRecord_create_empty(&dbrb, 5);
+        chidb_DBRecord_appendString(&dbrb, schema->type);
+        chidb_DBRecord_appendString(&dbrb, schema->name);
+        chidb_DBRecord_appendString(&dbrb, schema->assoc);
+        chidb_DBRecord_appendInt32(&dbrb, nroot);
+        chidb_DBRecord_appendString(&dbrb, schema->sql);
+        chidb_DBRecord_finalize(&dbrb, &dbr);
+        if ((rc = chidb_DBRecord_pack(dbr, &data)) == CHIDB_OK)
+        {
+            rc = chidb_Btree_insertInTable(newbt, 1, ++key, data, dbr->packed_len);
+            free(data);
+        }
+        chidb_DBRecord_destroy(dbr);
+    }
+    list_iterator_stop(&db->schemas);
+
+    if (rc == CHIDB_OK)
+        rc = chidb_Btree_replace(db->bt, newbt);
+
+    chidb_Btree_close(newbt);
+    if (!pager->memory)
+        unlink(fname);
+    free(fname);
+
+    // The roots have moved, so everything derived from the schema goes
+    if (rc == CHIDB_OK)
+        rc = reload_schema(db);
+    chidb_stats_free(db);
+
+    return rc;
+}
+
+/* Attach a database file under a name (see ATTACH)
+ *
+ * The file is opened as a database handle of its own, with its own
+ * pager and buffer pool, and its tables can be read as name.table from
+ * then on. They are not written to: a statement that would change an
+ * attached database is not valid (see chidb_stmt_codegen). Called by
+ * Op_Attach, with the handle already locked.
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_EMISUSE: The name is main, or another database is already
+ *                  attached as it
+ * - CHIDB_ENOMEM: Could not allocate memory
+ * - Any error from chidb_open
+ */
+int attach_database(chidb *db, const char *file, const char *name)
+{
+    chidb_attached_t *attached;
+    chidb *adb;
+    int rc;
+
+    if (strcasecmp(name, "main") == 0)
+        return CHIDB_EMISUSE;
+    for (uint32_t i = 0; i < db->nattached; i++)
+        if (strcasecmp(db->attached[i].name, name) == 0)
+            return CHIDB_EMISUSE;
+
+    if ((attached = realloc(db->attached, (db->nattached + 1) * sizeof(chidb_attached_t))) == NULL)
+        return CHIDB_ENOMEM;
+    db->attached = attached;
+
+    if ((rc = chidb_open(file, &adb)) != CHIDB_OK)
+        return rc;
+    if ((attached[db->nattached].name = strdup(name)) == NULL)
+    {
+        chidb_close(adb);
+        return CHIDB_ENOMEM;
+    }
+    if (db->threadsafe)
+        chidb_Pager_setThreadsafe(adb->bt->pager, true);
+    attached[db->nattached++].db = adb;
+
+    // A name in a statement compiled before now may mean another table
+    chidb_stmt_cache_clear(&db->stmt_cache);
+    chidb_result_cache_written_all(db);
+
+    return CHIDB_OK;
+}
+
+/* Close a database attached by attach_database. Called by Op_Detach,
+ * with the handle already locked.
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_EMISUSE: No database is attached as name, or statements that
+ *                  have not been finalized or reset are reading it
+ */
+int detach_database(chidb *db, const char *name)
+{
+    for (uint32_t i = 0; i < db->nattached; i++)
+    {
+        chidb *adb = db->attached[i].db;
+
+        if (strcasecmp(db->attached[i].name, name) != 0)
+            continue;
+        if (chidb_Pager_hasPinnedFrames(adb->bt->pager))
+            return CHIDB_EMISUSE;
+
+        chidb_close(adb);
+        free(db->attached[i].name);
+        memmove(&db->attached[i], &db->attached[i + 1], (db->nattached - i - 1) * sizeof(chidb_attached_t));
+        db->nattached--;
+
+        chidb_stmt_cache_clear(&db->stmt_cache);
+        chidb_result_cache_written_all(db);
+        return CHIDB_OK;
+    }
+
+    return CHIDB_EMISUSE;
+}
+
+/* An online backup (see chidb_backup_init) */
+struct chidb_backup
+{
+    chidb *src;
+    Pager *dst;
+    npage_t next;           /* First page that has not been copied yet */
+};
+
+/* Copy a page of the source over the same page of the destination,
+ * which grows to have it if need be */
+static int backup_page(chidb_backup *backup, npage_t npage)
+{
+    Pager *src = backup->src->bt->pager, *dst = backup->dst;
+    MemPage *from, *to;
+    npage_t n;
+    int rc;
+
+    while (dst->n_pages < npage)
+        if ((rc = chidb_Pager_allocatePage(dst, &n)) != CHIDB_OK)
+            return rc;
+
+    if ((rc = chidb_Pager_readPage(src, npage, &from)) != CHIDB_OK)
+        return rc;
+    if ((rc = chidb_Pager_readPage(dst, npage, &to)) != CHIDB_OK)
+    {
+        chidb_Pager_releaseMemPage(src, from);
+        return rc;
+    }
+    memcpy(to->data, from->data, dst->page_size);
+    rc = chidb_Pager_writePage(dst, to);
+    chidb_Pager_releaseMemPage(dst, to);
+    chidb_Pager_releaseMemPage(src, from);
+
+    return rc;
+}
+
+int chidb_backup_init(chidb *src, const char *file, chidb_backup **backup)
+{
+    Pager *pager = src->bt->pager;
+    struct stat a, b;
+    int rc;
+
+    // a backup over the database itself would wipe it out
+    if (pager->f != NULL && stat(file, &a) == 0 && fstat(fileno(pager->f), &b) == 0
+            && a.st_dev == b.st_dev && a.st_ino == b.st_ino)
+        return CHIDB_EMISUSE;
+
+    if ((*backup = malloc(sizeof(chidb_backup))) == NULL)
+        return CHIDB_ENOMEM;
+    (*backup)->src = src;
+    (*backup)->next = 1;
+    if ((rc = chidb_Pager_open(&(*backup)->dst, file)) != CHIDB_OK)
+    {
+        free(*backup);
+        return rc;
+    }
+
+    // the destination starts out empty
+    lock_db(src, false);
+    if ((rc = chidb_Pager_trackChanges(pager, true)) == CHIDB_OK)
+    {
+        if ((rc = chidb_Pager_setPageSize((*backup)->dst, pager->page_size)) == CHIDB_OK)
+            rc = chidb_Pager_truncate((*backup)->dst, 0);
+        if (rc != CHIDB_OK)
+            chidb_Pager_trackChanges(pager, false);
+    }
+    unlock_db(src);
+
+    if (rc != CHIDB_OK)
+    {
+        chidb_Pager_close((*backup)->dst);
+        free(*backup);
+    }
+
+    return rc;
+}
+
+int chidb_backup_step(chidb_backup *backup, int npages)
+{
+    Pager *src = backup->src->bt->pager, *dst = backup->dst;
+    int rc = CHIDB_OK, n = 0;
+
+    lock_db(backup->src, false);
+
+    // the pages written by a transaction are copied once it is over
+    if (src->in_txn)
+    {
+        unlock_db(backup->src);
+        return CHIDB_EBUSY;
+    }
+
+    // the page size changes only while the source is empty, and the
+    // source can also shrink (e.g., after a VACUUM)
+    if (dst->page_size != src->page_size)
+    {
+        if ((rc = chidb_Pager_truncate(dst, 0)) == CHIDB_OK)
+            rc = chidb_Pager_setPageSize(dst, src->page_size);
+        backup->next = 1;
+    }
+    if (backup->next > src->n_pages + 1)
+        backup->next = src->n_pages + 1;
+
+    // first the pages that were copied, and have been written since
+    for (npage_t i = 1; rc == CHIDB_OK && i < backup->next && (npages <= 0 || n < npages); i++)
+        if (chidb_Pager_takeChange(src, i))
+        {
+            rc = backup_page(backup, i);
+            n++;
+        }
+
+    // then the ones that were not copied yet
+    while (rc == CHIDB_OK && backup->next <= src->n_pages && (npages <= 0 || n < npages))
+    {
+        chidb_Pager_takeChange(src, backup->next);
+        if ((rc = backup_page(backup, backup->next)) == CHIDB_OK)
+            backup->next++;
+        n++;
+    }
+
+    if (rc == CHIDB_OK && backup->next > src->n_pages && chidb_Pager_countChanges(src, src->n_pages) == 0)
+    {
+        if (dst->n_pages > src->n_pages)
+            rc = chidb_Pager_truncate(dst, src->n_pages);
+        if (rc == CHIDB_OK && (rc = chidb_Pager_flush(dst)) == CHIDB_OK)
+            rc = dst->file->methods->sync(dst->file);
+        if (rc == CHIDB_OK)
+            rc = CHIDB_DONE;
+    }
+
+    // the pages whose changes were taken may not have been copied
+    if (rc != CHIDB_OK && rc != CHIDB_DONE)
+        backup->next = 1;
+
+    unlock_db(backup->src);
+
+    return rc;
+}
+
+int chidb_backup_remaining(chidb_backup *backup)
+{
+    Pager *src = backup->src->bt->pager;
+    npage_t n;
+
+    lock_db(backup->src, false);
+    if (backup->next > src->n_pages)
+        n = chidb_Pager_countChanges(src, src->n_pages);
+    else
+        n = src->n_pages - backup->next + 1 + chidb_Pager_countChanges(src, backup->next - 1);
+    unlock_db(backup->src);
+
+    return n;
+}
+
+int chidb_backup_finish(chidb_backup *backup)
+{
+    int rc;
+
+    lock_db(backup->src, false);
+    chidb_Pager_trackChanges(backup->src->bt->pager, false);
+    unlock_db(backup->src);
+
+    rc = chidb_Pager_close(backup->dst);
+    free(backup);
+
+    return rc;
+}
+
+int chidb_set_threadsafe(chidb *db, int on)
+{
+    db->threadsafe = on != 0;
+    for (uint32_t i = 0; i < db->nattached; i++)
+        chidb_Pager_setThreadsafe(db->attached[i].db->bt->pager, on != 0);
+
+    return chidb_Pager_setThreadsafe(db->bt->pager, on != 0);
+}
+
+int chidb_set_commit_delay(chidb *db, int usec)
+{
+    if (usec < 0)
+        return CHIDB_EMISUSE;
+
+    return chidb_Pager_setCommitDelay(db->bt->pager, (uint32_t) usec);
+}
+
+int chidb_stats(chidb *db, chidb_counters_t *counters, int reset)
+{
+    lock_db(db, false);
+
+    PagerStats *ps = &db->bt->pager->stats;
+    BTreeStats *bs = &db->bt->stats;
+
+    counters->page_reads = ps->reads;
+    counters->page_writes = ps->writes;
+    counters->cache_hits = ps->hits;
+    counters->cache_misses = ps->misses;
+    counters->bytes_read = ps->bytes_read;
+    counters->bytes_written = ps->bytes_written;
+    counters->splits = bs->splits;
+    counters->pages_allocated = bs->allocated;
+    counters->cursor_seeks = bs->seeks;
+    counters->cursor_steps = bs->steps;
+    counters->records_packed = bs->packed;
+    counters->records_unpacked = bs->unpacked;
+
+    if (reset)
+    {
+        memset(ps, 0, sizeof(PagerStats));
+        memset(bs, 0, sizeof(BTreeStats));
+    }
+
+    unlock_db(db);
+
+    return CHIDB_OK;
+}
+
+int chidb_latency_snapshot(chidb *db, chidb_latency_t latency[CHIDB_LATENCY_KINDS][CHIDB_LATENCY_PHASES], int reset)
+{
+    lock_db(db, false);
+
+    memcpy(latency, db->latency, sizeof(db->latency));
+    if (reset)
+        memset(db->latency, 0, sizeof(db->latency));
+
+    unlock_db(db);
+
+    return CHIDB_OK;
+}
+
+int chidb_memory_status(chidb *db, chidb_memory_status_t *status, int reset)
+{
+    size_t held[CHIDB_MEMORY_KINDS];
+
+    lock_db(db, false);
+
+    for (int kind = 0; kind < CHIDB_MEMORY_KINDS; kind++)
+        held[kind] = __atomic_load_n(&db->memory.held[kind], __ATOMIC_RELAXED);
+    status->limit = db->memory.limit;
+    status->used = chidb_memory_used(db, &status->page_cache, &status->results);
+    status->sorters = held[CHIDB_MEMORY_SORTERS];
+    status->hash_tables = held[CHIDB_MEMORY_HASHES];
+    if (reset || status->used > db->memory.peak)
+        db->memory.peak = status->used;
+    status->peak = db->memory.peak;
+
+    unlock_db(db);
+
+    return CHIDB_OK;
+}
+
+int chidb_set_io_backend(chidb *db, int backend)
+{
+    int rc;
+
+    lock_db(db, false);
+    rc = chidb_Pager_setBackend(db->bt->pager, backend);
+    unlock_db(db);
+
+    return rc;
+}
+
+int chidb_set_preallocation(chidb *db, int npages)
+{
+    int rc;
+
+    if (npages < 0)
+        return CHIDB_EMISUSE;
+
+    lock_db(db, false);
+    rc = chidb_Pager_setPreallocation(db->bt->pager, (uint32_t) npages);
+    unlock_db(db);
+
+    return rc;
+}
@@ -0,0 +1,240 @@
+/*
+ *  chidb - a didactic relational database management system
+ *
+ *  Cell accessors specialized by page type
+ *
+ */
+
+
+/*
+ *  Copyright (c) 2009-2015, The University of Chicago
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or withsend
+ *  modification, are permitted provided that the following conditions are met:
+ *
+ *  - Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ *  - Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ *  - Neither the name of The University of Chicago nor the names of its
+ *    contributors may be used to endorse or promote products derived from this
+ *    software withsend specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ *  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ *  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ *  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ *  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ *  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ *  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ *  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ *  ARISING IN ANY WAY send OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ *  POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+#ifndef BTREE_CELL_H_
+#define BTREE_CELL_H_
+
+#include "chidbInt.h"
+#include "btree.h"
+#include "util.h"
+
+/* chidb_Btree_getCell decodes every field of a cell of any type, which is
+ * more than most callers need: a descent only compares keys and then
+ * follows one child pointer. The accessors below are specialized by page
+ * type, so that they do not switch on it, and each reads one field of
+ * the cell straight from the page. They are generated from the offsets
+ * in btree.h:
+ *
+ *   chidb_Btree_<type>Key(btn, i)    Key of cell i (all four types)
+ *   chidb_Btree_<type>Child(btn, i)  Child page of cell i (internal nodes)
+ *   chidb_Btree_<type>Pk(btn, i)     Primary key of cell i (index nodes)
+ *   chidb_Btree_<type>Search(btn, k) First cell with a key >= k
+ *   chidb_Btree_<type>SearchPk(btn, k, pk)
+ *                                    First cell at or after the entry
+ *                                    (k, pk) (index nodes)
+ *
+ * where <type> is tableInternal, tableLeaf, indexInternal or indexLeaf,
+ * and the caller must know that btn is a node of that type and that i is
+ * a valid cell number. chidb_Btree_<type>Cell(btn, i, cell) decodes the
+ * whole cell, as chidb_Btree_getCell does, and chidb_Btree_tableLeafPayload
+ * only finds the data of a table leaf cell.
+ */
+
+
+/* Read and write the keys in cells
+ *
+ * Keys are written in the size used by the node they are in (see
+ * KEYSIZE_NARROW). Four-byte table keys are varints, and four-byte index
+ * keys are sign-extended, so that they compare with eight-byte keys
+ * (e.g., those of the DBM's registers) as they did when they were written.
+ */
+static inline chidb_key_t chidb_Btree_getTableKey(uint8_t key_size, const uint8_t *p)
+{
+    uint32_t key;
+
+    if (key_size == KEYSIZE_WIDE)
+        return get8byte(p);
+    getVarint32(p, &key);
+    return key;
+}
+
+static inline void chidb_Btree_putTableKey(uint8_t key_size, uint8_t *p, chidb_key_t key)
+{
+    if (key_size == KEYSIZE_WIDE)
+        put8byte(p, key);
+    else
+        putVarint32(p, (uint32_t) key);
+}
+
+static inline chidb_key_t chidb_Btree_getIndexKey(uint8_t key_size, const uint8_t *p)
+{
+    if (key_size == KEYSIZE_WIDE)
+        return get8byte(p);
+    return (chidb_key_t) (int64_t) (int32_t) get4byte(p);
+}
+
+static inline void chidb_Btree_putIndexKey(uint8_t key_size, uint8_t *p, chidb_key_t key)
+{
+    if (key_size == KEYSIZE_WIDE)
+        put8byte(p, key);
+    else
+        put4byte(p, (uint32_t) key);
+}
+
+
+/* Start of cell i of a node, in its in-memory page */
+static inline uint8_t *chidb_Btree_cellAt(BTreeNode *btn, ncell_t i)
+{
+    return btn->page->data + get2byte(btn->celloffset_array + i*2);
+}
+
+
+/* The offsets of primary keys depend on the key size of the node, ks */
+#define BTREE_CELL_KEY(type, offset, getkey)                                 \
+    static inline chidb_key_t chidb_Btree_##type##Key(BTreeNode *btn, ncell_t i) \
+    {                                                                        \
+        return getkey(btn->key_size, chidb_Btree_cellAt(btn, i) + (offset)); \
+    }
+
+#define BTREE_CELL_CHILD(type, offset)                                       \
+    static inline npage_t chidb_Btree_##type##Child(BTreeNode *btn, ncell_t i) \
+    {                                                                        \
+        return get4byte(chidb_Btree_cellAt(btn, i) + (offset));              \
+    }
+
+#define BTREE_CELL_PK(type, offset)                                          \
+    static inline chidb_key_t chidb_Btree_##type##Pk(BTreeNode *btn, ncell_t i) \
+    {                                                                        \
+        uint8_t ks = btn->key_size;                                          \
+        return chidb_Btree_getIndexKey(ks, chidb_Btree_cellAt(btn, i) + (offset)); \
+    }
+
+#define BTREE_CELL_SEARCH(type)                                              \
+    static inline ncell_t chidb_Btree_##type##Search(BTreeNode *btn, chidb_key_t key) \
+    {                                                                        \
+        ncell_t lo = 0, hi = btn->n_cells;                                   \
+                                                                             \
+        while (lo < hi) {                                                    \
+            ncell_t mid = lo + (hi - lo) / 2;                                \
+                                                                             \
+            if (chidb_Btree_##type##Key(btn, mid) < key)                     \
+                lo = mid + 1;                                                \
+            else                                                             \
+                hi = mid;                                                    \
+        }                                                                    \
+                                                                             \
+        return lo;                                                           \
+    }
+
+#define BTREE_CELL_SEARCH_PK(type)                                           \
+    static inline ncell_t chidb_Btree_##type##SearchPk(BTreeNode *btn, chidb_key_t key, chidb_key_t pk) \
+    {                                                                        \
+        ncell_t lo = 0, hi = btn->n_cells;                                   \
+                                                                             \
+        while (lo < hi) {                                                    \
+            ncell_t mid = lo + (hi - lo) / 2;                                \
+            chidb_key_t k = chidb_Btree_##type##Key(btn, mid);               \
+                                                                             \
+            if (k < key || (k == key && chidb_Btree_##type##Pk(btn, mid) < pk)) \
+                lo = mid + 1;                                                \
+            else                                                             \
+                hi = mid;                                                    \
+        }                                                                    \
+                                                                             \
+        return lo;                                                           \
+    }
+
+BTREE_CELL_KEY(tableInternal, TABLEINTCELL_KEY_OFFSET, chidb_Btree_getTableKey)
+BTREE_CELL_KEY(tableLeaf, TABLELEAFCELL_KEY_OFFSET, chidb_Btree_getTableKey)
+BTREE_CELL_KEY(indexInternal, INDEXINTCELL_KEYIDX_OFFSET, chidb_Btree_getIndexKey)
+BTREE_CELL_KEY(indexLeaf, INDEXLEAFCELL_KEYIDX_OFFSET, chidb_Btree_getIndexKey)
+
+BTREE_CELL_CHILD(tableInternal, TABLEINTCELL_CHILD_OFFSET)
+BTREE_CELL_CHILD(indexInternal, INDEXINTCELL_CHILD_OFFSET)
+
+BTREE_CELL_PK(indexInternal, INDEXINTCELL_KEYPK_OFFSET(ks))
+BTREE_CELL_PK(indexLeaf, INDEXLEAFCELL_KEYPK_OFFSET(ks))
+
+BTREE_CELL_SEARCH(tableInternal)
+BTREE_CELL_SEARCH(tableLeaf)
+BTREE_CELL_SEARCH(indexInternal)
+BTREE_CELL_SEARCH(indexLeaf)
+
+BTREE_CELL_SEARCH_PK(indexInternal)
+BTREE_CELL_SEARCH_PK(indexLeaf)
+
+
+/* Data of cell i of a table leaf: the total size of the data in *size,
+ * and the number of bytes of it kept in the page in *local */
+static inline uint8_t *chidb_Btree_tableLeafPayload(BTreeNode *btn, ncell_t i, uint32_t *size, uint32_t *local)
+{
+    uint8_t *cell = chidb_Btree_cellAt(btn, i);
+
+    getVarint32(cell + TABLELEAFCELL_SIZE_OFFSET, size);
+    *local = chidb_Btree_localSize(btn->page->size, btn->key_size, *size);
+    return cell + TABLELEAFCELL_DATA_OFFSET(btn->key_size);
+}
+
+
+/* Whole cells, decoded as chidb_Btree_getCell does */
+static inline void chidb_Btree_tableInternalCell(BTreeNode *btn, ncell_t i, BTreeCell *cell)
+{
+    cell->type = PGTYPE_TABLE_INTERNAL;
+    cell->key = chidb_Btree_tableInternalKey(btn, i);
+    cell->fields.tableInternal.child_page = chidb_Btree_tableInternalChild(btn, i);
+}
+
+static inline void chidb_Btree_tableLeafCell(BTreeNode *btn, ncell_t i, BTreeCell *cell)
+{
+    cell->type = PGTYPE_TABLE_LEAF;
+    cell->key = chidb_Btree_tableLeafKey(btn, i);
+    cell->fields.tableLeaf.data = chidb_Btree_tableLeafPayload(btn, i, &cell->fields.tableLeaf.data_size,
+                                                               &cell->fields.tableLeaf.local_size);
+    cell->fields.tableLeaf.overflow = 0;
+    if (cell->fields.tableLeaf.local_size < cell->fields.tableLeaf.data_size)
+        cell->fields.tableLeaf.overflow = get4byte(cell->fields.tableLeaf.data + cell->fields.tableLeaf.local_size);
+}
+
+static inline void chidb_Btree_indexInternalCell(BTreeNode *btn, ncell_t i, BTreeCell *cell)
+{
+    cell->type = PGTYPE_INDEX_INTERNAL;
+    cell->key = chidb_Btree_indexInternalKey(btn, i);
+    cell->fields.indexInternal.keyPk = chidb_Btree_indexInternalPk(btn, i);
+    cell->fields.indexInternal.child_page = chidb_Btree_indexInternalChild(btn, i);
+}
+
+static inline void chidb_Btree_indexLeafCell(BTreeNode *btn, ncell_t i, BTreeCell *cell)
+{
+    cell->type = PGTYPE_INDEX_LEAF;
+    cell->key = chidb_Btree_indexLeafKey(btn, i);
+    cell->fields.indexLeaf.keyPk = chidb_Btree_indexLeafPk(btn, i);
+}
+
+#endif /* BTREE_CELL_H_ */
@@ -51,12 +51,15 @@
 #include <chidb/log.h>
 #include "chidbInt.h"
 #include "btree.h"
+#include "btree-cell.h"
 #include "record.h"
 #include "pager.h"
 #include "util.h"
 
 #include <sys/stat.h>
 
+static int chidb_Btree_writePage(BTree *bt, MemPage *page);
+
 /* Open a B-Tree file
  *
  * This function opens a database file and verifies that the file
@@ -85,12 +88,12 @@ int chidb_Btree_open(const char *filename, chidb *db, BTree **bt)
 
     int status;
     Pager *pager;
-    struct stat buf;
+    off_t size = 0;
     npage_t npage;
     uint8_t pos[100];
-    uint16_t page_size;
+    uint32_t page_size;
 
-    uint8_t h12[] = {0x01,0x01,0x00,0x40,0x20,0x20};
+    uint8_t h14[] = {0x00,0x40,0x20,0x20};
     uint8_t h0[] = {0,0,0,0};
     uint8_t h1[] = {0,0,0,1};
 
@@ -106,11 +109,19 @@ int chidb_Btree_open(const char *filename, chidb *db, BTree **bt)
 
     (*bt)->pager = pager;
     (*bt)->db = db;
+    (*bt)->append_root = 0;
+    memset(&(*bt)->stats, 0, sizeof(BTreeStats));
+    (*bt)->append_leaf = 0;
+    (*bt)->last_root = 0;
+    (*bt)->insert_dir = 0;
+    (*bt)->key_size = KEYSIZE_WIDE;
+    memset((*bt)->decoded, 0, sizeof((*bt)->decoded));
     db->bt = *bt;
 
-    fstat(fileno(pager->f), &buf);
+    // The size the pages take up (a compressed file is never empty)
+    pager->file->methods->size(pager->file, &size);
 
-    if (!buf.st_size) {
+    if (!size) {
         //Newly created file
         //Need to initialize
 
@@ -130,10 +141,10 @@ int chidb_Btree_open(const char *filename, chidb *db, BTree **bt)
         }
 
         if (!memcmp(pos, "SQLite format 3", 16) &&
-            !memcmp(&pos[0x12], h12, 6) &&
-            !memcmp(&pos[0x20], h0, 4) &&
-            !memcmp(&pos[0x24], h0, 4) &&
-            !memcmp(&pos[0x2c], h1, 4) &&
+            (pos[0x12] == 0x01 || pos[0x12] == 0x02) && pos[0x13] == pos[0x12] &&
+            !memcmp(&pos[0x14], h14, 4) &&
+            !memcmp(&pos[0x2c], h0, 3) &&
+            (pos[0x2f] == FILEFORMAT_NARROW_KEYS || pos[0x2f] == FILEFORMAT_WIDE_KEYS) &&
             !memcmp(&pos[0x34], h0, 4) &&
             !memcmp(&pos[0x38], h1, 4) &&
             !memcmp(&pos[0x40], h0, 4) &&
@@ -141,9 +152,16 @@ int chidb_Btree_open(const char *filename, chidb *db, BTree **bt)
             //Header is accurate
             //Read out page size
 
-            page_size = get2byte(&pos[0x10]);
+            page_size = FILEHEADER_GET_PAGE_SIZE(pos);
+            if (!VALID_PAGE_SIZE(page_size))
+                return CHIDB_ECORRUPTHEADER;
             chidb_Pager_setPageSize(pager, page_size);
 
+            (*bt)->key_size = (pos[0x2f] == FILEFORMAT_WIDE_KEYS) ? KEYSIZE_WIDE : KEYSIZE_NARROW;
+
+            if (pos[0x12] == 0x02 && (status = chidb_Pager_setWal(pager, true)) != CHIDB_OK)
+                return status;
+
         } else {
             return CHIDB_ECORRUPTHEADER;
         }
@@ -171,10 +189,118 @@ int chidb_Btree_open(const char *filename, chidb *db, BTree **bt)
 int chidb_Btree_close(BTree *bt)
 {
     // fprintf(stderr, "IN CLOSE\n");
-    chidb_Pager_close(bt->pager);
+    int status = chidb_Pager_close(bt->pager);
+
+    for (int i = 0; i < BTREE_DECODED_SLOTS; i++)
+        free(bt->decoded[i].keys);
     free(bt);
 
-    return CHIDB_OK;
+    return status;
+}
+
+
+/* Switch a B-Tree file between rollback journal mode and WAL mode
+ *
+ * See chidb_Pager_setWal. The mode is recorded in the file header
+ * (bytes 0x12 and 0x13, which are 2 in WAL mode and 1 otherwise), so
+ * the file is opened in the same mode from then on. The header is
+ * always written to the file itself (not to the log), since that is
+ * where chidb_Btree_open reads it from.
+ *
+ * Parameters
+ * - bt: B-Tree file
+ * - on: true to switch to WAL mode
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - Any error from chidb_Pager_setWal
+ * - CHIDB_EIO: An I/O error has occurred when accessing the file
+ */
+int chidb_Btree_setWal(BTree *bt, bool on)
+{
+    MemPage *page;
+    int status;
+
+    if (on == (bt->pager->wal != NULL))
+        return CHIDB_OK;
+
+    /* Out of WAL mode first, so the header goes to the file */
+    if (!on && (status = chidb_Pager_setWal(bt->pager, false)) != CHIDB_OK)
+        return status;
+
+    if ((status = chidb_Pager_readPage(bt->pager, 1, &page)) != CHIDB_OK)
+        return status;
+    page->data[0x12] = page->data[0x13] = on ? 0x02 : 0x01;
+    status = chidb_Btree_writePage(bt, page);
+    chidb_Pager_releaseMemPage(bt->pager, page);
+
+    if (status == CHIDB_OK)
+        status = chidb_Pager_flush(bt->pager);
+
+    if (status == CHIDB_OK && on)
+        status = chidb_Pager_setWal(bt->pager, true);
+
+    return status;
+}
+
+
+/* Change the page size of an empty B-Tree file
+ *
+ * The page size can only change while the file has nothing but an empty
+ * page 1 (i.e., before any table is created), since every page would
+ * otherwise have to be rewritten. The file is truncated, and page 1 is
+ * written again with the new page size in the header. The memory
+ * mapping, if any, is set up again for the new page size.
+ *
+ * Parameters
+ * - bt: B-Tree file
+ * - page_size: New page size. A power of two from MIN_PAGE_SIZE to
+ *              MAX_PAGE_SIZE.
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_EMISUSE: The page size is not valid, the file is not empty,
+ *                  the file is in WAL mode, there is a transaction, or
+ *                  there are pinned pages
+ * - CHIDB_ENOMEM: Could not allocate memory
+ * - CHIDB_EIO: An I/O error has occurred when accessing the file
+ */
+int chidb_Btree_setPageSize(BTree *bt, uint32_t page_size)
+{
+    Pager *pager = bt->pager;
+    BTreeNode *root;
+    size_t map_size = pager->map_size;
+    npage_t npage;
+    bool empty;
+    int status;
+
+    if (!VALID_PAGE_SIZE(page_size) || pager->in_txn || pager->wal != NULL
+            || chidb_Pager_hasPinnedFrames(pager))
+        return CHIDB_EMISUSE;
+    if (page_size == pager->page_size)
+        return CHIDB_OK;
+    if (pager->n_pages != 1)
+        return CHIDB_EMISUSE;
+
+    if ((status = chidb_Btree_getNodeByPage(bt, 1, &root)) != CHIDB_OK)
+        return status;
+    empty = root->type == PGTYPE_TABLE_LEAF && root->n_cells == 0;
+    chidb_Btree_freeMemNode(bt, root);
+    if (!empty)
+        return CHIDB_EMISUSE;
+
+    if ((status = chidb_Pager_setMmapSize(pager, 0)) != CHIDB_OK
+            || (status = chidb_Pager_truncate(pager, 0)) != CHIDB_OK
+            || (status = chidb_Pager_setPageSize(pager, page_size)) != CHIDB_OK
+            || (status = chidb_Btree_newNode(bt, &npage, PGTYPE_TABLE_LEAF)) != CHIDB_OK
+            || (status = chidb_Pager_flush(pager)) != CHIDB_OK)
+        return status;
+
+    bt->append_root = 0;
+    bt->append_leaf = 0;
+    bt->last_root = 0;
+
+    return map_size > 0 ? chidb_Pager_setMmapSize(pager, map_size) : CHIDB_OK;
 }
 
 
@@ -203,29 +329,52 @@ int chidb_Btree_getNodeByPage(BTree *bt, npage_t npage, BTreeNode **btn)
 {
 
     int status;
-    uint8_t *dat;
+    MemPage *page;
 
     if (!(*btn = (BTreeNode *) malloc(sizeof(BTreeNode)))) {
         return CHIDB_ENOMEM;
     }
 
-    if ((status = chidb_Pager_readPage(bt->pager, npage, &(*btn)->page)) != CHIDB_OK) {
+    if ((status = chidb_Pager_readPage(bt->pager, npage, &page)) != CHIDB_OK) {
+        free(*btn);
         return status;
     }
 
-    dat = (*btn)->page->data + ((npage == 1) ? 100 : 0);
-
-    (*btn)->type = *dat;
-    (*btn)->free_offset = get2byte(dat + 1);
-    (*btn)->n_cells = get2byte(dat + 3);
-    (*btn)->cells_offset = get2byte(dat + 5);
-    (*btn)->right_page = (((*btn)->type == 0x05) || ((*btn)->type == 0x02)) ? get4byte(dat+8) : 0;
-    (*btn)->celloffset_array = dat + ((((*btn)->type == 0x05) || ((*btn)->type == 0x02)) ? 12 : 8);
+    chidb_Btree_loadNode(page, *btn);
 
     return CHIDB_OK;
 }
 
 
+/* Fill in a BTreeNode from an in-memory page
+ *
+ * Parses the page header of an in-memory page into a BTreeNode struct
+ * provided by the caller. Unlike chidb_Btree_getNodeByPage, this does not
+ * allocate anything, so it can be used with a BTreeNode on the stack.
+ * The BTreeNode is only valid for as long as the page is.
+ *
+ * Parameters
+ * - page: In-memory page returned by the Pager
+ * - btn: BTreeNode to fill in
+ */
+void chidb_Btree_loadNode(MemPage *page, BTreeNode *btn)
+{
+    uint8_t *dat = page->data + ((page->npage == 1) ? 100 : 0);
+
+    btn->page = page;
+    btn->type = *dat;
+    btn->free_offset = get2byte(dat + 1);
+    btn->n_cells = get2byte(dat + 3);
+    btn->cells_offset = get2byte(dat + 5);
+    // A 64K page with no cells has its cells start at 65536, stored as 0
+    if (btn->cells_offset == 0)
+        btn->cells_offset = MAX_PAGE_SIZE;
+    btn->right_page = PGTYPE_IS_INTERNAL(btn->type) ? get4byte(dat+8) : 0;
+    btn->key_size = PGHEADER_GET_KEYSIZE(dat[PGHEADER_KEYSIZE_OFFSET]);
+    btn->celloffset_array = dat + (PGTYPE_IS_INTERNAL(btn->type) ? 12 : 8);
+}
+
+
 /* Frees the memory allocated to an in-memory B-Tree node
  *
  * Frees the memory allocated to an in-memory B-Tree node, and
@@ -253,9 +402,187 @@ int chidb_Btree_freeMemNode(BTree *bt, BTreeNode *btn)
 }
 
 
+/* Allocate a page
+ *
+ * A page is taken from the free list if there is any (see
+ * chidb_Btree_freePage). Otherwise, the file is extended. The contents
+ * of a reused page are left as they were, so the caller must initialize
+ * the whole page.
+ *
+ * Parameters
+ * - bt: B-Tree file
+ * - npage: Out parameter. Returns the number of the page.
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_ECORRUPT: The free list refers to an invalid page
+ * - CHIDB_EIO: An I/O error has occurred when accessing the file
+ */
+static int chidb_Btree_takePage(BTree *bt, npage_t *npage)
+{
+    MemPage *header, *trunk;
+    npage_t ntrunk;
+    uint32_t nfree, nleaves;
+    int status;
+
+    // a new file does not even have a header yet
+    if (bt->pager->n_pages == 0) {
+        return chidb_Pager_allocatePage(bt->pager, npage);
+    }
+
+    if ((status = chidb_Pager_readPage(bt->pager, 1, &header)) != CHIDB_OK) {
+        return status;
+    }
+
+    nfree = get4byte(header->data + FILEHEADER_NFREE_OFFSET);
+    ntrunk = get4byte(header->data + FILEHEADER_FREELIST_OFFSET);
+    if (nfree == 0 || ntrunk == 0) {
+        chidb_Pager_releaseMemPage(bt->pager, header);
+        return chidb_Pager_allocatePage(bt->pager, npage);
+    }
+
+    if (ntrunk > bt->pager->n_pages) {
+        chidb_Pager_releaseMemPage(bt->pager, header);
+        return CHIDB_ECORRUPT;
+    }
+    if ((status = chidb_Pager_readPage(bt->pager, ntrunk, &trunk)) != CHIDB_OK) {
+        chidb_Pager_releaseMemPage(bt->pager, header);
+        return status;
+    }
+
+    nleaves = get4byte(trunk->data + FREELISTPG_NLEAVES_OFFSET);
+    if (nleaves > 0) {
+        // the last page listed in the first trunk page
+        *npage = get4byte(trunk->data + FREELISTPG_LEAVES_OFFSET + (nleaves - 1) * 4);
+        put4byte(trunk->data + FREELISTPG_NLEAVES_OFFSET, nleaves - 1);
+        status = chidb_Btree_writePage(bt, trunk);
+    } else {
+        // an empty trunk page is a free page itself
+        *npage = ntrunk;
+        put4byte(header->data + FILEHEADER_FREELIST_OFFSET, get4byte(trunk->data + FREELISTPG_NEXT_OFFSET));
+    }
+    chidb_Pager_releaseMemPage(bt->pager, trunk);
+
+    if (status == CHIDB_OK && (*npage < 2 || *npage > bt->pager->n_pages)) {
+        status = CHIDB_ECORRUPT;
+    }
+
+    if (status == CHIDB_OK) {
+        put4byte(header->data + FILEHEADER_NFREE_OFFSET, nfree - 1);
+        status = chidb_Btree_writePage(bt, header);
+    }
+    chidb_Pager_releaseMemPage(bt->pager, header);
+
+    return status;
+}
+
+/* chidb_Btree_takePage, counting the pages allocated (see chidb_stats) */
+static int chidb_Btree_allocPage(BTree *bt, npage_t *npage)
+{
+    int status = chidb_Btree_takePage(bt, npage);
+
+    if (status == CHIDB_OK)
+        bt->stats.allocated++;
+
+    return status;
+}
+
+
+/* Give a page back
+ *
+ * The page is added to the free list, so that chidb_Btree_allocPage
+ * can hand it out again, instead of extending the file. It is listed
+ * in the first trunk page if that has room. Otherwise, the page itself
+ * becomes the first trunk page. The page must no longer be referred to
+ * by any B-Tree.
+ *
+ * Parameters
+ * - bt: B-Tree file
+ * - npage: Page to free
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_EPAGENO: The provided page number is not valid
+ * - CHIDB_EIO: An I/O error has occurred when accessing the file
+ */
+int chidb_Btree_freePage(BTree *bt, npage_t npage)
+{
+    MemPage *header, *page;
+    npage_t ntrunk;
+    uint32_t nleaves;
+    bool listed = false;
+    int status;
+
+    if (npage < 2 || npage > bt->pager->n_pages) {
+        return CHIDB_EPAGENO;
+    }
+
+    if (npage == bt->append_leaf) {
+        bt->append_leaf = 0;
+    }
+
+    if ((status = chidb_Pager_readPage(bt->pager, 1, &header)) != CHIDB_OK) {
+        return status;
+    }
+    ntrunk = get4byte(header->data + FILEHEADER_FREELIST_OFFSET);
+
+    if (ntrunk != 0 && (status = chidb_Pager_readPage(bt->pager, ntrunk, &page)) == CHIDB_OK) {
+        nleaves = get4byte(page->data + FREELISTPG_NLEAVES_OFFSET);
+        if (nleaves < FREELISTPG_MAXLEAVES(bt->pager->page_size)) {
+            put4byte(page->data + FREELISTPG_LEAVES_OFFSET + nleaves * 4, npage);
+            put4byte(page->data + FREELISTPG_NLEAVES_OFFSET, nleaves + 1);
+            status = chidb_Btree_writePage(bt, page);
+            listed = true;
+        }
+        chidb_Pager_releaseMemPage(bt->pager, page);
+    }
+
+    if (status == CHIDB_OK && !listed && (status = chidb_Pager_readPage(bt->pager, npage, &page)) == CHIDB_OK) {
+        put4byte(page->data + FREELISTPG_NEXT_OFFSET, ntrunk);
+        put4byte(page->data + FREELISTPG_NLEAVES_OFFSET, 0);
+        status = chidb_Btree_writePage(bt, page);
+        chidb_Pager_releaseMemPage(bt->pager, page);
+        put4byte(header->data + FILEHEADER_FREELIST_OFFSET, npage);
+    }
+
+    if (status == CHIDB_OK) {
+        put4byte(header->data + FILEHEADER_NFREE_OFFSET, get4byte(header->data + FILEHEADER_NFREE_OFFSET) + 1);
+        status = chidb_Btree_writePage(bt, header);
+    }
+    chidb_Pager_releaseMemPage(bt->pager, header);
+
+    return status;
+}
+
+
+/* Number of pages in the free list
+ *
+ * Parameters
+ * - bt: B-Tree file
+ * - nfree: Out parameter. Number of free pages.
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_EIO: An I/O error has occurred when accessing the file
+ */
+int chidb_Btree_countFreePages(BTree *bt, uint32_t *nfree)
+{
+    MemPage *header;
+    int status;
+
+    if ((status = chidb_Pager_readPage(bt->pager, 1, &header)) != CHIDB_OK) {
+        return status;
+    }
+    *nfree = get4byte(header->data + FILEHEADER_NFREE_OFFSET);
+
+    return chidb_Pager_releaseMemPage(bt->pager, header);
+}
+
+
 /* Create a new B-Tree node
  *
- * Allocates a new page in the file and initializes it as a B-Tree node.
+ * Allocates a new page (reusing a free one, if there is any) and
+ * initializes it as a B-Tree node.
  *
  * Parameters
  * - bt: B-Tree file
@@ -272,7 +599,7 @@ int chidb_Btree_freeMemNode(BTree *bt, BTreeNode *btn)
 int chidb_Btree_newNode(BTree *bt, npage_t *npage, uint8_t type)
 {
     // fprintf(stderr, "IN NEW NODE\n");
-    int status = chidb_Pager_allocatePage(bt->pager, npage);
+    int status = chidb_Btree_allocPage(bt, npage);
 
     if (status == CHIDB_OK) {
 
@@ -308,11 +635,18 @@ int chidb_Btree_initEmptyNode(BTree *bt, npage_t npage, uint8_t type)
     uint8_t *pos = NULL;
     int status;
 
+    if (npage == bt->append_leaf)
+        bt->append_leaf = 0;
+
     if (chidb_Pager_readPage(bt->pager, npage, &page) == CHIDB_OK) {
 
         pos = page->data;
 
         if (npage == 1) {
+            //A new file has no header yet (the root in page 1 may
+            //also be reinitialized when it is split)
+            bool has_header = !memcmp(page->data, "SQLite format 3", 16);
+
             //Write File Header
 
             //Format string
@@ -320,12 +654,12 @@ int chidb_Btree_initEmptyNode(BTree *bt, npage_t npage, uint8_t type)
             pos += 16;
 
             //Write Page Size
-            put2byte(pos, bt->pager->page_size);
+            FILEHEADER_PUT_PAGE_SIZE(page->data, bt->pager->page_size);
             pos += 2;
 
-            //Write Hex Garbage (12 -17)
-            *(pos++) = 0x01;
-            *(pos++) = 0x01;
+            //Write Hex Garbage (12 -17). The first two bytes are 2 in WAL mode
+            *(pos++) = bt->pager->wal != NULL ? 0x02 : 0x01;
+            *(pos++) = bt->pager->wal != NULL ? 0x02 : 0x01;
             *(pos++) = 0x00;
             *(pos++) = 0x40;
             *(pos++) = 0x20;
@@ -335,18 +669,20 @@ int chidb_Btree_initEmptyNode(BTree *bt, npage_t npage, uint8_t type)
             put4byte(pos, 0);
             pos += 8; //4 unused bytes follow
 
-            //Write 8 bytes worth of 0
-            put4byte(pos, 0);
-            pos += 4;
-            put4byte(pos, 0);
-            pos += 4;
+            //Write the free list (0x20 - 0x27), empty in a new file. It
+            //must be kept when the root in page 1 is split
+            if (!has_header) {
+                put4byte(pos, 0);
+                put4byte(pos + 4, 0);
+            }
+            pos += 8;
 
             //Write Schema version (init to 0)
             put4byte(pos, 0);
             pos += 4;
 
-            //Write Hex Garbage (2C-2F)
-            put4byte(pos, 1);
+            //Write File Format (2C-2F), which depends on the key size
+            put4byte(pos, bt->key_size == KEYSIZE_WIDE ? FILEFORMAT_WIDE_KEYS : FILEFORMAT_NARROW_KEYS);
             pos += 4;
 
             //Write Page Cache Size
@@ -381,7 +717,7 @@ int chidb_Btree_initEmptyNode(BTree *bt, npage_t npage, uint8_t type)
 
         //Write Free offset 
         //We assume from start of Header
-        put2byte(pos, ((type == 0x05 || type == 0x02) ? 12 : 8) + ((npage == 1) ? 100 : 0));
+        put2byte(pos, (PGTYPE_IS_INTERNAL(type) ? 12 : 8) + ((npage == 1) ? 100 : 0));
         pos += 2;
 
         //Write NumCells
@@ -392,17 +728,17 @@ int chidb_Btree_initEmptyNode(BTree *bt, npage_t npage, uint8_t type)
         put2byte(pos, bt->pager->page_size);
         pos += 2;
 
-        //Write 0
-        *(pos++) = 0;
+        //Write Key Size
+        *(pos++) = PGHEADER_PUT_KEYSIZE(bt->key_size);
 
         //Write Right Page
-        if (type == 0x05 || type == 0x02) {
+        if (PGTYPE_IS_INTERNAL(type)) {
             //Node is Internal Node
             put4byte(pos, 0);
             pos += 4;
         }
 
-        if ((status = chidb_Pager_writePage(bt->pager, page)) == CHIDB_OK) {
+        if ((status = chidb_Btree_writePage(bt, page)) == CHIDB_OK) {
 
             status = chidb_Pager_releaseMemPage(bt->pager, page);
 
@@ -442,18 +778,136 @@ int chidb_Btree_initEmptyNode(BTree *bt, npage_t npage, uint8_t type)
 int chidb_Btree_writeNode(BTree *bt, BTreeNode *btn)
 {
     uint8_t *pos = ((btn->page->npage == 1) ? 100 : 0) + btn->page->data;
+    MemPage *header;
+
+    /* A private copy of page 1 (see chidb_Pager_readPage) may predate
+     * changes made to the free list through another copy */
+    if (btn->page->npage == 1 && !btn->page->pooled
+            && chidb_Pager_readPage(bt->pager, 1, &header) == CHIDB_OK) {
+        memcpy(btn->page->data + FILEHEADER_FREELIST_OFFSET, header->data + FILEHEADER_FREELIST_OFFSET, 8);
+        chidb_Pager_releaseMemPage(bt->pager, header);
+    }
 
     *pos = btn->type;
     put2byte(pos + 1, btn->free_offset);
     put2byte(pos + 3, btn->n_cells);
     put2byte(pos + 5, btn->cells_offset);
-    if ((btn->type == 0x05) || (btn->type == 0x02)) {
+    pos[PGHEADER_KEYSIZE_OFFSET] = PGHEADER_PUT_KEYSIZE(btn->key_size);
+    if (PGTYPE_IS_INTERNAL(btn->type)) {
         put4byte(pos + 8, btn->right_page);
     }
 
-    chidb_Pager_writePage(bt->pager, btn->page);
+    return chidb_Btree_writePage(bt, btn->page);
+}
 
-    return CHIDB_OK;
+
+/* Write a page of the B-Tree file
+ *
+ * Every page the B-Tree changes is written through here, so that the
+ * decoded copy of the page, if there is one, is dropped along with it
+ * (see chidb_Btree_searchInternal).
+ */
+static int chidb_Btree_writePage(BTree *bt, MemPage *page)
+{
+    BTreeDecoded *d = &bt->decoded[page->npage % BTREE_DECODED_SLOTS];
+
+    if (d->npage == page->npage)
+        d->npage = 0;
+
+    return chidb_Pager_writePage(bt->pager, page);
+}
+
+
+/* Read the texts of text index cells
+ *
+ * The text of a cell is in two pieces (see TEXTINDEXLEAFCELL_SHARED_OFFSET):
+ * the prefix it shares with the first cell of its node, and the rest.
+ * Cells that are not read from a node (e.g., a new entry) can have all of
+ * their text in the suffix.
+ */
+static inline uint8_t chidb_Btree_textByte(BTreeCell *cell, uint32_t i)
+{
+    if (i < cell->fields.textIndex.prefix_len)
+        return cell->fields.textIndex.prefix[i];
+    return cell->fields.textIndex.suffix[i - cell->fields.textIndex.prefix_len];
+}
+
+uint32_t chidb_Btree_textLength(BTreeCell *cell)
+{
+    return cell->fields.textIndex.prefix_len + cell->fields.textIndex.suffix_len;
+}
+
+/* Copies the text of a cell from byte from on */
+static void chidb_Btree_textCopyFrom(BTreeCell *cell, uint32_t from, uint8_t *buf)
+{
+    uint32_t plen = cell->fields.textIndex.prefix_len;
+
+    if (from < plen) {
+        memcpy(buf, cell->fields.textIndex.prefix + from, plen - from);
+        buf += plen - from;
+        from = plen;
+    }
+    memcpy(buf, cell->fields.textIndex.suffix + (from - plen), cell->fields.textIndex.suffix_len - (from - plen));
+}
+
+void chidb_Btree_textCopy(BTreeCell *cell, uint8_t *buf)
+{
+    chidb_Btree_textCopyFrom(cell, 0, buf);
+}
+
+/* Number of bytes at the start of the texts of two cells that are equal */
+static uint32_t chidb_Btree_textShared(BTreeCell *a, BTreeCell *b)
+{
+    uint32_t n = 0, len = chidb_Btree_textLength(a);
+
+    if (chidb_Btree_textLength(b) < len)
+        len = chidb_Btree_textLength(b);
+
+    while (n < len && chidb_Btree_textByte(a, n) == chidb_Btree_textByte(b, n))
+        n++;
+
+    return n;
+}
+
+/* Number of bytes a text index cell takes up in a node of the given type
+ * (not counting its entry in the cell offset array), with n bytes of its
+ * text stored in the cell */
+static uint16_t chidb_Btree_textCellSize(uint8_t type, uint8_t ks, BTreeCell *cell, uint32_t n)
+{
+    if (type == PGTYPE_TEXTINDEX_LEAF)
+        return TEXTINDEXLEAFCELL_SIZE(ks, n);
+    return TEXTINDEXINTCELL_SIZE(ks, cell->fields.textIndex.has_pk, n);
+}
+
+/* Decodes a text index cell. The prefix of its text is read from the
+ * first cell of the node, whose whole text is its suffix. */
+static void chidb_Btree_getTextCell(BTreeNode *btn, uint8_t *curr_cell, BTreeCell *cell)
+{
+    uint8_t ks = btn->key_size;
+    uint8_t *first = btn->page->data + get2byte(btn->celloffset_array);
+
+    cell->type = btn->type;
+    cell->key = 0;
+    if (btn->type == PGTYPE_TEXTINDEX_LEAF) {
+        cell->fields.textIndex.prefix = first + TEXTINDEXLEAFCELL_SUFFIX_OFFSET(ks);
+        cell->fields.textIndex.prefix_len = get2byte(curr_cell + TEXTINDEXLEAFCELL_SHARED_OFFSET);
+        cell->fields.textIndex.suffix = curr_cell + TEXTINDEXLEAFCELL_SUFFIX_OFFSET(ks);
+        cell->fields.textIndex.suffix_len = get2byte(curr_cell + TEXTINDEXLEAFCELL_SUFFIXLEN_OFFSET);
+        cell->fields.textIndex.keyPk = chidb_Btree_getIndexKey(ks, curr_cell + TEXTINDEXLEAFCELL_KEYPK_OFFSET);
+        cell->fields.textIndex.has_pk = true;
+        cell->fields.textIndex.child_page = 0;
+    } else {
+        bool has_pk = curr_cell[TEXTINDEXINTCELL_FLAGS_OFFSET] & TEXTINDEXINTCELL_HAS_PK;
+        bool first_pk = first[TEXTINDEXINTCELL_FLAGS_OFFSET] & TEXTINDEXINTCELL_HAS_PK;
+
+        cell->fields.textIndex.prefix = first + TEXTINDEXINTCELL_KEYPK_OFFSET + (first_pk ? ks : 0);
+        cell->fields.textIndex.prefix_len = get2byte(curr_cell + TEXTINDEXINTCELL_SHARED_OFFSET);
+        cell->fields.textIndex.suffix = curr_cell + TEXTINDEXINTCELL_KEYPK_OFFSET + (has_pk ? ks : 0);
+        cell->fields.textIndex.suffix_len = get2byte(curr_cell + TEXTINDEXINTCELL_SUFFIXLEN_OFFSET);
+        cell->fields.textIndex.keyPk = has_pk ? chidb_Btree_getIndexKey(ks, curr_cell + TEXTINDEXINTCELL_KEYPK_OFFSET) : 0;
+        cell->fields.textIndex.has_pk = has_pk;
+        cell->fields.textIndex.child_page = get4byte(curr_cell + TEXTINDEXINTCELL_CHILD_OFFSET);
+    }
 }
 
 
@@ -477,36 +931,26 @@ int chidb_Btree_writeNode(BTree *bt, BTreeNode *btn)
  */
 int chidb_Btree_getCell(BTreeNode *btn, ncell_t ncell, BTreeCell *cell)
 {
-    uint8_t *dat = btn->page->data;
-    uint8_t *curr_cell = dat + get2byte(btn->celloffset_array+ncell*2);
-
     if(ncell < 0 || ncell > btn->n_cells) {
             return CHIDB_ECELLNO;
     }
 
     switch(btn->type) {
         case PGTYPE_TABLE_INTERNAL:
-            cell->type = PGTYPE_TABLE_INTERNAL;
-            cell->fields.tableInternal.child_page = get4byte(curr_cell);
-            getVarint32(curr_cell + 4, &cell->key);
+            chidb_Btree_tableInternalCell(btn, ncell, cell);
             break;
         case PGTYPE_TABLE_LEAF:
-            cell->type = PGTYPE_TABLE_LEAF;
-
-            getVarint32(curr_cell, &cell->fields.tableLeaf.data_size);
-            getVarint32(curr_cell + 4, &cell->key);
-            cell->fields.tableLeaf.data = curr_cell + TABLELEAFCELL_SIZE_WITHOUTDATA;
+            chidb_Btree_tableLeafCell(btn, ncell, cell);
             break;
         case PGTYPE_INDEX_INTERNAL:
-            cell->type = PGTYPE_INDEX_INTERNAL;
-            cell->key = get4byte(curr_cell + 8);
-            cell->fields.indexInternal.keyPk = get4byte(curr_cell + 12);
-            cell->fields.indexInternal.child_page = get4byte(curr_cell);
+            chidb_Btree_indexInternalCell(btn, ncell, cell);
             break;
         case PGTYPE_INDEX_LEAF:
-            cell->type = PGTYPE_INDEX_LEAF;
-            cell->key = get4byte(curr_cell + 4);
-            cell->fields.indexLeaf.keyPk = get4byte(curr_cell + 8);
+            chidb_Btree_indexLeafCell(btn, ncell, cell);
+            break;
+        case PGTYPE_TEXTINDEX_INTERNAL:
+        case PGTYPE_TEXTINDEX_LEAF:
+            chidb_Btree_getTextCell(btn, chidb_Btree_cellAt(btn, ncell), cell);
             break;
         default:
 	    fprintf(stderr,"getCell: invalid page type (%d)\n",btn->type);
@@ -517,343 +961,1438 @@ int chidb_Btree_getCell(BTreeNode *btn, ncell_t ncell, BTreeCell *cell)
 }
 
 
-/* Insert a new cell into a B-Tree node
- *
- * Inserts a new cell into a B-Tree node at a specified position ncell.
- * This involves the following:
- *  1. Add the cell at the top of the cell area. This involves "translating"
- *     the BTreeCell into the chidb format (refer to The chidb File Format
- *     document for the format of cells).
- *  2. Modify cells_offset in BTreeNode to reflect the growth in the cell area.
- *  3. Modify the cell offset array so that all values in positions >= ncell
- *     are shifted one position forward in the array. Then, set the value of
- *     position ncell to be the offset of the newly added cell.
+/* Search for a key inside a B-Tree node
  *
- * This function assumes that there is enough space for this cell in this node.
+ * Binary-searches the cell offset array of a node (of any of the four
+ * page types) for the first cell whose key is greater than or equal to
+ * the given key. The page type is only looked at once: the search itself
+ * is the one specialized for it (see btree-cell.h), which only reads the
+ * key of each visited cell.
  *
  * Parameters
- * - btn: BTreeNode to insert cell in
- * - ncell: Cell number
- * - cell: BTreeCell to insert.
+ * - btn: BTreeNode to search in
+ * - key: Key to search for
+ * - ncell: Out parameter. Number of the first cell with a key >= key,
+ *          or btn->n_cells if every key in the node is < key.
  *
  * Return
- * - CHIDB_OK: Operation successful
- * - CHIDB_ECELLNO: The provided cell number is invalid
+ * - CHIDB_TRUE: The cell at ncell has exactly the given key
+ * - CHIDB_FALSE: No cell in the node has the given key
  */
-int chidb_Btree_insertCell(BTreeNode *btn, ncell_t ncell, BTreeCell *cell)
+int chidb_Btree_searchNode(BTreeNode *btn, chidb_key_t key, ncell_t *ncell)
 {
-    uint8_t *dat = btn->page->data;
-    uint8_t *cell_pointer = NULL;
-    uint8_t hexg[] = {0x0B, 0x03, 0x04, 0x04};
-
-    if(ncell < 0 || ncell > btn->n_cells) {
-            return CHIDB_ECELLNO;
-    }
+    ncell_t i;
+    chidb_key_t found;
 
     switch(btn->type) {
+        case PGTYPE_TABLE_INTERNAL:
+            i = chidb_Btree_tableInternalSearch(btn, key);
+            found = i < btn->n_cells ? chidb_Btree_tableInternalKey(btn, i) : 0;
+            break;
         case PGTYPE_TABLE_LEAF:
-            cell_pointer = dat + btn->cells_offset - cell->fields.tableLeaf.data_size - TABLELEAFCELL_SIZE_WITHOUTDATA;
+            i = chidb_Btree_tableLeafSearch(btn, key);
+            found = i < btn->n_cells ? chidb_Btree_tableLeafKey(btn, i) : 0;
+            break;
+        case PGTYPE_INDEX_INTERNAL:
+            i = chidb_Btree_indexInternalSearch(btn, key);
+            found = i < btn->n_cells ? chidb_Btree_indexInternalKey(btn, i) : 0;
+            break;
+        default:
+            i = chidb_Btree_indexLeafSearch(btn, key);
+            found = i < btn->n_cells ? chidb_Btree_indexLeafKey(btn, i) : 0;
+            break;
+    }
 
-            putVarint32(cell_pointer, cell->fields.tableLeaf.data_size);
+    *ncell = i;
 
-            putVarint32(cell_pointer + 4, cell->key);
+    if (i < btn->n_cells && found == key)
+        return CHIDB_TRUE;
 
-            memcpy(cell_pointer + 8, cell->fields.tableLeaf.data, cell->fields.tableLeaf.data_size);
+    return CHIDB_FALSE;
+}
 
-            btn->cells_offset -= (cell->fields.tableLeaf.data_size + TABLELEAFCELL_SIZE_WITHOUTDATA);
 
-        break;
-        case PGTYPE_TABLE_INTERNAL:
-            cell_pointer = dat + btn->cells_offset - TABLEINTCELL_SIZE;
+/* Search for an entry inside an index B-Tree node
+ *
+ * Same as chidb_Btree_searchNode, but the entries of an index are in the
+ * order of their keys and then of their primary keys (an index may have
+ * several entries with the same key), and this looks for a whole entry.
+ *
+ * Parameters
+ * - btn: BTreeNode to search in (an index node)
+ * - keyIdx: Key of the entry
+ * - keyPk: Primary key of the entry
+ * - ncell: Out parameter. Number of the first cell at or after the
+ *          entry, or btn->n_cells if every entry in the node is before it.
+ *
+ * Return
+ * - CHIDB_TRUE: The cell at ncell is the entry
+ * - CHIDB_FALSE: The entry is not in the node
+ */
+int chidb_Btree_searchIndex(BTreeNode *btn, chidb_key_t keyIdx, chidb_key_t keyPk, ncell_t *ncell)
+{
+    ncell_t i;
 
-            put4byte(cell_pointer, cell->fields.tableInternal.child_page);
-            putVarint32(cell_pointer + 4, cell->key);
+    if (btn->type == PGTYPE_INDEX_INTERNAL) {
+        i = chidb_Btree_indexInternalSearchPk(btn, keyIdx, keyPk);
+        *ncell = i;
+        return (i < btn->n_cells && chidb_Btree_indexInternalKey(btn, i) == keyIdx
+                && chidb_Btree_indexInternalPk(btn, i) == keyPk) ? CHIDB_TRUE : CHIDB_FALSE;
+    }
 
-            btn->cells_offset -= TABLEINTCELL_SIZE;
+    i = chidb_Btree_indexLeafSearchPk(btn, keyIdx, keyPk);
+    *ncell = i;
+    return (i < btn->n_cells && chidb_Btree_indexLeafKey(btn, i) == keyIdx
+            && chidb_Btree_indexLeafPk(btn, i) == keyPk) ? CHIDB_TRUE : CHIDB_FALSE;
+}
 
-        break;
-        case PGTYPE_INDEX_INTERNAL:
-            cell_pointer = dat + btn->cells_offset - INDEXINTCELL_SIZE;
 
-            put4byte(cell_pointer, cell->fields.indexInternal.child_page);
-            memcpy(cell_pointer + 4, hexg, 4);
-            put4byte(cell_pointer + 8, cell->key);
-            put4byte(cell_pointer + 12, cell->fields.indexInternal.keyPk);
+/* Compare two cells of the same B-Tree
+ *
+ * Cells are in the order of their keys. Index entries with the same key
+ * are in the order of their primary keys.
+ *
+ * Return
+ * - A negative number, 0, or a positive number if a is before, at,
+ *   or after b
+ */
+static int chidb_Btree_compareCells(BTreeCell *a, BTreeCell *b)
+{
+    chidb_key_t pa, pb;
 
-            btn->cells_offset -= INDEXINTCELL_SIZE;
+    if (a->key != b->key)
+        return a->key < b->key ? -1 : 1;
 
-        break;
+    switch (a->type) {
         case PGTYPE_INDEX_LEAF:
-            cell_pointer = dat + btn->cells_offset - INDEXLEAFCELL_SIZE;
+        case PGTYPE_INDEX_INTERNAL:
+            pa = (a->type == PGTYPE_INDEX_LEAF) ? a->fields.indexLeaf.keyPk : a->fields.indexInternal.keyPk;
+            pb = (b->type == PGTYPE_INDEX_LEAF) ? b->fields.indexLeaf.keyPk : b->fields.indexInternal.keyPk;
+            return (pa > pb) - (pa < pb);
+        default:
+            return 0;
+    }
+}
 
-            memcpy(cell_pointer, hexg, 4);
-            put4byte(cell_pointer + 4, cell->key);
-            put4byte(cell_pointer + 8, cell->fields.indexLeaf.keyPk);
 
-            btn->cells_offset -= INDEXLEAFCELL_SIZE;
-        break;
-    default:
-	exit(1);
+/* Decoded copies of table internal nodes
+ *
+ * The upper levels of a B-Tree are visited by every lookup, and are
+ * always in the buffer pool, so most of what a point lookup costs is the
+ * binary searches over their cells: each probe goes through the cell
+ * offset array and decodes a big-endian (or varint) key. The B-Tree keeps
+ * a decoded copy of the table internal nodes it searches most often: their
+ * keys in a flat, cache-line aligned array, and their child pages (the
+ * right page last) in another, which chidb_Btree_searchInternal searches
+ * without branching on the keys.
+ *
+ * The copies are kept in a small table indexed by page number. A node is
+ * only decoded the second time in a row it is searched in its slot, so
+ * that the lower levels, which random lookups seldom go through twice,
+ * do not push out the upper ones. A copy is dropped when its page is
+ * written through the B-Tree (see chidb_Btree_writePage), and every copy
+ * is out of date once the Pager's generation moves. A Pager shared
+ * between threads does not use them.
+ */
+#define DECODED_ALIGN (64)
+
+static BTreeDecoded *chidb_Btree_decoded(BTree *bt, BTreeNode *btn)
+{
+    npage_t npage = btn->page->npage;
+    BTreeDecoded *d = &bt->decoded[npage % BTREE_DECODED_SLOTS];
+    size_t keys;
+    void *mem;
+
+    if (bt->pager->threadsafe)
+        return NULL;
 
+    if (d->npage == npage && d->generation == bt->pager->generation)
+        return d;
+
+    if (d->candidate != npage) {
+        d->candidate = npage;
+        return NULL;
     }
- 
-    memmove(btn->celloffset_array + (ncell * 2) + 2, btn->celloffset_array + (ncell * 2), (btn->n_cells - ncell) * 2);
-    put2byte(btn->celloffset_array + (ncell * 2), btn->cells_offset);
-    btn->n_cells++;
-    btn->free_offset += 2;
 
-    return CHIDB_OK;
+    keys = (btn->n_cells * sizeof(chidb_key_t) + DECODED_ALIGN - 1) / DECODED_ALIGN * DECODED_ALIGN;
+    if (btn->n_cells > d->capacity || d->keys == NULL) {
+        if (posix_memalign(&mem, DECODED_ALIGN, keys + (btn->n_cells + 1) * sizeof(npage_t)) != 0)
+            return NULL;
+        free(d->keys);
+        d->keys = mem;
+        d->capacity = btn->n_cells;
+    }
+    d->children = (npage_t *) ((uint8_t *) d->keys + keys);
+
+    for (ncell_t i = 0; i < btn->n_cells; i++) {
+        d->keys[i] = chidb_Btree_tableInternalKey(btn, i);
+        d->children[i] = chidb_Btree_tableInternalChild(btn, i);
+    }
+    d->children[btn->n_cells] = btn->right_page;
+    d->n_cells = btn->n_cells;
+    d->npage = npage;
+    d->generation = bt->pager->generation;
+
+    return d;
 }
 
-/* Find an entry in a table B-Tree
+/* First of n sorted keys that is >= key (n if there is none). The loop
+ * always runs log2(n) times, and only the choice of base depends on the
+ * keys, which the compiler turns into a conditional move. */
+static inline ncell_t chidb_Btree_lowerBound(const chidb_key_t *keys, ncell_t n, chidb_key_t key)
+{
+    const chidb_key_t *base = keys;
+
+    if (n == 0)
+        return 0;
+
+    while (n > 1) {
+        ncell_t half = n / 2;
+
+        base = (base[half - 1] < key) ? base + half : base;
+        n -= half;
+    }
+
+    return (base - keys) + (*base < key);
+}
+
+
+/* Search a table internal node for a key
  *
- * Finds the data associated for a given key in a table B-Tree
+ * Same as chidb_Btree_searchNode, for a table internal node, but it also
+ * returns the child the key is in, and it searches the decoded copy of
+ * the node if there is one (see above).
  *
  * Parameters
  * - bt: B-Tree file
- * - nroot: Page number of the root node of the B-Tree we want search in
- * - key: Entry key
- * - data: Out-parameter where a copy of the data must be stored
- * - size: Number of bytes of data
+ * - btn: Table internal node to search in
+ * - key: Key to search for
+ * - child: Out parameter. Child page of the cell found, or the right
+ *          page if every key in the node is < key.
  *
  * Return
- * - CHIDB_OK: Operation successful
- * - CHIDB_ENOTFOUND: No entry with the given key way found
- * - CHIDB_ENOMEM: Could not allocate memory
- * - CHIDB_EIO: An I/O error has occurred when accessing the file
+ * - Number of the first cell with a key >= key, or btn->n_cells
  */
-int chidb_Btree_find(BTree *bt, npage_t nroot, chidb_key_t key, uint8_t **data, uint16_t *size)
+ncell_t chidb_Btree_searchInternal(BTree *bt, BTreeNode *btn, chidb_key_t key, npage_t *child)
 {
-    BTreeCell cell;
-    BTreeNode *btn;
+    BTreeDecoded *d = chidb_Btree_decoded(bt, btn);
+    ncell_t i;
 
-    int status;
-    int i;
-    int temp_type;
-
-    if ((status = chidb_Btree_getNodeByPage(bt, nroot, &btn)) != CHIDB_OK) {
-        return status;
+    if (d == NULL) {
+        i = chidb_Btree_tableInternalSearch(btn, key);
+        *child = i < btn->n_cells ? chidb_Btree_tableInternalChild(btn, i) : btn->right_page;
+        return i;
     }
 
-    for (i = 0; i < btn->n_cells; i++) {
-        if (chidb_Btree_getCell(btn, i, &cell) != CHIDB_OK) {
-            return CHIDB_ECELLNO;
-        }
+    i = chidb_Btree_lowerBound(d->keys, d->n_cells, key);
+    *child = d->children[i];
+    return i;
+}
 
-        if ((cell.key == key) && (btn->type == PGTYPE_TABLE_LEAF)) {
-            *size = cell.fields.tableLeaf.data_size;
-            (*data) = (uint8_t *) malloc(sizeof(uint8_t) * (*size));
-            if (!(*data)) {
-                chidb_Btree_freeMemNode(bt, btn);
-                return CHIDB_ENOMEM;
-            }
-            memcpy(*data, cell.fields.tableLeaf.data, *size);
 
-            if ((status = chidb_Btree_freeMemNode(bt, btn)) != CHIDB_OK) {
-                return status;
-            }
+/* Returns the i-th child of an internal node (right_page if i is n_cells)
+ *
+ * The child page is the first field of the cells of every type of
+ * internal node, so it is read without decoding the rest of the cell.
+ */
+npage_t chidb_Btree_getChild(BTreeNode *btn, ncell_t i)
+{
+    if (i == btn->n_cells)
+        return btn->right_page;
 
-            return CHIDB_OK;
+    return get4byte(btn->page->data + get2byte(btn->celloffset_array + i*2) + TABLEINTCELL_CHILD_OFFSET);
+}
 
-        } else if (key <= cell.key) {
-            temp_type = btn->type;
-            if ((status = chidb_Btree_freeMemNode(bt, btn)) != CHIDB_OK) {
-                return status;
-            }
 
-            if (temp_type != PGTYPE_TABLE_LEAF) {
-                return chidb_Btree_find(bt, cell.fields.tableInternal.child_page, key, data, size);
-            } else {
-                return CHIDB_ENOTFOUND;
-            }
+/* Number of bytes of data a table leaf cell keeps in the page
+ *
+ * Cells with up to MAXLOCAL bytes of data keep all of it. Larger ones
+ * keep a prefix of at least MINLOCAL bytes, chosen (as in SQLite) so
+ * that the rest fills its overflow pages exactly, if that keeps the cell
+ * small enough for a few of them to fit in a leaf.
+ *
+ * Parameters
+ * - page_size: Page size of the file
+ * - key_size: Key size of the file
+ * - data_size: Number of bytes of data in the cell
+ *
+ * Return
+ * - Number of bytes of data stored in the page
+ */
+uint32_t chidb_Btree_localSize(uint32_t page_size, uint8_t key_size, uint32_t data_size)
+{
+    uint32_t min_local = TABLELEAFCELL_MINLOCAL(page_size);
+    uint32_t local;
 
-        }
+    if (data_size <= TABLELEAFCELL_MAXLOCAL(page_size, key_size))
+        return data_size;
 
-    }
+    local = min_local + (data_size - min_local) % (page_size - OVERFLOWPG_DATA_OFFSET);
+    if (local > TABLELEAFCELL_OVERFLOW_MAXLOCAL(page_size))
+        local = min_local;
 
-    if (btn->type != PGTYPE_TABLE_LEAF) {
-        i = btn->right_page;
-        if ((status = chidb_Btree_freeMemNode(bt, btn)) != CHIDB_OK) {
-            return status;
-        }
-        return chidb_Btree_find(bt, i, key, data, size);
-    } 
+    return local;
+}
 
-    return CHIDB_ENOTFOUND;
 
-}
+/* Number of bytes a table leaf cell takes up in a page (not counting
+ * its entry in the cell offset array) */
+static uint16_t chidb_Btree_tableLeafCellSize(BTreeNode *btn, BTreeCell *btc)
+{
+    uint32_t local = chidb_Btree_localSize(btn->page->size, btn->key_size, btc->fields.tableLeaf.data_size);
 
+    if (local < btc->fields.tableLeaf.data_size)
+        return TABLELEAFCELL_SIZE_WITHOUTDATA(btn->key_size) + local + TABLELEAFCELL_OVERFLOW_SIZE;
+    return TABLELEAFCELL_SIZE_WITHOUTDATA(btn->key_size) + local;
+}
 
 
-/* Insert an entry into a table B-Tree
+/* Write the data of a new table leaf cell that does not fit in a page
+ * to overflow pages
  *
- * This is a convenience function that wraps around chidb_Btree_insert.
- * It takes a key and data, and creates a BTreeCell that can be passed
- * along to chidb_Btree_insert.
+ * The data past the cell's local prefix is written to a chain of newly
+ * allocated pages, and the first of them is stored in the cell. Cells
+ * that fit in a page (and cells of other types) are left alone. This is
+ * done right before the cell is inserted, once its key is known not to
+ * be in the tree. The pages are freed when the entry is deleted.
  *
  * Parameters
  * - bt: B-Tree file
- * - nroot: Page number of the root node of the B-Tree we want to insert
- *          this entry in.
- * - key: Entry key
- * - data: Pointer to data we want to insert
- * - size: Number of bytes of data
+ * - btc: New cell. Its data must point to all of the data.
  *
  * Return
  * - CHIDB_OK: Operation successful
- * - CHIDB_EDUPLICATE: An entry with that key already exists
  * - CHIDB_ENOMEM: Could not allocate memory
  * - CHIDB_EIO: An I/O error has occurred when accessing the file
  */
-int chidb_Btree_insertInTable(BTree *bt, npage_t nroot, chidb_key_t key, uint8_t *data, uint16_t size)
+int chidb_Btree_spill(BTree *bt, BTreeCell *btc)
 {
-    BTreeCell btc;
+    uint32_t page_size = bt->pager->page_size;
+    uint32_t room = page_size - OVERFLOWPG_DATA_OFFSET;
+    uint32_t size, offset;
+    npage_t npage, next;
+    MemPage *page;
+    int status;
 
-    btc.type = PGTYPE_TABLE_LEAF;
-    btc.key = key;
-    btc.fields.tableLeaf.data_size = size;
-    btc.fields.tableLeaf.data = data;
+    if (btc->type != PGTYPE_TABLE_LEAF)
+        return CHIDB_OK;
 
-    return chidb_Btree_insert(bt, nroot, &btc);
+    size = btc->fields.tableLeaf.data_size;
+    offset = chidb_Btree_localSize(page_size, bt->key_size, size);
+    btc->fields.tableLeaf.local_size = offset;
+    btc->fields.tableLeaf.overflow = 0;
+    if (offset == size)
+        return CHIDB_OK;
+
+    // unless free pages are reused, the pages are allocated in order, so
+    // the chain can be read sequentially
+    if ((status = chidb_Btree_allocPage(bt, &npage)) != CHIDB_OK)
+        return status;
+    btc->fields.tableLeaf.overflow = npage;
+
+    while (offset < size) {
+        uint32_t n = (size - offset < room) ? size - offset : room;
+
+        next = 0;
+        if (offset + n < size && (status = chidb_Btree_allocPage(bt, &next)) != CHIDB_OK)
+            return status;
 
+        if ((status = chidb_Pager_readPage(bt->pager, npage, &page)) != CHIDB_OK)
+            return status;
+        put4byte(page->data + OVERFLOWPG_NEXT_OFFSET, next);
+        memcpy(page->data + OVERFLOWPG_DATA_OFFSET, btc->fields.tableLeaf.data + offset, n);
+        memset(page->data + OVERFLOWPG_DATA_OFFSET + n, 0, room - n);
+        status = chidb_Btree_writePage(bt, page);
+        chidb_Pager_releaseMemPage(bt->pager, page);
+        if (status != CHIDB_OK)
+            return status;
+
+        offset += n;
+        npage = next;
+    }
+
+    return CHIDB_OK;
 }
 
 
-/* Insert an entry into an index B-Tree
+/* Read all the data of a table leaf cell
  *
- * This is a convenience function that wraps around chidb_Btree_insert.
- * It takes a KeyIdx and a KeyPk, and creates a BTreeCell that can be passed
- * along to chidb_Btree_insert.
+ * Copies the data in the page, and then the data in the cell's overflow
+ * pages (if any), into a buffer.
  *
  * Parameters
  * - bt: B-Tree file
- * - nroot: Page number of the root node of the B-Tree we want to insert
- *          this entry in.
- * - keyIdx: See The chidb File Format.
- * - keyPk: See The chidb File Format.
+ * - cell: Table leaf cell returned by chidb_Btree_getCell
+ * - buf: Buffer with room for the cell's data_size bytes
  *
  * Return
  * - CHIDB_OK: Operation successful
- * - CHIDB_EDUPLICATE: An entry with that key already exists
- * - CHIDB_ENOMEM: Could not allocate memory
+ * - CHIDB_ECORRUPT: The overflow chain is shorter than the data
+ * - CHIDB_EPAGENO: The chain refers to an invalid page
  * - CHIDB_EIO: An I/O error has occurred when accessing the file
  */
-int chidb_Btree_insertInIndex(BTree *bt, npage_t nroot, chidb_key_t keyIdx, chidb_key_t keyPk)
+int chidb_Btree_readPayload(BTree *bt, BTreeCell *cell, uint8_t *buf)
 {
-    BTreeCell btc;
+    uint32_t room = bt->pager->page_size - OVERFLOWPG_DATA_OFFSET;
+    uint32_t size = cell->fields.tableLeaf.data_size;
+    uint32_t offset = cell->fields.tableLeaf.local_size;
+    npage_t npage = cell->fields.tableLeaf.overflow;
+    MemPage *page;
+    int status;
 
-    btc.type = PGTYPE_INDEX_LEAF;
-    btc.key = keyIdx;
-    btc.fields.indexLeaf.keyPk = keyPk;
+    memcpy(buf, cell->fields.tableLeaf.data, offset);
 
-    return chidb_Btree_insert(bt, nroot, &btc);
+    while (offset < size) {
+        uint32_t n = (size - offset < room) ? size - offset : room;
 
+        if (npage == 0)
+            return CHIDB_ECORRUPT;
+        if ((status = chidb_Pager_readPage(bt->pager, npage, &page)) != CHIDB_OK)
+            return status;
+        memcpy(buf + offset, page->data + OVERFLOWPG_DATA_OFFSET, n);
+        npage = get4byte(page->data + OVERFLOWPG_NEXT_OFFSET);
+        chidb_Pager_releaseMemPage(bt->pager, page);
+
+        offset += n;
+    }
+
+    return CHIDB_OK;
 }
 
-//Helper function for Btree_insert
-//Checks if node has room for the cell
-int hasRoomForCell(BTreeNode *btn, BTreeCell *btc)
-{
-    int space, size;
 
-    size = 0;
-    space = btn->cells_offset - btn->free_offset;
+/* Make all the data of a table leaf cell available in memory
+ *
+ * If the cell has overflow pages, its data is read into a new buffer
+ * (see chidb_Btree_readPayload), and the cell's data is pointed at it.
+ * The buffer must be freed once the cell is no longer needed. Otherwise,
+ * the data is already in the page, and nothing is done.
+ *
+ * Parameters
+ * - bt: B-Tree file
+ * - cell: Table leaf cell returned by chidb_Btree_getCell
+ * - buf: Out parameter. The buffer, or NULL if none was needed.
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_ENOMEM: Could not allocate memory
+ * - chidb_Btree_readPayload return codes
+ */
+int chidb_Btree_loadPayload(BTree *bt, BTreeCell *cell, uint8_t **buf)
+{
+    int status;
 
-    switch(btc->type) {
-        case PGTYPE_TABLE_LEAF:
-            size = TABLELEAFCELL_SIZE_WITHOUTDATA + btc->fields.tableLeaf.data_size;
-            break;
-        case PGTYPE_TABLE_INTERNAL:
-            size = TABLEINTCELL_SIZE;
-            break;
-        case PGTYPE_INDEX_LEAF:
-            size = INDEXLEAFCELL_SIZE;
-            break;
-        case PGTYPE_INDEX_INTERNAL:
-            size = INDEXINTCELL_SIZE;
-            break;
-    }
+    *buf = NULL;
+    if (cell->fields.tableLeaf.overflow == 0)
+        return CHIDB_OK;
 
-    if (space >= size) {
-        return 1;
-    } else {
-        return 0;
+    if ((*buf = malloc(cell->fields.tableLeaf.data_size)) == NULL)
+        return CHIDB_ENOMEM;
+    if ((status = chidb_Btree_readPayload(bt, cell, *buf)) != CHIDB_OK) {
+        free(*buf);
+        *buf = NULL;
+        return status;
     }
+    cell->fields.tableLeaf.data = *buf;
 
+    return CHIDB_OK;
 }
-/* Insert a BTreeCell into a B-Tree
+
+
+/* Insert a new cell into a B-Tree node
  *
- * The chidb_Btree_insert and chidb_Btree_insertNonFull functions
- * are responsible for inserting new entries into a B-Tree, although
- * chidb_Btree_insertNonFull is the one that actually does the
- * insertion. chidb_Btree_insert, however, first checks if the root
- * has to be split (a splitting operation that is different from
- * splitting any other node). If so, chidb_Btree_split is called
- * before calling chidb_Btree_insertNonFull.
+ * Inserts a new cell into a B-Tree node at a specified position ncell.
+ * This involves the following:
+ *  1. Add the cell at the top of the cell area. This involves "translating"
+ *     the BTreeCell into the chidb format (refer to The chidb File Format
+ *     document for the format of cells).
+ *  2. Modify cells_offset in BTreeNode to reflect the growth in the cell area.
+ *  3. Modify the cell offset array so that all values in positions >= ncell
+ *     are shifted one position forward in the array. Then, set the value of
+ *     position ncell to be the offset of the newly added cell.
+ *
+ * This function assumes that there is enough space for this cell in this node.
+ *
+ * The text of a text index cell is stored compressed against the first
+ * cell of the node (see TEXTINDEXLEAFCELL_SHARED_OFFSET), which would be
+ * wrong for the other cells if a new cell were put before it. Such cells
+ * can only be put first in an empty node, so a node that gets a new first
+ * cell has to be rebuilt.
  *
  * Parameters
- * - bt: B-Tree file
- * - nroot: Page number of the root node of the B-Tree we want to insert
- *          this cell in.
- * - btc: BTreeCell to insert into B-Tree
+ * - btn: BTreeNode to insert cell in
+ * - ncell: Cell number
+ * - cell: BTreeCell to insert.
  *
  * Return
  * - CHIDB_OK: Operation successful
- * - CHIDB_EDUPLICATE: An entry with that key already exists
- * - CHIDB_ENOMEM: Could not allocate memory
- * - CHIDB_EIO: An I/O error has occurred when accessing the file
+ * - CHIDB_ECELLNO: The provided cell number is invalid
  */
-int chidb_Btree_insert(BTree *bt, npage_t nroot, BTreeCell *btc)
+int chidb_Btree_insertCell(BTreeNode *btn, ncell_t ncell, BTreeCell *cell)
 {
-    BTreeNode *root;
-    BTreeNode *new_child;
-
-    BTreeCell temp_cell;
+    uint8_t *dat = btn->page->data;
+    uint8_t *cell_pointer = NULL;
+    uint8_t hexg[] = {0x0B, 0x03, 0x04, 0x04};
+    uint8_t ks = btn->key_size;
+    uint32_t local, size, shared, len;
+    BTreeCell first;
 
-    int status, i;
-    uint8_t beginning_root_type;
-    npage_t lower_num, new_child_num;
+    // eight-byte keys are 8-byte integers in the index cell's record header
+    if (ks == KEYSIZE_WIDE)
+        hexg[2] = hexg[3] = SQL_INTEGER_8BYTE;
 
-    if ((status = chidb_Btree_getNodeByPage(bt, nroot, &root)) != CHIDB_OK) {
-        return status;
+    if(ncell < 0 || ncell > btn->n_cells) {
+            return CHIDB_ECELLNO;
     }
 
-    /*
-     * WHERE IS THIS NODE FREE'D???
-     */
+    switch(btn->type) {
+        case PGTYPE_TABLE_LEAF:
+            // only a prefix of the data goes in the page if it overflows
+            local = chidb_Btree_localSize(btn->page->size, ks, cell->fields.tableLeaf.data_size);
+            size = TABLELEAFCELL_SIZE_WITHOUTDATA(ks) + local;
+            if (local < cell->fields.tableLeaf.data_size)
+                size += TABLELEAFCELL_OVERFLOW_SIZE;
 
-    if (!hasRoomForCell(root, btc)) {
+            cell_pointer = dat + btn->cells_offset - size;
 
-	// root doesn't have room, so we need to prepare a new right child and populate it with everything in the root
+            putVarint32(cell_pointer, cell->fields.tableLeaf.data_size);
 
-	// prepare new node and initialize (accomplished by newNode...calls initEmptyNode)
-	if ((status = chidb_Btree_newNode(bt, &new_child_num, root->type)) != CHIDB_OK) {
-	    return status;
-	}
-	// get that new node into the new_child btn
-	if ((status = chidb_Btree_getNodeByPage(bt, new_child_num, &new_child)) != CHIDB_OK) {
-	    return status;
-	}
-	
-	// now, dump everything from the root into this new child node
-	for (i = 0; i < root->n_cells; i++) {
-	    // get the cell
-	    if ((status = chidb_Btree_getCell(root, i, &temp_cell)) != CHIDB_OK) {
-		return status;
-	    }
-	    // put the cell
-	    if ((status = chidb_Btree_insertCell(new_child, i, &temp_cell)) != CHIDB_OK) {
-		return status;
-	    }
-	}
+            chidb_Btree_putTableKey(ks, cell_pointer + TABLELEAFCELL_KEY_OFFSET, cell->key);
 
-	// in case we're splitting a root at any point other than the beginning, the root is going to have a right_page
-	// this needs to be preserved in the new_child prior to splitting.
-	switch(root->type) {
-	case PGTYPE_INDEX_INTERNAL:
-	case PGTYPE_TABLE_INTERNAL:
-	    new_child->right_page = root->right_page;
-	    break;
+            memcpy(cell_pointer + TABLELEAFCELL_DATA_OFFSET(ks), cell->fields.tableLeaf.data, local);
+            if (local < cell->fields.tableLeaf.data_size)
+                put4byte(cell_pointer + TABLELEAFCELL_DATA_OFFSET(ks) + local, cell->fields.tableLeaf.overflow);
+
+            btn->cells_offset -= size;
+
+        break;
+        case PGTYPE_TABLE_INTERNAL:
+            cell_pointer = dat + btn->cells_offset - TABLEINTCELL_SIZE(ks);
+
+            put4byte(cell_pointer, cell->fields.tableInternal.child_page);
+            chidb_Btree_putTableKey(ks, cell_pointer + TABLEINTCELL_KEY_OFFSET, cell->key);
+
+            btn->cells_offset -= TABLEINTCELL_SIZE(ks);
+
+        break;
+        case PGTYPE_INDEX_INTERNAL:
+            cell_pointer = dat + btn->cells_offset - INDEXINTCELL_SIZE(ks);
+
+            put4byte(cell_pointer, cell->fields.indexInternal.child_page);
+            memcpy(cell_pointer + 4, hexg, 4);
+            chidb_Btree_putIndexKey(ks, cell_pointer + INDEXINTCELL_KEYIDX_OFFSET, cell->key);
+            chidb_Btree_putIndexKey(ks, cell_pointer + INDEXINTCELL_KEYPK_OFFSET(ks), cell->fields.indexInternal.keyPk);
+
+            btn->cells_offset -= INDEXINTCELL_SIZE(ks);
+
+        break;
+        case PGTYPE_INDEX_LEAF:
+            cell_pointer = dat + btn->cells_offset - INDEXLEAFCELL_SIZE(ks);
+
+            memcpy(cell_pointer, hexg, 4);
+            chidb_Btree_putIndexKey(ks, cell_pointer + INDEXLEAFCELL_KEYIDX_OFFSET, cell->key);
+            chidb_Btree_putIndexKey(ks, cell_pointer + INDEXLEAFCELL_KEYPK_OFFSET(ks), cell->fields.indexLeaf.keyPk);
+
+            btn->cells_offset -= INDEXLEAFCELL_SIZE(ks);
+        break;
+        case PGTYPE_TEXTINDEX_LEAF:
+        case PGTYPE_TEXTINDEX_INTERNAL:
+            if (ncell == 0 && btn->n_cells > 0)
+                return CHIDB_ECELLNO;
+
+            shared = 0;
+            if (btn->n_cells > 0) {
+                chidb_Btree_getCell(btn, 0, &first);
+                shared = chidb_Btree_textShared(cell, &first);
+            }
+            len = chidb_Btree_textLength(cell);
+            size = chidb_Btree_textCellSize(btn->type, ks, cell, len - shared);
+            cell_pointer = dat + btn->cells_offset - size;
+
+            if (btn->type == PGTYPE_TEXTINDEX_LEAF) {
+                put2byte(cell_pointer + TEXTINDEXLEAFCELL_SHARED_OFFSET, shared);
+                put2byte(cell_pointer + TEXTINDEXLEAFCELL_SUFFIXLEN_OFFSET, len - shared);
+                chidb_Btree_putIndexKey(ks, cell_pointer + TEXTINDEXLEAFCELL_KEYPK_OFFSET, cell->fields.textIndex.keyPk);
+                chidb_Btree_textCopyFrom(cell, shared, cell_pointer + TEXTINDEXLEAFCELL_SUFFIX_OFFSET(ks));
+            } else {
+                put4byte(cell_pointer + TEXTINDEXINTCELL_CHILD_OFFSET, cell->fields.textIndex.child_page);
+                put2byte(cell_pointer + TEXTINDEXINTCELL_SHARED_OFFSET, shared);
+                put2byte(cell_pointer + TEXTINDEXINTCELL_SUFFIXLEN_OFFSET, len - shared);
+                cell_pointer[TEXTINDEXINTCELL_FLAGS_OFFSET] = cell->fields.textIndex.has_pk ? TEXTINDEXINTCELL_HAS_PK : 0;
+                if (cell->fields.textIndex.has_pk)
+                    chidb_Btree_putIndexKey(ks, cell_pointer + TEXTINDEXINTCELL_KEYPK_OFFSET, cell->fields.textIndex.keyPk);
+                chidb_Btree_textCopyFrom(cell, shared, cell_pointer + size - (len - shared));
+            }
+
+            btn->cells_offset -= size;
+        break;
+    default:
+	exit(1);
+
+    }
+ 
+    memmove(btn->celloffset_array + (ncell * 2) + 2, btn->celloffset_array + (ncell * 2), (btn->n_cells - ncell) * 2);
+    put2byte(btn->celloffset_array + (ncell * 2), btn->cells_offset);
+    btn->n_cells++;
+    btn->free_offset += 2;
+
+    return CHIDB_OK;
+}
+
+
+/* Replace the data of a cell in a table leaf node
+ *
+ * The new cell is written over the old one if it is not larger, and into
+ * the free space of the node otherwise (the bytes of the old one then go
+ * unused until the node is next rebuilt). Either way it keeps its place
+ * in the cell offset array, and no other cell moves, so the node is all
+ * that changes. Cells whose data overflows, before or after, are left
+ * alone: their overflow pages would have to be freed or written.
+ *
+ * The node is not written.
+ *
+ * Parameters
+ * - btn: Table leaf node
+ * - ncell: Cell number
+ * - cell: New cell. Its key is not used (the cell keeps its key).
+ *
+ * Return
+ * - true if the cell was replaced
+ * - false if it does not fit, and has to be deleted and inserted instead
+ */
+bool chidb_Btree_replaceCell(BTreeNode *btn, ncell_t ncell, BTreeCell *cell)
+{
+    uint8_t ks = btn->key_size;
+    uint32_t data_size = cell->fields.tableLeaf.data_size;
+    uint32_t size = TABLELEAFCELL_SIZE_WITHOUTDATA(ks) + data_size;
+    uint8_t *cell_pointer;
+    BTreeCell old;
+
+    if (btn->type != PGTYPE_TABLE_LEAF || ncell >= btn->n_cells)
+        return false;
+
+    chidb_Btree_getCell(btn, ncell, &old);
+    if (old.fields.tableLeaf.overflow != 0
+            || chidb_Btree_localSize(btn->page->size, ks, data_size) < data_size)
+        return false;
+
+    if (size <= TABLELEAFCELL_SIZE_WITHOUTDATA(ks) + old.fields.tableLeaf.data_size)
+        cell_pointer = btn->page->data + get2byte(btn->celloffset_array + (ncell * 2));
+    else if (btn->cells_offset - btn->free_offset >= size) {
+        btn->cells_offset -= size;
+        cell_pointer = btn->page->data + btn->cells_offset;
+        put2byte(btn->celloffset_array + (ncell * 2), btn->cells_offset);
+    }
+    else
+        return false;
+
+    putVarint32(cell_pointer, data_size);
+    chidb_Btree_putTableKey(ks, cell_pointer + TABLELEAFCELL_KEY_OFFSET, old.key);
+    memcpy(cell_pointer + TABLELEAFCELL_DATA_OFFSET(ks), cell->fields.tableLeaf.data, data_size);
+
+    return true;
+}
+
+/* Find the leaf cell with a given key in a table B-Tree
+ *
+ * The tree is walked iteratively, and no memory is allocated. The leaf
+ * page stays pinned, and the cell is only valid until it is released.
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_ENOTFOUND: No entry with the given key was found
+ * - CHIDB_ECORRUPT: The tree is not a table B-Tree
+ * - CHIDB_EPAGENO: The tree refers to an invalid page
+ * - CHIDB_EIO: An I/O error has occurred when accessing the file
+ */
+static int chidb_Btree_findCell(BTree *bt, npage_t nroot, chidb_key_t key, MemPage **page, BTreeCell *cell)
+{
+    BTreeNode btn;
+    npage_t npage = nroot;
+    ncell_t i;
+    int status;
+
+    for (;;) {
+        if ((status = chidb_Pager_readPage(bt->pager, npage, page)) != CHIDB_OK) {
+            return status;
+        }
+        chidb_Btree_loadNode(*page, &btn);
+
+        if (btn.type != PGTYPE_TABLE_INTERNAL && btn.type != PGTYPE_TABLE_LEAF) {
+            chidb_Pager_releaseMemPage(bt->pager, *page);
+            return CHIDB_ECORRUPT;
+        }
+
+        if (btn.type == PGTYPE_TABLE_LEAF) {
+            if (chidb_Btree_searchNode(&btn, key, &i) != CHIDB_TRUE) {
+                chidb_Pager_releaseMemPage(bt->pager, *page);
+                return CHIDB_ENOTFOUND;
+            }
+
+            chidb_Btree_tableLeafCell(&btn, i, cell);
+            return CHIDB_OK;
+        }
+
+        chidb_Btree_searchInternal(bt, &btn, key, &npage);
+
+        if ((status = chidb_Pager_releaseMemPage(bt->pager, *page)) != CHIDB_OK) {
+            return status;
+        }
+    }
+}
+
+
+/* Find an entry in a table B-Tree
+ *
+ * Finds the data associated for a given key in a table B-Tree
+ *
+ * Parameters
+ * - bt: B-Tree file
+ * - nroot: Page number of the root node of the B-Tree we want search in
+ * - key: Entry key
+ * - data: Out-parameter where a copy of the data must be stored
+ * - size: Number of bytes of data
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_ENOTFOUND: No entry with the given key was found
+ * - CHIDB_ENOMEM: Could not allocate memory
+ * - CHIDB_EIO: An I/O error has occurred when accessing the file
+ */
+int chidb_Btree_find(BTree *bt, npage_t nroot, chidb_key_t key, uint8_t **data, uint32_t *size)
+{
+    MemPage *page;
+    BTreeCell cell;
+    int status;
+
+    if ((status = chidb_Btree_findCell(bt, nroot, key, &page, &cell)) != CHIDB_OK) {
+        return status;
+    }
+
+    *size = cell.fields.tableLeaf.data_size;
+    (*data) = (uint8_t *) malloc(sizeof(uint8_t) * (*size));
+    if (!(*data)) {
+        chidb_Btree_releaseRef(bt, page);
+        return CHIDB_ENOMEM;
+    }
+
+    // the data may continue in overflow pages
+    if ((status = chidb_Btree_readPayload(bt, &cell, *data)) != CHIDB_OK) {
+        free(*data);
+        chidb_Btree_releaseRef(bt, page);
+        return status;
+    }
+
+    return chidb_Btree_releaseRef(bt, page);
+}
+
+
+/* Find an entry in a table B-Tree, without copying it
+ *
+ * Like chidb_Btree_find, but instead of returning a copy of the data,
+ * returns a pointer straight into the leaf page that contains it. The
+ * leaf page stays pinned in the Pager until chidb_Btree_releaseRef is
+ * called on it, and the data pointer is only valid until then.
+ * The tree is walked iteratively, and no memory is allocated.
+ *
+ * Parameters
+ * - bt: B-Tree file
+ * - nroot: Page number of the root node of the B-Tree we want search in
+ * - key: Entry key
+ * - page: Out-parameter with the page that must be released
+ * - data: Out-parameter with a pointer to the data (inside page)
+ * - size: Number of bytes of data
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_ENOTFOUND: No entry with the given key was found
+ * - CHIDB_EMISMATCH: The data does not fit in the page (it has overflow
+ *                    pages), so it can only be read with chidb_Btree_find
+ * - CHIDB_EPAGENO: The tree refers to an invalid page
+ * - CHIDB_EIO: An I/O error has occurred when accessing the file
+ */
+int chidb_Btree_findRef(BTree *bt, npage_t nroot, chidb_key_t key, MemPage **page, uint8_t **data, uint32_t *size)
+{
+    BTreeCell cell;
+    int status;
+
+    if ((status = chidb_Btree_findCell(bt, nroot, key, page, &cell)) != CHIDB_OK) {
+        return status;
+    }
+
+    if (cell.fields.tableLeaf.overflow != 0) {
+        chidb_Pager_releaseMemPage(bt->pager, *page);
+        return CHIDB_EMISMATCH;
+    }
+
+    *data = cell.fields.tableLeaf.data;
+    *size = cell.fields.tableLeaf.data_size;
+
+    return CHIDB_OK;
+}
+
+
+static int chidb_Btree_findManyIn(BTree *bt, npage_t npage, chidb_key_t *keys, uint32_t n,
+                                  chidb_Btree_findCallback found, void *ctx)
+{
+    MemPage *page;
+    BTreeNode btn;
+    BTreeCell cell;
+    uint8_t *buf;
+    uint32_t first = 0, last;
+    ncell_t i = 0;
+    int status;
+
+    if ((status = chidb_Pager_readPage(bt->pager, npage, &page)) != CHIDB_OK) {
+        return status;
+    }
+    chidb_Btree_loadNode(page, &btn);
+
+    if (btn.type != PGTYPE_TABLE_INTERNAL && btn.type != PGTYPE_TABLE_LEAF) {
+        chidb_Pager_releaseMemPage(bt->pager, page);
+        return CHIDB_ECORRUPT;
+    }
+
+    if (btn.type == PGTYPE_TABLE_LEAF) {
+        for (last = 0; last < n && status == CHIDB_OK; last++) {
+            if (chidb_Btree_searchNode(&btn, keys[last], &i) != CHIDB_TRUE) {
+                continue;
+            }
+
+            chidb_Btree_tableLeafCell(&btn, i, &cell);
+            if ((status = chidb_Btree_loadPayload(bt, &cell, &buf)) == CHIDB_OK) {
+                status = found(ctx, keys[last], cell.fields.tableLeaf.data, cell.fields.tableLeaf.data_size);
+                free(buf);
+            }
+        }
+
+        chidb_Pager_releaseMemPage(bt->pager, page);
+        return status;
+    }
+
+    // the keys go down to the first child whose key is >= them, and
+    // children none of them go down to are not read at all
+    while (first < n && status == CHIDB_OK) {
+        npage_t child;
+
+        while (i < btn.n_cells && chidb_Btree_tableInternalKey(&btn, i) < keys[first]) {
+            i++;
+        }
+
+        last = first + 1;
+        if (i < btn.n_cells) {
+            chidb_key_t key = chidb_Btree_tableInternalKey(&btn, i);
+
+            child = chidb_Btree_tableInternalChild(&btn, i);
+            while (last < n && keys[last] <= key) {
+                last++;
+            }
+        } else {
+            child = btn.right_page;
+            last = n;
+        }
+
+        status = chidb_Btree_findManyIn(bt, child, keys + first, last - first, found, ctx);
+        first = last;
+    }
+
+    chidb_Pager_releaseMemPage(bt->pager, page);
+    return status;
+}
+
+static int chidb_Btree_keyCmp(const void *a, const void *b)
+{
+    chidb_key_t ka = *(const chidb_key_t *) a;
+    chidb_key_t kb = *(const chidb_key_t *) b;
+
+    return (ka > kb) - (ka < kb);
+}
+
+/* Find several entries in a table B-Tree at once
+ *
+ * The keys are sorted (in place), and then looked up in a single walk
+ * down the tree, from left to right: each node is read once for all the
+ * keys that go through it, instead of once per key, and nodes that none
+ * of the keys are in are not read at all. For every key that is found,
+ * in key order, the callback is called with the entry's data, which is
+ * only valid during the call. Keys that are not found are skipped.
+ *
+ * Parameters
+ * - bt: B-Tree file
+ * - nroot: Page number of the root node of the B-Tree we want search in
+ * - keys: Entry keys (sorted in place)
+ * - n: Number of keys
+ * - found: Called for every entry found. If it returns anything other
+ *          than CHIDB_OK, the search stops, and that is returned.
+ * - ctx: Passed to found
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_ECORRUPT: The tree is not a table B-Tree
+ * - CHIDB_ENOMEM: Could not allocate memory
+ * - CHIDB_EIO: An I/O error has occurred when accessing the file
+ * - Whatever found returns, if not CHIDB_OK
+ */
+int chidb_Btree_findMany(BTree *bt, npage_t nroot, chidb_key_t *keys, uint32_t n,
+                         chidb_Btree_findCallback found, void *ctx)
+{
+    if (n == 0) {
+        return CHIDB_OK;
+    }
+
+    qsort(keys, n, sizeof(chidb_key_t), chidb_Btree_keyCmp);
+
+    return chidb_Btree_findManyIn(bt, nroot, keys, n, found, ctx);
+}
+
+
+/* Release an entry returned by chidb_Btree_findRef
+ *
+ * Parameters
+ * - bt: B-Tree file
+ * - page: Page returned by chidb_Btree_findRef
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ */
+int chidb_Btree_releaseRef(BTree *bt, MemPage *page)
+{
+    return chidb_Pager_releaseMemPage(bt->pager, page);
+}
+
+
+/* Estimate the number of entries in a B-Tree
+ *
+ * Only the leftmost path from the root to a leaf is read, and every node
+ * is assumed to have as many cells as the one on that path at the same
+ * depth. This is cheap (one page per level), and close enough for the
+ * optimizer to compare the sizes of two tables.
+ *
+ * Parameters
+ * - bt: B-Tree file
+ * - nroot: Page number of the root node of the B-Tree
+ * - nentries: Out parameter. Used to return the estimate.
+ * - depth: Out parameter. Number of nodes on a path from the root to a
+ *          leaf, which is what it costs to look up a key (can be NULL)
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_EPAGENO: The provided page number is not valid
+ * - CHIDB_ENOMEM: Could not allocate memory
+ * - CHIDB_EIO: An I/O error has occurred when accessing the file
+ */
+int chidb_Btree_estimateEntries(BTree *bt, npage_t nroot, uint64_t *nentries, uint32_t *depth)
+{
+    BTreeNode *btn;
+    npage_t npage = nroot;
+    uint64_t n = 1;
+    uint32_t levels = 0;
+    int rc;
+
+    for (;;)
+    {
+        levels++;
+        if ((rc = chidb_Btree_getNodeByPage(bt, npage, &btn)) != CHIDB_OK)
+            return rc;
+
+        if (!PGTYPE_IS_INTERNAL(btn->type) || btn->n_cells == 0)
+        {
+            n *= btn->n_cells;
+            chidb_Btree_freeMemNode(bt, btn);
+            break;
+        }
+
+        // the entries in the cells of an index's internal nodes are
+        // few enough to be left out
+        n *= btn->n_cells + 1;
+
+        npage = chidb_Btree_getChild(btn, 0);
+        chidb_Btree_freeMemNode(bt, btn);
+    }
+
+    *nentries = n;
+    if (depth)
+        *depth = levels;
+
+    return CHIDB_OK;
+}
+
+
+/* Count the entries in a B-Tree
+ *
+ * Every node is read, but only the headers of the leaves (which have the
+ * number of cells in them) are needed to count their entries, so no
+ * record is decoded. Internal nodes are only read for their child
+ * pages (and, in an index, their cells are entries as well).
+ *
+ * Parameters
+ * - bt: B-Tree file
+ * - nroot: Page number of the root node of the B-Tree
+ * - nentries: Out parameter. Used to return the count.
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_EPAGENO: The provided page number is not valid
+ * - CHIDB_ENOMEM: Could not allocate memory
+ * - CHIDB_EIO: An I/O error has occurred when accessing the file
+ */
+int chidb_Btree_countEntries(BTree *bt, npage_t nroot, uint64_t *nentries)
+{
+    BTreeNode *btn;
+    uint64_t n = 0, nchild;
+    int rc;
+
+    if ((rc = chidb_Btree_getNodeByPage(bt, nroot, &btn)) != CHIDB_OK)
+        return rc;
+
+    if (!PGTYPE_IS_INTERNAL(btn->type))
+    {
+        *nentries = btn->n_cells;
+        return chidb_Btree_freeMemNode(bt, btn);
+    }
+
+    if (btn->type == PGTYPE_INDEX_INTERNAL)
+        n = btn->n_cells;
+
+    for (ncell_t i = 0; i <= btn->n_cells && rc == CHIDB_OK; i++)
+    {
+        if ((rc = chidb_Btree_countEntries(bt, chidb_Btree_getChild(btn, i), &nchild)) == CHIDB_OK)
+            n += nchild;
+    }
+
+    chidb_Btree_freeMemNode(bt, btn);
+    *nentries = n;
+
+    return rc;
+}
+
+
+/* Insert an entry into a table B-Tree
+ *
+ * This is a convenience function that wraps around chidb_Btree_insert.
+ * It takes a key and data, and creates a BTreeCell that can be passed
+ * along to chidb_Btree_insert.
+ *
+ * Parameters
+ * - bt: B-Tree file
+ * - nroot: Page number of the root node of the B-Tree we want to insert
+ *          this entry in.
+ * - key: Entry key
+ * - data: Pointer to data we want to insert
+ * - size: Number of bytes of data
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_EDUPLICATE: An entry with that key already exists
+ * - CHIDB_ENOMEM: Could not allocate memory
+ * - CHIDB_EIO: An I/O error has occurred when accessing the file
+ */
+int chidb_Btree_insertInTable(BTree *bt, npage_t nroot, chidb_key_t key, uint8_t *data, uint32_t size)
+{
+    BTreeCell btc;
+
+    btc.type = PGTYPE_TABLE_LEAF;
+    btc.key = key;
+    btc.fields.tableLeaf.data_size = size;
+    btc.fields.tableLeaf.data = data;
+
+    return chidb_Btree_insert(bt, nroot, &btc);
+
+}
+
+
+/* Insert an entry into an index B-Tree
+ *
+ * This is a convenience function that wraps around chidb_Btree_insert.
+ * It takes a KeyIdx and a KeyPk, and creates a BTreeCell that can be passed
+ * along to chidb_Btree_insert.
+ *
+ * Parameters
+ * - bt: B-Tree file
+ * - nroot: Page number of the root node of the B-Tree we want to insert
+ *          this entry in.
+ * - keyIdx: See The chidb File Format.
+ * - keyPk: See The chidb File Format.
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_EDUPLICATE: The index already has an entry with that keyIdx
+ *                     and keyPk (several entries can have the same keyIdx)
+ * - CHIDB_ENOMEM: Could not allocate memory
+ * - CHIDB_EIO: An I/O error has occurred when accessing the file
+ */
+int chidb_Btree_insertInIndex(BTree *bt, npage_t nroot, chidb_key_t keyIdx, chidb_key_t keyPk)
+{
+    BTreeCell btc;
+
+    btc.type = PGTYPE_INDEX_LEAF;
+    btc.key = keyIdx;
+    btc.fields.indexLeaf.keyPk = keyPk;
+
+    return chidb_Btree_insert(bt, nroot, &btc);
+
+}
+
+//Helper function for Btree_insert
+//Checks if node has room for the cell (for an internal node, for the
+//cell that splitting one of its children adds to it)
+int hasRoomForCell(BTreeNode *btn, BTreeCell *btc)
+{
+    int space, size;
+    uint8_t type = btc->type;
+    BTreeCell first;
+
+    size = 0;
+    space = btn->cells_offset - btn->free_offset;
+
+    if (PGTYPE_IS_INTERNAL(btn->type)) {
+        type = btn->type;
+    }
+
+    switch(type) {
+        case PGTYPE_TABLE_LEAF:
+            size = chidb_Btree_tableLeafCellSize(btn, btc);
+            break;
+        case PGTYPE_TABLE_INTERNAL:
+            size = TABLEINTCELL_SIZE(btn->key_size);
+            break;
+        case PGTYPE_INDEX_LEAF:
+            size = INDEXLEAFCELL_SIZE(btn->key_size);
+            break;
+        case PGTYPE_INDEX_INTERNAL:
+            size = INDEXINTCELL_SIZE(btn->key_size);
+            break;
+        case PGTYPE_TEXTINDEX_LEAF:
+        case PGTYPE_TEXTINDEX_INTERNAL:
+            // compressed against the first cell, as chidb_Btree_insertCell does
+            size = chidb_Btree_textLength(btc);
+            if (btn->n_cells > 0) {
+                chidb_Btree_getCell(btn, 0, &first);
+                size -= chidb_Btree_textShared(btc, &first);
+            }
+            size = chidb_Btree_textCellSize(type, btn->key_size, btc, size);
+            break;
+    }
+
+    // the cell also needs an entry in the cell offset array
+    if (space >= size + 2) {
+        return 1;
+    } else {
+        return 0;
+    }
+
+}
+
+static int chidb_Btree_insertInNode(BTree *bt, npage_t nroot, npage_t npage, BTreeCell *btc, bool edge);
+static int chidb_Btree_insertInFull(BTree *bt, npage_t nroot, npage_t npage, npage_t nchild, ncell_t i, BTreeCell *btc, bool edge);
+static int chidb_Btree_splitFor(BTree *bt, npage_t npage_parent, npage_t npage_child, ncell_t parent_ncell,
+                                BTreeCell *btc, npage_t *npage_child2);
+static int chidb_Btree_shift(BTree *bt, npage_t npage_parent, ncell_t i, BTreeCell *btc, bool *shifted);
+static uint16_t chidb_Btree_cellSize(BTreeNode *btn, BTreeCell *btc);
+static uint32_t chidb_Btree_capacity(BTree *bt, npage_t npage, uint8_t type);
+
+/* Whether btn is a non-empty leaf, and btc goes after all the entries in it */
+static bool chidb_Btree_appendsAfter(BTreeNode *btn, BTreeCell *btc)
+{
+    BTreeCell last;
+
+    if ((btn->type != PGTYPE_TABLE_LEAF && btn->type != PGTYPE_INDEX_LEAF) || btn->n_cells == 0) {
+        return false;
+    }
+
+    chidb_Btree_getCell(btn, btn->n_cells - 1, &last);
+
+    return chidb_Btree_compareCells(&last, btc) < 0;
+}
+
+/* Add a cell at the end of a leaf, if it has room and the key is larger
+ * than all the keys in it. Sets *appended accordingly. */
+static int chidb_Btree_appendToLeaf(BTree *bt, npage_t npage, BTreeCell *btc, bool *appended)
+{
+    BTreeNode *btn;
+    int status;
+
+    *appended = false;
+
+    if ((status = chidb_Btree_getNodeByPage(bt, npage, &btn)) != CHIDB_OK) {
+        return status;
+    }
+
+    if (btn->type == btc->type && hasRoomForCell(btn, btc) && chidb_Btree_appendsAfter(btn, btc)) {
+        if ((status = chidb_Btree_insertCell(btn, btn->n_cells, btc)) == CHIDB_OK) {
+            status = chidb_Btree_writeNode(bt, btn);
+        }
+        *appended = (status == CHIDB_OK);
+    }
+
+    chidb_Btree_freeMemNode(bt, btn);
+
+    return status;
+}
+
+/* Start a new last leaf, instead of splitting the last one
+ *
+ * When the last leaf of a B-Tree is full, and the new key is larger than
+ * all the others, splitting the leaf down the middle would leave it half
+ * empty for good, since no entry will ever be added to it again. The
+ * leaf is left as it is instead: it becomes the child of a new cell in the
+ * parent, and a new leaf with only the new entry becomes the parent's
+ * right page.
+ *
+ * In a table B-Tree, the new cell in the parent has the largest key in
+ * the leaf. In an index B-Tree, cells in internal nodes are entries too,
+ * so the last entry of the leaf is moved to the parent.
+ *
+ * Parameters
+ * - bt: B-Tree file
+ * - nroot: Page number of the root
+ * - npage_parent: Page number of the parent of the last leaf
+ * - child: The last leaf. It is freed here.
+ * - btc: BTreeCell to insert
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_ENOMEM: Could not allocate memory
+ * - CHIDB_EIO: An I/O error has occurred when accessing the file
+ */
+static int chidb_Btree_appendNewLeaf(BTree *bt, npage_t nroot, npage_t npage_parent, BTreeNode *child, BTreeCell *btc)
+{
+    BTreeNode *parent, *leaf;
+    BTreeCell last, sep;
+    npage_t nleaf, nchild = child->page->npage;
+    uint8_t type = child->type;
+    int status = CHIDB_OK;
+
+    chidb_Btree_getCell(child, child->n_cells - 1, &last);
+
+    if (type == PGTYPE_INDEX_LEAF) {
+        // the entry was added last, so it is also at the top of the cell area
+        if (get2byte(child->celloffset_array + (child->n_cells - 1) * 2) == child->cells_offset) {
+            child->cells_offset += INDEXLEAFCELL_SIZE(child->key_size);
+        }
+        child->n_cells--;
+        child->free_offset -= 2;
+        status = chidb_Btree_writeNode(bt, child);
+    }
+    chidb_Btree_freeMemNode(bt, child);
+    if (status != CHIDB_OK) {
+        return status;
+    }
+
+    if ((status = chidb_Btree_newNode(bt, &nleaf, type)) != CHIDB_OK) {
+        return status;
+    }
+    if ((status = chidb_Btree_getNodeByPage(bt, nleaf, &leaf)) != CHIDB_OK) {
+        return status;
+    }
+    if ((status = chidb_Btree_insertCell(leaf, 0, btc)) == CHIDB_OK) {
+        status = chidb_Btree_writeNode(bt, leaf);
+    }
+    chidb_Btree_freeMemNode(bt, leaf);
+    if (status != CHIDB_OK) {
+        return status;
+    }
+
+    if ((status = chidb_Btree_getNodeByPage(bt, npage_parent, &parent)) != CHIDB_OK) {
+        return status;
+    }
+
+    sep.key = last.key;
+    if (type == PGTYPE_TABLE_LEAF) {
+        sep.type = PGTYPE_TABLE_INTERNAL;
+        sep.fields.tableInternal.child_page = nchild;
+    } else {
+        sep.type = PGTYPE_INDEX_INTERNAL;
+        sep.fields.indexInternal.keyPk = last.fields.indexLeaf.keyPk;
+        sep.fields.indexInternal.child_page = nchild;
+    }
+
+    if ((status = chidb_Btree_insertCell(parent, parent->n_cells, &sep)) == CHIDB_OK) {
+        parent->right_page = nleaf;
+        status = chidb_Btree_writeNode(bt, parent);
+    }
+    chidb_Btree_freeMemNode(bt, parent);
+
+    if (status == CHIDB_OK) {
+        bt->append_root = nroot;
+        bt->append_leaf = nleaf;
+        bt->stats.splits++;
+    }
+
+    return status;
+}
+
+/* Check that the keys of a new cell fit in a B-Tree file
+ *
+ * Any key fits in a file with eight-byte keys. Files with four-byte keys
+ * (see KEYSIZE_NARROW) only take table keys of up to 28 bits, and index
+ * keys that fit in a signed 32-bit integer. Such files have to be
+ * vacuumed (which rewrites them with eight-byte keys) before they can
+ * take larger keys. The texts of text indexes can be up to
+ * TEXTINDEX_MAXKEY bytes long in any file.
+ *
+ * Parameters
+ * - bt: B-Tree file
+ * - btc: New cell
+ *
+ * Return
+ * - CHIDB_OK: The keys fit
+ * - CHIDB_EMISMATCH: A key is too large for the file
+ */
+int chidb_Btree_checkKeys(BTree *bt, BTreeCell *btc)
+{
+    chidb_key_t keyPk;
+
+    if (PGTYPE_IS_TEXTINDEX(btc->type)
+            && chidb_Btree_textLength(btc) > TEXTINDEX_MAXKEY(bt->pager->page_size))
+        return CHIDB_EMISMATCH;
+
+    if (bt->key_size == KEYSIZE_WIDE)
+        return CHIDB_OK;
+
+    switch(btc->type) {
+        case PGTYPE_TABLE_LEAF:
+        case PGTYPE_TABLE_INTERNAL:
+            return btc->key <= NARROW_TABLEKEY_MAX ? CHIDB_OK : CHIDB_EMISMATCH;
+        case PGTYPE_TEXTINDEX_LEAF:
+        case PGTYPE_TEXTINDEX_INTERNAL:
+            keyPk = btc->fields.textIndex.keyPk;
+            return (int64_t) keyPk == (int32_t) keyPk ? CHIDB_OK : CHIDB_EMISMATCH;
+        default:
+            keyPk = (btc->type == PGTYPE_INDEX_LEAF) ? btc->fields.indexLeaf.keyPk : btc->fields.indexInternal.keyPk;
+            if ((int64_t) btc->key != (int32_t) btc->key || (int64_t) keyPk != (int32_t) keyPk)
+                return CHIDB_EMISMATCH;
+            return CHIDB_OK;
+    }
+}
+
+
+/* Insert a BTreeCell into a B-Tree
+ *
+ * The chidb_Btree_insert and chidb_Btree_insertNonFull functions
+ * are responsible for inserting new entries into a B-Tree, although
+ * chidb_Btree_insertNonFull is the one that actually does the
+ * insertion. chidb_Btree_insert, however, first checks if the root
+ * has to be split (a splitting operation that is different from
+ * splitting any other node). If so, chidb_Btree_split is called
+ * before calling chidb_Btree_insertNonFull.
+ *
+ * B-Trees are often filled in key order (e.g., a table with an increasing
+ * primary key, or an index on a timestamp), so the last leaf of the tree
+ * an entry was added at the end of is remembered. An entry with a
+ * larger key goes straight into that leaf if it has room, without going
+ * down from the root. If the last leaf is full, a new one is started
+ * (see chidb_Btree_appendNewLeaf), so leaves filled this way end up full.
+ *
+ * A table leaf cell whose data does not fit in a page has its tail
+ * written to overflow pages first (see chidb_Btree_spill). Entries of
+ * text indexes are inserted by chidb_Btree_insertText.
+ *
+ * Parameters
+ * - bt: B-Tree file
+ * - nroot: Page number of the root node of the B-Tree we want to insert
+ *          this cell in.
+ * - btc: BTreeCell to insert into B-Tree
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_EDUPLICATE: An entry with that key already exists
+ * - CHIDB_EMISMATCH: A key is too large for the file (see chidb_Btree_checkKeys)
+ * - CHIDB_ENOMEM: Could not allocate memory
+ * - CHIDB_EIO: An I/O error has occurred when accessing the file
+ */
+int chidb_Btree_insert(BTree *bt, npage_t nroot, BTreeCell *btc)
+{
+    BTreeNode *root;
+    BTreeNode *new_child;
+
+    BTreeCell temp_cell;
+
+    int status, i;
+    uint8_t beginning_root_type;
+    npage_t lower_num, new_child_num;
+    bool appended, append;
+
+    CHIDB_PROBE(btree__insert, nroot, btc->key, btc->type);
+
+    if (btc->type == PGTYPE_TEXTINDEX_LEAF) {
+        return chidb_Btree_insertText(bt, nroot, btc);
+    }
+
+    if ((status = chidb_Btree_checkKeys(bt, btc)) != CHIDB_OK) {
+        return status;
+    }
+
+    // which way entries are being added, in case a node has to be split
+    bt->insert_dir = (nroot != bt->last_root) ? 0 : (btc->key > bt->last_key) - (btc->key < bt->last_key);
+    bt->last_root = nroot;
+    bt->last_key = btc->key;
+
+    // data that does not fit in a page goes to overflow pages first, unless
+    // the key is taken (so that pages are not written for nothing)
+    if (btc->type == PGTYPE_TABLE_LEAF
+            && btc->fields.tableLeaf.data_size > TABLELEAFCELL_MAXLOCAL(bt->pager->page_size, bt->key_size)) {
+        MemPage *page;
+        if ((status = chidb_Btree_findCell(bt, nroot, btc->key, &page, &temp_cell)) == CHIDB_OK) {
+            chidb_Pager_releaseMemPage(bt->pager, page);
+            return CHIDB_EDUPLICATE;
+        }
+        if (status != CHIDB_ENOTFOUND) {
+            return status;
+        }
+    }
+    if ((status = chidb_Btree_spill(bt, btc)) != CHIDB_OK) {
+        return status;
+    }
+
+    if (nroot == bt->append_root && bt->append_leaf != 0) {
+        if ((status = chidb_Btree_appendToLeaf(bt, bt->append_leaf, btc, &appended)) != CHIDB_OK) {
+            return status;
+        }
+        if (appended) {
+            return CHIDB_OK;
+        }
+    }
+
+    if ((status = chidb_Btree_getNodeByPage(bt, nroot, &root)) != CHIDB_OK) {
+        return status;
+    }
+
+    if (!hasRoomForCell(root, btc)) {
+
+	// if the entry goes after all the others, the old root is kept whole
+	// as the first leaf, and the entry starts a new one (see below)
+	append = chidb_Btree_appendsAfter(root, btc);
+
+	// root doesn't have room, so we need to prepare a new right child and populate it with everything in the root
+
+	// prepare new node and initialize (accomplished by newNode...calls initEmptyNode)
+	if ((status = chidb_Btree_newNode(bt, &new_child_num, root->type)) != CHIDB_OK) {
+	    return status;
+	}
+	// get that new node into the new_child btn
+	if ((status = chidb_Btree_getNodeByPage(bt, new_child_num, &new_child)) != CHIDB_OK) {
+	    return status;
+	}
+	
+	// now, dump everything from the root into this new child node
+	for (i = 0; i < root->n_cells; i++) {
+	    // get the cell
+	    if ((status = chidb_Btree_getCell(root, i, &temp_cell)) != CHIDB_OK) {
+		return status;
+	    }
+	    // put the cell
+	    if ((status = chidb_Btree_insertCell(new_child, i, &temp_cell)) != CHIDB_OK) {
+		return status;
+	    }
+	}
+
+	// in case we're splitting a root at any point other than the beginning, the root is going to have a right_page
+	// this needs to be preserved in the new_child prior to splitting.
+	switch(root->type) {
+	case PGTYPE_INDEX_INTERNAL:
+	case PGTYPE_TABLE_INTERNAL:
+	    new_child->right_page = root->right_page;
+	    break;
 	default:
 	    break;
 	}
@@ -862,437 +2401,2665 @@ int chidb_Btree_insert(BTree *bt, npage_t nroot, BTreeCell *btc)
 	if ((status = chidb_Btree_writeNode(bt, new_child)) != CHIDB_OK) {
 	    return status;
 	}
-	if ((status = chidb_Btree_freeMemNode(bt, new_child)) != CHIDB_OK) {
-	    return status;
+	if ((status = chidb_Btree_freeMemNode(bt, new_child)) != CHIDB_OK) {
+	    return status;
+	}
+
+	// reinitialize the root as appropriate type (if formerly leaf, make internal)
+	beginning_root_type = root->type;
+
+	// CLOSE THE ROOT BEFORE REINITIALIZING!!!
+	if ((status = chidb_Btree_writeNode(bt, root)) != CHIDB_OK) {
+            return status;
+        }
+        if ((status = chidb_Btree_freeMemNode(bt, root)) != CHIDB_OK) {
+            return status;
+        }
+
+	switch(beginning_root_type) {
+	case PGTYPE_INDEX_LEAF:
+	case PGTYPE_INDEX_INTERNAL:
+	    if ((status = chidb_Btree_initEmptyNode(bt, nroot, PGTYPE_INDEX_INTERNAL)) != CHIDB_OK) {
+		return status;
+	    }
+	    break;
+	case PGTYPE_TABLE_LEAF:
+	case PGTYPE_TABLE_INTERNAL:
+	    if ((status = chidb_Btree_initEmptyNode(bt, nroot, PGTYPE_TABLE_INTERNAL)) != CHIDB_OK) {
+		return status;
+	    }
+	    break;
+	default:
+	    fprintf(stderr,"split: invalid root type\n");
+	    exit(1);
+	}
+
+	// re-open the root
+	if ((status = chidb_Btree_getNodeByPage(bt, nroot, &root)) != CHIDB_OK) {
+	    return status;
+	}
+
+	// set the root's right_page to the new_child_num
+	root->right_page = new_child_num;
+
+	// write and close the root
+	if ((status = chidb_Btree_writeNode(bt, root)) != CHIDB_OK) {
+	    return status;
+	}
+	if ((status = chidb_Btree_freeMemNode(bt, root)) != CHIDB_OK) {
+	    return status;
+	}
+
+	if (append) {
+	    if ((status = chidb_Btree_getNodeByPage(bt, new_child_num, &new_child)) != CHIDB_OK) {
+		return status;
+	    }
+	    return chidb_Btree_appendNewLeaf(bt, nroot, nroot, new_child, btc);
+	}
+
+	// split the root, unless it was empty (which only happens in page 1,
+	// where a large cell may not fit even then, e.g. after deletes)
+	if (i > 0 && (status = chidb_Btree_splitFor(bt, nroot, new_child_num, 0, btc, &lower_num)) != CHIDB_OK) {
+	    return status;
+	}
+
+    } else if ((status = chidb_Btree_freeMemNode(bt, root)) != CHIDB_OK) {
+        return status;
+    }
+
+    return chidb_Btree_insertInNode(bt, nroot, nroot, btc, true);
+
+}
+
+/* Insert a BTreeCell into a non-full B-Tree node
+ *
+ * chidb_Btree_insertNonFull inserts a BTreeCell into a node that is
+ * assumed not to be full (i.e., does not require splitting). If the
+ * node is a leaf node, the cell is directly added in the appropriate
+ * position according to its key. If the node is an internal node, the
+ * function will determine what child node it must insert it in, and
+ * calls itself recursively on that child node. However, before doing so
+ * it will check if the child node is full or not. If it is, then it will
+ * have to be split first.
+ *
+ * Parameters
+ * - bt: B-Tree file
+ * - nroot: Page number of the root node of the B-Tree we want to insert
+ *          this cell in.
+ * - btc: BTreeCell to insert into B-Tree
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_EDUPLICATE: An entry with that key already exists
+ * - CHIDB_ENOMEM: Could not allocate memory
+ * - CHIDB_EIO: An I/O error has occurred when accessing the file
+ */
+int chidb_Btree_insertNonFull(BTree *bt, npage_t npage, BTreeCell *btc)
+{
+    return chidb_Btree_insertInNode(bt, npage, npage, btc, false);
+}
+
+/* chidb_Btree_insertNonFull, for a node of the B-Tree rooted at nroot.
+ * edge is true if the node is on the right edge of the tree, i.e., if
+ * the keys in it are larger than all the others in the tree. */
+static int chidb_Btree_insertInNode(BTree *bt, npage_t nroot, npage_t npage, BTreeCell *btc, bool edge)
+{
+    BTreeNode *btn;
+    BTreeNode *child_btn;
+    BTreeCell temp_cell;
+    int i, status;
+    npage_t temp_right_page;
+
+    if ((status = chidb_Btree_getNodeByPage(bt, npage, &btn)) != CHIDB_OK) {
+        return status;
+    }
+
+    if(!npage) {
+	fprintf(stderr,"insertNonFull: npage is 0.......\n");
+	exit(1);
+    }
+
+    for (i = 0; i < btn->n_cells; i++) {
+
+        if (chidb_Btree_getCell(btn, i, &temp_cell) != CHIDB_OK) {
+	    fprintf(stderr,"insertNonFull: ecelno on cell (%d)\n",i);
+            return CHIDB_ECELLNO;
+        }
+        if (chidb_Btree_compareCells(&temp_cell, btc) == 0
+            && (btn->type != PGTYPE_TABLE_INTERNAL)) {
+
+            if ((status = chidb_Btree_freeMemNode(bt, btn)) != CHIDB_OK) {
+                return status;
+            }
+
+            return CHIDB_EDUPLICATE;
+
+        }
+
+
+        if (chidb_Btree_compareCells(btc, &temp_cell) <= 0) {
+            switch(btn->type) {
+                case PGTYPE_TABLE_INTERNAL:
+                    if ((status = chidb_Btree_freeMemNode(bt, btn)) != CHIDB_OK) {
+                        return status;
+                    }
+
+                    if ((status = chidb_Btree_getNodeByPage(bt, temp_cell.fields.tableInternal.child_page, &child_btn)) 
+                        != CHIDB_OK) {
+                        return status;
+                    }
+
+                    if (!hasRoomForCell(child_btn, btc)) {
+			// close child_btn
+			if ((status = chidb_Btree_freeMemNode(bt,child_btn)) != CHIDB_OK) {
+			    return status;
+			}
+                        return chidb_Btree_insertInFull(bt, nroot, npage, temp_cell.fields.tableInternal.child_page, i, btc, edge);
+                    }
+                    chidb_Btree_freeMemNode(bt, child_btn);
+
+                    return chidb_Btree_insertInNode(bt, nroot, temp_cell.fields.tableInternal.child_page, btc, false);
+
+                case PGTYPE_INDEX_INTERNAL:   
+                    if ((status = chidb_Btree_freeMemNode(bt, btn)) != CHIDB_OK) {
+                        return status;
+                    }
+
+                    if ((status = chidb_Btree_getNodeByPage(bt, temp_cell.fields.indexInternal.child_page, &child_btn)) 
+                        != CHIDB_OK) {
+                        return status;
+                    }
+
+                    if (!hasRoomForCell(child_btn, btc)) {
+			// close child_btn
+			if ((status = chidb_Btree_freeMemNode(bt,child_btn)) != CHIDB_OK) {
+			    return status;
+			}
+                        return chidb_Btree_insertInFull(bt, nroot, npage, temp_cell.fields.indexInternal.child_page, i, btc, edge);
+                    }
+                    chidb_Btree_freeMemNode(bt, child_btn);
+
+                    return chidb_Btree_insertInNode(bt, nroot, temp_cell.fields.indexInternal.child_page, btc, false);
+                    
+                case PGTYPE_TABLE_LEAF:
+                case PGTYPE_INDEX_LEAF:
+                    status = chidb_Btree_insertCell(btn, i, btc);
+                    chidb_Btree_writeNode(bt, btn);
+                    chidb_Btree_freeMemNode(bt, btn);
+                    return status;
+
+            }
+        }
+
+    }
+
+    if ((btn->type == PGTYPE_INDEX_LEAF) || (btn->type == PGTYPE_TABLE_LEAF)) {
+        status = chidb_Btree_insertCell(btn, i, btc);
+        chidb_Btree_writeNode(bt, btn);
+        chidb_Btree_freeMemNode(bt, btn);
+
+        // the entry went at the end of the tree; the next one may too
+        if (status == CHIDB_OK && edge) {
+            bt->append_root = nroot;
+            bt->append_leaf = npage;
+        }
+        return status;
+    } else {
+        temp_right_page = btn->right_page;
+
+        chidb_Btree_freeMemNode(bt, btn);
+
+        if ((status = chidb_Btree_getNodeByPage(bt, temp_right_page, &child_btn)) 
+            != CHIDB_OK) {
+            return status;
+        }
+
+        if (!hasRoomForCell(child_btn, btc)) {
+            if (edge && chidb_Btree_appendsAfter(child_btn, btc)) {
+                return chidb_Btree_appendNewLeaf(bt, nroot, npage, child_btn, btc);
+            }
+
+	    // close child_btn
+	    if ((status = chidb_Btree_freeMemNode(bt,child_btn)) != CHIDB_OK) {
+		return status;
+	    }
+            return chidb_Btree_insertInFull(bt, nroot, npage, temp_right_page, i, btc, edge);
+        }
+        chidb_Btree_freeMemNode(bt, child_btn);
+
+        return chidb_Btree_insertInNode(bt, nroot, temp_right_page, btc, edge);
+    }
+}
+
+/* Insert a BTreeCell under the i-th child of node npage, which is full
+ *
+ * A full leaf first tries to make room by spreading its cells (and the
+ * new one) over itself and a sibling (see chidb_Btree_shift). Otherwise,
+ * the child is split, at a point that depends on where the new entry
+ * goes (see chidb_Btree_split), and the insertion starts over at npage.
+ */
+static int chidb_Btree_insertInFull(BTree *bt, npage_t nroot, npage_t npage, npage_t nchild, ncell_t i, BTreeCell *btc, bool edge)
+{
+    npage_t child_num;
+    bool shifted;
+    int status;
+
+    if ((status = chidb_Btree_shift(bt, npage, i, btc, &shifted)) != CHIDB_OK || shifted) {
+        return status;
+    }
+    if ((status = chidb_Btree_splitFor(bt, npage, nchild, i, btc, &child_num)) != CHIDB_OK) {
+        return status;
+    }
+
+    return chidb_Btree_insertInNode(bt, nroot, npage, btc, edge);
+}
+
+
+/* Picks the cell a full node is split at (see chidb_Btree_split), given
+ * the entry that is about to be added under it.
+ *
+ * Entries that keep arriving in key order would leave every node they
+ * split half empty for good. So if the new entry goes after the one
+ * added before it (see chidb_Btree_insert) and after all the cells in the
+ * node, the node is split near its end, leaving a single cell in the
+ * upper half. Likewise, if it goes before the last entry and before all
+ * the cells, the lower half only gets a single cell (and the median
+ * moves up, in a leaf of a table). Any other entry, or one that would
+ * not fit in the small half, splits the node at its median.
+ */
+static int chidb_Btree_splitIndex(BTree *bt, BTreeNode *child, BTreeCell *btc)
+{
+    BTreeCell first, last;
+    int n = child->n_cells;
+    uint32_t need = 0;
+    bool table_leaf = (child->type == PGTYPE_TABLE_LEAF);
+
+    if (btc == NULL || bt->insert_dir == 0 || n < 4) {
+        return n / 2;
+    }
+
+    chidb_Btree_getCell(child, 0, &first);
+    chidb_Btree_getCell(child, n - 1, &last);
+
+    if (bt->insert_dir > 0 && btc->key > last.key) {
+        // only table leaf cells vary in size enough not to fit two to a page
+        if (table_leaf) {
+            need = chidb_Btree_cellSize(child, &last) + chidb_Btree_cellSize(child, btc);
+        }
+        return need <= chidb_Btree_capacity(bt, child->page->npage, child->type) ? n - 2 : n / 2;
+    }
+
+    if (bt->insert_dir < 0 && btc->key < first.key) {
+        if (table_leaf) {
+            need = chidb_Btree_cellSize(child, &first) + chidb_Btree_cellSize(child, btc);
+        }
+        return need <= chidb_Btree_capacity(bt, child->page->npage, child->type) ? (table_leaf ? 0 : 1) : n / 2;
+    }
+
+    return n / 2;
+}
+
+
+/* Split a B-Tree node
+ *
+ * Splits a B-Tree node N. This involves the following:
+ * - Find the median cell in N (or the cell to split it at, see below).
+ * - Create a new B-Tree node M.
+ * - Move the cells before the median cell to M (if the
+ *   cell is a table leaf cell, the median cell is moved too)
+ * - Add a cell to the parent (which, by definition, will be an
+ *   internal page) with the median key and the page number of M.
+ *
+ * When a node is split because of an insertion, the cell it is split at
+ * depends on where the new entry goes (see chidb_Btree_splitIndex).
+ *
+ * Parameters
+ * - bt: B-Tree file
+ * - npage_parent: Page number of the parent node
+ * - npage_child: Page number of the node to split
+ * - parent_ncell: Position in the parent where the new cell will
+ *                 be inserted.
+ * - npage_child2: Out parameter. Used to return the page of the new child node.
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_ENOMEM: Could not allocate memory
+ * - CHIDB_EIO: An I/O error has occurred when accessing the file
+ */
+int chidb_Btree_split(BTree *bt, npage_t npage_parent, npage_t npage_child, ncell_t parent_ncell, npage_t *npage_child2)
+{
+    return chidb_Btree_splitFor(bt, npage_parent, npage_child, parent_ncell, NULL, npage_child2);
+}
+
+/* chidb_Btree_split, for the insertion of btc (NULL to split at the median) */
+static int chidb_Btree_splitFor(BTree *bt, npage_t npage_parent, npage_t npage_child, ncell_t parent_ncell,
+                                BTreeCell *btc, npage_t *npage_child2)
+{
+
+    BTreeNode *parent;
+    BTreeNode *child;
+
+    BTreeNode *upper;
+    npage_t upper_num;
+
+    BTreeNode *lower;
+    npage_t lower_num, upper_right;
+
+    BTreeNode *temp;
+    npage_t temp_num;
+
+    BTreeCell insert_median_cell;
+    BTreeCell original_median_cell;
+    BTreeCell temp_cell;
+
+    int i, j, status, median_index;
+
+    //get parent page
+    if ((status = chidb_Btree_getNodeByPage(bt, npage_parent, &parent)) != CHIDB_OK) {
+        return status;
+    }
+
+    //get child page
+    if ((status = chidb_Btree_getNodeByPage(bt, npage_child, &child)) != CHIDB_OK) {
+        return status;
+    }
+
+    median_index = chidb_Btree_splitIndex(bt, child, btc);
+    CHIDB_PROBE(btree__split, npage_parent, npage_child, child->n_cells, median_index);
+
+    //initialize new node with page_num = lower_num
+    if ((status = chidb_Btree_newNode(bt, &lower_num, child->type)) != CHIDB_OK) {
+        return status;
+    }
+
+    //get page at page_num = lower_num
+    if ((status = chidb_Btree_getNodeByPage(bt, lower_num, &lower)) != CHIDB_OK) {
+        return status;
+    }
+
+    upper = child;
+    upper_num = npage_child;
+
+    //initialize new node with page_num = temp_num
+    if ((status = chidb_Btree_newNode(bt, &temp_num, child->type)) != CHIDB_OK) {
+        return status;
+    }
+
+    //get page at page_num = temp_num
+    if ((status = chidb_Btree_getNodeByPage(bt, temp_num, &temp))) {
+        return status;
+    }
+
+    //Setup insert_median_cell for insertion into parent
+    if ((status = chidb_Btree_getCell(child, median_index, &original_median_cell)) != CHIDB_OK) {
+        return status;
+    }
+
+    insert_median_cell.type = parent->type;
+    insert_median_cell.key = original_median_cell.key;
+
+    switch(insert_median_cell.type) {
+        case PGTYPE_TABLE_INTERNAL:
+            insert_median_cell.fields.tableInternal.child_page = lower_num;
+            break;
+        case PGTYPE_INDEX_INTERNAL:
+
+            insert_median_cell.fields.indexInternal.child_page = lower_num;
+
+            if (original_median_cell.type == PGTYPE_INDEX_INTERNAL) {
+                insert_median_cell.fields.indexInternal.keyPk = original_median_cell.fields.indexInternal.keyPk;
+            } else {
+                insert_median_cell.fields.indexInternal.keyPk = original_median_cell.fields.indexLeaf.keyPk;
+            }
+	    break;
+        default:
+	    fprintf(stderr,"split: type of parent should never be a leaf type; got type (%d)\n",insert_median_cell.type);
+	    exit(1);
+    }
+
+    //Insert insert_median_cell into parent
+    if ((status = chidb_Btree_insertCell(parent, parent_ncell, &insert_median_cell)) != CHIDB_OK) {
+
+	fprintf(stderr,"split: median cell insert into parent error (%d)\n",status);
+
+        return status;
+    }
+
+    //copy cells below the median to lower
+    for (i = 0; i < median_index; i++) {
+        if ((status = chidb_Btree_getCell(upper, i, &temp_cell)) != CHIDB_OK) {
+            return status;
+        }
+        if ((status = chidb_Btree_insertCell(lower, i, &temp_cell)) != CHIDB_OK) {
+            return status;
+        }
+    }
+
+    //copy original median cell if necessary
+    // get that original median cell into temp_cell
+    if ((status = chidb_Btree_getCell(upper, i, &temp_cell)) != CHIDB_OK) {
+	return status;
+    }	
+    if(upper->type == PGTYPE_TABLE_LEAF) {
+	if ((status = chidb_Btree_insertCell(lower, i, &temp_cell)) != CHIDB_OK) {
+	    return status;
+	}
+	i++;
+    } else if (temp_cell.type != PGTYPE_INDEX_LEAF) {
+	// if the type of the children is not a leaf type, then we must set right_page of lower to the former child of the median
+	switch(temp_cell.type) {
+	case PGTYPE_TABLE_INTERNAL:
+	    lower->right_page = temp_cell.fields.tableInternal.child_page;
+	    break;
+	case PGTYPE_INDEX_INTERNAL:
+	    lower->right_page = temp_cell.fields.indexInternal.child_page;
+	    break;
+	}
+	if(lower->right_page == 0) {
+	    fprintf(stderr,"split: 0 right page passed\n");
+	    exit(2);
 	}
+	i++;
+    } else {
+	// an index entry moves up to the parent, and must not stay in the child
+	i++;
+    }
+
+    //copy cells above the median to temp
+    for (j = 0; i < upper->n_cells; i++, j++) {
+        if ((status = chidb_Btree_getCell(upper, i, &temp_cell)) != CHIDB_OK) {
+            return status;
+        }
+        if ((status = chidb_Btree_insertCell(temp, j, &temp_cell)) != CHIDB_OK) {
+            return status;
+        }        
+    }
+
+    upper_right = upper->right_page;
+    // close upper
+
+    if ((status = chidb_Btree_freeMemNode(bt,upper)) != CHIDB_OK) {
+	return status;
+    }
+
+    //Clear upper
+    if ((status = chidb_Btree_initEmptyNode(bt, upper_num, temp->type)) != CHIDB_OK) {
+        return status;
+    }
+
+    // reopen upper
+
+    if ((status = chidb_Btree_getNodeByPage(bt, upper_num, &upper)) != CHIDB_OK) {
+	return status;
+    }
+    upper->right_page = upper_right;
+
+    //insert each cell in temp into upper
+    for (i = 0; i < temp->n_cells; i++) {
+        if ((status = chidb_Btree_getCell(temp, i, &temp_cell)) != CHIDB_OK) {
+            return status;
+        }
+        if ((status = chidb_Btree_insertCell(upper, i, &temp_cell)) != CHIDB_OK) {
+            return status;
+        }           
+    }
+
+    //free temp
+    //decrement number of pages (like it was never here), or give
+    //the page back if it was a free page
+    chidb_Btree_freeMemNode(bt, temp);
+    if (temp_num == bt->pager->n_pages) {
+        bt->pager->n_pages--;
+    } else if ((status = chidb_Btree_freePage(bt, temp_num)) != CHIDB_OK) {
+        return status;
+    }
+
+    //write parent
+    if ((status = chidb_Btree_writeNode(bt, parent)) != CHIDB_OK) {
+        return status;
+    }
+
+    //write upper
+    if ((status = chidb_Btree_writeNode(bt, upper)) != CHIDB_OK) {
+        return status;
+    }
+
+    //write lower
+    if ((status = chidb_Btree_writeNode(bt, lower)) != CHIDB_OK) {
+        return status;
+    }
+
+    //set out parameter to page number of child node
+    *npage_child2 = lower_num;
+
+    //free in-memory nodes
+    chidb_Btree_freeMemNode(bt, parent);
+    chidb_Btree_freeMemNode(bt, upper);
+    chidb_Btree_freeMemNode(bt, lower);
+
+    bt->stats.splits++;
+
+    return CHIDB_OK;
+
+}
+
+
+
+/*
+ * Bulk loading
+ *
+ * A bulk load builds a B-Tree bottom-up from entries that arrive in key
+ * order. Each level of the tree under construction has a scratch page,
+ * which holds the node currently being filled at that level. Once a node
+ * is full, it is written to a freshly allocated page and a reference to it
+ * is passed on to the level above. Each page is thus written exactly once,
+ * and no node is ever split.
+ *
+ * Internal levels keep the most recent child "pending" (i.e., not yet in
+ * a cell) because the last child of a node must go in right_page instead
+ * of a cell, and we only know which child is the last one when the next
+ * one arrives.
+ */
+
+#define BULK_MAX_LEVELS (32)
+
+typedef struct
+{
+    uint8_t *buf;          /* Scratch page */
+    MemPage page;          /* MemPage wrapping buf */
+    BTreeNode node;        /* Node being filled at this level */
+    bool has_child;        /* Internal levels: is there a pending child? */
+    npage_t child;         /* Pending child */
+    BTreeCell sep;         /* Separator between the pending child and the next one */
+    npage_t prev;          /* Last node written at this level (0 if none) */
+} BulkLevel;
+
+typedef struct
+{
+    BTree *bt;
+    npage_t nroot;
+    bool index;            /* Index B-Tree (as opposed to a table B-Tree) */
+    uint32_t reserve;      /* Bytes that must stay free in every node */
+    uint32_t leaf_reserve; /* Additional bytes that must stay free in leaf nodes */
+    int nlevels;
+    BulkLevel levels[BULK_MAX_LEVELS];
+} BulkState;
+
+
+/* Returns the number of bytes a cell takes up in a page (including its
+ * entry in the cell offset array) */
+static uint16_t chidb_Btree_cellSize(BTreeNode *btn, BTreeCell *btc)
+{
+    switch(btc->type) {
+        case PGTYPE_TABLE_LEAF:
+            return chidb_Btree_tableLeafCellSize(btn, btc) + 2;
+        case PGTYPE_TABLE_INTERNAL:
+            return TABLEINTCELL_SIZE(btn->key_size) + 2;
+        case PGTYPE_INDEX_LEAF:
+            return INDEXLEAFCELL_SIZE(btn->key_size) + 2;
+        case PGTYPE_TEXTINDEX_LEAF:
+        case PGTYPE_TEXTINDEX_INTERNAL:
+            // as stored in the node it was read from
+            return chidb_Btree_textCellSize(btc->type, btn->key_size, btc, btc->fields.textIndex.suffix_len) + 2;
+        default:
+            return INDEXINTCELL_SIZE(btn->key_size) + 2;
+    }
+}
+
+
+/* Checks whether a cell can be added to a node without going over the
+ * given reserve */
+static bool chidb_Btree_bulkFits(BTreeNode *btn, BTreeCell *btc, uint32_t reserve)
+{
+    int space = btn->cells_offset - btn->free_offset;
+
+    return space >= chidb_Btree_cellSize(btn, btc) + reserve;
+}
+
+
+/* Copies the key (and, in an index, the primary key) of a cell into a
+ * level's separator. Separators of index B-Trees are always stored as
+ * index leaf cells, and those of table B-Trees as table internal cells. */
+static void chidb_Btree_bulkSetSep(BulkState *st, BTreeCell *sep, BTreeCell *btc)
+{
+    sep->key = btc->key;
+    if (st->index) {
+        sep->type = PGTYPE_INDEX_LEAF;
+        sep->fields.indexLeaf.keyPk = (btc->type == PGTYPE_INDEX_LEAF) ? btc->fields.indexLeaf.keyPk : btc->fields.indexInternal.keyPk;
+    } else {
+        sep->type = PGTYPE_TABLE_INTERNAL;
+    }
+}
+
+
+/* Resets a level's scratch page to an empty node of the given type */
+static int chidb_Btree_bulkResetLevel(BTree *bt, BulkLevel *lvl, uint8_t type)
+{
+    uint32_t page_size = bt->pager->page_size;
+
+    if (lvl->buf == NULL && !(lvl->buf = malloc(page_size)))
+        return CHIDB_ENOMEM;
+
+    memset(lvl->buf, 0, page_size);
+    lvl->buf[0] = type;
+    put2byte(lvl->buf + 1, (type == PGTYPE_TABLE_INTERNAL || type == PGTYPE_INDEX_INTERNAL) ? 12 : 8);
+    put2byte(lvl->buf + 3, 0);
+    put2byte(lvl->buf + 5, page_size);
+    lvl->buf[PGHEADER_KEYSIZE_OFFSET] = PGHEADER_PUT_KEYSIZE(bt->key_size);
+
+    /* npage stays at 0 until the node is written out, so loadNode
+     * does not look for a file header in the scratch page */
+    lvl->page.npage = 0;
+    lvl->page.data = lvl->buf;
+    lvl->page.size = page_size;
+    lvl->page.pin_count = 0;
+    lvl->page.referenced = false;
+    lvl->page.pooled = false;
+    lvl->page.mapped = false;
+    lvl->page.dirty = false;
+
+    chidb_Btree_loadNode(&lvl->page, &lvl->node);
+
+    return CHIDB_OK;
+}
+
+
+/* Writes the node in a level's scratch page to a new page, and
+ * resets the scratch page */
+static int chidb_Btree_bulkWriteLevel(BulkState *st, BulkLevel *lvl, npage_t *npage)
+{
+    int status;
+    uint8_t type = lvl->node.type;
+
+    if ((status = chidb_Btree_allocPage(st->bt, npage)) != CHIDB_OK)
+        return status;
+
+    lvl->page.npage = *npage;
+    if ((status = chidb_Btree_writeNode(st->bt, &lvl->node)) != CHIDB_OK)
+        return status;
+
+    lvl->prev = *npage;
+
+    return chidb_Btree_bulkResetLevel(st->bt, lvl, type);
+}
+
+
+/* Passes a finished node on to level nlevel. sep is the separator
+ * between this node and the next one (NULL if this is the last node
+ * in the level below) */
+static int chidb_Btree_bulkAddChild(BulkState *st, int nlevel, npage_t child, BTreeCell *sep)
+{
+    int status;
+    BulkLevel *lvl;
+
+    if (nlevel == st->nlevels) {
+        if (nlevel == BULK_MAX_LEVELS)
+            return CHIDB_ENOMEM;
+
+        lvl = &st->levels[nlevel];
+        status = chidb_Btree_bulkResetLevel(st->bt, lvl, st->index ? PGTYPE_INDEX_INTERNAL : PGTYPE_TABLE_INTERNAL);
+        if (status != CHIDB_OK)
+            return status;
+        st->nlevels++;
+    }
+
+    lvl = &st->levels[nlevel];
+
+    if (lvl->has_child) {
+        BTreeCell cell;
+
+        cell.type = lvl->node.type;
+        cell.key = lvl->sep.key;
+        if (st->index) {
+            cell.fields.indexInternal.child_page = lvl->child;
+            cell.fields.indexInternal.keyPk = lvl->sep.fields.indexLeaf.keyPk;
+        } else {
+            cell.fields.tableInternal.child_page = lvl->child;
+        }
+
+        if (chidb_Btree_bulkFits(&lvl->node, &cell, st->reserve)) {
+            chidb_Btree_insertCell(&lvl->node, lvl->node.n_cells, &cell);
+        } else {
+            npage_t npage;
+            BTreeCell up = lvl->sep;
+
+            lvl->node.right_page = lvl->child;
+            if ((status = chidb_Btree_bulkWriteLevel(st, lvl, &npage)) != CHIDB_OK)
+                return status;
+            if ((status = chidb_Btree_bulkAddChild(st, nlevel + 1, npage, &up)) != CHIDB_OK)
+                return status;
+        }
+    }
+
+    lvl->has_child = true;
+    lvl->child = child;
+    if (sep != NULL)
+        chidb_Btree_bulkSetSep(st, &lvl->sep, sep);
+
+    return CHIDB_OK;
+}
+
+
+/* Fixes up an empty node at the end of a level
+ *
+ * When the last node of a level is written out right before the last
+ * entry (or child) arrives, the node that follows it ends up with no
+ * cells. This function moves the last entry of the previous node at this
+ * level through the parent separator, so that both nodes are well-formed.
+ */
+static int chidb_Btree_bulkBorrow(BulkState *st, int nlevel)
+{
+    int status;
+    BulkLevel *lvl = &st->levels[nlevel];
+    BulkLevel *parent = &st->levels[nlevel + 1];
+    MemPage *page;
+    BTreeNode prev;
+    BTreeCell last, cell;
+    uint16_t offset;
+
+    if ((status = chidb_Pager_readPage(st->bt->pager, lvl->prev, &page)) != CHIDB_OK)
+        return status;
+
+    chidb_Btree_loadNode(page, &prev);
+    if (prev.n_cells < 2) {
+        chidb_Pager_releaseMemPage(st->bt->pager, page);
+        return CHIDB_ECORRUPT;
+    }
+
+    chidb_Btree_getCell(&prev, prev.n_cells - 1, &last);
+
+    /* The parent separator moves down into this node... */
+    cell.type = lvl->node.type;
+    cell.key = parent->sep.key;
+    switch (cell.type) {
+        case PGTYPE_INDEX_LEAF:
+            cell.fields.indexLeaf.keyPk = parent->sep.fields.indexLeaf.keyPk;
+            break;
+        case PGTYPE_INDEX_INTERNAL:
+            cell.fields.indexInternal.keyPk = parent->sep.fields.indexLeaf.keyPk;
+            cell.fields.indexInternal.child_page = prev.right_page;
+            break;
+        default:
+            cell.fields.tableInternal.child_page = prev.right_page;
+            break;
+    }
+    chidb_Btree_insertCell(&lvl->node, 0, &cell);
+
+    /* ...and the last entry of the previous node takes its place */
+    chidb_Btree_bulkSetSep(st, &parent->sep, &last);
+    if (last.type == PGTYPE_TABLE_INTERNAL)
+        prev.right_page = last.fields.tableInternal.child_page;
+    else if (last.type == PGTYPE_INDEX_INTERNAL)
+        prev.right_page = last.fields.indexInternal.child_page;
+
+    /* Cells were added in order, so the last one is the lowest in the page */
+    offset = get2byte(prev.celloffset_array + (prev.n_cells - 1) * 2);
+    if (offset == prev.cells_offset)
+        prev.cells_offset += chidb_Btree_cellSize(&prev, &last) - 2;
+    prev.n_cells--;
+    prev.free_offset -= 2;
+
+    if ((status = chidb_Btree_writeNode(st->bt, &prev)) != CHIDB_OK) {
+        chidb_Pager_releaseMemPage(st->bt->pager, page);
+        return status;
+    }
+
+    return chidb_Pager_releaseMemPage(st->bt->pager, page);
+}
+
+
+/* Copies the top node of the tree into the root page */
+static int chidb_Btree_bulkWriteRoot(BulkState *st, BTreeNode *top)
+{
+    int status;
+    BTreeNode *root;
+    BTreeCell cell;
+    uint16_t header = (st->nroot == 1) ? 100 : 0;
+    bool internal = (top->type == PGTYPE_TABLE_INTERNAL || top->type == PGTYPE_INDEX_INTERNAL);
+
+    if ((status = chidb_Btree_getNodeByPage(st->bt, st->nroot, &root)) != CHIDB_OK)
+        return status;
+
+    /* The root is turned into an empty node of the right type by hand
+     * (rather than with initEmptyNode) to leave the file header alone */
+    root->type = top->type;
+    root->free_offset = header + (internal ? 12 : 8);
+    root->n_cells = 0;
+    root->cells_offset = st->bt->pager->page_size;
+    root->celloffset_array = root->page->data + root->free_offset;
+
+    for (ncell_t i = 0; i < top->n_cells; i++) {
+        chidb_Btree_getCell(top, i, &cell);
+        chidb_Btree_insertCell(root, i, &cell);
+    }
+    root->right_page = top->right_page;
+
+    if ((status = chidb_Btree_writeNode(st->bt, root)) != CHIDB_OK) {
+        chidb_Btree_freeMemNode(st->bt, root);
+        return status;
+    }
+
+    return chidb_Btree_freeMemNode(st->bt, root);
+}
+
+
+/* Adds an entry to the leaf level */
+static int chidb_Btree_bulkAddEntry(BulkState *st, BTreeCell *btc, chidb_key_t prev_key)
+{
+    int status;
+    npage_t npage;
+    BulkLevel *leaf = &st->levels[0];
+
+    /* The fill factor does not apply to the first entry of a leaf */
+    if (chidb_Btree_bulkFits(&leaf->node, btc, st->reserve + (leaf->node.n_cells ? st->leaf_reserve : 0)))
+        return chidb_Btree_insertCell(&leaf->node, leaf->node.n_cells, btc);
+
+    if (leaf->node.n_cells == 0)
+        return CHIDB_EMISUSE;
+
+    if ((status = chidb_Btree_bulkWriteLevel(st, leaf, &npage)) != CHIDB_OK)
+        return status;
+
+    if (st->index) {
+        /* In a B-Tree proper, the entry itself becomes the separator */
+        return chidb_Btree_bulkAddChild(st, 1, npage, btc);
+    } else {
+        /* In a B+Tree, the separator is the largest key in the leaf
+         * we just wrote, and the entry goes in the next leaf */
+        BTreeCell sep;
+
+        sep.type = PGTYPE_TABLE_INTERNAL;
+        sep.key = prev_key;
+        if ((status = chidb_Btree_bulkAddChild(st, 1, npage, &sep)) != CHIDB_OK)
+            return status;
+
+        return chidb_Btree_insertCell(&leaf->node, 0, btc);
+    }
+}
+
+
+/* Writes out the last node of every level, and the root */
+static int chidb_Btree_bulkFinish(BulkState *st)
+{
+    int status;
+    npage_t npage;
+
+    for (int i = 0; i < st->nlevels; i++) {
+        BulkLevel *lvl = &st->levels[i];
+
+        if (i > 0)
+            lvl->node.right_page = lvl->child;
+
+        if (i == st->nlevels - 1)
+            return chidb_Btree_bulkWriteRoot(st, &lvl->node);
+
+        if (lvl->node.n_cells == 0 && (status = chidb_Btree_bulkBorrow(st, i)) != CHIDB_OK)
+            return status;
+
+        if ((status = chidb_Btree_bulkWriteLevel(st, lvl, &npage)) != CHIDB_OK)
+            return status;
+        if ((status = chidb_Btree_bulkAddChild(st, i + 1, npage, NULL)) != CHIDB_OK)
+            return status;
+    }
+
+    return CHIDB_OK;
+}
+
+
+/* Bulk load a B-Tree
+ *
+ * Fills an empty B-Tree with entries provided, in ascending key order,
+ * by a callback function. Instead of inserting the entries one by one
+ * (which repeatedly descends the tree and splits nodes), the tree is
+ * built bottom-up: leaves are filled left to right, and the internal
+ * levels are built as the leaves are written out. Each page is written
+ * only once, and pages are allocated in order, so the leaves of the
+ * resulting tree are laid out sequentially in the file.
+ *
+ * Leaves are filled up to fill_factor percent of the page, leaving room
+ * for later insertions (internal nodes are always packed).
+ *
+ * Parameters
+ * - bt: B-Tree file
+ * - nroot: Page number of the root node of the B-Tree. It must be an empty
+ *          table leaf or index leaf node.
+ * - next: Callback function. Each call must fill in the next BTreeCell
+ *         (with the same type as the root node) and return CHIDB_OK, or
+ *         return CHIDB_DONE if there are no more entries. Any other return
+ *         value aborts the load and is returned by this function. The cell
+ *         (including its data) only needs to remain valid until the next
+ *         call.
+ * - ctx: Passed to the callback function
+ * - fill_factor: Percentage (1-100) of each leaf to fill. If 0,
+ *                DEFAULT_FILL_FACTOR is used.
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_EDUPLICATE: Two entries have the same key
+ * - CHIDB_EMISMATCH: A key is too large for the file (see chidb_Btree_checkKeys)
+ * - CHIDB_EMISUSE: The B-Tree is not empty, the entries are not in
+ *                  ascending order, a cell does not fit in a page,
+ *                  or fill_factor is invalid
+ * - CHIDB_ENOMEM: Could not allocate memory
+ * - CHIDB_EIO: An I/O error has occurred when accessing the file
+ */
+int chidb_Btree_bulkLoad(BTree *bt, npage_t nroot, chidb_Btree_bulkSource next, void *ctx, uint8_t fill_factor)
+{
+    int status;
+    BTreeNode *root;
+    BTreeCell btc, prev;
+    BulkState *st;
+    chidb_key_t prev_key = 0;
+    bool first = true;
+    int c;
+    uint32_t usable;
+
+    if (fill_factor == 0)
+        fill_factor = DEFAULT_FILL_FACTOR;
+    if (fill_factor > 100)
+        return CHIDB_EMISUSE;
+
+    if (nroot == bt->append_root)
+        bt->append_leaf = 0;
+
+    if ((status = chidb_Btree_getNodeByPage(bt, nroot, &root)) != CHIDB_OK)
+        return status;
+
+    if ((root->type != PGTYPE_TABLE_LEAF && root->type != PGTYPE_INDEX_LEAF) || root->n_cells != 0) {
+        chidb_Btree_freeMemNode(bt, root);
+        return CHIDB_EMISUSE;
+    }
+
+    if (!(st = calloc(1, sizeof(BulkState)))) {
+        chidb_Btree_freeMemNode(bt, root);
+        return CHIDB_ENOMEM;
+    }
+
+    st->bt = bt;
+    st->nroot = nroot;
+    st->index = (root->type == PGTYPE_INDEX_LEAF);
+    /* Every node must fit in the root page, in case it is the top one */
+    st->reserve = (nroot == 1) ? 100 : 0;
+    usable = bt->pager->page_size - st->reserve;
+    st->leaf_reserve = (usable * (100 - fill_factor)) / 100;
+    st->nlevels = 1;
+
+    status = chidb_Btree_bulkResetLevel(bt, &st->levels[0], root->type);
+    chidb_Btree_freeMemNode(bt, root);
+
+    while (status == CHIDB_OK) {
+        if ((status = next(ctx, &btc)) != CHIDB_OK)
+            break;
+
+        if (btc.type != st->levels[0].node.type) {
+            status = CHIDB_EMISUSE;
+        } else if (!first && (c = chidb_Btree_compareCells(&btc, &prev)) <= 0) {
+            status = (c == 0) ? CHIDB_EDUPLICATE : CHIDB_EMISUSE;
+        } else if ((status = chidb_Btree_checkKeys(bt, &btc)) == CHIDB_OK
+                && (status = chidb_Btree_spill(bt, &btc)) == CHIDB_OK) {
+            status = chidb_Btree_bulkAddEntry(st, &btc, prev_key);
+            prev_key = btc.key;
+            prev = btc;
+            first = false;
+        }
+    }
+
+    if (status == CHIDB_DONE)
+        status = chidb_Btree_bulkFinish(st);
+
+    for (int i = 0; i < st->nlevels; i++)
+        free(st->levels[i].buf);
+    free(st);
+
+    return status;
+}
+
+
+/*
+ * Copying a B-Tree
+ *
+ * The entries of a B-Tree are read in key order (walking the tree with a
+ * stack of pinned nodes) and fed to chidb_Btree_bulkLoad, so the copy is
+ * built bottom-up, with its leaves packed and laid out one after another.
+ */
+
+typedef struct
+{
+    BTree *bt;
+    BTreeNode *path[BULK_MAX_LEVELS];  /* Nodes from the root down */
+    uint32_t step[BULK_MAX_LEVELS];    /* Next cell (in a leaf), or next child and cell (2*i and 2*i+1) */
+    int depth;
+    uint8_t *buf;                      /* Data of the last entry, if it had overflow pages */
+} CopySource;
+
+
+/* chidb_Btree_bulkSource that returns the entries of a B-Tree in order */
+static int chidb_Btree_copyNext(void *ctx, BTreeCell *cell)
+{
+    CopySource *src = ctx;
+    int status;
+
+    free(src->buf);
+    src->buf = NULL;
+
+    while (src->depth > 0) {
+        BTreeNode *btn = src->path[src->depth - 1];
+        uint32_t step = src->step[src->depth - 1]++;
+
+        if (!PGTYPE_IS_INTERNAL(btn->type)) {
+            if (step < btn->n_cells) {
+                chidb_Btree_getCell(btn, step, cell);
+                if (cell->type == PGTYPE_TABLE_LEAF)
+                    return chidb_Btree_loadPayload(src->bt, cell, &src->buf);
+                return CHIDB_OK;
+            }
+        } else if (step % 2 == 0 && step / 2 <= btn->n_cells) {
+            /* The next child */
+            if (src->depth == BULK_MAX_LEVELS)
+                return CHIDB_ECORRUPT;
+            if ((status = chidb_Btree_getNodeByPage(src->bt, chidb_Btree_getChild(btn, step / 2), &src->path[src->depth])) != CHIDB_OK)
+                return status;
+            src->step[src->depth++] = 0;
+            continue;
+        } else if (step / 2 < btn->n_cells) {
+            /* The entry between two children (in an index) */
+            if (btn->type == PGTYPE_INDEX_INTERNAL) {
+                BTreeCell internal;
+
+                chidb_Btree_getCell(btn, step / 2, &internal);
+                cell->type = PGTYPE_INDEX_LEAF;
+                cell->key = internal.key;
+                cell->fields.indexLeaf.keyPk = internal.fields.indexInternal.keyPk;
+                return CHIDB_OK;
+            }
+            continue;
+        }
+
+        chidb_Btree_freeMemNode(src->bt, btn);
+        src->depth--;
+    }
+
+    return CHIDB_DONE;
+}
+
+
+/* Copy a B-Tree to another file
+ *
+ * Builds a copy of a table or index B-Tree in another B-Tree file (see
+ * chidb_Btree_bulkLoad), in a new root page. The leaves of the copy are
+ * filled completely, and laid out in key order in the pages that follow
+ * the root. The entries of a text index are inserted one after the
+ * other instead, which fills its leaves as well, since each one is added
+ * at the end of the tree (see chidb_Btree_insertText).
+ *
+ * Parameters
+ * - from: B-Tree file to copy from
+ * - nfrom: Page number of the root node of the B-Tree to copy
+ * - to: B-Tree file to copy to
+ * - nto: Out parameter. Page number of the root node of the copy.
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_ECORRUPT: The B-Tree is not well-formed
+ * - CHIDB_ENOMEM: Could not allocate memory
+ * - CHIDB_EIO: An I/O error has occurred when accessing either file
+ */
+int chidb_Btree_copy(BTree *from, npage_t nfrom, BTree *to, npage_t *nto)
+{
+    CopySource src;
+    BTreeCell cell;
+    uint8_t type;
+    int status;
+
+    memset(&src, 0, sizeof(CopySource));
+    src.bt = from;
+    if ((status = chidb_Btree_getNodeByPage(from, nfrom, &src.path[0])) != CHIDB_OK)
+        return status;
+    src.depth = 1;
+
+    type = (src.path[0]->type == PGTYPE_TABLE_LEAF || src.path[0]->type == PGTYPE_TABLE_INTERNAL)
+            ? PGTYPE_TABLE_LEAF : PGTYPE_INDEX_LEAF;
+    if (PGTYPE_IS_TEXTINDEX(src.path[0]->type))
+        type = PGTYPE_TEXTINDEX_LEAF;
+    if ((status = chidb_Btree_newNode(to, nto, type)) == CHIDB_OK) {
+        if (type != PGTYPE_TEXTINDEX_LEAF)
+            status = chidb_Btree_bulkLoad(to, *nto, chidb_Btree_copyNext, &src, 100);
+        else {
+            while ((status = chidb_Btree_copyNext(&src, &cell)) == CHIDB_OK)
+                if ((status = chidb_Btree_insertText(to, *nto, &cell)) != CHIDB_OK)
+                    break;
+            if (status == CHIDB_DONE)
+                status = CHIDB_OK;
+        }
+    }
+
+    free(src.buf);
+    while (src.depth > 0)
+        chidb_Btree_freeMemNode(from, src.path[--src.depth]);
+
+    /* Entries come out of a B-Tree in order, so bulkLoad can only
+     * complain if the tree is not well-formed */
+    return (status == CHIDB_EMISUSE || status == CHIDB_EDUPLICATE) ? CHIDB_ECORRUPT : status;
+}
+
+
+/* Replace the contents of a B-Tree file with those of another one
+ *
+ * Every page of the other file (which must have the same page size) is
+ * written over the same page of bt, in a transaction, and bt is then cut
+ * to the same number of pages (see chidb_Pager_truncate). The file header
+ * of bt is kept, except for its free list, which is taken from the other
+ * file along with the pages it lists, and its format, which goes with the
+ * key size of the pages (so a file with four-byte keys that is replaced
+ * with a new one ends up with eight-byte keys).
+ *
+ * Parameters
+ * - bt: B-Tree file to overwrite
+ * - from: B-Tree file to copy
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_EMISUSE: The page sizes differ, there is a transaction, or
+ *                  there are pinned pages
+ * - CHIDB_ENOMEM: Could not allocate memory
+ * - CHIDB_EIO: An I/O error has occurred when accessing either file
+ */
+int chidb_Btree_replace(BTree *bt, BTree *from)
+{
+    Pager *pager = bt->pager;
+    npage_t n = from->pager->n_pages;
+    uint8_t header[100];
+    MemPage *src, *dst;
+    int status;
+
+    if (pager->page_size != from->pager->page_size
+            || pager->in_txn || chidb_Pager_hasPinnedFrames(pager))
+        return CHIDB_EMISUSE;
+
+    if ((status = chidb_Pager_begin(pager)) != CHIDB_OK)
+        return status;
+
+    for (npage_t i = 1; i <= n && status == CHIDB_OK; i++) {
+        npage_t npage;
+
+        if (i > pager->n_pages && (status = chidb_Pager_allocatePage(pager, &npage)) != CHIDB_OK)
+            break;
+        if ((status = chidb_Pager_readPage(from->pager, i, &src)) != CHIDB_OK)
+            break;
+        if ((status = chidb_Pager_readPage(pager, i, &dst)) != CHIDB_OK) {
+            chidb_Pager_releaseMemPage(from->pager, src);
+            break;
+        }
+
+        memcpy(header, dst->data, sizeof(header));
+        memcpy(dst->data, src->data, pager->page_size);
+        if (i == 1) {
+            memcpy(dst->data, header, FILEHEADER_FREELIST_OFFSET);
+            memcpy(dst->data + FILEHEADER_NFREE_OFFSET + 4, header + FILEHEADER_NFREE_OFFSET + 4,
+                   sizeof(header) - FILEHEADER_NFREE_OFFSET - 4);
+            memcpy(dst->data + FILEHEADER_FORMAT_OFFSET, src->data + FILEHEADER_FORMAT_OFFSET, 4);
+        }
+        status = chidb_Btree_writePage(bt, dst);
+
+        chidb_Pager_releaseMemPage(from->pager, src);
+        chidb_Pager_releaseMemPage(pager, dst);
+    }
+
+    if (status == CHIDB_OK)
+        status = chidb_Pager_commit(pager);
+    else
+        chidb_Pager_rollback(pager);
+
+    if (status == CHIDB_OK)
+        bt->key_size = from->key_size;
+    if (status == CHIDB_OK && n < pager->n_pages)
+        status = chidb_Pager_truncate(pager, n);
+
+    bt->append_root = 0;
+    bt->append_leaf = 0;
+
+    return status;
+}
+
+
+/*
+ * Deleting entries
+ *
+ * An entry is removed from its leaf, and the tree is then fixed up on the
+ * way back to the root: a node that is left less than a third full is
+ * merged with a sibling (if they fit in one page), or takes some cells
+ * from it. The pages freed along the way (including the overflow pages of
+ * a deleted entry) go to the free list, and can be handed back to the
+ * file system with chidb_Btree_vacuum.
+ *
+ * Nodes are rebuilt from a copy of their page (rather than by moving the
+ * cells around in place), since insertCell always adds cells at the top
+ * of the cell area.
+ */
+
+typedef struct
+{
+    uint8_t *buf;          /* Copy of the page */
+    MemPage page;          /* MemPage wrapping buf */
+    BTreeNode node;        /* Node in the copy */
+} NodeCopy;
+
+
+/* Copies a node (as it is in memory, even if it has not been written
+ * yet), so that its cells stay valid while the node is rebuilt */
+static int chidb_Btree_copyNode(BTreeNode *btn, NodeCopy *copy)
+{
+    uint32_t size = btn->page->size;
+
+    if (!(copy->buf = malloc(size)))
+        return CHIDB_ENOMEM;
+    memcpy(copy->buf, btn->page->data, size);
+
+    memset(&copy->page, 0, sizeof(MemPage));
+    copy->page.npage = btn->page->npage;
+    copy->page.data = copy->buf;
+    copy->page.size = size;
+
+    copy->node = *btn;
+    copy->node.page = &copy->page;
+    copy->node.celloffset_array = copy->buf + (btn->celloffset_array - btn->page->data);
+
+    return CHIDB_OK;
+}
+
+
+/* Turns a node into an empty node of the given type, leaving the file
+ * header alone (unlike initEmptyNode). Only the BTreeNode is changed,
+ * until the node is written. */
+static void chidb_Btree_resetNode(BTree *bt, BTreeNode *btn, uint8_t type)
+{
+    uint16_t header = (btn->page->npage == 1) ? 100 : 0;
+    bool internal = PGTYPE_IS_INTERNAL(type);
+
+    btn->type = type;
+    btn->free_offset = header + (internal ? 12 : 8);
+    btn->n_cells = 0;
+    btn->cells_offset = bt->pager->page_size;
+    btn->right_page = 0;
+    btn->celloffset_array = btn->page->data + btn->free_offset;
+}
+
+
+/* Number of bytes available for cells (and their offsets) in a node of
+ * the given type in page npage */
+static uint32_t chidb_Btree_capacity(BTree *bt, npage_t npage, uint8_t type)
+{
+    bool internal = PGTYPE_IS_INTERNAL(type);
+
+    return bt->pager->page_size - ((npage == 1) ? 100 : 0) - (internal ? 12 : 8);
+}
+
+
+/* Number of bytes taken up by the cells (and their offsets) in a node */
+static uint32_t chidb_Btree_usedSpace(BTreeNode *btn)
+{
+    BTreeCell cell;
+    uint32_t used = 0;
+
+    for (ncell_t i = 0; i < btn->n_cells; i++) {
+        chidb_Btree_getCell(btn, i, &cell);
+        used += chidb_Btree_cellSize(btn, &cell);
+    }
+
+    return used;
+}
+
+
+/* Sets the i-th child of an internal node (right_page if i is n_cells) */
+static void chidb_Btree_setChild(BTreeNode *btn, ncell_t i, npage_t child)
+{
+    if (i == btn->n_cells)
+        btn->right_page = child;
+    else
+        put4byte(btn->page->data + get2byte(btn->celloffset_array + i*2) + TABLEINTCELL_CHILD_OFFSET, child);
+}
+
+
+/* Removes a cell from a node. The node is not written. */
+static int chidb_Btree_removeCell(BTree *bt, BTreeNode *btn, ncell_t ncell)
+{
+    NodeCopy copy;
+    BTreeCell cell;
+    npage_t right_page = btn->right_page;
+    int status;
+
+    if ((status = chidb_Btree_copyNode(btn, &copy)) != CHIDB_OK)
+        return status;
+
+    chidb_Btree_resetNode(bt, btn, copy.node.type);
+    btn->right_page = right_page;
+    for (ncell_t i = 0; i < copy.node.n_cells; i++) {
+        if (i == ncell)
+            continue;
+        chidb_Btree_getCell(&copy.node, i, &cell);
+        chidb_Btree_insertCell(btn, btn->n_cells, &cell);
+    }
+
+    free(copy.buf);
+
+    return CHIDB_OK;
+}
+
+
+/* Gives the overflow pages of a deleted entry back */
+static int chidb_Btree_freeOverflow(BTree *bt, npage_t npage)
+{
+    MemPage *page;
+    npage_t next;
+    int status;
+
+    for (npage_t n = 0; npage != 0; n++) {
+        if (n == bt->pager->n_pages)
+            return CHIDB_ECORRUPT;
+        if ((status = chidb_Pager_readPage(bt->pager, npage, &page)) != CHIDB_OK)
+            return status;
+        next = get4byte(page->data + OVERFLOWPG_NEXT_OFFSET);
+        chidb_Pager_releaseMemPage(bt->pager, page);
+
+        if ((status = chidb_Btree_freePage(bt, npage)) != CHIDB_OK)
+            return status;
+        npage = next;
+    }
+
+    return CHIDB_OK;
+}
+
+
+/* Picks where to split a sequence of cells between two siblings, so that
+ * both halves fit and neither is empty, as evenly (in bytes) as possible.
+ * If up is true, the cell at the split point moves up to the parent
+ * (instead of staying at the end of the left half). Returns 0 if there
+ * is no such split. */
+static int chidb_Btree_splitPoint(BTreeNode *btn, BTreeCell *cells, int n, bool up, uint32_t cap_left, uint32_t cap_right)
+{
+    uint32_t total = 0, left = 0;
+    uint32_t best_diff = UINT32_MAX;
+    int best = 0;
+
+    for (int k = 0; k < n; k++)
+        total += chidb_Btree_cellSize(btn, &cells[k]);
+
+    for (int m = 1; m < n - (up ? 1 : 0); m++) {
+        uint32_t right;
+
+        left += chidb_Btree_cellSize(btn, &cells[m - 1]);
+        right = total - left - (up ? chidb_Btree_cellSize(btn, &cells[m]) : 0);
+        if (left > cap_left || right > cap_right)
+            continue;
+
+        if ((left > right ? left - right : right - left) < best_diff) {
+            best_diff = left > right ? left - right : right - left;
+            best = m;
+        }
+    }
+
+    return best;
+}
+
+
+/* Spreads a sequence of cells between the left-th child of a node and
+ * the next one, splitting it at cell m (see chidb_Btree_splitPoint), and
+ * writes the three nodes. The cells must not be in either child's page. */
+static int chidb_Btree_spread(BTree *bt, BTreeNode *parent, ncell_t left, BTreeNode *lnode, BTreeNode *rnode,
+                              BTreeCell *cells, int n, int m, npage_t right_most)
+{
+    bool table_leaf = (lnode->type == PGTYPE_TABLE_LEAF);
+    BTreeCell *up = table_leaf ? &cells[m - 1] : &cells[m];
+    uint8_t *cell = parent->page->data + get2byte(parent->celloffset_array + left*2);
+    int k = 0, status;
+
+    chidb_Btree_resetNode(bt, lnode, lnode->type);
+    for (; k < m; k++)
+        chidb_Btree_insertCell(lnode, lnode->n_cells, &cells[k]);
+    if (!table_leaf) {
+        if (up->type == PGTYPE_TABLE_INTERNAL)
+            lnode->right_page = up->fields.tableInternal.child_page;
+        else if (up->type == PGTYPE_INDEX_INTERNAL)
+            lnode->right_page = up->fields.indexInternal.child_page;
+        k++;
+    }
+
+    chidb_Btree_resetNode(bt, rnode, rnode->type);
+    for (; k < n; k++)
+        chidb_Btree_insertCell(rnode, rnode->n_cells, &cells[k]);
+    rnode->right_page = right_most;
+
+    /* The separator only changes in place */
+    if (parent->type == PGTYPE_TABLE_INTERNAL) {
+        chidb_Btree_putTableKey(parent->key_size, cell + TABLEINTCELL_KEY_OFFSET, up->key);
+    } else {
+        chidb_Btree_putIndexKey(parent->key_size, cell + INDEXINTCELL_KEYIDX_OFFSET, up->key);
+        chidb_Btree_putIndexKey(parent->key_size, cell + INDEXINTCELL_KEYPK_OFFSET(parent->key_size),
+                                (up->type == PGTYPE_INDEX_LEAF) ? up->fields.indexLeaf.keyPk : up->fields.indexInternal.keyPk);
+    }
+
+    if ((status = chidb_Btree_writeNode(bt, lnode)) != CHIDB_OK
+            || (status = chidb_Btree_writeNode(bt, rnode)) != CHIDB_OK)
+        return status;
+
+    return chidb_Btree_writeNode(bt, parent);
+}
+
+
+/* Moves the only child of a root with no cells (see below) into the
+ * root, if it fits */
+static int chidb_Btree_collapseRoot(BTree *bt, BTreeNode *root)
+{
+    BTreeNode *child;
+    NodeCopy copy;
+    BTreeCell cell;
+    npage_t nchild = root->right_page;
+    int status;
+
+    if ((status = chidb_Btree_getNodeByPage(bt, nchild, &child)) != CHIDB_OK)
+        return status;
+    if (chidb_Btree_usedSpace(child) > chidb_Btree_capacity(bt, root->page->npage, child->type)) {
+        return chidb_Btree_freeMemNode(bt, child);
+    }
+
+    if ((status = chidb_Btree_copyNode(child, &copy)) != CHIDB_OK) {
+        chidb_Btree_freeMemNode(bt, child);
+        return status;
+    }
+    chidb_Btree_freeMemNode(bt, child);
+
+    chidb_Btree_resetNode(bt, root, copy.node.type);
+    for (ncell_t k = 0; k < copy.node.n_cells; k++) {
+        chidb_Btree_getCell(&copy.node, k, &cell);
+        chidb_Btree_insertCell(root, k, &cell);
+    }
+    root->right_page = copy.node.right_page;
+    free(copy.buf);
+
+    if ((status = chidb_Btree_writeNode(bt, root)) != CHIDB_OK)
+        return status;
+
+    return chidb_Btree_freePage(bt, nchild);
+}
+
+
+/* Fixes up the i-th child of a node after an entry has been removed
+ * from it
+ *
+ * If the child is at least a third full, nothing is done. Otherwise, the
+ * child and one of its siblings (the next one, or the previous one if
+ * the child is the last one) are either merged into one node, or their
+ * cells (and the separator between them) are spread evenly between
+ * them. When the parent is the root, and the two nodes are its only
+ * children, they are merged into the root itself if they fit, and the
+ * tree gets shorter. An empty table leaf that cannot be merged (because
+ * its sibling holds a large cell) is dropped. The parent is written if it
+ * changes.
+ */
+static int chidb_Btree_rebalance(BTree *bt, BTreeNode *parent, ncell_t i, bool root)
+{
+    BTreeNode *child, *lnode, *rnode;
+    NodeCopy lcopy, rcopy;
+    BTreeCell sep, *cells;
+    npage_t nleft, nright, right_most;
+    ncell_t left;
+    uint32_t total = 0;
+    int n = 0, m, status;
+    bool table_leaf;
+    npage_t freed[2] = {0, 0};
+
+    if (parent->n_cells == 0)
+        return root ? chidb_Btree_collapseRoot(bt, parent) : CHIDB_OK;
+
+    if ((status = chidb_Btree_getNodeByPage(bt, chidb_Btree_getChild(parent, i), &child)) != CHIDB_OK)
+        return status;
+    if (child->n_cells > 0 && chidb_Btree_usedSpace(child) * 3 >= chidb_Btree_capacity(bt, child->page->npage, child->type))
+        return chidb_Btree_freeMemNode(bt, child);
+    chidb_Btree_freeMemNode(bt, child);
+
+    left = (i < parent->n_cells) ? i : parent->n_cells - 1;
+    nleft = chidb_Btree_getChild(parent, left);
+    nright = chidb_Btree_getChild(parent, left + 1);
+    chidb_Btree_getCell(parent, left, &sep);
+
+    if ((status = chidb_Btree_getNodeByPage(bt, nleft, &lnode)) != CHIDB_OK)
+        return status;
+    if ((status = chidb_Btree_getNodeByPage(bt, nright, &rnode)) != CHIDB_OK) {
+        chidb_Btree_freeMemNode(bt, lnode);
+        return status;
+    }
+    if (lnode->type != rnode->type) {
+        chidb_Btree_freeMemNode(bt, lnode);
+        chidb_Btree_freeMemNode(bt, rnode);
+        return CHIDB_ECORRUPT;
+    }
+
+    table_leaf = (lnode->type == PGTYPE_TABLE_LEAF);
+
+    lcopy.buf = rcopy.buf = NULL;
+    cells = malloc((lnode->n_cells + rnode->n_cells + 1) * sizeof(BTreeCell));
+    if (cells == NULL
+            || (status = chidb_Btree_copyNode(lnode, &lcopy)) != CHIDB_OK
+            || (status = chidb_Btree_copyNode(rnode, &rcopy)) != CHIDB_OK) {
+        status = (cells == NULL) ? CHIDB_ENOMEM : status;
+        goto done;
+    }
+
+    /* All the cells of both nodes, in order. In a B-Tree proper (and
+     * between internal nodes), the separator goes in between. */
+    for (ncell_t k = 0; k < lcopy.node.n_cells; k++)
+        chidb_Btree_getCell(&lcopy.node, k, &cells[n++]);
+    if (!table_leaf) {
+        BTreeCell *mid = &cells[n++];
+
+        mid->type = lnode->type;
+        mid->key = sep.key;
+        switch (mid->type) {
+            case PGTYPE_INDEX_LEAF:
+                mid->fields.indexLeaf.keyPk = sep.fields.indexInternal.keyPk;
+                break;
+            case PGTYPE_INDEX_INTERNAL:
+                mid->fields.indexInternal.keyPk = sep.fields.indexInternal.keyPk;
+                mid->fields.indexInternal.child_page = lcopy.node.right_page;
+                break;
+            default:
+                mid->fields.tableInternal.child_page = lcopy.node.right_page;
+                break;
+        }
+    }
+    for (ncell_t k = 0; k < rcopy.node.n_cells; k++)
+        chidb_Btree_getCell(&rcopy.node, k, &cells[n++]);
+    right_most = rcopy.node.right_page;
+
+    for (int k = 0; k < n; k++)
+        total += chidb_Btree_cellSize(lnode, &cells[k]);
+
+    if (root && parent->n_cells == 1 && total <= chidb_Btree_capacity(bt, parent->page->npage, lnode->type)) {
+        /* Both children go into the root */
+        chidb_Btree_resetNode(bt, parent, lnode->type);
+        for (int k = 0; k < n; k++)
+            chidb_Btree_insertCell(parent, k, &cells[k]);
+        parent->right_page = right_most;
+        if ((status = chidb_Btree_writeNode(bt, parent)) != CHIDB_OK)
+            goto done;
+        freed[0] = nleft;
+        freed[1] = nright;
+    } else if (total <= chidb_Btree_capacity(bt, nleft, lnode->type) && !(root && parent->n_cells == 1)) {
+        /* The right node goes into the left one */
+        chidb_Btree_resetNode(bt, lnode, lnode->type);
+        for (int k = 0; k < n; k++)
+            chidb_Btree_insertCell(lnode, k, &cells[k]);
+        lnode->right_page = right_most;
+        if ((status = chidb_Btree_writeNode(bt, lnode)) != CHIDB_OK)
+            goto done;
+
+        chidb_Btree_setChild(parent, left + 1, nleft);
+        if ((status = chidb_Btree_removeCell(bt, parent, left)) != CHIDB_OK
+                || (status = chidb_Btree_writeNode(bt, parent)) != CHIDB_OK)
+            goto done;
+        freed[0] = nright;
+    } else if ((m = chidb_Btree_splitPoint(lnode, cells, n, !table_leaf,
+                                           chidb_Btree_capacity(bt, nleft, lnode->type), chidb_Btree_capacity(bt, nright, rnode->type))) > 0) {
+        /* The cells are spread between both nodes */
+        if ((status = chidb_Btree_spread(bt, parent, left, lnode, rnode, cells, n, m, right_most)) != CHIDB_OK)
+            goto done;
+    } else if (table_leaf && (lnode->n_cells == 0 || rnode->n_cells == 0)) {
+        /* A table leaf can be left empty next to one with a large cell.
+         * It is just dropped (in a root, this can leave it with no cells
+         * and only a right page, if that does not fit in it). */
+        npage_t keep = (lnode->n_cells == 0) ? nright : nleft;
+
+        chidb_Btree_setChild(parent, left + 1, keep);
+        if ((status = chidb_Btree_removeCell(bt, parent, left)) != CHIDB_OK
+                || (status = chidb_Btree_writeNode(bt, parent)) != CHIDB_OK)
+            goto done;
+        freed[0] = (keep == nleft) ? nright : nleft;
+    }
+
+done:
+    free(cells);
+    free(lcopy.buf);
+    free(rcopy.buf);
+    chidb_Btree_freeMemNode(bt, lnode);
+    chidb_Btree_freeMemNode(bt, rnode);
+
+    for (int k = 0; k < 2 && status == CHIDB_OK; k++)
+        if (freed[k] != 0)
+            status = chidb_Btree_freePage(bt, freed[k]);
+
+    return status;
+}
+
+
+/* Makes room for a new entry in the i-th child of a node, a full leaf, by
+ * spreading its cells, and the new entry, over it and one of its
+ * siblings (whichever has more free space). This is only done if the
+ * sibling is at least a third empty, so that a node is not shifted
+ * into over and over; the leaf is split instead (see chidb_Btree_insert).
+ * Sets *shifted to whether the entry was added.
+ */
+static int chidb_Btree_shift(BTree *bt, npage_t npage_parent, ncell_t i, BTreeCell *btc, bool *shifted)
+{
+    BTreeNode *parent, *lnode = NULL, *rnode = NULL, *nodes[2] = {NULL, NULL};
+    NodeCopy lcopy, rcopy;
+    BTreeCell sep, *cells = NULL;
+    ncell_t left;
+    uint32_t free_space[2] = {0, 0};
+    int n = 0, m, status, pick = -1;
+
+    *shifted = false;
+
+    if ((status = chidb_Btree_getNodeByPage(bt, npage_parent, &parent)) != CHIDB_OK)
+        return status;
+    if (parent->n_cells == 0 || (btc->type != PGTYPE_TABLE_LEAF && btc->type != PGTYPE_INDEX_LEAF))
+        return chidb_Btree_freeMemNode(bt, parent);
+
+    /* The siblings before and after the child */
+    for (int k = 0; k < 2; k++) {
+        if ((k == 0 && i == 0) || (k == 1 && i == parent->n_cells))
+            continue;
+        if ((status = chidb_Btree_getNodeByPage(bt, chidb_Btree_getChild(parent, k == 0 ? i - 1 : i + 1), &nodes[k])) != CHIDB_OK)
+            goto done;
+        if (nodes[k]->type != btc->type)
+            continue;
+        free_space[k] = nodes[k]->cells_offset - nodes[k]->free_offset;
+        if (free_space[k] * 3 >= chidb_Btree_capacity(bt, nodes[k]->page->npage, nodes[k]->type)
+                && (pick < 0 || free_space[k] > free_space[pick]))
+            pick = k;
+    }
+    if (pick < 0)
+        goto done;
+
+    left = (pick == 0) ? i - 1 : i;
+    if ((status = chidb_Btree_getNodeByPage(bt, chidb_Btree_getChild(parent, i), pick == 0 ? &rnode : &lnode)) != CHIDB_OK)
+        goto done;
+    if (pick == 0)
+        lnode = nodes[0];
+    else
+        rnode = nodes[1];
+    nodes[pick] = NULL;
+    if (lnode->type != rnode->type)
+        goto done;
+
+    lcopy.buf = rcopy.buf = NULL;
+    cells = malloc((lnode->n_cells + rnode->n_cells + 2) * sizeof(BTreeCell));
+    if (cells == NULL
+            || (status = chidb_Btree_copyNode(lnode, &lcopy)) != CHIDB_OK
+            || (status = chidb_Btree_copyNode(rnode, &rcopy)) != CHIDB_OK) {
+        status = (cells == NULL) ? CHIDB_ENOMEM : status;
+        goto copied;
+    }
 
-	// reinitialize the root as appropriate type (if formerly leaf, make internal)
-	beginning_root_type = root->type;
+    /* All the cells of both nodes, in order, with the separator in
+     * between in an index (as in chidb_Btree_rebalance) */
+    for (ncell_t k = 0; k < lcopy.node.n_cells; k++)
+        chidb_Btree_getCell(&lcopy.node, k, &cells[n++]);
+    if (btc->type == PGTYPE_INDEX_LEAF) {
+        chidb_Btree_getCell(parent, left, &sep);
+        cells[n].type = PGTYPE_INDEX_LEAF;
+        cells[n].key = sep.key;
+        cells[n++].fields.indexLeaf.keyPk = sep.fields.indexInternal.keyPk;
+    }
+    for (ncell_t k = 0; k < rcopy.node.n_cells; k++)
+        chidb_Btree_getCell(&rcopy.node, k, &cells[n++]);
+
+    /* And the new entry */
+    for (m = n; m > 0 && chidb_Btree_compareCells(&cells[m - 1], btc) > 0; m--)
+        cells[m] = cells[m - 1];
+    cells[m] = *btc;
+    n++;
+    if (m > 0 && chidb_Btree_compareCells(&cells[m - 1], btc) == 0) {
+        status = CHIDB_EDUPLICATE;
+        goto copied;
+    }
 
-	// CLOSE THE ROOT BEFORE REINITIALIZING!!!
-	if ((status = chidb_Btree_writeNode(bt, root)) != CHIDB_OK) {
-            return status;
+    if ((m = chidb_Btree_splitPoint(lnode, cells, n, btc->type != PGTYPE_TABLE_LEAF,
+                                    chidb_Btree_capacity(bt, lnode->page->npage, lnode->type),
+                                    chidb_Btree_capacity(bt, rnode->page->npage, rnode->type))) > 0) {
+        if ((status = chidb_Btree_spread(bt, parent, left, lnode, rnode, cells, n, m, rcopy.node.right_page)) == CHIDB_OK) {
+            *shifted = true;
+            bt->stats.shifts++;
         }
-        if ((status = chidb_Btree_freeMemNode(bt, root)) != CHIDB_OK) {
-            return status;
+    }
+
+copied:
+    free(cells);
+    free(lcopy.buf);
+    free(rcopy.buf);
+done:
+    for (int k = 0; k < 2; k++)
+        if (nodes[k] != NULL)
+            chidb_Btree_freeMemNode(bt, nodes[k]);
+    if (lnode != NULL)
+        chidb_Btree_freeMemNode(bt, lnode);
+    if (rnode != NULL)
+        chidb_Btree_freeMemNode(bt, rnode);
+    chidb_Btree_freeMemNode(bt, parent);
+
+    return status;
+}
+
+
+/* Removes the last entry of an index B-Tree (rooted at npage) and
+ * returns it in an index leaf cell. Used to find a replacement for an
+ * entry that is deleted from an internal node. */
+static int chidb_Btree_deleteLast(BTree *bt, npage_t npage, BTreeCell *last)
+{
+    BTreeNode *btn;
+    int status;
+
+    if ((status = chidb_Btree_getNodeByPage(bt, npage, &btn)) != CHIDB_OK)
+        return status;
+
+    if (btn->type == PGTYPE_INDEX_LEAF) {
+        if (btn->n_cells == 0) {
+            chidb_Btree_freeMemNode(bt, btn);
+            return CHIDB_ECORRUPT;
         }
+        chidb_Btree_getCell(btn, btn->n_cells - 1, last);
+        if ((status = chidb_Btree_removeCell(bt, btn, btn->n_cells - 1)) == CHIDB_OK)
+            status = chidb_Btree_writeNode(bt, btn);
+    } else if (btn->type == PGTYPE_INDEX_INTERNAL) {
+        if ((status = chidb_Btree_deleteLast(bt, btn->right_page, last)) == CHIDB_OK)
+            status = chidb_Btree_rebalance(bt, btn, btn->n_cells, false);
+    } else {
+        status = CHIDB_ECORRUPT;
+    }
 
-	switch(beginning_root_type) {
-	case PGTYPE_INDEX_LEAF:
-	case PGTYPE_INDEX_INTERNAL:
-	    if ((status = chidb_Btree_initEmptyNode(bt, nroot, PGTYPE_INDEX_INTERNAL)) != CHIDB_OK) {
-		return status;
-	    }
-	    break;
-	case PGTYPE_TABLE_LEAF:
-	case PGTYPE_TABLE_INTERNAL:
-	    if ((status = chidb_Btree_initEmptyNode(bt, nroot, PGTYPE_TABLE_INTERNAL)) != CHIDB_OK) {
-		return status;
-	    }
-	    break;
-	default:
-	    fprintf(stderr,"split: invalid root type\n");
-	    exit(1);
-	}
+    chidb_Btree_freeMemNode(bt, btn);
 
-	// re-open the root
-	if ((status = chidb_Btree_getNodeByPage(bt, nroot, &root)) != CHIDB_OK) {
-	    return status;
-	}
+    return status;
+}
 
-	// set the root's right_page to the new_child_num
-	root->right_page = new_child_num;
 
-	// write and close the root
-	if ((status = chidb_Btree_writeNode(bt, root)) != CHIDB_OK) {
-	    return status;
-	}
-	if ((status = chidb_Btree_freeMemNode(bt, root)) != CHIDB_OK) {
-	    return status;
-	}
+/* Deletes an entry from the subtree rooted at npage (in an index, the
+ * one with primary key *pk, or any entry with the key if pk is NULL) */
+static int chidb_Btree_deleteInNode(BTree *bt, npage_t npage, chidb_key_t key, const chidb_key_t *pk, bool root)
+{
+    BTreeNode *btn;
+    BTreeCell cell, last;
+    ncell_t i;
+    bool found;
+    int status;
 
-	// split the root
-	if ((status = chidb_Btree_split(bt, nroot, new_child_num, 0, &lower_num)) != CHIDB_OK) {
-	    return status;
-	}
+    if ((status = chidb_Btree_getNodeByPage(bt, npage, &btn)) != CHIDB_OK)
+        return status;
 
+    if (pk && (btn->type == PGTYPE_INDEX_LEAF || btn->type == PGTYPE_INDEX_INTERNAL))
+        found = (chidb_Btree_searchIndex(btn, key, *pk, &i) == CHIDB_TRUE);
+    else
+        found = (chidb_Btree_searchNode(btn, key, &i) == CHIDB_TRUE);
+
+    switch (btn->type) {
+        case PGTYPE_TABLE_LEAF:
+        case PGTYPE_INDEX_LEAF:
+            if (!found) {
+                status = CHIDB_ENOTFOUND;
+                break;
+            }
+            chidb_Btree_getCell(btn, i, &cell);
+            if ((status = chidb_Btree_removeCell(bt, btn, i)) != CHIDB_OK
+                    || (status = chidb_Btree_writeNode(bt, btn)) != CHIDB_OK)
+                break;
+            if (cell.type == PGTYPE_TABLE_LEAF && cell.fields.tableLeaf.overflow != 0)
+                status = chidb_Btree_freeOverflow(bt, cell.fields.tableLeaf.overflow);
+            break;
+        case PGTYPE_INDEX_INTERNAL:
+            if (found) {
+                /* The entry is replaced by the largest one below it */
+                uint8_t *pos = btn->page->data + get2byte(btn->celloffset_array + i*2);
+
+                if ((status = chidb_Btree_deleteLast(bt, chidb_Btree_getChild(btn, i), &last)) != CHIDB_OK)
+                    break;
+                chidb_Btree_putIndexKey(btn->key_size, pos + INDEXINTCELL_KEYIDX_OFFSET, last.key);
+                chidb_Btree_putIndexKey(btn->key_size, pos + INDEXINTCELL_KEYPK_OFFSET(btn->key_size), last.fields.indexLeaf.keyPk);
+                if ((status = chidb_Btree_writeNode(bt, btn)) == CHIDB_OK)
+                    status = chidb_Btree_rebalance(bt, btn, i, root);
+                break;
+            }
+            /* fall through */
+        case PGTYPE_TABLE_INTERNAL:
+            if ((status = chidb_Btree_deleteInNode(bt, chidb_Btree_getChild(btn, i), key, pk, false)) == CHIDB_OK)
+                status = chidb_Btree_rebalance(bt, btn, i, root);
+            break;
+        default:
+            status = CHIDB_ECORRUPT;
+            break;
     }
 
-    return chidb_Btree_insertNonFull(bt, nroot, btc);
+    chidb_Btree_freeMemNode(bt, btn);
 
+    return status;
 }
 
-/* Insert a BTreeCell into a non-full B-Tree node
+
+/* Delete an entry from a B-Tree
  *
- * chidb_Btree_insertNonFull inserts a BTreeCell into a node that is
- * assumed not to be full (i.e., does not require splitting). If the
- * node is a leaf node, the cell is directly added in the appropriate
- * position according to its key. If the node is an internal node, the
- * function will determine what child node it must insert it in, and
- * calls itself recursively on that child node. However, before doing so
- * it will check if the child node is full or not. If it is, then it will
- * have to be split first.
+ * Removes the entry with a given key from a table or index B-Tree, and
+ * rebalances the tree on the way back up (see chidb_Btree_rebalance).
+ * The root page never changes. Pages that are no longer needed go to the
+ * free list (see chidb_Btree_freePage).
  *
  * Parameters
  * - bt: B-Tree file
- * - nroot: Page number of the root node of the B-Tree we want to insert
- *          this cell in.
- * - btc: BTreeCell to insert into B-Tree
+ * - nroot: Page number of the root node of the B-Tree
+ * - key: Key of the entry (in an index, the indexed value)
  *
  * Return
  * - CHIDB_OK: Operation successful
- * - CHIDB_EDUPLICATE: An entry with that key already exists
+ * - CHIDB_ENOTFOUND: No entry with the given key was found
+ * - CHIDB_ECORRUPT: The tree is not well-formed
  * - CHIDB_ENOMEM: Could not allocate memory
  * - CHIDB_EIO: An I/O error has occurred when accessing the file
  */
-int chidb_Btree_insertNonFull(BTree *bt, npage_t npage, BTreeCell *btc)
+int chidb_Btree_delete(BTree *bt, npage_t nroot, chidb_key_t key)
+{
+    if (nroot == bt->append_root)
+        bt->append_leaf = 0;
+
+    return chidb_Btree_deleteInNode(bt, nroot, key, NULL, true);
+}
+
+
+/* Delete an entry from an index B-Tree
+ *
+ * Same as chidb_Btree_delete, but removes the entry with a given key and
+ * primary key, for indexes that have several entries with the same key.
+ *
+ * Parameters
+ * - bt: B-Tree file
+ * - nroot: Page number of the root node of the index
+ * - keyIdx: Key of the entry (the indexed value)
+ * - keyPk: Primary key of the entry
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_ENOTFOUND: The index has no such entry
+ * - CHIDB_ECORRUPT: The tree is not well-formed
+ * - CHIDB_ENOMEM: Could not allocate memory
+ * - CHIDB_EIO: An I/O error has occurred when accessing the file
+ */
+int chidb_Btree_deleteInIndex(BTree *bt, npage_t nroot, chidb_key_t keyIdx, chidb_key_t keyPk)
+{
+    if (nroot == bt->append_root)
+        bt->append_leaf = 0;
+
+    return chidb_Btree_deleteInNode(bt, nroot, keyIdx, &keyPk, true);
+}
+
+
+/*
+ * Text indexes
+ *
+ * A text index is a B+Tree, like a table B-Tree: its entries (a text and
+ * the primary key of a row) are only in the leaves, and the cells of its
+ * internal nodes are separators (see TEXTINDEXLEAFCELL_SHARED_OFFSET).
+ * Entries are added to a leaf, and nodes that get too full are split on
+ * the way back up, so the root page never changes. Nodes are not merged
+ * when entries are deleted, but nodes that are left empty are dropped, so
+ * that every leaf other than the root has entries. VACUUM rebuilds the
+ * whole index with full nodes (see chidb_Btree_copy).
+ */
+
+/* Compare the key of a text index cell with a position in the index
+ *
+ * Texts are compared byte by byte, and a text comes before the longer
+ * texts it is the start of. Entries with the same text are in the order
+ * of their primary keys.
+ *
+ * Parameters
+ * - cell: Cell of a text index node
+ * - key: Position to compare it with
+ *
+ * Return
+ * - A negative number, 0, or a positive number if the cell is before,
+ *   at, or after the position
+ */
+int chidb_Btree_compareText(BTreeCell *cell, const BTreeTextKey *key)
+{
+    uint32_t plen = cell->fields.textIndex.prefix_len, slen = cell->fields.textIndex.suffix_len;
+    uint32_t n = plen < key->len ? plen : key->len;
+    int c;
+
+    if (n > 0 && (c = memcmp(cell->fields.textIndex.prefix, key->text, n)) != 0)
+        return c;
+    if (n == plen) {
+        n = slen < key->len - plen ? slen : key->len - plen;
+        if (n > 0 && (c = memcmp(cell->fields.textIndex.suffix, key->text + plen, n)) != 0)
+            return c;
+    }
+    if (plen + slen != key->len)
+        return plen + slen < key->len ? -1 : 1;
+
+    // a separator without a primary key is right before the entries with its text
+    if (!cell->fields.textIndex.has_pk)
+        return key->edge == TEXTKEY_FIRST ? 0 : -1;
+    if (key->edge != TEXTKEY_ENTRY)
+        return -key->edge;
+    if (cell->fields.textIndex.keyPk != key->keyPk)
+        return cell->fields.textIndex.keyPk < key->keyPk ? -1 : 1;
+
+    return 0;
+}
+
+
+/* Search for a position inside a text index node
+ *
+ * Binary-searches a leaf for the first cell that is not before the given
+ * position, or an internal node for the child the position is in: the
+ * child of the first separator that is after it (or right_page, if there
+ * is none).
+ *
+ * Parameters
+ * - btn: Text index node to search in
+ * - key: Position to search for
+ * - ncell: Out parameter. Number of the cell (or child, in an internal
+ *          node) found, which is btn->n_cells if there is no such cell.
+ *
+ * Return
+ * - CHIDB_TRUE: The node is a leaf, and the cell at ncell is exactly at
+ *               the position
+ * - CHIDB_FALSE: Otherwise
+ */
+int chidb_Btree_searchText(BTreeNode *btn, const BTreeTextKey *key, ncell_t *ncell)
+{
+    ncell_t lo = 0, hi = btn->n_cells;
+    bool leaf = (btn->type == PGTYPE_TEXTINDEX_LEAF);
+    BTreeCell cell;
+
+    while (lo < hi) {
+        ncell_t mid = lo + (hi - lo) / 2;
+        int c;
+
+        chidb_Btree_getCell(btn, mid, &cell);
+        c = chidb_Btree_compareText(&cell, key);
+        if (c < 0 || (c == 0 && !leaf))
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+
+    *ncell = lo;
+
+    if (leaf && lo < btn->n_cells) {
+        chidb_Btree_getCell(btn, lo, &cell);
+        if (chidb_Btree_compareText(&cell, key) == 0)
+            return CHIDB_TRUE;
+    }
+
+    return CHIDB_FALSE;
+}
+
+
+/* Separator a split node passes up to its parent, along with the new
+ * node that has the entries before it */
+typedef struct
+{
+    npage_t left;          /* New node, or 0 if the node was not split */
+    uint8_t *text;         /* Text of the separator (malloc'd) */
+    uint32_t len;
+    chidb_key_t keyPk;
+    bool has_pk;
+} TextSplit;
+
+
+/* Adds cells[from..to) to the end of an empty text index node, and
+ * writes it */
+static int chidb_Btree_textWrite(BTree *bt, BTreeNode *btn, BTreeCell *cells, ncell_t from, ncell_t to, npage_t right_page)
+{
+    for (ncell_t k = from; k < to; k++)
+        chidb_Btree_insertCell(btn, btn->n_cells, &cells[k]);
+    btn->right_page = right_page;
+
+    return chidb_Btree_writeNode(bt, btn);
+}
+
+/* Same, in a new node */
+static int chidb_Btree_textWriteNew(BTree *bt, npage_t *npage, uint8_t type, BTreeCell *cells, ncell_t from, ncell_t to, npage_t right_page)
 {
     BTreeNode *btn;
-    BTreeNode *child_btn;
-    BTreeCell temp_cell;
-    int i, status;
-    npage_t child_num, temp_right_page;
+    int status;
 
-    if ((status = chidb_Btree_getNodeByPage(bt, npage, &btn)) != CHIDB_OK) {
+    if ((status = chidb_Btree_newNode(bt, npage, type)) != CHIDB_OK
+            || (status = chidb_Btree_getNodeByPage(bt, *npage, &btn)) != CHIDB_OK)
         return status;
+
+    status = chidb_Btree_textWrite(bt, btn, cells, from, to, right_page);
+    chidb_Btree_freeMemNode(bt, btn);
+
+    return status;
+}
+
+
+/* Puts a cell in position i of a text index node, splitting the node if
+ * it does not fit
+ *
+ * A cell that is not put first goes straight into the node if it has
+ * room. Otherwise, the node is rebuilt with the new cell, since the
+ * other cells have to be compressed against a new first cell, or the
+ * node is split in two if the cells do not fit. The cells before the
+ * split point go to a new node, and those after it stay in the node
+ * (or, in the root, go to another new node, and the root gets the
+ * separator between them).
+ *
+ * A node is split in halves, except that, when the cell is added at the
+ * end of the tree (append), the other cells are left where they are, so
+ * that entries added in order fill their nodes. The first half is made
+ * smaller if it does not fit, which can happen when the new cell is put
+ * first and the cells do not share as much of their texts with it as
+ * they did with the old first cell. The second half always fits, as its
+ * cells share at least as much with the first of them as they did with
+ * the first cell of the node. An internal node passes the cell at the
+ * split point up as the separator, instead of keeping it.
+ */
+static int chidb_Btree_textPut(BTree *bt, BTreeNode *btn, ncell_t i, BTreeCell *btc, bool root, bool append, TextSplit *split)
+{
+    NodeCopy copy;
+    BTreeCell *cells = NULL, sep;
+    uint32_t *sizes = NULL, total = 0, left = 0, sep_len;
+    uint32_t cap = chidb_Btree_capacity(bt, btn->page->npage, btn->type);
+    uint8_t *sep_text = NULL, type = btn->type;
+    npage_t right_page = btn->right_page, nleft, nright;
+    bool leaf = (type == PGTYPE_TEXTINDEX_LEAF);
+    ncell_t n, m, k;
+    int status;
+
+    split->left = 0;
+
+    if (i > 0 && hasRoomForCell(btn, btc)) {
+        chidb_Btree_insertCell(btn, i, btc);
+        return chidb_Btree_writeNode(bt, btn);
     }
 
-    if(!npage) {
-	fprintf(stderr,"insertNonFull: npage is 0.......\n");
-	exit(1);
+    if ((status = chidb_Btree_copyNode(btn, &copy)) != CHIDB_OK)
+        return status;
+
+    n = copy.node.n_cells + 1;
+    cells = malloc(n * sizeof(BTreeCell));
+    sizes = malloc(n * sizeof(uint32_t));
+    if (cells == NULL || sizes == NULL) {
+        status = CHIDB_ENOMEM;
+        goto done;
     }
 
-    for (i = 0; i < btn->n_cells; i++) {
+    for (k = 0; k < n; k++) {
+        if (k == i)
+            cells[k] = *btc;
+        else
+            chidb_Btree_getCell(&copy.node, k < i ? k : k - 1, &cells[k]);
+    }
+    for (k = 0; k < n; k++) {
+        uint32_t stored = chidb_Btree_textLength(&cells[k]) - (k > 0 ? chidb_Btree_textShared(&cells[k], &cells[0]) : 0);
 
-        if (chidb_Btree_getCell(btn, i, &temp_cell) != CHIDB_OK) {
-	    fprintf(stderr,"insertNonFull: ecelno on cell (%d)\n",i);
-            return CHIDB_ECELLNO;
-        }
-        if ((temp_cell.key == btc->key) 
-            && (btn->type != PGTYPE_TABLE_INTERNAL)) {
+        sizes[k] = chidb_Btree_textCellSize(type, btn->key_size, &cells[k], stored) + 2;
+        total += sizes[k];
+    }
 
-            if ((status = chidb_Btree_freeMemNode(bt, btn)) != CHIDB_OK) {
-                return status;
-            }
+    if (total <= cap) {
+        chidb_Btree_resetNode(bt, btn, type);
+        status = chidb_Btree_textWrite(bt, btn, cells, 0, n, right_page);
+        goto done;
+    }
+
+    if (append) {
+        m = leaf ? n - 1 : n - 2;
+    } else {
+        for (m = 0; m < n && left + sizes[m] <= total / 2; m++)
+            left += sizes[m];
+        while (m > 1 && left > cap)
+            left -= sizes[--m];
+    }
+    if (m < 1)
+        m = 1;
+    if (m > n - (leaf ? 1 : 2))
+        m = n - (leaf ? 1 : 2);
+
+    /* The separator. Between two leaves, it is as much of the first text
+     * of the second leaf as it takes to come after the last text of the
+     * first leaf (with the primary key, if the texts are the same). */
+    sep = cells[m];
+    sep_len = chidb_Btree_textLength(&sep);
+    if (leaf) {
+        uint32_t shared = chidb_Btree_textShared(&cells[m - 1], &cells[m]);
+
+        sep.fields.textIndex.has_pk = (shared == sep_len
+                                       && shared == chidb_Btree_textLength(&cells[m - 1]));
+        if (!sep.fields.textIndex.has_pk)
+            sep_len = shared + 1;
+    }
+    if ((sep_text = malloc(chidb_Btree_textLength(&sep) + 1)) == NULL) {
+        status = CHIDB_ENOMEM;
+        goto done;
+    }
+    chidb_Btree_textCopy(&sep, sep_text);
+    sep.type = PGTYPE_TEXTINDEX_INTERNAL;
+    sep.fields.textIndex.prefix = NULL;
+    sep.fields.textIndex.prefix_len = 0;
+    sep.fields.textIndex.suffix = sep_text;
+    sep.fields.textIndex.suffix_len = sep_len;
+
+    if ((status = chidb_Btree_textWriteNew(bt, &nleft, type, cells, 0, m,
+                                           leaf ? 0 : cells[m].fields.textIndex.child_page)) != CHIDB_OK)
+        goto done;
+
+    if (root) {
+        if ((status = chidb_Btree_textWriteNew(bt, &nright, type, cells, leaf ? m : m + 1, n, right_page)) != CHIDB_OK)
+            goto done;
+        chidb_Btree_resetNode(bt, btn, PGTYPE_TEXTINDEX_INTERNAL);
+        sep.fields.textIndex.child_page = nleft;
+        status = chidb_Btree_textWrite(bt, btn, &sep, 0, 1, nright);
+    } else {
+        chidb_Btree_resetNode(bt, btn, type);
+        if ((status = chidb_Btree_textWrite(bt, btn, cells, leaf ? m : m + 1, n, right_page)) != CHIDB_OK)
+            goto done;
+        split->left = nleft;
+        split->text = sep_text;
+        split->len = sep_len;
+        split->keyPk = sep.fields.textIndex.keyPk;
+        split->has_pk = sep.fields.textIndex.has_pk;
+        sep_text = NULL;
+    }
+
+done:
+    free(sep_text);
+    free(sizes);
+    free(cells);
+    free(copy.buf);
+
+    return status;
+}
 
-            return CHIDB_EDUPLICATE;
 
+/* Inserts an entry into the subtree rooted at npage. If the node is
+ * split, split has the new node and the separator for the parent. edge
+ * is true if the node is on the right edge of the tree. */
+static int chidb_Btree_textInsertInNode(BTree *bt, npage_t npage, bool root, bool edge, BTreeCell *btc, const BTreeTextKey *key, TextSplit *split)
+{
+    BTreeNode *btn;
+    BTreeCell sep;
+    TextSplit sub;
+    ncell_t i;
+    int status;
+
+    split->left = 0;
+
+    if ((status = chidb_Btree_getNodeByPage(bt, npage, &btn)) != CHIDB_OK)
+        return status;
+
+    if (!PGTYPE_IS_TEXTINDEX(btn->type)) {
+        status = CHIDB_ECORRUPT;
+    } else if (chidb_Btree_searchText(btn, key, &i) == CHIDB_TRUE) {
+        status = CHIDB_EDUPLICATE;
+    } else if (btn->type == PGTYPE_TEXTINDEX_LEAF) {
+        status = chidb_Btree_textPut(bt, btn, i, btc, root, edge && i == btn->n_cells, split);
+    } else {
+        edge = edge && i == btn->n_cells;
+        status = chidb_Btree_textInsertInNode(bt, chidb_Btree_getChild(btn, i), false, edge, btc, key, &sub);
+
+        // the child keeps the entries after the separator, so the new
+        // node goes right before it
+        if (status == CHIDB_OK && sub.left != 0) {
+            sep.type = PGTYPE_TEXTINDEX_INTERNAL;
+            sep.key = 0;
+            sep.fields.textIndex.prefix = NULL;
+            sep.fields.textIndex.prefix_len = 0;
+            sep.fields.textIndex.suffix = sub.text;
+            sep.fields.textIndex.suffix_len = sub.len;
+            sep.fields.textIndex.keyPk = sub.keyPk;
+            sep.fields.textIndex.has_pk = sub.has_pk;
+            sep.fields.textIndex.child_page = sub.left;
+            status = chidb_Btree_textPut(bt, btn, i, &sep, root, edge, split);
+            free(sub.text);
         }
+    }
 
+    chidb_Btree_freeMemNode(bt, btn);
 
-        if (btc->key <= temp_cell.key) {
-            switch(btn->type) {
-                case PGTYPE_TABLE_INTERNAL:
-                    if ((status = chidb_Btree_freeMemNode(bt, btn)) != CHIDB_OK) {
-                        return status;
-                    }
+    return status;
+}
 
-                    if ((status = chidb_Btree_getNodeByPage(bt, temp_cell.fields.tableInternal.child_page, &child_btn)) 
-                        != CHIDB_OK) {
-                        return status;
-                    }
 
-                    if (!hasRoomForCell(child_btn, btc)) {
-			// close child_btn
-			if ((status = chidb_Btree_freeMemNode(bt,child_btn)) != CHIDB_OK) {
-			    return status;
-			}
-                        if ((status = chidb_Btree_split(bt, npage, temp_cell.fields.tableInternal.child_page, i, &child_num))
-                            != CHIDB_OK) {
-                            return status;
-                        }
-                        return chidb_Btree_insertNonFull(bt, npage, btc);
-                    }
+/* Insert an entry into a text index
+ *
+ * Parameters
+ * - bt: B-Tree file
+ * - nroot: Page number of the root node of the text index
+ * - btc: Entry to insert (a PGTYPE_TEXTINDEX_LEAF cell, with the text and
+ *        the primary key of the row)
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_EDUPLICATE: The entry is already in the index
+ * - CHIDB_EMISMATCH: The text is too long, or the primary key is too
+ *                    large for the file (see chidb_Btree_checkKeys)
+ * - CHIDB_ECORRUPT: The tree is not a text index
+ * - CHIDB_ENOMEM: Could not allocate memory
+ * - CHIDB_EIO: An I/O error has occurred when accessing the file
+ */
+int chidb_Btree_insertText(BTree *bt, npage_t nroot, BTreeCell *btc)
+{
+    BTreeCell cell = *btc;
+    BTreeTextKey key;
+    TextSplit split;
+    uint32_t len = chidb_Btree_textLength(btc);
+    uint8_t *text;
+    int status;
 
-                    return chidb_Btree_insertNonFull(bt, temp_cell.fields.tableInternal.child_page, btc);
+    cell.type = PGTYPE_TEXTINDEX_LEAF;
+    if ((status = chidb_Btree_checkKeys(bt, &cell)) != CHIDB_OK)
+        return status;
 
-                case PGTYPE_INDEX_INTERNAL:   
-                    if ((status = chidb_Btree_freeMemNode(bt, btn)) != CHIDB_OK) {
-                        return status;
-                    }
+    // the text is searched for in one piece
+    if ((text = malloc(len + 1)) == NULL)
+        return CHIDB_ENOMEM;
+    chidb_Btree_textCopy(btc, text);
 
-                    if ((status = chidb_Btree_getNodeByPage(bt, temp_cell.fields.indexInternal.child_page, &child_btn)) 
-                        != CHIDB_OK) {
-                        return status;
-                    }
+    cell.key = 0;
+    cell.fields.textIndex.prefix = NULL;
+    cell.fields.textIndex.prefix_len = 0;
+    cell.fields.textIndex.suffix = text;
+    cell.fields.textIndex.suffix_len = len;
+    cell.fields.textIndex.has_pk = true;
+    cell.fields.textIndex.child_page = 0;
+
+    key.text = text;
+    key.len = len;
+    key.keyPk = cell.fields.textIndex.keyPk;
+    key.edge = TEXTKEY_ENTRY;
+
+    status = chidb_Btree_textInsertInNode(bt, nroot, true, true, &cell, &key, &split);
+    free(text);
+
+    return status;
+}
+
+
+/* Insert an entry into a text index
+ *
+ * This is a convenience function that wraps around chidb_Btree_insertText.
+ *
+ * Parameters
+ * - bt: B-Tree file
+ * - nroot: Page number of the root node of the text index
+ * - text: Indexed text (not NUL-terminated)
+ * - len: Length of the text
+ * - keyPk: Primary key of the row
+ *
+ * Return
+ * - chidb_Btree_insertText return codes
+ */
+int chidb_Btree_insertInTextIndex(BTree *bt, npage_t nroot, const uint8_t *text, uint32_t len, chidb_key_t keyPk)
+{
+    BTreeCell btc;
 
-                    if (!hasRoomForCell(child_btn, btc)) {
-			// close child_btn
-			if ((status = chidb_Btree_freeMemNode(bt,child_btn)) != CHIDB_OK) {
-			    return status;
-			}
-                        if ((status = chidb_Btree_split(bt, npage, temp_cell.fields.indexInternal.child_page, i, &child_num))
-                            != CHIDB_OK) {
-                            return status;
-                        }
-                        return chidb_Btree_insertNonFull(bt, npage, btc);
-                    }
+    btc.type = PGTYPE_TEXTINDEX_LEAF;
+    btc.key = 0;
+    btc.fields.textIndex.prefix = NULL;
+    btc.fields.textIndex.prefix_len = 0;
+    btc.fields.textIndex.suffix = (uint8_t *) text;
+    btc.fields.textIndex.suffix_len = len;
+    btc.fields.textIndex.keyPk = keyPk;
+    btc.fields.textIndex.has_pk = true;
+    btc.fields.textIndex.child_page = 0;
+
+    return chidb_Btree_insertText(bt, nroot, &btc);
+}
 
-                    return chidb_Btree_insertNonFull(bt, temp_cell.fields.indexInternal.child_page, btc); 
-                    
-                case PGTYPE_TABLE_LEAF:
-                case PGTYPE_INDEX_LEAF:
-                    status = chidb_Btree_insertCell(btn, i, btc);
-                    chidb_Btree_writeNode(bt, btn);
-                    chidb_Btree_freeMemNode(bt, btn);
-                    return status;
 
-            }
-        }
+/* Deletes an entry from the subtree rooted at npage
+ *
+ * now is set to the page that takes the place of the node in its parent:
+ * npage, 0 if the node was left empty, or its only child if it was left
+ * with no cells. The node is freed in the last two cases. The root stays
+ * where it is: it becomes an empty leaf, or takes in its only child.
+ */
+static int chidb_Btree_textDeleteInNode(BTree *bt, npage_t npage, bool root, const BTreeTextKey *key, npage_t *now)
+{
+    BTreeNode *btn;
+    npage_t child, sub;
+    ncell_t i;
+    int status;
 
-    }
+    *now = npage;
 
-    if ((btn->type == PGTYPE_INDEX_LEAF) || (btn->type == PGTYPE_TABLE_LEAF)) {
-        status = chidb_Btree_insertCell(btn, i, btc);
-        chidb_Btree_writeNode(bt, btn);
-        chidb_Btree_freeMemNode(bt, btn);
+    if ((status = chidb_Btree_getNodeByPage(bt, npage, &btn)) != CHIDB_OK)
         return status;
-    } else {
-        temp_right_page = btn->right_page;
-
-        chidb_Btree_freeMemNode(bt, btn);
 
-        if ((status = chidb_Btree_getNodeByPage(bt, temp_right_page, &child_btn)) 
-            != CHIDB_OK) {
-            return status;
+    if (!PGTYPE_IS_TEXTINDEX(btn->type)) {
+        status = CHIDB_ECORRUPT;
+    } else if (btn->type == PGTYPE_TEXTINDEX_LEAF) {
+        if (chidb_Btree_searchText(btn, key, &i) != CHIDB_TRUE)
+            status = CHIDB_ENOTFOUND;
+        else if ((status = chidb_Btree_removeCell(bt, btn, i)) == CHIDB_OK) {
+            if (btn->n_cells == 0 && !root)
+                *now = 0;
+            else
+                status = chidb_Btree_writeNode(bt, btn);
         }
+    } else {
+        chidb_Btree_searchText(btn, key, &i);
+        child = chidb_Btree_getChild(btn, i);
+        if ((status = chidb_Btree_textDeleteInNode(bt, child, false, key, &sub)) == CHIDB_OK && sub != child) {
+            if (sub != 0) {
+                chidb_Btree_setChild(btn, i, sub);
+            } else if (i < btn->n_cells) {
+                // the entries between the separators around it go to the next child
+                status = chidb_Btree_removeCell(bt, btn, i);
+            } else if (btn->n_cells > 0) {
+                btn->right_page = chidb_Btree_getChild(btn, btn->n_cells - 1);
+                status = chidb_Btree_removeCell(bt, btn, btn->n_cells - 1);
+            } else {
+                // nothing is left under the node
+                btn->right_page = 0;
+                if (root)
+                    chidb_Btree_resetNode(bt, btn, PGTYPE_TEXTINDEX_LEAF);
+                else
+                    *now = 0;
+            }
 
-        if (!hasRoomForCell(child_btn, btc)) {
-	    // close child_btn
-	    if ((status = chidb_Btree_freeMemNode(bt,child_btn)) != CHIDB_OK) {
-		return status;
-	    }
-            if ((status = chidb_Btree_split(bt, npage, temp_right_page, i, &child_num))
-                != CHIDB_OK) {
-                return status;
+            if (status == CHIDB_OK && *now != 0) {
+                if (btn->type == PGTYPE_TEXTINDEX_INTERNAL && btn->n_cells == 0 && !root)
+                    *now = btn->right_page;
+                else if ((status = chidb_Btree_writeNode(bt, btn)) == CHIDB_OK
+                        && btn->type == PGTYPE_TEXTINDEX_INTERNAL && btn->n_cells == 0)
+                    status = chidb_Btree_collapseRoot(bt, btn);
             }
-            return chidb_Btree_insertNonFull(bt, npage, btc);
         }
-
-        return chidb_Btree_insertNonFull(bt, temp_right_page, btc);
     }
+
+    chidb_Btree_freeMemNode(bt, btn);
+
+    if (status == CHIDB_OK && *now != npage)
+        status = chidb_Btree_freePage(bt, npage);
+
+    return status;
 }
 
 
-/* Split a B-Tree node
+/* Delete an entry from a text index
  *
- * Splits a B-Tree node N. This involves the following:
- * - Find the median cell in N.
- * - Create a new B-Tree node M.
- * - Move the cells before the median cell to M (if the
- *   cell is a table leaf cell, the median cell is moved too)
- * - Add a cell to the parent (which, by definition, will be an
- *   internal page) with the median key and the page number of M.
+ * Nodes that are left empty are dropped, but nodes are not merged (see
+ * above). Pages that are no longer needed go to the free list.
  *
  * Parameters
  * - bt: B-Tree file
- * - npage_parent: Page number of the parent node
- * - npage_child: Page number of the node to split
- * - parent_ncell: Position in the parent where the new cell will
- *                 be inserted.
- * - npage_child2: Out parameter. Used to return the page of the new child node.
- * - btc: BTreeCell to insert into B-Tree
+ * - nroot: Page number of the root node of the text index
+ * - key: The entry (with edge TEXTKEY_ENTRY)
  *
  * Return
  * - CHIDB_OK: Operation successful
+ * - CHIDB_ENOTFOUND: The entry is not in the index
+ * - CHIDB_ECORRUPT: The tree is not a text index
  * - CHIDB_ENOMEM: Could not allocate memory
  * - CHIDB_EIO: An I/O error has occurred when accessing the file
  */
-int chidb_Btree_split(BTree *bt, npage_t npage_parent, npage_t npage_child, ncell_t parent_ncell, npage_t *npage_child2)
+int chidb_Btree_deleteText(BTree *bt, npage_t nroot, const BTreeTextKey *key)
 {
+    npage_t now;
 
-    BTreeNode *parent;
-    BTreeNode *child;
+    return chidb_Btree_textDeleteInNode(bt, nroot, true, key, &now);
+}
 
-    BTreeNode *upper;
-    npage_t upper_num;
 
-    BTreeNode *lower;
-    npage_t lower_num, upper_right;
+/*
+ * Vacuum
+ *
+ * Free pages are only reused by the B-Tree file, so the file never gets
+ * smaller on its own. chidb_Btree_vacuum moves the pages at the end of
+ * the file into free pages, and then cuts the file. To move a page, the
+ * one pointer to it (in its parent node, in the cell it overflows from,
+ * or in the previous overflow page) must be updated, so every page is
+ * first mapped back to that pointer.
+ */
 
-    BTreeNode *temp;
-    npage_t temp_num;
+#define VACUUM_UNKNOWN  (0)
+#define VACUUM_FREE     (1)
+#define VACUUM_ROOT     (2)
+#define VACUUM_NODE     (3)
+#define VACUUM_OVERFLOW (4)
 
-    BTreeCell insert_median_cell;
-    BTreeCell original_median_cell;
-    BTreeCell temp_cell;
+typedef struct
+{
+    npage_t parent;        /* Page with the pointer to this page */
+    uint16_t offset;       /* Offset of the pointer in that page */
+    uint8_t kind;          /* VACUUM_* */
+} VacuumRef;
 
-    int i, j, status, median_index;
 
-    //get parent page
-    if ((status = chidb_Btree_getNodeByPage(bt, npage_parent, &parent)) != CHIDB_OK) {
-        return status;
-    }
+/* Records the pointer to a page. Every page can only be pointed at once. */
+static int chidb_Btree_vacuumRef(BTree *bt, VacuumRef *refs, npage_t npage, npage_t parent, uint16_t offset, uint8_t kind)
+{
+    if (npage < 2 || npage > bt->pager->n_pages || refs[npage].kind != VACUUM_UNKNOWN)
+        return CHIDB_ECORRUPT;
 
-    //get child page
-    if ((status = chidb_Btree_getNodeByPage(bt, npage_child, &child)) != CHIDB_OK) {
-        return status;
-    }
+    refs[npage].parent = parent;
+    refs[npage].offset = offset;
+    refs[npage].kind = kind;
+
+    return CHIDB_OK;
+}
 
-    median_index = child->n_cells / 2;
 
-    //initialize new node with page_num = lower_num
-    if ((status = chidb_Btree_newNode(bt, &lower_num, child->type)) != CHIDB_OK) {
-        return status;
-    }
+/* Records the pointers in a B-Tree node (and in the overflow chains of
+ * its cells), and walks down the tree */
+static int chidb_Btree_vacuumWalk(BTree *bt, VacuumRef *refs, npage_t npage)
+{
+    BTreeNode *btn;
+    BTreeCell cell;
+    int status = CHIDB_OK;
 
-    //get page at page_num = lower_num
-    if ((status = chidb_Btree_getNodeByPage(bt, lower_num, &lower)) != CHIDB_OK) {
+    if ((status = chidb_Btree_getNodeByPage(bt, npage, &btn)) != CHIDB_OK)
         return status;
-    }
 
-    upper = child;
-    upper_num = npage_child;
+    for (ncell_t i = 0; i < btn->n_cells && status == CHIDB_OK; i++) {
+        uint16_t offset = get2byte(btn->celloffset_array + i*2);
+
+        chidb_Btree_getCell(btn, i, &cell);
+        if (cell.type == PGTYPE_TABLE_LEAF && cell.fields.tableLeaf.overflow != 0) {
+            npage_t ov = cell.fields.tableLeaf.overflow;
+
+            status = chidb_Btree_vacuumRef(bt, refs, ov, npage,
+                                           offset + TABLELEAFCELL_DATA_OFFSET(btn->key_size) + cell.fields.tableLeaf.local_size, VACUUM_OVERFLOW);
+            while (status == CHIDB_OK) {
+                MemPage *page;
+                npage_t next;
+
+                if ((status = chidb_Pager_readPage(bt->pager, ov, &page)) != CHIDB_OK)
+                    break;
+                next = get4byte(page->data + OVERFLOWPG_NEXT_OFFSET);
+                chidb_Pager_releaseMemPage(bt->pager, page);
+                if (next == 0)
+                    break;
+                status = chidb_Btree_vacuumRef(bt, refs, next, ov, OVERFLOWPG_NEXT_OFFSET, VACUUM_OVERFLOW);
+                ov = next;
+            }
+        } else if (PGTYPE_IS_INTERNAL(cell.type)) {
+            npage_t child = chidb_Btree_getChild(btn, i);
 
-    //initialize new node with page_num = temp_num
-    if ((status = chidb_Btree_newNode(bt, &temp_num, child->type)) != CHIDB_OK) {
-        return status;
+            if ((status = chidb_Btree_vacuumRef(bt, refs, child, npage, offset + TABLEINTCELL_CHILD_OFFSET, VACUUM_NODE)) == CHIDB_OK)
+                status = chidb_Btree_vacuumWalk(bt, refs, child);
+        }
     }
 
-    //get page at page_num = temp_num
-    if ((status = chidb_Btree_getNodeByPage(bt, temp_num, &temp))) {
-        return status;
-    }
+    if (status == CHIDB_OK && PGTYPE_IS_INTERNAL(btn->type)) {
+        uint16_t offset = ((npage == 1) ? 100 : 0) + 8;
 
-    //Setup insert_median_cell for insertion into parent
-    if ((status = chidb_Btree_getCell(child, median_index, &original_median_cell)) != CHIDB_OK) {
-        return status;
+        if ((status = chidb_Btree_vacuumRef(bt, refs, btn->right_page, npage, offset, VACUUM_NODE)) == CHIDB_OK)
+            status = chidb_Btree_vacuumWalk(bt, refs, btn->right_page);
     }
 
-    insert_median_cell.type = parent->type;
-    insert_median_cell.key = original_median_cell.key;
+    chidb_Btree_freeMemNode(bt, btn);
 
-    switch(insert_median_cell.type) {
-        case PGTYPE_TABLE_INTERNAL:
-            insert_median_cell.fields.tableInternal.child_page = lower_num;
-            break;
-        case PGTYPE_INDEX_INTERNAL:
+    return status;
+}
 
-            insert_median_cell.fields.indexInternal.child_page = lower_num;
 
-            if (original_median_cell.type == PGTYPE_INDEX_INTERNAL) {
-                insert_median_cell.fields.indexInternal.keyPk = original_median_cell.fields.indexInternal.keyPk;
-            } else {
-                insert_median_cell.fields.indexInternal.keyPk = original_median_cell.fields.indexLeaf.keyPk;
-            }
-	    break;
-        default:
-	    fprintf(stderr,"split: type of parent should never be a leaf type; got type (%d)\n",insert_median_cell.type);
-	    exit(1);
+/* Moves a page (pointed at from refs[from]) to a free page, and points
+ * everything at the new page */
+static int chidb_Btree_vacuumMove(BTree *bt, VacuumRef *refs, npage_t from, npage_t to)
+{
+    MemPage *src, *dst, *parent;
+    BTreeNode btn;
+    int status;
+
+    if ((status = chidb_Pager_readPage(bt->pager, from, &src)) != CHIDB_OK)
+        return status;
+    if ((status = chidb_Pager_readPage(bt->pager, to, &dst)) != CHIDB_OK) {
+        chidb_Pager_releaseMemPage(bt->pager, src);
+        return status;
     }
+    memcpy(dst->data, src->data, bt->pager->page_size);
+    status = chidb_Btree_writePage(bt, dst);
+
+    /* The pages this page points at now have a new parent */
+    if (status == CHIDB_OK && refs[from].kind == VACUUM_NODE) {
+        BTreeCell cell;
+
+        chidb_Btree_loadNode(dst, &btn);
+        for (ncell_t i = 0; i < btn.n_cells; i++) {
+            chidb_Btree_getCell(&btn, i, &cell);
+            if (cell.type == PGTYPE_TABLE_LEAF && cell.fields.tableLeaf.overflow != 0)
+                refs[cell.fields.tableLeaf.overflow].parent = to;
+            else if (PGTYPE_IS_INTERNAL(cell.type))
+                refs[chidb_Btree_getChild(&btn, i)].parent = to;
+        }
+        if (PGTYPE_IS_INTERNAL(btn.type))
+            refs[btn.right_page].parent = to;
+    } else if (status == CHIDB_OK) {
+        npage_t next = get4byte(dst->data + OVERFLOWPG_NEXT_OFFSET);
 
-    //Insert insert_median_cell into parent
-    if ((status = chidb_Btree_insertCell(parent, parent_ncell, &insert_median_cell)) != CHIDB_OK) {
+        if (next != 0)
+            refs[next].parent = to;
+    }
 
-	fprintf(stderr,"split: median cell insert into parent error (%d)\n",status);
+    chidb_Pager_releaseMemPage(bt->pager, src);
+    chidb_Pager_releaseMemPage(bt->pager, dst);
+    if (status != CHIDB_OK)
+        return status;
 
+    if ((status = chidb_Pager_readPage(bt->pager, refs[from].parent, &parent)) != CHIDB_OK)
         return status;
-    }
+    put4byte(parent->data + refs[from].offset, to);
+    status = chidb_Btree_writePage(bt, parent);
+    chidb_Pager_releaseMemPage(bt->pager, parent);
 
-    //copy cells below the median to lower
-    for (i = 0; i < median_index; i++) {
-        if ((status = chidb_Btree_getCell(upper, i, &temp_cell)) != CHIDB_OK) {
-            return status;
-        }
-        if ((status = chidb_Btree_insertCell(lower, i, &temp_cell)) != CHIDB_OK) {
-            return status;
-        }
-    }
+    refs[to] = refs[from];
+    refs[from].kind = VACUUM_FREE;
 
-    //copy original median cell if necessary
-    // get that original median cell into temp_cell
-    if ((status = chidb_Btree_getCell(upper, i, &temp_cell)) != CHIDB_OK) {
-	return status;
-    }	
-    if(upper->type == PGTYPE_TABLE_LEAF) {
-	if ((status = chidb_Btree_insertCell(lower, i, &temp_cell)) != CHIDB_OK) {
-	    return status;
-	}
-	i++;
-    } else if (temp_cell.type != PGTYPE_INDEX_LEAF) {
-	// if the type of the children is not a leaf type, then we must set right_page of lower to the former child of the median
-	switch(temp_cell.type) {
-	case PGTYPE_TABLE_INTERNAL:
-	    lower->right_page = temp_cell.fields.tableInternal.child_page;
-	    break;
-	case PGTYPE_INDEX_INTERNAL:
-	    lower->right_page = temp_cell.fields.indexInternal.child_page;
-	    break;
-	}
-	if(lower->right_page == 0) {
-	    fprintf(stderr,"split: 0 right page passed\n");
-	    exit(2);
-	}
-    }
+    return status;
+}
 
-    //copy cells above the median to temp
-    for (j = 0; i < upper->n_cells; i++, j++) {
-        if ((status = chidb_Btree_getCell(upper, i, &temp_cell)) != CHIDB_OK) {
-            return status;
-        }
-        if ((status = chidb_Btree_insertCell(temp, j, &temp_cell)) != CHIDB_OK) {
-            return status;
-        }        
-    }
 
-    upper_right = upper->right_page;
-    // close upper
+/* Shrink the file
+ *
+ * Moves pages from the end of the file into free pages, and truncates the
+ * file (see chidb_Pager_truncate). Root pages are never moved, since the
+ * schema refers to them, so the file only shrinks down to the last root
+ * page. The pages left in the free list stay there.
+ *
+ * Every page that is in use must be reachable from one of the given
+ * roots. The file cannot be shrunk while there are pinned pages, or
+ * during a transaction.
+ *
+ * Parameters
+ * - bt: B-Tree file
+ * - roots: Root pages of every B-Tree in the file
+ * - nroots: Number of roots
+ * - max: Most pages to remove (0 to remove as many as possible)
+ * - nremoved: Out parameter. Number of pages removed.
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_EMISUSE: There are pinned pages, or there is a transaction
+ * - CHIDB_ECORRUPT: A page is referred to more than once, or a page
+ *                   number is not valid
+ * - CHIDB_ENOMEM: Could not allocate memory
+ * - CHIDB_EIO: An I/O error has occurred when accessing the file
+ */
+int chidb_Btree_vacuum(BTree *bt, npage_t *roots, uint32_t nroots, uint32_t max, uint32_t *nremoved)
+{
+    VacuumRef *refs;
+    MemPage *header, *trunk;
+    npage_t n = bt->pager->n_pages, lo = 2, ntrunk;
+    int status = CHIDB_OK;
 
-    if ((status = chidb_Btree_freeMemNode(bt,upper)) != CHIDB_OK) {
-	return status;
-    }
+    *nremoved = 0;
 
-    //Clear upper
-    if ((status = chidb_Btree_initEmptyNode(bt, upper_num, temp->type)) != CHIDB_OK) {
+    if (bt->pager->in_txn || chidb_Pager_hasPinnedFrames(bt->pager))
+        return CHIDB_EMISUSE;
+    if (n == 0)
+        return CHIDB_OK;
+
+    if (!(refs = calloc(n + 1, sizeof(VacuumRef))))
+        return CHIDB_ENOMEM;
+
+    /* Free pages */
+    if ((status = chidb_Pager_readPage(bt->pager, 1, &header)) != CHIDB_OK) {
+        free(refs);
         return status;
     }
+    ntrunk = get4byte(header->data + FILEHEADER_FREELIST_OFFSET);
+    chidb_Pager_releaseMemPage(bt->pager, header);
 
-    // reopen upper
+    while (ntrunk != 0 && status == CHIDB_OK) {
+        uint32_t nleaves;
 
-    if ((status = chidb_Btree_getNodeByPage(bt, upper_num, &upper)) != CHIDB_OK) {
-	return status;
-    }
-    upper->right_page = upper_right;
+        if ((status = chidb_Btree_vacuumRef(bt, refs, ntrunk, 0, 0, VACUUM_FREE)) != CHIDB_OK
+                || (status = chidb_Pager_readPage(bt->pager, ntrunk, &trunk)) != CHIDB_OK)
+            break;
 
-    //insert each cell in temp into upper
-    for (i = 0; i < temp->n_cells; i++) {
-        if ((status = chidb_Btree_getCell(temp, i, &temp_cell)) != CHIDB_OK) {
-            return status;
-        }
-        if ((status = chidb_Btree_insertCell(upper, i, &temp_cell)) != CHIDB_OK) {
-            return status;
-        }           
+        nleaves = get4byte(trunk->data + FREELISTPG_NLEAVES_OFFSET);
+        if (nleaves > FREELISTPG_MAXLEAVES(bt->pager->page_size))
+            status = CHIDB_ECORRUPT;
+        for (uint32_t i = 0; i < nleaves && status == CHIDB_OK; i++)
+            status = chidb_Btree_vacuumRef(bt, refs, get4byte(trunk->data + FREELISTPG_LEAVES_OFFSET + i*4), 0, 0, VACUUM_FREE);
+        ntrunk = get4byte(trunk->data + FREELISTPG_NEXT_OFFSET);
+        chidb_Pager_releaseMemPage(bt->pager, trunk);
     }
 
-    //free temp
-    //decrement number of pages (like it was never here)
-    chidb_Btree_freeMemNode(bt, temp);
-    bt->pager->n_pages--;
-
-    //write parent
-    if ((status = chidb_Btree_writeNode(bt, parent)) != CHIDB_OK) {
-        return status;
+    /* Pages in use */
+    for (uint32_t i = 0; i < nroots && status == CHIDB_OK; i++) {
+        if (roots[i] != 1 && (status = chidb_Btree_vacuumRef(bt, refs, roots[i], 0, 0, VACUUM_ROOT)) != CHIDB_OK)
+            break;
+        status = chidb_Btree_vacuumWalk(bt, refs, roots[i]);
     }
 
-    //write upper
-    if ((status = chidb_Btree_writeNode(bt, upper)) != CHIDB_OK) {
-        return status;
+    /* Pages at the end are dropped if they are free, or moved to the
+     * first free page otherwise */
+    while (status == CHIDB_OK && n > 1 && (max == 0 || *nremoved < max)) {
+        if (refs[n].kind != VACUUM_FREE) {
+            if (refs[n].kind != VACUUM_NODE && refs[n].kind != VACUUM_OVERFLOW)
+                break;
+            while (lo < n && refs[lo].kind != VACUUM_FREE)
+                lo++;
+            if (lo == n)
+                break;
+            if ((status = chidb_Btree_vacuumMove(bt, refs, n, lo)) != CHIDB_OK)
+                break;
+        }
+        n--;
+        (*nremoved)++;
     }
 
-    //write lower
-    if ((status = chidb_Btree_writeNode(bt, lower)) != CHIDB_OK) {
-        return status;
+    /* The free list is rebuilt with what is left, so that the lowest
+     * pages are handed out first */
+    if (status == CHIDB_OK && (status = chidb_Pager_readPage(bt->pager, 1, &header)) == CHIDB_OK) {
+        put4byte(header->data + FILEHEADER_FREELIST_OFFSET, 0);
+        put4byte(header->data + FILEHEADER_NFREE_OFFSET, 0);
+        status = chidb_Btree_writePage(bt, header);
+        chidb_Pager_releaseMemPage(bt->pager, header);
     }
+    for (npage_t i = n; i >= 2 && status == CHIDB_OK; i--)
+        if (refs[i].kind == VACUUM_FREE)
+            status = chidb_Btree_freePage(bt, i);
 
-    //set out parameter to page number of child node
-    *npage_child2 = lower_num;
+    free(refs);
 
-    //free in-memory nodes
-    chidb_Btree_freeMemNode(bt, parent);
-    chidb_Btree_freeMemNode(bt, upper);
-    chidb_Btree_freeMemNode(bt, lower);
+    if (status == CHIDB_OK)
+        status = chidb_Pager_truncate(bt->pager, n);
 
-    return CHIDB_OK;
+    bt->append_root = 0;
+    bt->append_leaf = 0;
 
+    return status;
 }
-
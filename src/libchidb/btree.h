@@ -49,51 +49,193 @@
 #define PGTYPE_TABLE_LEAF (0x0D)
 #define PGTYPE_INDEX_INTERNAL (0x02)
 #define PGTYPE_INDEX_LEAF (0x0A)
+#define PGTYPE_TEXTINDEX_INTERNAL (0x03)
+#define PGTYPE_TEXTINDEX_LEAF (0x0B)
+
+#define PGTYPE_IS_INTERNAL(t) \
+    ((t) == PGTYPE_TABLE_INTERNAL || (t) == PGTYPE_INDEX_INTERNAL || (t) == PGTYPE_TEXTINDEX_INTERNAL)
+#define PGTYPE_IS_TEXTINDEX(t) ((t) == PGTYPE_TEXTINDEX_INTERNAL || (t) == PGTYPE_TEXTINDEX_LEAF)
 
 #define PGHEADER_PGTYPE_OFFSET (0)
 #define PGHEADER_FREE_OFFSET (1)
 #define PGHEADER_NCELLS_OFFSET (3)
 #define PGHEADER_CELL_OFFSET (5)
-#define PGHEADER_ZERO_OFFSET (7)
+#define PGHEADER_KEYSIZE_OFFSET (7)
 #define PGHEADER_RIGHTPG_OFFSET (8)
 
 #define LEAFPG_CELLSOFFSET_OFFSET (8)
 #define INTPG_CELLSOFFSET_OFFSET (12)
 
-/* Cell offsets and sizes */
+/* Key sizes. Keys are eight bytes wide in files created by this version
+ * of chidb, and four bytes wide in older files, which keep using them
+ * until they are vacuumed (see FILEHEADER_FORMAT_OFFSET). Each node
+ * records the width of the keys in its cells in the byte of its header
+ * that used to be always 0 (0 for four bytes, 8 for eight bytes), so that
+ * its cells can be read without looking at the file header. Four-byte
+ * table keys are 28-bit varints, and four-byte index keys are signed. */
+#define KEYSIZE_NARROW (4)
+#define KEYSIZE_WIDE (8)
+#define PGHEADER_GET_KEYSIZE(b) ((b) == KEYSIZE_WIDE ? KEYSIZE_WIDE : KEYSIZE_NARROW)
+#define PGHEADER_PUT_KEYSIZE(ks) ((ks) == KEYSIZE_WIDE ? KEYSIZE_WIDE : 0)
+#define NARROW_TABLEKEY_MAX (0x0FFFFFFF)
+
+/* Cell offsets and sizes (ks is the key size of the node) */
 
 #define TABLEINTCELL_CHILD_OFFSET (0)
 #define TABLEINTCELL_KEY_OFFSET (4)
 
 #define TABLELEAFCELL_SIZE_OFFSET (0)
 #define TABLELEAFCELL_KEY_OFFSET (4)
-#define TABLELEAFCELL_DATA_OFFSET (8)
+#define TABLELEAFCELL_DATA_OFFSET(ks) (4 + (ks))
+
+#define TABLEINTCELL_SIZE(ks) (4 + (ks))
+#define TABLELEAFCELL_SIZE_WITHOUTDATA(ks) (4 + (ks))
+#define TABLELEAFCELL_OVERFLOW_SIZE (4)
+
+/* Overflow pages. A table leaf cell with more than MAXLOCAL bytes of data
+ * only keeps a prefix of it in the page (see chidb_Btree_localSize),
+ * followed by the number of the first page of a chain of overflow pages
+ * that hold the rest. Each overflow page starts with the number of the
+ * next page in the chain (0 in the last one). MAXLOCAL is the most data
+ * that fits in an empty leaf, so cells that do not overflow are laid out
+ * as they always have been. */
+#define TABLELEAFCELL_MAXLOCAL(page_size, ks) ((page_size) - 14 - (ks))
+#define TABLELEAFCELL_MINLOCAL(page_size) (((page_size) - 12) * 32 / 255 - 23)
+#define TABLELEAFCELL_OVERFLOW_MAXLOCAL(page_size) ((page_size) - 35)
 
-#define TABLEINTCELL_SIZE (8)
-#define TABLELEAFCELL_SIZE_WITHOUTDATA (8)
+#define OVERFLOWPG_NEXT_OFFSET (0)
+#define OVERFLOWPG_DATA_OFFSET (4)
 
 #define INDEXINTCELL_CHILD_OFFSET (0)
 #define INDEXINTCELL_KEYIDX_OFFSET (8)
-#define INDEXINTCELL_KEYPK_OFFSET (12)
+#define INDEXINTCELL_KEYPK_OFFSET(ks) (8 + (ks))
 
 #define INDEXLEAFCELL_SIZE_OFFSET (0)
 #define INDEXLEAFCELL_KEYIDX_OFFSET (4)
-#define INDEXLEAFCELL_KEYPK_OFFSET (8)
+#define INDEXLEAFCELL_KEYPK_OFFSET(ks) (4 + (ks))
+
+#define INDEXINTCELL_SIZE(ks) (8 + 2 * (ks))
+#define INDEXLEAFCELL_SIZE(ks) (4 + 2 * (ks))
+
+/* Text indexes. Their keys are texts of any length (up to MAXKEY) along
+ * with the primary key of the row, so that several rows can have the
+ * same text. As in a table B-Tree, the entries are only in the leaves,
+ * and the keys of internal nodes only separate their children: each is
+ * the shortest text that is larger than everything in the child before
+ * it, and only has a primary key if the texts on both sides are equal.
+ *
+ * The text of a cell is stored as the number of bytes it shares with the
+ * text of the first cell of its node (which is stored whole) and the rest
+ * of it. Every cell can be read on its own that way, so nodes are still
+ * binary-searched. A separator's primary key is only there if the
+ * HAS_PK flag is set. */
+#define TEXTINDEXLEAFCELL_SHARED_OFFSET (0)
+#define TEXTINDEXLEAFCELL_SUFFIXLEN_OFFSET (2)
+#define TEXTINDEXLEAFCELL_KEYPK_OFFSET (4)
+#define TEXTINDEXLEAFCELL_SUFFIX_OFFSET(ks) (4 + (ks))
+#define TEXTINDEXLEAFCELL_SIZE(ks, n) (4 + (ks) + (n))
+
+#define TEXTINDEXINTCELL_CHILD_OFFSET (0)
+#define TEXTINDEXINTCELL_SHARED_OFFSET (4)
+#define TEXTINDEXINTCELL_SUFFIXLEN_OFFSET (6)
+#define TEXTINDEXINTCELL_FLAGS_OFFSET (8)
+#define TEXTINDEXINTCELL_KEYPK_OFFSET (9)
+#define TEXTINDEXINTCELL_SIZE(ks, has_pk, n) (9 + ((has_pk) ? (ks) : 0) + (n))
+#define TEXTINDEXINTCELL_HAS_PK (0x01)
 
-#define INDEXINTCELL_SIZE (16)
-#define INDEXLEAFCELL_SIZE (12)
+/* Longest text in a text index, so that a node always has room for a
+ * few cells (and splitting one in two always makes room for another) */
+#define TEXTINDEX_MAXKEY(page_size) ((page_size) / 4 - 32)
+
+/* Page size. 65536 does not fit in the two bytes it has in the file
+ * header, so it is stored as 1. */
+#define FILEHEADER_PAGESIZE_OFFSET (0x10)
+#define FILEHEADER_GET_PAGE_SIZE(h) \
+    (get2byte((h) + FILEHEADER_PAGESIZE_OFFSET) == 1 ? MAX_PAGE_SIZE : get2byte((h) + FILEHEADER_PAGESIZE_OFFSET))
+#define FILEHEADER_PUT_PAGE_SIZE(h, v) \
+    put2byte((h) + FILEHEADER_PAGESIZE_OFFSET, (v) == MAX_PAGE_SIZE ? 1 : (v))
+
+/* Free pages. Pages that are no longer used (e.g., after entries are
+ * deleted) are kept in a list in the file, as in SQLite, and reused
+ * before the file is extended (see chidb_Btree_freePage). The file
+ * header has the first trunk page of the list and the number of free
+ * pages. A trunk page has the next trunk page (0 in the last one),
+ * followed by the number of free pages it lists and their numbers. */
+#define FILEHEADER_FREELIST_OFFSET (0x20)
+#define FILEHEADER_NFREE_OFFSET (0x24)
+
+#define FREELISTPG_NEXT_OFFSET (0)
+#define FREELISTPG_NLEAVES_OFFSET (4)
+#define FREELISTPG_LEAVES_OFFSET (8)
+#define FREELISTPG_MAXLEAVES(page_size) ((page_size) / 4 - 2)
+
+/* File format. 1 in files with four-byte keys, 2 in files with
+ * eight-byte keys (see KEYSIZE_NARROW and KEYSIZE_WIDE). */
+#define FILEHEADER_FORMAT_OFFSET (0x2C)
+#define FILEFORMAT_NARROW_KEYS (1)
+#define FILEFORMAT_WIDE_KEYS (2)
 
 // Advance declarations
 typedef struct BTreeCell BTreeCell;
 typedef struct BTreeNode BTreeNode;
 
+/* Decoded copy of a table internal node (see chidb_Btree_searchInternal) */
+#define BTREE_DECODED_SLOTS (32)
+
+typedef struct BTreeDecoded
+{
+    npage_t npage;          /* Page of the copy, or 0 if there is none */
+    npage_t candidate;      /* Last page looked up in this slot that has no copy */
+    uint64_t generation;    /* Pager generation the copy was made in */
+    ncell_t n_cells;
+    uint32_t capacity;      /* Number of cells keys and children have room for */
+    chidb_key_t *keys;      /* Keys of the cells, in a cache-line aligned array */
+    npage_t *children;      /* Child pages of the cells, then the right page */
+} BTreeDecoded;
+
 /* The BTree struct represent a "B-Tree file". It contains a pointer to the
  * chidb database it is a part of, and a pointer to a Pager, which it will
  * use to access pages on the file */
+/* What a B-Tree file, and the cursors over it, have done since it was
+ * opened, or since its counters were last reset (see chidb_stats) */
+typedef struct BTreeStats
+{
+    uint64_t splits;        /* Nodes split (or, when appending, given a new right sibling) */
+    uint64_t shifts;        /* Full leaves that made room by moving cells to a sibling */
+    uint64_t allocated;     /* Pages allocated, from the free list or not */
+    uint64_t seeks;         /* Cursors moved to a key */
+    uint64_t steps;         /* Cursors moved to the next or previous entry */
+    uint64_t packed;        /* Records made by MakeRecord */
+    uint64_t unpacked;      /* Record headers decoded by cursors */
+} BTreeStats;
+
 typedef struct BTree
 {
     chidb *db;
     Pager *pager;
+
+    /* Last leaf of the B-Tree rooted at append_root, remembered
+     * when an entry is added at the end of the tree, so that the next
+     * entry with a larger key can go straight in (see chidb_Btree_insert).
+     * 0 if there is none. */
+    npage_t append_root;
+    npage_t append_leaf;
+
+    /* Root and key of the last entry inserted, and whether the entry
+     * being inserted goes after it (1), before it (-1), or in another
+     * B-Tree (0). Used to pick where a node is split (see chidb_Btree_split). */
+    npage_t last_root;
+    chidb_key_t last_key;
+    int insert_dir;
+
+    /* Size of the keys in the file (KEYSIZE_NARROW or KEYSIZE_WIDE) */
+    uint8_t key_size;
+
+    /* Decoded copies of the table internal nodes searched most often,
+     * indexed by page number */
+    BTreeDecoded decoded[BTREE_DECODED_SLOTS];
+
+    BTreeStats stats;
 } Btree;
 
 /* The BTreeNode struct is an in-memory representation of a B-Tree node. Thus,
@@ -112,10 +254,11 @@ struct BTreeNode
 {
     MemPage *page;             /* In-memory page returned by the Pager */
     uint8_t type;              /* Type of page  */
-    uint16_t free_offset;      /* Byte offset of free space in page */
+    uint32_t free_offset;      /* Byte offset of free space in page */
     ncell_t n_cells;           /* Number of cells */
-    uint16_t cells_offset;     /* Byte offset of start of cells in page */
+    uint32_t cells_offset;     /* Byte offset of start of cells in page */
     npage_t right_page;        /* Right page (internal nodes only) */
+    uint8_t key_size;          /* Size of the keys in the cells */
     uint8_t *celloffset_array; /* Pointer to start of cell offset array in the in-memory page */
 };
 
@@ -134,7 +277,10 @@ struct BTreeCell
         struct
         {
             uint32_t data_size;  /* Number of bytes of data stored in this cell */
-            uint8_t *data;       /* Pointer to in-memory copy of data stored in this cell */
+            uint8_t *data;       /* Pointer to in-memory copy of data stored in this cell
+                                  * (only the first local_size bytes, if it overflows) */
+            uint32_t local_size; /* Number of bytes of data in the page (set by getCell) */
+            npage_t overflow;    /* First overflow page, or 0 (set by getCell) */
         } tableLeaf;
         struct
         {
@@ -145,15 +291,54 @@ struct BTreeCell
         {
             chidb_key_t keyPk;         /* Primary key of row where the indexed field is equal to key */
         } indexLeaf;
+        struct
+        {
+            uint8_t *prefix;     /* Start of the text, shared with the first cell of the node */
+            uint8_t *suffix;     /* Rest of the text */
+            uint16_t prefix_len;
+            uint16_t suffix_len;
+            chidb_key_t keyPk;   /* Primary key of the row (in a separator, only if has_pk) */
+            bool has_pk;         /* Always true in a leaf. A separator without one comes
+                                  * before every entry with its text. */
+            npage_t child_page;  /* Child page with entries < key (separators only) */
+        } textIndex;
     } fields;
 };
 
+/* Position in a text index, to search for. It is either the entry with
+ * a given text and primary key (edge TEXTKEY_ENTRY), or the position
+ * right before (TEXTKEY_FIRST) or after (TEXTKEY_LAST) every entry with
+ * the text, whatever their primary keys. */
+#define TEXTKEY_FIRST (-1)
+#define TEXTKEY_ENTRY (0)
+#define TEXTKEY_LAST (1)
+
+typedef struct BTreeTextKey
+{
+    const uint8_t *text;
+    uint32_t len;
+    chidb_key_t keyPk;
+    int edge;
+} BTreeTextKey;
+
+/* Source of entries for chidb_Btree_bulkLoad. Each call must fill in the
+ * next cell and return CHIDB_OK, or return CHIDB_DONE when there are no
+ * more entries. */
+typedef int (*chidb_Btree_bulkSource)(void *ctx, BTreeCell *cell);
+
+/* Called by chidb_Btree_findMany for each entry it finds. The data is
+ * only valid during the call. */
+typedef int (*chidb_Btree_findCallback)(void *ctx, chidb_key_t key, uint8_t *data, uint32_t size);
+
 
 int chidb_Btree_open(const char *filename, chidb *db, BTree **bt);
 int chidb_Btree_close(BTree *bt);
+int chidb_Btree_setWal(BTree *bt, bool on);
+int chidb_Btree_setPageSize(BTree *bt, uint32_t page_size);
 
 int chidb_Btree_getNodeByPage(BTree *bt, npage_t npage, BTreeNode **node);
 int chidb_Btree_freeMemNode(BTree *bt, BTreeNode *btn);
+void chidb_Btree_loadNode(MemPage *page, BTreeNode *btn);
 
 int chidb_Btree_newNode(BTree *bt, npage_t *npage, uint8_t type);
 int chidb_Btree_initEmptyNode(BTree *bt, npage_t npage, uint8_t type);
@@ -161,13 +346,48 @@ int chidb_Btree_writeNode(BTree *bt, BTreeNode *node);
 
 int chidb_Btree_getCell(BTreeNode *btn, ncell_t ncell, BTreeCell *cell);
 int chidb_Btree_insertCell(BTreeNode *btn, ncell_t ncell, BTreeCell *cell);
+bool chidb_Btree_replaceCell(BTreeNode *btn, ncell_t ncell, BTreeCell *cell);
+int chidb_Btree_searchNode(BTreeNode *btn, chidb_key_t key, ncell_t *ncell);
+int chidb_Btree_searchIndex(BTreeNode *btn, chidb_key_t keyIdx, chidb_key_t keyPk, ncell_t *ncell);
+ncell_t chidb_Btree_searchInternal(BTree *bt, BTreeNode *btn, chidb_key_t key, npage_t *child);
+npage_t chidb_Btree_getChild(BTreeNode *btn, ncell_t i);
+uint32_t chidb_Btree_localSize(uint32_t page_size, uint8_t key_size, uint32_t data_size);
+int chidb_Btree_spill(BTree *bt, BTreeCell *btc);
+int chidb_Btree_readPayload(BTree *bt, BTreeCell *cell, uint8_t *buf);
+int chidb_Btree_loadPayload(BTree *bt, BTreeCell *cell, uint8_t **buf);
 
-int chidb_Btree_find(BTree *bt, npage_t nroot, chidb_key_t key, uint8_t **data, uint16_t *size);
+int chidb_Btree_find(BTree *bt, npage_t nroot, chidb_key_t key, uint8_t **data, uint32_t *size);
+int chidb_Btree_findRef(BTree *bt, npage_t nroot, chidb_key_t key, MemPage **page, uint8_t **data, uint32_t *size);
+int chidb_Btree_findMany(BTree *bt, npage_t nroot, chidb_key_t *keys, uint32_t n,
+                         chidb_Btree_findCallback found, void *ctx);
+int chidb_Btree_releaseRef(BTree *bt, MemPage *page);
+int chidb_Btree_estimateEntries(BTree *bt, npage_t nroot, uint64_t *nentries, uint32_t *depth);
+int chidb_Btree_countEntries(BTree *bt, npage_t nroot, uint64_t *nentries);
 
-int chidb_Btree_insertInTable(BTree *bt, npage_t nroot, chidb_key_t key, uint8_t *data, uint16_t size);
+int chidb_Btree_insertInTable(BTree *bt, npage_t nroot, chidb_key_t key, uint8_t *data, uint32_t size);
 int chidb_Btree_insertInIndex(BTree *bt, npage_t nroot, chidb_key_t keyIdx, chidb_key_t keyPk);
 int chidb_Btree_insert(BTree *bt, npage_t nroot, BTreeCell *btc);
+int chidb_Btree_checkKeys(BTree *bt, BTreeCell *btc);
+int hasRoomForCell(BTreeNode *btn, BTreeCell *btc);
 int chidb_Btree_insertNonFull(BTree *bt, npage_t npage, BTreeCell *btc);
 int chidb_Btree_split(BTree *bt, npage_t npage_parent, npage_t npage_child, ncell_t parent_cell, npage_t *npage_child2);
 
+int chidb_Btree_bulkLoad(BTree *bt, npage_t nroot, chidb_Btree_bulkSource next, void *ctx, uint8_t fill_factor);
+int chidb_Btree_copy(BTree *from, npage_t nfrom, BTree *to, npage_t *nto);
+int chidb_Btree_replace(BTree *bt, BTree *from);
+
+int chidb_Btree_delete(BTree *bt, npage_t nroot, chidb_key_t key);
+int chidb_Btree_deleteInIndex(BTree *bt, npage_t nroot, chidb_key_t keyIdx, chidb_key_t keyPk);
+int chidb_Btree_freePage(BTree *bt, npage_t npage);
+int chidb_Btree_countFreePages(BTree *bt, uint32_t *nfree);
+int chidb_Btree_compareText(BTreeCell *cell, const BTreeTextKey *key);
+int chidb_Btree_searchText(BTreeNode *btn, const BTreeTextKey *key, ncell_t *ncell);
+uint32_t chidb_Btree_textLength(BTreeCell *cell);
+void chidb_Btree_textCopy(BTreeCell *cell, uint8_t *buf);
+int chidb_Btree_insertInTextIndex(BTree *bt, npage_t nroot, const uint8_t *text, uint32_t len, chidb_key_t keyPk);
+int chidb_Btree_insertText(BTree *bt, npage_t nroot, BTreeCell *btc);
+int chidb_Btree_deleteText(BTree *bt, npage_t nroot, const BTreeTextKey *key);
+
+int chidb_Btree_vacuum(BTree *bt, npage_t *roots, uint32_t nroots, uint32_t max, uint32_t *nremoved);
+
 #endif /*BTREE_H_*/
@@ -0,0 +1,568 @@
+/*
+ *  chidb - a didactic relational database management system
+ *
+ *  In-memory schema catalog
+ *
+ */
+
+/*
+ *  Copyright (c) 2009-2015, The University of Chicago
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or withsend
+ *  modification, are permitted provided that the following conditions are met:
+ *
+ *  - Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ *  - Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ *  - Neither the name of The University of Chicago nor the names of its
+ *    contributors may be used to endorse or promote products derived from this
+ *    software withsend specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ *  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ *  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ *  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ *  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ *  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ *  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ *  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ *  ARISING IN ANY WAY send OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ *  POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+/*
+ * The schemas in db->schemas are also indexed by name in hash maps:
+ * tables, indexes, and the columns of each table. This is what codegen
+ * uses to look up tables and columns, so that the time it takes to
+ * prepare a statement does not grow with the number of tables, or with
+ * the number of columns in them.
+ *
+ * The catalog does not own anything: its keys and values point into the
+ * schemas, so it must be cleared before the schemas are freed.
+ *
+ * Schemas are loaded as stubs, without parsing their SQL (see load_schema
+ * in api.c). The columns of a table are only added to the catalog the
+ * first time they are looked up, which is when its SQL is parsed.
+ */
+
+#include "catalog.h"
+
+
+/* A string-keyed hash map, with chaining */
+typedef struct catalog_entry
+{
+    const char *key;
+    void *value;
+    struct catalog_entry *next;
+} catalog_entry_t;
+
+typedef struct catalog_map
+{
+    catalog_entry_t **buckets;
+    uint32_t nbuckets;
+    uint32_t n;
+} catalog_map_t;
+
+/* A column of a table, and its position (0 is the primary key) */
+typedef struct catalog_column
+{
+    Column_t *column;
+    int position;
+} catalog_column_t;
+
+typedef struct catalog_table
+{
+    chidb_sql_schema_t *schema;
+    bool parsed; // have the columns been added?
+    catalog_column_t *columns;
+    int ncols;
+    catalog_map_t column_map; // name -> catalog_column_t
+} catalog_table_t;
+
+struct chidb_catalog
+{
+    catalog_map_t tables;  // name -> catalog_table_t
+    catalog_map_t indexes; // name -> chidb_sql_schema_t
+};
+
+
+/* FNV-1a */
+static uint32_t catalog_hash(const char *key)
+{
+    uint32_t hash = 2166136261u;
+
+    for (const char *s = key; *s != '\0'; s++)
+        hash = (hash ^ (uint8_t) *s) * 16777619u;
+
+    return hash;
+}
+
+static void *catalog_map_get(catalog_map_t *map, const char *key)
+{
+    if (map->n == 0)
+        return NULL;
+
+    catalog_entry_t *e = map->buckets[catalog_hash(key) & (map->nbuckets - 1)];
+
+    for (; e != NULL; e = e->next)
+        if (strcmp(e->key, key) == 0)
+            return e->value;
+
+    return NULL;
+}
+
+/* Doubles the number of buckets */
+static int catalog_map_grow(catalog_map_t *map)
+{
+    uint32_t nbuckets = map->nbuckets ? map->nbuckets * 2 : CATALOG_MIN_BUCKETS;
+    catalog_entry_t **buckets = calloc(nbuckets, sizeof(catalog_entry_t *));
+
+    if (buckets == NULL)
+        return CHIDB_ENOMEM;
+
+    for (uint32_t i = 0; i < map->nbuckets; i++)
+    {
+        catalog_entry_t *e = map->buckets[i], *next;
+        for (; e != NULL; e = next)
+        {
+            uint32_t b = catalog_hash(e->key) & (nbuckets - 1);
+            next = e->next;
+            e->next = buckets[b];
+            buckets[b] = e;
+        }
+    }
+
+    free(map->buckets);
+    map->buckets = buckets;
+    map->nbuckets = nbuckets;
+
+    return CHIDB_OK;
+}
+
+/* Adds a key to the map. If the key is already there, the map is
+ * left as it is (the first schema with a given name wins, just like
+ * when searching the schema list). */
+static int catalog_map_put(catalog_map_t *map, const char *key, void *value)
+{
+    catalog_entry_t *e;
+    int rc;
+
+    if (catalog_map_get(map, key) != NULL)
+        return CHIDB_OK;
+
+    if (map->n >= map->nbuckets && (rc = catalog_map_grow(map)) != CHIDB_OK)
+        return rc;
+
+    if ((e = malloc(sizeof(catalog_entry_t))) == NULL)
+        return CHIDB_ENOMEM;
+
+    uint32_t b = catalog_hash(key) & (map->nbuckets - 1);
+    e->key = key;
+    e->value = value;
+    e->next = map->buckets[b];
+    map->buckets[b] = e;
+    map->n++;
+
+    return CHIDB_OK;
+}
+
+static void catalog_map_clear(catalog_map_t *map)
+{
+    for (uint32_t i = 0; i < map->nbuckets; i++)
+    {
+        catalog_entry_t *e = map->buckets[i], *next;
+        for (; e != NULL; e = next)
+        {
+            next = e->next;
+            free(e);
+        }
+    }
+
+    free(map->buckets);
+    map->buckets = NULL;
+    map->nbuckets = 0;
+    map->n = 0;
+}
+
+static void catalog_table_free(catalog_table_t *t)
+{
+    catalog_map_clear(&t->column_map);
+    free(t->columns);
+    free(t);
+}
+
+
+/* Adds the columns of a table, parsing its SQL if necessary */
+static int catalog_table_parse(catalog_table_t *t)
+{
+    chisql_statement_t *stmt = chidb_schema_stmt(t->schema);
+    Column_t *col;
+    int rc;
+
+    if (stmt == NULL || stmt->type != STMT_CREATE || stmt->stmt.create->t != CREATE_TABLE)
+        return CHIDB_ECORRUPT;
+
+    for (col = stmt->stmt.create->table->columns; col != NULL; col = col->next)
+        t->ncols++;
+
+    if (t->ncols > 0 && (t->columns = malloc(t->ncols * sizeof(catalog_column_t))) == NULL)
+        return CHIDB_ENOMEM;
+
+    col = stmt->stmt.create->table->columns;
+    for (int i = 0; i < t->ncols; i++, col = col->next)
+    {
+        t->columns[i].column = col;
+        t->columns[i].position = i;
+        if ((rc = catalog_map_put(&t->column_map, col->name, &t->columns[i])) != CHIDB_OK)
+            return rc;
+    }
+
+    t->parsed = true;
+
+    return CHIDB_OK;
+}
+
+/* Looks up a table, and adds its columns if they haven't been yet.
+ * Returns NULL if there is no such table, or its SQL is not valid. */
+static catalog_table_t *catalog_table_columns(chidb *db, const char *table)
+{
+    catalog_table_t *t = catalog_map_get(&db->catalog->tables, table);
+
+    if (t == NULL || t->parsed)
+        return t;
+
+    if (catalog_table_parse(t) != CHIDB_OK)
+    {
+        /* Start over the next time */
+        catalog_map_clear(&t->column_map);
+        free(t->columns);
+        t->columns = NULL;
+        t->ncols = 0;
+        return NULL;
+    }
+
+    return t;
+}
+
+
+/* Get the parsed CREATE statement of a schema
+ *
+ * The SQL of a schema is only parsed the first time this is called.
+ *
+ * Return
+ * - The parsed statement, or NULL if the SQL is not valid
+ */
+chisql_statement_t *chidb_schema_stmt(chidb_sql_schema_t *schema)
+{
+    if (schema->stmt == NULL && schema->sql != NULL)
+        if (chisql_parser(schema->sql, &schema->stmt) != CHIDB_OK)
+            schema->stmt = NULL;
+
+    return schema->stmt;
+}
+
+
+/* Hash of the schemas of a database
+ *
+ * Compiled programs depend on the schema they were compiled against
+ * (e.g., root pages are compiled into them), so a program saved to a
+ * file can only be run by a database with the same schema version (see
+ * chidb_stmt_cache_load). The version covers the type, name, table,
+ * root page and SQL of every schema, in the order they were created.
+ */
+uint32_t chidb_catalog_version(chidb *db)
+{
+    uint32_t hash = 2166136261u;
+    char rpage[16];
+
+    list_iterator_start(&db->schemas);
+    while (list_iterator_hasnext(&db->schemas))
+    {
+        chidb_sql_schema_t *schema = list_iterator_next(&db->schemas);
+        const char *fields[5] = {schema->type, schema->name, schema->assoc, rpage, schema->sql};
+
+        snprintf(rpage, sizeof(rpage), "%d", schema->rpage);
+        for (int i = 0; i < 5; i++)
+        {
+            // FNV-1a, with the terminating nul of every field
+            const char *f = fields[i] != NULL ? fields[i] : "";
+
+            do
+                hash = (hash ^ (uint8_t) *f) * 16777619u;
+            while (*f++ != '\0');
+        }
+    }
+    list_iterator_stop(&db->schemas);
+
+    return hash;
+}
+
+
+/* Create an empty catalog for a database
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_ENOMEM: Could not allocate memory
+ */
+int chidb_catalog_init(chidb *db)
+{
+    if ((db->catalog = calloc(1, sizeof(chidb_catalog_t))) == NULL)
+        return CHIDB_ENOMEM;
+
+    return CHIDB_OK;
+}
+
+
+/* Free the catalog of a database */
+void chidb_catalog_free(chidb *db)
+{
+    if (db->catalog == NULL)
+        return;
+
+    chidb_catalog_clear(db);
+    free(db->catalog);
+    db->catalog = NULL;
+}
+
+
+/* Add a schema to the catalog
+ *
+ * Must be called for every schema added to db->schemas.
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_ENOMEM: Could not allocate memory
+ */
+int chidb_catalog_add(chidb *db, chidb_sql_schema_t *schema)
+{
+    catalog_table_t *t;
+    int rc;
+
+    if (strcmp(schema->type, "index") == 0)
+        return catalog_map_put(&db->catalog->indexes, schema->name, schema);
+
+    if (catalog_map_get(&db->catalog->tables, schema->name) != NULL)
+        return CHIDB_OK;
+
+    if ((t = calloc(1, sizeof(catalog_table_t))) == NULL)
+        return CHIDB_ENOMEM;
+
+    t->schema = schema;
+
+    if ((rc = catalog_map_put(&db->catalog->tables, schema->name, t)) != CHIDB_OK)
+    {
+        catalog_table_free(t);
+        return rc;
+    }
+
+    return CHIDB_OK;
+}
+
+
+/* Remove all the schemas from the catalog
+ *
+ * Must be called before the schemas in db->schemas are freed.
+ */
+void chidb_catalog_clear(chidb *db)
+{
+    catalog_map_t *tables = &db->catalog->tables;
+
+    for (uint32_t i = 0; i < tables->nbuckets; i++)
+        for (catalog_entry_t *e = tables->buckets[i]; e != NULL; e = e->next)
+            catalog_table_free(e->value);
+
+    catalog_map_clear(tables);
+    catalog_map_clear(&db->catalog->indexes);
+}
+
+
+/* The attached database a name is qualified with, if any */
+static chidb_attached_t *catalog_attached(chidb *db, const char *name)
+{
+    for (uint32_t i = 0; i < db->nattached; i++)
+    {
+        size_t len = strlen(db->attached[i].name);
+
+        if (strncmp(name, db->attached[i].name, len) == 0
+                && strncmp(name + len, CATALOG_SCHEMA_SEPARATOR, strlen(CATALOG_SCHEMA_SEPARATOR)) == 0)
+            return &db->attached[i];
+    }
+
+    return NULL;
+}
+
+
+/* Find the database a table or index is in
+ *
+ * The tables and indexes of an attached database (see ATTACH in api.c)
+ * are named "schema__name" by the time a statement is parsed. Every
+ * lookup in the catalog goes through here first, so that those names
+ * are looked up in the attached database's catalog.
+ *
+ * Parameters
+ * - db: Database
+ * - name: In/out parameter. Name of a table or index. If it is one in
+ *         an attached database, it is set to the name in that database.
+ *
+ * Return
+ * - The attached database, or db if the name is not qualified with one
+ */
+chidb *chidb_catalog_database(chidb *db, const char **name)
+{
+    chidb_attached_t *a = catalog_attached(db, *name);
+
+    if (a == NULL)
+        return db;
+
+    *name += strlen(a->name) + strlen(CATALOG_SCHEMA_SEPARATOR);
+    return a->db;
+}
+
+
+/* Name of the attached database a table or index is in
+ *
+ * Return
+ * - The name it was attached as, or NULL if the table or index is not
+ *   in an attached database
+ */
+char *chidb_catalog_schema(chidb *db, const char *name)
+{
+    chidb_attached_t *a = catalog_attached(db, name);
+
+    return a ? a->name : NULL;
+}
+
+
+/* Look up an attached database by the name it was attached as
+ *
+ * Return
+ * - The attached database, or NULL if there is none by that name
+ */
+chidb *chidb_catalog_attached(chidb *db, const char *schema)
+{
+    for (uint32_t i = 0; i < db->nattached; i++)
+        if (strcmp(db->attached[i].name, schema) == 0)
+            return db->attached[i].db;
+
+    return NULL;
+}
+
+
+/* Does a column qualifier name a table? A table of an attached
+ * database, schema__table, can be named as schema.table (which is
+ * rewritten as schema__table) or, like in SQLite, as just table.
+ */
+bool chidb_catalog_qualifies(chidb *db, const char *qualifier, const char *table)
+{
+    const char *name = table;
+
+    if (strcmp(qualifier, table) == 0)
+        return true;
+
+    return chidb_catalog_database(db, &name) != db && strcmp(qualifier, name) == 0;
+}
+
+
+/* Look up a table by name
+ *
+ * Return
+ * - The table's schema, or NULL if there is no such table
+ */
+chidb_sql_schema_t *chidb_catalog_table(chidb *db, const char *table)
+{
+    db = chidb_catalog_database(db, &table);
+    catalog_table_t *t = catalog_map_get(&db->catalog->tables, table);
+
+    return t ? t->schema : NULL;
+}
+
+
+/* Look up an index by name
+ *
+ * Return
+ * - The index's schema, or NULL if there is no such index
+ */
+chidb_sql_schema_t *chidb_catalog_index(chidb *db, const char *index)
+{
+    db = chidb_catalog_database(db, &index);
+    return catalog_map_get(&db->catalog->indexes, index);
+}
+
+
+/* Look up an index on a column of a table
+ *
+ * The indexes are few, so they are simply all looked at. Their SQL is
+ * parsed the first time, to know what column each of them is on.
+ *
+ * Return
+ * - The schema of an index on the column, or NULL if there is none
+ */
+chidb_sql_schema_t *chidb_catalog_column_index(chidb *db, const char *table, const char *column)
+{
+    db = chidb_catalog_database(db, &table);
+    catalog_map_t *indexes = &db->catalog->indexes;
+
+    for (uint32_t i = 0; i < indexes->nbuckets; i++)
+        for (catalog_entry_t *e = indexes->buckets[i]; e != NULL; e = e->next)
+        {
+            chidb_sql_schema_t *schema = e->value;
+            chisql_statement_t *stmt;
+
+            if (strcmp(schema->assoc, table) != 0 || (stmt = chidb_schema_stmt(schema)) == NULL)
+                continue;
+            if (stmt->type == STMT_CREATE && stmt->stmt.create->t == CREATE_INDEX
+                    && strcmp(stmt->stmt.create->index->column_name, column) == 0)
+                return schema;
+        }
+
+    return NULL;
+}
+
+
+/* Look up a column of a table
+ *
+ * Parameters
+ * - db: Database
+ * - table: Name of the table
+ * - column: Name of the column
+ * - col: Out parameter. The column (can be NULL)
+ * - position: Out parameter. Position of the column in the table, with
+ *             0 being the primary key (can be NULL)
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_EINVALIDSQL: There is no such table, or no such column in it
+ */
+int chidb_catalog_column(chidb *db, const char *table, const char *column, Column_t **col, int *position)
+{
+    db = chidb_catalog_database(db, &table);
+    catalog_table_t *t = catalog_table_columns(db, table);
+    catalog_column_t *c;
+
+    if (t == NULL || (c = catalog_map_get(&t->column_map, column)) == NULL)
+        return CHIDB_EINVALIDSQL;
+
+    if (col)
+        *col = c->column;
+    if (position)
+        *position = c->position;
+
+    return CHIDB_OK;
+}
+
+
+/* Number of columns in a table (0 if there is no such table) */
+int chidb_catalog_ncols(chidb *db, const char *table)
+{
+    db = chidb_catalog_database(db, &table);
+    catalog_table_t *t = catalog_table_columns(db, table);
+
+    return t ? t->ncols : 0;
+}
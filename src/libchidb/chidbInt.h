@@ -48,6 +48,7 @@
 #include <stdlib.h>
 #include <assert.h>
 #include <string.h>
+#include <pthread.h>
 #include <chidb/chidb.h>
 #include "../simclist/simclist.h"
 
@@ -75,12 +76,21 @@
 
 
 #define DEFAULT_PAGE_SIZE (1024)
+#define MIN_PAGE_SIZE (512)
+#define MAX_PAGE_SIZE (65536)
+#define VALID_PAGE_SIZE(s) ((s) >= MIN_PAGE_SIZE && (s) <= MAX_PAGE_SIZE && ((s) & ((s) - 1)) == 0)
+#define DEFAULT_CACHE_SIZE (128) // Number of frames in the Pager's buffer pool
+#define DEFAULT_READAHEAD (16) // Number of leaves a sequential scan asks the Pager to prefetch
+#define DEFAULT_PREALLOCATION (64) // Pages in the smallest extent the Pager reserves ahead of the file
+#define MAX_EXTENT_SIZE (16 << 20) // Bytes in the largest extent the Pager reserves ahead of the file
+#define DEFAULT_FILL_FACTOR (90) // Percentage of each leaf filled by a bulk load
+#define DEFAULT_STMT_CACHE_SIZE (64) // Number of compiled statements cached per database
 
 #define MAX_STR_LEN (256)
 
 typedef uint16_t ncell_t;
 typedef uint32_t npage_t;
-typedef uint32_t chidb_key_t;
+typedef uint64_t chidb_key_t;
 
 /* Forward declaration */
 typedef struct BTree BTree;
@@ -92,10 +102,98 @@ typedef struct chidb_sql_schema
     char *name;
     char *assoc;
     int rpage;
-    chisql_statement_t *stmt;
+    char *sql;                  // CREATE statement
+    chisql_statement_t *stmt;   // sql, parsed. NULL until it is needed
 } chidb_sql_schema_t;
 
 
+/* Hash maps over the schemas, by name. See catalog.c for details */
+typedef struct chidb_catalog chidb_catalog_t;
+
+/* Adds n to one of the counters chidb_stats reports. Statements that
+ * only read can run at the same time on a shared handle, so counters
+ * are added to atomically (but without ordering, which is not needed
+ * for counting) */
+#define CHIDB_COUNT(counter, n) __atomic_fetch_add(&(counter), (n), __ATOMIC_RELAXED)
+
+/* Fires the static probe chidb:name, with up to ten integer (or pointer)
+ * arguments, for tracing tools such as bpftrace (usdt:...:chidb:name)
+ * and SystemTap. Probes are only compiled in with configure's
+ * --enable-probes option; then, each one is a single nop until a tracer
+ * attaches to it. Otherwise, the arguments are not even evaluated.
+ *
+ * Probes and their arguments:
+ * - page__read(npage), page__miss(npage), page__write(npage)
+ * - btree__insert(nroot, key, type)
+ * - btree__split(npage_parent, npage_child, n_cells, median)
+ * - cursor__seek(nroot, key, seek_type), cursor__seek__near(nroot, key),
+ *   cursor__seek__text(nroot, len, seek_type)
+ * - stmt__prepare(sql), stmt__prepare__done(sql, rc, nops)
+ * - stmt__step(stmt, pc), stmt__step__done(stmt, rc, pc)
+ * - stmt__finalize(stmt, nops)
+ */
+#ifdef CHIDB_PROBES
+#include <sys/sdt.h>
+#define CHIDB_PROBE(name, ...) STAP_PROBEV(chidb, name, ##__VA_ARGS__)
+#else
+#define CHIDB_PROBE(name, ...) do { } while (0)
+#endif
+
+/* Statistics collected by ANALYZE. See stats.c for details */
+typedef struct chidb_stats chidb_stats_t;
+
+/* Bounded LRU cache of compiled statements, keyed by SQL text.
+ * See stmt-cache.c for details */
+typedef struct chidb_stmt_cache_entry chidb_stmt_cache_entry_t;
+typedef struct chidb_stmt_cache
+{
+    chidb_stmt_cache_entry_t *head; // Most recently used
+    chidb_stmt_cache_entry_t *tail; // Least recently used
+    uint32_t n;
+    uint32_t size;
+} chidb_stmt_cache_t;
+
+/* Results of read-only statements, kept until the tables they were
+ * read from are written to (see result-cache.c) */
+#define RESULT_VERSION_SLOTS (64)
+
+typedef struct chidb_result chidb_result_t;
+typedef struct chidb_result_cache
+{
+    chidb_result_t *head; // Most recently used
+    chidb_result_t *tail; // Least recently used
+    size_t used;          // bytes of the results in the cache
+    size_t budget;        // bytes of results kept at most. 0 if none are.
+    /* Write version of the B-Trees whose root page is i, modulo
+     * RESULT_VERSION_SLOTS. Only changed while the database is not
+     * being read. */
+    uint32_t versions[RESULT_VERSION_SLOTS];
+    pthread_mutex_t mutex; // protects everything else, for statements reading at the same time
+} chidb_result_cache_t;
+
+/* Memory the sorters and hash tables of a database handle's statements
+ * hold, against its limit (see memory.c). The buffer pool and the result
+ * cache are counted as they are. */
+#define CHIDB_MEMORY_SORTERS (0)
+#define CHIDB_MEMORY_HASHES  (1)
+#define CHIDB_MEMORY_KINDS   (2)
+
+typedef struct chidb_memory
+{
+    size_t limit;                       // bytes used at most. 0 if there is no limit.
+    size_t held[CHIDB_MEMORY_KINDS];    // added to atomically
+    size_t peak;                        // most bytes used at once, so far
+} chidb_memory_t;
+
+/* A database file attached to a handle under a name (see ATTACH in
+ * api.c). It is opened as a handle of its own, so it has its own pager
+ * and buffer pool. */
+typedef struct chidb_attached
+{
+    char *name;
+    chidb *db;
+} chidb_attached_t;
+
 /* A chidb database is initially only a BTree.
  * This presuposes that only the btree.c module has been implemented.
  * If other parts of the chidb Architecture are implemented, the
@@ -105,7 +203,21 @@ struct chidb
 {
     BTree   *bt;
     list_t schemas; // list of chidb_sql_schema_t structs
+    chidb_catalog_t *catalog; // index of the schemas, kept in sync with the list
+    chidb_key_t schema_last_key; // key of the last schema table entry loaded
+    chidb_key_t txn_schema_key; // schema_last_key when the transaction began
     int need_refresh;
+    chidb_stmt_cache_t stmt_cache;
+    chidb_result_cache_t result_cache;
+    chidb_stats_t *stats; // NULL until the stats table is first read
+    size_t sort_budget; // bytes of rows an ORDER BY sorts in memory before spilling
+    uint32_t scan_threads; // threads a filtered table scan is split between
+    bool threadsafe; // shared between threads (see chidb_set_threadsafe)
+    pthread_rwlock_t lock; // held shared by statements that only read, exclusively by everything else
+    chidb_latency_t latency[CHIDB_LATENCY_KINDS][CHIDB_LATENCY_PHASES]; // see latency.c
+    chidb_memory_t memory; // see chidb_set_memory_limit
+    chidb_attached_t *attached; // databases attached to this one
+    uint32_t nattached;
 };
 
 #endif /*CHIDBINT_H_*/
@@ -40,7 +40,10 @@
 #include <chidb/chidb.h>
 #include <chisql/chisql.h>
 #include "dbm.h"
+#include "dbm-sorter.h"
 #include "util.h"
+#include "catalog.h"
+#include "optimizer.h"
 
 
 int chidb_get_tables(list_t tables, chisql_statement_t *sql_statement);
@@ -49,13 +52,17 @@ int chidb_get_create_tables(list_t tables, Create_t *cre);
 int chidb_get_select_columns(list_t column_names, Expression_t *exp_list);
 int load_schema(chidb *db, npage_t nroot);
 
-int chidb_stmt_seed(chidb_stmt *stmt, list_t *ops, list_t *tables, list_t *names);
-int chidb_stmt_insert_op(chidb_stmt *stmt, list_t *ops, chidb_dbm_op_t *new_op);
 int chidb_stmt_select_project(chidb_stmt *stmt, list_t tables);
 int chidb_stmt_project_expand(chidb_stmt *stmt, SRA_t *sra, list_t tables);
 
 int chidb_stmt_select_star_expand(SRA_Project_t *sra_project, list_t names, list_t names2);
 int chidb_count_select_columns(int *ncols, Expression_t *exp_list);
+static void chidb_stmt_load_column(list_t *ops, int cursor, int pos, int reg);
+static int chidb_stmt_where(chidb *db, list_t *ops, list_t *conds, char *tables[2], int cursors[2]);
+static int chidb_stmt_where_deferred(chidb *db, list_t *ops, list_t *conds, char *table, int tcur,
+                                     int xcur, int xpos);
+static void chidb_stmt_where_split(chidb *db, list_t *conds, char *table, int xpos, list_t *indexed);
+static void chidb_stmt_peephole(list_t *ops);
 
 /* Step 1 schema loading is in api.c, steps 2-5 contained in here */
 
@@ -85,7 +92,7 @@ int chidb_stmt_check(chidb_stmt *stmt, chisql_statement_t *sql_stmt, list_t tabl
     while (list_iterator_hasnext(&table_names))
     {
         char *next = (char *)list_iterator_next(&table_names);
-        if (chidb_table_exists(stmt->db->schemas, next) != CHIDB_OK)
+        if (chidb_table_exists(stmt->db, next) != CHIDB_OK)
             return CHIDB_EINVALIDSQL;
     }
     list_iterator_stop(&table_names);
@@ -94,7 +101,7 @@ int chidb_stmt_check(chidb_stmt *stmt, chisql_statement_t *sql_stmt, list_t tabl
     while (list_iterator_hasnext(&col_names))
     {
         char *next = (char *)list_iterator_next(&col_names);
-        if (chidb_column_exists(stmt->db->schemas, list_get_at(&table_names, 0), next) != CHIDB_OK)
+        if (chidb_column_exists(stmt->db, list_get_at(&table_names, 0), next) != CHIDB_OK)
             return CHIDB_EINVALIDSQL;
     }
     list_iterator_stop(&col_names);
@@ -109,43 +116,133 @@ int chidb_stmt_check(chidb_stmt *stmt, chisql_statement_t *sql_stmt, list_t tabl
 
 /********************** Step 4: Create Table Code Generation ***********************/
 
+/* CREATE INDEX code generation
+ *
+ * Creates the index B-Tree, adds an entry to it for every row of the
+ * table, and then adds the index to the schema table (only once all the
+ * entries are in, so that an index is never in the schema half-built).
+ * The entries of an INTEGER index are sorted first and the B-Tree is
+ * built bottom-up from them (IdxLoad), which is much cheaper on a
+ * populated table than inserting them one by one.
+ * INTEGER and TEXT columns can be indexed; a TEXT column gets a text
+ * index, whose keys are the whole texts. Rows where the column is NULL
+ * are left out of the index.
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_EINVALIDSQL: The index already exists, or the table or the
+ *                      column don't, or the column is not an INTEGER
+ *                      or a TEXT
+ */
+static int chidb_stmt_create_index(chidb_stmt *stmt, chisql_statement_t *sql_stmt)
+{
+    Index_t *index = sql_stmt->stmt.create->index;
+    Column_t *col;
+    int pos, rc;
+
+    if(chidb_catalog_index(stmt->db, index->name) != NULL || chidb_table_exists(stmt->db, index->name) == CHIDB_OK)
+        return CHIDB_EINVALIDSQL;
+    if(chidb_catalog_column(stmt->db, index->table_name, index->column_name, &col, &pos) != CHIDB_OK)
+        return CHIDB_EINVALIDSQL;
+    if(col->type != TYPE_INT && col->type != TYPE_TEXT)
+        return CHIDB_EINVALIDSQL;
+
+    // clipping the semicolon
+    (sql_stmt->text)[strlen(sql_stmt->text)-1] = '\0';
+
+    // Cursors: 0 is the table, 1 the index, and 2 the schema table
+    chidb_dbm_prog_t prog;
+    chidb_dbm_prog_init(&prog);
+
+    chidb_dbm_prog_emit(&prog, Op_Integer, chidb_get_root(stmt->db, index->table_name), 0, 0, NULL);
+    chidb_dbm_prog_emit(&prog, Op_OpenRead, 0, 0, chidb_columns_total(stmt->db, index->table_name), NULL);
+    chidb_dbm_prog_emit(&prog, Op_CreateIndex, 8, col->type == TYPE_TEXT, 0, NULL);
+    chidb_dbm_prog_emit(&prog, Op_OpenWrite, 1, 8, 0, NULL);
+
+    // An INTEGER index is built from the sorted (key, pk) pairs in one
+    // go (cursor 3 is the sorter); a text index one entry at a time. The
+    // sort is stable and the table is read in pk order, so entries with
+    // the same key come out in the order of their pks, as in the index
+    bool bulk = col->type == TYPE_INT;
+    if(bulk)
+        chidb_dbm_prog_emit(&prog, Op_SorterOpen, 3, 0, 0, NULL);
+
+    int32_t done = chidb_dbm_prog_label(&prog);
+    chidb_dbm_prog_emit(&prog, Op_Rewind, 0, done, 0, NULL);
+    uint32_t loop = chidb_dbm_prog_here(&prog);
+    if(pos == 0)
+        chidb_dbm_prog_emit(&prog, Op_Key, 0, 3, 0, NULL);
+    else
+        chidb_dbm_prog_emit(&prog, Op_Column, 0, pos, 3, NULL);
+    chidb_dbm_prog_emit(&prog, Op_Key, 0, 4, 0, NULL);
+    if(bulk)
+        chidb_dbm_prog_emit(&prog, Op_SorterInsert, 3, 3, 2, NULL);
+    else
+        chidb_dbm_prog_emit(&prog, Op_IdxInsert, 1, 3, 4, NULL);
+    chidb_dbm_prog_emit(&prog, Op_Next, 0, loop, 0, NULL);
+    chidb_dbm_prog_place(&prog, done);
+    if(bulk)
+        chidb_dbm_prog_emit(&prog, Op_IdxLoad, 1, 3, 0, NULL);
+    chidb_dbm_prog_emit(&prog, Op_Close, 0, 0, 0, NULL);
+    chidb_dbm_prog_emit(&prog, Op_Close, 1, 0, 0, NULL);
+    if(bulk)
+        chidb_dbm_prog_emit(&prog, Op_Close, 3, 0, 0, NULL);
+
+    // Schema entry: type, name, table, root page (already in r8), sql
+    chidb_dbm_prog_emit(&prog, Op_Integer, 1, 2, 0, NULL);
+    chidb_dbm_prog_emit(&prog, Op_OpenWrite, 2, 2, 5, NULL);
+    chidb_dbm_prog_emit(&prog, Op_String, 5, 5, 0, "index");
+    chidb_dbm_prog_emit(&prog, Op_String, strlen(index->name), 6, 0, index->name);
+    chidb_dbm_prog_emit(&prog, Op_String, strlen(index->table_name), 7, 0, index->table_name);
+    chidb_dbm_prog_emit(&prog, Op_String, strlen(sql_stmt->text), 9, 0, sql_stmt->text);
+    chidb_dbm_prog_emit(&prog, Op_MakeRecord, 5, 5, 10, NULL);
+    chidb_dbm_prog_emit(&prog, Op_Integer, (int32_t)list_size(&(stmt->db->schemas))+1, 11, 0, NULL);
+    chidb_dbm_prog_emit(&prog, Op_Insert, 2, 10, 11, NULL);
+    chidb_dbm_prog_emit(&prog, Op_Close, 2, 0, 0, NULL);
+
+    stmt->sql = sql_stmt;
+    if((rc = chidb_dbm_prog_finish(&prog, stmt)) != CHIDB_OK)
+        return rc;
+
+    stmt->db->need_refresh = 1;
+
+    return CHIDB_OK;
+}
+
 int chidb_stmt_create(chidb_stmt *stmt, chisql_statement_t *sql_stmt)
 {
-    int opnum = 0;
-    int nOps;
-    int i;
+    chidb_dbm_prog_t prog;
+    char *name;
+    int rc;
+
+    if(sql_stmt->stmt.create->t == CREATE_INDEX)
+        return chidb_stmt_create_index(stmt, sql_stmt);
 
-    int ret = chidb_table_exists(stmt->db->schemas, sql_stmt->stmt.create->table->name);
+    name = sql_stmt->stmt.create->table->name;
+    int ret = chidb_table_exists(stmt->db, name);
     if(ret == CHIDB_OK)
         return CHIDB_EINVALIDSQL;
 
     // clipping the semicolon
     (sql_stmt->text)[strlen(sql_stmt->text)-1] = '\0';
-    
-
 
     // the type field of record is set to "table"... for now...
-    chidb_dbm_op_t ops[] = {
-            {Op_Integer, 1, 0, 0, NULL},
-            {Op_OpenWrite, 0, 0, 5, NULL},
-            {Op_CreateTable, 4, 0, 0, NULL},
-            {Op_String, 5, 1, 0, "table"}, // will need to change to support indicies
-            {Op_String,strlen(sql_stmt->stmt.create->table->name),2,0,sql_stmt->stmt.create->table->name},
-            {Op_String,strlen(sql_stmt->stmt.create->table->name),3,0,sql_stmt->stmt.create->table->name},
-            {Op_String,(int32_t)strlen(sql_stmt->text),5,0,sql_stmt->text},
-            {Op_MakeRecord,1,5,6,NULL},
-            {Op_Integer,(int32_t)list_size(&(stmt->db->schemas))+1,7,0,NULL},
-            {Op_Insert,0,6,7,NULL},
-            {Op_Close,0,0,0,NULL}
-    };
-
-    nOps = 11; //sizeof(ops) / sizeof(chidb_dbm_op_t);
+    chidb_dbm_prog_init(&prog);
+    chidb_dbm_prog_emit(&prog, Op_Integer, 1, 0, 0, NULL);
+    chidb_dbm_prog_emit(&prog, Op_OpenWrite, 0, 0, 5, NULL);
+    chidb_dbm_prog_emit(&prog, Op_CreateTable, 4, 0, 0, NULL);
+    chidb_dbm_prog_emit(&prog, Op_String, 5, 1, 0, "table");
+    chidb_dbm_prog_emit(&prog, Op_String, strlen(name), 2, 0, name);
+    chidb_dbm_prog_emit(&prog, Op_String, strlen(name), 3, 0, name);
+    chidb_dbm_prog_emit(&prog, Op_String, strlen(sql_stmt->text), 5, 0, sql_stmt->text);
+    chidb_dbm_prog_emit(&prog, Op_MakeRecord, 1, 5, 6, NULL);
+    chidb_dbm_prog_emit(&prog, Op_Integer, (int32_t)list_size(&(stmt->db->schemas))+1, 7, 0, NULL);
+    chidb_dbm_prog_emit(&prog, Op_Insert, 0, 6, 7, NULL);
+    chidb_dbm_prog_emit(&prog, Op_Close, 0, 0, 0, NULL);
 
     stmt->sql = sql_stmt;
-    stmt->nOps = nOps;
-
-    for(i=0; i < nOps; i++)
-        chidb_stmt_set_op(stmt, &ops[i], opnum++);
+    if((rc = chidb_dbm_prog_finish(&prog, stmt)) != CHIDB_OK)
+        return rc;
 
     stmt->db->need_refresh = 1;
 
@@ -161,13 +258,13 @@ int chidb_stmt_insert(chidb_stmt *stmt, chisql_statement_t *sql_stmt)
     char *table_name = sql_stmt->stmt.insert->table_name;
     // NOTE!!! This is NOT the names of columns in the table! Rather, columns specified for the insert!
 
-    Literal_t *values = sql_stmt->stmt.insert->values;
-    int numVals = 0; // This will be filled in as we error check (to do only one pass its faster)
+    Insert_t *tuple;
+    Literal_t *values;
 
     //------------------Error Checking first----------------------
 
     // Check if table name exists --assuming for now that inserting into all columns
-    if(chidb_table_exists(stmt->db->schemas, table_name) != CHIDB_OK)
+    if(chidb_table_exists(stmt->db, table_name) != CHIDB_OK)
     {
         fprintf(stderr, "%s\n", "Table does not exist!");
         return CHIDB_EINVALIDSQL;
@@ -176,123 +273,2107 @@ int chidb_stmt_insert(chidb_stmt *stmt, chisql_statement_t *sql_stmt)
     // This list will be the actual column names of the table we are inserting into
     list_t cnames;
     list_init(&cnames);
-    int ret = chidb_column_names(stmt->db->schemas, table_name, &cnames);
+    int ret = chidb_column_names(stmt->db, table_name, &cnames);
     if(ret == CHIDB_EINVALIDSQL)
     {
         fprintf(stderr, "%s\n", "No column names!");
         return ret;
     }
 
-    // Check that types match up
+    // Check that types match up, in every tuple of a multi-row insert
     // Iterate over each column, obtain type, and then check with the value given
-    list_iterator_start(&cnames);
-    while(list_iterator_hasnext(&cnames))
+    for(tuple = sql_stmt->stmt.insert; tuple != NULL; tuple = tuple->next)
     {
-        char *col_name = (char *)(list_iterator_next(&cnames));
-        int ret = chidb_column_get_type(stmt->db->schemas, table_name, col_name);
-        if(ret == CHIDB_EINVALIDSQL)
-            return ret;
-        else
+        values = tuple->values;
+        list_iterator_start(&cnames);
+        while(list_iterator_hasnext(&cnames))
         {
-            if(values == NULL)
+            char *col_name = (char *)(list_iterator_next(&cnames));
+            int ret = chidb_column_get_type(stmt->db, table_name, col_name);
+            if(ret == CHIDB_EINVALIDSQL)
+                return ret;
+            else
             {
-                // If the values list runs out before the string list, something is really wrong
-                return CHIDB_EINVALIDSQL;
+                if(values == NULL)
+                {
+                    // If the values list runs out before the string list, something is really wrong
+                    return CHIDB_EINVALIDSQL;
+                }
+                // Parameters can be bound to a value of any type
+                if(values->t != ret && values->t != TYPE_PARAM) // Ret holds the type of the column
+                {
+                    fprintf(stderr, "Input data type mismatch in column %s\n", col_name);
+                    return CHIDB_EINVALIDSQL;
+                }
+                values = values->next;
+            }
+        }
+        list_iterator_stop(&cnames);
+    }
+
+    //-------------produce actual insert---------------------------
+    // The ops go straight into the program (we don't know how many are needed yet)
+    chidb_dbm_prog_t prog;
+    chidb_dbm_prog_init(&prog);
+
+    // Get root page, then store it in register zero
+    int root = chidb_get_root(stmt->db, table_name);
+    if(root == CHIDB_EINVALIDSQL)
+    {
+        list_destroy(&cnames);
+        return root;
+    }
+
+    // The root page number is now in reg 0; open write using cursor zero
+    chidb_dbm_prog_emit(&prog, Op_Integer, root, 0, 0, NULL);
+    chidb_dbm_prog_emit(&prog, Op_OpenWrite, 0, 0, list_size(&cnames), NULL);
+
+    // Every index on the table gets an entry for each row, after the row
+    // itself is in (so a duplicate primary key leaves the indexes alone).
+    // Index i is opened with cursor 1+i. In a multi-row insert, the
+    // entries are collected in a sorter for each index (cursor
+    // 1+nindexes+i) and added in key order once all the rows are in, so
+    // that consecutive entries go to the same or nearby leaves.
+    int ncols = list_size(&cnames);
+    int key_reg = ncols + 3; // index key and primary key, past the record
+    int nindexes = 0;
+    int *indexes = malloc(ncols * sizeof(int));
+    bool batch = sql_stmt->stmt.insert->next != NULL;
+
+    if(indexes == NULL)
+    {
+        chidb_dbm_prog_free(&prog);
+        list_destroy(&cnames);
+        return CHIDB_ENOMEM;
+    }
+    for(int col = 1; col < ncols; col++)
+    {
+        chidb_sql_schema_t *index = chidb_catalog_column_index(stmt->db, table_name, list_get_at(&cnames, col));
+
+        if(index == NULL)
+            continue;
+        chidb_dbm_prog_emit(&prog, Op_Integer, index->rpage, key_reg, 0, NULL);
+        chidb_dbm_prog_emit(&prog, Op_OpenWrite, 1 + nindexes, key_reg, 0, NULL);
+        indexes[nindexes++] = col;
+    }
+    for(int i = 0; batch && i < nindexes; i++)
+        chidb_dbm_prog_emit(&prog, Op_SorterOpen, 1 + nindexes + i, 0, 0, NULL);
+
+    // Now create the records. All the tuples go through the same cursor,
+    // so rows with increasing keys are added without going back to the root.
+    for(tuple = sql_stmt->stmt.insert; tuple != NULL; tuple = tuple->next)
+    {
+        int reg = 1; // So we don't overwrite regs
+        values = tuple->values;
+        while(values != NULL)
+        {
+            if(values->t == TYPE_INT)
+                chidb_dbm_prog_emit(&prog, Op_Integer, values->val.ival, reg, 0, NULL);
+            else if(values->t == TYPE_TEXT)
+                chidb_dbm_prog_emit(&prog, Op_String, strlen(values->val.strval), reg, 0, values->val.strval);
+            else if(values->t == TYPE_PARAM)
+                chidb_dbm_prog_emit(&prog, Op_Param, values->val.ival, reg, 0, NULL);
+            // Other values are unspported by chisql
+
+            if(reg==1) //The key slot in CHIDB needs to be null, as specified in the project spec
+            {
+                reg++;
+                chidb_dbm_prog_emit(&prog, Op_Null, 0, reg, 0, NULL);
+                reg++;
             }
-            if(values->t != ret) // Ret holds the type of the column
+            else
             {
-                fprintf(stderr, "Input data type mismatch in column %s\n", col_name);
-                return CHIDB_EINVALIDSQL;
+                reg++;
             }
-            numVals++;
+
             values = values->next;
         }
+
+        // Create record from r1 through (r1+n-1), store in r2
+        // *NOTE: the primary key will always be first
+        chidb_dbm_prog_emit(&prog, Op_MakeRecord, 2, reg-2, reg, NULL);
+
+        // Cursor 0, record stored at reg+1, the first one is the primary key
+        chidb_dbm_prog_emit(&prog, Op_Insert, 0, reg, 1, NULL);
+
+        // Column col is in r(col+2), and the primary key in r1
+        for(int i = 0; i < nindexes; i++)
+        {
+            if(!batch)
+            {
+                chidb_dbm_prog_emit(&prog, Op_IdxInsert, 1 + i, indexes[i] + 2, 1, NULL);
+                continue;
+            }
+            chidb_dbm_prog_emit(&prog, Op_SCopy, indexes[i] + 2, key_reg, 0, NULL);
+            chidb_dbm_prog_emit(&prog, Op_SCopy, 1, key_reg + 1, 0, NULL);
+            chidb_dbm_prog_emit(&prog, Op_SorterInsert, 1 + nindexes + i, key_reg, 2, NULL);
+        }
     }
 
-    //-------------produce actual insert---------------------------
-    // Create a list to store (we don't know how many ops needed yet so can't use array)
-    list_t ops;
-    list_init(&ops);
+    for(int i = 0; batch && i < nindexes; i++)
+    {
+        int sorter = 1 + nindexes + i;
+        int32_t done = chidb_dbm_prog_label(&prog);
+
+        chidb_dbm_prog_emit(&prog, Op_SorterSort, sorter, done, 0, NULL);
+        uint32_t loop = chidb_dbm_prog_here(&prog);
+        chidb_dbm_prog_emit(&prog, Op_SorterColumn, sorter, 0, key_reg, NULL);
+        chidb_dbm_prog_emit(&prog, Op_SorterColumn, sorter, 1, key_reg + 1, NULL);
+        chidb_dbm_prog_emit(&prog, Op_IdxInsert, 1 + i, key_reg, key_reg + 1, NULL);
+        chidb_dbm_prog_emit(&prog, Op_SorterNext, sorter, loop, 0, NULL);
+        chidb_dbm_prog_place(&prog, done);
+    }
 
-    // Get root page, then store it in register zero
-    int root = chidb_get_root(stmt->db->schemas, table_name);
-    if(root == CHIDB_EINVALIDSQL){return root;}
+    // Close Cursor 0, and those of the indexes
+    chidb_dbm_prog_emit(&prog, Op_Close, 0, 0, 0, NULL);
+    for(int i = 1; i <= (batch ? 2 : 1) * nindexes; i++)
+        chidb_dbm_prog_emit(&prog, Op_Close, i, 0, 0, NULL);
+    free(indexes);
+    list_destroy(&cnames);
+
+    // Finally, the program becomes the statement's
+    return chidb_dbm_prog_finish(&prog, stmt);
+}
+
+/* Appends the op that loads a column of the entry a cursor is pointing
+ * to into a register. Position 0 is the primary key. */
+static void chidb_stmt_load_column(list_t *ops, int cursor, int pos, int reg)
+{
+    if(pos == 0)
+        list_append(ops, chidb_make_op(Op_Key, cursor, reg, 0, NULL));
+    else
+        list_append(ops, chidb_make_op(Op_Column, cursor, pos, reg, NULL));
+}
+
+/* Same, for a covering index: an index entry only has the value of the
+ * indexed column (its key), and the primary key of the row. */
+static void chidb_stmt_load_index_column(list_t *ops, int cursor, int pos, int reg)
+{
+    if(pos == 0)
+        list_append(ops, chidb_make_op(Op_IdxPKey, cursor, reg, 0, NULL));
+    else
+        list_append(ops, chidb_make_op(Op_Key, cursor, reg, 0, NULL));
+}
+
+/* Makes the op that loads the value a column is compared to in a WHERE */
+static chidb_dbm_op_t *chidb_stmt_load_value(Literal_t *value, int reg)
+{
+    switch(value->t)
+    {
+        case TYPE_INT:
+            return chidb_make_op(Op_Integer, value->val.ival, reg, 0, NULL);
+        case TYPE_TEXT:
+            return chidb_make_op(Op_String, strlen(value->val.strval), reg, 0, value->val.strval);
+        case TYPE_PARAM:
+            return chidb_make_op(Op_Param, value->val.ival, reg, 0, NULL);
+        default:
+            return NULL; // Not supported otherwise
+    }
+}
+
+/* Makes the op that skips an entry that does not match a WHERE condition
+ * (column OP value). The jump address must be filled in by the caller. */
+static chidb_dbm_op_t *chidb_stmt_skip_unless(enum CondType cond, int val_reg, int col_reg)
+{
+    switch(cond)
+    {
+        case RA_COND_EQ:
+            return chidb_make_op(Op_Ne, val_reg, 0, col_reg, NULL);
+        case RA_COND_LT:
+            return chidb_make_op(Op_Ge, val_reg, 0, col_reg, NULL);
+        case RA_COND_GT:
+            return chidb_make_op(Op_Le, val_reg, 0, col_reg, NULL);
+        case RA_COND_LEQ:
+            return chidb_make_op(Op_Gt, val_reg, 0, col_reg, NULL);
+        case RA_COND_GEQ:
+            return chidb_make_op(Op_Lt, val_reg, 0, col_reg, NULL);
+        default:
+            return NULL; // Our implementation of chidb does not support the other options
+    }
+}
+
+/* Turns the ops generated for a SELECT into the statement's program */
+static int chidb_stmt_select_finish(chidb_stmt *stmt, list_t *ops, list_t *snames, int first_col_reg)
+{
+    chidb_dbm_prog_t prog;
+    int j, rc;
+
+    chidb_stmt_peephole(ops);
+    chidb_dbm_prog_init(&prog);
+    for(j = 0; j < list_size(ops); j++)
+    {
+        chidb_dbm_op_t *next = (chidb_dbm_op_t *)list_get_at(ops, j);
+        chidb_dbm_prog_emit(&prog, next->opcode, next->p1, next->p2, next->p3, next->p4);
+
+        // should be able to free the op now...
+        free(next);
+    }
+    if((rc = chidb_dbm_prog_finish(&prog, stmt)) != CHIDB_OK)
+        return rc;
+
+    // a column that is only loaded to be compared in a WHERE can be
+    // compared for a whole leaf at once
+    for(j = 0; j < (int) stmt->endOp; j++)
+    {
+        if(stmt->ops[j].opcode == Op_Column && chidb_stmt_op_filters(stmt, j))
+            stmt->ops[j].opcode = Op_FilterColumn;
+    }
+
+    char **cols = malloc(sizeof(char *) * list_size(snames));
+    for(j=0; j < list_size(snames); j++)
+    {
+        cols[j] = strdup(list_get_at(snames, j));
+    }
+
+    stmt->nRR = list_size(snames);
+    stmt->startRR = first_col_reg;
+    stmt->nCols = list_size(snames);
+    stmt->cols = cols;
+
+    return CHIDB_OK;
+}
+
+/* Hash join code generation for a NATURAL JOIN
+ *
+ * The rows of the build table (table 1 or 2, as chosen by the optimizer)
+ * are inserted into a hash table, keyed by the common columns. Only the
+ * selected columns that the probe table does not have are stored along
+ * with the key. Then, for each row of the probe table, the rows with the
+ * same key are looked up in the hash table. A WHERE condition is checked
+ * on the table the column belongs to, so that rows that do not match it
+ * are never inserted or looked up. Probe rows are first checked against
+ * a Bloom filter of the first key column of the build rows, which skips
+ * most of those without a match before the rest of their key is loaded.
+ *
+ * The program looks like this (cursor p is the probe table, b the build
+ * table, and h the hash table):
+ *
+ *          [load WHERE value]
+ *          OpenRead p, OpenRead b, OpenHash h
+ *          Rewind b END
+ *   BUILD: [skip to BNEXT unless the WHERE holds for b]
+ *          load the key and the stored columns of b
+ *          HashInsert h
+ *   BNEXT: Next b BUILD
+ *          Rewind p END
+ *   PROBE: [skip to PNEXT unless the WHERE holds for p]
+ *          load the first key column of p
+ *          HashFilter h PNEXT
+ *          load the rest of the key of p
+ *          HashSeek h PNEXT
+ *   MATCH: load the selected columns from p and h
+ *          ResultRow
+ *          HashNext h MATCH
+ *   PNEXT: Next p PROBE
+ *     END: Close b, Close p, Close h, Halt
+ */
+static int chidb_stmt_select_hash_join(chidb_stmt *stmt, SRA_Select_t *sra_select, list_t *tnames,
+                                       list_t *cnames1, list_t *cnames2, list_t *snames,
+                                       int build, list_t *ops, int *first_col_reg)
+{
+    char *btable = list_get_at(tnames, build);
+    char *ptable = list_get_at(tnames, 1 - build);
+    list_t *bnames = build == 0 ? cnames1 : cnames2;
+    list_t *pnames = build == 0 ? cnames2 : cnames1;
+    list_t common;  // Columns in both tables: the key of the hash table
+    list_t stored;  // Selected columns only the build table has
+    chidb_dbm_op_t *new_op, *where_op = NULL, *brewind, *prewind, *seek, *filter = NULL;
+    char *name;
+    int i, pos;
+
+    list_init(&common);
+    list_init(&stored);
+
+    for(i = 0; i < list_size(cnames1); i++)
+    {
+        name = list_get_at(cnames1, i);
+        if(chidb_column_position(cnames2, name) >= 0)
+            list_append(&common, name);
+    }
+    for(i = 0; i < list_size(snames); i++)
+    {
+        name = list_get_at(snames, i);
+        if(chidb_column_position(pnames, name) < 0 && chidb_column_position(&stored, name) < 0)
+            list_append(&stored, name);
+    }
+
+    // Registers: WHERE value and column, root pages (same as the cursors),
+    // build rows, probe key, and the result row
+    int nkeys = list_size(&common);
+    int nstored = list_size(&stored);
+    int base = sra_select != NULL ? 2 : 0;
+    int pcur = base, bcur = base + 1, hcur = base + 2;
+    int brow = base + 3;
+    int pkey = brow + nkeys + nstored;
+    *first_col_reg = pkey + nkeys;
+
+    // Which table (if any) the WHERE is checked on, and where its column is
+    char *where_table = NULL;
+    int where_pos = -1;
+    if(sra_select != NULL)
+    {
+        name = sra_select->cond->cond.comp.expr1->expr.term.ref->columnName;
+        where_table = btable;
+        if((where_pos = chidb_column_get_position(stmt->db, btable, name)) < 0)
+        {
+            where_table = ptable;
+            where_pos = chidb_column_get_position(stmt->db, ptable, name);
+        }
+        if(where_pos < 0)
+            goto invalid; // The column trying to select (sigma) on does not exist
+
+        new_op = chidb_stmt_load_value(sra_select->cond->cond.comp.expr2->expr.term.val, 0);
+        if(new_op == NULL)
+            goto invalid;
+        list_append(ops, new_op);
+    }
+
+    list_append(ops, chidb_make_op(Op_Integer, chidb_get_root(stmt->db, ptable), pcur, 0, NULL));
+    list_append(ops, chidb_make_op(Op_OpenRead, pcur, pcur, list_size(pnames), chidb_catalog_schema(stmt->db, ptable)));
+    list_append(ops, chidb_make_op(Op_Integer, chidb_get_root(stmt->db, btable), bcur, 0, NULL));
+    list_append(ops, chidb_make_op(Op_OpenRead, bcur, bcur, list_size(bnames), chidb_catalog_schema(stmt->db, btable)));
+    list_append(ops, chidb_make_op(Op_OpenHash, hcur, nkeys, 0, NULL));
+
+    // *** Build ***
+    brewind = chidb_make_op(Op_Rewind, bcur, 0, 0, NULL);
+    list_append(ops, brewind);
+    int build_off = list_size(ops);
+
+    if(where_table == btable)
+    {
+        chidb_stmt_load_column(ops, bcur, where_pos, 1);
+        if((where_op = chidb_stmt_skip_unless(sra_select->cond->t, 0, 1)) == NULL)
+            goto invalid;
+        list_append(ops, where_op);
+    }
+    for(i = 0; i < nkeys; i++)
+        chidb_stmt_load_column(ops, bcur, chidb_column_get_position(stmt->db, btable, list_get_at(&common, i)), brow + i);
+    for(i = 0; i < nstored; i++)
+        chidb_stmt_load_column(ops, bcur, chidb_column_get_position(stmt->db, btable, list_get_at(&stored, i)), brow + nkeys + i);
+    list_append(ops, chidb_make_op(Op_HashInsert, hcur, brow, nkeys + nstored, NULL));
+
+    if(where_op != NULL)
+        where_op->p2 = list_size(ops);
+    list_append(ops, chidb_make_op(Op_Next, bcur, build_off, 0, NULL));
+
+    // *** Probe ***
+    prewind = chidb_make_op(Op_Rewind, pcur, 0, 0, NULL);
+    list_append(ops, prewind);
+    int probe_off = list_size(ops);
+
+    where_op = NULL;
+    if(where_table == ptable)
+    {
+        chidb_stmt_load_column(ops, pcur, where_pos, 1);
+        if((where_op = chidb_stmt_skip_unless(sra_select->cond->t, 0, 1)) == NULL)
+            goto invalid;
+        list_append(ops, where_op);
+    }
+    for(i = 0; i < nkeys; i++)
+    {
+        chidb_stmt_load_column(ops, pcur, chidb_column_get_position(stmt->db, ptable, list_get_at(&common, i)), pkey + i);
+        if(i == 0)
+        {
+            filter = chidb_make_op(Op_HashFilter, hcur, 0, pkey, NULL);
+            list_append(ops, filter);
+        }
+    }
+    seek = chidb_make_op(Op_HashSeek, hcur, 0, pkey, NULL);
+    list_append(ops, seek);
+    int match_off = list_size(ops);
+
+    for(i = 0; i < list_size(snames); i++)
+    {
+        name = list_get_at(snames, i);
+        if((pos = chidb_column_get_position(stmt->db, ptable, name)) >= 0)
+            chidb_stmt_load_column(ops, pcur, pos, *first_col_reg + i);
+        else if((pos = chidb_column_position(&stored, name)) >= 0)
+            list_append(ops, chidb_make_op(Op_HashColumn, hcur, nkeys + pos, *first_col_reg + i, NULL));
+        else
+            goto invalid; // The column trying to project does not exist
+    }
+    list_append(ops, chidb_make_op(Op_ResultRow, *first_col_reg, list_size(snames), 0, NULL));
+    list_append(ops, chidb_make_op(Op_HashNext, hcur, match_off, pkey, NULL));
+
+    seek->p2 = list_size(ops);
+    if(filter != NULL)
+        filter->p2 = list_size(ops);
+    if(where_op != NULL)
+        where_op->p2 = list_size(ops);
+    list_append(ops, chidb_make_op(Op_Next, pcur, probe_off, 0, NULL));
+
+    // *** Done ***
+    brewind->p2 = list_size(ops);
+    prewind->p2 = list_size(ops);
+    list_append(ops, chidb_make_op(Op_Close, bcur, 0, 0, NULL));
+    list_append(ops, chidb_make_op(Op_Close, pcur, 0, 0, NULL));
+    list_append(ops, chidb_make_op(Op_Close, hcur, 0, 0, NULL));
+    list_append(ops, chidb_make_op(Op_Halt, 0, 0, 0, NULL));
+
+    list_destroy(&common);
+    list_destroy(&stored);
+
+    return CHIDB_OK;
+
+invalid:
+    list_destroy(&common);
+    list_destroy(&stored);
+
+    return CHIDB_EINVALIDSQL;
+}
+
+/* Code generation for a SELECT on a single table, with a WHERE that can
+ * be evaluated by seeking in the table or in an index on the column
+ *
+ * The first row that can match is sought, and rows are read from there
+ * on in key order, until the end or the first row past the value. With
+ * an index, the keys are the values of the column, and each row is then
+ * sought in the table by the primary key stored in the index entry.
+ *
+ * The program looks like this (cursor t is the table, and x the index).
+ * Without an index, x is t, and IdxGt/IdxGe are Key and Gt/Ge:
+ *
+ *          load WHERE value into v
+ *          OpenRead t, [OpenRead x]
+ *   col = v:   SeekGe x END v        (Seek t END v, without an index)
+ *   col > v:   SeekGt x END v
+ *   col >= v:  SeekGe x END v
+ *   col < v:   Rewind x END
+ *   col <= v:  Rewind x END
+ *    LOOP: [col = v:  IdxGt x END v]  (with an index)
+ *          [col < v:  IdxGe x END v]
+ *          [col <= v: IdxGt x END v]
+ *          [IdxPKey x pk]
+ *          [DeferredSeek t pk]
+ *          [skip to NEXT unless the rest of the WHERE holds]
+ *          load the selected columns
+ *          ResultRow
+ *    NEXT: Next x LOOP               (not for col = v, without an index)
+ *     END: Close t, [Close x], Halt
+ *
+ * The indexed column and the primary key are loaded from x (with Key
+ * and IdxPKey), so the row is only read from t, by the DeferredSeek,
+ * if some other column is needed. The conditions of the rest of the
+ * WHERE that can be tested on x go first (see
+ * chidb_stmt_where_deferred). If the index covers the query, t is not
+ * opened at all.
+ *
+ * With a sorted fetch (see chidb_optimize_access), the primary keys of
+ * the matching entries are put in a sorter (cursor s) instead, and the
+ * rows are sought in the table once they are all in, in increasing
+ * order, like the keys of chidb_stmt_select_keys:
+ *
+ *          ... (the same, up to IdxPKey x pk)
+ *          [skip to NEXT unless the rest of the WHERE that can be
+ *           tested on x holds]
+ *          SorterInsert s pk
+ *    NEXT: Next x LOOP
+ *     END: SorterSort s DONE
+ *   FETCH: SorterColumn s 0 pk
+ *          Seek t FNEXT pk
+ *          [skip to FNEXT unless the rest of the WHERE holds]
+ *          load the selected columns
+ *          ResultRow
+ *   FNEXT: SorterNext s FETCH
+ *    DONE: Close t, Close x, Close s, Halt
+ *
+ * The comparison the rows are found by may be one of the conditions
+ * ANDed in the WHERE. The others (rest, which may be empty) are then
+ * tested on each row (see chidb_stmt_where).
+ */
+static int chidb_stmt_select_access(chidb_stmt *stmt, Condition_t *where, list_t *rest, char *table,
+                                    list_t *cnames, list_t *snames, chidb_access_path_t *path,
+                                    list_t *ops, int *first_col_reg)
+{
+    enum CondType cond = where->t;
+    chidb_dbm_op_t *new_op, *start, *stop = NULL, *test = NULL, *xtest = NULL, *sort = NULL;
+    list_t xrest;   // Conditions of rest tested on x, with a sorted fetch
+    char *name;
+    int i, pos, xpos, rc;
+
+    // Registers: WHERE value, key of the current entry, root pages (same
+    // as the cursors), primary key from the index, and the result row.
+    // The sorter of a sorted fetch is cursor 4.
+    int val = 0, key = 1, tcur = 2, xcur = 3, pk = 4, sorter = 4;
+    bool index = path->method == ACCESS_INDEX;
+    bool fetch = index && path->sorted_fetch && !path->covering;
+    int scur = index ? xcur : tcur;   // The cursor the range is read from
+    *first_col_reg = 5;
+
+    // Position of the column the rows are found by (the indexed column)
+    xpos = chidb_column_get_position(stmt->db, table, where->cond.comp.expr1->expr.term.ref->columnName);
+
+    new_op = chidb_stmt_load_value(where->cond.comp.expr2->expr.term.val, val);
+    if(new_op == NULL)
+        return CHIDB_EINVALIDSQL;
+    list_append(ops, new_op);
+
+    if(!path->covering)
+    {
+        list_append(ops, chidb_make_op(Op_Integer, chidb_get_root(stmt->db, table), tcur, 0, NULL));
+        list_append(ops, chidb_make_op(Op_OpenRead, tcur, tcur, list_size(cnames), chidb_catalog_schema(stmt->db, table)));
+    }
+    if(index)
+    {
+        list_append(ops, chidb_make_op(Op_Integer, path->index, xcur, 0, NULL));
+        list_append(ops, chidb_make_op(Op_OpenRead, xcur, xcur, 0, chidb_catalog_schema(stmt->db, table)));
+    }
+    if(fetch)
+        list_append(ops, chidb_make_op(Op_SorterOpen, sorter, 0, 0, NULL));
+
+    // *** First entry that can match ***
+    switch(cond)
+    {
+        case RA_COND_EQ:
+            start = chidb_make_op(index ? Op_SeekGe : Op_Seek, scur, 0, val, NULL);
+            break;
+        case RA_COND_GT:
+            start = chidb_make_op(Op_SeekGt, scur, 0, val, NULL);
+            break;
+        case RA_COND_GEQ:
+            start = chidb_make_op(Op_SeekGe, scur, 0, val, NULL);
+            break;
+        case RA_COND_LT:
+        case RA_COND_LEQ:
+            start = chidb_make_op(Op_Rewind, scur, 0, 0, NULL);
+            break;
+        default:
+            return CHIDB_EINVALIDSQL;
+    }
+    list_append(ops, start);
+    int loop_off = list_size(ops);
+
+    // *** Stop past the value ***
+    if(cond == RA_COND_LT || cond == RA_COND_LEQ || (cond == RA_COND_EQ && index))
+    {
+        if(index)
+            stop = chidb_make_op(cond == RA_COND_LT ? Op_IdxGe : Op_IdxGt, xcur, 0, val, NULL);
+        else
+        {
+            list_append(ops, chidb_make_op(Op_Key, tcur, key, 0, NULL));
+            stop = chidb_make_op(cond == RA_COND_LT ? Op_Ge : Op_Gt, val, 0, key, NULL);
+        }
+        list_append(ops, stop);
+    }
+
+    if(index && !path->covering)
+        list_append(ops, chidb_make_op(Op_IdxPKey, xcur, pk, 0, NULL));
+
+    // *** Sorted fetch: the keys go in the sorter, and the rows are
+    // sought once they are sorted ***
+    list_init(&xrest);
+    if(fetch)
+    {
+        chidb_stmt_where_split(stmt->db, rest, table, xpos, &xrest);
+        if(!list_empty(&xrest))
+        {
+            xtest = chidb_make_op(Op_Noop, 0, 0, 0, NULL);
+            list_append(ops, xtest);
+        }
+        list_append(ops, chidb_make_op(Op_SorterInsert, sorter, pk, 1, NULL));
+        if(xtest != NULL)
+            xtest->p2 = list_size(ops);
+        list_append(ops, chidb_make_op(Op_Next, xcur, loop_off, 0, NULL));
+
+        start->p2 = list_size(ops);
+        if(stop != NULL)
+            stop->p2 = list_size(ops);
+        sort = chidb_make_op(Op_SorterSort, sorter, 0, 0, NULL);
+        list_append(ops, sort);
+        loop_off = list_size(ops);
+        list_append(ops, chidb_make_op(Op_SorterColumn, sorter, 0, pk, NULL));
+        start = chidb_make_op(Op_Seek, tcur, 0, pk, NULL);
+        list_append(ops, start);
+        stop = NULL;
+    }
+    else if(index && !path->covering)
+        list_append(ops, chidb_make_op(Op_DeferredSeek, tcur, 0, pk, NULL));
+
+    if(!list_empty(rest))
+    {
+        test = chidb_make_op(Op_Noop, 0, 0, 0, NULL);
+        list_append(ops, test);
+    }
+
+    for(i = 0; i < list_size(snames); i++)
+    {
+        name = list_get_at(snames, i);
+        if((pos = chidb_column_get_position(stmt->db, table, name)) < 0)
+        {
+            list_destroy(&xrest);
+            return CHIDB_EINVALIDSQL; // The column trying to project does not exist
+        }
+        if(index && !fetch && (path->covering || pos == 0 || pos == xpos))
+            chidb_stmt_load_index_column(ops, xcur, pos, *first_col_reg + i);
+        else
+            chidb_stmt_load_column(ops, tcur, pos, *first_col_reg + i);
+    }
+    list_append(ops, chidb_make_op(Op_ResultRow, *first_col_reg, list_size(snames), 0, NULL));
+
+    // *** Next entry (a primary key is unique) ***
+    if(test != NULL)
+        test->p2 = list_size(ops);
+    if(fetch)
+    {
+        // the Seek skips a key only if the table has lost its row
+        start->p2 = list_size(ops);
+        list_append(ops, chidb_make_op(Op_SorterNext, sorter, loop_off, 0, NULL));
+        start = sort;
+    }
+    else if(index || cond != RA_COND_EQ)
+        list_append(ops, chidb_make_op(Op_Next, scur, loop_off, 0, NULL));
+
+    // *** Done ***
+    start->p2 = list_size(ops);
+    if(stop != NULL)
+        stop->p2 = list_size(ops);
+    if(!path->covering)
+        list_append(ops, chidb_make_op(Op_Close, tcur, 0, 0, NULL));
+    if(index)
+        list_append(ops, chidb_make_op(Op_Close, xcur, 0, 0, NULL));
+    if(fetch)
+        list_append(ops, chidb_make_op(Op_Close, sorter, 0, 0, NULL));
+    list_append(ops, chidb_make_op(Op_Halt, 0, 0, 0, NULL));
+
+    // the tests on x come first in the program, so they replace the
+    // first Noop
+    rc = xtest != NULL ? chidb_stmt_where_deferred(stmt->db, ops, &xrest, table, tcur, xcur, xpos) : CHIDB_OK;
+    list_destroy(&xrest);
+    if(rc != CHIDB_OK || test == NULL)
+        return rc;
+    if(index && !fetch)
+        return chidb_stmt_where_deferred(stmt->db, ops, rest, table, tcur, xcur, xpos);
+
+    char *tables[2] = {table, NULL};
+    int cursors[2] = {tcur, 0};
+    return chidb_stmt_where(stmt->db, ops, rest, tables, cursors);
+}
+
+/* Code generation for a SELECT on a single table, with a WHERE of the
+ * form "pk IN (values)"
+ *
+ * The values are put in a sorter, and each of them, in increasing
+ * order, is sought in the table. The cursor climbs its trail only as far
+ * as it needs to for the next key (see chidb_dbm_cursor_seekNear), so
+ * the root and the internal nodes are read once for all the keys that
+ * are near each other. A value that is in the list more than once is
+ * only sought once. The rows come out in primary key order.
+ *
+ * The program looks like this (cursor t is the table, and s the sorter):
+ *
+ *          load the values into v1 ... vn
+ *          OpenRead t
+ *          SorterOpen s
+ *          SorterInsert s v1 ... SorterInsert s vn
+ *          Null prev
+ *          SorterSort s END
+ *    LOOP: SorterColumn s 0 key
+ *          Eq prev NEXT key
+ *          Copy key prev
+ *          Seek t NEXT key
+ *          [skip to NEXT unless the rest of the WHERE holds]
+ *          load the selected columns
+ *          ResultRow
+ *    NEXT: SorterNext s LOOP
+ *     END: Close t, Close s, Halt
+ */
+static int chidb_stmt_select_keys(chidb_stmt *stmt, Condition_t *where, list_t *rest, char *table,
+                                  list_t *cnames, list_t *snames, list_t *ops, int *first_col_reg)
+{
+    chidb_dbm_op_t *new_op, *sort, *skip, *seek, *test = NULL;
+    char *name;
+    int i, pos, n = 0;
+
+    // Registers: current key, previous key, root page (same as the
+    // cursor), the values, and the result row. The sorter is cursor 3.
+    int key = 0, prev = 1, tcur = 2, scur = 3, val = 4;
+
+    for(Literal_t *v = where->cond.in.values_list; v != NULL; v = v->next, n++)
+    {
+        if((new_op = chidb_stmt_load_value(v, val + n)) == NULL)
+            return CHIDB_EINVALIDSQL;
+        list_append(ops, new_op);
+    }
+    *first_col_reg = val + n;
+
+    list_append(ops, chidb_make_op(Op_Integer, chidb_get_root(stmt->db, table), tcur, 0, NULL));
+    list_append(ops, chidb_make_op(Op_OpenRead, tcur, tcur, list_size(cnames), chidb_catalog_schema(stmt->db, table)));
+    list_append(ops, chidb_make_op(Op_SorterOpen, scur, 0, 0, NULL));
+    for(i = 0; i < n; i++)
+        list_append(ops, chidb_make_op(Op_SorterInsert, scur, val + i, 1, NULL));
+    list_append(ops, chidb_make_op(Op_Null, 0, prev, 0, NULL));
+    sort = chidb_make_op(Op_SorterSort, scur, 0, 0, NULL);
+    list_append(ops, sort);
+
+    // *** Next key, unless it is the same as the last one ***
+    int loop_off = list_size(ops);
+    list_append(ops, chidb_make_op(Op_SorterColumn, scur, 0, key, NULL));
+    skip = chidb_make_op(Op_Eq, prev, 0, key, NULL);
+    list_append(ops, skip);
+    list_append(ops, chidb_make_op(Op_Copy, key, prev, 0, NULL));
+    seek = chidb_make_op(Op_Seek, tcur, 0, key, NULL);
+    list_append(ops, seek);
+
+    if(!list_empty(rest))
+    {
+        test = chidb_make_op(Op_Noop, 0, 0, 0, NULL);
+        list_append(ops, test);
+    }
+
+    for(i = 0; i < list_size(snames); i++)
+    {
+        name = list_get_at(snames, i);
+        if((pos = chidb_column_get_position(stmt->db, table, name)) < 0)
+            return CHIDB_EINVALIDSQL; // The column trying to project does not exist
+        chidb_stmt_load_column(ops, tcur, pos, *first_col_reg + i);
+    }
+    list_append(ops, chidb_make_op(Op_ResultRow, *first_col_reg, list_size(snames), 0, NULL));
+
+    // *** Next key ***
+    skip->p2 = seek->p2 = list_size(ops);
+    if(test != NULL)
+        test->p2 = list_size(ops);
+    list_append(ops, chidb_make_op(Op_SorterNext, scur, loop_off, 0, NULL));
+
+    // *** Done ***
+    sort->p2 = list_size(ops);
+    list_append(ops, chidb_make_op(Op_Close, tcur, 0, 0, NULL));
+    list_append(ops, chidb_make_op(Op_Close, scur, 0, 0, NULL));
+    list_append(ops, chidb_make_op(Op_Halt, 0, 0, 0, NULL));
+
+    if(test != NULL)
+    {
+        char *tables[2] = {table, NULL};
+        int cursors[2] = {tcur, 0};
+        return chidb_stmt_where(stmt->db, ops, rest, tables, cursors);
+    }
+
+    return CHIDB_OK;
+}
+
+/* Index join code generation for a NATURAL JOIN
+ *
+ * For each row of the outer table, the rows of the inner table with the
+ * same value in the join column (chosen by the optimizer) are looked up,
+ * instead of scanning the whole inner table. If the join column is the
+ * primary key of the inner table, the row is sought in the table itself.
+ * Otherwise, the entries of the index on it with that value are sought
+ * in the index, and each row is then sought in the table by the primary
+ * key stored in the entry. The other common columns, and a WHERE
+ * condition, are checked once the rows are found.
+ *
+ * The program looks like this (cursor o is the outer table, i the inner
+ * table, and x the index on it):
+ *
+ *          [load WHERE value]
+ *          OpenRead o, OpenRead i, [OpenRead x]
+ *          Rewind o END
+ *   OUTER: [skip to ONEXT unless the WHERE holds for o]
+ *          load the join column of o into k
+ *   with an index:                   with the primary key:
+ *          SeekGe x ONEXT k                 Seek i ONEXT k
+ *   INNER: IdxGt x ONEXT k
+ *          IdxPKey x pk
+ *          DeferredSeek i pk
+ *          [skip to INEXT unless the WHERE holds for i]
+ *          [skip to INEXT unless the other common columns are equal]
+ *          load the selected columns from o and i
+ *          ResultRow
+ *   INEXT: [Next x INNER]
+ *   ONEXT: Next o OUTER
+ *     END: Close o, Close i, [Close x], Halt
+ *
+ * The join column and the primary key of the inner table are loaded
+ * from x, so an inner row is only read from i, by the DeferredSeek, if
+ * some other column of it is needed. If the index covers the query, i
+ * is not opened at all.
+ */
+static int chidb_stmt_select_index_join(chidb_stmt *stmt, SRA_Select_t *sra_select, list_t *tnames,
+                                        list_t *cnames1, list_t *cnames2, list_t *snames,
+                                        chidb_join_plan_t *plan, list_t *ops, int *first_col_reg)
+{
+    char *itable = list_get_at(tnames, plan->inner);
+    char *otable = list_get_at(tnames, 1 - plan->inner);
+    list_t *inames = plan->inner == 0 ? cnames1 : cnames2;
+    list_t *onames = plan->inner == 0 ? cnames2 : cnames1;
+    list_t inner_skips; // Ops that skip to the next inner row
+    chidb_dbm_op_t *new_op, *where_op = NULL, *rewind, *seek;
+    char *name;
+    int i, pos, pos2, xpos;
+
+    list_init(&inner_skips);
+
+    // Registers: WHERE value and column, root pages (same as the cursors),
+    // join value, primary key of the inner row, the other common columns,
+    // and the result row
+    int base = sra_select != NULL ? 2 : 0;
+    int ocur = base, icur = base + 1, xcur = base + 2;
+    int key = base + 3, pk = base + 4, cmp1 = base + 5, cmp2 = base + 6;
+    *first_col_reg = base + 7;
+
+    // Columns of the inner table that are in the index entries: the
+    // primary key and the indexed column (the join column)
+    xpos = plan->index != 0 ? chidb_column_get_position(stmt->db, itable, plan->column) : -1;
+
+    // Which table (if any) the WHERE is checked on, and where its column is
+    char *where_table = NULL;
+    int where_pos = -1;
+    if(sra_select != NULL)
+    {
+        name = sra_select->cond->cond.comp.expr1->expr.term.ref->columnName;
+        where_table = otable;
+        if((where_pos = chidb_column_get_position(stmt->db, otable, name)) < 0)
+        {
+            where_table = itable;
+            where_pos = chidb_column_get_position(stmt->db, itable, name);
+        }
+        if(where_pos < 0)
+            goto invalid; // The column trying to select (sigma) on does not exist
+
+        new_op = chidb_stmt_load_value(sra_select->cond->cond.comp.expr2->expr.term.val, 0);
+        if(new_op == NULL)
+            goto invalid;
+        list_append(ops, new_op);
+    }
+
+    list_append(ops, chidb_make_op(Op_Integer, chidb_get_root(stmt->db, otable), ocur, 0, NULL));
+    list_append(ops, chidb_make_op(Op_OpenRead, ocur, ocur, list_size(onames), chidb_catalog_schema(stmt->db, otable)));
+    if(!plan->covering)
+    {
+        list_append(ops, chidb_make_op(Op_Integer, chidb_get_root(stmt->db, itable), icur, 0, NULL));
+        list_append(ops, chidb_make_op(Op_OpenRead, icur, icur, list_size(inames), chidb_catalog_schema(stmt->db, itable)));
+    }
+    if(plan->index != 0)
+    {
+        list_append(ops, chidb_make_op(Op_Integer, plan->index, xcur, 0, NULL));
+        list_append(ops, chidb_make_op(Op_OpenRead, xcur, xcur, 0, chidb_catalog_schema(stmt->db, itable)));
+    }
+
+    // *** Outer table ***
+    rewind = chidb_make_op(Op_Rewind, ocur, 0, 0, NULL);
+    list_append(ops, rewind);
+    int outer_off = list_size(ops);
+
+    if(where_table == otable)
+    {
+        chidb_stmt_load_column(ops, ocur, where_pos, 1);
+        if((where_op = chidb_stmt_skip_unless(sra_select->cond->t, 0, 1)) == NULL)
+            goto invalid;
+        list_append(ops, where_op);
+    }
+    chidb_stmt_load_column(ops, ocur, chidb_column_get_position(stmt->db, otable, plan->column), key);
+
+    // *** Inner rows with the same value ***
+    chidb_dbm_op_t *idxgt = NULL;
+    int inner_off = 0;
+    if(plan->index != 0)
+    {
+        seek = chidb_make_op(Op_SeekGe, xcur, 0, key, NULL);
+        list_append(ops, seek);
+        inner_off = list_size(ops);
+        idxgt = chidb_make_op(Op_IdxGt, xcur, 0, key, NULL);
+        list_append(ops, idxgt);
+        if(!plan->covering)
+        {
+            list_append(ops, chidb_make_op(Op_IdxPKey, xcur, pk, 0, NULL));
+            list_append(ops, chidb_make_op(Op_DeferredSeek, icur, 0, pk, NULL));
+        }
+    }
+    else
+    {
+        seek = chidb_make_op(Op_Seek, icur, 0, key, NULL);
+        list_append(ops, seek);
+    }
+
+    if(where_table == itable)
+    {
+        if(plan->covering || (xpos >= 0 && (where_pos == 0 || where_pos == xpos)))
+            chidb_stmt_load_index_column(ops, xcur, where_pos, 1);
+        else
+            chidb_stmt_load_column(ops, icur, where_pos, 1);
+        if((where_op = chidb_stmt_skip_unless(sra_select->cond->t, 0, 1)) == NULL)
+            goto invalid;
+        list_append(ops, where_op);
+        list_append(&inner_skips, where_op);
+    }
+
+    for(i = 0; i < list_size(onames); i++)
+    {
+        name = list_get_at(onames, i);
+        if(strcmp(name, plan->column) == 0 || (pos2 = chidb_column_position(inames, name)) < 0)
+            continue;
+        pos = chidb_column_get_position(stmt->db, otable, name);
+        chidb_stmt_load_column(ops, ocur, pos, cmp1);
+        chidb_stmt_load_column(ops, icur, pos2, cmp2);
+        new_op = chidb_make_op(Op_Ne, cmp1, 0, cmp2, NULL);
+        list_append(ops, new_op);
+        list_append(&inner_skips, new_op);
+    }
 
-    chidb_dbm_op_t *first = chidb_make_op(Op_Integer, root, 0, 0, NULL); // The root page number is now in reg 0
-    list_append(&ops, first); // I'm fine passing the address, because this list will only be used in this function
-    chidb_dbm_op_t *second = chidb_make_op(Op_OpenWrite, 0, 0, list_size(&cnames), NULL);
-    list_append(&ops, second);
-    // Open write using cursor zero
+    for(i = 0; i < list_size(snames); i++)
+    {
+        name = list_get_at(snames, i);
+        if((pos = chidb_column_get_position(stmt->db, otable, name)) >= 0)
+            chidb_stmt_load_column(ops, ocur, pos, *first_col_reg + i);
+        else if((pos = chidb_column_get_position(stmt->db, itable, name)) >= 0
+                 && (plan->covering || (xpos >= 0 && (pos == 0 || pos == xpos))))
+            chidb_stmt_load_index_column(ops, xcur, pos, *first_col_reg + i);
+        else if(pos >= 0)
+            chidb_stmt_load_column(ops, icur, pos, *first_col_reg + i);
+        else
+            goto invalid; // The column trying to project does not exist
+    }
+    list_append(ops, chidb_make_op(Op_ResultRow, *first_col_reg, list_size(snames), 0, NULL));
+
+    // *** Next inner row (only with an index, the primary key is unique) ***
+    int inner_next = list_size(ops);
+    if(plan->index != 0)
+        list_append(ops, chidb_make_op(Op_Next, xcur, inner_off, 0, NULL));
+
+    // *** Next outer row ***
+    int outer_next = list_size(ops);
+    list_append(ops, chidb_make_op(Op_Next, ocur, outer_off, 0, NULL));
+
+    seek->p2 = outer_next;
+    if(idxgt != NULL)
+        idxgt->p2 = outer_next;
+    if(where_op != NULL && where_table == otable)
+        where_op->p2 = outer_next;
+    list_iterator_start(&inner_skips);
+    while(list_iterator_hasnext(&inner_skips))
+        ((chidb_dbm_op_t *)list_iterator_next(&inner_skips))->p2 = inner_next;
+    list_iterator_stop(&inner_skips);
+
+    // *** Done ***
+    rewind->p2 = list_size(ops);
+    list_append(ops, chidb_make_op(Op_Close, ocur, 0, 0, NULL));
+    if(!plan->covering)
+        list_append(ops, chidb_make_op(Op_Close, icur, 0, 0, NULL));
+    if(plan->index != 0)
+        list_append(ops, chidb_make_op(Op_Close, xcur, 0, 0, NULL));
+    list_append(ops, chidb_make_op(Op_Halt, 0, 0, 0, NULL));
+
+    list_destroy(&inner_skips);
+
+    return CHIDB_OK;
+
+invalid:
+    list_destroy(&inner_skips);
+
+    return CHIDB_EINVALIDSQL;
+}
+
+/* Number of rows an ORDER BY only has to keep the first of, for the LIMIT
+ * (and OFFSET) of a SELECT, or 0 to sort all of them */
+static int chidb_stmt_sort_limit(SRA_Project_t *sra_project)
+{
+    if(sra_project->limit <= 0 || sra_project->offset > SORTER_MAX_LIMIT
+            || sra_project->limit > SORTER_MAX_LIMIT - sra_project->offset)
+        return 0;
+
+    return sra_project->limit + sra_project->offset;
+}
+
+/* ORDER BY code generation
+ *
+ * Turns a SELECT program into one that returns its rows sorted by one of
+ * the columns, by passing them through a sorter (see dbm-sorter.c). The
+ * sorter is opened first, every ResultRow becomes a SorterInsert of the
+ * same registers, and once the program would halt, the rows are returned
+ * from the sorter instead:
+ *
+ *          SorterOpen s key desc
+ *          [the program, inserting its rows into s, up to its Halt]
+ *          SorterSort s END
+ *    LOOP: SorterColumn s for each column
+ *          ResultRow
+ *          SorterNext s LOOP
+ *     END: Close s, Halt
+ *
+ * The column the rows are sorted by may not be one of the selected
+ * columns. In that case, it has been appended to them (hidden is true),
+ * so it is inserted with the rest of the row, but not returned.
+ *
+ * If only the first limit rows will be returned (a LIMIT, plus its
+ * OFFSET, of at most SORTER_MAX_LIMIT), SorterLimit s limit follows
+ * SorterOpen, and the sorter only keeps those rows instead of sorting
+ * all of them.
+ */
+static void chidb_stmt_select_sort(list_t *ops, list_t *snames, int first_col_reg,
+                                   int key, bool desc, bool hidden, int limit)
+{
+    int nall = list_size(snames), ncols = nall - (hidden ? 1 : 0);
+    int scur = 0, i;
+    chidb_dbm_op_t *op, *sort;
+
+    // The sorter gets a cursor of its own
+    for(i = 0; i < list_size(ops); i++)
+    {
+        op = list_get_at(ops, i);
+        if((op->opcode == Op_OpenRead || op->opcode == Op_OpenWrite || op->opcode == Op_OpenHash
+                || op->opcode == Op_SorterOpen) && op->p1 >= scur)
+            scur = op->p1 + 1;
+    }
+
+    // Everything moves down to make room for SorterOpen (and SorterLimit)
+    for(i = 0; i < list_size(ops); i++)
+    {
+        op = list_get_at(ops, i);
+        if(chidb_stmt_op_jumps(op->opcode))
+            op->p2 += limit > 0 ? 2 : 1;
+        else if(op->opcode == Op_ResultRow)
+        {
+            op->opcode = Op_SorterInsert;
+            op->p3 = nall;
+            op->p2 = op->p1;
+            op->p1 = scur;
+        }
+    }
+    list_insert_at(ops, chidb_make_op(Op_SorterOpen, scur, key, desc, NULL), 0);
+    if(limit > 0)
+        list_insert_at(ops, chidb_make_op(Op_SorterLimit, scur, limit, 0, NULL), 1);
+    free(list_extract_at(ops, list_size(ops) - 1)); // Halt
+
+    sort = chidb_make_op(Op_SorterSort, scur, 0, 0, NULL);
+    list_append(ops, sort);
+    int loop_off = list_size(ops);
+    for(i = 0; i < ncols; i++)
+        list_append(ops, chidb_make_op(Op_SorterColumn, scur, i, first_col_reg + i, NULL));
+    list_append(ops, chidb_make_op(Op_ResultRow, first_col_reg, ncols, 0, NULL));
+    list_append(ops, chidb_make_op(Op_SorterNext, scur, loop_off, 0, NULL));
+    sort->p2 = list_size(ops);
+    list_append(ops, chidb_make_op(Op_Close, scur, 0, 0, NULL));
+    list_append(ops, chidb_make_op(Op_Halt, 0, 0, 0, NULL));
+
+    if(hidden)
+        list_delete_at(snames, nall - 1);
+}
+
+/* Aggregates of a SELECT with GROUP BY or aggregate functions
+ *
+ * The access path and join generators produce the input rows of the
+ * aggregation: the GROUP BY columns first, and then the columns that the
+ * aggregate functions read. Every aggregate function keeps an accumulator
+ * (AVG keeps two: a sum and a count), and every selected column is either
+ * a GROUP BY column or computed from the accumulators of its function.
+ */
+typedef struct chidb_stmt_agg
+{
+    int ngroup;                 // GROUP BY columns (the first input columns)
+    int ncols;                  // Selected columns
+    int *col_func;              // enum FuncType of each column, or -1 for a GROUP BY column
+    int *col_pos;               // Its first accumulator, or its GROUP BY column
+    int nacc;                   // Accumulators
+    chidb_dbm_agg_t *acc_func;  // The aggregate each accumulator computes
+    int *acc_input;             // The input column it reads, or -1 (COUNT(*))
+    char **names;               // Names of the selected columns
+} chidb_stmt_agg_t;
+
+static bool chidb_stmt_is_star(Expression_t *expr)
+{
+    if(expr == NULL || expr->t != EXPR_TERM)
+        return false;
+    if(expr->expr.term.t == TERM_COLREF)
+        return !strcmp(expr->expr.term.ref->columnName, "*");
+    if(expr->expr.term.t == TERM_ID)
+        return !strcmp(expr->expr.term.id, "*");
+    return false;
+}
+
+static bool chidb_stmt_select_has_aggregates(SRA_Project_t *sra_project)
+{
+    if(sra_project->group_by != NULL)
+        return true;
+    for(Expression_t *expr = sra_project->expr_list; expr != NULL; expr = expr->next)
+        if(expr->t == EXPR_TERM && expr->expr.term.t == TERM_FUNC)
+            return true;
+    return false;
+}
+
+static void chidb_stmt_agg_free(chidb_stmt_agg_t *agg)
+{
+    for(int i = 0; i < agg->ncols; i++)
+        free(agg->names[i]);
+    free(agg->names);
+    free(agg->col_func);
+    free(agg->col_pos);
+    free(agg->acc_func);
+    free(agg->acc_input);
+}
+
+static void chidb_stmt_agg_add(chidb_stmt_agg_t *agg, chidb_dbm_agg_t func, int input)
+{
+    agg->acc_func[agg->nacc] = func;
+    agg->acc_input[agg->nacc] = input;
+    agg->nacc++;
+}
+
+/* Works out the aggregates of a SELECT
+ *
+ * Appends the names of the input columns to inames, and fills in agg
+ * (which must be freed with chidb_stmt_agg_free, whatever the outcome).
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_EINVALIDSQL: A selected column is neither a GROUP BY column nor
+ *   an aggregate of a column, or the query is otherwise not supported
+ */
+static int chidb_stmt_select_agg_plan(SRA_Project_t *sra_project, list_t *inames, chidb_stmt_agg_t *agg)
+{
+    static const char *func_names[] = {"MAX", "MIN", "COUNT", "AVG", "SUM"};
+    Expression_t *expr;
+    char *name;
+    int i, n = 0;
+
+    for(expr = sra_project->expr_list; expr != NULL; expr = expr->next)
+        n++;
+
+    agg->ngroup = 0;
+    agg->ncols = n;
+    agg->nacc = 0;
+    agg->col_func = malloc(sizeof(int) * n);
+    agg->col_pos = malloc(sizeof(int) * n);
+    agg->acc_func = malloc(sizeof(chidb_dbm_agg_t) * 2 * n);
+    agg->acc_input = malloc(sizeof(int) * 2 * n);
+    agg->names = calloc(n, sizeof(char *));
+
+    for(expr = sra_project->group_by; expr != NULL; expr = expr->next)
+    {
+        if(expr->t != EXPR_TERM || expr->expr.term.t != TERM_COLREF)
+            return CHIDB_EINVALIDSQL;
+        name = expr->expr.term.ref->columnName;
+        if(chidb_column_position(inames, name) < 0)
+            list_append(inames, name);
+    }
+    agg->ngroup = list_size(inames);
+
+    for(i = 0, expr = sra_project->expr_list; expr != NULL; i++, expr = expr->next)
+    {
+        if(expr->t != EXPR_TERM)
+            return CHIDB_EINVALIDSQL;
+
+        if(expr->expr.term.t == TERM_COLREF)
+        {
+            name = expr->expr.term.ref->columnName;
+            agg->col_func[i] = -1;
+            agg->col_pos[i] = chidb_column_position(inames, name);
+            if(agg->col_pos[i] < 0 || agg->col_pos[i] >= agg->ngroup)
+                return CHIDB_EINVALIDSQL;
+            agg->names[i] = strdup(expr->alias != NULL ? expr->alias : name);
+            continue;
+        }
+        if(expr->expr.term.t != TERM_FUNC)
+            return CHIDB_EINVALIDSQL;
+
+        Func *f = &expr->expr.term.f;
+        int input = -1;
+        name = "*";
+        if(!chidb_stmt_is_star(f->expr))
+        {
+            if(f->expr == NULL || f->expr->t != EXPR_TERM || f->expr->expr.term.t != TERM_COLREF)
+                return CHIDB_EINVALIDSQL;
+            name = f->expr->expr.term.ref->columnName;
+            input = chidb_column_position(inames, name);
+            if(input < 0)
+            {
+                input = list_size(inames);
+                list_append(inames, name);
+            }
+        }
+        else if(f->t != FUNC_COUNT)
+            return CHIDB_EINVALIDSQL;
+
+        agg->col_func[i] = f->t;
+        agg->col_pos[i] = agg->nacc;
+        switch(f->t)
+        {
+            case FUNC_MAX:
+                chidb_stmt_agg_add(agg, AGG_MAX, input);
+                break;
+            case FUNC_MIN:
+                chidb_stmt_agg_add(agg, AGG_MIN, input);
+                break;
+            case FUNC_COUNT:
+                chidb_stmt_agg_add(agg, AGG_COUNT, input);
+                break;
+            case FUNC_AVG:
+                chidb_stmt_agg_add(agg, AGG_SUM, input);
+                chidb_stmt_agg_add(agg, AGG_COUNT, input);
+                break;
+            case FUNC_SUM:
+                chidb_stmt_agg_add(agg, AGG_SUM, input);
+                break;
+            default:
+                return CHIDB_EINVALIDSQL;
+        }
+
+        if(expr->alias != NULL)
+            agg->names[i] = strdup(expr->alias);
+        else
+        {
+            agg->names[i] = malloc(strlen(func_names[f->t]) + strlen(name) + 3);
+            sprintf(agg->names[i], "%s(%s)", func_names[f->t], name);
+        }
+    }
+
+    return CHIDB_OK;
+}
+
+/* Whether every selected column is a COUNT(*) without GROUP BY */
+static bool chidb_stmt_agg_count_only(chidb_stmt_agg_t *agg)
+{
+    if(agg->ngroup > 0)
+        return false;
+    for(int i = 0; i < agg->nacc; i++)
+        if(agg->acc_func[i] != AGG_COUNT || agg->acc_input[i] >= 0)
+            return false;
+    return agg->nacc == agg->ncols;
+}
+
+/* COUNT(*) of a whole table
+ *
+ * Counts the entries of the table B-Tree with Count, without reading any
+ * of its records. The count is in register 1 (and copied to the following
+ * registers, if it is selected more than once).
+ */
+static void chidb_stmt_select_count(chidb_stmt *stmt, char *table, list_t *cnames,
+                                    chidb_stmt_agg_t *agg, list_t *ops)
+{
+    list_append(ops, chidb_make_op(Op_Integer, chidb_get_root(stmt->db, table), 0, 0, NULL));
+    list_append(ops, chidb_make_op(Op_OpenRead, 0, 0, list_size(cnames), chidb_catalog_schema(stmt->db, table)));
+    list_append(ops, chidb_make_op(Op_Count, 0, 1, 0, NULL));
+    for(int i = 1; i < agg->ncols; i++)
+        list_append(ops, chidb_make_op(Op_SCopy, 1, 1 + i, 0, NULL));
+    list_append(ops, chidb_make_op(Op_ResultRow, 1, agg->ncols, 0, NULL));
+    list_append(ops, chidb_make_op(Op_Close, 0, 0, 0, NULL));
+    list_append(ops, chidb_make_op(Op_Halt, 0, 0, 0, NULL));
+}
+
+/* Replaces nremove ops at pos with the ops in code
+ *
+ * Jumps past the removed ops move along with their targets, and jumps to
+ * a removed op go to the first op of code instead. Jumps in code must
+ * already be to their final address. So does the address of a Noop that
+ * is yet to be replaced by a WHERE (see chidb_stmt_where).
+ */
+static void chidb_stmt_splice_ops(list_t *ops, int pos, int nremove, list_t *code)
+{
+    int n = list_size(code), i;
+    chidb_dbm_op_t *op;
+
+    for(i = 0; i < list_size(ops); i++)
+    {
+        op = list_get_at(ops, i);
+        bool jumps = chidb_stmt_op_jumps(op->opcode) || op->opcode == Op_Noop;
+        if(jumps && op->p2 >= pos + nremove)
+            op->p2 += n - nremove;
+        else if(jumps && op->p2 > pos)
+            op->p2 = pos;
+    }
+    for(i = 0; i < nremove; i++)
+        free(list_extract_at(ops, pos));
+    for(i = 0; i < n; i++)
+        list_insert_at(ops, list_get_at(code, i), pos + i);
+    list_clear(code);
+}
+
+#define IS_COMPARE_OP(o) ((o) >= Op_Eq && (o) <= Op_Ge)
+
+/* The comparison that jumps exactly when another one does not */
+static opcode_t chidb_stmt_negate_compare(opcode_t opcode)
+{
+    switch(opcode)
+    {
+        case Op_Eq: return Op_Ne;
+        case Op_Ne: return Op_Eq;
+        case Op_Lt: return Op_Ge;
+        case Op_Ge: return Op_Lt;
+        case Op_Le: return Op_Gt;
+        default:    return Op_Le;
+    }
+}
+
+/* Can the instructions from first to last be run without running the
+ * one before first? That is, does an instruction outside of them jump
+ * to one of them? */
+static bool chidb_stmt_entered(list_t *ops, int first, int last)
+{
+    for(int i = 0; i < list_size(ops); i++)
+    {
+        chidb_dbm_op_t *op = list_get_at(ops, i);
+        if((i < first - 1 || i > last) && chidb_stmt_op_jumps(op->opcode)
+                && op->p2 >= first && op->p2 <= last)
+            return true;
+    }
+    return false;
+}
+
+/* The register a Column, Key or IdxPKey reads a value into, if it reads
+ * the same value as the later one */
+static int chidb_stmt_same_read(chidb_dbm_op_t *op, chidb_dbm_op_t *later)
+{
+    if(later->opcode == Op_Key || later->opcode == Op_IdxPKey)
+        return op->opcode == later->opcode && op->p1 == later->p1 ? op->p2 : -1;
+
+    if((op->opcode == Op_Column || op->opcode == Op_FilterColumn)
+            && op->p1 == later->p1 && op->p2 == later->p2)
+        return op->p3;
+
+    return -1;
+}
+
+/* Turns a Column, Key or IdxPKey at pos into an SCopy of an earlier read
+ * of the same value, if the cursor has not moved since, and every path
+ * to pos goes through that read */
+static void chidb_stmt_reuse_read(list_t *ops, int pos)
+{
+    chidb_dbm_op_t *later = list_get_at(ops, pos);
+    int reg = later->opcode == Op_Column ? later->p3 : later->p2;
+
+    for(int i = pos - 1; i >= 0; i--)
+    {
+        chidb_dbm_op_t *op = list_get_at(ops, i);
+        int from = chidb_stmt_same_read(op, later);
+
+        if(from >= 0)
+        {
+            if(chidb_stmt_entered(ops, i + 1, pos))
+                return;
+            for(int j = i + 1; j < pos; j++)
+            {
+                if(chidb_stmt_op_uses_reg(list_get_at(ops, j), from, true))
+                    return;
+            }
+            if(from == reg)
+                later->opcode = Op_Noop;
+            else
+            {
+                later->opcode = Op_SCopy;
+                later->p1 = from;
+                later->p2 = reg;
+                later->p3 = 0;
+            }
+            return;
+        }
+
+        if(chidb_stmt_op_cursor(op) == later->p1 && op->opcode != Op_Column
+                && op->opcode != Op_FilterColumn && op->opcode != Op_Key && op->opcode != Op_IdxPKey)
+            return;
+    }
+}
+
+/* Moves a constant load at pos to the start of the program, if it is in
+ * a loop, nothing else writes to its register, and nothing before it
+ * reads the register */
+static bool chidb_stmt_hoist_const(list_t *ops, int pos)
+{
+    chidb_dbm_op_t *load = list_get_at(ops, pos), *op;
+    bool loop = false;
+    int i;
+
+    for(i = 0; i < list_size(ops); i++)
+    {
+        op = list_get_at(ops, i);
+        if(i >= pos && chidb_stmt_op_jumps(op->opcode) && op->p2 <= pos)
+            loop = true;
+        if(i != pos && chidb_stmt_op_uses_reg(op, load->p2, i > pos))
+            return false;
+    }
+    if(!loop)
+        return false;
+
+    for(i = 0; i < list_size(ops); i++)
+    {
+        op = list_get_at(ops, i);
+        if(chidb_stmt_op_jumps(op->opcode) && op->p2 <= pos)
+            op->p2++;
+    }
+    list_insert_at(ops, list_extract_at(ops, pos), 0);
+
+    return true;
+}
+
+/* Where a jump ends up: past Noops, and past comparisons of the same
+ * registers, which can only go one way once the jump is taken (a
+ * comparison with NULL never jumps) */
+static int chidb_stmt_thread_jump(list_t *ops, chidb_dbm_op_t *jump)
+{
+    int target = jump->p2;
+
+    for(int hops = 0; hops < list_size(ops) && target < list_size(ops); hops++)
+    {
+        chidb_dbm_op_t *op = list_get_at(ops, target);
+
+        if(op->opcode == Op_Noop)
+            target++;
+        else if(!IS_COMPARE_OP(jump->opcode) || !IS_COMPARE_OP(op->opcode)
+                || op->p1 != jump->p1 || op->p3 != jump->p3)
+            break;
+        else if(op->opcode == jump->opcode)
+            target = op->p2;
+        else if(op->opcode == chidb_stmt_negate_compare(jump->opcode))
+            target++;
+        else
+            break;
+    }
+
+    return target;
+}
+
+/* Peephole optimization of a program, before it is set in the DBM
+ *
+ * Code generation loads values wherever it is convenient, so a program
+ * can read the same column of a row more than once (the column of a
+ * WHERE is often selected too), load constants inside its loops, and
+ * jump to instructions that have nothing to do. This removes what it can
+ * of that, without changing what the program does:
+ *
+ *  - A Column, Key or IdxPKey that reads a value an earlier one already
+ *    read for the same row becomes an SCopy of it.
+ *  - An Integer, String, Null or Param in a loop is moved to the start
+ *    of the program, if it is the only instruction that writes to its
+ *    register.
+ *  - Jumps go straight to where they end up (see
+ *    chidb_stmt_thread_jump), and then Noops and comparisons that jump
+ *    to the next instruction are removed.
+ *
+ * This has to run before Columns are turned into FilterColumns, which
+ * it leaves the first read of each value for.
+ */
+static void chidb_stmt_peephole(list_t *ops)
+{
+    chidb_dbm_op_t *op;
+    list_t none;
+    int i;
+
+    list_init(&none);
+
+    for(i = 0; i < list_size(ops); i++)
+    {
+        op = list_get_at(ops, i);
+        if(op->opcode == Op_Column || op->opcode == Op_Key || op->opcode == Op_IdxPKey)
+            chidb_stmt_reuse_read(ops, i);
+    }
+
+    for(i = 0; i < list_size(ops); i++)
+    {
+        op = list_get_at(ops, i);
+        if(op->opcode == Op_Integer || op->opcode == Op_String
+                || op->opcode == Op_Null || op->opcode == Op_Param)
+            chidb_stmt_hoist_const(ops, i);
+    }
+
+    for(i = 0; i < list_size(ops); i++)
+    {
+        op = list_get_at(ops, i);
+        if(chidb_stmt_op_jumps(op->opcode))
+            op->p2 = chidb_stmt_thread_jump(ops, op);
+    }
+
+    for(i = list_size(ops) - 1; i >= 0; i--)
+    {
+        op = list_get_at(ops, i);
+        if(op->opcode == Op_Noop || (IS_COMPARE_OP(op->opcode) && op->p2 == i + 1))
+            chidb_stmt_splice_ops(ops, i, 1, &none);
+    }
+
+    list_destroy(&none);
+}
+
+/* Is a WHERE condition a single comparison of a column with a value?
+ * Those are what the access paths and joins are chosen for, and are
+ * tested with two ops. Anything else is compiled by chidb_stmt_where. */
+static bool chidb_stmt_cond_simple(Condition_t *cond)
+{
+    Expression_t *col, *val;
+
+    if(cond == NULL || cond->t > RA_COND_GEQ)
+        return false;
+
+    col = cond->cond.comp.expr1;
+    val = cond->cond.comp.expr2;
+    return col->t == EXPR_TERM && col->expr.term.t == TERM_COLREF
+        && val->t == EXPR_TERM && val->expr.term.t == TERM_LITERAL
+        && (val->expr.term.val->t == TYPE_INT || val->expr.term.val->t == TYPE_TEXT
+            || val->expr.term.val->t == TYPE_PARAM);
+}
+
+/* Appends the conditions ANDed in a WHERE condition to a list */
+static void chidb_stmt_conjuncts(Condition_t *cond, list_t *conds)
+{
+    if(cond->t == RA_COND_AND)
+    {
+        chidb_stmt_conjuncts(cond->cond.binary.cond1, conds);
+        chidb_stmt_conjuncts(cond->cond.binary.cond2, conds);
+    }
+    else
+        list_append(conds, cond);
+}
+
+/* A WHERE condition being compiled (see chidb_stmt_where) */
+typedef struct chidb_stmt_where
+{
+    chidb *db;
+    char *tables[2];    // Tables the columns are in (tables[1] is NULL if
+                        // there is only one)
+    int cursors[2];     // Cursors the rows of those tables are read with
+    int xcur;           // Index cursor the rows of tables[0] are found with,
+                        // by a DeferredSeek (-1 if they are not)
+    int xpos;           // Position of the column of that index
+    int pos;            // Address the code will be at
+    int reg;            // First register that is not used yet
+    list_t values;      // Ops that load the values compared to, once
+    list_t code;        // Ops that test the condition on a row
+} chidb_stmt_where_t;
+
+/* Position of the column a reference is to, and which of the tables it
+ * is in (in *t). -1 if there is no such column. */
+static int chidb_stmt_where_column(chidb_stmt_where_t *w, ColumnReference_t *ref, int *t)
+{
+    int pos = -1;
+
+    for(*t = 0; *t < 2 && w->tables[*t] != NULL; (*t)++)
+        if(ref->tableName == NULL || chidb_catalog_qualifies(w->db, ref->tableName, w->tables[*t]))
+            if((pos = chidb_column_get_position(w->db, w->tables[*t], ref->columnName)) >= 0)
+                break;
+
+    return pos;
+}
+
+/* Is an operand of a comparison in the index entry the row was found
+ * by (if it was found by one)? Values are. */
+static bool chidb_stmt_where_in_index(chidb_stmt_where_t *w, Expression_t *expr)
+{
+    int t, pos;
+
+    if(expr->t != EXPR_TERM || expr->expr.term.t != TERM_COLREF)
+        return true;
+
+    pos = chidb_stmt_where_column(w, expr->expr.term.ref, &t);
+    return w->xcur >= 0 && t == 0 && (pos == 0 || pos == w->xpos);
+}
+
+/* Can a condition be tested on the index entry alone? */
+static bool chidb_stmt_where_indexed(chidb_stmt_where_t *w, Condition_t *cond)
+{
+    switch(cond->t)
+    {
+        case RA_COND_AND:
+        case RA_COND_OR:
+            return chidb_stmt_where_indexed(w, cond->cond.binary.cond1)
+                && chidb_stmt_where_indexed(w, cond->cond.binary.cond2);
+        case RA_COND_NOT:
+            return chidb_stmt_where_indexed(w, cond->cond.unary.cond);
+        case RA_COND_IN:
+            return chidb_stmt_where_in_index(w, cond->cond.in.expr);
+        default:
+            return chidb_stmt_where_in_index(w, cond->cond.comp.expr1)
+                && chidb_stmt_where_in_index(w, cond->cond.comp.expr2);
+    }
+}
+
+/* Loads an operand of a comparison into a new register: a column of the
+ * current row, in code, or a value, in values */
+static int chidb_stmt_where_operand(chidb_stmt_where_t *w, Expression_t *expr, int *reg)
+{
+    chidb_dbm_op_t *op;
+    int t, pos;
+
+    if(expr->t != EXPR_TERM)
+        return CHIDB_EINVALIDSQL;
+
+    *reg = w->reg++;
+    switch(expr->expr.term.t)
+    {
+        case TERM_LITERAL:
+            if((op = chidb_stmt_load_value(expr->expr.term.val, *reg)) == NULL)
+                return CHIDB_EINVALIDSQL;
+            list_append(&w->values, op);
+            return CHIDB_OK;
+        case TERM_NULL:
+            list_append(&w->values, chidb_make_op(Op_Null, 0, *reg, 0, NULL));
+            return CHIDB_OK;
+        case TERM_COLREF:
+            break;
+        default:
+            return CHIDB_EINVALIDSQL;
+    }
+
+    if((pos = chidb_stmt_where_column(w, expr->expr.term.ref, &t)) < 0)
+        return CHIDB_EINVALIDSQL;
+
+    if(chidb_stmt_where_in_index(w, expr))
+        chidb_stmt_load_index_column(&w->code, w->xcur, pos, *reg);
+    else
+        chidb_stmt_load_column(&w->code, w->cursors[t], pos, *reg);
+    return CHIDB_OK;
+}
+
+/* Sets the address of the jumps in a list to the next op of code */
+static void chidb_stmt_where_land(chidb_stmt_where_t *w, list_t *jumps)
+{
+    while(!list_empty(jumps))
+        ((chidb_dbm_op_t *) list_fetch(jumps))->p2 = w->pos + list_size(&w->code);
+}
+
+/* Compiles a condition into ops that jump when it is sense, and go on
+ * to the next op otherwise. The jumps are added to a list, for the caller
+ * to set their address.
+ *
+ * AND and OR short-circuit: with sense false, an AND jumps as soon as one
+ * of its conditions is false, and with sense true, it skips the rest of
+ * the test (to the op after it) as soon as one is false. OR is the other
+ * way around, and NOT flips the sense. Like every comparison op, a
+ * comparison with a NULL (or of an integer with a text) does not jump,
+ * whatever the sense.
+ */
+static int chidb_stmt_where_branch(chidb_stmt_where_t *w, Condition_t *cond, bool sense, list_t *jumps)
+{
+    // Op that jumps when reg[p3] OP reg[p1], and the one when it does not
+    static const opcode_t jump_if[] = {Op_Eq, Op_Lt, Op_Gt, Op_Le, Op_Ge};
+    static const opcode_t jump_unless[] = {Op_Ne, Op_Ge, Op_Le, Op_Gt, Op_Lt};
+    // The same comparison with the operands the other way around
+    static const enum CondType mirror[] = {RA_COND_EQ, RA_COND_GT, RA_COND_LT, RA_COND_GEQ, RA_COND_LEQ};
+    Expression_t *e1, *e2;
+    chidb_dbm_op_t *op;
+    enum CondType t = cond->t;
+    list_t skips;   // Jumps to the op after this condition
+    int rc = CHIDB_OK, r1, r2;
+
+    list_init(&skips);
+    switch(t)
+    {
+        case RA_COND_AND:
+        case RA_COND_OR:
+            // AND with sense false and OR with sense true jump on either
+            if(sense == (t == RA_COND_OR))
+            {
+                if((rc = chidb_stmt_where_branch(w, cond->cond.binary.cond1, sense, jumps)) == CHIDB_OK)
+                    rc = chidb_stmt_where_branch(w, cond->cond.binary.cond2, sense, jumps);
+                break;
+            }
+            if((rc = chidb_stmt_where_branch(w, cond->cond.binary.cond1, !sense, &skips)) == CHIDB_OK)
+                rc = chidb_stmt_where_branch(w, cond->cond.binary.cond2, sense, jumps);
+            break;
+
+        case RA_COND_NOT:
+            rc = chidb_stmt_where_branch(w, cond->cond.unary.cond, !sense, jumps);
+            break;
+
+        case RA_COND_IN:
+            // An OR of comparisons with each value. With sense false, the
+            // last comparison jumps if the column is not equal to it.
+            if((rc = chidb_stmt_where_operand(w, cond->cond.in.expr, &r1)) != CHIDB_OK)
+                break;
+            for(Literal_t *v = cond->cond.in.values_list; v != NULL && rc == CHIDB_OK; v = v->next)
+            {
+                r2 = w->reg++;
+                if((op = chidb_stmt_load_value(v, r2)) == NULL)
+                {
+                    rc = CHIDB_EINVALIDSQL;
+                    break;
+                }
+                list_append(&w->values, op);
+                op = chidb_make_op(sense || v->next != NULL ? Op_Eq : Op_Ne, r2, 0, r1, NULL);
+                list_append(&w->code, op);
+                list_append(sense || v->next == NULL ? jumps : &skips, op);
+            }
+            break;
+
+        case RA_COND_EQ:
+        case RA_COND_LT:
+        case RA_COND_GT:
+        case RA_COND_LEQ:
+        case RA_COND_GEQ:
+            e1 = cond->cond.comp.expr1;
+            e2 = cond->cond.comp.expr2;
+            if(e1->t == EXPR_TERM && e1->expr.term.t != TERM_COLREF
+                    && e2->t == EXPR_TERM && e2->expr.term.t == TERM_COLREF)
+            {
+                e1 = cond->cond.comp.expr2;
+                e2 = cond->cond.comp.expr1;
+                t = mirror[t];
+            }
+            if((rc = chidb_stmt_where_operand(w, e1, &r1)) != CHIDB_OK
+                    || (rc = chidb_stmt_where_operand(w, e2, &r2)) != CHIDB_OK)
+                break;
+            op = chidb_make_op(sense ? jump_if[t] : jump_unless[t], r2, 0, r1, NULL);
+            list_append(&w->code, op);
+            list_append(jumps, op);
+            break;
+    }
+
+    chidb_stmt_where_land(w, &skips);
+    list_destroy(&skips);
+
+    return rc;
+}
+
+/* The code of chidb_stmt_where and chidb_stmt_where_deferred */
+static int chidb_stmt_where_compile(chidb_stmt_where_t *w, list_t *ops, list_t *conds)
+{
+    chidb_dbm_op_t *noop = NULL;
+    list_t skips;
+    int i, n, skip, rc = CHIDB_OK;
+
+    for(i = 0; i < list_size(ops) && noop == NULL; i++)
+    {
+        chidb_dbm_op_t *op = list_get_at(ops, i);
+        int last = chidb_stmt_op_last_reg(op);
+        if(op->opcode == Op_Noop)
+        {
+            noop = op;
+            w->pos = i;
+        }
+        if(last >= w->reg)
+            w->reg = last + 1;
+    }
+    for(; i < list_size(ops); i++)
+    {
+        int last = chidb_stmt_op_last_reg(list_get_at(ops, i));
+        if(last >= w->reg)
+            w->reg = last + 1;
+    }
+    if(noop == NULL)
+        return CHIDB_EINVALIDSQL;
+
+    if((rc = chidb_optimize_where(w->db, w->tables[0], w->tables[1], conds)) != CHIDB_OK)
+        return rc;
+
+    // conditions on the index entry first, in the same order
+    if(w->xcur >= 0)
+        for(i = 0, n = 0; i < list_size(conds); i++)
+            if(chidb_stmt_where_indexed(w, list_get_at(conds, i)))
+                list_insert_at(conds, list_extract_at(conds, i), n++);
+
+    list_init(&w->values);
+    list_init(&w->code);
+    list_init(&skips);
+    for(i = 0; i < list_size(conds) && rc == CHIDB_OK; i++)
+        rc = chidb_stmt_where_branch(w, list_get_at(conds, i), false, &skips);
+
+    if(rc == CHIDB_OK)
+    {
+        // where the Noop skipped to, once it is replaced with the code
+        skip = noop->p2 + list_size(&w->code) - 1;
+        while(!list_empty(&skips))
+            ((chidb_dbm_op_t *) list_fetch(&skips))->p2 = skip;
+        chidb_stmt_splice_ops(ops, w->pos, 1, &w->code);
+        chidb_stmt_splice_ops(ops, 0, 0, &w->values);
+    }
+
+    while(!list_empty(&w->code))
+        free(list_fetch(&w->code));
+    while(!list_empty(&w->values))
+        free(list_fetch(&w->values));
+    list_destroy(&w->code);
+    list_destroy(&w->values);
+    list_destroy(&skips);
+
+    return rc;
+}
+
+/* WHERE code generation, for conditions other than column OP value
+ *
+ * The program has a Noop where the WHERE goes, with the address of the
+ * op to go to for rows that do not match it in p2. The Noop is replaced
+ * with ops that test each condition ANDed in the WHERE (in the order
+ * chidb_optimize_where puts them in), and skip the row as soon as one
+ * does not hold. The values compared to are loaded once, before the
+ * program, in registers that it does not use. For example, a = 1 AND
+ * (b < c OR NOT d = 'x') becomes
+ *
+ *          Integer 1 v1, String 1 v2 'x'
+ *          ...
+ *          Column t a r1
+ *          Ne v1 SKIP r1
+ *          Column t b r2
+ *          Column t c r3
+ *          Lt r3 MATCH r2
+ *          Column t d r4
+ *          Eq v2 SKIP r4
+ *   MATCH: ...
+ *
+ * Parameters
+ * - db: The database
+ * - ops: The program
+ * - conds: The conditions ANDed in the WHERE (Condition_t *)
+ * - tables: Tables the columns are in (tables[1] is NULL if there is
+ *           only one)
+ * - cursors: Cursors the rows of those tables are read with
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_EINVALIDSQL: A column does not exist, or a condition is not
+ *                      supported
+ */
+static int chidb_stmt_where(chidb *db, list_t *ops, list_t *conds, char *tables[2], int cursors[2])
+{
+    chidb_stmt_where_t w = {.db = db, .tables = {tables[0], tables[1]}, .cursors = {cursors[0], cursors[1]},
+                            .xcur = -1, .xpos = -1};
+
+    return chidb_stmt_where_compile(&w, ops, conds);
+}
+
+/* Same as chidb_stmt_where, for the rows of a table that are found with
+ * an index (on the column at position xpos) and sought in the table
+ * with DeferredSeek
+ *
+ * The primary key and the indexed column are loaded from the index
+ * entry, and the conditions that need no other column are tested first
+ * (keeping the order chidb_optimize_where puts them in otherwise), so
+ * that the rows they rule out are never read from the table.
+ */
+static int chidb_stmt_where_deferred(chidb *db, list_t *ops, list_t *conds, char *table, int tcur,
+                                     int xcur, int xpos)
+{
+    chidb_stmt_where_t w = {.db = db, .tables = {table, NULL}, .cursors = {tcur, 0},
+                            .xcur = xcur, .xpos = xpos};
+
+    return chidb_stmt_where_compile(&w, ops, conds);
+}
+
+/* Moves the conditions of a list that can be tested on the entries of an
+ * index on the column at position xpos of a table (the ones
+ * chidb_stmt_where_deferred tests first) to another list, in order */
+static void chidb_stmt_where_split(chidb *db, list_t *conds, char *table, int xpos, list_t *indexed)
+{
+    chidb_stmt_where_t w = {.db = db, .tables = {table, NULL}, .xcur = 0, .xpos = xpos};
+
+    for(int i = 0; i < list_size(conds); )
+        if(chidb_stmt_where_indexed(&w, list_get_at(conds, i)))
+            list_append(indexed, list_extract_at(conds, i));
+        else
+            i++;
+}
+
+
+/* GROUP BY and aggregate function code generation
+ *
+ * Turns a SELECT program that returns the input rows of the aggregation
+ * (nin columns, starting at first_reg) into one that aggregates them.
+ * Without GROUP BY, the accumulators are registers, every ResultRow
+ * becomes an AggStep on each of them, and a single row is returned once
+ * the program would halt:
+ *
+ *          [initialize the accumulators]
+ *          [the program, with AggStep instead of ResultRow, up to its Halt]
+ *          compute the selected columns from the accumulators
+ *          ResultRow, Halt
+ *
+ * With GROUP BY, the accumulators of each group are kept along with the
+ * GROUP BY columns in a hash table h (see dbm-hash.c). Every ResultRow
+ * then looks the group up (adding it, with the accumulators initialized,
+ * if it is new), steps its accumulators and stores them back, and the
+ * groups are returned once the program would halt:
+ *
+ *          OpenHash h ngroup 1
+ *          [initialize the accumulators]
+ *          [the program, with HashGroup, HashColumn, AggStep and HashUpdate
+ *           instead of ResultRow, up to its Halt]
+ *          HashRewind h END
+ *    LOOP: compute the selected columns from the row of h
+ *          ResultRow
+ *          HashNextRow h LOOP
+ *     END: Close h, Halt
+ *
+ * Returns the first register of the rows the new program returns.
+ */
+static int chidb_stmt_select_aggregate(list_t *ops, chidb_stmt_agg_t *agg, int first_reg, int nin)
+{
+    bool grouped = agg->ngroup > 0;
+    int ngroup = agg->ngroup, nacc = agg->nacc;
+    int i, pos, loop_off, hcur = 0;
+    chidb_dbm_op_t *op, *rewind = NULL;
+    list_t code;
+
+    // Registers: the constant 1 (what COUNT(*) counts), the key of the
+    // group, the initial accumulators (so that key and accumulators can be
+    // inserted as one row), the accumulators and the result row, past
+    // any register the program uses (a WHERE may use some past the rows)
+    int one = first_reg + nin, key, init, acc, out;
+
+    for(i = 0; i < list_size(ops); i++)
+    {
+        op = list_get_at(ops, i);
+        if((op->opcode == Op_OpenRead || op->opcode == Op_OpenWrite || op->opcode == Op_OpenHash
+                || op->opcode == Op_SorterOpen) && op->p1 >= hcur)
+            hcur = op->p1 + 1;
+        if(chidb_stmt_op_last_reg(op) >= one)
+            one = chidb_stmt_op_last_reg(op) + 1;
+    }
+    key = one + 1;
+    init = key + ngroup;
+    acc = grouped ? init + nacc : init;
+    out = acc + nacc;
+
+    list_init(&code);
+
+    // *** Every input row is added to the aggregates ***
+    for(pos = 0; pos < list_size(ops); pos++)
+    {
+        op = list_get_at(ops, pos);
+        if(op->opcode != Op_ResultRow)
+            continue;
+
+        if(grouped)
+        {
+            for(i = 0; i < ngroup; i++)
+                list_append(&code, chidb_make_op(Op_SCopy, first_reg + i, key + i, 0, NULL));
+            list_append(&code, chidb_make_op(Op_HashGroup, hcur, key, ngroup + nacc, NULL));
+            for(i = 0; i < nacc; i++)
+                list_append(&code, chidb_make_op(Op_HashColumn, hcur, ngroup + i, acc + i, NULL));
+        }
+        for(i = 0; i < nacc; i++)
+            if(agg->acc_input[i] < 0)
+            {
+                list_append(&code, chidb_make_op(Op_Integer, 1, one, 0, NULL));
+                break;
+            }
+        for(i = 0; i < nacc; i++)
+            list_append(&code, chidb_make_op(Op_AggStep, agg->acc_input[i] < 0 ? one : first_reg + agg->acc_input[i],
+                                             acc + i, agg->acc_func[i], NULL));
+        if(grouped && nacc > 0)
+            list_append(&code, chidb_make_op(Op_HashUpdate, hcur, acc, nacc, NULL));
+
+        int n = list_size(&code);
+        chidb_stmt_splice_ops(ops, pos, 1, &code);
+        pos += n - 1;
+    }
+
+    // *** Then the results are returned instead of halting ***
+    pos = list_size(ops) - 1;
+    if(grouped)
+    {
+        rewind = chidb_make_op(Op_HashRewind, hcur, 0, 0, NULL);
+        list_append(&code, rewind);
+    }
+    loop_off = pos + list_size(&code);
+    for(i = 0; i < agg->ncols; i++)
+    {
+        int a = agg->col_pos[i];
+        if(agg->col_func[i] < 0)
+            list_append(&code, chidb_make_op(Op_HashColumn, hcur, a, out + i, NULL));
+        else if(grouped && agg->col_func[i] == FUNC_AVG)
+        {
+            list_append(&code, chidb_make_op(Op_HashColumn, hcur, ngroup + a, out + i, NULL));
+            list_append(&code, chidb_make_op(Op_HashColumn, hcur, ngroup + a + 1, acc, NULL));
+            list_append(&code, chidb_make_op(Op_Divide, out + i, acc, out + i, NULL));
+        }
+        else if(grouped)
+            list_append(&code, chidb_make_op(Op_HashColumn, hcur, ngroup + a, out + i, NULL));
+        else if(agg->col_func[i] == FUNC_AVG)
+            list_append(&code, chidb_make_op(Op_Divide, acc + a, acc + a + 1, out + i, NULL));
+        else
+            list_append(&code, chidb_make_op(Op_SCopy, acc + a, out + i, 0, NULL));
+    }
+    list_append(&code, chidb_make_op(Op_ResultRow, out, agg->ncols, 0, NULL));
+    if(grouped)
+    {
+        list_append(&code, chidb_make_op(Op_HashNextRow, hcur, loop_off, 0, NULL));
+        rewind->p2 = pos + list_size(&code);
+        list_append(&code, chidb_make_op(Op_Close, hcur, 0, 0, NULL));
+    }
+    list_append(&code, chidb_make_op(Op_Halt, 0, 0, 0, NULL));
+    chidb_stmt_splice_ops(ops, pos, 1, &code);
+
+    // *** And the accumulators start out empty ***
+    if(grouped)
+        list_append(&code, chidb_make_op(Op_OpenHash, hcur, ngroup, 1, NULL));
+    for(i = 0; i < nacc; i++)
+        if(agg->acc_func[i] == AGG_COUNT)
+            list_append(&code, chidb_make_op(Op_Integer, 0, init + i, 0, NULL));
+        else
+            list_append(&code, chidb_make_op(Op_Null, 0, init + i, 0, NULL));
+    chidb_stmt_splice_ops(ops, 0, 0, &code);
+
+    list_destroy(&code);
+
+    return out;
+}
+
+
+/* LIMIT and OFFSET code generation
+ *
+ * Counts down the rows a SELECT program returns in two registers that it
+ * does not use: o, the rows still to be skipped, and l, the rows still to
+ * be returned. Every ResultRow becomes
+ *
+ *          IfPos o NEXT 1
+ *          ResultRow
+ *          DecrJumpZero l HALT
+ *    NEXT: ...
+ *
+ * so the program stops as soon as it has returned the last row, instead
+ * of running its loops to the end. If skip is true, the rows are read in
+ * order by a single scan of a table, with nothing to filter them, and the
+ * rows the offset skips are skipped by the cursor instead (Skip after its
+ * Rewind), without reading them.
+ */
+static void chidb_stmt_select_limit(list_t *ops, int limit, int offset, bool skip)
+{
+    int l = 0, o, i, pos, rewind = -1;
+    chidb_dbm_op_t *op;
+    list_t code;
 
-    // Now create the record
-    int reg = 1; // So we don't overwrite regs
-    values = sql_stmt->stmt.insert->values; // Need to put this back because we ruined it before
-    while(values != NULL)
+    // No rows at all
+    if(limit == 0)
     {
-        if(values->t == TYPE_INT)
-        {
-            chidb_dbm_op_t *next = chidb_make_op(Op_Integer, values->val.ival, reg, 0, NULL);
-            list_append(&ops, next);
-        }
-        else if(values->t == TYPE_TEXT)
-        {
-            chidb_dbm_op_t *next = chidb_make_op(Op_String, strlen(values->val.strval), reg, 0, values->val.strval);
-            list_append(&ops, next);
-        }
-        // Other values are unspported by chisql
-
-        if(reg==1) //The key slot in CHIDB needs to be null, as specified in the project spec
-        {
-            reg++;
-            chidb_dbm_op_t * next = chidb_make_op(Op_Null, 0, reg, 0, NULL);
-            list_append(&ops, next);
-            reg++;
-        }
-        else
-        {
-            reg++;
-        }
+        while(!list_empty(ops))
+            free(list_extract_at(ops, 0));
+        list_append(ops, chidb_make_op(Op_Halt, 0, 0, 0, NULL));
+        return;
+    }
 
-        values = values->next;
+    for(i = 0; i < list_size(ops); i++)
+    {
+        int last = chidb_stmt_op_last_reg(list_get_at(ops, i));
+        if(last >= l)
+            l = last + 1;
     }
+    o = l + 1;
 
-    // Create record from r1 through (r1+n-1), store in r2
-    // *NOTE: the primary key will always be first
-    chidb_dbm_op_t *make = chidb_make_op(Op_MakeRecord,2,reg-2,reg, NULL);
-    list_append(&ops, make);
+    for(i = 0; skip && i < list_size(ops) && rewind < 0; i++)
+        if(((chidb_dbm_op_t *) list_get_at(ops, i))->opcode == Op_Rewind)
+            rewind = i;
+    skip = rewind >= 0;
 
-    // Cursor 0, record stored at reg+1, the first one is the primary key
-    chidb_dbm_op_t *insert = chidb_make_op(Op_Insert,0,reg,1, NULL);
-    list_append(&ops, insert);
-    // Close Cursor 0
-    chidb_dbm_op_t *close = chidb_make_op(Op_Close,0,0,0,NULL);
-    list_append(&ops, close);
+    list_init(&code);
 
-    // Finally, transfer the list of ops into an array of ops, and fix it all up in the actual stmt
-    int numOps = list_size(&ops);
-    int i;
-    for(i = 0; i < numOps; i++)
+    for(pos = 0; pos < list_size(ops); pos++)
     {
-        chidb_dbm_op_t *next = (chidb_dbm_op_t *)list_get_at(&ops, i);
-        chidb_stmt_set_op(stmt, next, i);
-        // There seems to be a leak having to do with set_op but I can't figure out how to plug it...
+        op = list_get_at(ops, pos);
+        if(op->opcode != Op_ResultRow)
+            continue;
+
+        int n = (offset > 0 && !skip) ? 3 : 2;
+        int halt = list_size(ops) - 1 + n - 1;
+        if(n == 3)
+            list_append(&code, chidb_make_op(Op_IfPos, o, pos + n, 1, NULL));
+        list_append(&code, chidb_make_op(Op_ResultRow, op->p1, op->p2, 0, NULL));
+        list_append(&code, chidb_make_op(Op_DecrJumpZero, l, halt, 0, NULL));
+        chidb_stmt_splice_ops(ops, pos, 1, &code);
+        pos += n - 1;
     }
 
-    //Free everything! 
-    chidb_dbm_op_t *op_free;
-    while(!list_empty(&ops))
+    if(offset > 0 && skip)
     {
-        op_free = (chidb_dbm_op_t *)list_fetch(&ops);
-        free(op_free->p4);
-        free(op_free);
+        op = list_get_at(ops, rewind);
+        list_append(&code, chidb_make_op(Op_Skip, op->p1, 0, o, NULL));
+        chidb_stmt_splice_ops(ops, rewind + 1, 0, &code);
+        // past the last entry is where Rewind goes for an empty table
+        ((chidb_dbm_op_t *) list_get_at(ops, rewind + 1))->p2 = op->p2;
     }
 
-    list_destroy(&ops);
-    list_destroy(&cnames);
+    list_append(&code, chidb_make_op(Op_Integer, limit, l, 0, NULL));
+    if(offset > 0)
+        list_append(&code, chidb_make_op(Op_Integer, offset, o, 0, NULL));
+    chidb_stmt_splice_ops(ops, 0, 0, &code);
 
-    return CHIDB_OK;
+    list_destroy(&code);
 }
 
+
 /********************** Step 2: Simple Select Code Generation ***********************/
 
 /* 
@@ -338,7 +2419,7 @@ int chidb_stmt_select(chidb_stmt *stmt, chisql_statement_t *sql_stmt)
                 sra_next = NULL; // Table doesnt have next but we're at end
 
                 // Check to see if the table exists
-                if(chidb_table_exists(stmt->db->schemas, sra_table1->ref->table_name))
+                if(chidb_table_exists(stmt->db, sra_table1->ref->table_name))
                 {
                     // chilog error: table does not exist
                     fprintf(stderr, "%s\n", "esql: 333");
@@ -349,7 +2430,7 @@ int chidb_stmt_select(chidb_stmt *stmt, chisql_statement_t *sql_stmt)
                 list_append(&tnames, strdup(sra_table1->ref->table_name));
 
                 // Populate cnames1 list with column names of table1
-                chidb_column_names(stmt->db->schemas, list_get_at(&tnames, 0), &cnames1);
+                chidb_column_names(stmt->db, list_get_at(&tnames, 0), &cnames1);
                 break;
 
             case SRA_PROJECT:
@@ -378,7 +2459,7 @@ int chidb_stmt_select(chidb_stmt *stmt, chisql_statement_t *sql_stmt)
                 while(list_iterator_hasnext(&tnames))
                 {
                     next_name = (char *)list_iterator_next(&tnames);
-                    if(chidb_table_exists(stmt->db->schemas,next_name))
+                    if(chidb_table_exists(stmt->db,next_name))
                     {
                         // chilog warning!! table doesn't exist
                         fprintf(stderr, "%s\n", "fuck");
@@ -389,8 +2470,8 @@ int chidb_stmt_select(chidb_stmt *stmt, chisql_statement_t *sql_stmt)
                 list_iterator_stop(&tnames);
 
                 // Populate cnames1 and cnames2 list with column names of t1 and t2 respectively
-                chidb_column_names(stmt->db->schemas, list_get_at(&tnames, 0), &cnames1);
-                chidb_column_names(stmt->db->schemas, list_get_at(&tnames, 1), &cnames2);
+                chidb_column_names(stmt->db, list_get_at(&tnames, 0), &cnames1);
+                chidb_column_names(stmt->db, list_get_at(&tnames, 1), &cnames2);
                 break;
 
             default:
@@ -402,7 +2483,15 @@ int chidb_stmt_select(chidb_stmt *stmt, chisql_statement_t *sql_stmt)
 
     // ----------select columns error checking and upstream expansion----------
 
-    char *first_col = sra_project->expr_list->expr.term.ref->columnName;
+    // With aggregates, the select names are the columns they read, and
+    // the names of the columns returned are in onames
+    bool aggregate = chidb_stmt_select_has_aggregates(sra_project);
+    chidb_stmt_agg_t agg;
+    list_t onames;
+    list_t *rnames = aggregate ? &onames : &snames;
+    list_init(&onames);
+
+    char *first_col = aggregate ? "" : sra_project->expr_list->expr.term.ref->columnName;
 
     Expression_t *expr_next = sra_project->expr_list;
     while(expr_next != NULL)
@@ -419,8 +2508,19 @@ int chidb_stmt_select(chidb_stmt *stmt, chisql_statement_t *sql_stmt)
         chidb_stmt_select_star_expand(sra_project, cnames1, cnames2);
     }
 
+    if(aggregate)
+    {
+        if(chidb_stmt_select_agg_plan(sra_project, &snames, &agg) != CHIDB_OK)
+        {
+            chidb_stmt_agg_free(&agg);
+            return CHIDB_EINVALIDSQL;
+        }
+        for(int i = 0; i < agg.ncols; i++)
+            list_append(&onames, agg.names[i]);
+    }
+
     // Populate the select names list 
-    expr_next = sra_project->expr_list;
+    expr_next = aggregate ? NULL : sra_project->expr_list;
     while(expr_next != NULL)
     {
         // Add to the select names list
@@ -430,6 +2530,185 @@ int chidb_stmt_select(chidb_stmt *stmt, chisql_statement_t *sql_stmt)
         expr_next = expr_next->next;
     }
 
+    // ------------------------ORDER BY column---------------------------------
+
+    Expression_t *order_by = sra_project->order_by;
+    bool desc = sra_project->asc_desc == ORDER_BY_DESC;
+    bool sorted = true, hidden = false;
+    int order_pos = -1;
+
+    if(order_by != NULL)
+    {
+        if(order_by->t != EXPR_TERM || order_by->expr.term.t != TERM_COLREF)
+            return CHIDB_EINVALIDSQL;
+
+        // A column that is not selected is still needed to sort by
+        // (unless there are aggregates, which can only sort what they return)
+        sorted = false;
+        order_pos = chidb_column_position(rnames, order_by->expr.term.ref->columnName);
+        if(order_pos < 0 && aggregate)
+        {
+            chidb_stmt_agg_free(&agg);
+            return CHIDB_EINVALIDSQL;
+        }
+        else if(aggregate)
+            sorted = agg.ngroup == 0;
+        else if(order_pos < 0)
+        {
+            order_pos = list_size(&snames);
+            list_append(&snames, order_by->expr.term.ref->columnName);
+            hidden = true;
+        }
+    }
+
+    // --------------------COUNT(*) of a whole table---------------------------
+
+    if(aggregate && sra_select == NULL && sra_table2 == NULL && chidb_stmt_agg_count_only(&agg))
+    {
+        chidb_stmt_select_count(stmt, list_get_at(&tnames, 0), &cnames1, &agg, &ops);
+        if(sra_project->limit >= 0)
+            chidb_stmt_select_limit(&ops, sra_project->limit, sra_project->offset, false);
+        int rc = chidb_stmt_select_finish(stmt, &ops, &onames, 1);
+
+        list_destroy(&tnames);
+        list_destroy(&cnames1);
+        list_destroy(&cnames2);
+        list_destroy(&snames);
+        list_destroy(&onames);
+        list_destroy(&ops);
+        chidb_stmt_agg_free(&agg);
+
+        return rc;
+    }
+
+    // ---------------------------WHERE condition------------------------------
+
+    // The joins and access paths are chosen for a comparison of a column
+    // with a value. Any other condition is split into the conditions it
+    // ANDs, which are tested on the rows (see chidb_stmt_where), except
+    // for one that the rows of a single table can be found by.
+    Condition_t *access = sra_select != NULL ? sra_select->cond : NULL;
+    list_t conds;
+    list_init(&conds);
+
+    if(access != NULL && !chidb_stmt_cond_simple(access))
+    {
+        chidb_stmt_conjuncts(access, &conds);
+        access = NULL;
+    }
+
+    // ------------------------choosing a join method--------------------------
+
+    chidb_join_plan_t plan = {JOIN_NESTED_LOOP, 0, NULL, 0, false};
+
+    if(sra_table2 != NULL && list_empty(&conds))
+    {
+        list_t common;
+        list_init(&common);
+        list_iterator_start(&cnames1);
+        while(list_iterator_hasnext(&cnames1))
+        {
+            next_name = (char *)list_iterator_next(&cnames1);
+            if(chidb_column_position(&cnames2, next_name) >= 0)
+                list_append(&common, next_name);
+        }
+        list_iterator_stop(&cnames1);
+
+        int ret = chidb_optimize_join(stmt->db, list_get_at(&tnames, 0), list_get_at(&tnames, 1), &common,
+                                      access, &snames, &plan);
+        list_destroy(&common);
+        if(ret != CHIDB_OK)
+            return CHIDB_EINVALIDSQL;
+    }
+
+    // ------------------------choosing an access path-------------------------
+
+    chidb_access_path_t path = {ACCESS_SCAN, 0, false, false};
+
+    if(sra_table2 == NULL && access != NULL)
+        chidb_optimize_access(stmt->db, list_get_at(&tnames, 0), access, &snames, &path);
+
+    // a seek by the primary key is preferred to seeks of a list of keys,
+    // and those to a seek in an index
+    for(int i = 0; sra_table2 == NULL && i < list_size(&conds) && path.method != ACCESS_PKEY; i++)
+    {
+        Condition_t *cond = list_get_at(&conds, i);
+        chidb_access_path_t p;
+
+        if(!chidb_stmt_cond_simple(cond) && cond->t != RA_COND_IN)
+            continue;
+        chidb_optimize_access(stmt->db, list_get_at(&tnames, 0), cond, &snames, &p);
+        if(p.method == ACCESS_PKEY || (p.method == ACCESS_KEYS && path.method != ACCESS_KEYS)
+                || (p.method == ACCESS_INDEX && path.method == ACCESS_SCAN))
+        {
+            path = p;
+            access = cond;
+        }
+    }
+    if(access != NULL && !list_empty(&conds))
+    {
+        // the other conditions are tested on the rows of the table
+        list_delete_at(&conds, list_locate(&conds, access));
+        path.covering = path.covering && list_empty(&conds);
+    }
+
+    // -----------------------skipping the sort if we can----------------------
+
+    if(!sorted && sra_table2 == NULL && !aggregate)
+    {
+        chidb_optimize_order(stmt->db, list_get_at(&tnames, 0), access,
+                             &path, order_by->expr.term.ref->columnName, desc, &sorted);
+        if(sorted && hidden)
+        {
+            list_delete_at(&snames, order_pos);
+            hidden = false;
+        }
+    }
+
+    // A sorted fetch returns the rows in primary key order, so it is not
+    // done if they must come out in the order of the index: for an ORDER
+    // BY it does without a sort, or for a LIMIT to stop early at
+    if(sorted && (order_by != NULL || sra_project->limit >= 0))
+        path.sorted_fetch = false;
+
+    if(plan.method != JOIN_NESTED_LOOP || path.method != ACCESS_SCAN)
+    {
+        int first_reg, ret;
+        if(plan.method == JOIN_HASH)
+            ret = chidb_stmt_select_hash_join(stmt, sra_select, &tnames, &cnames1, &cnames2,
+                                              &snames, plan.inner, &ops, &first_reg);
+        else if(plan.method == JOIN_INDEX)
+            ret = chidb_stmt_select_index_join(stmt, sra_select, &tnames, &cnames1, &cnames2,
+                                               &snames, &plan, &ops, &first_reg);
+        else if(path.method == ACCESS_KEYS)
+            ret = chidb_stmt_select_keys(stmt, access, &conds, list_get_at(&tnames, 0), &cnames1,
+                                         &snames, &ops, &first_reg);
+        else
+            ret = chidb_stmt_select_access(stmt, access, &conds, list_get_at(&tnames, 0), &cnames1,
+                                           &snames, &path, &ops, &first_reg);
+        if(ret == CHIDB_OK && aggregate)
+            first_reg = chidb_stmt_select_aggregate(&ops, &agg, first_reg, list_size(&snames));
+        if(ret == CHIDB_OK && !sorted)
+            chidb_stmt_select_sort(&ops, rnames, first_reg, order_pos, desc, hidden,
+                                   chidb_stmt_sort_limit(sra_project));
+        if(ret == CHIDB_OK && sra_project->limit >= 0)
+            chidb_stmt_select_limit(&ops, sra_project->limit, sra_project->offset, false);
+        if(ret == CHIDB_OK)
+            ret = chidb_stmt_select_finish(stmt, &ops, rnames, first_reg);
+
+        list_destroy(&tnames);
+        list_destroy(&cnames1);
+        list_destroy(&cnames2);
+        list_destroy(&snames);
+        list_destroy(&onames);
+        list_destroy(&ops);
+        list_destroy(&conds);
+        if(aggregate)
+            chidb_stmt_agg_free(&agg);
+
+        return ret;
+    }
+
     // =========================== CODEGEN SECTION ============================
 
     // *** Initialization ***
@@ -469,7 +2748,9 @@ int chidb_stmt_select(chidb_stmt *stmt, chisql_statement_t *sql_stmt)
     enum CondType comp_op; 
 
     // *** If we have a where, insert the comp value at first instruction ***
-    if(sra_select != NULL)
+    // (any other condition is compiled once the program is done)
+    bool compiled = !list_empty(&conds);
+    if(sra_select != NULL && !compiled)
     {
         comp_column = sra_select->cond->cond.comp.expr1->expr.term.ref;
         comp_value = sra_select->cond->cond.comp.expr2->expr.term.val;
@@ -480,31 +2761,12 @@ int chidb_stmt_select(chidb_stmt *stmt, chisql_statement_t *sql_stmt)
         comp_val_reg = 0;
         comp_col_reg = 1;
 
-        switch(comp_value->t)
+        if((new_op = chidb_stmt_load_value(comp_value, comp_val_reg)) == NULL)
         {
-            case TYPE_INT:
-                new_op = chidb_make_op(Op_Integer,
-                                       comp_value->val.ival,
-                                       comp_val_reg,
-                                       0,
-                                       NULL);
-                list_append(&ops, new_op);
-                break;
-
-            case TYPE_TEXT:
-                new_op = chidb_make_op(Op_String, 
-                                       strlen(comp_value->val.strval), 
-                                       comp_val_reg, 
-                                       0, 
-                                       comp_value->val.strval);
-                list_append(&ops, new_op);
-                break;
-
-            default:
-                fprintf(stderr, "%s\n", "esql: 476");
-                return CHIDB_EINVALIDSQL; // Not supported otherwise
-
+            fprintf(stderr, "%s\n", "esql: 476");
+            return CHIDB_EINVALIDSQL; // Not supported otherwise
         }
+        list_append(&ops, new_op);
 
         // Update the offset of open
         open_off = 1;
@@ -524,11 +2786,11 @@ int chidb_stmt_select(chidb_stmt *stmt, chisql_statement_t *sql_stmt)
         c1_reg = 2; // Gets 2 register if column doing where on is not selected
 
     // Get root page of first table
-    root = chidb_get_root(stmt->db->schemas, list_get_at(&tnames, 0));
+    root = chidb_get_root(stmt->db, list_get_at(&tnames, 0));
 
     // Insert page into register we are opening the cursor on, open for reading
     list_append(&ops, chidb_make_op(Op_Integer, root, c1_reg, 0, NULL));
-    list_append(&ops, chidb_make_op(Op_OpenRead, c1_reg, c1_reg, list_size(&cnames1), NULL));
+    list_append(&ops, chidb_make_op(Op_OpenRead, c1_reg, c1_reg, list_size(&cnames1), chidb_catalog_schema(stmt->db, list_get_at(&tnames, 0))));
 
     // Update rewind offset
     rewind_off = open_off + 2;
@@ -538,10 +2800,10 @@ int chidb_stmt_select(chidb_stmt *stmt, chisql_statement_t *sql_stmt)
     {
         c2_reg = c1_reg + 1;
 
-        root = chidb_get_root(stmt->db->schemas, list_get_at(&tnames,1));
+        root = chidb_get_root(stmt->db, list_get_at(&tnames,1));
 
         list_append(&ops, chidb_make_op(Op_Integer, root, c2_reg, 0, NULL));
-        list_append(&ops, chidb_make_op(Op_OpenRead, c2_reg, c2_reg, list_size(&cnames2), NULL));
+        list_append(&ops, chidb_make_op(Op_OpenRead, c2_reg, c2_reg, list_size(&cnames2), chidb_catalog_schema(stmt->db, list_get_at(&tnames, 1))));
         rewind_off += 2; // Leave rewind offset at first rewind for now
     }
 
@@ -555,17 +2817,23 @@ int chidb_stmt_select(chidb_stmt *stmt, chisql_statement_t *sql_stmt)
     }
 
     // *** Revisiting the case if we have a where ***
-    if(sra_select != NULL)
+    if(compiled)
+    {
+        // Placeholder for the condition, which skips to next like the comparison
+        comp_off = rewind_off + 1;
+        list_append(&ops, chidb_make_op(Op_Noop, 0, 0, 0, NULL));
+    }
+    else if(sra_select != NULL)
     {
         // Update the comparison offset
         comp_off = rewind_off + 2;
 
         // Get the column position to get the column with op_key or op_column
-        col_pos = chidb_column_position(&cnames1, comp_column->columnName);
+        col_pos = chidb_column_get_position(stmt->db, list_get_at(&tnames, 0), comp_column->columnName);
         col_c_reg = c1_reg; 
         if(sra_table2 != NULL && col_pos < 0) // if not found in first table
         {
-            col_pos = chidb_column_position(&cnames2, comp_column->columnName);
+            col_pos = chidb_column_get_position(stmt->db, list_get_at(&tnames, 1), comp_column->columnName);
             col_c_reg = c2_reg;
         }
         if(col_pos < 0) // Error checking (not found in either table)
@@ -576,34 +2844,14 @@ int chidb_stmt_select(chidb_stmt *stmt, chisql_statement_t *sql_stmt)
         }
 
         // Add the op to grab the column
-        if(col_pos == 0)
-            new_op = chidb_make_op(Op_Key, col_c_reg, comp_col_reg, 0, NULL);
-        else
-            new_op = chidb_make_op(Op_Column, col_c_reg, col_pos, comp_col_reg, NULL);
-        list_append(&ops, new_op); // Actually add
+        chidb_stmt_load_column(&ops, col_c_reg, col_pos, comp_col_reg);
 
         // Add the op to make the comparison. needs to be updated with jump to next later.
-        switch(comp_op)
+        if((new_op = chidb_stmt_skip_unless(comp_op, comp_val_reg, comp_col_reg)) == NULL)
         {
-            case RA_COND_EQ:
-                new_op = chidb_make_op(Op_Ne, comp_val_reg, 0, comp_col_reg, NULL);
-                break;
-            case RA_COND_LT:
-                new_op = chidb_make_op(Op_Ge, comp_val_reg, 0, comp_col_reg, NULL);
-                break;
-            case RA_COND_GT:
-                new_op = chidb_make_op(Op_Le, comp_val_reg, 0, comp_col_reg, NULL);
-                break;
-            case RA_COND_LEQ:
-                new_op = chidb_make_op(Op_Gt, comp_val_reg, 0, comp_col_reg, NULL);
-                break;
-            case RA_COND_GEQ:
-                new_op = chidb_make_op(Op_Lt, comp_val_reg, 0, comp_col_reg, NULL);
-                break;
-            default:
-                // Our implementation of chidb does not support the other options
-                fprintf(stderr, "%s\n", "esql: 579");
-                return CHIDB_EINVALIDSQL;
+            // Our implementation of chidb does not support the other options
+            fprintf(stderr, "%s\n", "esql: 579");
+            return CHIDB_EINVALIDSQL;
         }
         list_append(&ops, new_op); // Actually add
     }
@@ -626,14 +2874,15 @@ int chidb_stmt_select(chidb_stmt *stmt, chisql_statement_t *sql_stmt)
         comp_nj_t1_reg = c2_reg + 1; // We share with first_col_reg
         comp_nj_t2_reg = c2_reg + 2;
 
-        // Count number of common columns and add the ops to list
+        // Count number of common columns and add the ops to list. All
+        // of them are compared, whether they are selected or not.
         num_common_cols = 0;
-        list_iterator_start(&snames);
-        while(list_iterator_hasnext(&snames))
+        list_iterator_start(&cnames1);
+        while(list_iterator_hasnext(&cnames1))
         {
-            next_name = (char *)list_iterator_next(&snames);
-            col_pos = chidb_column_position(&cnames1, next_name);
-            col_pos2 = chidb_column_position(&cnames2, next_name);
+            next_name = (char *)list_iterator_next(&cnames1);
+            col_pos = chidb_column_get_position(stmt->db, list_get_at(&tnames, 0), next_name);
+            col_pos2 = chidb_column_get_position(stmt->db, list_get_at(&tnames, 1), next_name);
             if(col_pos >=0 && col_pos2 >=0)
             {
                 num_common_cols++;
@@ -656,7 +2905,7 @@ int chidb_stmt_select(chidb_stmt *stmt, chisql_statement_t *sql_stmt)
                 list_append(&ops, chidb_make_op(Op_Ne, comp_nj_t1_reg, 0, comp_nj_t2_reg, NULL));
             }
         }
-        list_iterator_stop(&snames);
+        list_iterator_stop(&cnames1);
     }
 
     // *** Column and result row ops! ***
@@ -694,14 +2943,14 @@ int chidb_stmt_select(chidb_stmt *stmt, chisql_statement_t *sql_stmt)
         next_col_name = (char *)list_iterator_next(&snames);
 
         // Get the column position to get the column with op_key or op_column
-        col_pos = chidb_column_position(&cnames1, next_col_name);
+        col_pos = chidb_column_get_position(stmt->db, list_get_at(&tnames, 0), next_col_name);
         
         col_c_reg = c1_reg;
  
         if(sra_table2 != NULL && col_pos < 0) // If not found in first table
         {
             // fprintf(stderr, "%s\n", "Considering second column\n");
-            col_pos = chidb_column_position(&cnames2, next_col_name);
+            col_pos = chidb_column_get_position(stmt->db, list_get_at(&tnames, 1), next_col_name);
             col_c_reg = c2_reg;
         }
         
@@ -793,38 +3042,39 @@ int chidb_stmt_select(chidb_stmt *stmt, chisql_statement_t *sql_stmt)
 
     // ======================== END CODEGEN SECTION ===========================
 
-    // ------------------convert instructions to stmt struct------------------
-    int j;
-    for(j = 0; j < list_size(&ops); j++)
+    int ret = CHIDB_OK;
+    if(compiled)
     {
-        chidb_dbm_op_t *next = (chidb_dbm_op_t *)list_get_at(&ops, j);
-        chidb_stmt_set_op(stmt, next, j);
-        
-        // should be able to free the op now...
-        free(next);
+        char *tables[2] = {list_get_at(&tnames, 0), sra_table2 != NULL ? list_get_at(&tnames, 1) : NULL};
+        int cursors[2] = {c1_reg, c2_reg};
+        ret = chidb_stmt_where(stmt->db, &ops, &conds, tables, cursors);
     }
-    // ------------------convert column names from list to array--------------
 
-    char **cols = malloc(sizeof(char *) * list_size(&snames));
-    for(j=0; j < list_size(&snames); j++)
-    {
-        cols[j] = strdup(list_get_at(&snames, j)); 
-    }
+    // ------------------convert instructions to stmt struct------------------
+    if(ret == CHIDB_OK && aggregate)
+        first_col_reg = chidb_stmt_select_aggregate(&ops, &agg, first_col_reg, list_size(&snames));
+    if(ret == CHIDB_OK && !sorted)
+        chidb_stmt_select_sort(&ops, rnames, first_col_reg, order_pos, desc, hidden,
+                               chidb_stmt_sort_limit(sra_project));
+    if(ret == CHIDB_OK && sra_project->limit >= 0)
+        chidb_stmt_select_limit(&ops, sra_project->limit, sra_project->offset,
+                                sra_select == NULL && sra_table2 == NULL && !aggregate && sorted);
+    if(ret == CHIDB_OK)
+        ret = chidb_stmt_select_finish(stmt, &ops, rnames, first_col_reg);
 
-    // -------------------- fill in rest of stmt struct ----------------------
-    stmt->nRR = list_size(&snames);
-    stmt->startRR = first_col_reg;
-    stmt->nCols = list_size(&snames);
-    stmt->cols = cols;
     // --------------------convenience list destruction-----------------------
 
     list_destroy(&tnames); 
     list_destroy(&cnames1);
     list_destroy(&cnames2);
     list_destroy(&snames);
+    list_destroy(&onames);
     list_destroy(&ops);
+    list_destroy(&conds);
+    if(aggregate)
+        chidb_stmt_agg_free(&agg);
 
-    return CHIDB_OK;
+    return ret;
 }
 
 int chidb_stmt_select_star_expand(SRA_Project_t *sra_project, list_t names, list_t names2)
@@ -930,6 +3180,437 @@ int chidb_stmt_select_star_expand(SRA_Project_t *sra_project, list_t names, list
 }
 
 
+/* Splits the WHERE condition of a DELETE or an UPDATE, which goes
+ * through the whole table. A comparison of a column with a value is
+ * left in *cond, and *pos is set to the column, so that it can be tested
+ * like in a SELECT. Any other condition is split into conds, to be
+ * compiled by chidb_stmt_where, and *cond is set to NULL.
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_EINVALIDSQL: The column does not exist, or the comparison is
+ *                      not supported
+ */
+static int chidb_stmt_scan_where(chidb_stmt *stmt, char *table, Condition_t **cond, int *pos, list_t *conds)
+{
+    Expression_t *col, *val;
+
+    *pos = -1;
+    if(*cond == NULL)
+        return CHIDB_OK;
+
+    if(!chidb_stmt_cond_simple(*cond))
+    {
+        chidb_stmt_conjuncts(*cond, conds);
+        *cond = NULL;
+        return CHIDB_OK;
+    }
+
+    col = (*cond)->cond.comp.expr1;
+    val = (*cond)->cond.comp.expr2;
+    if((*cond)->t > RA_COND_GEQ || col->t != EXPR_TERM || col->expr.term.t != TERM_COLREF
+            || val->t != EXPR_TERM || val->expr.term.t != TERM_LITERAL)
+        return CHIDB_EINVALIDSQL;
+    if((*pos = chidb_column_get_position(stmt->db, table, col->expr.term.ref->columnName)) < 0)
+        return CHIDB_EINVALIDSQL;
+
+    return CHIDB_OK;
+}
+
+/* Appends the test of a condition split by chidb_stmt_scan_where to the
+ * loop over the table (cursor 0), with its value in r0 and its column
+ * loaded into r1. Returns the op that skips the row, whose address has
+ * to be filled in, or NULL if there is no condition. */
+static chidb_dbm_op_t *chidb_stmt_scan_test(list_t *ops, Condition_t *cond, int pos, list_t *conds)
+{
+    chidb_dbm_op_t *where_op = NULL;
+
+    if(cond != NULL)
+    {
+        chidb_stmt_load_column(ops, 0, pos, 1);
+        where_op = chidb_stmt_skip_unless(cond->t, 0, 1);
+        list_append(ops, where_op);
+    }
+    else if(!list_empty(conds))
+    {
+        where_op = chidb_make_op(Op_Noop, 0, 0, 0, NULL);
+        list_append(ops, where_op);
+    }
+
+    return where_op;
+}
+
+/* Turns the ops generated for a DELETE or an UPDATE into the statement's
+ * program, once the conditions in conds are compiled into it */
+static int chidb_stmt_scan_finish(chidb_stmt *stmt, list_t *ops, list_t *conds, char *table)
+{
+    chidb_dbm_prog_t prog;
+    int i, rc = CHIDB_OK;
+
+    if(!list_empty(conds))
+    {
+        char *tables[2] = {table, NULL};
+        int cursors[2] = {0, 0};
+        rc = chidb_stmt_where(stmt->db, ops, conds, tables, cursors);
+    }
+    if(rc == CHIDB_OK)
+        chidb_stmt_peephole(ops);
+
+    chidb_dbm_prog_init(&prog);
+    for(i = 0; i < list_size(ops); i++)
+    {
+        chidb_dbm_op_t *next = list_get_at(ops, i);
+        if(rc == CHIDB_OK)
+            chidb_dbm_prog_emit(&prog, next->opcode, next->p1, next->p2, next->p3, next->p4);
+        free(next);
+    }
+    if(rc == CHIDB_OK)
+        rc = chidb_dbm_prog_finish(&prog, stmt);
+    else
+        chidb_dbm_prog_free(&prog);
+
+    return rc;
+}
+
+
+/* DELETE code generation
+ *
+ * Goes through the whole table, and deletes the rows that match the
+ * WHERE condition (if any). A comparison of a column with a value is
+ * tested like in a SELECT, and any other condition is compiled by
+ * chidb_stmt_where. The entry for the row in each index on the table is
+ * deleted first (see chidb_dbm_op_IdxDelete).
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_EINVALIDSQL: The table or the column don't exist, or the
+ *                      condition is not supported
+ */
+static int chidb_stmt_delete(chidb_stmt *stmt, chisql_statement_t *sql_stmt)
+{
+    Delete_t *del = sql_stmt->stmt.delete;
+    Condition_t *cond = del->where;
+    chidb_dbm_op_t *rewind, *where_op;
+    list_t ops, cnames, conds;
+    int *indexes, nindexes = 0;
+    int where_pos, i, rc;
+
+    if(chidb_table_exists(stmt->db, del->table_name) != CHIDB_OK)
+        return CHIDB_EINVALIDSQL;
+
+    // Conditions other than column OP value are compiled once the
+    // program is done
+    list_init(&conds);
+    if((rc = chidb_stmt_scan_where(stmt, del->table_name, &cond, &where_pos, &conds)) != CHIDB_OK)
+    {
+        list_destroy(&conds);
+        return rc;
+    }
+
+    // Registers: WHERE value and column, primary key, index key, and the
+    // root pages (the table's in r4, and then the indexes', in the same
+    // order as the cursors)
+    list_init(&ops);
+    list_init(&cnames);
+    chidb_column_names(stmt->db, del->table_name, &cnames);
+    if((indexes = malloc(list_size(&cnames) * sizeof(int))) == NULL)
+    {
+        list_destroy(&ops);
+        list_destroy(&cnames);
+        list_destroy(&conds);
+        return CHIDB_ENOMEM;
+    }
+
+    if(cond != NULL)
+    {
+        chidb_dbm_op_t *load = chidb_stmt_load_value(cond->cond.comp.expr2->expr.term.val, 0);
+        if(load == NULL)
+        {
+            list_destroy(&ops);
+            list_destroy(&cnames);
+            list_destroy(&conds);
+            free(indexes);
+            return CHIDB_EINVALIDSQL;
+        }
+        list_append(&ops, load);
+    }
+
+    list_append(&ops, chidb_make_op(Op_Integer, chidb_get_root(stmt->db, del->table_name), 4, 0, NULL));
+    list_append(&ops, chidb_make_op(Op_OpenWrite, 0, 4, list_size(&cnames), NULL));
+    for(i = 0; i < list_size(&cnames); i++)
+    {
+        chidb_sql_schema_t *index = chidb_catalog_column_index(stmt->db, del->table_name, list_get_at(&cnames, i));
+        int cursor = nindexes + 1;
+
+        if(index == NULL)
+            continue;
+        indexes[nindexes++] = i;
+        list_append(&ops, chidb_make_op(Op_Integer, index->rpage, 4 + cursor, 0, NULL));
+        list_append(&ops, chidb_make_op(Op_OpenWrite, cursor, 4 + cursor, 0, NULL));
+    }
+
+    rewind = chidb_make_op(Op_Rewind, 0, 0, 0, NULL);
+    list_append(&ops, rewind);
+    int loop_off = list_size(&ops);
+
+    where_op = chidb_stmt_scan_test(&ops, cond, where_pos, &conds);
+    if(nindexes > 0)
+        list_append(&ops, chidb_make_op(Op_Key, 0, 2, 0, NULL));
+    for(i = 0; i < nindexes; i++)
+    {
+        chidb_stmt_load_column(&ops, 0, indexes[i], 3);
+        list_append(&ops, chidb_make_op(Op_IdxDelete, i + 1, 3, 2, NULL));
+    }
+    list_append(&ops, chidb_make_op(Op_Delete, 0, 0, 0, NULL));
+
+    if(where_op != NULL)
+        where_op->p2 = list_size(&ops);
+    list_append(&ops, chidb_make_op(Op_Next, 0, loop_off, 0, NULL));
+    rewind->p2 = list_size(&ops);
+    for(i = 0; i <= nindexes; i++)
+        list_append(&ops, chidb_make_op(Op_Close, i, 0, 0, NULL));
+
+    rc = chidb_stmt_scan_finish(stmt, &ops, &conds, del->table_name);
+    list_destroy(&ops);
+    list_destroy(&cnames);
+    list_destroy(&conds);
+    free(indexes);
+
+    return rc;
+}
+
+
+/* Appends the op that loads the new value of a column SET by an UPDATE.
+ * The value can be a literal, NULL, a parameter, or a column of the row
+ * (as it was before the update), of the same type as the column.
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_EINVALIDSQL: The value is not supported, or has another type
+ */
+static int chidb_stmt_update_value(chidb_stmt *stmt, list_t *ops, char *table, char *col,
+                                   Expression_t *value, int reg)
+{
+    int type = chidb_column_get_type(stmt->db, table, col);
+    ColumnReference_t *ref;
+    chidb_dbm_op_t *load;
+    int pos;
+
+    if(value->t != EXPR_TERM)
+        return CHIDB_EINVALIDSQL;
+
+    switch(value->expr.term.t)
+    {
+        case TERM_NULL:
+            list_append(ops, chidb_make_op(Op_Null, 0, reg, 0, NULL));
+            return CHIDB_OK;
+        case TERM_LITERAL:
+            // Parameters can be bound to a value of any type
+            if(value->expr.term.val->t != type && value->expr.term.val->t != TYPE_PARAM)
+                return CHIDB_EINVALIDSQL;
+            if((load = chidb_stmt_load_value(value->expr.term.val, reg)) == NULL)
+                return CHIDB_EINVALIDSQL;
+            list_append(ops, load);
+            return CHIDB_OK;
+        case TERM_COLREF:
+            ref = value->expr.term.ref;
+            if(ref->tableName != NULL && !chidb_catalog_qualifies(stmt->db, ref->tableName, table))
+                return CHIDB_EINVALIDSQL;
+            if((pos = chidb_column_get_position(stmt->db, table, ref->columnName)) < 0
+                    || chidb_column_get_type(stmt->db, table, ref->columnName) != type)
+                return CHIDB_EINVALIDSQL;
+            chidb_stmt_load_column(ops, 0, pos, reg);
+            return CHIDB_OK;
+        default:
+            return CHIDB_EINVALIDSQL;
+    }
+}
+
+/* UPDATE code generation
+ *
+ * Goes through the whole table like a DELETE, and replaces the record of
+ * each row that matches the WHERE condition with one made of the new
+ * values of the columns that are SET and the old values of the others.
+ * The new record is written over the old one when it fits in the leaf
+ * (see chidb_dbm_cursor_update), so most updates only write that page.
+ * Only the indexes on columns that are SET are opened: the entry for
+ * the old value is deleted before the row is updated, and the one for
+ * the new value is added after.
+ *
+ * With t's root in r4, the roots of the n indexes in r5 to r(4+n), and
+ * the new row starting at r, the program looks like this:
+ *
+ *          [load WHERE value]
+ *          Integer t r4, OpenWrite 0 r4, Integer/OpenWrite each index
+ *          Rewind 0 END
+ *    LOOP: [skip to NEXT unless the WHERE holds]
+ *          Key 0 r2
+ *          load the new row into r, r+1, ... (r is NULL, the key's slot)
+ *          load the old value of each indexed column into r3, IdxDelete
+ *          MakeRecord r ncols rec
+ *          Update 0 rec
+ *          IdxInsert each index, with its new value
+ *    NEXT: Next 0 LOOP
+ *     END: Close each cursor
+ *
+ * The primary key cannot be SET: the scan is in primary key order, and
+ * would find a row again if its key moved past it.
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_EINVALIDSQL: The table or a column don't exist, a column is
+ *                      SET twice, the primary key is SET, or a value or
+ *                      the condition is not supported
+ */
+static int chidb_stmt_update(chidb_stmt *stmt, chisql_statement_t *sql_stmt)
+{
+    Update_t *update = sql_stmt->stmt.update;
+    Condition_t *cond = update->where;
+    chidb_dbm_op_t *rewind, *where_op;
+    list_t ops, cnames, conds;
+    Expression_t **values = NULL;
+    int *indexes = NULL, nindexes = 0;
+    int where_pos, ncols, first, i, rc;
+
+    if(chidb_table_exists(stmt->db, update->table_name) != CHIDB_OK)
+        return CHIDB_EINVALIDSQL;
+
+    list_init(&ops);
+    list_init(&conds);
+    list_init(&cnames);
+    chidb_column_names(stmt->db, update->table_name, &cnames);
+    ncols = list_size(&cnames);
+
+    // The new value of each column, or NULL if it is not SET
+    values = calloc(ncols, sizeof(Expression_t *));
+    indexes = malloc(ncols * sizeof(int));
+    rc = (values == NULL || indexes == NULL) ? CHIDB_ENOMEM : CHIDB_OK;
+
+    Expression_t *value = update->values;
+    for(StrList_t *col = update->col_names; col != NULL && rc == CHIDB_OK; col = col->next, value = value->next)
+    {
+        int pos = chidb_column_get_position(stmt->db, update->table_name, col->str);
+
+        if(pos <= 0 || values[pos] != NULL)
+            rc = CHIDB_EINVALIDSQL;
+        else
+            values[pos] = value;
+    }
+
+    if(rc == CHIDB_OK)
+        rc = chidb_stmt_scan_where(stmt, update->table_name, &cond, &where_pos, &conds);
+
+    if(rc == CHIDB_OK && cond != NULL)
+    {
+        chidb_dbm_op_t *load = chidb_stmt_load_value(cond->cond.comp.expr2->expr.term.val, 0);
+        if(load == NULL)
+            rc = CHIDB_EINVALIDSQL;
+        else
+            list_append(&ops, load);
+    }
+
+    if(rc != CHIDB_OK)
+    {
+        while(!list_empty(&ops))
+            free(list_fetch(&ops));
+        list_destroy(&ops);
+        list_destroy(&cnames);
+        list_destroy(&conds);
+        free(values);
+        free(indexes);
+        return rc;
+    }
+
+    // Registers: WHERE value and column, primary key, old index key, the
+    // root pages (the table's in r4, and then the indexes', in the same
+    // order as the cursors), the new row, and its record
+    list_append(&ops, chidb_make_op(Op_Integer, chidb_get_root(stmt->db, update->table_name), 4, 0, NULL));
+    list_append(&ops, chidb_make_op(Op_OpenWrite, 0, 4, ncols, NULL));
+    for(i = 1; i < ncols; i++)
+    {
+        chidb_sql_schema_t *index;
+        int cursor = nindexes + 1;
+
+        if(values[i] == NULL)
+            continue;
+        if((index = chidb_catalog_column_index(stmt->db, update->table_name, list_get_at(&cnames, i))) == NULL)
+            continue;
+        indexes[nindexes++] = i;
+        list_append(&ops, chidb_make_op(Op_Integer, index->rpage, 4 + cursor, 0, NULL));
+        list_append(&ops, chidb_make_op(Op_OpenWrite, cursor, 4 + cursor, 0, NULL));
+    }
+    first = 5 + nindexes;
+
+    rewind = chidb_make_op(Op_Rewind, 0, 0, 0, NULL);
+    list_append(&ops, rewind);
+    int loop_off = list_size(&ops);
+
+    where_op = chidb_stmt_scan_test(&ops, cond, where_pos, &conds);
+    if(nindexes > 0)
+        list_append(&ops, chidb_make_op(Op_Key, 0, 2, 0, NULL));
+    list_append(&ops, chidb_make_op(Op_Null, 0, first, 0, NULL));
+    for(i = 1; i < ncols && rc == CHIDB_OK; i++)
+    {
+        if(values[i] == NULL)
+            list_append(&ops, chidb_make_op(Op_Column, 0, i, first + i, NULL));
+        else
+            rc = chidb_stmt_update_value(stmt, &ops, update->table_name, list_get_at(&cnames, i),
+                                         values[i], first + i);
+    }
+    for(i = 0; i < nindexes; i++)
+    {
+        chidb_stmt_load_column(&ops, 0, indexes[i], 3);
+        list_append(&ops, chidb_make_op(Op_IdxDelete, i + 1, 3, 2, NULL));
+    }
+    list_append(&ops, chidb_make_op(Op_MakeRecord, first, ncols, first + ncols, NULL));
+    list_append(&ops, chidb_make_op(Op_Update, 0, first + ncols, 0, NULL));
+    for(i = 0; i < nindexes; i++)
+        list_append(&ops, chidb_make_op(Op_IdxInsert, i + 1, first + indexes[i], 2, NULL));
+
+    if(where_op != NULL)
+        where_op->p2 = list_size(&ops);
+    list_append(&ops, chidb_make_op(Op_Next, 0, loop_off, 0, NULL));
+    rewind->p2 = list_size(&ops);
+    for(i = 0; i <= nindexes; i++)
+        list_append(&ops, chidb_make_op(Op_Close, i, 0, 0, NULL));
+
+    if(rc == CHIDB_OK)
+        rc = chidb_stmt_scan_finish(stmt, &ops, &conds, update->table_name);
+    else
+        while(!list_empty(&ops))
+            free(list_fetch(&ops));
+    list_destroy(&ops);
+    list_destroy(&cnames);
+    list_destroy(&conds);
+    free(values);
+    free(indexes);
+
+    return rc;
+}
+
+
+/* Does a statement write to a table of an attached database, or create
+ * one in it? Attached databases are only read from (see ATTACH in api.c) */
+static bool chidb_stmt_writes_attached(chidb *db, chisql_statement_t *sql_stmt)
+{
+    switch(sql_stmt->type)
+    {
+        case STMT_CREATE:
+            if(sql_stmt->stmt.create->t == CREATE_INDEX)
+                return chidb_catalog_schema(db, sql_stmt->stmt.create->index->name) != NULL
+                    || chidb_catalog_schema(db, sql_stmt->stmt.create->index->table_name) != NULL;
+            return chidb_catalog_schema(db, sql_stmt->stmt.create->table->name) != NULL;
+        case STMT_INSERT:
+            return chidb_catalog_schema(db, sql_stmt->stmt.insert->table_name) != NULL;
+        case STMT_DELETE:
+            return chidb_catalog_schema(db, sql_stmt->stmt.delete->table_name) != NULL;
+        case STMT_UPDATE:
+            return chidb_catalog_schema(db, sql_stmt->stmt.update->table_name) != NULL;
+        default:
+            return false;
+    }
+}
+
 //Main function that calls all the helpers
 int chidb_stmt_codegen(chidb_stmt *stmt, chisql_statement_t *sql_stmt)
 {
@@ -939,18 +3620,12 @@ int chidb_stmt_codegen(chidb_stmt *stmt, chisql_statement_t *sql_stmt)
     if (chidb_stmt_check(stmt, sql_stmt, tables) != CHIDB_OK)
         return CHIDB_EINVALIDSQL;
 
-    //Refresh the in-memory schema table if necessary
-    if(stmt->db->need_refresh == 1) {
-        list_iterator_start(&(stmt->db->schemas));
-        while(list_iterator_hasnext(&(stmt->db->schemas)))
-        {
-            chidb_sql_schema_t *next = (chidb_sql_schema_t *)(list_iterator_next(&(stmt->db->schemas)));
-            free(next);
-        }
-        list_iterator_stop(&(stmt->db->schemas));
-        list_destroy(&(stmt->db->schemas));
+    if (chidb_stmt_writes_attached(stmt->db, sql_stmt))
+        return CHIDB_EINVALIDSQL;
 
-        list_init(&(stmt->db->schemas));
+    //Refresh the in-memory schema table if necessary. Only the
+    //entries added since it was last loaded are read.
+    if(stmt->db->need_refresh == 1) {
         load_schema(stmt->db,1);
         stmt->db->need_refresh = 0;
 
@@ -969,6 +3644,12 @@ int chidb_stmt_codegen(chidb_stmt *stmt, chisql_statement_t *sql_stmt)
         case STMT_INSERT: 
             ret =  chidb_stmt_insert(stmt, sql_stmt);
             break;
+        case STMT_DELETE:
+            ret =  chidb_stmt_delete(stmt, sql_stmt);
+            break;
+        case STMT_UPDATE:
+            ret =  chidb_stmt_update(stmt, sql_stmt);
+            break;
     }
 
     return ret;
@@ -0,0 +1,157 @@
+/*
+ *  chidb - a didactic relational database management system
+ *
+ *  Arena allocator for the Database Machine
+ *
+ */
+
+/*
+ *  Copyright (c) 2009-2015, The University of Chicago
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or withsend
+ *  modification, are permitted provided that the following conditions are met:
+ *
+ *  - Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ *  - Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ *  - Neither the name of The University of Chicago nor the names of its
+ *    contributors may be used to endorse or promote products derived from this
+ *    software withsend specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ *  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ *  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ *  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ *  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ *  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ *  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ *  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ *  ARISING IN ANY WAY send OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ *  POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+/*
+ * Arenas are used for memory that lives as long as something else does,
+ * and can all be let go of at the same time: the rows of a hash table
+ * live until the table is freed, and the values a statement copies into
+ * its registers (see reg_space in dbm-ops.c) live until the statement is
+ * reset or finalized. Instead of a malloc and a free per value, memory
+ * comes out of large chunks, and the chunks are freed (or reused) all at
+ * once.
+ *
+ * Resetting an arena keeps its most recent chunk, unless it was made for
+ * a single large allocation, so a statement that is run again and again
+ * does not have to go back to malloc at all.
+ */
+
+#include <stdlib.h>
+#include "dbm-arena.h"
+
+
+/* Initialize an empty arena. Nothing is allocated until it is used.
+ *
+ * Parameters
+ * - arena: Arena to initialize
+ * - chunk_size: Size of the chunks. Larger allocations get a chunk
+ *               of their own.
+ */
+void chidb_dbm_arena_init(chidb_dbm_arena_t *arena, uint32_t chunk_size)
+{
+    arena->chunks = NULL;
+    arena->chunk_size = chunk_size;
+}
+
+/* Allocate memory from an arena
+ *
+ * The memory is aligned for any of the types the DBM stores in it, and
+ * is valid until the arena is reset or freed.
+ *
+ * Parameters
+ * - arena: Arena
+ * - size: Number of bytes
+ *
+ * Return
+ * - Pointer to the memory, or NULL if it could not be allocated
+ */
+void *chidb_dbm_arena_alloc(chidb_dbm_arena_t *arena, uint32_t size)
+{
+    chidb_dbm_arena_chunk_t *chunk = arena->chunks;
+
+    size = (size + 7) & ~7u;
+
+    if (chunk == NULL || chunk->size - chunk->used < size)
+    {
+        uint32_t chunk_size = size > arena->chunk_size ? size : arena->chunk_size;
+
+        if ((chunk = malloc(sizeof(chidb_dbm_arena_chunk_t) + chunk_size)) == NULL)
+            return NULL;
+        chunk->used = 0;
+        chunk->size = chunk_size;
+        chunk->next = arena->chunks;
+        arena->chunks = chunk;
+    }
+
+    void *p = chunk->data + chunk->used;
+    chunk->used += size;
+
+    return p;
+}
+
+/* Is p in memory allocated from an arena? */
+bool chidb_dbm_arena_owns(chidb_dbm_arena_t *arena, const void *p)
+{
+    for (chidb_dbm_arena_chunk_t *chunk = arena->chunks; chunk != NULL; chunk = chunk->next)
+        if ((const uint8_t *) p >= chunk->data && (const uint8_t *) p < chunk->data + chunk->used)
+            return true;
+
+    return false;
+}
+
+/* Let go of everything allocated from an arena, keeping a chunk to
+ * allocate from the next time it is used
+ *
+ * Parameters
+ * - arena: Arena to reset
+ */
+void chidb_dbm_arena_reset(chidb_dbm_arena_t *arena)
+{
+    chidb_dbm_arena_chunk_t *keep = NULL, *chunk, *next;
+
+    for (chunk = arena->chunks; chunk != NULL; chunk = next)
+    {
+        next = chunk->next;
+        if (keep == NULL && chunk->size == arena->chunk_size)
+            keep = chunk;
+        else
+            free(chunk);
+    }
+
+    if (keep != NULL)
+    {
+        keep->used = 0;
+        keep->next = NULL;
+    }
+    arena->chunks = keep;
+}
+
+/* Free all the memory of an arena. It is left empty, and can be used
+ * again. */
+void chidb_dbm_arena_free(chidb_dbm_arena_t *arena)
+{
+    chidb_dbm_arena_chunk_t *chunk, *next;
+
+    for (chunk = arena->chunks; chunk != NULL; chunk = next)
+    {
+        next = chunk->next;
+        free(chunk);
+    }
+
+    arena->chunks = NULL;
+}
@@ -0,0 +1,69 @@
+/*
+ *  chidb - a didactic relational database management system
+ *
+ *  Arena allocator for the Database Machine -- header
+ *
+ */
+
+/*
+ *  Copyright (c) 2009-2015, The University of Chicago
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or withsend
+ *  modification, are permitted provided that the following conditions are met:
+ *
+ *  - Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ *  - Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ *  - Neither the name of The University of Chicago nor the names of its
+ *    contributors may be used to endorse or promote products derived from this
+ *    software withsend specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ *  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ *  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ *  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ *  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ *  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ *  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ *  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ *  ARISING IN ANY WAY send OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ *  POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+#ifndef DBM_ARENA_H_
+#define DBM_ARENA_H_
+
+#include "chidbInt.h"
+
+/* A chunk of memory that allocations are carved out of */
+typedef struct chidb_dbm_arena_chunk
+{
+    struct chidb_dbm_arena_chunk *next;
+    uint32_t used;
+    uint32_t size;
+    uint8_t data[];
+} chidb_dbm_arena_chunk_t;
+
+/* An arena hands out memory that is never freed piece by piece, only all
+ * at once, by resetting or freeing the arena. Allocating is just moving
+ * a pointer forward in the current chunk. */
+typedef struct chidb_dbm_arena
+{
+    chidb_dbm_arena_chunk_t *chunks; // most recent first
+    uint32_t chunk_size;             // size of a new chunk
+} chidb_dbm_arena_t;
+
+void chidb_dbm_arena_init(chidb_dbm_arena_t *arena, uint32_t chunk_size);
+void *chidb_dbm_arena_alloc(chidb_dbm_arena_t *arena, uint32_t size);
+bool chidb_dbm_arena_owns(chidb_dbm_arena_t *arena, const void *p);
+void chidb_dbm_arena_reset(chidb_dbm_arena_t *arena);
+void chidb_dbm_arena_free(chidb_dbm_arena_t *arena);
+
+#endif /* DBM_ARENA_H_ */
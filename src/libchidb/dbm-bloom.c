@@ -0,0 +1,124 @@
+/*
+ *  chidb - a didactic relational database management system
+ *
+ *  Bloom filters for the Database Machine
+ *
+ */
+
+/*
+ *  Copyright (c) 2009-2015, The University of Chicago
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or withsend
+ *  modification, are permitted provided that the following conditions are met:
+ *
+ *  - Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ *  - Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ *  - Neither the name of The University of Chicago nor the names of its
+ *    contributors may be used to endorse or promote products derived from this
+ *    software withsend specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ *  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ *  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ *  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ *  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ *  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ *  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ *  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ *  ARISING IN ANY WAY send OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ *  POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+/*
+ * A Bloom filter answers "could this key be in the set?" without
+ * storing the keys: a key that was added is always found, and a key
+ * that was not is found only now and then (a false positive). The DBM
+ * uses one to skip probe rows of a hash join that cannot have a match
+ * (see chidb_dbm_hash_filter).
+ *
+ * The filter is blocked: all the bits of a key are in the same 64-bit
+ * word, so that a test touches a single word. The word, and three bits
+ * in it, are taken from the key's hash (mixed, so that hashes that only
+ * differ in a few bits are spread out). With BLOOM_BITS_PER_KEY bits
+ * per key, fewer than 1 in 100 keys that were not added are found.
+ */
+
+#include <stdlib.h>
+#include "dbm-bloom.h"
+
+#define BLOOM_BITS_PER_KEY (16)
+
+
+static uint64_t bloom_mix(uint32_t hash)
+{
+    return (hash | ((uint64_t) hash << 32)) * 0x9e3779b97f4a7c15ull;
+}
+
+static uint64_t bloom_bits(uint64_t x)
+{
+    return (1ull << (x & 63)) | (1ull << ((x >> 6) & 63)) | (1ull << ((x >> 12) & 63));
+}
+
+
+/* Initialize an empty filter
+ *
+ * Parameters
+ * - b: Filter
+ * - nkeys: Number of keys that will be added. The filter does not
+ *          grow, so more keys make for more false positives.
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_ENOMEM: Could not allocate memory
+ */
+int chidb_dbm_bloom_init(chidb_dbm_bloom_t *b, uint32_t nkeys)
+{
+    uint64_t nwords = 1;
+
+    while (nwords * 64 < (uint64_t) nkeys * BLOOM_BITS_PER_KEY)
+        nwords *= 2;
+
+    if ((b->words = calloc(nwords, sizeof(uint64_t))) == NULL)
+        return CHIDB_ENOMEM;
+    b->mask = nwords - 1;
+
+    return CHIDB_OK;
+}
+
+/* Free the memory of a filter. It can be initialized again. */
+void chidb_dbm_bloom_free(chidb_dbm_bloom_t *b)
+{
+    free(b->words);
+    b->words = NULL;
+    b->mask = 0;
+}
+
+/* Add a key, by its hash, to a filter */
+void chidb_dbm_bloom_add(chidb_dbm_bloom_t *b, uint32_t hash)
+{
+    uint64_t x = bloom_mix(hash);
+
+    b->words[(x >> 32) & b->mask] |= bloom_bits(x);
+}
+
+/* Could a key, by its hash, have been added to a filter?
+ *
+ * Return
+ * - false if it was not
+ * - true if it was, or (rarely) if it was not
+ */
+bool chidb_dbm_bloom_test(chidb_dbm_bloom_t *b, uint32_t hash)
+{
+    uint64_t x = bloom_mix(hash);
+    uint64_t bits = bloom_bits(x);
+
+    return (b->words[(x >> 32) & b->mask] & bits) == bits;
+}
@@ -0,0 +1,57 @@
+/*
+ *  chidb - a didactic relational database management system
+ *
+ *  Bloom filters for the Database Machine -- header
+ *
+ */
+
+/*
+ *  Copyright (c) 2009-2015, The University of Chicago
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or withsend
+ *  modification, are permitted provided that the following conditions are met:
+ *
+ *  - Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ *  - Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ *  - Neither the name of The University of Chicago nor the names of its
+ *    contributors may be used to endorse or promote products derived from this
+ *    software withsend specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ *  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ *  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ *  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ *  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ *  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ *  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ *  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ *  ARISING IN ANY WAY send OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ *  POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+#ifndef DBM_BLOOM_H_
+#define DBM_BLOOM_H_
+
+#include "chidbInt.h"
+
+/* A Bloom filter over 32-bit hashes (see dbm-bloom.c) */
+typedef struct chidb_dbm_bloom
+{
+    uint64_t *words;
+    uint32_t mask;                  // number of words - 1 (a power of two)
+} chidb_dbm_bloom_t;
+
+int chidb_dbm_bloom_init(chidb_dbm_bloom_t *b, uint32_t nkeys);
+void chidb_dbm_bloom_free(chidb_dbm_bloom_t *b);
+void chidb_dbm_bloom_add(chidb_dbm_bloom_t *b, uint32_t hash);
+bool chidb_dbm_bloom_test(chidb_dbm_bloom_t *b, uint32_t hash);
+
+#endif /* DBM_BLOOM_H_ */
@@ -39,222 +39,619 @@
 
 
 #include "dbm-cursor.h"
+#include "btree-cell.h"
+#include "dbm-hash.h"
+#include "dbm-sorter.h"
+#include "pager.h"
+
+/* Most pages passed to chidb_Pager_prefetch at once */
+#define READAHEAD_BATCH (32)
 
 int chidb_dbm_cursor_print(chidb_dbm_cursor_t *c)
 {
     fprintf(stderr, "\n");
     fprintf(stderr, "+++++++++ CURSOR PRINTOUT +++++++\n");
     fprintf(stderr, "Current Cell Type: %d\n", c->current_cell.type);
-    fprintf(stderr, "Current Key: %d\n", c->current_cell.key);
+    fprintf(stderr, "Current Key: %lli\n", (long long) c->current_cell.key);
     fprintf(stderr, "Root Page: %d\n", c->root_page);
     fprintf(stderr, "Root type: %d\n", c->root_type);
     fprintf(stderr, "Number of Columns: %d\n", c->n_cols);
     fprintf(stderr, "Cursor Type: %s\n", c->type == CURSOR_READ ? "read" : "write");
     fprintf(stderr, "====== Starting Trail Print ======\n");
 
-    chidb_dbm_cursor_trail_t *ct;
-    list_t *l = &(c->trail);
-    list_iterator_start(l);
-    while(list_iterator_hasnext(l))
+    for(uint32_t i = 0; i < c->depth; i++)
     {
-        ct = (chidb_dbm_cursor_trail_t *)list_iterator_next(l);
-        fprintf(stderr, "Depth: %d\n", ct->depth);
+        chidb_dbm_cursor_trail_t *ct = &c->trail[i];
+        fprintf(stderr, "Depth: %d\n", i);
         fprintf(stderr, "Number Current Cell: %d\n", ct->n_current_cell);
-        fprintf(stderr, "Page Number: %d\n", ct->btn->page->npage);
+        fprintf(stderr, "Page Number: %d\n", ct->btn.page->npage);
         fprintf(stderr, "-------------------------------\n");
     }
 
     fprintf(stderr, "+++++++++ DONE PRINTING CURSOR ++++++++++++\n");
     fprintf(stderr, "\n");
-    list_iterator_stop(l);
 
     return CHIDB_OK;
 }
 
-/* Creates a new cursor trail and allocates memory for it
+/* Adds a level to the bottom of the trail
+ *
+ * The node is loaded into the next slot of the trail array (no memory is
+ * allocated), and its page stays pinned until the level is popped.
  *
  * Return
  * - CHIDB_OK: Operation sucessful
- * - CHIDB_ENOMEM: Malloc failed
+ * - CHIDB_ECORRUPT: The tree is deeper than CURSOR_MAX_DEPTH
+ * - chidb_Pager_readPage return codes
  */
-int chidb_dbm_cursor_trail_new(BTree *bt, chidb_dbm_cursor_trail_t **ct, npage_t npage, uint32_t depth)
+int chidb_dbm_cursor_trail_push(BTree *bt, chidb_dbm_cursor_t *c, npage_t npage)
 {
-    (*ct) = malloc(sizeof(chidb_dbm_cursor_trail_t));
-    if((*ct)==NULL)
-        return CHIDB_ENOMEM;
+    MemPage *page;
+    int ret;
 
-    BTreeNode *btn;
-    int ret = chidb_Btree_getNodeByPage(bt, npage, &btn);
-    if(ret != CHIDB_OK)
+    if(c->depth == CURSOR_MAX_DEPTH)
+        return CHIDB_ECORRUPT;
+
+    if((ret = chidb_Pager_readPage(bt->pager, npage, &page)) != CHIDB_OK)
         return ret;
 
-    // populate!
-    (*ct)->depth = depth;
-    (*ct)->btn = btn;
-    (*ct)->n_current_cell = 0;
+    chidb_dbm_cursor_trail_t *ct = &c->trail[c->depth++];
+    chidb_Btree_loadNode(page, &ct->btn);
+    ct->n_current_cell = 0;
+    ct->readahead = 0;
+
+    // the page may have changed since the filter last read it
+    c->filter.npage = 0;
 
     return CHIDB_OK;
 }
 
-/* Frees a cursor trail.
- * expects that the type of elements in the list are cursor_trail *'s
+/* Removes the bottom level of the trail, releasing its page
  *
  * Return
  * - CHIDB_OK: Operation sucessful
  */
-int chidb_dbm_cursor_trail_list_destroy(BTree *bt, list_t *restrict l)
+int chidb_dbm_cursor_trail_pop(BTree *bt, chidb_dbm_cursor_t *c)
 {
-    // free all of the btn's held within the cursor trail structs and all of the trail structs
-    chidb_dbm_cursor_trail_t *ct;
+    if(c->depth == 0)
+        return CHIDB_OK;
+
+    c->depth--;
+    return chidb_Pager_releaseMemPage(bt->pager, c->trail[c->depth].btn.page);
+}
+
+/* Clears all elements NOT including depth
+ *
+ * If you want to clear the node too, just destroy the cursor and make a new one
+ * Return
+ * - CHIDB_OK: Operation sucessful
+ */
+int chidb_dbm_cursor_clear_trail_from(BTree *bt, chidb_dbm_cursor_t *c, uint32_t depth)
+{
+    while(c->depth > depth + 1)
+        chidb_dbm_cursor_trail_pop(bt, c);
+
+    return CHIDB_OK;
+}
+
+/* Resets the trail so that it only contains the root node
+ *
+ * The root is read again, so that changes made to the tree since the
+ * cursor was positioned are picked up.
+ *
+ * Return
+ * - CHIDB_OK: Operation sucessful
+ * - chidb_Pager_readPage return codes
+ */
+int chidb_dbm_cursor_reset(BTree *bt, chidb_dbm_cursor_t *c)
+{
+    c->record.valid = false;
+    c->deleted = false;
+    c->deferred = false;
+
+    while(c->depth > 0)
+        chidb_dbm_cursor_trail_pop(bt, c);
 
-    while(!list_empty(l))
+    return chidb_dbm_cursor_trail_push(bt, c, c->root_page);
+}
+
+/* Note where a cursor is (see chidb_dbm_cursor_restore) */
+void chidb_dbm_cursor_save(chidb_dbm_cursor_t *c, chidb_dbm_cursor_position_t *pos)
+{
+    pos->depth = c->depth;
+    for (uint32_t i = 0; i < c->depth; i++)
+    {
+        pos->npage[i] = c->trail[i].btn.page->npage;
+        pos->n_current_cell[i] = c->trail[i].n_current_cell;
+        pos->readahead[i] = c->trail[i].readahead;
+    }
+
+    pos->deleted = c->deleted;
+    pos->deferred = c->deferred;
+    pos->deferred_key = c->deferred_key;
+}
+
+/* Put a cursor back where chidb_dbm_cursor_save found it
+ *
+ * The trail is read again from the pages it was on, which are usually
+ * still in the buffer pool, and the record of the entry is decoded again
+ * when it is next read. This undoes a move that failed halfway (see
+ * chidb_dbm_run_async); the tree must not have changed since the save.
+ *
+ * Return
+ * - CHIDB_OK: Operation sucessful
+ * - chidb_Pager_readPage return codes
+ */
+int chidb_dbm_cursor_restore(BTree *bt, chidb_dbm_cursor_t *c, const chidb_dbm_cursor_position_t *pos)
+{
+    int rc;
+
+    while(c->depth > 0)
+        chidb_dbm_cursor_trail_pop(bt, c);
+
+    for (uint32_t i = 0; i < pos->depth; i++)
     {
-        ct = (chidb_dbm_cursor_trail_t *)list_fetch(l);
-        chidb_Btree_freeMemNode(bt, ct->btn);
-        free(ct);
+        if ((rc = chidb_dbm_cursor_trail_push(bt, c, pos->npage[i])) != CHIDB_OK)
+            return rc;
+        c->trail[i].n_current_cell = pos->n_current_cell[i];
+        c->trail[i].readahead = pos->readahead[i];
     }
 
-    // list_iterator_start(l);
-    // while(list_iterator_hasnext(l))
-    // {
-    //     ct = (chidb_dbm_cursor_trail_t *)list_iterator_next(l);
-    //     chidb_Btree_freeMemNode(bt, ct->btn);
-    //     // free(ct);
-    // }
-    // list_iterator_stop(l);
+    // current_cell pointed into the pages, which may have moved since
+    if (c->depth > 0)
+    {
+        chidb_dbm_cursor_trail_t *ct = CURSOR_TRAIL_TOP(c);
+        if (ct->n_current_cell >= 0 && ct->n_current_cell < ct->btn.n_cells)
+            chidb_Btree_getCell(&ct->btn, ct->n_current_cell, &c->current_cell);
+    }
 
-    list_destroy(l); // this frees all elements as per simclist.h
+    c->record.valid = false;
+    c->deleted = pos->deleted;
+    c->deferred = pos->deferred;
+    c->deferred_key = pos->deferred_key;
 
     return CHIDB_OK;
 }
 
-/* Makes a copy of a whole trail list
+/* Create a new cursor.
  *
  * Return
  * - CHIDB_OK: Operation sucessful
  * - CHIDB_ENOMEM: Malloc failed
  */
-int chidb_dbm_cursor_trail_cpy(BTree *bt, list_t *restrict l1, list_t *restrict l2)
+int chidb_dbm_cursor_init(BTree *bt, chidb_dbm_cursor_t *c, npage_t root_page, ncol_t n_cols)
 {
-    chidb_dbm_cursor_trail_t *ct_next, *ct_next_cpy;
-    BTreeNode *btncpy;
+    int rc;
 
-    // initialize the list we are copying to
-    list_init(l2);
+    // populate cursor
+    c->bt = bt;
+    c->root_page = root_page;
+    c->n_cols = n_cols;
+    c->depth = 0;
+    c->record.valid = false;
+    c->deleted = false;
+    c->deferred = false;
+    c->text = NULL;
+    c->text_size = 0;
+    c->payload = NULL;
+    c->payload_size = 0;
+    c->hash = NULL;
+    c->sorter = NULL;
+    memset(&c->filter, 0, sizeof(c->filter));
 
-    list_iterator_start(l1);
-    while(list_iterator_hasnext(l1))
+    // load up the root btree node
+    if((rc = chidb_dbm_cursor_trail_push(bt, c, root_page)) != CHIDB_OK)
+        return rc;
+
+    c->root_type = c->trail[0].btn.type;
+
+    return CHIDB_OK;
+}
+
+/* Free a cursor.
+ *
+ * Return
+ * - CHIDB_OK: Operation sucessful
+ */
+int chidb_dbm_cursor_destroy(BTree *bt, chidb_dbm_cursor_t *c)
+{
+    // release all of the pages held by the trail
+    while(c->depth > 0)
+        chidb_dbm_cursor_trail_pop(bt, c);
+
+    free(c->text);
+    c->text = NULL;
+    c->text_size = 0;
+
+    free(c->payload);
+    c->payload = NULL;
+    c->payload_size = 0;
+
+    free(c->filter.values);
+    free(c->filter.known);
+    free(c->filter.fails);
+    memset(&c->filter, 0, sizeof(c->filter));
+
+    if(c->hash != NULL)
     {
-        ct_next = (chidb_dbm_cursor_trail_t *)list_iterator_next(l1);
+        chidb_dbm_hash_free(c->hash);
+        c->hash = NULL;
+    }
 
-        // make a deep copy of the element
-        ct_next_cpy = malloc(sizeof(chidb_dbm_cursor_t));
-        if(ct_next_cpy == NULL)
-            return CHIDB_ENOMEM;
+    if(c->sorter != NULL)
+    {
+        chidb_dbm_sorter_free(c->sorter);
+        c->sorter = NULL;
+    }
 
-        ct_next_cpy->depth = ct_next->depth;
-        chidb_Btree_getNodeByPage(bt, ct_next->btn->page->npage, &btncpy);
-        ct_next_cpy->btn = btncpy;
-        ct_next_cpy->n_current_cell = ct_next->n_current_cell;
+    return CHIDB_OK;
+}
 
-        // append the new element to the new list
-        list_append(l2, ct_next_cpy);
+/* Read all the data of the current cell into the cursor's payload buffer
+ *
+ * Return
+ * - CHIDB_OK: Operation sucessful
+ * - CHIDB_ENOMEM: Malloc failed
+ * - chidb_Btree_readPayload return codes
+ */
+static int chidb_dbm_cursor_payload(BTree *bt, chidb_dbm_cursor_t *c)
+{
+    uint32_t size = c->current_cell.fields.tableLeaf.data_size;
+    int rc;
+
+    if(size > c->payload_size)
+    {
+        uint8_t *payload = realloc(c->payload, size);
+        if(payload == NULL)
+            return CHIDB_ENOMEM;
+        c->payload = payload;
+        c->payload_size = size;
     }
-    list_iterator_stop(l1);
+
+    if((rc = chidb_Btree_readPayload(bt, &c->current_cell, c->payload)) != CHIDB_OK)
+        return rc;
+    c->record.full = true;
 
     return CHIDB_OK;
 }
 
-/* Clears all elements NOT including depth
+/* Get the record in the cell the cursor is pointing to
+ *
+ * Only the header of the record is decoded, and only as far as the
+ * field asked for: the types of the fields before it are decoded once
+ * after the cursor moves, and those of the fields after it only if they
+ * are asked for later (so dbr->nfields is the number of fields decoded
+ * so far, and field is not in the record if it is not less than that).
+ * Scans that read a few columns of a wide table skip most of each
+ * header. The DBRecord belongs to the cursor: its data points into the
+ * cell, so it must not be destroyed, and it is only valid until the
+ * cursor moves.
+ *
+ * If the record continues in overflow pages, they are only read when a
+ * field past the part of the record in the page is asked for (or when
+ * field is -1, meaning the whole record). Until then, the data of the
+ * later fields is not there yet.
+ *
+ * A deferred seek is done first (see chidb_dbm_cursor_finishSeek).
  *
- * If you want to clear the node too, just destroy the cursor and make a new one
  * Return
  * - CHIDB_OK: Operation sucessful
+ * - CHIDB_ETYPE: The cursor is not pointing to a table cell
+ * - CHIDB_ENOMEM: Malloc failed
+ * - chidb_Btree_readPayload return codes
+ * - chidb_dbm_cursor_finishSeek return codes
  */
-int chidb_dbm_cursor_clear_trail_from(BTree *bt, chidb_dbm_cursor_t *c, uint32_t depth)
+int chidb_dbm_cursor_record(BTree *bt, chidb_dbm_cursor_t *c, int field, DBRecord **dbr)
 {
-    int i;
-    chidb_dbm_cursor_trail_t *ct;
+    chidb_dbm_cursor_record_t *r = &c->record;
+    BTreeCell *cell = &c->current_cell;
+    int rc;
+
+    if(c->deferred && (rc = chidb_dbm_cursor_finishSeek(bt, c)) != CHIDB_OK)
+        return rc;
+
+    // the cursor may have been moved in memory since the header was decoded
+    r->dbr.types = r->types;
+    r->dbr.offsets = r->offsets;
+
+    if(!r->valid)
+    {
+        if(cell->type != PGTYPE_TABLE_LEAF)
+            return CHIDB_ETYPE;
+
+        // a header too large for the part in the page needs everything
+        r->full = false;
+        if(cell->fields.tableLeaf.data[0] > cell->fields.tableLeaf.local_size
+                && (rc = chidb_dbm_cursor_payload(bt, c)) != CHIDB_OK)
+            return rc;
+
+        r->dbr.nfields = 0;
+        r->dbr.data_len = 0;
+        r->header_pos = 1;
+        r->valid = true;
+        CHIDB_COUNT(bt->stats.unpacked, 1);
+
+        // make room for every text field plus its terminator (the record,
+        // header included, is larger than that). This is the only point
+        // where the buffer can move, so strings handed out by
+        // chidb_dbm_cursor_text stay put until the cursor moves
+        uint32_t size = cell->fields.tableLeaf.data_size;
+        if(size > c->text_size)
+        {
+            char *text = realloc(c->text, size);
+            if(text == NULL)
+            {
+                r->valid = false;
+                return CHIDB_ENOMEM;
+            }
+            c->text = text;
+            c->text_size = size;
+        }
+    }
+
+    if(field < 0 || field >= r->dbr.nfields)
+        chidb_DBRecord_unpackHeaderTo(&r->dbr, r->full ? c->payload : cell->fields.tableLeaf.data,
+                                      &r->header_pos, field < 0 ? DBRECORD_MAX_FIELDS : field + 1);
 
-    for(i = list_size(&(c->trail))-1; i > depth; i--)
+    if(!r->full && cell->fields.tableLeaf.local_size < cell->fields.tableLeaf.data_size)
     {
-        ct = list_extract_at(&(c->trail), i); // remove element from list
+        uint32_t header_size = cell->fields.tableLeaf.data[0];
+        uint32_t end;
 
-        // free resources associated with the trail element
-        chidb_Btree_freeMemNode(bt, ct->btn);
-        free(ct);
+        if(field < 0 || field + 1 >= r->dbr.nfields)
+            end = r->dbr.data_len;
+        else
+            end = r->dbr.offsets[field + 1];
+
+        if(header_size + end > cell->fields.tableLeaf.local_size)
+        {
+            if((rc = chidb_dbm_cursor_payload(bt, c)) != CHIDB_OK)
+                return rc;
+            r->dbr.data = c->payload + header_size;
+        }
     }
+
+    *dbr = &r->dbr;
+
     return CHIDB_OK;
 }
 
-/* Clears the specific element at specified position
+/* Get a text field of the entry the cursor is pointing to
+ *
+ * Text is not NUL-terminated inside a record, so the field is copied into
+ * a buffer owned by the cursor, which is reused from entry to entry. The
+ * string must not be freed, and it is only valid until the cursor moves.
  *
  * Return
  * - CHIDB_OK: Operation sucessful
+ * - CHIDB_ETYPE: The field is not a text field
+ * - chidb_dbm_cursor_record return codes
  */
-int chidb_dbm_cursor_trail_remove_at(BTree *bt, chidb_dbm_cursor_t *c, uint32_t depth)
+int chidb_dbm_cursor_text(BTree *bt, chidb_dbm_cursor_t *c, uint8_t field, char **s)
 {
-    chidb_dbm_cursor_trail_t *ct = list_extract_at(&(c->trail), depth);
-    chidb_Btree_freeMemNode(bt, ct->btn);
-    free(ct);
+    DBRecord *dbr;
+    int len, ret;
+
+    if((ret = chidb_dbm_cursor_record(bt, c, field, &dbr)) != CHIDB_OK)
+        return ret;
+
+    if(field >= dbr->nfields || chidb_DBRecord_getType(dbr, field) != SQL_TEXT)
+        return CHIDB_ETYPE;
+
+    // each field gets its own slot, so several columns can be borrowed at once
+    chidb_DBRecord_getStringLength(dbr, field, &len);
+    *s = c->text + dbr->offsets[field] + field;
+    memcpy(*s, &dbr->data[dbr->offsets[field]], len);
+    (*s)[len] = '\0';
 
     return CHIDB_OK;
 }
 
-/* Create a new cursor.
+/* Get the text of the text index entry the cursor is pointing to
+ *
+ * Like chidb_dbm_cursor_text, the text is copied into the cursor's buffer
+ * and NUL-terminated, and it is only valid until the cursor moves.
  *
  * Return
  * - CHIDB_OK: Operation sucessful
+ * - CHIDB_ETYPE: The cursor is not pointing to a text index entry
  * - CHIDB_ENOMEM: Malloc failed
  */
-int chidb_dbm_cursor_init(BTree *bt, chidb_dbm_cursor_t *c, npage_t root_page, ncol_t n_cols)
+int chidb_dbm_cursor_keyText(BTree *bt, chidb_dbm_cursor_t *c, char **s)
 {
-    int rc;
-    BTreeNode *btn;
-    chidb_dbm_cursor_trail_t *ct;
+    BTreeCell *cell = &c->current_cell;
+    uint32_t len;
 
-    // allocate space for the root btn in the trail
-    ct = malloc(sizeof(chidb_dbm_cursor_trail_t));
-    if(ct == NULL)
-        return CHIDB_ENOMEM;
+    if(!PGTYPE_IS_TEXTINDEX(cell->type))
+        return CHIDB_ETYPE;
 
-    // load up the root btree node
-    if((rc = chidb_Btree_getNodeByPage(bt, root_page, &btn)) != CHIDB_OK)
-        return rc;
-    /*
-     * WHY DOES THE ABOVE GET NODE GIVE A LEAK??????
-     */
+    len = chidb_Btree_textLength(cell);
+    if(len + 1 > c->text_size)
+    {
+        char *text = realloc(c->text, len + 1);
+        if(text == NULL)
+            return CHIDB_ENOMEM;
+        c->text = text;
+        c->text_size = len + 1;
+    }
 
-    // populate the cursor trail bit
-    ct->depth = 0;
-    ct->btn = btn;
-    ct->n_current_cell = 0;
+    chidb_Btree_textCopy(cell, (uint8_t *) c->text);
+    c->text[len] = '\0';
+    *s = c->text;
 
-    // initialize stuff for cursor
-    list_init(&(c->trail));
+    return CHIDB_OK;
+}
 
-    // populate cursor
-    c->root_page = root_page;
-    c->root_type = btn->type;
-    c->n_cols = n_cols;
-    list_insert_at(&(c->trail), ct, ct->depth);
+/* Reads a column of every entry of the leaf the cursor is on into the
+ * cursor's filter. Entries whose column is not an integer, or is not in
+ * the part of the entry that is in the page, are left unknown. */
+static int chidb_dbm_cursor_filter_load(BTree *bt, chidb_dbm_cursor_t *c, ncol_t col)
+{
+    chidb_dbm_cursor_filter_t *f = &c->filter;
+    BTreeNode *btn = &CURSOR_TRAIL_TOP(c)->btn;
+    uint8_t *data;
+    uint32_t size, local;
+
+    if(btn->n_cells > f->size)
+    {
+        int64_t *values = realloc(f->values, btn->n_cells * sizeof(int64_t));
+        if(values != NULL)
+            f->values = values;
+        uint8_t *known = realloc(f->known, btn->n_cells);
+        if(known != NULL)
+            f->known = known;
+        uint8_t *fails = realloc(f->fails, btn->n_cells);
+        if(fails != NULL)
+            f->fails = fails;
+        if(values == NULL || known == NULL || fails == NULL)
+            return CHIDB_ENOMEM;
+        f->size = btn->n_cells;
+    }
+
+    for(ncell_t i = 0; i < btn->n_cells; i++)
+    {
+        data = chidb_Btree_tableLeafPayload(btn, i, &size, &local);
+        f->known[i] = chidb_DBRecord_peekInt64(data, local, col, &f->values[i]) == CHIDB_OK;
+        if(!f->known[i])
+            f->values[i] = 0;
+    }
+
+    f->npage = btn->page->npage;
+    f->n_cells = btn->n_cells;
+    f->col = col;
+    f->evaluated = false;
 
     return CHIDB_OK;
 }
 
-/* Free a cursor.
+/* Compares the values in the cursor's filter with a value. Each
+ * comparison is a loop without branches, which the compiler can turn
+ * into vector instructions. */
+static void chidb_dbm_cursor_filter_eval(chidb_dbm_cursor_filter_t *f, chidb_dbm_filter_cmp_t cmp, int64_t value)
+{
+    const int64_t *v = f->values;
+    const uint8_t *known = f->known;
+    uint8_t *fails = f->fails;
+    uint32_t n = f->n_cells;
+
+    switch(cmp)
+    {
+        case FILTER_EQ:
+            for(uint32_t i = 0; i < n; i++)
+                fails[i] = known[i] & (v[i] == value);
+            break;
+        case FILTER_NE:
+            for(uint32_t i = 0; i < n; i++)
+                fails[i] = known[i] & (v[i] != value);
+            break;
+        case FILTER_LT:
+            for(uint32_t i = 0; i < n; i++)
+                fails[i] = known[i] & (v[i] < value);
+            break;
+        case FILTER_LE:
+            for(uint32_t i = 0; i < n; i++)
+                fails[i] = known[i] & (v[i] <= value);
+            break;
+        case FILTER_GT:
+            for(uint32_t i = 0; i < n; i++)
+                fails[i] = known[i] & (v[i] > value);
+            break;
+        case FILTER_GE:
+            for(uint32_t i = 0; i < n; i++)
+                fails[i] = known[i] & (v[i] >= value);
+            break;
+    }
+
+    f->cmp = cmp;
+    f->value = value;
+    f->evaluated = true;
+}
+
+/* Moves a cursor past the entries of its leaf that fail a comparison
+ *
+ * An entry fails if an integer column compares to value with cmp (like
+ * the Eq, Ne, Lt, Le, Gt and Ge instructions, an entry fails when the
+ * comparison is true). The column of every entry of the leaf is read and
+ * compared the first time this is called on the leaf, and the result is
+ * reused until the cursor moves to another leaf, so only the entries that
+ * do not fail are ever decoded. Entries whose column is not an integer
+ * never fail: they have to be compared one by one.
+ *
+ * The cursor does not leave its leaf: if every entry from the one it is
+ * on to the last fails, it is left on the last one.
  *
  * Return
- * - CHIDB_OK: Operation sucessful
+ * - CHIDB_OK: The cursor is on an entry that is not known to fail
+ * - CHIDB_EEMPTY: The cursor is on the last entry of the leaf, which fails
+ * - CHIDB_ETYPE: The cursor is not on a table leaf
+ * - CHIDB_ENOMEM: Malloc failed
  */
-int chidb_dbm_cursor_destroy(BTree *bt, chidb_dbm_cursor_t *c)
+int chidb_dbm_cursor_filter(BTree *bt, chidb_dbm_cursor_t *c, ncol_t col, chidb_dbm_filter_cmp_t cmp, int64_t value)
 {
-    // free all of the btn's held within the cursor trail structs
-    chidb_dbm_cursor_trail_list_destroy(bt, &(c->trail));
+    chidb_dbm_cursor_filter_t *f = &c->filter;
+    chidb_dbm_cursor_trail_t *ct;
+    int start, rc;
 
-    // free(c);
+    if(c->depth == 0 || c->deleted)
+        return CHIDB_ETYPE;
 
-    return CHIDB_OK;
+    ct = CURSOR_TRAIL_TOP(c);
+    if(ct->btn.type != PGTYPE_TABLE_LEAF || ct->btn.n_cells == 0)
+        return CHIDB_ETYPE;
+
+    if(f->npage != ct->btn.page->npage || f->n_cells != ct->btn.n_cells || f->col != col)
+    {
+        if((rc = chidb_dbm_cursor_filter_load(bt, c, col)) != CHIDB_OK)
+            return rc;
+    }
+
+    if(!f->evaluated || f->cmp != cmp || f->value != value)
+        chidb_dbm_cursor_filter_eval(f, cmp, value);
+
+    start = ct->n_current_cell;
+    while(ct->n_current_cell < ct->btn.n_cells - 1 && f->fails[ct->n_current_cell])
+        ct->n_current_cell++;
+
+    if(ct->n_current_cell != start)
+    {
+        CHIDB_COUNT(bt->stats.steps, ct->n_current_cell - start);
+        c->record.valid = false;
+        chidb_Btree_getCell(&ct->btn, ct->n_current_cell, &c->current_cell);
+    }
+
+    return f->fails[ct->n_current_cell] ? CHIDB_EEMPTY : CHIDB_OK;
+}
+
+static inline bool chidb_dbm_cursor_is_leaf(chidb_dbm_cursor_trail_t *ct)
+{
+    return ct->btn.type == PGTYPE_TABLE_LEAF || ct->btn.type == PGTYPE_INDEX_LEAF || ct->btn.type == PGTYPE_TEXTINDEX_LEAF;
+}
+
+/* Checks whether the cursor can move one entry forward (or backwards)
+ *
+ * It is enough to look for a level in the trail that is not at its
+ * last (or first) position. Doing this before moving means that the
+ * trail does not have to be saved in case the cursor cannot move.
+ */
+static bool chidb_dbm_cursor_can_move(chidb_dbm_cursor_t *c, bool fwd)
+{
+    for(int i = c->depth - 1; i >= 0; i--)
+    {
+        chidb_dbm_cursor_trail_t *ct = &c->trail[i];
+        bool leaf = chidb_dbm_cursor_is_leaf(ct);
+
+        if(fwd && ct->n_current_cell < ct->btn.n_cells - (leaf ? 1 : 0))
+            return true;
+        if(!fwd && ct->n_current_cell > 0)
+            return true;
+
+        /* An index cursor can rest on an internal cell, which
+         * always has a left subtree to move back into */
+        if(!fwd && i == c->depth - 1 && ct->btn.type == PGTYPE_INDEX_INTERNAL)
+            return true;
+    }
+
+    return false;
 }
 
 /* Wrapper for the index and table versions of forward
@@ -266,18 +663,37 @@ int chidb_dbm_cursor_destroy(BTree *bt, chidb_dbm_cursor_t *c)
  */
 int chidb_dbm_cursor_fwd(BTree *bt, chidb_dbm_cursor_t *c)
 {
-    uint32_t list_loc = list_size(&(c->trail)) - 1;
-    chidb_dbm_cursor_trail_t *ct = list_get_at(&(c->trail), list_loc);
-    uint8_t node_type = ct->btn->type;
+    chidb_dbm_cursor_trail_t *ct = CURSOR_TRAIL_TOP(c);
+    uint8_t node_type = ct->btn.type;
     int ret = CHIDB_OK; // to quiet compiler warnings
 
-    list_t trail_copy;
-    chidb_dbm_cursor_trail_cpy(bt, &(c->trail), &trail_copy);
+    c->record.valid = false;
+    CHIDB_COUNT(bt->stats.steps, 1);
+
+    // the entry after a deleted one is already under the cursor
+    if(c->deleted)
+    {
+        c->deleted = false;
+        return CHIDB_OK;
+    }
+
+    // fast path: the next entry is in the leaf we're already holding
+    if(chidb_dbm_cursor_is_leaf(ct) && ct->n_current_cell < ct->btn.n_cells - 1)
+    {
+        ct->n_current_cell++;
+        return chidb_Btree_getCell(&ct->btn, ct->n_current_cell, &(c->current_cell));
+    }
+
+    // if we're at the rightmost entry, leave the trail as it is
+    if(!chidb_dbm_cursor_can_move(c, true))
+        return CHIDB_CURSORCANTMOVE;
 
     switch(node_type)
     {
         case PGTYPE_TABLE_INTERNAL:
         case PGTYPE_TABLE_LEAF:
+        case PGTYPE_TEXTINDEX_INTERNAL:
+        case PGTYPE_TEXTINDEX_LEAF:
             ret = chidb_dbm_cursorTable_fwd(bt, c);
             break;
 
@@ -291,23 +707,97 @@ int chidb_dbm_cursor_fwd(BTree *bt, chidb_dbm_cursor_t *c)
             break;
     }
 
-    if(ret == CHIDB_CURSORCANTMOVE)
+    return ret;
+}
+
+/* Move a cursor forward by n entries
+ *
+ * On a table B-Tree, the entries of a leaf are skipped by moving the cell
+ * number along, so only the first and last cells of the leaves in between
+ * are read. If there are fewer than n entries left, the cursor ends up on
+ * the last one.
+ *
+ * Return
+ * - CHIDB_OK: Operation sucessful
+ * - CHIDB_CURSORCANTMOVE: There were fewer than n entries after the cursor
+ */
+int chidb_dbm_cursor_skip(BTree *bt, chidb_dbm_cursor_t *c, uint32_t n)
+{
+    int ret;
+
+    while(n > 0)
     {
-        // we're currently at the root with the trail, so now put the copy of the trail
-        // back into the cursor
-        c->trail = trail_copy;
+        chidb_dbm_cursor_trail_t *ct = CURSOR_TRAIL_TOP(c);
+
+        if(ct->btn.type == PGTYPE_TABLE_LEAF && ct->btn.n_cells > 0)
+        {
+            uint32_t left = ct->btn.n_cells - 1 - ct->n_current_cell;
+
+            c->record.valid = false;
+            if(n <= left)
+            {
+                ct->n_current_cell += n;
+                return chidb_Btree_getCell(&ct->btn, ct->n_current_cell, &(c->current_cell));
+            }
+
+            // on to the last cell, so that the next move is to the next leaf
+            ct->n_current_cell += left;
+            n -= left;
+            if(left > 0 && (ret = chidb_Btree_getCell(&ct->btn, ct->n_current_cell, &(c->current_cell))) != CHIDB_OK)
+                return ret;
+        }
+
+        if((ret = chidb_dbm_cursor_fwd(bt, c)) != CHIDB_OK)
+            return ret;
+        n--;
     }
-    else
+
+    return CHIDB_OK;
+}
+
+/* Ask the Pager to prefetch the leaves after the one the cursor just left
+ *
+ * Called when a forward scan runs off the end of a leaf, which means the
+ * following siblings (whose page numbers are in the parent, at the top of
+ * the trail) are about to be read in order. Up to pager->readahead of them
+ * are hinted; to avoid a hint per leaf, nothing is done until the cursor
+ * gets within half that many of the last leaf that was already hinted.
+ */
+static void chidb_dbm_cursor_readahead(BTree *bt, chidb_dbm_cursor_trail_t *ct)
+{
+    int window = bt->pager->readahead;
+    int next = ct->n_current_cell + 1;
+    int last = ct->n_current_cell + window;
+    npage_t pages[READAHEAD_BATCH];
+    uint32_t n = 0;
+
+    if(window == 0 || ct->btn.type != PGTYPE_TABLE_INTERNAL || ct->readahead >= next + window / 2)
+        return;
+
+    if(last > ct->btn.n_cells)
+        last = ct->btn.n_cells;
+
+    for(int i = next > ct->readahead ? next : ct->readahead + 1; i <= last; i++)
     {
-        // we were able to move, so we didn't need the copy of the trail. destroy it
-        chidb_dbm_cursor_trail_list_destroy(bt, &trail_copy);
-    }
+        if(i < ct->btn.n_cells)
+            pages[n++] = chidb_Btree_tableInternalChild(&ct->btn, i);
+        else
+            pages[n++] = ct->btn.right_page;
 
-    return ret;
+        if(n == READAHEAD_BATCH || i == last)
+        {
+            chidb_Pager_prefetch(bt->pager, pages, n);
+            n = 0;
+        }
+    }
+    if(last > ct->readahead)
+        ct->readahead = last;
 }
 
 /* Outer most shell for forward on a table.
  *
+ * Also used for text indexes, which keep all their entries in the
+ * leaves too.
  * If there is a next cell to move to, advance the cell number and get the new cell.
  * Otherwise, use the cursor trail to go up the tree to check for the next cell.
  * Will only ever hit one peak where you have to then go down.
@@ -318,16 +808,19 @@ int chidb_dbm_cursor_fwd(BTree *bt, chidb_dbm_cursor_t *c)
  */
 int chidb_dbm_cursorTable_fwd(BTree *bt, chidb_dbm_cursor_t *c)
 {
-    uint32_t list_loc = list_size(&(c->trail)) - 1;
-    chidb_dbm_cursor_trail_t *ct = list_get_at(&(c->trail), list_loc);
+    chidb_dbm_cursor_trail_t *ct = CURSOR_TRAIL_TOP(c);
 
-    if(c->current_cell.type != PGTYPE_TABLE_LEAF)
+    if(!chidb_dbm_cursor_is_leaf(ct))
         return CHIDB_ETYPE;
 
-    if(ct->n_current_cell == ct->btn->n_cells - 1) // we're at the last cell in the leaf
+    if(ct->n_current_cell == ct->btn.n_cells - 1) // we're at the last cell in the leaf
     {
         // remove the old portion of the trail, we're going up
-        chidb_dbm_cursor_trail_remove_at(bt, c, list_loc);
+        chidb_dbm_cursor_trail_pop(bt, c);
+
+        // the scan is sequential, so the next leaves will be needed soon
+        if(c->depth > 0)
+            chidb_dbm_cursor_readahead(bt, CURSOR_TRAIL_TOP(c));
 
         // going up
         return chidb_dbm_cursorTable_fwdUp(bt, c);
@@ -335,7 +828,7 @@ int chidb_dbm_cursorTable_fwd(BTree *bt, chidb_dbm_cursor_t *c)
     else // we can just move to next cell
     {
         ct->n_current_cell++;
-        chidb_Btree_getCell(ct->btn, ct->n_current_cell, &(c->current_cell));
+        chidb_Btree_getCell(&ct->btn, ct->n_current_cell, &(c->current_cell));
 
         return CHIDB_OK;
     }
@@ -355,26 +848,23 @@ int chidb_dbm_cursorTable_fwd(BTree *bt, chidb_dbm_cursor_t *c)
  */
 int chidb_dbm_cursorTable_fwdUp(BTree *bt, chidb_dbm_cursor_t *c)
 {
-    uint32_t list_loc = list_size(&(c->trail)) - 1;
-
     //In the case of a root, when trying to go up we have already removed our past trail
-    //this means the trail length is actually negative
-    if(list_loc == -1)
+    if(c->depth == 0)
     {
         return CHIDB_CURSORCANTMOVE;
     }
 
-    chidb_dbm_cursor_trail_t *ct = list_get_at(&(c->trail), list_loc);
+    chidb_dbm_cursor_trail_t *ct = CURSOR_TRAIL_TOP(c);
 
     //Up can never be called on a leaf, because we can't go up into a leaf
-    if(ct->btn->type != PGTYPE_TABLE_INTERNAL)
+    if(ct->btn.type != PGTYPE_TABLE_INTERNAL && ct->btn.type != PGTYPE_TEXTINDEX_INTERNAL)
     {
         return CHIDB_ETYPE;
     }
 
     ct->n_current_cell++; // advance the current cell as if we are going down to next one
 
-    if(ct->n_current_cell <= ct->btn->n_cells)
+    if(ct->n_current_cell <= ct->btn.n_cells)
     {
         // go down the current cell or right page
         return chidb_dbm_cursorTable_fwdDwn(bt,c);
@@ -382,7 +872,7 @@ int chidb_dbm_cursorTable_fwdUp(BTree *bt, chidb_dbm_cursor_t *c)
     else
     {
         // remove the old portion of the trail, we're going up
-        chidb_dbm_cursor_trail_remove_at(bt, c, list_loc);
+        chidb_dbm_cursor_trail_pop(bt, c);
 
         // going up
         return chidb_dbm_cursorTable_fwdUp(bt, c);
@@ -403,44 +893,33 @@ int chidb_dbm_cursorTable_fwdUp(BTree *bt, chidb_dbm_cursor_t *c)
  */
 int chidb_dbm_cursorTable_fwdDwn(BTree *bt, chidb_dbm_cursor_t *c)
 {
-    uint32_t list_loc = list_size(&(c->trail)) - 1;
-    chidb_dbm_cursor_trail_t *ct = list_get_at(&(c->trail), list_loc);
-    uint8_t node_type = ct->btn->type;
+    chidb_dbm_cursor_trail_t *ct = CURSOR_TRAIL_TOP(c);
+    uint8_t node_type = ct->btn.type;
+    int ret;
 
     npage_t pg;
     switch(node_type)
     {
         case PGTYPE_TABLE_INTERNAL:
-            if(ct->n_current_cell < ct->btn->n_cells)
-            {
-                // we need to make the new part of trail on the cell num
-                BTreeCell cell;
-                chidb_Btree_getCell(ct->btn, ct->n_current_cell, &cell);
-                pg = cell.fields.tableInternal.child_page;
-            }
-            else if(ct->n_current_cell == ct->btn->n_cells)
-            {
-                // trail on right page
-                pg = ct->btn->right_page;
-            }
+        case PGTYPE_TEXTINDEX_INTERNAL:
+            // the cell's child, or the right page after the last cell
+            if(ct->n_current_cell <= ct->btn.n_cells)
+                pg = chidb_Btree_getChild(&ct->btn, ct->n_current_cell);
             else
                 return CHIDB_ECELLNO;
 
-            // build new cursor trail instance for next level down
-            chidb_dbm_cursor_trail_t *ct_new;
-            uint32_t next_depth = list_loc + 1;
-            chidb_dbm_cursor_trail_new(bt, &ct_new, pg, next_depth); // adding to the NEXT position
-
-            // add the new thing to the trail
-            list_insert_at(&(c->trail), ct_new, next_depth);
+            // add the next level down to the trail
+            if((ret = chidb_dbm_cursor_trail_push(bt, c, pg)) != CHIDB_OK)
+                return ret;
 
             // call fwdDwn again
             return chidb_dbm_cursorTable_fwdDwn(bt, c);
 
         case PGTYPE_TABLE_LEAF:
+        case PGTYPE_TEXTINDEX_LEAF:
             // get the cell and put it in the cursor
             // n_current_cell is initialized to cell zero
-            chidb_Btree_getCell(ct->btn, ct->n_current_cell, &(c->current_cell));
+            chidb_Btree_getCell(&ct->btn, ct->n_current_cell, &(c->current_cell));
             // update cursor fields
 
             return CHIDB_OK;
@@ -461,18 +940,17 @@ int chidb_dbm_cursorTable_fwdDwn(BTree *bt, chidb_dbm_cursor_t *c)
  */
 int chidb_dbm_cursorIndex_fwd(BTree *bt, chidb_dbm_cursor_t *c)
 {
-    uint32_t list_loc = list_size(&(c->trail)) - 1;
-    chidb_dbm_cursor_trail_t *ct = list_get_at(&(c->trail), list_loc);
-    uint8_t node_type = ct->btn->type;
+    chidb_dbm_cursor_trail_t *ct = CURSOR_TRAIL_TOP(c);
+    uint8_t node_type = ct->btn.type;
 
     switch(node_type)
     {
         case PGTYPE_INDEX_LEAF:
             //check if we can go to the next cell
-            if(ct->n_current_cell == ct->btn->n_cells - 1) // we're at the last cell in the leaf
+            if(ct->n_current_cell == ct->btn.n_cells - 1) // we're at the last cell in the leaf
             {
                 // remove the old portion of the trail, we're going up
-                chidb_dbm_cursor_trail_remove_at(bt, c, list_loc);
+                chidb_dbm_cursor_trail_pop(bt, c);
 
                 // going up
                 return chidb_dbm_cursorIndex_fwdUp(bt, c);
@@ -480,7 +958,7 @@ int chidb_dbm_cursorIndex_fwd(BTree *bt, chidb_dbm_cursor_t *c)
             else // we can just move to next cell
             {
                 ct->n_current_cell++;
-                chidb_Btree_getCell(ct->btn, ct->n_current_cell, &(c->current_cell));
+                chidb_Btree_getCell(&ct->btn, ct->n_current_cell, &(c->current_cell));
 
                 return CHIDB_OK;
             }
@@ -488,7 +966,7 @@ int chidb_dbm_cursorIndex_fwd(BTree *bt, chidb_dbm_cursor_t *c)
             //at this point we always need to go down the next cell's child page
             //first though, need to check if there is another cell to go to
             ct->n_current_cell++;
-            if(ct->n_current_cell <= ct->btn->n_cells)
+            if(ct->n_current_cell <= ct->btn.n_cells)
             {
                 // go down the current cell or right page
                 return chidb_dbm_cursorIndex_fwdDwn(bt,c);
@@ -496,7 +974,7 @@ int chidb_dbm_cursorIndex_fwd(BTree *bt, chidb_dbm_cursor_t *c)
             else //we've increased over the possible number of cells
             {
                 // remove the old portion of the trail, we're going up
-                chidb_dbm_cursor_trail_remove_at(bt, c, list_loc);
+                chidb_dbm_cursor_trail_pop(bt, c);
 
                 // going up
                 return chidb_dbm_cursorIndex_fwdUp(bt, c);
@@ -508,44 +986,34 @@ int chidb_dbm_cursorIndex_fwd(BTree *bt, chidb_dbm_cursor_t *c)
 
 /* Ascend one level in an index tree when trying to advance cursor.
  *
+ * The trail says which child we came out of. If it was the child of a cell,
+ * that cell is the next entry and the cursor rests on it. If it was the right
+ * page, this subtree is done too and we keep going up.
  * Return
  * - CHIDB_OK: Operation sucessful
  * - CHIDB_CURSORCANTMOVE: At rightmost edge of tree, cannot advance cursor more
  */
 int chidb_dbm_cursorIndex_fwdUp(BTree *bt, chidb_dbm_cursor_t *c)
 {
-    uint32_t list_loc = list_size(&(c->trail)) - 1;
-
     //In the case of a root, when trying to go up we have already removed our past trail
-    //this means the trail length is actually negative
-    if(list_loc == -1)
+    if(c->depth == 0)
     {
         return CHIDB_CURSORCANTMOVE;
     }
 
-    chidb_dbm_cursor_trail_t *ct = list_get_at(&(c->trail), list_loc);
-
-    ct->n_current_cell++; // advance the current cell as if we are going down to next one
+    chidb_dbm_cursor_trail_t *ct = CURSOR_TRAIL_TOP(c);
 
-    if(ct->n_current_cell < ct->btn->n_cells)
+    if(ct->n_current_cell < ct->btn.n_cells)
     {
         //since this is an index, and you are looking for the next biggest value, we need to stop here
-        //at the internal's next cell because it holds the key value pair that is greater than the leaf
+        //at the internal's cell because it holds the key value pair that is greater than the child
         //we just came out of
-        BTreeCell cell;
-        chidb_Btree_getCell(ct->btn, ct->n_current_cell, &cell);
-
-        return CHIDB_OK;
-    }
-    else if(ct->n_current_cell == ct->btn->n_cells)
-    {
-        //need to go down right page
-        return chidb_dbm_cursorIndex_fwdDwn(bt,c);
+        return chidb_Btree_getCell(&ct->btn, ct->n_current_cell, &(c->current_cell));
     }
     else //we've already explored the right page and are out of cells to go down
     {
         // remove the old portion of the trail, we're going up
-        chidb_dbm_cursor_trail_remove_at(bt, c, list_loc);
+        chidb_dbm_cursor_trail_pop(bt, c);
 
         // going up
         return chidb_dbm_cursorIndex_fwdUp(bt, c);
@@ -564,43 +1032,39 @@ int chidb_dbm_cursorIndex_fwdUp(BTree *bt, chidb_dbm_cursor_t *c)
  */
 int chidb_dbm_cursorIndex_fwdDwn(BTree *bt, chidb_dbm_cursor_t *c)
 {
-    uint32_t list_loc = list_size(&(c->trail)) - 1;
-    chidb_dbm_cursor_trail_t *ct = list_get_at(&(c->trail), list_loc);
-    uint8_t node_type = ct->btn->type;
+    chidb_dbm_cursor_trail_t *ct = CURSOR_TRAIL_TOP(c);
+    uint8_t node_type = ct->btn.type;
+    int ret;
 
     npage_t pg;
     switch(node_type)
     {
         case PGTYPE_INDEX_INTERNAL:
-            if(ct->n_current_cell < ct->btn->n_cells)
+            if(ct->n_current_cell < ct->btn.n_cells)
             {
                 // we need to make the new part of trail on the cell num
                 BTreeCell cell;
-                chidb_Btree_getCell(ct->btn, ct->n_current_cell, &cell);
+                chidb_Btree_getCell(&ct->btn, ct->n_current_cell, &cell);
                 pg = cell.fields.indexInternal.child_page;
             }
-            else if(ct->n_current_cell == ct->btn->n_cells)
+            else if(ct->n_current_cell == ct->btn.n_cells)
             {
                 // trail on right page
-                pg = ct->btn->right_page;
+                pg = ct->btn.right_page;
             }
             else
                 return CHIDB_ECELLNO;
 
-            // build new cursor trail instance for next level down
-            chidb_dbm_cursor_trail_t *ct_new;
-            uint32_t next_depth = list_loc + 1;
-            chidb_dbm_cursor_trail_new(bt, &ct_new, pg, next_depth); // adding to the NEXT position
-
-            // add the new thing to the trail
-            list_insert_at(&(c->trail), ct_new, next_depth);
+            // add the next level down to the trail
+            if((ret = chidb_dbm_cursor_trail_push(bt, c, pg)) != CHIDB_OK)
+                return ret;
 
             // call fwdDwn again
             return chidb_dbm_cursorIndex_fwdDwn(bt, c);
 
         case PGTYPE_INDEX_LEAF:
             // get the cell and put it in the cursor
-            chidb_Btree_getCell(ct->btn, ct->n_current_cell, &(c->current_cell));
+            chidb_Btree_getCell(&ct->btn, ct->n_current_cell, &(c->current_cell));
             // update cursor fields
             return CHIDB_OK;
         default:
@@ -618,15 +1082,31 @@ int chidb_dbm_cursorIndex_fwdDwn(BTree *bt, chidb_dbm_cursor_t *c)
  */
 int chidb_dbm_cursor_rev(BTree *bt, chidb_dbm_cursor_t *c)
 {
-    uint32_t list_loc = list_size(&(c->trail)) - 1;
-    chidb_dbm_cursor_trail_t *ct = list_get_at(&(c->trail), list_loc);
+    chidb_dbm_cursor_trail_t *ct = CURSOR_TRAIL_TOP(c);
 
-    uint8_t node_type = ct->btn->type;
+    uint8_t node_type = ct->btn.type;
     int ret = CHIDB_OK;
+
+    c->record.valid = false;
+    CHIDB_COUNT(bt->stats.steps, 1);
+
+    // fast path: the previous entry is in the leaf we're already holding
+    if(chidb_dbm_cursor_is_leaf(ct) && ct->n_current_cell > 0)
+    {
+        ct->n_current_cell--;
+        return chidb_Btree_getCell(&ct->btn, ct->n_current_cell, &(c->current_cell));
+    }
+
+    // if we're at the leftmost entry, leave the trail as it is
+    if(!chidb_dbm_cursor_can_move(c, false))
+        return CHIDB_CURSORCANTMOVE;
+
     switch(node_type)
     {
         case PGTYPE_TABLE_INTERNAL:
         case PGTYPE_TABLE_LEAF:
+        case PGTYPE_TEXTINDEX_INTERNAL:
+        case PGTYPE_TEXTINDEX_LEAF:
             ret = chidb_dbm_cursorTable_rev(bt, c);
             break;
 
@@ -654,16 +1134,15 @@ int chidb_dbm_cursor_rev(BTree *bt, chidb_dbm_cursor_t *c)
  */
 int chidb_dbm_cursorTable_rev(BTree *bt, chidb_dbm_cursor_t *c)
 {
-    uint32_t list_loc = list_size(&(c->trail)) - 1;
-    chidb_dbm_cursor_trail_t *ct = list_get_at(&(c->trail), list_loc);
+    chidb_dbm_cursor_trail_t *ct = CURSOR_TRAIL_TOP(c);
 
-    if(c->current_cell.type != PGTYPE_TABLE_LEAF)
+    if(!chidb_dbm_cursor_is_leaf(ct))
         return CHIDB_ETYPE;
 
     if(ct->n_current_cell == 0) //we're at the first cell in the leaf
     {
         // remove the old portion of the trail, we're going up
-        chidb_dbm_cursor_trail_remove_at(bt, c, list_loc);
+        chidb_dbm_cursor_trail_pop(bt, c);
 
         // going up
         return chidb_dbm_cursorTable_revUp(bt, c);
@@ -671,7 +1150,7 @@ int chidb_dbm_cursorTable_rev(BTree *bt, chidb_dbm_cursor_t *c)
     else // there are cells behind us we can move into
     {
         ct->n_current_cell--;
-        chidb_Btree_getCell(ct->btn, ct->n_current_cell, &(c->current_cell));
+        chidb_Btree_getCell(&ct->btn, ct->n_current_cell, &(c->current_cell));
 
         return CHIDB_OK;
     }
@@ -690,17 +1169,15 @@ int chidb_dbm_cursorTable_rev(BTree *bt, chidb_dbm_cursor_t *c)
  */
 int chidb_dbm_cursorTable_revUp(BTree *bt, chidb_dbm_cursor_t *c)
 {
-    uint32_t list_loc = list_size(&(c->trail)) - 1;
-
-    if(list_loc == -1)
+    if(c->depth == 0)
     {
         return CHIDB_CURSORCANTMOVE;
     }
 
-    chidb_dbm_cursor_trail_t *ct = list_get_at(&(c->trail), list_loc);
+    chidb_dbm_cursor_trail_t *ct = CURSOR_TRAIL_TOP(c);
 
     //Sanity check. we can't have gone up to another leaf, so...
-    if(ct->btn->type != PGTYPE_TABLE_INTERNAL)
+    if(ct->btn.type != PGTYPE_TABLE_INTERNAL && ct->btn.type != PGTYPE_TEXTINDEX_INTERNAL)
     {
         return CHIDB_ETYPE;
     }
@@ -715,7 +1192,7 @@ int chidb_dbm_cursorTable_revUp(BTree *bt, chidb_dbm_cursor_t *c)
     else
     {
         // remove the old portion of the trail, we're going up
-        chidb_dbm_cursor_trail_remove_at(bt, c, list_loc);
+        chidb_dbm_cursor_trail_pop(bt, c);
 
         // we need to go up again, backed up the farthest we can here
         return chidb_dbm_cursorTable_revUp(bt,c);
@@ -734,51 +1211,42 @@ int chidb_dbm_cursorTable_revUp(BTree *bt, chidb_dbm_cursor_t *c)
  */
 int chidb_dbm_cursorTable_revDwn(BTree *bt, chidb_dbm_cursor_t *c)
 {
-    uint32_t list_loc = list_size(&(c->trail)) - 1;
-    chidb_dbm_cursor_trail_t *ct = list_get_at(&(c->trail), list_loc);
-    uint8_t node_type = ct->btn->type;
+    chidb_dbm_cursor_trail_t *ct = CURSOR_TRAIL_TOP(c);
+    uint8_t node_type = ct->btn.type;
+    int ret;
 
     npage_t pg;
     switch(node_type)
     {
         //if it is internal, then we will definitely need to go further down to reach more leaves
         case PGTYPE_TABLE_INTERNAL:
-            if(ct->n_current_cell < ct->btn->n_cells)
-            {
-                BTreeCell cell;
-                chidb_Btree_getCell(ct->btn, ct->n_current_cell, &cell);
-                pg = cell.fields.tableInternal.child_page;
-            }
-            else if(ct->n_current_cell == ct->btn->n_cells)
-            {
-                // trail on right page
-                pg = ct->btn->right_page;
-            }
+        case PGTYPE_TEXTINDEX_INTERNAL:
+            // the cell's child, or the right page after the last cell
+            if(ct->n_current_cell <= ct->btn.n_cells)
+                pg = chidb_Btree_getChild(&ct->btn, ct->n_current_cell);
             else
                 return CHIDB_ECELLNO;
 
-            // build new cursor trail instance for next level down
-            chidb_dbm_cursor_trail_t *ct_new;
-            uint32_t next_depth = list_loc + 1;
-            chidb_dbm_cursor_trail_new(bt, &ct_new, pg, next_depth);
+            // add the next level down to the trail
+            if((ret = chidb_dbm_cursor_trail_push(bt, c, pg)) != CHIDB_OK)
+                return ret;
+            chidb_dbm_cursor_trail_t *ct_new = CURSOR_TRAIL_TOP(c);
 
             //since we are going backwards, need to manually set the new cell as the maximum
-            ct_new->n_current_cell = ct_new->btn->n_cells;
+            ct_new->n_current_cell = ct_new->btn.n_cells;
 
             // if the new trail instance holds a leaf btn, it doesn't have a right page so
             // its max current cell is n_cells-1.
-            if(ct_new->btn->type == PGTYPE_TABLE_LEAF)
+            if(chidb_dbm_cursor_is_leaf(ct_new))
                 ct_new->n_current_cell--;
 
-            // add the new thing to the trail
-            list_insert_at(&(c->trail), ct_new, next_depth);
-
             // finally able to go down now that trail has been constructed
             return chidb_dbm_cursorTable_revDwn(bt, c);
 
         case PGTYPE_TABLE_LEAF:
+        case PGTYPE_TEXTINDEX_LEAF:
             // get the cell and put it in the cursor
-            chidb_Btree_getCell(ct->btn, ct->n_current_cell, &(c->current_cell));
+            chidb_Btree_getCell(&ct->btn, ct->n_current_cell, &(c->current_cell));
 
             return CHIDB_OK;
 
@@ -800,9 +1268,8 @@ int chidb_dbm_cursorTable_revDwn(BTree *bt, chidb_dbm_cursor_t *c)
  */
 int chidb_dbm_cursorIndex_rev(BTree *bt, chidb_dbm_cursor_t *c)
 {
-    uint32_t list_loc = list_size(&(c->trail)) - 1;
-    chidb_dbm_cursor_trail_t *ct = list_get_at(&(c->trail), list_loc);
-    uint8_t node_type = ct->btn->type;
+    chidb_dbm_cursor_trail_t *ct = CURSOR_TRAIL_TOP(c);
+    uint8_t node_type = ct->btn.type;
 
     switch(node_type)
     {
@@ -811,7 +1278,7 @@ int chidb_dbm_cursorIndex_rev(BTree *bt, chidb_dbm_cursor_t *c)
             if(ct->n_current_cell == 0) // we're at the first cell in the leaf
             {
                 // remove the old portion of the trail, we're going up
-                chidb_dbm_cursor_trail_remove_at(bt, c, list_loc);
+                chidb_dbm_cursor_trail_pop(bt, c);
 
                 // going up
                 return chidb_dbm_cursorIndex_revUp(bt, c);
@@ -819,7 +1286,7 @@ int chidb_dbm_cursorIndex_rev(BTree *bt, chidb_dbm_cursor_t *c)
             else // there are cells behind us we can move into
             {
                 ct->n_current_cell--;
-                chidb_Btree_getCell(ct->btn, ct->n_current_cell, &(c->current_cell));
+                chidb_Btree_getCell(&ct->btn, ct->n_current_cell, &(c->current_cell));
 
                 return CHIDB_OK;
             }
@@ -833,7 +1300,7 @@ int chidb_dbm_cursorIndex_rev(BTree *bt, chidb_dbm_cursor_t *c)
             else //we've decreased over the possible number of cells
             {
                 // remove the old portion of the trail, we're going up
-                chidb_dbm_cursor_trail_remove_at(bt, c, list_loc);
+                chidb_dbm_cursor_trail_pop(bt, c);
 
                 // going up
                 return chidb_dbm_cursorIndex_revUp(bt, c);
@@ -854,36 +1321,30 @@ int chidb_dbm_cursorIndex_rev(BTree *bt, chidb_dbm_cursor_t *c)
  */
 int chidb_dbm_cursorIndex_revUp(BTree *bt, chidb_dbm_cursor_t *c)
 {
-    uint32_t list_loc = list_size(&(c->trail)) - 1;
-
     //In the case of a root, when trying to go up we have already removed our past trail
-    //this means the trail length is actually negative
-    if(list_loc == -1)
+    if(c->depth == 0)
     {
         return CHIDB_CURSORCANTMOVE;
     }
 
-    chidb_dbm_cursor_trail_t *ct = list_get_at(&(c->trail), list_loc);
+    chidb_dbm_cursor_trail_t *ct = CURSOR_TRAIL_TOP(c);
 
     ct->n_current_cell--; // decrease the current cell as if we are going down to prev one
 
     if(ct->n_current_cell >= 0)
     {
         //since this is an index, and you are looking for the next smallest value, we need to stop here
-        //at the internal's next cell because it holds the key value pair that is less than the child
+        //at the internal's previous cell because it holds the key value pair that is less than the child
         //we just came out of
-        BTreeCell cell;
-        chidb_Btree_getCell(ct->btn, ct->n_current_cell, &cell);
-
-        return CHIDB_OK;
+        return chidb_Btree_getCell(&ct->btn, ct->n_current_cell, &(c->current_cell));
     }
     else //we've already explored the left most child and we are out of cells to go down
     {
         // remove the old portion of the trail, we're going up
-        chidb_dbm_cursor_trail_remove_at(bt, c, list_loc);
+        chidb_dbm_cursor_trail_pop(bt, c);
 
         // going up
-        return chidb_dbm_cursorIndex_fwdUp(bt, c);
+        return chidb_dbm_cursorIndex_revUp(bt, c);
     }
 
     return CHIDB_OK;
@@ -899,51 +1360,48 @@ int chidb_dbm_cursorIndex_revUp(BTree *bt, chidb_dbm_cursor_t *c)
  */
 int chidb_dbm_cursorIndex_revDwn(BTree *bt, chidb_dbm_cursor_t *c)
 {
-    uint32_t list_loc = list_size(&(c->trail)) - 1;
-    chidb_dbm_cursor_trail_t *ct = list_get_at(&(c->trail), list_loc);
-    uint8_t node_type = ct->btn->type;
+    chidb_dbm_cursor_trail_t *ct = CURSOR_TRAIL_TOP(c);
+    uint8_t node_type = ct->btn.type;
+    int ret;
 
     npage_t pg;
     switch(node_type)
     {
         case PGTYPE_INDEX_INTERNAL:
-            if(ct->n_current_cell >= 0)
+            if(ct->n_current_cell >= 0 && ct->n_current_cell < ct->btn.n_cells)
             {
                 // we need to make the new part of trail on the cell num
                 BTreeCell cell;
-                chidb_Btree_getCell(ct->btn, ct->n_current_cell, &cell);
+                chidb_Btree_getCell(&ct->btn, ct->n_current_cell, &cell);
                 pg = cell.fields.indexInternal.child_page;
             }
-            else if(ct->n_current_cell == ct->btn->n_cells)
+            else if(ct->n_current_cell == ct->btn.n_cells)
             {
                 // trail on right page
-                pg = ct->btn->right_page;
+                pg = ct->btn.right_page;
             }
             else
                 return CHIDB_ECELLNO;
 
-            // build new cursor trail instance for next level down
-            chidb_dbm_cursor_trail_t *ct_new;
-            uint32_t next_depth = list_loc + 1;
-            chidb_dbm_cursor_trail_new(bt, &ct_new, pg, next_depth);
+            // add the next level down to the trail
+            if((ret = chidb_dbm_cursor_trail_push(bt, c, pg)) != CHIDB_OK)
+                return ret;
+            chidb_dbm_cursor_trail_t *ct_new = CURSOR_TRAIL_TOP(c);
 
             //since we are going backwards, need to manually set the new cell as the maximum
-            ct_new->n_current_cell = ct_new->btn->n_cells;
+            ct_new->n_current_cell = ct_new->btn.n_cells;
 
             // if the new trail instance holds a leaf btn, it doesn't have a right page so
             // its max current cell is n_cells-1.
-            if(ct_new->btn->type == PGTYPE_TABLE_LEAF)
+            if(ct_new->btn.type == PGTYPE_INDEX_LEAF)
                 ct_new->n_current_cell--;
 
-            // add the new thing to the trail
-            list_insert_at(&(c->trail), ct_new, next_depth);
-
-            // call fwdDwn again
-            return chidb_dbm_cursorIndex_fwdDwn(bt, c);
+            // call revDwn again
+            return chidb_dbm_cursorIndex_revDwn(bt, c);
 
         case PGTYPE_INDEX_LEAF:
             // get the cell and put it in the cursor
-            chidb_Btree_getCell(ct->btn, ct->n_current_cell, &(c->current_cell));
+            chidb_Btree_getCell(&ct->btn, ct->n_current_cell, &(c->current_cell));
 
             return CHIDB_OK;
 
@@ -954,6 +1412,8 @@ int chidb_dbm_cursorIndex_revDwn(BTree *bt, chidb_dbm_cursor_t *c)
     return CHIDB_OK;
 }
 
+static int chidb_dbm_cursor_seekFrom(BTree *bt, chidb_dbm_cursor_t *c, chidb_key_t key, int depth, int seek_type);
+
 /* seek bt c key next depth seek_type
  * bt:        our full B-tree for searching
  * c:         our cursor for cursing
@@ -964,180 +1424,507 @@ int chidb_dbm_cursorIndex_revDwn(BTree *bt, chidb_dbm_cursor_t *c)
  */
 int chidb_dbm_cursor_seek(BTree *bt, chidb_dbm_cursor_t *c, chidb_key_t key, npage_t next, int depth, int seek_type)
 {
-    chidb_dbm_cursor_trail_t *trail_entry;
+    int status;
 
     if (!depth)
     {
-        chidb_dbm_cursor_clear_trail_from(bt, c, 0);
-        next = c->root_page; // jic you didn't call it right
-        trail_entry = list_get_at(&(c->trail), 0);
+        CHIDB_COUNT(bt->stats.seeks, 1);
+        CHIDB_PROBE(cursor__seek, c->root_page, key, seek_type);
+
+        // start over from a freshly read root (jic you didn't call it right)
+        if ((status = chidb_dbm_cursor_reset(bt, c)) != CHIDB_OK)
+            return status;
     }
-    else
+    else if ((status = chidb_dbm_cursor_trail_push(bt, c, next)) != CHIDB_OK)
     {
-        trail_entry = malloc(sizeof(chidb_dbm_cursor_trail_t));
+        return status;
     }
 
-    BTreeCell cell;
-    BTreeNode *btn;
+    return chidb_dbm_cursor_seekFrom(bt, c, key, depth, seek_type);
+}
+
+/* Seek a key in a table, starting from where the cursor is
+ *
+ * Same as chidb_dbm_cursor_seek with SEEK, except that the trail is only
+ * climbed as far as the lowest node whose range of keys can include the
+ * key, and the search goes down from there. Seeking keys close to one
+ * another, and especially in increasing order (e.g., the values of an
+ * IN list), then reads the root and the internal nodes once, instead of
+ * once per key. Only read cursors keep their trail between seeks, as
+ * writes can change the nodes in it; other cursors seek from the root.
+ */
+int chidb_dbm_cursor_seekNear(BTree *bt, chidb_dbm_cursor_t *c, chidb_key_t key)
+{
+    chidb_key_t lo = 0, hi = 0;
+    bool has_lo = false, has_hi = false;
+    uint32_t d;
 
+    if (c->type != CURSOR_READ || c->depth < 2 || CURSOR_TRAIL_TOP(c)->btn.type != PGTYPE_TABLE_LEAF)
+        return chidb_dbm_cursor_seek(bt, c, key, c->root_page, 0, SEEK);
 
-    int status;
-    int i = 0;
+    CHIDB_COUNT(bt->stats.seeks, 1);
+    CHIDB_PROBE(cursor__seek__near, c->root_page, key);
 
-    if ((status = chidb_Btree_getNodeByPage(bt, next, &btn)) != CHIDB_OK)
+    // the node below level d has the keys in (lo, hi] of the cells on
+    // either side of the one level d went down from
+    for (d = 0; d + 1 < c->depth; d++)
     {
-        free(btn);
-        return status;
+        chidb_dbm_cursor_trail_t *ct = &c->trail[d];
+
+        if (ct->n_current_cell < ct->btn.n_cells)
+        {
+            hi = chidb_Btree_tableInternalKey(&ct->btn, ct->n_current_cell);
+            has_hi = true;
+        }
+        if (ct->n_current_cell > 0)
+        {
+            lo = chidb_Btree_tableInternalKey(&ct->btn, ct->n_current_cell - 1);
+            has_lo = true;
+        }
+        if ((has_lo && key <= lo) || (has_hi && key > hi))
+            break;
     }
 
-    // Same info no matter what cell we choose. Just need cell # and to append
-    trail_entry->depth = depth;
-    trail_entry->btn = btn;
+    c->record.valid = false;
+    c->deleted = false;
+    c->deferred = false;
+    chidb_dbm_cursor_clear_trail_from(bt, c, d);
 
-    if (btn->type == PGTYPE_TABLE_LEAF)
+    return chidb_dbm_cursor_seekFrom(bt, c, key, d, SEEK);
+}
+
+/* Do the seek a DeferredSeek put off, if there is one
+ *
+ * A DeferredSeek only notes the key the cursor is to be moved to (in
+ * deferred_key). The row is sought (with chidb_dbm_cursor_seekNear) when
+ * its record is first read, so that rows that an index scan rules out
+ * on what is in the index are never read from the table. Its key is
+ * known without seeking it.
+ *
+ * Return
+ * - CHIDB_OK: The cursor is on the row (or there was no deferred seek)
+ * - CHIDB_ECORRUPT: There is no row with the key (the index it came
+ *                   from does not match the table)
+ * - chidb_dbm_cursor_seekNear return codes
+ */
+int chidb_dbm_cursor_finishSeek(BTree *bt, chidb_dbm_cursor_t *c)
+{
+    int rc;
+
+    if(!c->deferred)
+        return CHIDB_OK;
+
+    c->deferred = false;
+    rc = chidb_dbm_cursor_seekNear(bt, c, c->deferred_key);
+    if(rc == CHIDB_ENOTFOUND || rc == CHIDB_CURSORCANTMOVE)
+        return CHIDB_ECORRUPT;
+
+    return rc;
+}
+
+/* The part of chidb_dbm_cursor_seekFrom for index nodes
+ *
+ * An index can have several entries with the same key (in the order of
+ * their primary keys), and some of them can be below an internal cell
+ * with that key, so the search always goes down to a leaf: to the first
+ * entry with a key >= the one sought, or, for SEEKGT and SEEKLE, to the
+ * first one with a larger key. The cursor then moves to the entry next
+ * to it if the seek type calls for it. */
+static int chidb_dbm_cursor_seekIndexFrom(BTree *bt, chidb_dbm_cursor_t *c, chidb_key_t key, int depth, int seek_type)
+{
+    chidb_dbm_cursor_trail_t *trail_entry = CURSOR_TRAIL_TOP(c);
+    BTreeNode *btn = &trail_entry->btn;
+    ncell_t i = 0;
+    int rc;
+
+    if (seek_type == SEEKGT || seek_type == SEEKLE)
     {
-        do
-        {
-            if (chidb_Btree_getCell(btn, i, &cell) != CHIDB_OK)
-                return CHIDB_ECELLNO;
+        if (key == UINT64_MAX)
+            i = btn->n_cells;
+        else
+            chidb_Btree_searchNode(btn, key + 1, &i);
+    }
+    else
+    {
+        chidb_Btree_searchNode(btn, key, &i);
+    }
 
-            if (cell.key == key)
-            {
-                trail_entry->n_current_cell = i;
-                c->current_cell = cell;
-                if (depth)
-                    list_append(&c->trail, trail_entry);
+    if (btn->type == PGTYPE_INDEX_INTERNAL)
+    {
+        if (chidb_Btree_getCell(btn, i == btn->n_cells ? i - 1 : i, &(c->current_cell)) != CHIDB_OK)
+            return CHIDB_ECELLNO;
 
-                if (seek_type == SEEKLT)
-                    return chidb_dbm_cursor_rev(bt, c);
+        trail_entry->n_current_cell = i;
 
-                else if (seek_type == SEEKGT)
-                    return chidb_dbm_cursor_fwd(bt, c);
+        return chidb_dbm_cursor_seek(bt, c, key,
+                                     i == btn->n_cells ? btn->right_page : c->current_cell.fields.indexInternal.child_page,
+                                     depth+1, seek_type);
+    }
 
-                return CHIDB_OK;
-            }
-            else if (cell.key > key)
-            {
-                // technically not correct for if it's seek, but doesn't matter...
-                trail_entry->n_current_cell = i;
-                c->current_cell = cell;
-                if (depth)
-                    list_append(&c->trail, trail_entry);
+    if (i == btn->n_cells)
+    {
+        // the entry after the last one in this leaf may be further up the tree
+        trail_entry->n_current_cell = btn->n_cells - 1;
+        chidb_Btree_getCell(btn, btn->n_cells - 1, &(c->current_cell));
 
-                if (seek_type == SEEK)
-                    return CHIDB_ENOTFOUND;
+        if (seek_type == SEEKLT || seek_type == SEEKLE)
+            return CHIDB_OK;
 
-                else if (seek_type == SEEKLT || seek_type == SEEKLE)
-                    return chidb_dbm_cursor_rev(bt, c);
+        if ((rc = chidb_dbm_cursor_fwd(bt, c)) != CHIDB_OK)
+            return (seek_type == SEEK && rc == CHIDB_CURSORCANTMOVE) ? CHIDB_ENOTFOUND : rc;
+    }
+    else
+    {
+        trail_entry->n_current_cell = i;
+        chidb_Btree_getCell(btn, i, &(c->current_cell));
 
-                return CHIDB_OK;
-            }
-            else if (cell.key < key)
-            {
-                i++;
-            }
+        if (seek_type == SEEKLT || seek_type == SEEKLE)
+            return chidb_dbm_cursor_rev(bt, c);
+    }
+
+    if (seek_type == SEEK && c->current_cell.key != key)
+        return CHIDB_ENOTFOUND;
+
+    return CHIDB_OK;
+}
+
+/* The part of chidb_dbm_cursor_seek that searches the node at the bottom
+ * of the trail (at the given depth) and goes on down from it */
+static int chidb_dbm_cursor_seekFrom(BTree *bt, chidb_dbm_cursor_t *c, chidb_key_t key, int depth, int seek_type)
+{
+    chidb_dbm_cursor_trail_t *trail_entry = CURSOR_TRAIL_TOP(c);
 
-            // i++;
-        } while (i < btn->n_cells);
+    BTreeCell cell;
+    BTreeNode *btn = &trail_entry->btn;
+
+    int found;
+    ncell_t i = 0;
+    npage_t child;
 
+    if (!btn->n_cells)
         return CHIDB_CURSORCANTMOVE;
+
+    // table internal nodes hold keys <= cell key in the child, and larger
+    // ones in the right page; only the child pointer is needed on the way down
+    if (btn->type == PGTYPE_TABLE_INTERNAL)
+    {
+        trail_entry->n_current_cell = chidb_Btree_searchInternal(bt, btn, key, &child);
+        return chidb_dbm_cursor_seek(bt, c, key, child, depth+1, seek_type);
     }
 
-    else if (btn->type == PGTYPE_TABLE_INTERNAL)
+    if (btn->type == PGTYPE_INDEX_INTERNAL || btn->type == PGTYPE_INDEX_LEAF)
+        return chidb_dbm_cursor_seekIndexFrom(bt, c, key, depth, seek_type);
+
+    // i is the first cell with a key >= the key we're seeking
+    found = chidb_Btree_searchNode(btn, key, &i);
+
+    if (i == btn->n_cells)
     {
-        do
+        // every key in this node is smaller than the one we want
+        if (btn->type == PGTYPE_TABLE_LEAF || btn->type == PGTYPE_INDEX_LEAF)
         {
-            if (chidb_Btree_getCell(btn, i, &cell) != CHIDB_OK)
-                return CHIDB_ECELLNO;
+            // rest on the last cell; the entry after it may be further up the tree
+            trail_entry->n_current_cell = btn->n_cells - 1;
+            chidb_Btree_getCell(btn, btn->n_cells - 1, &(c->current_cell));
 
-            if ((cell.key >= key))
-            {
-                // add the node to the cursor's list
-                trail_entry->n_current_cell = i;
-                c->current_cell = cell;
-                if (depth)
-                    list_append(&c->trail, trail_entry);
-
-                if ((status = chidb_dbm_cursor_seek(bt, c, key,
-                                                    cell.fields.tableInternal.child_page, depth+1, seek_type)) != CHIDB_OK)
-                    return status;
+            if (seek_type == SEEKLT || seek_type == SEEKLE)
                 return CHIDB_OK;
-            }
-            else
-            {
-                i++;
-            }
+            else if (seek_type == SEEK)
+                return CHIDB_ENOTFOUND;
 
-        } while ((cell.key < key) && (i < btn->n_cells));
+            return chidb_dbm_cursor_fwd(bt, c);
+        }
 
+        if (chidb_Btree_getCell(btn, i - 1, &cell) != CHIDB_OK)
+            return CHIDB_ECELLNO;
 
         trail_entry->n_current_cell = btn->n_cells;
         c->current_cell = cell;
-        if (depth)
-            list_append(&c->trail, trail_entry);
 
         return chidb_dbm_cursor_seek(bt, c, key, btn->right_page, depth+1, seek_type);
     }
 
-    else
+    if (chidb_Btree_getCell(btn, i, &cell) != CHIDB_OK)
+        return CHIDB_ECELLNO;
+
+    trail_entry->n_current_cell = i;
+    c->current_cell = cell;
+
+    if (found == CHIDB_TRUE) // WE FOUND A THING
     {
-        do
-        {
-            if (chidb_Btree_getCell(btn, i, &cell) != CHIDB_OK)
-                return CHIDB_ECELLNO;
+        if (seek_type == SEEKLT)
+            return chidb_dbm_cursor_rev(bt, c);
 
-            if (cell.key == key) // WE FOUND A THING
-            {
-                trail_entry->n_current_cell = i;
-                c->current_cell = cell;
-                if (depth)
-                    list_append(&c->trail, trail_entry);
+        else if (seek_type == SEEKGT)
+            return chidb_dbm_cursor_fwd(bt, c);
 
-                if (seek_type == SEEKLT)
-                    return chidb_dbm_cursor_rev(bt, c);
-                else if (seek_type == SEEKGT)
-                    return chidb_dbm_cursor_fwd(bt, c);
+        return CHIDB_OK;
+    }
 
-                return CHIDB_OK;
-            }
-            else if (cell.key > key)
-            {
-                trail_entry->n_current_cell = i;
-                c->current_cell = cell;
-                if (depth)
-                    list_append(&c->trail, trail_entry);
-
-                if (btn->type == PGTYPE_INDEX_INTERNAL)
-                    return chidb_dbm_cursor_seek(bt, c, key,
-                                                 cell.fields.indexInternal.child_page, depth+1, seek_type);
-                else
-                {
-                    if (seek_type == SEEK)
-                        return CHIDB_ENOTFOUND;
-
-                    else if (seek_type == SEEKLT || seek_type == SEEKLE)
-                        return chidb_dbm_cursor_rev(bt, c);
-
-                    return CHIDB_OK;
-                }
-            }
+    // cell.key > key
+    if (btn->type == PGTYPE_INDEX_INTERNAL)
+        return chidb_dbm_cursor_seek(bt, c, key,
+                                     cell.fields.indexInternal.child_page, depth+1, seek_type);
 
-            i++;
-        } while (i < btn->n_cells);
+    // technically not correct for if it's seek, but doesn't matter...
+    if (seek_type == SEEK)
+        return CHIDB_ENOTFOUND;
 
-        if (btn->type == PGTYPE_INDEX_INTERNAL)
-        {
-            trail_entry->n_current_cell = btn->n_cells;
-            c->current_cell = cell;
-            if (depth)
-                list_append(&c->trail, trail_entry);
+    else if (seek_type == SEEKLT || seek_type == SEEKLE)
+        return chidb_dbm_cursor_rev(bt, c);
 
-            return chidb_dbm_cursor_seek(bt, c, key, btn->right_page, depth+1, seek_type);
-        }
+    return CHIDB_OK;
+}
+
+
+/* Seek a text in a text index
+ *
+ * Same as chidb_dbm_cursor_seek, for the entries of a text index. Entries
+ * with the same text are in the order of their primary keys, so the seek
+ * lands on the first (or, for SEEKLE, the last) of them.
+ *
+ * Return
+ * - CHIDB_OK: The cursor is on the entry sought
+ * - CHIDB_ENOTFOUND: SEEK did not find the text (the cursor is on the entry
+ *                    after it, or on the last one)
+ * - CHIDB_CURSORCANTMOVE: There is no such entry
+ * - CHIDB_ETYPE: The cursor is not on a text index
+ */
+int chidb_dbm_cursor_seekText(BTree *bt, chidb_dbm_cursor_t *c, const uint8_t *text, uint32_t len, int seek_type)
+{
+    BTreeTextKey key = { text, len, 0, TEXTKEY_FIRST };
+    chidb_dbm_cursor_trail_t *ct;
+    BTreeCell *cell = &c->current_cell;
+    ncell_t i;
+    int status;
+
+    CHIDB_COUNT(bt->stats.seeks, 1);
+    CHIDB_PROBE(cursor__seek__text, c->root_page, len, seek_type);
+    if ((status = chidb_dbm_cursor_reset(bt, c)) != CHIDB_OK)
+        return status;
+    if (!PGTYPE_IS_TEXTINDEX(c->trail[0].btn.type))
+        return CHIDB_ETYPE;
+
+    // position right after the entries with the text, or right before them
+    if (seek_type == SEEKGT || seek_type == SEEKLE)
+        key.edge = TEXTKEY_LAST;
+
+    for (ct = CURSOR_TRAIL_TOP(c); !chidb_dbm_cursor_is_leaf(ct); ct = CURSOR_TRAIL_TOP(c))
+    {
+        chidb_Btree_searchText(&ct->btn, &key, &i);
+        ct->n_current_cell = i;
+        if ((status = chidb_dbm_cursor_trail_push(bt, c, chidb_Btree_getChild(&ct->btn, i))) != CHIDB_OK)
+            return status;
+    }
 
-        else if (btn->type == PGTYPE_INDEX_LEAF)
+    // i is the first entry after the position
+    chidb_Btree_searchText(&ct->btn, &key, &i);
+
+    if (i == ct->btn.n_cells)
+    {
+        if (!ct->btn.n_cells)
             return CHIDB_CURSORCANTMOVE;
+
+        // rest on the last entry; the one after it may be in the next leaf
+        ct->n_current_cell = ct->btn.n_cells - 1;
+        chidb_Btree_getCell(&ct->btn, ct->n_current_cell, cell);
+
+        if (seek_type == SEEKLT || seek_type == SEEKLE)
+            return CHIDB_OK;
+
+        if ((status = chidb_dbm_cursor_fwd(bt, c)) != CHIDB_OK)
+            return (seek_type == SEEK) ? CHIDB_ENOTFOUND : status;
+    }
+    else
+    {
+        ct->n_current_cell = i;
+        chidb_Btree_getCell(&ct->btn, i, cell);
+    }
+
+    if (seek_type == SEEKLT || seek_type == SEEKLE)
+        return chidb_dbm_cursor_rev(bt, c);
+
+    if (seek_type == SEEK)
+    {
+        key.edge = TEXTKEY_LAST;
+        if (chidb_Btree_compareText(cell, &key) > 0)
+            return CHIDB_ENOTFOUND;
+    }
+
+    return CHIDB_OK;
+}
+
+/* Checks whether a key goes at the end of the leaf the cursor is on
+ *
+ * That is the case when the trail runs down the right edge of the tree
+ * and the key is larger than every key in the leaf, so the key is larger
+ * than every key in the tree.
+ */
+static bool chidb_dbm_cursor_appends(chidb_dbm_cursor_t *c, chidb_key_t key)
+{
+    chidb_dbm_cursor_trail_t *ct = CURSOR_TRAIL_TOP(c);
+
+    if(ct->btn.type != PGTYPE_TABLE_LEAF)
+        return false;
+
+    for(uint32_t i = 0; i < c->depth - 1; i++)
+        if(c->trail[i].n_current_cell != c->trail[i].btn.n_cells)
+            return false;
+
+    if(ct->btn.n_cells == 0)
+        return true;
+
+    return chidb_Btree_tableLeafKey(&ct->btn, ct->btn.n_cells - 1) < key;
+}
+
+/* Insert an entry into a table through a cursor
+ *
+ * The cursor is moved to the leaf the entry belongs in, and the entry is
+ * added to that leaf in place. When the cursor is already on the last
+ * leaf of the tree and the key is larger than all the others (as when
+ * rows are inserted in primary key order), there is no need to go down
+ * from the root at all. Only when the leaf is full is the entry handed
+ * to chidb_Btree_insert, which splits it, and the cursor is then moved
+ * again, since the split changes the pages on the trail. Either way the
+ * cursor ends up on the new entry.
+ *
+ * Return
+ * - CHIDB_OK: Operation sucessful
+ * - CHIDB_EDUPLICATE: An entry with that key already exists
+ * - CHIDB_EMISMATCH: The key does not fit in the file's key size
+ * - chidb_Btree_insert return codes
+ */
+int chidb_dbm_cursor_insert(BTree *bt, chidb_dbm_cursor_t *c, BTreeCell *btc)
+{
+    chidb_dbm_cursor_trail_t *ct;
+    ncell_t ncell;
+    int rc;
+
+    if((rc = chidb_Btree_checkKeys(bt, btc)) != CHIDB_OK)
+        return rc;
+
+    if(!chidb_dbm_cursor_appends(c, btc->key))
+    {
+        rc = chidb_dbm_cursor_seek(bt, c, btc->key, c->root_page, 0, SEEK);
+        if(rc == CHIDB_OK)
+            return CHIDB_EDUPLICATE;
+        if(rc != CHIDB_ENOTFOUND && rc != CHIDB_CURSORCANTMOVE)
+            return rc;
+    }
+
+    c->record.valid = false;
+    ct = CURSOR_TRAIL_TOP(c);
+
+    if(!hasRoomForCell(&ct->btn, btc))
+    {
+        if((rc = chidb_Btree_insert(bt, c->root_page, btc)) != CHIDB_OK)
+            return rc;
+
+        rc = chidb_dbm_cursor_seek(bt, c, btc->key, c->root_page, 0, SEEK);
+        c->root_type = c->trail[0].btn.type;
+        return rc;
+    }
+
+    // the part of a record that does not fit in the page goes first
+    if((rc = chidb_Btree_spill(bt, btc)) != CHIDB_OK)
+        return rc;
+
+    chidb_Btree_searchNode(&ct->btn, btc->key, &ncell);
+    if((rc = chidb_Btree_insertCell(&ct->btn, ncell, btc)) != CHIDB_OK)
+        return rc;
+    if((rc = chidb_Btree_writeNode(bt, &ct->btn)) != CHIDB_OK)
+        return rc;
+
+    ct->n_current_cell = ncell;
+    return chidb_Btree_getCell(&ct->btn, ncell, &(c->current_cell));
+}
+
+/* Delete the entry a table cursor is on
+ *
+ * The entry is removed with chidb_Btree_delete, which may merge or free
+ * pages on the trail, so the trail is let go of first. The cursor is
+ * then moved to the entry that followed the deleted one, and marked, so
+ * that the next chidb_dbm_cursor_fwd stays there instead of skipping
+ * over it. If there is no such entry, the next move fails as usual.
+ *
+ * Return
+ * - CHIDB_OK: Operation sucessful
+ * - chidb_Btree_delete return codes
+ */
+int chidb_dbm_cursor_delete(BTree *bt, chidb_dbm_cursor_t *c)
+{
+    chidb_key_t key = c->current_cell.key;
+    int rc;
+
+    if(c->current_cell.type != PGTYPE_TABLE_LEAF)
+        return CHIDB_ETYPE;
+
+    c->record.valid = false;
+    while(c->depth > 0)
+        chidb_dbm_cursor_trail_pop(bt, c);
+
+    if((rc = chidb_Btree_delete(bt, c->root_page, key)) != CHIDB_OK)
+        return rc;
+
+    rc = chidb_dbm_cursor_seek(bt, c, key, c->root_page, 0, SEEKGE);
+    if(c->depth > 0)
+        c->root_type = c->trail[0].btn.type;
+    if(rc == CHIDB_OK)
+        c->deleted = true;
+    else if(rc != CHIDB_CURSORCANTMOVE)
+        return rc;
+
+    return CHIDB_OK;
+}
+
+/* Replace the record of the entry a table cursor is on
+ *
+ * When the new record fits in the leaf (see chidb_Btree_replaceCell),
+ * the cell is rewritten where it is, and the leaf is the only page
+ * written. Otherwise the entry is deleted and inserted again with the
+ * same key, which may restructure the tree, and the cursor is moved back
+ * to it. Either way the cursor ends up on the entry, so the next
+ * chidb_dbm_cursor_fwd moves on to the entry after it.
+ *
+ * Return
+ * - CHIDB_OK: Operation sucessful
+ * - CHIDB_ETYPE: The cursor is not on a table entry
+ * - chidb_Btree_delete and chidb_Btree_insert return codes
+ */
+int chidb_dbm_cursor_update(BTree *bt, chidb_dbm_cursor_t *c, uint8_t *data, uint32_t size)
+{
+    chidb_dbm_cursor_trail_t *ct;
+    BTreeCell btc;
+    int rc;
+
+    if(c->depth == 0 || c->current_cell.type != PGTYPE_TABLE_LEAF)
+        return CHIDB_ETYPE;
+
+    btc.type = PGTYPE_TABLE_LEAF;
+    btc.key = c->current_cell.key;
+    btc.fields.tableLeaf.data = data;
+    btc.fields.tableLeaf.data_size = size;
+
+    c->record.valid = false;
+    c->filter.npage = 0;
+    ct = CURSOR_TRAIL_TOP(c);
+
+    if(chidb_Btree_replaceCell(&ct->btn, ct->n_current_cell, &btc))
+    {
+        if((rc = chidb_Btree_writeNode(bt, &ct->btn)) != CHIDB_OK)
+            return rc;
+        return chidb_Btree_getCell(&ct->btn, ct->n_current_cell, &(c->current_cell));
     }
 
-    return CHIDB_OK; // this should never be reached!
+    // the tree may change under the trail, so let go of it first
+    while(c->depth > 0)
+        chidb_dbm_cursor_trail_pop(bt, c);
+    if((rc = chidb_Btree_delete(bt, c->root_page, btc.key)) != CHIDB_OK)
+        return rc;
+    if((rc = chidb_Btree_insert(bt, c->root_page, &btc)) != CHIDB_OK)
+        return rc;
+
+    rc = chidb_dbm_cursor_seek(bt, c, btc.key, c->root_page, 0, SEEK);
+    c->root_type = c->trail[0].btn.type;
+    return rc;
 }
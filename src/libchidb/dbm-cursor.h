@@ -43,7 +43,7 @@
 
 #include "chidbInt.h"
 #include "btree.h"
-#include "../simclist/simclist.h"
+#include "record.h"
 
 typedef uint32_t ncol_t;   // number of columns a table has OR the number of a column
 
@@ -51,9 +51,17 @@ typedef enum chidb_dbm_cursor_type
 {
     CURSOR_UNSPECIFIED,
     CURSOR_READ,
-    CURSOR_WRITE
+    CURSOR_WRITE,
+    CURSOR_HASH,
+    CURSOR_SORTER
 } chidb_dbm_cursor_type_t;
 
+/* See dbm-hash.h */
+typedef struct chidb_dbm_hash chidb_dbm_hash_t;
+
+/* See dbm-sorter.h */
+typedef struct chidb_dbm_sorter chidb_dbm_sorter_t;
+
 typedef enum chidb_dbm_seek_type
 {
     SEEK,
@@ -63,42 +71,131 @@ typedef enum chidb_dbm_seek_type
     SEEKGT
 } chidb_dbm_seek_type_t;
 
+/* Deepest tree a cursor can walk. With the smallest page size an internal
+ * node still holds dozens of cells, so this is far beyond any real file */
+#define CURSOR_MAX_DEPTH (32)
+
 typedef struct chidb_dbm_cursor_trail
 {
-    uint32_t depth; // 0 indexed from root
-
-    BTreeNode *btn; // data structure representation w/ mempage
+    BTreeNode btn; // data structure representation w/ mempage (pinned while in the trail)
 
     int n_current_cell; // cell whose child page we're currently down
+    int readahead;      // last cell whose child page was prefetched (see chidb_dbm_cursorTable_fwd)
 } chidb_dbm_cursor_trail_t;
 
+/* Header of the record in the cell the cursor is pointing to. It is decoded
+ * as far as the columns that are read, and reused until the cursor moves */
+typedef struct chidb_dbm_cursor_record
+{
+    bool valid;             // true if the header below belongs to current_cell
+    bool full;              // true if dbr's data points into the cursor's payload
+    uint32_t header_pos;    // where the types of the fields not yet decoded start
+
+    DBRecord dbr;           // data points into current_cell, or into payload if
+                            // the record continues in overflow pages
+    uint32_t types[DBRECORD_MAX_FIELDS];
+    uint32_t offsets[DBRECORD_MAX_FIELDS];
+} chidb_dbm_cursor_record_t;
+
+/* Comparisons a scan can be filtered with (see chidb_dbm_cursor_filter) */
+typedef enum chidb_dbm_filter_cmp
+{
+    FILTER_EQ,
+    FILTER_NE,
+    FILTER_LT,
+    FILTER_LE,
+    FILTER_GT,
+    FILTER_GE
+} chidb_dbm_filter_cmp_t;
+
+/* An integer column of every entry of the leaf the cursor is on, and
+ * which of those entries a comparison rules out */
+typedef struct chidb_dbm_cursor_filter
+{
+    npage_t npage;          // leaf the values were read from (0 if none)
+    ncell_t n_cells;        // number of entries in values, known and fails
+    ncol_t col;             // column the values were read from
+
+    bool evaluated;         // true if fails is the result of cmp and value
+    chidb_dbm_filter_cmp_t cmp;
+    int64_t value;
+
+    int64_t *values;        // values[i] is only meaningful if known[i] is 1
+    uint8_t *known;         // 1 if the column of entry i is an integer in the page
+    uint8_t *fails;         // 1 if entry i is known not to match
+    uint32_t size;          // number of entries the arrays have room for
+} chidb_dbm_cursor_filter_t;
+
 typedef struct chidb_dbm_cursor
 {
     BTreeCell current_cell; // access to data (current table cell the cursor is pointing to)
 
+    BTree *bt;              // B-Tree the table is in (that of an attached database, or the main one)
+
     npage_t root_page;      // root page of the table in case of reloading
     uint8_t root_type;      // type of page the root is (can be any of the four)
 
     ncol_t n_cols;          // number of columns in the table
-    list_t trail;           // holds chidb_dbm_cursor_trail
+    chidb_dbm_cursor_trail_t trail[CURSOR_MAX_DEPTH]; // trail[0] is the root
+    uint32_t depth;         // number of levels in the trail
+
+    chidb_dbm_cursor_record_t record; // use chidb_dbm_cursor_record to access
+    char *text;             // NUL-terminated copies of the text fields of the current entry
+    uint32_t text_size;
+    uint8_t *payload;       // all the data of the current entry, when a column past
+    uint32_t payload_size;  // the part in the page is read (see chidb_dbm_cursor_record)
+
+    chidb_dbm_cursor_filter_t filter; // use chidb_dbm_cursor_filter to access
+
+    chidb_dbm_hash_t *hash; // the hash table of a CURSOR_HASH (NULL otherwise)
+    chidb_dbm_sorter_t *sorter; // the sorter of a CURSOR_SORTER (NULL otherwise)
 
     chidb_dbm_cursor_type_t type;
 
+    bool deleted;           // the entry under the cursor follows one that was just
+                            // deleted, so the next move forward stays on it
+
+    bool deferred;          // the cursor is to be moved to deferred_key before its
+    chidb_key_t deferred_key; // entry is read (see chidb_dbm_cursor_finishSeek)
 } chidb_dbm_cursor_t;
 
+/* Where a cursor is, so that it can be put back there after a move that
+ * did not complete (see chidb_dbm_cursor_save) */
+typedef struct chidb_dbm_cursor_position
+{
+    uint32_t depth;
+    npage_t npage[CURSOR_MAX_DEPTH];
+    int n_current_cell[CURSOR_MAX_DEPTH];
+    int readahead[CURSOR_MAX_DEPTH];
+
+    bool deleted;
+    bool deferred;
+    chidb_key_t deferred_key;
+} chidb_dbm_cursor_position_t;
+
+/* The level of the trail the cursor is resting on */
+#define CURSOR_TRAIL_TOP(c) (&(c)->trail[(c)->depth - 1])
+
 /* Cursor function definitions go here */
 int chidb_dbm_cursor_print(chidb_dbm_cursor_t *c);
 
-int chidb_dbm_cursor_trail_new(BTree *bt, chidb_dbm_cursor_trail_t **ct, npage_t npage, uint32_t depth);
-int chidb_dbm_cursor_trail_list_destroy(BTree *bt, list_t *restrict l);
-int chidb_dbm_cursor_trail_cpy(BTree *bt, list_t *restrict l1, list_t *restrict l2);
+int chidb_dbm_cursor_trail_push(BTree *bt, chidb_dbm_cursor_t *c, npage_t npage);
+int chidb_dbm_cursor_trail_pop(BTree *bt, chidb_dbm_cursor_t *c);
 int chidb_dbm_cursor_clear_trail_from(BTree *bt, chidb_dbm_cursor_t *c, uint32_t depth); // clears everything NOT INCLUDING given depth
-int chidb_dbm_cursor_trail_remove_at(BTree *bt, chidb_dbm_cursor_t *c, uint32_t depth);
+int chidb_dbm_cursor_reset(BTree *bt, chidb_dbm_cursor_t *c);
+void chidb_dbm_cursor_save(chidb_dbm_cursor_t *c, chidb_dbm_cursor_position_t *pos);
+int chidb_dbm_cursor_restore(BTree *bt, chidb_dbm_cursor_t *c, const chidb_dbm_cursor_position_t *pos);
 
 int chidb_dbm_cursor_init(BTree *bt, chidb_dbm_cursor_t *c, npage_t root_page, ncol_t n_cols);
 int chidb_dbm_cursor_destroy(BTree *bt, chidb_dbm_cursor_t *c);
+int chidb_dbm_cursor_record(BTree *bt, chidb_dbm_cursor_t *c, int field, DBRecord **dbr);
+int chidb_dbm_cursor_finishSeek(BTree *bt, chidb_dbm_cursor_t *c);
+int chidb_dbm_cursor_text(BTree *bt, chidb_dbm_cursor_t *c, uint8_t field, char **s);
+int chidb_dbm_cursor_keyText(BTree *bt, chidb_dbm_cursor_t *c, char **s);
+int chidb_dbm_cursor_filter(BTree *bt, chidb_dbm_cursor_t *c, ncol_t col, chidb_dbm_filter_cmp_t cmp, int64_t value);
 
 int chidb_dbm_cursor_fwd(BTree *bt, chidb_dbm_cursor_t *c);
+int chidb_dbm_cursor_skip(BTree *bt, chidb_dbm_cursor_t *c, uint32_t n);
 int chidb_dbm_cursorTable_fwd(BTree *bt, chidb_dbm_cursor_t *c);
 int chidb_dbm_cursorTable_fwdUp(BTree *bt, chidb_dbm_cursor_t *c);
 int chidb_dbm_cursorTable_fwdDwn(BTree *bt, chidb_dbm_cursor_t *c);
@@ -115,5 +212,10 @@ int chidb_dbm_cursorIndex_revUp(BTree *bt, chidb_dbm_cursor_t *c);
 int chidb_dbm_cursorIndex_revDwn(BTree *bt, chidb_dbm_cursor_t *c);
 
 int chidb_dbm_cursor_seek(BTree *bt, chidb_dbm_cursor_t *c, chidb_key_t key, npage_t next, int depth, int seek_type);
+int chidb_dbm_cursor_seekNear(BTree *bt, chidb_dbm_cursor_t *c, chidb_key_t key);
+int chidb_dbm_cursor_seekText(BTree *bt, chidb_dbm_cursor_t *c, const uint8_t *text, uint32_t len, int seek_type);
+int chidb_dbm_cursor_insert(BTree *bt, chidb_dbm_cursor_t *c, BTreeCell *btc);
+int chidb_dbm_cursor_delete(BTree *bt, chidb_dbm_cursor_t *c);
+int chidb_dbm_cursor_update(BTree *bt, chidb_dbm_cursor_t *c, uint8_t *data, uint32_t size);
 
 #endif /* DBM_CURSOR_H_ */
\ No newline at end of file
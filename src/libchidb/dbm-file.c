@@ -75,7 +75,7 @@ typedef enum dbm_file_program_type
 int chidb_stmt_codegen(chidb_stmt *stmt, chisql_statement_t *sql_stmt);
 
 /* Implemented in optimizer.c */
-int chidb_stmt_optimize(chidb_stmt *stmt, chisql_statement_t *sql_stmt, chisql_statement_t **sql_stmt_opt);
+int chidb_stmt_optimize(chidb *db, chisql_statement_t *sql_stmt, chisql_statement_t **sql_stmt_opt);
 
 
 int __chidb_dbm_file_read_line(FILE *f, char* line)
@@ -280,7 +280,9 @@ int __chidb_dbm_file_parse_register(char *line, chidb_dbm_file_register_t *reg)
         reg->reg.type = REG_INT32;
         if(ntokens == 3)
         {
-            reg->reg.value.i = atoi(tokens[2]);
+            reg->reg.value.i = atoll(tokens[2]);
+            if ((int32_t) reg->reg.value.i != reg->reg.value.i)
+                reg->reg.type = REG_INT64;
             reg->has_value = true;
         }
     }
@@ -445,7 +447,7 @@ int __chidb_dbm_file_load(const char* filename, chidb_dbm_file_t **_dbmf, chidb
                         return rc;
                     }
 
-                    rc = chidb_stmt_optimize(&dbmf->stmt, sql_stmt, &sql_stmt_opt);
+                    rc = chidb_stmt_optimize(dbmf->db, sql_stmt, &sql_stmt_opt);
 
                     if(rc != CHIDB_OK)
                     {
@@ -500,7 +502,7 @@ int chidb_dbm_file_load2(const char* filename, chidb_dbm_file_t **dbmf, const ch
 
 int chidb_dbm_file_run(chidb_dbm_file_t *dbmf)
 {
-    return chidb_stmt_exec(&dbmf->stmt);
+    return chidb_stmt_sync(&dbmf->stmt, chidb_stmt_exec(&dbmf->stmt));
 }
 
 int chidb_dbm_file_print_rr(chidb_dbm_file_t *dbmf)
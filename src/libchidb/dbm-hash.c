@@ -0,0 +1,562 @@
+/*
+ *  chidb - a didactic relational database management system
+ *
+ *  In-memory hash tables for the Database Machine
+ *
+ */
+
+/*
+ *  Copyright (c) 2009-2015, The University of Chicago
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or withsend
+ *  modification, are permitted provided that the following conditions are met:
+ *
+ *  - Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ *  - Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ *  - Neither the name of The University of Chicago nor the names of its
+ *    contributors may be used to endorse or promote products derived from this
+ *    software withsend specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ *  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ *  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ *  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ *  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ *  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ *  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ *  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ *  ARISING IN ANY WAY send OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ *  POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+/*
+ * A hash table holds rows of register values, looked up by their first
+ * few fields. The DBM uses them to evaluate joins: the rows of one input
+ * are inserted into a hash table (the "build" side), and then each row of
+ * the other input is looked up in it (the "probe" side). This takes one
+ * pass over each input, instead of one pass over the inner input for each
+ * row of the outer one.
+ *
+ * Rows with a NULL key are never inserted, and looking up a NULL key never
+ * finds anything, because NULL is not equal to anything in a join.
+ *
+ * Most probe rows of a selective join have no match. Before the rest of
+ * their key is even loaded, the first key field can be checked against a
+ * Bloom filter of the first key fields of the rows (see dbm-bloom.c),
+ * which is much smaller than the buckets, and rules out most of them.
+ *
+ * They are also used for GROUP BY, with a row per group, keyed by the
+ * values that are grouped by, and holding the accumulators of the
+ * aggregates as the rest of its fields. Those are updated in place as the
+ * rows of the group are read, and all the rows are then read back in no
+ * particular order. In such a hash table (nulls is true), NULL keys are
+ * kept, and are all equal, since all the NULLs go into the same group.
+ */
+
+#include "dbm-hash.h"
+#include "memory.h"
+
+#define HASH_CHUNK_SIZE (64 * 1024)
+#define HASH_INITIAL_BUCKETS (64)
+
+
+/* FNV-1a over the first n key fields */
+static bool hash_fields(chidb_dbm_hash_t *h, chidb_dbm_register_t *key, uint32_t n_fields, uint32_t *hash)
+{
+    uint32_t x = 2166136261u;
+
+    for (uint32_t i = 0; i < n_fields; i++)
+    {
+        const uint8_t *bytes;
+        size_t n;
+        uint32_t type = key[i].type;
+
+        if (IS_INT_REG(key[i].type))
+        {
+            bytes = (const uint8_t *) &key[i].value.i;
+            n = sizeof(int64_t);
+            type = REG_INT32;
+        }
+        else if (key[i].type == REG_STRING)
+        {
+            bytes = (const uint8_t *) key[i].value.s;
+            n = strlen(key[i].value.s);
+        }
+        else if (h->nulls && (key[i].type == REG_NULL || key[i].type == REG_UNSPECIFIED))
+        {
+            bytes = NULL;
+            n = 0;
+            type = REG_NULL;
+        }
+        else
+            return false;
+
+        x = (x ^ type) * 16777619u;
+        for (size_t j = 0; j < n; j++)
+            x = (x ^ bytes[j]) * 16777619u;
+    }
+
+    *hash = x;
+    return true;
+}
+
+static bool hash_key(chidb_dbm_hash_t *h, chidb_dbm_register_t *key, uint32_t *hash)
+{
+    return hash_fields(h, key, h->nkeys, hash);
+}
+
+static bool keys_equal(chidb_dbm_hash_t *h, chidb_dbm_hash_row_t *row, chidb_dbm_register_t *key)
+{
+    for (uint32_t i = 0; i < h->nkeys; i++)
+    {
+        chidb_dbm_register_t *f = &row->fields[i];
+        bool fnull = f->type == REG_NULL || f->type == REG_UNSPECIFIED;
+        bool knull = key[i].type == REG_NULL || key[i].type == REG_UNSPECIFIED;
+
+        if (fnull || knull)
+        {
+            if (fnull != knull)
+                return false;
+            continue;
+        }
+        if (IS_INT_REG(f->type) && IS_INT_REG(key[i].type))
+        {
+            if (f->value.i != key[i].value.i)
+                return false;
+            continue;
+        }
+        if (f->type != key[i].type)
+            return false;
+        if (f->type == REG_STRING && strcmp(f->value.s, key[i].value.s) != 0)
+            return false;
+    }
+
+    return true;
+}
+
+/* Charges memory to the database the hash table belongs to (see
+ * chidb_memory_charge) */
+static int hash_charge(chidb_dbm_hash_t *h, size_t size)
+{
+    int rc;
+
+    if ((rc = chidb_memory_charge(h->db, CHIDB_MEMORY_HASHES, size)) == CHIDB_OK)
+        h->mem += size;
+
+    return rc;
+}
+
+/* Allocates memory for a row, or a value of one, from the arena */
+static void *hash_alloc(chidb_dbm_hash_t *h, size_t size)
+{
+    if (hash_charge(h, size) != CHIDB_OK)
+        return NULL;
+
+    return chidb_dbm_arena_alloc(&h->arena, size);
+}
+
+static int hash_grow(chidb_dbm_hash_t *h)
+{
+    uint32_t nbuckets = h->nbuckets * 2;
+    chidb_dbm_hash_row_t **buckets;
+
+    // the old buckets are freed once the new ones are filled
+    if (hash_charge(h, nbuckets * sizeof(chidb_dbm_hash_row_t *)) != CHIDB_OK)
+        return CHIDB_ENOMEM;
+    if ((buckets = calloc(nbuckets, sizeof(chidb_dbm_hash_row_t *))) == NULL)
+        return CHIDB_ENOMEM;
+
+    // walking each chain from the front and pushing onto the new chains
+    // would reverse them, so rows are appended to keep insertion order
+    chidb_dbm_hash_row_t **tails = calloc(nbuckets, sizeof(chidb_dbm_hash_row_t *));
+    if (tails == NULL)
+    {
+        free(buckets);
+        return CHIDB_ENOMEM;
+    }
+
+    for (uint32_t i = 0; i < h->nbuckets; i++)
+    {
+        chidb_dbm_hash_row_t *row = h->buckets[i], *next;
+
+        for (; row != NULL; row = next)
+        {
+            uint32_t b = row->hash & (nbuckets - 1);
+
+            next = row->next;
+            row->next = NULL;
+            if (tails[b] == NULL)
+                buckets[b] = row;
+            else
+                tails[b]->next = row;
+            tails[b] = row;
+        }
+    }
+
+    free(tails);
+    free(h->buckets);
+    chidb_memory_release(h->db, CHIDB_MEMORY_HASHES, h->nbuckets * sizeof(chidb_dbm_hash_row_t *));
+    h->mem -= h->nbuckets * sizeof(chidb_dbm_hash_row_t *);
+    h->buckets = buckets;
+    h->nbuckets = nbuckets;
+
+    return CHIDB_OK;
+}
+
+
+/* Create an empty hash table
+ *
+ * Parameters
+ * - h: Out parameter for the new hash table
+ * - nkeys: Number of fields, at the start of each row, that rows are
+ *          looked up by
+ * - db: Database the memory of the rows is charged to (see
+ *       chidb_memory_charge), or NULL
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_ENOMEM: Could not allocate memory
+ */
+int chidb_dbm_hash_create(chidb_dbm_hash_t **h, uint32_t nkeys, chidb *db)
+{
+    if ((*h = malloc(sizeof(chidb_dbm_hash_t))) == NULL)
+        return CHIDB_ENOMEM;
+
+    (*h)->db = db;
+    (*h)->mem = 0;
+    (*h)->nkeys = nkeys;
+    (*h)->nulls = false;
+    (*h)->nbuckets = HASH_INITIAL_BUCKETS;
+    (*h)->nrows = 0;
+    chidb_dbm_arena_init(&(*h)->arena, HASH_CHUNK_SIZE);
+    (*h)->match = NULL;
+    (*h)->filter.words = NULL;
+    (*h)->filter_rows = 0;
+
+    if (hash_charge(*h, HASH_INITIAL_BUCKETS * sizeof(chidb_dbm_hash_row_t *)) != CHIDB_OK)
+    {
+        free(*h);
+        return CHIDB_ENOMEM;
+    }
+    if (((*h)->buckets = calloc(HASH_INITIAL_BUCKETS, sizeof(chidb_dbm_hash_row_t *))) == NULL)
+    {
+        chidb_memory_release(db, CHIDB_MEMORY_HASHES, (*h)->mem);
+        free(*h);
+        return CHIDB_ENOMEM;
+    }
+
+    return CHIDB_OK;
+}
+
+/* Free a hash table, and all of its rows */
+void chidb_dbm_hash_free(chidb_dbm_hash_t *h)
+{
+    chidb_memory_release(h->db, CHIDB_MEMORY_HASHES, h->mem);
+    chidb_dbm_arena_free(&h->arena);
+    chidb_dbm_bloom_free(&h->filter);
+    free(h->buckets);
+    free(h);
+}
+
+/* Insert a row into a hash table
+ *
+ * The values of the fields are copied, so the registers can be reused
+ * once this returns. Rows with the same key are found in the order they
+ * were inserted.
+ *
+ * Parameters
+ * - h: Hash table
+ * - fields: Values of the fields of the row
+ * - nfields: Number of fields. Must be at least the number of key fields.
+ *
+ * Return
+ * - CHIDB_OK: Operation successful (this includes not inserting a
+ *             row because its key has a NULL)
+ * - CHIDB_ENOMEM: Could not allocate memory, or the database has none
+ *                 left for the row
+ */
+int chidb_dbm_hash_insert(chidb_dbm_hash_t *h, chidb_dbm_register_t *fields, uint32_t nfields)
+{
+    uint32_t hash, size;
+    int rc;
+
+    if (!hash_key(h, fields, &hash))
+        return CHIDB_OK;
+
+    size = sizeof(chidb_dbm_hash_row_t) + nfields * sizeof(chidb_dbm_register_t);
+    for (uint32_t i = 0; i < nfields; i++)
+    {
+        if (fields[i].type == REG_STRING)
+            size += strlen(fields[i].value.s) + 1;
+        else if (fields[i].type == REGISTER_BINARY)
+            size += fields[i].value.bin.nbytes;
+    }
+
+    if (h->nrows >= h->nbuckets && (rc = hash_grow(h)) != CHIDB_OK)
+        return rc;
+
+    chidb_dbm_hash_row_t *row = hash_alloc(h, size);
+    if (row == NULL)
+        return CHIDB_ENOMEM;
+
+    uint8_t *data = (uint8_t *) &row->fields[nfields];
+
+    row->hash = hash;
+    row->nfields = nfields;
+    for (uint32_t i = 0; i < nfields; i++)
+    {
+        // the row owns its values, but registers that read them must not free them
+        row->fields[i] = fields[i];
+        row->fields[i].borrowed = true;
+
+        if (fields[i].type == REG_STRING)
+        {
+            size_t len = strlen(fields[i].value.s) + 1;
+            row->fields[i].value.s = memcpy(data, fields[i].value.s, len);
+            data += len;
+        }
+        else if (fields[i].type == REGISTER_BINARY)
+        {
+            row->fields[i].value.bin.bytes = memcpy(data, fields[i].value.bin.bytes, fields[i].value.bin.nbytes);
+            data += fields[i].value.bin.nbytes;
+        }
+    }
+
+    // append to the bucket, so that equal keys come out in insertion order
+    chidb_dbm_hash_row_t **p = &h->buckets[hash & (h->nbuckets - 1)];
+    while (*p != NULL)
+        p = &(*p)->next;
+    row->next = NULL;
+    *p = row;
+    h->nrows++;
+
+    return CHIDB_OK;
+}
+
+/* Find the first row with a given key
+ *
+ * The row is left in h->match.
+ *
+ * Parameters
+ * - h: Hash table
+ * - key: Values of the key fields
+ *
+ * Return
+ * - CHIDB_OK: A row was found
+ * - CHIDB_ENOTFOUND: There is no row with that key
+ */
+int chidb_dbm_hash_find(chidb_dbm_hash_t *h, chidb_dbm_register_t *key)
+{
+    uint32_t hash;
+
+    h->match = NULL;
+    if (!hash_key(h, key, &hash))
+        return CHIDB_ENOTFOUND;
+
+    for (chidb_dbm_hash_row_t *row = h->buckets[hash & (h->nbuckets - 1)]; row != NULL; row = row->next)
+        if (row->hash == hash && keys_equal(h, row, key))
+        {
+            h->match = row;
+            return CHIDB_OK;
+        }
+
+    return CHIDB_ENOTFOUND;
+}
+
+/* Build the Bloom filter from the rows (see chidb_dbm_hash_filter) */
+static int hash_filter_build(chidb_dbm_hash_t *h)
+{
+    uint32_t hash;
+    int rc;
+
+    chidb_dbm_bloom_free(&h->filter);
+    if ((rc = chidb_dbm_bloom_init(&h->filter, h->nrows)) != CHIDB_OK)
+        return rc;
+
+    for (uint32_t b = 0; b < h->nbuckets; b++)
+        for (chidb_dbm_hash_row_t *row = h->buckets[b]; row != NULL; row = row->next)
+        {
+            // with a single key field, the row's hash is that of its first field
+            if (h->nkeys == 1)
+                chidb_dbm_bloom_add(&h->filter, row->hash);
+            else if (hash_fields(h, row->fields, 1, &hash))
+                chidb_dbm_bloom_add(&h->filter, hash);
+        }
+    h->filter_rows = h->nrows;
+
+    return CHIDB_OK;
+}
+
+/* Could a row have a given value as its first key field?
+ *
+ * This is checked against a Bloom filter of the first key fields of the
+ * rows, so it is cheaper than chidb_dbm_hash_find, but it can answer true
+ * when there is no such row. The filter is built the first time it is
+ * needed after rows have been inserted (in a join, once all of the rows
+ * of the build side have been). If it cannot be built, the answer is
+ * always true.
+ *
+ * Parameters
+ * - h: Hash table
+ * - key: Value of the first key field
+ *
+ * Return
+ * - false if no row has that value
+ * - true if a row may have it
+ */
+bool chidb_dbm_hash_filter(chidb_dbm_hash_t *h, chidb_dbm_register_t *key)
+{
+    uint32_t hash;
+
+    if (h->nrows == 0)
+        return false;
+    if (h->nkeys == 0 || (h->filter_rows != h->nrows && hash_filter_build(h) != CHIDB_OK))
+        return true;
+    if (!hash_fields(h, key, 1, &hash))
+        return false;
+
+    return chidb_dbm_bloom_test(&h->filter, hash);
+}
+
+/* Find the next row with the same key as h->match
+ *
+ * Parameters
+ * - h: Hash table
+ * - key: Values of the key fields (the same ones given to
+ *        chidb_dbm_hash_find)
+ *
+ * Return
+ * - CHIDB_OK: A row was found, and left in h->match
+ * - CHIDB_ENOTFOUND: There are no more rows with that key
+ */
+int chidb_dbm_hash_find_next(chidb_dbm_hash_t *h, chidb_dbm_register_t *key)
+{
+    if (h->match == NULL)
+        return CHIDB_ENOTFOUND;
+
+    for (chidb_dbm_hash_row_t *row = h->match->next; row != NULL; row = row->next)
+        if (row->hash == h->match->hash && keys_equal(h, row, key))
+        {
+            h->match = row;
+            return CHIDB_OK;
+        }
+
+    h->match = NULL;
+    return CHIDB_ENOTFOUND;
+}
+
+/* Change the fields of h->match that come after its key
+ *
+ * Strings are copied into the hash table, unless they are already the
+ * ones in the row. The old values stay where they were, unused, until the
+ * hash table is freed.
+ *
+ * Parameters
+ * - h: Hash table
+ * - fields: New values of the fields, starting with the first one after
+ *           the key
+ * - nfields: Number of fields to change
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_EMISUSE: There is no h->match, or it has fewer fields
+ * - CHIDB_ENOMEM: Could not allocate memory, or the database has none
+ *                 left for the values
+ */
+int chidb_dbm_hash_update(chidb_dbm_hash_t *h, chidb_dbm_register_t *fields, uint32_t nfields)
+{
+    chidb_dbm_hash_row_t *row = h->match;
+
+    if (row == NULL || h->nkeys + nfields > row->nfields)
+        return CHIDB_EMISUSE;
+
+    for (uint32_t i = 0; i < nfields; i++)
+    {
+        chidb_dbm_register_t *f = &row->fields[h->nkeys + i];
+        void *p;
+
+        if (fields[i].type == REG_STRING && (f->type != REG_STRING || f->value.s != fields[i].value.s))
+        {
+            size_t len = strlen(fields[i].value.s) + 1;
+            if ((p = hash_alloc(h, len)) == NULL)
+                return CHIDB_ENOMEM;
+            f->value.s = memcpy(p, fields[i].value.s, len);
+        }
+        else if (fields[i].type == REGISTER_BINARY && (f->type != REGISTER_BINARY || f->value.bin.bytes != fields[i].value.bin.bytes))
+        {
+            if ((p = hash_alloc(h, fields[i].value.bin.nbytes)) == NULL)
+                return CHIDB_ENOMEM;
+            f->value.bin.bytes = memcpy(p, fields[i].value.bin.bytes, fields[i].value.bin.nbytes);
+            f->value.bin.nbytes = fields[i].value.bin.nbytes;
+        }
+        else if (fields[i].type != REG_STRING && fields[i].type != REGISTER_BINARY)
+            f->value = fields[i].value;
+
+        f->type = fields[i].type;
+        f->borrowed = true;
+    }
+
+    return CHIDB_OK;
+}
+
+/* Move h->match to the first row of a hash table, in no particular order
+ *
+ * Return
+ * - CHIDB_OK: h->match is the first row
+ * - CHIDB_ENOTFOUND: The hash table is empty
+ */
+int chidb_dbm_hash_rewind(chidb_dbm_hash_t *h)
+{
+    for (uint32_t b = 0; b < h->nbuckets; b++)
+        if (h->buckets[b] != NULL)
+        {
+            h->match = h->buckets[b];
+            return CHIDB_OK;
+        }
+
+    h->match = NULL;
+    return CHIDB_ENOTFOUND;
+}
+
+/* Move h->match to the row after it, whatever its key
+ *
+ * Rows must not be inserted in between, as that can move them around.
+ *
+ * Return
+ * - CHIDB_OK: h->match is the next row
+ * - CHIDB_ENOTFOUND: There are no more rows
+ */
+int chidb_dbm_hash_next_row(chidb_dbm_hash_t *h)
+{
+    if (h->match == NULL)
+        return CHIDB_ENOTFOUND;
+    if (h->match->next != NULL)
+    {
+        h->match = h->match->next;
+        return CHIDB_OK;
+    }
+
+    for (uint32_t b = (h->match->hash & (h->nbuckets - 1)) + 1; b < h->nbuckets; b++)
+        if (h->buckets[b] != NULL)
+        {
+            h->match = h->buckets[b];
+            return CHIDB_OK;
+        }
+
+    h->match = NULL;
+    return CHIDB_ENOTFOUND;
+}
+
+/* Does a pointer point into one of the rows of a hash table? */
+bool chidb_dbm_hash_owns(chidb_dbm_hash_t *h, const void *p)
+{
+    return chidb_dbm_arena_owns(&h->arena, p);
+}
@@ -0,0 +1,91 @@
+/*
+ *  chidb - a didactic relational database management system
+ *
+ *  In-memory hash tables for the Database Machine -- header
+ *
+ */
+
+/*
+ *  Copyright (c) 2009-2015, The University of Chicago
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or withsend
+ *  modification, are permitted provided that the following conditions are met:
+ *
+ *  - Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ *  - Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ *  - Neither the name of The University of Chicago nor the names of its
+ *    contributors may be used to endorse or promote products derived from this
+ *    software withsend specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ *  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ *  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ *  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ *  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ *  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ *  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ *  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ *  ARISING IN ANY WAY send OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ *  POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+#ifndef DBM_HASH_H_
+#define DBM_HASH_H_
+
+#include "chidbInt.h"
+#include "dbm-types.h"
+#include "dbm-arena.h"
+#include "dbm-bloom.h"
+
+/* A row in a hash table
+ *
+ * The fields are copies of the registers the row was inserted from. The
+ * first nkeys of them (see chidb_dbm_hash_t) are the key. Strings are
+ * stored right after the fields, so a row is a single allocation. */
+typedef struct chidb_dbm_hash_row
+{
+    struct chidb_dbm_hash_row *next; // next row in the same bucket
+    uint32_t hash;
+    uint32_t nfields;
+    chidb_dbm_register_t fields[];
+} chidb_dbm_hash_row_t;
+
+struct chidb_dbm_hash
+{
+    uint32_t nkeys;                 // number of key fields in each row
+    bool nulls;                     // NULL keys are kept, and equal (GROUP BY)
+
+    chidb_dbm_hash_row_t **buckets; // always a power of two of them
+    uint32_t nbuckets;
+    uint32_t nrows;
+
+    chidb_dbm_arena_t arena;        // the rows are allocated from it
+    chidb *db;                      // the rows and buckets are charged to it (NULL if not)
+    size_t mem;                     // bytes charged
+
+    chidb_dbm_hash_row_t *match;    // row found by the last lookup, if any
+
+    chidb_dbm_bloom_t filter;       // first key field of the rows (see chidb_dbm_hash_filter)
+    uint32_t filter_rows;           // rows in the filter
+};
+
+int chidb_dbm_hash_create(chidb_dbm_hash_t **h, uint32_t nkeys, chidb *db);
+void chidb_dbm_hash_free(chidb_dbm_hash_t *h);
+int chidb_dbm_hash_insert(chidb_dbm_hash_t *h, chidb_dbm_register_t *fields, uint32_t nfields);
+int chidb_dbm_hash_find(chidb_dbm_hash_t *h, chidb_dbm_register_t *key);
+bool chidb_dbm_hash_filter(chidb_dbm_hash_t *h, chidb_dbm_register_t *key);
+int chidb_dbm_hash_find_next(chidb_dbm_hash_t *h, chidb_dbm_register_t *key);
+int chidb_dbm_hash_update(chidb_dbm_hash_t *h, chidb_dbm_register_t *fields, uint32_t nfields);
+int chidb_dbm_hash_rewind(chidb_dbm_hash_t *h);
+int chidb_dbm_hash_next_row(chidb_dbm_hash_t *h);
+bool chidb_dbm_hash_owns(chidb_dbm_hash_t *h, const void *p);
+
+#endif /* DBM_HASH_H_ */
@@ -38,14 +38,30 @@
  */
 
 
+#include <time.h>
 #include "dbm.h"
+#include "dbm-hash.h"
+#include "dbm-sorter.h"
+#include "result-cache.h"
 #include "btree.h"
 #include "record.h"
+#include "stats.h"
+#include "catalog.h"
+#include "util.h"
 
 // Forward declaration
 int chidb_dbm_op_WriteReg (chidb_stmt *stmt, int regNo, int reg_type, void *data);
+int chidb_dbm_op_WriteInt (chidb_stmt *stmt, int regNo, int64_t v);
+int chidb_dbm_op_WriteString (chidb_stmt *stmt, int regNo, char *s, bool borrowed);
+int chidb_dbm_op_WriteCopy (chidb_stmt *stmt, int regNo, int reg_type, const void *data, uint32_t n);
+uint8_t *chidb_dbm_reg_space (chidb_stmt *stmt, int regNo, uint32_t n);
 int realloc_cur(chidb_stmt *stmt, uint32_t size);
 int realloc_reg(chidb_stmt *stmt, uint32_t size);
+int load_schema(chidb *db, npage_t nroot);
+int reload_schema(chidb *db);
+int vacuum_database(chidb *db);
+int attach_database(chidb *db, const char *file, const char *name);
+int detach_database(chidb *db, const char *name);
 
 
 /* Function pointer for dispatch table */
@@ -83,6 +99,326 @@ int chidb_dbm_op_handle (chidb_stmt *stmt, chidb_dbm_op_t *op)
 }
 
 
+#if defined(__GNUC__)
+/* A program is compiled to threaded code once it has been started this
+ * many times (see chidb_dbm_run) */
+#define DBM_HOT_RUNS (4)
+
+/* Is a register always a constant when the instruction at pos runs?
+ * It is if the only instruction that writes to it is an Integer in the
+ * prologue: the instructions at the start of the program that run once,
+ * in order, before any other. */
+static bool chidb_dbm_const_reg(chidb_stmt *stmt, int32_t reg, uint32_t prologue, int64_t *value)
+{
+    chidb_dbm_op_t *load = NULL;
+
+    for (uint32_t i = 0; i < stmt->endOp; i++)
+    {
+        if (!chidb_stmt_op_uses_reg(&stmt->ops[i], reg, true))
+            continue;
+        if (load != NULL || stmt->ops[i].opcode != Op_Integer || i >= prologue)
+            return false;
+        load = &stmt->ops[i];
+    }
+
+    if (load == NULL)
+        return false;
+
+    *value = load->p1;
+    return true;
+}
+
+/* Compile a program to threaded code
+ *
+ * Each instruction gets the address of its handler in chidb_dbm_run
+ * (labels), so running it does not have to look up its opcode. A
+ * comparison with a register that always holds the same integer gets
+ * the address of code that compares with that integer instead
+ * (int_labels), without loading the register or checking its type. The
+ * end of the program gets an instruction of its own (end), so that the
+ * program counter does not have to be checked on every instruction.
+ *
+ * If there is no memory for it, the program is just not compiled.
+ */
+static void chidb_dbm_compile(chidb_stmt *stmt, void **labels, void **int_labels, void *end)
+{
+    chidb_dbm_code_t *code = malloc(sizeof(chidb_dbm_code_t) * (stmt->endOp + 1));
+    uint32_t prologue = 0, i;
+
+    if (code == NULL)
+        return;
+
+    while (prologue < stmt->endOp && !chidb_stmt_op_jumps(stmt->ops[prologue].opcode))
+        prologue++;
+    for (i = 0; i < stmt->endOp; i++)
+    {
+        chidb_dbm_op_t *op = &stmt->ops[i];
+        if (chidb_stmt_op_jumps(op->opcode) && op->p2 < (int32_t) prologue)
+            prologue = op->p2;
+    }
+
+    for (i = 0; i < stmt->endOp; i++)
+    {
+        chidb_dbm_op_t *op = &stmt->ops[i];
+
+        code[i].label = labels[op->opcode];
+        code[i].imm = 0;
+        if (op->opcode >= Op_Eq && op->opcode <= Op_Ge
+                && chidb_dbm_const_reg(stmt, op->p1, prologue, &code[i].imm))
+            code[i].label = int_labels[op->opcode];
+    }
+    code[stmt->endOp].label = end;
+    code[stmt->endOp].imm = 0;
+
+    stmt->code = code;
+}
+
+#endif
+
+/* Run a DBM program
+ *
+ * Runs instructions starting at the program counter until one of them
+ * returns something other than CHIDB_OK, or the end of the program is
+ * reached. The program must have been checked with chidb_stmt_verify,
+ * since the instruction handlers do not check their operands.
+ *
+ * With GCC and Clang, this uses computed gotos: each handler jumps
+ * straight to the next instruction's handler, instead of going back
+ * through a single indirect call. Since the handlers are in this same
+ * file, the compiler can also inline them. Other compilers get an
+ * equivalent switch.
+ *
+ * Programs that are run over and over (prepared statements that are
+ * reset, and programs from the statement cache) are compiled to
+ * threaded code once they have been started DBM_HOT_RUNS times (see
+ * chidb_dbm_compile), and then jump straight to the handler in the
+ * code of each instruction.
+ *
+ * Return
+ * - CHIDB_OK: The end of the program was reached
+ * - Anything else returned by an instruction handler
+ */
+int chidb_dbm_run (chidb_stmt *stmt)
+{
+    chidb_dbm_op_t *op;
+    int rc;
+
+    if (stmt->pc == 0)
+        stmt->runs++;
+
+#if defined(__GNUC__)
+    #define DISPATCH_LABEL(OP) [Op_ ## OP] = &&do_ ## OP,
+    static void *labels[] = { FOREACH_OP(DISPATCH_LABEL) };
+    static void *int_labels[] =
+    {
+        [Op_Eq] = &&do_EqInt, [Op_Ne] = &&do_NeInt,
+        [Op_Lt] = &&do_LtInt, [Op_Le] = &&do_LeInt,
+        [Op_Gt] = &&do_GtInt, [Op_Ge] = &&do_GeInt
+    };
+    chidb_dbm_register_t *reg;
+
+    if (stmt->code == NULL && stmt->pc == 0 && stmt->runs >= DBM_HOT_RUNS)
+        chidb_dbm_compile(stmt, labels, int_labels, &&done);
+
+    #define DISPATCH()                                  \
+        do {                                            \
+            if (stmt->code != NULL)                     \
+            {                                           \
+                op = &stmt->ops[stmt->pc];              \
+                goto *stmt->code[stmt->pc++].label;     \
+            }                                           \
+            if (stmt->pc >= stmt->endOp)                \
+                return CHIDB_OK;                        \
+            op = &stmt->ops[stmt->pc++];                \
+            goto *labels[op->opcode];                   \
+        } while (0)
+
+    #define DISPATCH_TARGET(OP)                         \
+        do_ ## OP:                                      \
+            if ((rc = chidb_dbm_op_ ## OP(stmt, op)) != CHIDB_OK) \
+                return rc;                              \
+            DISPATCH();
+
+    /* Same as the comparison handlers, with p1 known to be an integer */
+    #define DISPATCH_INT_TARGET(OP, CMP)                \
+        do_ ## OP ## Int:                               \
+            reg = &stmt->reg[op->p3];                   \
+            if (IS_INT_REG(reg->type) && reg->value.i CMP stmt->code[op - stmt->ops].imm) \
+                stmt->pc = (uint32_t) op->p2;           \
+            DISPATCH();
+
+    DISPATCH();
+    FOREACH_OP(DISPATCH_TARGET)
+    DISPATCH_INT_TARGET(Eq, ==)
+    DISPATCH_INT_TARGET(Ne, !=)
+    DISPATCH_INT_TARGET(Lt, <)
+    DISPATCH_INT_TARGET(Le, <=)
+    DISPATCH_INT_TARGET(Gt, >)
+    DISPATCH_INT_TARGET(Ge, >=)
+done:
+    return CHIDB_OK;
+
+    #undef DISPATCH_INT_TARGET
+    #undef DISPATCH_TARGET
+    #undef DISPATCH
+    #undef DISPATCH_LABEL
+#else
+    #define DISPATCH_CASE(OP)                           \
+        case Op_ ## OP:                                 \
+            rc = chidb_dbm_op_ ## OP(stmt, op);         \
+            break;
+
+    while (stmt->pc < stmt->endOp)
+    {
+        op = &stmt->ops[stmt->pc++];
+
+        switch (op->opcode)
+        {
+            FOREACH_OP(DISPATCH_CASE)
+            default:
+                rc = CHIDB_PROBLEM;
+        }
+
+        if (rc != CHIDB_OK)
+            return rc;
+    }
+
+    #undef DISPATCH_CASE
+#endif
+
+    return CHIDB_OK;
+}
+
+
+/* Run a DBM program, keeping count of what each instruction does
+ *
+ * Same as chidb_dbm_run, but each instruction is dispatched through
+ * chidb_dbm_op_handle, and its entry in stmt->profile is updated with
+ * the time it took and the pages read from the Pager while it ran.
+ * This is how EXPLAIN ANALYZE runs a program; timing every instruction
+ * is too slow for the plain interpreter loop.
+ *
+ * Return
+ * - CHIDB_OK: The end of the program was reached
+ * - Anything else returned by an instruction handler
+ */
+int chidb_dbm_run_profiled (chidb_stmt *stmt)
+{
+    Pager *pager = stmt->db->bt != NULL ? stmt->db->bt->pager : NULL;
+    struct timespec start, end;
+    int rc;
+
+    while (stmt->pc < stmt->endOp)
+    {
+        chidb_dbm_profile_t *prof = &stmt->profile[stmt->pc];
+        chidb_dbm_op_t *op = &stmt->ops[stmt->pc++];
+        uint64_t reads = pager != NULL ? pager->stats.reads : 0;
+
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        rc = chidb_dbm_op_handle(stmt, op);
+        clock_gettime(CLOCK_MONOTONIC, &end);
+
+        prof->count++;
+        prof->ns += (uint64_t) (end.tv_sec - start.tv_sec) * 1000000000
+                    + end.tv_nsec - start.tv_nsec;
+        if (pager != NULL)
+            prof->pages += pager->stats.reads - reads;
+
+        if (rc != CHIDB_OK)
+            return rc;
+    }
+
+    return CHIDB_OK;
+}
+
+
+/* Can an instruction be run again from the start, if the page it is
+ * waiting for stops it halfway? It can if all it does is move a read
+ * cursor, or read from it: putting the cursor back undoes it, and the
+ * registers it writes are written again. */
+static bool chidb_dbm_op_resumable(chidb_stmt *stmt, chidb_dbm_op_t *op)
+{
+    switch (op->opcode)
+    {
+        case Op_Rewind:
+        case Op_Next:
+        case Op_Prev:
+        case Op_Skip:
+        case Op_Seek:
+        case Op_SeekGt:
+        case Op_SeekGe:
+        case Op_SeekLt:
+        case Op_SeekLe:
+        case Op_Column:
+        case Op_Key:
+        case Op_IdxGt:
+        case Op_IdxGe:
+        case Op_IdxLt:
+        case Op_IdxLe:
+        case Op_IdxPKey:
+            return EXISTS_CURSOR(stmt, op->p1) && stmt->cursors[op->p1].type == CURSOR_READ;
+        default:
+            return false;
+    }
+}
+
+
+/* Run a DBM program until it has to wait for the disk
+ *
+ * Same as chidb_dbm_run, but the instructions that only read through a
+ * cursor (see chidb_dbm_op_resumable) are run with the Pager in nowait
+ * mode: a page that is not in the buffer pool is read asynchronously,
+ * and the instruction is stopped. Its cursor is then put back where it
+ * was, and the program counter on the instruction, so that running the
+ * program again, once the read has completed, runs it from the start.
+ * Handlers do not all pass on what the Pager returns, so whether the
+ * instruction was stopped is told by the Pager's wait_page.
+ *
+ * Return
+ * - CHIDB_OK: The end of the program was reached
+ * - CHIDB_PENDING: The program is waiting for the Pager's wait_page
+ * - Anything else returned by an instruction handler
+ */
+int chidb_dbm_run_async (chidb_stmt *stmt)
+{
+    Pager *pager = stmt->db->bt != NULL ? stmt->db->bt->pager : NULL;
+    chidb_dbm_cursor_position_t pos;
+    int rc;
+
+    while (stmt->pc < stmt->endOp)
+    {
+        uint32_t pc = stmt->pc;
+        chidb_dbm_op_t *op = &stmt->ops[stmt->pc++];
+
+        if (pager == NULL || pager->threadsafe || !chidb_dbm_op_resumable(stmt, op))
+        {
+            if ((rc = chidb_dbm_op_handle(stmt, op)) != CHIDB_OK)
+                return rc;
+            continue;
+        }
+
+        chidb_dbm_cursor_save(&stmt->cursors[op->p1], &pos);
+        pager->wait_page = 0;
+        pager->nowait = true;
+        rc = chidb_dbm_op_handle(stmt, op);
+        pager->nowait = false;
+
+        if (pager->wait_page != 0)
+        {
+            if ((rc = chidb_dbm_cursor_restore(stmt->cursors[op->p1].bt, &stmt->cursors[op->p1], &pos)) != CHIDB_OK)
+                return rc;
+            stmt->pc = pc;
+            return CHIDB_PENDING;
+        }
+
+        if (rc != CHIDB_OK)
+            return rc;
+    }
+
+    return CHIDB_OK;
+}
+
+
 /*** INSTRUCTION HANDLER IMPLEMENTATIONS ***/
 
 int chidb_dbm_op_Noop (chidb_stmt *stmt, chidb_dbm_op_t *op)
@@ -92,14 +428,46 @@ int chidb_dbm_op_Noop (chidb_stmt *stmt, chidb_dbm_op_t *op)
 
 
 
+/* The B-Tree an OpenRead opens its cursor on
+ *
+ * p4 is the name of the attached database the table is in (see ATTACH
+ * in api.c), or NULL if it is in the database itself.
+ *
+ * Return
+ * - The B-Tree, or NULL if no database is attached by that name (a
+ *   program loaded from a file may have been compiled with one)
+ */
+BTree *chidb_dbm_op_btree (chidb_stmt *stmt, chidb_dbm_op_t *op)
+{
+    chidb *db;
+
+    if (op->p4 == NULL)
+        return stmt->db->bt;
+
+    return (db = chidb_catalog_attached(stmt->db, op->p4)) != NULL ? db->bt : NULL;
+}
+
+/* OpenRead p1 p2 p3 p4
+ *
+ * p1: cursor
+ * p2: register with the root page of the table or index
+ * p3: number of columns
+ * p4: attached database the table is in, or NULL (see chidb_dbm_op_btree)
+ */
 int chidb_dbm_op_OpenRead (chidb_stmt *stmt, chidb_dbm_op_t *op)
 {
+    BTree *bt = chidb_dbm_op_btree(stmt, op);
+
+    if (bt == NULL)
+        return CHIDB_EMISUSE;
+
     // If cursor doesn't exist, allocate it
     if (!EXISTS_CURSOR(stmt, op->p1))
         realloc_cur(stmt, op->p1);
 
     chidb_dbm_cursor_t *c = &((stmt)->cursors[op->p1]);
-    chidb_dbm_cursor_init(stmt->db->bt, c, stmt->reg[op->p2].value.i, op->p3);
+    // a worker of a parallel scan only reads its subtree (see dbm-parallel.c)
+    chidb_dbm_cursor_init(bt, c, stmt->scan_root != 0 ? stmt->scan_root : (npage_t) stmt->reg[op->p2].value.i, op->p3);
 
     c->type = CURSOR_READ;
 
@@ -130,12 +498,24 @@ int chidb_dbm_op_OpenWrite (chidb_stmt *stmt, chidb_dbm_op_t *op)
 
 int chidb_dbm_op_Close (chidb_stmt *stmt, chidb_dbm_op_t *op)
 {
-    // makes sure we are trying to destroy a valid cursor
-    if (!EXISTS_CURSOR(stmt, op->p1))
-        return CHIDB_PROBLEM;
-
     chidb_dbm_cursor_t *c = &((stmt)->cursors[op->p1]);
-    chidb_dbm_cursor_destroy(stmt->db->bt, c);
+
+    // registers can still be read once the program is done, so anything
+    // borrowed from this cursor gets its own copy before the cursor goes away
+    for (uint32_t i = 0; i < stmt->nReg; i++)
+    {
+        chidb_dbm_register_t *reg = &stmt->reg[i];
+        if (reg->type == REG_STRING && reg->borrowed &&
+            ((reg->value.s >= c->text && reg->value.s < c->text + c->text_size) ||
+             (c->hash != NULL && chidb_dbm_hash_owns(c->hash, reg->value.s))))
+        {
+            int rc = chidb_dbm_op_WriteCopy(stmt, i, REG_STRING, reg->value.s, strlen(reg->value.s) + 1);
+            if (rc != CHIDB_OK)
+                return rc;
+        }
+    }
+
+    chidb_dbm_cursor_destroy(c->bt, c);
 
     return CHIDB_OK;
 }
@@ -144,39 +524,36 @@ int chidb_dbm_op_Rewind (chidb_stmt *stmt, chidb_dbm_op_t *op)
 {
     uint32_t jmp_addr = op->p2;
 
-    if (!EXISTS_CURSOR(stmt, op->p1))
-        return CHIDB_PROBLEM;
-
     chidb_dbm_cursor_t *c = &((stmt)->cursors[op->p1]);
 
-    // this is going to have the root
-    chidb_dbm_cursor_trail_t *ct = (chidb_dbm_cursor_trail_t*) list_get_at(&c->trail, 0);
+    // start from a freshly read root, dropping the old trail
+    int rc;
+    if ((rc = chidb_dbm_cursor_reset(c->bt, c)) != CHIDB_OK)
+        return rc;
 
-    if (ct->btn->n_cells == 0) // jump if empty
-    {
-        if (!IS_VALID_ADDRESS(stmt, jmp_addr))
-            return CHIDB_PROBLEM;
+    chidb_dbm_cursor_trail_t *ct = &c->trail[0];
 
+    if (ct->btn.n_cells == 0) // jump if empty
+    {
         stmt->pc = jmp_addr;
     }
     else // set cursor to the first entry
     {
-        // remove the old trail from the cursor
-        chidb_dbm_cursor_clear_trail_from(stmt->db->bt, c, 0);
-
         // reset the current cell of the root to be 0 (go down leftmost side)
         ct->n_current_cell = 0;
 
         // now actually rewind (get the first entry) by calling down
-        switch(ct->btn->type)
+        switch(ct->btn.type)
         {
             case PGTYPE_TABLE_INTERNAL:
             case PGTYPE_TABLE_LEAF:
-                chidb_dbm_cursorTable_fwdDwn(stmt->db->bt, c);
+            case PGTYPE_TEXTINDEX_INTERNAL:
+            case PGTYPE_TEXTINDEX_LEAF:
+                chidb_dbm_cursorTable_fwdDwn(c->bt, c);
                 break;
             case PGTYPE_INDEX_INTERNAL:
             case PGTYPE_INDEX_LEAF:
-                chidb_dbm_cursorIndex_fwdDwn(stmt->db->bt, c);
+                chidb_dbm_cursorIndex_fwdDwn(c->bt, c);
                 break;
             default:
                 return CHIDB_ETYPE;
@@ -192,18 +569,13 @@ int chidb_dbm_op_Next (chidb_stmt *stmt, chidb_dbm_op_t *op)
     uint32_t jmp_addr = op->p2;
     int fwd_ret;
 
-    if (!EXISTS_CURSOR(stmt, c_index))
-        return CHIDB_PROBLEM;
-
     chidb_dbm_cursor_t *c = &((stmt)->cursors[c_index]);
 
     // move the cursor forward
-    fwd_ret = chidb_dbm_cursor_fwd(stmt->db->bt,c);
+    fwd_ret = chidb_dbm_cursor_fwd(c->bt, c);
     // if the cursor can't move and the jump op is valid, jump. else, get out!
     if(fwd_ret != CHIDB_CURSORCANTMOVE)
     {
-        if (!IS_VALID_ADDRESS(stmt, op->p2))
-            return CHIDB_DONE;
         stmt->pc = jmp_addr;
     }
     return CHIDB_OK;
@@ -215,39 +587,112 @@ int chidb_dbm_op_Prev (chidb_stmt *stmt, chidb_dbm_op_t *op)
     int32_t jmp_addr = op->p2;
     int fwd_ret;
 
-    if (!EXISTS_CURSOR(stmt, c_index))
-        return CHIDB_PROBLEM;
-
     chidb_dbm_cursor_t *c = &((stmt)->cursors[c_index]);
 
-    fwd_ret = chidb_dbm_cursor_rev(stmt->db->bt,c);
+    fwd_ret = chidb_dbm_cursor_rev(c->bt, c);
     // if the cursor can't move and the jump op is valid, jump. else, get out!
     if(fwd_ret != CHIDB_CURSORCANTMOVE)
     {
-        if (!IS_VALID_ADDRESS(stmt, jmp_addr))
-            return CHIDB_DONE;
         stmt->pc = (uint32_t)jmp_addr;
     }
 
     return CHIDB_OK;
 }
 
-int chidb_dbm_op_Seek (chidb_stmt *stmt, chidb_dbm_op_t *op)
+/* Skip p1 p2 p3 *
+ *
+ * p1: cursor
+ * p2: jump addr
+ * p3: register containing n
+ *
+ * move cursor p1 forward by n entries (see chidb_dbm_cursor_skip), or
+ * leave it if n is not positive. If there are fewer than n entries after
+ * it, jump
+ */
+int chidb_dbm_op_Skip (chidb_stmt *stmt, chidb_dbm_op_t *op)
 {
-    uint32_t c_index = op->p1;
-    uint32_t jmp_addr = op->p2;
+    chidb_dbm_cursor_t *c = &((stmt)->cursors[op->p1]);
+    chidb_dbm_register_t *r = &((stmt)->reg[op->p3]);
+    int rc;
 
-    if (!IS_VALID_REGISTER(stmt, op->p3))
-    {
-        fprintf(stderr, "%s\n", "an error has occured in seek");
+    if (c->type != CURSOR_READ && c->type != CURSOR_WRITE)
         return CHIDB_PROBLEM;
+    if (!IS_INT_REG(r->type))
+        return CHIDB_EMISMATCH;
+    if (r->value.i <= 0)
+        return CHIDB_OK;
+
+    rc = chidb_dbm_cursor_skip(c->bt, c, r->value.i > UINT32_MAX ? UINT32_MAX : (uint32_t) r->value.i);
+    if (rc == CHIDB_CURSORCANTMOVE)
+        stmt->pc = (uint32_t) op->p2;
+    else if (rc != CHIDB_OK)
+        return rc;
+
+    return CHIDB_OK;
+}
+
+/* DeferredSeek p1 * p3 *
+ *
+ * p1: cursor (of a table)
+ * p3: register with the key
+ *
+ * Seek, for a key that is known to be in the table (a primary key read
+ * from an index with IdxPKey). The cursor is only moved to the row when
+ * a column of it is read; until then, reading its key gives the key.
+ * Rows that are skipped on what is in the index are then never read
+ * from the table (see chidb_dbm_cursor_finishSeek).
+ */
+int chidb_dbm_op_DeferredSeek (chidb_stmt *stmt, chidb_dbm_op_t *op)
+{
+    chidb_dbm_register_t *r = &((stmt)->reg[op->p3]);
+    chidb_dbm_cursor_t *c = &((stmt)->cursors[op->p1]);
+
+    if (!IS_INT_REG(r->type))
+        return CHIDB_EMISMATCH;
+
+    c->deferred = true;
+    c->deferred_key = (chidb_key_t) r->value.i;
+    c->record.valid = false;
+
+    return CHIDB_OK;
+}
+
+/* Seeks the text in register p3 in the text index under cursor p1, and
+ * jumps to p2 if there is no such entry (or the register is not a text) */
+static int chidb_dbm_op_SeekText (chidb_stmt *stmt, chidb_dbm_op_t *op, int seek_type)
+{
+    chidb_dbm_register_t *r1 = &((stmt)->reg[op->p3]);
+    chidb_dbm_cursor_t *c = &((stmt)->cursors[op->p1]);
+
+    if (r1->type != REG_STRING ||
+        chidb_dbm_cursor_seekText(c->bt, c, (uint8_t *) r1->value.s, strlen(r1->value.s), seek_type) != CHIDB_OK)
+    {
+        stmt->pc = (uint32_t) op->p2;
     }
 
+    return CHIDB_OK;
+}
+
+int chidb_dbm_op_Seek (chidb_stmt *stmt, chidb_dbm_op_t *op)
+{
+    uint32_t c_index = op->p1;
+    uint32_t jmp_addr = op->p2;
+
     chidb_dbm_register_t *r1 = &((stmt)->reg[op->p3]);
-    uint32_t key = r1->value.i;
+    chidb_key_t key = (chidb_key_t) r1->value.i;
 
     int seek_ret;
 
+    if (IS_VALID_CURSOR(stmt, op->p1) && PGTYPE_IS_TEXTINDEX(stmt->cursors[op->p1].root_type))
+        return chidb_dbm_op_SeekText(stmt, op, SEEK);
+
+    // Only integers can be keys, there is nothing to find otherwise
+    if (!IS_INT_REG(r1->type))
+    {
+        stmt->pc = jmp_addr;
+        return CHIDB_OK;
+    }
+
     if (!IS_VALID_CURSOR(stmt, c_index))
     {
         fprintf(stderr, "%s\n", "a cursor error has occured in seek");
@@ -256,15 +701,10 @@ int chidb_dbm_op_Seek (chidb_stmt *stmt, chidb_dbm_op_t *op)
 
     chidb_dbm_cursor_t *c = &((stmt)->cursors[c_index]);
 
-    seek_ret = chidb_dbm_cursor_seek(stmt->db->bt, c, key, c->root_page, 0, SEEK);
+    seek_ret = chidb_dbm_cursor_seekNear(c->bt, c, key);
 
     if(seek_ret != CHIDB_OK)
     {
-        if (!IS_VALID_ADDRESS(stmt, jmp_addr))
-        {
-            fprintf(stderr, "%s\n", "error, invalid jump address");
-            return CHIDB_PROBLEM;
-        }
         stmt->pc = (uint32_t)jmp_addr;
     }
 
@@ -276,24 +716,26 @@ int chidb_dbm_op_SeekGt (chidb_stmt *stmt, chidb_dbm_op_t *op)
     uint32_t c_index = op->p1;
     uint32_t jmp_addr = op->p2;
 
-    if (!IS_VALID_REGISTER(stmt, op->p3))
-        return CHIDB_PROBLEM;
-
     chidb_dbm_register_t *r1 = &((stmt)->reg[op->p3]);
-    uint32_t key = r1->value.i;
+    chidb_key_t key = (chidb_key_t) r1->value.i;
 
     int seek_ret;
 
-    if (!IS_VALID_CURSOR(stmt, c_index))
-        return CHIDB_PROBLEM;
+    if (IS_VALID_CURSOR(stmt, op->p1) && PGTYPE_IS_TEXTINDEX(stmt->cursors[op->p1].root_type))
+        return chidb_dbm_op_SeekText(stmt, op, SEEKGT);
+
+    // Only integers can be keys, there is nothing to find otherwise
+    if (!IS_INT_REG(r1->type))
+    {
+        stmt->pc = jmp_addr;
+        return CHIDB_OK;
+    }
 
     chidb_dbm_cursor_t *c = &((stmt)->cursors[c_index]);
 
-    seek_ret = chidb_dbm_cursor_seek(stmt->db->bt, c, key, c->root_page, 0, SEEKGT);
+    seek_ret = chidb_dbm_cursor_seek(c->bt, c, key, c->root_page, 0, SEEKGT);
     if(seek_ret != CHIDB_OK)
     {
-        if (!IS_VALID_ADDRESS(stmt, jmp_addr))
-            return CHIDB_PROBLEM;
         stmt->pc = (uint32_t)jmp_addr;
     }
 
@@ -305,24 +747,26 @@ int chidb_dbm_op_SeekGe (chidb_stmt *stmt, chidb_dbm_op_t *op)
     uint32_t c_index = op->p1;
     uint32_t jmp_addr = op->p2;
 
-    if (!IS_VALID_REGISTER(stmt, op->p3))
-        return CHIDB_PROBLEM;
-
     chidb_dbm_register_t *r1 = &((stmt)->reg[op->p3]);
-    uint32_t key = r1->value.i;
+    chidb_key_t key = (chidb_key_t) r1->value.i;
 
     int seek_ret;
 
-    if (!IS_VALID_CURSOR(stmt, c_index))
-        return CHIDB_PROBLEM;
+    if (IS_VALID_CURSOR(stmt, op->p1) && PGTYPE_IS_TEXTINDEX(stmt->cursors[op->p1].root_type))
+        return chidb_dbm_op_SeekText(stmt, op, SEEKGE);
+
+    // Only integers can be keys, there is nothing to find otherwise
+    if (!IS_INT_REG(r1->type))
+    {
+        stmt->pc = jmp_addr;
+        return CHIDB_OK;
+    }
 
     chidb_dbm_cursor_t *c = &((stmt)->cursors[c_index]);
 
-    seek_ret = chidb_dbm_cursor_seek(stmt->db->bt, c, key, c->root_page, 0, SEEKGE);
+    seek_ret = chidb_dbm_cursor_seek(c->bt, c, key, c->root_page, 0, SEEKGE);
     if(seek_ret != CHIDB_OK)
     {
-        if (!IS_VALID_ADDRESS(stmt, jmp_addr))
-            return CHIDB_PROBLEM;
         stmt->pc = (uint32_t)jmp_addr;
     }
 
@@ -334,24 +778,26 @@ int chidb_dbm_op_SeekLt (chidb_stmt *stmt, chidb_dbm_op_t *op)
     uint32_t c_index = op->p1;
     uint32_t jmp_addr = op->p2;
 
-    if (!IS_VALID_REGISTER(stmt, op->p3))
-        return CHIDB_PROBLEM;
-
     chidb_dbm_register_t *r1 = &((stmt)->reg[op->p3]);
-    uint32_t key = r1->value.i;
+    chidb_key_t key = (chidb_key_t) r1->value.i;
 
     int seek_ret;
 
-    if (!IS_VALID_CURSOR(stmt, c_index))
-        return CHIDB_PROBLEM;
+    if (IS_VALID_CURSOR(stmt, op->p1) && PGTYPE_IS_TEXTINDEX(stmt->cursors[op->p1].root_type))
+        return chidb_dbm_op_SeekText(stmt, op, SEEKLT);
+
+    // Only integers can be keys, there is nothing to find otherwise
+    if (!IS_INT_REG(r1->type))
+    {
+        stmt->pc = jmp_addr;
+        return CHIDB_OK;
+    }
 
     chidb_dbm_cursor_t *c = &((stmt)->cursors[c_index]);
 
-    seek_ret = chidb_dbm_cursor_seek(stmt->db->bt, c, key, c->root_page, 0, SEEKLT);
+    seek_ret = chidb_dbm_cursor_seek(c->bt, c, key, c->root_page, 0, SEEKLT);
     if(seek_ret != CHIDB_OK)
     {
-        if (!IS_VALID_ADDRESS(stmt, jmp_addr))
-            return CHIDB_PROBLEM;
         stmt->pc = (uint32_t)jmp_addr;
     }
 
@@ -363,24 +809,26 @@ int chidb_dbm_op_SeekLe (chidb_stmt *stmt, chidb_dbm_op_t *op)
     uint32_t c_index = op->p1;
     uint32_t jmp_addr = op->p2;
 
-    if (!IS_VALID_REGISTER(stmt, op->p3))
-        return CHIDB_PROBLEM;
-
     chidb_dbm_register_t *r1 = &((stmt)->reg[op->p3]);
-    uint32_t key = r1->value.i;
+    chidb_key_t key = (chidb_key_t) r1->value.i;
 
     int seek_ret;
 
-    if (!IS_VALID_CURSOR(stmt, c_index))
-        return CHIDB_PROBLEM;
+    if (IS_VALID_CURSOR(stmt, op->p1) && PGTYPE_IS_TEXTINDEX(stmt->cursors[op->p1].root_type))
+        return chidb_dbm_op_SeekText(stmt, op, SEEKLE);
+
+    // Only integers can be keys, there is nothing to find otherwise
+    if (!IS_INT_REG(r1->type))
+    {
+        stmt->pc = jmp_addr;
+        return CHIDB_OK;
+    }
 
     chidb_dbm_cursor_t *c = &((stmt)->cursors[c_index]);
 
-    seek_ret = chidb_dbm_cursor_seek(stmt->db->bt, c, key, c->root_page, 0, SEEKLE);
+    seek_ret = chidb_dbm_cursor_seek(c->bt, c, key, c->root_page, 0, SEEKLE);
     if(seek_ret != CHIDB_OK)
     {
-        if (!IS_VALID_ADDRESS(stmt, jmp_addr))
-            return CHIDB_PROBLEM;
         stmt->pc = (uint32_t)jmp_addr;
     }
 
@@ -393,9 +841,7 @@ int chidb_dbm_op_Column (chidb_stmt *stmt, chidb_dbm_op_t *op)
     int32_t col_num = op->p2;
     int32_t reg_index = op->p3;
 
-    int8_t byte;
-    int16_t smallint;
-    int32_t integer;
+    int64_t integer;
     char *string;
 
     int ret;
@@ -403,31 +849,26 @@ int chidb_dbm_op_Column (chidb_stmt *stmt, chidb_dbm_op_t *op)
     DBRecord *dbr;
 
     // get cursor and entry data
-    if (!IS_VALID_CURSOR(stmt, c_index))
-        return CHIDB_PROBLEM;
     chidb_dbm_cursor_t *c = &((stmt)->cursors[c_index]);
-    uint8_t *entry = c->current_cell.fields.tableLeaf.data;
 
-    if((ret = chidb_DBRecord_unpack(&dbr, entry)) != CHIDB_OK)
-        fprintf(stderr,"CHIDB_DBM_OP_COLUMN: couldn't unpack record\n");
+    // the header is decoded once per entry, and only as far as the columns read
+    if((ret = chidb_dbm_cursor_record(c->bt, c, col_num, &dbr)) != CHIDB_OK)
+        return ret;
 
-    type = chidb_DBRecord_getType(dbr, (uint8_t)col_num);
+    if(col_num < 0 || col_num >= dbr->nfields)
+        type = SQL_NOTVALID;
+    else
+        type = chidb_DBRecord_getType(dbr, (uint8_t)col_num);
 
     switch(type)
     {
         case SQL_INTEGER_1BYTE:
-            ret = chidb_DBRecord_getInt8(dbr, (uint8_t)col_num, &byte);
-            if (chidb_dbm_op_WriteReg(stmt, reg_index, REG_INT32, &byte) != CHIDB_OK)
-                return CHIDB_PROBLEM;
-            break;
         case SQL_INTEGER_2BYTE:
-            ret = chidb_DBRecord_getInt16(dbr, (uint8_t)col_num, &smallint);
-            if (chidb_dbm_op_WriteReg(stmt, reg_index, REG_INT32, &smallint) != CHIDB_OK)
-                return CHIDB_PROBLEM;
-            break;
         case SQL_INTEGER_4BYTE:
-            ret = chidb_DBRecord_getInt32(dbr,(uint8_t)col_num, &integer);
-            if (chidb_dbm_op_WriteReg(stmt, reg_index, REG_INT32, &integer) != CHIDB_OK)
+        case SQL_INTEGER_6BYTE:
+        case SQL_INTEGER_8BYTE:
+            ret = chidb_DBRecord_getInt64(dbr, (uint8_t)col_num, &integer);
+            if (chidb_dbm_op_WriteInt(stmt, reg_index, integer) != CHIDB_OK)
                 return CHIDB_PROBLEM;
             break;
         case SQL_NULL:
@@ -435,34 +876,98 @@ int chidb_dbm_op_Column (chidb_stmt *stmt, chidb_dbm_op_t *op)
                 return CHIDB_PROBLEM;
             break;
         case SQL_TEXT:
-            ret = chidb_DBRecord_getString(dbr, (uint8_t)col_num, &string);
-            if (chidb_dbm_op_WriteReg(stmt, reg_index, REG_STRING, strdup(string)) != CHIDB_OK)
+            // borrow the cursor's copy of the text, valid until the cursor moves
+            if ((ret = chidb_dbm_cursor_text(c->bt, c, (uint8_t)col_num, &string)) != CHIDB_OK)
+                return ret;
+            if (chidb_dbm_op_WriteString(stmt, reg_index, string, true) != CHIDB_OK)
                 return CHIDB_PROBLEM;
             break;
         case SQL_NOTVALID:
-            (stmt)->reg[reg_index].type = REG_UNSPECIFIED;
+            if (chidb_dbm_op_WriteReg(stmt, reg_index, REG_UNSPECIFIED, NULL) != CHIDB_OK)
+                return CHIDB_PROBLEM;
             break;
     }
 
     return CHIDB_OK;
 }
 
+/* FilterColumn p1 p2 p3 *
+ *
+ * p1: cursor
+ * p2: column number
+ * p3: register
+ *
+ * Column, for a scan filtered on a column. The next instruction compares
+ * register p3 and skips to the Next of the cursor if the entry fails
+ * (see chidb_stmt_op_filters). When it compares with an integer, the
+ * whole leaf the cursor is on is compared at once, and the cursor is
+ * moved past the entries that fail without decoding them (see
+ * chidb_dbm_cursor_filter). If the rest of the leaf fails, this skips to
+ * the Next itself. Otherwise, the column is loaded as Column does, and
+ * the comparison is done as usual.
+ */
+int chidb_dbm_op_FilterColumn (chidb_stmt *stmt, chidb_dbm_op_t *op)
+{
+    static const chidb_dbm_filter_cmp_t cmps[] =
+    {
+        [Op_Eq] = FILTER_EQ, [Op_Ne] = FILTER_NE,
+        [Op_Lt] = FILTER_LT, [Op_Le] = FILTER_LE,
+        [Op_Gt] = FILTER_GT, [Op_Ge] = FILTER_GE
+    };
+    chidb_dbm_cursor_t *c = &((stmt)->cursors[op->p1]);
+    chidb_dbm_op_t *cmp = &stmt->ops[stmt->pc];
+    chidb_dbm_register_t *value = &((stmt)->reg[cmp->p1]);
+    int rc;
+
+    if (c->type == CURSOR_READ && IS_INT_REG(value->type) && op->p2 >= 0 && op->p2 < DBRECORD_MAX_FIELDS)
+    {
+        rc = chidb_dbm_cursor_filter(c->bt, c, op->p2, cmps[cmp->opcode], value->value.i);
+        if (rc == CHIDB_EEMPTY)
+        {
+            stmt->pc = cmp->p2;
+            return CHIDB_OK;
+        }
+        if (rc != CHIDB_OK && rc != CHIDB_ETYPE)
+            return rc;
+    }
+
+    return chidb_dbm_op_Column(stmt, op);
+}
+
 int chidb_dbm_op_Key (chidb_stmt *stmt, chidb_dbm_op_t *op)
 {
     int32_t c_index = op->p1;
     int32_t reg_index = op->p2;
-    uint32_t key;
+    chidb_key_t key;
 
     // get cursor
-    if (!IS_VALID_CURSOR(stmt, c_index))
-        return CHIDB_PROBLEM;
-
     chidb_dbm_cursor_t *c = &((stmt)->cursors[c_index]);
 
+    // the row of a deferred seek need not be read for its key
+    if (c->deferred)
+    {
+        if (chidb_dbm_op_WriteInt(stmt, reg_index, (int64_t) c->deferred_key) != CHIDB_OK)
+            return CHIDB_PROBLEM;
+        return CHIDB_OK;
+    }
+
+    // the key of a text index is its text
+    if (PGTYPE_IS_TEXTINDEX(c->current_cell.type))
+    {
+        char *text;
+        int rc;
+
+        if ((rc = chidb_dbm_cursor_keyText(c->bt, c, &text)) != CHIDB_OK)
+            return rc;
+        if (chidb_dbm_op_WriteString(stmt, reg_index, text, true) != CHIDB_OK)
+            return CHIDB_PROBLEM;
+        return CHIDB_OK;
+    }
+
     // get key
     key = c->current_cell.key;
 
-    if (chidb_dbm_op_WriteReg(stmt, reg_index, REG_INT32, &key) != CHIDB_OK)
+    if (chidb_dbm_op_WriteInt(stmt, reg_index, (int64_t) key) != CHIDB_OK)
         return CHIDB_PROBLEM;
 
     return CHIDB_OK;
@@ -478,7 +983,8 @@ int chidb_dbm_op_Integer (chidb_stmt *stmt, chidb_dbm_op_t *op)
 
 int chidb_dbm_op_String (chidb_stmt *stmt, chidb_dbm_op_t *op)
 {
-    if (chidb_dbm_op_WriteReg(stmt, op->p2, REG_STRING, strdup(op->p4)) != CHIDB_OK)
+    // the string stays in the instruction, which lives as long as the register
+    if (chidb_dbm_op_WriteString(stmt, op->p2, op->p4, true) != CHIDB_OK)
         return CHIDB_PROBLEM;
 
     return CHIDB_OK;
@@ -492,13 +998,25 @@ int chidb_dbm_op_Null (chidb_stmt *stmt, chidb_dbm_op_t *op)
     return CHIDB_OK;
 }
 
-int chidb_dbm_op_ResultRow (chidb_stmt *stmt, chidb_dbm_op_t *op)
+int chidb_dbm_op_Param (chidb_stmt *stmt, chidb_dbm_op_t *op)
 {
-    if (!IS_VALID_REGISTER(stmt, op->p1))
-        return CHIDB_PROBLEM;
-    if (!IS_VALID_REGISTER(stmt, op->p2))
-        return CHIDB_PROBLEM;
+    chidb_dbm_register_t *param = &stmt->params[op->p1 - 1];
+    int rc;
+
+    // the value stays bound until the statement is reset, so strings
+    // can be borrowed instead of copied
+    if (IS_INT_REG(param->type))
+        rc = chidb_dbm_op_WriteInt(stmt, op->p2, param->value.i);
+    else if (param->type == REG_STRING)
+        rc = chidb_dbm_op_WriteString(stmt, op->p2, param->value.s, true);
+    else
+        rc = chidb_dbm_op_WriteReg(stmt, op->p2, REG_NULL, NULL);
+
+    return rc == CHIDB_OK ? CHIDB_OK : CHIDB_PROBLEM;
+}
 
+int chidb_dbm_op_ResultRow (chidb_stmt *stmt, chidb_dbm_op_t *op)
+{
     stmt->startRR = (uint32_t)op->p1;
     stmt->nRR = (uint32_t)op->p2;
 
@@ -511,61 +1029,133 @@ int chidb_dbm_op_ResultRow (chidb_stmt *stmt, chidb_dbm_op_t *op)
  * p2: n -- number of fields to be stored
  * p2: register to store new record in
  */
-// Now passes tests!
+/* Serial type of the value of a register in a record, and the number of
+ * bytes it takes in the record's data. Binary values (and registers with
+ * no value) are not stored in records. */
+static bool record_type(chidb_dbm_register_t *reg, uint32_t *type, uint32_t *len)
+{
+    if (reg->type == REG_NULL)
+        *type = SQL_NULL, *len = 0;
+    else if (reg->type == REG_INT32)
+        *type = SQL_INTEGER_4BYTE, *len = 4;
+    else if (reg->type == REG_INT64 && reg->value.i >= -((int64_t) 1 << 47) && reg->value.i < ((int64_t) 1 << 47))
+        *type = SQL_INTEGER_6BYTE, *len = 6;
+    else if (reg->type == REG_INT64)
+        *type = SQL_INTEGER_8BYTE, *len = 8;
+    else if (reg->type == REG_STRING)
+        *len = strlen(reg->value.s), *type = *len * 2 + SQL_TEXT;
+    else
+        return false;
+
+    return true;
+}
+
+/* MakeRecord p1 p2 p3 *
+ *
+ * p1: first register
+ * p2: number of registers
+ * p3: register to store the record in
+ *
+ * make a record out of the values of registers p1 to p1+p2-1. The record
+ * is written straight into p3's space in the statement's arena, in the
+ * format chidb_DBRecord_pack produces, so making a record per row (e.g.,
+ * in an INSERT) does not allocate once per row.
+ */
 int chidb_dbm_op_MakeRecord (chidb_stmt *stmt, chidb_dbm_op_t *op)
 {
     int32_t r1 = op->p1;
     int32_t n = op->p2;
     int32_t r2 = op->p3;
     int32_t end_reg = (r1+n-1);
-    DBRecord *dbr;
+    uint32_t header_size = 1, data_len = 0, type, len;
     uint8_t *record;
 
-    // Get register that record will be stored in
-    chidb_dbm_register_t *reg2 = &((stmt)->reg[r2]);
-
-    // Initialize the DBRecordBuffer
-    DBRecordBuffer dbrb;
-    chidb_DBRecord_create_empty(&dbrb, (uint8_t)n);
-
-    // get data from registers and append to DBRecordBuffer
-    int i;
-    for(i = r1; i <= end_reg; i++)
+    for (int32_t i = r1; i <= end_reg; i++)
     {
         if (!IS_VALID_REGISTER(stmt, i))
             return CHIDB_PROBLEM;
 
-        chidb_dbm_register_t *tmp = &((stmt)->reg[i]);
-
-        if(tmp->type == REG_NULL)
-            chidb_DBRecord_appendNull(&dbrb);
-        else if(tmp->type == REG_INT32)
-            chidb_DBRecord_appendInt32(&dbrb, tmp->value.i);
-        else if(tmp->type == REG_STRING)
-            chidb_DBRecord_appendString(&dbrb, tmp->value.s);
+        if (record_type(&stmt->reg[i], &type, &len))
+        {
+            header_size += type >= SQL_TEXT ? 4 : 1;
+            data_len += len;
+        }
     }
 
-    chidb_DBRecord_finalize(&dbrb, &dbr);
-    uint32_t packed_len = dbr->packed_len;
-    chidb_DBRecord_pack(dbr, &record);
-    chidb_DBRecord_destroy(dbr);
+    // the header size is a single byte (see chidb_DBRecord_unpackHeader)
+    if (header_size > UINT8_MAX)
+        return CHIDB_PROBLEM;
+
+    // p3 can be one of the registers the record is made of, so the record
+    // must not go into the space its value may be in
+    if (r2 >= r1 && r2 <= end_reg)
+        record = chidb_dbm_arena_alloc(&stmt->arena, header_size + data_len);
+    else
+        record = chidb_dbm_reg_space(stmt, r2, header_size + data_len);
+    if (record == NULL)
+        return CHIDB_ENOMEM;
+
+    uint8_t *header = record + 1, *data = record + header_size;
+    record[0] = header_size;
+
+    for (int32_t i = r1; i <= end_reg; i++)
+    {
+        chidb_dbm_register_t *reg = &stmt->reg[i];
+
+        if (!record_type(reg, &type, &len))
+            continue;
+
+        if (type >= SQL_TEXT)
+        {
+            putVarint32(header, type);
+            header += 4;
+        }
+        else
+            *header++ = type;
+
+        if (type == SQL_INTEGER_4BYTE)
+            put4byte(data, reg->value.i);
+        else if (type == SQL_INTEGER_6BYTE)
+        {
+            put2byte(data, (uint16_t)(reg->value.i >> 32));
+            put4byte(data + 2, (uint32_t) reg->value.i);
+        }
+        else if (type == SQL_INTEGER_8BYTE)
+            put8byte(data, reg->value.i);
+        else if (type >= SQL_TEXT)
+            memcpy(data, reg->value.s, len);
+        data += len;
+    }
 
     // this checks the reg, but does not write the data because there are more fields to set than normal
     if (chidb_dbm_op_WriteReg(stmt, r2, REGISTER_BINARY, NULL) != CHIDB_OK)
         return CHIDB_PROBLEM;
 
-    reg2->type = REGISTER_BINARY;
-    reg2->value.bin.nbytes = packed_len;
-    reg2->value.bin.bytes = record;
+    stmt->reg[r2].value.bin.nbytes = header_size + data_len;
+    stmt->reg[r2].value.bin.bytes = record;
+    stmt->reg[r2].borrowed = true;
+    CHIDB_COUNT(stmt->db->bt->stats.packed, 1);
 
     return CHIDB_OK;
 }
 
+/* Insert p1 p2 p3 *
+ *
+ * p1: cursor
+ * p2: register containing the record
+ * p3: register containing the key
+ *
+ * add a new entry to the table B-Tree pointed at by cursor at p1, and
+ * leave the cursor on it. Keys are unique, and adding one that is
+ * already there is an error. A key that is not an integer (e.g., a ?
+ * parameter bound to text, or not bound at all) is a mismatch.
+ */
 int chidb_dbm_op_Insert (chidb_stmt *stmt, chidb_dbm_op_t *op)
 {
     int32_t c_index = op->p1;
     int32_t r1 = op->p2;
     int32_t r2 = op->p3;
+    int rc;
 
     // Get registers
     if (!IS_VALID_REGISTER(stmt, r1))
@@ -580,40 +1170,77 @@ int chidb_dbm_op_Insert (chidb_stmt *stmt, chidb_dbm_op_t *op)
         return CHIDB_PROBLEM;
     chidb_dbm_cursor_t *c = &((stmt)->cursors[c_index]);
 
+    // The key can come from a parameter, which may be NULL or text
+    if (!IS_INT_REG(reg2->type))
+        return CHIDB_EMISMATCH;
+
     //creating a new cell to insert
-    BTreeCell *cell = malloc(sizeof(BTreeCell));
-    cell->type = PGTYPE_TABLE_LEAF;
-    cell->key = (uint32_t)reg2->value.i;
-    // fprintf(stderr, "THE KEY TO INSERT IS %d\n", cell->key);
+    BTreeCell cell;
+    cell.type = PGTYPE_TABLE_LEAF;
+    cell.key = (chidb_key_t)reg2->value.i;
 
-    cell->fields.tableLeaf.data = reg1->value.bin.bytes; //take the data from the record struct
-    cell->fields.tableLeaf.data_size = reg1->value.bin.nbytes;
-    chidb_Btree_insert(stmt->db->bt, c->root_page, cell);
+    cell.fields.tableLeaf.data = reg1->value.bin.bytes; //take the data from the record struct
+    cell.fields.tableLeaf.data_size = reg1->value.bin.nbytes;
 
-    //RELOADING THE TREE just in case the insert messed up the treee
-    chidb_key_t old_key = c->current_cell.key;
-    chidb_dbm_cursor_seek(stmt->db->bt, c, old_key, c->root_page, 0, SEEK);
+    // cached results read from the table are out of date (see result-cache.c)
+    chidb_result_cache_written(stmt->db, c->root_page);
 
-    free(cell);
+    // The cursor only goes back to the root if the insert split a page
+    rc = chidb_dbm_cursor_insert(c->bt, c, &cell);
+    if (rc == CHIDB_EDUPLICATE)
+        return CHIDB_ECONSTRAINT;
 
-    return CHIDB_OK;
+    return rc;
+}
+
+/* Delete p1 _ _ *
+ *
+ * p1: cursor
+ *
+ * delete the entry the cursor at p1 is on, from its table B-Tree. The
+ * cursor is left so that the next Next moves it to the entry that
+ * followed the deleted one (see chidb_dbm_cursor_delete).
+ */
+int chidb_dbm_op_Delete (chidb_stmt *stmt, chidb_dbm_op_t *op)
+{
+    chidb_dbm_cursor_t *c = &((stmt)->cursors[op->p1]);
+
+    chidb_result_cache_written(stmt->db, c->root_page);
+
+    return chidb_dbm_cursor_delete(c->bt, c);
+}
+
+/* Update p1 p2 _ *
+ *
+ * p1: cursor
+ * p2: register containing the record
+ *
+ * replace the record of the entry the cursor at p1 is on, keeping its
+ * key. The cell is rewritten in place when the record fits in the leaf,
+ * and the cursor stays on the entry either way (see
+ * chidb_dbm_cursor_update).
+ */
+int chidb_dbm_op_Update (chidb_stmt *stmt, chidb_dbm_op_t *op)
+{
+    chidb_dbm_cursor_t *c = &((stmt)->cursors[op->p1]);
+    chidb_dbm_register_t *reg = &((stmt)->reg[op->p2]);
+
+    if (reg->type != REGISTER_BINARY)
+        return CHIDB_EMISMATCH;
+
+    chidb_result_cache_written(stmt->db, c->root_page);
+
+    return chidb_dbm_cursor_update(c->bt, c, reg->value.bin.bytes, reg->value.bin.nbytes);
 }
 
 int chidb_dbm_op_Eq (chidb_stmt *stmt, chidb_dbm_op_t *op)
 {
     uint32_t jmp_addr = op->p2;
 
-    if (!IS_VALID_REGISTER(stmt, op->p1))
-        return CHIDB_PROBLEM;
-    if (!IS_VALID_REGISTER(stmt, op->p3))
-        return CHIDB_PROBLEM;
-    if (!IS_VALID_ADDRESS(stmt, jmp_addr))
-        return CHIDB_PROBLEM;
-
     chidb_dbm_register_t *reg1 = &((stmt)->reg[op->p1]);
     chidb_dbm_register_t *reg2 = &((stmt)->reg[op->p3]);
 
-    if(reg1->type == REG_INT32 && reg2->type == REG_INT32) {
+    if(IS_INT_REG(reg1->type) && IS_INT_REG(reg2->type)) {
         if(reg2->value.i == reg1->value.i) {
             stmt->pc = (uint32_t)jmp_addr;
         }
@@ -631,17 +1258,10 @@ int chidb_dbm_op_Ne (chidb_stmt *stmt, chidb_dbm_op_t *op)
 {
     int32_t jmp_addr = op->p2;
 
-    if (!IS_VALID_REGISTER(stmt, op->p1))
-        return CHIDB_PROBLEM;
-    if (!IS_VALID_REGISTER(stmt, op->p3))
-        return CHIDB_PROBLEM;
-    if (!IS_VALID_ADDRESS(stmt, jmp_addr))
-        return CHIDB_PROBLEM;
-
     chidb_dbm_register_t *reg1 = &((stmt)->reg[op->p1]);
     chidb_dbm_register_t *reg2 = &((stmt)->reg[op->p3]);
 
-    if(reg1->type == REG_INT32 && reg2->type == REG_INT32) {
+    if(IS_INT_REG(reg1->type) && IS_INT_REG(reg2->type)) {
         if(reg2->value.i != reg1->value.i) {
             stmt->pc = (uint32_t)jmp_addr;
         }
@@ -659,17 +1279,10 @@ int chidb_dbm_op_Lt (chidb_stmt *stmt, chidb_dbm_op_t *op)
 {
     uint32_t jmp_addr = op->p2;
 
-    if (!IS_VALID_REGISTER(stmt, op->p1))
-        return CHIDB_PROBLEM;
-    if (!IS_VALID_REGISTER(stmt, op->p3))
-        return CHIDB_PROBLEM;
-    if (!IS_VALID_ADDRESS(stmt, jmp_addr))
-        return CHIDB_PROBLEM;
-
     chidb_dbm_register_t *reg1 = &((stmt)->reg[op->p1]);
     chidb_dbm_register_t *reg2 = &((stmt)->reg[op->p3]);
 
-    if(reg1->type == REG_INT32 && reg2->type == REG_INT32) {
+    if(IS_INT_REG(reg1->type) && IS_INT_REG(reg2->type)) {
         if(reg2->value.i < reg1->value.i) {
             stmt->pc = (uint32_t)jmp_addr;
         }
@@ -689,7 +1302,7 @@ int chidb_dbm_op_Le (chidb_stmt *stmt, chidb_dbm_op_t *op)
     chidb_dbm_register_t *reg1 = &((stmt)->reg[op->p1]);
     chidb_dbm_register_t *reg2 = &((stmt)->reg[op->p3]);
 
-    if(reg1->type == REG_INT32 && reg2->type == REG_INT32) {
+    if(IS_INT_REG(reg1->type) && IS_INT_REG(reg2->type)) {
         if(reg2->value.i <= reg1->value.i) {
             stmt->pc = (uint32_t)jmp_addr;
         }
@@ -710,18 +1323,10 @@ int chidb_dbm_op_Gt (chidb_stmt *stmt, chidb_dbm_op_t *op)
     int32_t r2 = op->p3;
     int32_t jmp_addr = op->p2;
 
-    if (!IS_VALID_REGISTER(stmt, r1))
-        return CHIDB_PROBLEM;
-    if (!IS_VALID_REGISTER(stmt, r2))
-        return CHIDB_PROBLEM;
-    if (!IS_VALID_ADDRESS(stmt, jmp_addr))
-        return CHIDB_PROBLEM;
-
     chidb_dbm_register_t *reg1 = &((stmt)->reg[r1]);
     chidb_dbm_register_t *reg2 = &((stmt)->reg[r2]);
 
-
-    if(reg1->type == REG_INT32 && reg2->type == REG_INT32) {
+    if(IS_INT_REG(reg1->type) && IS_INT_REG(reg2->type)) {
         if(reg2->value.i > reg1->value.i) {
             stmt->pc = (uint32_t)jmp_addr;
         }
@@ -741,18 +1346,10 @@ int chidb_dbm_op_Ge (chidb_stmt *stmt, chidb_dbm_op_t *op)
     int32_t r2 = op->p3;
     int32_t jmp_addr = op->p2;
 
-    if (!IS_VALID_REGISTER(stmt, r1))
-        return CHIDB_PROBLEM;
-    if (!IS_VALID_REGISTER(stmt, r2))
-        return CHIDB_PROBLEM;
-    if (!IS_VALID_ADDRESS(stmt, jmp_addr))
-        return CHIDB_PROBLEM;
-
     chidb_dbm_register_t *reg1 = &((stmt)->reg[r1]);
     chidb_dbm_register_t *reg2 = &((stmt)->reg[r2]);
 
-
-    if(reg1->type == REG_INT32 && reg2->type == REG_INT32) {
+    if(IS_INT_REG(reg1->type) && IS_INT_REG(reg2->type)) {
         if((reg2->value.i >= reg1->value.i))
             stmt->pc = (uint32_t)jmp_addr;
     }
@@ -765,6 +1362,65 @@ int chidb_dbm_op_Ge (chidb_stmt *stmt, chidb_dbm_op_t *op)
 }
 
 
+/* IfPos p1 p2 p3 *
+ *
+ * p1: register
+ * p2: jump addr
+ * p3: n
+ *
+ * if register p1 holds an integer greater than 0, subtract n from it and
+ * jump. Counts down the rows an OFFSET skips
+ */
+int chidb_dbm_op_IfPos (chidb_stmt *stmt, chidb_dbm_op_t *op)
+{
+    chidb_dbm_register_t *r = &((stmt)->reg[op->p1]);
+
+    if (IS_INT_REG(r->type) && r->value.i > 0)
+    {
+        r->value.i -= op->p3;
+        stmt->pc = (uint32_t) op->p2;
+    }
+
+    return CHIDB_OK;
+}
+
+/* DecrJumpZero p1 p2 * *
+ *
+ * p1: register
+ * p2: jump addr
+ *
+ * subtract 1 from the integer in register p1, and jump if it is now 0.
+ * Counts down the rows a LIMIT returns
+ */
+int chidb_dbm_op_DecrJumpZero (chidb_stmt *stmt, chidb_dbm_op_t *op)
+{
+    chidb_dbm_register_t *r = &((stmt)->reg[op->p1]);
+
+    if (!IS_INT_REG(r->type))
+        return CHIDB_EMISMATCH;
+
+    if (--r->value.i == 0)
+        stmt->pc = (uint32_t) op->p2;
+
+    return CHIDB_OK;
+}
+
+/* Compares the text index entry under cursor c with the text in register
+ * r, at the given edge of the entries with that text (see
+ * chidb_Btree_compareText). Texts are after any other value. */
+static int chidb_dbm_op_IdxCompareText (chidb_dbm_cursor_t *c, chidb_dbm_register_t *r, int edge)
+{
+    BTreeTextKey key = { NULL, 0, 0, edge };
+
+    if (r->type != REG_STRING)
+        return 1;
+
+    key.text = (uint8_t *) r->value.s;
+    key.len = strlen(r->value.s);
+
+    return chidb_Btree_compareText(&c->current_cell, &key);
+}
+
 /* IdxGt p1 p2 p3 *
  *
  * p1: cursor
@@ -778,18 +1434,18 @@ int chidb_dbm_op_IdxGt (chidb_stmt *stmt, chidb_dbm_op_t *op)
     int32_t c_index = op->p1;
     int32_t jmp_addr = op->p2;
 
-    if (!IS_VALID_REGISTER(stmt, op->p3))
-        return CHIDB_PROBLEM;
-    if (!IS_VALID_CURSOR(stmt, c_index))
-        return CHIDB_PROBLEM;
-    if (!IS_VALID_ADDRESS(stmt, jmp_addr))
-        return CHIDB_PROBLEM;
-
     chidb_dbm_register_t *r1 = &((stmt)->reg[op->p3]);
-    int32_t key = r1->value.i;
+    chidb_key_t key = (chidb_key_t) r1->value.i;
 
     chidb_dbm_cursor_t *c = &((stmt)->cursors[c_index]);
 
+    if (PGTYPE_IS_TEXTINDEX(c->current_cell.type))
+    {
+        if (chidb_dbm_op_IdxCompareText(c, r1, TEXTKEY_LAST) > 0)
+            stmt->pc = (uint32_t)jmp_addr;
+        return CHIDB_OK;
+    }
+
     // I'm assuming hopefully that current cell points to an index cell
     if(c->current_cell.key > key) {
         stmt->pc = (uint32_t)jmp_addr;
@@ -811,18 +1467,18 @@ int chidb_dbm_op_IdxGe (chidb_stmt *stmt, chidb_dbm_op_t *op)
     uint32_t c_index = op->p1;
     uint32_t jmp_addr = op->p2;
 
-    if (!IS_VALID_REGISTER(stmt, op->p3))
-        return CHIDB_PROBLEM;
-    if (!IS_VALID_CURSOR(stmt, c_index))
-        return CHIDB_PROBLEM;
-    if (!IS_VALID_ADDRESS(stmt, jmp_addr))
-        return CHIDB_PROBLEM;
-
     chidb_dbm_register_t *r1 = &((stmt)->reg[op->p3]);
-    int32_t key = r1->value.i;
+    chidb_key_t key = (chidb_key_t) r1->value.i;
 
     chidb_dbm_cursor_t *c = &((stmt)->cursors[c_index]);
 
+    if (PGTYPE_IS_TEXTINDEX(c->current_cell.type))
+    {
+        if (chidb_dbm_op_IdxCompareText(c, r1, TEXTKEY_FIRST) > 0)
+            stmt->pc = (uint32_t)jmp_addr;
+        return CHIDB_OK;
+    }
+
     // I'm assuming hopefully that current cell points to an index cell
     if((c->current_cell.key > key) || (c->current_cell.key == key)) {
         stmt->pc = (uint32_t)jmp_addr;
@@ -844,18 +1500,18 @@ int chidb_dbm_op_IdxLt (chidb_stmt *stmt, chidb_dbm_op_t *op)
     int32_t c_index = op->p1;
     int32_t jmp_addr = op->p2;
 
-    if (!IS_VALID_REGISTER(stmt, op->p3))
-        return CHIDB_PROBLEM;
-    if (!IS_VALID_CURSOR(stmt, c_index))
-        return CHIDB_PROBLEM;
-    if (!IS_VALID_ADDRESS(stmt, jmp_addr))
-        return CHIDB_PROBLEM;
-
     chidb_dbm_register_t *r1 = &((stmt)->reg[op->p3]);
-    int32_t key = r1->value.i;
+    chidb_key_t key = (chidb_key_t) r1->value.i;
 
     chidb_dbm_cursor_t *c = &((stmt)->cursors[c_index]);
 
+    if (PGTYPE_IS_TEXTINDEX(c->current_cell.type))
+    {
+        if (chidb_dbm_op_IdxCompareText(c, r1, TEXTKEY_FIRST) < 0)
+            stmt->pc = (uint32_t)jmp_addr;
+        return CHIDB_OK;
+    }
+
     // I'm assuming hopefully that current cell points to an index cell
     if(c->current_cell.key < key) {
         stmt->pc = (uint32_t)jmp_addr;
@@ -877,18 +1533,18 @@ int chidb_dbm_op_IdxLe (chidb_stmt *stmt, chidb_dbm_op_t *op)
     int32_t c_index = op->p1;
     int32_t jmp_addr = op->p2;
 
-    if (!IS_VALID_REGISTER(stmt, op->p3))
-        return CHIDB_PROBLEM;
-    if (!IS_VALID_CURSOR(stmt, c_index))
-        return CHIDB_PROBLEM;
-    if (!IS_VALID_ADDRESS(stmt, jmp_addr))
-        return CHIDB_PROBLEM;
-
     chidb_dbm_register_t *r1 = &((stmt)->reg[op->p3]);
-    int32_t key = r1->value.i;
+    chidb_key_t key = (chidb_key_t) r1->value.i;
 
     chidb_dbm_cursor_t *c = &((stmt)->cursors[c_index]);
 
+    if (PGTYPE_IS_TEXTINDEX(c->current_cell.type))
+    {
+        if (chidb_dbm_op_IdxCompareText(c, r1, TEXTKEY_LAST) < 0)
+            stmt->pc = (uint32_t)jmp_addr;
+        return CHIDB_OK;
+    }
+
     // I'm assuming hopefully that current cell points to an index cell
     if((c->current_cell.key < key) || (c->current_cell.key == key)) {
         stmt->pc = (uint32_t)jmp_addr;
@@ -908,10 +1564,7 @@ int chidb_dbm_op_IdxPKey (chidb_stmt *stmt, chidb_dbm_op_t *op)
 {
     int32_t c_index = op->p1;
     int32_t reg_index = op->p2;
-    uint32_t key;
-
-    if (!IS_VALID_CURSOR(stmt, c_index))
-        return CHIDB_PROBLEM;
+    chidb_key_t key;
 
     // get cursor
     chidb_dbm_cursor_t *c = &((stmt)->cursors[c_index]);
@@ -920,11 +1573,14 @@ int chidb_dbm_op_IdxPKey (chidb_stmt *stmt, chidb_dbm_op_t *op)
     if(c->current_cell.type == PGTYPE_INDEX_INTERNAL) {
         key = c->current_cell.fields.indexInternal.keyPk;
     }
+    else if(PGTYPE_IS_TEXTINDEX(c->current_cell.type)) {
+        key = c->current_cell.fields.textIndex.keyPk;
+    }
     else {
         key = c->current_cell.fields.indexLeaf.keyPk;
     }
 
-    if (chidb_dbm_op_WriteReg(stmt, reg_index, REG_INT32, &key) != CHIDB_OK)
+    if (chidb_dbm_op_WriteInt(stmt, reg_index, (int64_t) key) != CHIDB_OK)
         return CHIDB_PROBLEM;
 
     return CHIDB_OK;
@@ -936,13 +1592,18 @@ int chidb_dbm_op_IdxPKey (chidb_stmt *stmt, chidb_dbm_op_t *op)
  * p2: register containing IdxKey
  * p2: register containing PKey
  *
- * add new (IdkKey,PKey) entry in index BTree pointed at by cursor at p1
+ * add new (IdkKey,PKey) entry in index BTree pointed at by cursor at p1.
+ * NULLs are not indexed, so nothing is added if IdxKey is NULL. Entries
+ * are in the order of IdxKey and then of PKey, so several rows can have
+ * the same IdxKey; adding an entry that is already there (same IdxKey and
+ * PKey) is an error. In a text index, IdxKey must be a text.
  */
 int chidb_dbm_op_IdxInsert (chidb_stmt *stmt, chidb_dbm_op_t *op)
 {
     int32_t c_index = op->p1;
     int32_t r1 = op->p2;
     int32_t r2 = op->p3;
+    int rc;
 
     if (!IS_VALID_REGISTER(stmt, r1))
         return CHIDB_PROBLEM;
@@ -955,92 +1616,1067 @@ int chidb_dbm_op_IdxInsert (chidb_stmt *stmt, chidb_dbm_op_t *op)
     chidb_dbm_register_t *reg1 = &((stmt)->reg[r1]);
     chidb_dbm_register_t *reg2 = &((stmt)->reg[r2]);
 
+    if (reg1->type == REG_NULL)
+        return CHIDB_OK;
+
     // Get cursor
     chidb_dbm_cursor_t *c = &((stmt)->cursors[c_index]);
 
+    chidb_result_cache_written(stmt->db, c->root_page);
+
     //creating a new cell to insert
-    BTreeCell *cell = malloc(sizeof(BTreeCell));
-    cell->type = PGTYPE_INDEX_LEAF;
-    cell->key = (uint32_t)reg1->value.i; //grab the idx key
+    BTreeCell cell;
+
+    if (PGTYPE_IS_TEXTINDEX(c->root_type))
+    {
+        if (reg1->type != REG_STRING)
+            return CHIDB_EMISMATCH;
+
+        cell.type = PGTYPE_TEXTINDEX_LEAF;
+        cell.key = 0;
+        cell.fields.textIndex.prefix = NULL;
+        cell.fields.textIndex.prefix_len = 0;
+        cell.fields.textIndex.suffix = (uint8_t *) reg1->value.s;
+        cell.fields.textIndex.suffix_len = strlen(reg1->value.s);
+        cell.fields.textIndex.keyPk = (chidb_key_t)reg2->value.i;
+        cell.fields.textIndex.has_pk = true;
+        cell.fields.textIndex.child_page = 0;
+
+        // the trail may not match the tree after the insert
+        while (c->depth > 0)
+            chidb_dbm_cursor_trail_pop(c->bt, c);
+        rc = chidb_Btree_insert(c->bt, c->root_page, &cell);
+        if (rc == CHIDB_EDUPLICATE)
+            return CHIDB_ECONSTRAINT;
+        if (rc != CHIDB_OK)
+            return rc;
+
+        return chidb_dbm_cursor_reset(c->bt, c);
+    }
 
-    cell->fields.indexLeaf.keyPk = (uint32_t)reg2->value.i;
-    chidb_Btree_insert(stmt->db->bt, c->root_page, cell);
+    cell.type = PGTYPE_INDEX_LEAF;
+    cell.key = (chidb_key_t)reg1->value.i; //grab the idx key
+
+    cell.fields.indexLeaf.keyPk = (chidb_key_t)reg2->value.i;
+    rc = chidb_Btree_insert(c->bt, c->root_page, &cell);
+    if (rc == CHIDB_EDUPLICATE)
+        return CHIDB_ECONSTRAINT;
+    if (rc != CHIDB_OK)
+        return rc;
 
     //RELOADING THE TREE just in case the insert messed up the tree
     chidb_key_t old_key = c->current_cell.key;
-    chidb_dbm_cursor_seek(stmt->db->bt, c, old_key, c->root_page, 0, SEEK);
+    chidb_dbm_cursor_seek(c->bt, c, old_key, c->root_page, 0, SEEK);
 
     return CHIDB_OK;
 }
 
-/* CreateTable p1 * * *
+/* IdxDelete p1 p2 p3 *
  *
- * p1: register containing root page for table
+ * p1: cursor
+ * p2: register containing IdxKey
+ * p3: register containing PKey
+ *
+ * delete the (IdxKey,PKey) entry from the index BTree pointed at by
+ * cursor at p1. Nothing is done if IdxKey is NULL, or if there is no such
+ * entry (rows added with chidb_insert_rows or chidb_load are not added to
+ * the indexes).
  */
-int chidb_dbm_op_CreateTable (chidb_stmt *stmt, chidb_dbm_op_t *op)
+int chidb_dbm_op_IdxDelete (chidb_stmt *stmt, chidb_dbm_op_t *op)
 {
-    npage_t *root = malloc(sizeof(npage_t));
+    chidb_dbm_register_t *reg1 = &((stmt)->reg[op->p2]);
+    chidb_dbm_register_t *reg2 = &((stmt)->reg[op->p3]);
+    chidb_dbm_cursor_t *c = &((stmt)->cursors[op->p1]);
+    int rc;
 
-    int ret = chidb_Btree_newNode(stmt->db->bt, root, PGTYPE_TABLE_LEAF);
-    if (ret != CHIDB_OK)
-        return ret;
+    if (reg1->type == REG_NULL)
+        return CHIDB_OK;
 
-    if (chidb_dbm_op_WriteReg(stmt, op->p1, REG_INT32, root) != CHIDB_OK)
-        return CHIDB_PROBLEM;
+    chidb_result_cache_written(stmt->db, c->root_page);
+
+    // text index entries are found by text and primary key together
+    if (PGTYPE_IS_TEXTINDEX(c->root_type))
+    {
+        BTreeTextKey key = { NULL, 0, (chidb_key_t)reg2->value.i, TEXTKEY_ENTRY };
 
-    free(root);
+        if (reg1->type != REG_STRING)
+            return CHIDB_OK;
+        key.text = (uint8_t *) reg1->value.s;
+        key.len = strlen(reg1->value.s);
+
+        while (c->depth > 0)
+            chidb_dbm_cursor_trail_pop(c->bt, c);
+        rc = chidb_Btree_deleteText(c->bt, c->root_page, &key);
+        if (rc != CHIDB_OK && rc != CHIDB_ENOTFOUND)
+            return rc;
+
+        return chidb_dbm_cursor_reset(c->bt, c);
+    }
+
+    // the tree may change under the trail, so let go of it first
+    while (c->depth > 0)
+        chidb_dbm_cursor_trail_pop(c->bt, c);
+    rc = chidb_Btree_deleteInIndex(c->bt, c->root_page, (chidb_key_t)reg1->value.i, (chidb_key_t)reg2->value.i);
+    if (rc != CHIDB_OK && rc != CHIDB_ENOTFOUND)
+        return rc;
+
+    return chidb_dbm_cursor_reset(c->bt, c);
+}
+
+/* Entries of an index being built by IdxLoad: the rows of a sorter */
+typedef struct
+{
+    chidb_dbm_sorter_t *sorter;
+    bool started;       // has the first row been returned?
+} chidb_dbm_idx_load_t;
+
+/* chidb_Btree_bulkSource that returns the (key, primary key) rows of a
+ * sorter as index entries. Rows with a NULL key are not indexed. */
+static int chidb_dbm_op_IdxLoadNext(void *ctx, BTreeCell *cell)
+{
+    chidb_dbm_idx_load_t *load = ctx;
+    chidb_dbm_sorter_row_t *row;
+    int rc;
+
+    do
+    {
+        if (load->started && (rc = chidb_dbm_sorter_next(load->sorter)) != CHIDB_OK)
+            return rc;
+        load->started = true;
+
+        if ((row = load->sorter->current) == NULL || row->nfields < 2)
+            return CHIDB_PROBLEM;
+    } while (row->fields[0].type == REG_NULL);
+
+    if (!IS_INT_REG(row->fields[0].type) || !IS_INT_REG(row->fields[1].type))
+        return CHIDB_EMISMATCH;
+
+    cell->type = PGTYPE_INDEX_LEAF;
+    cell->key = (chidb_key_t) row->fields[0].value.i;
+    cell->fields.indexLeaf.keyPk = (chidb_key_t) row->fields[1].value.i;
 
     return CHIDB_OK;
 }
 
-/* CreateIndex p1 * * *
+/* IdxLoad p1 p2 * *
  *
- * p1: register containing root page for index table
+ * p1: cursor (an empty index)
+ * p2: sorter cursor
  *
+ * sort the rows of the sorter at cursor p2, made of an index key and a
+ * primary key, and build the index at cursor p1 from them bottom-up (see
+ * chidb_Btree_bulkLoad), instead of inserting them one at a time. Rows
+ * with a NULL key are left out, like IdxInsert does. Only for indexes on
+ * INTEGER columns: text indexes are filled with IdxInsert.
  */
-int chidb_dbm_op_CreateIndex (chidb_stmt *stmt, chidb_dbm_op_t *op)
+int chidb_dbm_op_IdxLoad (chidb_stmt *stmt, chidb_dbm_op_t *op)
 {
-    npage_t *root = malloc(sizeof(npage_t));
+    chidb_dbm_cursor_t *c = &((stmt)->cursors[op->p1]);
+    chidb_dbm_cursor_t *s = &((stmt)->cursors[op->p2]);
+    chidb_dbm_idx_load_t load = { s->sorter, false };
+    int rc;
 
-    int ret = chidb_Btree_newNode(stmt->db->bt, root, PGTYPE_INDEX_LEAF);
-    if (ret != CHIDB_OK)
-        return ret;
+    if (c->type != CURSOR_WRITE || c->root_type != PGTYPE_INDEX_LEAF || s->type != CURSOR_SORTER || s->sorter == NULL)
+        return CHIDB_PROBLEM;
+
+    chidb_result_cache_written(stmt->db, c->root_page);
+
+    rc = chidb_dbm_sorter_sort(s->sorter);
+    if (rc == CHIDB_DONE)
+        return CHIDB_OK;
+    if (rc != CHIDB_OK)
+        return rc;
+
+    // the root is rewritten under the trail
+    while (c->depth > 0)
+        chidb_dbm_cursor_trail_pop(c->bt, c);
+    rc = chidb_Btree_bulkLoad(c->bt, c->root_page, chidb_dbm_op_IdxLoadNext, &load, 0);
+    if (rc == CHIDB_EDUPLICATE)
+        return CHIDB_ECONSTRAINT;
+    if (rc != CHIDB_OK)
+        return rc;
+
+    return chidb_dbm_cursor_reset(c->bt, c);
+}
+
+/* OpenHash p1 p2 p3 *
+ *
+ * p1: cursor
+ * p2: number of key fields
+ * p3: keep NULL keys if non-zero
+ *
+ * open cursor p1 on a new, empty hash table, whose rows are looked up by
+ * their first p2 fields. If p3 is non-zero, rows with NULL keys are kept,
+ * and NULLs are equal to each other (as GROUP BY needs)
+ */
+int chidb_dbm_op_OpenHash (chidb_stmt *stmt, chidb_dbm_op_t *op)
+{
+    chidb_dbm_cursor_t *c = &((stmt)->cursors[op->p1]);
+    int rc;
 
-    if (chidb_dbm_op_WriteReg(stmt, op->p1, REG_INT32, root) != CHIDB_OK)
+    if (op->p2 < 1)
         return CHIDB_PROBLEM;
 
+    // a hash cursor has no trail and no current cell
+    c->depth = 0;
+    c->record.valid = false;
+    c->current_cell.type = 0;
+    c->text = NULL;
+    c->text_size = 0;
+    c->payload = NULL;
+    c->payload_size = 0;
+    c->n_cols = 0;
+    c->bt = stmt->db->bt;
+
+    if ((rc = chidb_dbm_hash_create(&c->hash, op->p2, stmt->db)) != CHIDB_OK)
+        return rc;
+    c->hash->nulls = op->p3 != 0;
+
+    c->type = CURSOR_HASH;
+
     return CHIDB_OK;
 }
 
+/* HashInsert p1 p2 p3 *
+ *
+ * p1: hash cursor
+ * p2: register containing the first field of the row
+ * p3: n -- number of fields in the row
+ *
+ * insert a copy of registers p2..p2+n-1 into the hash table at cursor p1
+ */
+int chidb_dbm_op_HashInsert (chidb_stmt *stmt, chidb_dbm_op_t *op)
+{
+    chidb_dbm_cursor_t *c = &((stmt)->cursors[op->p1]);
+
+    if (c->hash == NULL || op->p3 < (int32_t) c->hash->nkeys)
+        return CHIDB_PROBLEM;
 
-int chidb_dbm_op_Copy (chidb_stmt *stmt, chidb_dbm_op_t *op)
+    return chidb_dbm_hash_insert(c->hash, &stmt->reg[op->p2], op->p3);
+}
+
+/* HashSeek p1 p2 p3 *
+ *
+ * p1: hash cursor
+ * p2: jump addr
+ * p3: register containing the first key field
+ *
+ * move cursor p1 to the first row whose key is in registers p3 onwards.
+ * If there is no such row, jump
+ */
+int chidb_dbm_op_HashSeek (chidb_stmt *stmt, chidb_dbm_op_t *op)
 {
+    chidb_dbm_cursor_t *c = &((stmt)->cursors[op->p1]);
+
+    if (c->hash == NULL || op->p3 + c->hash->nkeys > stmt->nReg)
+        return CHIDB_PROBLEM;
+
+    if (chidb_dbm_hash_find(c->hash, &stmt->reg[op->p3]) != CHIDB_OK)
+        stmt->pc = (uint32_t) op->p2;
+
     return CHIDB_OK;
 }
 
-
-int chidb_dbm_op_SCopy (chidb_stmt *stmt, chidb_dbm_op_t *op)
+/* HashFilter p1 p2 p3 *
+ *
+ * p1: hash cursor
+ * p2: jump addr
+ * p3: register containing the first key field
+ *
+ * If no row of hash table p1 can have the value in register p3 as its
+ * first key field, jump (see chidb_dbm_hash_filter). This may not jump
+ * even when there is no such row.
+ */
+int chidb_dbm_op_HashFilter (chidb_stmt *stmt, chidb_dbm_op_t *op)
 {
+    chidb_dbm_cursor_t *c = &((stmt)->cursors[op->p1]);
+
+    if (c->hash == NULL || op->p3 >= stmt->nReg)
+        return CHIDB_PROBLEM;
+
+    if (!chidb_dbm_hash_filter(c->hash, &stmt->reg[op->p3]))
+        stmt->pc = (uint32_t) op->p2;
+
     return CHIDB_OK;
 }
 
-int chidb_dbm_op_Halt (chidb_stmt *stmt, chidb_dbm_op_t *op)
+/* HashNext p1 p2 p3 *
+ *
+ * p1: hash cursor
+ * p2: jump addr
+ * p3: register containing the first key field
+ *
+ * move cursor p1 to the next row whose key is in registers p3 onwards
+ * (the same key given to HashSeek). If there is one, jump
+ */
+int chidb_dbm_op_HashNext (chidb_stmt *stmt, chidb_dbm_op_t *op)
 {
-    return CHIDB_DONE;
+    chidb_dbm_cursor_t *c = &((stmt)->cursors[op->p1]);
+
+    if (c->hash == NULL || op->p3 + c->hash->nkeys > stmt->nReg)
+        return CHIDB_PROBLEM;
+
+    if (chidb_dbm_hash_find_next(c->hash, &stmt->reg[op->p3]) == CHIDB_OK)
+        stmt->pc = (uint32_t) op->p2;
+
+    return CHIDB_OK;
 }
 
-int chidb_dbm_op_WriteReg (chidb_stmt *stmt, int regNo, int reg_type, void *data)
+/* HashColumn p1 p2 p3 *
+ *
+ * p1: hash cursor
+ * p2: field number
+ * p3: register
+ *
+ * store field p2 of the row at cursor p1 in register p3. Strings are
+ * borrowed from the hash table, so they are valid until it is closed
+ */
+int chidb_dbm_op_HashColumn (chidb_stmt *stmt, chidb_dbm_op_t *op)
 {
-    if (IS_VALID_REGISTER(stmt, regNo) && regNo > stmt->nReg)
-        realloc_reg(stmt, regNo);
+    chidb_dbm_cursor_t *c = &((stmt)->cursors[op->p1]);
+    chidb_dbm_hash_row_t *row;
 
-    chidb_dbm_register_t *reg = &(stmt->reg[regNo]);
-    reg->type = reg_type;
+    if (c->hash == NULL || (row = c->hash->match) == NULL)
+        return CHIDB_PROBLEM;
 
-    if (reg_type == REG_INT32)
-        reg->value.i = *((int32_t *) data);
-    else if (reg_type == REG_STRING)
-        reg->value.s = (char *) data;
+    if (op->p2 < 0 || op->p2 >= (int32_t) row->nfields)
+        return chidb_dbm_op_WriteReg(stmt, op->p3, REG_UNSPECIFIED, NULL);
+
+    chidb_dbm_register_t *field = &row->fields[op->p2];
+
+    if (field->type == REG_STRING)
+        return chidb_dbm_op_WriteString(stmt, op->p3, field->value.s, true);
+    else if (field->type == REGISTER_BINARY)
+    {
+        if (chidb_dbm_op_WriteReg(stmt, op->p3, REGISTER_BINARY, NULL) != CHIDB_OK)
+            return CHIDB_PROBLEM;
+        stmt->reg[op->p3] = *field;
+        return CHIDB_OK;
+    }
+    else if (IS_INT_REG(field->type))
+        return chidb_dbm_op_WriteInt(stmt, op->p3, field->value.i);
+    else
+        return chidb_dbm_op_WriteReg(stmt, op->p3, field->type, NULL);
+}
+
+/* HashGroup p1 p2 p3 *
+ *
+ * p1: hash cursor
+ * p2: register containing the first key field
+ * p3: n -- number of fields in a row
+ *
+ * move cursor p1 to the row whose key is in registers p2 onwards. If
+ * there is no such row, insert registers p2..p2+n-1 as one first
+ */
+int chidb_dbm_op_HashGroup (chidb_stmt *stmt, chidb_dbm_op_t *op)
+{
+    chidb_dbm_cursor_t *c = &((stmt)->cursors[op->p1]);
+    int rc;
+
+    if (c->hash == NULL || op->p3 < (int32_t) c->hash->nkeys)
+        return CHIDB_PROBLEM;
+
+    if (chidb_dbm_hash_find(c->hash, &stmt->reg[op->p2]) == CHIDB_OK)
+        return CHIDB_OK;
+
+    if ((rc = chidb_dbm_hash_insert(c->hash, &stmt->reg[op->p2], op->p3)) != CHIDB_OK)
+        return rc;
+
+    // a key the hash table does not keep (a NULL) leaves no row to be on
+    return chidb_dbm_hash_find(c->hash, &stmt->reg[op->p2]) == CHIDB_OK ? CHIDB_OK : CHIDB_PROBLEM;
+}
+
+/* HashUpdate p1 p2 p3 *
+ *
+ * p1: hash cursor
+ * p2: register containing the first value
+ * p3: n -- number of values
+ *
+ * store a copy of registers p2..p2+n-1 in the fields that follow the key
+ * of the row at cursor p1
+ */
+int chidb_dbm_op_HashUpdate (chidb_stmt *stmt, chidb_dbm_op_t *op)
+{
+    chidb_dbm_cursor_t *c = &((stmt)->cursors[op->p1]);
+
+    if (c->hash == NULL || c->hash->match == NULL)
+        return CHIDB_PROBLEM;
+
+    if (chidb_dbm_hash_update(c->hash, &stmt->reg[op->p2], op->p3) != CHIDB_OK)
+        return CHIDB_PROBLEM;
+
+    return CHIDB_OK;
+}
+
+/* HashRewind p1 p2 * *
+ *
+ * p1: hash cursor
+ * p2: jump addr
+ *
+ * move cursor p1 to the first row of the hash table (rows are read in no
+ * particular order). If it is empty, jump
+ */
+int chidb_dbm_op_HashRewind (chidb_stmt *stmt, chidb_dbm_op_t *op)
+{
+    chidb_dbm_cursor_t *c = &((stmt)->cursors[op->p1]);
+
+    if (c->hash == NULL)
+        return CHIDB_PROBLEM;
+
+    if (chidb_dbm_hash_rewind(c->hash) != CHIDB_OK)
+        stmt->pc = (uint32_t) op->p2;
+
+    return CHIDB_OK;
+}
+
+/* HashNextRow p1 p2 * *
+ *
+ * p1: hash cursor
+ * p2: jump addr
+ *
+ * move cursor p1 to the next row of the hash table, whatever its key. If
+ * there is one, jump
+ */
+int chidb_dbm_op_HashNextRow (chidb_stmt *stmt, chidb_dbm_op_t *op)
+{
+    chidb_dbm_cursor_t *c = &((stmt)->cursors[op->p1]);
+
+    if (c->hash == NULL)
+        return CHIDB_PROBLEM;
+
+    if (chidb_dbm_hash_next_row(c->hash) == CHIDB_OK)
+        stmt->pc = (uint32_t) op->p2;
+
+    return CHIDB_OK;
+}
+
+/* SorterOpen p1 p2 p3 *
+ *
+ * p1: cursor
+ * p2: field number
+ * p3: descending order if non-zero
+ *
+ * open cursor p1 on a new, empty sorter, which sorts its rows by field p2.
+ * Rows are kept in memory up to the database's sort budget, and spilled
+ * to temporary files after that (see dbm-sorter.c)
+ */
+int chidb_dbm_op_SorterOpen (chidb_stmt *stmt, chidb_dbm_op_t *op)
+{
+    chidb_dbm_cursor_t *c = &((stmt)->cursors[op->p1]);
+    int rc;
+
+    if (op->p2 < 0)
+        return CHIDB_PROBLEM;
+
+    // like a hash cursor, a sorter cursor has no trail and no current cell
+    c->depth = 0;
+    c->record.valid = false;
+    c->current_cell.type = 0;
+    c->text = NULL;
+    c->text_size = 0;
+    c->payload = NULL;
+    c->payload_size = 0;
+    c->n_cols = 0;
+    c->bt = stmt->db->bt;
+    c->hash = NULL;
+
+    if ((rc = chidb_dbm_sorter_create(&c->sorter, op->p2, op->p3 != 0, stmt->db->sort_budget, stmt->db)) != CHIDB_OK)
+        return rc;
+
+    c->type = CURSOR_SORTER;
+
+    return CHIDB_OK;
+}
+
+/* SorterLimit p1 p2 * *
+ *
+ * p1: sorter cursor
+ * p2: n -- number of rows
+ *
+ * make the sorter at cursor p1, which must not have any rows yet, keep
+ * only the first n of the rows inserted into it (see
+ * chidb_dbm_sorter_limit). It then needs memory for n rows at most, and
+ * never spills them
+ */
+int chidb_dbm_op_SorterLimit (chidb_stmt *stmt, chidb_dbm_op_t *op)
+{
+    chidb_dbm_cursor_t *c = &((stmt)->cursors[op->p1]);
+
+    if (c->type != CURSOR_SORTER || c->sorter == NULL || op->p2 <= 0)
+        return CHIDB_PROBLEM;
+
+    return chidb_dbm_sorter_limit(c->sorter, (uint32_t) op->p2);
+}
+
+/* SorterInsert p1 p2 p3 *
+ *
+ * p1: sorter cursor
+ * p2: register containing the first field of the row
+ * p3: n -- number of fields in the row
+ *
+ * insert a copy of registers p2..p2+n-1 into the sorter at cursor p1
+ */
+int chidb_dbm_op_SorterInsert (chidb_stmt *stmt, chidb_dbm_op_t *op)
+{
+    chidb_dbm_cursor_t *c = &((stmt)->cursors[op->p1]);
+
+    if (c->type != CURSOR_SORTER || c->sorter == NULL)
+        return CHIDB_PROBLEM;
+
+    return chidb_dbm_sorter_insert(c->sorter, &stmt->reg[op->p2], op->p3);
+}
+
+/* SorterSort p1 p2 * *
+ *
+ * p1: sorter cursor
+ * p2: jump addr
+ *
+ * sort the rows of the sorter at cursor p1, and move it to the first one.
+ * If there are no rows, jump
+ */
+int chidb_dbm_op_SorterSort (chidb_stmt *stmt, chidb_dbm_op_t *op)
+{
+    chidb_dbm_cursor_t *c = &((stmt)->cursors[op->p1]);
+    int rc;
+
+    if (c->type != CURSOR_SORTER || c->sorter == NULL)
+        return CHIDB_PROBLEM;
+
+    rc = chidb_dbm_sorter_sort(c->sorter);
+    if (rc == CHIDB_DONE)
+        stmt->pc = (uint32_t) op->p2;
+    else if (rc != CHIDB_OK)
+        return rc;
+
+    return CHIDB_OK;
+}
+
+/* SorterNext p1 p2 * *
+ *
+ * p1: sorter cursor
+ * p2: jump addr
+ *
+ * move the sorter at cursor p1 to its next row. If there is one, jump
+ */
+int chidb_dbm_op_SorterNext (chidb_stmt *stmt, chidb_dbm_op_t *op)
+{
+    chidb_dbm_cursor_t *c = &((stmt)->cursors[op->p1]);
+    int rc;
+
+    if (c->type != CURSOR_SORTER || c->sorter == NULL || c->sorter->current == NULL)
+        return CHIDB_PROBLEM;
+
+    rc = chidb_dbm_sorter_next(c->sorter);
+    if (rc == CHIDB_OK)
+        stmt->pc = (uint32_t) op->p2;
+    else if (rc != CHIDB_DONE)
+        return rc;
+
+    return CHIDB_OK;
+}
+
+/* SorterColumn p1 p2 p3 *
+ *
+ * p1: sorter cursor
+ * p2: field number
+ * p3: register
+ *
+ * store field p2 of the row the sorter at cursor p1 is on in register p3.
+ * Rows read back from a spilled run only last until the sorter moves, so
+ * strings are copied into the register
+ */
+int chidb_dbm_op_SorterColumn (chidb_stmt *stmt, chidb_dbm_op_t *op)
+{
+    chidb_dbm_cursor_t *c = &((stmt)->cursors[op->p1]);
+    chidb_dbm_sorter_row_t *row;
+
+    if (c->type != CURSOR_SORTER || c->sorter == NULL || (row = c->sorter->current) == NULL)
+        return CHIDB_PROBLEM;
+
+    if (op->p2 < 0 || op->p2 >= (int32_t) row->nfields)
+        return chidb_dbm_op_WriteReg(stmt, op->p3, REG_UNSPECIFIED, NULL);
+
+    chidb_dbm_register_t *field = &row->fields[op->p2];
+
+    if (field->type == REG_STRING)
+        return chidb_dbm_op_WriteCopy(stmt, op->p3, REG_STRING, field->value.s, strlen(field->value.s) + 1);
+    else if (field->type == REGISTER_BINARY)
+        return chidb_dbm_op_WriteCopy(stmt, op->p3, REGISTER_BINARY, field->value.bin.bytes, field->value.bin.nbytes);
+    else if (IS_INT_REG(field->type))
+        return chidb_dbm_op_WriteInt(stmt, op->p3, field->value.i);
+    else
+        return chidb_dbm_op_WriteReg(stmt, op->p3, field->type, NULL);
+}
+
+/* CreateTable p1 * * *
+ *
+ * p1: register containing root page for table
+ */
+int chidb_dbm_op_CreateTable (chidb_stmt *stmt, chidb_dbm_op_t *op)
+{
+    npage_t root;
+
+    int ret = chidb_Btree_newNode(stmt->db->bt, &root, PGTYPE_TABLE_LEAF);
+    if (ret != CHIDB_OK)
+        return ret;
+
+    if (chidb_dbm_op_WriteInt(stmt, op->p1, root) != CHIDB_OK)
+        return CHIDB_PROBLEM;
+
+    return CHIDB_OK;
+}
+
+/* CreateIndex p1 p2 * *
+ *
+ * p1: register containing root page for index table
+ * p2: nonzero to create a text index (see chidb_Btree_insertText)
+ *
+ */
+int chidb_dbm_op_CreateIndex (chidb_stmt *stmt, chidb_dbm_op_t *op)
+{
+    npage_t root;
+
+    int ret = chidb_Btree_newNode(stmt->db->bt, &root, op->p2 ? PGTYPE_TEXTINDEX_LEAF : PGTYPE_INDEX_LEAF);
+    if (ret != CHIDB_OK)
+        return ret;
+
+    if (chidb_dbm_op_WriteInt(stmt, op->p1, root) != CHIDB_OK)
+        return CHIDB_PROBLEM;
+
+    return CHIDB_OK;
+}
+
+
+/* Copy p1 p2
+ *
+ * p1: register to copy from
+ * p2: register to copy to
+ *
+ * Strings and binary values get their own copy, so p2 remains valid after
+ * the cursor (or instruction) that p1 borrows its value from is gone
+ */
+int chidb_dbm_op_Copy (chidb_stmt *stmt, chidb_dbm_op_t *op)
+{
+    if (!IS_VALID_REGISTER(stmt, op->p1) || !EXISTS_REGISTER(stmt, op->p2))
+        return CHIDB_PROBLEM;
+    if (op->p1 == op->p2)
+        return CHIDB_OK;
+
+    chidb_dbm_register_t *src = &stmt->reg[op->p1];
+
+    switch (src->type)
+    {
+        case REG_STRING:
+            return chidb_dbm_op_WriteCopy(stmt, op->p2, REG_STRING, src->value.s, strlen(src->value.s) + 1);
+
+        case REGISTER_BINARY:
+            return chidb_dbm_op_WriteCopy(stmt, op->p2, REGISTER_BINARY, src->value.bin.bytes, src->value.bin.nbytes);
+
+        case REG_INT32:
+        case REG_INT64:
+            return chidb_dbm_op_WriteInt(stmt, op->p2, src->value.i);
+
+        default:
+            return chidb_dbm_op_WriteReg(stmt, op->p2, src->type, NULL);
+    }
+}
+
+
+/* SCopy p1 p2
+ *
+ * p1: register to copy from
+ * p2: register to copy to
+ *
+ * Shallow copy: p2 borrows p1's string or binary value, so it is only
+ * valid for as long as the value in p1 is
+ */
+int chidb_dbm_op_SCopy (chidb_stmt *stmt, chidb_dbm_op_t *op)
+{
+    if (!IS_VALID_REGISTER(stmt, op->p1) || !EXISTS_REGISTER(stmt, op->p2))
+        return CHIDB_PROBLEM;
+    if (op->p1 == op->p2)
+        return CHIDB_OK;
+
+    // release whatever p2 was holding before sharing p1's value
+    if (chidb_dbm_op_WriteReg(stmt, op->p2, REG_NULL, NULL) != CHIDB_OK)
+        return CHIDB_PROBLEM;
+
+    chidb_dbm_register_t *src = &stmt->reg[op->p1];
+    stmt->reg[op->p2].type = src->type;
+    stmt->reg[op->p2].value = src->value;
+    stmt->reg[op->p2].borrowed = (src->type == REG_STRING || src->type == REGISTER_BINARY);
+
+    return CHIDB_OK;
+}
+
+/* Order of two values for MIN and MAX: integers come before strings */
+static int agg_compare(chidb_dbm_register_t *a, chidb_dbm_register_t *b)
+{
+    if (IS_INT_REG(a->type) != IS_INT_REG(b->type))
+        return IS_INT_REG(a->type) ? -1 : 1;
+    if (IS_INT_REG(a->type))
+        return (a->value.i > b->value.i) - (a->value.i < b->value.i);
+
+    return strcmp(a->value.s, b->value.s);
+}
+
+/* AggStep p1 p2 p3 *
+ *
+ * p1: register containing a value
+ * p2: accumulator register
+ * p3: aggregate function (see chidb_dbm_agg_t)
+ *
+ * add the value in p1 to the aggregate in p2. NULL values are left out.
+ * The accumulator starts out as NULL, or as 0 for AGG_COUNT, and then:
+ * - AGG_COUNT: counts the values
+ * - AGG_SUM: adds integer values up
+ * - AGG_MIN, AGG_MAX: keeps the smallest or largest value (a copy of it,
+ *   if it is a string)
+ */
+int chidb_dbm_op_AggStep (chidb_stmt *stmt, chidb_dbm_op_t *op)
+{
+    if (!EXISTS_REGISTER(stmt, op->p1) || !EXISTS_REGISTER(stmt, op->p2))
+        return CHIDB_PROBLEM;
+
+    chidb_dbm_register_t *val = &stmt->reg[op->p1];
+    chidb_dbm_register_t *acc = &stmt->reg[op->p2];
+    bool empty = !IS_INT_REG(acc->type) && acc->type != REG_STRING;
+    int64_t n;
+
+    if (val->type == REG_NULL || val->type == REG_UNSPECIFIED)
+        return CHIDB_OK;
+
+    switch (op->p3)
+    {
+        case AGG_COUNT:
+            n = empty ? 1 : acc->value.i + 1;
+            return chidb_dbm_op_WriteInt(stmt, op->p2, n);
+
+        case AGG_SUM:
+            if (!IS_INT_REG(val->type) || (!empty && !IS_INT_REG(acc->type)))
+                return CHIDB_EMISMATCH;
+            n = empty ? val->value.i : acc->value.i + val->value.i;
+            return chidb_dbm_op_WriteInt(stmt, op->p2, n);
+
+        case AGG_MIN:
+        case AGG_MAX:
+            if (!IS_INT_REG(val->type) && val->type != REG_STRING)
+                return CHIDB_EMISMATCH;
+            if (!empty && (op->p3 == AGG_MIN ? agg_compare(val, acc) >= 0 : agg_compare(val, acc) <= 0))
+                return CHIDB_OK;
+            if (val->type == REG_STRING)
+                return chidb_dbm_op_WriteCopy(stmt, op->p2, REG_STRING, val->value.s, strlen(val->value.s) + 1);
+            return chidb_dbm_op_WriteInt(stmt, op->p2, val->value.i);
+
+        default:
+            return CHIDB_PROBLEM;
+    }
+}
+
+/* Divide p1 p2 p3 *
+ *
+ * p1: register containing the dividend
+ * p2: register containing the divisor
+ * p3: register
+ *
+ * store p1 / p2 (an integer division) in register p3. If either is NULL,
+ * or the divisor is 0, store NULL
+ */
+int chidb_dbm_op_Divide (chidb_stmt *stmt, chidb_dbm_op_t *op)
+{
+    if (!EXISTS_REGISTER(stmt, op->p1) || !EXISTS_REGISTER(stmt, op->p2) || !EXISTS_REGISTER(stmt, op->p3))
+        return CHIDB_PROBLEM;
+
+    chidb_dbm_register_t *a = &stmt->reg[op->p1], *b = &stmt->reg[op->p2];
+
+    if (a->type == REG_NULL || a->type == REG_UNSPECIFIED || b->type == REG_NULL || b->type == REG_UNSPECIFIED)
+        return chidb_dbm_op_WriteReg(stmt, op->p3, REG_NULL, NULL);
+    if (!IS_INT_REG(a->type) || !IS_INT_REG(b->type))
+        return CHIDB_EMISMATCH;
+    if (b->value.i == 0 || (a->value.i == INT64_MIN && b->value.i == -1))
+        return chidb_dbm_op_WriteReg(stmt, op->p3, REG_NULL, NULL);
+
+    return chidb_dbm_op_WriteInt(stmt, op->p3, a->value.i / b->value.i);
+}
+
+/* Count p1 p2 * *
+ *
+ * p1: cursor
+ * p2: register
+ *
+ * store the number of entries in the B-Tree of cursor p1 in register p2.
+ * They are counted from the headers of the leaves, without decoding any
+ * of them. The cursor is not moved
+ */
+int chidb_dbm_op_Count (chidb_stmt *stmt, chidb_dbm_op_t *op)
+{
+    chidb_dbm_cursor_t *c = &((stmt)->cursors[op->p1]);
+    uint64_t n;
+    int rc;
+
+    if (c->type != CURSOR_READ && c->type != CURSOR_WRITE)
+        return CHIDB_PROBLEM;
+
+    if ((rc = chidb_Btree_countEntries(c->bt, c->root_page, &n)) != CHIDB_OK)
+        return rc;
+
+    return chidb_dbm_op_WriteInt(stmt, op->p2, (int64_t) n);
+}
+
+/* Analyze * * * *
+ *
+ * Collect the stats of every table and index into the stats table
+ * (see stats.c). Statements prepared before then were planned without
+ * them, so they are dropped from the statement cache.
+ */
+int chidb_dbm_op_Analyze (chidb_stmt *stmt, chidb_dbm_op_t *op)
+{
+    chidb *db = stmt->db;
+    int rc;
+
+    if (db->need_refresh && (rc = load_schema(db, 1)) != CHIDB_OK)
+        return rc;
+
+    rc = chidb_stats_analyze(db);
+    db->need_refresh = 1;
+    chidb_result_cache_written_all(db);
+
+    return rc;
+}
+
+/* Vacuum * * * *
+ *
+ * Rebuild the file, with every B-Tree packed and in key order (see
+ * vacuum_database in api.c). The roots move, so statements prepared
+ * before then are dropped from the statement cache.
+ */
+int chidb_dbm_op_Vacuum (chidb_stmt *stmt, chidb_dbm_op_t *op)
+{
+    int rc = vacuum_database(stmt->db);
+
+    stmt->db->need_refresh = 1;
+    chidb_result_cache_written_all(stmt->db);
+
+    return rc;
+}
+
+/* SetPageSize p1 * * *
+ *
+ * p1: page size
+ *
+ * Change the page size of the file, which must be empty (see
+ * chidb_Btree_setPageSize).
+ */
+int chidb_dbm_op_SetPageSize (chidb_stmt *stmt, chidb_dbm_op_t *op)
+{
+    return chidb_Btree_setPageSize(stmt->db->bt, op->p1);
+}
+
+/* Throw away everything that was derived from the pages a rollback
+ * (of a transaction, or of a statement; see chidb_stmt_exec) restored:
+ * the last leaf appended to, the stats, the statements and results in
+ * the caches and, if tables or indexes were created since
+ * db->txn_schema_key was set, the schema. */
+int chidb_dbm_rolled_back(chidb *db)
+{
+    db->bt->append_leaf = 0;
+    chidb_stats_free(db);
+    chidb_result_cache_written_all(db);
+    db->need_refresh = 1;
+    if (db->schema_last_key != db->txn_schema_key)
+        return reload_schema(db);
+
+    return CHIDB_OK;
+}
+
+/* Transaction p1 * * *
+ *
+ * p1: one of chidb_dbm_txn_t
+ *
+ * Begin, commit or roll back a transaction (see chidb_Pager_begin).
+ * Rolling back also throws away everything that was derived from the
+ * pages that were restored (see chidb_dbm_rolled_back).
+ */
+int chidb_dbm_op_Transaction (chidb_stmt *stmt, chidb_dbm_op_t *op)
+{
+    chidb *db = stmt->db;
+    int rc;
+
+    switch (op->p1)
+    {
+    case TXN_BEGIN:
+        if ((rc = chidb_Pager_begin(db->bt->pager)) == CHIDB_OK)
+            db->txn_schema_key = db->schema_last_key;
+        return rc;
+
+    case TXN_COMMIT:
+        return chidb_Pager_commit(db->bt->pager);
+
+    case TXN_ROLLBACK:
+        if ((rc = chidb_Pager_rollback(db->bt->pager)) != CHIDB_OK)
+            return rc;
+
+        return chidb_dbm_rolled_back(db);
+
+    default:
+        return CHIDB_PROBLEM;
+    }
+}
+
+/* Attach p1 * * p4
+ *
+ * p1: register containing the name of a database file
+ * p4: name to attach it as
+ *
+ * Open another database file, whose tables can then be read as
+ * p4.table (see attach_database in api.c)
+ */
+int chidb_dbm_op_Attach (chidb_stmt *stmt, chidb_dbm_op_t *op)
+{
+    chidb_dbm_register_t *r = &stmt->reg[op->p1];
+
+    if (r->type != REG_STRING)
+        return CHIDB_EMISMATCH;
+
+    return attach_database(stmt->db, r->value.s, op->p4);
+}
+
+/* Detach * * * p4
+ *
+ * p4: name a database was attached as
+ *
+ * Close an attached database (see detach_database in api.c)
+ */
+int chidb_dbm_op_Detach (chidb_stmt *stmt, chidb_dbm_op_t *op)
+{
+    return detach_database(stmt->db, op->p4);
+}
+
+int chidb_dbm_op_Halt (chidb_stmt *stmt, chidb_dbm_op_t *op)
+{
+    return CHIDB_DONE;
+}
+
+int chidb_dbm_op_WriteReg (chidb_stmt *stmt, int regNo, int reg_type, void *data)
+{
+    chidb_dbm_register_t *reg = &(stmt->reg[regNo]);
+
+    // let go of the old value, unless it belongs to someone else
+    if (!reg->borrowed && reg->type == REG_STRING)
+        free(reg->value.s);
+    else if (!reg->borrowed && reg->type == REGISTER_BINARY)
+        free(reg->value.bin.bytes);
+
+    reg->type = reg_type;
+    reg->borrowed = false;
+
+    if (reg_type == REG_INT32)
+        reg->value.i = *((int32_t *) data);
+    else if (reg_type == REG_INT64)
+        reg->value.i = *((int64_t *) data);
+    else if (reg_type == REG_STRING)
+        reg->value.s = (char *) data;
+
+    return CHIDB_OK;
+}
+
+/* Writes an integer into a register
+ *
+ * The register is a REG_INT32 if the value fits in one, and a REG_INT64
+ * otherwise.
+ */
+int chidb_dbm_op_WriteInt (chidb_stmt *stmt, int regNo, int64_t v)
+{
+    int32_t i32 = (int32_t) v;
+
+    if (i32 == v)
+        return chidb_dbm_op_WriteReg(stmt, regNo, REG_INT32, &i32);
+
+    return chidb_dbm_op_WriteReg(stmt, regNo, REG_INT64, &v);
+}
+
+/* Writes a string into a register
+ *
+ * If borrowed is true, the register does not take ownership of the
+ * string (it is never freed by the register)
+ */
+int chidb_dbm_op_WriteString (chidb_stmt *stmt, int regNo, char *s, bool borrowed)
+{
+    if (s == NULL)
+        return CHIDB_ENOMEM;
+
+    if (chidb_dbm_op_WriteReg(stmt, regNo, REG_STRING, s) != CHIDB_OK)
+        return CHIDB_PROBLEM;
+
+    stmt->reg[regNo].borrowed = borrowed;
+
+    return CHIDB_OK;
+}
+
+/* Returns space for a value of n bytes that register regNo will own
+ *
+ * Small values go in the register's inline space. Larger ones go in
+ * the statement's arena, and the register keeps that space, so the
+ * values written to a register once per row all go in the same place.
+ * It only grows (to at least twice its size) if a value does not fit,
+ * so the arena does not grow with the number of rows. Anything the
+ * register was holding in its space before is overwritten.
+ *
+ * Return
+ * - Pointer to the space, or NULL if it could not be allocated
+ */
+uint8_t *chidb_dbm_reg_space (chidb_stmt *stmt, int regNo, uint32_t n)
+{
+    chidb_dbm_regspace_t *space = &stmt->space[regNo];
+
+    if (n <= REG_INLINE_SIZE)
+        return space->inline_bytes;
+
+    if (space->bytes == NULL || space->size < n)
+    {
+        uint32_t size = space->size * 2 > n ? space->size * 2 : n;
+        if (size < 16)
+            size = 16;
+        uint8_t *bytes = chidb_dbm_arena_alloc(&stmt->arena, size);
+
+        if (bytes == NULL)
+            return NULL;
+        space->bytes = bytes;
+        space->size = size;
+    }
+
+    return space->bytes;
+}
+
+/* Writes a copy of a string or binary value into a register
+ *
+ * The copy goes in the register's space (see chidb_dbm_reg_space), so
+ * it is valid until the register is written to again, or the statement
+ * is reset. For strings, n includes the terminating NUL.
+ */
+int chidb_dbm_op_WriteCopy (chidb_stmt *stmt, int regNo, int reg_type, const void *data, uint32_t n)
+{
+    uint8_t *bytes = chidb_dbm_reg_space(stmt, regNo, n);
+
+    if (bytes == NULL)
+        return CHIDB_ENOMEM;
+
+    // the value may already be in this space (e.g., it was SCopy'd from
+    // this register)
+    memmove(bytes, data, n);
+
+    if (chidb_dbm_op_WriteReg(stmt, regNo, reg_type, NULL) != CHIDB_OK)
+        return CHIDB_PROBLEM;
+
+    if (reg_type == REG_STRING)
+        stmt->reg[regNo].value.s = (char *) bytes;
+    else
+    {
+        stmt->reg[regNo].value.bin.bytes = bytes;
+        stmt->reg[regNo].value.bin.nbytes = n;
+    }
+    // the arena frees it, not the register
+    stmt->reg[regNo].borrowed = true;
 
     return CHIDB_OK;
 }
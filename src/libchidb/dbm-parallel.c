@@ -0,0 +1,424 @@
+/*
+ *  chidb - a didactic relational database management system
+ *
+ *  Parallel table scans for the Database Machine
+ *
+ */
+
+/*
+ *  Copyright (c) 2009-2015, The University of Chicago
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or withsend
+ *  modification, are permitted provided that the following conditions are met:
+ *
+ *  - Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ *  - Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ *  - Neither the name of The University of Chicago nor the names of its
+ *    contributors may be used to endorse or promote products derived from this
+ *    software withsend specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ *  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ *  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ *  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ *  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ *  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ *  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ *  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ *  ARISING IN ANY WAY send OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ *  POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+/*
+ * A SELECT that filters a whole table spends most of its time going
+ * through leaves and evaluating the WHERE clause on every entry. If the
+ * table is large enough for its root to be an internal node, the subtrees
+ * hanging from the root (one per cell, plus the right page) are scanned
+ * by several threads at once instead, each one running the statement's
+ * program on a copy of the statement whose cursor is opened on the
+ * subtree instead of the root. The rows each subtree returns are kept,
+ * and once every subtree has been scanned, they are returned subtree by
+ * subtree, which is the order the program would have returned them in.
+ *
+ * Only programs that scan a single table and return rows as they go can
+ * be split like this: no joins, sorting, grouping or LIMIT, and nothing
+ * that writes. Since every row is kept until the scan is done, it is only
+ * worth it if the WHERE clause filters out most of the table, so programs
+ * without a filter are run as usual too.
+ *
+ * The threads share the buffer pool of the database the table is in
+ * (which may be an attached one), which is made safe to share for the
+ * duration of the scan (see chidb_Pager_setThreadsafe).
+ *
+ * Statements are only split when they are run through chidb_step. When
+ * a program is split, its registers do not end up the way the program
+ * would have left them, and the DBM's own tests look at those.
+ */
+
+#include <unistd.h>
+#include "dbm-parallel.h"
+#include "dbm.h"
+#include "btree.h"
+#include "pager.h"
+
+/* Rows of a subtree are allocated this many at a time, at first */
+#define SCAN_TASK_ROWS (64)
+
+
+/* Can a program with this instruction be split between threads? */
+static bool scan_op(opcode_t opcode)
+{
+    switch (opcode)
+    {
+        case Op_Noop:
+        case Op_Integer:
+        case Op_String:
+        case Op_Null:
+        case Op_Param:
+        case Op_OpenRead:
+        case Op_Rewind:
+        case Op_Next:
+        case Op_Column:
+        case Op_FilterColumn:
+        case Op_Key:
+        case Op_Eq:
+        case Op_Ne:
+        case Op_Lt:
+        case Op_Le:
+        case Op_Gt:
+        case Op_Ge:
+        case Op_Copy:
+        case Op_SCopy:
+        case Op_ResultRow:
+        case Op_Close:
+        case Op_Halt:
+            return true;
+        default:
+            return false;
+    }
+}
+
+/* Finds the table a program scans, if it can be split between threads.
+ * Returns the page the table is opened on (which may still turn out to
+ * be an index), or 0 if it can't be split. bt is set to the B-Tree the
+ * table is in, which is that of an attached database if it is in one. */
+static npage_t scan_root(chidb_stmt *stmt, BTree **bt)
+{
+    chidb_dbm_op_t *open = NULL, *result = NULL;
+    bool filter = false;
+
+    for (uint32_t i = 0; i < stmt->endOp; i++)
+    {
+        chidb_dbm_op_t *op = &stmt->ops[i];
+
+        if (!scan_op(op->opcode))
+            return 0;
+
+        if (op->opcode == Op_OpenRead)
+        {
+            if (open != NULL)
+                return 0;
+            open = op;
+        }
+        else if (op->opcode == Op_ResultRow)
+        {
+            if (result != NULL)
+                return 0;
+            result = op;
+        }
+        else if (op->opcode >= Op_Eq && op->opcode <= Op_Ge)
+            filter = true;
+    }
+
+    if (open == NULL || result == NULL || !filter || (*bt = chidb_dbm_op_btree(stmt, open)) == NULL)
+        return 0;
+
+    for (uint32_t i = 0; i < stmt->endOp; i++)
+        if (stmt->ops[i].opcode == Op_Integer && stmt->ops[i].p2 == open->p2)
+            return stmt->ops[i].p1;
+
+    return 0;
+}
+
+/* Creates a copy of a statement for a worker. The copy uses the
+ * statement's instructions and parameters, but has its own registers
+ * and cursors. */
+static int worker_create(chidb_stmt *stmt, chidb_stmt **w)
+{
+    int rc;
+
+    if ((*w = malloc(sizeof(chidb_stmt))) == NULL)
+        return CHIDB_ENOMEM;
+
+    if ((rc = chidb_stmt_init(*w, stmt->db)) != CHIDB_OK ||
+        (stmt->nReg > (*w)->nReg && (rc = realloc_reg(*w, stmt->nReg)) != CHIDB_OK) ||
+        (stmt->nCursors > (*w)->nCursors && (rc = realloc_cur(*w, stmt->nCursors)) != CHIDB_OK))
+    {
+        chidb_stmt_free(*w);
+        *w = NULL;
+        return rc;
+    }
+
+    free((*w)->ops);
+    (*w)->ops = stmt->ops;
+    (*w)->nOps = stmt->endOp;
+    (*w)->endOp = stmt->endOp;
+    (*w)->params = stmt->params;
+    (*w)->nParams = stmt->nParams;
+    (*w)->verified = true;
+    (*w)->readonly = true;
+
+    return CHIDB_OK;
+}
+
+/* Releases the pages a worker's cursors are on, so it can scan again */
+static void worker_reset(chidb_stmt *w)
+{
+    for (uint32_t i = 0; i < w->nCursors; i++)
+    {
+        chidb_dbm_cursor_t *c = &w->cursors[i];
+
+        if (c->type != CURSOR_UNSPECIFIED)
+        {
+            chidb_dbm_cursor_destroy(c->bt, c);
+            c->type = CURSOR_UNSPECIFIED;
+        }
+    }
+
+    w->pc = 0;
+}
+
+static void worker_free(chidb_stmt *w)
+{
+    worker_reset(w);
+
+    /* These belong to the statement the worker is a copy of */
+    w->ops = NULL;
+    w->params = NULL;
+    w->nParams = 0;
+
+    chidb_stmt_free(w);
+}
+
+/* Runs a worker's program on one subtree, keeping the rows it returns */
+static int scan_subtree(chidb_stmt *w, chidb_dbm_scan_task_t *task)
+{
+    int rc;
+
+    w->scan_root = task->root;
+
+    while ((rc = chidb_dbm_run(w)) == CHIDB_ROW)
+    {
+        if (task->nrows == task->cap)
+        {
+            uint32_t cap = task->cap == 0 ? SCAN_TASK_ROWS : task->cap * 2;
+            chidb_dbm_sorter_row_t **rows = realloc(task->rows, cap * sizeof(chidb_dbm_sorter_row_t *));
+
+            if (rows == NULL)
+                return CHIDB_ENOMEM;
+            task->rows = rows;
+            task->cap = cap;
+        }
+
+        if ((task->rows[task->nrows] = chidb_dbm_sorter_row_create(&w->reg[w->startRR], w->nRR)) == NULL)
+            return CHIDB_ENOMEM;
+        task->nrows++;
+    }
+
+    return rc == CHIDB_DONE ? CHIDB_OK : rc;
+}
+
+/* Scans subtrees until there are none left (or a worker fails) */
+static void *scan_worker(void *arg)
+{
+    chidb_dbm_scan_t *scan = arg;
+    chidb_dbm_scan_task_t *task;
+    chidb_stmt *w;
+    int rc;
+
+    rc = worker_create(scan->stmt, &w);
+
+    while (rc == CHIDB_OK)
+    {
+        pthread_mutex_lock(&scan->mutex);
+        task = NULL;
+        if (scan->rc == CHIDB_OK && scan->next_task < scan->ntasks)
+            task = &scan->tasks[scan->next_task++];
+        pthread_mutex_unlock(&scan->mutex);
+
+        if (task == NULL)
+            break;
+
+        rc = scan_subtree(w, task);
+        worker_reset(w);
+    }
+
+    if (w != NULL)
+        worker_free(w);
+
+    if (rc != CHIDB_OK)
+    {
+        pthread_mutex_lock(&scan->mutex);
+        if (scan->rc == CHIDB_OK)
+            scan->rc = rc;
+        pthread_mutex_unlock(&scan->mutex);
+    }
+
+    return NULL;
+}
+
+/* Split a statement's table between threads, and scan it
+ *
+ * Does nothing if the statement can't be run as a parallel scan (see
+ * the top of this file), or if it is not worth it: the table fits in
+ * a single node, or the database only scans with one thread (see
+ * chidb_set_scan_threads). Otherwise, stmt->scan is set, and every row
+ * of the result is ready when this returns.
+ *
+ * Parameters
+ * - stmt: DBM about to run a step (nothing is done once it has started)
+ *
+ * Return
+ * - CHIDB_OK: Operation successful (or the statement is run as usual)
+ * - CHIDB_ENOMEM: Could not allocate memory
+ * - Any error returned while running the program on a subtree
+ */
+int chidb_dbm_scan_start(chidb_stmt *stmt)
+{
+    Pager *pager;
+    BTree *bt;
+    chidb_dbm_scan_t *scan;
+    BTreeNode *root;
+    BTreeCell cell;
+    pthread_t *threads;
+    uint32_t nthreads = stmt->db->scan_threads, started = 0;
+    npage_t nroot;
+    bool shared;
+    int rc;
+
+    if (stmt->pc != 0 || stmt->scan != NULL || stmt->replaying || stmt->explain || stmt->profile != NULL || !stmt->readonly || nthreads < 2)
+        return CHIDB_OK;
+
+    if ((nroot = scan_root(stmt, &bt)) == 0)
+        return CHIDB_OK;
+    pager = bt->pager;
+
+    if ((rc = chidb_Btree_getNodeByPage(bt, nroot, &root)) != CHIDB_OK)
+        return rc;
+
+    if (root->type != PGTYPE_TABLE_INTERNAL)
+        return chidb_Btree_freeMemNode(bt, root);
+
+    if ((scan = calloc(1, sizeof(chidb_dbm_scan_t))) == NULL ||
+        (scan->tasks = calloc(root->n_cells + 1, sizeof(chidb_dbm_scan_task_t))) == NULL)
+    {
+        free(scan);
+        chidb_Btree_freeMemNode(bt, root);
+        return CHIDB_ENOMEM;
+    }
+
+    for (ncell_t i = 0; i < root->n_cells; i++)
+    {
+        chidb_Btree_getCell(root, i, &cell);
+        scan->tasks[i].root = cell.fields.tableInternal.child_page;
+    }
+    scan->tasks[root->n_cells].root = root->right_page;
+    scan->ntasks = root->n_cells + 1;
+    chidb_Btree_freeMemNode(bt, root);
+
+    scan->stmt = stmt;
+    scan->rc = CHIDB_OK;
+    pthread_mutex_init(&scan->mutex, NULL);
+
+    /* The rows are returned from the scan from now on, not by the program */
+    stmt->scan = scan;
+    stmt->pc = stmt->endOp;
+    for (uint32_t i = 0; i < stmt->endOp; i++)
+    {
+        if (stmt->ops[i].opcode == Op_ResultRow)
+        {
+            stmt->startRR = stmt->ops[i].p1;
+            stmt->nRR = stmt->ops[i].p2;
+        }
+    }
+
+    if (nthreads > scan->ntasks)
+        nthreads = scan->ntasks;
+
+    /* If fewer threads can be started, the ones that are do the work */
+    if ((threads = malloc((nthreads - 1) * sizeof(pthread_t))) == NULL)
+        nthreads = 1;
+
+    shared = pager->threadsafe;
+    chidb_Pager_setThreadsafe(pager, true);
+
+    for (uint32_t i = 0; i + 1 < nthreads; i++)
+        if (pthread_create(&threads[started], NULL, scan_worker, scan) == 0)
+            started++;
+
+    /* This thread is one of the workers */
+    scan_worker(scan);
+
+    for (uint32_t i = 0; i < started; i++)
+        pthread_join(threads[i], NULL);
+    free(threads);
+
+    chidb_Pager_setThreadsafe(pager, shared);
+
+    return scan->rc;
+}
+
+/* Return the next row of a parallel scan
+ *
+ * The row's fields are put in the result row registers of the program.
+ * They belong to the scan.
+ *
+ * Parameters
+ * - stmt: DBM with a parallel scan (see chidb_dbm_scan_start)
+ *
+ * Return
+ * - CHIDB_ROW: There is a row
+ * - CHIDB_DONE: Every row has been returned
+ */
+int chidb_dbm_scan_next(chidb_stmt *stmt)
+{
+    chidb_dbm_scan_t *scan = stmt->scan;
+    chidb_dbm_sorter_row_t *row;
+
+    while (scan->task < scan->ntasks && scan->row == scan->tasks[scan->task].nrows)
+    {
+        scan->task++;
+        scan->row = 0;
+    }
+
+    if (scan->task == scan->ntasks)
+        return CHIDB_DONE;
+
+    row = scan->tasks[scan->task].rows[scan->row++];
+    for (uint32_t i = 0; i < row->nfields; i++)
+        stmt->reg[stmt->startRR + i] = row->fields[i];
+
+    return CHIDB_ROW;
+}
+
+void chidb_dbm_scan_free(chidb_dbm_scan_t *scan)
+{
+    for (uint32_t i = 0; i < scan->ntasks; i++)
+    {
+        for (uint32_t j = 0; j < scan->tasks[i].nrows; j++)
+            free(scan->tasks[i].rows[j]);
+        free(scan->tasks[i].rows);
+    }
+
+    pthread_mutex_destroy(&scan->mutex);
+    free(scan->tasks);
+    free(scan);
+}
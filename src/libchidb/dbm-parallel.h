@@ -0,0 +1,75 @@
+/*
+ *  chidb - a didactic relational database management system
+ *
+ *  Parallel table scans for the Database Machine -- header
+ *
+ */
+
+/*
+ *  Copyright (c) 2009-2015, The University of Chicago
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or withsend
+ *  modification, are permitted provided that the following conditions are met:
+ *
+ *  - Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ *  - Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ *  - Neither the name of The University of Chicago nor the names of its
+ *    contributors may be used to endorse or promote products derived from this
+ *    software withsend specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ *  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ *  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ *  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ *  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ *  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ *  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ *  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ *  ARISING IN ANY WAY send OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ *  POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+#ifndef DBM_PARALLEL_H_
+#define DBM_PARALLEL_H_
+
+#include <pthread.h>
+#include "chidbInt.h"
+#include "dbm-types.h"
+#include "dbm-sorter.h"
+
+/* The scan of one subtree of the table. Its rows are in key order. */
+typedef struct chidb_dbm_scan_task
+{
+    npage_t root;                   // root of the subtree
+    chidb_dbm_sorter_row_t **rows;  // result rows (see chidb_dbm_sorter_row_create)
+    uint32_t nrows;
+    uint32_t cap;
+} chidb_dbm_scan_task_t;
+
+struct chidb_dbm_scan
+{
+    chidb_stmt *stmt;               // statement being run
+    chidb_dbm_scan_task_t *tasks;   // one per subtree, from left to right
+    uint32_t ntasks;
+
+    pthread_mutex_t mutex;          // protects next_task and rc
+    uint32_t next_task;             // next task a worker will take
+    int rc;                         // first error a worker ran into
+
+    uint32_t task;                  // row the statement is on
+    uint32_t row;
+};
+
+int chidb_dbm_scan_start(chidb_stmt *stmt);
+int chidb_dbm_scan_next(chidb_stmt *stmt);
+void chidb_dbm_scan_free(chidb_dbm_scan_t *scan);
+
+#endif /* DBM_PARALLEL_H_ */
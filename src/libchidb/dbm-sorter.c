@@ -0,0 +1,764 @@
+/*
+ *  chidb - a didactic relational database management system
+ *
+ *  External sorter for the Database Machine
+ *
+ */
+
+/*
+ *  Copyright (c) 2009-2015, The University of Chicago
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or withsend
+ *  modification, are permitted provided that the following conditions are met:
+ *
+ *  - Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ *  - Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ *  - Neither the name of The University of Chicago nor the names of its
+ *    contributors may be used to endorse or promote products derived from this
+ *    software withsend specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ *  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ *  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ *  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ *  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ *  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ *  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ *  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ *  ARISING IN ANY WAY send OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ *  POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+/*
+ * A sorter takes rows of register values in any order, and gives them back
+ * sorted by one of their fields. The DBM uses it for ORDER BY: the rows of
+ * the result are inserted into a sorter instead of being returned, and are
+ * returned from the sorter once they have all been inserted.
+ *
+ * Rows are kept in memory until they take up more than the sorter's
+ * budget. They are then sorted, and written to a temporary file as a
+ * "run", and the memory is reused for the next rows. Once all the rows are
+ * in, the runs (and the rows still in memory) are merged: the smallest row
+ * at the front of any of them is the next one. The merge reads one row of
+ * each run at a time, so it only needs memory for that. To not have to
+ * keep too many files open, every SORTER_MAX_RUNS runs are merged into a
+ * single, longer run as they are written.
+ *
+ * The sort is stable: rows with equal keys come out in the order they were
+ * inserted. NULLs come before integers, and integers before strings.
+ *
+ * A sorter can also be told that only its first rows will be read (for
+ * ORDER BY with a LIMIT). It then keeps only that many rows, in a heap with
+ * the last of them on top: a row that comes after it is dropped without
+ * being copied, and any other row replaces it. Its memory is bounded by the
+ * limit, whatever the number of rows inserted, and it never spills.
+ */
+
+#include "dbm-sorter.h"
+#include "memory.h"
+
+#define SORTER_MAX_RUNS (16)
+#define SORTER_INITIAL_ROWS (256)
+
+
+static int compare_fields(chidb_dbm_register_t *a, chidb_dbm_register_t *b)
+{
+    int ra = IS_INT_REG(a->type) ? 1 : a->type == REG_STRING ? 2 : a->type == REGISTER_BINARY ? 3 : 0;
+    int rb = IS_INT_REG(b->type) ? 1 : b->type == REG_STRING ? 2 : b->type == REGISTER_BINARY ? 3 : 0;
+
+    if (ra != rb)
+        return ra - rb;
+
+    switch (ra)
+    {
+        case 1:
+            return (a->value.i > b->value.i) - (a->value.i < b->value.i);
+        case 2:
+            return strcmp(a->value.s, b->value.s);
+        case 3:
+        {
+            uint32_t n = a->value.bin.nbytes < b->value.bin.nbytes ? a->value.bin.nbytes : b->value.bin.nbytes;
+            int c = memcmp(a->value.bin.bytes, b->value.bin.bytes, n);
+            return c != 0 ? c : (a->value.bin.nbytes > b->value.bin.nbytes) - (a->value.bin.nbytes < b->value.bin.nbytes);
+        }
+        default:
+            return 0;
+    }
+}
+
+/* Compare the keys of two rows, given as their fields */
+static int compare_keys(chidb_dbm_sorter_t *s, chidb_dbm_register_t *a, uint32_t na,
+                        chidb_dbm_register_t *b, uint32_t nb)
+{
+    chidb_dbm_register_t null = {.type = REG_NULL};
+    int c = compare_fields(s->key < na ? &a[s->key] : &null, s->key < nb ? &b[s->key] : &null);
+
+    return s->desc ? -c : c;
+}
+
+static int compare_rows(chidb_dbm_sorter_t *s, chidb_dbm_sorter_row_t *a, chidb_dbm_sorter_row_t *b)
+{
+    return compare_keys(s, a->fields, a->nfields, b->fields, b->nfields);
+}
+
+/* Merge sort, which (unlike qsort) is stable, and needs no globals to
+ * know what to sort by. tmp must have room for n rows. */
+static void sort_rows(chidb_dbm_sorter_t *s, chidb_dbm_sorter_row_t **rows,
+                      chidb_dbm_sorter_row_t **tmp, uint32_t n)
+{
+    if (n < 2)
+        return;
+
+    uint32_t half = n / 2, i = 0, j = half, k = 0;
+
+    sort_rows(s, rows, tmp, half);
+    sort_rows(s, rows + half, tmp, n - half);
+
+    if (compare_rows(s, rows[half - 1], rows[half]) <= 0)
+        return; // already in order (e.g. the rows came from an index)
+
+    while (i < half && j < n)
+        tmp[k++] = compare_rows(s, rows[j], rows[i]) < 0 ? rows[j++] : rows[i++];
+    while (i < half)
+        tmp[k++] = rows[i++];
+    memcpy(rows, tmp, k * sizeof(chidb_dbm_sorter_row_t *));
+}
+
+static int sort_memory(chidb_dbm_sorter_t *s)
+{
+    chidb_dbm_sorter_row_t **tmp;
+
+    if (s->nrows < 2)
+        return CHIDB_OK;
+    if ((tmp = malloc(s->nrows * sizeof(chidb_dbm_sorter_row_t *))) == NULL)
+        return CHIDB_ENOMEM;
+
+    sort_rows(s, s->rows, tmp, s->nrows);
+    free(tmp);
+
+    return CHIDB_OK;
+}
+
+/* Does row i of a sorter with a limit come after row j? Ties go to the
+ * row inserted last, which keeps the sort stable. */
+static bool limit_after(chidb_dbm_sorter_t *s, uint32_t i, uint32_t j)
+{
+    int c = compare_rows(s, s->rows[i], s->rows[j]);
+
+    return c > 0 || (c == 0 && s->seqs[i] > s->seqs[j]);
+}
+
+static void limit_swap(chidb_dbm_sorter_t *s, uint32_t i, uint32_t j)
+{
+    chidb_dbm_sorter_row_t *row = s->rows[i];
+    uint64_t seq = s->seqs[i];
+
+    s->rows[i] = s->rows[j];
+    s->seqs[i] = s->seqs[j];
+    s->rows[j] = row;
+    s->seqs[j] = seq;
+}
+
+/* The rows of a sorter with a limit are a heap of its first n rows, with
+ * the one that comes last on top */
+static void limit_sift_down(chidb_dbm_sorter_t *s, uint32_t i, uint32_t n)
+{
+    for (;;)
+    {
+        uint32_t l = 2 * i + 1, r = l + 1, max = i;
+
+        if (l < n && limit_after(s, l, max))
+            max = l;
+        if (r < n && limit_after(s, r, max))
+            max = r;
+        if (max == i)
+            return;
+
+        limit_swap(s, i, max);
+        i = max;
+    }
+}
+
+static void limit_sift_up(chidb_dbm_sorter_t *s, uint32_t i)
+{
+    while (i > 0 && limit_after(s, i, (i - 1) / 2))
+    {
+        limit_swap(s, i, (i - 1) / 2);
+        i = (i - 1) / 2;
+    }
+}
+
+/* Sort the heap of a sorter with a limit in place (a heapsort: the row on
+ * top is the last one of those left) */
+static void limit_sort(chidb_dbm_sorter_t *s)
+{
+    for (uint32_t n = s->nrows; n > 1; n--)
+    {
+        limit_swap(s, 0, n - 1);
+        limit_sift_down(s, 0, n - 1);
+    }
+}
+
+/* Insert a row into a sorter with a limit */
+static int limit_insert(chidb_dbm_sorter_t *s, chidb_dbm_register_t *fields, uint32_t nfields)
+{
+    chidb_dbm_sorter_row_t *row;
+    size_t size;
+    int rc;
+
+    // A row that does not come before the last row kept would not be kept
+    if (s->nrows == s->limit
+            && compare_keys(s, fields, nfields, s->rows[0]->fields, s->rows[0]->nfields) >= 0)
+    {
+        s->seq++;
+        return CHIDB_OK;
+    }
+
+    if ((row = chidb_dbm_sorter_row_create(fields, nfields)) == NULL)
+        return CHIDB_ENOMEM;
+    size = row->size + sizeof(chidb_dbm_sorter_row_t *);
+    if ((rc = chidb_memory_charge(s->db, CHIDB_MEMORY_SORTERS, size)) != CHIDB_OK)
+    {
+        free(row);
+        return rc;
+    }
+    s->mem += size;
+
+    if (s->nrows == s->limit)
+    {
+        size = s->rows[0]->size + sizeof(chidb_dbm_sorter_row_t *);
+        chidb_memory_release(s->db, CHIDB_MEMORY_SORTERS, size);
+        s->mem -= size;
+        free(s->rows[0]);
+
+        s->rows[0] = row;
+        s->seqs[0] = s->seq++;
+        limit_sift_down(s, 0, s->nrows);
+    }
+    else
+    {
+        s->rows[s->nrows] = row;
+        s->seqs[s->nrows] = s->seq++;
+        limit_sift_up(s, s->nrows++);
+    }
+
+    return CHIDB_OK;
+}
+
+/* Copy a row of registers into a single allocation, which can be
+ * freed with free(). The fields of the copy are borrowed. */
+chidb_dbm_sorter_row_t *chidb_dbm_sorter_row_create(chidb_dbm_register_t *fields, uint32_t nfields)
+{
+    uint32_t size = sizeof(chidb_dbm_sorter_row_t) + nfields * sizeof(chidb_dbm_register_t);
+
+    for (uint32_t i = 0; i < nfields; i++)
+    {
+        if (fields[i].type == REG_STRING)
+            size += strlen(fields[i].value.s) + 1;
+        else if (fields[i].type == REGISTER_BINARY)
+            size += fields[i].value.bin.nbytes;
+    }
+
+    chidb_dbm_sorter_row_t *row = malloc(size);
+    if (row == NULL)
+        return NULL;
+
+    uint8_t *data = (uint8_t *) &row->fields[nfields];
+
+    row->size = size;
+    row->nfields = nfields;
+    for (uint32_t i = 0; i < nfields; i++)
+    {
+        row->fields[i] = fields[i];
+        row->fields[i].borrowed = true;
+
+        if (fields[i].type == REG_STRING)
+        {
+            size_t len = strlen(fields[i].value.s) + 1;
+            row->fields[i].value.s = memcpy(data, fields[i].value.s, len);
+            data += len;
+        }
+        else if (fields[i].type == REGISTER_BINARY)
+        {
+            row->fields[i].value.bin.bytes = memcpy(data, fields[i].value.bin.bytes, fields[i].value.bin.nbytes);
+            data += fields[i].value.bin.nbytes;
+        }
+    }
+
+    return row;
+}
+
+/* A row is written to a run as its size, its number of fields, and then
+ * the type and value of each field, with strings and binary values
+ * prefixed by their length */
+static int row_write(FILE *f, chidb_dbm_sorter_row_t *row)
+{
+    if (fwrite(&row->size, sizeof(uint32_t), 1, f) != 1 || fwrite(&row->nfields, sizeof(uint32_t), 1, f) != 1)
+        return CHIDB_EIO;
+
+    for (uint32_t i = 0; i < row->nfields; i++)
+    {
+        chidb_dbm_register_t *field = &row->fields[i];
+        uint8_t type = field->type;
+        uint32_t len;
+        bool ok = fwrite(&type, 1, 1, f) == 1;
+
+        if (IS_INT_REG(field->type))
+            ok = ok && fwrite(&field->value.i, sizeof(int64_t), 1, f) == 1;
+        else if (field->type == REG_STRING)
+        {
+            len = strlen(field->value.s) + 1;
+            ok = ok && fwrite(&len, sizeof(uint32_t), 1, f) == 1 && fwrite(field->value.s, 1, len, f) == len;
+        }
+        else if (field->type == REGISTER_BINARY)
+        {
+            len = field->value.bin.nbytes;
+            ok = ok && fwrite(&len, sizeof(uint32_t), 1, f) == 1 && fwrite(field->value.bin.bytes, 1, len, f) == len;
+        }
+
+        if (!ok)
+            return CHIDB_EIO;
+    }
+
+    return CHIDB_OK;
+}
+
+/* Read the next row of a run into *row (NULL at the end of the run) */
+static int row_read(FILE *f, chidb_dbm_sorter_row_t **row)
+{
+    uint32_t size, nfields;
+
+    *row = NULL;
+    if (fread(&size, sizeof(uint32_t), 1, f) != 1)
+        return feof(f) ? CHIDB_OK : CHIDB_EIO;
+    if (fread(&nfields, sizeof(uint32_t), 1, f) != 1)
+        return CHIDB_EIO;
+
+    chidb_dbm_sorter_row_t *r = malloc(size);
+    if (r == NULL)
+        return CHIDB_ENOMEM;
+
+    uint8_t *data = (uint8_t *) &r->fields[nfields];
+
+    r->size = size;
+    r->nfields = nfields;
+    for (uint32_t i = 0; i < nfields; i++)
+    {
+        chidb_dbm_register_t *field = &r->fields[i];
+        uint8_t type;
+        uint32_t len = 0;
+        bool ok = fread(&type, 1, 1, f) == 1;
+
+        field->type = type;
+        field->borrowed = true;
+        if (ok && IS_INT_REG(type))
+            ok = fread(&field->value.i, sizeof(int64_t), 1, f) == 1;
+        else if (ok && (type == REG_STRING || type == REGISTER_BINARY))
+        {
+            ok = fread(&len, sizeof(uint32_t), 1, f) == 1
+                 && data + len <= (uint8_t *) r + size && fread(data, 1, len, f) == len;
+            if (type == REG_STRING)
+                field->value.s = (char *) data;
+            else
+            {
+                field->value.bin.bytes = data;
+                field->value.bin.nbytes = len;
+            }
+            data += len;
+        }
+
+        if (!ok)
+        {
+            free(r);
+            return CHIDB_EIO;
+        }
+    }
+
+    *row = r;
+    return CHIDB_OK;
+}
+
+/* Move a source on to its next row */
+static int source_advance(chidb_dbm_sorter_t *s, chidb_dbm_sorter_source_t *src)
+{
+    if (src->run == NULL)
+    {
+        src->row = s->next < s->nrows ? s->rows[s->next++] : NULL;
+        return CHIDB_OK;
+    }
+
+    free(src->row);
+    return row_read(src->run, &src->row);
+}
+
+/* Is the row of source a smaller than that of source b? Ties go to the
+ * source with the older rows, which keeps the sort stable. */
+static bool source_less(chidb_dbm_sorter_t *s, uint32_t a, uint32_t b)
+{
+    int c = compare_rows(s, s->sources[a].row, s->sources[b].row);
+
+    return c < 0 || (c == 0 && a < b);
+}
+
+static void heap_sift_down(chidb_dbm_sorter_t *s, uint32_t i)
+{
+    for (;;)
+    {
+        uint32_t l = 2 * i + 1, r = l + 1, min = i;
+
+        if (l < s->nheap && source_less(s, s->heap[l], s->heap[min]))
+            min = l;
+        if (r < s->nheap && source_less(s, s->heap[r], s->heap[min]))
+            min = r;
+        if (min == i)
+            return;
+
+        uint32_t tmp = s->heap[i];
+        s->heap[i] = s->heap[min];
+        s->heap[min] = tmp;
+        i = min;
+    }
+}
+
+/* Start merging the first nruns runs, and the rows in memory if memory is
+ * true. The smallest row is left in s->current (NULL if there are none). */
+static int merge_start(chidb_dbm_sorter_t *s, uint32_t nruns, bool memory)
+{
+    uint32_t nsources = nruns + (memory ? 1 : 0);
+    int rc;
+
+    s->sources = calloc(nsources ? nsources : 1, sizeof(chidb_dbm_sorter_source_t));
+    s->heap = malloc((nsources ? nsources : 1) * sizeof(uint32_t));
+    if (s->sources == NULL || s->heap == NULL)
+        return CHIDB_ENOMEM;
+
+    s->nheap = 0;
+    s->next = 0;
+    for (uint32_t i = 0; i < nsources; i++)
+    {
+        chidb_dbm_sorter_source_t *src = &s->sources[i];
+
+        src->run = i < nruns ? s->runs[i] : NULL;
+        if (src->run != NULL)
+            rewind(src->run);
+        if ((rc = source_advance(s, src)) != CHIDB_OK)
+            return rc;
+        if (src->row != NULL)
+            s->heap[s->nheap++] = i;
+    }
+
+    for (uint32_t i = s->nheap; i-- > 0; )
+        heap_sift_down(s, i);
+
+    s->current = s->nheap ? s->sources[s->heap[0]].row : NULL;
+
+    return CHIDB_OK;
+}
+
+/* Move the merge on to the next row */
+static int merge_next(chidb_dbm_sorter_t *s)
+{
+    int rc;
+
+    if (s->nheap == 0)
+        return CHIDB_OK;
+
+    chidb_dbm_sorter_source_t *src = &s->sources[s->heap[0]];
+    if ((rc = source_advance(s, src)) != CHIDB_OK)
+        return rc;
+    if (src->row == NULL)
+        s->heap[0] = s->heap[--s->nheap];
+    heap_sift_down(s, 0);
+
+    s->current = s->nheap ? s->sources[s->heap[0]].row : NULL;
+
+    return CHIDB_OK;
+}
+
+static void merge_end(chidb_dbm_sorter_t *s, uint32_t nruns)
+{
+    if (s->sources != NULL)
+        for (uint32_t i = 0; i < nruns; i++)
+            free(s->sources[i].row);
+
+    free(s->sources);
+    free(s->heap);
+    s->sources = NULL;
+    s->heap = NULL;
+    s->nheap = 0;
+    s->current = NULL;
+}
+
+/* Merge all the runs into a single one */
+static int merge_runs(chidb_dbm_sorter_t *s)
+{
+    FILE *f = tmpfile();
+    int rc;
+
+    if (f == NULL)
+        return CHIDB_EIO;
+
+    rc = merge_start(s, s->nruns, false);
+    while (rc == CHIDB_OK && s->current != NULL)
+        if ((rc = row_write(f, s->current)) == CHIDB_OK)
+            rc = merge_next(s);
+    merge_end(s, s->nruns);
+
+    if (rc != CHIDB_OK)
+    {
+        fclose(f);
+        return rc;
+    }
+
+    for (uint32_t i = 0; i < s->nruns; i++)
+        fclose(s->runs[i]);
+    s->runs[0] = f;
+    s->nruns = 1;
+
+    return CHIDB_OK;
+}
+
+/* Write the rows in memory, sorted, to a new run, and free them */
+static int spill(chidb_dbm_sorter_t *s)
+{
+    FILE *f;
+    int rc = CHIDB_OK;
+
+    if (s->nruns == SORTER_MAX_RUNS && (rc = merge_runs(s)) != CHIDB_OK)
+        return rc;
+    if ((rc = sort_memory(s)) != CHIDB_OK)
+        return rc;
+    if ((f = tmpfile()) == NULL)
+        return CHIDB_EIO;
+
+    for (uint32_t i = 0; i < s->nrows && rc == CHIDB_OK; i++)
+        rc = row_write(f, s->rows[i]);
+    if (rc == CHIDB_OK && fflush(f) != 0)
+        rc = CHIDB_EIO;
+    if (rc != CHIDB_OK)
+    {
+        fclose(f);
+        return rc;
+    }
+
+    s->runs[s->nruns++] = f;
+    for (uint32_t i = 0; i < s->nrows; i++)
+        free(s->rows[i]);
+    s->nrows = 0;
+    chidb_memory_release(s->db, CHIDB_MEMORY_SORTERS, s->mem);
+    s->mem = 0;
+
+    return CHIDB_OK;
+}
+
+
+/* Create an empty sorter
+ *
+ * Parameters
+ * - s: Out parameter for the new sorter
+ * - key: Field the rows are sorted by. Rows without it sort as NULL.
+ * - desc: Sort in descending order?
+ * - budget: Bytes of rows to keep in memory before spilling them to disk
+ * - db: Database the memory of the rows is charged to (see
+ *       chidb_memory_charge), or NULL
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_ENOMEM: Could not allocate memory
+ */
+int chidb_dbm_sorter_create(chidb_dbm_sorter_t **s, uint32_t key, bool desc, size_t budget, chidb *db)
+{
+    if ((*s = calloc(1, sizeof(chidb_dbm_sorter_t))) == NULL)
+        return CHIDB_ENOMEM;
+
+    (*s)->key = key;
+    (*s)->desc = desc;
+    (*s)->budget = budget;
+    (*s)->db = db;
+    (*s)->cap = SORTER_INITIAL_ROWS;
+
+    (*s)->rows = malloc(SORTER_INITIAL_ROWS * sizeof(chidb_dbm_sorter_row_t *));
+    (*s)->runs = malloc(SORTER_MAX_RUNS * sizeof(FILE *));
+    if ((*s)->rows == NULL || (*s)->runs == NULL)
+    {
+        chidb_dbm_sorter_free(*s);
+        return CHIDB_ENOMEM;
+    }
+
+    return CHIDB_OK;
+}
+
+/* Free a sorter, its rows, and its runs (which are deleted) */
+void chidb_dbm_sorter_free(chidb_dbm_sorter_t *s)
+{
+    merge_end(s, s->nruns);
+
+    chidb_memory_release(s->db, CHIDB_MEMORY_SORTERS, s->mem);
+    for (uint32_t i = 0; i < s->nrows; i++)
+        free(s->rows[i]);
+    for (uint32_t i = 0; i < s->nruns; i++)
+        fclose(s->runs[i]);
+
+    free(s->rows);
+    free(s->seqs);
+    free(s->runs);
+    free(s);
+}
+
+/* Keep only the first rows of a sorter
+ *
+ * Once it has limit rows, a row is only inserted if it comes before the
+ * last of them, which it replaces. The rows are never spilled, so the
+ * budget of the sorter does not apply (their memory is still charged to
+ * its database).
+ *
+ * Parameters
+ * - s: Sorter. Must not have any rows yet.
+ * - limit: Number of rows to keep. Must be positive.
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_ENOMEM: Could not allocate memory
+ * - CHIDB_EMISUSE: The sorter already has rows, or the limit is 0
+ */
+int chidb_dbm_sorter_limit(chidb_dbm_sorter_t *s, uint32_t limit)
+{
+    chidb_dbm_sorter_row_t **rows;
+
+    if (limit == 0 || s->seq > 0 || s->sources != NULL)
+        return CHIDB_EMISUSE;
+
+    if ((rows = realloc(s->rows, limit * sizeof(chidb_dbm_sorter_row_t *))) == NULL)
+        return CHIDB_ENOMEM;
+    s->rows = rows;
+    s->cap = limit;
+
+    free(s->seqs);
+    if ((s->seqs = malloc(limit * sizeof(uint64_t))) == NULL)
+        return CHIDB_ENOMEM;
+    s->limit = limit;
+
+    return CHIDB_OK;
+}
+
+/* Insert a row into a sorter
+ *
+ * The values of the fields are copied, so the registers can be reused
+ * once this returns. If the rows in memory go over the budget, or the
+ * database has no memory left for the row (see chidb_memory_charge),
+ * they are spilled to a run first (unless the sorter has a limit, see
+ * chidb_dbm_sorter_limit).
+ *
+ * Parameters
+ * - s: Sorter. Must not have been sorted yet.
+ * - fields: Values of the fields of the row
+ * - nfields: Number of fields
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_ENOMEM: Could not allocate memory, or the database has none
+ *                 left for the row alone
+ * - CHIDB_EIO: Could not write a run
+ * - CHIDB_EMISUSE: The sorter has already been sorted
+ */
+int chidb_dbm_sorter_insert(chidb_dbm_sorter_t *s, chidb_dbm_register_t *fields, uint32_t nfields)
+{
+    chidb_dbm_sorter_row_t *row;
+    size_t size;
+    bool charged;
+    int rc;
+
+    if (s->sources != NULL)
+        return CHIDB_EMISUSE;
+    if (s->limit > 0)
+        return limit_insert(s, fields, nfields);
+    if ((row = chidb_dbm_sorter_row_create(fields, nfields)) == NULL)
+        return CHIDB_ENOMEM;
+
+    size = row->size + sizeof(chidb_dbm_sorter_row_t *);
+    charged = s->mem + row->size <= s->budget
+              && chidb_memory_charge(s->db, CHIDB_MEMORY_SORTERS, size) == CHIDB_OK;
+    if (!charged && s->nrows > 0 && (rc = spill(s)) != CHIDB_OK)
+    {
+        free(row);
+        return rc;
+    }
+    if (!charged && (rc = chidb_memory_charge(s->db, CHIDB_MEMORY_SORTERS, size)) != CHIDB_OK)
+    {
+        free(row);
+        return rc;
+    }
+
+    if (s->nrows == s->cap)
+    {
+        chidb_dbm_sorter_row_t **rows = realloc(s->rows, 2 * s->cap * sizeof(chidb_dbm_sorter_row_t *));
+        if (rows == NULL)
+        {
+            chidb_memory_release(s->db, CHIDB_MEMORY_SORTERS, size);
+            free(row);
+            return CHIDB_ENOMEM;
+        }
+        s->rows = rows;
+        s->cap *= 2;
+    }
+
+    s->rows[s->nrows++] = row;
+    s->mem += size;
+    s->seq++;
+
+    return CHIDB_OK;
+}
+
+/* Sort the rows, and move to the first one (left in s->current)
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_DONE: There are no rows
+ * - CHIDB_ENOMEM: Could not allocate memory
+ * - CHIDB_EIO: Could not read a run
+ * - CHIDB_EMISUSE: The sorter has already been sorted
+ */
+int chidb_dbm_sorter_sort(chidb_dbm_sorter_t *s)
+{
+    int rc = CHIDB_OK;
+
+    if (s->sources != NULL)
+        return CHIDB_EMISUSE;
+
+    if (s->limit > 0)
+        limit_sort(s);
+    else
+        rc = sort_memory(s);
+    if (rc == CHIDB_OK)
+        rc = merge_start(s, s->nruns, true);
+    if (rc != CHIDB_OK)
+        return rc;
+
+    return s->current != NULL ? CHIDB_OK : CHIDB_DONE;
+}
+
+/* Move to the next row (left in s->current)
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_DONE: There are no more rows
+ * - CHIDB_ENOMEM: Could not allocate memory
+ * - CHIDB_EIO: Could not read a run
+ */
+int chidb_dbm_sorter_next(chidb_dbm_sorter_t *s)
+{
+    int rc;
+
+    if ((rc = merge_next(s)) != CHIDB_OK)
+        return rc;
+
+    return s->current != NULL ? CHIDB_OK : CHIDB_DONE;
+}
@@ -45,10 +45,13 @@
 #include <chisql/chisql.h>
 #include "chidbInt.h"
 #include "dbm-cursor.h"
+#include "dbm-arena.h"
 
 #define DEFAULT_OPS_SIZE (50)
 #define DEFAULT_REG_SIZE (10)
 #define DEFAULT_CUR_SIZE (10)
+#define ARENA_CHUNK_SIZE (4 * 1024)
+#define REG_INLINE_SIZE (24)
 
 /* We define a "for each" macro to generate the various portions
  * of code that relate to opcodes. This is based on the solution
@@ -63,35 +66,70 @@
         OP(Rewind)      \
         OP(Next)        \
         OP(Prev)        \
+        OP(Skip)        \
         OP(Seek)        \
         OP(SeekGt)      \
         OP(SeekGe)      \
         OP(SeekLt)      \
         OP(SeekLe)      \
+        OP(DeferredSeek) \
         OP(Column)      \
         OP(Key)         \
         OP(Integer)     \
         OP(String)      \
         OP(Null)        \
+        OP(Param)       \
         OP(ResultRow)   \
         OP(MakeRecord)  \
         OP(Insert)      \
+        OP(Delete)      \
+        OP(Update)      \
         OP(Eq)          \
         OP(Ne)          \
         OP(Lt)          \
         OP(Le)          \
         OP(Gt)          \
         OP(Ge)          \
+        OP(IfPos)       \
+        OP(DecrJumpZero) \
         OP(IdxGt)       \
         OP(IdxGe)       \
         OP(IdxLt)       \
         OP(IdxLe)       \
         OP(IdxPKey)     \
         OP(IdxInsert)   \
+        OP(IdxDelete)   \
+        OP(OpenHash)    \
+        OP(HashInsert)  \
+        OP(HashSeek)    \
+        OP(HashFilter)  \
+        OP(HashNext)    \
+        OP(HashColumn)  \
+        OP(HashGroup)   \
+        OP(HashUpdate)  \
+        OP(HashRewind)  \
+        OP(HashNextRow) \
+        OP(SorterOpen)  \
+        OP(SorterLimit) \
+        OP(SorterInsert) \
+        OP(SorterSort)  \
+        OP(SorterNext)  \
+        OP(SorterColumn) \
         OP(CreateTable) \
         OP(CreateIndex) \
         OP(Copy)        \
         OP(SCopy)       \
+        OP(AggStep)     \
+        OP(Divide)      \
+        OP(Count)       \
+        OP(Analyze)     \
+        OP(Vacuum)      \
+        OP(SetPageSize) \
+        OP(Transaction) \
+        OP(Attach)      \
+        OP(Detach)      \
+        OP(FilterColumn) \
+        OP(IdxLoad)     \
         OP(Halt)
 
 /* The following generates an enum type for the opcode. It expands to:
@@ -147,6 +185,23 @@ static inline int str_to_opcode(const char *s)
     return -1;
 }
 
+/* Aggregate functions, as given to AggStep */
+typedef enum chidb_dbm_agg
+{
+    AGG_COUNT = 0,
+    AGG_SUM   = 1,
+    AGG_MIN   = 2,
+    AGG_MAX   = 3
+} chidb_dbm_agg_t;
+
+/* Transaction statements, as given to Transaction */
+typedef enum chidb_dbm_txn
+{
+    TXN_BEGIN    = 0,
+    TXN_COMMIT   = 1,
+    TXN_ROLLBACK = 2
+} chidb_dbm_txn_t;
+
 /* A single DBM instruction */
 typedef struct chidb_dbm_op
 {
@@ -160,16 +215,22 @@ typedef struct chidb_dbm_op
 
 /* A register can be of type integer, string, null or binary.
  * Additionally we define a REG_UNSPECIFIED type, which is
- * the type of any new register than hasn't been assigned a value. */
+ * the type of any new register than hasn't been assigned a value.
+ * Integers that fit in 32 bits are REG_INT32, and larger ones are
+ * REG_INT64 (see chidb_dbm_op_WriteInt). Both hold their value in
+ * value.i, so the same code can usually handle both (see IS_INT_REG). */
 typedef enum register_type
 {
     REG_UNSPECIFIED    = 0,
     REG_NULL           = 1,
     REG_INT32          = 2,
     REG_STRING         = 3,
-    REGISTER_BINARY         = 4
+    REGISTER_BINARY         = 4,
+    REG_INT64          = 5
 } register_type_t;
 
+#define IS_INT_REG(t) ((t) == REG_INT32 || (t) == REG_INT64)
+
 static inline const char* regtype_to_str(register_type_t regtype)
 {
     switch(regtype)
@@ -179,6 +240,7 @@ static inline const char* regtype_to_str(register_type_t regtype)
     case REG_NULL:
         return "null";
     case REG_INT32:
+    case REG_INT64:
         return "integer";
     case REG_STRING:
         return "string";
@@ -194,9 +256,15 @@ typedef struct chidb_dbm_register
 {
     register_type_t type;
 
+    /* A borrowed string or binary value belongs to someone else (an
+     * instruction, or the entry a cursor is pointing to), so it is never
+     * freed by the register. Column values are only valid until their
+     * cursor moves; use Copy if a value must outlive it. */
+    bool borrowed;
+
     union
     {
-        int32_t i;
+        int64_t i;
         char* s;
         struct
         {
@@ -207,6 +275,58 @@ typedef struct chidb_dbm_register
 
 } chidb_dbm_register_t;
 
+/* Space in a statement's arena that a register's own copies of string
+ * and binary values are written to. It is reused by every value that
+ * fits in it, so a register written once per row does not allocate
+ * once per row. Values of up to REG_INLINE_SIZE bytes (strings of up
+ * to 23 characters) are written inline instead, and never use the
+ * arena at all. */
+typedef struct chidb_dbm_regspace
+{
+    uint8_t *bytes;
+    uint32_t size;
+    uint8_t inline_bytes[REG_INLINE_SIZE];
+} chidb_dbm_regspace_t;
+
+/* What one instruction of an EXPLAIN ANALYZE statement did while the
+ * program ran: how many times it ran, the time spent in it, and the
+ * pages it read from the Pager */
+typedef struct chidb_dbm_profile
+{
+    uint64_t count;
+    uint64_t ns;
+    uint64_t pages;
+} chidb_dbm_profile_t;
+
+/* A program being generated (see chidb_dbm_prog_init). Jumps to a label
+ * have -1-label as their address until the program is finished. */
+typedef struct chidb_dbm_prog
+{
+    chidb_dbm_op_t *ops;
+    uint32_t nops;
+    uint32_t size;
+
+    /* Address of each label, or -1 while it has not been placed */
+    int32_t *labels;
+    uint32_t nlabels;
+    uint32_t label_size;
+
+    /* Ran out of memory along the way */
+    bool failed;
+} chidb_dbm_prog_t;
+
+/* An instruction of a program compiled to threaded code (see
+ * chidb_dbm_run): the address of the code that runs it, and the value a
+ * comparison compares with, if that is a constant */
+typedef struct chidb_dbm_code
+{
+    void *label;
+    int64_t imm;
+} chidb_dbm_code_t;
+
+/* See dbm-parallel.h */
+typedef struct chidb_dbm_scan chidb_dbm_scan_t;
+
 /*  This is the struct that represents a single DBM program.
  *
  *  Notice how a single DBM program has its own registers and cursors;
@@ -239,6 +359,14 @@ struct chidb_stmt
     chidb_dbm_register_t *reg;
     uint32_t nReg;
 
+    /* Memory the values copied into registers, and records made by
+     * MakeRecord, are allocated from. It is reset all at once when the
+     * statement is reset, and freed when it is finalized. space[i] is
+     * the space register i writes its copies to (see reg_space in
+     * dbm-ops.c); it has nReg entries too. */
+    chidb_dbm_arena_t arena;
+    chidb_dbm_regspace_t *space;
+
     /* Cursors */
     /* Cursors are stored in a dynamically allocated array of chidb_dbm_cursor_t's */
     chidb_dbm_cursor_t *cursors;
@@ -259,6 +387,71 @@ struct chidb_stmt
      * per operation */
     bool explain;
 
+    /* Is this an "EXPLAIN ANALYZE" statement? If so, profile has one
+     * entry per instruction, which the program fills in when it is run
+     * on the first step (see chidb_step). NULL otherwise. */
+    chidb_dbm_profile_t *profile;
+    bool analyzed;
+
+    /* Has the program been checked by chidb_stmt_verify? Instruction
+     * handlers rely on it to not have to check their operands */
+    bool verified;
+
+    /* The program compiled to threaded code, once it has been started
+     * often enough to be worth it (runs counts the starts). NULL until
+     * then, and whenever the program changes. */
+    chidb_dbm_code_t *code;
+    uint32_t runs;
+
+    /* Does the program only read from the database? Set by
+     * chidb_stmt_verify. On a shared handle, programs that only read
+     * can run at the same time (see chidb_set_threadsafe) */
+    bool readonly;
+
+    /* Is the program undone if it fails partway (see chidb_stmt_exec)?
+     * Set by chidb_stmt_verify, for programs that write, unless they
+     * begin or end transactions, or change the whole file themselves.
+     * savepoint is set while a run has a statement savepoint open. */
+    bool atomic;
+    bool savepoint;
+
+    /* Values bound to the ? parameters of the statement (parameter i
+     * is params[i-1]). Unbound parameters are REG_NULL. */
+    chidb_dbm_register_t *params;
+    uint32_t nParams;
+
+    /* Cached program this statement runs, if it was prepared from the
+     * statement cache. The instructions and column names belong to it. */
+    chidb_stmt_cache_entry_t *program;
+
+    /* Rows of a parallel scan, once it has run (see dbm-parallel.c).
+     * NULL if the statement is not run as one. */
+    chidb_dbm_scan_t *scan;
+
+    /* If not 0, the table is opened on this page instead of its root.
+     * Each worker of a parallel scan reads one subtree of the table. */
+    npage_t scan_root;
+
+    /* Result the statement is keeping the rows of, as it runs, or (if
+     * replaying is true) returning the rows of instead of running (see
+     * result-cache.c). result_row is the next row it returns. */
+    chidb_result_t *result;
+    bool replaying;
+    uint32_t result_row;
+
+    /* Kind of statement its latencies are counted as (see latency.c),
+     * and whether it has been stepped since it was prepared or reset */
+    int kind;
+    bool started;
+
+    /* Is the statement being stepped by chidb_step_async? If so, it is
+     * suspended instead of waiting for a page (see chidb_dbm_run_async) */
+    bool nowait;
+
+    /* Commit made by the last step, if the log has yet to be synced for
+     * it (see chidb_stmt_sync). 0 if there is none. */
+    uint64_t commit_seq;
+
     /* Additional fields go here */
 };
 
@@ -40,11 +40,15 @@
 #include <assert.h>
 #include <stdbool.h>
 #include "dbm.h"
+#include "stmt-cache.h"
+#include "result-cache.h"
+#include "dbm-parallel.h"
 
 /* Forward declaration of auxiliary functions. */
 int realloc_ops(chidb_stmt *stmt, uint32_t size);
 int realloc_reg(chidb_stmt *stmt, uint32_t size);
 int realloc_cur(chidb_stmt *stmt, uint32_t size);
+int realloc_params(chidb_stmt *stmt, uint32_t size);
 
 
 
@@ -74,6 +78,18 @@ int chidb_stmt_init(chidb_stmt *stmt, chidb *db)
     stmt->db = db;
     stmt->sql = NULL;
     stmt->explain = false;
+    stmt->profile = NULL;
+    stmt->analyzed = false;
+    stmt->verified = false;
+    stmt->readonly = false;
+    stmt->atomic = false;
+    stmt->savepoint = false;
+    stmt->code = NULL;
+    stmt->runs = 0;
+    stmt->kind = CHIDB_LATENCY_OTHER;
+    stmt->started = false;
+    stmt->nowait = false;
+    stmt->commit_seq = 0;
 
     /* The program starts running in instruction 0 */
     stmt->pc = 0;
@@ -90,9 +106,12 @@ int chidb_stmt_init(chidb_stmt *stmt, chidb *db)
     if(rc != CHIDB_OK)
         return rc;
 
-    /* Same as above, but with registers. */
+    /* Same as above, but with registers. Values the registers make their
+     * own copies of come from the statement's arena. */
     stmt->reg = NULL;
+    stmt->space = NULL;
     stmt->nReg = 0;
+    chidb_dbm_arena_init(&stmt->arena, ARENA_CHUNK_SIZE);
     rc = realloc_reg(stmt, DEFAULT_REG_SIZE);
     if(rc != CHIDB_OK)
         return rc;
@@ -104,6 +123,23 @@ int chidb_stmt_init(chidb_stmt *stmt, chidb *db)
     if(rc != CHIDB_OK)
         return rc;
 
+    /* Parameters are only allocated if the statement has any */
+    stmt->params = NULL;
+    stmt->nParams = 0;
+
+    /* The statement has its own instructions, unless it is prepared
+     * from the statement cache */
+    stmt->program = NULL;
+
+    /* It reads whole tables (see dbm-parallel.c) */
+    stmt->scan = NULL;
+    stmt->scan_root = 0;
+
+    /* Its rows are not being kept or returned from the result cache */
+    stmt->result = NULL;
+    stmt->replaying = false;
+    stmt->result_row = 0;
+
     /* Initially, there is no Result Row */
     stmt->startRR = 0;
     stmt->nRR = 0;
@@ -125,9 +161,22 @@ int chidb_stmt_init(chidb_stmt *stmt, chidb *db)
  */
 int chidb_stmt_free(chidb_stmt *stmt)
 {
-	free(stmt->ops);
+    /* Release the pages held by cursors that were left open */
+    chidb_stmt_reset(stmt);
+
+    if (stmt->program)
+        chidb_stmt_cache_release(stmt->program);
+    else
+        free(stmt->ops);
     free_reg(stmt);
+    free(stmt->reg);
+    free(stmt->space);
+    free(stmt->profile);
+    free(stmt->code);
+    chidb_dbm_arena_free(&stmt->arena);
 	free(stmt->cursors);
+    chidb_stmt_clear_params(stmt);
+    free(stmt->params);
     free(stmt);
     return CHIDB_OK;
 }
@@ -151,11 +200,14 @@ int chidb_stmt_free(chidb_stmt *stmt)
  */
 int chidb_stmt_set_op(chidb_stmt *stmt, chidb_dbm_op_t *op, uint32_t pos)
 {
+    /* Cached programs are shared, and can't be changed */
+    assert(stmt->program == NULL);
+
 	/* Is the array of instructions large enough for instruction "pos"?
 	 * If not, reallocate the instruction array */
     if (pos >= stmt->nOps)
     {
-        int rc = realloc_ops(stmt, pos + 1);
+        int rc = realloc_ops(stmt, pos + 1 > 2 * stmt->nOps ? pos + 1 : 2 * stmt->nOps);
         if (rc != CHIDB_OK)
             return rc;
     }
@@ -168,12 +220,685 @@ int chidb_stmt_set_op(chidb_stmt *stmt, chidb_dbm_op_t *op, uint32_t pos)
     if(pos >= stmt->endOp)
         stmt->endOp = pos + 1;
 
+    stmt->verified = false;
+    free(stmt->code);
+    stmt->code = NULL;
+
+    return CHIDB_OK;
+}
+
+
+/* Start generating a program
+ *
+ * Code generation emits instructions straight into the program's array
+ * with chidb_dbm_prog_emit, instead of allocating each of them. A jump
+ * forward, to an instruction that has not been emitted yet, jumps to a
+ * label (chidb_dbm_prog_label), which is placed once that instruction
+ * is emitted; chidb_dbm_prog_finish then fixes up all the jumps to
+ * labels in one pass, and hands the array over to the DBM.
+ *
+ * Parameters
+ * - prog: program to initialize
+ */
+void chidb_dbm_prog_init(chidb_dbm_prog_t *prog)
+{
+    prog->ops = NULL;
+    prog->nops = 0;
+    prog->size = 0;
+    prog->labels = NULL;
+    prog->nlabels = 0;
+    prog->label_size = 0;
+    prog->failed = false;
+}
+
+/* Add an instruction to a program
+ *
+ * Parameters
+ * - prog: program
+ * - opcode, p1, p2, p3: the instruction. p2 can be a label
+ * - p4: string operand, or NULL. The program gets a copy of it.
+ *
+ * Return
+ * - The address of the instruction
+ */
+uint32_t chidb_dbm_prog_emit(chidb_dbm_prog_t *prog, opcode_t opcode, int32_t p1, int32_t p2, int32_t p3,
+                             const char *p4)
+{
+    chidb_dbm_op_t *op;
+
+    if (prog->nops == prog->size)
+    {
+        uint32_t size = prog->size == 0 ? DEFAULT_OPS_SIZE : prog->size * 2;
+        chidb_dbm_op_t *ops = realloc(prog->ops, sizeof(chidb_dbm_op_t) * size);
+
+        if (ops == NULL)
+        {
+            prog->failed = true;
+            return prog->nops;
+        }
+        prog->ops = ops;
+        prog->size = size;
+    }
+
+    op = &prog->ops[prog->nops];
+    op->opcode = opcode;
+    op->p1 = p1;
+    op->p2 = p2;
+    op->p3 = p3;
+    op->p4 = NULL;
+    if (p4 != NULL && (op->p4 = strdup(p4)) == NULL)
+        prog->failed = true;
+
+    return prog->nops++;
+}
+
+/* Address of the next instruction to be added to a program */
+uint32_t chidb_dbm_prog_here(chidb_dbm_prog_t *prog)
+{
+    return prog->nops;
+}
+
+/* Make a new label, to jump to before it is placed
+ *
+ * Return
+ * - The address to give jumps to the label
+ */
+int32_t chidb_dbm_prog_label(chidb_dbm_prog_t *prog)
+{
+    if (prog->nlabels == prog->label_size)
+    {
+        uint32_t size = prog->label_size == 0 ? 8 : prog->label_size * 2;
+        int32_t *labels = realloc(prog->labels, sizeof(int32_t) * size);
+
+        if (labels == NULL)
+        {
+            prog->failed = true;
+            return -1;
+        }
+        prog->labels = labels;
+        prog->label_size = size;
+    }
+
+    prog->labels[prog->nlabels] = -1;
+    return -1 - (int32_t) prog->nlabels++;
+}
+
+/* Place a label at the next instruction to be added to a program */
+void chidb_dbm_prog_place(chidb_dbm_prog_t *prog, int32_t label)
+{
+    if (label < 0 && -1 - label < (int32_t) prog->nlabels)
+        prog->labels[-1 - label] = prog->nops;
+}
+
+/* Free a program that is not going to be finished */
+void chidb_dbm_prog_free(chidb_dbm_prog_t *prog)
+{
+    for (uint32_t i = 0; i < prog->nops; i++)
+        free(prog->ops[i].p4);
+    free(prog->ops);
+    free(prog->labels);
+    chidb_dbm_prog_init(prog);
+}
+
+/* Finish a program, and make it the program of a DBM
+ *
+ * Jumps to labels get the address the label was placed at. The DBM
+ * takes the array of instructions as it is; its registers and cursors
+ * are sized for the program when it is verified (see chidb_stmt_verify).
+ * The program is freed either way.
+ *
+ * Parameters
+ * - prog: program
+ * - stmt: DBM, with no instructions yet
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_ENOMEM: Could not allocate memory along the way
+ * - CHIDB_PROBLEM: A jump is to a label that was never placed
+ */
+int chidb_dbm_prog_finish(chidb_dbm_prog_t *prog, chidb_stmt *stmt)
+{
+    /* Cached programs are shared, and can't be changed */
+    assert(stmt->program == NULL);
+
+    if (prog->failed)
+    {
+        chidb_dbm_prog_free(prog);
+        return CHIDB_ENOMEM;
+    }
+
+    for (uint32_t i = 0; i < prog->nops; i++)
+    {
+        chidb_dbm_op_t *op = &prog->ops[i];
+        int32_t label = -1 - op->p2;
+
+        if (!chidb_stmt_op_jumps(op->opcode) || op->p2 >= 0)
+            continue;
+        if (label >= (int32_t) prog->nlabels || prog->labels[label] < 0)
+        {
+            chidb_dbm_prog_free(prog);
+            return CHIDB_PROBLEM;
+        }
+        op->p2 = prog->labels[label];
+    }
+
+    free(stmt->ops);
+    free(stmt->code);
+    stmt->ops = prog->ops;
+    stmt->nOps = prog->size;
+    stmt->endOp = prog->nops;
+    stmt->code = NULL;
+    stmt->verified = false;
+
+    free(prog->labels);
+    prog->ops = NULL;
+    chidb_dbm_prog_init(prog);
+
+    return CHIDB_OK;
+}
+
+
+/* What each operand of an instruction refers to. The verifier uses this
+ * to check all the operands of a program before it runs. */
+typedef enum operand_kind
+{
+    OPND_NONE,      /* Unused, or an immediate value */
+    OPND_REG,       /* A register */
+    OPND_NREGS,     /* Number of registers, starting at the one in the operand before */
+    OPND_CURSOR,    /* A cursor */
+    OPND_ADDR       /* Address of an instruction to jump to */
+} operand_kind_t;
+
+#define IS_OPEN_OP(o) ((o) == Op_OpenRead || (o) == Op_OpenWrite || (o) == Op_OpenHash || (o) == Op_SorterOpen)
+#define IS_WRITE_OP(o) ((o) == Op_OpenWrite || (o) == Op_CreateTable || (o) == Op_CreateIndex || \
+                        (o) == Op_Analyze || (o) == Op_Vacuum || \
+                        (o) == Op_SetPageSize || (o) == Op_Transaction || \
+                        (o) == Op_Attach || (o) == Op_Detach)
+
+/* Instructions that manage transactions, or the file as a whole, on
+ * their own: a program with one is not run in a statement savepoint */
+#define IS_FILE_OP(o) ((o) == Op_Vacuum || (o) == Op_SetPageSize || (o) == Op_Transaction || \
+                       (o) == Op_Attach || (o) == Op_Detach)
+
+#define R OPND_REG
+#define N OPND_NREGS
+#define C OPND_CURSOR
+#define A OPND_ADDR
+#define _ OPND_NONE
+static const operand_kind_t op_operands[][3] =
+{
+    [Op_Noop]        = {_, _, _},
+    [Op_OpenRead]    = {C, R, _},
+    [Op_OpenWrite]   = {C, R, _},
+    [Op_Close]       = {C, _, _},
+    [Op_Rewind]      = {C, A, _},
+    [Op_Next]        = {C, A, _},
+    [Op_Prev]        = {C, A, _},
+    [Op_Skip]        = {C, A, R},
+    [Op_Seek]        = {C, A, R},
+    [Op_SeekGt]      = {C, A, R},
+    [Op_SeekGe]      = {C, A, R},
+    [Op_SeekLt]      = {C, A, R},
+    [Op_SeekLe]      = {C, A, R},
+    [Op_DeferredSeek] = {C, _, R},
+    [Op_Column]      = {C, _, R},
+    [Op_Key]         = {C, R, _},
+    [Op_Integer]     = {_, R, _},
+    [Op_String]      = {_, R, _},
+    [Op_Null]        = {_, R, _},
+    [Op_Param]       = {_, R, _},
+    [Op_ResultRow]   = {R, N, _},
+    [Op_MakeRecord]  = {R, N, R},
+    [Op_Insert]      = {C, R, R},
+    [Op_Delete]      = {C, _, _},
+    [Op_Update]      = {C, R, _},
+    [Op_Eq]          = {R, A, R},
+    [Op_Ne]          = {R, A, R},
+    [Op_Lt]          = {R, A, R},
+    [Op_Le]          = {R, A, R},
+    [Op_Gt]          = {R, A, R},
+    [Op_Ge]          = {R, A, R},
+    [Op_IfPos]       = {R, A, _},
+    [Op_DecrJumpZero] = {R, A, _},
+    [Op_IdxGt]       = {C, A, R},
+    [Op_IdxGe]       = {C, A, R},
+    [Op_IdxLt]       = {C, A, R},
+    [Op_IdxLe]       = {C, A, R},
+    [Op_IdxPKey]     = {C, R, _},
+    [Op_IdxInsert]   = {C, R, R},
+    [Op_IdxDelete]   = {C, R, R},
+    [Op_OpenHash]    = {C, _, _},
+    [Op_HashInsert]  = {C, R, N},
+    [Op_HashSeek]    = {C, A, R},
+    [Op_HashFilter]  = {C, A, R},
+    [Op_HashNext]    = {C, A, R},
+    [Op_HashColumn]  = {C, _, R},
+    [Op_HashGroup]   = {C, R, N},
+    [Op_HashUpdate]  = {C, R, N},
+    [Op_HashRewind]  = {C, A, _},
+    [Op_HashNextRow] = {C, A, _},
+    [Op_SorterOpen]  = {C, _, _},
+    [Op_SorterLimit] = {C, _, _},
+    [Op_SorterInsert] = {C, R, N},
+    [Op_SorterSort]  = {C, A, _},
+    [Op_SorterNext]  = {C, A, _},
+    [Op_SorterColumn] = {C, _, R},
+    [Op_CreateTable] = {R, _, _},
+    [Op_CreateIndex] = {R, _, _},
+    [Op_Copy]        = {R, R, _},
+    [Op_SCopy]       = {R, R, _},
+    [Op_AggStep]     = {R, R, _},
+    [Op_Divide]      = {R, R, R},
+    [Op_Count]       = {C, R, _},
+    [Op_Analyze]     = {_, _, _},
+    [Op_Vacuum]      = {_, _, _},
+    [Op_SetPageSize] = {_, _, _},
+    [Op_Transaction] = {_, _, _},
+    [Op_Attach]      = {R, _, _},
+    [Op_Detach]      = {_, _, _},
+    [Op_FilterColumn] = {C, _, R},
+    [Op_IdxLoad]     = {C, C, _},
+    [Op_Halt]        = {_, _, _},
+};
+#undef R
+#undef N
+#undef C
+#undef A
+#undef _
+
+/* Verify a DBM program
+ *
+ * Checks every instruction once, so that the instruction handlers do not
+ * have to check their operands every time they run:
+ *
+ *  - Opcodes are valid, and String instructions have a string.
+ *  - Jump addresses are inside the program (jumping to endOp
+ *    just ends the program).
+ *  - Register and cursor numbers are not negative, and parameter
+ *    numbers are positive. The register, cursor and parameter arrays
+ *    are grown to fit the largest ones used.
+ *  - Every cursor that is used is opened by some instruction.
+ *  - FilterColumn instructions are followed by the comparison they
+ *    stand for (see chidb_stmt_op_filters).
+ *
+ * It also notes whether the program writes to the database.
+ *
+ * Parameters
+ * - stmt: DBM to verify
+ *
+ * Return
+ * - CHIDB_OK: The program can be run
+ * - CHIDB_PROBLEM: The program has an invalid instruction
+ * - CHIDB_ENOMEM: Could not allocate memory
+ */
+int chidb_stmt_verify(chidb_stmt *stmt)
+{
+    int32_t max_reg = -1, max_cur = -1, max_param = 0;
+    bool readonly = true, file = false;
+    int rc;
+
+    for (uint32_t i = 0; i < stmt->endOp; i++)
+    {
+        chidb_dbm_op_t *op = &stmt->ops[i];
+        int32_t p[3] = {op->p1, op->p2, op->p3};
+
+        if (IS_WRITE_OP(op->opcode))
+            readonly = false;
+        if (IS_FILE_OP(op->opcode))
+            file = true;
+
+        if (op->opcode < 0 || op->opcode > Op_Halt)
+            return CHIDB_PROBLEM;
+        if ((op->opcode == Op_String || op->opcode == Op_Attach || op->opcode == Op_Detach) && op->p4 == NULL)
+            return CHIDB_PROBLEM;
+        if (op->opcode == Op_Param)
+        {
+            if (op->p1 < 1)
+                return CHIDB_PROBLEM;
+            max_param = op->p1 > max_param ? op->p1 : max_param;
+        }
+        if (op->opcode == Op_FilterColumn && !chidb_stmt_op_filters(stmt, i))
+            return CHIDB_PROBLEM;
+
+        for (int j = 0; j < 3; j++)
+        {
+            switch (op_operands[op->opcode][j])
+            {
+                case OPND_REG:
+                    if (p[j] < 0)
+                        return CHIDB_PROBLEM;
+                    max_reg = p[j] > max_reg ? p[j] : max_reg;
+                    break;
+                case OPND_NREGS:
+                    if (p[j] < 0)
+                        return CHIDB_PROBLEM;
+                    max_reg = p[j-1] + p[j] - 1 > max_reg ? p[j-1] + p[j] - 1 : max_reg;
+                    break;
+                case OPND_CURSOR:
+                    if (p[j] < 0)
+                        return CHIDB_PROBLEM;
+                    max_cur = p[j] > max_cur ? p[j] : max_cur;
+                    break;
+                case OPND_ADDR:
+                    if (p[j] < 0 || p[j] > stmt->endOp)
+                        return CHIDB_PROBLEM;
+                    break;
+                case OPND_NONE:
+                    break;
+            }
+        }
+    }
+
+    if (max_reg >= (int32_t) stmt->nReg && (rc = realloc_reg(stmt, max_reg + 1)) != CHIDB_OK)
+        return rc;
+    if (max_cur >= (int32_t) stmt->nCursors && (rc = realloc_cur(stmt, max_cur + 1)) != CHIDB_OK)
+        return rc;
+    if (max_param > (int32_t) stmt->nParams && (rc = realloc_params(stmt, max_param)) != CHIDB_OK)
+        return rc;
+
+    /* A cursor that is never opened would be used uninitialized */
+    for (uint32_t i = 0; i < stmt->endOp; i++)
+    {
+        chidb_dbm_op_t *op = &stmt->ops[i];
+        bool opened = false;
+
+        if (op_operands[op->opcode][0] != OPND_CURSOR || IS_OPEN_OP(op->opcode))
+            continue;
+
+        for (uint32_t j = 0; j < stmt->endOp && !opened; j++)
+            opened = IS_OPEN_OP(stmt->ops[j].opcode) && stmt->ops[j].p1 == op->p1;
+
+        if (!opened)
+            return CHIDB_PROBLEM;
+    }
+
+    stmt->verified = true;
+    stmt->readonly = readonly;
+    stmt->atomic = !readonly && !file;
+
+    return CHIDB_OK;
+}
+
+/* Does an instruction jump?
+ *
+ * Code generation uses this to fix up the jump addresses of a program
+ * when instructions are inserted into it.
+ *
+ * Return
+ * - true if p2 of the instruction is the address of an instruction
+ */
+bool chidb_stmt_op_jumps(opcode_t opcode)
+{
+    return opcode >= 0 && opcode <= Op_Halt && op_operands[opcode][1] == OPND_ADDR;
+}
+
+/* The cursor an instruction works on
+ *
+ * EXPLAIN ANALYZE uses this to add up the pages read through each
+ * cursor.
+ *
+ * Return
+ * - The cursor, or -1 if the instruction does not use one
+ */
+int chidb_stmt_op_cursor(chidb_dbm_op_t *op)
+{
+    if(op->opcode < 0 || op->opcode > Op_Halt || op_operands[op->opcode][0] != OPND_CURSOR)
+        return -1;
+
+    return op->p1;
+}
+
+/* Can the instruction at pos be a FilterColumn?
+ *
+ * It has to load a column into the register that the next instruction
+ * compares, and that comparison has to skip to the Next of the same
+ * cursor, so that an entry that fails it has no other effect. The Next
+ * has to loop back to the Column, so that an entry skipped along the way
+ * misses no other test (like those of a WHERE with AND). Code
+ * generation turns every Column like this into a FilterColumn, and
+ * chidb_stmt_verify checks that every FilterColumn is like this.
+ */
+bool chidb_stmt_op_filters(chidb_stmt *stmt, uint32_t pos)
+{
+    chidb_dbm_op_t *op = &stmt->ops[pos];
+    chidb_dbm_op_t *cmp;
+
+    if (op->opcode != Op_Column && op->opcode != Op_FilterColumn)
+        return false;
+    if (pos + 1 >= stmt->endOp)
+        return false;
+
+    cmp = &stmt->ops[pos + 1];
+    if (cmp->opcode < Op_Eq || cmp->opcode > Op_Ge || cmp->p3 != op->p3)
+        return false;
+    if (cmp->p2 < 0 || cmp->p2 >= stmt->endOp)
+        return false;
+
+    return stmt->ops[cmp->p2].opcode == Op_Next && stmt->ops[cmp->p2].p1 == op->p1
+        && stmt->ops[cmp->p2].p2 == (int32_t) pos;
+}
+
+/* The last register an instruction uses
+ *
+ * Code generation uses this to find registers that a program does not
+ * use yet.
+ *
+ * Return
+ * - The highest register among the operands, or -1 if there are none
+ */
+int chidb_stmt_op_last_reg(chidb_dbm_op_t *op)
+{
+    int32_t p[3] = {op->p1, op->p2, op->p3};
+    int last = -1;
+
+    if(op->opcode < 0 || op->opcode > Op_Halt)
+        return -1;
+
+    for(int i = 0; i < 3; i++)
+    {
+        if(op_operands[op->opcode][i] == OPND_REG && p[i] > last)
+            last = p[i];
+        else if(op_operands[op->opcode][i] == OPND_NREGS && i > 0 && p[i-1] + p[i] - 1 > last)
+            last = p[i-1] + p[i] - 1;
+    }
+
+    return last;
+}
+
+/* Does an instruction use a register?
+ *
+ * Code generation uses this to tell which instructions of a program can
+ * be moved or merged. When asked about writes, an instruction is taken
+ * to change every register it uses, unless it is known to only read
+ * them (or some of them).
+ *
+ * Parameters
+ * - op: instruction
+ * - reg: register
+ * - write: only count the instruction if it may change the register
+ *
+ * Return
+ * - true if the instruction uses (or changes) the register
+ */
+bool chidb_stmt_op_uses_reg(chidb_dbm_op_t *op, int32_t reg, bool write)
+{
+    int32_t p[3] = {op->p1, op->p2, op->p3};
+
+    if(op->opcode < 0 || op->opcode > Op_Halt)
+        return false;
+
+    if(write)
+    {
+        switch(op->opcode)
+        {
+            case Op_OpenRead:
+            case Op_OpenWrite:
+            case Op_Seek:
+            case Op_SeekGt:
+            case Op_SeekGe:
+            case Op_SeekLt:
+            case Op_SeekLe:
+            case Op_DeferredSeek:
+            case Op_Eq:
+            case Op_Ne:
+            case Op_Lt:
+            case Op_Le:
+            case Op_Gt:
+            case Op_Ge:
+            case Op_IdxGt:
+            case Op_IdxGe:
+            case Op_IdxLt:
+            case Op_IdxLe:
+            case Op_ResultRow:
+            case Op_Insert:
+            case Op_Update:
+            case Op_IdxInsert:
+            case Op_IdxDelete:
+            case Op_HashInsert:
+            case Op_SorterInsert:
+                return false;
+            case Op_Copy:
+            case Op_SCopy:
+            case Op_AggStep:
+                return op->p2 == reg;
+            case Op_MakeRecord:
+            case Op_Divide:
+                return op->p3 == reg;
+            default:
+                break;
+        }
+    }
+
+    for(int i = 0; i < 3; i++)
+    {
+        if(op_operands[op->opcode][i] == OPND_REG && p[i] == reg)
+            return true;
+        if(op_operands[op->opcode][i] == OPND_NREGS && i > 0 && reg >= p[i-1] && reg < p[i-1] + p[i])
+            return true;
+    }
+
+    return false;
+}
+
+/* Is p a copy a register made in its own space (see chidb_dbm_reg_space)? */
+static bool reg_copy(chidb_stmt *stmt, const void *p)
+{
+    uintptr_t space = (uintptr_t) stmt->space;
+
+    if ((uintptr_t) p >= space && (uintptr_t) p < space + stmt->nReg * sizeof(chidb_dbm_regspace_t))
+        return true;
+
+    return chidb_dbm_arena_owns(&stmt->arena, p);
+}
+
+/* Lets go of the snapshots the attached databases (see ATTACH in api.c)
+ * were read from, in WAL mode. Statements only read from them, so there
+ * is nothing to write. */
+static void chidb_stmt_release_attached(chidb_stmt *stmt)
+{
+    for (uint32_t i = 0; i < stmt->db->nattached; i++)
+        chidb_Pager_flush(stmt->db->attached[i].db->bt->pager);
+}
+
+/* End the statement savepoint of a run (see chidb_stmt_exec), undoing
+ * the run if rollback is true. What was derived from the pages that were
+ * restored is thrown away (see chidb_dbm_rolled_back). The statement
+ * already failed, so a failure to undo it cannot be reported. */
+static void chidb_stmt_end_savepoint(chidb_stmt *stmt, bool rollback)
+{
+    stmt->savepoint = false;
+    if (chidb_Pager_endStatement(stmt->db->bt->pager, rollback) == CHIDB_OK && rollback)
+        chidb_dbm_rolled_back(stmt->db);
+}
+
+/* Reset a DBM
+ *
+ * Gets a DBM ready to run its program again from the start. Any cursors
+ * that are still open are closed. Bound parameters are not changed.
+ *
+ * Parameters
+ * - stmt: DBM to reset
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ */
+int chidb_stmt_reset(chidb_stmt *stmt)
+{
+    for (uint32_t i = 0; i < stmt->nCursors; i++)
+    {
+        chidb_dbm_cursor_t *c = &stmt->cursors[i];
+
+        if (c->type != CURSOR_UNSPECIFIED)
+        {
+            chidb_dbm_cursor_destroy(c->bt, c);
+            c->type = CURSOR_UNSPECIFIED;
+        }
+    }
+
+    /* A statement that writes, stopped before it was done, is undone */
+    if (stmt->savepoint)
+        chidb_stmt_end_savepoint(stmt, true);
+
+    /* A statement stopped before it was done lets go of the snapshot it
+     * was reading from (in WAL mode; see chidb_Pager_flush) */
+    if (stmt->pc != 0 && stmt->db->bt != NULL && !stmt->db->bt->pager->in_txn)
+        chidb_Pager_flush(stmt->db->bt->pager);
+    if (stmt->pc != 0)
+        chidb_stmt_release_attached(stmt);
+
+    if (stmt->scan != NULL)
+    {
+        chidb_dbm_scan_free(stmt->scan);
+        stmt->scan = NULL;
+    }
+
+    chidb_result_cache_stop(stmt);
+
+    /* Everything copied into the registers goes away at once. Registers
+     * holding such a copy (in the arena, or inline) are left NULL,
+     * instead of pointing to memory the next run will reuse. */
+    for (uint32_t i = 0; i < stmt->nReg; i++)
+    {
+        chidb_dbm_register_t *reg = &stmt->reg[i];
+
+        if (reg->borrowed &&
+            ((reg->type == REG_STRING && reg_copy(stmt, reg->value.s)) ||
+             (reg->type == REGISTER_BINARY && reg_copy(stmt, reg->value.bin.bytes))))
+        {
+            reg->type = REG_NULL;
+            reg->borrowed = false;
+        }
+        stmt->space[i].bytes = NULL;
+        stmt->space[i].size = 0;
+    }
+    chidb_dbm_arena_reset(&stmt->arena);
+
+    stmt->pc = 0;
+    stmt->startRR = 0;
+    stmt->nRR = 0;
+
     return CHIDB_OK;
 }
 
-/* Forward declaration of instruction handler. See dbm-ops.c for details */
-int chidb_dbm_op_handle (chidb_stmt *stmt, chidb_dbm_op_t *op);
+/* Unbind all the parameters of a DBM
+ *
+ * Parameters
+ * - stmt: DBM
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ */
+int chidb_stmt_clear_params(chidb_stmt *stmt)
+{
+    for (uint32_t i = 0; i < stmt->nParams; i++)
+    {
+        if (stmt->params[i].type == REG_STRING)
+            free(stmt->params[i].value.s);
+        stmt->params[i].type = REG_NULL;
+    }
 
+    return CHIDB_OK;
+}
 
 /* Run the DBM
  *
@@ -198,23 +923,94 @@ int chidb_dbm_op_handle (chidb_stmt *stmt, chidb_dbm_op_t *op);
  */
 int chidb_stmt_exec(chidb_stmt *stmt)
 {
-    int rc = CHIDB_OK;
+    int rc;
 
-    while(stmt->pc < stmt->endOp)
-    {
-        chidb_dbm_op_t *op = &stmt->ops[stmt->pc++];
-        rc = chidb_dbm_op_handle(stmt, op);
+    if (!stmt->verified && (rc = chidb_stmt_verify(stmt)) != CHIDB_OK)
+        return rc;
 
-        if (rc != CHIDB_OK)
-            break;
+    /* The rows of a cached result (see result-cache.c) */
+    if (stmt->replaying)
+        return chidb_result_cache_next(stmt);
+
+    /* Outside a transaction, a program that writes runs in a statement
+     * savepoint, so that if it fails partway (e.g., on a duplicate
+     * primary key in the third row of a multi-row INSERT), what it did
+     * until then is undone (see chidb_Pager_beginStatement). Inside a
+     * transaction, it stays there until the transaction is rolled back. */
+    if (stmt->pc == 0 && stmt->atomic && !stmt->savepoint && stmt->db->bt != NULL
+            && !stmt->db->bt->pager->in_txn)
+    {
+        if ((rc = chidb_Pager_beginStatement(stmt->db->bt->pager)) != CHIDB_OK)
+            return rc;
+        stmt->savepoint = true;
+        stmt->db->txn_schema_key = stmt->db->schema_last_key;
     }
 
+    /* The rows of a parallel scan are ready (see dbm-parallel.c) */
+    if (stmt->scan != NULL)
+        rc = chidb_dbm_scan_next(stmt);
+    else if (stmt->profile != NULL)
+        rc = chidb_dbm_run_profiled(stmt);
+    else if (stmt->nowait)
+        rc = chidb_dbm_run_async(stmt);
+    else
+        rc = chidb_dbm_run(stmt);
+
+    /* The statement is suspended, not done (see chidb_step_async) */
+    if (rc == CHIDB_PENDING)
+        return rc;
+
     if (rc==CHIDB_ROW)
         assert(stmt->nRR == stmt->nCols);
 
     if (rc == CHIDB_OK || rc == CHIDB_DONE)
         rc = CHIDB_DONE;
 
+    chidb_result_cache_keep(stmt, rc);
+
+    if (rc != CHIDB_ROW && stmt->savepoint)
+        chidb_stmt_end_savepoint(stmt, rc != CHIDB_DONE);
+
+    /* Pages written by this statement are only in the buffer pool
+     * until now. Write them out in one go (unless a transaction is
+     * open, in which case they are written when it is committed). On a
+     * shared handle, the log is synced by chidb_stmt_sync. */
+    if (rc != CHIDB_ROW && stmt->db->bt != NULL && !stmt->db->bt->pager->in_txn)
+    {
+        int flush_rc = chidb_Pager_flushCommit(stmt->db->bt->pager, &stmt->commit_seq);
+        if (flush_rc != CHIDB_OK && rc == CHIDB_DONE)
+            rc = CHIDB_EIO;
+    }
+    if (rc != CHIDB_ROW)
+        chidb_stmt_release_attached(stmt);
+
+    return rc;
+}
+
+/* Wait until what the last step of a statement committed is durable
+ *
+ * A step on a shared handle leaves syncing the log to this function
+ * (see chidb_Pager_flushCommit), which is called once the handle's lock
+ * is let go of, so that the commits of other threads can share the sync.
+ *
+ * Parameters
+ * - stmt: A statement
+ * - rc: What the step returned
+ *
+ * Return
+ * - rc, or CHIDB_EIO if rc is CHIDB_DONE and the log could not be synced
+ */
+int chidb_stmt_sync(chidb_stmt *stmt, int rc)
+{
+    uint64_t seq = stmt->commit_seq;
+
+    if (seq == 0)
+        return rc;
+
+    stmt->commit_seq = 0;
+    if (chidb_Pager_syncCommit(stmt->db->bt->pager, seq) != CHIDB_OK && rc == CHIDB_DONE)
+        rc = CHIDB_EIO;
+
     return rc;
 }
 
@@ -238,31 +1034,40 @@ int chidb_stmt_op_print(chidb_dbm_op_t *op)
     return CHIDB_OK;
 }
 
-/* Returns a human-readable string representation of a register */
-char* chidb_stmt_reg_str(chidb_dbm_register_t *r)
+/* Writes a human-readable representation of a register into s, which
+ * has room for n bytes (see snprintf). s can be NULL if n is 0.
+ *
+ * Return
+ * - Length of the representation, not counting the terminating NUL
+ */
+static int reg_format(chidb_dbm_register_t *r, char *s, size_t n)
 {
-    char s[MAX_STR_LEN + 1];
-
     switch(r->type)
     {
-    case REG_UNSPECIFIED:
-        strcpy(s, "");
-        break;
     case REG_NULL:
-        strcpy(s, "NULL");
-        break;
+        return snprintf(s, n, "NULL");
     case REG_INT32:
-        snprintf(s, MAX_STR_LEN, "%i", r->value.i);
-        break;
+    case REG_INT64:
+        return snprintf(s, n, "%lli", (long long) r->value.i);
     case REG_STRING:
-        snprintf(s, MAX_STR_LEN, "\"%s\"", r->value.s);
-        break;
+        return snprintf(s, n, "\"%s\"", r->value.s);
     case REGISTER_BINARY:
-        snprintf(s, MAX_STR_LEN, "(%i bytes)", r->value.bin.nbytes);
-        break;
+        return snprintf(s, n, "(%i bytes)", r->value.bin.nbytes);
+    default:
+        return snprintf(s, n, "%s", "");
     }
+}
+
+/* Returns a human-readable string representation of a register */
+char* chidb_stmt_reg_str(chidb_dbm_register_t *r)
+{
+    int len = reg_format(r, NULL, 0);
+    char *s = malloc(len + 1);
 
-    return strdup(s);
+    if(s != NULL)
+        reg_format(r, s, len + 1);
+
+    return s;
 }
 
 /* Prints a human-readable representation of a register */
@@ -278,16 +1083,25 @@ int chidb_stmt_reg_print(chidb_dbm_register_t *r)
 }
 
 /* Returns a string representation of the current Result Row, with each
- * column separated by "sep"  */
+ * column separated by "sep". Its length is worked out first, so the
+ * string is allocated once, however long the row is. */
 char* chidb_stmt_rr_str(chidb_stmt *stmt, char sep)
 {
-    char s[MAX_STR_LEN + 1], *rstr, sepstr[2];
+    size_t len = 0, pos = 0;
     bool first = true;
+    char *s;
 
-    s[0]='\0';
+    // every column but the first one has a separator before it
+    for(int i=stmt->startRR; i < stmt->startRR + stmt->nRR; i++)
+    {
+        if(stmt->reg[i].type != REG_UNSPECIFIED)
+            len += 1 + reg_format(&stmt->reg[i], NULL, 0);
+    }
+    len = len > 0 ? len - 1 : 0;
 
-    sepstr[0] = sep;
-    sepstr[1] = '\0';
+    if((s = malloc(len + 1)) == NULL)
+        return NULL;
+    s[0] = '\0';
 
     for(int i=stmt->startRR; i < stmt->startRR + stmt->nRR; i++)
     {
@@ -296,17 +1110,15 @@ char* chidb_stmt_rr_str(chidb_stmt *stmt, char sep)
         if(r->type != REG_UNSPECIFIED)
         {
             if(!first)
-                strcat(s, sepstr);
+                s[pos++] = sep;
             else
                 first = false;
 
-            rstr = chidb_stmt_reg_str(r);
-            strcat(s, rstr);
-            free(rstr);
+            pos += reg_format(r, s + pos, len + 1 - pos);
         }
     }
 
-    return strdup(s);
+    return s;
 }
 
 
@@ -381,16 +1193,26 @@ int realloc_ops(chidb_stmt *stmt, uint32_t size)
 }
 
 /* Reallocates the number of registers in the DBM to be
- * to be "size" registers. All new registers are set to type REG_UNSPECIFIED */
+ * to be "size" registers. All new registers are set to type REG_UNSPECIFIED.
+ * Only called before the program runs, as registers can point into the
+ * inline space of other registers. */
 int realloc_reg(chidb_stmt *stmt, uint32_t size)
 {
     stmt->reg = realloc(stmt->reg, sizeof(chidb_dbm_register_t) * size);
     if(stmt->reg == NULL)
         return CHIDB_ENOMEM;
 
+    chidb_dbm_regspace_t *space = realloc(stmt->space, sizeof(chidb_dbm_regspace_t) * size);
+    if(space == NULL)
+        return CHIDB_ENOMEM;
+    stmt->space = space;
+
     for(int i=stmt->nReg; i < size; i++)
     {
         stmt->reg[i].type = REG_UNSPECIFIED;
+        stmt->reg[i].borrowed = false;
+        stmt->space[i].bytes = NULL;
+        stmt->space[i].size = 0;
     }
 
     stmt->nReg = size;
@@ -409,6 +1231,9 @@ int realloc_cur(chidb_stmt *stmt, uint32_t size)
     for(int i=stmt->nCursors; i < size; i++)
     {
         stmt->cursors[i].type = CURSOR_UNSPECIFIED;
+        stmt->cursors[i].hash = NULL;
+        stmt->cursors[i].sorter = NULL;
+        memset(&stmt->cursors[i].filter, 0, sizeof(stmt->cursors[i].filter));
     }
 
     stmt->nCursors = size;
@@ -416,6 +1241,26 @@ int realloc_cur(chidb_stmt *stmt, uint32_t size)
     return CHIDB_OK;
 }
 
+/* Reallocates the number of parameters in the DBM to be
+ * to be "size" parameters. All new parameters are set to type REG_NULL */
+int realloc_params(chidb_stmt *stmt, uint32_t size)
+{
+    chidb_dbm_register_t *params = realloc(stmt->params, sizeof(chidb_dbm_register_t) * size);
+    if(params == NULL)
+        return CHIDB_ENOMEM;
+    stmt->params = params;
+
+    for(int i=stmt->nParams; i < size; i++)
+    {
+        stmt->params[i].type = REG_NULL;
+        stmt->params[i].borrowed = false;
+    }
+
+    stmt->nParams = size;
+
+    return CHIDB_OK;
+}
+
 void free_reg(chidb_stmt *stmt)
 {
     chidb_dbm_register_t reg;
@@ -423,6 +1268,9 @@ void free_reg(chidb_stmt *stmt)
     for (int i = stmt->nReg; i > 0; i--)
     {
         reg = stmt->reg[i-1];
+        if (reg.borrowed)
+            continue;
+
         switch (reg.type)
         {
             case REG_STRING:
@@ -435,6 +1283,7 @@ void free_reg(chidb_stmt *stmt)
             case REG_UNSPECIFIED:
             case REG_NULL:
             case REG_INT32:
+            case REG_INT64:
                 break;
         }
     }
@@ -47,12 +47,36 @@
 int chidb_stmt_init(chidb_stmt *stmt, chidb *db);
 int chidb_stmt_free(chidb_stmt *stmt);
 int chidb_stmt_set_op(chidb_stmt *stmt, chidb_dbm_op_t *op, uint32_t pos);
+int chidb_stmt_verify(chidb_stmt *stmt);
+int chidb_stmt_sync(chidb_stmt *stmt, int rc);
+void chidb_dbm_prog_init(chidb_dbm_prog_t *prog);
+uint32_t chidb_dbm_prog_emit(chidb_dbm_prog_t *prog, opcode_t opcode, int32_t p1, int32_t p2, int32_t p3,
+                             const char *p4);
+uint32_t chidb_dbm_prog_here(chidb_dbm_prog_t *prog);
+int32_t chidb_dbm_prog_label(chidb_dbm_prog_t *prog);
+void chidb_dbm_prog_place(chidb_dbm_prog_t *prog, int32_t label);
+void chidb_dbm_prog_free(chidb_dbm_prog_t *prog);
+int chidb_dbm_prog_finish(chidb_dbm_prog_t *prog, chidb_stmt *stmt);
+bool chidb_stmt_op_jumps(opcode_t opcode);
+int chidb_stmt_op_last_reg(chidb_dbm_op_t *op);
+int chidb_stmt_op_cursor(chidb_dbm_op_t *op);
+bool chidb_stmt_op_uses_reg(chidb_dbm_op_t *op, int32_t reg, bool write);
+bool chidb_stmt_op_filters(chidb_stmt *stmt, uint32_t pos);
+int chidb_stmt_reset(chidb_stmt *stmt);
+int chidb_stmt_clear_params(chidb_stmt *stmt);
 int chidb_stmt_exec(chidb_stmt *stmt);
+int chidb_dbm_run(chidb_stmt *stmt); /* Interpreter loop. See dbm-ops.c for details */
+int chidb_dbm_run_profiled(chidb_stmt *stmt); /* Same, for EXPLAIN ANALYZE */
+int chidb_dbm_run_async(chidb_stmt *stmt); /* Same, for chidb_step_async */
+int chidb_dbm_rolled_back(chidb *db); /* See dbm-ops.c */
+BTree *chidb_dbm_op_btree(chidb_stmt *stmt, chidb_dbm_op_t *op);
 char* chidb_stmt_rr_str(chidb_stmt *stmt, char sep);
 int chidb_stmt_rr_print(chidb_stmt *stmt, char sep);
 int chidb_stmt_print(chidb_stmt *stmt);
 
+int realloc_ops(chidb_stmt *stmt, uint32_t size);
 int realloc_reg(chidb_stmt *stmt, uint32_t size);
 int realloc_cur(chidb_stmt *stmt, uint32_t size);
+int realloc_params(chidb_stmt *stmt, uint32_t size);
 
 #endif /* DBM_H_ */
@@ -47,12 +47,12 @@
 
 
 /* Logging level. Set by default to print just errors */
-static int loglevel = LOG_ERROR;
+loglevel_t __chilog_level = LOG_ERROR;
 
 
 void chilog_setloglevel(loglevel_t level)
 {
-    loglevel = level;
+    __chilog_level = level;
 }
 
 
@@ -61,7 +61,7 @@ void __chilog(loglevel_t level, char *file, int line, char *fmt, ...)
     char buf[31], *levelstr;
     va_list argptr;
 
-    if(level > loglevel)
+    if(level > __chilog_level)
         return;
 
     snprintf(buf, 31, "%s:%i", file, line);
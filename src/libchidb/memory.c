@@ -0,0 +1,142 @@
+/*
+ *  chidb - a didactic relational database management system
+ *
+ *  Memory accounting
+ *
+ */
+
+
+/*
+ *  Copyright (c) 2009-2015, The University of Chicago
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or withsend
+ *  modification, are permitted provided that the following conditions are met:
+ *
+ *  - Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ *  - Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ *  - Neither the name of The University of Chicago nor the names of its
+ *    contributors may be used to endorse or promote products derived from this
+ *    software withsend specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ *  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ *  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ *  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ *  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ *  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ *  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ *  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ *  ARISING IN ANY WAY send OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ *  POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+/*
+ * A database handle can be given a limit on the memory it uses (see
+ * chidb_set_memory_limit). What counts against it is the buffer pool,
+ * the result cache, and the rows the sorters and hash tables of running
+ * statements hold. The buffer pool and the result cache already know
+ * their size, which is read as it is; the sorters and hash tables charge
+ * what they allocate to the handle, and release it once they free it.
+ *
+ * A charge that would take the handle over its limit first makes room
+ * by dropping the least recently used cached results. If that is not
+ * enough, the charge fails (with nothing charged), and it is up to the
+ * caller what to do: a sorter spills its rows to disk, and a hash table
+ * gives up with CHIDB_ENOMEM. The buffer pool is sized once, when the
+ * limit is set, as its frames are pinned by running statements.
+ *
+ * Statements that only read can run at the same time on a shared
+ * handle, so charges are added atomically.
+ */
+
+#include "memory.h"
+#include "pager.h"
+#include "result-cache.h"
+
+
+/* Bytes of memory a database handle uses (and, if not NULL, how many
+ * of them are the buffer pool and the result cache) */
+size_t chidb_memory_used(chidb *db, size_t *pages, size_t *results)
+{
+    Pager *pager = db->bt->pager;
+    size_t p = (size_t) pager->n_frames * pager->page_size;
+    size_t r = __atomic_load_n(&db->result_cache.used, __ATOMIC_RELAXED);
+    size_t used = p + r;
+
+    for (int kind = 0; kind < CHIDB_MEMORY_KINDS; kind++)
+        used += __atomic_load_n(&db->memory.held[kind], __ATOMIC_RELAXED);
+
+    if (pages != NULL)
+        *pages = p;
+    if (results != NULL)
+        *results = r;
+
+    return used;
+}
+
+
+/* Bytes a database handle can still use before reaching its limit
+ * (SIZE_MAX if it has none) */
+size_t chidb_memory_available(chidb *db)
+{
+    size_t used;
+
+    if (db->memory.limit == 0)
+        return SIZE_MAX;
+
+    used = chidb_memory_used(db, NULL, NULL);
+    return used < db->memory.limit ? db->memory.limit - used : 0;
+}
+
+
+/* Charge memory that a sorter or a hash table (kind) has allocated, or
+ * is about to, to a database handle
+ *
+ * Return
+ * - CHIDB_OK: The memory is charged
+ * - CHIDB_ENOMEM: It would take the handle over its limit, even without
+ *                 its cached results. Nothing is charged.
+ */
+int chidb_memory_charge(chidb *db, int kind, size_t bytes)
+{
+    size_t used, peak;
+
+    if (db == NULL)
+        return CHIDB_OK;
+
+    __atomic_add_fetch(&db->memory.held[kind], bytes, __ATOMIC_RELAXED);
+    used = chidb_memory_used(db, NULL, NULL);
+
+    if (db->memory.limit != 0 && used > db->memory.limit)
+    {
+        chidb_result_cache_trim(&db->result_cache, used - db->memory.limit);
+        if ((used = chidb_memory_used(db, NULL, NULL)) > db->memory.limit)
+        {
+            __atomic_sub_fetch(&db->memory.held[kind], bytes, __ATOMIC_RELAXED);
+            return CHIDB_ENOMEM;
+        }
+    }
+
+    peak = __atomic_load_n(&db->memory.peak, __ATOMIC_RELAXED);
+    while (used > peak && !__atomic_compare_exchange_n(&db->memory.peak, &peak, used, true,
+                                                       __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+        ;
+
+    return CHIDB_OK;
+}
+
+
+/* Release memory charged with chidb_memory_charge, once it is freed */
+void chidb_memory_release(chidb *db, int kind, size_t bytes)
+{
+    if (db != NULL)
+        __atomic_sub_fetch(&db->memory.held[kind], bytes, __ATOMIC_RELAXED);
+}
@@ -39,9 +39,28 @@
 
 #include <chidb/chidb.h>
 #include "dbm-types.h"
+#include "btree.h"
+#include "util.h"
+#include "catalog.h"
+#include "stats.h"
+#include "optimizer.h"
+#include "memory.h"
 
 #define CHIDB_DONT_OPT (808)
 
+/* Below this many pairs of rows, a join is done with a nested loop */
+#define HASH_JOIN_MIN_PAIRS (1024)
+
+/* Bytes a row of a hash join is assumed to take in the hash table */
+#define HASH_JOIN_ROW_BYTES (128)
+
+/* Fraction of the rows assumed to match a range on a parameter */
+#define RANGE_PARAM_SELECTIVITY (1.0 / 3)
+
+/* From this many rows on, the rows found by an index are sought in the
+ * table in primary key order */
+#define SORTED_FETCH_MIN_ROWS (64)
+
 int chidb_sql_optimize_check(chisql_statement_t *sql_stmt);
 int chidb_sra_optimize_check(SRA_t *sra_select);
 int chidb_sigma_push_one_cond(chidb_stmt *stmt, SRA_t *sra_select, Condition_t *cond);
@@ -59,8 +78,162 @@ int chidb_get_sra_tables(list_t tables, SRA_t *s);
 
 void Condition_print(Condition_t *cond);
 
-int chidb_stmt_optimize(chidb_stmt *stmt, chisql_statement_t *sql_stmt, chisql_statement_t **sql_stmt_opt)
+/* Is a column qualified with a table of FROM? The qualifier is the alias
+ * of the table, if it has one, or else its name (see
+ * chidb_catalog_qualifies) */
+static bool chidb_optimize_qualifies(chidb *db, const char *qualifier, TableReference_t *ref)
+{
+    if (ref->alias != NULL)
+        return strcmp(qualifier, ref->alias) == 0;
+
+    return chidb_catalog_qualifies(db, qualifier, ref->table_name);
+}
+
+/* Which of the two tables of a join (0 or 1) an expression is a column
+ * of, or -1 if it is not a column qualified with one of them */
+static int chidb_optimize_join_side(chidb *db, Expression_t *expr, TableReference_t *refs[2])
+{
+    ColumnReference_t *col;
+
+    if (expr->t != EXPR_TERM || expr->expr.term.t != TERM_COLREF)
+        return -1;
+    col = expr->expr.term.ref;
+    if (col->tableName == NULL)
+        return -1;
+
+    for (int i = 0; i < 2; i++)
+        if (chidb_optimize_qualifies(db, col->tableName, refs[i]))
+            return i;
+
+    return -1;
+}
+
+/* Split a condition into the ones it ANDs. The equalities between a
+ * column of each table of a join that have the same name go to joined
+ * (with the name in names), the others to rest. The AND nodes go to
+ * ands, so they can be freed without what they AND. */
+static void chidb_optimize_join_conds(chidb *db, Condition_t *cond, TableReference_t *refs[2],
+                                      list_t *joined, list_t *names, list_t *rest, list_t *ands)
+{
+    Expression_t *e1, *e2;
+    int side1, side2;
+
+    if (cond->t == RA_COND_AND)
+    {
+        list_append(ands, cond);
+        chidb_optimize_join_conds(db, cond->cond.binary.cond1, refs, joined, names, rest, ands);
+        chidb_optimize_join_conds(db, cond->cond.binary.cond2, refs, joined, names, rest, ands);
+        return;
+    }
+
+    if (cond->t == RA_COND_EQ)
+    {
+        e1 = cond->cond.comp.expr1;
+        e2 = cond->cond.comp.expr2;
+        side1 = chidb_optimize_join_side(db, e1, refs);
+        side2 = chidb_optimize_join_side(db, e2, refs);
+        if (side1 >= 0 && side2 >= 0 && side1 != side2
+                && strcmp(e1->expr.term.ref->columnName, e2->expr.term.ref->columnName) == 0)
+        {
+            list_append(joined, cond);
+            list_append(names, e1->expr.term.ref->columnName);
+            return;
+        }
+    }
+
+    list_append(rest, cond);
+}
+
+/* Codegen only joins two tables with a NATURAL JOIN. A join of the
+ * tables listed in FROM, t, u WHERE t.a = u.a AND ..., is turned into
+ * t NATURAL JOIN u WHERE ..., if the equalities of the columns of t with
+ * the columns of u are on exactly the columns the tables have in common
+ * (with t.a, u.a, and a column of an attached table qualified as
+ * schema.u.a or u.a). The rest of the WHERE stays as it was. As with a
+ * NATURAL JOIN, SELECT * returns the common columns once.
+ *
+ * Any other join is left as it is (and is not supported by codegen).
+ */
+static void chidb_optimize_comma_join(chidb *db, SRA_t *sra)
+{
+    SRA_t *select, *join;
+    TableReference_t *refs[2];
+    list_t cnames[2], joined, names, rest, ands;
+    Condition_t *cond = NULL;
+    bool natural = true;
+
+    if (sra->t != SRA_PROJECT || sra->project.sra->t != SRA_SELECT)
+        return;
+    select = sra->project.sra;
+    join = select->select.sra;
+    if (join->t != SRA_JOIN || join->join.opt_cond != NULL
+            || join->join.sra1->t != SRA_TABLE || join->join.sra2->t != SRA_TABLE)
+        return;
+    refs[0] = join->join.sra1->table.ref;
+    refs[1] = join->join.sra2->table.ref;
+
+    list_init(&cnames[0]);
+    list_init(&cnames[1]);
+    list_init(&joined);
+    list_init(&names);
+    list_init(&rest);
+    list_init(&ands);
+
+    if (chidb_column_names(db, refs[0]->table_name, &cnames[0]) != CHIDB_OK
+            || chidb_column_names(db, refs[1]->table_name, &cnames[1]) != CHIDB_OK)
+        natural = false;
+    else
+        chidb_optimize_join_conds(db, select->select.cond, refs, &joined, &names, &rest, &ands);
+
+    // Every common column is joined on, and only those
+    for (int i = 0; natural && i < list_size(&cnames[0]); i++)
+    {
+        char *name = list_get_at(&cnames[0], i);
+        bool common = chidb_column_position(&cnames[1], name) >= 0;
+
+        if (common != (chidb_column_position(&names, name) >= 0))
+            natural = false;
+    }
+    for (int i = 0; natural && i < list_size(&names); i++)
+        if (chidb_column_position(&cnames[0], list_get_at(&names, i)) < 0)
+            natural = false;
+    if (list_empty(&joined))
+        natural = false;
+
+    if (natural)
+    {
+        // The joined conditions are what the NATURAL JOIN tests, and
+        // SRA_Binary_t is the first two fields of SRA_Join_t
+        join->t = SRA_NATURAL_JOIN;
+        for (int i = 0; i < list_size(&joined); i++)
+            Condition_free(list_get_at(&joined, i));
+        for (int i = 0; i < list_size(&ands); i++)
+            free(list_get_at(&ands, i));
+        for (int i = 0; i < list_size(&rest); i++)
+            cond = cond == NULL ? list_get_at(&rest, i) : And(cond, list_get_at(&rest, i));
+
+        if (cond != NULL)
+            select->select.cond = cond;
+        else
+        {
+            sra->project.sra = join;
+            free(select);
+        }
+    }
+
+    list_destroy(&cnames[0]);
+    list_destroy(&cnames[1]);
+    list_destroy(&joined);
+    list_destroy(&names);
+    list_destroy(&rest);
+    list_destroy(&ands);
+}
+
+int chidb_stmt_optimize(chidb *db, chisql_statement_t *sql_stmt, chisql_statement_t **sql_stmt_opt)
 {
+    if (sql_stmt->type == STMT_SELECT)
+        chidb_optimize_comma_join(db, sql_stmt->stmt.select);
+
     // do initial check to see if we need to optimize
     int opt_check = chidb_sql_optimize_check(sql_stmt);
 
@@ -75,7 +248,6 @@ int chidb_stmt_optimize(chidb_stmt *stmt, chisql_statement_t *sql_stmt, chisql_s
  		// check verified that no optimization needs to be done
  		*sql_stmt_opt = malloc(sizeof(chisql_statement_t));
     	memcpy(*sql_stmt_opt, sql_stmt, sizeof(chisql_statement_t));
-    	fprintf(stderr, "%s\n\n", "No sigma optimization to be completed.");
  	}
  	else
  	{
@@ -83,7 +255,7 @@ int chidb_stmt_optimize(chidb_stmt *stmt, chisql_statement_t *sql_stmt, chisql_s
  		*sql_stmt_opt = malloc(sizeof(chisql_statement_t));
 
  		// do sigma pushing
- 		int ret = chidb_sigma_push(stmt, sql_stmt->stmt.select);
+ 		int ret = chidb_sigma_push(NULL, sql_stmt->stmt.select);
 
     	memcpy(*sql_stmt_opt, sql_stmt, sizeof(chisql_statement_t));
  	}
@@ -149,6 +321,11 @@ int chidb_sra_optimize_check(SRA_t *sra_select)
 	{
 		opt_ret = CHIDB_DONT_OPT;
 	}
+	// SELECT * FROM t, u (which codegen does not support)
+	else if(select->t == SRA_JOIN)
+	{
+		opt_ret = CHIDB_DONT_OPT;
+	}
 	// SELECT * FROM t WHERE ...
 	else if(select->t == SRA_SELECT)
 	{
@@ -167,6 +344,7 @@ int chidb_sra_optimize_check(SRA_t *sra_select)
 			p2 = GroupBy_make(sra_select->project.group_by);
 			ProjectOption_t *option = ProjectOption_combine(p1, p2);
 			SRA_applyOption(new, option);
+			SRA_applyLimit(new, sra_select->project.limit, sra_select->project.offset);
 
 			memcpy(&sra_select->project, &new->project, sizeof(SRA_Project_t));
 			return CHIDB_DONT_OPT;
@@ -193,15 +371,566 @@ int chidb_sra_optimize_check(SRA_t *sra_select)
 			opt_ret = CHIDB_DONT_OPT;
 		}
 		// SELECT * FROM t |><| u WHERE ...
+		// codegen evaluates the condition on the input of the join that
+		// has the column, so the sigma does not have to be pushed down
 		else if(select_where->t == SRA_NATURAL_JOIN)
 		{
-			opt_ret = CHIDB_OK;
+			opt_ret = CHIDB_DONT_OPT;
+		}
+		// SELECT * FROM t, u WHERE ... that chidb_optimize_comma_join could
+		// not turn into a NATURAL JOIN: codegen does not support it
+		else if(select_where->t == SRA_JOIN)
+		{
+			opt_ret = CHIDB_DONT_OPT;
 		}
 	}
 
 	return opt_ret;
 }
 
+/* Estimate the fraction of the rows of a table that match a WHERE
+ * condition of the form "column OP value", from the stats collected by
+ * ANALYZE. A value is assumed to match 1 / (number of distinct values) of
+ * the rows, and a range to match the part of [lo, hi] it covers (or
+ * RANGE_PARAM_SELECTIVITY, if the value is not known yet).
+ *
+ * Returns a negative number if there are no stats for the column.
+ */
+static double chidb_optimize_selectivity(chidb *db, char *table, Condition_t *cond)
+{
+    chidb_column_stats_t *cs;
+    Literal_t *value;
+    double sel, span;
+
+    cs = chidb_stats_column(db, table, cond->cond.comp.expr1->expr.term.ref->columnName);
+    if(cs == NULL)
+        return -1;
+
+    value = cond->cond.comp.expr2->expr.term.val;
+    switch(cond->t)
+    {
+        case RA_COND_EQ:
+            return cs->ndistinct ? 1.0 / cs->ndistinct : 0;
+        case RA_COND_GT:
+        case RA_COND_GEQ:
+        case RA_COND_LT:
+        case RA_COND_LEQ:
+            break;
+        default:
+            return 1;
+    }
+
+    if(value->t != TYPE_INT || !cs->has_range)
+        return RANGE_PARAM_SELECTIVITY;
+
+    span = (double) cs->hi - cs->lo + 1;
+    if(cond->t == RA_COND_GT || cond->t == RA_COND_GEQ)
+        sel = ((double) cs->hi - value->val.ival + (cond->t == RA_COND_GEQ)) / span;
+    else
+        sel = ((double) value->val.ival - cs->lo + (cond->t == RA_COND_LEQ)) / span;
+
+    return sel < 0 ? 0 : sel > 1 ? 1 : sel;
+}
+
+/* Can the values of the columns a query needs from a table be read from
+ * an index on one of its columns? An index entry has the value of that
+ * column, and the primary key of the row. Names that are not columns of
+ * the table are read from somewhere else, and don't matter here.
+ */
+static bool chidb_optimize_covers(chidb *db, char *table, char *column, list_t *columns)
+{
+    for(int i = 0; i < list_size(columns); i++)
+    {
+        char *name = list_get_at(columns, i);
+        if(chidb_column_get_position(db, table, name) > 0 && strcmp(name, column) != 0)
+            return false;
+    }
+
+    return true;
+}
+
+/* chidb_optimize_access for a "column IN (values)" condition */
+static int chidb_optimize_access_keys(chidb *db, char *table, Condition_t *cond, chidb_access_path_t *path)
+{
+    Expression_t *expr = cond->cond.in.expr;
+    chidb_tree_stats_t *ts;
+    Column_t *col;
+    int pos, n = 0;
+
+    if(expr->t != EXPR_TERM || expr->expr.term.t != TERM_COLREF
+            || chidb_catalog_column(db, table, expr->expr.term.ref->columnName, &col, &pos) != CHIDB_OK
+            || pos != 0 || col->type != TYPE_INT)
+        return CHIDB_OK;
+
+    for(Literal_t *v = cond->cond.in.values_list; v != NULL; v = v->next, n++)
+        if(v->t != TYPE_INT && v->t != TYPE_PARAM)
+            return CHIDB_OK;
+
+    if((ts = chidb_stats_tree(db, table)) != NULL && (uint32_t) n >= ts->npages)
+        return CHIDB_OK;
+
+    path->method = ACCESS_KEYS;
+    return CHIDB_OK;
+}
+
+/* Choose how to find the rows of a table that match a WHERE condition
+ *
+ * A condition of the form "column OP value" on the primary key can be
+ * evaluated by seeking the first matching row in the table, and reading
+ * on from there until the rows stop matching. If there is an index on
+ * the column, the same is done in the index, and each row is then sought
+ * in the table. Either way, only the matching rows (and the pages on the
+ * way to them) are read. Otherwise, the whole table is scanned.
+ *
+ * The value must be an integer, like the keys of the B-Trees, a text
+ * for the index on a TEXT column (a text index), or a parameter. When a parameter is bound to something else, the first seek
+ * finds nothing, so there are no rows. With < and <=, there is no first
+ * seek (the rows are read from the start, up to the value), so these can
+ * only be used with integers.
+ *
+ * Seeking by the primary key never reads more than a scan. An index,
+ * however, leads to a seek in the table for every matching row, so once
+ * ANALYZE has been run, it is only used if the pages read that way (in
+ * the index, and in the table for each row) are fewer than the pages of
+ * the table. Without stats, the index is always used.
+ *
+ * If the index covers the query (the columns it needs are the indexed
+ * column and the primary key), the rows are read from the index alone,
+ * without seeking them in the table.
+ *
+ * The rows an index finds are in the order of the indexed column, so
+ * seeking them in the table one at a time jumps all over it. When many
+ * rows are expected to match (SORTED_FETCH_MIN_ROWS, or any range
+ * condition, without stats), the path is marked for a sorted fetch:
+ * their primary keys are all read from the index and sorted first, and
+ * the rows are then sought in increasing key order, which reads the
+ * table about once, from start to end. The rows then come out in
+ * primary key order, so the caller only does that if the query does not
+ * need them in the order of the index.
+ *
+ * A "column IN (values)" condition on the primary key, with integers or
+ * parameters for values, is evaluated by seeking each of the keys in
+ * the table, in increasing order. Consecutive seeks share the nodes on
+ * the way down (see chidb_dbm_cursor_seekNear), so each reads about one
+ * leaf. Once ANALYZE has been run, that is only done if there are fewer
+ * keys than pages in the table.
+ *
+ * Parameters
+ * - db: The database
+ * - table: The table
+ * - cond: The WHERE condition
+ * - columns: Names of the columns the query returns
+ * - path: Out parameter. How to find the rows.
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ */
+int chidb_optimize_access(chidb *db, char *table, Condition_t *cond, list_t *columns,
+                          chidb_access_path_t *path)
+{
+    chidb_sql_schema_t *schema;
+    Column_t *col;
+    Literal_t *value;
+    char *column;
+    int pos;
+
+    path->method = ACCESS_SCAN;
+    path->index = 0;
+    path->covering = false;
+    path->sorted_fetch = false;
+
+    if(cond->t == RA_COND_IN)
+        return chidb_optimize_access_keys(db, table, cond, path);
+
+    switch(cond->t)
+    {
+        case RA_COND_EQ:
+        case RA_COND_GT:
+        case RA_COND_GEQ:
+        case RA_COND_LT:
+        case RA_COND_LEQ:
+            break;
+        default:
+            return CHIDB_OK;
+    }
+
+    value = cond->cond.comp.expr2->expr.term.val;
+    if(value->t != TYPE_INT && value->t != TYPE_TEXT
+            && !(value->t == TYPE_PARAM && cond->t != RA_COND_LT && cond->t != RA_COND_LEQ))
+        return CHIDB_OK;
+
+    column = cond->cond.comp.expr1->expr.term.ref->columnName;
+    if(chidb_catalog_column(db, table, column, &col, &pos) != CHIDB_OK
+            || (col->type != TYPE_INT && col->type != TYPE_TEXT))
+        return CHIDB_OK;
+
+    // texts are only in text indexes, and integers only in the others
+    if(value->t != TYPE_PARAM && (value->t == TYPE_TEXT) != (col->type == TYPE_TEXT))
+        return CHIDB_OK;
+
+    if(pos == 0 && col->type == TYPE_INT)
+        path->method = ACCESS_PKEY;
+    else if((schema = chidb_catalog_column_index(db, table, column)) != NULL)
+    {
+        chidb_tree_stats_t *ts = chidb_stats_tree(db, table);
+        chidb_tree_stats_t *xs = chidb_stats_tree(db, schema->name);
+        double sel = chidb_optimize_selectivity(db, table, cond);
+        bool covering = chidb_optimize_covers(db, table, column, columns);
+
+        if(ts != NULL && xs != NULL && sel >= 0
+                && xs->depth + sel * xs->npages + (covering ? 0 : sel * ts->nrows * ts->depth) >= ts->npages)
+            return CHIDB_OK;
+
+        path->method = ACCESS_INDEX;
+        path->index = schema->rpage;
+        path->covering = covering;
+        path->sorted_fetch = ts != NULL && sel >= 0 ? sel * ts->nrows >= SORTED_FETCH_MIN_ROWS
+                                                    : cond->t != RA_COND_EQ;
+    }
+
+    return CHIDB_OK;
+}
+
+/* Do the rows of a table come out already sorted for an ORDER BY?
+ *
+ * A scan reads a table in primary key order, and so does a seek by the
+ * primary key (which reads on from the first matching row to the last).
+ * A seek in an index reads the entries in the order of the indexed
+ * column. In those cases, rows ordered by that column need no sort. Keys
+ * are in the order the B-Trees keep them in, the same as the table scans
+ * and index seeks use for their ranges.
+ *
+ * An index is only read in order when the WHERE condition is on its
+ * column: without one, rows with a NULL in the column, which are not in
+ * the index, would be missed. Only ascending order is read this way.
+ *
+ * Parameters
+ * - db: The database
+ * - table: The table
+ * - cond: The WHERE condition (NULL if there is none)
+ * - path: How the rows of the table are found (see chidb_optimize_access)
+ * - column: Column the rows are ordered by
+ * - desc: Descending order?
+ * - sorted: Out parameter. true if the rows need no sort.
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ */
+int chidb_optimize_order(chidb *db, char *table, Condition_t *cond, chidb_access_path_t *path,
+                         char *column, bool desc, bool *sorted)
+{
+    *sorted = false;
+
+    if(desc)
+        return CHIDB_OK;
+
+    if(path->method == ACCESS_INDEX)
+        *sorted = cond != NULL && !strcmp(cond->cond.comp.expr1->expr.term.ref->columnName, column);
+    else
+        *sorted = chidb_column_get_position(db, table, column) == 0;
+
+    return CHIDB_OK;
+}
+
+/* Cost of looking up the rows of a table by the value of a column, in
+ * pages read per lookup. This can only be done if the column is the
+ * primary key of the table (a Seek in the table), or if there is an index
+ * on it (a Seek in the index, then one in the table). Either way, the
+ * values must be integers, like the keys of the B-Trees.
+ *
+ * Returns 0 if the rows can't be looked up by the column, and sets index
+ * to the root page of the index used (0 for the primary key). If the
+ * index covers the query, the rows are not sought in the table.
+ */
+static uint64_t chidb_optimize_lookup_cost(chidb *db, char *table, char *column,
+                                           uint32_t depth, bool covering, npage_t *index)
+{
+    chidb_sql_schema_t *schema;
+    Column_t *col;
+    int pos;
+    uint64_t nentries;
+    uint32_t idepth;
+
+    if(chidb_catalog_column(db, table, column, &col, &pos) != CHIDB_OK || col->type != TYPE_INT)
+        return 0;
+
+    if(pos == 0)
+    {
+        *index = 0;
+        return depth;
+    }
+
+    if((schema = chidb_catalog_column_index(db, table, column)) == NULL)
+        return 0;
+    if(chidb_Btree_estimateEntries(chidb_get_btree(db, table), schema->rpage, &nentries, &idepth) != CHIDB_OK)
+        return 0;
+
+    *index = schema->rpage;
+    return covering ? idepth : idepth + depth;
+}
+
+/* Choose how to evaluate a NATURAL JOIN
+ *
+ * A nested loop reads the second table once for every row of the first
+ * one. A hash join reads each table once: the rows of the smaller table
+ * are put in an in-memory hash table, keyed by the common columns, and
+ * the rows of the other table are looked up in it. An index join reads
+ * the outer table once, and looks up the matching rows of the inner
+ * table by a common column that is its primary key or has an index,
+ * which only reads the pages on the way to them.
+ *
+ * The tables are joined with a nested loop if they are small enough for
+ * it to be cheaper than the alternatives, or if they have no columns in
+ * common (then every pair of rows is in the result, and there is nothing
+ * to look up). Otherwise, the cost of a hash join (the number of rows
+ * read) is compared to the cost of an index join (the number of rows of
+ * the outer table, times the pages read per lookup). Under a memory
+ * limit (see chidb_set_memory_limit), a hash join is only done if its
+ * hash table is expected to fit in the memory left.
+ *
+ * The WHERE condition is checked on the rows of the table that has its
+ * column as they are read, so only the matching rows of the outer table
+ * are looked up, and only those of the build table are hashed. Once
+ * ANALYZE has been run, the number of matching rows is estimated (see
+ * chidb_optimize_selectivity), and the cost of an index join includes
+ * reading the whole outer table. Without stats, all the rows are assumed
+ * to match.
+ *
+ * If the join has a single common column, and the query needs nothing
+ * else from the inner table than its primary key, the index covers it,
+ * and the inner rows are never read.
+ *
+ * Parameters
+ * - db: The database
+ * - table1, table2: The tables being joined
+ * - common: Names of the columns the tables have in common
+ * - cond: The WHERE condition, or NULL if there is none
+ * - columns: Names of the columns the query returns
+ * - plan: Out parameter. How to evaluate the join.
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - Any of the chidb_Btree_estimateEntries errors
+ */
+int chidb_optimize_join(chidb *db, char *table1, char *table2, list_t *common,
+                        Condition_t *cond, list_t *columns, chidb_join_plan_t *plan)
+{
+    char *tables[2] = {table1, table2};
+    uint64_t n[2], cost, best;
+    uint32_t depth[2];
+    double matching[2], sel;
+    bool stats, covering;
+    list_t where;   // The WHERE column, which may also be read from the inner table
+    npage_t index;
+    int rc, i, t;
+
+    plan->method = JOIN_NESTED_LOOP;
+    plan->column = NULL;
+    plan->index = 0;
+    plan->covering = false;
+    if(list_size(common) == 0)
+        return CHIDB_OK;
+
+    for(t = 0; t < 2; t++)
+        if((rc = chidb_Btree_estimateEntries(chidb_get_btree(db, tables[t]), chidb_get_root(db, tables[t]), &n[t], &depth[t])) != CHIDB_OK)
+            return rc;
+
+    if(n[0] * n[1] <= HASH_JOIN_MIN_PAIRS)
+        return CHIDB_OK;
+
+    stats = chidb_stats_tree(db, table1) != NULL && chidb_stats_tree(db, table2) != NULL;
+    for(t = 0; t < 2; t++)
+        matching[t] = n[t];
+    if(stats && cond != NULL)
+    {
+        // Same table as codegen checks the WHERE on
+        char *column = cond->cond.comp.expr1->expr.term.ref->columnName;
+        t = chidb_column_get_position(db, table1, column) >= 0 ? 0 : 1;
+        if((sel = chidb_optimize_selectivity(db, tables[t], cond)) >= 0)
+            matching[t] *= sel;
+    }
+
+    plan->method = JOIN_HASH;
+    plan->inner = matching[1] < matching[0] ? 1 : 0;
+    best = n[0] + n[1];
+
+    // a hash table that would not fit in the memory left is not an option
+    if(matching[plan->inner] * HASH_JOIN_ROW_BYTES > chidb_memory_available(db))
+    {
+        plan->method = JOIN_NESTED_LOOP;
+        best = UINT64_MAX;
+    }
+
+    list_init(&where);
+    if(cond != NULL)
+        list_append(&where, cond->cond.comp.expr1->expr.term.ref->columnName);
+
+    for(t = 0; t < 2; t++)
+        for(i = 0; i < list_size(common); i++)
+        {
+            char *column = list_get_at(common, i);
+            if(chidb_column_get_type(db, tables[1 - t], column) != TYPE_INT)
+                continue;
+            covering = list_size(common) == 1 && chidb_optimize_covers(db, tables[t], column, columns)
+                       && (cond == NULL || chidb_optimize_covers(db, tables[t], column, &where));
+            if((cost = chidb_optimize_lookup_cost(db, tables[t], column, depth[t], covering, &index)) == 0)
+                continue;
+
+            cost = stats ? n[1 - t] + cost * matching[1 - t] : cost * n[1 - t];
+            if(cost < best)
+            {
+                best = cost;
+                plan->method = JOIN_INDEX;
+                plan->inner = t;
+                plan->column = column;
+                plan->index = index;
+                plan->covering = covering && index != 0;
+            }
+        }
+
+    list_destroy(&where);
+
+    return CHIDB_OK;
+}
+
+/* Selectivity of a comparison when nothing better is known: one value
+ * in ten is assumed to be equal to another (see also
+ * RANGE_PARAM_SELECTIVITY, for a range) */
+#define EQ_DEFAULT_SELECTIVITY (0.1)
+
+/* Position of a column in one of the tables of a query, and the table
+ * (0 or 1) it is in. Returns -1 if it is not a column of either. */
+static int chidb_optimize_column(chidb *db, char *tables[2], ColumnReference_t *ref, int *t)
+{
+    int pos;
+
+    for(*t = 0; *t < 2 && tables[*t] != NULL; (*t)++)
+    {
+        if(ref->tableName != NULL && !chidb_catalog_qualifies(db, ref->tableName, tables[*t]))
+            continue;
+        if((pos = chidb_column_get_position(db, tables[*t], ref->columnName)) >= 0)
+            return pos;
+    }
+
+    return -1;
+}
+
+/* Cost of loading an operand of a comparison for each row: a value is
+ * loaded once, a primary key is the key of the entry, and any other
+ * column has to be found in the record. */
+static double chidb_optimize_operand_cost(chidb *db, char *tables[2], Expression_t *expr)
+{
+    int t;
+
+    if(expr->t != EXPR_TERM || expr->expr.term.t != TERM_COLREF)
+        return 0;
+
+    return chidb_optimize_column(db, tables, expr->expr.term.ref, &t) == 0 ? 1 : 2;
+}
+
+/* Estimate the fraction of the rows that match a condition, and the
+ * cost of testing it on a row (in ops run). Comparisons of a column with
+ * a value use the stats, if there are any (see
+ * chidb_optimize_selectivity), and the defaults otherwise. The
+ * conditions in an AND or OR are assumed to be independent. */
+static double chidb_optimize_cond(chidb *db, char *tables[2], Condition_t *cond, double *cost)
+{
+    Expression_t *e1, *e2;
+    double sel1, sel2, cost2;
+    int t, n = 0;
+
+    switch(cond->t)
+    {
+        case RA_COND_AND:
+        case RA_COND_OR:
+            sel1 = chidb_optimize_cond(db, tables, cond->cond.binary.cond1, cost);
+            sel2 = chidb_optimize_cond(db, tables, cond->cond.binary.cond2, &cost2);
+            *cost += cost2;
+            return cond->t == RA_COND_AND ? sel1 * sel2 : sel1 + sel2 - sel1 * sel2;
+        case RA_COND_NOT:
+            return 1 - chidb_optimize_cond(db, tables, cond->cond.unary.cond, cost);
+        case RA_COND_IN:
+            for(Literal_t *v = cond->cond.in.values_list; v != NULL; v = v->next)
+                n++;
+            *cost = chidb_optimize_operand_cost(db, tables, cond->cond.in.expr) + n;
+            sel1 = n * EQ_DEFAULT_SELECTIVITY;
+            return sel1 > 1 ? 1 : sel1;
+        default:
+            break;
+    }
+
+    e1 = cond->cond.comp.expr1;
+    e2 = cond->cond.comp.expr2;
+    *cost = 1 + chidb_optimize_operand_cost(db, tables, e1) + chidb_optimize_operand_cost(db, tables, e2);
+
+    if(e1->t == EXPR_TERM && e1->expr.term.t == TERM_COLREF && e2->t == EXPR_TERM
+            && e2->expr.term.t == TERM_LITERAL && chidb_optimize_column(db, tables, e1->expr.term.ref, &t) >= 0
+            && (sel1 = chidb_optimize_selectivity(db, tables[t], cond)) >= 0)
+        return sel1;
+
+    return cond->t == RA_COND_EQ ? EQ_DEFAULT_SELECTIVITY : RANGE_PARAM_SELECTIVITY;
+}
+
+/* Order the conditions ANDed in a WHERE
+ *
+ * The conditions are tested one after the other, and a row is skipped
+ * as soon as one of them does not hold, so the ones that rule out the
+ * most rows for the least work go first: they are sorted by (1 - s) / c,
+ * from highest to lowest, where s is the fraction of the rows that
+ * match the condition, and c the cost of testing it (see
+ * chidb_optimize_cond). Conditions that rank the same stay in the order
+ * they were written in.
+ *
+ * Parameters
+ * - db: The database
+ * - table1, table2: The tables of the query (table2 is NULL if there is
+ *                   only one)
+ * - conds: The conditions (Condition_t *). Sorted in place.
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_ENOMEM: Could not allocate memory
+ */
+int chidb_optimize_where(chidb *db, char *table1, char *table2, list_t *conds)
+{
+    char *tables[2] = {table1, table2};
+    int n = list_size(conds), i, j;
+    Condition_t **sorted;
+    double *rank, cost;
+
+    sorted = malloc(n * sizeof(Condition_t *));
+    rank = malloc(n * sizeof(double));
+    if(sorted == NULL || rank == NULL)
+    {
+        free(sorted);
+        free(rank);
+        return CHIDB_ENOMEM;
+    }
+
+    for(i = 0; i < n; i++)
+    {
+        Condition_t *cond = list_get_at(conds, i);
+        double r = (1 - chidb_optimize_cond(db, tables, cond, &cost)) / (cost > 0 ? cost : 1);
+
+        for(j = i; j > 0 && rank[j - 1] < r; j--)
+        {
+            sorted[j] = sorted[j - 1];
+            rank[j] = rank[j - 1];
+        }
+        sorted[j] = cond;
+        rank[j] = r;
+    }
+
+    list_clear(conds);
+    for(i = 0; i < n; i++)
+        list_append(conds, sorted[i]);
+
+    free(sorted);
+    free(rank);
+
+    return CHIDB_OK;
+}
+
 // I'm thinking this might be the "main" function which calls sub push routines
 int chidb_sigma_push(chidb_stmt *stmt, SRA_t *sra_select)
 {
@@ -210,9 +939,7 @@ int chidb_sigma_push(chidb_stmt *stmt, SRA_t *sra_select)
 	// if we're dealing with a union
 	if(sra_select->t == SRA_UNION)
 	{
-		fprintf(stderr, "FIRST SQL IN UNION\n");
 		chidb_sigma_push(stmt, sra_select->binary.sra1);
-		fprintf(stderr, "SECOND SQL IN UNION\n");
 		chidb_sigma_push(stmt, sra_select->binary.sra2);
 	}
 	
@@ -224,8 +951,6 @@ int chidb_sigma_push(chidb_stmt *stmt, SRA_t *sra_select)
 	// check if we're dealing with mutiple AND clauses or not
 	if(select->select.cond->t == RA_COND_AND || select->select.cond->t == RA_COND_OR)
 	{
-		fprintf(stderr, "%s\n", "PUSHING AND/OR");
-
 		// do pushing stuff dealing with mutiple and clauses
 		// list_t conditions;
 		// list_init(&conditions);
@@ -250,7 +975,6 @@ int chidb_sigma_push(chidb_stmt *stmt, SRA_t *sra_select)
 	}
 	else
 	{
-		fprintf(stderr, "ABOUT TO PUSH WITH ONE COND\n");
 		// do pushing with just one and clause
 		// chidb_sigma_push_SRA(stmt, select, select->select.cond);
 		// fprintf(stderr, "%s%i\n", "type of condition: ", select->select.cond->t);
@@ -383,7 +1107,6 @@ int chidb_sigma_push_one_cond(chidb_stmt *stmt, SRA_t *sra_select, Condition_t *
 	// --and thus we can just push the sigma down both branches-- not true.
 	if(list_sz == 0)
 	{
-		fprintf(stderr, "%s\n", "no tables mentioned");
 		// do sigma pushing to both branches
 		// E.x: WHERE 1 < 2
 
@@ -720,7 +1443,6 @@ int chidb_sigma_cond_simplify(Condition_t *cond, Condition_t **out_cond)
 	}
 	else if (cond->t == RA_COND_AND || cond->t == RA_COND_OR)
 	{
-		fprintf(stderr, "%s\n", "IN AND");
 		ret1 = chidb_sigma_cond_simplify(cond->cond.binary.cond1, &c);
 		ret2 = chidb_sigma_cond_simplify(cond->cond.binary.cond2, &v);
 
@@ -778,6 +1500,10 @@ int chidb_sigma_evaluate(Condition_t *cond)
 				if ((e1->expr.term.t != TERM_LITERAL) || (e2->expr.term.t != TERM_LITERAL))
 					return CHIDB_OK;
 
+				/* Parameters are only known when the statement runs */
+				if ((e1->expr.term.val->t == TYPE_PARAM) || (e2->expr.term.val->t == TYPE_PARAM))
+					return CHIDB_OK;
+
 				if (e1->expr.term.val->t != e2->expr.term.val->t)
 					return CHIDB_EINVALIDSQL;
 
@@ -799,6 +1525,9 @@ int chidb_sigma_evaluate(Condition_t *cond)
 						return (!strncmp(e1->expr.term.val->val.strval, e1->expr.term.val->val.strval, 
 							strlen(e1->expr.term.val->val.strval))) ? CHIDB_TRUE : CHIDB_FALSE;
 						break;
+
+					case TYPE_PARAM:
+						break;
 				}
 			}
 		}
@@ -814,6 +1543,10 @@ int chidb_sigma_evaluate(Condition_t *cond)
 				if ((e1->expr.term.t != TERM_LITERAL) || (e2->expr.term.t != TERM_LITERAL))
 					return CHIDB_OK;
 
+				/* Parameters are only known when the statement runs */
+				if ((e1->expr.term.val->t == TYPE_PARAM) || (e2->expr.term.val->t == TYPE_PARAM))
+					return CHIDB_OK;
+
 				if (e1->expr.term.val->t != e2->expr.term.val->t)
 					return CHIDB_EINVALIDSQL;
 
@@ -835,6 +1568,9 @@ int chidb_sigma_evaluate(Condition_t *cond)
 						return (strncmp(e1->expr.term.val->val.strval, e1->expr.term.val->val.strval, 
 							strlen(e1->expr.term.val->val.strval)) < 0) ? CHIDB_TRUE : CHIDB_FALSE;
 						break;
+
+					case TYPE_PARAM:
+						break;
 				}
 			}
 		}
@@ -850,6 +1586,10 @@ int chidb_sigma_evaluate(Condition_t *cond)
 				if ((e1->expr.term.t != TERM_LITERAL) || (e2->expr.term.t != TERM_LITERAL))
 					return CHIDB_OK;
 
+				/* Parameters are only known when the statement runs */
+				if ((e1->expr.term.val->t == TYPE_PARAM) || (e2->expr.term.val->t == TYPE_PARAM))
+					return CHIDB_OK;
+
 				if (e1->expr.term.val->t != e2->expr.term.val->t)
 					return CHIDB_EINVALIDSQL;
 
@@ -871,6 +1611,9 @@ int chidb_sigma_evaluate(Condition_t *cond)
 						return (strncmp(e1->expr.term.val->val.strval, e1->expr.term.val->val.strval, 
 							strlen(e1->expr.term.val->val.strval)) <= 0) ? CHIDB_TRUE : CHIDB_FALSE;
 						break;
+
+					case TYPE_PARAM:
+						break;
 				}
 			}
 		}
@@ -886,6 +1629,10 @@ int chidb_sigma_evaluate(Condition_t *cond)
 				if ((e1->expr.term.t != TERM_LITERAL) || (e2->expr.term.t != TERM_LITERAL))
 					return CHIDB_OK;
 
+				/* Parameters are only known when the statement runs */
+				if ((e1->expr.term.val->t == TYPE_PARAM) || (e2->expr.term.val->t == TYPE_PARAM))
+					return CHIDB_OK;
+
 				if (e1->expr.term.val->t != e2->expr.term.val->t)
 					return CHIDB_EINVALIDSQL;
 
@@ -907,6 +1654,9 @@ int chidb_sigma_evaluate(Condition_t *cond)
 						return (strncmp(e1->expr.term.val->val.strval, e1->expr.term.val->val.strval, 
 							strlen(e1->expr.term.val->val.strval)) > 0) ? CHIDB_TRUE : CHIDB_FALSE;
 						break;
+
+					case TYPE_PARAM:
+						break;
 				}
 			}
 		}
@@ -922,6 +1672,10 @@ int chidb_sigma_evaluate(Condition_t *cond)
 				if ((e1->expr.term.t != TERM_LITERAL) || (e2->expr.term.t != TERM_LITERAL))
 					return CHIDB_OK;
 
+				/* Parameters are only known when the statement runs */
+				if ((e1->expr.term.val->t == TYPE_PARAM) || (e2->expr.term.val->t == TYPE_PARAM))
+					return CHIDB_OK;
+
 				if (e1->expr.term.val->t != e2->expr.term.val->t)
 					return CHIDB_EINVALIDSQL;
 
@@ -943,6 +1697,9 @@ int chidb_sigma_evaluate(Condition_t *cond)
 						return (strncmp(e1->expr.term.val->val.strval, e1->expr.term.val->val.strval, 
 							strlen(e1->expr.term.val->val.strval)) >= 0) ? CHIDB_TRUE : CHIDB_FALSE;
 						break;
+
+					case TYPE_PARAM:
+						break;
 				}
 			}
 		}
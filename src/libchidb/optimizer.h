@@ -0,0 +1,94 @@
+/*
+ *  chidb - a didactic relational database management system
+ *
+ *  Query optimizer -- header
+ *
+ */
+
+/*
+ *  Copyright (c) 2009-2015, The University of Chicago
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or withsend
+ *  modification, are permitted provided that the following conditions are met:
+ *
+ *  - Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ *  - Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ *  - Neither the name of The University of Chicago nor the names of its
+ *    contributors may be used to endorse or promote products derived from this
+ *    software withsend specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ *  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ *  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ *  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ *  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ *  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ *  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ *  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ *  ARISING IN ANY WAY send OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ *  POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+#ifndef OPTIMIZER_H_
+#define OPTIMIZER_H_
+
+#include "chidbInt.h"
+#include <chisql/chisql.h>
+
+/* How a NATURAL JOIN is evaluated */
+typedef enum chidb_join_method
+{
+    JOIN_NESTED_LOOP,   // rescan one table for every row of the other
+    JOIN_HASH,          // probe a hash table built from one of the tables
+    JOIN_INDEX          // look up the rows of one table by their key
+} chidb_join_method_t;
+
+typedef struct chidb_join_plan
+{
+    chidb_join_method_t method;
+    int inner;          // Table (0 or 1) the hash table is built from (JOIN_HASH),
+                        // or the rows are looked up in (JOIN_INDEX)
+    char *column;       // JOIN_INDEX: common column the rows are looked up by
+    npage_t index;      // JOIN_INDEX: root page of the index on that column,
+                        // or 0 if it is the primary key of the inner table
+    bool covering;      // JOIN_INDEX: the index has all the columns needed
+                        // from the inner table, so the table is not read
+} chidb_join_plan_t;
+
+/* How the rows of a table that match a WHERE condition are found */
+typedef enum chidb_access_method
+{
+    ACCESS_SCAN,        // read the whole table
+    ACCESS_PKEY,        // seek in the table, by its primary key
+    ACCESS_INDEX,       // seek in an index, then in the table
+    ACCESS_KEYS         // seek each primary key of an IN list, in order
+} chidb_access_method_t;
+
+typedef struct chidb_access_path
+{
+    chidb_access_method_t method;
+    npage_t index;      // ACCESS_INDEX: root page of the index
+    bool covering;      // ACCESS_INDEX: the index has all the columns needed,
+                        // so the table is not read
+    bool sorted_fetch;  // ACCESS_INDEX: enough rows match for their primary
+                        // keys to be sorted before they are sought in the
+                        // table (only if the rows need not come out in the
+                        // order of the index, and it does not cover the query)
+} chidb_access_path_t;
+
+int chidb_optimize_access(chidb *db, char *table, Condition_t *cond, list_t *columns,
+                          chidb_access_path_t *path);
+int chidb_optimize_order(chidb *db, char *table, Condition_t *cond, chidb_access_path_t *path,
+                         char *column, bool desc, bool *sorted);
+int chidb_optimize_join(chidb *db, char *table1, char *table2, list_t *common,
+                        Condition_t *cond, list_t *columns, chidb_join_plan_t *plan);
+int chidb_optimize_where(chidb *db, char *table1, char *table2, list_t *conds);
+
+#endif /* OPTIMIZER_H_ */
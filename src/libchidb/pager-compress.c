@@ -0,0 +1,988 @@
+/*
+ *  chidb - a didactic relational database management system
+ *
+ *  Compressed Pager I/O backend
+ *
+ */
+
+/*
+ *  Copyright (c) 2009-2015, The University of Chicago
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or withsend
+ *  modification, are permitted provided that the following conditions are met:
+ *
+ *  - Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ *  - Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ *  - Neither the name of The University of Chicago nor the names of its
+ *    contributors may be used to endorse or promote products derived from this
+ *    software withsend specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ *  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ *  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ *  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ *  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ *  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ *  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ *  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ *  ARISING IN ANY WAY send OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ *  POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+/*
+ * A compressed file stores every page compressed, in a variable-size
+ * extent of whole chunks (CMP_CHUNK bytes) wherever it fits. The
+ * Pager still sees a file of fixed-size pages: the backend keeps a
+ * page map, with the offset and compressed length of each page, and
+ * compresses and decompresses pages as they are written and read.
+ * Pages that do not shrink by at least a chunk are stored as they are.
+ *
+ * The file starts with two slots (at 0 and CMP_SLOT_STRIDE), each of
+ * which points to a copy of the page map somewhere in the file, and
+ * then the extents (from CMP_DATA_OFFSET on):
+ *
+ *   0   "chidbcmp"
+ *   8   Generation (incremented each time a slot is written)
+ *   12  Page size
+ *   16  Number of pages
+ *   20  Chunk the page map starts at
+ *   24  Checksum of the page map (8 bytes per page: chunk and length)
+ *   28  Checksum of the slot
+ *
+ * Pages are never overwritten in place. Each batch of writes puts the
+ * pages in new extents, and then writes the whole map to a new extent,
+ * and the slot that was not current at the last sync to point to it. A
+ * sync makes that slot the current one. When the file is opened, the
+ * valid slot with the newest generation is used, so a batch that did not
+ * make it to the file in full is as if it had not been written at all.
+ *
+ * The extents a new map no longer points to can be reused once the map
+ * is in a slot, except those the map in the synced slot points to,
+ * which are kept until the next sync. The free extents at the end of
+ * the file are cut off at each sync.
+ *
+ * The pages are compressed with a byte-oriented LZ77 coder in the style
+ * of LZ4: a sequence of runs, each made of literal bytes and a match
+ * (an earlier copy of at least LZ_MIN_MATCH bytes, up to 64K back).
+ * It is fast enough to run on every read, and B-Tree pages (with
+ * repetitive keys and records, and free space filled with zeroes)
+ * compress well with it.
+ *
+ * A compressed file can only be used by one handle at a time, cannot
+ * be memory-mapped, and cannot be in WAL mode.
+ */
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <chidb/chidb.h>
+#include "pager-file.h"
+#include "util.h"
+
+#define CMP_MAGIC "chidbcmp"
+#define CMP_SLOT_SIZE (32)
+#define CMP_SLOT_STRIDE (512)
+#define CMP_DATA_OFFSET (1024)
+#define CMP_ENTRY_SIZE (8)
+#define CMP_CHUNK (64)
+
+#define CMP_CHUNKS(bytes) (((bytes) + CMP_CHUNK - 1) / CMP_CHUNK)
+#define CMP_OFFSET(chunk) ((off_t) (chunk) * CMP_CHUNK)
+
+#define LZ_MIN_MATCH (4)
+#define LZ_MAX_OFFSET (65535)
+#define LZ_HASH_BITS (12)
+
+/* A run of chunks in the file */
+typedef struct Extent
+{
+    uint32_t start;
+    uint32_t len;
+} Extent;
+
+typedef struct ExtentList
+{
+    Extent *ext;
+    uint32_t n;
+    uint32_t cap;
+} ExtentList;
+
+/* Where a page is. A length of zero is a page that was never written */
+typedef struct CompressedPage
+{
+    uint32_t chunk;
+    uint32_t len;
+} CompressedPage;
+
+typedef struct Compressed
+{
+    PagerFile base;
+    uint32_t page_size;
+    uint32_t n_pages;
+    CompressedPage *pages;
+    uint8_t *fresh;         /* Bitmap of the pages written since the last sync */
+    uint32_t cap;           /* Entries allocated in pages (and bits in fresh) */
+
+    ExtentList free;        /* Sorted, with adjacent extents merged */
+    ExtentList pending;     /* Freed, but the synced map points to them */
+    ExtentList retired;     /* Freed, but the map in the other slot points to them */
+    uint32_t end;           /* Chunk past the last one in use */
+
+    Extent map[2];          /* The page map each slot points to */
+    uint32_t gen;           /* Generation of the newest slot */
+    int synced;             /* The slot that was current at the last sync */
+    bool changed;           /* The other slot has been written since */
+
+    uint8_t *cbuf;          /* Scratch buffer for compressing a page */
+} Compressed;
+
+
+/*
+ * The page codec
+ */
+
+static uint32_t lz_hash(const uint8_t *p)
+{
+    uint32_t v = p[0] | p[1] << 8 | p[2] << 16 | (uint32_t) p[3] << 24;
+
+    return (v * 2654435761u) >> (32 - LZ_HASH_BITS);
+}
+
+/* Write the part of a length that did not fit in a token */
+static uint8_t *lz_putLength(uint8_t *op, uint8_t *oend, size_t len)
+{
+    for (; len >= 255; len -= 255)
+    {
+        if (op >= oend)
+            return NULL;
+        *op++ = 255;
+    }
+    if (op >= oend)
+        return NULL;
+    *op++ = len;
+
+    return op;
+}
+
+static bool lz_getLength(const uint8_t **ip, const uint8_t *iend, size_t *len)
+{
+    uint8_t b;
+
+    do
+    {
+        if (*ip >= iend)
+            return false;
+        b = *(*ip)++;
+        *len += b;
+    } while (b == 255);
+
+    return true;
+}
+
+/* Write a run: a token (the lengths of the literals and the match, up
+ * to 15 each), the rest of the literal length, the literals, the offset
+ * of the match, and the rest of the match length. The last run has no
+ * match. Return NULL if the run does not fit. */
+static uint8_t *lz_putRun(uint8_t *op, uint8_t *oend, const uint8_t *lit, size_t nlit,
+                          size_t offset, size_t mlen)
+{
+    size_t mcode = mlen > 0 ? mlen - LZ_MIN_MATCH : 0;
+    uint8_t *token = op;
+
+    if (op >= oend)
+        return NULL;
+    *token = (nlit < 15 ? nlit : 15) << 4 | (mcode < 15 ? mcode : 15);
+    op++;
+
+    if (nlit >= 15 && (op = lz_putLength(op, oend, nlit - 15)) == NULL)
+        return NULL;
+    if ((size_t) (oend - op) < nlit)
+        return NULL;
+    memcpy(op, lit, nlit);
+    op += nlit;
+
+    if (mlen == 0)
+        return op;
+
+    if (oend - op < 2)
+        return NULL;
+    op[0] = offset & 0xFF;
+    op[1] = offset >> 8;
+    op += 2;
+
+    if (mcode >= 15 && (op = lz_putLength(op, oend, mcode - 15)) == NULL)
+        return NULL;
+
+    return op;
+}
+
+/* Compress n bytes into dst. Return the compressed length, or 0 if it
+ * would be more than cap bytes */
+static size_t lz_compress(const uint8_t *src, size_t n, uint8_t *dst, size_t cap)
+{
+    int32_t table[1 << LZ_HASH_BITS];
+    const uint8_t *ip = src, *anchor = src, *end = src + n;
+    uint8_t *op = dst, *oend = dst + cap;
+
+    for (size_t i = 0; i < (1 << LZ_HASH_BITS); i++)
+        table[i] = -1;
+
+    while (ip + LZ_MIN_MATCH <= end)
+    {
+        uint32_t h = lz_hash(ip);
+        int32_t ref = table[h];
+        size_t mlen = LZ_MIN_MATCH;
+
+        table[h] = ip - src;
+        if (ref < 0 || ip - src - ref > LZ_MAX_OFFSET || memcmp(src + ref, ip, LZ_MIN_MATCH) != 0)
+        {
+            ip++;
+            continue;
+        }
+
+        while (ip + mlen < end && src[ref + mlen] == ip[mlen])
+            mlen++;
+
+        if ((op = lz_putRun(op, oend, anchor, ip - anchor, ip - src - ref, mlen)) == NULL)
+            return 0;
+        ip += mlen;
+        anchor = ip;
+    }
+
+    if ((op = lz_putRun(op, oend, anchor, end - anchor, 0, 0)) == NULL)
+        return 0;
+
+    return op - dst;
+}
+
+/* Decompress n bytes into exactly size bytes. Return false if the
+ * input is not well-formed */
+static bool lz_decompress(const uint8_t *src, size_t n, uint8_t *dst, size_t size)
+{
+    const uint8_t *ip = src, *iend = src + n;
+    uint8_t *op = dst, *oend = dst + size;
+
+    while (ip < iend)
+    {
+        uint8_t token = *ip++;
+        size_t nlit = token >> 4, mlen = token & 15, offset;
+
+        if (nlit == 15 && !lz_getLength(&ip, iend, &nlit))
+            return false;
+        if ((size_t) (iend - ip) < nlit || (size_t) (oend - op) < nlit)
+            return false;
+        memcpy(op, ip, nlit);
+        op += nlit;
+        ip += nlit;
+
+        /* The last run has no match */
+        if (ip == iend)
+            break;
+
+        if (iend - ip < 2)
+            return false;
+        offset = ip[0] | ip[1] << 8;
+        ip += 2;
+        if (mlen == 15 && !lz_getLength(&ip, iend, &mlen))
+            return false;
+        mlen += LZ_MIN_MATCH;
+        if (offset == 0 || offset > (size_t) (op - dst) || (size_t) (oend - op) < mlen)
+            return false;
+
+        /* The match can overlap the bytes it produces */
+        for (size_t i = 0; i < mlen; i++, op++)
+            *op = *(op - offset);
+    }
+
+    return op == oend;
+}
+
+
+/*
+ * Extents
+ */
+
+static uint32_t cmp_checksum(const uint8_t *data, size_t size)
+{
+    uint32_t sum = 0;
+
+    for (size_t i = 0; i < size; i++)
+        sum = sum * 31 + data[i];
+
+    return sum;
+}
+
+static int cmp_push(ExtentList *l, Extent e)
+{
+    if (l->n == l->cap)
+    {
+        uint32_t cap = l->cap ? 2 * l->cap : 16;
+        Extent *ext = realloc(l->ext, cap * sizeof(Extent));
+
+        if (ext == NULL)
+            return CHIDB_ENOMEM;
+        l->ext = ext;
+        l->cap = cap;
+    }
+    l->ext[l->n++] = e;
+
+    return CHIDB_OK;
+}
+
+/* Return an extent to the free list, merging it with its neighbours */
+static int cmp_free(Compressed *c, Extent e)
+{
+    ExtentList *l = &c->free;
+    uint32_t lo = 0, hi = l->n;
+
+    if (e.len == 0)
+        return CHIDB_OK;
+
+    while (lo < hi)
+    {
+        uint32_t mid = (lo + hi) / 2;
+
+        if (l->ext[mid].start < e.start)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+
+    if (lo > 0 && l->ext[lo - 1].start + l->ext[lo - 1].len == e.start)
+    {
+        l->ext[lo - 1].len += e.len;
+        if (lo < l->n && e.start + e.len == l->ext[lo].start)
+        {
+            l->ext[lo - 1].len += l->ext[lo].len;
+            memmove(&l->ext[lo], &l->ext[lo + 1], (l->n - lo - 1) * sizeof(Extent));
+            l->n--;
+        }
+        return CHIDB_OK;
+    }
+    if (lo < l->n && e.start + e.len == l->ext[lo].start)
+    {
+        l->ext[lo].start = e.start;
+        l->ext[lo].len += e.len;
+        return CHIDB_OK;
+    }
+
+    if (cmp_push(l, e) != CHIDB_OK)
+        return CHIDB_ENOMEM;
+    memmove(&l->ext[lo + 1], &l->ext[lo], (l->n - lo - 1) * sizeof(Extent));
+    l->ext[lo] = e;
+
+    return CHIDB_OK;
+}
+
+/* Free every extent in a list */
+static int cmp_freeAll(Compressed *c, ExtentList *l)
+{
+    int rc = CHIDB_OK;
+
+    for (uint32_t i = 0; i < l->n; i++)
+        if (cmp_free(c, l->ext[i]) != CHIDB_OK)
+            rc = CHIDB_ENOMEM;
+    l->n = 0;
+
+    return rc;
+}
+
+/* Find room for len chunks: the first free extent that is large
+ * enough, or else the end of the file */
+static uint32_t cmp_alloc(Compressed *c, uint32_t len)
+{
+    ExtentList *l = &c->free;
+    uint32_t start;
+
+    for (uint32_t i = 0; i < l->n; i++)
+    {
+        if (l->ext[i].len < len)
+            continue;
+
+        start = l->ext[i].start;
+        l->ext[i].start += len;
+        l->ext[i].len -= len;
+        if (l->ext[i].len == 0)
+        {
+            memmove(&l->ext[i], &l->ext[i + 1], (l->n - i - 1) * sizeof(Extent));
+            l->n--;
+        }
+        return start;
+    }
+
+    start = c->end;
+    c->end += len;
+
+    return start;
+}
+
+/* Let go of the extent a page is in. It cannot be reused until no
+ * slot points to a map with it. */
+static int cmp_release(Compressed *c, uint32_t i)
+{
+    Extent e = { c->pages[i].chunk, CMP_CHUNKS(c->pages[i].len) };
+
+    if (e.len == 0)
+        return CHIDB_OK;
+    if (c->fresh[i / 8] & (1 << (i % 8)))
+        return cmp_push(&c->retired, e);
+
+    return cmp_push(&c->pending, e);
+}
+
+/* Make room for n pages. The new pages have never been written */
+static int cmp_grow(Compressed *c, uint32_t n)
+{
+    if (n > c->cap)
+    {
+        uint32_t cap = n > 2 * c->cap ? n : 2 * c->cap;
+        size_t old = c->fresh != NULL ? c->cap / 8 + 1 : 0;
+        CompressedPage *pages = realloc(c->pages, (size_t) cap * sizeof(CompressedPage));
+        uint8_t *fresh;
+
+        if (pages == NULL)
+            return CHIDB_ENOMEM;
+        c->pages = pages;
+        if ((fresh = realloc(c->fresh, cap / 8 + 1)) == NULL)
+            return CHIDB_ENOMEM;
+        c->fresh = fresh;
+        memset(c->fresh + old, 0, cap / 8 + 1 - old);
+        c->cap = cap;
+    }
+
+    for (uint32_t i = c->n_pages; i < n; i++)
+    {
+        c->pages[i].chunk = 0;
+        c->pages[i].len = 0;
+        c->fresh[i / 8] &= ~(1 << (i % 8));
+    }
+    c->n_pages = n;
+
+    return CHIDB_OK;
+}
+
+
+/*
+ * The page map
+ */
+
+/* Write the page map to a new extent, and the slot that is not synced
+ * to point to it */
+static int cmp_writeMap(Compressed *c)
+{
+    int slot = 1 - c->synced;
+    size_t size = (size_t) c->n_pages * CMP_ENTRY_SIZE;
+    uint8_t header[CMP_SLOT_SIZE];
+    uint8_t *buf = NULL;
+    Extent map = { 0, 0 };
+    int rc;
+
+    if (size > 0)
+    {
+        if ((buf = malloc(size)) == NULL)
+            return CHIDB_ENOMEM;
+        for (uint32_t i = 0; i < c->n_pages; i++)
+        {
+            put4byte(buf + CMP_ENTRY_SIZE * i, c->pages[i].chunk);
+            put4byte(buf + CMP_ENTRY_SIZE * i + 4, c->pages[i].len);
+        }
+
+        map.len = CMP_CHUNKS(size);
+        map.start = cmp_alloc(c, map.len);
+        if (pwrite(c->base.fd, buf, size, CMP_OFFSET(map.start)) != (ssize_t) size)
+        {
+            free(buf);
+            cmp_free(c, map);
+            return CHIDB_EIO;
+        }
+    }
+
+    memcpy(header, CMP_MAGIC, 8);
+    put4byte(header + 8, c->gen + 1);
+    put4byte(header + 12, c->page_size);
+    put4byte(header + 16, c->n_pages);
+    put4byte(header + 20, map.start);
+    put4byte(header + 24, cmp_checksum(buf, size));
+    put4byte(header + 28, cmp_checksum(header, 28));
+    free(buf);
+
+    if (pwrite(c->base.fd, header, CMP_SLOT_SIZE, (off_t) slot * CMP_SLOT_STRIDE) != CMP_SLOT_SIZE)
+    {
+        cmp_free(c, map);
+        return CHIDB_EIO;
+    }
+    c->gen++;
+    c->changed = true;
+
+    /* The slot no longer points to the previous map, or to the pages
+     * that were only in it */
+    rc = cmp_push(&c->retired, c->map[slot]);
+    c->map[slot] = map;
+    if (cmp_freeAll(c, &c->retired) != CHIDB_OK)
+        rc = CHIDB_ENOMEM;
+
+    return rc;
+}
+
+/* Read a slot, and the page map it points to. Return false if either
+ * is not valid. */
+static bool cmp_readSlot(int fd, int slot, uint8_t *header, uint8_t **map)
+{
+    uint32_t n_pages, page_size;
+    size_t size;
+
+    *map = NULL;
+    if (pread(fd, header, CMP_SLOT_SIZE, (off_t) slot * CMP_SLOT_STRIDE) != CMP_SLOT_SIZE
+            || memcmp(header, CMP_MAGIC, 8) != 0
+            || get4byte(header + 28) != cmp_checksum(header, 28))
+        return false;
+
+    page_size = get4byte(header + 12);
+    n_pages = get4byte(header + 16);
+    size = (size_t) n_pages * CMP_ENTRY_SIZE;
+    if (!VALID_PAGE_SIZE(page_size) || (size > 0 && get4byte(header + 20) < CMP_CHUNKS(CMP_DATA_OFFSET)))
+        return false;
+
+    if (size > 0 && (*map = malloc(size)) == NULL)
+        return false;
+    if ((size > 0 && pread(fd, *map, size, CMP_OFFSET(get4byte(header + 20))) != (ssize_t) size)
+            || get4byte(header + 24) != cmp_checksum(*map, size))
+    {
+        free(*map);
+        *map = NULL;
+        return false;
+    }
+
+    return true;
+}
+
+static int cmp_cmpExtents(const void *a, const void *b)
+{
+    uint32_t sa = ((const Extent *) a)->start, sb = ((const Extent *) b)->start;
+
+    return (sa > sb) - (sa < sb);
+}
+
+/* Load the page map from the newest valid slot. Every chunk that
+ * neither the map nor its pages are in is free. */
+static int cmp_load(Compressed *c)
+{
+    uint8_t header[2][CMP_SLOT_SIZE];
+    uint8_t *maps[2];
+    bool valid[2];
+    ExtentList used = { NULL, 0, 0 };
+    int slot, rc = CHIDB_OK;
+
+    for (int i = 0; i < 2; i++)
+        valid[i] = cmp_readSlot(c->base.fd, i, header[i], &maps[i]);
+
+    if (!valid[0] && !valid[1])
+        return CHIDB_ECORRUPT;
+    if (valid[0] && valid[1])
+        slot = (int32_t) (get4byte(header[1] + 8) - get4byte(header[0] + 8)) > 0;
+    else
+        slot = valid[1];
+
+    c->page_size = get4byte(header[slot] + 12);
+    c->gen = get4byte(header[slot] + 8);
+    c->synced = slot;
+    c->changed = false;
+    c->map[slot].start = get4byte(header[slot] + 20);
+    c->map[slot].len = CMP_CHUNKS((size_t) get4byte(header[slot] + 16) * CMP_ENTRY_SIZE);
+
+    if ((rc = cmp_grow(c, get4byte(header[slot] + 16))) != CHIDB_OK)
+        goto out;
+    rc = cmp_push(&used, c->map[slot]);
+    for (uint32_t i = 0; i < c->n_pages && rc == CHIDB_OK; i++)
+    {
+        c->pages[i].chunk = get4byte(maps[slot] + CMP_ENTRY_SIZE * i);
+        c->pages[i].len = get4byte(maps[slot] + CMP_ENTRY_SIZE * i + 4);
+        if (c->pages[i].len > c->page_size
+                || (c->pages[i].len > 0 && c->pages[i].chunk < CMP_CHUNKS(CMP_DATA_OFFSET)))
+            rc = CHIDB_ECORRUPT;
+        else
+            rc = cmp_push(&used, (Extent) { c->pages[i].chunk, CMP_CHUNKS(c->pages[i].len) });
+    }
+    if (rc != CHIDB_OK)
+        goto out;
+
+    qsort(used.ext, used.n, sizeof(Extent), cmp_cmpExtents);
+    c->end = CMP_CHUNKS(CMP_DATA_OFFSET);
+    for (uint32_t i = 0; i < used.n && rc == CHIDB_OK; i++)
+    {
+        if (used.ext[i].len == 0)
+            continue;
+        if (used.ext[i].start < c->end)
+            rc = CHIDB_ECORRUPT;
+        else if (used.ext[i].start > c->end)
+            rc = cmp_free(c, (Extent) { c->end, used.ext[i].start - c->end });
+        c->end = used.ext[i].start + used.ext[i].len;
+    }
+
+out:
+    free(used.ext);
+    free(maps[0]);
+    free(maps[1]);
+
+    return rc;
+}
+
+
+/*
+ * The backend
+ */
+
+/* Read page i (which must exist) into dst */
+static int cmp_readPage(Compressed *c, uint32_t i, uint8_t *dst)
+{
+    CompressedPage p = c->pages[i];
+    uint8_t *cbuf;
+    bool ok;
+
+    if (p.len == 0)
+    {
+        memset(dst, 0, c->page_size);
+        return CHIDB_OK;
+    }
+    if (p.len == c->page_size)
+        return pread(c->base.fd, dst, p.len, CMP_OFFSET(p.chunk)) == (ssize_t) p.len ? CHIDB_OK : CHIDB_EIO;
+
+    /* Reads can run in several threads at once (see
+     * chidb_Pager_setThreadsafe), so each uses its own buffer */
+    if ((cbuf = malloc(p.len)) == NULL)
+        return CHIDB_ENOMEM;
+    if (pread(c->base.fd, cbuf, p.len, CMP_OFFSET(p.chunk)) != (ssize_t) p.len)
+    {
+        free(cbuf);
+        return CHIDB_EIO;
+    }
+    ok = lz_decompress(cbuf, p.len, dst, c->page_size);
+    free(cbuf);
+
+    return ok ? CHIDB_OK : CHIDB_ECORRUPT;
+}
+
+/* Write page i to a new extent */
+static int cmp_writePage(Compressed *c, uint32_t i, const uint8_t *data)
+{
+    size_t len = lz_compress(data, c->page_size, c->cbuf, c->page_size - CMP_CHUNK);
+    const uint8_t *src = c->cbuf;
+    Extent e;
+    int rc;
+
+    if (len == 0)
+    {
+        len = c->page_size;
+        src = data;
+    }
+    if (i >= c->n_pages && (rc = cmp_grow(c, i + 1)) != CHIDB_OK)
+        return rc;
+
+    e.len = CMP_CHUNKS(len);
+    e.start = cmp_alloc(c, e.len);
+    if (pwrite(c->base.fd, src, len, CMP_OFFSET(e.start)) != (ssize_t) len)
+    {
+        cmp_free(c, e);
+        return CHIDB_EIO;
+    }
+
+    rc = cmp_release(c, i);
+    c->pages[i].chunk = e.start;
+    c->pages[i].len = len;
+    c->fresh[i / 8] |= 1 << (i % 8);
+
+    return rc;
+}
+
+static int cmp_read(PagerFile *pf, void *buf, size_t len, off_t offset, size_t *nread)
+{
+    Compressed *c = (Compressed *) pf;
+    uint8_t *out = buf, *page = NULL;
+    int rc = CHIDB_OK;
+
+    *nread = 0;
+    while (len > 0 && offset / c->page_size < c->n_pages)
+    {
+        uint32_t i = offset / c->page_size;
+        size_t skip = offset % c->page_size;
+        size_t n = len < c->page_size - skip ? len : c->page_size - skip;
+
+        if (n == c->page_size)
+            rc = cmp_readPage(c, i, out);
+        else if (page == NULL && (page = malloc(c->page_size)) == NULL)
+            rc = CHIDB_ENOMEM;
+        else if ((rc = cmp_readPage(c, i, page)) == CHIDB_OK)
+            memcpy(out, page + skip, n);
+        if (rc != CHIDB_OK)
+            break;
+
+        out += n;
+        offset += n;
+        len -= n;
+        *nread += n;
+    }
+    free(page);
+
+    return rc;
+}
+
+/* Write len bytes at offset. Pages that are only partly written are
+ * read first, into page (a scratch buffer of page_size bytes) */
+static int cmp_writeRange(Compressed *c, const uint8_t *data, size_t len, off_t offset, uint8_t **page)
+{
+    int rc = CHIDB_OK;
+
+    while (len > 0 && rc == CHIDB_OK)
+    {
+        uint32_t i = offset / c->page_size;
+        size_t skip = offset % c->page_size;
+        size_t n = len < c->page_size - skip ? len : c->page_size - skip;
+
+        if (n == c->page_size)
+            rc = cmp_writePage(c, i, data);
+        else if (*page == NULL && (*page = malloc(c->page_size)) == NULL)
+            rc = CHIDB_ENOMEM;
+        else
+        {
+            if (i < c->n_pages)
+                rc = cmp_readPage(c, i, *page);
+            else
+                memset(*page, 0, c->page_size);
+            memcpy(*page + skip, data, n);
+            if (rc == CHIDB_OK)
+                rc = cmp_writePage(c, i, *page);
+        }
+
+        data += n;
+        offset += n;
+        len -= n;
+    }
+
+    return rc;
+}
+
+static int cmp_write(PagerFile *pf, const PagerWrite *writes, uint32_t nwrites)
+{
+    Compressed *c = (Compressed *) pf;
+    uint8_t *page = NULL;
+    int rc = CHIDB_OK, mrc;
+
+    for (uint32_t i = 0; i < nwrites && rc == CHIDB_OK; i++)
+    {
+        off_t offset = writes[i].offset;
+
+        for (int j = 0; j < writes[i].iovcnt && rc == CHIDB_OK; j++)
+        {
+            rc = cmp_writeRange(c, writes[i].iov[j].iov_base, writes[i].iov[j].iov_len, offset, &page);
+            offset += writes[i].iov[j].iov_len;
+        }
+    }
+    free(page);
+
+    /* Whatever was written is in the map, even if not everything was */
+    mrc = cmp_writeMap(c);
+
+    return rc != CHIDB_OK ? rc : mrc;
+}
+
+static int cmp_sync(PagerFile *pf)
+{
+    Compressed *c = (Compressed *) pf;
+    int old = c->synced, rc;
+
+    if (fsync(pf->fd) != 0)
+        return CHIDB_EIO;
+    if (!c->changed)
+        return CHIDB_OK;
+
+    /* The other slot is now the current one, so what only the old
+     * one pointed to can be reused */
+    c->synced = 1 - old;
+    c->changed = false;
+    rc = cmp_push(&c->pending, c->map[old]);
+    c->map[old].start = c->map[old].len = 0;
+    if (cmp_freeAll(c, &c->pending) != CHIDB_OK)
+        rc = CHIDB_ENOMEM;
+    if (c->fresh != NULL)
+        memset(c->fresh, 0, c->cap / 8 + 1);
+
+    /* Cut off the free extents at the end */
+    if (c->free.n > 0 && c->free.ext[c->free.n - 1].start + c->free.ext[c->free.n - 1].len == c->end)
+    {
+        c->end = c->free.ext[--c->free.n].start;
+        if (ftruncate(pf->fd, CMP_OFFSET(c->end)) != 0)
+            return CHIDB_EIO;
+    }
+
+    return rc;
+}
+
+static int cmp_size(PagerFile *pf, off_t *size)
+{
+    Compressed *c = (Compressed *) pf;
+
+    *size = (off_t) c->n_pages * c->page_size;
+
+    return CHIDB_OK;
+}
+
+static int cmp_truncate(PagerFile *pf, off_t size)
+{
+    Compressed *c = (Compressed *) pf;
+    uint32_t n = (size + c->page_size - 1) / c->page_size;
+    int rc = CHIDB_OK;
+
+    if (n > c->n_pages)
+        rc = cmp_grow(c, n);
+    for (uint32_t i = n; i < c->n_pages; i++)
+        if (cmp_release(c, i) != CHIDB_OK)
+            rc = CHIDB_ENOMEM;
+    if (n < c->n_pages)
+        c->n_pages = n;
+
+    return rc == CHIDB_OK ? cmp_writeMap(c) : rc;
+}
+
+static int cmp_setPageSize(PagerFile *pf, uint32_t page_size)
+{
+    Compressed *c = (Compressed *) pf;
+    uint8_t *cbuf;
+
+    if (page_size == c->page_size)
+        return CHIDB_OK;
+    if (c->n_pages > 0)
+        return CHIDB_EMISUSE;
+
+    if ((cbuf = realloc(c->cbuf, page_size)) == NULL)
+        return CHIDB_ENOMEM;
+    c->cbuf = cbuf;
+    c->page_size = page_size;
+
+    return cmp_writeMap(c);
+}
+
+static void cmp_destroy(Compressed *c)
+{
+    free(c->pages);
+    free(c->fresh);
+    free(c->free.ext);
+    free(c->pending.ext);
+    free(c->retired.ext);
+    free(c->cbuf);
+    free(c);
+}
+
+/* The map must be synced before the extents it does not point to can
+ * be cut off the file, so closing the file syncs it */
+static void cmp_close(PagerFile *pf)
+{
+    cmp_sync(pf);
+    cmp_destroy((Compressed *) pf);
+}
+
+static const PagerFileMethods cmp_methods =
+{
+    cmp_read,
+    cmp_write,
+    cmp_sync,
+    cmp_size,
+    cmp_truncate,
+    cmp_close,
+    cmp_setPageSize,
+    NULL,
+    NULL,
+    NULL,
+    NULL
+};
+
+
+/* Open the compressed backend on a file
+ *
+ * If the file is empty, it is set up as a compressed file with no
+ * pages. Otherwise, it must already be one (see
+ * chidb_PagerFile_isCompressed), and its page map is loaded.
+ *
+ * Parameters
+ * - pf: Out parameter. Used to return the new PagerFile.
+ * - fd: Descriptor of the file.
+ * - page_size: Page size of a new file (ignored if the file is not
+ *              empty, since the page size is stored in it).
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_ECORRUPT: The file is not a valid compressed file
+ * - CHIDB_ENOMEM: Could not allocate memory
+ * - CHIDB_EIO: An I/O error has occurred when accessing the file
+ */
+int chidb_PagerFile_openCompressed(PagerFile **pf, int fd, uint32_t page_size)
+{
+    Compressed *c;
+    struct stat buf;
+    int rc;
+
+    if ((c = calloc(1, sizeof(Compressed))) == NULL)
+        return CHIDB_ENOMEM;
+    c->base.methods = &cmp_methods;
+    c->base.fd = fd;
+    c->end = CMP_CHUNKS(CMP_DATA_OFFSET);
+
+    if (fstat(fd, &buf) != 0)
+        rc = CHIDB_EIO;
+    else if (buf.st_size == 0)
+    {
+        /* Written to slot 0, which then becomes the synced one */
+        c->page_size = page_size;
+        c->synced = 1;
+        if ((rc = cmp_writeMap(c)) == CHIDB_OK)
+            rc = cmp_sync(&c->base);
+    }
+    else
+        rc = cmp_load(c);
+
+    if (rc == CHIDB_OK && (c->cbuf = malloc(c->page_size)) == NULL)
+        rc = CHIDB_ENOMEM;
+    if (rc != CHIDB_OK)
+    {
+        cmp_destroy(c);
+        return rc;
+    }
+    *pf = &c->base;
+
+    return CHIDB_OK;
+}
+
+
+/* Check whether a file is a compressed file
+ *
+ * Either slot may have been cut short when the file was last written,
+ * so the magic string is looked for in both. A file that starts with
+ * a chidb header is not compressed.
+ *
+ * Parameters
+ * - fd: Descriptor of the file.
+ *
+ * Return
+ * - true if the file is a compressed file
+ */
+bool chidb_PagerFile_isCompressed(int fd)
+{
+    char magic[16];
+
+    if (pread(fd, magic, 16, 0) != 16 || !memcmp(magic, "SQLite format 3", 16))
+        return false;
+    if (!memcmp(magic, CMP_MAGIC, 8))
+        return true;
+
+    return pread(fd, magic, 8, CMP_SLOT_STRIDE) == 8 && !memcmp(magic, CMP_MAGIC, 8);
+}
@@ -0,0 +1,199 @@
+/*
+ *  chidb - a didactic relational database management system
+ *
+ *  Pager I/O backends
+ *
+ */
+
+/*
+ *  Copyright (c) 2009-2015, The University of Chicago
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or withsend
+ *  modification, are permitted provided that the following conditions are met:
+ *
+ *  - Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ *  - Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ *  - Neither the name of The University of Chicago nor the names of its
+ *    contributors may be used to endorse or promote products derived from this
+ *    software withsend specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ *  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ *  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ *  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ *  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ *  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ *  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ *  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ *  ARISING IN ANY WAY send OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ *  POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+/*
+ * The Pager does not access its file directly. Reading and writing
+ * pages, syncing the file and getting its size go through a PagerFile,
+ * whose methods are implemented by an I/O backend:
+ *
+ * - The stdio backend (the default) does what the Pager has always
+ *   done: one pread or pwritev system call per request, which blocks
+ *   until the request is done.
+ *
+ * - The io_uring backend (Linux only; see pager-uring.c) submits every
+ *   write in a batch at once, and also supports asynchronous reads,
+ *   which the Pager uses for read-ahead: the reads are submitted into
+ *   buffer pool frames, and reaped when the page is needed.
+ *
+ * - The compressed backend (see pager-compress.c) stores each page
+ *   compressed, wherever it fits in the file, and keeps a table of where
+ *   every page is. The Pager still sees a file of fixed-size pages.
+ *
+ * - The memory backend (see pager-memory.c) keeps the pages of an
+ *   in-memory database in RAM. There is no file at all.
+ *
+ * Everything else the Pager does with the file (mapping it, locking it)
+ * still uses its descriptor, pf->fd, which is owned by the Pager and not
+ * closed by the backend. Neither is done with compressed files, or in
+ * memory.
+ */
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <chidb/chidb.h>
+#include "pager-file.h"
+
+
+static int stdio_read(PagerFile *pf, void *buf, size_t len, off_t offset, size_t *nread)
+{
+    ssize_t n = pread(pf->fd, buf, len, offset);
+
+    *nread = n > 0 ? n : 0;
+
+    return n < 0 ? CHIDB_EIO : CHIDB_OK;
+}
+
+static int stdio_write(PagerFile *pf, const PagerWrite *writes, uint32_t nwrites)
+{
+    for (uint32_t i = 0; i < nwrites; i++)
+    {
+        ssize_t len = 0;
+
+        for (int j = 0; j < writes[i].iovcnt; j++)
+            len += writes[i].iov[j].iov_len;
+        if (pwritev(pf->fd, writes[i].iov, writes[i].iovcnt, writes[i].offset) != len)
+            return CHIDB_EIO;
+    }
+
+    return CHIDB_OK;
+}
+
+static int stdio_sync(PagerFile *pf)
+{
+    return fsync(pf->fd) == 0 ? CHIDB_OK : CHIDB_EIO;
+}
+
+static int stdio_size(PagerFile *pf, off_t *size)
+{
+    struct stat buf;
+
+    if (fstat(pf->fd, &buf) != 0)
+        return CHIDB_EIO;
+    *size = buf.st_size;
+
+    return CHIDB_OK;
+}
+
+static int stdio_truncate(PagerFile *pf, off_t size)
+{
+    return ftruncate(pf->fd, size) == 0 ? CHIDB_OK : CHIDB_EIO;
+}
+
+static void stdio_close(PagerFile *pf)
+{
+    free(pf);
+}
+
+/* Space past the end of the file can only be reserved where fallocate
+ * can keep the size as it is (i.e., on Linux) */
+#ifdef FALLOC_FL_KEEP_SIZE
+static int stdio_reserve(PagerFile *pf, off_t offset, off_t len)
+{
+    return fallocate(pf->fd, FALLOC_FL_KEEP_SIZE, offset, len) == 0 ? CHIDB_OK : CHIDB_EIO;
+}
+#else
+#define stdio_reserve NULL
+#endif
+
+static const PagerFileMethods stdio_methods =
+{
+    stdio_read,
+    stdio_write,
+    stdio_sync,
+    stdio_size,
+    stdio_truncate,
+    stdio_close,
+    NULL,
+    NULL,
+    NULL,
+    NULL,
+    stdio_reserve
+};
+
+
+/* Open the stdio backend on a file
+ *
+ * Parameters
+ * - pf: Out parameter. Used to return the new PagerFile.
+ * - fd: Descriptor of the file.
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_ENOMEM: Could not allocate memory
+ */
+int chidb_PagerFile_openStdio(PagerFile **pf, int fd)
+{
+    if ((*pf = malloc(sizeof(PagerFile))) == NULL)
+        return CHIDB_ENOMEM;
+    (*pf)->methods = &stdio_methods;
+    (*pf)->fd = fd;
+
+    return CHIDB_OK;
+}
+
+
+/* Open a backend on a file
+ *
+ * Parameters
+ * - pf: Out parameter. Used to return the new PagerFile.
+ * - fd: Descriptor of the file.
+ * - backend: CHIDB_IO_STDIO or CHIDB_IO_URING
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_EMISUSE: Invalid backend
+ * - CHIDB_ENOMEM: Could not allocate memory
+ * - CHIDB_EIO: The backend is not available on this system
+ */
+int chidb_PagerFile_open(PagerFile **pf, int fd, int backend)
+{
+    switch (backend)
+    {
+        case CHIDB_IO_STDIO:
+            return chidb_PagerFile_openStdio(pf, fd);
+        case CHIDB_IO_URING:
+            return chidb_PagerFile_openUring(pf, fd);
+        default:
+            return CHIDB_EMISUSE;
+    }
+}
@@ -0,0 +1,98 @@
+/*
+ *  chidb - a didactic relational database management system
+ *
+ *  Pager I/O backends -- header
+ *
+ */
+
+/*
+ *  Copyright (c) 2009-2015, The University of Chicago
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or withsend
+ *  modification, are permitted provided that the following conditions are met:
+ *
+ *  - Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ *  - Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ *  - Neither the name of The University of Chicago nor the names of its
+ *    contributors may be used to endorse or promote products derived from this
+ *    software withsend specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ *  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ *  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ *  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ *  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ *  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ *  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ *  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ *  ARISING IN ANY WAY send OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ *  POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+#ifndef PAGER_FILE_H_
+#define PAGER_FILE_H_
+
+#include <sys/types.h>
+#include <sys/uio.h>
+#include "chidbInt.h"
+
+/* A vectored write: iovcnt buffers written one after another, starting
+ * at the given offset in the file */
+typedef struct PagerWrite
+{
+    struct iovec *iov;
+    int iovcnt;
+    off_t offset;
+} PagerWrite;
+
+typedef struct PagerFile PagerFile;
+
+/* The operations of an I/O backend (see pager-file.c for details) */
+typedef struct PagerFileMethods
+{
+    int (*read)(PagerFile *pf, void *buf, size_t len, off_t offset, size_t *nread);
+    int (*write)(PagerFile *pf, const PagerWrite *writes, uint32_t nwrites);
+    int (*sync)(PagerFile *pf);
+    int (*size)(PagerFile *pf, off_t *size);
+    int (*truncate)(PagerFile *pf, off_t size);
+    void (*close)(PagerFile *pf);
+
+    /* Told the page size whenever the Pager's changes. NULL if the
+     * backend does not care how the file is divided into pages */
+    int (*setPageSize)(PagerFile *pf, uint32_t page_size);
+
+    /* Asynchronous reads. NULL if the backend only does synchronous I/O */
+    int (*readAsync)(PagerFile *pf, void *buf, size_t len, off_t offset, void *tag);
+    int (*submit)(PagerFile *pf);
+    int (*complete)(PagerFile *pf, bool wait, void **tag, ssize_t *res);
+
+    /* Reserves disk space for len bytes from offset on, without changing
+     * the size of the file. NULL if the backend cannot */
+    int (*reserve)(PagerFile *pf, off_t offset, off_t len);
+} PagerFileMethods;
+
+/* The file a Pager reads and writes pages through. Backends embed
+ * this at the start of their own struct. */
+struct PagerFile
+{
+    const PagerFileMethods *methods;
+    int fd;
+};
+
+int chidb_PagerFile_open(PagerFile **pf, int fd, int backend);
+
+int chidb_PagerFile_openStdio(PagerFile **pf, int fd);
+int chidb_PagerFile_openUring(PagerFile **pf, int fd);
+int chidb_PagerFile_openCompressed(PagerFile **pf, int fd, uint32_t page_size);
+bool chidb_PagerFile_isCompressed(int fd);
+int chidb_PagerFile_openMemory(PagerFile **pf);
+
+#endif /* PAGER_FILE_H_ */
@@ -0,0 +1,241 @@
+/*
+ *  chidb - a didactic relational database management system
+ *
+ *  In-memory Pager I/O backend
+ *
+ */
+
+/*
+ *  Copyright (c) 2009-2015, The University of Chicago
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or withsend
+ *  modification, are permitted provided that the following conditions are met:
+ *
+ *  - Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ *  - Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ *  - Neither the name of The University of Chicago nor the names of its
+ *    contributors may be used to endorse or promote products derived from this
+ *    software withsend specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ *  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ *  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ *  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ *  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ *  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ *  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ *  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ *  ARISING IN ANY WAY send OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ *  POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+/*
+ * The memory backend keeps the "file" of an in-memory database (see
+ * chidb_Pager_open) in RAM: a growable array of fixed-size blocks,
+ * each allocated the first time something is written to it. A block
+ * that was never written (e.g., a page that was allocated but not yet
+ * written) reads as zeroes, like the hole in a sparse file would.
+ *
+ * There is no descriptor (pf->fd is -1), syncing does nothing, and the
+ * contents go away when the backend is closed. The Pager also uses it
+ * for the rollback journal of an in-memory database.
+ */
+
+#include <sys/types.h>
+#include <sys/uio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <chidb/chidb.h>
+#include "pager-file.h"
+
+#define MEM_BLOCK_SIZE (4096)
+
+typedef struct Memory
+{
+    PagerFile base;
+    uint8_t **blocks;       /* NULL for a block that was never written */
+    uint32_t n_blocks;      /* Entries allocated in blocks */
+    off_t size;
+} Memory;
+
+
+static int mem_read(PagerFile *pf, void *buf, size_t len, off_t offset, size_t *nread)
+{
+    Memory *m = (Memory *) pf;
+    uint8_t *dst = buf;
+
+    *nread = offset < m->size ? (size_t) (m->size - offset) : 0;
+    if (*nread > len)
+        *nread = len;
+
+    for (size_t done = 0; done < *nread; )
+    {
+        uint32_t block = (offset + done) / MEM_BLOCK_SIZE;
+        size_t at = (offset + done) % MEM_BLOCK_SIZE;
+        size_t n = MEM_BLOCK_SIZE - at < *nread - done ? MEM_BLOCK_SIZE - at : *nread - done;
+
+        if (m->blocks[block] != NULL)
+            memcpy(dst + done, m->blocks[block] + at, n);
+        else
+            memset(dst + done, 0, n);
+        done += n;
+    }
+
+    return CHIDB_OK;
+}
+
+/* Make room in the array for the blocks up to (not including) end */
+static int mem_grow(Memory *m, off_t end)
+{
+    uint32_t need = (end + MEM_BLOCK_SIZE - 1) / MEM_BLOCK_SIZE;
+    uint32_t cap = m->n_blocks > 0 ? m->n_blocks : 16;
+    uint8_t **blocks;
+
+    if (need <= m->n_blocks)
+        return CHIDB_OK;
+
+    while (cap < need)
+        cap *= 2;
+    if ((blocks = realloc(m->blocks, cap * sizeof(uint8_t *))) == NULL)
+        return CHIDB_ENOMEM;
+    memset(blocks + m->n_blocks, 0, (cap - m->n_blocks) * sizeof(uint8_t *));
+    m->blocks = blocks;
+    m->n_blocks = cap;
+
+    return CHIDB_OK;
+}
+
+static int mem_writeRange(Memory *m, const uint8_t *data, size_t len, off_t offset)
+{
+    int rc;
+
+    if ((rc = mem_grow(m, offset + len)) != CHIDB_OK)
+        return rc;
+
+    for (size_t done = 0; done < len; )
+    {
+        uint32_t block = (offset + done) / MEM_BLOCK_SIZE;
+        size_t at = (offset + done) % MEM_BLOCK_SIZE;
+        size_t n = MEM_BLOCK_SIZE - at < len - done ? MEM_BLOCK_SIZE - at : len - done;
+
+        if (m->blocks[block] == NULL && (m->blocks[block] = calloc(1, MEM_BLOCK_SIZE)) == NULL)
+            return CHIDB_ENOMEM;
+        memcpy(m->blocks[block] + at, data + done, n);
+        done += n;
+    }
+    if (offset + (off_t) len > m->size)
+        m->size = offset + len;
+
+    return CHIDB_OK;
+}
+
+static int mem_write(PagerFile *pf, const PagerWrite *writes, uint32_t nwrites)
+{
+    Memory *m = (Memory *) pf;
+    int rc;
+
+    for (uint32_t i = 0; i < nwrites; i++)
+    {
+        off_t offset = writes[i].offset;
+
+        for (int j = 0; j < writes[i].iovcnt; j++)
+        {
+            if ((rc = mem_writeRange(m, writes[i].iov[j].iov_base, writes[i].iov[j].iov_len, offset)) != CHIDB_OK)
+                return rc;
+            offset += writes[i].iov[j].iov_len;
+        }
+    }
+
+    return CHIDB_OK;
+}
+
+static int mem_sync(PagerFile *pf)
+{
+    return CHIDB_OK;
+}
+
+static int mem_size(PagerFile *pf, off_t *size)
+{
+    *size = ((Memory *) pf)->size;
+
+    return CHIDB_OK;
+}
+
+/* The blocks past the new end are freed, and the rest of the last block
+ * is cleared, so that the file reads as zeroes if it grows again */
+static int mem_truncate(PagerFile *pf, off_t size)
+{
+    Memory *m = (Memory *) pf;
+    uint32_t keep = (size + MEM_BLOCK_SIZE - 1) / MEM_BLOCK_SIZE;
+
+    if (size < m->size)
+    {
+        for (uint32_t i = keep; i < m->n_blocks; i++)
+        {
+            free(m->blocks[i]);
+            m->blocks[i] = NULL;
+        }
+        if (size % MEM_BLOCK_SIZE != 0 && m->blocks[keep - 1] != NULL)
+            memset(m->blocks[keep - 1] + size % MEM_BLOCK_SIZE, 0, MEM_BLOCK_SIZE - size % MEM_BLOCK_SIZE);
+    }
+    m->size = size;
+
+    return CHIDB_OK;
+}
+
+static void mem_close(PagerFile *pf)
+{
+    Memory *m = (Memory *) pf;
+
+    for (uint32_t i = 0; i < m->n_blocks; i++)
+        free(m->blocks[i]);
+    free(m->blocks);
+    free(m);
+}
+
+static const PagerFileMethods mem_methods =
+{
+    mem_read,
+    mem_write,
+    mem_sync,
+    mem_size,
+    mem_truncate,
+    mem_close,
+    NULL,
+    NULL,
+    NULL,
+    NULL,
+    NULL
+};
+
+
+/* Open the memory backend, on a new, empty file
+ *
+ * Parameters
+ * - pf: Out parameter. Used to return the new PagerFile.
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_ENOMEM: Could not allocate memory
+ */
+int chidb_PagerFile_openMemory(PagerFile **pf)
+{
+    Memory *m;
+
+    if ((m = calloc(1, sizeof(Memory))) == NULL)
+        return CHIDB_ENOMEM;
+    m->base.methods = &mem_methods;
+    m->base.fd = -1;
+    *pf = &m->base;
+
+    return CHIDB_OK;
+}
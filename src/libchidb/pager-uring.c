@@ -0,0 +1,448 @@
+/*
+ *  chidb - a didactic relational database management system
+ *
+ *  io_uring Pager I/O backend
+ *
+ */
+
+/*
+ *  Copyright (c) 2009-2015, The University of Chicago
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or withsend
+ *  modification, are permitted provided that the following conditions are met:
+ *
+ *  - Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ *  - Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ *  - Neither the name of The University of Chicago nor the names of its
+ *    contributors may be used to endorse or promote products derived from this
+ *    software withsend specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ *  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ *  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ *  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ *  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ *  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ *  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ *  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ *  ARISING IN ANY WAY send OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ *  POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+/*
+ * An io_uring instance is a pair of ring buffers shared with the
+ * kernel: requests are queued in the submission queue, and the kernel
+ * posts their results to the completion queue. Any number of requests
+ * can be submitted with a single system call, and they are then carried
+ * out concurrently, keeping the device busy.
+ *
+ * The rings are used directly through the system calls (liburing is
+ * not needed). At most URING_ENTRIES requests are queued or in flight at
+ * any time, which is also the size of the submission queue; the kernel
+ * makes the completion queue twice as large, so it never overflows.
+ *
+ * Writes are submitted all at once, and waited for before returning.
+ * Asynchronous reads are queued by readAsync, submitted by submit, and
+ * their completions are returned by complete with the caller's tag.
+ * Reads that complete while a batch of writes is being waited for are
+ * kept until complete is called. Synchronous reads, sync, size,
+ * truncate and reserve do not gain anything from the ring, and use plain
+ * system calls.
+ *
+ * If the system has no io_uring, chidb_PagerFile_openUring fails with
+ * CHIDB_EIO (and the Pager keeps using the stdio backend).
+ */
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <chidb/chidb.h>
+#include "pager-file.h"
+
+#if defined(__linux__) && defined(__has_include)
+#if __has_include(<linux/io_uring.h>)
+#define HAVE_IO_URING
+#endif
+#endif
+
+#ifdef HAVE_IO_URING
+
+#include <linux/io_uring.h>
+
+#define URING_ENTRIES (64)
+
+/* The user_data of a write is the address of its PagerWrite with the
+ * low bit set, so that it cannot be mistaken for the tag of a read */
+#define URING_WRITE_BIT ((uint64_t) 1)
+
+typedef struct Uring
+{
+    PagerFile base;
+    int ring_fd;
+
+    /* Submission queue */
+    unsigned *sq_head, *sq_tail, *sq_mask, *sq_array;
+    struct io_uring_sqe *sqes;
+
+    /* Completion queue */
+    unsigned *cq_head, *cq_tail, *cq_mask;
+    struct io_uring_cqe *cqes;
+
+    void *sq_ring, *cq_ring;
+    size_t sq_ring_size, cq_ring_size;
+
+    uint32_t queued;        /* In the submission queue, not submitted yet */
+    uint32_t in_flight;     /* Submitted, not reaped yet */
+
+    /* Reads reaped while waiting for writes */
+    struct
+    {
+        void *tag;
+        ssize_t res;
+    } done[URING_ENTRIES];
+    uint32_t n_done;
+} Uring;
+
+
+/* Submit the queued requests, and wait until at least min_complete
+ * completions are available */
+static int uring_enter(Uring *u, unsigned min_complete)
+{
+    int n;
+
+    do
+        n = syscall(__NR_io_uring_enter, u->ring_fd, u->queued, min_complete,
+                    min_complete > 0 ? IORING_ENTER_GETEVENTS : 0, NULL, 0);
+    while (n < 0 && errno == EINTR);
+
+    if (n < 0)
+        return CHIDB_EIO;
+    u->queued -= n;
+    u->in_flight += n;
+
+    return CHIDB_OK;
+}
+
+/* Get the next free entry in the submission queue (NULL if there is
+ * none). uring_push queues it once it has been filled in. */
+static struct io_uring_sqe *uring_sqe(Uring *u)
+{
+    unsigned tail = *u->sq_tail;
+    unsigned index = tail & *u->sq_mask;
+
+    if (u->queued + u->in_flight == URING_ENTRIES
+            || tail - __atomic_load_n(u->sq_head, __ATOMIC_ACQUIRE) == URING_ENTRIES)
+        return NULL;
+
+    memset(&u->sqes[index], 0, sizeof(struct io_uring_sqe));
+    u->sq_array[index] = index;
+
+    return &u->sqes[index];
+}
+
+static void uring_push(Uring *u)
+{
+    __atomic_store_n(u->sq_tail, *u->sq_tail + 1, __ATOMIC_RELEASE);
+    u->queued++;
+}
+
+/* Take one completion off the completion queue (false if it is empty) */
+static bool uring_reap(Uring *u, uint64_t *data, int32_t *res)
+{
+    unsigned head = *u->cq_head;
+
+    if (head == __atomic_load_n(u->cq_tail, __ATOMIC_ACQUIRE))
+        return false;
+
+    *data = u->cqes[head & *u->cq_mask].user_data;
+    *res = u->cqes[head & *u->cq_mask].res;
+    __atomic_store_n(u->cq_head, head + 1, __ATOMIC_RELEASE);
+    u->in_flight--;
+
+    return true;
+}
+
+
+static int uring_read(PagerFile *pf, void *buf, size_t len, off_t offset, size_t *nread)
+{
+    ssize_t n = pread(pf->fd, buf, len, offset);
+
+    *nread = n > 0 ? n : 0;
+
+    return n < 0 ? CHIDB_EIO : CHIDB_OK;
+}
+
+static int uring_write(PagerFile *pf, const PagerWrite *writes, uint32_t nwrites)
+{
+    Uring *u = (Uring *) pf;
+    uint32_t submitted = 0, completed = 0;
+    int rc = CHIDB_OK;
+
+    while (completed < nwrites)
+    {
+        struct io_uring_sqe *sqe;
+
+        while (submitted < nwrites && (sqe = uring_sqe(u)) != NULL)
+        {
+            sqe->opcode = IORING_OP_WRITEV;
+            sqe->fd = pf->fd;
+            sqe->addr = (uintptr_t) writes[submitted].iov;
+            sqe->len = writes[submitted].iovcnt;
+            sqe->off = writes[submitted].offset;
+            sqe->user_data = (uintptr_t) &writes[submitted] | URING_WRITE_BIT;
+            uring_push(u);
+            submitted++;
+        }
+
+        if (uring_enter(u, 1) != CHIDB_OK)
+            return CHIDB_EIO;
+
+        uint64_t data;
+        int32_t res;
+        while (uring_reap(u, &data, &res))
+        {
+            if (data & URING_WRITE_BIT)
+            {
+                const PagerWrite *w = (const PagerWrite *) (uintptr_t) (data & ~URING_WRITE_BIT);
+                ssize_t len = 0;
+
+                for (int j = 0; j < w->iovcnt; j++)
+                    len += w->iov[j].iov_len;
+                if (res != len)
+                    rc = CHIDB_EIO;
+                completed++;
+            }
+            else
+            {
+                u->done[u->n_done].tag = (void *) (uintptr_t) data;
+                u->done[u->n_done].res = res;
+                u->n_done++;
+            }
+        }
+    }
+
+    return rc;
+}
+
+static int uring_sync(PagerFile *pf)
+{
+    return fsync(pf->fd) == 0 ? CHIDB_OK : CHIDB_EIO;
+}
+
+static int uring_truncate(PagerFile *pf, off_t size)
+{
+    return ftruncate(pf->fd, size) == 0 ? CHIDB_OK : CHIDB_EIO;
+}
+
+#ifdef FALLOC_FL_KEEP_SIZE
+static int uring_reserve(PagerFile *pf, off_t offset, off_t len)
+{
+    return fallocate(pf->fd, FALLOC_FL_KEEP_SIZE, offset, len) == 0 ? CHIDB_OK : CHIDB_EIO;
+}
+#else
+#define uring_reserve NULL
+#endif
+
+static int uring_size(PagerFile *pf, off_t *size)
+{
+    struct stat buf;
+
+    if (fstat(pf->fd, &buf) != 0)
+        return CHIDB_EIO;
+    *size = buf.st_size;
+
+    return CHIDB_OK;
+}
+
+/* Queue an asynchronous read. Return CHIDB_EBUSY if the ring is full */
+static int uring_readAsync(PagerFile *pf, void *buf, size_t len, off_t offset, void *tag)
+{
+    Uring *u = (Uring *) pf;
+    struct io_uring_sqe *sqe = uring_sqe(u);
+
+    if (sqe == NULL)
+        return CHIDB_EBUSY;
+
+    sqe->opcode = IORING_OP_READ;
+    sqe->fd = pf->fd;
+    sqe->addr = (uintptr_t) buf;
+    sqe->len = len;
+    sqe->off = offset;
+    sqe->user_data = (uintptr_t) tag;
+    uring_push(u);
+
+    return CHIDB_OK;
+}
+
+static int uring_submit(PagerFile *pf)
+{
+    Uring *u = (Uring *) pf;
+
+    return u->queued > 0 ? uring_enter(u, 0) : CHIDB_OK;
+}
+
+/* Return the tag and result of a completed read. If none has completed,
+ * wait for one if wait is true; otherwise (or if no read is pending)
+ * return CHIDB_EEMPTY */
+static int uring_complete(PagerFile *pf, bool wait, void **tag, ssize_t *res)
+{
+    Uring *u = (Uring *) pf;
+    uint64_t data;
+    int32_t res32;
+    int rc;
+
+    if (u->n_done > 0)
+    {
+        u->n_done--;
+        *tag = u->done[u->n_done].tag;
+        *res = u->done[u->n_done].res;
+        return CHIDB_OK;
+    }
+
+    while (!uring_reap(u, &data, &res32))
+    {
+        if (!wait || u->queued + u->in_flight == 0)
+            return CHIDB_EEMPTY;
+        if ((rc = uring_enter(u, 1)) != CHIDB_OK)
+            return rc;
+    }
+    *tag = (void *) (uintptr_t) data;
+    *res = res32;
+
+    return CHIDB_OK;
+}
+
+static void uring_close(PagerFile *pf)
+{
+    Uring *u = (Uring *) pf;
+    void *tag;
+    ssize_t res;
+
+    /* The kernel may still be writing into the caller's buffers */
+    while (uring_complete(pf, true, &tag, &res) == CHIDB_OK)
+        ;
+
+    munmap(u->sqes, URING_ENTRIES * sizeof(struct io_uring_sqe));
+    if (u->cq_ring != u->sq_ring)
+        munmap(u->cq_ring, u->cq_ring_size);
+    munmap(u->sq_ring, u->sq_ring_size);
+    close(u->ring_fd);
+    free(u);
+}
+
+static const PagerFileMethods uring_methods =
+{
+    uring_read,
+    uring_write,
+    uring_sync,
+    uring_size,
+    uring_truncate,
+    uring_close,
+    NULL,
+    uring_readAsync,
+    uring_submit,
+    uring_complete,
+    uring_reserve
+};
+
+
+/* Open the io_uring backend on a file
+ *
+ * Parameters
+ * - pf: Out parameter. Used to return the new PagerFile.
+ * - fd: Descriptor of the file.
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_ENOMEM: Could not allocate memory
+ * - CHIDB_EIO: io_uring is not available
+ */
+int chidb_PagerFile_openUring(PagerFile **pf, int fd)
+{
+    struct io_uring_params p;
+    Uring *u;
+
+    if ((u = calloc(1, sizeof(Uring))) == NULL)
+        return CHIDB_ENOMEM;
+
+    memset(&p, 0, sizeof(p));
+    if ((u->ring_fd = syscall(__NR_io_uring_setup, URING_ENTRIES, &p)) < 0)
+    {
+        free(u);
+        return CHIDB_EIO;
+    }
+
+    /* With IORING_FEAT_SINGLE_MMAP, both rings share one mapping */
+    u->sq_ring_size = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    u->cq_ring_size = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+    if ((p.features & IORING_FEAT_SINGLE_MMAP) && u->cq_ring_size > u->sq_ring_size)
+        u->sq_ring_size = u->cq_ring_size;
+
+    u->sq_ring = mmap(NULL, u->sq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                      u->ring_fd, IORING_OFF_SQ_RING);
+    if (u->sq_ring == MAP_FAILED)
+    {
+        close(u->ring_fd);
+        free(u);
+        return CHIDB_EIO;
+    }
+
+    if (p.features & IORING_FEAT_SINGLE_MMAP)
+        u->cq_ring = u->sq_ring;
+    else
+        u->cq_ring = mmap(NULL, u->cq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                          u->ring_fd, IORING_OFF_CQ_RING);
+    u->sqes = mmap(NULL, p.sq_entries * sizeof(struct io_uring_sqe), PROT_READ | PROT_WRITE,
+                   MAP_SHARED | MAP_POPULATE, u->ring_fd, IORING_OFF_SQES);
+    if (u->cq_ring == MAP_FAILED || u->sqes == MAP_FAILED || p.sq_entries != URING_ENTRIES)
+    {
+        if (u->sqes != MAP_FAILED)
+            munmap(u->sqes, p.sq_entries * sizeof(struct io_uring_sqe));
+        if (u->cq_ring != MAP_FAILED && u->cq_ring != u->sq_ring)
+            munmap(u->cq_ring, u->cq_ring_size);
+        munmap(u->sq_ring, u->sq_ring_size);
+        close(u->ring_fd);
+        free(u);
+        return CHIDB_EIO;
+    }
+
+    u->sq_head = (unsigned *) ((uint8_t *) u->sq_ring + p.sq_off.head);
+    u->sq_tail = (unsigned *) ((uint8_t *) u->sq_ring + p.sq_off.tail);
+    u->sq_mask = (unsigned *) ((uint8_t *) u->sq_ring + p.sq_off.ring_mask);
+    u->sq_array = (unsigned *) ((uint8_t *) u->sq_ring + p.sq_off.array);
+    u->cq_head = (unsigned *) ((uint8_t *) u->cq_ring + p.cq_off.head);
+    u->cq_tail = (unsigned *) ((uint8_t *) u->cq_ring + p.cq_off.tail);
+    u->cq_mask = (unsigned *) ((uint8_t *) u->cq_ring + p.cq_off.ring_mask);
+    u->cqes = (struct io_uring_cqe *) ((uint8_t *) u->cq_ring + p.cq_off.cqes);
+
+    u->base.methods = &uring_methods;
+    u->base.fd = fd;
+    *pf = &u->base;
+
+    return CHIDB_OK;
+}
+
+#else /* !HAVE_IO_URING */
+
+int chidb_PagerFile_openUring(PagerFile **pf, int fd)
+{
+    return CHIDB_EIO;
+}
+
+#endif /* HAVE_IO_URING */
@@ -55,6 +55,11 @@
 #include <stdlib.h>
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <sys/mman.h>
+#include <sys/uio.h>
+#include <sys/file.h>
+#include <fcntl.h>
+#include <limits.h>
 #include <unistd.h>
 #include <stdio.h>
 
@@ -63,175 +68,2628 @@
 #include "chidbInt.h"
 
 #include "pager.h"
+#include "wal.h"
+#include "util.h"
+
+/* The rollback journal starts with a header (the magic string, the page
+ * size and the number of pages in the file when the transaction began),
+ * followed by one record per page: its number, its original contents,
+ * and a checksum of both. */
+#define JOURNAL_MAGIC "chidbjnl"
+#define JOURNAL_HEADER_SIZE (16)
+#define JOURNAL_RECORD_SIZE(page_size) (4 + (page_size) + 4)
+
+static int chidb_Pager_recover(Pager *pager);
+static int chidb_Pager_writeBack(Pager *pager, bool end);
+static void chidb_Pager_drain(Pager *pager);
+static bool chidb_Pager_readAsync(Pager *pager, npage_t npage);
 
 /* Open a file
  *
- * This function opens a file for paged access.
+ * This function opens a file for paged access.
+ *
+ * If the filename is ":memory:" (MEMORY_FILENAME), there is no file: the
+ * pages are kept in RAM by the memory backend (see pager-memory.c), and
+ * are gone once the Pager is closed. Such a Pager cannot be memory-mapped,
+ * compressed or put in WAL mode, and its rollback journal is also kept
+ * in memory.
+ *
+ * Parameters
+ * - pager: An out parameter. Used to return a pointer to the
+ *			 newly created Pager.
+ * - filename: Database file (might not exist), or ":memory:"
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_ENOMEM: Could not allocate memory
+ * - CHIDB_EIO: An I/O error has occurred when accessing the file
+ */
+int chidb_Pager_open(Pager **pager, const char *filename)
+{
+    int rc;
+
+    *pager = malloc(sizeof(Pager));
+    if (*pager == NULL)
+        return CHIDB_ENOMEM;
+    (*pager)->frames = NULL;
+    (*pager)->frame_data = NULL;
+    (*pager)->frame_hash = NULL;
+    (*pager)->hash_mask = 0;
+    (*pager)->n_frames = 0;
+    (*pager)->cache_size = DEFAULT_CACHE_SIZE;
+    (*pager)->clock_hand = 0;
+    (*pager)->n_pending = 0;
+    (*pager)->generation = 0;
+    (*pager)->nowait = false;
+    (*pager)->wait_page = 0;
+    memset(&(*pager)->stats, 0, sizeof(PagerStats));
+    (*pager)->n_pages = 0;
+    (*pager)->page_size = 0;
+    (*pager)->map = NULL;
+    (*pager)->map_size = 0;
+    (*pager)->readahead = DEFAULT_READAHEAD;
+    (*pager)->preallocation = DEFAULT_PREALLOCATION;
+    (*pager)->reserved_pages = 0;
+    (*pager)->journal = NULL;
+    (*pager)->changed = NULL;
+    (*pager)->changed_pages = 0;
+    (*pager)->in_txn = false;
+    (*pager)->journaled = NULL;
+    (*pager)->in_stmt = false;
+    (*pager)->stmt_journal = NULL;
+    (*pager)->stmt_journaled = NULL;
+    (*pager)->wal = NULL;
+    (*pager)->threadsafe = false;
+    (*pager)->compressed = false;
+    (*pager)->memory = strcmp(filename, MEMORY_FILENAME) == 0;
+    (*pager)->f = NULL;
+    pthread_mutex_init(&(*pager)->mutex, NULL);
+    (*pager)->commit_seq = 0;
+    (*pager)->synced_seq = 0;
+    (*pager)->group_syncs = 0;
+    (*pager)->syncing = false;
+    (*pager)->commit_delay = 0;
+    pthread_cond_init(&(*pager)->synced, NULL);
+    (*pager)->filename = strdup(filename);
+    (*pager)->journal_name = malloc(strlen(filename) + strlen("-journal") + 1);
+    if ((*pager)->filename == NULL || (*pager)->journal_name == NULL)
+        return CHIDB_ENOMEM;
+    sprintf((*pager)->journal_name, "%s-journal", filename);
+
+    if ((*pager)->memory)
+        return chidb_PagerFile_openMemory(&(*pager)->file);
+
+    (*pager)->f = fopen(filename, "r+");
+
+    if ((*pager)->f == NULL)
+        (*pager)->f = fopen(filename, "w+");
+
+    if ((*pager)->f == NULL)
+        return CHIDB_EIO;
+
+    /* Compressed files are recognized by their contents */
+    if (chidb_PagerFile_isCompressed(fileno((*pager)->f)))
+    {
+        rc = chidb_PagerFile_openCompressed(&(*pager)->file, fileno((*pager)->f), 0);
+        (*pager)->compressed = true;
+    }
+    else
+        rc = chidb_PagerFile_openStdio(&(*pager)->file, fileno((*pager)->f));
+    if (rc != CHIDB_OK)
+        return rc;
+
+    /* A transaction that did not finish may have left its journal behind */
+    return chidb_Pager_recover(*pager);
+}
+
+
+/* Free the buffer pool
+ *
+ * Flushes any dirty pages, and then frees every frame in the buffer pool,
+ * regardless of whether it is pinned. The pool will be allocated again on
+ * the next read.
+ *
+ * Parameters
+ * - pager: A Pager.
+ */
+static void chidb_Pager_freePool(Pager *pager)
+{
+    chidb_Pager_drain(pager);
+    chidb_Pager_flush(pager);
+    for (uint32_t i = 0; i < pager->n_frames; i++)
+        pthread_rwlock_destroy(&pager->frames[i].latch);
+    free(pager->frames);
+    free(pager->frame_data);
+    free(pager->frame_hash);
+    pager->frames = NULL;
+    pager->frame_data = NULL;
+    pager->frame_hash = NULL;
+    pager->hash_mask = 0;
+    pager->n_frames = 0;
+    pager->clock_hand = 0;
+}
+
+
+/* Check whether any frame in the buffer pool is pinned
+ *
+ * Parameters
+ * - pager: A Pager.
+ *
+ * Return
+ * - true if at least one frame has a non-zero pin count
+ */
+bool chidb_Pager_hasPinnedFrames(Pager *pager)
+{
+    for (uint32_t i = 0; i < pager->n_frames; i++)
+        if (pager->frames[i].pin_count > 0)
+            return true;
+
+    return false;
+}
+
+
+/* Allocate the buffer pool
+ *
+ * Allocates cache_size frames of page_size bytes each. Does nothing
+ * if the pool already exists or if caching is disabled.
+ *
+ * Parameters
+ * - pager: A Pager.
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_ENOMEM: Could not allocate memory
+ */
+static int chidb_Pager_initPool(Pager *pager)
+{
+    if (pager->frames != NULL || pager->cache_size == 0)
+        return CHIDB_OK;
+
+    /* At least twice as many buckets as frames keeps the chains short */
+    uint32_t nbuckets = 2;
+    while (nbuckets < 2 * pager->cache_size && nbuckets < (1u << 31))
+        nbuckets *= 2;
+
+    pager->frames = calloc(pager->cache_size, sizeof(MemPage));
+    pager->frame_data = malloc((size_t) pager->cache_size * pager->page_size);
+    pager->frame_hash = calloc(nbuckets, sizeof(uint32_t));
+    pager->hash_mask = nbuckets - 1;
+    if (pager->frames == NULL || pager->frame_data == NULL || pager->frame_hash == NULL)
+    {
+        chidb_Pager_freePool(pager);
+        return CHIDB_ENOMEM;
+    }
+
+    for (uint32_t i = 0; i < pager->cache_size; i++)
+    {
+        pager->frames[i].npage = 0;
+        pager->frames[i].data = pager->frame_data + (size_t) i * pager->page_size;
+        pager->frames[i].size = pager->page_size;
+        pager->frames[i].pin_count = 0;
+        pager->frames[i].referenced = false;
+        pager->frames[i].pooled = true;
+        pager->frames[i].mapped = false;
+        pager->frames[i].dirty = false;
+        pager->frames[i].pending = false;
+        pager->frames[i].hash_next = 0;
+        pthread_rwlock_init(&pager->frames[i].latch, NULL);
+    }
+    pager->n_frames = pager->cache_size;
+    pager->clock_hand = 0;
+
+    return CHIDB_OK;
+}
+
+
+/* Look up a page in the buffer pool
+ *
+ * Parameters
+ * - pager: A Pager.
+ * - npage: Page number to look for.
+ *
+ * Return
+ * - The frame holding npage, or NULL if the page is not cached.
+ */
+static MemPage *chidb_Pager_findFrame(Pager *pager, npage_t npage)
+{
+    if (pager->frame_hash == NULL)
+        return NULL;
+
+    for (uint32_t i = pager->frame_hash[npage & pager->hash_mask]; i != 0; i = pager->frames[i - 1].hash_next)
+        if (pager->frames[i - 1].npage == npage)
+            return &pager->frames[i - 1];
+
+    return NULL;
+}
+
+
+/* Change the page a frame of the buffer pool holds
+ *
+ * Every frame of the pool must have its page number set through this
+ * function, so that chidb_Pager_findFrame can find it.
+ *
+ * Parameters
+ * - pager: A Pager.
+ * - frame: A frame in the buffer pool.
+ * - npage: Page number (0 to empty the frame).
+ */
+static void chidb_Pager_setFrame(Pager *pager, MemPage *frame, npage_t npage)
+{
+    uint32_t self = (uint32_t) (frame - pager->frames) + 1;
+    uint32_t *link;
+
+    if (frame->npage == npage)
+        return;
+
+    if (frame->npage != 0)
+    {
+        for (link = &pager->frame_hash[frame->npage & pager->hash_mask]; *link != self;
+             link = &pager->frames[*link - 1].hash_next)
+            ;
+        *link = frame->hash_next;
+        frame->hash_next = 0;
+    }
+
+    frame->npage = npage;
+    if (npage != 0)
+    {
+        link = &pager->frame_hash[npage & pager->hash_mask];
+        frame->hash_next = *link;
+        *link = self;
+    }
+}
+
+
+/* Pick a frame to evict using the CLOCK algorithm
+ *
+ * Sweeps the frames starting at the clock hand, clearing reference bits,
+ * until an unpinned frame with a clear reference bit is found. Two full
+ * sweeps are enough to find a victim if one exists.
+ *
+ * Parameters
+ * - pager: A Pager.
+ *
+ * Return
+ * - A free or evictable frame, or NULL if every frame is pinned (or
+ *   being read asynchronously).
+ */
+static MemPage *chidb_Pager_victimFrame(Pager *pager)
+{
+    for (uint32_t n = 0; n < 2 * pager->n_frames; n++)
+    {
+        MemPage *frame = &pager->frames[pager->clock_hand];
+        pager->clock_hand = (pager->clock_hand + 1) % pager->n_frames;
+
+        if (frame->pin_count > 0 || frame->pending)
+            continue;
+
+        if (frame->referenced && frame->npage != 0)
+            frame->referenced = false;
+        else
+            return frame;
+    }
+
+    return NULL;
+}
+
+
+/* Check whether a page lies inside the memory-mapped region
+ *
+ * Parameters
+ * - pager: A Pager.
+ * - npage: Page number.
+ *
+ * Return
+ * - true if the page can be accessed through pager->map
+ */
+static bool chidb_Pager_isMapped(Pager *pager, npage_t npage)
+{
+    return pager->map != NULL && (size_t) npage * pager->page_size <= pager->map_size;
+}
+
+
+/* Make a page's contents available in memory
+ *
+ * If the page is inside the memory-mapped region, the page's data
+ * simply points into the mapping. Otherwise, the page is read from the
+ * file into buf. Pages that have been allocated but not written yet lie
+ * beyond the end of the file; the part of the page that could not be
+ * read is zeroed.
+ *
+ * Parameters
+ * - pager: A Pager.
+ * - page: MemPage (with npage set) to fill in.
+ * - buf: Buffer of page_size bytes to read into if the page is not mapped
+ *        (or if it is in the write-ahead log).
+ */
+static void chidb_Pager_fillPage(Pager *pager, MemPage *page, uint8_t *buf)
+{
+    size_t n = 0;
+    uint32_t frame;
+
+    /* In WAL mode, the log has the latest version of the page */
+    if (pager->wal != NULL && (frame = chidb_Wal_findFrame(pager->wal, page->npage)) != 0)
+    {
+        page->data = buf;
+        page->mapped = false;
+        if (chidb_Wal_readFrame(pager->wal, frame, page->data) != CHIDB_OK)
+            memset(page->data, 0, pager->page_size);
+        return;
+    }
+
+    if (chidb_Pager_isMapped(pager, page->npage))
+    {
+        page->data = pager->map + (size_t) (page->npage - 1) * pager->page_size;
+        page->mapped = true;
+        return;
+    }
+
+    page->data = buf;
+    page->mapped = false;
+    pager->file->methods->read(pager->file, page->data, pager->page_size, (off_t) (page->npage - 1) * pager->page_size, &n);
+    CHIDB_COUNT(pager->stats.bytes_read, n);
+    if (n < pager->page_size)
+        memset(page->data + n, 0, pager->page_size - n);
+
+    chilog(TRACE, "Read %i bytes from page %i into memory [%x data: %x]", n, page->npage, page, page->data);
+}
+
+
+/* Reap the completion of an asynchronous read (see chidb_Pager_prefetch)
+ *
+ * The frame the read was for is ready to be used. If the read failed, the
+ * frame is dropped instead, and the page will be read again when needed.
+ *
+ * Parameters
+ * - pager: A Pager.
+ * - wait: Whether to wait if no read has completed yet.
+ *
+ * Return
+ * - CHIDB_OK: A read has completed
+ * - CHIDB_EEMPTY: No read has completed (and wait is false)
+ * - CHIDB_EIO: An I/O error has occurred when waiting for the read
+ */
+static int chidb_Pager_completeRead(Pager *pager, bool wait)
+{
+    MemPage *frame;
+    ssize_t res;
+    int rc;
+
+    if ((rc = pager->file->methods->complete(pager->file, wait, (void **) &frame, &res)) != CHIDB_OK)
+        return rc;
+
+    frame->pending = false;
+    pager->n_pending--;
+    if (res < 0)
+    {
+        chidb_Pager_setFrame(pager, frame, 0);
+        frame->referenced = false;
+    }
+    else if (res < pager->page_size)
+        memset(frame->data + res, 0, pager->page_size - res);
+
+    return CHIDB_OK;
+}
+
+
+/* Wait until a frame's asynchronous read, if any, has completed
+ *
+ * Parameters
+ * - pager: A Pager.
+ * - frame: A frame in the buffer pool.
+ *
+ * Return
+ * - CHIDB_OK: Operation successful (but note that, if the read failed,
+ *             the frame no longer holds the page)
+ * - CHIDB_EIO: An I/O error has occurred when waiting for the read
+ */
+static int chidb_Pager_awaitFrame(Pager *pager, MemPage *frame)
+{
+    int rc;
+
+    while (frame->pending)
+        if ((rc = chidb_Pager_completeRead(pager, true)) != CHIDB_OK)
+            return rc;
+
+    return CHIDB_OK;
+}
+
+
+/* Wait for every asynchronous read to complete */
+static void chidb_Pager_drain(Pager *pager)
+{
+    while (pager->n_pending > 0)
+        if (chidb_Pager_completeRead(pager, true) != CHIDB_OK)
+            break;
+}
+
+
+/* Extend the file so that it covers every allocated page
+ *
+ * Accessing a mapped page past the end of the file raises SIGBUS, so
+ * in mmap mode the file must always be at least n_pages long.
+ *
+ * Parameters
+ * - pager: A Pager.
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_EIO: An I/O error has occurred when accessing the file
+ */
+static int chidb_Pager_extendFile(Pager *pager)
+{
+    off_t cur, size = (off_t) pager->n_pages * pager->page_size;
+
+    if (pager->file->methods->size(pager->file, &cur) != CHIDB_OK)
+        return CHIDB_EIO;
+    if (cur < size && pager->file->methods->truncate(pager->file, size) != CHIDB_OK)
+        return CHIDB_EIO;
+
+    return CHIDB_OK;
+}
+
+
+/* Drop the private changes to the memory-mapped region
+ *
+ * Mapped pages that were written to have a private copy, which hides
+ * whatever is in the file from then on. Mapping the file again (at the
+ * same address, so that outstanding MemPages stay valid) drops them.
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_EIO: The file could not be mapped
+ */
+static int chidb_Pager_remap(Pager *pager)
+{
+    if (pager->map != NULL
+            && mmap(pager->map, pager->map_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_FIXED,
+                    fileno(pager->f), 0) == MAP_FAILED)
+        return CHIDB_EIO;
+
+    return CHIDB_OK;
+}
+
+
+/* Drop every page in the buffer pool, after the pages have changed
+ * under it (e.g., after a rollback)
+ *
+ * Dirty pages are dropped too. Pinned pages cannot be dropped, so they
+ * are read again instead (or zeroed, if they are past the last page).
+ */
+static void chidb_Pager_dropFrames(Pager *pager)
+{
+    pager->generation++;
+    for (uint32_t i = 0; i < pager->n_frames; i++)
+    {
+        MemPage *frame = &pager->frames[i];
+
+        frame->dirty = false;
+        if (frame->npage == 0)
+            continue;
+
+        if (frame->pin_count == 0)
+        {
+            chidb_Pager_setFrame(pager, frame, 0);
+            frame->referenced = false;
+        }
+        else if (frame->npage <= pager->n_pages)
+            chidb_Pager_fillPage(pager, frame, pager->frame_data + (size_t) i * pager->page_size);
+        else
+        {
+            /* The file no longer covers the page, so it cannot stay mapped */
+            frame->data = pager->frame_data + (size_t) i * pager->page_size;
+            frame->mapped = false;
+            memset(frame->data, 0, pager->page_size);
+        }
+    }
+}
+
+
+/* Catch up with a new snapshot of the write-ahead log
+ *
+ * If other handles have committed since the last snapshot, the cached
+ * pages may be out of date, and the number of pages may have changed.
+ * If the log was checkpointed, the file itself has changed.
+ */
+static int chidb_Pager_walChanged(Pager *pager, bool changed, bool reset)
+{
+    int rc;
+
+    if (!changed)
+        return CHIDB_OK;
+
+    if (reset && (rc = chidb_Pager_remap(pager)) != CHIDB_OK)
+        return rc;
+
+    if (pager->wal->db_pages != 0)
+        pager->n_pages = pager->wal->db_pages;
+    else
+        chidb_Pager_getRealDBSize(pager, &pager->n_pages);
+
+    chidb_Pager_dropFrames(pager);
+
+    return CHIDB_OK;
+}
+
+
+/* Make sure there is a snapshot of the write-ahead log to read from
+ *
+ * In WAL mode, a snapshot is taken on the first access to a page, and
+ * kept until the dirty pages are flushed outside a transaction (i.e., at
+ * the end of a statement, or when the transaction is committed).
+ *
+ * Return
+ * - CHIDB_OK: Operation successful (or not in WAL mode)
+ * - Any error from chidb_Wal_beginRead
+ */
+static int chidb_Pager_walRead(Pager *pager)
+{
+    bool changed, reset;
+    int rc;
+
+    if (pager->wal == NULL || pager->wal->reading)
+        return CHIDB_OK;
+
+    if ((rc = chidb_Wal_beginRead(pager->wal, &changed, &reset)) != CHIDB_OK)
+        return rc;
+
+    return chidb_Pager_walChanged(pager, changed, reset);
+}
+
+
+/* Become the writer of the write-ahead log (see chidb_Wal_beginWrite)
+ *
+ * The caller has already changed the page it is about to write (and
+ * maybe others), so if it cannot write, every cached page is read
+ * again from the snapshot.
+ *
+ * Return
+ * - CHIDB_OK: Operation successful (or not in WAL mode)
+ * - CHIDB_EBUSY: Another handle is writing, or has written since the
+ *                snapshot was taken
+ * - Any error from chidb_Wal_beginWrite
+ */
+static int chidb_Pager_walWrite(Pager *pager)
+{
+    bool changed, reset;
+    int rc;
+
+    if (pager->wal == NULL || pager->wal->writing)
+        return CHIDB_OK;
+
+    if ((rc = chidb_Pager_walRead(pager)) != CHIDB_OK)
+        return rc;
+
+    rc = chidb_Wal_beginWrite(pager->wal, &changed, &reset);
+    if (rc != CHIDB_OK)
+        chidb_Pager_walChanged(pager, true, true);
+
+    return rc;
+}
+
+
+/* Set the page size
+ *
+ * This tells the pager what the size of each page is.
+ * This function must be called before operating on pages.
+ * It will not verify if the page size makes size. If an incorrect
+ * page size is provided, this will result in unexpected behaviour.
+ * The page size of a compressed file can only be changed while it has
+ * no pages.
+ *
+ * Parameters
+ * - pager: A Pager.
+ * - pagesize: Size of a page (in bytes)
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_EMISUSE: The file is compressed, and it is not empty
+ */
+int chidb_Pager_setPageSize(Pager *pager, uint32_t pagesize)
+{
+    int rc;
+
+    if (pager->file->methods->setPageSize != NULL
+            && (rc = pager->file->methods->setPageSize(pager->file, pagesize)) != CHIDB_OK)
+        return rc;
+
+    if (pager->page_size != pagesize)
+        chidb_Pager_freePool(pager);
+    pager->page_size = pagesize;
+    pager->generation++;
+    chidb_Pager_getRealDBSize(pager, &pager->n_pages);
+
+    return CHIDB_OK;
+}
+
+
+/* Set the size of the buffer pool
+ *
+ * Sets how many pages the pager keeps cached in memory. Cached pages
+ * are evicted using the CLOCK algorithm. A size of zero disables
+ * caching, in which case every read goes to the file.
+ * The size cannot be changed while pages are pinned (i.e., while there
+ * are MemPages that have not been released).
+ *
+ * Parameters
+ * - pager: A Pager.
+ * - nframes: Number of pages to cache.
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_EMISUSE: There are pinned pages in the buffer pool
+ */
+int chidb_Pager_setCacheSize(Pager *pager, uint32_t nframes)
+{
+    if (chidb_Pager_hasPinnedFrames(pager))
+        return CHIDB_EMISUSE;
+
+    chidb_Pager_freePool(pager);
+    pager->cache_size = nframes;
+
+    return CHIDB_OK;
+}
+
+
+/* Set the size of the memory-mapped region
+ *
+ * Maps the first size bytes of the file into memory. Pages that fall
+ * inside the mapping are returned by chidb_Pager_readPage as pointers
+ * straight into the mapping, without copying them. The address range
+ * is reserved up front, so it can be larger than the file: as
+ * chidb_Pager_allocatePage extends the file, new pages become
+ * accessible without remapping (which would invalidate outstanding
+ * MemPages). Pages beyond the mapping are read as usual.
+ *
+ * The mapping is private, so changes done to a mapped MemPage still only
+ * reach the file when chidb_Pager_writePage is called.
+ * A size of zero disables the memory-mapped read path. This function must
+ * be called after chidb_Pager_setPageSize, and cannot be called while
+ * pages are pinned. Compressed files are never mapped (their pages are
+ * not where the Pager would look for them), and neither are in-memory
+ * databases, so this only drops the mapping, if there is one.
+ *
+ * Parameters
+ * - pager: A Pager.
+ * - size: Size of the mapping (in bytes).
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_EMISUSE: There are pinned pages in the buffer pool
+ * - CHIDB_EIO: The file could not be mapped
+ */
+int chidb_Pager_setMmapSize(Pager *pager, size_t size)
+{
+    int rc;
+
+    if (chidb_Pager_hasPinnedFrames(pager))
+        return CHIDB_EMISUSE;
+
+    chidb_Pager_freePool(pager);
+
+    if (pager->map != NULL)
+    {
+        munmap(pager->map, pager->map_size);
+        pager->map = NULL;
+        pager->map_size = 0;
+    }
+
+    size -= size % pager->page_size;
+    if (size == 0 || pager->compressed || pager->memory)
+        return CHIDB_OK;
+
+    if ((rc = chidb_Pager_extendFile(pager)) != CHIDB_OK)
+        return rc;
+
+    pager->map = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fileno(pager->f), 0);
+    if (pager->map == MAP_FAILED)
+    {
+        pager->map = NULL;
+        return CHIDB_EIO;
+    }
+    pager->map_size = size;
+
+    return CHIDB_OK;
+}
+
+
+/* Share the Pager between threads
+ *
+ * Once shared, chidb_Pager_readPage, chidb_Pager_releaseMemPage and
+ * chidb_Pager_flush can be called from several threads at once. The
+ * buffer pool is protected by a mutex, which is not held while a page
+ * is read from the file: the frame being filled is latched instead, so
+ * that other threads can keep using the pages that are already cached
+ * (and those that want the same page wait for it).
+ *
+ * Only reads can be concurrent. Any other call must not overlap with
+ * any call from another thread (the database handle takes care of
+ * this; see chidb_set_threadsafe).
+ *
+ * Parameters
+ * - pager: A Pager.
+ * - on: Whether the Pager is shared.
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ */
+int chidb_Pager_setThreadsafe(Pager *pager, bool on)
+{
+    pager->threadsafe = on;
+
+    return CHIDB_OK;
+}
+
+
+/* Change the Pager's I/O backend
+ *
+ * Every asynchronous read is waited for before the current backend is
+ * closed. The buffer pool is left as it is: dirty pages are written
+ * back through the new backend. If the new backend cannot be opened,
+ * the current one is kept. Compressed files always use the compressed
+ * backend (see chidb_Pager_setCompression), and in-memory databases the
+ * memory backend.
+ *
+ * Parameters
+ * - pager: A Pager.
+ * - backend: CHIDB_IO_STDIO or CHIDB_IO_URING (see pager-file.c)
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_EMISUSE: Invalid backend, or the file is compressed or in memory
+ * - CHIDB_ENOMEM: Could not allocate memory
+ * - CHIDB_EIO: The backend is not available
+ */
+int chidb_Pager_setBackend(Pager *pager, int backend)
+{
+    PagerFile *file;
+    int rc;
+
+    if (pager->compressed || pager->memory)
+        return CHIDB_EMISUSE;
+
+    if ((rc = chidb_PagerFile_open(&file, fileno(pager->f), backend)) != CHIDB_OK)
+        return rc;
+
+    chidb_Pager_drain(pager);
+    pager->file->methods->close(pager->file);
+    pager->file = file;
+
+    return CHIDB_OK;
+}
+
+
+/* Store the pages compressed, or stop doing so
+ *
+ * A compressed file is a different format (see pager-compress.c), so
+ * the file is rewritten: its pages (at most one) are read, the file is
+ * emptied, and they are written again through the new backend. This is
+ * why it can only be done while the file has at most one page (e.g., a
+ * database with no tables). The memory mapping, if any, is dropped, and
+ * an uncompressed file goes back to the stdio backend. If the file
+ * cannot be set up as a compressed file, it is left uncompressed.
+ *
+ * Parameters
+ * - pager: A Pager.
+ * - on: Whether to compress the pages.
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_EMISUSE: The file has more than one page, it is in WAL mode,
+ *                  there is a transaction, there are pinned pages, or
+ *                  the database is in memory
+ * - CHIDB_ENOMEM: Could not allocate memory
+ * - CHIDB_EIO: An I/O error has occurred when accessing the file
+ */
+int chidb_Pager_setCompression(Pager *pager, bool on)
+{
+    uint8_t *page = NULL;
+    size_t n = 0;
+    int rc, wrc = CHIDB_OK;
+
+    if (pager->in_txn || pager->wal != NULL || pager->n_pages > 1
+            || chidb_Pager_hasPinnedFrames(pager) || pager->memory)
+        return CHIDB_EMISUSE;
+    if (on == pager->compressed)
+        return CHIDB_OK;
+
+    /* This also writes back the dirty pages */
+    if ((rc = chidb_Pager_setMmapSize(pager, 0)) != CHIDB_OK)
+        return rc;
+
+    if (pager->n_pages == 1)
+    {
+        if ((page = malloc(pager->page_size)) == NULL)
+            return CHIDB_ENOMEM;
+        if ((rc = pager->file->methods->read(pager->file, page, pager->page_size, 0, &n)) != CHIDB_OK)
+        {
+            free(page);
+            return rc;
+        }
+        memset(page + n, 0, pager->page_size - n);
+    }
+
+    chidb_Pager_drain(pager);
+    pager->file->methods->close(pager->file);
+    if (ftruncate(fileno(pager->f), 0) != 0)
+        rc = CHIDB_EIO;
+    else if (on)
+        rc = chidb_PagerFile_openCompressed(&pager->file, fileno(pager->f), pager->page_size);
+
+    /* If the file cannot be compressed, the page goes back uncompressed */
+    pager->compressed = on && rc == CHIDB_OK;
+    if (!pager->compressed && (wrc = chidb_PagerFile_openStdio(&pager->file, fileno(pager->f))) != CHIDB_OK)
+    {
+        free(page);
+        return wrc;
+    }
+
+    if (page != NULL)
+    {
+        struct iovec iov = { page, pager->page_size };
+        PagerWrite w = { &iov, 1, 0 };
+
+        if ((wrc = pager->file->methods->write(pager->file, &w, 1)) == CHIDB_OK)
+            wrc = pager->file->methods->sync(pager->file);
+        free(page);
+    }
+
+    return rc != CHIDB_OK ? rc : wrc;
+}
+
+
+/* Set how far ahead sequential scans read
+ *
+ * Cursors that walk the leaves of a B-Tree in order pass the pages
+ * of the next npages leaves to chidb_Pager_prefetch, so that the
+ * operating system can read them while the current ones are used.
+ *
+ * Parameters
+ * - pager: A Pager.
+ * - npages: Number of pages to prefetch (0 disables read-ahead).
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ */
+int chidb_Pager_setReadahead(Pager *pager, uint32_t npages)
+{
+    pager->readahead = npages;
+
+    return CHIDB_OK;
+}
+
+
+/* Set how much disk space is reserved ahead of the file
+ *
+ * When a page is allocated past the space already reserved, the Pager
+ * reserves the next extent of the file at once (see chidb_Pager_reserve),
+ * instead of letting the file system find room for each page as it is
+ * first written. Extents grow with the file, from npages pages up to
+ * MAX_EXTENT_SIZE bytes. Only backends that can reserve space without
+ * changing the size of the file do this (see PagerFileMethods).
+ *
+ * Parameters
+ * - pager: A Pager.
+ * - npages: Number of pages in the smallest extent (0 disables
+ *           preallocation).
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ */
+int chidb_Pager_setPreallocation(Pager *pager, uint32_t npages)
+{
+    pager->preallocation = npages;
+
+    return CHIDB_OK;
+}
+
+
+/* Keep track of the pages that are written
+ *
+ * While tracking is on, chidb_Pager_writePage marks every page it is
+ * given in a bitmap, which chidb_Pager_takeChange reads (and clears) one
+ * page at a time. This is how an online backup (see chidb_backup_step)
+ * finds the pages it has already copied that it has to copy again.
+ * Pages are marked when they are written to the Pager, not when they
+ * reach the file, so a page written in a transaction that is rolled
+ * back is also marked.
+ *
+ * Parameters
+ * - pager: A Pager.
+ * - on: Whether to track the pages that are written. Turning it off
+ *       forgets the pages that were marked.
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_EMISUSE: Tracking is already on
+ * - CHIDB_ENOMEM: Could not allocate memory
+ */
+int chidb_Pager_trackChanges(Pager *pager, bool on)
+{
+    if (!on)
+    {
+        free(pager->changed);
+        pager->changed = NULL;
+        pager->changed_pages = 0;
+        return CHIDB_OK;
+    }
+
+    if (pager->changed != NULL)
+        return CHIDB_EMISUSE;
+    pager->changed_pages = (pager->n_pages / 8 + 1) * 8;
+    if ((pager->changed = calloc(pager->changed_pages / 8, 1)) == NULL)
+        return CHIDB_ENOMEM;
+
+    return CHIDB_OK;
+}
+
+
+/* Mark a page as written (see chidb_Pager_trackChanges) */
+static int chidb_Pager_markChanged(Pager *pager, npage_t npage)
+{
+    if (npage > pager->changed_pages)
+    {
+        npage_t bits = pager->changed_pages;
+        uint8_t *changed;
+
+        while (bits < npage)
+            bits *= 2;
+        if ((changed = realloc(pager->changed, bits / 8)) == NULL)
+            return CHIDB_ENOMEM;
+        memset(changed + pager->changed_pages / 8, 0, (bits - pager->changed_pages) / 8);
+        pager->changed = changed;
+        pager->changed_pages = bits;
+    }
+    pager->changed[(npage - 1) / 8] |= 1 << ((npage - 1) % 8);
+
+    return CHIDB_OK;
+}
+
+
+/* Check whether a page has been written since it was last checked
+ *
+ * Parameters
+ * - pager: A Pager, with change tracking on (see chidb_Pager_trackChanges).
+ * - npage: Page number.
+ *
+ * Return
+ * - true if the page was written since tracking was turned on, or since
+ *   the last time this was called on it
+ */
+bool chidb_Pager_takeChange(Pager *pager, npage_t npage)
+{
+    bool changed;
+
+    if (pager->changed == NULL || npage > pager->changed_pages)
+        return false;
+
+    changed = pager->changed[(npage - 1) / 8] & (1 << ((npage - 1) % 8));
+    pager->changed[(npage - 1) / 8] &= ~(1 << ((npage - 1) % 8));
+
+    return changed;
+}
+
+
+/* Count the pages that have been written since they were last checked
+ *
+ * Parameters
+ * - pager: A Pager, with change tracking on (see chidb_Pager_trackChanges).
+ * - npages: Only pages 1 to npages are counted.
+ *
+ * Return
+ * - The number of those pages for which chidb_Pager_takeChange would
+ *   return true
+ */
+npage_t chidb_Pager_countChanges(Pager *pager, npage_t npages)
+{
+    npage_t n = 0;
+
+    if (npages > pager->changed_pages)
+        npages = pager->changed_pages;
+    for (npage_t i = 0; i < npages; i++)
+        n += (pager->changed[i / 8] >> (i % 8)) & 1;
+
+    return n;
+}
+
+
+/* Read the chidb file header
+ *
+ * This function reads in the header of a chidb file and returns it
+ * in a byte array. Note that this function can be called even if
+ * the page size is unknown, since the chidb header always occupies
+ * the first 100 bytes of the file.
+ *
+ * Parameters
+ * - pager: A Pager.
+ * - header: Pointer to a byte array with enough space for 100 bytes.
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_NOHEADER: The file does not have a header. This will
+ */
+int chidb_Pager_readHeader(Pager *pager, uint8_t *header)
+{
+    size_t count;
+    if (pager->file->methods->read(pager->file, header, 100, 0, &count) != CHIDB_OK || count != 100)
+        return CHIDB_NOHEADER;
+    else
+        return CHIDB_OK;
+}
+
+
+/* Reserve disk space for the next extent of the file
+ *
+ * The extent starts at the last page (which was just allocated), and is
+ * a quarter of the file, but at least preallocation pages and at most
+ * MAX_EXTENT_SIZE bytes, so a file loaded in bulk ends up in a few large
+ * extents on disk instead of one per page. The size of the file is left
+ * as it is. Reserving is only a hint: if the file system cannot do it,
+ * preallocation is turned off, and the file grows as pages are written.
+ */
+static void chidb_Pager_reserve(Pager *pager)
+{
+    npage_t start = pager->n_pages - 1;
+    npage_t extent = pager->n_pages / 4;
+
+    if (pager->preallocation == 0 || pager->file->methods->reserve == NULL)
+        return;
+
+    if (extent < pager->preallocation)
+        extent = pager->preallocation;
+    if (extent > MAX_EXTENT_SIZE / pager->page_size)
+        extent = MAX_EXTENT_SIZE / pager->page_size;
+    if (pager->file->methods->reserve(pager->file, (off_t) start * pager->page_size,
+                                      (off_t) extent * pager->page_size) != CHIDB_OK)
+    {
+        pager->preallocation = 0;
+        return;
+    }
+
+    pager->reserved_pages = start + extent;
+    pager->stats.extents++;
+}
+
+
+/* Allocate an extra page on the file
+ *
+ * Parameters
+ * - pager: A Pager.
+ * - npage: An out parameter that will contain the page number of the
+ *          new page.
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ */
+int chidb_Pager_allocatePage(Pager *pager, npage_t *npage)
+{
+    int rc;
+
+    /* The number of pages depends on the snapshot */
+    if ((rc = chidb_Pager_walRead(pager)) != CHIDB_OK)
+        return rc;
+
+    /* We simply increment the page number counter. readPage
+     * and writePage take care of the rest. */
+    *npage = ++pager->n_pages;
+
+    if (*npage > pager->reserved_pages)
+        chidb_Pager_reserve(pager);
+
+    if (chidb_Pager_isMapped(pager, *npage))
+    {
+        if ((rc = chidb_Pager_extendFile(pager)) != CHIDB_OK)
+            return rc;
+    }
+
+    /* A page number can be handed out again after n_pages has been
+     * decremented, so drop anything we still have cached for it. */
+    MemPage *frame = chidb_Pager_findFrame(pager, *npage);
+    if (frame != NULL && frame->pin_count == 0)
+    {
+        chidb_Pager_setFrame(pager, frame, 0);
+        frame->referenced = false;
+        frame->dirty = false;
+    }
+
+    return CHIDB_OK;
+}
+
+
+/* Cut the file back to a number of pages
+ *
+ * The pages past npages are dropped from the buffer pool (even if they
+ * are dirty), and the rest are written to the file. In rollback journal
+ * mode, the file is truncated right away. In WAL mode, the new number of
+ * pages is committed to the log, and the file is only truncated when
+ * the log is checkpointed (see chidb_Wal_checkpoint).
+ *
+ * Parameters
+ * - pager: A Pager.
+ * - npages: Number of pages to keep.
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_EMISUSE: There is a transaction, one of the pages past npages
+ *                  is pinned, or npages is larger than the file
+ * - CHIDB_ENOMEM: Could not allocate memory
+ * - CHIDB_EIO: An I/O error has occurred when accessing the file
+ */
+int chidb_Pager_truncate(Pager *pager, npage_t npages)
+{
+    int rc;
+
+    if (pager->in_txn || npages > pager->n_pages)
+        return CHIDB_EMISUSE;
+
+    for (uint32_t i = 0; i < pager->n_frames; i++)
+        if (pager->frames[i].npage > npages && pager->frames[i].pin_count > 0)
+            return CHIDB_EMISUSE;
+
+    pager->n_pages = npages;
+    if (pager->reserved_pages > npages)
+        pager->reserved_pages = npages;
+    pager->generation++;
+    for (uint32_t i = 0; i < pager->n_frames; i++)
+    {
+        MemPage *frame = &pager->frames[i];
+
+        if (frame->npage > npages)
+        {
+            chidb_Pager_setFrame(pager, frame, 0);
+            frame->referenced = false;
+            frame->dirty = false;
+        }
+    }
+
+    if ((rc = chidb_Pager_flush(pager)) != CHIDB_OK)
+        return rc;
+
+    if (pager->wal == NULL
+            && pager->file->methods->truncate(pager->file, (off_t) npages * pager->page_size) != CHIDB_OK)
+        return CHIDB_EIO;
+
+    return CHIDB_OK;
+}
+
+
+/* Find a page in the buffer pool, or make room for it
+ *
+ * See chidb_Pager_readPage. If fill is not NULL, a frame taken for the
+ * page is not filled: it is returned latched exclusively, *fill is set,
+ * and the caller fills it (see chidb_Pager_setThreadsafe).
+ */
+static int chidb_Pager_fetchPage(Pager *pager, npage_t npage, MemPage **page, bool *fill)
+{
+    int rc;
+    MemPage *frame;
+
+    if ((rc = chidb_Pager_walRead(pager)) != CHIDB_OK)
+        return rc;
+
+    if (npage > pager->n_pages || npage <= 0)
+        return CHIDB_EPAGENO;
+
+    if ((rc = chidb_Pager_initPool(pager)) != CHIDB_OK)
+        return rc;
+
+    if ((frame = chidb_Pager_findFrame(pager, npage)) != NULL && frame->pending && pager->nowait)
+    {
+        pager->wait_page = npage;
+        return CHIDB_PENDING;
+    }
+
+    if (frame != NULL && (rc = chidb_Pager_awaitFrame(pager, frame)) != CHIDB_OK)
+        return rc;
+
+    /* The frame is dropped if its asynchronous read failed */
+    if (frame != NULL && frame->npage == npage)
+    {
+        frame->pin_count++;
+        frame->referenced = true;
+        *page = frame;
+        CHIDB_COUNT(pager->stats.hits, 1);
+        return CHIDB_OK;
+    }
+
+    CHIDB_COUNT(pager->stats.misses, 1);
+    CHIDB_PROBE(page__miss, npage);
+
+    /* Start the read and let the caller do something else meanwhile
+     * (pages in the log are read from it, which is not asynchronous) */
+    if (pager->nowait && !chidb_Pager_isMapped(pager, npage)
+            && (pager->wal == NULL || chidb_Wal_findFrame(pager->wal, npage) == 0)
+            && chidb_Pager_readAsync(pager, npage))
+    {
+        if (pager->file->methods->submit != NULL)
+            pager->file->methods->submit(pager->file);
+        pager->wait_page = npage;
+        return CHIDB_PENDING;
+    }
+
+    if ((frame = chidb_Pager_victimFrame(pager)) != NULL)
+    {
+        /* Write back in one batch rather than one page at a time */
+        if (frame->dirty && (rc = chidb_Pager_writeBack(pager, false)) != CHIDB_OK)
+            return rc;
+
+        chidb_Pager_setFrame(pager, frame, npage);
+        frame->pin_count = 1;
+        frame->referenced = true;
+        *page = frame;
+        if (fill != NULL)
+        {
+            pthread_rwlock_wrlock(&frame->latch);
+            *fill = true;
+            return CHIDB_OK;
+        }
+        chidb_Pager_fillPage(pager, frame, pager->frame_data + (size_t) (frame - pager->frames) * pager->page_size);
+        return CHIDB_OK;
+    }
+
+    /* Every frame is pinned (or caching is disabled) */
+    *page = malloc(sizeof(MemPage));
+    if (*page == NULL)
+        return CHIDB_ENOMEM;
+    (*page)->npage = npage;
+    (*page)->size = pager->page_size;
+    (*page)->pin_count = 1;
+    (*page)->referenced = false;
+    (*page)->pooled = false;
+    (*page)->dirty = false;
+    if (chidb_Pager_isMapped(pager, npage)
+            && (pager->wal == NULL || chidb_Wal_findFrame(pager->wal, npage) == 0))
+    {
+        chidb_Pager_fillPage(pager, *page, NULL);
+        return CHIDB_OK;
+    }
+    uint8_t *buf = malloc(pager->page_size);
+    if (buf == NULL)
+    {
+        free(*page);
+        return CHIDB_ENOMEM;
+    }
+    chidb_Pager_fillPage(pager, *page, buf);
+
+    return CHIDB_OK;
+}
+
+
+/* Read a page from file
+ *
+ * This page reads a page from the file, and creates an in-memory copy
+ * in a MemPage struct (see header file for more details on this struct).
+ * Always use chidb_Pager_releaseMemPage to free the memory allocated for
+ * a MemPage created by this function.
+ * Any changes done to a MemPage will not be effective until you call
+ * chidb_Pager_writePage with that MemPage.
+ *
+ * Pages are served from the buffer pool whenever possible: a cached page
+ * is returned without touching the file, and the returned MemPage stays
+ * pinned (and thus cannot be evicted) until it is released. Note that
+ * this means that two readers of the same page share the same MemPage.
+ * If every frame is pinned, a private copy is allocated instead.
+ *
+ * Parameters
+ * - pager: A Pager.
+ * - npage: Page number of page to read.
+ * - page: Out parameter. Used to return a pointer to newly created MemPage
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_ENOMEM: Could not allocate memory
+ * - CHIDB_EIO: An I/O error has occurred when accessing the file
+ */
+int	chidb_Pager_readPage(Pager *pager, npage_t npage, MemPage **page)
+{
+    bool fill = false;
+    int rc;
+
+    CHIDB_COUNT(pager->stats.reads, 1);
+    CHIDB_PROBE(page__read, npage);
+
+    if (!pager->threadsafe)
+        return chidb_Pager_fetchPage(pager, npage, page, NULL);
+
+    pthread_mutex_lock(&pager->mutex);
+    rc = chidb_Pager_fetchPage(pager, npage, page, &fill);
+    pthread_mutex_unlock(&pager->mutex);
+
+    if (rc != CHIDB_OK || !(*page)->pooled)
+        return rc;
+
+    if (fill)
+    {
+        chidb_Pager_fillPage(pager, *page, pager->frame_data + (size_t) (*page - pager->frames) * pager->page_size);
+        pthread_rwlock_unlock(&(*page)->latch);
+    }
+    else
+    {
+        /* Another thread may still be filling the frame */
+        pthread_rwlock_rdlock(&(*page)->latch);
+        pthread_rwlock_unlock(&(*page)->latch);
+    }
+
+    return CHIDB_OK;
+}
+
+
+/* Start reading a page into the buffer pool asynchronously
+ *
+ * The read is queued into a victim frame, which is marked as pending
+ * until the read completes: it cannot be evicted, and reading the page
+ * waits for the read (see chidb_Pager_awaitFrame). The frame's reference
+ * bit is set, so that the page survives one sweep of the clock hand
+ * before it is used. Nothing is done if the backend has no asynchronous
+ * reads, if there is no clean frame to spare, or if the backend cannot
+ * take more requests.
+ *
+ * Parameters
+ * - pager: A Pager.
+ * - npage: Page number (not cached, and not mapped).
+ *
+ * Return
+ * - true if the read was queued
+ */
+static bool chidb_Pager_readAsync(Pager *pager, npage_t npage)
+{
+    MemPage *frame;
+    uint8_t *buf;
+
+    if (pager->file->methods->readAsync == NULL
+            || chidb_Pager_initPool(pager) != CHIDB_OK
+            || (frame = chidb_Pager_victimFrame(pager)) == NULL
+            || frame->dirty)
+        return false;
+
+    buf = pager->frame_data + (size_t) (frame - pager->frames) * pager->page_size;
+    if (pager->file->methods->readAsync(pager->file, buf, pager->page_size,
+                                         (off_t) (npage - 1) * pager->page_size, frame) != CHIDB_OK)
+        return false;
+
+    chidb_Pager_setFrame(pager, frame, npage);
+    frame->data = buf;
+    frame->referenced = true;
+    frame->mapped = false;
+    frame->pending = true;
+    pager->n_pending++;
+    CHIDB_COUNT(pager->stats.bytes_read, pager->page_size);
+
+    return true;
+}
+
+
+/* Check whether the asynchronous read of a page has completed
+ *
+ * The reads that have completed are reaped first. A page that is not
+ * being read (because its read completed, or because it was never
+ * started) is ready: reading it does not fail with CHIDB_PENDING
+ * (see Pager.nowait), although it may still have to be read from the
+ * file if its read failed, or if its frame has been evicted since.
+ *
+ * Parameters
+ * - pager: A Pager.
+ * - npage: Page number.
+ * - wait: Whether to wait for the read if it has not completed yet.
+ *
+ * Return
+ * - CHIDB_OK: The page is ready
+ * - CHIDB_PENDING: The page is still being read (and wait is false)
+ * - CHIDB_EIO: An I/O error has occurred when waiting for a read
+ */
+int chidb_Pager_poll(Pager *pager, npage_t npage, bool wait)
+{
+    MemPage *frame;
+    int rc;
+
+    while (pager->n_pending > 0 && (rc = chidb_Pager_completeRead(pager, false)) != CHIDB_EEMPTY)
+        if (rc != CHIDB_OK)
+            return rc;
+
+    if ((frame = chidb_Pager_findFrame(pager, npage)) == NULL || !frame->pending)
+        return CHIDB_OK;
+
+    if (!wait)
+        return CHIDB_PENDING;
+
+    return chidb_Pager_awaitFrame(pager, frame);
+}
+
+
+/* Tell the operating system which pages will be read soon
+ *
+ * This is only a hint. Pages that are already cached, or that are in
+ * the write-ahead log, are skipped. If the I/O backend can read
+ * asynchronously, the rest are read into frames of the buffer pool in
+ * the background (see chidb_Pager_readAsync). Otherwise, they are
+ * handed to the kernel with madvise (if they are mapped) or
+ * posix_fadvise, which start reading them into the kernel's page
+ * cache instead. Consecutive pages are hinted with a single call.
+ *
+ * Parameters
+ * - pager: A Pager.
+ * - pages: Page numbers, in the order they will be read.
+ * - n: Number of pages.
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ */
+int chidb_Pager_prefetch(Pager *pager, const npage_t *pages, uint32_t n)
+{
+    npage_t first = 0, last = 0;
+
+    if (pager->page_size == 0)
+        return CHIDB_OK;
+
+    if (pager->threadsafe)
+        pthread_mutex_lock(&pager->mutex);
+
+    for (uint32_t i = 0; i <= n; i++)
+    {
+        npage_t npage = 0;
+
+        if (i < n)
+        {
+            npage = pages[i];
+            if (npage == 0 || npage > pager->n_pages
+                    || chidb_Pager_findFrame(pager, npage) != NULL
+                    || (pager->wal != NULL && chidb_Wal_findFrame(pager->wal, npage) != 0))
+                continue;
+            if (!chidb_Pager_isMapped(pager, npage) && chidb_Pager_readAsync(pager, npage))
+                continue;
+            if (first != 0 && npage == last + 1
+                    && chidb_Pager_isMapped(pager, npage) == chidb_Pager_isMapped(pager, first))
+            {
+                last = npage;
+                continue;
+            }
+        }
+
+        /* Hint the run [first, last] before starting a new one */
+        if (first != 0)
+        {
+            off_t off = (off_t) (first - 1) * pager->page_size;
+            size_t len = (size_t) (last - first + 1) * pager->page_size;
+
+            if (chidb_Pager_isMapped(pager, first))
+            {
+                /* madvise wants an address aligned to the system page size */
+                size_t skew = (size_t) off % getpagesize();
+                madvise(pager->map + off - skew, len + skew, MADV_WILLNEED);
+            }
+            else if (!pager->compressed && !pager->memory)
+                posix_fadvise(fileno(pager->f), off, len, POSIX_FADV_WILLNEED);
+        }
+        first = last = npage;
+    }
+
+    if (pager->file->methods->submit != NULL)
+        pager->file->methods->submit(pager->file);
+
+    if (pager->threadsafe)
+        pthread_mutex_unlock(&pager->mutex);
+
+    return CHIDB_OK;
+}
+
+
+/* Compute the checksum of a journal record
+ *
+ * Parameters
+ * - npage: Page number in the record.
+ * - data: Contents of the page.
+ * - size: Page size.
+ *
+ * Return
+ * - The checksum
+ */
+static uint32_t chidb_Pager_checksum(npage_t npage, const uint8_t *data, uint32_t size)
+{
+    uint32_t sum = npage;
+
+    for (uint32_t i = 0; i < size; i++)
+        sum = sum * 31 + data[i];
+
+    return sum;
+}
+
+
+/* Write the header of a journal, for a file of n_pages pages */
+static int chidb_Pager_journalHeader(Pager *pager, PagerFile *journal, npage_t n_pages)
+{
+    uint8_t header[JOURNAL_HEADER_SIZE];
+
+    memcpy(header, JOURNAL_MAGIC, 8);
+    put4byte(header + 8, pager->page_size);
+    put4byte(header + 12, n_pages);
+
+    struct iovec iov = { header, JOURNAL_HEADER_SIZE };
+    PagerWrite w = { &iov, 1, 0 };
+
+    return journal->methods->write(journal, &w, 1);
+}
+
+
+/* Copy a page from the file to record nrecord of a journal */
+static int chidb_Pager_journalRecord(Pager *pager, PagerFile *journal, uint32_t nrecord, npage_t npage)
+{
+    uint8_t *rec;
+    size_t nread;
+    int rc;
+
+    if ((rec = malloc(JOURNAL_RECORD_SIZE(pager->page_size))) == NULL)
+        return CHIDB_ENOMEM;
+
+    put4byte(rec, npage);
+    pager->file->methods->read(pager->file, rec + 4, pager->page_size, (off_t) (npage - 1) * pager->page_size, &nread);
+    memset(rec + 4 + nread, 0, pager->page_size - nread);
+    put4byte(rec + 4 + pager->page_size, chidb_Pager_checksum(npage, rec + 4, pager->page_size));
+
+    struct iovec iov = { rec, JOURNAL_RECORD_SIZE(pager->page_size) };
+    PagerWrite w = { &iov, 1, JOURNAL_HEADER_SIZE + (off_t) nrecord * JOURNAL_RECORD_SIZE(pager->page_size) };
+    rc = journal->methods->write(journal, &w, 1);
+    free(rec);
+
+    return rc;
+}
+
+
+/* Save the original contents of a page in the journal
+ *
+ * Does nothing if there is no transaction, if the page is already in
+ * the journal, or if it was allocated during the transaction (it will
+ * simply be cut off the file on rollback). Otherwise, the page is still
+ * as it was when the transaction began in the file (it has not been
+ * written since), so it is read from there.
+ *
+ * Parameters
+ * - pager: A Pager.
+ * - npage: Page number.
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_ENOMEM: Could not allocate memory
+ * - CHIDB_EIO: An I/O error has occurred when accessing the journal
+ */
+static int chidb_Pager_journalPage(Pager *pager, npage_t npage)
+{
+    int rc;
+
+    if (!pager->in_txn || pager->wal != NULL || npage > pager->txn_n_pages
+            || pager->journaled[(npage - 1) / 8] & (1 << ((npage - 1) % 8)))
+        return CHIDB_OK;
+
+    if ((rc = chidb_Pager_journalRecord(pager, pager->journal, pager->journal_nrecords, npage)) != CHIDB_OK)
+        return rc;
+
+    pager->journaled[(npage - 1) / 8] |= 1 << ((npage - 1) % 8);
+    pager->journal_nrecords++;
+    pager->journal_synced = false;
+
+    return CHIDB_OK;
+}
+
+
+/* Save the contents of a page in the statement journal, before the page
+ * is overwritten in the file during a statement savepoint (see
+ * chidb_Pager_beginStatement). Pages allocated by the statement, and
+ * pages already in the journal, are not saved. The journal is opened
+ * the first time a page is saved in it.
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_ENOMEM: Could not allocate memory
+ */
+static int chidb_Pager_stmtJournalPage(Pager *pager, npage_t npage)
+{
+    int rc;
+
+    if (!pager->in_stmt || pager->wal != NULL || npage > pager->stmt_n_pages)
+        return CHIDB_OK;
+
+    if (pager->stmt_journal == NULL)
+    {
+        if ((pager->stmt_journaled = calloc(pager->stmt_n_pages / 8 + 1, 1)) == NULL)
+            return CHIDB_ENOMEM;
+        if ((rc = chidb_PagerFile_openMemory(&pager->stmt_journal)) != CHIDB_OK
+                || (rc = chidb_Pager_journalHeader(pager, pager->stmt_journal, pager->stmt_n_pages)) != CHIDB_OK)
+        {
+            if (pager->stmt_journal != NULL)
+                pager->stmt_journal->methods->close(pager->stmt_journal);
+            free(pager->stmt_journaled);
+            pager->stmt_journal = NULL;
+            pager->stmt_journaled = NULL;
+            return rc;
+        }
+        pager->stmt_nrecords = 0;
+    }
+    else if (pager->stmt_journaled[(npage - 1) / 8] & (1 << ((npage - 1) % 8)))
+        return CHIDB_OK;
+
+    if ((rc = chidb_Pager_journalRecord(pager, pager->stmt_journal, pager->stmt_nrecords, npage)) != CHIDB_OK)
+        return rc;
+
+    pager->stmt_journaled[(npage - 1) / 8] |= 1 << ((npage - 1) % 8);
+    pager->stmt_nrecords++;
+
+    return CHIDB_OK;
+}
+
+
+/* Make the journal durable before the file is written to
+ *
+ * Must be called before any write to the file. Outside a transaction,
+ * or if nothing was added to the journal since the last call, it does
+ * nothing.
+ *
+ * Parameters
+ * - pager: A Pager.
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_EIO: An I/O error has occurred when accessing the journal
+ */
+static int chidb_Pager_syncJournal(Pager *pager)
+{
+    if (!pager->in_txn || pager->wal != NULL)
+        return CHIDB_OK;
+
+    pager->txn_written = true;
+    if (pager->journal_synced)
+        return CHIDB_OK;
+
+    if (pager->journal->methods->sync(pager->journal) != CHIDB_OK)
+        return CHIDB_EIO;
+    pager->journal_synced = true;
+
+    return CHIDB_OK;
+}
+
+
+/* Write a page to file
+ *
+ * This page writes the in-memory copy of a page (stored in a MemPage
+ * struct) back to disk.
+ *
+ * Pages in the buffer pool are only marked as dirty; they reach the file
+ * when chidb_Pager_flush is called (or when a dirty frame has to be
+ * evicted). This way, a page that is written several times (e.g., a parent
+ * node during a split) only hits the disk once.
+ *
+ * During a transaction, the original contents of the page are saved in
+ * the journal the first time it is written. In WAL mode, pages go to the
+ * write-ahead log instead of the file, and only one handle can write
+ * at a time.
+ *
+ * Parameters
+ * - pager: A Pager.
+ * - page: In-memory copy of page to write
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_EPAGENO: The page has an incorrect page number
+ * - CHIDB_EBUSY: In WAL mode, another handle is writing (or has written
+ *                since this handle's snapshot was taken)
+ * - CHIDB_EIO: An I/O error has occurred when accessing the file
+ */
+int	chidb_Pager_writePage(Pager *pager, MemPage *page)
+{
+    int rc;
+
+    CHIDB_PROBE(page__write, page->npage);
+
+    if (page->npage > pager->n_pages)
+        return CHIDB_EPAGENO;
+
+    if ((rc = chidb_Pager_walWrite(pager)) != CHIDB_OK)
+        return rc;
+
+    if (pager->changed != NULL && (rc = chidb_Pager_markChanged(pager, page->npage)) != CHIDB_OK)
+        return rc;
+
+    if ((rc = chidb_Pager_journalPage(pager, page->npage)) != CHIDB_OK)
+        return rc;
+
+    if (page->pooled)
+    {
+        page->dirty = true;
+        return CHIDB_OK;
+    }
+
+    /* A private copy. If the page is also cached, the cached frame
+     * takes the write; otherwise, write it out straight away. */
+    MemPage *frame = chidb_Pager_findFrame(pager, page->npage);
+    if (frame != NULL && (rc = chidb_Pager_awaitFrame(pager, frame)) != CHIDB_OK)
+        return rc;
+    if (frame != NULL && frame->npage == page->npage)
+    {
+        if (frame->data != page->data)
+            memcpy(frame->data, page->data, pager->page_size);
+        frame->dirty = true;
+        return CHIDB_OK;
+    }
+
+    if (pager->wal != NULL)
+    {
+        if ((rc = chidb_Wal_append(pager->wal, &page, 1, 0)) == CHIDB_OK)
+        {
+            pager->stats.writes++;
+            pager->stats.bytes_written += pager->page_size;
+        }
+        return rc;
+    }
+
+    if ((rc = chidb_Pager_syncJournal(pager)) != CHIDB_OK
+            || (rc = chidb_Pager_stmtJournalPage(pager, page->npage)) != CHIDB_OK)
+        return rc;
+
+    struct iovec iov = { page->data, pager->page_size };
+    PagerWrite w = { &iov, 1, (off_t) (page->npage - 1) * pager->page_size };
+    if ((rc = pager->file->methods->write(pager->file, &w, 1)) != CHIDB_OK)
+        return rc;
+    pager->stats.writes++;
+    pager->stats.bytes_written += pager->page_size;
+    chilog(TRACE, "Wrote page %i", page->npage);
+
+    return CHIDB_OK;
+}
+
+
+/* Compares two frames by page number (for qsort) */
+static int chidb_Pager_cmpFrames(const void *a, const void *b)
+{
+    npage_t pa = (*(MemPage * const *) a)->npage;
+    npage_t pb = (*(MemPage * const *) b)->npage;
+
+    return (pa > pb) - (pa < pb);
+}
+
+
+/* Finish writing (and reading) the write-ahead log
+ *
+ * Called once the dirty pages have been committed. If the log has grown
+ * past its autocheckpoint size, it is checkpointed, unless some other
+ * handle is reading it (it is then checkpointed after a later commit).
+ */
+static int chidb_Pager_walEnd(Pager *pager)
+{
+    Wal *wal = pager->wal;
+    int rc = CHIDB_OK;
+
+    if (wal->writing && wal->autocheckpoint != 0 && wal->n_frames >= wal->autocheckpoint)
+    {
+        rc = chidb_Wal_checkpoint(wal);
+        if (rc == CHIDB_EBUSY)
+            rc = CHIDB_OK;
+    }
+
+    chidb_Wal_endWrite(wal);
+
+    /* Pinned pages belong to statements that are still reading */
+    if (!chidb_Pager_hasPinnedFrames(pager))
+        chidb_Wal_endRead(wal);
+
+    return rc;
+}
+
+
+/* Write all dirty pages to file
+ *
+ * Dirty pages are sorted by page number, and each run of consecutive
+ * pages is written with a single vectored write. The runs are handed
+ * to the I/O backend together, as one batch. Dirty frames that lie
+ * beyond the last allocated page (e.g., scratch pages that were given
+ * back) are discarded.
+ *
+ * In WAL mode, the pages are appended to the log instead. If end is true
+ * and there is no transaction, this commits them, and the snapshot is
+ * let go of (unless some page is still pinned). Otherwise (e.g., when a dirty page has to be evicted), they
+ * are appended without committing.
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_ENOMEM: Could not allocate memory
+ * - CHIDB_EIO: An I/O error has occurred when accessing the file
+ */
+static int chidb_Pager_writeBack(Pager *pager, bool end)
+{
+    MemPage **dirty;
+    uint32_t ndirty = 0;
+    int rc = CHIDB_OK;
+    bool commit = end && !pager->in_txn && !pager->in_stmt;
+
+    if (pager->n_frames == 0)
+        return pager->wal != NULL && commit ? chidb_Pager_walEnd(pager) : CHIDB_OK;
+
+    if ((dirty = malloc(pager->n_frames * sizeof(MemPage *))) == NULL)
+        return CHIDB_ENOMEM;
+
+    for (uint32_t i = 0; i < pager->n_frames; i++)
+    {
+        MemPage *frame = &pager->frames[i];
+
+        if (!frame->dirty)
+            continue;
+
+        if (frame->npage > pager->n_pages)
+            frame->dirty = false;
+        else
+            dirty[ndirty++] = frame;
+    }
+
+    /* During a transaction, the original pages must be safely in the
+     * journal before any of them is overwritten */
+    if (ndirty > 0 && (rc = chidb_Pager_syncJournal(pager)) != CHIDB_OK)
+    {
+        free(dirty);
+        return rc;
+    }
+
+    qsort(dirty, ndirty, sizeof(MemPage *), chidb_Pager_cmpFrames);
+
+    if (pager->wal != NULL)
+    {
+        if (ndirty > 0 || (commit && pager->wal->writing))
+            rc = chidb_Wal_append(pager->wal, dirty, ndirty, commit ? pager->n_pages : 0);
+        if (rc == CHIDB_OK)
+        {
+            pager->stats.writes += ndirty;
+            pager->stats.bytes_written += (uint64_t) ndirty * pager->page_size;
+        }
+        for (uint32_t i = 0; i < ndirty && rc == CHIDB_OK; i++)
+            dirty[i]->dirty = false;
+        free(dirty);
+
+        if (rc == CHIDB_OK && commit)
+            rc = chidb_Pager_walEnd(pager);
+        return rc;
+    }
+
+    /* During a statement savepoint, the pages are saved before they are
+     * overwritten, in case the statement fails */
+    for (uint32_t i = 0; i < ndirty; i++)
+        if ((rc = chidb_Pager_stmtJournalPage(pager, dirty[i]->npage)) != CHIDB_OK)
+        {
+            free(dirty);
+            return rc;
+        }
+
+    struct iovec *iov = malloc(ndirty * sizeof(struct iovec));
+    PagerWrite *writes = malloc(ndirty * sizeof(PagerWrite));
+    uint32_t nwrites = 0;
+    if (ndirty > 0 && (iov == NULL || writes == NULL))
+    {
+        free(iov);
+        free(writes);
+        free(dirty);
+        return CHIDB_ENOMEM;
+    }
+
+    for (uint32_t i = 0; i < ndirty; i++)
+    {
+        iov[i].iov_base = dirty[i]->data;
+        iov[i].iov_len = pager->page_size;
+
+        if (i > 0 && dirty[i]->npage == dirty[i - 1]->npage + 1
+                && writes[nwrites - 1].iovcnt < (IOV_MAX < 64 ? IOV_MAX : 64))
+        {
+            writes[nwrites - 1].iovcnt++;
+            continue;
+        }
+
+        writes[nwrites].iov = &iov[i];
+        writes[nwrites].iovcnt = 1;
+        writes[nwrites].offset = (off_t) (dirty[i]->npage - 1) * pager->page_size;
+        nwrites++;
+    }
+
+    /* The backend may carry out the writes in any order */
+    if (nwrites > 0 && (rc = pager->file->methods->write(pager->file, writes, nwrites)) == CHIDB_OK)
+    {
+        chilog(TRACE, "Wrote %i pages in %i runs", ndirty, nwrites);
+        pager->stats.writes += ndirty;
+        pager->stats.bytes_written += (uint64_t) ndirty * pager->page_size;
+        for (uint32_t i = 0; i < ndirty; i++)
+            dirty[i]->dirty = false;
+    }
+
+    free(iov);
+    free(writes);
+    free(dirty);
+
+    return rc;
+}
+
+
+/* Write all dirty pages to file (see chidb_Pager_writeBack)
+ *
+ * Parameters
+ * - pager: A Pager.
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_ENOMEM: Could not allocate memory
+ * - CHIDB_EIO: An I/O error has occurred when accessing the file
+ */
+int chidb_Pager_flush(Pager *pager)
+{
+    int rc;
+
+    if (!pager->threadsafe)
+        return chidb_Pager_writeBack(pager, true);
+
+    pthread_mutex_lock(&pager->mutex);
+    rc = chidb_Pager_writeBack(pager, true);
+    pthread_mutex_unlock(&pager->mutex);
+
+    return rc;
+}
+
+
+/* Commit the dirty pages, leaving the log to be synced later
+ *
+ * Same as chidb_Pager_flush, except that in WAL mode, on a shared Pager,
+ * the log is not synced when there is no transaction. Instead, the
+ * commit is given a number, and it is not durable until
+ * chidb_Pager_syncCommit has been called with that number. This is done
+ * without holding the database's lock, so that commits that other
+ * threads make in the meantime are synced along with it (group commit).
+ * Note that the commit can be read (by this handle and others) before
+ * it is durable.
  *
  * Parameters
- * - pager: An out parameter. Used to return a pointer to the
- *			 newly created Pager.
- * - filename: Database file (might not exist)
+ * - pager: A Pager.
+ * - seq: Out parameter. The number of the commit, or 0 if there is
+ *        nothing to sync.
  *
  * Return
  * - CHIDB_OK: Operation successful
  * - CHIDB_ENOMEM: Could not allocate memory
  * - CHIDB_EIO: An I/O error has occurred when accessing the file
  */
-int chidb_Pager_open(Pager **pager, const char *filename)
+int chidb_Pager_flushCommit(Pager *pager, uint64_t *seq)
 {
-    *pager = malloc(sizeof(Pager));
-    if (pager == NULL)
+    int rc;
+
+    *seq = 0;
+    if (!pager->threadsafe || pager->wal == NULL || pager->in_txn)
+        return chidb_Pager_flush(pager);
+
+    pthread_mutex_lock(&pager->mutex);
+    pager->wal->nosync = true;
+    pager->wal->unsynced = false;
+    rc = chidb_Pager_writeBack(pager, true);
+    pager->wal->nosync = false;
+    if (pager->wal->unsynced)
+        *seq = ++pager->commit_seq;
+    pthread_mutex_unlock(&pager->mutex);
+
+    return rc;
+}
+
+
+/* Wait until a commit made by chidb_Pager_flushCommit is durable
+ *
+ * The first thread to wait syncs the log, after waiting commit_delay
+ * microseconds for other commits to be appended. Threads whose commits
+ * are appended while it syncs wait for it to finish, and then one of
+ * them syncs the log once for all of them (see chidb_Pager_flushCommit).
+ *
+ * Parameters
+ * - pager: A Pager.
+ * - seq: Number of the commit (0 for none).
+ *
+ * Return
+ * - CHIDB_OK: The commit is durable
+ * - CHIDB_EIO: An I/O error has occurred when syncing the log
+ */
+int chidb_Pager_syncCommit(Pager *pager, uint64_t seq)
+{
+    int rc = CHIDB_OK;
+
+    pthread_mutex_lock(&pager->mutex);
+    while (pager->synced_seq < seq && rc == CHIDB_OK)
+    {
+        uint64_t last;
+        int fd;
+
+        if (pager->syncing)
+        {
+            pthread_cond_wait(&pager->synced, &pager->mutex);
+            continue;
+        }
+
+        pager->syncing = true;
+        if (pager->commit_delay > 0)
+        {
+            pthread_mutex_unlock(&pager->mutex);
+            usleep(pager->commit_delay);
+            pthread_mutex_lock(&pager->mutex);
+        }
+
+        last = pager->commit_seq;
+        fd = pager->wal->fd;
+        pthread_mutex_unlock(&pager->mutex);
+        if (fsync(fd) != 0)
+            rc = CHIDB_EIO;
+        pthread_mutex_lock(&pager->mutex);
+
+        if (rc == CHIDB_OK)
+        {
+            pager->synced_seq = last;
+            pager->group_syncs++;
+        }
+        pager->syncing = false;
+        pthread_cond_broadcast(&pager->synced);
+    }
+    pthread_mutex_unlock(&pager->mutex);
+
+    return rc;
+}
+
+
+/* Set how long a group commit waits for commits to join it
+ *
+ * Parameters
+ * - pager: A Pager.
+ * - usec: Microseconds (0 to sync the log as soon as a commit needs it)
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ */
+int chidb_Pager_setCommitDelay(Pager *pager, uint32_t usec)
+{
+    pager->commit_delay = usec;
+
+    return CHIDB_OK;
+}
+
+
+/* Copy the pages in a journal back into the file
+ *
+ * Records are read until the end of the journal, or until one that is
+ * incomplete or does not match its checksum (the rest of the journal
+ * was never made durable, so those pages were not written to the file
+ * either). The file is then cut back to its size when the journal was
+ * started.
+ *
+ * Parameters
+ * - pager: A Pager.
+ * - journal: The journal.
+ * - n_pages: Out parameter. Number of pages in the file when the
+ *            journal was started.
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_ECORRUPT: The journal does not have a valid header
+ * - CHIDB_ENOMEM: Could not allocate memory
+ * - CHIDB_EIO: An I/O error has occurred when accessing the file
+ */
+static int chidb_Pager_playback(Pager *pager, PagerFile *journal, npage_t *n_pages)
+{
+    uint8_t header[JOURNAL_HEADER_SIZE];
+    uint8_t *rec;
+    uint32_t page_size;
+    size_t n;
+    off_t size;
+    int rc = CHIDB_OK;
+
+    if (journal->methods->read(journal, header, JOURNAL_HEADER_SIZE, 0, &n) != CHIDB_OK
+            || n != JOURNAL_HEADER_SIZE || memcmp(header, JOURNAL_MAGIC, 8) != 0)
+        return CHIDB_ECORRUPT;
+    page_size = get4byte(header + 8);
+    *n_pages = get4byte(header + 12);
+    if (!VALID_PAGE_SIZE(page_size))
+        return CHIDB_ECORRUPT;
+
+    if ((rec = malloc(JOURNAL_RECORD_SIZE(page_size))) == NULL)
         return CHIDB_ENOMEM;
-    (*pager)->f = fopen(filename, "r+");
 
-    if ((*pager)->f == NULL)
-        (*pager)->f = fopen(filename, "w+");
+    for (off_t off = JOURNAL_HEADER_SIZE;
+            journal->methods->read(journal, rec, JOURNAL_RECORD_SIZE(page_size), off, &n) == CHIDB_OK
+                && n == JOURNAL_RECORD_SIZE(page_size);
+            off += JOURNAL_RECORD_SIZE(page_size))
+    {
+        npage_t npage = get4byte(rec);
 
-    if ((*pager)->f == NULL)
-        return CHIDB_EIO;
-    else
+        if (npage == 0 || npage > *n_pages
+                || get4byte(rec + 4 + page_size) != chidb_Pager_checksum(npage, rec + 4, page_size))
+            break;
+
+        struct iovec iov = { rec + 4, page_size };
+        PagerWrite w = { &iov, 1, (off_t) (npage - 1) * page_size };
+        if ((rc = pager->file->methods->write(pager->file, &w, 1)) != CHIDB_OK)
+            break;
+    }
+    free(rec);
+
+    if (rc == CHIDB_OK && pager->file->methods->size(pager->file, &size) == CHIDB_OK
+            && size > (off_t) *n_pages * page_size
+            && pager->file->methods->truncate(pager->file, (off_t) *n_pages * page_size) != CHIDB_OK)
+        rc = CHIDB_EIO;
+
+    return rc;
+}
+
+
+/* Roll back a transaction that did not finish
+ *
+ * If the process that was running a transaction died, its journal is
+ * left behind, and the file may have some of the transaction's pages.
+ * The journal is played back, so the file is as it was before the
+ * transaction, and then deleted. A journal that is locked belongs to
+ * a transaction that is still running, and is left alone.
+ *
+ * Parameters
+ * - pager: A Pager.
+ *
+ * Return
+ * - CHIDB_OK: Operation successful (or there was no journal)
+ * - CHIDB_ENOMEM: Could not allocate memory
+ * - CHIDB_EIO: An I/O error has occurred when accessing the file
+ */
+static int chidb_Pager_recover(Pager *pager)
+{
+    PagerFile *journal;
+    npage_t n_pages;
+    int fd, rc;
+
+    if ((fd = open(pager->journal_name, O_RDWR)) < 0)
         return CHIDB_OK;
+
+    if (flock(fd, LOCK_EX | LOCK_NB) != 0)
+    {
+        close(fd);
+        return CHIDB_OK;
+    }
+    if ((rc = chidb_PagerFile_openStdio(&journal, fd)) != CHIDB_OK)
+    {
+        close(fd);
+        return rc;
+    }
+
+    // if the header is not valid, the file was never written to
+    rc = chidb_Pager_playback(pager, journal, &n_pages);
+    if (rc == CHIDB_OK)
+        rc = pager->file->methods->sync(pager->file);
+    if (rc == CHIDB_OK || rc == CHIDB_ECORRUPT)
+    {
+        unlink(pager->journal_name);
+        rc = CHIDB_OK;
+    }
+    journal->methods->close(journal);
+    close(fd);
+
+    return rc;
 }
 
 
-/* Set the page size
+/* Close and delete the journal, ending the transaction */
+static void chidb_Pager_endTransaction(Pager *pager)
+{
+    int fd = pager->journal->fd;
+
+    pager->journal->methods->close(pager->journal);
+    if (fd >= 0)
+    {
+        unlink(pager->journal_name);
+        close(fd);
+    }
+    free(pager->journaled);
+    pager->journal = NULL;
+    pager->journaled = NULL;
+    pager->in_txn = false;
+}
+
+
+/* Begin a transaction
  *
- * This tells the pager what the size of each page is.
- * This function must be called before operating on pages.
- * It will not verify if the page size makes size. If an incorrect
- * page size is provided, this will result in unexpected behaviour.
+ * Until the transaction is committed, the original contents of every
+ * page that is written are saved in a rollback journal (a file next to
+ * the database file, with "-journal" appended to its name, or a memory
+ * backend for an in-memory database). Dirty pages
+ * are not written to the file until the transaction is committed (or
+ * until they have to be evicted), and the journal is made durable
+ * before they are. If the transaction is rolled back, or the process
+ * dies before committing it, the pages in the journal are copied back.
+ *
+ * Any dirty pages are flushed first, so that the file has every change
+ * made before the transaction.
+ *
+ * In WAL mode, there is no journal: the pages written in the transaction
+ * are only committed when the transaction is, and the snapshot taken
+ * here is kept until then.
  *
  * Parameters
  * - pager: A Pager.
- * - pagesize: Size of a page (in bytes)
  *
  * Return
  * - CHIDB_OK: Operation successful
+ * - CHIDB_EMISUSE: A transaction (or a statement savepoint) has already begun
+ * - CHIDB_ENOMEM: Could not allocate memory
+ * - CHIDB_EIO: An I/O error has occurred when accessing the file or journal
  */
-int chidb_Pager_setPageSize(Pager *pager, uint16_t pagesize)
+int chidb_Pager_begin(Pager *pager)
 {
-    pager->page_size = pagesize;
-    chidb_Pager_getRealDBSize(pager, &pager->n_pages);
+    int fd, rc;
+
+    if (pager->in_txn || pager->in_stmt)
+        return CHIDB_EMISUSE;
+
+    if ((rc = chidb_Pager_flush(pager)) != CHIDB_OK)
+        return rc;
+
+    if (pager->wal != NULL)
+    {
+        if ((rc = chidb_Pager_walRead(pager)) != CHIDB_OK)
+            return rc;
+        pager->in_txn = true;
+        pager->txn_n_pages = pager->n_pages;
+        pager->txn_wal_frames = pager->wal->n_frames;
+        return CHIDB_OK;
+    }
+
+    if ((pager->journaled = calloc(pager->n_pages / 8 + 1, 1)) == NULL)
+        return CHIDB_ENOMEM;
+
+    if (pager->memory)
+        rc = chidb_PagerFile_openMemory(&pager->journal);
+    else if ((fd = open(pager->journal_name, O_RDWR | O_CREAT | O_TRUNC, 0644)) < 0)
+        rc = CHIDB_EIO;
+    else if (flock(fd, LOCK_EX) != 0 || (rc = chidb_PagerFile_openStdio(&pager->journal, fd)) != CHIDB_OK)
+    {
+        close(fd);
+        rc = CHIDB_EIO;
+    }
+    if (rc != CHIDB_OK)
+    {
+        free(pager->journaled);
+        pager->journaled = NULL;
+        return rc;
+    }
+
+    pager->in_txn = true;
+    pager->journal_synced = false;
+    pager->txn_written = false;
+    pager->txn_n_pages = pager->n_pages;
+    pager->journal_nrecords = 0;
+
+    if ((rc = chidb_Pager_journalHeader(pager, pager->journal, pager->n_pages)) != CHIDB_OK)
+    {
+        chidb_Pager_endTransaction(pager);
+        return rc;
+    }
 
     return CHIDB_OK;
 }
 
 
-/* Read the chidb file header
+/* Commit a transaction
  *
- * This function reads in the header of a chidb file and returns it
- * in a byte array. Note that this function can be called even if
- * the page size is unknown, since the chidb header always occupies
- * the first 100 bytes of the file.
+ * Flushes the dirty pages (after making the journal durable), syncs the
+ * file, and deletes the journal. Deleting the journal is what commits
+ * the transaction. If nothing was written, nothing is synced.
+ * If the pages cannot be written, the transaction is still open, and
+ * can be rolled back.
+ *
+ * In WAL mode, the pages are appended to the log, and the last one is
+ * marked as a commit frame.
  *
  * Parameters
  * - pager: A Pager.
- * - header: Pointer to a byte array with enough space for 100 bytes.
  *
  * Return
  * - CHIDB_OK: Operation successful
- * - CHIDB_NOHEADER: The file does not have a header. This will
+ * - CHIDB_EMISUSE: No transaction has begun
+ * - CHIDB_ENOMEM: Could not allocate memory
+ * - CHIDB_EIO: An I/O error has occurred when accessing the file or journal
  */
-int chidb_Pager_readHeader(Pager *pager, uint8_t *header)
+int chidb_Pager_commit(Pager *pager)
 {
-    int count;
-    count = fseek(pager->f, 0, SEEK_SET);
-    count = fread(header, 1, 100, pager->f);
-    if (count != 100)
-        return CHIDB_NOHEADER;
+    int rc;
+
+    if (!pager->in_txn)
+        return CHIDB_EMISUSE;
+
+    if (pager->wal != NULL)
+    {
+        pager->in_txn = false;
+        if ((rc = chidb_Pager_flush(pager)) != CHIDB_OK)
+            pager->in_txn = true;
+        return rc;
+    }
+
+    if ((rc = chidb_Pager_flush(pager)) != CHIDB_OK)
+        return rc;
+
+    if (pager->txn_written && (rc = pager->file->methods->sync(pager->file)) != CHIDB_OK)
+        return rc;
+
+    chidb_Pager_endTransaction(pager);
+
+    return CHIDB_OK;
+}
+
+
+/* Roll back a transaction
+ *
+ * The pages in the journal are copied back into the file, the file is
+ * cut back to its original size, and every page in the buffer pool is
+ * dropped (or, if it is pinned, read again), along with every dirty
+ * page. If the file had been written to, it is synced before the journal
+ * is deleted.
+ *
+ * In WAL mode, the frames appended in the transaction are cut off the log.
+ *
+ * Parameters
+ * - pager: A Pager.
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_EMISUSE: No transaction has begun
+ * - CHIDB_ENOMEM: Could not allocate memory
+ * - CHIDB_EIO: An I/O error has occurred when accessing the file or journal
+ */
+int chidb_Pager_rollback(Pager *pager)
+{
+    npage_t n_pages;
+    int rc;
+
+    if (!pager->in_txn)
+        return CHIDB_EMISUSE;
+
+    if (pager->wal != NULL)
+    {
+        if ((rc = chidb_Wal_rollback(pager->wal, pager->txn_wal_frames)) != CHIDB_OK)
+            return rc;
+    }
     else
-        return CHIDB_OK;
+    {
+        if ((rc = chidb_Pager_playback(pager, pager->journal, &n_pages)) != CHIDB_OK)
+            return rc;
+        if (pager->txn_written && (rc = pager->file->methods->sync(pager->file)) != CHIDB_OK)
+            return rc;
+    }
+
+    pager->n_pages = pager->txn_n_pages;
+    if (pager->reserved_pages > pager->n_pages)
+        pager->reserved_pages = pager->n_pages;
+
+    /* Changes to mapped pages live in the private mapping, not the file */
+    if ((rc = chidb_Pager_remap(pager)) != CHIDB_OK)
+        return rc;
+
+    chidb_Pager_dropFrames(pager);
+
+    if (pager->wal != NULL)
+    {
+        pager->in_txn = false;
+        chidb_Wal_endWrite(pager->wal);
+        chidb_Wal_endRead(pager->wal);
+    }
+    else
+        chidb_Pager_endTransaction(pager);
+
+    return CHIDB_OK;
 }
 
 
-/* Allocate an extra page on the file
+/* Begin a statement savepoint
+ *
+ * Outside a transaction, the pages a statement writes stay in the buffer
+ * pool until it is done, and are then flushed (see chidb_stmt_exec), but
+ * dirty pages may have to be evicted before that. A savepoint makes it
+ * possible to undo a statement that fails partway, so that it changes
+ * nothing (see chidb_Pager_endStatement): the first time one of the
+ * pages the statement started with is written to the file, it is saved
+ * in a statement journal first. The statement journal is kept in memory,
+ * and never synced, since a statement that was not done when the process
+ * died was not committed either way. In WAL mode, evicted pages are
+ * appended to the log without committing them, so there is no journal.
+ *
+ * Inside a transaction, this does nothing: a statement that fails leaves
+ * its changes in the transaction, and it is the whole transaction that
+ * is rolled back.
  *
  * Parameters
  * - pager: A Pager.
- * - npage: An out parameter that will contain the page number of the
- *          new page.
  *
  * Return
  * - CHIDB_OK: Operation successful
+ * - CHIDB_EMISUSE: A statement savepoint has already begun
+ * - Any error from chidb_Wal_beginRead
  */
-int chidb_Pager_allocatePage(Pager *pager, npage_t *npage)
+int chidb_Pager_beginStatement(Pager *pager)
 {
-    /* We simply increment the page number counter. readPage
-     * and writePage take care of the rest. */
-    *npage = ++pager->n_pages;
+    int rc;
+
+    if (pager->in_stmt)
+        return CHIDB_EMISUSE;
+    if (pager->in_txn)
+        return CHIDB_OK;
+
+    /* The statement starts from the latest snapshot of the log */
+    if ((rc = chidb_Pager_walRead(pager)) != CHIDB_OK)
+        return rc;
+
+    pager->in_stmt = true;
+    pager->stmt_n_pages = pager->n_pages;
+    pager->stmt_wal_frames = pager->wal != NULL ? pager->wal->n_frames : 0;
 
     return CHIDB_OK;
 }
 
 
-/* Read a page from file
+/* End a statement savepoint
  *
- * This page reads a page from the file, and creates an in-memory copy
- * in a MemPage struct (see header file for more details on this struct).
- * Always use chidb_Pager_releaseMemPage to free the memory allocated for
- * a MemPage created by this function.
- * Any changes done to a MemPage will not be effective until you call
- * chidb_Pager_writePage with that MemPage.
+ * If the statement is done, the statement journal is thrown away, and its
+ * pages can then be flushed as usual. If it failed, it is undone: the
+ * pages in the statement journal are copied back into the file (or, in
+ * WAL mode, the frames it appended are cut off the log), the file is cut
+ * back to its size when the statement began, and every page in the
+ * buffer pool is dropped, along with the dirty ones.
+ * Does nothing if there is no statement savepoint (e.g., inside a
+ * transaction).
  *
  * Parameters
  * - pager: A Pager.
- * - npage: Page number of page to read.
- * - page: Out parameter. Used to return a pointer to newly created MemPage
+ * - rollback: true to undo the statement.
  *
  * Return
  * - CHIDB_OK: Operation successful
  * - CHIDB_ENOMEM: Could not allocate memory
- * - CHIDB_EIO: An I/O error has occurred when accessing the file
+ * - CHIDB_EIO: An I/O error has occurred when accessing the file or log
  */
-int	chidb_Pager_readPage(Pager *pager, npage_t npage, MemPage **page)
+int chidb_Pager_endStatement(Pager *pager, bool rollback)
 {
-    if (npage > pager->n_pages || npage <= 0)
-        return CHIDB_EPAGENO;
-    int n;
+    npage_t n_pages;
+    off_t size;
+    int rc = CHIDB_OK;
 
-    *page = malloc(sizeof(MemPage));
-    if (page == NULL)
-        return CHIDB_ENOMEM;
-    (*page)->npage = npage;
-    (*page)->data = calloc(pager->page_size, 1);
-    if ((*page)->data == NULL)
-        return CHIDB_ENOMEM;
-    fseek(pager->f, (npage - 1) * pager->page_size, SEEK_SET);
-    n = fread((*page)->data, 1, pager->page_size, pager->f);
-    chilog(TRACE, "Read %i bytes from page %i into memory [%x data: %x]", n, npage, *page, (*page)->data);
+    if (!pager->in_stmt)
+        return CHIDB_OK;
+    pager->in_stmt = false;
 
-    return CHIDB_OK;
+    if (rollback)
+    {
+        if (pager->wal != NULL)
+        {
+            if (pager->wal->writing)
+            {
+                rc = chidb_Wal_rollback(pager->wal, pager->stmt_wal_frames);
+                chidb_Wal_endWrite(pager->wal);
+            }
+        }
+        else if (pager->stmt_journal != NULL)
+            rc = chidb_Pager_playback(pager, pager->stmt_journal, &n_pages);
+        else if (pager->file->methods->size(pager->file, &size) == CHIDB_OK
+                && size > (off_t) pager->stmt_n_pages * pager->page_size
+                && pager->file->methods->truncate(pager->file, (off_t) pager->stmt_n_pages * pager->page_size) != CHIDB_OK)
+            rc = CHIDB_EIO;
+
+        pager->n_pages = pager->stmt_n_pages;
+        if (pager->reserved_pages > pager->n_pages)
+            pager->reserved_pages = pager->n_pages;
+
+        if (rc == CHIDB_OK)
+            rc = chidb_Pager_remap(pager);
+        chidb_Pager_dropFrames(pager);
+    }
+
+    if (pager->stmt_journal != NULL)
+    {
+        pager->stmt_journal->methods->close(pager->stmt_journal);
+        free(pager->stmt_journaled);
+        pager->stmt_journal = NULL;
+        pager->stmt_journaled = NULL;
+    }
+
+    return rc;
 }
 
 
-/* Write a page to file
+/* Switch between rollback journal mode and WAL mode
  *
- * This page writes the in-memory copy of a page (stored in a MemPage
- * struct) back to disk.
+ * In WAL mode, pages are appended to a write-ahead log (see wal.c)
+ * instead of being written to the file, so that readers are never
+ * blocked by the writer: each one keeps reading from the snapshot it
+ * took when it started. The log is checkpointed back into the file
+ * as it grows.
+ * Switching back to rollback journal mode checkpoints the log, and
+ * deletes it. No other handle may be using the log at that point.
+ * The mode cannot be switched during a transaction, or while pages
+ * are pinned. Compressed files cannot be in WAL mode (the log is
+ * checkpointed straight into the file), and neither can in-memory
+ * databases (there is no file for the log to go next to).
  *
  * Parameters
  * - pager: A Pager.
- * - page: In-memory copy of page to write
+ * - on: true to switch to WAL mode.
  *
  * Return
  * - CHIDB_OK: Operation successful
- * - CHIDB_EPAGENO: The page has an incorrect page number
- * - CHIDB_EIO: An I/O error has occurred when accessing the file
+ * - CHIDB_EMISUSE: There is a transaction, there are pinned pages, or
+ *                  the file is compressed or in memory
+ * - CHIDB_EBUSY: Switching back, and another handle is using the log
+ * - CHIDB_ENOMEM: Could not allocate memory
+ * - CHIDB_EIO: An I/O error has occurred when accessing the files
  */
-int	chidb_Pager_writePage(Pager *pager, MemPage *page)
+int chidb_Pager_setWal(Pager *pager, bool on)
 {
-    if (page->npage > pager->n_pages)
-        return CHIDB_EPAGENO;
-    int n;
-    fseek(pager->f, (page->npage - 1) * pager->page_size, SEEK_SET);
-    n = fwrite(page->data, 1, pager->page_size, pager->f);
-    chilog(TRACE, "Wrote %i bytes to page %i", n, page->npage);
+    int rc;
+
+    if (pager->in_txn || chidb_Pager_hasPinnedFrames(pager))
+        return CHIDB_EMISUSE;
+    if (on == (pager->wal != NULL))
+        return CHIDB_OK;
+    if (on && (pager->compressed || pager->memory))
+        return CHIDB_EMISUSE;
+
+    if ((rc = chidb_Pager_flush(pager)) != CHIDB_OK)
+        return rc;
+
+    if (on)
+    {
+        if ((rc = chidb_Wal_open(&pager->wal, pager->filename, fileno(pager->f), pager->page_size)) != CHIDB_OK)
+            pager->wal = NULL;
+        return rc;
+    }
+
+    if ((rc = chidb_Pager_syncCommit(pager, pager->commit_seq)) != CHIDB_OK
+            || (rc = chidb_Pager_checkpoint(pager)) != CHIDB_OK)
+        return rc;
+
+    unlink(pager->wal->name);
+    chidb_Wal_close(pager->wal);
+    pager->wal = NULL;
+    chidb_Pager_getRealDBSize(pager, &pager->n_pages);
+
     return CHIDB_OK;
 }
 
 
+/* Checkpoint the write-ahead log
+ *
+ * Copies every page in the log back into the file, and empties the log
+ * (see chidb_Wal_checkpoint). This needs the writer lock, and no other
+ * handle can be reading.
+ *
+ * Parameters
+ * - pager: A Pager.
+ *
+ * Return
+ * - CHIDB_OK: Operation successful (or not in WAL mode)
+ * - CHIDB_EMISUSE: There is a transaction
+ * - CHIDB_EBUSY: Another handle is writing or reading
+ * - CHIDB_ENOMEM: Could not allocate memory
+ * - CHIDB_EIO: An I/O error has occurred when accessing the files
+ */
+int chidb_Pager_checkpoint(Pager *pager)
+{
+    int rc;
+
+    if (pager->wal == NULL)
+        return CHIDB_OK;
+    if (pager->in_txn)
+        return CHIDB_EMISUSE;
+
+    if ((rc = chidb_Pager_flush(pager)) != CHIDB_OK)
+        return rc;
+
+    if ((rc = chidb_Pager_walWrite(pager)) == CHIDB_OK)
+        rc = chidb_Wal_checkpoint(pager->wal);
+
+    chidb_Wal_endWrite(pager->wal);
+    chidb_Wal_endRead(pager->wal);
+
+    return rc;
+}
+
+
 /* Release an in-memory copy of a page
+ *
+ * Unpins a page returned by chidb_Pager_readPage. Pages in the buffer
+ * pool remain cached until they are evicted; private copies are freed.
  *
  * Parameters
  * - pager: A Pager.
@@ -243,12 +2701,27 @@ int	chidb_Pager_writePage(Pager *pager, MemPage *page)
  */
 int	chidb_Pager_releaseMemPage(Pager *pager, MemPage *page)
 {
-    if (page->npage > pager->n_pages)
+    /* A pinned frame may be past the last page after a rollback, and
+     * must still be unpinned */
+    if (page->npage > pager->n_pages && !page->pooled)
         return CHIDB_EPAGENO;
 
     chilog(TRACE, "Releasing page %i from memory [%x data: %x]", page->npage, page, page->data);
-    free(page->data);
-    free(page);
+    if (page->pooled)
+    {
+        if (pager->threadsafe)
+            pthread_mutex_lock(&pager->mutex);
+        if (page->pin_count > 0)
+            page->pin_count--;
+        if (pager->threadsafe)
+            pthread_mutex_unlock(&pager->mutex);
+    }
+    else
+    {
+        if (!page->mapped)
+            free(page->data);
+        free(page);
+    }
 
     return CHIDB_OK;
 }
@@ -265,15 +2738,17 @@ int	chidb_Pager_releaseMemPage(Pager *pager, MemPage *page)
  */
 int chidb_Pager_getRealDBSize(Pager *pager, npage_t *npages)
 {
-    struct stat buf;
-    fstat(fileno(pager->f), &buf);
-    *npages = buf.st_size / pager->page_size;
+    off_t size = 0;
+    pager->file->methods->size(pager->file, &size);
+    *npages = size / pager->page_size;
 
     return CHIDB_OK;
 }
 
 
 /* Closes a pager and frees up all resources used by the pager.
+ *
+ * If a transaction is still open, it is rolled back.
  *
  * Parameters
  * - pager: A Pager.
@@ -284,8 +2759,37 @@ int chidb_Pager_getRealDBSize(Pager *pager, npage_t *npages)
  */
 int chidb_Pager_close(Pager *pager)
 {
-    fclose(pager->f);
+    int rc;
+
+    /* A transaction (or statement) that was not committed is rolled back */
+    if (pager->in_txn)
+        chidb_Pager_rollback(pager);
+    chidb_Pager_endStatement(pager, true);
+
+    rc = chidb_Pager_flush(pager);
+
+    /* The log is left for whoever is still reading it */
+    if (pager->wal != NULL)
+    {
+        if (chidb_Pager_syncCommit(pager, pager->commit_seq) != CHIDB_OK)
+            rc = CHIDB_EIO;
+        chidb_Pager_checkpoint(pager);
+        chidb_Wal_close(pager->wal);
+        pager->wal = NULL;
+    }
+
+    chidb_Pager_freePool(pager);
+    if (pager->map != NULL)
+        munmap(pager->map, pager->map_size);
+    pager->file->methods->close(pager->file);
+    if (pager->f != NULL && fclose(pager->f) != 0)
+        rc = CHIDB_EIO;
+    pthread_mutex_destroy(&pager->mutex);
+    pthread_cond_destroy(&pager->synced);
+    free(pager->changed);
+    free(pager->filename);
+    free(pager->journal_name);
     free(pager);
 
-    return CHIDB_OK;
+    return rc;
 }
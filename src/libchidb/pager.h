@@ -41,31 +41,176 @@
 #define PAGER_H_
 
 #include <stdio.h>
+#include <pthread.h>
 #include "chidbInt.h"
+#include "pager-file.h"
+
+/* Opening this "file" creates an in-memory database (see chidb_Pager_open) */
+#define MEMORY_FILENAME ":memory:"
 
 struct MemPage
 {
     npage_t npage;
     uint8_t *data;
+    uint32_t size;          /* Bytes in data (the page size) */
+    uint32_t pin_count;     /* Number of outstanding readPage calls on this frame */
+    bool referenced;        /* CLOCK reference bit */
+    bool pooled;            /* False if this page lives outside the buffer pool */
+    bool mapped;            /* True if data points into the Pager's mmap'd region */
+    bool dirty;             /* Written, but not flushed to the file yet */
+    bool pending;           /* Being read asynchronously (see chidb_Pager_prefetch) */
+    uint32_t hash_next;     /* Next frame (plus one) in the same bucket of the pool's index */
+    pthread_rwlock_t latch; /* Held exclusively while the frame is being filled
+                             * (only if the Pager is shared; see chidb_Pager_setThreadsafe) */
 };
 typedef struct MemPage MemPage;
 
+/* What a Pager has done since it was opened, or since its counters
+ * were last reset (see chidb_stats) */
+typedef struct PagerStats
+{
+    uint64_t reads;         /* Pages read with chidb_Pager_readPage */
+    uint64_t writes;        /* Pages written to the file (or to the log) */
+    uint64_t hits;          /* Reads served from the buffer pool */
+    uint64_t misses;        /* Reads that had to load the page */
+    uint64_t bytes_read;    /* Bytes read from the file */
+    uint64_t bytes_written; /* Bytes written to the file (or to the log) */
+    uint64_t extents;       /* Extents of disk space reserved ahead of the file */
+} PagerStats;
+
 struct Pager
 {
-    FILE *f;
+    FILE *f;                /* NULL for an in-memory database */
+    PagerFile *file;        /* I/O backend (see chidb_Pager_setBackend) */
+    bool compressed;        /* Pages are stored compressed (see chidb_Pager_setCompression) */
+    bool memory;            /* There is no file (see chidb_Pager_open) */
+    char *filename;
     npage_t n_pages;
-    uint16_t page_size;
+    uint32_t page_size;
+
+    /* Buffer pool. Frames are allocated lazily on the first read,
+     * once the page size is known. A frame with npage == 0 is empty.
+     * The frames are indexed by page number in a hash table of
+     * hash_mask + 1 buckets, each holding the first frame (plus one, so
+     * that 0 is an empty bucket) of a chain linked by hash_next. */
+    MemPage *frames;
+    uint8_t *frame_data;
+    uint32_t *frame_hash;
+    uint32_t hash_mask;
+    uint32_t n_frames;
+    uint32_t cache_size;
+    uint32_t clock_hand;
+    uint32_t n_pending;     /* Frames being read asynchronously */
+    /* Instead of waiting for a page that is not cached, start reading it
+     * asynchronously and fail with CHIDB_PENDING, if the backend can
+     * (see chidb_Pager_poll). wait_page is the page it failed for. */
+    bool nowait;
+    npage_t wait_page;
+    /* Moves whenever pages may have changed other than through
+     * chidb_Pager_writePage (a rollback, a new snapshot of the log, a
+     * truncation, or a new page size), so that copies made of their
+     * contents can tell they are out of date (see chidb_Btree_searchInternal) */
+    uint64_t generation;
+    PagerStats stats;
+
+    /* Memory-mapped read path (see chidb_Pager_setMmapSize).
+     * Pages that fall inside the mapping are never copied. */
+    uint8_t *map;
+    size_t map_size;
+
+    /* Number of pages a sequential scan hints ahead of itself
+     * (see chidb_Pager_prefetch). 0 disables read-ahead. */
+    uint32_t readahead;
+
+    /* Disk space reserved ahead of the last page (see
+     * chidb_Pager_setPreallocation). The size of the file only covers
+     * n_pages, but the pages up to reserved_pages already have room on
+     * disk, so the file can grow into them without allocating. */
+    uint32_t preallocation; /* Pages in the smallest extent (0 disables preallocation) */
+    npage_t reserved_pages;
+
+    /* Rollback journal (see chidb_Pager_begin). The journal is only
+     * open while a transaction is. */
+    char *journal_name;
+    PagerFile *journal;
+    bool in_txn;
+    bool journal_synced;    /* Every record in the journal has been fsync'd */
+    bool txn_written;       /* The file has been written to since the transaction began */
+    npage_t txn_n_pages;    /* n_pages when the transaction began */
+    uint32_t journal_nrecords;
+    uint8_t *journaled;     /* Bitmap of the pages (up to txn_n_pages) in the journal */
+
+    /* Statement savepoint (see chidb_Pager_beginStatement). The statement
+     * journal is in memory, and is only opened if one of the pages the
+     * statement started with is written to the file before it ends. */
+    bool in_stmt;
+    npage_t stmt_n_pages;   /* n_pages when the statement began */
+    uint32_t stmt_wal_frames; /* Frames in the log when the statement began */
+    PagerFile *stmt_journal;
+    uint32_t stmt_nrecords;
+    uint8_t *stmt_journaled; /* Bitmap of the pages (up to stmt_n_pages) in the statement journal */
+
+    /* Write-ahead log (see chidb_Pager_setWal). NULL in rollback
+     * journal mode. */
+    struct Wal *wal;
+    uint32_t txn_wal_frames; /* Frames in the log when the transaction began */
+
+    /* Bitmap of the pages written since change tracking was turned on
+     * (see chidb_Pager_trackChanges). NULL if it is off. */
+    uint8_t *changed;
+    npage_t changed_pages;  /* Pages the bitmap has room for */
+
+    /* Shared between threads (see chidb_Pager_setThreadsafe). The mutex
+     * protects the buffer pool, but not the contents of the frames. */
+    bool threadsafe;
+    pthread_mutex_t mutex;
+
+    /* Group commit (see chidb_Pager_syncCommit). Commits whose log sync
+     * is left to chidb_Pager_syncCommit are numbered in the order they
+     * are appended to the log; the ones up to synced_seq are durable.
+     * Protected by mutex. */
+    uint64_t commit_seq;
+    uint64_t synced_seq;
+    uint64_t group_syncs;   /* Syncs made by chidb_Pager_syncCommit */
+    bool syncing;           /* A thread is syncing the log */
+    uint32_t commit_delay;  /* Microseconds a sync waits for other commits to join it */
+    pthread_cond_t synced;
 };
 typedef struct Pager Pager;
 
 int chidb_Pager_open(Pager **pager, const char *filename);
-int chidb_Pager_setPageSize(Pager *pager, uint16_t pagesize);
+int chidb_Pager_setPageSize(Pager *pager, uint32_t pagesize);
+int chidb_Pager_setCacheSize(Pager *pager, uint32_t nframes);
+int chidb_Pager_setMmapSize(Pager *pager, size_t size);
+int chidb_Pager_setThreadsafe(Pager *pager, bool on);
+int chidb_Pager_setBackend(Pager *pager, int backend);
+int chidb_Pager_setCompression(Pager *pager, bool on);
+int chidb_Pager_setReadahead(Pager *pager, uint32_t npages);
+int chidb_Pager_setPreallocation(Pager *pager, uint32_t npages);
+int chidb_Pager_trackChanges(Pager *pager, bool on);
+bool chidb_Pager_takeChange(Pager *pager, npage_t npage);
+npage_t chidb_Pager_countChanges(Pager *pager, npage_t npages);
 int chidb_Pager_readHeader(Pager *pager, uint8_t *header);
 int chidb_Pager_allocatePage(Pager *pager, npage_t *npage);
+int chidb_Pager_truncate(Pager *pager, npage_t npages);
 int chidb_Pager_releaseMemPage(Pager *pager, MemPage *page);
 int	chidb_Pager_readPage(Pager *pager, npage_t page_num, MemPage **page);
+int chidb_Pager_prefetch(Pager *pager, const npage_t *pages, uint32_t n);
+int chidb_Pager_poll(Pager *pager, npage_t npage, bool wait);
 int chidb_Pager_writePage(Pager *pager, MemPage *page);
+int chidb_Pager_flush(Pager *pager);
+int chidb_Pager_flushCommit(Pager *pager, uint64_t *seq);
+int chidb_Pager_syncCommit(Pager *pager, uint64_t seq);
+int chidb_Pager_setCommitDelay(Pager *pager, uint32_t usec);
+int chidb_Pager_begin(Pager *pager);
+int chidb_Pager_commit(Pager *pager);
+int chidb_Pager_rollback(Pager *pager);
+int chidb_Pager_beginStatement(Pager *pager);
+int chidb_Pager_endStatement(Pager *pager, bool rollback);
+int chidb_Pager_setWal(Pager *pager, bool on);
+int chidb_Pager_checkpoint(Pager *pager);
 int chidb_Pager_getRealDBSize(Pager *pager, npage_t *npages);
 int chidb_Pager_close(Pager *pager);
+bool chidb_Pager_hasPinnedFrames(Pager *pager);
 
 #endif /*PAGER_H_*/
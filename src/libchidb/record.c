@@ -193,6 +193,65 @@ int chidb_DBRecord_appendInt32(DBRecordBuffer *dbrb, int32_t v)
     return CHIDB_OK;
 }
 
+
+/* Append a 6-byte integer to an initialized DBRecordBuffer
+ *
+ * Parameters
+ * - dbrb: Initialized DBRecordBuffer
+ * - v: Value to append (must fit in 48 bits)
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_ENOMEM: Could not allocate memory
+ */
+int chidb_DBRecord_appendInt48(DBRecordBuffer *dbrb, int64_t v)
+{
+    dbrb->dbr->offsets[dbrb->field] = dbrb->offset;
+
+    dbrb->dbr->types[dbrb->field] = SQL_INTEGER_6BYTE;
+    if (dbrb->offset + 6 > dbrb->buf_size)
+    {
+        dbrb->buf_size += 1024;
+        dbrb->dbr->data = realloc(dbrb->dbr->data, dbrb->buf_size);
+    }
+    put2byte(&dbrb->dbr->data[dbrb->offset], (uint16_t)(v >> 32));
+    put4byte(&dbrb->dbr->data[dbrb->offset + 2], (uint32_t) v);
+    dbrb->offset += 6;
+    dbrb->header_size++;
+    dbrb->field++;
+
+    return CHIDB_OK;
+}
+
+
+/* Append an 8-byte integer to an initialized DBRecordBuffer
+ *
+ * Parameters
+ * - dbrb: Initialized DBRecordBuffer
+ * - v: Value to append
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_ENOMEM: Could not allocate memory
+ */
+int chidb_DBRecord_appendInt64(DBRecordBuffer *dbrb, int64_t v)
+{
+    dbrb->dbr->offsets[dbrb->field] = dbrb->offset;
+
+    dbrb->dbr->types[dbrb->field] = SQL_INTEGER_8BYTE;
+    if (dbrb->offset + 8 > dbrb->buf_size)
+    {
+        dbrb->buf_size += 1024;
+        dbrb->dbr->data = realloc(dbrb->dbr->data, dbrb->buf_size);
+    }
+    put8byte(&dbrb->dbr->data[dbrb->offset], v);
+    dbrb->offset += 8;
+    dbrb->header_size++;
+    dbrb->field++;
+
+    return CHIDB_OK;
+}
+
 /* Append a NULL value to an initialized DBRecordBuffer
  *
  * Parameters
@@ -231,7 +290,8 @@ int chidb_DBRecord_appendString(DBRecordBuffer *dbrb,  char *v)
     len = strlen(v);
     if (dbrb->offset + len > dbrb->buf_size)
     {
-        dbrb->buf_size += 1024;
+        // a string can be longer than a page (see chidb_Btree_spill)
+        dbrb->buf_size = dbrb->offset + len + 1024;
         dbrb->dbr->data = realloc(dbrb->dbr->data, dbrb->buf_size);
     }
     memcpy(&dbrb->dbr->data[dbrb->offset], v, len);
@@ -270,74 +330,159 @@ int chidb_DBRecord_finalize(DBRecordBuffer *dbrb, DBRecord **dbr)
 }
 
 
-/* Create a DBRecord from a raw binary database record
+/* Bytes of data taken by a field of each type below SQL_TEXT. Invalid
+ * types take none, as do even types from SQL_TEXT on (only odd ones
+ * are text). */
+static const uint8_t field_sizes[SQL_TEXT] = {0, 1, 2, 0, 4, 6, 8};
+
+#define RECORD_HIGH_BITS UINT64_C(0x8080808080808080)
+
+/* Same as getVarint32, without the call */
+#define RECORD_VARINT32(p) ((((uint32_t) (p)[0] & 0x7F) << 21) | (((uint32_t) (p)[1] & 0x7F) << 14) | \
+                            (((uint32_t) (p)[2] & 0x7F) << 7) | ((uint32_t) (p)[3] & 0x7F))
+
+static inline uint32_t chidb_DBRecord_fieldSize(uint32_t type)
+{
+    if(type < SQL_TEXT)
+        return field_sizes[type];
+    return (type & 1) ? (type - SQL_TEXT) / 2 : 0;
+}
+
+
+/* Decode the header of a raw binary database record in place
+ *
+ * Nothing is allocated or copied: the types and offsets arrays of the
+ * DBRecord must already have room for DBRECORD_MAX_FIELDS fields, and its
+ * data is left pointing into the raw record. This is meant for callers
+ * that read a few fields of many records (e.g., the Column instruction)
+ * and can reuse the same arrays for each of them.
  *
  * Parameters
- * - dbr: Out paremeter used to return a pointer to a DBRecord.
+ * - dbr: DBRecord with preallocated types and offsets arrays
  * - raw: Pointer to first byte of raw binary database record
  *
  * Return
  * - CHIDB_OK: Operation successful
- * - CHIDB_ENOMEM: Could not allocate memory
  */
-int chidb_DBRecord_unpack(DBRecord **dbr, uint8_t *raw)
+int chidb_DBRecord_unpackHeader(DBRecord *dbr, uint8_t *raw)
 {
-    *dbr = malloc(sizeof(DBRecord));
-    if (dbr == NULL)
-        return CHIDB_ENOMEM;
+    uint32_t header_pos = 1;
 
-    (*dbr)->nfields = 0;
+    dbr->nfields = 0;
+    dbr->data_len = 0;
 
-    uint8_t header_size = raw[0];
-    uint8_t header_pos = 1;
-    (*dbr)->types = malloc(0xFF * sizeof(uint32_t));
-    while(header_pos < header_size)
+    return chidb_DBRecord_unpackHeaderTo(dbr, raw, &header_pos, DBRECORD_MAX_FIELDS);
+}
+
+/* Decode more of the header of a raw binary database record in place
+ *
+ * Like chidb_DBRecord_unpackHeader, but only until the first nfields
+ * fields have been decoded (or the header ends). The dbr->nfields fields
+ * that were decoded before, whose types end at *header_pos in the header,
+ * are not decoded again, so a caller that only reads the first few fields
+ * of a wide record never decodes the types of the rest. dbr->nfields,
+ * data_len and packed_len only count the fields decoded so far. To start
+ * from the beginning, set dbr->nfields and dbr->data_len to 0 and
+ * *header_pos to 1.
+ *
+ * Runs of single-byte types, which is what integers and NULLs take, are
+ * found and copied eight bytes at a time. The offsets are then a running
+ * sum of the sizes of the fields, which come from a table.
+ *
+ * Parameters
+ * - dbr: DBRecord with preallocated types and offsets arrays
+ * - raw: Pointer to first byte of raw binary database record
+ * - header_pos: In/out parameter. Position in the header of the type of
+ *               the next field to decode.
+ * - nfields: Number of fields that should be decoded once done
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ */
+int chidb_DBRecord_unpackHeaderTo(DBRecord *dbr, uint8_t *raw, uint32_t *header_pos, uint32_t nfields)
+{
+    uint32_t *types = dbr->types, *offsets = dbr->offsets;
+    uint32_t header_size = raw[0];
+    uint32_t pos = *header_pos, n = dbr->nfields, first = n;
+
+    if(nfields > DBRECORD_MAX_FIELDS)
+        nfields = DBRECORD_MAX_FIELDS;
+
+    while(pos < header_size && n < nfields)
     {
-        if (raw[header_pos] & 0x80)
+        uint64_t word;
+
+        // eight single-byte types at once, while there are eight of them
+        if(pos + 8 <= header_size && n + 8 <= nfields)
         {
-            getVarint32(&raw[header_pos], &(*dbr)->types[(*dbr)->nfields]);
-            header_pos += 4;
+            memcpy(&word, &raw[pos], 8);
+            if(!(word & RECORD_HIGH_BITS))
+            {
+                for(int i = 0; i < 8; i++)
+                    types[n + i] = raw[pos + i];
+                pos += 8;
+                n += 8;
+                continue;
+            }
         }
-        else
+
+        if(raw[pos] & 0x80)
         {
-            (*dbr)->types[(*dbr)->nfields] = raw[header_pos];
-            header_pos += 1;
+            types[n++] = RECORD_VARINT32(&raw[pos]);
+            pos += 4;
         }
-
-        (*dbr)->nfields++;
+        else
+            types[n++] = raw[pos++];
     }
-    (*dbr)->types = realloc((*dbr)->types, (*dbr)->nfields * sizeof(uint32_t));
 
-    uint32_t offset = 0;
-    (*dbr)->offsets = malloc((*dbr)->nfields * sizeof(uint32_t));
-    if ((*dbr)->offsets == NULL)
-        return CHIDB_ENOMEM;
-    for(int i=0; i<(*dbr)->nfields; i++)
+    // the offsets are the running sum of the sizes
+    uint32_t offset = dbr->data_len;
+    for(uint32_t i = first; i < n; i++)
     {
-        (*dbr)->offsets[i] = offset;
-        int type = chidb_DBRecord_getType(*dbr, i);
-        if (type == SQL_NULL)
-            offset += 0;
-        else if (type == SQL_INTEGER_1BYTE)
-            offset += 1;
-        else if (type == SQL_INTEGER_2BYTE)
-            offset += 2;
-        else if (type == SQL_INTEGER_4BYTE)
-            offset += 4;
-        else if (type == SQL_TEXT)
-        {
-            int len;
-            chidb_DBRecord_getStringLength(*dbr, i, &len);
-            offset += len;
-        }
+        offsets[i] = offset;
+        offset += chidb_DBRecord_fieldSize(types[i]);
     }
 
-    (*dbr)->data_len = offset;
-    (*dbr)->packed_len = header_size + offset;
-    (*dbr)->data = malloc(offset);
+    *header_pos = pos;
+    dbr->nfields = n;
+    dbr->data_len = offset;
+    dbr->packed_len = header_size + offset;
+    dbr->data = raw + header_size;
+
+    return CHIDB_OK;
+}
+
+
+/* Create a DBRecord from a raw binary database record
+ *
+ * Parameters
+ * - dbr: Out paremeter used to return a pointer to a DBRecord.
+ * - raw: Pointer to first byte of raw binary database record
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_ENOMEM: Could not allocate memory
+ */
+int chidb_DBRecord_unpack(DBRecord **dbr, uint8_t *raw)
+{
+    *dbr = malloc(sizeof(DBRecord));
+    if (*dbr == NULL)
+        return CHIDB_ENOMEM;
+
+    (*dbr)->types = malloc(DBRECORD_MAX_FIELDS * sizeof(uint32_t));
+    (*dbr)->offsets = malloc(DBRECORD_MAX_FIELDS * sizeof(uint32_t));
+    if ((*dbr)->types == NULL || (*dbr)->offsets == NULL)
+        return CHIDB_ENOMEM;
+
+    chidb_DBRecord_unpackHeader(*dbr, raw);
+
+    (*dbr)->types = realloc((*dbr)->types, (*dbr)->nfields * sizeof(uint32_t));
+    (*dbr)->offsets = realloc((*dbr)->offsets, (*dbr)->nfields * sizeof(uint32_t));
+
+    (*dbr)->data = malloc((*dbr)->data_len);
     if ((*dbr)->data == NULL)
         return CHIDB_ENOMEM;
-    memcpy((*dbr)->data, raw + header_size, (*dbr)->data_len);
+    memcpy((*dbr)->data, raw + raw[0], (*dbr)->data_len);
 
     return CHIDB_OK;
 }
@@ -389,13 +534,15 @@ int chidb_DBRecord_pack(DBRecord *dbr, uint8_t **p)
  *
  * Return
  * - SQL_NULL, SQL_INTEGER_1BYTE, SQL_INTEGER_2BYTE, SQL_INTEGER_4BYTE,
- *   or SQL_TEXT depending on the field type.
+ *   SQL_INTEGER_6BYTE, SQL_INTEGER_8BYTE, or SQL_TEXT depending on the
+ *   field type.
  * - SQL_NOTVALID if the specified field has an invalid field type.
  */
 int chidb_DBRecord_getType(DBRecord *dbr, uint8_t field)
 {
     if(dbr->types[field] == SQL_NULL || dbr->types[field] == SQL_INTEGER_1BYTE ||
-            dbr->types[field] == SQL_INTEGER_2BYTE || dbr->types[field] == SQL_INTEGER_4BYTE)
+            dbr->types[field] == SQL_INTEGER_2BYTE || dbr->types[field] == SQL_INTEGER_4BYTE ||
+            dbr->types[field] == SQL_INTEGER_6BYTE || dbr->types[field] == SQL_INTEGER_8BYTE)
         return dbr->types[field];
     else if ((dbr->types[field] - SQL_TEXT) % 2 == 0)
         return SQL_TEXT;
@@ -458,6 +605,99 @@ int chidb_DBRecord_getInt32(DBRecord *dbr, uint8_t field, int32_t *v)
 }
 
 
+/* Returns the value of an integer field of any size
+ *
+ * Parameters
+ * - dbr: The DBRecord
+ * - field: Index of the field
+ * - v: Out parameter used to return the value
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_EMISMATCH: The field is not an integer
+ */
+int chidb_DBRecord_getInt64(DBRecord *dbr, uint8_t field, int64_t *v)
+{
+    uint8_t *p = &dbr->data[dbr->offsets[field]];
+
+    switch(chidb_DBRecord_getType(dbr, field))
+    {
+    case SQL_INTEGER_1BYTE:
+        *v = (int8_t) p[0];
+        break;
+    case SQL_INTEGER_2BYTE:
+        *v = (int16_t) get2byte(p);
+        break;
+    case SQL_INTEGER_4BYTE:
+        *v = (int32_t) get4byte(p);
+        break;
+    case SQL_INTEGER_6BYTE:
+        // sign-extend the top two bytes
+        *v = ((int64_t) (int16_t) get2byte(p) << 32) | get4byte(p + 2);
+        break;
+    case SQL_INTEGER_8BYTE:
+        *v = (int64_t) get8byte(p);
+        break;
+    default:
+        return CHIDB_EMISMATCH;
+    }
+
+    return CHIDB_OK;
+}
+
+
+/* Returns an integer field straight from a raw record
+ *
+ * Only the types of the fields up to this one are read from the header,
+ * which makes this much cheaper than unpacking the record when a single
+ * field is needed (see chidb_dbm_cursor_filter).
+ *
+ * Parameters
+ * - raw: Pointer to first byte of raw binary database record
+ * - len: Number of bytes of the record available at raw
+ * - field: Index of the field
+ * - v: Out parameter used to return the value
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_EMISMATCH: The field is not an integer, it does not exist, or
+ *                    it is not within the first len bytes
+ */
+int chidb_DBRecord_peekInt64(const uint8_t *raw, uint32_t len, uint8_t field, int64_t *v)
+{
+    uint32_t header_size, pos = 1, offset = 0, type = SQL_NULL;
+    DBRecord dbr = { .types = &type, .nfields = 1 };
+
+    if (len == 0 || (header_size = raw[0]) > len)
+        return CHIDB_EMISMATCH;
+
+    for (uint32_t i = 0; i <= field; i++)
+    {
+        if (pos >= header_size || ((raw[pos] & 0x80) && pos + 4 > header_size))
+            return CHIDB_EMISMATCH;
+        if (raw[pos] & 0x80)
+        {
+            type = RECORD_VARINT32(&raw[pos]);
+            pos += 4;
+        }
+        else
+            type = raw[pos++];
+
+        if (i < field)
+            offset += chidb_DBRecord_fieldSize(type);
+    }
+
+    if (type == SQL_NULL || type > SQL_INTEGER_8BYTE || type == 3
+            || header_size + offset + field_sizes[type] > len)
+        return CHIDB_EMISMATCH;
+
+    dbr.data = (uint8_t *) raw + header_size;
+    dbr.offsets = &offset;
+
+    return chidb_DBRecord_getInt64(&dbr, 0, v);
+}
+
+
 /* Returns the value of a string field
  *
  * Parameters
@@ -533,6 +773,12 @@ int chidb_DBRecord_print(DBRecord *dbr)
             chidb_DBRecord_getInt32(dbr, i, (int32_t *) &i32);
             printf("| %i ", i32);
         }
+        else if (type == SQL_INTEGER_6BYTE || type == SQL_INTEGER_8BYTE)
+        {
+            int64_t i64;
+            chidb_DBRecord_getInt64(dbr, i, &i64);
+            printf("| %lli ", (long long) i64);
+        }
         else if (type == SQL_TEXT)
         {
             char *s;
@@ -561,8 +807,10 @@ int chidb_DBRecord_print(DBRecord *dbr)
  * - i1: A 1-byte integer
  * - i2: A 2-byte integer
  * . i4: A 4-byte integer
+ * - i6: A 6-byte integer
+ * - i8: An 8-byte integer
  *
- * For example, "|s|0|i1|i2|i4|".
+ * For example, "|s|0|i1|i2|i4|i8|".
  *
  * Parameters
  * - dbr: Out parameter to return the DBRecord
@@ -596,6 +844,7 @@ int chidb_DBRecord_create(DBRecord **dbr, const char *spec, ...)
         uint8_t i8;
         uint16_t i16;
         uint32_t i32;
+        int64_t i64;
 
         switch(*aux++)
         {
@@ -615,6 +864,14 @@ int chidb_DBRecord_create(DBRecord **dbr, const char *spec, ...)
                 i32 = va_arg(args, int);
                 chidb_DBRecord_appendInt32(&dbrb, i32);
                 break;
+            case '6':
+                i64 = va_arg(args, int64_t);
+                chidb_DBRecord_appendInt48(&dbrb, i64);
+                break;
+            case '8':
+                i64 = va_arg(args, int64_t);
+                chidb_DBRecord_appendInt64(&dbrb, i64);
+                break;
             }
 
             break;
@@ -42,6 +42,8 @@
 
 #include "chidbInt.h"
 
+#define DBRECORD_MAX_FIELDS (255) // nfields is a single byte
+
 struct DBRecord
 {
     uint8_t *data;
@@ -56,7 +58,7 @@ typedef struct DBRecord DBRecord;
 struct DBRecordBuffer
 {
     DBRecord *dbr;
-    uint16_t buf_size;
+    uint32_t buf_size;
     uint8_t field;
     uint32_t offset;
     uint8_t header_size;
@@ -69,11 +71,15 @@ int chidb_DBRecord_create_empty(DBRecordBuffer *dbrb, uint8_t nfields);
 int chidb_DBRecord_appendInt8(DBRecordBuffer *dbrb, int8_t v);
 int chidb_DBRecord_appendInt16(DBRecordBuffer *dbrb, int16_t v);
 int chidb_DBRecord_appendInt32(DBRecordBuffer *dbrb, int32_t v);
+int chidb_DBRecord_appendInt48(DBRecordBuffer *dbrb, int64_t v);
+int chidb_DBRecord_appendInt64(DBRecordBuffer *dbrb, int64_t v);
 int chidb_DBRecord_appendNull(DBRecordBuffer *dbrb);
 int chidb_DBRecord_appendString(DBRecordBuffer *dbrb,  char *v);
 int chidb_DBRecord_finalize(DBRecordBuffer *dbrb, DBRecord **dbr);
 
 int chidb_DBRecord_unpack(DBRecord **dbr, uint8_t *);
+int chidb_DBRecord_unpackHeader(DBRecord *dbr, uint8_t *raw);
+int chidb_DBRecord_unpackHeaderTo(DBRecord *dbr, uint8_t *raw, uint32_t *header_pos, uint32_t nfields);
 int chidb_DBRecord_pack(DBRecord *dbr, uint8_t **);
 
 int chidb_DBRecord_getType(DBRecord *dbr, uint8_t field);
@@ -81,6 +87,8 @@ int chidb_DBRecord_getType(DBRecord *dbr, uint8_t field);
 int chidb_DBRecord_getInt8(DBRecord *dbr, uint8_t field, int8_t *v);
 int chidb_DBRecord_getInt16(DBRecord *dbr, uint8_t field, int16_t *v);
 int chidb_DBRecord_getInt32(DBRecord *dbr, uint8_t field, int32_t *v);
+int chidb_DBRecord_getInt64(DBRecord *dbr, uint8_t field, int64_t *v);
+int chidb_DBRecord_peekInt64(const uint8_t *raw, uint32_t len, uint8_t field, int64_t *v);
 int chidb_DBRecord_getString(DBRecord *dbr, uint8_t field, char **v);
 int chidb_DBRecord_getStringLength(DBRecord *dbr, uint8_t field, int *len);
 
@@ -0,0 +1,515 @@
+/*
+ *  chidb - a didactic relational database management system
+ *
+ *  Result cache
+ *
+ */
+
+/*
+ *  Copyright (c) 2009-2015, The University of Chicago
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or withsend
+ *  modification, are permitted provided that the following conditions are met:
+ *
+ *  - Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ *  - Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ *  - Neither the name of The University of Chicago nor the names of its
+ *    contributors may be used to endorse or promote products derived from this
+ *    software withsend specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ *  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ *  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ *  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ *  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ *  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ *  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ *  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ *  ARISING IN ANY WAY send OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ *  POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+/*
+ * Dashboards and the like run the same read-only statements over and
+ * over, against tables that hardly ever change. Each database can keep
+ * the rows such statements returned, up to a budget of bytes (see
+ * chidb_set_result_cache), and return them again, instead of running
+ * the program, the next time the same cached program (see stmt-cache.c)
+ * is run with the same parameters.
+ *
+ * A result is only returned while the tables it was read from are as
+ * they were. Each B-Tree has a write version, which goes up whenever
+ * an entry is added to or removed from it. The versions are kept in
+ * RESULT_VERSION_SLOTS slots, the one for a B-Tree being its root page
+ * modulo the number of slots (B-Trees that share a slot only make each
+ * other's results go sooner). The root pages a program opens are
+ * constants in it, so the slots it reads from are known when it is
+ * cached. A result remembers the versions it was read at, and is only
+ * returned if none of the program's slots have changed since. Changes
+ * that undo writes or move B-Trees around (rolling back, vacuuming), or
+ * that write the stats table, bump every version.
+ *
+ * Only writes made through the same database handle are seen.
+ */
+
+#include "result-cache.h"
+#include "stmt-cache.h"
+#include "memory.h"
+#include "dbm.h"
+
+
+static void chidb_result_unlink(chidb_result_cache_t *cache, chidb_result_t *r)
+{
+    if (r->prev)
+        r->prev->next = r->next;
+    else
+        cache->head = r->next;
+
+    if (r->next)
+        r->next->prev = r->prev;
+    else
+        cache->tail = r->prev;
+
+    r->prev = r->next = NULL;
+    cache->used -= r->size;
+}
+
+static void chidb_result_push(chidb_result_cache_t *cache, chidb_result_t *r)
+{
+    r->prev = NULL;
+    r->next = cache->head;
+
+    if (cache->head)
+        cache->head->prev = r;
+    else
+        cache->tail = r;
+
+    cache->head = r;
+    cache->used += r->size;
+}
+
+/* Releases a reference to a result, which is freed once nothing
+ * refers to it. The cache's mutex must be held. */
+static void chidb_result_release(chidb_result_t *r)
+{
+    if (--r->refs > 0)
+        return;
+
+    for (uint32_t i = 0; i < r->nrows; i++)
+        free(r->rows[i]);
+    free(r->rows);
+    free(r->params);
+    chidb_stmt_cache_release(r->program);
+    free(r);
+}
+
+/* Drops the least recently used results until the ones left take up
+ * at most used bytes. The cache's mutex must be held. */
+static void chidb_result_evict(chidb_result_cache_t *cache, size_t used)
+{
+    while (cache->tail != NULL && cache->used > used)
+    {
+        chidb_result_t *lru = cache->tail;
+
+        chidb_result_unlink(cache, lru);
+        chidb_result_release(lru);
+    }
+}
+
+/* Is a result still what its program would return? */
+static bool chidb_result_valid(chidb_result_cache_t *cache, chidb_result_t *r)
+{
+    uint64_t tables = r->program->tables;
+
+    for (uint32_t i = 0; tables != 0; i++, tables >>= 1)
+        if ((tables & 1) && r->versions[i] != cache->versions[i])
+            return false;
+
+    return true;
+}
+
+/* Were a result's rows returned for these parameter values? */
+static bool chidb_result_params_eq(chidb_dbm_sorter_row_t *params, chidb_dbm_register_t *values)
+{
+    for (uint32_t i = 0; i < params->nfields; i++)
+    {
+        chidb_dbm_register_t *a = &params->fields[i], *b = &values[i];
+
+        if (a->type != b->type)
+            return false;
+        if (a->type == REG_STRING && strcmp(a->value.s, b->value.s) != 0)
+            return false;
+        if ((a->type == REG_INT32 || a->type == REG_INT64) && a->value.i != b->value.i)
+            return false;
+    }
+
+    return true;
+}
+
+/* Stops keeping the rows of the statement's result */
+static void chidb_result_drop(chidb_stmt *stmt)
+{
+    chidb_result_cache_t *cache = &stmt->db->result_cache;
+
+    pthread_mutex_lock(&cache->mutex);
+    chidb_result_release(stmt->result);
+    pthread_mutex_unlock(&cache->mutex);
+
+    stmt->result = NULL;
+    stmt->replaying = false;
+}
+
+
+/* Initialize an empty result cache, which keeps no results until it is
+ * given a budget (see chidb_result_cache_resize)
+ *
+ * Parameters
+ * - cache: Result cache
+ */
+void chidb_result_cache_init(chidb_result_cache_t *cache)
+{
+    cache->head = NULL;
+    cache->tail = NULL;
+    cache->used = 0;
+    cache->budget = 0;
+    memset(cache->versions, 0, sizeof(cache->versions));
+    pthread_mutex_init(&cache->mutex, NULL);
+}
+
+/* Free the results in a result cache, and the cache itself
+ *
+ * Parameters
+ * - cache: Result cache
+ */
+void chidb_result_cache_free(chidb_result_cache_t *cache)
+{
+    chidb_result_cache_resize(cache, 0);
+    pthread_mutex_destroy(&cache->mutex);
+}
+
+/* Change the number of bytes of results a cache keeps
+ *
+ * The least recently used results are dropped until the ones left fit.
+ *
+ * Parameters
+ * - cache: Result cache
+ * - budget: Bytes of results kept at most. If 0, none are.
+ */
+void chidb_result_cache_resize(chidb_result_cache_t *cache, size_t budget)
+{
+    pthread_mutex_lock(&cache->mutex);
+
+    cache->budget = budget;
+    chidb_result_evict(cache, budget);
+
+    pthread_mutex_unlock(&cache->mutex);
+}
+
+/* Drop the least recently used results of a cache, to free memory for
+ * something else (see chidb_memory_charge)
+ *
+ * Parameters
+ * - cache: Result cache
+ * - bytes: Bytes of results to drop (all of them, if there are fewer)
+ */
+void chidb_result_cache_trim(chidb_result_cache_t *cache, size_t bytes)
+{
+    pthread_mutex_lock(&cache->mutex);
+
+    chidb_result_evict(cache, cache->used > bytes ? cache->used - bytes : 0);
+
+    pthread_mutex_unlock(&cache->mutex);
+}
+
+/* Note that a B-Tree is being written to
+ *
+ * Cached results read from it are not returned anymore. Must not be
+ * called while statements are reading the database.
+ *
+ * Parameters
+ * - db: Database
+ * - root: Root page of the B-Tree
+ */
+void chidb_result_cache_written(chidb *db, npage_t root)
+{
+    db->result_cache.versions[root % RESULT_VERSION_SLOTS]++;
+}
+
+/* Note that any B-Tree may have changed (see chidb_result_cache_written)
+ *
+ * Parameters
+ * - db: Database
+ */
+void chidb_result_cache_written_all(chidb *db)
+{
+    for (uint32_t i = 0; i < RESULT_VERSION_SLOTS; i++)
+        db->result_cache.versions[i]++;
+}
+
+/* Find the version slots of the B-Trees a program reads
+ *
+ * Parameters
+ * - stmt: Verified statement
+ * - tables: Out parameter. One bit set for each slot.
+ *
+ * Return
+ * - true if the results of the program can be cached: it only reads,
+ *   and every B-Tree it opens has its root page loaded by an Integer
+ * - false otherwise
+ */
+bool chidb_result_cache_tables(chidb_stmt *stmt, uint64_t *tables)
+{
+    *tables = 0;
+
+    if (!stmt->readonly)
+        return false;
+
+    for (uint32_t i = 0; i < stmt->endOp; i++)
+    {
+        bool found = false;
+
+        if (stmt->ops[i].opcode != Op_OpenRead)
+            continue;
+
+        for (uint32_t j = 0; j < stmt->endOp; j++)
+        {
+            if (!chidb_stmt_op_uses_reg(&stmt->ops[j], stmt->ops[i].p2, true))
+                continue;
+            if (stmt->ops[j].opcode != Op_Integer)
+                return false;
+            *tables |= (uint64_t) 1 << ((uint32_t) stmt->ops[j].p1 % RESULT_VERSION_SLOTS);
+            found = true;
+        }
+
+        if (!found)
+            return false;
+    }
+
+    return true;
+}
+
+
+/* Start returning a cached result, or keeping the rows of a new one
+ *
+ * Called when a statement is stepped. If the statement has not started
+ * running, its results can be cached, and the cache has a result that
+ * is still valid for its program and parameters, the statement returns
+ * the rows of that result from then on (see chidb_result_cache_next).
+ * Otherwise, it keeps the rows the program returns (see
+ * chidb_result_cache_keep). Results found to be out of date on the way
+ * are dropped.
+ *
+ * Not being able to keep the rows is not an error: the statement just
+ * runs as usual.
+ *
+ * Parameters
+ * - stmt: Statement
+ */
+void chidb_result_cache_start(chidb_stmt *stmt)
+{
+    chidb_result_cache_t *cache = &stmt->db->result_cache;
+    chidb_stmt_cache_entry_t *program = stmt->program;
+    chidb_result_t *r, *next;
+
+    if (stmt->pc != 0 || stmt->result != NULL || stmt->explain || stmt->profile != NULL ||
+        program == NULL || !program->reusable || cache->budget == 0)
+        return;
+
+    pthread_mutex_lock(&cache->mutex);
+
+    for (r = cache->head; r != NULL; r = next)
+    {
+        next = r->next;
+
+        if (!chidb_result_valid(cache, r))
+        {
+            chidb_result_unlink(cache, r);
+            chidb_result_release(r);
+        }
+        else if (r->program == program && chidb_result_params_eq(r->params, stmt->params))
+            break;
+    }
+
+    if (r != NULL)
+    {
+        /* Most recently used goes first */
+        chidb_result_unlink(cache, r);
+        chidb_result_push(cache, r);
+        r->refs++;
+
+        stmt->result = r;
+        stmt->replaying = true;
+        stmt->result_row = 0;
+    }
+    else if ((r = calloc(1, sizeof(chidb_result_t))) != NULL)
+    {
+        if ((r->params = chidb_dbm_sorter_row_create(stmt->params, stmt->nParams)) == NULL)
+            free(r);
+        else
+        {
+            r->program = program;
+            program->refs++;
+            memcpy(r->versions, cache->versions, sizeof(r->versions));
+            r->size = sizeof(chidb_result_t) + r->params->size;
+            r->refs = 1;
+
+            stmt->result = r;
+            stmt->replaying = false;
+        }
+    }
+
+    pthread_mutex_unlock(&cache->mutex);
+}
+
+/* Return the next row of a cached result
+ *
+ * The row's fields are put in the first registers of the program,
+ * which become the result row.
+ *
+ * Parameters
+ * - stmt: Statement returning a cached result
+ *
+ * Return
+ * - CHIDB_ROW: There is a row
+ * - CHIDB_DONE: Every row has been returned
+ */
+int chidb_result_cache_next(chidb_stmt *stmt)
+{
+    chidb_result_t *r = stmt->result;
+    chidb_dbm_sorter_row_t *row;
+
+    if (stmt->result_row == r->nrows)
+        return CHIDB_DONE;
+
+    row = r->rows[stmt->result_row++];
+    for (uint32_t i = 0; i < row->nfields; i++)
+    {
+        chidb_dbm_register_t *reg = &stmt->reg[i];
+
+        if (!reg->borrowed && reg->type == REG_STRING)
+            free(reg->value.s);
+        else if (!reg->borrowed && reg->type == REGISTER_BINARY)
+            free(reg->value.bin.bytes);
+        *reg = row->fields[i];
+    }
+    stmt->startRR = 0;
+    stmt->nRR = row->nfields;
+
+    return CHIDB_ROW;
+}
+
+/* Keep what a step of a statement returned in its result
+ *
+ * Rows are added to the result. Once the program is done, the result
+ * goes in the cache, unless a table it read from was written to while
+ * it ran. If the statement fails, or its rows take up more than the
+ * whole budget, the result is dropped. Under a memory limit (see
+ * chidb_memory_charge), the results only get what the rest of the
+ * handle leaves.
+ *
+ * Parameters
+ * - stmt: Statement keeping its result
+ * - rc: What the step returned
+ */
+void chidb_result_cache_keep(chidb_stmt *stmt, int rc)
+{
+    chidb_result_cache_t *cache = &stmt->db->result_cache;
+    chidb_result_t *r = stmt->result;
+
+    if (r == NULL || stmt->replaying)
+        return;
+
+    if (rc == CHIDB_ROW)
+    {
+        chidb_dbm_sorter_row_t *row;
+
+        if (r->nrows == r->cap)
+        {
+            uint32_t cap = r->cap ? 2 * r->cap : 16;
+            chidb_dbm_sorter_row_t **rows = realloc(r->rows, cap * sizeof(chidb_dbm_sorter_row_t *));
+
+            if (rows == NULL)
+            {
+                chidb_result_drop(stmt);
+                return;
+            }
+            r->rows = rows;
+            r->size += (cap - r->cap) * sizeof(chidb_dbm_sorter_row_t *);
+            r->cap = cap;
+        }
+
+        if ((row = chidb_dbm_sorter_row_create(&stmt->reg[stmt->startRR], stmt->nRR)) == NULL)
+        {
+            chidb_result_drop(stmt);
+            return;
+        }
+        r->rows[r->nrows++] = row;
+        r->size += row->size;
+
+        if (r->size > cache->budget)
+            chidb_result_drop(stmt);
+        return;
+    }
+
+    if (rc != CHIDB_DONE)
+    {
+        chidb_result_drop(stmt);
+        return;
+    }
+
+    pthread_mutex_lock(&cache->mutex);
+
+    size_t budget = cache->budget, room = chidb_memory_available(stmt->db);
+    if (room < budget - cache->used)
+        budget = cache->used + room;
+
+    if (!chidb_result_valid(cache, r) || r->size > budget)
+    {
+        chidb_result_release(r);
+        stmt->result = NULL;
+    }
+    else
+    {
+        chidb_result_evict(cache, budget - r->size);
+        chidb_result_push(cache, r);
+        r->refs++;
+
+        /* The statement is done. Stepping it again returns no rows
+         * until it is reset, as if it had run. */
+        stmt->replaying = true;
+        stmt->result_row = r->nrows;
+    }
+
+    pthread_mutex_unlock(&cache->mutex);
+}
+
+/* Stop returning or keeping a result, when a statement is reset
+ *
+ * Parameters
+ * - stmt: Statement
+ */
+void chidb_result_cache_stop(chidb_stmt *stmt)
+{
+    if (stmt->result == NULL)
+        return;
+
+    /* The first registers may be pointing to the result's rows */
+    if (stmt->replaying)
+    {
+        for (uint32_t i = 0; i < stmt->nCols && i < stmt->nReg; i++)
+        {
+            stmt->reg[i].type = REG_NULL;
+            stmt->reg[i].borrowed = false;
+        }
+    }
+
+    chidb_result_drop(stmt);
+}
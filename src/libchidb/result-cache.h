@@ -0,0 +1,90 @@
+/*
+ *  chidb - a didactic relational database management system
+ *
+ *  Result cache -- header
+ *
+ */
+
+/*
+ *  Copyright (c) 2009-2015, The University of Chicago
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or withsend
+ *  modification, are permitted provided that the following conditions are met:
+ *
+ *  - Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ *  - Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ *  - Neither the name of The University of Chicago nor the names of its
+ *    contributors may be used to endorse or promote products derived from this
+ *    software withsend specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ *  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ *  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ *  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ *  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ *  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ *  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ *  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ *  ARISING IN ANY WAY send OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ *  POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+#ifndef RESULT_CACHE_H_
+#define RESULT_CACHE_H_
+
+#include "chidbInt.h"
+#include "dbm-types.h"
+#include "dbm-sorter.h"
+
+/* The rows a cached program returned, when run with some parameters
+ *
+ * Rows are kept as sorter rows (see chidb_dbm_sorter_row_create), so
+ * each one is a single allocation, and the parameters are kept as one
+ * more such row. */
+struct chidb_result
+{
+    /* Program the rows were returned by (the result holds a reference
+     * to it), and the values bound to its parameters */
+    chidb_stmt_cache_entry_t *program;
+    chidb_dbm_sorter_row_t *params;
+
+    /* The write versions of the database when the program was run */
+    uint32_t versions[RESULT_VERSION_SLOTS];
+
+    chidb_dbm_sorter_row_t **rows;
+    uint32_t nrows;
+    uint32_t cap;
+
+    /* Bytes of memory the result takes up */
+    size_t size;
+
+    /* Statements returning or keeping these rows, plus one while the
+     * result is cached */
+    uint32_t refs;
+
+    /* Position in the LRU list */
+    chidb_result_t *prev;
+    chidb_result_t *next;
+};
+
+void chidb_result_cache_init(chidb_result_cache_t *cache);
+void chidb_result_cache_free(chidb_result_cache_t *cache);
+void chidb_result_cache_resize(chidb_result_cache_t *cache, size_t budget);
+void chidb_result_cache_trim(chidb_result_cache_t *cache, size_t bytes);
+void chidb_result_cache_written(chidb *db, npage_t root);
+void chidb_result_cache_written_all(chidb *db);
+bool chidb_result_cache_tables(chidb_stmt *stmt, uint64_t *tables);
+void chidb_result_cache_start(chidb_stmt *stmt);
+int chidb_result_cache_next(chidb_stmt *stmt);
+void chidb_result_cache_keep(chidb_stmt *stmt, int rc);
+void chidb_result_cache_stop(chidb_stmt *stmt);
+
+#endif /* RESULT_CACHE_H_ */
@@ -0,0 +1,667 @@
+/*
+ *  chidb - a didactic relational database management system
+ *
+ *  Table and index statistics
+ *
+ */
+
+/*
+ *  Copyright (c) 2009-2015, The University of Chicago
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or withsend
+ *  modification, are permitted provided that the following conditions are met:
+ *
+ *  - Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ *  - Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ *  - Neither the name of The University of Chicago nor the names of its
+ *    contributors may be used to endorse or promote products derived from this
+ *    software withsend specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ *  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ *  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ *  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ *  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ *  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ *  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ *  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ *  ARISING IN ANY WAY send OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ *  POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+/*
+ * ANALYZE walks every table and index B-Tree, and stores what it finds
+ * in the stats table (STATS_TABLE), next to the schema table: the number
+ * of entries, pages and levels of each B-Tree, and for each column, the
+ * number of distinct values and the range of the values.
+ *
+ * Reading all the values of a column to count the distinct ones exactly
+ * would take as much memory as the column itself. Instead, each value is
+ * hashed, and only the STATS_KMV_SIZE smallest hashes are kept (a "k
+ * minimum values" sketch). With hashes spread evenly over [0, 2^64), if
+ * the k-th smallest is h, there are about (k - 1) * 2^64 / h distinct
+ * values. With fewer than k distinct values the count is exact.
+ *
+ * The stats are read back from the stats table the first time the
+ * optimizer asks for them, and are replaced by every ANALYZE. Until the
+ * next one, they don't change as rows are inserted.
+ */
+
+#include "stats.h"
+#include "btree.h"
+#include "record.h"
+#include "catalog.h"
+#include "util.h"
+#include <ctype.h>
+#include <strings.h>
+
+struct chidb_stats
+{
+    chidb_tree_stats_t *trees;
+    int ntrees;
+};
+
+typedef struct stats_kmv
+{
+    uint64_t h[STATS_KMV_SIZE];  // Smallest hashes seen, sorted
+    uint32_t n;
+} stats_kmv_t;
+
+/* What has been seen of a column so far */
+typedef struct stats_acc
+{
+    stats_kmv_t kmv;
+    bool has_range;
+    int32_t lo, hi;
+} stats_acc_t;
+
+typedef struct stats_walk
+{
+    BTree *bt;
+    chidb_tree_stats_t *ts;
+    stats_acc_t *acc;   // One for each column
+    DBRecord dbr;       // Reused to decode the records
+} stats_walk_t;
+
+
+/* splitmix64's finalizer */
+static uint64_t stats_mix(uint64_t x)
+{
+    x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ull;
+    x = (x ^ (x >> 27)) * 0x94d049bb133111ebull;
+    return x ^ (x >> 31);
+}
+
+#define STATS_FNV_OFFSET (14695981039346656037ull)
+
+/* FNV-1a, continued from hash, so a value can be hashed in pieces */
+static uint64_t stats_fnv(uint64_t hash, const uint8_t *s, int len)
+{
+    for (int i = 0; i < len; i++)
+        hash = (hash ^ s[i]) * 1099511628211ull;
+
+    return hash;
+}
+
+/* FNV-1a, mixed so that the high bits depend on every byte */
+static uint64_t stats_hash_bytes(const uint8_t *s, int len)
+{
+    return stats_mix(stats_fnv(STATS_FNV_OFFSET, s, len));
+}
+
+static void stats_kmv_add(stats_kmv_t *kmv, uint64_t hash)
+{
+    uint32_t lo = 0, hi = kmv->n;
+
+    if (kmv->n == STATS_KMV_SIZE && hash >= kmv->h[kmv->n - 1])
+        return;
+
+    while (lo < hi)
+    {
+        uint32_t mid = (lo + hi) / 2;
+        if (kmv->h[mid] < hash)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    if (lo < kmv->n && kmv->h[lo] == hash)
+        return;
+
+    if (kmv->n == STATS_KMV_SIZE)
+        kmv->n--;
+    memmove(&kmv->h[lo + 1], &kmv->h[lo], (kmv->n - lo) * sizeof(uint64_t));
+    kmv->h[lo] = hash;
+    kmv->n++;
+}
+
+static uint32_t stats_kmv_estimate(stats_kmv_t *kmv, uint32_t nrows)
+{
+    double est;
+
+    if (kmv->n < STATS_KMV_SIZE)
+        return kmv->n;
+
+    est = (STATS_KMV_SIZE - 1) * (18446744073709551616.0 / (double) kmv->h[STATS_KMV_SIZE - 1]);
+
+    return est > nrows ? nrows : (uint32_t) est;
+}
+
+/* Adds an integer value. The distinct-value sketch sees the whole value,
+ * but the range is kept in 32 bits (as it is stored in chidb_stats), so
+ * values outside it are clamped. */
+static void stats_add_int(stats_acc_t *acc, int64_t v64)
+{
+    int32_t v = v64 < INT32_MIN ? INT32_MIN : v64 > INT32_MAX ? INT32_MAX : (int32_t) v64;
+
+    stats_kmv_add(&acc->kmv, stats_mix((uint64_t) v64));
+
+    if (!acc->has_range || v < acc->lo)
+        acc->lo = v;
+    if (!acc->has_range || v > acc->hi)
+        acc->hi = v;
+    acc->has_range = true;
+}
+
+/* Adds the values in a table row. Column 0 is the primary key, and the
+ * others are in the record (where field 0 stands in for the key). */
+static void stats_add_row(stats_walk_t *w, BTreeCell *btc)
+{
+    DBRecord *dbr = &w->dbr;
+
+    stats_add_int(&w->acc[0], btc->key);
+
+    chidb_DBRecord_unpackHeader(dbr, btc->fields.tableLeaf.data);
+    for (int col = 1; col < w->ts->ncols && col < dbr->nfields; col++)
+    {
+        int64_t i64;
+        int len;
+
+        switch (chidb_DBRecord_getType(dbr, col))
+        {
+            case SQL_INTEGER_1BYTE:
+            case SQL_INTEGER_2BYTE:
+            case SQL_INTEGER_4BYTE:
+            case SQL_INTEGER_6BYTE:
+            case SQL_INTEGER_8BYTE:
+                chidb_DBRecord_getInt64(dbr, col, &i64);
+                stats_add_int(&w->acc[col], i64);
+                break;
+            case SQL_TEXT:
+                chidb_DBRecord_getStringLength(dbr, col, &len);
+                stats_kmv_add(&w->acc[col].kmv, stats_hash_bytes(&dbr->data[dbr->offsets[col]], len));
+                break;
+            default:
+                break; // NULLs are not values
+        }
+    }
+
+    w->ts->nrows++;
+}
+
+static int stats_walk_node(stats_walk_t *w, npage_t npage, uint32_t depth)
+{
+    BTreeNode *btn;
+    BTreeCell btc;
+    int rc;
+
+    if ((rc = chidb_Btree_getNodeByPage(w->bt, npage, &btn)) != CHIDB_OK)
+        return rc;
+
+    w->ts->npages++;
+    if (depth > w->ts->depth)
+        w->ts->depth = depth;
+
+    for (ncell_t i = 0; i < btn->n_cells && rc == CHIDB_OK; i++)
+    {
+        if ((rc = chidb_Btree_getCell(btn, i, &btc)) != CHIDB_OK)
+            break;
+
+        switch (btc.type)
+        {
+            case PGTYPE_TABLE_INTERNAL:
+                rc = stats_walk_node(w, btc.fields.tableInternal.child_page, depth + 1);
+                break;
+            case PGTYPE_INDEX_INTERNAL:
+                rc = stats_walk_node(w, btc.fields.indexInternal.child_page, depth + 1);
+                /* Fall through: the cell is an entry in its own right */
+            case PGTYPE_INDEX_LEAF:
+                stats_add_int(&w->acc[0], btc.key);
+                w->ts->nrows++;
+                break;
+            case PGTYPE_TEXTINDEX_INTERNAL:
+                rc = stats_walk_node(w, btc.fields.textIndex.child_page, depth + 1);
+                break;
+            case PGTYPE_TEXTINDEX_LEAF:
+            {
+                /* The text is in two pieces (see chidb_Btree_getCell) */
+                uint64_t hash = stats_fnv(STATS_FNV_OFFSET, btc.fields.textIndex.prefix, btc.fields.textIndex.prefix_len);
+
+                hash = stats_fnv(hash, btc.fields.textIndex.suffix, btc.fields.textIndex.suffix_len);
+                stats_kmv_add(&w->acc[0].kmv, stats_mix(hash));
+                w->ts->nrows++;
+                break;
+            }
+            case PGTYPE_TABLE_LEAF:
+            {
+                uint8_t *buf;
+
+                if ((rc = chidb_Btree_loadPayload(w->bt, &btc, &buf)) != CHIDB_OK)
+                    break;
+                stats_add_row(w, &btc);
+                free(buf);
+                break;
+            }
+        }
+    }
+
+    if (rc == CHIDB_OK && PGTYPE_IS_INTERNAL(btn->type))
+        rc = stats_walk_node(w, btn->right_page, depth + 1);
+
+    chidb_Btree_freeMemNode(w->bt, btn);
+
+    return rc;
+}
+
+/* Walks the B-Tree of a table or index, and fills in its stats */
+static int stats_analyze_tree(chidb *db, chidb_sql_schema_t *schema, chidb_tree_stats_t *ts)
+{
+    chisql_statement_t *stmt = chidb_schema_stmt(schema);
+    stats_walk_t w;
+    Column_t *col = NULL;
+    int rc, i;
+
+    if (stmt == NULL || stmt->type != STMT_CREATE)
+        return CHIDB_ECORRUPT;
+
+    ts->name = strdup(schema->name);
+    if (stmt->stmt.create->t == CREATE_INDEX)
+        ts->ncols = 1;
+    else
+    {
+        col = stmt->stmt.create->table->columns;
+        ts->ncols = chidb_catalog_ncols(db, schema->name);
+    }
+
+    ts->cols = calloc(ts->ncols, sizeof(chidb_column_stats_t));
+    w.acc = calloc(ts->ncols, sizeof(stats_acc_t));
+    w.dbr.types = malloc(DBRECORD_MAX_FIELDS * sizeof(uint32_t));
+    w.dbr.offsets = malloc(DBRECORD_MAX_FIELDS * sizeof(uint32_t));
+    if (ts->name == NULL || ts->cols == NULL || w.acc == NULL || w.dbr.types == NULL || w.dbr.offsets == NULL)
+    {
+        rc = CHIDB_ENOMEM;
+        goto done;
+    }
+
+    w.bt = db->bt;
+    w.ts = ts;
+    if ((rc = stats_walk_node(&w, schema->rpage, 1)) != CHIDB_OK)
+        goto done;
+
+    for (i = 0; i < ts->ncols; i++)
+    {
+        chidb_column_stats_t *cs = &ts->cols[i];
+
+        cs->name = strdup(col ? col->name : stmt->stmt.create->index->column_name);
+        cs->ndistinct = stats_kmv_estimate(&w.acc[i].kmv, ts->nrows);
+        cs->has_range = w.acc[i].has_range;
+        cs->lo = w.acc[i].lo;
+        cs->hi = w.acc[i].hi;
+        if (col)
+            col = col->next;
+    }
+
+done:
+    free(w.acc);
+    free(w.dbr.types);
+    free(w.dbr.offsets);
+
+    return rc;
+}
+
+
+static void stats_free_trees(chidb_tree_stats_t *trees, int ntrees)
+{
+    for (int i = 0; i < ntrees; i++)
+    {
+        for (int j = 0; j < trees[i].ncols; j++)
+            free(trees[i].cols[j].name);
+        free(trees[i].cols);
+        free(trees[i].name);
+    }
+    free(trees);
+}
+
+static int stats_insert_record(BTree *bt, npage_t nroot, chidb_key_t key, DBRecordBuffer *dbrb)
+{
+    DBRecord *dbr;
+    uint8_t *data;
+    int rc;
+
+    chidb_DBRecord_finalize(dbrb, &dbr);
+    if ((rc = chidb_DBRecord_pack(dbr, &data)) == CHIDB_OK)
+    {
+        rc = chidb_Btree_insertInTable(bt, nroot, key, data, dbr->packed_len);
+        free(data);
+    }
+    chidb_DBRecord_destroy(dbr);
+
+    return rc;
+}
+
+/* Writes the stats to the stats table, creating it if it doesn't exist.
+ * Otherwise, its root is emptied, and its rows are written anew. */
+static int stats_write(chidb *db, chidb_tree_stats_t *trees, int ntrees)
+{
+    chidb_sql_schema_t *schema = chidb_catalog_table(db, STATS_TABLE);
+    DBRecordBuffer dbrb;
+    npage_t nroot;
+    chidb_key_t key = 1;
+    int rc;
+
+    if (schema == NULL)
+    {
+        if ((rc = chidb_Btree_newNode(db->bt, &nroot, PGTYPE_TABLE_LEAF)) != CHIDB_OK)
+            return rc;
+
+        chidb_DBRecord_create_empty(&dbrb, 5);
+        chidb_DBRecord_appendString(&dbrb, "table");
+        chidb_DBRecord_appendString(&dbrb, STATS_TABLE);
+        chidb_DBRecord_appendString(&dbrb, STATS_TABLE);
+        chidb_DBRecord_appendInt32(&dbrb, nroot);
+        chidb_DBRecord_appendString(&dbrb, STATS_TABLE_SQL);
+        if ((rc = stats_insert_record(db->bt, 1, db->schema_last_key + 1, &dbrb)) != CHIDB_OK)
+            return rc;
+
+        db->need_refresh = 1;
+    }
+    else
+    {
+        nroot = schema->rpage;
+        if ((rc = chidb_Btree_initEmptyNode(db->bt, nroot, PGTYPE_TABLE_LEAF)) != CHIDB_OK)
+            return rc;
+    }
+
+    for (int i = 0; i < ntrees; i++)
+        for (int j = 0; j < trees[i].ncols; j++)
+        {
+            chidb_column_stats_t *cs = &trees[i].cols[j];
+
+            chidb_DBRecord_create_empty(&dbrb, 9);
+            chidb_DBRecord_appendNull(&dbrb);
+            chidb_DBRecord_appendString(&dbrb, trees[i].name);
+            chidb_DBRecord_appendString(&dbrb, cs->name);
+            chidb_DBRecord_appendInt32(&dbrb, trees[i].nrows);
+            chidb_DBRecord_appendInt32(&dbrb, trees[i].npages);
+            chidb_DBRecord_appendInt32(&dbrb, trees[i].depth);
+            chidb_DBRecord_appendInt32(&dbrb, cs->ndistinct);
+            if (cs->has_range)
+            {
+                chidb_DBRecord_appendInt32(&dbrb, cs->lo);
+                chidb_DBRecord_appendInt32(&dbrb, cs->hi);
+            }
+            else
+            {
+                chidb_DBRecord_appendNull(&dbrb);
+                chidb_DBRecord_appendNull(&dbrb);
+            }
+            if ((rc = stats_insert_record(db->bt, nroot, key++, &dbrb)) != CHIDB_OK)
+                return rc;
+        }
+
+    return CHIDB_OK;
+}
+
+/* Reads the rows of the stats table in the subtree rooted at npage */
+static int stats_read_node(chidb *db, npage_t npage, chidb_stats_t *stats)
+{
+    BTreeNode *btn;
+    BTreeCell btc;
+    int rc;
+
+    if ((rc = chidb_Btree_getNodeByPage(db->bt, npage, &btn)) != CHIDB_OK)
+        return rc;
+
+    for (ncell_t i = 0; i < btn->n_cells && rc == CHIDB_OK; i++)
+    {
+        DBRecord *dbr;
+        char *name, *col;
+        int32_t v[4];
+
+        if ((rc = chidb_Btree_getCell(btn, i, &btc)) != CHIDB_OK)
+            break;
+        if (btn->type == PGTYPE_TABLE_INTERNAL)
+        {
+            rc = stats_read_node(db, btc.fields.tableInternal.child_page, stats);
+            continue;
+        }
+
+        uint8_t *buf;
+        if ((rc = chidb_Btree_loadPayload(db->bt, &btc, &buf)) != CHIDB_OK)
+            break;
+        rc = chidb_DBRecord_unpack(&dbr, btc.fields.tableLeaf.data);
+        free(buf);
+        if (rc != CHIDB_OK)
+            break;
+        if (dbr->nfields != 9)
+        {
+            chidb_DBRecord_destroy(dbr);
+            rc = CHIDB_ECORRUPT;
+            break;
+        }
+        chidb_DBRecord_getString(dbr, 1, &name);
+        chidb_DBRecord_getString(dbr, 2, &col);
+        for (int f = 0; f < 4; f++)
+            chidb_DBRecord_getInt32(dbr, 3 + f, &v[f]);
+
+        /* The rows of a B-Tree are next to each other */
+        chidb_tree_stats_t *ts = stats->ntrees ? &stats->trees[stats->ntrees - 1] : NULL;
+        if (ts == NULL || strcmp(ts->name, name) != 0)
+        {
+            chidb_tree_stats_t *trees = realloc(stats->trees, (stats->ntrees + 1) * sizeof(chidb_tree_stats_t));
+            if (trees == NULL)
+                rc = CHIDB_ENOMEM;
+            else
+            {
+                stats->trees = trees;
+                ts = &trees[stats->ntrees++];
+                memset(ts, 0, sizeof(chidb_tree_stats_t));
+                ts->name = name;
+                ts->nrows = v[0];
+                ts->npages = v[1];
+                ts->depth = v[2];
+                name = NULL;
+            }
+        }
+
+        chidb_column_stats_t *cols = rc == CHIDB_OK ? realloc(ts->cols, (ts->ncols + 1) * sizeof(chidb_column_stats_t)) : NULL;
+        if (cols == NULL)
+        {
+            free(col);
+            rc = CHIDB_ENOMEM;
+        }
+        else
+        {
+            chidb_column_stats_t *cs = &cols[ts->ncols++];
+            ts->cols = cols;
+            cs->name = col;
+            cs->ndistinct = v[3];
+            cs->has_range = chidb_DBRecord_getType(dbr, 7) != SQL_NULL;
+            cs->lo = cs->hi = 0;
+            if (cs->has_range)
+            {
+                chidb_DBRecord_getInt32(dbr, 7, &cs->lo);
+                chidb_DBRecord_getInt32(dbr, 8, &cs->hi);
+            }
+        }
+
+        free(name);
+        chidb_DBRecord_destroy(dbr);
+    }
+
+    if (rc == CHIDB_OK && btn->type == PGTYPE_TABLE_INTERNAL)
+        rc = stats_read_node(db, btn->right_page, stats);
+
+    chidb_Btree_freeMemNode(db->bt, btn);
+
+    return rc;
+}
+
+/* Reads the stats table, if it hasn't been yet. Without one (or if it
+ * can't be read) there are no stats. */
+static chidb_stats_t *stats_load(chidb *db)
+{
+    chidb_sql_schema_t *schema;
+
+    if (db->stats != NULL)
+        return db->stats;
+
+    if ((db->stats = calloc(1, sizeof(chidb_stats_t))) == NULL)
+        return NULL;
+
+    if ((schema = chidb_catalog_table(db, STATS_TABLE)) != NULL
+            && stats_read_node(db, schema->rpage, db->stats) != CHIDB_OK)
+    {
+        stats_free_trees(db->stats->trees, db->stats->ntrees);
+        db->stats->trees = NULL;
+        db->stats->ntrees = 0;
+    }
+
+    return db->stats;
+}
+
+
+/* Is a statement ANALYZE?
+ *
+ * ANALYZE is not part of the chisql grammar, so it is recognized before
+ * the statement is parsed.
+ */
+bool chidb_stats_is_analyze(const char *sql)
+{
+    while (isspace((unsigned char) *sql))
+        sql++;
+    if (strncasecmp(sql, "ANALYZE", 7) != 0)
+        return false;
+    for (sql += 7; isspace((unsigned char) *sql); sql++)
+        ;
+    if (*sql == ';')
+        sql++;
+    while (isspace((unsigned char) *sql))
+        sql++;
+
+    return *sql == '\0';
+}
+
+
+/* Collect the stats of every table and index, and store them
+ *
+ * The in-memory schema must be up to date. The stats table is created
+ * (and added to the schema table) the first time.
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_ENOMEM: Could not allocate memory
+ * - CHIDB_ECORRUPT: The SQL of a table or index is not valid
+ * - Any error from reading or writing the B-Trees
+ */
+int chidb_stats_analyze(chidb *db)
+{
+    chidb_tree_stats_t *trees;
+    int ntrees = 0, rc = CHIDB_OK;
+
+    if ((trees = calloc(list_size(&db->schemas) + 1, sizeof(chidb_tree_stats_t))) == NULL)
+        return CHIDB_ENOMEM;
+
+    list_iterator_start(&db->schemas);
+    while (list_iterator_hasnext(&db->schemas) && rc == CHIDB_OK)
+    {
+        chidb_sql_schema_t *schema = list_iterator_next(&db->schemas);
+
+        if (strcmp(schema->name, STATS_TABLE) == 0)
+            continue;
+        rc = stats_analyze_tree(db, schema, &trees[ntrees++]);
+    }
+    list_iterator_stop(&db->schemas);
+
+    if (rc == CHIDB_OK)
+        rc = stats_write(db, trees, ntrees);
+
+    if (rc != CHIDB_OK)
+    {
+        stats_free_trees(trees, ntrees);
+        return rc;
+    }
+
+    chidb_stats_free(db);
+    if ((db->stats = malloc(sizeof(chidb_stats_t))) == NULL)
+    {
+        stats_free_trees(trees, ntrees);
+        return CHIDB_ENOMEM;
+    }
+    db->stats->trees = trees;
+    db->stats->ntrees = ntrees;
+
+    return CHIDB_OK;
+}
+
+
+/* Free the in-memory stats of a database (they are read again from the
+ * stats table the next time they are needed) */
+void chidb_stats_free(chidb *db)
+{
+    if (db->stats == NULL)
+        return;
+
+    stats_free_trees(db->stats->trees, db->stats->ntrees);
+    free(db->stats);
+    db->stats = NULL;
+}
+
+
+/* Look up the stats of a table or index
+ *
+ * Return
+ * - The stats, or NULL if ANALYZE has not been run since it was created
+ */
+chidb_tree_stats_t *chidb_stats_tree(chidb *db, const char *name)
+{
+    // the stats of an attached database are its own
+    db = chidb_catalog_database(db, &name);
+    chidb_stats_t *stats = stats_load(db);
+
+    if (stats == NULL)
+        return NULL;
+
+    for (int i = 0; i < stats->ntrees; i++)
+        if (strcmp(stats->trees[i].name, name) == 0)
+            return &stats->trees[i];
+
+    return NULL;
+}
+
+
+/* Look up the stats of a column of a table
+ *
+ * Return
+ * - The stats, or NULL if there are none for the table, or no such column
+ */
+chidb_column_stats_t *chidb_stats_column(chidb *db, const char *table, const char *column)
+{
+    chidb_tree_stats_t *ts = chidb_stats_tree(db, table);
+
+    if (ts == NULL)
+        return NULL;
+
+    for (int i = 0; i < ts->ncols; i++)
+        if (strcmp(ts->cols[i].name, column) == 0)
+            return &ts->cols[i];
+
+    return NULL;
+}
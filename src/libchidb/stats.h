@@ -0,0 +1,81 @@
+/*
+ *  chidb - a didactic relational database management system
+ *
+ *  Table and index statistics -- header
+ *
+ */
+
+/*
+ *  Copyright (c) 2009-2015, The University of Chicago
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or withsend
+ *  modification, are permitted provided that the following conditions are met:
+ *
+ *  - Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ *  - Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ *  - Neither the name of The University of Chicago nor the names of its
+ *    contributors may be used to endorse or promote products derived from this
+ *    software withsend specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ *  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ *  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ *  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ *  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ *  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ *  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ *  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ *  ARISING IN ANY WAY send OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ *  POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+#ifndef STATS_H_
+#define STATS_H_
+
+#include "chidbInt.h"
+
+/* The stats are stored in this table, which ANALYZE creates. There is a
+ * row for every column of every table, and for every index, with the
+ * numbers for the whole B-Tree repeated in each one. */
+#define STATS_TABLE "chidb_stat"
+#define STATS_TABLE_SQL "CREATE TABLE chidb_stat(id INTEGER PRIMARY KEY, name TEXT, col TEXT, " \
+                        "nrows INTEGER, npages INTEGER, depth INTEGER, ndistinct INTEGER, " \
+                        "lo INTEGER, hi INTEGER)"
+
+/* Number of hashes kept to estimate the number of distinct values */
+#define STATS_KMV_SIZE (1024)
+
+typedef struct chidb_column_stats
+{
+    char *name;
+    uint32_t ndistinct;     // Estimated number of distinct values (not NULL)
+    bool has_range;         // Is [lo, hi] known? Only for INTEGER columns.
+    int32_t lo, hi;
+} chidb_column_stats_t;
+
+/* Stats of a table or index B-Tree. An index has one column. */
+typedef struct chidb_tree_stats
+{
+    char *name;
+    uint32_t nrows;
+    uint32_t npages;
+    uint32_t depth;         // Nodes on a path from the root to a leaf
+    int ncols;
+    chidb_column_stats_t *cols;
+} chidb_tree_stats_t;
+
+bool chidb_stats_is_analyze(const char *sql);
+int chidb_stats_analyze(chidb *db);
+void chidb_stats_free(chidb *db);
+
+chidb_tree_stats_t *chidb_stats_tree(chidb *db, const char *name);
+chidb_column_stats_t *chidb_stats_column(chidb *db, const char *table, const char *column);
+
+#endif /* STATS_H_ */
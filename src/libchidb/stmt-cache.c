@@ -0,0 +1,700 @@
+/*
+ *  chidb - a didactic relational database management system
+ *
+ *  Compiled statement cache
+ *
+ */
+
+/*
+ *  Copyright (c) 2009-2015, The University of Chicago
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or withsend
+ *  modification, are permitted provided that the following conditions are met:
+ *
+ *  - Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ *  - Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ *  - Neither the name of The University of Chicago nor the names of its
+ *    contributors may be used to endorse or promote products derived from this
+ *    software withsend specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ *  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ *  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ *  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ *  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ *  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ *  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ *  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ *  ARISING IN ANY WAY send OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ *  POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+/*
+ * Callers that prepare the same SQL over and over (instead of keeping the
+ * statement and resetting it) would spend most of their time in the parser
+ * and codegen. Each database keeps the programs it compiled most recently,
+ * keyed by their SQL text with the whitespace normalized, and chidb_prepare
+ * reuses them when it can. Statements prepared from the cache share the
+ * cached instructions; they only get their own registers and cursors.
+ *
+ * The programs depend on the schema (e.g., root pages are compiled into
+ * them), so the whole cache is dropped whenever the schema changes.
+ *
+ * The programs in the cache can also be saved to a file, and loaded into
+ * the cache of another database handle (e.g., in another process), so
+ * that the statements they were compiled from are prepared without being
+ * parsed or compiled at all (see chidb_stmt_cache_save).
+ */
+
+#include <ctype.h>
+#include <sys/stat.h>
+#include "stmt-cache.h"
+#include "result-cache.h"
+#include "catalog.h"
+#include "util.h"
+#include "dbm.h"
+
+int load_schema(chidb *db, npage_t nroot);
+
+
+/* Normalizes SQL text, so that statements that only differ in
+ * whitespace, or in a trailing semicolon, are found in the cache.
+ * Whitespace inside quotes is kept. Also returns the (FNV-1a) hash
+ * of the normalized text. */
+static char *chidb_stmt_cache_key(const char *sql, uint32_t *hash)
+{
+    char *key = malloc(strlen(sql) + 1);
+    char quote = '\0';
+    size_t n = 0;
+
+    if (key == NULL)
+        return NULL;
+
+    for (const char *s = sql; *s != '\0'; s++)
+    {
+        if (quote == '\0' && isspace((unsigned char) *s))
+        {
+            if (n > 0 && key[n-1] != ' ')
+                key[n++] = ' ';
+            continue;
+        }
+
+        if (quote == '\0' && (*s == '\'' || *s == '"'))
+            quote = *s;
+        else if (*s == quote)
+            quote = '\0';
+
+        key[n++] = *s;
+    }
+
+    while (n > 0 && (key[n-1] == ' ' || key[n-1] == ';'))
+        n--;
+    key[n] = '\0';
+
+    *hash = 2166136261u;
+    for (size_t i = 0; i < n; i++)
+        *hash = (*hash ^ (uint8_t) key[i]) * 16777619u;
+
+    return key;
+}
+
+static void chidb_stmt_cache_unlink(chidb_stmt_cache_t *cache, chidb_stmt_cache_entry_t *entry)
+{
+    if (entry->prev)
+        entry->prev->next = entry->next;
+    else
+        cache->head = entry->next;
+
+    if (entry->next)
+        entry->next->prev = entry->prev;
+    else
+        cache->tail = entry->prev;
+
+    entry->prev = entry->next = NULL;
+    cache->n--;
+}
+
+static void chidb_stmt_cache_push(chidb_stmt_cache_t *cache, chidb_stmt_cache_entry_t *entry)
+{
+    entry->prev = NULL;
+    entry->next = cache->head;
+
+    if (cache->head)
+        cache->head->prev = entry;
+    else
+        cache->tail = entry;
+
+    cache->head = entry;
+    cache->n++;
+}
+
+static chidb_stmt_cache_entry_t *chidb_stmt_cache_find(chidb_stmt_cache_t *cache, const char *key, uint32_t hash)
+{
+    chidb_stmt_cache_entry_t *entry;
+
+    for (entry = cache->head; entry != NULL; entry = entry->next)
+        if (entry->hash == hash && strcmp(entry->sql, key) == 0)
+            break;
+
+    return entry;
+}
+
+
+/* Initialize a statement cache
+ *
+ * Parameters
+ * - cache: Statement cache
+ * - size: Maximum number of programs in the cache. If 0, nothing
+ *         is ever cached.
+ */
+void chidb_stmt_cache_init(chidb_stmt_cache_t *cache, uint32_t size)
+{
+    cache->head = NULL;
+    cache->tail = NULL;
+    cache->n = 0;
+    cache->size = size;
+}
+
+
+/* Remove all the programs from a statement cache
+ *
+ * Statements that were prepared from the cache can still be used.
+ *
+ * Parameters
+ * - cache: Statement cache
+ */
+void chidb_stmt_cache_clear(chidb_stmt_cache_t *cache)
+{
+    while (cache->head != NULL)
+    {
+        chidb_stmt_cache_entry_t *entry = cache->head;
+
+        chidb_stmt_cache_unlink(cache, entry);
+        chidb_stmt_cache_release(entry);
+    }
+}
+
+
+/* Prepare a statement from the statement cache
+ *
+ * If the program for this SQL is in the cache, creates a statement
+ * that runs it. The statement's instructions belong to the cache
+ * entry, which stays alive until the statement is finalized.
+ *
+ * Parameters
+ * - db: Database
+ * - sql: SQL text
+ * - stmt: Out parameter. The new statement.
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_ENOTFOUND: The program is not in the cache
+ * - CHIDB_ENOMEM: Could not allocate memory
+ */
+int chidb_stmt_cache_lookup(chidb *db, const char *sql, chidb_stmt **stmt)
+{
+    chidb_stmt_cache_t *cache = &db->stmt_cache;
+    chidb_stmt_cache_entry_t *entry;
+    uint32_t hash;
+    char *key;
+    int rc;
+
+    if (cache->size == 0)
+        return CHIDB_ENOTFOUND;
+
+    if ((key = chidb_stmt_cache_key(sql, &hash)) == NULL)
+        return CHIDB_ENOMEM;
+
+    entry = chidb_stmt_cache_find(cache, key, hash);
+    free(key);
+
+    if (entry == NULL)
+        return CHIDB_ENOTFOUND;
+
+    /* Most recently used goes first */
+    chidb_stmt_cache_unlink(cache, entry);
+    chidb_stmt_cache_push(cache, entry);
+
+    if ((*stmt = malloc(sizeof(chidb_stmt))) == NULL)
+        return CHIDB_ENOMEM;
+
+    if ((rc = chidb_stmt_init(*stmt, db)) != CHIDB_OK)
+    {
+        chidb_stmt_free(*stmt);
+        return rc;
+    }
+
+    if ((entry->nReg > (*stmt)->nReg && (rc = realloc_reg(*stmt, entry->nReg)) != CHIDB_OK) ||
+        (entry->nCursors > (*stmt)->nCursors && (rc = realloc_cur(*stmt, entry->nCursors)) != CHIDB_OK) ||
+        (entry->nParams > 0 && (rc = realloc_params(*stmt, entry->nParams)) != CHIDB_OK))
+    {
+        chidb_stmt_free(*stmt);
+        return rc;
+    }
+
+    free((*stmt)->ops);
+    (*stmt)->ops = entry->ops;
+    (*stmt)->nOps = entry->endOp;
+    (*stmt)->endOp = entry->endOp;
+    (*stmt)->cols = entry->cols;
+    (*stmt)->nCols = entry->nCols;
+    (*stmt)->verified = true;
+    (*stmt)->readonly = entry->readonly;
+    (*stmt)->atomic = entry->atomic;
+    (*stmt)->kind = entry->kind;
+    (*stmt)->program = entry;
+    entry->refs++;
+
+    /* A program that has been prepared before counts as having been
+     * started that many times already, so that statements that are
+     * prepared over and over get it compiled too (see chidb_dbm_run) */
+    (*stmt)->runs = entry->uses++;
+
+    return CHIDB_OK;
+}
+
+
+/* Add a compiled statement to the statement cache
+ *
+ * Only statements that have been verified (and are, thus, ready to run)
+ * can be cached. The cache makes its own copy of the program. If the
+ * cache is full, the least recently used program is evicted.
+ *
+ * Parameters
+ * - db: Database
+ * - sql: SQL text the statement was compiled from
+ * - stmt: Compiled statement
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_EMISUSE: The statement has not been verified
+ * - CHIDB_ENOMEM: Could not allocate memory
+ */
+int chidb_stmt_cache_insert(chidb *db, const char *sql, chidb_stmt *stmt)
+{
+    chidb_stmt_cache_t *cache = &db->stmt_cache;
+    chidb_stmt_cache_entry_t *entry;
+
+    if (!stmt->verified)
+        return CHIDB_EMISUSE;
+
+    if (cache->size == 0)
+        return CHIDB_OK;
+
+    if ((entry = calloc(1, sizeof(chidb_stmt_cache_entry_t))) == NULL)
+        return CHIDB_ENOMEM;
+
+    entry->refs = 1;
+    entry->endOp = stmt->endOp;
+    entry->nCols = stmt->nCols;
+    entry->readonly = stmt->readonly;
+    entry->atomic = stmt->atomic;
+    entry->kind = stmt->kind;
+    entry->nReg = stmt->nReg;
+    entry->nCursors = stmt->nCursors;
+    entry->nParams = stmt->nParams;
+    entry->reusable = chidb_result_cache_tables(stmt, &entry->tables);
+
+    if ((entry->sql = chidb_stmt_cache_key(sql, &entry->hash)) == NULL ||
+        (entry->ops = calloc(stmt->endOp, sizeof(chidb_dbm_op_t))) == NULL ||
+        (stmt->nCols > 0 && (entry->cols = calloc(stmt->nCols, sizeof(char *))) == NULL))
+    {
+        chidb_stmt_cache_release(entry);
+        return CHIDB_ENOMEM;
+    }
+
+    for (uint32_t i = 0; i < stmt->endOp; i++)
+    {
+        entry->ops[i] = stmt->ops[i];
+        entry->ops[i].p4 = NULL;
+        if (stmt->ops[i].p4 != NULL && (entry->ops[i].p4 = strdup(stmt->ops[i].p4)) == NULL)
+        {
+            chidb_stmt_cache_release(entry);
+            return CHIDB_ENOMEM;
+        }
+    }
+
+    for (uint32_t i = 0; i < stmt->nCols; i++)
+    {
+        if ((entry->cols[i] = strdup(stmt->cols[i])) == NULL)
+        {
+            chidb_stmt_cache_release(entry);
+            return CHIDB_ENOMEM;
+        }
+    }
+
+    chidb_stmt_cache_push(cache, entry);
+
+    if (cache->n > cache->size)
+    {
+        chidb_stmt_cache_entry_t *lru = cache->tail;
+
+        chidb_stmt_cache_unlink(cache, lru);
+        chidb_stmt_cache_release(lru);
+    }
+
+    return CHIDB_OK;
+}
+
+
+/* Release a reference to a cached program
+ *
+ * The program is freed once nothing refers to it.
+ *
+ * Parameters
+ * - entry: Cache entry
+ */
+void chidb_stmt_cache_release(chidb_stmt_cache_entry_t *entry)
+{
+    if (--entry->refs > 0)
+        return;
+
+    if (entry->ops != NULL)
+        for (uint32_t i = 0; i < entry->endOp; i++)
+            free(entry->ops[i].p4);
+
+    if (entry->cols != NULL)
+        for (uint32_t i = 0; i < entry->nCols; i++)
+            free(entry->cols[i]);
+
+    free(entry->ops);
+    free(entry->cols);
+    free(entry->sql);
+    free(entry);
+}
+
+
+/*
+ * Program files
+ *
+ * A program file holds the programs of a statement cache, each with the
+ * SQL it was compiled from. All integers are 4-byte big-endian:
+ *
+ *   Header: STMT_FILE_MAGIC (8 bytes), STMT_FILE_VERSION, schema version
+ *           (see chidb_catalog_version), number of programs
+ *   Programs, each:
+ *     - Size of the rest of the program, in bytes
+ *     - Kind of statement (see latency.c), number of registers, cursors
+ *       and parameters, number of instructions and of result columns,
+ *       offset of the SQL text, and size of the strings
+ *     - Instructions: opcode, p1, p2, p3, and the offset of p4 plus one
+ *       (0 if it has none)
+ *     - Offset of the name of each result column
+ *     - Strings, nul-terminated. Offsets are from the first of them.
+ *
+ * The programs are oldest first, so that the cache they are loaded into
+ * ends up in the same order.
+ */
+
+/* If the schema has changed, drop the programs compiled against the
+ * old one, and read the new one (as chidb_prepare would) */
+static int chidb_stmt_cache_refresh(chidb *db)
+{
+    int rc;
+
+    if (!db->need_refresh)
+        return CHIDB_OK;
+
+    chidb_stmt_cache_clear(&db->stmt_cache);
+    if ((rc = load_schema(db, 1)) != CHIDB_OK)
+        return rc;
+    db->need_refresh = 0;
+
+    return CHIDB_OK;
+}
+
+static int chidb_stmt_cache_write(FILE *f, chidb_stmt_cache_entry_t *entry)
+{
+    uint32_t nstr = strlen(entry->sql) + 1, size, off;
+    uint8_t *buf, *p;
+    char *strings;
+    int rc = CHIDB_OK;
+
+    for (uint32_t i = 0; i < entry->endOp; i++)
+        if (entry->ops[i].p4 != NULL)
+            nstr += strlen(entry->ops[i].p4) + 1;
+    for (uint32_t i = 0; i < entry->nCols; i++)
+        nstr += strlen(entry->cols[i]) + 1;
+
+    size = STMT_FILE_PROGRAM_SIZE + entry->endOp * STMT_FILE_OP_SIZE + entry->nCols * 4 + nstr;
+    if ((buf = malloc(4 + size)) == NULL)
+        return CHIDB_ENOMEM;
+
+    strings = (char *) buf + 4 + size - nstr;
+    strcpy(strings, entry->sql);
+    off = strlen(entry->sql) + 1;
+
+    put4byte(buf, size);
+    put4byte(buf + 4, entry->kind);
+    put4byte(buf + 8, entry->nReg);
+    put4byte(buf + 12, entry->nCursors);
+    put4byte(buf + 16, entry->nParams);
+    put4byte(buf + 20, entry->endOp);
+    put4byte(buf + 24, entry->nCols);
+    put4byte(buf + 28, 0);
+    put4byte(buf + 32, nstr);
+
+    p = buf + 4 + STMT_FILE_PROGRAM_SIZE;
+    for (uint32_t i = 0; i < entry->endOp; i++, p += STMT_FILE_OP_SIZE)
+    {
+        chidb_dbm_op_t *op = &entry->ops[i];
+
+        put4byte(p, op->opcode);
+        put4byte(p + 4, op->p1);
+        put4byte(p + 8, op->p2);
+        put4byte(p + 12, op->p3);
+        put4byte(p + 16, op->p4 != NULL ? off + 1 : 0);
+        if (op->p4 != NULL)
+        {
+            strcpy(strings + off, op->p4);
+            off += strlen(op->p4) + 1;
+        }
+    }
+    for (uint32_t i = 0; i < entry->nCols; i++, p += 4)
+    {
+        put4byte(p, off);
+        strcpy(strings + off, entry->cols[i]);
+        off += strlen(entry->cols[i]) + 1;
+    }
+
+    if (fwrite(buf, 4 + size, 1, f) != 1)
+        rc = CHIDB_EIO;
+    free(buf);
+
+    return rc;
+}
+
+/* Checks that a string offset of a program file is inside its strings */
+static char *chidb_stmt_cache_string(char *strings, uint32_t nstr, uint32_t off)
+{
+    return off < nstr ? strings + off : NULL;
+}
+
+/* Puts one program of a program file (without its size) in the cache.
+ * Programs whose SQL is already in the cache are skipped. */
+static int chidb_stmt_cache_read(chidb *db, uint8_t *p, uint32_t size)
+{
+    uint32_t kind, nreg, ncur, nparams, nops, ncols, nstr, hash;
+    char *strings, *sql, *key;
+    chidb_stmt *stmt;
+    chidb_stmt_cache_entry_t *entry;
+    int rc;
+
+    if (size < STMT_FILE_PROGRAM_SIZE)
+        return CHIDB_ECORRUPT;
+
+    kind = get4byte(p);
+    nreg = get4byte(p + 4);
+    ncur = get4byte(p + 8);
+    nparams = get4byte(p + 12);
+    nops = get4byte(p + 16);
+    ncols = get4byte(p + 20);
+    nstr = get4byte(p + 28);
+
+    if (kind >= CHIDB_LATENCY_KINDS || nops == 0 || nstr == 0
+            || STMT_FILE_PROGRAM_SIZE + (uint64_t) nops * STMT_FILE_OP_SIZE + (uint64_t) ncols * 4 + nstr != size)
+        return CHIDB_ECORRUPT;
+
+    strings = (char *) p + size - nstr;
+    if (strings[nstr - 1] != '\0' || (sql = chidb_stmt_cache_string(strings, nstr, get4byte(p + 24))) == NULL)
+        return CHIDB_ECORRUPT;
+
+    if ((key = chidb_stmt_cache_key(sql, &hash)) == NULL)
+        return CHIDB_ENOMEM;
+    entry = chidb_stmt_cache_find(&db->stmt_cache, key, hash);
+    free(key);
+    if (entry != NULL)
+        return CHIDB_OK;
+
+    if ((stmt = malloc(sizeof(chidb_stmt))) == NULL)
+        return CHIDB_ENOMEM;
+    if ((rc = chidb_stmt_init(stmt, db)) != CHIDB_OK)
+    {
+        chidb_stmt_free(stmt);
+        return rc;
+    }
+
+    /* The strings of the instructions and columns are not copied: the
+     * cache makes its own copy of them */
+    if ((nops > stmt->nOps && (rc = realloc_ops(stmt, nops)) != CHIDB_OK) ||
+        (nreg > stmt->nReg && (rc = realloc_reg(stmt, nreg)) != CHIDB_OK) ||
+        (ncur > stmt->nCursors && (rc = realloc_cur(stmt, ncur)) != CHIDB_OK) ||
+        (nparams > 0 && (rc = realloc_params(stmt, nparams)) != CHIDB_OK) ||
+        (ncols > 0 && (stmt->cols = calloc(ncols, sizeof(char *))) == NULL))
+    {
+        chidb_stmt_free(stmt);
+        return rc != CHIDB_OK ? rc : CHIDB_ENOMEM;
+    }
+
+    p += STMT_FILE_PROGRAM_SIZE;
+    for (uint32_t i = 0; i < nops && rc == CHIDB_OK; i++, p += STMT_FILE_OP_SIZE)
+    {
+        chidb_dbm_op_t *op = &stmt->ops[i];
+        uint32_t p4 = get4byte(p + 16);
+
+        op->opcode = (opcode_t) get4byte(p);
+        op->p1 = (int32_t) get4byte(p + 4);
+        op->p2 = (int32_t) get4byte(p + 8);
+        op->p3 = (int32_t) get4byte(p + 12);
+        op->p4 = NULL;
+        if (p4 != 0 && (op->p4 = chidb_stmt_cache_string(strings, nstr, p4 - 1)) == NULL)
+            rc = CHIDB_ECORRUPT;
+    }
+    stmt->endOp = nops;
+    for (uint32_t i = 0; i < ncols && rc == CHIDB_OK; i++, p += 4)
+        if ((stmt->cols[i] = chidb_stmt_cache_string(strings, nstr, get4byte(p))) == NULL)
+            rc = CHIDB_ECORRUPT;
+    stmt->nCols = ncols;
+    stmt->kind = kind;
+
+    /* The program is checked like any other, before it is cached */
+    if (rc == CHIDB_OK && (rc = chidb_stmt_verify(stmt)) == CHIDB_PROBLEM)
+        rc = CHIDB_ECORRUPT;
+    if (rc == CHIDB_OK)
+        rc = chidb_stmt_cache_insert(db, sql, stmt);
+
+    for (uint32_t i = 0; i < nops; i++)
+        stmt->ops[i].p4 = NULL;
+    free(stmt->cols);
+    chidb_stmt_free(stmt);
+
+    return rc;
+}
+
+
+/* Save the programs in a statement cache to a file
+ *
+ * The file can be loaded into the statement cache of any database
+ * handle with the same schema (see chidb_stmt_cache_load).
+ *
+ * Parameters
+ * - db: Database
+ * - filename: File to write (it is replaced if it exists)
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_ECANTOPEN: Unable to create the file
+ * - CHIDB_ENOMEM: Could not allocate memory
+ * - CHIDB_EIO: An I/O error has occurred when writing the file
+ */
+int chidb_stmt_cache_save(chidb *db, const char *filename)
+{
+    chidb_stmt_cache_t *cache = &db->stmt_cache;
+    uint8_t header[STMT_FILE_HEADER_SIZE];
+    FILE *f;
+    int rc;
+
+    if ((rc = chidb_stmt_cache_refresh(db)) != CHIDB_OK)
+        return rc;
+
+    if ((f = fopen(filename, "wb")) == NULL)
+        return CHIDB_ECANTOPEN;
+
+    memcpy(header, STMT_FILE_MAGIC, 8);
+    put4byte(header + 8, STMT_FILE_VERSION);
+    put4byte(header + 12, chidb_catalog_version(db));
+    put4byte(header + 16, cache->n);
+    if (fwrite(header, sizeof(header), 1, f) != 1)
+        rc = CHIDB_EIO;
+
+    for (chidb_stmt_cache_entry_t *entry = cache->tail; entry != NULL && rc == CHIDB_OK; entry = entry->prev)
+        rc = chidb_stmt_cache_write(f, entry);
+
+    if (fclose(f) != 0 && rc == CHIDB_OK)
+        rc = CHIDB_EIO;
+
+    return rc;
+}
+
+
+/* Load the programs in a file into a statement cache
+ *
+ * The file is read all at once, and each of its programs is verified
+ * (see chidb_stmt_verify) and added to the cache, unless a program for
+ * the same SQL is already there. The cache keeps at most as many
+ * programs as it always does, so loading more than that only keeps
+ * the last ones.
+ *
+ * Parameters
+ * - db: Database
+ * - filename: File written by chidb_stmt_cache_save
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_ECANTOPEN: Unable to open the file
+ * - CHIDB_ECORRUPT: The file is not a well-formed program file
+ * - CHIDB_EMISMATCH: The file was written by a different version of
+ *                    chidb, or for a different schema
+ * - CHIDB_ENOMEM: Could not allocate memory
+ * - CHIDB_EIO: An I/O error has occurred when reading the file
+ */
+int chidb_stmt_cache_load(chidb *db, const char *filename)
+{
+    struct stat st;
+    uint8_t *buf, *p;
+    uint32_t n;
+    size_t left;
+    FILE *f;
+    int rc = CHIDB_OK;
+
+    if ((f = fopen(filename, "rb")) == NULL)
+        return CHIDB_ECANTOPEN;
+
+    if (fstat(fileno(f), &st) != 0)
+    {
+        fclose(f);
+        return CHIDB_EIO;
+    }
+    if (st.st_size < STMT_FILE_HEADER_SIZE)
+    {
+        fclose(f);
+        return CHIDB_ECORRUPT;
+    }
+    if ((buf = malloc(st.st_size)) == NULL)
+    {
+        fclose(f);
+        return CHIDB_ENOMEM;
+    }
+    if (fread(buf, st.st_size, 1, f) != 1)
+        rc = CHIDB_EIO;
+    fclose(f);
+
+    if (rc == CHIDB_OK && memcmp(buf, STMT_FILE_MAGIC, 8) != 0)
+        rc = CHIDB_ECORRUPT;
+    else if (rc == CHIDB_OK && get4byte(buf + 8) != STMT_FILE_VERSION)
+        rc = CHIDB_EMISMATCH;
+    else if (rc == CHIDB_OK && (rc = chidb_stmt_cache_refresh(db)) == CHIDB_OK
+             && get4byte(buf + 12) != chidb_catalog_version(db))
+        rc = CHIDB_EMISMATCH;
+
+    n = get4byte(buf + 16);
+    p = buf + STMT_FILE_HEADER_SIZE;
+    left = st.st_size - STMT_FILE_HEADER_SIZE;
+    for (uint32_t i = 0; i < n && rc == CHIDB_OK; i++)
+    {
+        uint32_t size;
+
+        if (left < 4 || (size = get4byte(p)) > left - 4)
+        {
+            rc = CHIDB_ECORRUPT;
+            break;
+        }
+        rc = chidb_stmt_cache_read(db, p + 4, size);
+        p += 4 + size;
+        left -= 4 + size;
+    }
+    if (rc == CHIDB_OK && left != 0)
+        rc = CHIDB_ECORRUPT;
+
+    free(buf);
+
+    return rc;
+}
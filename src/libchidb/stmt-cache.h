@@ -0,0 +1,106 @@
+/*
+ *  chidb - a didactic relational database management system
+ *
+ *  Compiled statement cache -- header
+ *
+ */
+
+/*
+ *  Copyright (c) 2009-2015, The University of Chicago
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or withsend
+ *  modification, are permitted provided that the following conditions are met:
+ *
+ *  - Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ *  - Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ *  - Neither the name of The University of Chicago nor the names of its
+ *    contributors may be used to endorse or promote products derived from this
+ *    software withsend specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ *  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ *  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ *  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ *  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ *  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ *  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ *  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ *  ARISING IN ANY WAY send OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ *  POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+#ifndef STMT_CACHE_H_
+#define STMT_CACHE_H_
+
+#include "chidbInt.h"
+#include "dbm-types.h"
+
+/* A compiled DBM program in the statement cache
+ *
+ * The entry owns its instructions, including their p4 strings, and the
+ * names of the result columns. Statements prepared from the cache use
+ * them directly instead of having their own copy, so an entry is only
+ * freed once it has been evicted and no statement is using it. */
+struct chidb_stmt_cache_entry
+{
+    /* Normalized SQL text, and its hash */
+    char *sql;
+    uint32_t hash;
+
+    /* The program */
+    chidb_dbm_op_t *ops;
+    uint32_t endOp;
+    char **cols;
+    uint32_t nCols;
+    bool readonly;
+    bool atomic;
+    int kind;       /* Kind of statement (see latency.c) */
+
+    /* Registers, cursors and parameters used by the program */
+    uint32_t nReg;
+    uint32_t nCursors;
+    uint32_t nParams;
+
+    /* Can the results of the program be cached? If so, tables has a bit
+     * set for the version slot of every B-Tree it reads (see
+     * result-cache.c) */
+    bool reusable;
+    uint64_t tables;
+
+    /* Statements and cached results using this program, plus one while
+     * it is cached */
+    uint32_t refs;
+
+    /* Statements that have been prepared from it */
+    uint32_t uses;
+
+    /* Position in the LRU list */
+    chidb_stmt_cache_entry_t *prev;
+    chidb_stmt_cache_entry_t *next;
+};
+
+/* Program files (see chidb_stmt_cache_save). The version changes
+ * whenever the format, or the meaning of any instruction, does. */
+#define STMT_FILE_MAGIC "chidbprg"
+#define STMT_FILE_VERSION (1)
+#define STMT_FILE_HEADER_SIZE (20)
+#define STMT_FILE_PROGRAM_SIZE (32)
+#define STMT_FILE_OP_SIZE (20)
+
+void chidb_stmt_cache_init(chidb_stmt_cache_t *cache, uint32_t size);
+void chidb_stmt_cache_clear(chidb_stmt_cache_t *cache);
+int chidb_stmt_cache_lookup(chidb *db, const char *sql, chidb_stmt **stmt);
+int chidb_stmt_cache_insert(chidb *db, const char *sql, chidb_stmt *stmt);
+void chidb_stmt_cache_release(chidb_stmt_cache_entry_t *entry);
+int chidb_stmt_cache_save(chidb *db, const char *filename);
+int chidb_stmt_cache_load(chidb *db, const char *filename);
+
+#endif /* STMT_CACHE_H_ */
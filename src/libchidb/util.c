@@ -43,6 +43,7 @@
 #include <ctype.h>
 #include "chidbInt.h"
 #include "util.h"
+#include "catalog.h"
 #include "record.h"
 
 /*
@@ -62,6 +63,20 @@ void put4byte(unsigned char *p, uint32_t v)
     p[3] = (uint8_t)v;
 }
 
+/*
+** Read or write an eight-byte big-endian integer value.
+*/
+uint64_t get8byte(const uint8_t *p)
+{
+    return ((uint64_t) get4byte(p) << 32) | get4byte(p + 4);
+}
+
+void put8byte(uint8_t *p, uint64_t v)
+{
+    put4byte(p, (uint32_t)(v >> 32));
+    put4byte(p + 4, (uint32_t) v);
+}
+
 int getVarint32(const uint8_t *p, uint32_t *v)
 {
     *v = 0;
@@ -98,7 +113,7 @@ void chidb_BTree_recordPrinter(BTreeNode *btn, BTreeCell *btc)
 
     chidb_DBRecord_unpack(&dbr, btc->fields.tableLeaf.data);
 
-    printf("< %5i >", btc->key);
+    printf("< %5lli >", (long long) btc->key);
     chidb_DBRecord_print(dbr);
     printf("\n");
 
@@ -107,7 +122,7 @@ void chidb_BTree_recordPrinter(BTreeNode *btn, BTreeCell *btc)
 
 void chidb_BTree_stringPrinter(BTreeNode *btn, BTreeCell *btc)
 {
-    printf("%5i -> %10s\n", btc->key, btc->fields.tableLeaf.data);
+    printf("%5lli -> %10s\n", (long long) btc->key, btc->fields.tableLeaf.data);
 }
 
 int chidb_astrcat(char **dst, char *src)
@@ -152,11 +167,11 @@ int chidb_Btree_print(BTree *bt, npage_t npage, fBTreeCellPrinter printer, bool
 
             last_key = btc.key;
             if(verbose)
-                printf("Printing Keys <= %i\n", last_key);
+                printf("Printing Keys <= %lli\n", (long long) last_key);
             chidb_Btree_print(bt, btc.fields.tableInternal.child_page, printer, verbose);
         }
         if(verbose)
-            printf("Printing Keys > %i\n", last_key);
+            printf("Printing Keys > %lli\n", (long long) last_key);
         chidb_Btree_print(bt, btn->right_page, printer, verbose);
     }
     else if (btn->type == PGTYPE_INDEX_LEAF)
@@ -168,7 +183,7 @@ int chidb_Btree_print(BTree *bt, npage_t npage, fBTreeCellPrinter printer, bool
             BTreeCell btc;
 
             chidb_Btree_getCell(btn, i, &btc);
-            printf("%10i -> %10i\n", btc.key, btc.fields.indexLeaf.keyPk);
+            printf("%10lli -> %10lli\n", (long long) btc.key, (long long) btc.fields.indexLeaf.keyPk);
         }
     }
     else if (btn->type == PGTYPE_INDEX_INTERNAL)
@@ -184,12 +199,43 @@ int chidb_Btree_print(BTree *bt, npage_t npage, fBTreeCellPrinter printer, bool
             chidb_Btree_getCell(btn, i, &btc);
             last_key = btc.key;
             if(verbose)
-                printf("Printing Keys < %i\n", last_key);
+                printf("Printing Keys < %lli\n", (long long) last_key);
             chidb_Btree_print(bt, btc.fields.indexInternal.child_page, printer, verbose);
-            printf("%10i -> %10i\n", btc.key, btc.fields.indexInternal.keyPk);
+            printf("%10lli -> %10lli\n", (long long) btc.key, (long long) btc.fields.indexInternal.keyPk);
         }
         if(verbose)
-            printf("Printing Keys > %i\n", last_key);
+            printf("Printing Keys > %lli\n", (long long) last_key);
+        chidb_Btree_print(bt, btn->right_page, printer, verbose);
+    }
+    else if (btn->type == PGTYPE_TEXTINDEX_LEAF)
+    {
+        if (verbose)
+            printf("Leaf node (page %i)\n", btn->page->npage);
+        for(int i = 0; i<btn->n_cells; i++)
+        {
+            BTreeCell btc;
+
+            chidb_Btree_getCell(btn, i, &btc);
+            printf("%.*s%.*s -> %10lli\n", btc.fields.textIndex.prefix_len, btc.fields.textIndex.prefix,
+                   btc.fields.textIndex.suffix_len, btc.fields.textIndex.suffix, (long long) btc.fields.textIndex.keyPk);
+        }
+    }
+    else if (btn->type == PGTYPE_TEXTINDEX_INTERNAL)
+    {
+        if(verbose)
+            printf("Internal node (page %i)\n", btn->page->npage);
+        for(int i = 0; i<btn->n_cells; i++)
+        {
+            BTreeCell btc;
+
+            chidb_Btree_getCell(btn, i, &btc);
+            if(verbose)
+                printf("Printing Keys < %.*s%.*s\n", btc.fields.textIndex.prefix_len, btc.fields.textIndex.prefix,
+                       btc.fields.textIndex.suffix_len, btc.fields.textIndex.suffix);
+            chidb_Btree_print(bt, btc.fields.textIndex.child_page, printer, verbose);
+        }
+        if(verbose)
+            printf("Printing the rest\n");
         chidb_Btree_print(bt, btn->right_page, printer, verbose);
     }
 
@@ -284,157 +330,78 @@ int chidb_tokenize(char *str, char ***tokens)
 
 
 // Given a table name, determine whether such a table exists.
-int chidb_table_exists(list_t s, char *table)
+int chidb_table_exists(chidb *db, char *table)
 {
-    list_iterator_start(&s);
-    while(list_iterator_hasnext(&s))
-    {
-        chidb_sql_schema_t *next = (chidb_sql_schema_t *)(list_iterator_next(&s));
-        // fprintf(stderr, "checking table name: %s\n", next->name);
-        if(!strcmp(next->name, table))
-        {
-            return CHIDB_OK;
-        }
-    }
-
-    list_iterator_stop(&s);
-
-    return CHIDB_EINVALIDSQL;
+    return chidb_catalog_table(db, table) ? CHIDB_OK : CHIDB_EINVALIDSQL;
 }
 
-// Given a table name, obtain its root page.
-int chidb_get_root(list_t s, char *table)
+// Given a table (or index) name, obtain its root page.
+int chidb_get_root(chidb *db, char *table)
 {
-    list_iterator_start(&s);
-    while(list_iterator_hasnext(&s))
-    {
-        chidb_sql_schema_t *next = (chidb_sql_schema_t *)(list_iterator_next(&s));
-        if(!strcmp(next->name, table))
-        {
-            list_iterator_stop(&s);
-            return next->rpage;
-        }
-    }
+    chidb_sql_schema_t *schema = chidb_catalog_table(db, table);
 
-    list_iterator_stop(&s);
+    if(schema == NULL)
+        schema = chidb_catalog_index(db, table);
 
-    return CHIDB_EINVALIDSQL;
+    return schema ? schema->rpage : CHIDB_EINVALIDSQL;
 }
 
-// Given a table name and a column name, determine whether such a column exists in the table.
-int chidb_column_exists(list_t s, char *table, char *column)
+// Given a table (or index) name, obtain the B-Tree it is in: the database's
+// own, or that of the attached database it is qualified with.
+BTree *chidb_get_btree(chidb *db, char *table)
 {
-    list_iterator_start(&s);
-    while(list_iterator_hasnext(&s))
-    {
-        chidb_sql_schema_t *next = (chidb_sql_schema_t *)(list_iterator_next(&s));
-        if(!strcmp(next->name, table))
-        {
-            Column_t *next_column = next->stmt->stmt.create->table->columns;
-            while(next_column != NULL)
-            {
-                if(!strcmp(next_column->name, column))
-                {
-                    list_iterator_stop(&s);
-                    return CHIDB_OK;
-                }
-                else
-                    next_column = next_column->next;
-            }
-            list_iterator_stop(&s);
-            return CHIDB_EINVALIDSQL;
-        }
-    }
+    const char *name = table;
 
-    list_iterator_stop(&s);
+    return chidb_catalog_database(db, &name)->bt;
+}
 
-    return CHIDB_EINVALIDSQL;
+// Given a table name and a column name, determine whether such a column exists in the table.
+int chidb_column_exists(chidb *db, char *table, char *column)
+{
+    return chidb_catalog_column(db, table, column, NULL, NULL);
 }
 
 // Given a table name and a column name, obtain the type of the column.
-int chidb_column_get_type(list_t s, char *table, char *column)
+int chidb_column_get_type(chidb *db, char *table, char *column)
 {
-    list_iterator_start(&s);
-    while(list_iterator_hasnext(&s))
-    {
-        chidb_sql_schema_t *next = (chidb_sql_schema_t *)(list_iterator_next(&s));
-        if(!strcmp(next->name, table))
-        {
-            Column_t *next_column = next->stmt->stmt.create->table->columns;
-            while(next_column != NULL)
-            {
-                if(!strcmp(next_column->name, column))
-                {
-                    list_iterator_stop(&s);
-                    return next_column->type;
-                }
-                else
-                    next_column = next_column->next;
-            }
-            list_iterator_stop(&s);
-            return CHIDB_EINVALIDSQL;
+    Column_t *col;
 
-        }
-    }
-
-    list_iterator_stop(&s);
+    if(chidb_catalog_column(db, table, column, &col, NULL) != CHIDB_OK)
+        return CHIDB_EINVALIDSQL;
 
-    return CHIDB_EINVALIDSQL;
+    return col->type;
 }
 
-// S is the schema table
-int chidb_column_names(list_t s, char *table, list_t *names)
+// Given a table name and a column name, obtain the position of the column
+// in the table (0 indexed). Returns -1 if the column was not found.
+int chidb_column_get_position(chidb *db, char *table, char *column)
 {
-    list_iterator_start(&s);
-    while(list_iterator_hasnext(&s))
-    {
-        chidb_sql_schema_t *next = (chidb_sql_schema_t *)(list_iterator_next(&s));
-        if(!strcmp(next->name, table))
-        {
-            Column_t *next_column = next->stmt->stmt.create->table->columns;
-            if(next_column ==NULL) //if it starts null then there are no columns
-            {
-                return CHIDB_EINVALIDSQL;
-            }
+    int position;
 
-            while(next_column != NULL)
-            {
-                // fprintf(stderr, "Adding %s as column name\n", next_column->name);
-                list_append(names, next_column->name);
+    if(chidb_catalog_column(db, table, column, NULL, &position) != CHIDB_OK)
+        return -1;
 
-                next_column = next_column->next;
-            }
-            return CHIDB_OK;
-        }
-    }
+    return position;
+}
+
+// Appends the names of the columns of a table, in order, to names
+int chidb_column_names(chidb *db, char *table, list_t *names)
+{
+    chidb_sql_schema_t *schema = chidb_catalog_table(db, table);
+
+    if(schema == NULL || chidb_catalog_ncols(db, table) == 0)
+        return CHIDB_EINVALIDSQL;
 
-    list_iterator_stop(&s);
+    for(Column_t *next_column = schema->stmt->stmt.create->table->columns; next_column != NULL; next_column = next_column->next)
+        list_append(names, next_column->name);
 
-    return CHIDB_EINVALIDSQL;
+    return CHIDB_OK;
 }
 
 // Returns number of columns for a specified schema table
-int chidb_columns_total(list_t schemas, char *table)
+int chidb_columns_total(chidb *db, char *table)
 {
-    int i = 0;  // Return value of number of columns
-
-    list_iterator_start(&schemas);
-    while(list_iterator_hasnext(&schemas))
-    {
-        chidb_sql_schema_t *next = (chidb_sql_schema_t *)(list_iterator_next(&schemas));
-        if(!strcmp(next->name,table))
-        {
-            Column_t *column = next->stmt->stmt.create->table->columns;
-            while(column != NULL)
-            {
-                i++;
-                column = column->next;
-            }
-        }
-    }
-    list_iterator_stop(&schemas);
-
-    return i;
+    return chidb_catalog_ncols(db, table);
 }
 
 // print the schema list found in db->schemas
@@ -451,7 +418,8 @@ void print_schema_list(list_t schemas)
         fprintf(stderr, "  Name: %s\n",next->name);
         fprintf(stderr, "  Assoc: %s\n",next->assoc);
         fprintf(stderr, "  Root Page: %d\n",next->rpage);
-        chisql_stmt_print(next->stmt);
+        if (chidb_schema_stmt(next))
+            chisql_stmt_print(next->stmt);
         i++;
     }
     list_iterator_stop(&schemas);
@@ -474,6 +442,9 @@ int chidb_get_tables(list_t tables, chisql_statement_t *sql_statement)
         case STMT_DELETE:
             list_append(&tables, sql_statement->stmt.delete->table_name);
             break;
+        case STMT_UPDATE:
+            list_append(&tables, sql_statement->stmt.update->table_name);
+            break;
         case STMT_CREATE:
             break;
     }
@@ -677,13 +648,13 @@ int chidb_get_where_columns(list_t column_names, Condition_t *cond)
 //     return CHIDB_OK;
 // }
 
-int chidb_columns_in_same_table(list_t s, list_t tables, list_t found_tables, char *col1, char *col2)
+int chidb_columns_in_same_table(chidb *db, list_t tables, list_t found_tables, char *col1, char *col2)
 {
     list_iterator_start(&tables);
     while(list_iterator_hasnext(&tables))
     {
         char *t = (char *) list_iterator_next(&tables);
-        if (chidb_column_exists(s, t, col1) && chidb_column_exists(s, t, col2))
+        if (chidb_column_exists(db, t, col1) && chidb_column_exists(db, t, col2))
         {
             list_append(&found_tables, t);
         }
@@ -750,6 +721,11 @@ void chisql_statement_free(chisql_statement_t *sql)
         {
             Delete_free(sql->stmt.delete);
         } break;
+
+        case STMT_UPDATE:
+        {
+            Update_free(sql->stmt.update);
+        } break;
     }
 
     free(sql->text);
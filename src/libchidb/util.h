@@ -46,7 +46,7 @@
 #include <simclist.h>
 
 /*
-** Read or write a two- and four-byte big-endian integer values.
+** Read or write a two-, four- and eight-byte big-endian integer values.
 * Based on SQLite code
 */
 #define get2byte(x)   ((x)[0]<<8 | (x)[1])
@@ -57,6 +57,8 @@
 
 uint32_t get4byte(const uint8_t *p);
 void put4byte(unsigned char *p, uint32_t v);
+uint64_t get8byte(const uint8_t *p);
+void put8byte(uint8_t *p, uint64_t v);
 int getVarint32(const uint8_t *p, uint32_t *v);
 int putVarint32(uint8_t *p, uint32_t v);
 
@@ -70,19 +72,21 @@ void chidb_BTree_stringPrinter(BTreeNode *btn, BTreeCell *btc);
 FILE *copy(const char *from, const char *to);
 
 
-int chidb_table_exists(list_t s, char *table);
-int chidb_get_root(list_t s, char *table);
-int chidb_column_exists(list_t s, char *table, char *column);
-int chidb_column_get_type(list_t s, char *table, char *column);
-int chidb_column_names(list_t s, char *table, list_t *names);
-int chidb_columns_total(list_t schemas, char *table);
+int chidb_table_exists(chidb *db, char *table);
+int chidb_get_root(chidb *db, char *table);
+BTree *chidb_get_btree(chidb *db, char *table);
+int chidb_column_exists(chidb *db, char *table, char *column);
+int chidb_column_get_type(chidb *db, char *table, char *column);
+int chidb_column_get_position(chidb *db, char *table, char *column);
+int chidb_column_names(chidb *db, char *table, list_t *names);
+int chidb_columns_total(chidb *db, char *table);
 void print_schema_list(list_t schemas);
 int chidb_column_position(list_t *names, char *col_name);
 
 int chidb_get_tables(list_t tables, chisql_statement_t *sql_statement);
 int chidb_get_sra_tables(list_t tables, SRA_t *s);
 int chidb_get_select_columns(list_t column_names, Expression_t *exp_list);
-int chidb_columns_in_same_table(list_t s, list_t tables, list_t found_tables, char *col1, char *col2);
+int chidb_columns_in_same_table(chidb *db, list_t tables, list_t found_tables, char *col1, char *col2);
 int chidb_get_where_tables(list_t tables, Condition_t *cond);
 int chidb_get_where_columns(list_t column_names, Condition_t *cond);
 // int chidb_get_where_conds(list_t conds, SRA_t *s);
@@ -0,0 +1,805 @@
+/*
+ *  chidb - a didactic relational database management system
+ *
+ *  Write-ahead log
+ *
+ */
+
+/*
+ *  Copyright (c) 2009-2015, The University of Chicago
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or withsend
+ *  modification, are permitted provided that the following conditions are met:
+ *
+ *  - Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ *  - Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ *  - Neither the name of The University of Chicago nor the names of its
+ *    contributors may be used to endorse or promote products derived from this
+ *    software withsend specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ *  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ *  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ *  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ *  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ *  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ *  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ *  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ *  ARISING IN ANY WAY send OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ *  POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+/*
+ * In WAL mode, pages are never written to the database file directly.
+ * Instead, they are appended to the write-ahead log (the file with
+ * "-wal" appended to its name) as frames, and a transaction commits
+ * when its last frame, which is marked as a commit frame, is in the log.
+ * The log starts with a header (the magic string, the page size, and a
+ * salt), and each frame has a header of its own (the page number, the
+ * number of pages in the database if it is a commit frame, the salt, and
+ * a checksum of all that and the page) followed by the page.
+ *
+ * Each handle keeps a wal index, mapping page numbers to the last frame
+ * that holds them. A reader takes a snapshot when it starts reading: it
+ * adds the frames committed since its last snapshot to its index, and
+ * reads every page in the index from the log, and every other page from
+ * the database file. The frames appended after that are not in its index,
+ * so a single writer can keep appending without disturbing it.
+ *
+ * Checkpointing copies the last version of each page in the log back
+ * into the database file and resets the log (with a new salt, so frames
+ * left over from before are not valid anymore). This can only be done
+ * while nobody is reading: readers hold a shared lock on the log during
+ * their snapshot, and the checkpoint takes an exclusive one. The writer
+ * holds an exclusive lock on the database file.
+ */
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/file.h>
+#include <sys/uio.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <chidb/chidb.h>
+#include "wal.h"
+#include "util.h"
+
+#define WAL_MAGIC "chidbwal"
+#define WAL_HEADER_SIZE (16)
+#define WAL_FRAME_HEADER_SIZE (16)
+#define WAL_FRAME_SIZE(page_size) (WAL_FRAME_HEADER_SIZE + (page_size))
+#define WAL_FRAME_OFFSET(wal, frame) \
+    (WAL_HEADER_SIZE + (off_t) ((frame) - 1) * WAL_FRAME_SIZE((wal)->page_size))
+
+#define WAL_DEFAULT_AUTOCHECKPOINT (1000)
+#define WAL_INITIAL_INDEX_SIZE (64)
+
+
+/* Checksum of a frame: the first 12 bytes of its header, and the page */
+static uint32_t chidb_Wal_checksum(const uint8_t *header, const uint8_t *data, uint32_t size)
+{
+    uint32_t sum = 0;
+
+    for (int i = 0; i < 12; i++)
+        sum = sum * 31 + header[i];
+    for (uint32_t i = 0; i < size; i++)
+        sum = sum * 31 + data[i];
+
+    return sum;
+}
+
+
+/* Forget every frame in the wal index */
+static void chidb_Wal_resetIndex(Wal *wal)
+{
+    memset(wal->index_pages, 0, wal->index_size * sizeof(npage_t));
+    wal->index_n = 0;
+    wal->n_frames = 0;
+    wal->n_committed = 0;
+    wal->db_pages = 0;
+}
+
+
+/* Add a frame to the wal index, replacing any older frame for the page
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_ENOMEM: Could not allocate memory
+ */
+static int chidb_Wal_indexPut(Wal *wal, npage_t npage, uint32_t frame)
+{
+    uint32_t i;
+
+    /* Keep the table at most half full */
+    if (2 * (wal->index_n + 1) > wal->index_size)
+    {
+        npage_t *old_pages = wal->index_pages;
+        uint32_t *old_frames = wal->index_frames;
+        uint32_t old_size = wal->index_size;
+
+        wal->index_pages = calloc(2 * old_size, sizeof(npage_t));
+        wal->index_frames = malloc(2 * old_size * sizeof(uint32_t));
+        if (wal->index_pages == NULL || wal->index_frames == NULL)
+        {
+            free(wal->index_pages);
+            free(wal->index_frames);
+            wal->index_pages = old_pages;
+            wal->index_frames = old_frames;
+            return CHIDB_ENOMEM;
+        }
+        wal->index_size = 2 * old_size;
+        wal->index_n = 0;
+
+        for (uint32_t j = 0; j < old_size; j++)
+            if (old_pages[j] != 0)
+                chidb_Wal_indexPut(wal, old_pages[j], old_frames[j]);
+        free(old_pages);
+        free(old_frames);
+    }
+
+    for (i = (npage * 2654435761u) & (wal->index_size - 1);
+            wal->index_pages[i] != 0 && wal->index_pages[i] != npage;
+            i = (i + 1) & (wal->index_size - 1))
+        ;
+
+    if (wal->index_pages[i] == 0)
+        wal->index_n++;
+    wal->index_pages[i] = npage;
+    wal->index_frames[i] = frame;
+
+    return CHIDB_OK;
+}
+
+
+/* Look up the last frame that holds a page
+ *
+ * Parameters
+ * - wal: A Wal.
+ * - npage: Page number.
+ *
+ * Return
+ * - The frame number, or 0 if the page is not in the snapshot
+ *   (and has to be read from the database file)
+ */
+uint32_t chidb_Wal_findFrame(Wal *wal, npage_t npage)
+{
+    for (uint32_t i = (npage * 2654435761u) & (wal->index_size - 1);
+            wal->index_pages[i] != 0;
+            i = (i + 1) & (wal->index_size - 1))
+        if (wal->index_pages[i] == npage)
+            return wal->index_frames[i];
+
+    return 0;
+}
+
+
+/* Add the transactions committed to the log since the snapshot was taken
+ *
+ * Frames are read from the end of the snapshot until one that is
+ * incomplete, or that does not belong to this log (its salt does not
+ * match, or its checksum is wrong). The frames up to the last commit
+ * frame are added to the wal index; the ones after it belong to a
+ * transaction that has not committed (or never will).
+ *
+ * Parameters
+ * - wal: A Wal.
+ * - changed: Out parameter. Set to true if any transaction was added.
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_ENOMEM: Could not allocate memory
+ */
+static int chidb_Wal_scan(Wal *wal, bool *changed)
+{
+    uint8_t *frame;
+    npage_t *npages = NULL;
+    uint32_t n = 0, max = 0, last = 0;
+    npage_t db_pages = 0;
+    int rc = CHIDB_OK;
+
+    if ((frame = malloc(WAL_FRAME_SIZE(wal->page_size))) == NULL)
+        return CHIDB_ENOMEM;
+
+    while (pread(wal->fd, frame, WAL_FRAME_SIZE(wal->page_size),
+                 WAL_FRAME_OFFSET(wal, wal->n_committed + n + 1)) == WAL_FRAME_SIZE(wal->page_size))
+    {
+        uint8_t *data = frame + WAL_FRAME_HEADER_SIZE;
+
+        if (get4byte(frame) == 0 || get4byte(frame + 8) != wal->salt
+                || get4byte(frame + 12) != chidb_Wal_checksum(frame, data, wal->page_size))
+            break;
+
+        if (n == max)
+        {
+            npage_t *p = realloc(npages, (max = max ? 2 * max : 64) * sizeof(npage_t));
+            if (p == NULL)
+            {
+                rc = CHIDB_ENOMEM;
+                break;
+            }
+            npages = p;
+        }
+        npages[n++] = get4byte(frame);
+
+        if (get4byte(frame + 4) != 0)
+        {
+            last = n;
+            db_pages = get4byte(frame + 4);
+        }
+    }
+
+    for (uint32_t i = 0; i < last && rc == CHIDB_OK; i++)
+        rc = chidb_Wal_indexPut(wal, npages[i], wal->n_committed + i + 1);
+
+    if (rc == CHIDB_OK && last > 0)
+    {
+        wal->n_committed += last;
+        wal->n_frames = wal->n_committed;
+        wal->db_pages = db_pages;
+        *changed = true;
+    }
+
+    free(npages);
+    free(frame);
+
+    return rc;
+}
+
+
+/* Bring the snapshot up to date with the log
+ *
+ * If the log has been reset since the last snapshot (i.e., its salt is
+ * different), the whole index is thrown away, since the database file
+ * now has pages that are newer than anything this handle has seen.
+ *
+ * Parameters
+ * - wal: A Wal.
+ * - changed: Out parameter. Set to true if the snapshot has changed.
+ * - reset: Out parameter. Set to true if the log was reset.
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_ECORRUPT: The log is not a log of this database
+ * - CHIDB_ENOMEM: Could not allocate memory
+ * - CHIDB_EIO: An I/O error has occurred when accessing the log
+ */
+static int chidb_Wal_refresh(Wal *wal, bool *changed, bool *reset)
+{
+    uint8_t header[WAL_HEADER_SIZE];
+    uint32_t salt = 0;
+    struct stat buf;
+
+    if (fstat(wal->fd, &buf) != 0)
+        return CHIDB_EIO;
+
+    if (buf.st_size >= WAL_HEADER_SIZE)
+    {
+        if (pread(wal->fd, header, WAL_HEADER_SIZE, 0) != WAL_HEADER_SIZE)
+            return CHIDB_EIO;
+        if (memcmp(header, WAL_MAGIC, 8) != 0 || get4byte(header + 8) != wal->page_size)
+            return CHIDB_ECORRUPT;
+        salt = get4byte(header + 12);
+    }
+
+    if (salt != wal->salt)
+    {
+        chidb_Wal_resetIndex(wal);
+        wal->salt = salt;
+        *changed = *reset = true;
+    }
+
+    if (salt == 0)
+        return CHIDB_OK;
+
+    return chidb_Wal_scan(wal, changed);
+}
+
+
+/* Open the write-ahead log of a database file
+ *
+ * The log is created if it does not exist. No snapshot is taken until
+ * chidb_Wal_beginRead is called.
+ *
+ * Parameters
+ * - wal: Out parameter. Used to return the Wal.
+ * - filename: Name of the database file.
+ * - db_fd: Database file.
+ * - page_size: Page size of the database.
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_ENOMEM: Could not allocate memory
+ * - CHIDB_EIO: The log could not be opened
+ */
+int chidb_Wal_open(Wal **wal, const char *filename, int db_fd, uint32_t page_size)
+{
+    if ((*wal = calloc(1, sizeof(Wal))) == NULL)
+        return CHIDB_ENOMEM;
+
+    (*wal)->name = malloc(strlen(filename) + strlen("-wal") + 1);
+    (*wal)->index_size = WAL_INITIAL_INDEX_SIZE;
+    (*wal)->index_pages = calloc(WAL_INITIAL_INDEX_SIZE, sizeof(npage_t));
+    (*wal)->index_frames = malloc(WAL_INITIAL_INDEX_SIZE * sizeof(uint32_t));
+    if ((*wal)->name == NULL || (*wal)->index_pages == NULL || (*wal)->index_frames == NULL)
+    {
+        (*wal)->fd = -1;
+        chidb_Wal_close(*wal);
+        return CHIDB_ENOMEM;
+    }
+
+    sprintf((*wal)->name, "%s-wal", filename);
+    (*wal)->db_fd = db_fd;
+    (*wal)->page_size = page_size;
+    (*wal)->autocheckpoint = WAL_DEFAULT_AUTOCHECKPOINT;
+
+    if (((*wal)->fd = open((*wal)->name, O_RDWR | O_CREAT, 0644)) < 0)
+    {
+        chidb_Wal_close(*wal);
+        return CHIDB_EIO;
+    }
+
+    return CHIDB_OK;
+}
+
+
+/* Close the write-ahead log, letting go of any lock on it
+ *
+ * The log itself stays there; the frames in it are still part of the
+ * database until they are checkpointed.
+ *
+ * Parameters
+ * - wal: A Wal.
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ */
+int chidb_Wal_close(Wal *wal)
+{
+    if (wal->writing)
+        chidb_Wal_endWrite(wal);
+    if (wal->fd >= 0)
+        close(wal->fd);
+    free(wal->index_pages);
+    free(wal->index_frames);
+    free(wal->name);
+    free(wal);
+
+    return CHIDB_OK;
+}
+
+
+/* Take a snapshot
+ *
+ * Takes the read lock (waiting for any checkpoint in progress to finish)
+ * and adds the transactions committed since the last snapshot. Until
+ * chidb_Wal_endRead is called, the log cannot be checkpointed.
+ *
+ * Parameters
+ * - wal: A Wal.
+ * - changed: Out parameter. Set to true if the database has changed
+ *            since the last snapshot (so any page cached from before
+ *            may be out of date).
+ * - reset: Out parameter. Set to true if the log was checkpointed by
+ *          someone else since the last snapshot (so the database file
+ *          itself has changed).
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_ECORRUPT: The log is not a log of this database
+ * - CHIDB_ENOMEM: Could not allocate memory
+ * - CHIDB_EIO: An I/O error has occurred when accessing the log
+ */
+int chidb_Wal_beginRead(Wal *wal, bool *changed, bool *reset)
+{
+    int rc;
+
+    *changed = *reset = false;
+
+    if (wal->reading)
+        return CHIDB_OK;
+
+    if (flock(wal->fd, LOCK_SH) != 0)
+        return CHIDB_EIO;
+    wal->reading = true;
+
+    if ((rc = chidb_Wal_refresh(wal, changed, reset)) != CHIDB_OK)
+        chidb_Wal_endRead(wal);
+
+    return rc;
+}
+
+
+/* Let go of the snapshot (and of the read lock) */
+void chidb_Wal_endRead(Wal *wal)
+{
+    if (!wal->reading)
+        return;
+
+    flock(wal->fd, LOCK_UN);
+    wal->reading = false;
+}
+
+
+/* Become the writer
+ *
+ * Only one handle can write at a time, and only if its snapshot is the
+ * latest: a transaction started on an older snapshot would overwrite
+ * the changes it did not see. In both cases, CHIDB_EBUSY is returned.
+ * If the snapshot was out of date, it is brought up to date (so that
+ * the transaction can be retried once any page cached from the old
+ * snapshot has been dropped).
+ * Must be called with a snapshot.
+ *
+ * Parameters
+ * - wal: A Wal.
+ * - changed, reset: Out parameters. See chidb_Wal_beginRead.
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_EBUSY: Another handle is writing, or has written since the
+ *                snapshot was taken
+ * - CHIDB_EMISUSE: There is no snapshot
+ * - CHIDB_ENOMEM: Could not allocate memory
+ * - CHIDB_EIO: An I/O error has occurred when accessing the log
+ */
+int chidb_Wal_beginWrite(Wal *wal, bool *changed, bool *reset)
+{
+    uint8_t header[WAL_HEADER_SIZE];
+    int rc;
+
+    *changed = *reset = false;
+
+    if (wal->writing)
+        return CHIDB_OK;
+    if (!wal->reading)
+        return CHIDB_EMISUSE;
+
+    if (flock(wal->db_fd, LOCK_EX | LOCK_NB) != 0)
+        return CHIDB_EBUSY;
+
+    rc = chidb_Wal_refresh(wal, changed, reset);
+    if (rc == CHIDB_OK && *changed)
+        rc = CHIDB_EBUSY;
+
+    /* The first writer creates the log's header */
+    if (rc == CHIDB_OK && wal->salt == 0)
+    {
+        uint32_t salt = (uint32_t) time(NULL) ^ ((uint32_t) getpid() << 16);
+
+        wal->salt = salt ? salt : 1;
+        memcpy(header, WAL_MAGIC, 8);
+        put4byte(header + 8, wal->page_size);
+        put4byte(header + 12, wal->salt);
+        if (pwrite(wal->fd, header, WAL_HEADER_SIZE, 0) != WAL_HEADER_SIZE)
+            rc = CHIDB_EIO;
+    }
+
+    /* Frames left behind by a writer that did not commit are thrown away,
+     * so that they cannot be mistaken for frames of this transaction */
+    if (rc == CHIDB_OK && ftruncate(wal->fd, WAL_FRAME_OFFSET(wal, wal->n_frames + 1)) != 0)
+        rc = CHIDB_EIO;
+
+    if (rc != CHIDB_OK)
+    {
+        flock(wal->db_fd, LOCK_UN);
+        return rc;
+    }
+
+    wal->writing = true;
+
+    return CHIDB_OK;
+}
+
+
+/* Let go of the writer lock */
+void chidb_Wal_endWrite(Wal *wal)
+{
+    if (!wal->writing)
+        return;
+
+    flock(wal->db_fd, LOCK_UN);
+    wal->writing = false;
+}
+
+
+/* Read a page from a frame
+ *
+ * Parameters
+ * - wal: A Wal.
+ * - frame: Frame number (as returned by chidb_Wal_findFrame).
+ * - data: Buffer of page_size bytes.
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_EIO: An I/O error has occurred when accessing the log
+ */
+int chidb_Wal_readFrame(Wal *wal, uint32_t frame, uint8_t *data)
+{
+    if (pread(wal->fd, data, wal->page_size,
+              WAL_FRAME_OFFSET(wal, frame) + WAL_FRAME_HEADER_SIZE) != wal->page_size)
+        return CHIDB_EIO;
+
+    return CHIDB_OK;
+}
+
+
+/* Append pages to the log
+ *
+ * The frames are added to the wal index, so that this handle reads the
+ * pages back from the log. If commit is not zero, the last frame is a
+ * commit frame, and the log is synced: the transaction is committed
+ * once this function returns (or, if nosync is set, once the log is
+ * synced by the caller).
+ * Must be called by the writer.
+ *
+ * Parameters
+ * - wal: A Wal.
+ * - pages: Pages to append.
+ * - npages: Number of pages.
+ * - commit: Number of pages in the database, if this commits the
+ *           transaction. Otherwise, zero.
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_EMISUSE: This handle is not the writer
+ * - CHIDB_ENOMEM: Could not allocate memory
+ * - CHIDB_EIO: An I/O error has occurred when accessing the log
+ */
+int chidb_Wal_append(Wal *wal, MemPage **pages, uint32_t npages, npage_t commit)
+{
+    struct iovec iov[IOV_MAX < 64 ? IOV_MAX : 64];
+    uint8_t *headers;
+    uint32_t i = 0;
+    int rc = CHIDB_OK;
+
+    if (!wal->writing)
+        return CHIDB_EMISUSE;
+    if (npages == 0)
+        return commit ? chidb_Wal_commit(wal, commit) : CHIDB_OK;
+
+    if ((headers = malloc((size_t) npages * WAL_FRAME_HEADER_SIZE)) == NULL)
+        return CHIDB_ENOMEM;
+
+    for (uint32_t j = 0; j < npages; j++)
+    {
+        uint8_t *h = headers + (size_t) j * WAL_FRAME_HEADER_SIZE;
+
+        put4byte(h, pages[j]->npage);
+        put4byte(h + 4, j == npages - 1 ? commit : 0);
+        put4byte(h + 8, wal->salt);
+        put4byte(h + 12, chidb_Wal_checksum(h, pages[j]->data, wal->page_size));
+    }
+
+    /* Several frames per pwritev call, each as a header and a page */
+    while (i < npages && rc == CHIDB_OK)
+    {
+        uint32_t n = 0;
+        ssize_t size = 0;
+
+        for (; i + n < npages && 2 * (n + 1) <= sizeof(iov) / sizeof(iov[0]); n++)
+        {
+            iov[2 * n].iov_base = headers + (size_t) (i + n) * WAL_FRAME_HEADER_SIZE;
+            iov[2 * n].iov_len = WAL_FRAME_HEADER_SIZE;
+            iov[2 * n + 1].iov_base = pages[i + n]->data;
+            iov[2 * n + 1].iov_len = wal->page_size;
+            size += WAL_FRAME_SIZE(wal->page_size);
+        }
+
+        if (pwritev(wal->fd, iov, 2 * n, WAL_FRAME_OFFSET(wal, wal->n_frames + i + 1)) != size)
+            rc = CHIDB_EIO;
+        i += n;
+    }
+    free(headers);
+
+    for (uint32_t j = 0; j < npages && rc == CHIDB_OK; j++)
+        rc = chidb_Wal_indexPut(wal, pages[j]->npage, wal->n_frames + j + 1);
+    if (rc != CHIDB_OK)
+        return rc;
+    wal->n_frames += npages;
+
+    if (commit)
+    {
+        if (wal->nosync)
+            wal->unsynced = true;
+        else if (fsync(wal->fd) != 0)
+            return CHIDB_EIO;
+        wal->n_committed = wal->n_frames;
+        wal->db_pages = commit;
+    }
+
+    return CHIDB_OK;
+}
+
+
+/* Commit the frames appended since the last commit
+ *
+ * Used when every page of the transaction has already been appended
+ * (e.g., because it had to be evicted from the buffer pool): the last
+ * frame is turned into a commit frame, and the log is synced.
+ *
+ * Parameters
+ * - wal: A Wal.
+ * - db_pages: Number of pages in the database.
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_ENOMEM: Could not allocate memory
+ * - CHIDB_EIO: An I/O error has occurred when accessing the log
+ */
+int chidb_Wal_commit(Wal *wal, npage_t db_pages)
+{
+    uint8_t *frame;
+    off_t offset = WAL_FRAME_OFFSET(wal, wal->n_frames);
+
+    if (wal->n_frames == wal->n_committed)
+        return CHIDB_OK;
+
+    if ((frame = malloc(WAL_FRAME_SIZE(wal->page_size))) == NULL)
+        return CHIDB_ENOMEM;
+
+    if (pread(wal->fd, frame, WAL_FRAME_SIZE(wal->page_size), offset) != WAL_FRAME_SIZE(wal->page_size))
+    {
+        free(frame);
+        return CHIDB_EIO;
+    }
+    put4byte(frame + 4, db_pages);
+    put4byte(frame + 12, chidb_Wal_checksum(frame, frame + WAL_FRAME_HEADER_SIZE, wal->page_size));
+
+    ssize_t n = pwrite(wal->fd, frame, WAL_FRAME_HEADER_SIZE, offset);
+    free(frame);
+    if (n != WAL_FRAME_HEADER_SIZE)
+        return CHIDB_EIO;
+    if (wal->nosync)
+        wal->unsynced = true;
+    else if (fsync(wal->fd) != 0)
+        return CHIDB_EIO;
+
+    wal->n_committed = wal->n_frames;
+    wal->db_pages = db_pages;
+
+    return CHIDB_OK;
+}
+
+
+/* Throw away the frames of the transaction that has not committed
+ *
+ * The log is cut back to n_frames frames, and the wal index is
+ * rebuilt from the frames that are left.
+ *
+ * Parameters
+ * - wal: A Wal.
+ * - n_frames: Number of frames in the log when the transaction began.
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_ENOMEM: Could not allocate memory
+ * - CHIDB_EIO: An I/O error has occurred when accessing the log
+ */
+int chidb_Wal_rollback(Wal *wal, uint32_t n_frames)
+{
+    bool changed;
+
+    if (n_frames > wal->n_committed)
+        return CHIDB_EMISUSE;
+
+    if (wal->salt != 0 && ftruncate(wal->fd, WAL_FRAME_OFFSET(wal, n_frames + 1)) != 0)
+        return CHIDB_EIO;
+
+    chidb_Wal_resetIndex(wal);
+    if (wal->salt == 0)
+        return CHIDB_OK;
+
+    return chidb_Wal_scan(wal, &changed);
+}
+
+
+static int chidb_Wal_cmpPages(const void *a, const void *b)
+{
+    npage_t pa = *(const npage_t *) a, pb = *(const npage_t *) b;
+
+    return (pa > pb) - (pa < pb);
+}
+
+
+/* Copy the log into the database file, and reset it
+ *
+ * The last version of each page is copied (in page order), the
+ * database file is synced, and the log is emptied. This needs every
+ * other handle to be done reading; otherwise, nothing is done and
+ * CHIDB_EBUSY is returned (this is not an error: the frames stay in the
+ * log until the next checkpoint).
+ * Must be called by the writer, with no uncommitted frames.
+ *
+ * Parameters
+ * - wal: A Wal.
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_EBUSY: Another handle has a snapshot
+ * - CHIDB_EMISUSE: This handle is not the writer, or it has frames
+ *                  that have not been committed
+ * - CHIDB_ENOMEM: Could not allocate memory
+ * - CHIDB_EIO: An I/O error has occurred when accessing the files
+ */
+int chidb_Wal_checkpoint(Wal *wal)
+{
+    uint8_t header[WAL_HEADER_SIZE];
+    npage_t *npages;
+    uint8_t *data;
+    uint32_t n = 0;
+    int rc = CHIDB_OK;
+
+    if (!wal->writing || wal->n_frames != wal->n_committed)
+        return CHIDB_EMISUSE;
+    if (wal->n_committed == 0)
+        return CHIDB_OK;
+
+    /* Not atomic: if this fails, our own shared lock may be gone too */
+    if (flock(wal->fd, LOCK_EX | LOCK_NB) != 0)
+    {
+        if (wal->reading && flock(wal->fd, LOCK_SH) != 0)
+            return CHIDB_EIO;
+        return CHIDB_EBUSY;
+    }
+
+    npages = malloc(wal->index_n * sizeof(npage_t));
+    data = malloc(wal->page_size);
+    if (npages == NULL || data == NULL)
+        rc = CHIDB_ENOMEM;
+
+    for (uint32_t i = 0; i < wal->index_size && rc == CHIDB_OK; i++)
+        if (wal->index_pages[i] != 0)
+            npages[n++] = wal->index_pages[i];
+    if (rc == CHIDB_OK)
+        qsort(npages, n, sizeof(npage_t), chidb_Wal_cmpPages);
+
+    for (uint32_t i = 0; i < n && rc == CHIDB_OK; i++)
+    {
+        if ((rc = chidb_Wal_readFrame(wal, chidb_Wal_findFrame(wal, npages[i]), data)) != CHIDB_OK)
+            break;
+        if (pwrite(wal->db_fd, data, wal->page_size, (off_t) (npages[i] - 1) * wal->page_size) != wal->page_size)
+            rc = CHIDB_EIO;
+    }
+
+    /* Pages allocated but never written are still part of the database,
+     * and pages past the end of it (after a vacuum) are not */
+    struct stat buf;
+    if (rc == CHIDB_OK && (fstat(wal->db_fd, &buf) != 0
+            || (buf.st_size != (off_t) wal->db_pages * wal->page_size
+                && ftruncate(wal->db_fd, (off_t) wal->db_pages * wal->page_size) != 0)))
+        rc = CHIDB_EIO;
+
+    if (rc == CHIDB_OK && fsync(wal->db_fd) != 0)
+        rc = CHIDB_EIO;
+
+    /* Only once the file has every page can the log be reset */
+    if (rc == CHIDB_OK)
+    {
+        wal->salt = wal->salt + 1 ? wal->salt + 1 : 1;
+        memcpy(header, WAL_MAGIC, 8);
+        put4byte(header + 8, wal->page_size);
+        put4byte(header + 12, wal->salt);
+        if (pwrite(wal->fd, header, WAL_HEADER_SIZE, 0) != WAL_HEADER_SIZE
+                || ftruncate(wal->fd, WAL_HEADER_SIZE) != 0)
+            rc = CHIDB_EIO;
+        chidb_Wal_resetIndex(wal);
+    }
+
+    flock(wal->fd, wal->reading ? LOCK_SH : LOCK_UN);
+    free(npages);
+    free(data);
+
+    return rc;
+}
@@ -113,6 +113,8 @@ size_t Column_getSize(Column_t *col)
         return sizeof(int);
     case TYPE_TEXT:
         return 250; /* default text length */
+    case TYPE_PARAM:
+        break;
     }
 
     return 0;
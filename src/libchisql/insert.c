@@ -1,3 +1,4 @@
+#include <ctype.h>
 #include <chisql/chisql.h>
 
 
@@ -39,24 +40,33 @@ Insert_t *Insert_make(const char *table_name, StrList_t *opt_col_names, Literal_
 
 void Insert_print(Insert_t *insert)
 {
-    Literal_t *val = insert->values;
-    int first = 1;
+    Insert_t *tuple;
+    Literal_t *val;
+    int first;
     printf("Insert ");
-    printf("[");
-    while (val)
+    for (tuple = insert; tuple; tuple = tuple->next)
     {
-        if (first)
+        if (tuple != insert)
         {
-            first = 0;
+            printf(", ");
         }
-        else
+        printf("[");
+        first = 1;
+        for (val = tuple->values; val; val = val->next)
         {
-            printf(", ");
+            if (first)
+            {
+                first = 0;
+            }
+            else
+            {
+                printf(", ");
+            }
+            Literal_print(val);
         }
-        Literal_print(val);
-        val = val->next;
+        printf("]");
     }
-    printf("] into %s", insert->table_name);
+    printf(" into %s", insert->table_name);
     if (insert->col_names)
     {
         StrList_t *list = insert->col_names;
@@ -88,8 +98,101 @@ void Insert_free(Insert_t *insert)
         fprintf(stderr, "Warning: Insert_free called on null pointer\n");
         return;
     }
-    free(insert->table_name);
-    StrList_free(insert->col_names);
-    Literal_free(insert->values);
-    free(insert);
+    while (insert)
+    {
+        Insert_t *next = insert->next;
+        free(insert->table_name);
+        StrList_free(insert->col_names);
+        Literal_free(insert->values);
+        free(insert);
+        insert = next;
+    }
+}
+
+/* Skips to the parenthesis that closes the one at p, or to the end of
+ * the string if there is none. Parentheses inside quotes do not count. */
+static const char *Insert_closeParen(const char *p)
+{
+    char quote = 0;
+    int depth = 0;
+
+    for (; *p; p++)
+    {
+        if (quote)
+            quote = (*p == quote) ? 0 : quote;
+        else if (*p == '"' || *p == '\'')
+            quote = *p;
+        else if (*p == '(')
+            depth++;
+        else if (*p == ')' && --depth == 0)
+            break;
+    }
+    return p;
+}
+
+/* Splits a multi-row INSERT
+ *
+ * The grammar only takes one tuple after VALUES, so an
+ * INSERT ... VALUES (...), (...) statement is parsed one tuple at a
+ * time. Each statement in *split is the text up to VALUES followed by
+ * one of the tuples, and has to be freed (as does *split).
+ *
+ * Returns the number of statements, 0 if sql does not have more than
+ * one tuple (*split is then not set), or -1 if a tuple is malformed.
+ */
+int Insert_split(const char *sql, char ***split)
+{
+    const char *p, *end, *values = NULL;
+    char quote = 0;
+    char **stmts = NULL;
+    int n = 0, prefix, len, i;
+
+    for (p = sql; *p && !values; p++)
+    {
+        if (quote)
+            quote = (*p == quote) ? 0 : quote;
+        else if (*p == '"' || *p == '\'')
+            quote = *p;
+        else if (SRA_isWord(sql, p, "VALUES"))
+            values = p + 6;
+    }
+    if (values == NULL)
+        return 0;
+    prefix = values - sql;
+
+    for (p = values; ; p++)
+    {
+        while (isspace((unsigned char) *p))
+            p++;
+        end = Insert_closeParen(p);
+        if (*p != '(' || *end == '\0')
+            break;
+
+        len = prefix + (end - p) + 4;
+        stmts = realloc(stmts, (n + 1) * sizeof(char *));
+        stmts[n] = malloc(len);
+        snprintf(stmts[n++], len, "%.*s %.*s;", prefix, sql, (int) (end - p + 1), p);
+
+        for (p = end + 1; isspace((unsigned char) *p); p++);
+        if (*p != ',')
+            break;
+    }
+
+    /* Only the semicolon may follow the last tuple */
+    if (*p == ';')
+        p++;
+    while (isspace((unsigned char) *p))
+        p++;
+
+    if (n > 1 && *p == '\0')
+    {
+        *split = stmts;
+        return n;
+    }
+
+    for (i = 0; i < n; i++)
+        free(stmts[i]);
+    free(stmts);
+
+    return n > 1 ? -1 : 0;
 }
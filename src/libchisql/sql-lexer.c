@@ -1398,6 +1398,7 @@ case 78:
 YY_RULE_SETUP
 #line 103 "src/libchisql/sql.l"
 { if (yydebug) printf("lexed single character '%c'\n", yytext[0]); 
+                          if (yytext[0] == '?') return PARAM;
                           return yytext[0]; }
 	YY_BREAK
 case 79:
@@ -73,6 +73,7 @@
 #include <stdlib.h>
 #include <chidb/chidb.h>
 #include <chisql/chisql.h>
+#include <pthread.h>
 #include "sql-lexer.h"
 
 #define YYERROR_VERBOSE
@@ -87,6 +88,10 @@ int num_stmts = 0;
 
 chisql_statement_t *__stmt;
 
+/* The scanner and the parser keep their state in globals (and so does
+ * __stmt), so only one statement is parsed at a time */
+static pthread_mutex_t __sql_mutex = PTHREAD_MUTEX_INITIALIZER;
+
 
 
 /* Line 268 of yacc.c  */
@@ -187,7 +192,8 @@ chisql_statement_t *__stmt;
      IDENTIFIER = 325,
      STRING_LITERAL = 326,
      DOUBLE_LITERAL = 327,
-     INT_LITERAL = 328
+     INT_LITERAL = 328,
+     PARAM = 329
    };
 #endif
 /* Tokens.  */
@@ -262,6 +268,7 @@ chisql_statement_t *__stmt;
 #define STRING_LITERAL 326
 #define DOUBLE_LITERAL 327
 #define INT_LITERAL 328
+#define PARAM 329
 
 
 
@@ -529,20 +536,20 @@ union yyalloc
 /* YYFINAL -- State number of the termination state.  */
 #define YYFINAL  26
 /* YYLAST -- Last index in YYTABLE.  */
-#define YYLAST   273
+#define YYLAST   284
 
 /* YYNTOKENS -- Number of terminals.  */
-#define YYNTOKENS  86
+#define YYNTOKENS  87
 /* YYNNTS -- Number of nonterminals.  */
 #define YYNNTS  57
 /* YYNRULES -- Number of rules.  */
-#define YYNRULES  142
+#define YYNRULES  143
 /* YYNRULES -- Number of states.  */
-#define YYNSTATES  248
+#define YYNSTATES  249
 
 /* YYTRANSLATE(YYLEX) -- Bison symbol number corresponding to YYLEX.  */
 #define YYUNDEFTOK  2
-#define YYMAXUTOK   328
+#define YYMAXUTOK   329
 
 #define YYTRANSLATE(YYX)						\
   ((unsigned int) (YYX) <= YYMAXUTOK ? yytranslate[YYX] : YYUNDEFTOK)
@@ -554,9 +561,9 @@ static const yytype_uint8 yytranslate[] =
        2,     2,     2,     2,     2,     2,     2,     2,     2,     2,
        2,     2,     2,     2,     2,     2,     2,     2,     2,     2,
        2,     2,     2,     2,     2,     2,     2,     2,     2,     2,
-      75,    76,    83,    81,    77,    82,    85,    84,     2,     2,
-       2,     2,     2,     2,     2,     2,     2,     2,     2,    74,
-      80,    78,    79,     2,     2,     2,     2,     2,     2,     2,
+      76,    77,    84,    82,    78,    83,    86,    85,     2,     2,
+       2,     2,     2,     2,     2,     2,     2,     2,     2,    75,
+      81,    79,    80,     2,     2,     2,     2,     2,     2,     2,
        2,     2,     2,     2,     2,     2,     2,     2,     2,     2,
        2,     2,     2,     2,     2,     2,     2,     2,     2,     2,
        2,     2,     2,     2,     2,     2,     2,     2,     2,     2,
@@ -582,7 +589,7 @@ static const yytype_uint8 yytranslate[] =
       35,    36,    37,    38,    39,    40,    41,    42,    43,    44,
       45,    46,    47,    48,    49,    50,    51,    52,    53,    54,
       55,    56,    57,    58,    59,    60,    61,    62,    63,    64,
-      65,    66,    67,    68,    69,    70,    71,    72,    73
+      65,    66,    67,    68,    69,    70,    71,    72,    73,    74
 };
 
 #if YYDEBUG
@@ -604,54 +611,55 @@ static const yytype_uint16 yyprhs[] =
      320,   322,   324,   326,   328,   333,   338,   340,   341,   344,
      349,   352,   356,   360,   364,   367,   369,   371,   373,   376,
      379,   381,   382,   391,   395,   396,   398,   402,   404,   408,
-     410,   412,   414
+     410,   412,   414,   419
 };
 
 /* YYRHS -- A `-1'-separated list of the rules' RHS.  */
 static const yytype_int16 yyrhs[] =
 {
-      87,     0,    -1,    88,    -1,    87,    88,    -1,    89,    74,
-      -1,    69,    89,    74,    -1,    90,    -1,   105,    -1,   137,
-      -1,   142,    -1,    -1,    94,    -1,    91,    -1,     3,    92,
-      68,    93,    51,   129,    75,   128,    76,    -1,    49,    -1,
-      -1,    70,    -1,     3,     4,   129,    75,    95,    98,    76,
-      -1,    96,    -1,    95,    77,    96,    -1,   128,    97,   102,
+      88,     0,    -1,    89,    -1,    88,    89,    -1,    90,    75,
+      -1,    69,    90,    75,    -1,    91,    -1,   106,    -1,   138,
+      -1,   143,    -1,    -1,    95,    -1,    92,    -1,     3,    93,
+      68,    94,    51,   130,    76,   129,    77,    -1,    49,    -1,
+      -1,    70,    -1,     3,     4,   130,    76,    96,    99,    77,
+      -1,    97,    -1,    96,    78,    97,    -1,   129,    98,   103,
       -1,    28,    -1,    30,    -1,    31,    -1,    32,    -1,    33,
-      -1,    97,    75,    73,    76,    -1,    77,    99,    -1,    -1,
-     100,    -1,    99,    77,   100,    -1,    11,    13,    75,   139,
-      76,    -1,    12,    13,    75,   128,    76,   101,    -1,    23,
-     129,    -1,    23,   129,    75,   128,    76,    -1,   103,    -1,
-      -1,   104,    -1,   104,   103,    -1,    16,    17,    -1,    49,
-      -1,    11,    13,    -1,    12,    13,   101,    -1,    14,   141,
-      -1,    46,    -1,    15,   114,    -1,   107,    -1,   105,   106,
-     107,    -1,    43,    -1,    57,    -1,    58,    -1,     7,   108,
-     119,     8,   130,   110,   109,    -1,    75,   107,    76,    -1,
-      59,    -1,    -1,   113,    -1,   112,    -1,   113,   112,    -1,
-     112,   113,    -1,    -1,   111,    -1,    -1,     9,   114,    -1,
-      67,    25,   120,    -1,    24,    25,   120,    -1,    24,    25,
-     120,    47,    -1,    24,    25,   120,    48,    -1,   115,    -1,
-     115,   117,   114,    -1,   120,   118,   120,    -1,   120,   116,
-      -1,    75,   114,    76,    -1,    16,   115,    -1,    50,    75,
-     140,    76,    -1,    50,    75,   105,    76,    -1,    18,    -1,
-      19,    -1,    78,    -1,    79,    -1,    80,    -1,    21,    -1,
-      22,    -1,    20,    -1,   120,   125,    -1,   119,    77,   120,
-     125,    -1,   120,    81,   121,    -1,   120,    82,   121,    -1,
-     121,    -1,   121,    83,   122,    -1,   121,    84,   122,    -1,
-     121,    60,   122,    -1,   122,    -1,    75,   120,    76,    -1,
-      82,   122,    -1,   123,    -1,   141,    -1,    17,    -1,   124,
-      -1,   126,    75,   120,    76,    -1,   127,    -1,   129,    85,
-     127,    -1,    27,    70,    -1,    70,    -1,    -1,    52,    -1,
-      53,    -1,    54,    -1,    55,    -1,    56,    -1,    83,    -1,
-     128,    -1,    70,    -1,    70,    -1,   133,    -1,   130,   135,
-     133,   131,    -1,   130,   134,   133,   131,    -1,   132,    -1,
-      -1,    51,   114,    -1,    34,    75,   139,    76,    -1,   129,
-     125,    -1,    39,   136,    36,    -1,    40,   136,    36,    -1,
-      10,   136,    36,    -1,    41,    36,    -1,    44,    -1,    77,
+      -1,    98,    76,    73,    77,    -1,    78,   100,    -1,    -1,
+     101,    -1,   100,    78,   101,    -1,    11,    13,    76,   140,
+      77,    -1,    12,    13,    76,   129,    77,   102,    -1,    23,
+     130,    -1,    23,   130,    76,   129,    77,    -1,   104,    -1,
+      -1,   105,    -1,   105,   104,    -1,    16,    17,    -1,    49,
+      -1,    11,    13,    -1,    12,    13,   102,    -1,    14,   142,
+      -1,    46,    -1,    15,   115,    -1,   108,    -1,   106,   107,
+     108,    -1,    43,    -1,    57,    -1,    58,    -1,     7,   109,
+     120,     8,   131,   111,   110,    -1,    76,   108,    77,    -1,
+      59,    -1,    -1,   114,    -1,   113,    -1,   114,   113,    -1,
+     113,   114,    -1,    -1,   112,    -1,    -1,     9,   115,    -1,
+      67,    25,   121,    -1,    24,    25,   121,    -1,    24,    25,
+     121,    47,    -1,    24,    25,   121,    48,    -1,   116,    -1,
+     116,   118,   115,    -1,   121,   119,   121,    -1,   121,   117,
+      -1,    76,   115,    77,    -1,    16,   116,    -1,    50,    76,
+     141,    77,    -1,    50,    76,   106,    77,    -1,    18,    -1,
+      19,    -1,    79,    -1,    80,    -1,    81,    -1,    21,    -1,
+      22,    -1,    20,    -1,   121,   126,    -1,   120,    78,   121,
+     126,    -1,   121,    82,   122,    -1,   121,    83,   122,    -1,
+     122,    -1,   122,    84,   123,    -1,   122,    85,   123,    -1,
+     122,    60,   123,    -1,   123,    -1,    76,   121,    77,    -1,
+      83,   123,    -1,   124,    -1,   142,    -1,    17,    -1,   125,
+      -1,   127,    76,   121,    77,    -1,   128,    -1,   130,    86,
+     128,    -1,    27,    70,    -1,    70,    -1,    -1,    52,    -1,
+      53,    -1,    54,    -1,    55,    -1,    56,    -1,    84,    -1,
+     129,    -1,    70,    -1,    70,    -1,   134,    -1,   131,   136,
+     134,   132,    -1,   131,   135,   134,   132,    -1,   133,    -1,
+      -1,    51,   115,    -1,    34,    76,   140,    77,    -1,   130,
+     126,    -1,    39,   137,    36,    -1,    40,   137,    36,    -1,
+      10,   137,    36,    -1,    41,    36,    -1,    44,    -1,    78,
       -1,    36,    -1,    42,    36,    -1,    37,    36,    -1,    38,
-      -1,    -1,     5,     6,   129,   138,    45,    75,   140,    76,
-      -1,    75,   139,    76,    -1,    -1,   128,    -1,   139,    77,
-     128,    -1,   141,    -1,   140,    77,   141,    -1,    73,    -1,
-      72,    -1,    71,    -1,    26,     8,   129,   111,    -1
+      -1,    -1,     5,     6,   130,   139,    45,    76,   141,    77,
+      -1,    76,   140,    77,    -1,    -1,   129,    -1,   140,    78,
+     129,    -1,   142,    -1,   141,    78,   142,    -1,    73,    -1,
+      72,    -1,    71,    -1,    26,     8,   130,   112,    -1,    74,
+      -1
 };
 
 /* YYRLINE[YYN] -- source line where rule number YYN was defined.  */
@@ -671,7 +679,7 @@ static const yytype_uint16 yyrline[] =
      376,   380,   384,   388,   389,   390,   412,   413,   417,   418,
      422,   426,   427,   428,   429,   430,   434,   434,   434,   434,
      438,   439,   443,   450,   451,   455,   456,   460,   461,   469,
-     470,   471,   481
+     470,   471,   481,   485
 };
 #endif
 
@@ -690,7 +698,7 @@ static const char *const yytname[] =
   "SUM", "AVG", "MIN", "MAX", "INTERSECT", "EXCEPT", "DISTINCT", "CONCAT",
   "TRUE", "FALSE", "CASE", "WHEN", "DECLARE", "BIT", "GROUP", "INDEX",
   "EXPLAIN", "IDENTIFIER", "STRING_LITERAL", "DOUBLE_LITERAL",
-  "INT_LITERAL", "';'", "'('", "')'", "','", "'='", "'>'", "'<'", "'+'",
+  "INT_LITERAL", "PARAM", "';'", "'('", "')'", "','", "'='", "'>'", "'<'", "'+'",
   "'-'", "'*'", "'/'", "'.'", "$accept", "sql_queries", "sql_query",
   "sql_line", "create", "create_index", "opt_unique", "index_name",
   "create_table", "column_dec_list", "column_dec", "column_type",
@@ -719,29 +727,29 @@ static const yytype_uint16 yytoknum[] =
      295,   296,   297,   298,   299,   300,   301,   302,   303,   304,
      305,   306,   307,   308,   309,   310,   311,   312,   313,   314,
      315,   316,   317,   318,   319,   320,   321,   322,   323,   324,
-     325,   326,   327,   328,    59,    40,    41,    44,    61,    62,
-      60,    43,    45,    42,    47,    46
+     325,   326,   327,   328,   329,    59,    40,    41,    44,    61,
+      62,    60,    43,    45,    42,    47,    46
 };
 # endif
 
 /* YYR1[YYN] -- Symbol number of symbol that rule YYN derives.  */
 static const yytype_uint8 yyr1[] =
 {
-       0,    86,    87,    87,    88,    88,    89,    89,    89,    89,
-      89,    90,    90,    91,    92,    92,    93,    94,    95,    95,
-      96,    97,    97,    97,    97,    97,    97,    98,    98,    99,
-      99,   100,   100,   101,   101,   102,   102,   103,   103,   104,
-     104,   104,   104,   104,   104,   104,   105,   105,   106,   106,
-     106,   107,   107,   108,   108,   109,   109,   109,   109,   109,
-     110,   110,   111,   112,   113,   113,   113,   114,   114,   115,
-     115,   115,   115,   116,   116,   117,   117,   118,   118,   118,
-     118,   118,   118,   119,   119,   120,   120,   120,   121,   121,
-     121,   121,   122,   122,   122,   123,   123,   123,   123,   124,
-     124,   125,   125,   125,   126,   126,   126,   126,   126,   127,
-     127,   128,   129,   130,   130,   130,   131,   131,   132,   132,
-     133,   134,   134,   134,   134,   134,   135,   135,   135,   135,
-     136,   136,   137,   138,   138,   139,   139,   140,   140,   141,
-     141,   141,   142
+       0,    87,    88,    88,    89,    89,    90,    90,    90,    90,
+      90,    91,    91,    92,    93,    93,    94,    95,    96,    96,
+      97,    98,    98,    98,    98,    98,    98,    99,    99,   100,
+     100,   101,   101,   102,   102,   103,   103,   104,   104,   105,
+     105,   105,   105,   105,   105,   105,   106,   106,   107,   107,
+     107,   108,   108,   109,   109,   110,   110,   110,   110,   110,
+     111,   111,   112,   113,   114,   114,   114,   115,   115,   116,
+     116,   116,   116,   117,   117,   118,   118,   119,   119,   119,
+     119,   119,   119,   120,   120,   121,   121,   121,   122,   122,
+     122,   122,   123,   123,   123,   124,   124,   124,   124,   125,
+     125,   126,   126,   126,   127,   127,   127,   127,   127,   128,
+     128,   129,   130,   131,   131,   131,   132,   132,   133,   133,
+     134,   135,   135,   135,   135,   135,   136,   136,   136,   136,
+     137,   137,   138,   139,   139,   140,   140,   141,   141,   142,
+     142,   142,   143,   142
 };
 
 /* YYR2[YYN] -- Number of symbols composing right hand side of rule YYN.  */
@@ -761,7 +769,7 @@ static const yytype_uint8 yyr2[] =
        1,     1,     1,     1,     4,     4,     1,     0,     2,     4,
        2,     3,     3,     3,     2,     1,     1,     1,     2,     2,
        1,     0,     8,     3,     0,     1,     3,     1,     3,     1,
-       1,     1,     4
+       1,     1,     4,     1
 };
 
 /* YYDEFACT[STATE-NAME] -- Default reduction number in state STATE-NUM.
@@ -773,81 +781,81 @@ static const yytype_uint8 yydefact[] =
        6,    12,    11,     7,    46,     8,     9,     0,    14,     0,
        0,    53,     0,     0,     0,     0,     1,     3,     4,    48,
       49,    50,     0,   112,     0,     0,   134,    96,   104,   105,
-     106,   107,   108,   111,   141,   140,   139,     0,     0,   109,
-       0,   103,    87,    91,    94,    97,     0,    99,   110,     0,
-      95,     0,     5,    52,    47,     0,    16,     0,     0,     0,
-       0,    93,     0,     0,     0,   102,     0,     0,    83,     0,
-       0,     0,     0,     0,     0,   142,   111,    28,    18,     0,
-       0,   135,     0,     0,    92,   103,    61,   113,   103,   101,
-      85,    86,    90,    88,    89,     0,   100,     0,     0,    62,
-      67,     0,     0,     0,    21,    22,    23,    24,    25,    36,
-       0,   133,     0,     0,   120,   131,   127,     0,   131,   131,
-       0,     0,   125,   126,    59,    60,     0,     0,    84,    98,
-      72,     0,     0,    75,    76,     0,    82,    80,    81,     0,
-      77,    78,    79,    70,     0,     0,     0,    19,    27,    29,
-      17,     0,     0,     0,     0,     0,    44,    40,     0,    20,
-      35,    37,     0,   136,     0,   137,   130,     0,   129,     0,
-       0,   124,   128,     0,     0,    51,    56,    55,   117,   117,
-      71,    68,     0,    69,     0,     0,     0,    41,     0,    43,
-      45,    39,     0,    38,     0,   132,     0,   123,   121,   122,
-       0,     0,    58,    57,     0,     0,   115,   116,   114,     0,
-       0,     0,     0,    30,     0,    42,    26,    13,   138,    64,
-      63,     0,   118,    74,    73,     0,     0,    33,    65,    66,
-       0,    31,     0,     0,   119,    32,     0,    34
+     106,   107,   108,   111,   141,   140,   139,   143,     0,     0,
+     109,     0,   103,    87,    91,    94,    97,     0,    99,   110,
+       0,    95,     0,     5,    52,    47,     0,    16,     0,     0,
+       0,     0,    93,     0,     0,     0,   102,     0,     0,    83,
+       0,     0,     0,     0,     0,     0,   142,   111,    28,    18,
+       0,     0,   135,     0,     0,    92,   103,    61,   113,   103,
+     101,    85,    86,    90,    88,    89,     0,   100,     0,     0,
+      62,    67,     0,     0,     0,    21,    22,    23,    24,    25,
+      36,     0,   133,     0,     0,   120,   131,   127,     0,   131,
+     131,     0,     0,   125,   126,    59,    60,     0,     0,    84,
+      98,    72,     0,     0,    75,    76,     0,    82,    80,    81,
+       0,    77,    78,    79,    70,     0,     0,     0,    19,    27,
+      29,    17,     0,     0,     0,     0,     0,    44,    40,     0,
+      20,    35,    37,     0,   136,     0,   137,   130,     0,   129,
+       0,     0,   124,   128,     0,     0,    51,    56,    55,   117,
+     117,    71,    68,     0,    69,     0,     0,     0,    41,     0,
+      43,    45,    39,     0,    38,     0,   132,     0,   123,   121,
+     122,     0,     0,    58,    57,     0,     0,   115,   116,   114,
+       0,     0,     0,     0,    30,     0,    42,    26,    13,   138,
+      64,    63,     0,   118,    74,    73,     0,     0,    33,    65,
+      66,     0,    31,     0,     0,   119,    32,     0,    34
 };
 
 /* YYDEFGOTO[NTERM-NUM].  */
 static const yytype_int16 yydefgoto[] =
 {
-      -1,     7,     8,     9,    10,    11,    19,    67,    12,    87,
-      88,   119,   113,   158,   159,   225,   169,   170,   171,    13,
-      32,    14,    22,   185,   134,    85,   186,   187,   109,   110,
-     153,   145,   154,    50,   111,    52,    53,    54,    55,    78,
-      56,    57,    58,    59,    96,   216,   217,    97,   136,   137,
-     177,    15,    69,    92,   174,    60,    16
+      -1,     7,     8,     9,    10,    11,    19,    68,    12,    88,
+      89,   120,   114,   159,   160,   226,   170,   171,   172,    13,
+      32,    14,    22,   186,   135,    86,   187,   188,   110,   111,
+     154,   146,   155,    51,   112,    53,    54,    55,    56,    79,
+      57,    58,    59,    60,    97,   217,   218,    98,   137,   138,
+     178,    15,    70,    93,   175,    61,    16
 };
 
 /* YYPACT[STATE-NUM] -- Index in YYTABLE of the portion describing
    STATE-NUM.  */
-#define YYPACT_NINF -184
+#define YYPACT_NINF -193
 static const yytype_int16 yypact[] =
 {
-       9,     5,    26,   -29,    43,    14,    11,     8,  -184,   -35,
-    -184,  -184,  -184,    45,  -184,  -184,  -184,     0,  -184,    42,
-       0,  -184,   122,     0,     1,    25,  -184,  -184,  -184,  -184,
-    -184,  -184,    11,  -184,    41,    38,    68,  -184,  -184,  -184,
-    -184,  -184,  -184,    61,  -184,  -184,  -184,   122,   122,  -184,
-       2,    15,    34,  -184,  -184,  -184,    94,  -184,  -184,    88,
-    -184,   172,  -184,  -184,  -184,   113,  -184,   140,   113,   158,
-      24,  -184,     0,   122,   136,  -184,   122,   122,  -184,   122,
-     122,   122,   122,   -50,    82,  -184,  -184,   134,  -184,   187,
-       0,  -184,    48,   141,  -184,    -5,    27,  -184,    15,  -184,
-      34,    34,  -184,  -184,  -184,    31,  -184,    82,    82,  -184,
-     111,   106,    12,   151,  -184,  -184,  -184,  -184,  -184,   133,
-     153,  -184,   113,    50,  -184,   191,  -184,   194,   191,   191,
-     195,   196,  -184,  -184,     7,  -184,     0,     0,  -184,  -184,
-    -184,   157,   120,  -184,  -184,    82,  -184,  -184,  -184,   159,
-    -184,  -184,  -184,  -184,   122,   222,   223,  -184,   160,  -184,
-    -184,   225,   226,    50,    82,   224,  -184,  -184,   167,  -184,
-    -184,   198,   113,  -184,    55,  -184,  -184,   206,  -184,   207,
-     209,  -184,  -184,   221,   227,  -184,   229,   181,    -6,    -6,
-    -184,  -184,    20,    69,   174,   175,   149,  -184,   228,  -184,
-    -184,  -184,   178,  -184,   179,  -184,    50,  -184,  -184,  -184,
-     122,   122,  -184,  -184,   182,    82,  -184,  -184,  -184,   -14,
-      86,   113,   113,  -184,     0,  -184,  -184,  -184,  -184,    33,
-      69,   113,  -184,  -184,  -184,    90,   180,   183,  -184,  -184,
-      95,  -184,   228,   113,  -184,  -184,   184,  -184
+       9,     6,    42,   -20,    25,    16,    10,     8,  -193,    -3,
+    -193,  -193,  -193,     0,  -193,  -193,  -193,   -16,  -193,     7,
+     -16,  -193,   123,   -16,    44,     5,  -193,  -193,  -193,  -193,
+    -193,  -193,    10,  -193,    15,    40,    57,  -193,  -193,  -193,
+    -193,  -193,  -193,    53,  -193,  -193,  -193,  -193,   123,   123,
+    -193,     1,    17,   -34,  -193,  -193,  -193,    65,  -193,  -193,
+      63,  -193,   144,  -193,  -193,  -193,    87,  -193,   114,    87,
+     122,    31,  -193,   -16,   123,    99,  -193,   123,   123,  -193,
+     123,   123,   123,   123,   -32,    90,  -193,  -193,   103,  -193,
+      94,   -16,  -193,   -46,   107,  -193,    -9,    27,  -193,    17,
+    -193,   -34,   -34,  -193,  -193,  -193,    35,  -193,    90,    90,
+    -193,    83,   150,    13,   115,  -193,  -193,  -193,  -193,  -193,
+     136,   129,  -193,    87,    64,  -193,   160,  -193,   184,   160,
+     160,   192,   200,  -193,  -193,    -2,  -193,   -16,   -16,  -193,
+    -193,  -193,   161,   134,  -193,  -193,    90,  -193,  -193,  -193,
+     163,  -193,  -193,  -193,  -193,   123,   224,   227,  -193,   164,
+    -193,  -193,   228,   230,    64,    90,   229,  -193,  -193,   171,
+    -193,  -193,   207,    87,  -193,    54,  -193,  -193,   209,  -193,
+     211,   212,  -193,  -193,   225,   226,  -193,   231,   182,    -6,
+      -6,  -193,  -193,    22,   104,   176,   178,   177,  -193,   234,
+    -193,  -193,  -193,   181,  -193,   183,  -193,    64,  -193,  -193,
+    -193,   123,   123,  -193,  -193,   185,    90,  -193,  -193,  -193,
+      46,   124,    87,    87,  -193,   -16,  -193,  -193,  -193,  -193,
+      33,   104,    87,  -193,  -193,  -193,   126,   186,   188,  -193,
+    -193,   132,  -193,   234,    87,  -193,  -193,   189,  -193
 };
 
 /* YYPGOTO[NTERM-NUM].  */
 static const yytype_int16 yypgoto[] =
 {
-    -184,  -184,   252,   256,  -184,  -184,  -184,  -184,  -184,  -184,
-     150,  -184,  -184,  -184,    67,    22,  -184,    96,  -184,    73,
-    -184,    40,  -184,  -184,  -184,   170,    81,    83,  -104,   163,
-    -184,  -184,  -184,  -184,   -21,   145,   -23,  -184,  -184,   -45,
-    -184,   188,   -63,   -17,  -184,    84,  -184,    87,  -184,  -184,
-      97,  -184,  -184,  -183,    80,  -116,  -184
+    -193,  -193,   252,   257,  -193,  -193,  -193,  -193,  -193,  -193,
+     152,  -193,  -193,  -193,    70,    26,  -193,    96,  -193,    77,
+    -193,    14,  -193,  -193,  -193,   174,    84,    86,  -105,   166,
+    -193,  -193,  -193,  -193,   -21,   147,    48,  -193,  -193,   -26,
+    -193,   191,   -64,   -17,  -193,    88,  -193,    89,  -193,  -193,
+     105,  -193,  -193,  -192,    91,  -117,  -193
 };
 
 /* YYTABLE[YYPACT[STATE-NUM]].  What to do in state STATE-NUM.  If
@@ -856,34 +864,35 @@ static const yytype_int16 yypgoto[] =
 #define YYTABLE_NINF -113
 static const yytype_int16 yytable[] =
 {
-      34,    51,    89,    36,   141,    91,    61,   175,    26,    17,
-      72,     1,     1,     2,     2,     3,     3,     1,     3,     2,
-      86,     3,    74,   155,   156,    71,    70,     3,   214,    29,
-      21,   183,    20,    49,     4,     4,    84,   125,   235,    28,
-       4,   191,    74,    30,    31,   215,    25,   199,   240,    89,
-     124,    23,    98,   138,    18,    95,   102,   103,   104,   173,
-     200,   105,   233,   126,   127,    75,   128,   129,   130,   131,
-      33,   132,    64,   120,   184,    62,   175,     5,     5,    73,
-     238,   239,    86,     6,     6,    75,     6,   142,    29,     6,
-     228,    44,    45,    46,    79,     6,    76,    77,   107,    37,
-      94,    63,    30,    31,   133,    76,    77,   139,    66,   204,
-      35,   232,    76,    77,    76,    77,    65,    80,    81,    95,
-      95,    44,    45,    46,   121,   122,   146,   147,   148,   143,
-     144,   205,   206,   193,    38,    39,    40,    41,    42,    37,
-     146,   147,   148,    68,   161,   162,  -112,   163,   164,   165,
-      76,    77,    43,    44,    45,    46,   149,   108,    91,   236,
-     155,   156,   234,   206,    48,    49,   241,   122,    91,    82,
-     149,   244,   122,    83,    38,    39,    40,    41,    42,   166,
-     246,    84,   167,    86,   150,   151,   152,    76,    77,   229,
-     230,    90,    43,    44,    45,    46,    94,    47,   150,   151,
-     152,    76,    77,    93,    48,    49,    99,   237,   168,   161,
-     162,   112,   163,   164,   165,   114,   123,   115,   116,   117,
-     118,   100,   101,   188,   189,   179,   180,   160,   172,   176,
-     178,   181,   182,   190,   192,   194,   195,   196,   197,   198,
-     202,   201,   207,   208,   166,   209,   210,   167,   184,   221,
-     222,   224,   211,   183,   226,   227,   242,   231,   243,    27,
-     247,    24,   157,   223,   245,   219,   135,   203,   213,   212,
-     140,   106,   220,   218
+      34,    52,    90,    36,   142,    92,    62,   176,    26,    73,
+      17,     1,     1,     2,     2,     3,     3,     3,    75,     1,
+      25,     2,   184,     3,   156,   157,    80,    71,   215,     3,
+     236,   122,   123,    23,     4,     4,    85,   126,    87,    21,
+     241,   192,     4,    29,    75,   216,    65,   200,    20,    90,
+      81,    82,    50,    99,    33,    18,    96,    30,    31,   174,
+     201,    76,   106,   127,   128,   185,   129,   130,   131,   132,
+     125,   133,    28,   139,   121,    35,   176,     5,     5,    74,
+     239,   240,    64,    87,     6,     6,     6,    76,   143,    29,
+     229,    66,     6,    44,    45,    46,    47,    72,     6,    77,
+      78,   144,   145,    30,    31,   134,   108,    37,    95,   205,
+      67,   233,   140,    77,    78,    77,    78,    77,    78,    63,
+      96,    96,   115,   234,   116,   117,   118,   119,   103,   104,
+     105,   206,   207,    69,   194,    44,    45,    46,    47,  -112,
+      37,    83,    38,    39,    40,    41,    42,   162,   163,    84,
+     164,   165,   166,    85,   147,   148,   149,    87,    92,   237,
+      43,    44,    45,    46,    47,    91,   109,    94,    92,   100,
+     147,   148,   149,    49,    50,    38,    39,    40,    41,    42,
+     247,   113,   167,   124,   150,   168,    77,    78,   156,   157,
+     230,   231,   161,    43,    44,    45,    46,    47,   177,    48,
+     150,   235,   207,   242,   123,   173,    49,    50,   238,   245,
+     123,    95,   169,   151,   152,   153,    77,    78,   162,   163,
+     179,   164,   165,   166,   101,   102,   189,   190,   182,   151,
+     152,   153,    77,    78,   180,   181,   183,   195,   191,   193,
+     196,   198,   197,   199,   203,   208,   202,   209,   210,   185,
+     211,   212,   222,   167,   223,   184,   168,   225,   227,    27,
+     228,   232,    24,   243,   244,   158,   248,   224,   204,   246,
+     220,   136,   214,   213,   141,   107,     0,     0,   219,     0,
+       0,     0,     0,     0,   221
 };
 
 #define yypact_value_is_default(yystate) \
@@ -892,67 +901,68 @@ static const yytype_int16 yytable[] =
 #define yytable_value_is_error(yytable_value) \
   YYID (0)
 
-static const yytype_uint8 yycheck[] =
+static const yytype_int16 yycheck[] =
 {
-      17,    22,    65,    20,   108,    68,    23,   123,     0,     4,
-       8,     3,     3,     5,     5,     7,     7,     3,     7,     5,
-      70,     7,    27,    11,    12,    48,    47,     7,    34,    43,
-      59,    24,     6,    83,    26,    26,     9,    10,   221,    74,
-      26,   145,    27,    57,    58,    51,     6,   163,   231,   112,
-      95,     8,    73,    98,    49,    72,    79,    80,    81,   122,
-     164,    82,    76,    36,    37,    70,    39,    40,    41,    42,
-      70,    44,    32,    90,    67,    74,   192,    69,    69,    77,
-      47,    48,    70,    75,    75,    70,    75,   108,    43,    75,
-     206,    71,    72,    73,    60,    75,    81,    82,    16,    17,
-      76,    76,    57,    58,    77,    81,    82,    76,    70,   172,
-      68,   215,    81,    82,    81,    82,    75,    83,    84,   136,
-     137,    71,    72,    73,    76,    77,    20,    21,    22,    18,
-      19,    76,    77,   154,    52,    53,    54,    55,    56,    17,
-      20,    21,    22,    75,    11,    12,    85,    14,    15,    16,
-      81,    82,    70,    71,    72,    73,    50,    75,   221,   222,
-      11,    12,    76,    77,    82,    83,    76,    77,   231,    75,
-      50,    76,    77,    85,    52,    53,    54,    55,    56,    46,
-     243,     9,    49,    70,    78,    79,    80,    81,    82,   210,
-     211,    51,    70,    71,    72,    73,    76,    75,    78,    79,
-      80,    81,    82,    45,    82,    83,    70,   224,    75,    11,
-      12,    77,    14,    15,    16,    28,    75,    30,    31,    32,
-      33,    76,    77,   136,   137,   128,   129,    76,    75,    38,
-      36,    36,    36,    76,    75,    13,    13,    77,    13,    13,
-      73,    17,    36,    36,    46,    36,    25,    49,    67,    75,
-      75,    23,    25,    24,    76,    76,    76,    75,    75,     7,
-      76,     5,   112,   196,   242,   192,    96,   171,   187,   186,
-     107,    83,   192,   189
+      17,    22,    66,    20,   109,    69,    23,   124,     0,     8,
+       4,     3,     3,     5,     5,     7,     7,     7,    27,     3,
+       6,     5,    24,     7,    11,    12,    60,    48,    34,     7,
+     222,    77,    78,     8,    26,    26,     9,    10,    70,    59,
+     232,   146,    26,    43,    27,    51,    32,   164,     6,   113,
+      84,    85,    84,    74,    70,    49,    73,    57,    58,   123,
+     165,    70,    83,    36,    37,    67,    39,    40,    41,    42,
+      96,    44,    75,    99,    91,    68,   193,    69,    69,    78,
+      47,    48,    77,    70,    76,    76,    76,    70,   109,    43,
+     207,    76,    76,    71,    72,    73,    74,    49,    76,    82,
+      83,    18,    19,    57,    58,    78,    16,    17,    77,   173,
+      70,   216,    77,    82,    83,    82,    83,    82,    83,    75,
+     137,   138,    28,    77,    30,    31,    32,    33,    80,    81,
+      82,    77,    78,    76,   155,    71,    72,    73,    74,    86,
+      17,    76,    52,    53,    54,    55,    56,    11,    12,    86,
+      14,    15,    16,     9,    20,    21,    22,    70,   222,   223,
+      70,    71,    72,    73,    74,    51,    76,    45,   232,    70,
+      20,    21,    22,    83,    84,    52,    53,    54,    55,    56,
+     244,    78,    46,    76,    50,    49,    82,    83,    11,    12,
+     211,   212,    77,    70,    71,    72,    73,    74,    38,    76,
+      50,    77,    78,    77,    78,    76,    83,    84,   225,    77,
+      78,    77,    76,    79,    80,    81,    82,    83,    11,    12,
+      36,    14,    15,    16,    77,    78,   137,   138,    36,    79,
+      80,    81,    82,    83,   129,   130,    36,    13,    77,    76,
+      13,    13,    78,    13,    73,    36,    17,    36,    36,    67,
+      25,    25,    76,    46,    76,    24,    49,    23,    77,     7,
+      77,    76,     5,    77,    76,   113,    77,   197,   172,   243,
+     193,    97,   188,   187,   108,    84,    -1,    -1,   190,    -1,
+      -1,    -1,    -1,    -1,   193
 };
 
 /* YYSTOS[STATE-NUM] -- The (internal number of the) accessing
    symbol of state STATE-NUM.  */
 static const yytype_uint8 yystos[] =
 {
-       0,     3,     5,     7,    26,    69,    75,    87,    88,    89,
-      90,    91,    94,   105,   107,   137,   142,     4,    49,    92,
-       6,    59,   108,     8,    89,   107,     0,    88,    74,    43,
-      57,    58,   106,    70,   129,    68,   129,    17,    52,    53,
-      54,    55,    56,    70,    71,    72,    73,    75,    82,    83,
-     119,   120,   121,   122,   123,   124,   126,   127,   128,   129,
-     141,   129,    74,    76,   107,    75,    70,    93,    75,   138,
-     120,   122,     8,    77,    27,    70,    81,    82,   125,    60,
-      83,    84,    75,    85,     9,   111,    70,    95,    96,   128,
-      51,   128,   139,    45,    76,   129,   130,   133,   120,    70,
-     121,   121,   122,   122,   122,   120,   127,    16,    75,   114,
-     115,   120,    77,    98,    28,    30,    31,    32,    33,    97,
-     129,    76,    77,    75,   125,    10,    36,    37,    39,    40,
-      41,    42,    44,    77,   110,   111,   134,   135,   125,    76,
-     115,   114,   120,    18,    19,   117,    20,    21,    22,    50,
-      78,    79,    80,   116,   118,    11,    12,    96,    99,   100,
-      76,    11,    12,    14,    15,    16,    46,    49,    75,   102,
-     103,   104,    75,   128,   140,   141,    38,   136,    36,   136,
-     136,    36,    36,    24,    67,   109,   112,   113,   133,   133,
-      76,   114,    75,   120,    13,    13,    77,    13,    13,   141,
-     114,    17,    73,   103,   128,    76,    77,    36,    36,    36,
-      25,    25,   113,   112,    34,    51,   131,   132,   131,   105,
-     140,    75,    75,   100,    23,   101,    76,    76,   141,   120,
-     120,    75,   114,    76,    76,   139,   128,   129,    47,    48,
-     139,    76,    76,    75,    76,   101,   128,    76
+       0,     3,     5,     7,    26,    69,    76,    88,    89,    90,
+      91,    92,    95,   106,   108,   138,   143,     4,    49,    93,
+       6,    59,   109,     8,    90,   108,     0,    89,    75,    43,
+      57,    58,   107,    70,   130,    68,   130,    17,    52,    53,
+      54,    55,    56,    70,    71,    72,    73,    74,    76,    83,
+      84,   120,   121,   122,   123,   124,   125,   127,   128,   129,
+     130,   142,   130,    75,    77,   108,    76,    70,    94,    76,
+     139,   121,   123,     8,    78,    27,    70,    82,    83,   126,
+      60,    84,    85,    76,    86,     9,   112,    70,    96,    97,
+     129,    51,   129,   140,    45,    77,   130,   131,   134,   121,
+      70,   122,   122,   123,   123,   123,   121,   128,    16,    76,
+     115,   116,   121,    78,    99,    28,    30,    31,    32,    33,
+      98,   130,    77,    78,    76,   126,    10,    36,    37,    39,
+      40,    41,    42,    44,    78,   111,   112,   135,   136,   126,
+      77,   116,   115,   121,    18,    19,   118,    20,    21,    22,
+      50,    79,    80,    81,   117,   119,    11,    12,    97,   100,
+     101,    77,    11,    12,    14,    15,    16,    46,    49,    76,
+     103,   104,   105,    76,   129,   141,   142,    38,   137,    36,
+     137,   137,    36,    36,    24,    67,   110,   113,   114,   134,
+     134,    77,   115,    76,   121,    13,    13,    78,    13,    13,
+     142,   115,    17,    73,   104,   129,    77,    78,    36,    36,
+      36,    25,    25,   114,   113,    34,    51,   132,   133,   132,
+     106,   141,    76,    76,   101,    23,   102,    77,    77,   142,
+     121,   121,    76,   115,    77,    77,   140,   129,   130,    47,
+      48,   140,    77,    77,    76,    77,   102,   129,    77
 };
 
 #define yyerrok		(yyerrstatus = 0)
@@ -2710,6 +2720,13 @@ yyreduce:
 		}
     break;
 
+  case 143:
+
+/* Line 1806 of yacc.c  */
+#line 485 "src/libchisql/sql.y"
+    { (yyval.lval) = litParam(++__stmt->nparams); }
+    break;
+
 
 
 /* Line 1806 of yacc.c  */
@@ -2967,6 +2984,9 @@ int chisql_stmt_print(chisql_statement_t *stmt)
     case STMT_DELETE:
         Delete_print(stmt->stmt.delete);
         break;
+    case STMT_UPDATE:
+        Update_print(stmt->stmt.update);
+        break;
     }
 
     return 0;
@@ -2985,24 +3005,91 @@ char *__sql_semicolon(const char *sql)
   return t;
 }
 
+static int __sql_parse(const char *sql)
+{
+  int rc;
+
+  YY_BUFFER_STATE my_string_buffer = yy_scan_string (sql);
+  rc = yyparse();
+  yy_delete_buffer (my_string_buffer);
+
+  return rc;
+}
+
 int chisql_parser(const char *sql, chisql_statement_t **stmt)
 {
   int rc;
   
+  int limit, offset, has_limit, nsplit, is_update, i;
+  char **split, *usql;
+  StrList_t *ucols;
+  Insert_t *first = NULL, *last = NULL;
+  
+  pthread_mutex_lock(&__sql_mutex);
   __stmt = malloc(sizeof(chisql_statement_t));
+  __stmt->nparams = 0;
   char *tsql = __sql_semicolon(sql);
+  char *psql = strdup(tsql);
+
+  has_limit = SRA_stripLimit(psql, &limit, &offset);
+  is_update = has_limit < 0 ? -1 : Update_rewrite(psql, &usql, &ucols);
+  nsplit = is_update != 0 ? 0 : Insert_split(psql, &split);
     
-  YY_BUFFER_STATE my_string_buffer = yy_scan_string (tsql);
-  rc = yyparse();
-  yy_delete_buffer (my_string_buffer);
+  if (is_update < 0 || nsplit < 0)
+    rc = 1;
+  else if (is_update) {
+    /* Parsed as a SELECT of the new values (see Update_rewrite) */
+    Update_t *update;
+    rc = __sql_parse(usql);
+    update = Update_make(rc == 0 && __stmt->type == STMT_SELECT ? __stmt->stmt.select : NULL, ucols);
+    if (update == NULL)
+      rc = 1;
+    else {
+      __stmt->stmt.update = update;
+      __stmt->type = STMT_UPDATE;
+    }
+    free(usql);
+  }
+  else if (nsplit == 0)
+    rc = __sql_parse(psql);
+  else {
+    /* One tuple at a time. Parameters keep being numbered across tuples. */
+    for (i = 0, rc = 0; i < nsplit; i++) {
+      if (rc == 0 && (rc = __sql_parse(split[i])) == 0) {
+        if (__stmt->type != STMT_INSERT || __stmt->stmt.insert == NULL)
+          rc = 1;
+        else if (last == NULL)
+          first = last = __stmt->stmt.insert;
+        else
+          last = last->next = __stmt->stmt.insert;
+      }
+      free(split[i]);
+    }
+    free(split);
+
+    if (rc == 0)
+      __stmt->stmt.insert = first;
+    else if (first != NULL)
+      Insert_free(first);
+  }
+  free(psql);
+
+  if (rc == 0 && has_limit > 0) {
+    if (__stmt->type == STMT_SELECT && __stmt->stmt.select->t == SRA_PROJECT)
+      SRA_applyLimit(__stmt->stmt.select, limit, offset);
+    else
+      rc = 1;
+  }
   
   if (rc == 0) {
     __stmt->text = tsql; /* strdup(sql); */
     *stmt = __stmt;
+    pthread_mutex_unlock(&__sql_mutex);
     return CHIDB_OK;
   } else {
     fprintf(stderr,"invalid sql: \"%s\"\n", tsql);
     free(__stmt);
+    pthread_mutex_unlock(&__sql_mutex);
     return CHIDB_EINVALIDSQL;
   }
 
@@ -107,7 +107,8 @@
      IDENTIFIER = 325,
      STRING_LITERAL = 326,
      DOUBLE_LITERAL = 327,
-     INT_LITERAL = 328
+     INT_LITERAL = 328,
+     PARAM = 329
    };
 #endif
 /* Tokens.  */
@@ -182,6 +183,7 @@
 #define STRING_LITERAL 326
 #define DOUBLE_LITERAL 327
 #define INT_LITERAL 328
+#define PARAM 329
 
 
 
@@ -1,3 +1,6 @@
+#include <ctype.h>
+#include <limits.h>
+#include <strings.h>
 #include <chisql/chisql.h>
 
 
@@ -17,6 +20,7 @@ SRA_t *SRAProject(SRA_t *sra, Expression_t *expr)
     new_sra->t = SRA_PROJECT;
     new_sra->project.sra = sra;
     new_sra->project.expr_list = expr;
+    new_sra->project.limit = -1;
     return new_sra;
 }
 
@@ -122,7 +126,8 @@ void SRA_print(SRA_t *sra)
         SRA_print(sra->project.sra);
         if (sra->project.distinct ||
                 sra->project.group_by ||
-                sra->project.order_by)
+                sra->project.order_by ||
+                sra->project.limit >= 0)
         {
             printf(",\n");
             indent_print("Options: ");
@@ -139,8 +144,10 @@ void SRA_print(SRA_t *sra)
                 printf("Order by ");
                 Expression_print(sra->project.order_by);
                 printf(sra->project.asc_desc == ORDER_BY_ASC ? " a" : " de");
-                printf("scending");
+                printf("scending ");
             }
+            if (sra->project.limit >= 0)
+                printf("Limit %d Offset %d", sra->project.limit, sra->project.offset);
         }
         downInd();
         indent_print(")");
@@ -327,6 +334,95 @@ SRA_t *SRA_makeDistinct(SRA_t *sra)
     return sra;
 }
 
+SRA_t *SRA_applyLimit(SRA_t *sra, int limit, int offset)
+{
+    if (sra->t != SRA_PROJECT)
+    {
+        fprintf(stderr, "Error: limit only applies to Project\n");
+    }
+    else
+    {
+        sra->project.limit = limit;
+        sra->project.offset = offset;
+    }
+    return sra;
+}
+
+static int SRA_readCount(char **p, int *n)
+{
+    long v;
+
+    while (isspace((unsigned char) **p))
+        (*p)++;
+    if (!isdigit((unsigned char) **p))
+        return 0;
+    v = strtol(*p, p, 10);
+    if (v > INT_MAX)
+        return 0;
+    while (isspace((unsigned char) **p))
+        (*p)++;
+    *n = (int) v;
+    return 1;
+}
+
+int SRA_isWord(const char *sql, const char *p, const char *word)
+{
+    int len = strlen(word);
+
+    if (strncasecmp(p, word, len) != 0)
+        return 0;
+    if (p > sql && (isalnum((unsigned char) p[-1]) || p[-1] == '_'))
+        return 0;
+    return !isalnum((unsigned char) p[len]) && p[len] != '_';
+}
+
+/* Takes "LIMIT n [OFFSET m]" off the end of a statement
+ *
+ * The grammar does not have LIMIT, so the clause is cut off the text
+ * (which ends with a semicolon again) and applied once the rest of the
+ * statement is parsed. Returns 1 if there was a clause, 0 if there was
+ * none (limit is then -1), and -1 if it is not well formed.
+ */
+int SRA_stripLimit(char *sql, int *limit, int *offset)
+{
+    char *p, *clause = NULL, quote = 0;
+
+    *limit = -1;
+    *offset = 0;
+
+    for (p = sql; *p; p++)
+    {
+        if (quote)
+            quote = (*p == quote) ? 0 : quote;
+        else if (*p == '"' || *p == '\'')
+            quote = *p;
+        else if (SRA_isWord(sql, p, "LIMIT"))
+            clause = p;
+    }
+    if (clause == NULL)
+        return 0;
+
+    p = clause + 5;
+    if (!SRA_readCount(&p, limit))
+        return -1;
+    if (SRA_isWord(sql, p, "OFFSET"))
+    {
+        p += 6;
+        if (!SRA_readCount(&p, offset))
+            return -1;
+    }
+    if (*p == ';')
+        p++;
+    while (isspace((unsigned char) *p))
+        p++;
+    if (*p != '\0')
+        return -1;
+
+    clause[0] = ';';
+    clause[1] = '\0';
+    return 1;
+}
+
 JoinCondition_t *On(Condition_t *cond)
 {
     JoinCondition_t *jc = (JoinCondition_t *)calloc(1, sizeof(JoinCondition_t));
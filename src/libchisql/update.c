@@ -0,0 +1,220 @@
+#include <ctype.h>
+#include <chisql/chisql.h>
+
+
+/* Frees a list of column names, and the names */
+static void Update_freeNames(StrList_t *names)
+{
+    for (StrList_t *name = names; name; name = name->next)
+        free(name->str);
+    StrList_free(names);
+}
+
+/* Reads an identifier at *p into a new string, and moves *p past it.
+ * Returns NULL if there is none. */
+static char *Update_readName(const char **p)
+{
+    const char *start;
+
+    while (isspace((unsigned char) **p))
+        (*p)++;
+    for (start = *p; isalnum((unsigned char) **p) || **p == '_'; (*p)++);
+
+    return *p > start ? strndup(start, *p - start) : NULL;
+}
+
+/* Skips to the end of the value of a SET assignment: the comma before
+ * the next one, WHERE, the semicolon, or the end of the string. Commas
+ * and words inside quotes or parentheses do not count. */
+static const char *Update_valueEnd(const char *sql, const char *p)
+{
+    char quote = 0;
+    int depth = 0;
+
+    for (; *p; p++)
+    {
+        if (quote)
+            quote = (*p == quote) ? 0 : quote;
+        else if (*p == '"' || *p == '\'')
+            quote = *p;
+        else if (*p == '(')
+            depth++;
+        else if (*p == ')')
+            depth--;
+        else if (depth == 0 && (*p == ',' || *p == ';' || SRA_isWord(sql, p, "WHERE")))
+            break;
+    }
+    return p;
+}
+
+/* Rewrites an UPDATE as a SELECT
+ *
+ * UPDATE t SET a = x, b = y [WHERE c] becomes SELECT x, y FROM t
+ * [WHERE c], which the grammar can parse, and the names of the columns
+ * that are SET (a and b) are returned in *col_names. The new values and
+ * the condition are then taken from the parsed SELECT (see Update_make).
+ * Parameters keep their numbers, since the values come before the
+ * condition in both. EXPLAIN UPDATE becomes EXPLAIN SELECT. *select has to be freed, as does *col_names.
+ *
+ * Returns 1 if sql is an UPDATE, 0 if it is not (nothing is set then),
+ * or -1 if it is not well formed.
+ */
+int Update_rewrite(const char *sql, char **select, StrList_t **col_names)
+{
+    const char *p = sql, *value, *end;
+    char *table, *col, *buf;
+    StrList_t *cols = NULL;
+    size_t len, size;
+    bool explain = false, well_formed = false;
+
+    while (isspace((unsigned char) *p))
+        p++;
+    if (SRA_isWord(sql, p, "EXPLAIN"))
+    {
+        explain = true;
+        for (p += 7; isspace((unsigned char) *p); p++);
+    }
+    if (!SRA_isWord(sql, p, "UPDATE"))
+        return 0;
+    p += 6;
+
+    if ((table = Update_readName(&p)) == NULL)
+        return -1;
+    while (isspace((unsigned char) *p))
+        p++;
+    if (!SRA_isWord(sql, p, "SET"))
+    {
+        free(table);
+        return -1;
+    }
+    p += 3;
+
+    size = strlen(sql) + strlen(table) + 16;
+    buf = malloc(size);
+    len = snprintf(buf, size, "%sSELECT", explain ? "EXPLAIN " : "");
+
+    for (int n = 0; (col = Update_readName(&p)) != NULL; n++)
+    {
+        cols = StrList_append(cols, StrList_make(col));
+        while (isspace((unsigned char) *p))
+            p++;
+        if (*p != '=')
+            break;
+
+        for (value = p + 1; isspace((unsigned char) *value); value++);
+        p = Update_valueEnd(sql, value);
+        for (end = p; end > value && isspace((unsigned char) end[-1]); end--);
+        if (end == value)
+            break;
+        len += snprintf(buf + len, size - len, "%s %.*s", n > 0 ? "," : "", (int) (end - value), value);
+
+        if (*p != ',')
+        {
+            well_formed = true;
+            break;
+        }
+        p++;
+    }
+
+    if (!well_formed)
+    {
+        free(table);
+        free(buf);
+        Update_freeNames(cols);
+        return -1;
+    }
+
+    snprintf(buf + len, size - len, " FROM %s %s", table, p);
+    free(table);
+
+    *select = buf;
+    *col_names = cols;
+    return 1;
+}
+
+/* Makes an UPDATE out of the SELECT that Update_rewrite turned it into
+ *
+ * The new values and the condition are taken out of the SELECT, which
+ * is then freed. Returns NULL if select is NULL (it did not parse) or
+ * not the one expected. col_names is freed then, but the SELECT is not.
+ */
+Update_t *Update_make(SRA_t *select, StrList_t *col_names)
+{
+    SRA_t *table, *cond = NULL;
+    Expression_t *value;
+    StrList_t *col;
+    Update_t *update;
+
+    if (select == NULL || select->t != SRA_PROJECT || select->project.order_by || select->project.group_by
+            || select->project.distinct)
+    {
+        Update_freeNames(col_names);
+        return NULL;
+    }
+    table = select->project.sra;
+    if (table->t == SRA_SELECT)
+    {
+        cond = table;
+        table = cond->select.sra;
+    }
+
+    /* one value for each column */
+    for (value = select->project.expr_list, col = col_names; value && col; value = value->next, col = col->next);
+    if (table->t != SRA_TABLE || value || col)
+    {
+        Update_freeNames(col_names);
+        return NULL;
+    }
+
+    update = (Update_t *)calloc(1, sizeof(Update_t));
+    update->table_name = strdup(table->table.ref->table_name);
+    update->col_names = col_names;
+    update->values = select->project.expr_list;
+    update->where = cond ? cond->select.cond : NULL;
+
+    TableReference_free(table->table.ref);
+    free(table);
+    free(cond);
+    free(select);
+
+    return update;
+}
+
+void Update_print(Update_t *update)
+{
+    StrList_t *col = update->col_names;
+
+    printf("Update %s set", update->table_name);
+    for (Expression_t *value = update->values; value; value = value->next, col = col->next)
+    {
+        printf(" %s = ", col->str);
+        Expression_print(value);
+    }
+    if (update->where)
+    {
+        printf(" where ");
+        Condition_print(update->where);
+    }
+    puts("");
+}
+
+void Update_free(Update_t *update)
+{
+    Expression_t *value, *next;
+
+    if (!update)
+    {
+        fprintf(stderr, "Warning: Update_free called on null pointer\n");
+        return;
+    }
+    free(update->table_name);
+    Update_freeNames(update->col_names);
+    for (value = update->values; value; value = next)
+    {
+        next = value->next;
+        Expression_free(value);
+    }
+    if (update->where)
+        Condition_free(update->where);
+    free(update);
+}
@@ -1,5 +1,7 @@
 #include <unistd.h>
+#include <stdlib.h>
 #include <string.h>
+#include <strings.h>
 #include <chidb/dbm-file.h>
 #include "shell.h"
 #include "commands.h"
@@ -8,6 +10,16 @@
 
 
 #define COL_SEPARATOR "|"
+#define MAX_CURSOR_PAGES 64 /* Cursors EXPLAIN ANALYZE adds up pages for */
+#define OUTPUT_BATCH_ROWS 256       /* Rows a query's output fetches at a time */
+#define OUTPUT_FLUSH_SIZE (1 << 16) /* Bytes of output written at a time */
+
+/* Type of each value in binary mode. An integer is followed by its 8
+ * bytes, and a text by its length (4 bytes) and its characters, all
+ * least significant byte first. */
+#define BINARY_NULL    (0)
+#define BINARY_INTEGER (1)
+#define BINARY_TEXT    (2)
 
 struct handler_entry handlers[] =
 {
@@ -15,10 +27,33 @@ struct handler_entry handlers[] =
     HANDLER_ENTRY (parse,     ".parse \"SQL\"       Show parse tree for statement SQL"),
     HANDLER_ENTRY (opt,       ".opt \"SQL\"       Show parse tree and optimized parse tree for statement SQL"),
     HANDLER_ENTRY (dbmrun,    ".dbmrun DBMFILE    Run DBM program in DBMFILE"),
+    HANDLER_ENTRY (load,      ".load TABLE FILE   Load rows (values delimited by |) from FILE into the empty\n"
+                              "                   table TABLE. An optional third argument sets the\n"
+                              "                   percentage (1-100) of each page to fill"),
+    HANDLER_ENTRY (import,    ".import FILE TABLE Insert the rows of the CSV file FILE (or TSV, if its name\n"
+                              "                   ends in .tsv) into TABLE"),
+    HANDLER_ENTRY (export,    ".export \"SQL\" FILE Write the result rows of statement SQL to the CSV file\n"
+                              "                   FILE (or TSV, if its name ends in .tsv)"),
+    HANDLER_ENTRY (read,      ".read FILE         Run the SQL statements in FILE (separated by semicolons),\n"
+                              "                   writing in one transaction"),
+    HANDLER_ENTRY (analyze,   ".analyze           Collect table and index statistics for the query planner\n"
+                              "                   (same as the ANALYZE statement)"),
+    HANDLER_ENTRY (vacuum,    ".vacuum            Rebuild the database file, with every table and index in\n"
+                              "                   key order (same as the VACUUM statement)"),
+    HANDLER_ENTRY (stats,     ".stats [reset]     Show I/O, B-Tree and cursor counters for the database.\n"
+                              "                   With reset, start them over from zero afterwards"),
+    HANDLER_ENTRY (latency,   ".latency [reset]   Show how long statements took to prepare, step and finalize\n"
+                              "                   (in microseconds). With reset, start over afterwards"),
+    HANDLER_ENTRY (memory,    ".memory [LIMIT]    Show the memory the database uses, in bytes. With LIMIT, first\n"
+                              "                   limit it to LIMIT bytes (0 for no limit)"),
     HANDLER_ENTRY (headers,   ".headers on|off    Switch display of headers on or off in query results"),
     HANDLER_ENTRY (mode,      ".mode MODE         Switch display mode. MODE is one of:\n"
     		                  "                     column  Left-aligned columns\n"
-    		                  "                     list    Values delimited by | (default)"),
+    		                  "                     list    Values delimited by | (default)\n"
+    		                  "                     csv     Comma-separated values\n"
+    		                  "                     binary  Each value as a type byte (0 NULL, 1 integer,\n"
+    		                  "                             2 text) followed by an 8-byte integer, or a\n"
+    		                  "                             4-byte length and the text (little-endian)"),
     HANDLER_ENTRY (explain,   ".explain on|off    Turn output mode suitable for EXPLAIN on or off."),
     HANDLER_ENTRY (help,      ".help              Show this message"),
     HANDLER_ENTRY (exit,      ".exit              Exit shell."),
@@ -86,10 +121,281 @@ int chidb_shell_handle_cmd(chidb_shell_ctx_t *ctx, const char *cmd)
     return 0;
 }
 
+/* Print the pages read through each cursor, after the listing of an
+ * EXPLAIN ANALYZE statement (pages[c] is -1 if no instruction used
+ * cursor c) */
+static void print_cursor_pages(const int64_t *pages, int ncursors)
+{
+    for(int c = 0; c < ncursors; c++)
+        if(pages[c] >= 0)
+            printf("Cursor %i: %lli pages\n", c, (long long) pages[c]);
+}
+
+/* Output of a query, kept in one buffer and written to f in large
+ * writes (see out_end_row), instead of a few bytes per value */
+typedef struct shell_output
+{
+    FILE *f;
+    shell_mode_t mode;
+    char sep;           /* Separator of MODE_CSV */
+    char *buf;
+    size_t len;
+    size_t size;
+    bool failed;        /* The buffer could not grow, so output was lost */
+} shell_output_t;
+
+static void out_init(shell_output_t *out, FILE *f, shell_mode_t mode, char sep)
+{
+    out->f = f;
+    out->mode = mode;
+    out->sep = sep;
+    out->buf = NULL;
+    out->len = out->size = 0;
+    out->failed = false;
+}
+
+/* Room for n more bytes at the end of the buffer, or NULL */
+static char *out_reserve(shell_output_t *out, size_t n)
+{
+    if(out->len + n > out->size)
+    {
+        size_t size = out->size < OUTPUT_FLUSH_SIZE ? 2 * OUTPUT_FLUSH_SIZE : out->size;
+        char *buf;
+
+        while(size < out->len + n)
+            size *= 2;
+        if((buf = realloc(out->buf, size)) == NULL)
+        {
+            out->failed = true;
+            return NULL;
+        }
+        out->buf = buf;
+        out->size = size;
+    }
+
+    return out->buf + out->len;
+}
+
+static void out_bytes(shell_output_t *out, const void *bytes, size_t n)
+{
+    char *p = out_reserve(out, n);
+
+    if(p != NULL)
+    {
+        memcpy(p, bytes, n);
+        out->len += n;
+    }
+}
+
+static void out_char(shell_output_t *out, char c)
+{
+    out_bytes(out, &c, 1);
+}
+
+/* Writes n bytes of v, least significant first */
+static void out_le(shell_output_t *out, uint64_t v, int n)
+{
+    for(int i = 0; i < n; i++)
+        out_char(out, (char) (v >> (8 * i)));
+}
+
+static void out_flush(shell_output_t *out)
+{
+    if(out->len > 0)
+        fwrite(out->buf, 1, out->len, out->f);
+    out->len = 0;
+}
+
+static void out_free(shell_output_t *out)
+{
+    out_flush(out);
+    free(out->buf);
+}
+
+/* A text value of a CSV file, quoted if it would not be read back as the
+ * same value otherwise */
+static void out_csv_text(shell_output_t *out, const char *text, uint32_t len)
+{
+    if(len > 0 && strcspn(text, "\"\r\n") == len && memchr(text, out->sep, len) == NULL)
+    {
+        out_bytes(out, text, len);
+        return;
+    }
+
+    out_char(out, '"');
+    for(uint32_t i = 0; i < len; i++)
+    {
+        if(text[i] == '"')
+            out_char(out, '"');
+        out_char(out, text[i]);
+    }
+    out_char(out, '"');
+}
+
+/* What goes before the value of column col */
+static void out_separator(shell_output_t *out, int col)
+{
+    if(col == 0)
+        return;
+
+    switch(out->mode)
+    {
+    case MODE_LIST:
+        out_bytes(out, COL_SEPARATOR, strlen(COL_SEPARATOR));
+        break;
+    case MODE_COLUMN:
+        out_char(out, ' ');
+        break;
+    case MODE_CSV:
+        out_char(out, out->sep);
+        break;
+    case MODE_BINARY:
+        break;
+    }
+}
+
+static void out_int(shell_output_t *out, int col, int64_t v)
+{
+    char *p;
+
+    out_separator(out, col);
+    if(out->mode == MODE_BINARY)
+    {
+        out_char(out, BINARY_INTEGER);
+        out_le(out, (uint64_t) v, 8);
+    }
+    else if((p = out_reserve(out, 32)) != NULL)
+        out->len += sprintf(p, out->mode == MODE_COLUMN ? "%10lli" : "%lli", (long long) v);
+}
+
+static void out_text(shell_output_t *out, int col, const char *text, uint32_t len)
+{
+    char *p;
+
+    out_separator(out, col);
+    switch(out->mode)
+    {
+    case MODE_LIST:
+        out_bytes(out, text, len);
+        break;
+    case MODE_COLUMN:
+        if((p = out_reserve(out, 11)) != NULL)
+            out->len += sprintf(p, "%-10.10s", text);
+        break;
+    case MODE_CSV:
+        out_csv_text(out, text, len);
+        break;
+    case MODE_BINARY:
+        out_char(out, BINARY_TEXT);
+        out_le(out, len, 4);
+        out_bytes(out, text, len);
+        break;
+    }
+}
+
+static void out_null(shell_output_t *out, int col)
+{
+    out_separator(out, col);
+    if(out->mode == MODE_COLUMN)
+        out_bytes(out, "          ", 10);
+    else if(out->mode == MODE_BINARY)
+        out_char(out, BINARY_NULL);
+}
+
+/* Ends a row, and writes the buffer out once there is enough in it */
+static void out_end_row(shell_output_t *out)
+{
+    if(out->mode != MODE_BINARY)
+        out_char(out, '\n');
+    if(out->len >= OUTPUT_FLUSH_SIZE)
+        out_flush(out);
+}
+
+/* The column names, and a line under them in MODE_COLUMN. Binary output
+ * has no header. */
+static void out_header(shell_output_t *out, chidb_stmt *stmt)
+{
+    int numcol = chidb_column_count(stmt);
+
+    if(out->mode == MODE_BINARY)
+        return;
+
+    for(int i = 0; i < numcol; i++)
+    {
+        const char *name = chidb_column_name(stmt, i);
+        out_text(out, i, name, strlen(name));
+    }
+    out_end_row(out);
+
+    if(out->mode == MODE_COLUMN)
+    {
+        for(int i = 0; i < numcol; i++)
+        {
+            out_separator(out, i);
+            out_bytes(out, "----------", 10);
+        }
+        out_end_row(out);
+    }
+}
+
+/* Writes the rows of a batch */
+static void out_batch(shell_output_t *out, chidb_batch *batch)
+{
+    for(int r = 0; r < batch->nrows; r++)
+    {
+        for(int c = 0; c < batch->ncols; c++)
+        {
+            chidb_batch_column *col = &batch->cols[c];
+
+            if(CHIDB_BATCH_IS_SET(col->nulls, r))
+                out_null(out, c);
+            else if(CHIDB_BATCH_IS_SET(col->texts, r))
+                out_text(out, c, batch->text + col->offsets[r], col->lengths[r]);
+            else
+                out_int(out, c, col->ints[r]);
+        }
+        out_end_row(out);
+    }
+}
+
+/* Writes the current row of a statement */
+static int out_row(shell_output_t *out, chidb_stmt *stmt)
+{
+    int numcol = chidb_column_count(stmt);
+
+    for(int i = 0; i < numcol; i++)
+    {
+        int coltype = chidb_column_type(stmt, i);
+
+        if(coltype == SQL_NOTVALID || (coltype >= SQL_TEXT && (coltype - SQL_TEXT) % 2 != 0))
+        {
+            out_flush(out);
+            printf("ERROR: Column %i returned an invalid type.\n", i);
+            return CHIDB_EMISMATCH;
+        }
+        else if(coltype == SQL_NULL)
+            out_null(out, i);
+        else if(coltype >= SQL_TEXT)
+        {
+            const char *text = chidb_column_text(stmt, i);
+            out_text(out, i, text, strlen(text));
+        }
+        else
+            out_int(out, i, chidb_column_int64(stmt, i));
+    }
+    out_end_row(out);
+
+    return CHIDB_OK;
+}
+
 int chidb_shell_handle_sql(chidb_shell_ctx_t *ctx, const char *sql)
 {
     int rc;
     chidb_stmt *stmt;
+    chidb_batch *batch = NULL;
+    shell_output_t out;
+    int64_t cursor_pages[MAX_CURSOR_PAGES];
+    int ncursors = 0;
 
     rc = chidb_prepare(ctx->db, sql, &stmt);
 
@@ -97,90 +403,49 @@ int chidb_shell_handle_sql(chidb_shell_ctx_t *ctx, const char *sql)
     {
         int numcol = chidb_column_count(stmt);
 
+        /* EXPLAIN ANALYZE has a "pages" and a "cursor" column */
+        bool analyze = numcol == 10 && !strcmp(chidb_column_name(stmt, 8), "pages")
+                       && !strcmp(chidb_column_name(stmt, 9), "cursor");
+
+        out_init(&out, stdout, ctx->mode, ',');
         if(ctx->header)
-        {
-            for(int i = 0; i < numcol; i ++)
-            {
-                if(ctx->mode == MODE_LIST)
-                {
-                    printf(i==0?"":COL_SEPARATOR);
-                    printf("%s", chidb_column_name(stmt,i));
-                }
-                else if(ctx->mode == MODE_COLUMN)
-                {
-                    printf(i==0?"":" ");
-                    printf("%-10.10s", chidb_column_name(stmt,i));
-                }
-            }
-            printf("\n");
+            out_header(&out, stmt);
 
-            if(ctx->mode == MODE_COLUMN)
-            {
-                for(int i = 0; i < numcol; i ++)
-                {
-                   printf(i==0?"":" ");
-                   printf("----------");
-                }
-                printf("\n");
-            }
-        }
+        /* A batch of rows at a time */
+        while((rc = chidb_step_batch(stmt, OUTPUT_BATCH_ROWS, &batch)) == CHIDB_ROW)
+            out_batch(&out, batch);
+        chidb_batch_free(batch);
 
-        while((rc = chidb_step(stmt)) == CHIDB_ROW)
+        /* EXPLAIN listings cannot be read in batches (and nothing has been
+         * read yet), so they are read a row at a time */
+        if(rc == CHIDB_EMISUSE)
         {
-            for(int i = 0; i < numcol; i++)
+            while((rc = chidb_step(stmt)) == CHIDB_ROW)
             {
-                int coltype;
-
-                if(ctx->mode == MODE_LIST)
-                    printf(i==0?"":COL_SEPARATOR);
-                else if (ctx->mode == MODE_COLUMN)
-                    printf(i==0?"":" ");
-
-
-                coltype = chidb_column_type(stmt,i);
-
-                if(coltype == SQL_NOTVALID)
-                {
-                    printf("ERROR: Column %i return an invalid type.\n", coltype);
+                if(out_row(&out, stmt) != CHIDB_OK)
                     break;
-                }
-                else if(coltype == SQL_INTEGER_1BYTE || coltype == SQL_INTEGER_2BYTE || coltype == SQL_INTEGER_4BYTE)
-                {
-                    if(ctx->mode == MODE_LIST)
-                        printf("%i", chidb_column_int(stmt,i));
-                    else if (ctx->mode == MODE_COLUMN)
-                        printf("%10i", chidb_column_int(stmt,i));
-                }
-                else if(coltype == SQL_NULL)
-                {
-                    /* Print nothing */
-                    if (ctx->mode == MODE_COLUMN)
-                        printf("          ");
-                }
-                else
+
+                if(analyze && chidb_column_type(stmt, 9) != SQL_NULL)
                 {
-                    int len;
-                    if((coltype - 13) % 2 != 0)
-                    {
-                        printf("ERROR: Column %i returned an invalid type.\n", i);
-                        break;
-                    }
-                    const char *text = chidb_column_text(stmt,i);
-                    len = strlen(text);
-                    if(len != (coltype-13)/2)
+                    int c = chidb_column_int(stmt, 9);
+
+                    if(c >= 0 && c < MAX_CURSOR_PAGES)
                     {
-                        printf("ERROR: THe length (%i) of the text in column %i does not match its type (%i).\n", len, i, coltype);
-                        break;
+                        for(; ncursors <= c; ncursors++)
+                            cursor_pages[ncursors] = -1;
+                        if(cursor_pages[c] < 0)
+                            cursor_pages[c] = 0;
+                        cursor_pages[c] += chidb_column_int64(stmt, 8);
                     }
-
-                    if(ctx->mode == MODE_LIST)
-                        printf("%s", text);
-                    else if (ctx->mode == MODE_COLUMN)
-                        printf("%-10.10s", text);
                 }
             }
-            printf("\n");
         }
+        out_free(&out);
+        if(out.failed)
+            printf("ERROR: Could not allocate memory.\n");
+
+        if(rc == CHIDB_DONE)
+            print_cursor_pages(cursor_pages, ncursors);
 
         switch(rc)
         {
@@ -211,6 +476,64 @@ int chidb_shell_handle_sql(chidb_shell_ctx_t *ctx, const char *sql)
 }
 
 
+/* Output of the statements of a script (see chidb_shell_handle_script) */
+typedef struct shell_script
+{
+    chidb_shell_ctx_t *ctx;
+    shell_output_t out;
+} shell_script_t;
+
+/* Writes a row of a statement of a script (see chidb_exec) */
+static int script_row(void *arg, chidb_stmt *stmt, int row)
+{
+    shell_script_t *script = arg;
+
+    if(row == 0 && script->ctx->header)
+        out_header(&script->out, stmt);
+
+    return out_row(&script->out, stmt);
+}
+
+int chidb_shell_handle_script(chidb_shell_ctx_t *ctx, const char *sql)
+{
+    shell_script_t script;
+    int rc;
+
+    script.ctx = ctx;
+    out_init(&script.out, stdout, ctx->mode, ',');
+    rc = chidb_exec(ctx->db, sql, script_row, &script);
+    out_free(&script.out);
+    if(script.out.failed)
+        printf("ERROR: Could not allocate memory.\n");
+
+    switch(rc)
+    {
+    case CHIDB_OK:
+        break;
+    case CHIDB_EINVALIDSQL:
+        printf("SQL syntax error.\n");
+        break;
+    case CHIDB_ECONSTRAINT:
+        printf("ERROR: SQL statement failed because of a constraint violation.\n");
+        break;
+    case CHIDB_EMISMATCH:
+        printf("ERROR: Data type mismatch.\n");
+        break;
+    case CHIDB_ENOMEM:
+        printf("ERROR: Could not allocate memory.\n");
+        break;
+    case CHIDB_EIO:
+        printf("ERROR: An I/O error has occurred when accessing the file.\n");
+        break;
+    default:
+        printf("ERROR: SQL statement failed (error %i).\n", rc);
+        break;
+    }
+
+    return rc;
+}
+
+
 int chidb_shell_handle_cmd_open(chidb_shell_ctx_t *ctx, struct handler_entry *e, const char **tokens, int ntokens)
 {
     int rc;
@@ -376,6 +699,352 @@ int chidb_shell_handle_cmd_dbmrun(chidb_shell_ctx_t *ctx, struct handler_entry *
     return 0;
 }
 
+int chidb_shell_handle_cmd_load(chidb_shell_ctx_t *ctx, struct handler_entry *e, const char **tokens, int ntokens)
+{
+    int rc, fill = 0;
+
+    if(ntokens != 3 && ntokens != 4)
+    {
+        usage_error(e, "Invalid arguments");
+        return 1;
+    }
+
+    if(ntokens == 4)
+    {
+        fill = atoi(tokens[3]);
+        if(fill < 1 || fill > 100)
+        {
+            usage_error(e, "Invalid fill factor");
+            return 1;
+        }
+    }
+
+    if(!ctx->db)
+    {
+        fprintf(stderr, "ERROR: No database is open.\n");
+        return 1;
+    }
+
+    rc = chidb_load(ctx->db, tokens[1], tokens[2], fill);
+
+    switch(rc)
+    {
+    case CHIDB_OK:
+        break;
+    case CHIDB_EINVALIDSQL:
+        fprintf(stderr, "ERROR: No such table: %s\n", tokens[1]);
+        break;
+    case CHIDB_ECANTOPEN:
+        fprintf(stderr, "ERROR: Could not open file %s\n", tokens[2]);
+        break;
+    case CHIDB_EMISMATCH:
+        fprintf(stderr, "ERROR: Data type mismatch.\n");
+        break;
+    case CHIDB_ECONSTRAINT:
+        fprintf(stderr, "ERROR: Duplicate primary key.\n");
+        break;
+    case CHIDB_EMISUSE:
+        fprintf(stderr, "ERROR: Table %s is not empty.\n", tokens[1]);
+        break;
+    default:
+        fprintf(stderr, "ERROR: Could not load file %s (error %i).\n", tokens[2], rc);
+        break;
+    }
+
+    return rc;
+}
+
+/* Values in FILE.tsv are separated by tabs, and by commas in any other file */
+static char file_separator(const char *file)
+{
+    size_t len = strlen(file);
+
+    return (len >= 4 && !strcasecmp(file + len - 4, ".tsv")) ? '\t' : ',';
+}
+
+int chidb_shell_handle_cmd_import(chidb_shell_ctx_t *ctx, struct handler_entry *e, const char **tokens, int ntokens)
+{
+    int rc;
+
+    if(ntokens != 3)
+    {
+        usage_error(e, "Invalid arguments");
+        return 1;
+    }
+
+    if(!ctx->db)
+    {
+        fprintf(stderr, "ERROR: No database is open.\n");
+        return 1;
+    }
+
+    rc = chidb_import(ctx->db, tokens[2], tokens[1], file_separator(tokens[1]));
+
+    switch(rc)
+    {
+    case CHIDB_OK:
+        break;
+    case CHIDB_EINVALIDSQL:
+        fprintf(stderr, "ERROR: No such table: %s\n", tokens[2]);
+        break;
+    case CHIDB_ECANTOPEN:
+        fprintf(stderr, "ERROR: Could not open file %s\n", tokens[1]);
+        break;
+    case CHIDB_EMISMATCH:
+        fprintf(stderr, "ERROR: Data type mismatch.\n");
+        break;
+    case CHIDB_ECONSTRAINT:
+        fprintf(stderr, "ERROR: Duplicate key.\n");
+        break;
+    default:
+        fprintf(stderr, "ERROR: Could not import file %s (error %i).\n", tokens[1], rc);
+        break;
+    }
+
+    return rc;
+}
+
+int chidb_shell_handle_cmd_read(chidb_shell_ctx_t *ctx, struct handler_entry *e, const char **tokens, int ntokens)
+{
+    char *sql;
+    long size;
+    FILE *f;
+    int rc;
+
+    if(ntokens != 2)
+    {
+        usage_error(e, "Invalid arguments");
+        return 1;
+    }
+
+    if(!ctx->db)
+    {
+        fprintf(stderr, "ERROR: No database is open.\n");
+        return 1;
+    }
+
+    if(!(f = fopen(tokens[1], "r")))
+    {
+        fprintf(stderr, "ERROR: Could not open file %s\n", tokens[1]);
+        return CHIDB_ECANTOPEN;
+    }
+
+    if(fseek(f, 0, SEEK_END) != 0 || (size = ftell(f)) < 0 || fseek(f, 0, SEEK_SET) != 0
+            || !(sql = malloc(size + 1)))
+    {
+        fprintf(stderr, "ERROR: Could not read file %s\n", tokens[1]);
+        fclose(f);
+        return CHIDB_EIO;
+    }
+    sql[fread(sql, 1, size, f)] = '\0';
+    fclose(f);
+
+    rc = chidb_shell_handle_script(ctx, sql);
+    free(sql);
+
+    return rc;
+}
+
+int chidb_shell_handle_cmd_export(chidb_shell_ctx_t *ctx, struct handler_entry *e, const char **tokens, int ntokens)
+{
+    chidb_stmt *stmt;
+    chidb_batch *batch = NULL;
+    shell_output_t out;
+    int rc;
+    FILE *f;
+
+    if(ntokens != 3)
+    {
+        usage_error(e, "Invalid arguments");
+        return 1;
+    }
+
+    if(!ctx->db)
+    {
+        fprintf(stderr, "ERROR: No database is open.\n");
+        return 1;
+    }
+
+    if((rc = chidb_prepare(ctx->db, tokens[1], &stmt)) != CHIDB_OK)
+    {
+        fprintf(stderr, "ERROR: Could not prepare statement (error %i).\n", rc);
+        return rc;
+    }
+
+    if(!(f = fopen(tokens[2], "w")))
+    {
+        fprintf(stderr, "ERROR: Could not open file %s\n", tokens[2]);
+        chidb_finalize(stmt);
+        return CHIDB_ECANTOPEN;
+    }
+    out_init(&out, f, MODE_CSV, file_separator(tokens[2]));
+
+    while((rc = chidb_step_batch(stmt, OUTPUT_BATCH_ROWS, &batch)) == CHIDB_ROW)
+        out_batch(&out, batch);
+    out_free(&out);
+    if(out.failed && rc == CHIDB_DONE)
+        rc = CHIDB_ENOMEM;
+
+    chidb_batch_free(batch);
+    chidb_finalize(stmt);
+
+    if(fclose(f) != 0 && rc == CHIDB_DONE)
+        rc = CHIDB_EIO;
+    if(rc != CHIDB_DONE)
+    {
+        fprintf(stderr, "ERROR: Could not export to file %s (error %i).\n", tokens[2], rc);
+        return rc;
+    }
+
+    return CHIDB_OK;
+}
+
+int chidb_shell_handle_cmd_analyze(chidb_shell_ctx_t *ctx, struct handler_entry *e, const char **tokens, int ntokens)
+{
+    if(ntokens != 1)
+    {
+        usage_error(e, "Invalid arguments");
+        return 1;
+    }
+
+    if(!ctx->db)
+    {
+        fprintf(stderr, "ERROR: No database is open.\n");
+        return 1;
+    }
+
+    return chidb_shell_handle_sql(ctx, "ANALYZE;");
+}
+
+int chidb_shell_handle_cmd_vacuum(chidb_shell_ctx_t *ctx, struct handler_entry *e, const char **tokens, int ntokens)
+{
+    if(ntokens != 1)
+    {
+        usage_error(e, "Invalid arguments");
+        return 1;
+    }
+
+    if(!ctx->db)
+    {
+        fprintf(stderr, "ERROR: No database is open.\n");
+        return 1;
+    }
+
+    return chidb_shell_handle_sql(ctx, "VACUUM;");
+}
+
+int chidb_shell_handle_cmd_stats(chidb_shell_ctx_t *ctx, struct handler_entry *e, const char **tokens, int ntokens)
+{
+    chidb_counters_t c;
+
+    if(ntokens > 2 || (ntokens == 2 && strcmp(tokens[1], "reset") != 0))
+    {
+        usage_error(e, "Invalid arguments");
+        return 1;
+    }
+
+    if(!ctx->db)
+    {
+        fprintf(stderr, "ERROR: No database is open.\n");
+        return 1;
+    }
+
+    chidb_stats(ctx->db, &c, ntokens == 2);
+
+    printf("Page reads:        %llu\n", (unsigned long long) c.page_reads);
+    printf("Page writes:       %llu\n", (unsigned long long) c.page_writes);
+    printf("Cache hits:        %llu\n", (unsigned long long) c.cache_hits);
+    printf("Cache misses:      %llu\n", (unsigned long long) c.cache_misses);
+    printf("Bytes read:        %llu\n", (unsigned long long) c.bytes_read);
+    printf("Bytes written:     %llu\n", (unsigned long long) c.bytes_written);
+    printf("Node splits:       %llu\n", (unsigned long long) c.splits);
+    printf("Pages allocated:   %llu\n", (unsigned long long) c.pages_allocated);
+    printf("Cursor seeks:      %llu\n", (unsigned long long) c.cursor_seeks);
+    printf("Cursor steps:      %llu\n", (unsigned long long) c.cursor_steps);
+    printf("Records packed:    %llu\n", (unsigned long long) c.records_packed);
+    printf("Records unpacked:  %llu\n", (unsigned long long) c.records_unpacked);
+
+    return CHIDB_OK;
+}
+
+int chidb_shell_handle_cmd_latency(chidb_shell_ctx_t *ctx, struct handler_entry *e, const char **tokens, int ntokens)
+{
+    static const char *kinds[] = {"SELECT", "INSERT", "CREATE", "Other"};
+    static const char *phases[] = {"prepare", "first row", "next row", "finalize"};
+    chidb_latency_t l[CHIDB_LATENCY_KINDS][CHIDB_LATENCY_PHASES];
+
+    if(ntokens > 2 || (ntokens == 2 && strcmp(tokens[1], "reset") != 0))
+    {
+        usage_error(e, "Invalid arguments");
+        return 1;
+    }
+
+    if(!ctx->db)
+    {
+        fprintf(stderr, "ERROR: No database is open.\n");
+        return 1;
+    }
+
+    chidb_latency_snapshot(ctx->db, l, ntokens == 2);
+
+    printf("%-8s %-10s %10s %10s %10s %10s %10s %10s\n",
+           "Kind", "Call", "Count", "Mean", "p50", "p90", "p99", "Max");
+    for(int k = 0; k < CHIDB_LATENCY_KINDS; k++)
+        for(int p = 0; p < CHIDB_LATENCY_PHASES; p++)
+        {
+            chidb_latency_t *h = &l[k][p];
+
+            if(h->count == 0)
+                continue;
+            printf("%-8s %-10s %10llu %10.1f %10.1f %10.1f %10.1f %10.1f\n",
+                   kinds[k], phases[p], (unsigned long long) h->count,
+                   h->total_ns / 1000.0 / h->count,
+                   chidb_latency_percentile(h, 50) / 1000.0,
+                   chidb_latency_percentile(h, 90) / 1000.0,
+                   chidb_latency_percentile(h, 99) / 1000.0,
+                   h->max_ns / 1000.0);
+        }
+
+    return CHIDB_OK;
+}
+
+int chidb_shell_handle_cmd_memory(chidb_shell_ctx_t *ctx, struct handler_entry *e, const char **tokens, int ntokens)
+{
+    chidb_memory_status_t m;
+    char *end;
+    unsigned long long limit = 0;
+
+    if(ntokens > 2 || (ntokens == 2 && ((limit = strtoull(tokens[1], &end, 10)), *end != '\0' || tokens[1][0] == '-')))
+    {
+        usage_error(e, "Invalid arguments");
+        return 1;
+    }
+
+    if(!ctx->db)
+    {
+        fprintf(stderr, "ERROR: No database is open.\n");
+        return 1;
+    }
+
+    if(ntokens == 2 && chidb_set_memory_limit(ctx->db, limit) != CHIDB_OK)
+    {
+        fprintf(stderr, "ERROR: The buffer pool is in use.\n");
+        return 1;
+    }
+
+    chidb_memory_status(ctx->db, &m, 0);
+
+    printf("Limit:             %llu\n", (unsigned long long) m.limit);
+    printf("Used:              %llu\n", (unsigned long long) m.used);
+    printf("Peak:              %llu\n", (unsigned long long) m.peak);
+    printf("Page cache:        %llu\n", (unsigned long long) m.page_cache);
+    printf("Sorters:           %llu\n", (unsigned long long) m.sorters);
+    printf("Hash tables:       %llu\n", (unsigned long long) m.hash_tables);
+    printf("Results:           %llu\n", (unsigned long long) m.results);
+
+    return CHIDB_OK;
+}
+
 int chidb_shell_handle_cmd_headers(chidb_shell_ctx_t *ctx, struct handler_entry *e, const char **tokens, int ntokens)
 {
     if(ntokens != 2)
@@ -409,6 +1078,10 @@ int chidb_shell_handle_cmd_mode(chidb_shell_ctx_t *ctx, struct handler_entry *e,
         ctx->mode = MODE_LIST;
     else if(strcmp(tokens[1],"column")==0)
         ctx->mode = MODE_COLUMN;
+    else if(strcmp(tokens[1],"csv")==0)
+        ctx->mode = MODE_CSV;
+    else if(strcmp(tokens[1],"binary")==0)
+        ctx->mode = MODE_BINARY;
     else
     {
     	usage_error(e, "Invalid argument");
@@ -23,7 +23,7 @@ int main(int argc, char *argv[]) {
     int opt;
     int rc;
     int verbosity = 0;
-    char *command = "select sno from student;";
+    char *command = NULL;
     chidb_shell_ctx_t shell_ctx;
 
     chidb_shell_init_ctx(&shell_ctx);
@@ -64,6 +64,36 @@ int main(int argc, char *argv[]) {
             break;
     }
 
+    if (optind < argc)
+    {
+        rc = chidb_shell_open_db(&shell_ctx, argv[optind]);
+        if(rc)
+        {
+            fprintf(stderr, "ERROR: Could not open file %s or file is not well formed.\n", argv[optind]);
+            exit(1);
+        }
+    }
+
+    /* If a command was specified as an argument, we just run that (all
+     * of its statements, if it is SQL). Otherwise, we start the shell. */
+    if (command != NULL)
+    {
+        if (command[0] == '.')
+            rc = chidb_shell_handle_cmd(&shell_ctx, command);
+        else if (!shell_ctx.db)
+        {
+            fprintf(stderr, "ERROR: No database is open.\n");
+            rc = 1;
+        }
+        else
+            rc = chidb_shell_handle_script(&shell_ctx, command);
+
+        if (shell_ctx.db)
+            chidb_close(shell_ctx.db);
+        free(command);
+        return rc == 0 ? 0 : 1;
+    }
+
     char cmdstring[MAX_CMD];
     int n;
     while (1) {
@@ -85,23 +115,6 @@ int main(int argc, char *argv[]) {
 
     }
 
-//    optind= 0;
-//    char *file = "demo.db";
-//    if (optind < argc)
-//    {
-//        rc = chidb_shell_open_db(&shell_ctx, file /*argv[optind]*/);
-//        if(rc)
-//        {
-//            fprintf(stderr, "ERROR: Could not open file %s or file is not well formed.\n", argv[optind]);
-//            exit(1);
-//        }
-//    }
-
-    /* If a command was specified as an argument, we just run that.
-     * Otherwise, we start the shell. */
-
-
-
     return 0;
 }
 
@@ -7,6 +7,8 @@ typedef enum shell_mode
 {
     MODE_LIST          = 0,
     MODE_COLUMN        = 1,
+    MODE_CSV           = 2,
+    MODE_BINARY        = 3,
 } shell_mode_t;
 
 typedef struct chidb_shell_ctx
@@ -27,6 +27,9 @@ TCase* make_btree_5_tc(void);
 TCase* make_btree_6_tc(void);
 TCase* make_btree_7_tc(void);
 TCase* make_btree_8_tc(void);
+TCase* make_btree_9_tc(void);
+TCase* make_btree_10_tc(void);
+TCase* make_btree_11_tc(void);
 
 
 
@@ -53,3 +56,7 @@ void test_bigfile(chidb *db);
 int chidb_Btree_findInIndex(BTree *bt, npage_t nroot, chidb_key_t ikey, chidb_key_t *pkey);
 
 void test_index_bigfile(chidb *db, npage_t index_nroot);
+
+int check_subtree(BTree *bt, npage_t npage, int depth, int *leaf_depth, chidb_key_t *last, bool *first);
+
+void check_tree(BTree *bt, npage_t nroot, int nentries);
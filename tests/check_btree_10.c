@@ -0,0 +1,299 @@
+#include <stdlib.h>
+#include <sys/stat.h>
+#include <check.h>
+#include "check_btree.h"
+
+/* Checks the entries of the bigfile that are still in the table (those
+ * for which deleted[i] is false), and that the others are gone */
+static void test_bigfile_deleted(chidb *db, bool *deleted)
+{
+    int rc;
+
+    for(int i=0; i<bigfile_nvalues; i++)
+    {
+        uint8_t *buf;
+        uint32_t size;
+        uint8_t data[192];
+        int datalen = ((bigfile_pkeys[i] % 3) + 1) * 64;
+
+        rc = chidb_Btree_find(db->bt, 1, bigfile_pkeys[i], &buf, &size);
+        if(deleted[i])
+        {
+            ck_assert(rc == CHIDB_ENOTFOUND);
+            continue;
+        }
+
+        for(int j=0; j<48; j++)
+            put4byte(data + (4*j), bigfile_ikeys[i]);
+
+        ck_assert(rc == CHIDB_OK);
+        ck_assert(size == datalen);
+        ck_assert(!memcmp(buf, data, datalen));
+        free(buf);
+    }
+}
+
+/* Inserts large entries (with overflow pages) with keys 1 to n */
+static void insert_large(chidb *db, int n, uint32_t size)
+{
+    uint8_t *buf = malloc(size);
+
+    for(int i=1; i<=n; i++)
+    {
+        memset(buf, i, size);
+        ck_assert(chidb_Btree_insertInTable(db->bt, 1, i, buf, size) == CHIDB_OK);
+    }
+
+    free(buf);
+}
+
+static chidb *open_tmp(char **fname)
+{
+    chidb *db = malloc(sizeof(chidb));
+
+    *fname = create_tmp_file();
+    ck_assert(chidb_Btree_open(*fname, db, &db->bt) == CHIDB_OK);
+
+    return db;
+}
+
+
+START_TEST (test_10_1)
+{
+    char *fname;
+    chidb *db = open_tmp(&fname);
+    bool deleted[2048] = {false};
+    BTreeNode *btn;
+    int n = bigfile_nvalues;
+
+    for(int i=0; i<bigfile_nvalues; i++)
+        insert_bigfile(db, i);
+
+    /* Every other entry */
+    for(int i=0; i<bigfile_nvalues; i+=2)
+    {
+        ck_assert(chidb_Btree_delete(db->bt, 1, bigfile_pkeys[i]) == CHIDB_OK);
+        deleted[i] = true;
+        n--;
+    }
+    check_tree(db->bt, 1, n);
+    test_bigfile_deleted(db, deleted);
+
+    /* Entries that are not there */
+    ck_assert(chidb_Btree_delete(db->bt, 1, bigfile_pkeys[0]) == CHIDB_ENOTFOUND);
+
+    /* All the others, which leaves an empty root */
+    for(int i=1; i<bigfile_nvalues; i+=2)
+        ck_assert(chidb_Btree_delete(db->bt, 1, bigfile_pkeys[i]) == CHIDB_OK);
+
+    ck_assert(chidb_Btree_getNodeByPage(db->bt, 1, &btn) == CHIDB_OK);
+    ck_assert_int_eq(btn->type, PGTYPE_TABLE_LEAF);
+    ck_assert_int_eq(btn->n_cells, 0);
+    chidb_Btree_freeMemNode(db->bt, btn);
+
+    chidb_Btree_close(db->bt);
+    delete_tmp_file(fname);
+    free(db);
+}
+END_TEST
+
+
+START_TEST (test_10_2)
+{
+    char *fname;
+    chidb *db = open_tmp(&fname);
+    npage_t npage;
+    int n = bigfile_nvalues;
+
+    chidb_Btree_newNode(db->bt, &npage, PGTYPE_INDEX_LEAF);
+    for(int i=0; i<bigfile_nvalues; i++)
+        chidb_Btree_insertInIndex(db->bt, npage, bigfile_ikeys[i], bigfile_pkeys[i]);
+
+    /* Entries in internal nodes are deleted too, in a B-Tree proper */
+    for(int i=0; i<bigfile_nvalues; i++)
+    {
+        if(i % 3 == 0)
+            continue;
+        ck_assert(chidb_Btree_delete(db->bt, npage, bigfile_ikeys[i]) == CHIDB_OK);
+        n--;
+    }
+    check_tree(db->bt, npage, n);
+
+    for(int i=0; i<bigfile_nvalues; i++)
+    {
+        if(i % 3 != 0)
+            ck_assert(chidb_Btree_delete(db->bt, npage, bigfile_ikeys[i]) == CHIDB_ENOTFOUND);
+    }
+
+    for(int i=0; i<bigfile_nvalues; i+=3)
+        ck_assert(chidb_Btree_delete(db->bt, npage, bigfile_ikeys[i]) == CHIDB_OK);
+
+    chidb_Btree_close(db->bt);
+    delete_tmp_file(fname);
+    free(db);
+}
+END_TEST
+
+
+START_TEST (test_10_3)
+{
+    char *fname;
+    chidb *db = open_tmp(&fname);
+    npage_t npages;
+    uint32_t nfree;
+
+    for(int i=0; i<bigfile_nvalues; i++)
+        insert_bigfile(db, i);
+    npages = db->bt->pager->n_pages;
+
+    for(int i=0; i<bigfile_nvalues; i++)
+        ck_assert(chidb_Btree_delete(db->bt, 1, bigfile_pkeys[i]) == CHIDB_OK);
+
+    /* Only the root is left */
+    ck_assert(chidb_Btree_countFreePages(db->bt, &nfree) == CHIDB_OK);
+    ck_assert_int_eq(nfree, npages - 1);
+
+    /* The free pages are used before the file grows */
+    for(int i=0; i<bigfile_nvalues; i++)
+        insert_bigfile(db, i);
+    ck_assert_int_le(db->bt->pager->n_pages, npages);
+    check_tree(db->bt, 1, bigfile_nvalues);
+    test_bigfile(db);
+
+    chidb_Btree_close(db->bt);
+    delete_tmp_file(fname);
+    free(db);
+}
+END_TEST
+
+
+START_TEST (test_10_4)
+{
+    char *fname;
+    chidb *db = open_tmp(&fname);
+    npage_t npages;
+    uint32_t nfree;
+
+    /* The overflow pages of deleted entries are freed too */
+    insert_large(db, 40, 5000);
+    npages = db->bt->pager->n_pages;
+
+    for(int i=1; i<=40; i+=2)
+        ck_assert(chidb_Btree_delete(db->bt, 1, i) == CHIDB_OK);
+    check_tree(db->bt, 1, 20);
+
+    for(int i=2; i<=40; i+=2)
+        ck_assert(chidb_Btree_delete(db->bt, 1, i) == CHIDB_OK);
+    ck_assert(chidb_Btree_countFreePages(db->bt, &nfree) == CHIDB_OK);
+    ck_assert_int_eq(nfree, npages - 1);
+
+    insert_large(db, 40, 5000);
+    ck_assert_int_eq(db->bt->pager->n_pages, npages);
+
+    chidb_Btree_close(db->bt);
+    delete_tmp_file(fname);
+    free(db);
+}
+END_TEST
+
+
+START_TEST (test_10_5)
+{
+    char *fname;
+    chidb *db = open_tmp(&fname);
+    bool deleted[2048] = {false};
+    npage_t root = 1, npages;
+    uint32_t nfree, nremoved;
+    struct stat st;
+    int n = bigfile_nvalues;
+
+    for(int i=0; i<bigfile_nvalues; i++)
+        insert_bigfile(db, i);
+    npages = db->bt->pager->n_pages;
+
+    for(int i=0; i<bigfile_nvalues; i++)
+    {
+        if(i % 4 == 0)
+            continue;
+        ck_assert(chidb_Btree_delete(db->bt, 1, bigfile_pkeys[i]) == CHIDB_OK);
+        deleted[i] = true;
+        n--;
+    }
+
+    ck_assert(chidb_Btree_vacuum(db->bt, &root, 1, 0, &nremoved) == CHIDB_OK);
+    ck_assert_int_gt(nremoved, 0);
+    ck_assert_int_eq(db->bt->pager->n_pages, npages - nremoved);
+    ck_assert(chidb_Btree_countFreePages(db->bt, &nfree) == CHIDB_OK);
+    ck_assert_int_eq(nfree, 0);
+
+    ck_assert(stat(fname, &st) == 0);
+    ck_assert_int_eq(st.st_size, (off_t) db->bt->pager->n_pages * db->bt->pager->page_size);
+
+    check_tree(db->bt, 1, n);
+    test_bigfile_deleted(db, deleted);
+
+    /* The moved pages must also be there after reopening the file */
+    chidb_Btree_close(db->bt);
+    ck_assert(chidb_Btree_open(fname, db, &db->bt) == CHIDB_OK);
+    check_tree(db->bt, 1, n);
+    test_bigfile_deleted(db, deleted);
+
+    chidb_Btree_close(db->bt);
+    delete_tmp_file(fname);
+    free(db);
+}
+END_TEST
+
+
+START_TEST (test_10_6)
+{
+    char *fname;
+    chidb *db = open_tmp(&fname);
+    npage_t root = 1, npages;
+    uint32_t nfree, nremoved;
+    BTreeNode *btn;
+
+    insert_large(db, 40, 5000);
+    for(int i=1; i<=40; i+=2)
+        ck_assert(chidb_Btree_delete(db->bt, 1, i) == CHIDB_OK);
+    npages = db->bt->pager->n_pages;
+    ck_assert(chidb_Btree_countFreePages(db->bt, &nfree) == CHIDB_OK);
+    ck_assert_int_gt(nfree, 3);
+
+    /* Not while pages are in use */
+    ck_assert(chidb_Btree_getNodeByPage(db->bt, 1, &btn) == CHIDB_OK);
+    ck_assert(chidb_Btree_vacuum(db->bt, &root, 1, 0, &nremoved) == CHIDB_EMISUSE);
+    chidb_Btree_freeMemNode(db->bt, btn);
+
+    /* A few pages at a time */
+    ck_assert(chidb_Btree_vacuum(db->bt, &root, 1, 3, &nremoved) == CHIDB_OK);
+    ck_assert_int_eq(nremoved, 3);
+    ck_assert_int_eq(db->bt->pager->n_pages, npages - 3);
+    ck_assert(chidb_Btree_countFreePages(db->bt, &nfree) == CHIDB_OK);
+    ck_assert_int_gt(nfree, 0);
+    check_tree(db->bt, 1, 20);
+
+    ck_assert(chidb_Btree_vacuum(db->bt, &root, 1, 0, &nremoved) == CHIDB_OK);
+    ck_assert(chidb_Btree_countFreePages(db->bt, &nfree) == CHIDB_OK);
+    ck_assert_int_eq(nfree, 0);
+    check_tree(db->bt, 1, 20);
+
+    chidb_Btree_close(db->bt);
+    delete_tmp_file(fname);
+    free(db);
+}
+END_TEST
+
+
+TCase* make_btree_10_tc(void)
+{
+    TCase *tc = tcase_create ("Step 10: Deleting entries");
+    tcase_add_test (tc, test_10_1);
+    tcase_add_test (tc, test_10_2);
+    tcase_add_test (tc, test_10_3);
+    tcase_add_test (tc, test_10_4);
+    tcase_add_test (tc, test_10_5);
+    tcase_add_test (tc, test_10_6);
+
+    return tc;
+}
@@ -0,0 +1,364 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <check.h>
+#include "check_btree.h"
+
+#define NTEXTS (2000)
+
+/* Texts with long shared prefixes, like the values of a column of
+ * paths or qualified names */
+static uint32_t make_text(int i, uint8_t *buf)
+{
+    return sprintf((char *) buf, "/var/lib/chidb/customers/region-%02d/account-%06d", i % 7, i * 37);
+}
+
+/* Entry i of the test, in a scrambled order */
+static int scrambled(int i)
+{
+    return (int) (((long) i * 7919) % NTEXTS);
+}
+
+static chidb *open_tmp(char **fname)
+{
+    chidb *db = malloc(sizeof(chidb));
+
+    *fname = create_tmp_file();
+    ck_assert(chidb_Btree_open(*fname, db, &db->bt) == CHIDB_OK);
+
+    return db;
+}
+
+/* Walks a text index in order, checking that the entries are sorted and
+ * that every separator is after the entries to its left and not after the
+ * entries to its right. Returns the number of entries. */
+typedef struct
+{
+    uint8_t last[1024];
+    BTreeTextKey last_key;
+    bool first;
+    int leaf_depth;
+} TextWalk;
+
+static int check_text_subtree(BTree *bt, npage_t npage, int depth, TextWalk *w, BTreeCell *pending)
+{
+    BTreeNode *btn;
+    BTreeCell cell, sep;
+    int n = 0;
+
+    ck_assert(chidb_Btree_getNodeByPage(bt, npage, &btn) == CHIDB_OK);
+    btn_sanity_check(bt, btn, false);
+    ck_assert(PGTYPE_IS_TEXTINDEX(btn->type));
+
+    if (btn->type == PGTYPE_TEXTINDEX_LEAF)
+    {
+        if (w->leaf_depth < 0)
+            w->leaf_depth = depth;
+        ck_assert_int_eq(depth, w->leaf_depth);
+
+        for (ncell_t i = 0; i < btn->n_cells; i++)
+        {
+            chidb_Btree_getCell(btn, i, &cell);
+            ck_assert(cell.fields.textIndex.has_pk);
+            if (!w->first)
+                ck_assert_int_gt(chidb_Btree_compareText(&cell, &w->last_key), 0);
+
+            w->last_key.len = chidb_Btree_textLength(&cell);
+            ck_assert_int_le(w->last_key.len, sizeof(w->last));
+            chidb_Btree_textCopy(&cell, w->last);
+            w->last_key.text = w->last;
+            w->last_key.keyPk = cell.fields.textIndex.keyPk;
+            w->last_key.edge = TEXTKEY_ENTRY;
+            w->first = false;
+
+            // the separator to the left of this leaf is not after its entries
+            if (pending != NULL)
+            {
+                ck_assert_int_le(chidb_Btree_compareText(pending, &w->last_key), 0);
+                pending = NULL;
+            }
+            n++;
+        }
+    }
+    else
+    {
+        for (ncell_t i = 0; i < btn->n_cells; i++)
+        {
+            chidb_Btree_getCell(btn, i, &cell);
+            n += check_text_subtree(bt, cell.fields.textIndex.child_page, depth + 1, w, pending);
+            ck_assert(!w->first);
+            ck_assert_int_gt(chidb_Btree_compareText(&cell, &w->last_key), 0);
+            sep = cell;
+            pending = &sep;
+        }
+        n += check_text_subtree(bt, btn->right_page, depth + 1, w, pending);
+    }
+
+    chidb_Btree_freeMemNode(bt, btn);
+
+    return n;
+}
+
+static void check_text_tree(BTree *bt, npage_t nroot, int nentries)
+{
+    TextWalk w;
+
+    w.first = true;
+    w.leaf_depth = -1;
+    ck_assert_int_eq(check_text_subtree(bt, nroot, 0, &w, NULL), nentries);
+}
+
+/* Finds an entry by descending from the root */
+static bool find_text(BTree *bt, npage_t nroot, const uint8_t *text, uint32_t len, chidb_key_t keyPk)
+{
+    BTreeTextKey key = { text, len, keyPk, TEXTKEY_ENTRY };
+    BTreeNode *btn;
+    npage_t npage = nroot;
+    ncell_t i;
+
+    for (;;)
+    {
+        ck_assert(chidb_Btree_getNodeByPage(bt, npage, &btn) == CHIDB_OK);
+        if (btn->type == PGTYPE_TEXTINDEX_LEAF)
+            break;
+        chidb_Btree_searchText(btn, &key, &i);
+        npage = chidb_Btree_getChild(btn, i);
+        chidb_Btree_freeMemNode(bt, btn);
+    }
+
+    bool found = (chidb_Btree_searchText(btn, &key, &i) == CHIDB_TRUE);
+    chidb_Btree_freeMemNode(bt, btn);
+
+    return found;
+}
+
+static npage_t insert_texts(BTree *bt, int n)
+{
+    uint8_t buf[128];
+    npage_t nroot;
+
+    ck_assert(chidb_Btree_newNode(bt, &nroot, PGTYPE_TEXTINDEX_LEAF) == CHIDB_OK);
+    for (int i = 0; i < n; i++)
+    {
+        int k = scrambled(i);
+        uint32_t len = make_text(k, buf);
+
+        ck_assert(chidb_Btree_insertInTextIndex(bt, nroot, buf, len, k) == CHIDB_OK);
+    }
+
+    return nroot;
+}
+
+
+START_TEST (test_11_1)
+{
+    char *fname;
+    chidb *db = open_tmp(&fname);
+    uint8_t buf[128];
+    npage_t nroot = insert_texts(db->bt, NTEXTS);
+    BTreeNode *btn;
+
+    check_text_tree(db->bt, nroot, NTEXTS);
+
+    ck_assert(chidb_Btree_getNodeByPage(db->bt, nroot, &btn) == CHIDB_OK);
+    ck_assert_int_eq(btn->type, PGTYPE_TEXTINDEX_INTERNAL);
+    chidb_Btree_freeMemNode(db->bt, btn);
+
+    for (int i = 0; i < NTEXTS; i++)
+    {
+        uint32_t len = make_text(i, buf);
+
+        ck_assert(find_text(db->bt, nroot, buf, len, i));
+        ck_assert(!find_text(db->bt, nroot, buf, len, i + 1));
+        ck_assert(!find_text(db->bt, nroot, buf, len - 1, i));
+    }
+
+    /* The same entry twice is a duplicate, the same text in another row is not */
+    uint32_t len = make_text(42, buf);
+    ck_assert(chidb_Btree_insertInTextIndex(db->bt, nroot, buf, len, 42) == CHIDB_EDUPLICATE);
+    ck_assert(chidb_Btree_insertInTextIndex(db->bt, nroot, buf, len, NTEXTS + 42) == CHIDB_OK);
+    ck_assert(chidb_Btree_insertInTextIndex(db->bt, nroot, buf, len, -1) == CHIDB_OK);
+    check_text_tree(db->bt, nroot, NTEXTS + 2);
+    ck_assert(find_text(db->bt, nroot, buf, len, NTEXTS + 42));
+    ck_assert(find_text(db->bt, nroot, buf, len, -1));
+
+    chidb_Btree_close(db->bt);
+    delete_tmp_file(fname);
+    free(db);
+}
+END_TEST
+
+
+START_TEST (test_11_2)
+{
+    char *fname;
+    chidb *db = open_tmp(&fname);
+    uint8_t buf[128];
+    uint32_t total = 0;
+    npage_t npages = db->bt->pager->n_pages;
+
+    insert_texts(db->bt, NTEXTS);
+
+    /* The shared prefixes are not stored in every cell, so the index takes
+     * less space than its texts alone */
+    for (int i = 0; i < NTEXTS; i++)
+        total += make_text(i, buf);
+    ck_assert_int_lt((db->bt->pager->n_pages - npages) * db->bt->pager->page_size, total);
+
+    chidb_Btree_close(db->bt);
+    delete_tmp_file(fname);
+    free(db);
+}
+END_TEST
+
+
+START_TEST (test_11_3)
+{
+    char *fname;
+    chidb *db = open_tmp(&fname);
+    uint8_t buf[128];
+    npage_t nroot = insert_texts(db->bt, NTEXTS);
+    npage_t npages = db->bt->pager->n_pages;
+    uint32_t nfree;
+    BTreeNode *btn;
+
+    for (int i = 0; i < NTEXTS; i += 2)
+    {
+        uint32_t len = make_text(i, buf);
+        BTreeTextKey key = { buf, len, i, TEXTKEY_ENTRY };
+
+        ck_assert(chidb_Btree_deleteText(db->bt, nroot, &key) == CHIDB_OK);
+        ck_assert(chidb_Btree_deleteText(db->bt, nroot, &key) == CHIDB_ENOTFOUND);
+    }
+    check_text_tree(db->bt, nroot, NTEXTS / 2);
+
+    for (int i = 0; i < NTEXTS; i++)
+    {
+        uint32_t len = make_text(i, buf);
+
+        ck_assert(find_text(db->bt, nroot, buf, len, i) == (i % 2 == 1));
+    }
+
+    /* All the others, in no particular order, which leaves an empty root */
+    for (int i = 0; i < NTEXTS; i++)
+    {
+        int k = scrambled(i);
+        uint32_t len = make_text(k, buf);
+        BTreeTextKey key = { buf, len, k, TEXTKEY_ENTRY };
+
+        if (k % 2 == 1)
+            ck_assert(chidb_Btree_deleteText(db->bt, nroot, &key) == CHIDB_OK);
+    }
+
+    ck_assert(chidb_Btree_getNodeByPage(db->bt, nroot, &btn) == CHIDB_OK);
+    ck_assert_int_eq(btn->type, PGTYPE_TEXTINDEX_LEAF);
+    ck_assert_int_eq(btn->n_cells, 0);
+    chidb_Btree_freeMemNode(db->bt, btn);
+
+    /* Only the table and index roots are left */
+    ck_assert(chidb_Btree_countFreePages(db->bt, &nfree) == CHIDB_OK);
+    ck_assert_int_eq(nfree, npages - 2);
+
+    chidb_Btree_close(db->bt);
+    delete_tmp_file(fname);
+    free(db);
+}
+END_TEST
+
+
+START_TEST (test_11_4)
+{
+    char *fname, *fname2;
+    chidb *db = open_tmp(&fname);
+    chidb *db2 = open_tmp(&fname2);
+    uint8_t buf[128];
+    npage_t nroot = insert_texts(db->bt, NTEXTS), ncopy, root;
+    uint32_t nremoved;
+
+    /* A copy is packed in key order */
+    ck_assert(chidb_Btree_copy(db->bt, nroot, db2->bt, &ncopy) == CHIDB_OK);
+    check_text_tree(db2->bt, ncopy, NTEXTS);
+    ck_assert_int_lt(db2->bt->pager->n_pages, db->bt->pager->n_pages);
+    for (int i = 0; i < NTEXTS; i++)
+    {
+        uint32_t len = make_text(i, buf);
+
+        ck_assert(find_text(db2->bt, ncopy, buf, len, i));
+    }
+
+    /* Vacuuming moves the nodes of the index too (the texts of one region
+     * are next to each other, so deleting the others empties nodes) */
+    for (int i = 0; i < NTEXTS; i++)
+    {
+        uint32_t len = make_text(i, buf);
+        BTreeTextKey key = { buf, len, i, TEXTKEY_ENTRY };
+
+        if (i % 7 != 0)
+            ck_assert(chidb_Btree_deleteText(db->bt, nroot, &key) == CHIDB_OK);
+    }
+    npage_t roots[2] = {1, nroot};
+    ck_assert(chidb_Btree_vacuum(db->bt, roots, 2, 0, &nremoved) == CHIDB_OK);
+    ck_assert_int_gt(nremoved, 0);
+    root = roots[1];
+    check_text_tree(db->bt, root, (NTEXTS + 6) / 7);
+    for (int i = 0; i < NTEXTS; i += 7)
+    {
+        uint32_t len = make_text(i, buf);
+
+        ck_assert(find_text(db->bt, root, buf, len, i));
+    }
+
+    chidb_Btree_close(db->bt);
+    chidb_Btree_close(db2->bt);
+    delete_tmp_file(fname);
+    delete_tmp_file(fname2);
+    free(db);
+    free(db2);
+}
+END_TEST
+
+
+START_TEST (test_11_5)
+{
+    char *fname;
+    chidb *db = open_tmp(&fname);
+    uint32_t max = TEXTINDEX_MAXKEY(db->bt->pager->page_size);
+    uint8_t *buf = malloc(max + 1);
+    npage_t nroot;
+
+    ck_assert(chidb_Btree_newNode(db->bt, &nroot, PGTYPE_TEXTINDEX_LEAF) == CHIDB_OK);
+
+    /* Texts as long as allowed, which differ only at the end */
+    memset(buf, 'x', max + 1);
+    for (int i = 0; i < 200; i++)
+    {
+        buf[max - 1] = 'a' + (i % 26);
+        buf[max - 2] = 'a' + (i / 26);
+        ck_assert(chidb_Btree_insertInTextIndex(db->bt, nroot, buf, max, i) == CHIDB_OK);
+    }
+    check_text_tree(db->bt, nroot, 200);
+
+    ck_assert(chidb_Btree_insertInTextIndex(db->bt, nroot, buf, max + 1, 0) == CHIDB_EMISMATCH);
+
+    /* The empty text comes first */
+    ck_assert(chidb_Btree_insertInTextIndex(db->bt, nroot, buf, 0, 0) == CHIDB_OK);
+    check_text_tree(db->bt, nroot, 201);
+
+    free(buf);
+    chidb_Btree_close(db->bt);
+    delete_tmp_file(fname);
+    free(db);
+}
+END_TEST
+
+
+TCase* make_btree_11_tc(void)
+{
+    TCase *tc = tcase_create ("Step 11: Text indexes");
+    tcase_add_test (tc, test_11_1);
+    tcase_add_test (tc, test_11_2);
+    tcase_add_test (tc, test_11_3);
+    tcase_add_test (tc, test_11_4);
+    tcase_add_test (tc, test_11_5);
+
+    return tc;
+}
@@ -39,13 +39,13 @@ START_TEST (test_1b_2)
 
     if(strcmp((char *) rawpage, "SQLite format 3") || rawpage[18] != 1 || rawpage[19] != 1 ||
             rawpage[20] != 0 || rawpage[21] != 64 || rawpage[22] != 32 || rawpage[23] != 32 ||
-            get4byte(&rawpage[32]) != 0 || get4byte(&rawpage[36]) != 0 || get4byte(&rawpage[44]) != 1 ||
+            get4byte(&rawpage[32]) != 0 || get4byte(&rawpage[36]) != 0 || get4byte(&rawpage[44]) != FILEFORMAT_WIDE_KEYS ||
             get4byte(&rawpage[52]) != 0 || get4byte(&rawpage[56]) != 1 || get4byte(&rawpage[64]) != 0 ||
             get4byte(&rawpage[48]) != 20000)
         ck_abort_msg("File header is not well-formed.");
 
     if(rawpage[100] != PGTYPE_TABLE_LEAF || get2byte(&rawpage[101]) != 108 || get2byte(&rawpage[103]) != 0 ||
-            get2byte(&rawpage[105]) != 1024 || rawpage[107] != 0)
+            get2byte(&rawpage[105]) != 1024 || rawpage[107] != KEYSIZE_WIDE)
         ck_abort_msg("Page 1 header is not well-formed.");
 
     rc = chidb_Btree_close(db->bt);
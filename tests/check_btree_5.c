@@ -1,6 +1,7 @@
 #include <stdlib.h>
 #include <check.h>
 #include "check_btree.h"
+#include "libchidb/btree-cell.h"
 
 START_TEST (test_5_1)
 {
@@ -20,7 +21,7 @@ END_TEST
 START_TEST (test_5_2)
 {
     chidb *db;
-    uint16_t size;
+    uint32_t size;
     uint8_t *data;
     chidb_key_t nokeys[] = {0,4,6,8,9,11,18,27,36,40,100,650,1500,2500,3500,4500,5500};
     int rc;
@@ -40,11 +41,271 @@ START_TEST (test_5_2)
 END_TEST
 
 
+START_TEST (test_5_3)
+{
+    chidb *db;
+    BTreeNode *btn;
+    BTreeCell btc;
+    ncell_t ncell, expected;
+    int rc;
+
+    db = malloc(sizeof(chidb));
+    char *fname = create_copy(TESTFILE_STRINGS1, "btree-test-5-3.dat");
+    chidb_Btree_open(fname, db, &db->bt);
+    for(npage_t npage = 1; npage <= db->bt->pager->n_pages; npage++)
+    {
+        chidb_Btree_getNodeByPage(db->bt, npage, &btn);
+        for(chidb_key_t key = 0; key < 5600; key++)
+        {
+            /* Binary search must agree with a linear scan */
+            for(expected = 0; expected < btn->n_cells; expected++)
+            {
+                chidb_Btree_getCell(btn, expected, &btc);
+                if(btc.key >= key)
+                    break;
+            }
+
+            rc = chidb_Btree_searchNode(btn, key, &ncell);
+            ck_assert_int_eq(ncell, expected);
+            ck_assert(rc == ((expected < btn->n_cells && btc.key == key)? CHIDB_TRUE : CHIDB_FALSE));
+        }
+        chidb_Btree_freeMemNode(db->bt, btn);
+    }
+    chidb_Btree_close(db->bt);
+    delete_copy(fname);
+    free(db);
+}
+END_TEST
+
+
+START_TEST (test_5_4)
+{
+    chidb *db;
+    MemPage *page;
+    uint32_t size;
+    uint8_t *data;
+    int rc;
+
+    db = malloc(sizeof(chidb));
+    char *fname = create_copy(TESTFILE_STRINGS1, "btree-test-5-4.dat");
+    chidb_Btree_open(fname, db, &db->bt);
+    for(int i = 0; i<file1_nvalues; i++)
+    {
+        rc = chidb_Btree_findRef(db->bt, 1, file1_keys[i], &page, &data, &size);
+        ck_assert(rc == CHIDB_OK);
+        ck_assert(size == 128);
+        ck_assert(data >= page->data && data + size <= page->data + db->bt->pager->page_size);
+        ck_assert(!strcmp((char *) data, file1_values[i]));
+        rc = chidb_Btree_releaseRef(db->bt, page);
+        ck_assert(rc == CHIDB_OK);
+        ck_assert_int_eq(page->pin_count, 0);
+    }
+    rc = chidb_Btree_findRef(db->bt, 1, 4, &page, &data, &size);
+    ck_assert(rc == CHIDB_ENOTFOUND);
+    chidb_Btree_close(db->bt);
+    delete_copy(fname);
+    free(db);
+}
+END_TEST
+
+
+/* Entries found by chidb_Btree_findMany, in the order they were found */
+struct found_entries
+{
+    chidb_key_t keys[64];
+    char *values[64];
+    int n;
+};
+
+static int found_entry(void *ctx, chidb_key_t key, uint8_t *data, uint32_t size)
+{
+    struct found_entries *found = ctx;
+
+    found->keys[found->n] = key;
+    found->values[found->n++] = strndup((char *) data, size);
+    return CHIDB_OK;
+}
+
+START_TEST (test_5_5)
+{
+    chidb *db;
+    struct found_entries found = {{0}, {0}, 0};
+    chidb_key_t keys[64];
+    uint64_t reads;
+    int rc, n = 0;
+
+    db = malloc(sizeof(chidb));
+    char *fname = create_copy(TESTFILE_STRINGS1, "btree-test-5-5.dat");
+    chidb_Btree_open(fname, db, &db->bt);
+
+    /* Every key, from last to first, and a few that are not there */
+    for(int i = file1_nvalues - 1; i >= 0; i--)
+        keys[n++] = file1_keys[i];
+    keys[n++] = 4;
+    keys[n++] = 6000;
+    keys[n++] = 0;
+
+    reads = db->bt->pager->stats.reads;
+    rc = chidb_Btree_findMany(db->bt, 1, keys, n, found_entry, &found);
+    ck_assert(rc == CHIDB_OK);
+    ck_assert_int_eq(found.n, file1_nvalues);
+    for(int i = 0; i < found.n; i++)
+    {
+        ck_assert(i == 0 || found.keys[i - 1] < found.keys[i]);
+        for(int j = 0; j < file1_nvalues; j++)
+            if(file1_keys[j] == found.keys[i])
+                ck_assert(!strcmp(found.values[i], file1_values[j]));
+        free(found.values[i]);
+    }
+
+    /* Each page is read once, however many keys are in it */
+    ck_assert(db->bt->pager->stats.reads - reads <= db->bt->pager->n_pages);
+    for(npage_t npage = 1; npage <= db->bt->pager->n_pages; npage++)
+    {
+        MemPage *page;
+        ck_assert(chidb_Pager_readPage(db->bt->pager, npage, &page) == CHIDB_OK);
+        ck_assert_int_eq(page->pin_count, 1);
+        chidb_Pager_releaseMemPage(db->bt->pager, page);
+    }
+
+    chidb_Btree_close(db->bt);
+    delete_copy(fname);
+    free(db);
+}
+END_TEST
+
+
+/* The accessors specialized by page type must read the same fields
+ * as chidb_Btree_getCell, in nodes of each of the four types */
+START_TEST (test_5_6)
+{
+    chidb *db;
+    BTreeNode *btn;
+    BTreeCell btc, spec;
+    uint8_t *data;
+    uint32_t size, local;
+    npage_t npage;
+    int types = 0;
+
+    char *fname = create_tmp_file();
+    db = malloc(sizeof(chidb));
+    ck_assert(chidb_Btree_open(fname, db, &db->bt) == CHIDB_OK);
+
+    for(int i=0; i<bigfile_nvalues; i++)
+        insert_bigfile(db, i);
+    chidb_Btree_newNode(db->bt, &npage, PGTYPE_INDEX_LEAF);
+    for(int i=0; i<bigfile_nvalues; i++)
+        chidb_Btree_insertInIndex(db->bt, npage, bigfile_ikeys[i], bigfile_pkeys[i]);
+
+    for(npage = 1; npage <= db->bt->pager->n_pages; npage++)
+    {
+        if(chidb_Btree_getNodeByPage(db->bt, npage, &btn) != CHIDB_OK)
+            continue;
+
+        for(ncell_t i = 0; i < btn->n_cells; i++)
+        {
+            chidb_Btree_getCell(btn, i, &btc);
+            switch(btn->type)
+            {
+            case PGTYPE_TABLE_INTERNAL:
+                types |= 1;
+                ck_assert(chidb_Btree_tableInternalKey(btn, i) == btc.key);
+                ck_assert_int_eq(chidb_Btree_tableInternalChild(btn, i), btc.fields.tableInternal.child_page);
+                ck_assert_int_eq(chidb_Btree_tableInternalSearch(btn, btc.key), i);
+                chidb_Btree_tableInternalCell(btn, i, &spec);
+                ck_assert_int_eq(spec.fields.tableInternal.child_page, btc.fields.tableInternal.child_page);
+                break;
+            case PGTYPE_TABLE_LEAF:
+                types |= 2;
+                ck_assert(chidb_Btree_tableLeafKey(btn, i) == btc.key);
+                data = chidb_Btree_tableLeafPayload(btn, i, &size, &local);
+                ck_assert(data == btc.fields.tableLeaf.data);
+                ck_assert_int_eq(size, btc.fields.tableLeaf.data_size);
+                ck_assert_int_eq(local, btc.fields.tableLeaf.local_size);
+                ck_assert_int_eq(chidb_Btree_tableLeafSearch(btn, btc.key), i);
+                chidb_Btree_tableLeafCell(btn, i, &spec);
+                ck_assert_int_eq(spec.fields.tableLeaf.overflow, btc.fields.tableLeaf.overflow);
+                break;
+            case PGTYPE_INDEX_INTERNAL:
+                types |= 4;
+                ck_assert(chidb_Btree_indexInternalKey(btn, i) == btc.key);
+                ck_assert(chidb_Btree_indexInternalPk(btn, i) == btc.fields.indexInternal.keyPk);
+                ck_assert_int_eq(chidb_Btree_indexInternalChild(btn, i), btc.fields.indexInternal.child_page);
+                ck_assert_int_eq(chidb_Btree_indexInternalSearch(btn, btc.key), i);
+                break;
+            case PGTYPE_INDEX_LEAF:
+                types |= 8;
+                ck_assert(chidb_Btree_indexLeafKey(btn, i) == btc.key);
+                ck_assert(chidb_Btree_indexLeafPk(btn, i) == btc.fields.indexLeaf.keyPk);
+                ck_assert_int_eq(chidb_Btree_indexLeafSearch(btn, btc.key), i);
+                break;
+            }
+        }
+        chidb_Btree_freeMemNode(db->bt, btn);
+    }
+    ck_assert_int_eq(types, 15);
+
+    chidb_Btree_close(db->bt);
+    delete_tmp_file(fname);
+    free(db);
+}
+END_TEST
+
+
+/* Lookups go through decoded copies of the internal nodes they search
+ * often, which must not outlive changes to the nodes: through the B-Tree,
+ * or under it, when a transaction is rolled back */
+START_TEST (test_5_7)
+{
+    chidb *db;
+    uint8_t *data;
+    uint32_t size;
+    int half = bigfile_nvalues / 2;
+
+    char *fname = create_tmp_file();
+    db = malloc(sizeof(chidb));
+    ck_assert(chidb_Btree_open(fname, db, &db->bt) == CHIDB_OK);
+
+    for(int i=0; i<half; i++)
+        insert_bigfile(db, i);
+    for(int round = 0; round < 2; round++)
+        for(int i=0; i<half; i++)
+            ck_assert(chidb_Btree_find(db->bt, 1, bigfile_pkeys[i], &data, &size) == CHIDB_OK);
+    ck_assert_int_eq(db->bt->decoded[1 % BTREE_DECODED_SLOTS].npage, 1);
+
+    /* The root and the nodes below it split */
+    for(int i=half; i<bigfile_nvalues; i++)
+        insert_bigfile(db, i);
+    test_bigfile(db);
+
+    ck_assert(chidb_Pager_begin(db->bt->pager) == CHIDB_OK);
+    for(chidb_key_t key = 20000; key < 22000; key++)
+        ck_assert(chidb_Btree_insertInTable(db->bt, 1, key, (uint8_t *) "x", 2) == CHIDB_OK);
+    for(int round = 0; round < 2; round++)
+        for(chidb_key_t key = 20000; key < 22000; key += 7)
+            ck_assert(chidb_Btree_find(db->bt, 1, key, &data, &size) == CHIDB_OK);
+    ck_assert(chidb_Pager_rollback(db->bt->pager) == CHIDB_OK);
+
+    ck_assert(chidb_Btree_find(db->bt, 1, 21000, &data, &size) == CHIDB_ENOTFOUND);
+    test_bigfile(db);
+
+    chidb_Btree_close(db->bt);
+    delete_tmp_file(fname);
+    free(db);
+}
+END_TEST
+
+
 TCase* make_btree_5_tc(void)
 {
     TCase *tc = tcase_create ("Step 5: Finding a value in a B-Tree");
     tcase_add_test (tc, test_5_1);
     tcase_add_test (tc, test_5_2);
+    tcase_add_test (tc, test_5_3);
+    tcase_add_test (tc, test_5_4);
+    tcase_add_test (tc, test_5_5);
+    tcase_add_test (tc, test_5_6);
+    tcase_add_test (tc, test_5_7);
 
     return tc;
 }
@@ -69,6 +69,140 @@ START_TEST (test_7_3)
 }
 END_TEST
 
+/* Counts the leaves of a table B-Tree, and the most cells in one of them */
+static int count_leaves(BTree *bt, npage_t npage, int *max_ncells)
+{
+    BTreeNode *btn;
+    BTreeCell btc;
+    int n = 0;
+
+    ck_assert(chidb_Btree_getNodeByPage(bt, npage, &btn) == CHIDB_OK);
+
+    if(btn->type == PGTYPE_TABLE_LEAF)
+    {
+        if(btn->n_cells > *max_ncells)
+            *max_ncells = btn->n_cells;
+        n = 1;
+    }
+    else
+    {
+        for(int i=0; i<btn->n_cells; i++)
+        {
+            chidb_Btree_getCell(btn, i, &btc);
+            n += count_leaves(bt, btc.fields.tableInternal.child_page, max_ncells);
+        }
+        n += count_leaves(bt, btn->right_page, max_ncells);
+    }
+
+    chidb_Btree_freeMemNode(bt, btn);
+
+    return n;
+}
+
+static void insert_seq(chidb *db, chidb_key_t key)
+{
+    uint8_t buf[100];
+    uint8_t *data;
+    uint32_t size;
+
+    memset(buf, key & 0xFF, sizeof(buf));
+    ck_assert(chidb_Btree_insertInTable(db->bt, 1, key, buf, sizeof(buf)) == CHIDB_OK);
+    ck_assert(chidb_Btree_find(db->bt, 1, key, &data, &size) == CHIDB_OK);
+    ck_assert_int_eq(size, sizeof(buf));
+    ck_assert(memcmp(data, buf, size) == 0);
+    free(data);
+}
+
+START_TEST (test_7_4)
+{
+    chidb *db;
+    int rc, n = 2000, max_ncells = 0;
+
+    char *fname = create_tmp_file();
+    db = malloc(sizeof(chidb));
+    rc = chidb_Btree_open(fname, db, &db->bt);
+    ck_assert(rc == CHIDB_OK);
+
+    /* Entries added in key order fill every leaf but the last (the first
+     * one, which used to be the root, holds a little less) */
+    for(int i=1; i<=n; i++)
+        insert_seq(db, i*2);
+
+    int nleaves = count_leaves(db->bt, 1, &max_ncells);
+    ck_assert(max_ncells > 1);
+    ck_assert(nleaves <= (n + max_ncells - 1) / max_ncells + 1);
+
+    /* Entries in the middle still go where they belong, and appending
+     * afterwards still works */
+    for(int i=1; i<=n; i+=7)
+        insert_seq(db, i*2 - 1);
+    ck_assert(chidb_Btree_insertInTable(db->bt, 1, n*2, NULL, 0) == CHIDB_EDUPLICATE);
+    for(int i=n+1; i<=n+500; i++)
+        insert_seq(db, i*2);
+
+    chidb_Btree_close(db->bt);
+
+    /* Everything must also be there after reopening the file */
+    rc = chidb_Btree_open(fname, db, &db->bt);
+    ck_assert(rc == CHIDB_OK);
+    for(int i=1; i<=n+500; i++)
+    {
+        uint8_t *data;
+        uint32_t size;
+
+        ck_assert(chidb_Btree_find(db->bt, 1, i*2, &data, &size) == CHIDB_OK);
+        ck_assert_int_eq(data[0], (i*2) & 0xFF);
+        free(data);
+    }
+    chidb_Btree_close(db->bt);
+
+    delete_tmp_file(fname);
+    free(db);
+}
+END_TEST
+
+
+START_TEST (test_7_5)
+{
+    chidb *db;
+    int rc, n = 2000, max_ncells = 0;
+
+    char *fname = create_tmp_file();
+    db = malloc(sizeof(chidb));
+    rc = chidb_Btree_open(fname, db, &db->bt);
+    ck_assert(rc == CHIDB_OK);
+
+    /* Entries added in reverse key order fill every leaf but the first,
+     * since each split leaves the lower half with a single cell */
+    for(int i=n; i>=1; i--)
+        insert_seq(db, i*4);
+
+    int nleaves = count_leaves(db->bt, 1, &max_ncells);
+    ck_assert(max_ncells > 1);
+    ck_assert(nleaves <= (n + max_ncells - 1) / max_ncells + 2);
+
+    /* Entries in between land in full leaves, which make room by moving
+     * cells to a sibling once the splits have left some free space */
+    for(int i=1; i<=n; i++)
+        insert_seq(db, (i * 7919) % (n*2) * 2 + 1);
+    ck_assert(db->bt->stats.shifts > 0);
+    ck_assert(chidb_Btree_insertInTable(db->bt, 1, n*4, NULL, 0) == CHIDB_EDUPLICATE);
+
+    for(int i=1; i<=n; i++)
+    {
+        uint8_t *data;
+        uint32_t size;
+
+        ck_assert(chidb_Btree_find(db->bt, 1, i*4, &data, &size) == CHIDB_OK);
+        ck_assert_int_eq(data[0], (i*4) & 0xFF);
+        free(data);
+    }
+    chidb_Btree_close(db->bt);
+
+    delete_tmp_file(fname);
+    free(db);
+}
+END_TEST
 
 TCase* make_btree_7_tc(void)
 {
@@ -76,6 +210,8 @@ TCase* make_btree_7_tc(void)
     tcase_add_test (tc, test_7_1);
     tcase_add_test (tc, test_7_2);
     tcase_add_test (tc, test_7_3);
+    tcase_add_test (tc, test_7_4);
+    tcase_add_test (tc, test_7_5);
 
     return tc;
 }
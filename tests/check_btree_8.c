@@ -85,12 +85,141 @@ START_TEST (test_8_3)
 END_TEST
 
 
+START_TEST (test_8_4)
+{
+    chidb *db;
+    int rc;
+    npage_t npage;
+    int order[2048];
+
+    char *fname = create_tmp_file();
+    db = malloc(sizeof(chidb));
+    rc = chidb_Btree_open(fname, db, &db->bt);
+    ck_assert(rc == CHIDB_OK);
+
+    for(int i=0; i<bigfile_nvalues; i++)
+        insert_bigfile(db, i);
+
+    /* Insert the index entries in key order, so that each one goes after
+     * all the others */
+    for(int i=0; i<bigfile_nvalues; i++)
+    {
+        int j = i;
+        for(; j>0 && bigfile_ikeys[order[j-1]] > bigfile_ikeys[i]; j--)
+            order[j] = order[j-1];
+        order[j] = i;
+    }
+
+    chidb_Btree_newNode(db->bt, &npage, PGTYPE_INDEX_LEAF);
+    for(int i=0; i<bigfile_nvalues; i++)
+    {
+        rc = chidb_Btree_insertInIndex(db->bt, npage, bigfile_ikeys[order[i]], bigfile_pkeys[order[i]]);
+        ck_assert(rc == CHIDB_OK);
+    }
+
+    rc = chidb_Btree_insertInIndex(db->bt, npage, bigfile_ikeys[order[0]], bigfile_pkeys[order[0]]);
+    ck_assert(rc == CHIDB_EDUPLICATE);
+
+    test_index_bigfile(db, npage);
+
+    chidb_Btree_close(db->bt);
+    delete_tmp_file(fname);
+    free(db);
+}
+END_TEST
+
+
+START_TEST (test_8_5)
+{
+    chidb *db;
+    int rc;
+    npage_t npage;
+    uint8_t data[8];
+    uint8_t *buf;
+    uint32_t size;
+    chidb_key_t pkey;
+    chidb_key_t base = (chidb_key_t) 1 << 40;
+
+    /* New files get eight-byte keys */
+    char *fname = create_tmp_file();
+    db = malloc(sizeof(chidb));
+    rc = chidb_Btree_open(fname, db, &db->bt);
+    ck_assert(rc == CHIDB_OK);
+    ck_assert_int_eq(db->bt->key_size, KEYSIZE_WIDE);
+
+    chidb_Btree_newNode(db->bt, &npage, PGTYPE_INDEX_LEAF);
+    for(int i=0; i<bigfile_nvalues; i++)
+    {
+        put8byte(data, base + bigfile_pkeys[i]);
+        rc = chidb_Btree_insertInTable(db->bt, 1, base + bigfile_pkeys[i], data, sizeof(data));
+        ck_assert(rc == CHIDB_OK);
+        rc = chidb_Btree_insertInIndex(db->bt, npage, base + bigfile_ikeys[i], base + bigfile_pkeys[i]);
+        ck_assert(rc == CHIDB_OK);
+    }
+
+    /* The keys are still there after reopening the file */
+    chidb_Btree_close(db->bt);
+    rc = chidb_Btree_open(fname, db, &db->bt);
+    ck_assert(rc == CHIDB_OK);
+
+    check_tree(db->bt, 1, bigfile_nvalues);
+    check_tree(db->bt, npage, bigfile_nvalues);
+    for(int i=0; i<bigfile_nvalues; i++)
+    {
+        rc = chidb_Btree_find(db->bt, 1, base + bigfile_pkeys[i], &buf, &size);
+        ck_assert(rc == CHIDB_OK);
+        ck_assert_int_eq(size, sizeof(data));
+        ck_assert(get8byte(buf) == base + bigfile_pkeys[i]);
+        free(buf);
+
+        rc = chidb_Btree_findInIndex(db->bt, npage, base + bigfile_ikeys[i], &pkey);
+        ck_assert(rc == CHIDB_OK);
+        ck_assert(pkey == base + bigfile_pkeys[i]);
+    }
+
+    chidb_Btree_close(db->bt);
+    delete_tmp_file(fname);
+    free(db);
+}
+END_TEST
+
+
+START_TEST (test_8_6)
+{
+    chidb *db;
+    int rc;
+    uint8_t data[4] = {0};
+
+    /* Files made before eight-byte keys keep their four-byte keys */
+    char *fname = create_copy(TESTFILE_STRINGS1, "btree-test-8-6.dat");
+    db = malloc(sizeof(chidb));
+    rc = chidb_Btree_open(fname, db, &db->bt);
+    ck_assert(rc == CHIDB_OK);
+    ck_assert_int_eq(db->bt->key_size, KEYSIZE_NARROW);
+
+    rc = chidb_Btree_insertInTable(db->bt, 1, (chidb_key_t) 1 << 32, data, sizeof(data));
+    ck_assert(rc == CHIDB_EMISMATCH);
+    rc = chidb_Btree_insertInTable(db->bt, 1, NARROW_TABLEKEY_MAX, data, sizeof(data));
+    ck_assert(rc == CHIDB_OK);
+
+    test_values(db->bt, file1_keys, file1_values, file1_nvalues);
+
+    chidb_Btree_close(db->bt);
+    delete_copy(fname);
+    free(db);
+}
+END_TEST
+
+
 TCase* make_btree_8_tc(void)
 {
     TCase *tc = tcase_create ("Step 8: Supporting index B-Trees");
     tcase_add_test (tc, test_8_1);
     tcase_add_test (tc, test_8_2);
     tcase_add_test (tc, test_8_3);
+    tcase_add_test (tc, test_8_4);
+    tcase_add_test (tc, test_8_5);
+    tcase_add_test (tc, test_8_6);
 
     return tc;
 }
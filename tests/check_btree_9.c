@@ -0,0 +1,317 @@
+#include <stdlib.h>
+#include <check.h>
+#include "check_btree.h"
+
+/* Feeds the bigfile entries to chidb_Btree_bulkLoad in key order */
+struct bulk_source
+{
+    int order[2048];
+    int n;
+    int next;
+    bool index;
+    uint8_t buf[192];
+};
+
+static int cmp_pkeys(const void *a, const void *b)
+{
+    chidb_key_t ka = bigfile_pkeys[*(const int *) a], kb = bigfile_pkeys[*(const int *) b];
+    return (ka > kb) - (ka < kb);
+}
+
+static int cmp_ikeys(const void *a, const void *b)
+{
+    chidb_key_t ka = bigfile_ikeys[*(const int *) a], kb = bigfile_ikeys[*(const int *) b];
+    return (ka > kb) - (ka < kb);
+}
+
+static void bulk_source_init(struct bulk_source *src, bool index)
+{
+    src->n = bigfile_nvalues;
+    src->next = 0;
+    src->index = index;
+    for(int i=0; i<src->n; i++)
+        src->order[i] = i;
+    qsort(src->order, src->n, sizeof(int), index? cmp_ikeys : cmp_pkeys);
+}
+
+static int bulk_source_next(void *ctx, BTreeCell *btc)
+{
+    struct bulk_source *src = ctx;
+
+    if(src->next == src->n)
+        return CHIDB_DONE;
+
+    int i = src->order[src->next++];
+
+    if(src->index)
+    {
+        btc->type = PGTYPE_INDEX_LEAF;
+        btc->key = bigfile_ikeys[i];
+        btc->fields.indexLeaf.keyPk = bigfile_pkeys[i];
+    }
+    else
+    {
+        for(int j=0; j<48; j++)
+            put4byte(src->buf + (4*j), bigfile_ikeys[i]);
+        btc->type = PGTYPE_TABLE_LEAF;
+        btc->key = bigfile_pkeys[i];
+        btc->fields.tableLeaf.data_size = ((bigfile_pkeys[i] % 3) + 1) * 64;
+        btc->fields.tableLeaf.data = src->buf;
+    }
+
+    return CHIDB_OK;
+}
+
+/* Feeds the keys 1..n to chidb_Btree_bulkLoad */
+struct seq_source
+{
+    uint8_t type;
+    int n;
+    int next;
+    uint16_t size;
+    uint8_t buf[512];
+};
+
+static void seq_source_init(struct seq_source *src, uint8_t type, int n, uint16_t size)
+{
+    src->type = type;
+    src->n = n;
+    src->next = 0;
+    src->size = size;
+    memset(src->buf, 0xAB, sizeof(src->buf));
+}
+
+static int seq_source_next(void *ctx, BTreeCell *btc)
+{
+    struct seq_source *src = ctx;
+
+    if(src->next == src->n)
+        return CHIDB_DONE;
+
+    btc->type = src->type;
+    btc->key = ++src->next;
+    if(src->type == PGTYPE_INDEX_LEAF)
+        btc->fields.indexLeaf.keyPk = btc->key * 10;
+    else
+    {
+        btc->fields.tableLeaf.data_size = src->size;
+        btc->fields.tableLeaf.data = src->buf;
+    }
+
+    return CHIDB_OK;
+}
+
+static void bulk_load_table(uint8_t fill_factor)
+{
+    chidb *db;
+    struct bulk_source src;
+    int rc;
+
+    char *fname = create_tmp_file();
+    db = malloc(sizeof(chidb));
+    rc = chidb_Btree_open(fname, db, &db->bt);
+    ck_assert(rc == CHIDB_OK);
+
+    bulk_source_init(&src, false);
+    rc = chidb_Btree_bulkLoad(db->bt, 1, bulk_source_next, &src, fill_factor);
+    ck_assert(rc == CHIDB_OK);
+
+    check_tree(db->bt, 1, bigfile_nvalues);
+    test_bigfile(db);
+
+    chidb_Btree_close(db->bt);
+
+    /* The tree must also be there after reopening the file */
+    rc = chidb_Btree_open(fname, db, &db->bt);
+    ck_assert(rc == CHIDB_OK);
+    test_bigfile(db);
+    chidb_Btree_close(db->bt);
+
+    delete_tmp_file(fname);
+    free(db);
+}
+
+
+START_TEST (test_9_1)
+{
+    bulk_load_table(100);
+}
+END_TEST
+
+
+START_TEST (test_9_2)
+{
+    bulk_load_table(50);
+}
+END_TEST
+
+
+START_TEST (test_9_3)
+{
+    bulk_load_table(0);
+}
+END_TEST
+
+
+START_TEST (test_9_4)
+{
+    chidb *db;
+    struct bulk_source src;
+    int rc;
+    npage_t npage;
+
+    char *fname = create_tmp_file();
+    db = malloc(sizeof(chidb));
+    rc = chidb_Btree_open(fname, db, &db->bt);
+    ck_assert(rc == CHIDB_OK);
+
+    for(int i=0; i<bigfile_nvalues; i++)
+        insert_bigfile(db, i);
+
+    for(uint8_t fill = 100; fill >= 40; fill -= 20)
+    {
+        chidb_Btree_newNode(db->bt, &npage, PGTYPE_INDEX_LEAF);
+        bulk_source_init(&src, true);
+        rc = chidb_Btree_bulkLoad(db->bt, npage, bulk_source_next, &src, fill);
+        ck_assert(rc == CHIDB_OK);
+
+        check_tree(db->bt, npage, bigfile_nvalues);
+        test_index_bigfile(db, npage);
+    }
+
+    chidb_Btree_close(db->bt);
+    delete_tmp_file(fname);
+    free(db);
+}
+END_TEST
+
+
+START_TEST (test_9_5)
+{
+    chidb *db;
+    struct seq_source src;
+    int rc;
+    npage_t npage;
+    int ns[] = {1, 600, 4000, 4200};
+
+    char *fname = create_tmp_file();
+    db = malloc(sizeof(chidb));
+    rc = chidb_Btree_open(fname, db, &db->bt);
+    ck_assert(rc == CHIDB_OK);
+
+    /* Try every size in a few ranges, so that the last node of each level
+     * ends up anywhere from empty to full */
+    for(int r = 0; r < 4; r += 2)
+        for(int n = ns[r]; n < ns[r+1]; n++)
+        {
+            /* Three cells per leaf */
+            chidb_Btree_newNode(db->bt, &npage, PGTYPE_TABLE_LEAF);
+            seq_source_init(&src, PGTYPE_TABLE_LEAF, n, 300);
+            rc = chidb_Btree_bulkLoad(db->bt, npage, seq_source_next, &src, 100);
+            ck_assert(rc == CHIDB_OK);
+            check_tree(db->bt, npage, n);
+
+            chidb_Btree_newNode(db->bt, &npage, PGTYPE_INDEX_LEAF);
+            seq_source_init(&src, PGTYPE_INDEX_LEAF, n, 0);
+            rc = chidb_Btree_bulkLoad(db->bt, npage, seq_source_next, &src, 100);
+            ck_assert(rc == CHIDB_OK);
+            check_tree(db->bt, npage, n);
+        }
+
+    chidb_Btree_close(db->bt);
+    delete_tmp_file(fname);
+    free(db);
+}
+END_TEST
+
+
+START_TEST (test_9_6)
+{
+    chidb *db;
+    struct bulk_source src;
+    int rc;
+    npage_t npage;
+
+    char *fname = create_tmp_file();
+    db = malloc(sizeof(chidb));
+    rc = chidb_Btree_open(fname, db, &db->bt);
+    ck_assert(rc == CHIDB_OK);
+
+    /* The root must be empty */
+    insert_bigfile(db, 0);
+    bulk_source_init(&src, false);
+    rc = chidb_Btree_bulkLoad(db->bt, 1, bulk_source_next, &src, 100);
+    ck_assert(rc == CHIDB_EMISUSE);
+
+    /* Entries must be in ascending order */
+    chidb_Btree_newNode(db->bt, &npage, PGTYPE_TABLE_LEAF);
+    bulk_source_init(&src, false);
+    src.order[10] = src.order[5];
+    rc = chidb_Btree_bulkLoad(db->bt, npage, bulk_source_next, &src, 100);
+    ck_assert(rc == CHIDB_EMISUSE);
+
+    chidb_Btree_newNode(db->bt, &npage, PGTYPE_TABLE_LEAF);
+    bulk_source_init(&src, false);
+    src.order[11] = src.order[10];
+    rc = chidb_Btree_bulkLoad(db->bt, npage, bulk_source_next, &src, 100);
+    ck_assert(rc == CHIDB_EDUPLICATE);
+
+    /* Cells must match the type of the tree */
+    chidb_Btree_newNode(db->bt, &npage, PGTYPE_INDEX_LEAF);
+    bulk_source_init(&src, false);
+    rc = chidb_Btree_bulkLoad(db->bt, npage, bulk_source_next, &src, 100);
+    ck_assert(rc == CHIDB_EMISUSE);
+
+    chidb_Btree_close(db->bt);
+    delete_tmp_file(fname);
+    free(db);
+}
+END_TEST
+
+
+START_TEST (test_9_7)
+{
+    chidb *db;
+    struct bulk_source src;
+    int rc;
+
+    char *fname = create_tmp_file();
+    db = malloc(sizeof(chidb));
+    rc = chidb_Btree_open(fname, db, &db->bt);
+    ck_assert(rc == CHIDB_OK);
+
+    /* Load the even entries in one go, and insert the odd ones afterwards */
+    bulk_source_init(&src, false);
+    for(int i=0; i<src.n/2; i++)
+        src.order[i] = src.order[i*2];
+    src.n /= 2;
+    rc = chidb_Btree_bulkLoad(db->bt, 1, bulk_source_next, &src, 70);
+    ck_assert(rc == CHIDB_OK);
+    check_tree(db->bt, 1, src.n);
+
+    bulk_source_init(&src, false);
+    for(int i=1; i<src.n; i+=2)
+        insert_bigfile(db, src.order[i]);
+
+    test_bigfile(db);
+
+    chidb_Btree_close(db->bt);
+    delete_tmp_file(fname);
+    free(db);
+}
+END_TEST
+
+
+TCase* make_btree_9_tc(void)
+{
+    TCase *tc = tcase_create ("Step 9: Bulk loading");
+    tcase_add_test (tc, test_9_1);
+    tcase_add_test (tc, test_9_2);
+    tcase_add_test (tc, test_9_3);
+    tcase_add_test (tc, test_9_4);
+    tcase_add_test (tc, test_9_5);
+    tcase_add_test (tc, test_9_6);
+    tcase_add_test (tc, test_9_7);
+
+    return tc;
+}
@@ -8,18 +8,21 @@ void btn_sanity_check(BTree *bt, BTreeNode *btn, bool empty)
     ck_assert(btn->page->npage >= 1);
     int header_offset = btn->page->npage==1? 100:0;
 
-    ck_assert(btn->type == PGTYPE_TABLE_INTERNAL || btn->type == PGTYPE_TABLE_LEAF  || btn->type == PGTYPE_INDEX_INTERNAL  || btn->type == PGTYPE_INDEX_LEAF);
+    ck_assert(btn->type == PGTYPE_TABLE_INTERNAL || btn->type == PGTYPE_TABLE_LEAF  || btn->type == PGTYPE_INDEX_INTERNAL  || btn->type == PGTYPE_INDEX_LEAF
+              || btn->type == PGTYPE_TEXTINDEX_INTERNAL || btn->type == PGTYPE_TEXTINDEX_LEAF);
     ck_assert(btn->n_cells >= 0);
 
     switch(btn->type)
     {
     case PGTYPE_TABLE_INTERNAL:
     case PGTYPE_INDEX_INTERNAL:
+    case PGTYPE_TEXTINDEX_INTERNAL:
         ck_assert(btn->free_offset == header_offset + INTPG_CELLSOFFSET_OFFSET + (btn->n_cells * 2));
         ck_assert(btn->celloffset_array == btn->page->data + header_offset + INTPG_CELLSOFFSET_OFFSET);
         break;
     case PGTYPE_TABLE_LEAF:
     case PGTYPE_INDEX_LEAF:
+    case PGTYPE_TEXTINDEX_LEAF:
         ck_assert(btn->free_offset == header_offset + LEAFPG_CELLSOFFSET_OFFSET + (btn->n_cells * 2));
         ck_assert(btn->celloffset_array == btn->page->data + header_offset + LEAFPG_CELLSOFFSET_OFFSET);
         break;
@@ -35,7 +38,7 @@ void btn_sanity_check(BTree *bt, BTreeNode *btn, bool empty)
         ck_assert(cell_offset <= bt->pager->page_size);
     }
 
-    if (!empty && (btn->type == PGTYPE_TABLE_INTERNAL || btn->type == PGTYPE_INDEX_INTERNAL))
+    if (!empty && PGTYPE_IS_INTERNAL(btn->type))
     {
         ck_assert(btn->right_page > 1);
         ck_assert(btn->right_page <= bt->pager->n_pages);
@@ -86,7 +89,7 @@ void test_new_node(BTree *bt, uint8_t type)
 
 void test_values(BTree *bt, chidb_key_t *keys, char **values, chidb_key_t nkeys)
 {
-    uint16_t size;
+    uint32_t size;
     uint8_t *data;
     int rc;
 
@@ -121,7 +124,7 @@ void test_bigfile(chidb *db)
     for(int i=0; i<bigfile_nvalues; i++)
     {
         uint8_t* buf;
-        uint16_t size;
+        uint32_t size;
         uint8_t data[192];
         int datalen = ((bigfile_pkeys[i] % 3) + 1) * 64;
 
@@ -188,7 +191,7 @@ void test_index_bigfile(chidb *db, npage_t index_nroot)
     for(int i=0; i<bigfile_nvalues; i++)
     {
         uint8_t* buf;
-        uint16_t size;
+        uint32_t size;
         uint8_t data[192];
         chidb_key_t pkey;
 
@@ -207,3 +210,62 @@ void test_index_bigfile(chidb *db, npage_t index_nroot)
     }
 }
 
+/* Checks that keys are in order, that every node but the root has at least
+ * one cell, and that all the leaves are at the same depth. Returns the
+ * number of entries in the subtree. */
+int check_subtree(BTree *bt, npage_t npage, int depth, int *leaf_depth, chidb_key_t *last, bool *first)
+{
+    BTreeNode *btn;
+    BTreeCell btc;
+    int n = 0;
+
+    ck_assert(chidb_Btree_getNodeByPage(bt, npage, &btn) == CHIDB_OK);
+    btn_sanity_check(bt, btn, false);
+
+    if(btn->type == PGTYPE_TABLE_LEAF || btn->type == PGTYPE_INDEX_LEAF)
+    {
+        if(*leaf_depth == -1)
+            *leaf_depth = depth;
+        ck_assert_int_eq(depth, *leaf_depth);
+    }
+    if(depth > 0)
+        ck_assert(btn->n_cells > 0);
+
+    for(int i=0; i<btn->n_cells; i++)
+    {
+        chidb_Btree_getCell(btn, i, &btc);
+        switch(btn->type)
+        {
+        case PGTYPE_TABLE_INTERNAL:
+            n += check_subtree(bt, btc.fields.tableInternal.child_page, depth+1, leaf_depth, last, first);
+            ck_assert(btc.key >= *last);
+            break;
+        case PGTYPE_INDEX_INTERNAL:
+            n += check_subtree(bt, btc.fields.indexInternal.child_page, depth+1, leaf_depth, last, first);
+            /* Fall through: the cell is an entry in its own right */
+        default:
+            ck_assert(*first || btc.key > *last);
+            *last = btc.key;
+            *first = false;
+            if(btn->type != PGTYPE_TABLE_INTERNAL)
+                n++;
+        }
+    }
+
+    if(btn->type == PGTYPE_TABLE_INTERNAL || btn->type == PGTYPE_INDEX_INTERNAL)
+        n += check_subtree(bt, btn->right_page, depth+1, leaf_depth, last, first);
+
+    chidb_Btree_freeMemNode(bt, btn);
+
+    return n;
+}
+
+void check_tree(BTree *bt, npage_t nroot, int nentries)
+{
+    int leaf_depth = -1;
+    chidb_key_t last = 0;
+    bool first = true;
+
+    ck_assert_int_eq(check_subtree(bt, nroot, 0, &leaf_depth, &last, &first), nentries);
+    ck_assert(leaf_depth >= 0);
+}
@@ -2,10 +2,19 @@
 #include <stdio.h>
 #include <check.h>
 #include <dirent.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/stat.h>
 #include <chidb/chidb.h>
 #include "libchidb/dbm.h"
 #include "libchidb/dbm-file.h"
 #include "libchidb/dbm-types.h"
+#include "libchidb/dbm-bloom.h"
+#include "libchidb/dbm-sorter.h"
+#include "libchidb/catalog.h"
+#include "libchidb/util.h"
+#include "libchidb/stats.h"
+#include "libchidb/pager.h"
 #include "check_common.h"
 
 // Make this array bigger if we ever have more than 1024 DBM tests
@@ -64,8 +73,10 @@ START_TEST (test_dbm)
             switch(expected->type)
             {
             case REG_INT32:
+            case REG_INT64:
                 ck_assert_msg(expected->value.i == actual->value.i,
-                        "Expected register %i to have value %i but it has value %i", nReg, expected->value.i, actual->value.i);
+                        "Expected register %i to have value %lli but it has value %lli", nReg,
+                        (long long) expected->value.i, (long long) actual->value.i);
                 break;
             case REG_STRING:
                 ck_assert_msg(strcmp(expected->value.s, actual->value.s) == 0,
@@ -89,6 +100,4124 @@ START_TEST (test_dbm)
 END_TEST
 
 
+/* Counts the rows returned by a statement, checking the first column
+ * of each one against the expected values */
+static int step_rows(chidb_stmt *stmt, const char **expected, int max)
+{
+    int rc, n = 0;
+
+    while((rc = chidb_step(stmt)) == CHIDB_ROW)
+    {
+        ck_assert_msg(n < max, "Statement produced more rows than expected");
+        ck_assert_str_eq(chidb_column_text(stmt, 0), expected[n]);
+        n++;
+    }
+    ck_assert_int_eq(rc, CHIDB_DONE);
+
+    return n;
+}
+
+START_TEST (test_bind)
+{
+    chidb *db;
+    chidb_stmt *stmt;
+    const char *dept89[] = {"Programming Languages", "Operating Systems"};
+    const char *dept42[] = {"Databases"};
+
+    ck_assert(chidb_open(DATABASES_DIR "1table-1page.cdb", &db) == CHIDB_OK);
+    ck_assert(chidb_prepare(db, "SELECT name FROM courses WHERE dept = ?;", &stmt) == CHIDB_OK);
+
+    /* Parameters are numbered from 1 */
+    ck_assert(chidb_bind_int(stmt, 0, 89) == CHIDB_EMISUSE);
+    ck_assert(chidb_bind_int(stmt, 2, 89) == CHIDB_EMISUSE);
+
+    ck_assert(chidb_bind_int(stmt, 1, 89) == CHIDB_OK);
+    ck_assert_int_eq(step_rows(stmt, dept89, 2), 2);
+
+    /* Can't bind until the statement is reset */
+    ck_assert(chidb_bind_int(stmt, 1, 42) == CHIDB_EMISUSE);
+    ck_assert(chidb_reset(stmt) == CHIDB_OK);
+    ck_assert(chidb_bind_int(stmt, 1, 42) == CHIDB_OK);
+    ck_assert_int_eq(step_rows(stmt, dept42, 1), 1);
+
+    /* Bindings are kept across resets, even in the middle of a run */
+    ck_assert(chidb_reset(stmt) == CHIDB_OK);
+    ck_assert(chidb_bind_int(stmt, 1, 89) == CHIDB_OK);
+    ck_assert(chidb_step(stmt) == CHIDB_ROW);
+    ck_assert(chidb_reset(stmt) == CHIDB_OK);
+    ck_assert_int_eq(step_rows(stmt, dept89, 2), 2);
+
+    ck_assert(chidb_reset(stmt) == CHIDB_OK);
+    ck_assert(chidb_clear_bindings(stmt) == CHIDB_OK);
+    ck_assert(chidb_bind_text(stmt, 1, "89") == CHIDB_OK);
+    ck_assert(chidb_finalize(stmt) == CHIDB_OK);
+
+    ck_assert(chidb_close(db) == CHIDB_OK);
+}
+END_TEST
+
+
+START_TEST (test_stmt_cache)
+{
+    chidb *db;
+    chidb_stmt *stmt1, *stmt2;
+    const char *dept89[] = {"Programming Languages", "Operating Systems"};
+    char sql[128];
+
+    char *fname = create_copy("1table-1page.cdb", "stmt-cache.cdb");
+    ck_assert(chidb_open(fname, &db) == CHIDB_OK);
+
+    /* The second statement only differs in whitespace, so it runs the
+     * cached program. Both statements can be used at the same time. */
+    ck_assert(chidb_prepare(db, "SELECT name FROM courses WHERE dept = 89;", &stmt1) == CHIDB_OK);
+    ck_assert(stmt1->program == NULL);
+    ck_assert(chidb_prepare(db, "  SELECT name\n FROM   courses WHERE dept = 89", &stmt2) == CHIDB_OK);
+    ck_assert(stmt2->program != NULL);
+    ck_assert(chidb_step(stmt2) == CHIDB_ROW);
+    ck_assert_int_eq(step_rows(stmt1, dept89, 2), 2);
+    ck_assert(chidb_finalize(stmt1) == CHIDB_OK);
+    ck_assert_str_eq(chidb_column_text(stmt2, 0), dept89[0]);
+    ck_assert(chidb_finalize(stmt2) == CHIDB_OK);
+
+    /* The cache is bounded */
+    for(int i = 0; i < DEFAULT_STMT_CACHE_SIZE + 10; i++)
+    {
+        sprintf(sql, "SELECT name FROM courses WHERE dept = %i;", i);
+        ck_assert(chidb_prepare(db, sql, &stmt1) == CHIDB_OK);
+        chidb_finalize(stmt1);
+    }
+    ck_assert_int_eq(db->stmt_cache.n, DEFAULT_STMT_CACHE_SIZE);
+
+    /* Changing the schema drops the cached programs */
+    ck_assert(chidb_prepare(db, "CREATE TABLE t(a INTEGER PRIMARY KEY, b INTEGER);", &stmt1) == CHIDB_OK);
+    ck_assert(chidb_step(stmt1) == CHIDB_DONE);
+    chidb_finalize(stmt1);
+    ck_assert(chidb_prepare(db, "SELECT name FROM courses WHERE dept = 89;", &stmt1) == CHIDB_OK);
+    ck_assert(stmt1->program == NULL);
+    ck_assert_int_eq(db->stmt_cache.n, 1);
+    ck_assert_int_eq(step_rows(stmt1, dept89, 2), 2);
+    chidb_finalize(stmt1);
+
+    ck_assert(chidb_close(db) == CHIDB_OK);
+    delete_copy(fname);
+}
+END_TEST
+
+
+START_TEST (test_catalog)
+{
+    chidb *db;
+    chidb_stmt *stmt;
+
+    char *fname = create_copy("1table-1index-1pageeach.cdb", "catalog.cdb");
+    ck_assert(chidb_open(fname, &db) == CHIDB_OK);
+
+    /* Schemas are only parsed once their columns are needed */
+    ck_assert(chidb_table_exists(db, "numbers") == CHIDB_OK);
+    ck_assert(chidb_catalog_table(db, "numbers")->stmt == NULL);
+    ck_assert(chidb_table_exists(db, "idxNumbers") == CHIDB_EINVALIDSQL);
+    ck_assert(chidb_table_exists(db, "nosuchtable") == CHIDB_EINVALIDSQL);
+    ck_assert(chidb_catalog_index(db, "idxNumbers") != NULL);
+    ck_assert_int_eq(chidb_get_root(db, "idxNumbers"), chidb_catalog_index(db, "idxNumbers")->rpage);
+    ck_assert(chidb_get_root(db, "numbers") != chidb_get_root(db, "idxNumbers"));
+
+    ck_assert_int_eq(chidb_columns_total(db, "numbers"), 3);
+    ck_assert(chidb_catalog_table(db, "numbers")->stmt != NULL);
+    ck_assert(chidb_catalog_index(db, "idxNumbers")->stmt == NULL);
+    ck_assert_int_eq(chidb_column_get_position(db, "numbers", "code"), 0);
+    ck_assert_int_eq(chidb_column_get_position(db, "numbers", "altcode"), 2);
+    ck_assert_int_eq(chidb_column_get_position(db, "numbers", "nosuchcolumn"), -1);
+    ck_assert_int_eq(chidb_column_get_type(db, "numbers", "textcode"), TYPE_TEXT);
+    ck_assert(chidb_column_exists(db, "numbers", "textcode") == CHIDB_OK);
+    ck_assert(chidb_column_exists(db, "nosuchtable", "textcode") == CHIDB_EINVALIDSQL);
+
+    /* New tables show up once the schema is refreshed */
+    ck_assert(chidb_prepare(db, "CREATE TABLE t(a INTEGER PRIMARY KEY, b TEXT);", &stmt) == CHIDB_OK);
+    ck_assert(chidb_step(stmt) == CHIDB_DONE);
+    chidb_finalize(stmt);
+    ck_assert(chidb_prepare(db, "SELECT * FROM t;", &stmt) == CHIDB_OK);
+    ck_assert(chidb_step(stmt) == CHIDB_DONE);
+    chidb_finalize(stmt);
+    ck_assert(chidb_table_exists(db, "t") == CHIDB_OK);
+    ck_assert(chidb_table_exists(db, "numbers") == CHIDB_OK);
+    ck_assert_int_eq(chidb_column_get_position(db, "t", "b"), 1);
+
+    ck_assert(chidb_close(db) == CHIDB_OK);
+    delete_copy(fname);
+}
+END_TEST
+
+
+START_TEST (test_catalog_many_tables)
+{
+    chidb *db;
+    chidb_stmt *stmt;
+    char sql[128], name[16];
+
+    char *fname = create_tmp_file();
+    ck_assert(chidb_open(fname, &db) == CHIDB_OK);
+
+    /* Enough tables for the schema table to need more than one page */
+    for(int i = 0; i < 50; i++)
+    {
+        sprintf(sql, "CREATE TABLE t%i(a INTEGER PRIMARY KEY, b%i INTEGER);", i, i);
+        ck_assert(chidb_prepare(db, sql, &stmt) == CHIDB_OK);
+        ck_assert(chidb_step(stmt) == CHIDB_DONE);
+        chidb_finalize(stmt);
+    }
+    ck_assert(chidb_close(db) == CHIDB_OK);
+
+    ck_assert(chidb_open(fname, &db) == CHIDB_OK);
+    ck_assert_int_eq(list_size(&db->schemas), 50);
+    for(int i = 0; i < 50; i++)
+    {
+        sprintf(name, "t%i", i);
+        sprintf(sql, "b%i", i);
+        ck_assert(chidb_table_exists(db, name) == CHIDB_OK);
+        ck_assert_int_eq(chidb_column_get_position(db, name, sql), 1);
+    }
+    ck_assert(chidb_close(db) == CHIDB_OK);
+
+    delete_tmp_file(fname);
+}
+END_TEST
+
+
+/* Runs a statement that is not expected to return rows */
+static void exec_sql(chidb *db, const char *sql)
+{
+    chidb_stmt *stmt;
+
+    ck_assert(chidb_prepare(db, sql, &stmt) == CHIDB_OK);
+    ck_assert(chidb_step(stmt) == CHIDB_DONE);
+    ck_assert(chidb_finalize(stmt) == CHIDB_OK);
+}
+
+static int count_ops(chidb_stmt *stmt, opcode_t opcode)
+{
+    int n = 0;
+
+    for(uint32_t i = 0; i < stmt->endOp; i++)
+        n += stmt->ops[i].opcode == opcode;
+    return n;
+}
+
+static bool uses_op(chidb_stmt *stmt, opcode_t opcode)
+{
+    return count_ops(stmt, opcode) > 0;
+}
+
+static bool uses_hash_join(chidb_stmt *stmt)
+{
+    return uses_op(stmt, Op_OpenHash);
+}
+
+
+/* Runs "SELECT id FROM t WHERE x = ?" (t.x = t.id % 10) in test_result_cache
+ * with x bound, and checks that it returns n rows, from the result cache
+ * or not */
+static void check_cached(chidb *db, int x, int n, bool cached)
+{
+    chidb_stmt *stmt;
+    int rc, rows = 0;
+
+    ck_assert(chidb_prepare(db, "SELECT id FROM t WHERE x = ?;", &stmt) == CHIDB_OK);
+    ck_assert(chidb_bind_int(stmt, 1, x) == CHIDB_OK);
+    ck_assert(chidb_step(stmt) == CHIDB_ROW);
+    ck_assert(stmt->replaying == cached);
+    do
+    {
+        ck_assert_int_eq(chidb_column_int(stmt, 0) % 10, x);
+        rows++;
+    } while((rc = chidb_step(stmt)) == CHIDB_ROW);
+    ck_assert_int_eq(rc, CHIDB_DONE);
+    ck_assert_int_eq(rows, n);
+    ck_assert(chidb_step(stmt) == CHIDB_DONE);
+    ck_assert(chidb_finalize(stmt) == CHIDB_OK);
+}
+
+START_TEST (test_program_file)
+{
+    chidb *db;
+    chidb_stmt *stmt;
+    const char *dept89[] = {"Programming Languages", "Operating Systems"};
+    struct stat st;
+
+    char *fname = create_copy("1table-1page.cdb", "program-file.cdb");
+    char *pname = create_tmp_file();
+    ck_assert(chidb_open(fname, &db) == CHIDB_OK);
+    ck_assert(chidb_prepare(db, "SELECT name FROM courses WHERE dept = ?;", &stmt) == CHIDB_OK);
+    chidb_finalize(stmt);
+    ck_assert(chidb_prepare(db, "SELECT name FROM courses WHERE dept = 89;", &stmt) == CHIDB_OK);
+    chidb_finalize(stmt);
+    ck_assert(chidb_save_programs(db, pname) == CHIDB_OK);
+    ck_assert(chidb_close(db) == CHIDB_OK);
+
+    /* Another handle prepares the same statements without compiling
+     * them. Loading the file again does not add them twice. */
+    ck_assert(chidb_open(fname, &db) == CHIDB_OK);
+    ck_assert(chidb_load_programs(db, pname) == CHIDB_OK);
+    ck_assert_int_eq(db->stmt_cache.n, 2);
+    ck_assert(chidb_load_programs(db, pname) == CHIDB_OK);
+    ck_assert_int_eq(db->stmt_cache.n, 2);
+
+    ck_assert(chidb_prepare(db, "SELECT name FROM courses WHERE dept = ?", &stmt) == CHIDB_OK);
+    ck_assert(stmt->program != NULL);
+    ck_assert(chidb_bind_int(stmt, 1, 89) == CHIDB_OK);
+    ck_assert_str_eq(chidb_column_name(stmt, 0), "name");
+    ck_assert_int_eq(step_rows(stmt, dept89, 2), 2);
+    chidb_finalize(stmt);
+    ck_assert(chidb_prepare(db, "SELECT name FROM courses WHERE dept = 89;", &stmt) == CHIDB_OK);
+    ck_assert(stmt->program != NULL);
+    ck_assert_int_eq(step_rows(stmt, dept89, 2), 2);
+    chidb_finalize(stmt);
+
+    /* Files that are cut short, or saved for another schema, are refused */
+    ck_assert(chidb_load_programs(db, "no-such-file") == CHIDB_ECANTOPEN);
+    ck_assert(stat(pname, &st) == 0);
+    ck_assert(truncate(pname, st.st_size - 1) == 0);
+    ck_assert(chidb_load_programs(db, pname) == CHIDB_ECORRUPT);
+    ck_assert(chidb_save_programs(db, pname) == CHIDB_OK);
+    exec_sql(db, "CREATE TABLE t(a INTEGER PRIMARY KEY, b INTEGER);");
+    ck_assert(chidb_load_programs(db, pname) == CHIDB_EMISMATCH);
+
+    ck_assert(chidb_close(db) == CHIDB_OK);
+    delete_tmp_file(pname);
+    delete_copy(fname);
+}
+END_TEST
+
+START_TEST (test_result_cache)
+{
+    chidb *db;
+    chidb_stmt *stmt;
+    char sql[128];
+
+    char *fname = create_tmp_file();
+    ck_assert(chidb_open(fname, &db) == CHIDB_OK);
+
+    exec_sql(db, "CREATE TABLE t(id INTEGER PRIMARY KEY, x INTEGER);");
+    exec_sql(db, "CREATE TABLE u(id INTEGER PRIMARY KEY, y INTEGER);");
+    for(int i = 1; i <= 100; i++)
+    {
+        sprintf(sql, "INSERT INTO t VALUES(%i, %i);", i, i % 10);
+        exec_sql(db, sql);
+    }
+    ck_assert(chidb_set_result_cache(db, 1 << 20) == CHIDB_OK);
+
+    /* Once the program is cached, its rows are kept, and then returned
+     * again, for each value of the parameter */
+    check_cached(db, 3, 10, false);
+    check_cached(db, 3, 10, false);
+    check_cached(db, 3, 10, true);
+    check_cached(db, 4, 10, false);
+    check_cached(db, 4, 10, true);
+    check_cached(db, 3, 10, true);
+
+    /* Writing to another table does not matter. Writing to t does. */
+    exec_sql(db, "INSERT INTO u VALUES(1, 1);");
+    check_cached(db, 3, 10, true);
+    exec_sql(db, "INSERT INTO t VALUES(103, 3);");
+    check_cached(db, 3, 11, false);
+    check_cached(db, 3, 11, true);
+    exec_sql(db, "DELETE FROM t WHERE id = 103;");
+    check_cached(db, 3, 10, false);
+    check_cached(db, 3, 10, true);
+
+    /* Nor do rows written in a transaction that is rolled back stay */
+    exec_sql(db, "BEGIN;");
+    exec_sql(db, "INSERT INTO t VALUES(113, 3);");
+    check_cached(db, 3, 11, false);
+    check_cached(db, 3, 11, true);
+    exec_sql(db, "ROLLBACK;");
+    check_cached(db, 3, 10, false);
+    check_cached(db, 3, 10, false);
+    check_cached(db, 3, 10, true);
+
+    /* A statement reset before it is done keeps nothing */
+    ck_assert(chidb_prepare(db, "SELECT id FROM t WHERE x = ?;", &stmt) == CHIDB_OK);
+    ck_assert(chidb_bind_int(stmt, 1, 5) == CHIDB_OK);
+    ck_assert(chidb_step(stmt) == CHIDB_ROW);
+    ck_assert(chidb_reset(stmt) == CHIDB_OK);
+    ck_assert(chidb_finalize(stmt) == CHIDB_OK);
+    check_cached(db, 5, 10, false);
+    check_cached(db, 5, 10, true);
+
+    /* Results that do not fit are dropped, and none are kept without
+     * a budget */
+    ck_assert(chidb_set_result_cache(db, db->result_cache.used / 2) == CHIDB_OK);
+    ck_assert(db->result_cache.used <= db->result_cache.budget);
+    ck_assert(chidb_set_result_cache(db, 0) == CHIDB_OK);
+    ck_assert(db->result_cache.head == NULL);
+    check_cached(db, 5, 10, false);
+    check_cached(db, 5, 10, false);
+
+    ck_assert(chidb_close(db) == CHIDB_OK);
+    delete_tmp_file(fname);
+}
+END_TEST
+
+/* Runs a query on 1table-largebtree.cdb, and checks that the (code, altcode)
+ * rows returned are the ones in rows[] that match "column OP value", and
+ * that it was run with the given opcode */
+static void check_access_path(chidb *db, int rows[][2], int nrows, int column, int op,
+                              int value, opcode_t opcode)
+{
+    const char *columns[] = {"code", "altcode"};
+    const char *ops[] = {"=", ">", ">=", "<", "<="};
+    chidb_stmt *stmt;
+    char sql[128];
+    long sum = 0, expected_sum = 0;
+    int rc, n = 0, expected = 0;
+
+    sprintf(sql, "SELECT code, altcode FROM numbers WHERE %s %s %i;", columns[column], ops[op], value);
+    ck_assert(chidb_prepare(db, sql, &stmt) == CHIDB_OK);
+    ck_assert_msg(uses_op(stmt, opcode), "%s is not using %s", sql, opcode_to_str(opcode));
+    ck_assert(!uses_op(stmt, Op_Ne) && !uses_op(stmt, Op_Le) && !uses_op(stmt, Op_Lt));
+
+    while((rc = chidb_step(stmt)) == CHIDB_ROW)
+    {
+        sum += chidb_column_int(stmt, 0) * 10007L + chidb_column_int(stmt, 1);
+        n++;
+    }
+    ck_assert_int_eq(rc, CHIDB_DONE);
+    ck_assert(chidb_finalize(stmt) == CHIDB_OK);
+
+    for(int i = 0; i < nrows; i++)
+    {
+        int x = rows[i][column];
+        bool match = op == 0 ? x == value : op == 1 ? x > value : op == 2 ? x >= value
+                   : op == 3 ? x < value : x <= value;
+        if(match)
+        {
+            expected_sum += rows[i][0] * 10007L + rows[i][1];
+            expected++;
+        }
+    }
+    ck_assert_msg(n == expected && sum == expected_sum, "%s returned %i rows, not %i", sql, n, expected);
+}
+
+START_TEST (test_access_paths)
+{
+    chidb *db;
+    chidb_stmt *stmt;
+    static int rows[2048][2];
+    int values[] = {0, 1, 597, 598, 5000, 9861, 9990, 10000, 20000};
+    int rc, nrows = 0;
+
+    char *fname = create_copy("1table-largebtree.cdb", "access-paths.cdb");
+    ck_assert(chidb_open(fname, &db) == CHIDB_OK);
+
+    ck_assert(chidb_prepare(db, "SELECT code, altcode FROM numbers;", &stmt) == CHIDB_OK);
+    while((rc = chidb_step(stmt)) == CHIDB_ROW && nrows < 2048)
+    {
+        rows[nrows][0] = chidb_column_int(stmt, 0);
+        rows[nrows][1] = chidb_column_int(stmt, 1);
+        nrows++;
+    }
+    ck_assert_int_eq(rc, CHIDB_DONE);
+    ck_assert(chidb_finalize(stmt) == CHIDB_OK);
+
+    /* code is the primary key, and altcode is indexed by idxNumbers. Ranges
+     * start with a seek, or stop with a comparison to the value. */
+    for(int v = 0; v < 9; v++)
+    {
+        check_access_path(db, rows, nrows, 0, 0, values[v], Op_Seek);
+        check_access_path(db, rows, nrows, 0, 1, values[v], Op_SeekGt);
+        check_access_path(db, rows, nrows, 0, 2, values[v], Op_SeekGe);
+        check_access_path(db, rows, nrows, 0, 3, values[v], Op_Ge);
+        check_access_path(db, rows, nrows, 0, 4, values[v], Op_Gt);
+        check_access_path(db, rows, nrows, 1, 0, values[v], Op_IdxGt);
+        check_access_path(db, rows, nrows, 1, 1, values[v], Op_SeekGt);
+        check_access_path(db, rows, nrows, 1, 2, values[v], Op_SeekGe);
+        check_access_path(db, rows, nrows, 1, 3, values[v], Op_IdxGe);
+        check_access_path(db, rows, nrows, 1, 4, values[v], Op_IdxGt);
+    }
+
+    /* The index has all that these need, so the table is never opened */
+    const char *covered[] = {
+        "SELECT code, altcode FROM numbers WHERE altcode >= 9990;",
+        "SELECT altcode FROM numbers WHERE altcode = 9990;",
+        "SELECT code FROM numbers WHERE altcode < 20;",
+    };
+    for(int i = 0; i < 3; i++)
+    {
+        ck_assert(chidb_prepare(db, covered[i], &stmt) == CHIDB_OK);
+        ck_assert_msg(count_ops(stmt, Op_OpenRead) == 1 && !uses_op(stmt, Op_Seek), "%s reads the table", covered[i]);
+        ck_assert(chidb_finalize(stmt) == CHIDB_OK);
+    }
+    ck_assert(chidb_prepare(db, "SELECT code, textcode FROM numbers WHERE altcode >= 9990 ORDER BY altcode;", &stmt) == CHIDB_OK);
+    ck_assert_int_eq(count_ops(stmt, Op_OpenRead), 2);
+    ck_assert(uses_op(stmt, Op_DeferredSeek) && !uses_op(stmt, Op_SorterOpen));
+    ck_assert(chidb_finalize(stmt) == CHIDB_OK);
+
+    /* Unless they must come out in the order of the index, the rows of a
+     * range are sought in primary key order, which reads fewer pages */
+    uint64_t reads[2];
+    for(int i = 0; i < 2; i++)
+    {
+        chidb_counters_t c;
+        int n = 0, prev = -1, expected = 0;
+
+        for(int r = 0; r < nrows; r++)
+            expected += rows[r][1] >= 2000;
+        ck_assert(chidb_prepare(db, i ? "SELECT code, textcode FROM numbers WHERE altcode >= 2000;"
+                                      : "SELECT code, textcode FROM numbers WHERE altcode >= 2000 LIMIT 100000;",
+                                &stmt) == CHIDB_OK);
+        ck_assert(uses_op(stmt, Op_SorterInsert) == i);
+        ck_assert(chidb_stats(db, &c, 1) == CHIDB_OK);
+        while((rc = chidb_step(stmt)) == CHIDB_ROW)
+        {
+            int code = chidb_column_int(stmt, 0);
+            const char *text = chidb_column_text(stmt, 1);
+
+            ck_assert(!i || code > prev);
+            ck_assert_int_ge(atoi(strrchr(text, ':') + 1), 2000);
+            prev = code;
+            n++;
+        }
+        ck_assert_int_eq(rc, CHIDB_DONE);
+        ck_assert(chidb_stats(db, &c, 0) == CHIDB_OK);
+        ck_assert(chidb_finalize(stmt) == CHIDB_OK);
+        ck_assert_int_eq(n, expected);
+        reads[i] = c.page_reads;
+    }
+    ck_assert_msg(reads[1] < reads[0], "%lu pages read in key order, %lu in index order",
+                  (unsigned long) reads[1], (unsigned long) reads[0]);
+    ck_assert(chidb_prepare(db, "SELECT code FROM numbers WHERE altcode >= 2000 AND altcode < 5000 AND textcode = ?;",
+                            &stmt) == CHIDB_OK);
+    ck_assert(uses_op(stmt, Op_SorterInsert));
+    ck_assert(chidb_bind_text(stmt, 1, "PK: 879 -- IK: 4402") == CHIDB_OK);
+    ck_assert(chidb_step(stmt) == CHIDB_ROW);
+    ck_assert_int_eq(chidb_column_int(stmt, 0), 879);
+    ck_assert(chidb_step(stmt) == CHIDB_DONE);
+    ck_assert(chidb_finalize(stmt) == CHIDB_OK);
+
+    /* Rows are only sought in the table once the conditions on the index
+     * hold: one seek in the index, and one per row returned */
+    chidb_counters_t c;
+    int n = 0, expected = 0;
+    for(int r = 0; r < nrows; r++)
+        expected += rows[r][1] >= 5000 && rows[r][1] < 5100;
+    ck_assert(chidb_stats(db, &c, 1) == CHIDB_OK);
+    ck_assert(chidb_prepare(db, "SELECT code, altcode, textcode FROM numbers WHERE altcode >= 5000 AND altcode < 5100;", &stmt) == CHIDB_OK);
+    while((rc = chidb_step(stmt)) == CHIDB_ROW)
+    {
+        char text[32];
+
+        snprintf(text, sizeof(text), "PK: %i -- IK: %i", chidb_column_int(stmt, 0), chidb_column_int(stmt, 1));
+        ck_assert_str_eq(chidb_column_text(stmt, 2), text);
+        n++;
+    }
+    ck_assert_int_eq(rc, CHIDB_DONE);
+    ck_assert(chidb_finalize(stmt) == CHIDB_OK);
+    ck_assert_int_gt(expected, 0);
+    ck_assert_int_eq(n, expected);
+    ck_assert(chidb_stats(db, &c, 0) == CHIDB_OK);
+    ck_assert_int_eq(c.cursor_seeks, expected + 1);
+
+    /* A parameter bound to text is never equal to an integer */
+    ck_assert(chidb_prepare(db, "SELECT code FROM numbers WHERE altcode = ?;", &stmt) == CHIDB_OK);
+    ck_assert(uses_op(stmt, Op_IdxPKey));
+    ck_assert(chidb_bind_int(stmt, 1, 9990) == CHIDB_OK);
+    ck_assert(chidb_step(stmt) == CHIDB_ROW);
+    ck_assert_int_eq(chidb_column_int(stmt, 0), 597);
+    ck_assert(chidb_step(stmt) == CHIDB_DONE);
+    ck_assert(chidb_reset(stmt) == CHIDB_OK);
+    ck_assert(chidb_bind_text(stmt, 1, "9990") == CHIDB_OK);
+    ck_assert(chidb_step(stmt) == CHIDB_DONE);
+    ck_assert(chidb_finalize(stmt) == CHIDB_OK);
+
+    ck_assert(chidb_close(db) == CHIDB_OK);
+    delete_copy(fname);
+}
+END_TEST
+
+/* Checks that "SELECT code, altcode FROM numbers WHERE code IN (...)" on
+ * 1table-largebtree.cdb returns, in order, the distinct codes in keys[]
+ * that are in rows[] (sorted by code), with altcode > min_alt */
+static void check_key_list(chidb_stmt *stmt, int rows[][2], int nrows, int *keys, int nkeys, int min_alt)
+{
+    int rc, r = 0;
+
+    while((rc = chidb_step(stmt)) == CHIDB_ROW)
+    {
+        int code = chidb_column_int(stmt, 0);
+        bool listed = false;
+
+        for(int k = 0; k < nkeys; k++)
+            listed = listed || keys[k] == code;
+        ck_assert_msg(listed, "%i is not in the list", code);
+        while(r < nrows && rows[r][0] < code)
+        {
+            for(int k = 0; k < nkeys; k++)
+                ck_assert_msg(keys[k] != rows[r][0] || rows[r][1] <= min_alt, "%i is missing", rows[r][0]);
+            r++;
+        }
+        ck_assert(r < nrows && rows[r][0] == code);
+        ck_assert_int_eq(chidb_column_int(stmt, 1), rows[r][1]);
+        ck_assert(rows[r][1] > min_alt);
+        r++;
+    }
+    ck_assert_int_eq(rc, CHIDB_DONE);
+    for(; r < nrows; r++)
+        for(int k = 0; k < nkeys; k++)
+            ck_assert_msg(keys[k] != rows[r][0] || rows[r][1] <= min_alt, "%i is missing", rows[r][0]);
+}
+
+START_TEST (test_key_list)
+{
+    chidb *db;
+    chidb_stmt *stmt;
+    static int rows[2048][2];
+    int keys[] = {9861, 0, 597, 20000, 597, 1, 5000, 598};
+    int rc, nrows = 0;
+
+    char *fname = create_copy("1table-largebtree.cdb", "key-list.cdb");
+    ck_assert(chidb_open(fname, &db) == CHIDB_OK);
+
+    ck_assert(chidb_prepare(db, "SELECT code, altcode FROM numbers;", &stmt) == CHIDB_OK);
+    while((rc = chidb_step(stmt)) == CHIDB_ROW && nrows < 2048)
+    {
+        rows[nrows][0] = chidb_column_int(stmt, 0);
+        rows[nrows][1] = chidb_column_int(stmt, 1);
+        nrows++;
+    }
+    ck_assert_int_eq(rc, CHIDB_DONE);
+    ck_assert(chidb_finalize(stmt) == CHIDB_OK);
+
+    /* Unsorted, with a duplicate and keys that are not in the table */
+    ck_assert(chidb_prepare(db, "SELECT code, altcode FROM numbers WHERE code IN "
+                                "(9861, 0, 597, 20000, 597, 1, 5000, 598);", &stmt) == CHIDB_OK);
+    ck_assert(uses_op(stmt, Op_SorterOpen) && uses_op(stmt, Op_Seek) && !uses_op(stmt, Op_Next));
+    check_key_list(stmt, rows, nrows, keys, 8, -1);
+    ck_assert(chidb_finalize(stmt) == CHIDB_OK);
+
+    /* The other conditions are tested on the rows that are found */
+    ck_assert(chidb_prepare(db, "SELECT code, altcode FROM numbers WHERE code IN "
+                                "(9861, 0, 597, 20000, 597, 1, 5000, 598) AND altcode > 5000;", &stmt) == CHIDB_OK);
+    ck_assert(uses_op(stmt, Op_SorterOpen));
+    check_key_list(stmt, rows, nrows, keys, 8, 5000);
+    ck_assert(chidb_finalize(stmt) == CHIDB_OK);
+
+    /* With parameters, the list is sorted each time the statement runs */
+    ck_assert(chidb_prepare(db, "SELECT code, altcode FROM numbers WHERE code IN (?, ?, ?);", &stmt) == CHIDB_OK);
+    ck_assert(uses_op(stmt, Op_SorterOpen));
+    for(int i = 0; i < 3; i++)
+        ck_assert(chidb_bind_int(stmt, i + 1, keys[i]) == CHIDB_OK);
+    check_key_list(stmt, rows, nrows, keys, 3, -1);
+    ck_assert(chidb_reset(stmt) == CHIDB_OK);
+    for(int i = 0; i < 3; i++)
+        ck_assert(chidb_bind_int(stmt, i + 1, keys[i + 5]) == CHIDB_OK);
+    check_key_list(stmt, rows, nrows, keys + 5, 3, -1);
+    ck_assert(chidb_finalize(stmt) == CHIDB_OK);
+
+    /* Not the primary key */
+    ck_assert(chidb_prepare(db, "SELECT code FROM numbers WHERE altcode IN (1, 2);", &stmt) == CHIDB_OK);
+    ck_assert(!uses_op(stmt, Op_SorterOpen));
+    ck_assert(chidb_finalize(stmt) == CHIDB_OK);
+
+    ck_assert(chidb_close(db) == CHIDB_OK);
+    delete_copy(fname);
+}
+END_TEST
+
+/* Checks the (id, bid) pairs returned by a join of the tables created in
+ * test_hash_join against the ones that should be there */
+static void check_join(chidb *db, const char *sql, int na, int nb, int min_y, bool hash)
+{
+    chidb_stmt *stmt;
+    bool seen[101][51] = {{false}};
+    int rc, n = 0, expected = 0;
+
+    ck_assert(chidb_prepare(db, sql, &stmt) == CHIDB_OK);
+    ck_assert(uses_hash_join(stmt) == hash);
+    ck_assert(uses_op(stmt, Op_HashFilter) == hash);
+
+    while((rc = chidb_step(stmt)) == CHIDB_ROW)
+    {
+        int id = chidb_column_int(stmt, 0), bid = chidb_column_int(stmt, 1);
+
+        ck_assert(id >= 1 && id <= na && bid >= 1 && bid <= nb);
+        ck_assert_msg(!seen[id][bid], "Row (%i, %i) returned twice", id, bid);
+        ck_assert_int_eq(id % 10, bid % 7);
+        ck_assert(bid >= min_y);
+        seen[id][bid] = true;
+        n++;
+    }
+    ck_assert_int_eq(rc, CHIDB_DONE);
+    ck_assert(chidb_finalize(stmt) == CHIDB_OK);
+
+    for(int id = 1; id <= na; id++)
+        for(int bid = min_y; bid <= nb; bid++)
+            expected += (id % 10 == bid % 7);
+    ck_assert_int_eq(n, expected);
+}
+
+START_TEST (test_hash_join)
+{
+    chidb *db;
+    char sql[128];
+
+    char *fname = create_tmp_file();
+    ck_assert(chidb_open(fname, &db) == CHIDB_OK);
+
+    exec_sql(db, "CREATE TABLE a(id INTEGER PRIMARY KEY, x INTEGER);");
+    exec_sql(db, "CREATE TABLE b(bid INTEGER PRIMARY KEY, x INTEGER, y INTEGER);");
+    for(int i = 1; i <= 3; i++)
+    {
+        sprintf(sql, "INSERT INTO a VALUES(%i, %i);", i, i % 10);
+        exec_sql(db, sql);
+        sprintf(sql, "INSERT INTO b VALUES(%i, %i, %i);", i, i % 7, i);
+        exec_sql(db, sql);
+    }
+
+    /* Small tables are joined with a nested loop */
+    check_join(db, "SELECT id, bid FROM a NATURAL JOIN b;", 3, 3, 1, false);
+
+    for(int i = 4; i <= 100; i++)
+    {
+        sprintf(sql, "INSERT INTO a VALUES(%i, %i);", i, i % 10);
+        exec_sql(db, sql);
+        if(i <= 50)
+        {
+            sprintf(sql, "INSERT INTO b VALUES(%i, %i, %i);", i, i % 7, i);
+            exec_sql(db, sql);
+        }
+    }
+
+    /* Larger ones with a hash join, whichever side the larger one is on */
+    check_join(db, "SELECT id, bid FROM a NATURAL JOIN b;", 100, 50, 1, true);
+    check_join(db, "SELECT id, bid FROM b NATURAL JOIN a;", 100, 50, 1, true);
+    check_join(db, "SELECT id, bid FROM a NATURAL JOIN b WHERE y >= 20;", 100, 50, 20, true);
+    check_join(db, "SELECT id, bid FROM b NATURAL JOIN a WHERE y >= 45;", 100, 50, 45, true);
+
+    ck_assert(chidb_close(db) == CHIDB_OK);
+    delete_tmp_file(fname);
+}
+END_TEST
+
+
+START_TEST (test_bloom)
+{
+    chidb_dbm_bloom_t b;
+    int found = 0;
+
+    ck_assert(chidb_dbm_bloom_init(&b, 1000) == CHIDB_OK);
+    for(uint32_t i = 0; i < 1000; i++)
+        chidb_dbm_bloom_add(&b, i * 2654435761u);
+
+    /* Keys that were added are always found... */
+    for(uint32_t i = 0; i < 1000; i++)
+        ck_assert(chidb_dbm_bloom_test(&b, i * 2654435761u));
+
+    /* ...and hardly any of those that were not */
+    for(uint32_t i = 1000; i < 11000; i++)
+        found += chidb_dbm_bloom_test(&b, i * 2654435761u);
+    ck_assert_msg(found < 100, "%i false positives in 10000", found);
+
+    chidb_dbm_bloom_free(&b);
+}
+END_TEST
+
+/* Checks the (did, cid, z) rows returned by a join of the tables created in
+ * test_index_join (c.code = 3 * cid, z = cid, and d.code = 4 * did, or
+ * 4000 + did for did > 20), and the opcode that tells how it was done */
+static void check_index_join(chidb *db, const char *sql, int min_z, opcode_t opcode)
+{
+    chidb_stmt *stmt;
+    bool seen[26] = {false};
+    int rc, n = 0, expected = 0;
+
+    ck_assert(chidb_prepare(db, sql, &stmt) == CHIDB_OK);
+    ck_assert(uses_op(stmt, opcode));
+    ck_assert(!uses_hash_join(stmt));
+
+    while((rc = chidb_step(stmt)) == CHIDB_ROW)
+    {
+        int did = chidb_column_int(stmt, 0), cid = chidb_column_int(stmt, 1);
+
+        ck_assert(did >= 1 && did <= 20);
+        ck_assert_msg(!seen[did], "Row for did %i returned twice", did);
+        ck_assert_int_eq(4 * did, 3 * cid);
+        ck_assert_int_eq(chidb_column_int(stmt, 2), cid);
+        ck_assert(cid >= min_z);
+        seen[did] = true;
+        n++;
+    }
+    ck_assert_int_eq(rc, CHIDB_DONE);
+    ck_assert(chidb_finalize(stmt) == CHIDB_OK);
+
+    for(int did = 1; did <= 20; did++)
+        expected += (did % 3 == 0 && 4 * did / 3 >= min_z);
+    ck_assert_int_eq(n, expected);
+}
+
+START_TEST (test_index_join)
+{
+    chidb *db;
+    chidb_stmt *stmt;
+    char sql[128];
+
+    char *fname = create_tmp_file();
+    ck_assert(chidb_open(fname, &db) == CHIDB_OK);
+
+    exec_sql(db, "CREATE TABLE c(cid INTEGER PRIMARY KEY, code INTEGER, z INTEGER);");
+    exec_sql(db, "CREATE TABLE d(did INTEGER PRIMARY KEY, code INTEGER);");
+    exec_sql(db, "CREATE TABLE e(code INTEGER PRIMARY KEY, z INTEGER);");
+    for(int i = 1; i <= 1000; i++)
+    {
+        sprintf(sql, "INSERT INTO c VALUES(%i, %i, %i);", i, 3 * i, i);
+        exec_sql(db, sql);
+        sprintf(sql, "INSERT INTO e VALUES(%i, %i);", 3 * i, i);
+        exec_sql(db, sql);
+    }
+    for(int i = 1; i <= 25; i++)
+    {
+        sprintf(sql, "INSERT INTO d VALUES(%i, %i);", i, i <= 20 ? 4 * i : 4000 + i);
+        exec_sql(db, sql);
+    }
+
+    /* Without an index, the tables are hashed */
+    ck_assert(chidb_prepare(db, "SELECT did, cid, z FROM d NATURAL JOIN c;", &stmt) == CHIDB_OK);
+    ck_assert(uses_hash_join(stmt));
+    ck_assert(chidb_finalize(stmt) == CHIDB_OK);
+
+    /* With one, the few rows of d are looked up in it */
+    exec_sql(db, "CREATE INDEX icode ON c(code);");
+    check_index_join(db, "SELECT did, cid, z FROM d NATURAL JOIN c;", 1, Op_IdxPKey);
+    check_index_join(db, "SELECT did, cid, z FROM c NATURAL JOIN d;", 1, Op_IdxPKey);
+    check_index_join(db, "SELECT did, cid, z FROM d NATURAL JOIN c WHERE z >= 12;", 12, Op_IdxPKey);
+    check_index_join(db, "SELECT did, cid, z FROM d NATURAL JOIN c WHERE did > 10;", 14, Op_IdxPKey);
+
+    /* Nothing but the primary key is needed from c, and icode has it */
+    ck_assert(chidb_prepare(db, "SELECT did, cid, cid FROM d NATURAL JOIN c WHERE cid >= 12;", &stmt) == CHIDB_OK);
+    ck_assert_int_eq(count_ops(stmt, Op_OpenRead), 2);
+    ck_assert(!uses_op(stmt, Op_Seek));
+    ck_assert(chidb_finalize(stmt) == CHIDB_OK);
+    check_index_join(db, "SELECT did, cid, cid FROM d NATURAL JOIN c WHERE cid >= 12;", 12, Op_IdxPKey);
+    check_index_join(db, "SELECT did, cid, cid FROM c NATURAL JOIN d;", 1, Op_IdxPKey);
+
+    /* The primary key of the inner table needs no index. e has the values
+     * of c, with z standing in for cid. */
+    check_index_join(db, "SELECT did, z, z FROM d NATURAL JOIN e;", 1, Op_Seek);
+    check_index_join(db, "SELECT did, z, z FROM e NATURAL JOIN d WHERE z >= 12;", 12, Op_Seek);
+
+    /* Several rows can have the same key in an index, but index names
+     * are unique */
+    exec_sql(db, "INSERT INTO d VALUES(26, 4);");
+    exec_sql(db, "CREATE INDEX idcode ON d(code);");
+    ck_assert(chidb_prepare(db, "SELECT did FROM d WHERE code = 4;", &stmt) == CHIDB_OK);
+    ck_assert(chidb_catalog_index(db, "idcode") != NULL);
+    ck_assert(uses_op(stmt, Op_IdxPKey));
+    ck_assert(chidb_step(stmt) == CHIDB_ROW);
+    ck_assert_int_eq(chidb_column_int(stmt, 0), 1);
+    ck_assert(chidb_step(stmt) == CHIDB_ROW);
+    ck_assert_int_eq(chidb_column_int(stmt, 0), 26);
+    ck_assert(chidb_step(stmt) == CHIDB_DONE);
+    ck_assert(chidb_finalize(stmt) == CHIDB_OK);
+    ck_assert(chidb_prepare(db, "CREATE INDEX icode ON d(did);", &stmt) == CHIDB_EINVALIDSQL);
+    ck_assert(chidb_prepare(db, "CREATE INDEX inone ON d(nothere);", &stmt) == CHIDB_EINVALIDSQL);
+
+    ck_assert(chidb_close(db) == CHIDB_OK);
+    delete_tmp_file(fname);
+}
+END_TEST
+
+
+/* Checks that the rows of a query come out ordered by column key, and by
+ * column 0 for rows with the same key if stable is true, and whether they
+ * were sorted by the DBM (with a sorter) or came out in order */
+static void check_order(chidb *db, const char *sql, int key, bool desc, bool stable,
+                        bool sorter, int nrows)
+{
+    chidb_stmt *stmt;
+    int rc, n = 0, last_key = 0, last_id = 0;
+
+    ck_assert(chidb_prepare(db, sql, &stmt) == CHIDB_OK);
+    ck_assert_msg(uses_op(stmt, Op_SorterOpen) == sorter, "%s: %s a sorter", sql, sorter ? "does not use" : "uses");
+
+    while((rc = chidb_step(stmt)) == CHIDB_ROW)
+    {
+        int id = chidb_column_int(stmt, 0), k = chidb_column_int(stmt, key);
+
+        if(n > 0)
+        {
+            ck_assert_msg(desc ? k <= last_key : k >= last_key, "%s: %i after %i", sql, k, last_key);
+            ck_assert_msg(!stable || k != last_key || id > last_id, "%s: %i after %i", sql, id, last_id);
+        }
+        last_key = k;
+        last_id = id;
+        n++;
+    }
+    ck_assert_int_eq(rc, CHIDB_DONE);
+    ck_assert_int_eq(n, nrows);
+    ck_assert(chidb_finalize(stmt) == CHIDB_OK);
+}
+
+START_TEST (test_order_by)
+{
+    chidb *db;
+    chidb_stmt *stmt;
+    char sql[128];
+    int rc, n = 0, last = 101;
+
+    char *fname = create_tmp_file();
+    ck_assert(chidb_open(fname, &db) == CHIDB_OK);
+
+    exec_sql(db, "CREATE TABLE s(id INTEGER PRIMARY KEY, g INTEGER, v INTEGER);");
+    exec_sql(db, "CREATE TABLE t(g INTEGER PRIMARY KEY, w INTEGER);");
+    for(int i = 1; i <= 2000; i++)
+    {
+        sprintf(sql, "INSERT INTO s VALUES(%i, %i, %i);", i, (i * 37) % 100 + 1, 2000 - i);
+        exec_sql(db, sql);
+    }
+    for(int i = 1; i <= 100; i++)
+    {
+        sprintf(sql, "INSERT INTO t VALUES(%i, %i);", i, (i * 13) % 100);
+        exec_sql(db, sql);
+    }
+
+    /* A budget this small spills a run every few rows, and merges them */
+    for(int budget = 4 * 1024 * 1024; budget > 0; budget = budget > 512 ? 512 : 0)
+    {
+        ck_assert(chidb_set_sort_budget(db, budget) == CHIDB_OK);
+
+        check_order(db, "SELECT id, g FROM s ORDER BY g;", 1, false, true, true, 2000);
+        check_order(db, "SELECT id, v FROM s ORDER BY v;", 1, false, true, true, 2000);
+        check_order(db, "SELECT id, g FROM s ORDER BY g DESC;", 1, true, true, true, 2000);
+        check_order(db, "SELECT id, g FROM s WHERE v < 1000 ORDER BY g;", 1, false, true, true, 1000);
+        check_order(db, "SELECT id, w FROM s NATURAL JOIN t ORDER BY w;", 1, false, false, true, 2000);
+    }
+    ck_assert(chidb_set_sort_budget(db, 0) == CHIDB_EMISUSE);
+
+    /* A column rows are ordered by does not have to be selected */
+    ck_assert(chidb_prepare(db, "SELECT id FROM s ORDER BY g DESC;", &stmt) == CHIDB_OK);
+    ck_assert_int_eq(chidb_column_count(stmt), 1);
+    while((rc = chidb_step(stmt)) == CHIDB_ROW)
+    {
+        int g = (chidb_column_int(stmt, 0) * 37) % 100 + 1;
+        ck_assert(g <= last);
+        last = g;
+        n++;
+    }
+    ck_assert_int_eq(rc, CHIDB_DONE);
+    ck_assert_int_eq(n, 2000);
+    ck_assert(chidb_finalize(stmt) == CHIDB_OK);
+
+    /* Rows read in primary key order, or from an index on the column, are
+     * not sorted again */
+    check_order(db, "SELECT id, g FROM s ORDER BY id;", 0, false, false, false, 2000);
+    check_order(db, "SELECT id, g FROM s WHERE id > 1500 ORDER BY id;", 0, false, false, false, 500);
+    check_order(db, "SELECT id, g FROM s WHERE g <= 50 ORDER BY id;", 0, false, false, false, 1000);
+    check_order(db, "SELECT id FROM s ORDER BY id DESC;", 0, true, false, true, 2000);
+    exec_sql(db, "CREATE INDEX iv ON s(v);");
+    check_order(db, "SELECT id, v FROM s WHERE v < 100 ORDER BY v;", 1, false, false, false, 100);
+    check_order(db, "SELECT g, v FROM s WHERE v >= 1900 ORDER BY v;", 1, false, false, false, 100);
+    check_order(db, "SELECT id, g, v FROM s WHERE v < 10 ORDER BY g;", 1, false, false, true, 10);
+
+    /* A statement can be finalized or reset before all the sorted rows are
+     * read */
+    ck_assert(chidb_set_sort_budget(db, 512) == CHIDB_OK);
+    ck_assert(chidb_prepare(db, "SELECT id, g FROM s ORDER BY v;", &stmt) == CHIDB_OK);
+    for(int i = 0; i < 2; i++)
+    {
+        ck_assert(chidb_step(stmt) == CHIDB_ROW);
+        ck_assert_int_eq(chidb_column_int(stmt, 0), 2000);
+        ck_assert(chidb_reset(stmt) == CHIDB_OK);
+    }
+    ck_assert(chidb_finalize(stmt) == CHIDB_OK);
+
+    ck_assert(chidb_close(db) == CHIDB_OK);
+    delete_tmp_file(fname);
+}
+END_TEST
+
+START_TEST (test_aggregates)
+{
+    chidb *db;
+    chidb_stmt *stmt;
+    char sql[128];
+    int rc, n = 0;
+
+    char *fname = create_tmp_file();
+    ck_assert(chidb_open(fname, &db) == CHIDB_OK);
+
+    exec_sql(db, "CREATE TABLE s(id INTEGER PRIMARY KEY, g INTEGER, v INTEGER);");
+    exec_sql(db, "CREATE TABLE t(g INTEGER PRIMARY KEY, w INTEGER);");
+    for(int i = 1; i <= 2000; i++)
+    {
+        sprintf(sql, "INSERT INTO s VALUES(%i, %i, %i);", i, (i * 37) % 100 + 1, 2000 - i);
+        exec_sql(db, sql);
+    }
+    for(int i = 1; i <= 100; i++)
+    {
+        sprintf(sql, "INSERT INTO t VALUES(%i, %i);", i, (i * 13) % 100);
+        exec_sql(db, sql);
+    }
+
+    /* COUNT(*) of a whole table only counts the cells of the leaves */
+    ck_assert(chidb_prepare(db, "SELECT COUNT(*), COUNT(*) AS n FROM s;", &stmt) == CHIDB_OK);
+    ck_assert(uses_op(stmt, Op_Count));
+    ck_assert(!uses_op(stmt, Op_Column));
+    ck_assert_str_eq(chidb_column_name(stmt, 0), "COUNT(*)");
+    ck_assert_str_eq(chidb_column_name(stmt, 1), "n");
+    ck_assert(chidb_step(stmt) == CHIDB_ROW);
+    ck_assert_int_eq(chidb_column_int(stmt, 0), 2000);
+    ck_assert_int_eq(chidb_column_int(stmt, 1), 2000);
+    ck_assert(chidb_step(stmt) == CHIDB_DONE);
+    ck_assert(chidb_finalize(stmt) == CHIDB_OK);
+
+    /* Without GROUP BY, there is one row, even if no row matches */
+    ck_assert(chidb_prepare(db, "SELECT COUNT(*), SUM(v), MIN(id), MAX(id), AVG(v) FROM s WHERE id <= 100;",
+                            &stmt) == CHIDB_OK);
+    ck_assert(!uses_op(stmt, Op_Count));
+    ck_assert(chidb_step(stmt) == CHIDB_ROW);
+    ck_assert_int_eq(chidb_column_int(stmt, 0), 100);
+    ck_assert_int_eq(chidb_column_int(stmt, 1), 194950);
+    ck_assert_int_eq(chidb_column_int(stmt, 2), 1);
+    ck_assert_int_eq(chidb_column_int(stmt, 3), 100);
+    ck_assert_int_eq(chidb_column_int(stmt, 4), 1949);
+    ck_assert(chidb_step(stmt) == CHIDB_DONE);
+    ck_assert(chidb_finalize(stmt) == CHIDB_OK);
+
+    ck_assert(chidb_prepare(db, "SELECT COUNT(v), SUM(v) FROM s WHERE id > 5000;", &stmt) == CHIDB_OK);
+    ck_assert(chidb_step(stmt) == CHIDB_ROW);
+    ck_assert_int_eq(chidb_column_int(stmt, 0), 0);
+    ck_assert_int_eq(chidb_column_type(stmt, 1), SQL_NULL);
+    ck_assert(chidb_step(stmt) == CHIDB_DONE);
+    ck_assert(chidb_finalize(stmt) == CHIDB_OK);
+
+    /* Each group has 20 rows: i, i + 100, ..., where (i * 37) % 100 + 1 is
+     * the group */
+    ck_assert(chidb_prepare(db, "SELECT g, COUNT(*), SUM(v), MIN(id), MAX(id), AVG(v) FROM s GROUP BY g ORDER BY g;",
+                            &stmt) == CHIDB_OK);
+    ck_assert(uses_op(stmt, Op_HashGroup));
+    while((rc = chidb_step(stmt)) == CHIDB_ROW)
+    {
+        int g = chidb_column_int(stmt, 0), first = chidb_column_int(stmt, 3);
+
+        ck_assert_int_eq(g, n + 1);
+        ck_assert_int_eq((first * 37) % 100 + 1, g);
+        ck_assert(first <= 100);
+        ck_assert_int_eq(chidb_column_int(stmt, 1), 20);
+        ck_assert_int_eq(chidb_column_int(stmt, 2), 20 * (2000 - first) - 100 * 190);
+        ck_assert_int_eq(chidb_column_int(stmt, 4), first + 1900);
+        ck_assert_int_eq(chidb_column_int(stmt, 5), 2000 - first - 950);
+        n++;
+    }
+    ck_assert_int_eq(rc, CHIDB_DONE);
+    ck_assert_int_eq(n, 100);
+    ck_assert(chidb_finalize(stmt) == CHIDB_OK);
+
+    /* Groups of the rows that match, and of a join */
+    check_order(db, "SELECT COUNT(*) AS n, g FROM s WHERE v < 1000 GROUP BY g ORDER BY n;", 0, false, false, true, 100);
+    check_order(db, "SELECT w, COUNT(*) FROM s NATURAL JOIN t GROUP BY w ORDER BY w DESC;", 0, true, false, true, 100);
+    check_order(db, "SELECT g FROM s WHERE id > 1990 GROUP BY g ORDER BY g;", 0, false, false, true, 10);
+
+    /* A selected column must be grouped by, or aggregated, and the rows can
+     * only be ordered by one of the selected columns */
+    ck_assert(chidb_prepare(db, "SELECT id, COUNT(*) FROM s;", &stmt) == CHIDB_EINVALIDSQL);
+    ck_assert(chidb_prepare(db, "SELECT id FROM s GROUP BY g;", &stmt) == CHIDB_EINVALIDSQL);
+    ck_assert(chidb_prepare(db, "SELECT SUM(*) FROM s;", &stmt) == CHIDB_EINVALIDSQL);
+    ck_assert(chidb_prepare(db, "SELECT g, COUNT(*) FROM s GROUP BY g ORDER BY v;", &stmt) == CHIDB_EINVALIDSQL);
+
+    ck_assert(chidb_close(db) == CHIDB_OK);
+    delete_tmp_file(fname);
+}
+END_TEST
+
+/* Checks that a query returns the rows of s with ids first, first + 1, ...,
+ * and how many */
+static void check_limit(chidb *db, const char *sql, int first, int nrows, opcode_t opcode, bool used)
+{
+    chidb_stmt *stmt;
+    int rc, n = 0;
+
+    ck_assert(chidb_prepare(db, sql, &stmt) == CHIDB_OK);
+    ck_assert_msg(uses_op(stmt, opcode) == used, "%s: %s %s", sql, used ? "does not use" : "uses", opcode_to_str(opcode));
+    while((rc = chidb_step(stmt)) == CHIDB_ROW)
+    {
+        ck_assert_int_eq(chidb_column_int(stmt, 0), first + n);
+        n++;
+    }
+    ck_assert_int_eq(rc, CHIDB_DONE);
+    ck_assert_int_eq(n, nrows);
+    ck_assert(chidb_finalize(stmt) == CHIDB_OK);
+}
+
+START_TEST (test_limit)
+{
+    chidb *db;
+    chidb_stmt *stmt;
+    char sql[128];
+
+    char *fname = create_tmp_file();
+    ck_assert(chidb_open(fname, &db) == CHIDB_OK);
+
+    exec_sql(db, "CREATE TABLE s(id INTEGER PRIMARY KEY, g INTEGER, v INTEGER);");
+    for(int i = 1; i <= 2000; i++)
+    {
+        sprintf(sql, "INSERT INTO s VALUES(%i, %i, %i);", i, (i * 37) % 100 + 1, 2000 - i);
+        exec_sql(db, sql);
+    }
+
+    /* A scan of the whole table skips the offset with the cursor */
+    check_limit(db, "SELECT id FROM s LIMIT 10;", 1, 10, Op_DecrJumpZero, true);
+    check_limit(db, "SELECT id, g FROM s LIMIT 10 OFFSET 1500;", 1501, 10, Op_Skip, true);
+    check_limit(db, "select id from s limit 10 offset 1995;", 1996, 5, Op_Skip, true);
+    check_limit(db, "SELECT id FROM s LIMIT 10 OFFSET 5000;", 1, 0, Op_Skip, true);
+    check_limit(db, "SELECT id FROM s ORDER BY id LIMIT 3 OFFSET 7;", 8, 3, Op_Skip, true);
+    check_limit(db, "SELECT id FROM s LIMIT 0;", 1, 0, Op_Rewind, false);
+
+    /* Otherwise, the rows that are left out are still counted down */
+    check_limit(db, "SELECT id FROM s WHERE id > 1000 LIMIT 10 OFFSET 20;", 1021, 10, Op_Skip, false);
+    check_limit(db, "SELECT id FROM s WHERE g > 0 LIMIT 10 OFFSET 20;", 21, 10, Op_IfPos, true);
+    check_limit(db, "SELECT v FROM s ORDER BY v LIMIT 5 OFFSET 10;", 10, 5, Op_IfPos, true);
+    check_limit(db, "SELECT g FROM s GROUP BY g ORDER BY g LIMIT 5 OFFSET 95;", 96, 5, Op_HashGroup, true);
+    check_limit(db, "SELECT COUNT(*) FROM s LIMIT 1 OFFSET 1;", 2000, 0, Op_Count, true);
+
+    /* With a small LIMIT, the sorter only keeps the rows that are returned.
+     * Rows with the same key still come out in the order they were found,
+     * and none are spilled, however small the budget. */
+    ck_assert(chidb_set_sort_budget(db, 512) == CHIDB_OK);
+    check_limit(db, "SELECT v FROM s ORDER BY v LIMIT 5 OFFSET 10;", 10, 5, Op_SorterLimit, true);
+    check_order(db, "SELECT id, g FROM s ORDER BY g LIMIT 50;", 1, false, true, true, 50);
+    check_order(db, "SELECT id, g FROM s ORDER BY g DESC LIMIT 30 OFFSET 5;", 1, true, true, true, 30);
+    check_order(db, "SELECT id, g FROM s WHERE v > 100 ORDER BY g LIMIT 1000;", 1, false, true, true, 1000);
+    ck_assert(chidb_prepare(db, "SELECT id, g FROM s ORDER BY g DESC LIMIT 25;", &stmt) == CHIDB_OK);
+    ck_assert(uses_op(stmt, Op_SorterLimit));
+    for(int i = 0; i < 25; i++)
+    {
+        /* g is 100 for the ids 27, 127, ..., 1927, and 99 for 54, 154, ... */
+        ck_assert(chidb_step(stmt) == CHIDB_ROW);
+        ck_assert_int_eq(chidb_column_int(stmt, 0), i < 20 ? 27 + 100 * i : 54 + 100 * (i - 20));
+        ck_assert_int_eq(chidb_column_int(stmt, 1), i < 20 ? 100 : 99);
+    }
+    for(uint32_t i = 0; i < stmt->endOp; i++)
+        if(stmt->ops[i].opcode == Op_SorterOpen)
+        {
+            ck_assert_int_eq(stmt->cursors[stmt->ops[i].p1].sorter->nrows, 25);
+            ck_assert_int_eq(stmt->cursors[stmt->ops[i].p1].sorter->nruns, 0);
+        }
+    ck_assert(chidb_finalize(stmt) == CHIDB_OK);
+
+    /* Larger limits sort all the rows */
+    check_order(db, "SELECT id, g FROM s ORDER BY g LIMIT 1500;", 1, false, true, true, 1500);
+    ck_assert(chidb_prepare(db, "SELECT id, g FROM s ORDER BY g LIMIT 999 OFFSET 2;", &stmt) == CHIDB_OK);
+    ck_assert(!uses_op(stmt, Op_SorterLimit));
+    ck_assert(chidb_finalize(stmt) == CHIDB_OK);
+
+    /* Only SELECT has a LIMIT, and its values are numbers */
+    ck_assert(chidb_prepare(db, "SELECT id FROM s LIMIT n;", &stmt) == CHIDB_EINVALIDSQL);
+    ck_assert(chidb_prepare(db, "SELECT id FROM s LIMIT 5 OFFSET;", &stmt) == CHIDB_EINVALIDSQL);
+    ck_assert(chidb_prepare(db, "INSERT INTO s VALUES(3000, 1, 1) LIMIT 1;", &stmt) == CHIDB_EINVALIDSQL);
+
+    ck_assert(chidb_close(db) == CHIDB_OK);
+    delete_tmp_file(fname);
+}
+END_TEST
+
+
+/* Counts the rows of a query, and checks whether it used an instruction */
+static int count_rows(chidb *db, const char *sql, opcode_t opcode, bool used)
+{
+    chidb_stmt *stmt;
+    int rc, n = 0;
+
+    ck_assert(chidb_prepare(db, sql, &stmt) == CHIDB_OK);
+    ck_assert_msg(uses_op(stmt, opcode) == used, "%s: %s %s", sql, used ? "does not use" : "uses", opcode_to_str(opcode));
+    while((rc = chidb_step(stmt)) == CHIDB_ROW)
+        n++;
+    ck_assert_int_eq(rc, CHIDB_DONE);
+    ck_assert(chidb_finalize(stmt) == CHIDB_OK);
+
+    return n;
+}
+
+/* Checks that SELECT id, v FROM s returns the ids first..last, with v = 2 * id */
+static void check_inserted(chidb *db, int first, int last)
+{
+    chidb_stmt *stmt;
+    int rc, n = 0;
+
+    ck_assert(chidb_prepare(db, "SELECT id, v FROM s;", &stmt) == CHIDB_OK);
+    while((rc = chidb_step(stmt)) == CHIDB_ROW)
+    {
+        ck_assert_int_eq(chidb_column_int(stmt, 0), first + n);
+        ck_assert_int_eq(chidb_column_int(stmt, 1), 2 * (first + n));
+        n++;
+    }
+    ck_assert_int_eq(rc, CHIDB_DONE);
+    ck_assert_int_eq(n, last - first + 1);
+    ck_assert(chidb_finalize(stmt) == CHIDB_OK);
+}
+
+START_TEST (test_insert_batch)
+{
+    chidb *db;
+    chidb_stmt *stmt;
+    char *sql, row[32];
+    const char *rows[3000];
+    int len;
+
+    char *fname = create_tmp_file();
+    ck_assert(chidb_open(fname, &db) == CHIDB_OK);
+
+    exec_sql(db, "CREATE TABLE s(id INTEGER PRIMARY KEY, v INTEGER);");
+
+    /* One statement with enough tuples to split the leaves several times */
+    sql = malloc(600 * 32);
+    len = sprintf(sql, "INSERT INTO s VALUES");
+    for(int i = 1; i <= 600; i++)
+        len += sprintf(sql + len, "%s(%i, %i)", i > 1 ? ", " : " ", i, 2 * i);
+    sprintf(sql + len, ";");
+    ck_assert(chidb_prepare(db, sql, &stmt) == CHIDB_OK);
+    ck_assert_int_eq(count_ops(stmt, Op_OpenWrite), 1);
+    ck_assert_int_eq(count_ops(stmt, Op_Insert), 600);
+    ck_assert(chidb_step(stmt) == CHIDB_DONE);
+    ck_assert(chidb_finalize(stmt) == CHIDB_OK);
+    free(sql);
+    check_inserted(db, 1, 600);
+
+    /* Parameters are numbered across the tuples */
+    ck_assert(chidb_prepare(db, "INSERT INTO s VALUES (?, ?), (?, ?);", &stmt) == CHIDB_OK);
+    for(int i = 0; i < 4; i++)
+        ck_assert(chidb_bind_int(stmt, i + 1, i % 2 ? 1202 + 2 * (i / 2) : 601 + i / 2) == CHIDB_OK);
+    ck_assert(chidb_step(stmt) == CHIDB_DONE);
+    ck_assert(chidb_finalize(stmt) == CHIDB_OK);
+    check_inserted(db, 1, 602);
+
+    /* Malformed tuples, and tuples that do not match the table */
+    ck_assert(chidb_prepare(db, "INSERT INTO s VALUES (700, 1400), ;", &stmt) != CHIDB_OK);
+    ck_assert(chidb_prepare(db, "INSERT INTO s VALUES (700, 1400), (701, 1402", &stmt) != CHIDB_OK);
+    ck_assert(chidb_prepare(db, "INSERT INTO s VALUES (700, 1400), (701);", &stmt) != CHIDB_OK);
+    ck_assert(chidb_prepare(db, "INSERT INTO s VALUES (700, 1400), (701, 1402) LIMIT 1;", &stmt) != CHIDB_OK);
+
+    /* A key that is already there stops the insert, and the tuples before
+     * it are taken out again */
+    ck_assert(chidb_prepare(db, "INSERT INTO s VALUES (603, 1206), (5, 10), (604, 1208);", &stmt) == CHIDB_OK);
+    ck_assert(chidb_step(stmt) == CHIDB_ECONSTRAINT);
+    ck_assert(chidb_finalize(stmt) == CHIDB_OK);
+    check_inserted(db, 1, 602);
+
+    /* Inside a transaction, they stay until the transaction is rolled back */
+    exec_sql(db, "BEGIN;");
+    ck_assert(chidb_prepare(db, "INSERT INTO s VALUES (603, 1206), (5, 10), (604, 1208);", &stmt) == CHIDB_OK);
+    ck_assert(chidb_step(stmt) == CHIDB_ECONSTRAINT);
+    ck_assert(chidb_finalize(stmt) == CHIDB_OK);
+    check_inserted(db, 1, 603);
+    exec_sql(db, "ROLLBACK;");
+    check_inserted(db, 1, 602);
+    exec_sql(db, "INSERT INTO s VALUES (603, 1206);");
+    check_inserted(db, 1, 603);
+
+    /* Rows in key order through the API, then rows in the middle of the table */
+    for(int i = 0; i < 3000; i++)
+    {
+        sprintf(row, "%i|%i", 604 + i, 2 * (604 + i));
+        rows[i] = strdup(row);
+    }
+    ck_assert(chidb_insert_rows(db, "s", rows, 2000) == CHIDB_OK);
+    check_inserted(db, 1, 2603);
+    ck_assert(chidb_insert_rows(db, "s", rows + 2500, 500) == CHIDB_OK);
+    ck_assert(chidb_insert_rows(db, "s", rows + 2000, 500) == CHIDB_OK);
+    check_inserted(db, 1, 3603);
+
+    ck_assert(chidb_insert_rows(db, "s", rows, 1) == CHIDB_ECONSTRAINT);
+    rows[0] = "5000|1|2";
+    ck_assert(chidb_insert_rows(db, "s", rows, 1) == CHIDB_EMISMATCH);
+    ck_assert(chidb_insert_rows(db, "t", rows, 1) == CHIDB_EINVALIDSQL);
+    check_inserted(db, 1, 3603);
+
+    for(int i = 1; i < 3000; i++)
+        free((char *) rows[i]);
+
+    /* Everything must still be there after reopening the file */
+    ck_assert(chidb_close(db) == CHIDB_OK);
+    ck_assert(chidb_open(fname, &db) == CHIDB_OK);
+    check_inserted(db, 1, 3603);
+
+    ck_assert(chidb_close(db) == CHIDB_OK);
+    delete_tmp_file(fname);
+}
+END_TEST
+
+/* Runs a statement, and returns what its first step returned */
+static int step_sql(chidb *db, const char *sql)
+{
+    chidb_stmt *stmt;
+    int rc;
+
+    ck_assert(chidb_prepare(db, sql, &stmt) == CHIDB_OK);
+    rc = chidb_step(stmt);
+    ck_assert(chidb_finalize(stmt) == CHIDB_OK);
+
+    return rc;
+}
+
+/* A negative literal is a value, not a ? parameter, and the key of a
+ * row must be an integer, whatever its parameter is bound to */
+START_TEST (test_insert_params)
+{
+    chidb *db;
+    chidb_stmt *stmt;
+
+    char *fname = create_tmp_file();
+    ck_assert(chidb_open(fname, &db) == CHIDB_OK);
+    exec_sql(db, "CREATE TABLE t(id INTEGER PRIMARY KEY, a INTEGER, b INTEGER);");
+    exec_sql(db, "INSERT INTO t VALUES (1, -1, 5);");
+    exec_sql(db, "INSERT INTO t VALUES (2, 7, -1), (-1, 3, 3);");
+
+    ck_assert(chidb_prepare(db, "SELECT id, a, b FROM t WHERE a = -1;", &stmt) == CHIDB_OK);
+    ck_assert(chidb_step(stmt) == CHIDB_ROW);
+    ck_assert_int_eq(chidb_column_int(stmt, 0), 1);
+    ck_assert_int_eq(chidb_column_int(stmt, 1), -1);
+    ck_assert_int_eq(chidb_column_int(stmt, 2), 5);
+    ck_assert(chidb_step(stmt) == CHIDB_DONE);
+    ck_assert(chidb_finalize(stmt) == CHIDB_OK);
+
+    ck_assert(chidb_prepare(db, "SELECT a FROM t WHERE id = -1;", &stmt) == CHIDB_OK);
+    ck_assert(chidb_step(stmt) == CHIDB_ROW);
+    ck_assert_int_eq(chidb_column_int(stmt, 0), 3);
+    ck_assert(chidb_step(stmt) == CHIDB_DONE);
+    ck_assert(chidb_finalize(stmt) == CHIDB_OK);
+    ck_assert_int_eq(count_rows(db, "SELECT id FROM t WHERE b = -1;", Op_OpenRead, true), 1);
+
+    /* A key parameter that is not bound, or is bound to text */
+    ck_assert(chidb_prepare(db, "INSERT INTO t VALUES (?, 4, 4);", &stmt) == CHIDB_OK);
+    ck_assert(chidb_step(stmt) == CHIDB_EMISMATCH);
+    ck_assert(chidb_reset(stmt) == CHIDB_OK);
+    ck_assert(chidb_bind_text(stmt, 1, "10") == CHIDB_OK);
+    ck_assert(chidb_step(stmt) == CHIDB_EMISMATCH);
+    ck_assert(chidb_reset(stmt) == CHIDB_OK);
+    ck_assert(chidb_bind_int(stmt, 1, 10) == CHIDB_OK);
+    ck_assert(chidb_step(stmt) == CHIDB_DONE);
+    ck_assert(chidb_finalize(stmt) == CHIDB_OK);
+    ck_assert_int_eq(count_rows(db, "SELECT id FROM t;", Op_OpenRead, true), 4);
+
+    ck_assert(chidb_close(db) == CHIDB_OK);
+    delete_tmp_file(fname);
+}
+END_TEST
+
+START_TEST (test_attach)
+{
+    chidb *db;
+    chidb_stmt *stmt;
+    char sql[128];
+
+    /* The attached database has a table large enough to be scanned in
+     * parallel, and an index */
+    char *aname = create_tmp_file();
+    ck_assert(chidb_open(aname, &db) == CHIDB_OK);
+    exec_sql(db, "CREATE TABLE u(id INTEGER PRIMARY KEY, y INTEGER, z INTEGER);");
+    exec_sql(db, "CREATE INDEX uy ON u(y);");
+    exec_sql(db, "BEGIN;");
+    for(int i = 1; i <= 2000; i++)
+    {
+        sprintf(sql, "INSERT INTO u VALUES(%i, %i, %i);", i, i * 10, i % 100);
+        exec_sql(db, sql);
+    }
+    exec_sql(db, "COMMIT;");
+    ck_assert(chidb_close(db) == CHIDB_OK);
+
+    char *fname = create_tmp_file();
+    ck_assert(chidb_open(fname, &db) == CHIDB_OK);
+    exec_sql(db, "CREATE TABLE t(id INTEGER PRIMARY KEY, x INTEGER);");
+    for(int i = 1; i <= 5; i++)
+    {
+        sprintf(sql, "INSERT INTO t VALUES(%i, %i);", i, i);
+        exec_sql(db, sql);
+    }
+    sprintf(sql, "ATTACH DATABASE '%s' AS aux;", aname);
+    exec_sql(db, sql);
+    ck_assert_int_eq(db->nattached, 1);
+    ck_assert(chidb_set_scan_threads(db, 4) == CHIDB_OK);
+
+    /* Tables are qualified with the name they were attached as */
+    ck_assert_int_eq(count_rows(db, "SELECT id FROM aux.u WHERE y > 19900;", Op_OpenRead, true), 10);
+    ck_assert_int_eq(count_rows(db, "SELECT id FROM aux.u WHERE z = 7;", Op_OpenRead, true), 20);
+    ck_assert(chidb_prepare(db, "SELECT id FROM aux.u WHERE z = 7;", &stmt) == CHIDB_OK);
+    ck_assert(chidb_step(stmt) == CHIDB_ROW);
+    ck_assert(stmt->scan != NULL);
+    ck_assert(chidb_finalize(stmt) == CHIDB_OK);
+    ck_assert_int_eq(count_rows(db, "SELECT * FROM AUX.u;", Op_OpenRead, true), 2000);
+    ck_assert_int_eq(count_rows(db, "SELECT x, y FROM t NATURAL JOIN aux.u;", Op_OpenRead, true), 5);
+    ck_assert_int_eq(count_rows(db, "SELECT * FROM main.t;", Op_OpenRead, true), 5);
+
+    /* Columns of an attached table are qualified with or without the
+     * schema, also when it is joined with a table of main by equating
+     * the columns they have in common */
+    ck_assert_int_eq(count_rows(db, "SELECT * FROM t, aux.u WHERE t.id = aux.u.id;", Op_OpenRead, true), 5);
+    ck_assert_int_eq(count_rows(db, "SELECT * FROM t, aux.u WHERE t.id = u.id;", Op_OpenRead, true), 5);
+    ck_assert_int_eq(count_rows(db, "SELECT t.x, u.y FROM main.t, aux.u WHERE u.y > 20 AND u.id = t.id AND t.x < 5;",
+                                Op_OpenRead, true), 2);
+    ck_assert(chidb_prepare(db, "SELECT t.x, aux.u.z FROM t NATURAL JOIN aux.u WHERE aux.u.y >= 40;", &stmt) == CHIDB_OK);
+    for(int i = 4; i <= 5; i++)
+    {
+        ck_assert(chidb_step(stmt) == CHIDB_ROW);
+        ck_assert_int_eq(chidb_column_int(stmt, 0), i);
+        ck_assert_int_eq(chidb_column_int(stmt, 1), i);
+    }
+    ck_assert(chidb_step(stmt) == CHIDB_DONE);
+    ck_assert(chidb_finalize(stmt) == CHIDB_OK);
+    ck_assert(chidb_prepare(db, "SELECT * FROM t, aux.u WHERE t.x = u.y;", &stmt) == CHIDB_EINVALIDSQL);
+
+    ck_assert(chidb_prepare(db, "SELECT aux.u.id FROM aux.u WHERE aux.u.y = 500;", &stmt) == CHIDB_OK);
+    for(uint32_t i = 0; i < stmt->endOp; i++)
+        if(stmt->ops[i].opcode == Op_OpenRead)
+            ck_assert_str_eq(stmt->ops[i].p4, "aux");
+    ck_assert(chidb_step(stmt) == CHIDB_ROW);
+    ck_assert_int_eq(chidb_column_int(stmt, 0), 50);
+    ck_assert(chidb_step(stmt) == CHIDB_DONE);
+    ck_assert(chidb_finalize(stmt) == CHIDB_OK);
+
+    /* Attached databases are only read from */
+    ck_assert(chidb_prepare(db, "INSERT INTO aux.u VALUES(3000, 1, 1);", &stmt) == CHIDB_EINVALIDSQL);
+    ck_assert(chidb_prepare(db, "CREATE TABLE aux.v(a INTEGER PRIMARY KEY);", &stmt) == CHIDB_EINVALIDSQL);
+    ck_assert(chidb_prepare(db, "DELETE FROM aux.u WHERE id = 1;", &stmt) == CHIDB_EINVALIDSQL);
+
+    /* Names are unique, and have to look like table names */
+    ck_assert_int_eq(step_sql(db, sql), CHIDB_EMISUSE);
+    sprintf(sql, "ATTACH '%s' AS main;", aname);
+    ck_assert_int_eq(step_sql(db, sql), CHIDB_EMISUSE);
+    sprintf(sql, "ATTACH '%s' AS a__b;", aname);
+    ck_assert(chidb_prepare(db, sql, &stmt) == CHIDB_EINVALIDSQL);
+    ck_assert(chidb_prepare(db, "DETACH aux extra;", &stmt) == CHIDB_EINVALIDSQL);
+
+    /* A database can't be detached while it is being read */
+    ck_assert(chidb_prepare(db, "SELECT * FROM aux.u;", &stmt) == CHIDB_OK);
+    ck_assert(chidb_step(stmt) == CHIDB_ROW);
+    ck_assert_int_eq(step_sql(db, "DETACH aux;"), CHIDB_EMISUSE);
+    ck_assert(chidb_finalize(stmt) == CHIDB_OK);
+    ck_assert_int_eq(step_sql(db, "DETACH DATABASE aux;"), CHIDB_DONE);
+    ck_assert_int_eq(db->nattached, 0);
+    ck_assert(chidb_prepare(db, "SELECT * FROM aux.u;", &stmt) == CHIDB_EINVALIDSQL);
+    ck_assert_int_eq(step_sql(db, "DETACH aux;"), CHIDB_EMISUSE);
+
+    /* Closing the database closes the ones attached to it */
+    sprintf(sql, "ATTACH '%s' AS aux;", aname);
+    exec_sql(db, sql);
+    ck_assert(chidb_close(db) == CHIDB_OK);
+
+    delete_tmp_file(fname);
+    delete_tmp_file(aname);
+}
+END_TEST
+
+START_TEST (test_import)
+{
+    chidb *db;
+    chidb_stmt *stmt;
+    FILE *f;
+
+    char *fname = create_tmp_file();
+    char *csv = create_tmp_file();
+    ck_assert(chidb_open(fname, &db) == CHIDB_OK);
+    exec_sql(db, "CREATE TABLE s(id INTEGER PRIMARY KEY, t TEXT, v INTEGER);");
+    exec_sql(db, "CREATE INDEX iv ON s(v);");
+
+    /* Quoted values, NULLs, and rows out of key order */
+    ck_assert((f = fopen(csv, "w")) != NULL);
+    for(int i = 1; i <= 1000; i++)
+        fprintf(f, "%i,text %i,%i\n", i, i, 2 * i);
+    fprintf(f, "2000,\"a, \"\"quoted\"\" text\",\r\n");
+    fprintf(f, "1500,,3000\n\n");
+    fprintf(f, "1600,\"\",3200\n");
+    fclose(f);
+    ck_assert(chidb_import(db, "s", csv, ',') == CHIDB_OK);
+    ck_assert_int_eq(count_rows(db, "SELECT id FROM s;", Op_IdxPKey, false), 1003);
+    ck_assert_int_eq(count_rows(db, "SELECT id FROM s WHERE v > 1900;", Op_IdxPKey, true), 52);
+
+    ck_assert(chidb_prepare(db, "SELECT t, v FROM s WHERE id >= 1500;", &stmt) == CHIDB_OK);
+    ck_assert(chidb_step(stmt) == CHIDB_ROW);
+    ck_assert_int_eq(chidb_column_type(stmt, 0), SQL_NULL);
+    ck_assert(chidb_step(stmt) == CHIDB_ROW);
+    ck_assert_str_eq(chidb_column_text(stmt, 0), "");
+    ck_assert(chidb_step(stmt) == CHIDB_ROW);
+    ck_assert_str_eq(chidb_column_text(stmt, 0), "a, \"quoted\" text");
+    ck_assert_int_eq(chidb_column_type(stmt, 1), SQL_NULL);
+    ck_assert(chidb_step(stmt) == CHIDB_DONE);
+    ck_assert(chidb_finalize(stmt) == CHIDB_OK);
+
+    /* Rows that do not fit the table stop the import */
+    ck_assert(chidb_import(db, "s", csv, ',') == CHIDB_ECONSTRAINT);
+    ck_assert((f = fopen(csv, "w")) != NULL);
+    fprintf(f, "3000\tx\t6000\n3001\ty\n");
+    fclose(f);
+    ck_assert(chidb_import(db, "s", csv, ',') == CHIDB_EMISMATCH);
+    ck_assert(chidb_import(db, "s", csv, '\t') == CHIDB_EMISMATCH);
+    ck_assert_int_eq(count_rows(db, "SELECT id FROM s WHERE v = 6000;", Op_IdxPKey, true), 1);
+    ck_assert(chidb_import(db, "t", csv, '\t') == CHIDB_EINVALIDSQL);
+    ck_assert(chidb_import(db, "s", "/nonexistent/file.csv", ',') == CHIDB_ECANTOPEN);
+    ck_assert(chidb_import(db, "s", csv, '"') == CHIDB_EMISUSE);
+
+    ck_assert(chidb_close(db) == CHIDB_OK);
+    delete_tmp_file(fname);
+    delete_tmp_file(csv);
+}
+END_TEST
+
+START_TEST (test_wide_keys)
+{
+    chidb *db;
+    chidb_stmt *stmt;
+    int64_t base = (int64_t) 1 << 40;
+    const char *rows[1];
+    int n = 0;
+
+    char *fname = create_tmp_file();
+    ck_assert(chidb_open(fname, &db) == CHIDB_OK);
+
+    exec_sql(db, "CREATE TABLE w(id INTEGER PRIMARY KEY, v INTEGER);");
+
+    /* Keys and values that do not fit in 32 bits */
+    ck_assert(chidb_prepare(db, "INSERT INTO w VALUES (?, ?);", &stmt) == CHIDB_OK);
+    for(int i = 0; i < 500; i++)
+    {
+        ck_assert(chidb_reset(stmt) == CHIDB_OK);
+        ck_assert(chidb_bind_int64(stmt, 1, base + i) == CHIDB_OK);
+        ck_assert(chidb_bind_int64(stmt, 2, i % 2 ? base * i : i) == CHIDB_OK);
+        ck_assert(chidb_step(stmt) == CHIDB_DONE);
+    }
+    ck_assert(chidb_finalize(stmt) == CHIDB_OK);
+
+    rows[0] = "1099511628276|9000000000000000000";
+    ck_assert(chidb_insert_rows(db, "w", rows, 1) == CHIDB_OK);
+    exec_sql(db, "CREATE INDEX iv ON w(v);");
+
+    ck_assert(chidb_close(db) == CHIDB_OK);
+    ck_assert(chidb_open(fname, &db) == CHIDB_OK);
+
+    ck_assert(chidb_prepare(db, "SELECT id, v FROM w WHERE id >= ?;", &stmt) == CHIDB_OK);
+    ck_assert(chidb_bind_int64(stmt, 1, base + 250) == CHIDB_OK);
+    while(chidb_step(stmt) == CHIDB_ROW)
+    {
+        int64_t id = chidb_column_int64(stmt, 0), v = chidb_column_int64(stmt, 1);
+
+        ck_assert(id == base + 250 + n);
+        if(n == 250)
+            ck_assert(v == 9000000000000000000LL);
+        else
+        {
+            ck_assert(v == (id % 2 ? base * (id - base) : id - base));
+            ck_assert_int_eq(chidb_column_type(stmt, 1), id % 2 ? SQL_INTEGER_8BYTE : SQL_INTEGER_4BYTE);
+        }
+        ck_assert_int_eq(chidb_column_type(stmt, 0), SQL_INTEGER_8BYTE);
+        n++;
+    }
+    ck_assert_int_eq(n, 251);
+    ck_assert(chidb_finalize(stmt) == CHIDB_OK);
+
+    /* Through the index */
+    ck_assert(chidb_prepare(db, "SELECT id FROM w WHERE v > 1000;", &stmt) == CHIDB_OK);
+    ck_assert(uses_op(stmt, Op_IdxPKey));
+    for(n = 0; chidb_step(stmt) == CHIDB_ROW; n++)
+        ck_assert(chidb_column_int64(stmt, 0) % 2 == 1 || n == 250);
+    ck_assert_int_eq(n, 251);
+    ck_assert(chidb_finalize(stmt) == CHIDB_OK);
+
+    ck_assert(chidb_close(db) == CHIDB_OK);
+    delete_tmp_file(fname);
+}
+END_TEST
+
+/* Name of row i of p. Every name is in two rows (i and i + 300). */
+static void text_index_name(int i, char *buf)
+{
+    sprintf(buf, "/home/users/group-%d/user-%04d", (i % 300) % 3, i % 300);
+}
+
+/* Counts the rows of a query with a text parameter, which must be read
+ * from the index on p(name) */
+static int count_text_rows(chidb *db, const char *sql, const char *text)
+{
+    chidb_stmt *stmt;
+    int rc, n = 0;
+
+    ck_assert(chidb_prepare(db, sql, &stmt) == CHIDB_OK);
+    ck_assert_msg(uses_op(stmt, Op_IdxPKey), "%s: does not use the index", sql);
+    ck_assert(chidb_bind_text(stmt, 1, text) == CHIDB_OK);
+    while((rc = chidb_step(stmt)) == CHIDB_ROW)
+        n++;
+    ck_assert_int_eq(rc, CHIDB_DONE);
+    ck_assert(chidb_finalize(stmt) == CHIDB_OK);
+
+    return n;
+}
+
+START_TEST (test_text_index)
+{
+    chidb *db;
+    chidb_stmt *stmt;
+    char name[64];
+    int n;
+
+    char *fname = create_tmp_file();
+    ck_assert(chidb_open(fname, &db) == CHIDB_OK);
+
+    exec_sql(db, "CREATE TABLE p(id INTEGER PRIMARY KEY, name TEXT, n INTEGER);");
+    ck_assert(chidb_prepare(db, "INSERT INTO p VALUES (?, ?, ?);", &stmt) == CHIDB_OK);
+    for(int i = 0; i < 600; i++)
+    {
+        text_index_name(i, name);
+        ck_assert(chidb_reset(stmt) == CHIDB_OK);
+        ck_assert(chidb_bind_int(stmt, 1, i) == CHIDB_OK);
+        ck_assert(chidb_bind_text(stmt, 2, name) == CHIDB_OK);
+        ck_assert(chidb_bind_int(stmt, 3, i) == CHIDB_OK);
+        ck_assert(chidb_step(stmt) == CHIDB_DONE);
+    }
+    ck_assert(chidb_finalize(stmt) == CHIDB_OK);
+    exec_sql(db, "CREATE INDEX iname ON p(name);");
+
+    /* Each name is in the index once for every row */
+    ck_assert_int_eq(count_text_rows(db, "SELECT id FROM p WHERE name = ?;", "/home/users/group-1/user-0004"), 2);
+    ck_assert_int_eq(count_text_rows(db, "SELECT id FROM p WHERE name = ?;", "/home/users/group-1/user-0005"), 0);
+    ck_assert_int_eq(count_text_rows(db, "SELECT id FROM p WHERE name = ?;", "/home/users/group-1"), 0);
+    ck_assert_int_eq(count_text_rows(db, "SELECT id FROM p WHERE name > ?;", "/home/users/group-2/user-0290"), 6);
+    ck_assert_int_eq(count_text_rows(db, "SELECT id FROM p WHERE name >= ?;", "/home/users/group-2"), 200);
+    ck_assert_int_eq(count_text_rows(db, "SELECT id FROM p WHERE name >= ?;", "/home/users/group-0/user-0003"), 598);
+    ck_assert_int_eq(count_text_rows(db, "SELECT id FROM p WHERE name > ?;", "/home/users/group-3"), 0);
+    ck_assert_int_eq(count_rows(db, "SELECT id FROM p WHERE n > 590;", Op_IdxPKey, false), 9);
+
+    /* In text order, and read from the index alone */
+    ck_assert(chidb_prepare(db, "SELECT name FROM p WHERE name >= ?;", &stmt) == CHIDB_OK);
+    ck_assert(!uses_op(stmt, Op_IdxPKey));
+    ck_assert(chidb_bind_text(stmt, 1, "/home/users/group-0/user-0297") == CHIDB_OK);
+    for(n = 0; chidb_step(stmt) == CHIDB_ROW; n++)
+    {
+        // 297 in group 0, then groups 1 and 2 (two rows for each name)
+        int k = (n - 2) / 2;
+
+        text_index_name(n < 2 ? 297 : k < 100 ? 1 + 3 * k : 2 + 3 * (k - 100), name);
+        ck_assert_str_eq(chidb_column_text(stmt, 0), name);
+    }
+    ck_assert_int_eq(n, 402);
+
+    /* An integer is not in a text index */
+    ck_assert(chidb_reset(stmt) == CHIDB_OK);
+    ck_assert(chidb_bind_int(stmt, 1, 8) == CHIDB_OK);
+    ck_assert(chidb_step(stmt) == CHIDB_DONE);
+    ck_assert(chidb_finalize(stmt) == CHIDB_OK);
+
+    /* Deleted rows leave the index too */
+    exec_sql(db, "DELETE FROM p WHERE id < 300;");
+    ck_assert(chidb_close(db) == CHIDB_OK);
+    ck_assert(chidb_open(fname, &db) == CHIDB_OK);
+    ck_assert_int_eq(count_text_rows(db, "SELECT id FROM p WHERE name = ?;", "/home/users/group-1/user-0004"), 1);
+    ck_assert_int_eq(count_text_rows(db, "SELECT id FROM p WHERE name >= ?;", "/home/users/group-2"), 100);
+    exec_sql(db, "DELETE FROM p WHERE id > 0;");
+    ck_assert_int_eq(count_text_rows(db, "SELECT id FROM p WHERE name >= ?;", "/home/users"), 0);
+
+    ck_assert(chidb_close(db) == CHIDB_OK);
+    delete_tmp_file(fname);
+}
+END_TEST
+
+START_TEST (test_bulk_index)
+{
+    chidb *db;
+    chidb_stmt *stmt;
+    char sql[128];
+
+    char *fname = create_tmp_file();
+    ck_assert(chidb_open(fname, &db) == CHIDB_OK);
+
+    /* v is a permutation of the ids, in no particular order, and NULL
+     * in every tenth row */
+    exec_sql(db, "CREATE TABLE b(id INTEGER PRIMARY KEY, v INTEGER);");
+    ck_assert(chidb_prepare(db, "INSERT INTO b VALUES (?, ?);", &stmt) == CHIDB_OK);
+    for(int i = 0; i < 5000; i++)
+    {
+        ck_assert(chidb_bind_int(stmt, 1, i) == CHIDB_OK);
+        if(i % 10 != 0)
+            ck_assert(chidb_bind_int(stmt, 2, (i * 2003) % 5000) == CHIDB_OK);
+        ck_assert(chidb_step(stmt) == CHIDB_DONE);
+        ck_assert(chidb_reset(stmt) == CHIDB_OK);
+        ck_assert(chidb_clear_bindings(stmt) == CHIDB_OK);
+    }
+    ck_assert(chidb_finalize(stmt) == CHIDB_OK);
+
+    /* Sorted in a few runs that spill to disk */
+    ck_assert(chidb_set_sort_budget(db, 4096) == CHIDB_OK);
+    ck_assert(chidb_prepare(db, "CREATE INDEX iv ON b(v);", &stmt) == CHIDB_OK);
+    ck_assert(uses_op(stmt, Op_IdxLoad));
+    ck_assert(!uses_op(stmt, Op_IdxInsert));
+    ck_assert(chidb_step(stmt) == CHIDB_DONE);
+    ck_assert(chidb_finalize(stmt) == CHIDB_OK);
+
+    ck_assert_int_eq(count_rows(db, "SELECT id FROM b WHERE v >= 0;", Op_IdxPKey, true), 4500);
+    ck_assert_int_eq(count_rows(db, "SELECT id FROM b WHERE v < 100;", Op_IdxPKey, true), 90);
+    for(int i = 1; i < 5000; i += 499)
+    {
+        sprintf(sql, "SELECT id FROM b WHERE v = %i;", (i * 2003) % 5000);
+        ck_assert(chidb_prepare(db, sql, &stmt) == CHIDB_OK);
+        ck_assert(chidb_step(stmt) == (i % 10 != 0 ? CHIDB_ROW : CHIDB_DONE));
+        if(i % 10 != 0)
+        {
+            ck_assert_int_eq(chidb_column_int(stmt, 0), i);
+            ck_assert(chidb_step(stmt) == CHIDB_DONE);
+        }
+        ck_assert(chidb_finalize(stmt) == CHIDB_OK);
+    }
+
+    /* Entries are deleted from it like from any other index */
+    exec_sql(db, "DELETE FROM b WHERE id < 1000;");
+    ck_assert_int_eq(count_rows(db, "SELECT id FROM b WHERE v >= 0;", Op_IdxPKey, true), 3600);
+
+    /* An empty table gives an empty index */
+    exec_sql(db, "CREATE TABLE e(id INTEGER PRIMARY KEY, v INTEGER);");
+    exec_sql(db, "CREATE INDEX iev ON e(v);");
+    ck_assert_int_eq(count_rows(db, "SELECT id FROM e WHERE v >= 0;", Op_IdxPKey, true), 0);
+
+    ck_assert(chidb_close(db) == CHIDB_OK);
+    delete_tmp_file(fname);
+}
+END_TEST
+
+START_TEST (test_index_insert)
+{
+    chidb *db;
+    chidb_stmt *stmt;
+    char *sql, name[64];
+    int len;
+
+    char *fname = create_tmp_file();
+    ck_assert(chidb_open(fname, &db) == CHIDB_OK);
+
+    exec_sql(db, "CREATE TABLE p(id INTEGER PRIMARY KEY, name TEXT, n INTEGER);");
+    exec_sql(db, "CREATE INDEX iname ON p(name);");
+    exec_sql(db, "CREATE INDEX ino ON p(n);");
+
+    /* One row at a time, straight into the indexes */
+    ck_assert(chidb_prepare(db, "INSERT INTO p VALUES (?, ?, ?);", &stmt) == CHIDB_OK);
+    ck_assert_int_eq(count_ops(stmt, Op_IdxInsert), 2);
+    ck_assert(!uses_op(stmt, Op_SorterOpen));
+    for(int i = 0; i < 300; i++)
+    {
+        text_index_name(i, name);
+        ck_assert(chidb_reset(stmt) == CHIDB_OK);
+        ck_assert(chidb_bind_int(stmt, 1, i) == CHIDB_OK);
+        ck_assert(chidb_bind_text(stmt, 2, name) == CHIDB_OK);
+        ck_assert(chidb_bind_int(stmt, 3, 1000 - i) == CHIDB_OK);
+        ck_assert(chidb_step(stmt) == CHIDB_DONE);
+    }
+    ck_assert(chidb_finalize(stmt) == CHIDB_OK);
+
+    /* Many rows, with n in descending order, through sorters */
+    sql = malloc(600 * 32);
+    len = sprintf(sql, "INSERT INTO p VALUES");
+    for(int i = 300; i < 600; i++)
+        len += sprintf(sql + len, "%s(%i, ?, %i)", i > 300 ? ", " : " ", i, 1000 - i);
+    sprintf(sql + len, ";");
+    ck_assert(chidb_prepare(db, sql, &stmt) == CHIDB_OK);
+    ck_assert_int_eq(count_ops(stmt, Op_SorterOpen), 2);
+    ck_assert_int_eq(count_ops(stmt, Op_IdxInsert), 2);
+    for(int i = 300; i < 600; i++)
+    {
+        text_index_name(i, name);
+        ck_assert(chidb_bind_text(stmt, i - 299, name) == CHIDB_OK);
+    }
+    ck_assert(chidb_step(stmt) == CHIDB_DONE);
+    ck_assert(chidb_finalize(stmt) == CHIDB_OK);
+    free(sql);
+
+    /* Every row is in both indexes */
+    ck_assert_int_eq(count_rows(db, "SELECT id FROM p WHERE n > 0;", Op_IdxPKey, true), 600);
+    ck_assert_int_eq(count_rows(db, "SELECT id FROM p WHERE n <= 500;", Op_IdxPKey, true), 100);
+    ck_assert_int_eq(count_text_rows(db, "SELECT id FROM p WHERE name = ?;", "/home/users/group-1/user-0004"), 2);
+    ck_assert_int_eq(count_text_rows(db, "SELECT id FROM p WHERE name >= ?;", "/home/users/group-2"), 200);
+
+    /* A key that is already in an INTEGER index gets another entry */
+    exec_sql(db, "INSERT INTO p VALUES (600, ?, 1000);");
+    ck_assert_int_eq(count_rows(db, "SELECT id FROM p WHERE n > 0;", Op_IdxPKey, true), 601);
+    ck_assert_int_eq(count_rows(db, "SELECT id FROM p WHERE n = 1000;", Op_IdxPKey, true), 2);
+
+    /* NULLs are not indexed, and deleted rows leave the indexes */
+    exec_sql(db, "INSERT INTO p VALUES (700, ?, ?), (701, ?, ?);");
+    ck_assert_int_eq(count_rows(db, "SELECT id FROM p WHERE n > 0;", Op_IdxPKey, true), 601);
+    exec_sql(db, "DELETE FROM p WHERE id < 300;");
+    ck_assert_int_eq(count_rows(db, "SELECT id FROM p WHERE n > 0;", Op_IdxPKey, true), 301);
+    ck_assert_int_eq(count_rows(db, "SELECT id FROM p WHERE n = 1000;", Op_IdxPKey, true), 1);
+    ck_assert_int_eq(count_text_rows(db, "SELECT id FROM p WHERE name >= ?;", "/home/users/group-2"), 100);
+
+    /* Many entries with the same key, over several levels of the index,
+     * added one at a time (q) or all at once by CREATE INDEX (r) */
+    exec_sql(db, "CREATE TABLE q(id INTEGER PRIMARY KEY, a INTEGER);");
+    exec_sql(db, "CREATE TABLE r(id INTEGER PRIMARY KEY, a INTEGER);");
+    exec_sql(db, "CREATE INDEX iqa ON q(a);");
+    for(int i = 1; i <= 3000; i++)
+    {
+        char row[64];
+
+        sprintf(row, "INSERT INTO q VALUES(%i, %i);", i, (i * 5) % 7);
+        exec_sql(db, row);
+        sprintf(row, "INSERT INTO r VALUES(%i, %i);", i, (i * 5) % 7);
+        exec_sql(db, row);
+    }
+    exec_sql(db, "CREATE INDEX ira ON r(a);");
+    for(int k = 0; k < 2; k++)
+    {
+        const char *t = k == 0 ? "q" : "r";
+        char query[64];
+
+        sprintf(query, "SELECT id FROM %s WHERE a = 3;", t);
+        ck_assert_int_eq(count_rows(db, query, Op_IdxPKey, true), 429);
+        sprintf(query, "SELECT id FROM %s WHERE a > 3;", t);
+        ck_assert_int_eq(count_rows(db, query, Op_IdxPKey, true), 1286);
+        sprintf(query, "SELECT id FROM %s WHERE a >= 3;", t);
+        ck_assert_int_eq(count_rows(db, query, Op_IdxPKey, true), 1715);
+        sprintf(query, "SELECT id FROM %s WHERE a < 3;", t);
+        ck_assert_int_eq(count_rows(db, query, Op_IdxPKey, true), 1285);
+        sprintf(query, "SELECT id FROM %s WHERE a <= 3;", t);
+        ck_assert_int_eq(count_rows(db, query, Op_IdxPKey, true), 1714);
+
+        /* Deleting and updating rows takes out their own entries */
+        sprintf(query, "DELETE FROM %s WHERE id > 1500;", t);
+        exec_sql(db, query);
+        sprintf(query, "UPDATE %s SET a = 9 WHERE id <= 7;", t);
+        exec_sql(db, query);
+        sprintf(query, "SELECT id FROM %s WHERE a = 3;", t);
+        ck_assert_int_eq(count_rows(db, query, Op_IdxPKey, true), 214);
+        sprintf(query, "SELECT id FROM %s WHERE a = 9;", t);
+        ck_assert_int_eq(count_rows(db, query, Op_IdxPKey, true), 7);
+        sprintf(query, "SELECT id FROM %s WHERE a >= 0;", t);
+        ck_assert_int_eq(count_rows(db, query, Op_IdxPKey, true), 1500);
+    }
+
+    ck_assert(chidb_close(db) == CHIDB_OK);
+    delete_tmp_file(fname);
+}
+END_TEST
+
+/* Checks that t, in test_insert_failed, still has its first three rows
+ * (id, a) = (1, 10), (2, 20), (3, 30), and that its index on a does too */
+static void check_not_inserted(chidb *db)
+{
+    chidb_stmt *stmt;
+
+    ck_assert_int_eq(count_rows(db, "SELECT id FROM t;", Op_IdxPKey, false), 3);
+    ck_assert_int_eq(count_rows(db, "SELECT id FROM t WHERE a > 15;", Op_IdxPKey, true), 2);
+    ck_assert_int_eq(count_rows(db, "SELECT id FROM t WHERE a = 10;", Op_IdxPKey, true), 1);
+
+    ck_assert(chidb_prepare(db, "SELECT id, a FROM t WHERE a >= 0;", &stmt) == CHIDB_OK);
+    for(int id = 1; id <= 3; id++)
+    {
+        ck_assert(chidb_step(stmt) == CHIDB_ROW);
+        ck_assert_int_eq(chidb_column_int(stmt, 0), id);
+        ck_assert_int_eq(chidb_column_int(stmt, 1), 10 * id);
+    }
+    ck_assert(chidb_step(stmt) == CHIDB_DONE);
+    ck_assert(chidb_finalize(stmt) == CHIDB_OK);
+}
+
+START_TEST (test_insert_failed)
+{
+    chidb *db;
+    chidb_stmt *stmt;
+    char *sql;
+    int len;
+
+    char *fname = create_tmp_file();
+    ck_assert(chidb_open(fname, &db) == CHIDB_OK);
+
+    exec_sql(db, "CREATE TABLE t(id INTEGER PRIMARY KEY, a INTEGER, b INTEGER);");
+    exec_sql(db, "CREATE INDEX ia ON t(a);");
+    exec_sql(db, "INSERT INTO t VALUES(1, 10, 5), (2, 20, 5), (3, 30, 6);");
+
+    /* Many rows, then one whose key is already there */
+    sql = malloc(2001 * 32);
+    len = sprintf(sql, "INSERT INTO t VALUES");
+    for(int i = 100; i < 2100; i++)
+        len += sprintf(sql + len, "%s(%i, %i, %i)", i > 100 ? ", " : " ", i, i % 50, i);
+    sprintf(sql + len, ", (3, 40, 7);");
+
+    /* A failed insert changes neither the table nor the index, even if
+     * the buffer pool is so small that pages it wrote were evicted */
+    ck_assert(chidb_set_cache_size(db, 8) == CHIDB_OK);
+    for(int wal = 0; wal < 2; wal++)
+    {
+        if(wal)
+            ck_assert(chidb_set_journal_mode(db, CHIDB_JOURNAL_WAL) == CHIDB_OK);
+
+        ck_assert(chidb_prepare(db, "INSERT INTO t VALUES(2, 10, 6);", &stmt) == CHIDB_OK);
+        ck_assert(chidb_step(stmt) == CHIDB_ECONSTRAINT);
+        ck_assert(chidb_finalize(stmt) == CHIDB_OK);
+        check_not_inserted(db);
+
+        ck_assert(chidb_prepare(db, sql, &stmt) == CHIDB_OK);
+        ck_assert(chidb_step(stmt) == CHIDB_ECONSTRAINT);
+        ck_assert(chidb_finalize(stmt) == CHIDB_OK);
+        check_not_inserted(db);
+    }
+    free(sql);
+
+    ck_assert(chidb_close(db) == CHIDB_OK);
+    ck_assert(chidb_open(fname, &db) == CHIDB_OK);
+    check_not_inserted(db);
+
+    ck_assert(chidb_close(db) == CHIDB_OK);
+    delete_tmp_file(fname);
+}
+END_TEST
+
+/* A text of len characters that depends on id */
+static char *long_text(int id, int len)
+{
+    char *t = malloc(len + 1);
+
+    for(int i = 0; i < len; i++)
+        t[i] = 'a' + (id + i) % 26;
+    t[len] = '\0';
+
+    return t;
+}
+
+static void check_long_rows(chidb *db, int n)
+{
+    chidb_stmt *stmt;
+    char *t;
+    int rc, id = 0;
+
+    ck_assert(chidb_prepare(db, "SELECT id, v, t FROM o;", &stmt) == CHIDB_OK);
+    while((rc = chidb_step(stmt)) == CHIDB_ROW)
+    {
+        id++;
+        t = long_text(id, (id * 997) % 6000);
+        ck_assert_int_eq(chidb_column_int(stmt, 0), id);
+        ck_assert_int_eq(chidb_column_int(stmt, 1), 2 * id);
+        ck_assert_str_eq(chidb_column_text(stmt, 2), t);
+        free(t);
+    }
+    ck_assert_int_eq(rc, CHIDB_DONE);
+    ck_assert_int_eq(id, n);
+    ck_assert(chidb_finalize(stmt) == CHIDB_OK);
+}
+
+START_TEST (test_overflow)
+{
+    chidb *db;
+    chidb_stmt *stmt;
+    const char *rows[100];
+    char *t;
+    int rc, id;
+
+    char *fname = create_tmp_file();
+    ck_assert(chidb_open(fname, &db) == CHIDB_OK);
+    exec_sql(db, "CREATE TABLE o(id INTEGER PRIMARY KEY, v INTEGER, t TEXT);");
+
+    /* Rows several pages wide, through the API and through INSERT */
+    for(int i = 0; i < 100; i++)
+    {
+        t = long_text(i + 1, ((i + 1) * 997) % 6000);
+        rows[i] = malloc(strlen(t) + 32);
+        sprintf((char *) rows[i], "%i|%i|%s", i + 1, 2 * (i + 1), t);
+        free(t);
+    }
+    ck_assert(chidb_insert_rows(db, "o", rows, 100) == CHIDB_OK);
+    for(int i = 0; i < 100; i++)
+        free((char *) rows[i]);
+
+    ck_assert(chidb_prepare(db, "INSERT INTO o VALUES (?, ?, ?);", &stmt) == CHIDB_OK);
+    for(int i = 101; i <= 150; i++)
+    {
+        t = long_text(i, (i * 997) % 6000);
+        ck_assert(chidb_bind_int(stmt, 1, i) == CHIDB_OK);
+        ck_assert(chidb_bind_int(stmt, 2, 2 * i) == CHIDB_OK);
+        ck_assert(chidb_bind_text(stmt, 3, t) == CHIDB_OK);
+        ck_assert(chidb_step(stmt) == CHIDB_DONE);
+        ck_assert(chidb_reset(stmt) == CHIDB_OK);
+        free(t);
+    }
+    ck_assert(chidb_finalize(stmt) == CHIDB_OK);
+    check_long_rows(db, 150);
+
+    /* A key that is already there is still caught */
+    t = long_text(7, 5000);
+    ck_assert(chidb_prepare(db, "INSERT INTO o VALUES (7, 14, ?);", &stmt) == CHIDB_OK);
+    ck_assert(chidb_bind_text(stmt, 1, t) == CHIDB_OK);
+    ck_assert(chidb_step(stmt) == CHIDB_ECONSTRAINT);
+    ck_assert(chidb_finalize(stmt) == CHIDB_OK);
+    free(t);
+
+    /* Columns in the page are read without the overflow pages */
+    ck_assert(chidb_prepare(db, "SELECT id, v FROM o;", &stmt) == CHIDB_OK);
+    for(id = 1; (rc = chidb_step(stmt)) == CHIDB_ROW; id++)
+        ck_assert_int_eq(chidb_column_int(stmt, 1), 2 * id);
+    ck_assert_int_eq(rc, CHIDB_DONE);
+    ck_assert_int_eq(id, 151);
+    ck_assert(stmt->cursors[0].payload == NULL);
+    ck_assert(chidb_finalize(stmt) == CHIDB_OK);
+
+    ck_assert(chidb_close(db) == CHIDB_OK);
+    ck_assert(chidb_open(fname, &db) == CHIDB_OK);
+    check_long_rows(db, 150);
+
+    ck_assert(chidb_close(db) == CHIDB_OK);
+    delete_tmp_file(fname);
+}
+END_TEST
+
+/* Number of chunks in a statement's arena */
+static int arena_chunks(chidb_stmt *stmt)
+{
+    int n = 0;
+
+    for(chidb_dbm_arena_chunk_t *chunk = stmt->arena.chunks; chunk != NULL; chunk = chunk->next)
+        n++;
+
+    return n;
+}
+
+START_TEST (test_arena)
+{
+    chidb *db;
+    chidb_stmt *stmt;
+    char *t, prev[256], first[256];
+    int rc, n;
+
+    char *fname = create_tmp_file();
+    ck_assert(chidb_open(fname, &db) == CHIDB_OK);
+
+    exec_sql(db, "CREATE TABLE t(id INTEGER PRIMARY KEY, name TEXT, g INTEGER);");
+
+    /* The same statement run again and again keeps reusing its arena */
+    ck_assert(chidb_prepare(db, "INSERT INTO t VALUES (?, ?, ?);", &stmt) == CHIDB_OK);
+    for(int i = 1; i <= 1000; i++)
+    {
+        t = long_text(i * 7, 10 + (i * 31) % 200);
+        ck_assert(chidb_bind_int(stmt, 1, i) == CHIDB_OK);
+        ck_assert(chidb_bind_text(stmt, 2, t) == CHIDB_OK);
+        ck_assert(chidb_bind_int(stmt, 3, i % 10) == CHIDB_OK);
+        ck_assert(chidb_step(stmt) == CHIDB_DONE);
+        ck_assert(chidb_reset(stmt) == CHIDB_OK);
+        ck_assert_int_le(arena_chunks(stmt), 1);
+        free(t);
+    }
+    ck_assert(chidb_finalize(stmt) == CHIDB_OK);
+
+    /* Sorted rows are copied into the registers, but the arena does not
+     * grow with the number of rows */
+    ck_assert(chidb_prepare(db, "SELECT name FROM t ORDER BY name;", &stmt) == CHIDB_OK);
+    for(int pass = 0; pass < 2; pass++)
+    {
+        n = 0;
+        while((rc = chidb_step(stmt)) == CHIDB_ROW)
+        {
+            const char *name = chidb_column_text(stmt, 0);
+            if(n == 0 && pass == 0)
+                strcpy(first, name);
+            else if(n == 0)
+                ck_assert_str_eq(name, first);
+            else
+                ck_assert(strcmp(prev, name) <= 0);
+            strcpy(prev, name);
+            n++;
+            ck_assert_int_le(arena_chunks(stmt), 2);
+        }
+        ck_assert(rc == CHIDB_DONE);
+        ck_assert_int_eq(n, 1000);
+        ck_assert(chidb_reset(stmt) == CHIDB_OK);
+    }
+    ck_assert(chidb_finalize(stmt) == CHIDB_OK);
+
+    /* MIN and MAX keep a copy of the smallest and largest string */
+    ck_assert(chidb_prepare(db, "SELECT g, MIN(name), MAX(name) FROM t GROUP BY g;", &stmt) == CHIDB_OK);
+    n = 0;
+    while((rc = chidb_step(stmt)) == CHIDB_ROW)
+    {
+        ck_assert(strcmp(chidb_column_text(stmt, 1), chidb_column_text(stmt, 2)) <= 0);
+        n++;
+    }
+    ck_assert(rc == CHIDB_DONE);
+    ck_assert_int_eq(n, 10);
+    ck_assert(chidb_finalize(stmt) == CHIDB_OK);
+
+    /* Short strings are copied inline, without using the arena at all */
+    exec_sql(db, "CREATE TABLE codes(id INTEGER PRIMARY KEY, code TEXT);");
+    ck_assert(chidb_prepare(db, "INSERT INTO codes VALUES (?, ?);", &stmt) == CHIDB_OK);
+    for(int i = 1; i <= 200; i++)
+    {
+        char code[24];
+
+        sprintf(code, "code-%03i-%s", (i * 37) % 200, i % 2 ? "abcdefghijklm" : "x");
+        ck_assert(chidb_bind_int(stmt, 1, i) == CHIDB_OK);
+        ck_assert(chidb_bind_text(stmt, 2, code) == CHIDB_OK);
+        ck_assert(chidb_step(stmt) == CHIDB_DONE);
+        ck_assert(chidb_reset(stmt) == CHIDB_OK);
+    }
+    ck_assert(chidb_finalize(stmt) == CHIDB_OK);
+
+    ck_assert(chidb_prepare(db, "SELECT code FROM codes ORDER BY code;", &stmt) == CHIDB_OK);
+    n = 0;
+    prev[0] = '\0';
+    while((rc = chidb_step(stmt)) == CHIDB_ROW)
+    {
+        const char *code = chidb_column_text(stmt, 0);
+        ck_assert(strcmp(prev, code) < 0);
+        strcpy(prev, code);
+        ck_assert_int_eq(arena_chunks(stmt), 0);
+        n++;
+    }
+    ck_assert(rc == CHIDB_DONE);
+    ck_assert_int_eq(n, 200);
+    ck_assert(chidb_finalize(stmt) == CHIDB_OK);
+
+    ck_assert(chidb_close(db) == CHIDB_OK);
+    delete_tmp_file(fname);
+}
+END_TEST
+
+/* Inserts rows id|3 * id|text for ids first..last into d */
+static void insert_deleted_rows(chidb *db, int first, int last)
+{
+    const char *rows[400];
+    char *t;
+
+    for(int i = first; i <= last; i++)
+    {
+        t = long_text(i, 300);
+        rows[i - first] = malloc(strlen(t) + 32);
+        sprintf((char *) rows[i - first], "%i|%i|%s", i, 3 * i, t);
+        free(t);
+    }
+    ck_assert(chidb_insert_rows(db, "d", rows, last - first + 1) == CHIDB_OK);
+    for(int i = first; i <= last; i++)
+        free((char *) rows[i - first]);
+}
+
+static off_t file_size(const char *fname)
+{
+    struct stat st;
+
+    ck_assert(stat(fname, &st) == 0);
+    return st.st_size;
+}
+
+START_TEST (test_delete)
+{
+    chidb *db;
+    chidb_stmt *stmt;
+    off_t size;
+
+    char *fname = create_tmp_file();
+    ck_assert(chidb_open(fname, &db) == CHIDB_OK);
+    exec_sql(db, "CREATE TABLE d(id INTEGER PRIMARY KEY, v INTEGER, t TEXT);");
+    insert_deleted_rows(db, 1, 400);
+    exec_sql(db, "CREATE INDEX iv ON d(v);");
+
+    /* The rows and their index entries are gone */
+    exec_sql(db, "DELETE FROM d WHERE id > 200;");
+    ck_assert_int_eq(count_rows(db, "SELECT id FROM d;", Op_IdxPKey, false), 200);
+    ck_assert_int_eq(count_rows(db, "SELECT id FROM d WHERE v > 300;", Op_IdxPKey, true), 100);
+    exec_sql(db, "DELETE FROM d WHERE v = 30;");
+    ck_assert_int_eq(count_rows(db, "SELECT id FROM d WHERE v = 30;", Op_IdxPKey, true), 0);
+    ck_assert_int_eq(count_rows(db, "SELECT id FROM d WHERE v = 33;", Op_IdxPKey, true), 1);
+    ck_assert_int_eq(count_rows(db, "SELECT id FROM d;", Op_IdxPKey, false), 199);
+
+    /* Deleting and inserting the same rows reuses the freed pages */
+    size = file_size(fname);
+    for(int i = 0; i < 3; i++)
+    {
+        insert_deleted_rows(db, 201, 400);
+        exec_sql(db, "DELETE FROM d WHERE id > 200;");
+    }
+    ck_assert_int_le(file_size(fname), size);
+
+    /* Not while a statement is running */
+    ck_assert(chidb_prepare(db, "SELECT id FROM d;", &stmt) == CHIDB_OK);
+    ck_assert(chidb_step(stmt) == CHIDB_ROW);
+    ck_assert(chidb_incremental_vacuum(db, 0) == CHIDB_EMISUSE);
+    ck_assert(chidb_finalize(stmt) == CHIDB_OK);
+
+    /* The file only shrinks when asked to, down to the last root page
+     * (here, the index's) */
+    exec_sql(db, "DELETE FROM d WHERE id > 0;");
+    size = file_size(fname);
+    ck_assert(chidb_incremental_vacuum(db, 2) == CHIDB_OK);
+    ck_assert_int_eq(file_size(fname), size - 2 * 1024);
+    ck_assert(chidb_incremental_vacuum(db, 0) == CHIDB_OK);
+    ck_assert_int_lt(file_size(fname), size - 2 * 1024);
+    size = file_size(fname);
+    ck_assert(chidb_incremental_vacuum(db, 0) == CHIDB_OK);
+    ck_assert_int_eq(file_size(fname), size);
+
+    insert_deleted_rows(db, 1, 100);
+    ck_assert(chidb_close(db) == CHIDB_OK);
+    ck_assert(chidb_open(fname, &db) == CHIDB_OK);
+    ck_assert_int_eq(count_rows(db, "SELECT id FROM d;", Op_IdxPKey, false), 100);
+
+    ck_assert(chidb_close(db) == CHIDB_OK);
+    delete_tmp_file(fname);
+}
+END_TEST
+
+/* Checks that SELECT id, v FROM d returns the ids 2, 4, ..., 400, with v = 3 * id */
+static void check_vacuumed(chidb *db)
+{
+    chidb_stmt *stmt;
+    int rc, n = 0;
+
+    ck_assert(chidb_prepare(db, "SELECT id, v FROM d;", &stmt) == CHIDB_OK);
+    while((rc = chidb_step(stmt)) == CHIDB_ROW)
+    {
+        n++;
+        ck_assert_int_eq(chidb_column_int(stmt, 0), 2 * n);
+        ck_assert_int_eq(chidb_column_int(stmt, 1), 6 * n);
+    }
+    ck_assert_int_eq(rc, CHIDB_DONE);
+    ck_assert_int_eq(n, 200);
+    ck_assert(chidb_finalize(stmt) == CHIDB_OK);
+
+    ck_assert_int_eq(count_rows(db, "SELECT id FROM d WHERE v > 900;", Op_IdxPKey, true), 50);
+    ck_assert_int_eq(count_rows(db, "SELECT id FROM d WHERE v = 33;", Op_IdxPKey, true), 0);
+    ck_assert_int_eq(count_rows(db, "SELECT id FROM d WHERE v = 36;", Op_IdxPKey, true), 1);
+}
+
+START_TEST (test_vacuum)
+{
+    chidb *db;
+    chidb_stmt *stmt, *vacuum;
+    off_t size;
+
+    char *fname = create_tmp_file();
+    ck_assert(chidb_open(fname, &db) == CHIDB_OK);
+    exec_sql(db, "CREATE TABLE d(id INTEGER PRIMARY KEY, v INTEGER, t TEXT);");
+
+    /* Out of order, and with every other row deleted */
+    insert_deleted_rows(db, 301, 400);
+    insert_deleted_rows(db, 1, 100);
+    insert_deleted_rows(db, 201, 300);
+    insert_deleted_rows(db, 101, 200);
+    exec_sql(db, "CREATE INDEX iv ON d(v);");
+    for(int i = 1; i <= 400; i += 2)
+    {
+        char sql[64];
+        sprintf(sql, "DELETE FROM d WHERE id = %i;", i);
+        exec_sql(db, sql);
+    }
+    size = file_size(fname);
+
+    /* Not while a statement is running, or in a transaction */
+    ck_assert(chidb_prepare(db, "SELECT id FROM d;", &stmt) == CHIDB_OK);
+    ck_assert(chidb_step(stmt) == CHIDB_ROW);
+    ck_assert(chidb_prepare(db, "VACUUM;", &vacuum) == CHIDB_OK);
+    ck_assert(chidb_step(vacuum) == CHIDB_EMISUSE);
+    ck_assert(chidb_finalize(vacuum) == CHIDB_OK);
+    ck_assert(chidb_finalize(stmt) == CHIDB_OK);
+    exec_sql(db, "BEGIN;");
+    ck_assert(chidb_prepare(db, "VACUUM;", &vacuum) == CHIDB_OK);
+    ck_assert(chidb_step(vacuum) == CHIDB_EMISUSE);
+    ck_assert(chidb_finalize(vacuum) == CHIDB_OK);
+    exec_sql(db, "ROLLBACK;");
+
+    exec_sql(db, "VACUUM;");
+    ck_assert_int_lt(file_size(fname), size);
+    check_vacuumed(db);
+
+    /* Again, now that there is nothing to gain */
+    size = file_size(fname);
+    exec_sql(db, "vacuum");
+    ck_assert_int_eq(file_size(fname), size);
+    check_vacuumed(db);
+
+    ck_assert(chidb_close(db) == CHIDB_OK);
+    ck_assert(chidb_open(fname, &db) == CHIDB_OK);
+    check_vacuumed(db);
+
+    ck_assert(chidb_close(db) == CHIDB_OK);
+    delete_tmp_file(fname);
+}
+END_TEST
+
+/* Checks the row of u with a given id in test_update: v, w, and the
+ * length of t */
+static void check_updated(chidb *db, int id, int v, int w, int len)
+{
+    chidb_stmt *stmt;
+
+    ck_assert(chidb_prepare(db, "SELECT v, w, t FROM u WHERE id = ?;", &stmt) == CHIDB_OK);
+    ck_assert(chidb_bind_int(stmt, 1, id) == CHIDB_OK);
+    ck_assert(chidb_step(stmt) == CHIDB_ROW);
+    ck_assert_int_eq(chidb_column_int(stmt, 0), v);
+    ck_assert_int_eq(chidb_column_int(stmt, 1), w);
+    ck_assert_int_eq(strlen(chidb_column_text(stmt, 2)), len);
+    ck_assert(chidb_step(stmt) == CHIDB_DONE);
+    ck_assert(chidb_finalize(stmt) == CHIDB_OK);
+}
+
+START_TEST (test_update)
+{
+    chidb *db;
+    chidb_stmt *stmt;
+    char text[256];
+    off_t size;
+    int nrows = 300, i;
+
+    char *fname = create_tmp_file();
+    ck_assert(chidb_open(fname, &db) == CHIDB_OK);
+    exec_sql(db, "CREATE TABLE u(id INTEGER PRIMARY KEY, v INTEGER, w INTEGER, t TEXT);");
+    ck_assert(chidb_prepare(db, "INSERT INTO u VALUES (?, ?, ?, ?);", &stmt) == CHIDB_OK);
+    for(i = 1; i <= nrows; i++)
+    {
+        sprintf(text, "row-%04d", i);
+        ck_assert(chidb_bind_int(stmt, 1, i) == CHIDB_OK);
+        ck_assert(chidb_bind_int(stmt, 2, i) == CHIDB_OK);
+        ck_assert(chidb_bind_int(stmt, 3, i % 10) == CHIDB_OK);
+        ck_assert(chidb_bind_text(stmt, 4, text) == CHIDB_OK);
+        ck_assert(chidb_step(stmt) == CHIDB_DONE);
+        ck_assert(chidb_reset(stmt) == CHIDB_OK);
+    }
+    ck_assert(chidb_finalize(stmt) == CHIDB_OK);
+    exec_sql(db, "CREATE INDEX iv ON u(v);");
+    size = file_size(fname);
+
+    /* Records that still fit are rewritten where they are, and the index
+     * on v is left alone */
+    ck_assert(chidb_prepare(db, "UPDATE u SET w = 7 WHERE id <= 100;", &stmt) == CHIDB_OK);
+    ck_assert_int_eq(count_ops(stmt, Op_OpenWrite), 1);
+    ck_assert(chidb_step(stmt) == CHIDB_DONE);
+    ck_assert(chidb_finalize(stmt) == CHIDB_OK);
+    ck_assert_int_eq(count_rows(db, "SELECT id FROM u WHERE w = 7;", Op_IdxPKey, false), 120);
+    check_updated(db, 50, 50, 7, 8);
+    check_updated(db, 101, 101, 1, 8);
+    ck_assert_int_eq(file_size(fname), size);
+
+    /* The index entries of the rows whose v changes are moved */
+    ck_assert(chidb_prepare(db, "UPDATE u SET v = ?, w = v WHERE id = ?;", &stmt) == CHIDB_OK);
+    ck_assert_int_eq(count_ops(stmt, Op_OpenWrite), 2);
+    for(i = 1; i <= 20; i++)
+    {
+        ck_assert(chidb_bind_int(stmt, 1, 1000 + i) == CHIDB_OK);
+        ck_assert(chidb_bind_int(stmt, 2, i) == CHIDB_OK);
+        ck_assert(chidb_step(stmt) == CHIDB_DONE);
+        ck_assert(chidb_reset(stmt) == CHIDB_OK);
+    }
+    ck_assert(chidb_finalize(stmt) == CHIDB_OK);
+    ck_assert_int_eq(count_rows(db, "SELECT id FROM u WHERE v = 1005;", Op_IdxPKey, true), 1);
+    ck_assert_int_eq(count_rows(db, "SELECT id FROM u WHERE v = 5;", Op_IdxPKey, true), 0);
+    ck_assert_int_eq(count_rows(db, "SELECT id FROM u WHERE v > 1000;", Op_IdxPKey, true), 20);
+    check_updated(db, 5, 1005, 5, 8);
+
+    exec_sql(db, "UPDATE u SET v = NULL WHERE id = 30;");
+    ck_assert_int_eq(count_rows(db, "SELECT id FROM u WHERE v = 30;", Op_IdxPKey, true), 0);
+
+    /* Records that grow past the room in their leaf are moved, and the
+     * scan still sees every row once */
+    memset(text, 'x', 200);
+    text[200] = '\0';
+    ck_assert(chidb_prepare(db, "UPDATE u SET t = ? WHERE w < 5;", &stmt) == CHIDB_OK);
+    ck_assert(chidb_bind_text(stmt, 1, text) == CHIDB_OK);
+    ck_assert(chidb_step(stmt) == CHIDB_DONE);
+    ck_assert(chidb_finalize(stmt) == CHIDB_OK);
+    ck_assert_int_eq(count_rows(db, "SELECT id FROM u;", Op_IdxPKey, false), nrows);
+    for(i = 1; i <= nrows; i++)
+    {
+        int v = i == 30 ? 0 : i <= 20 ? 1000 + i : i;
+        int w = i <= 20 ? i : i <= 100 ? 7 : i % 10;
+        check_updated(db, i, v, w, w < 5 ? 200 : 8);
+    }
+    ck_assert_int_eq(count_rows(db, "SELECT id FROM u WHERE v = 250;", Op_IdxPKey, true), 1);
+
+    /* The primary key cannot change, and values must match the columns */
+    ck_assert(chidb_prepare(db, "UPDATE u SET id = 5 WHERE v = 1;", &stmt) == CHIDB_EINVALIDSQL);
+    ck_assert(chidb_prepare(db, "UPDATE u SET z = 5;", &stmt) == CHIDB_EINVALIDSQL);
+    ck_assert(chidb_prepare(db, "UPDATE u SET v = 1, v = 2;", &stmt) == CHIDB_EINVALIDSQL);
+    ck_assert(chidb_prepare(db, "UPDATE u SET w = t;", &stmt) == CHIDB_EINVALIDSQL);
+    ck_assert(chidb_prepare(db, "UPDATE u SET w = ;", &stmt) == CHIDB_EINVALIDSQL);
+
+    ck_assert(chidb_close(db) == CHIDB_OK);
+    delete_tmp_file(fname);
+}
+END_TEST
+
+START_TEST (test_backup)
+{
+    chidb *db, *copy;
+    chidb_backup *backup, *backup2;
+    int rc, steps = 0;
+
+    char *fname = create_tmp_file();
+    char *fname2 = create_tmp_file();
+    ck_assert(chidb_open(fname, &db) == CHIDB_OK);
+    exec_sql(db, "CREATE TABLE d(id INTEGER PRIMARY KEY, v INTEGER, t TEXT);");
+    insert_deleted_rows(db, 1, 400);
+    exec_sql(db, "CREATE INDEX iv ON d(v);");
+
+    ck_assert(chidb_backup_init(db, fname, &backup) == CHIDB_EMISUSE);
+    ck_assert(chidb_backup_init(db, fname2, &backup) == CHIDB_OK);
+    ck_assert(chidb_backup_init(db, fname2, &backup2) == CHIDB_EMISUSE);
+    ck_assert_int_eq(chidb_backup_remaining(backup), db->bt->pager->n_pages);
+    ck_assert(chidb_backup_step(backup, 10) == CHIDB_OK);
+    ck_assert_int_eq(chidb_backup_remaining(backup), db->bt->pager->n_pages - 10);
+
+    /* Pages that were already copied are written to between the steps,
+     * leaving the rows that test_vacuum checks */
+    for(int i = 1; i <= 400; i += 2)
+    {
+        char sql[64];
+        sprintf(sql, "DELETE FROM d WHERE id = %i;", i);
+        exec_sql(db, sql);
+        if(i % 50 == 1)
+            ck_assert(chidb_backup_step(backup, 10) == CHIDB_OK);
+    }
+
+    /* Nothing is copied in the middle of a transaction */
+    exec_sql(db, "BEGIN;");
+    exec_sql(db, "DELETE FROM d WHERE id = 2;");
+    ck_assert(chidb_backup_step(backup, 10) == CHIDB_EBUSY);
+    exec_sql(db, "ROLLBACK;");
+
+    while((rc = chidb_backup_step(backup, 10)) == CHIDB_OK)
+        steps++;
+    ck_assert_int_eq(rc, CHIDB_DONE);
+    ck_assert_int_gt(steps, 0);
+    ck_assert_int_eq(chidb_backup_remaining(backup), 0);
+    ck_assert(chidb_backup_finish(backup) == CHIDB_OK);
+
+    ck_assert(chidb_open(fname2, &copy) == CHIDB_OK);
+    check_vacuumed(copy);
+    ck_assert(chidb_close(copy) == CHIDB_OK);
+
+    /* A backup that is done can carry on with the changes made since */
+    ck_assert(chidb_backup_init(db, fname2, &backup) == CHIDB_OK);
+    ck_assert(chidb_backup_step(backup, 0) == CHIDB_DONE);
+    exec_sql(db, "DELETE FROM d WHERE id = 400;");
+    ck_assert_int_gt(chidb_backup_remaining(backup), 0);
+    ck_assert(chidb_backup_step(backup, 0) == CHIDB_DONE);
+    ck_assert(chidb_backup_finish(backup) == CHIDB_OK);
+
+    ck_assert(chidb_open(fname2, &copy) == CHIDB_OK);
+    ck_assert_int_eq(count_rows(copy, "SELECT id FROM d;", Op_Rewind, true), 199);
+    ck_assert(chidb_close(copy) == CHIDB_OK);
+
+    ck_assert(chidb_close(db) == CHIDB_OK);
+    delete_tmp_file(fname2);
+    delete_tmp_file(fname);
+}
+END_TEST
+
+START_TEST (test_memory_db)
+{
+    chidb *db, *db2;
+    chidb_stmt *stmt;
+    npage_t npages;
+
+    ck_assert(chidb_open(":memory:", &db) == CHIDB_OK);
+    ck_assert(chidb_open(":memory:", &db2) == CHIDB_OK);
+    exec_sql(db, "CREATE TABLE d(id INTEGER PRIMARY KEY, v INTEGER, t TEXT);");
+
+    /* The same rows as in test_vacuum */
+    insert_deleted_rows(db, 301, 400);
+    insert_deleted_rows(db, 1, 100);
+    insert_deleted_rows(db, 201, 300);
+    insert_deleted_rows(db, 101, 200);
+    exec_sql(db, "CREATE INDEX iv ON d(v);");
+    for(int i = 1; i <= 400; i += 2)
+    {
+        char sql[64];
+        sprintf(sql, "DELETE FROM d WHERE id = %i;", i);
+        exec_sql(db, sql);
+    }
+    check_vacuumed(db);
+
+    /* Transactions roll back, with the journal in memory */
+    exec_sql(db, "BEGIN;");
+    exec_sql(db, "DELETE FROM d WHERE id = 2;");
+    insert_deleted_rows(db, 1000, 1000);
+    exec_sql(db, "ROLLBACK;");
+    check_vacuumed(db);
+
+    npages = db->bt->pager->n_pages;
+    exec_sql(db, "VACUUM;");
+    ck_assert_int_lt(db->bt->pager->n_pages, npages);
+    check_vacuumed(db);
+
+    /* Nothing went to disk, and the other handle is a database of its own */
+    ck_assert(access(":memory:", F_OK) != 0);
+    ck_assert(access(":memory:-journal", F_OK) != 0);
+    ck_assert(chidb_prepare(db2, "SELECT id FROM d;", &stmt) == CHIDB_EINVALIDSQL);
+
+    ck_assert(chidb_close(db2) == CHIDB_OK);
+    ck_assert(chidb_close(db) == CHIDB_OK);
+}
+END_TEST
+
+START_TEST (test_page_size)
+{
+    chidb *db;
+    chidb_stmt *stmt;
+    int sizes[] = {512, 4096, 65536};
+
+    for(int i = 0; i < 3; i++)
+    {
+        char *fname = create_tmp_file();
+        char sql[64];
+
+        ck_assert(chidb_open(fname, &db) == CHIDB_OK);
+        ck_assert(chidb_set_page_size(db, 1000) == CHIDB_EMISUSE);
+        ck_assert(chidb_set_page_size(db, 256) == CHIDB_EMISUSE);
+        ck_assert(chidb_set_page_size(db, 131072) == CHIDB_EMISUSE);
+        sprintf(sql, "PRAGMA page_size = %i;", sizes[i]);
+        exec_sql(db, sql);
+        ck_assert_int_eq(db->bt->pager->page_size, sizes[i]);
+        ck_assert_int_eq(file_size(fname), sizes[i]);
+
+        exec_sql(db, "CREATE TABLE d(id INTEGER PRIMARY KEY, v INTEGER, t TEXT);");
+        insert_deleted_rows(db, 1, 400);
+        exec_sql(db, "CREATE INDEX iv ON d(v);");
+        exec_sql(db, "DELETE FROM d WHERE id > 200;");
+
+        /* Only while the database is empty */
+        ck_assert(chidb_set_page_size(db, 1024) == CHIDB_EMISUSE);
+        ck_assert(chidb_prepare(db, "PRAGMA page_size = 1024;", &stmt) == CHIDB_OK);
+        ck_assert(chidb_step(stmt) == CHIDB_EMISUSE);
+        ck_assert(chidb_finalize(stmt) == CHIDB_OK);
+
+        /* The page size is read back from the file, and kept by VACUUM */
+        ck_assert(chidb_close(db) == CHIDB_OK);
+        ck_assert(chidb_open(fname, &db) == CHIDB_OK);
+        ck_assert_int_eq(db->bt->pager->page_size, sizes[i]);
+        ck_assert_int_eq(count_rows(db, "SELECT id FROM d;", Op_IdxPKey, false), 200);
+        ck_assert_int_eq(count_rows(db, "SELECT id FROM d WHERE v > 300;", Op_IdxPKey, true), 100);
+        exec_sql(db, "VACUUM;");
+        ck_assert_int_eq(file_size(fname) % sizes[i], 0);
+        ck_assert_int_eq(count_rows(db, "SELECT id FROM d WHERE v > 300;", Op_IdxPKey, true), 100);
+
+        ck_assert(chidb_close(db) == CHIDB_OK);
+        delete_tmp_file(fname);
+    }
+}
+END_TEST
+
+START_TEST (test_analyze)
+{
+    chidb *db;
+    chidb_stmt *stmt;
+    chidb_tree_stats_t *ts;
+    chidb_column_stats_t *cs;
+    char sql[128];
+    int n = 0;
+
+    char *fname = create_tmp_file();
+    ck_assert(chidb_open(fname, &db) == CHIDB_OK);
+
+    exec_sql(db, "CREATE TABLE c(cid INTEGER PRIMARY KEY, code INTEGER, z INTEGER);");
+    exec_sql(db, "CREATE TABLE f(fid INTEGER PRIMARY KEY, code INTEGER);");
+    for(int i = 1; i <= 1000; i++)
+    {
+        sprintf(sql, "INSERT INTO c VALUES(%i, %i, %i);", i, 3 * i, i % 7);
+        exec_sql(db, sql);
+        sprintf(sql, "INSERT INTO f VALUES(%i, %i);", i, 3 * i);
+        exec_sql(db, sql);
+    }
+    exec_sql(db, "CREATE INDEX icode ON c(code);");
+
+    /* Without stats, a range on an indexed column uses the index, and
+     * a join is hashed unless looking up every row is cheaper (here, in
+     * the index and then in c) */
+    ck_assert(chidb_stats_tree(db, "c") == NULL);
+    ck_assert_int_eq(count_rows(db, "SELECT z FROM c WHERE code > 30;", Op_IdxPKey, true), 990);
+    ck_assert_int_eq(count_rows(db, "SELECT fid, z FROM f NATURAL JOIN c WHERE fid <= 20;", Op_OpenHash, true), 20);
+
+    exec_sql(db, "ANALYZE;");
+
+    ck_assert((ts = chidb_stats_tree(db, "c")) != NULL);
+    ck_assert_int_eq(ts->nrows, 1000);
+    ck_assert_int_eq(ts->ncols, 3);
+    ck_assert(ts->depth >= 2 && ts->npages > 1);
+    ck_assert((cs = chidb_stats_column(db, "c", "z")) != NULL);
+    ck_assert_int_eq(cs->ndistinct, 7);
+    ck_assert(cs->has_range && cs->lo == 0 && cs->hi == 6);
+    ck_assert((cs = chidb_stats_column(db, "c", "code")) != NULL);
+    ck_assert_int_eq(cs->ndistinct, 1000);
+    ck_assert(cs->lo == 3 && cs->hi == 3000);
+    ck_assert((ts = chidb_stats_tree(db, "icode")) != NULL);
+    ck_assert_int_eq(ts->nrows, 1000);
+    ck_assert(chidb_stats_tree(db, STATS_TABLE) == NULL);
+    ck_assert(chidb_catalog_table(db, STATS_TABLE) == NULL);
+
+    /* The stats table is a table like any other */
+    ck_assert(chidb_prepare(db, "SELECT name, col, nrows, ndistinct FROM chidb_stat;", &stmt) == CHIDB_OK);
+    while(chidb_step(stmt) == CHIDB_ROW)
+    {
+        if(strcmp(chidb_column_text(stmt, 0), "f") == 0 && strcmp(chidb_column_text(stmt, 1), "code") == 0)
+        {
+            ck_assert_int_eq(chidb_column_int(stmt, 2), 1000);
+            ck_assert_int_eq(chidb_column_int(stmt, 3), 1000);
+        }
+        n++;
+    }
+    ck_assert(chidb_finalize(stmt) == CHIDB_OK);
+    ck_assert_int_eq(n, 3 + 2 + 1);
+
+    /* With them, the index is only used if few rows match (or if it has
+     * all the columns needed, and is smaller than the table), and only the
+     * few rows of f that match the WHERE are looked up in c */
+    ck_assert_int_eq(count_rows(db, "SELECT z FROM c WHERE code > 30;", Op_IdxPKey, false), 990);
+    ck_assert_int_eq(count_rows(db, "SELECT z FROM c WHERE code >= 2997;", Op_IdxPKey, true), 2);
+    ck_assert_int_eq(count_rows(db, "SELECT z FROM c WHERE code = 300;", Op_IdxPKey, true), 1);
+    ck_assert_int_eq(count_rows(db, "SELECT cid FROM c WHERE code > 30;", Op_IdxPKey, true), 990);
+    ck_assert_int_eq(count_rows(db, "SELECT fid, cid FROM f NATURAL JOIN c WHERE fid <= 20;", Op_IdxPKey, true), 20);
+
+    /* The stats are kept in the file, and a second ANALYZE replaces them */
+    ck_assert(chidb_close(db) == CHIDB_OK);
+    ck_assert(chidb_open(fname, &db) == CHIDB_OK);
+    ck_assert(chidb_catalog_table(db, STATS_TABLE) != NULL);
+    ck_assert((ts = chidb_stats_tree(db, "c")) != NULL);
+    ck_assert_int_eq(ts->nrows, 1000);
+    ck_assert_int_eq(chidb_stats_column(db, "c", "z")->ndistinct, 7);
+    ck_assert_int_eq(count_rows(db, "SELECT z FROM c WHERE code > 30;", Op_IdxPKey, false), 990);
+
+    exec_sql(db, "INSERT INTO c VALUES(1001, 7, 7);");
+    ck_assert(chidb_prepare(db, " analyze ", &stmt) == CHIDB_OK);
+    ck_assert(chidb_step(stmt) == CHIDB_DONE);
+    ck_assert(chidb_finalize(stmt) == CHIDB_OK);
+    ck_assert_int_eq(chidb_stats_tree(db, "c")->nrows, 1001);
+    ck_assert_int_eq(chidb_stats_column(db, "c", "z")->ndistinct, 8);
+    ck_assert(chidb_close(db) == CHIDB_OK);
+
+    ck_assert(chidb_open(fname, &db) == CHIDB_OK);
+    ck_assert_int_eq(chidb_stats_tree(db, "c")->nrows, 1001);
+    ck_assert_int_eq(count_rows(db, "SELECT * FROM chidb_stat;", Op_Halt, true), 6);
+    ck_assert(chidb_close(db) == CHIDB_OK);
+
+    delete_tmp_file(fname);
+}
+END_TEST
+
+START_TEST (test_analyze_distinct)
+{
+    chidb *db;
+    char sql[128];
+
+    char *fname = create_tmp_file();
+    ck_assert(chidb_open(fname, &db) == CHIDB_OK);
+
+    /* Past STATS_KMV_SIZE distinct values, the count is an estimate */
+    exec_sql(db, "CREATE TABLE t(id INTEGER PRIMARY KEY, v INTEGER, s INTEGER);");
+    for(int i = 1; i <= 5000; i++)
+    {
+        sprintf(sql, "INSERT INTO t VALUES(%i, %i, %i);", i, i / 2, i % 1000);
+        exec_sql(db, sql);
+    }
+    exec_sql(db, "ANALYZE;");
+
+    ck_assert_int_eq(chidb_stats_column(db, "t", "id")->ndistinct, 5000);
+    ck_assert_int_eq(chidb_stats_column(db, "t", "s")->ndistinct, 1000);
+    uint32_t v = chidb_stats_column(db, "t", "v")->ndistinct;
+    ck_assert_msg(v > 2250 && v < 2750, "Estimated %u distinct values instead of 2501", v);
+
+    ck_assert(chidb_close(db) == CHIDB_OK);
+    delete_tmp_file(fname);
+}
+END_TEST
+
+
+START_TEST (test_transactions)
+{
+    chidb *db;
+    chidb_stmt *stmt;
+    char row[32];
+    const char *rows[300];
+
+    char *fname = create_tmp_file();
+    ck_assert(chidb_open(fname, &db) == CHIDB_OK);
+
+    exec_sql(db, "CREATE TABLE s(id INTEGER PRIMARY KEY, v INTEGER);");
+    for(int i = 0; i < 300; i++)
+    {
+        sprintf(row, "%i|%i", 1 + i, 2 * (1 + i));
+        rows[i] = strdup(row);
+    }
+
+    exec_sql(db, "BEGIN;");
+    ck_assert(chidb_insert_rows(db, "s", rows, 300) == CHIDB_OK);
+    check_inserted(db, 1, 300);
+    exec_sql(db, "ROLLBACK;");
+    check_inserted(db, 1, 0);
+
+    exec_sql(db, "begin transaction");
+    ck_assert(chidb_insert_rows(db, "s", rows, 200) == CHIDB_OK);
+    exec_sql(db, "INSERT INTO s VALUES (201, 402), (202, 404);");
+    exec_sql(db, "COMMIT TRANSACTION;");
+    check_inserted(db, 1, 202);
+
+    /* Tables created in a rolled back transaction are gone */
+    exec_sql(db, "BEGIN;");
+    exec_sql(db, "CREATE TABLE t(id INTEGER PRIMARY KEY, w INTEGER);");
+    exec_sql(db, "INSERT INTO t VALUES (1, 1);");
+    ck_assert(chidb_insert_rows(db, "s", rows + 202, 98) == CHIDB_OK);
+    exec_sql(db, "ROLLBACK;");
+    ck_assert(chidb_prepare(db, "SELECT w FROM t;", &stmt) != CHIDB_OK);
+    check_inserted(db, 1, 202);
+
+    /* Only one transaction at a time, and nothing to end outside one */
+    exec_sql(db, "BEGIN;");
+    ck_assert(chidb_prepare(db, "BEGIN;", &stmt) == CHIDB_OK);
+    ck_assert(chidb_step(stmt) == CHIDB_EMISUSE);
+    ck_assert(chidb_finalize(stmt) == CHIDB_OK);
+    exec_sql(db, "END;");
+    ck_assert(chidb_prepare(db, "COMMIT;", &stmt) == CHIDB_OK);
+    ck_assert(chidb_step(stmt) == CHIDB_EMISUSE);
+    ck_assert(chidb_finalize(stmt) == CHIDB_OK);
+
+    /* Closing the database rolls back the open transaction */
+    exec_sql(db, "BEGIN;");
+    ck_assert(chidb_insert_rows(db, "s", rows + 202, 98) == CHIDB_OK);
+    ck_assert(chidb_close(db) == CHIDB_OK);
+    ck_assert(chidb_open(fname, &db) == CHIDB_OK);
+    check_inserted(db, 1, 202);
+
+    for(int i = 0; i < 300; i++)
+        free((char *) rows[i]);
+
+    ck_assert(chidb_close(db) == CHIDB_OK);
+    delete_tmp_file(fname);
+}
+END_TEST
+
+START_TEST (test_wal)
+{
+    chidb *db, *db2;
+    chidb_stmt *stmt;
+    char row[32];
+    const char *rows[400];
+    int n = 0;
+
+    char *fname = create_tmp_file();
+    ck_assert(chidb_open(fname, &db) == CHIDB_OK);
+    exec_sql(db, "CREATE TABLE s(id INTEGER PRIMARY KEY, v INTEGER);");
+    for(int i = 0; i < 400; i++)
+    {
+        sprintf(row, "%i|%i", 1 + i, 2 * (1 + i));
+        rows[i] = strdup(row);
+    }
+    ck_assert(chidb_insert_rows(db, "s", rows, 100) == CHIDB_OK);
+
+    ck_assert(chidb_set_journal_mode(db, 2) == CHIDB_EMISUSE);
+    ck_assert(chidb_set_journal_mode(db, CHIDB_JOURNAL_WAL) == CHIDB_OK);
+    ck_assert(chidb_open(fname, &db2) == CHIDB_OK);
+    ck_assert(db2->bt->pager->wal != NULL);
+
+    /* A query keeps reading from its snapshot while rows are committed */
+    ck_assert(chidb_prepare(db2, "SELECT id, v FROM s;", &stmt) == CHIDB_OK);
+    ck_assert(chidb_step(stmt) == CHIDB_ROW);
+    ck_assert(chidb_insert_rows(db, "s", rows + 100, 200) == CHIDB_OK);
+    check_inserted(db, 1, 300);
+    for(n = 1; chidb_step(stmt) == CHIDB_ROW; n++)
+        ;
+    ck_assert_int_eq(n, 100);
+    ck_assert(chidb_finalize(stmt) == CHIDB_OK);
+    check_inserted(db2, 1, 300);
+
+    /* One writer at a time */
+    exec_sql(db, "BEGIN;");
+    exec_sql(db, "INSERT INTO s VALUES (301, 602);");
+    ck_assert(chidb_prepare(db2, "INSERT INTO s VALUES (302, 604);", &stmt) == CHIDB_OK);
+    ck_assert(chidb_step(stmt) == CHIDB_EBUSY);
+    ck_assert(chidb_finalize(stmt) == CHIDB_OK);
+    check_inserted(db2, 1, 300);
+    exec_sql(db, "COMMIT;");
+    check_inserted(db2, 1, 301);
+
+    ck_assert(chidb_checkpoint(db2) == CHIDB_OK);
+    ck_assert(chidb_insert_rows(db2, "s", rows + 301, 99) == CHIDB_OK);
+    check_inserted(db, 1, 400);
+
+    /* The mode is kept in the file */
+    ck_assert(chidb_close(db2) == CHIDB_OK);
+    ck_assert(chidb_close(db) == CHIDB_OK);
+    ck_assert(chidb_open(fname, &db) == CHIDB_OK);
+    ck_assert(db->bt->pager->wal != NULL);
+    check_inserted(db, 1, 400);
+    ck_assert(chidb_set_journal_mode(db, CHIDB_JOURNAL_ROLLBACK) == CHIDB_OK);
+    ck_assert(chidb_close(db) == CHIDB_OK);
+    ck_assert(chidb_open(fname, &db) == CHIDB_OK);
+    ck_assert(db->bt->pager->wal == NULL);
+    check_inserted(db, 1, 400);
+
+    for(int i = 0; i < 400; i++)
+        free((char *) rows[i]);
+
+    ck_assert(chidb_close(db) == CHIDB_OK);
+    delete_tmp_file(fname);
+}
+END_TEST
+
+/* Checks that a query returns the rows of p with v == mod, in order.
+ * Returns whether the table was scanned in parallel. */
+static bool check_scan(chidb *db, const char *sql, int mod)
+{
+    chidb_stmt *stmt;
+    char name[32];
+    bool parallel;
+    int rc, id = mod;
+
+    ck_assert(chidb_prepare(db, sql, &stmt) == CHIDB_OK);
+    if(mod >= 0)
+        ck_assert(chidb_bind_int(stmt, 1, mod) == CHIDB_OK);
+    else
+        id = 3;
+    while((rc = chidb_step(stmt)) == CHIDB_ROW)
+    {
+        if(id == 0)
+            id = 7;
+        sprintf(name, "name%i", id);
+        ck_assert_int_eq(chidb_column_int(stmt, 0), id);
+        ck_assert_str_eq(chidb_column_text(stmt, 1), name);
+        id += 7;
+    }
+    ck_assert_int_eq(rc, CHIDB_DONE);
+    ck_assert_int_gt(id, 3000);
+    parallel = stmt->scan != NULL;
+    ck_assert(chidb_finalize(stmt) == CHIDB_OK);
+
+    return parallel;
+}
+
+START_TEST (test_parallel_scan)
+{
+    chidb *db;
+    chidb_stmt *stmt;
+    char row[64];
+    const char *rows[3000];
+
+    char *fname = create_tmp_file();
+    ck_assert(chidb_open(fname, &db) == CHIDB_OK);
+    exec_sql(db, "CREATE TABLE p(id INTEGER PRIMARY KEY, v INTEGER, t TEXT);");
+    for(int i = 0; i < 3000; i++)
+    {
+        sprintf(row, "%i|%i|name%i", 1 + i, (1 + i) % 7, 1 + i);
+        rows[i] = strdup(row);
+    }
+    ck_assert(chidb_insert_rows(db, "p", rows, 3000) == CHIDB_OK);
+
+    ck_assert(chidb_set_scan_threads(db, 0) == CHIDB_EMISUSE);
+    ck_assert(chidb_set_scan_threads(db, 1) == CHIDB_OK);
+    ck_assert(!check_scan(db, "SELECT id, t FROM p WHERE v = 3;", -1));
+
+    /* Same rows, in the same order */
+    ck_assert(chidb_set_scan_threads(db, 4) == CHIDB_OK);
+    ck_assert(check_scan(db, "SELECT id, t FROM p WHERE v = 3;", -1));
+    for(int mod = 0; mod < 7; mod++)
+        ck_assert(check_scan(db, "SELECT id, t FROM p WHERE v = ?;", mod));
+
+    /* A scan can be stopped, and run again */
+    ck_assert(chidb_prepare(db, "SELECT id, t FROM p WHERE v = 3;", &stmt) == CHIDB_OK);
+    ck_assert(chidb_step(stmt) == CHIDB_ROW);
+    ck_assert_int_eq(chidb_column_int(stmt, 0), 3);
+    ck_assert(chidb_reset(stmt) == CHIDB_OK);
+    ck_assert(stmt->scan == NULL);
+    ck_assert(chidb_step(stmt) == CHIDB_ROW);
+    ck_assert_int_eq(chidb_column_int(stmt, 0), 3);
+    ck_assert(chidb_finalize(stmt) == CHIDB_OK);
+
+    /* Without a filter, it isn't worth it */
+    ck_assert(chidb_prepare(db, "SELECT id, t FROM p;", &stmt) == CHIDB_OK);
+    ck_assert(chidb_step(stmt) == CHIDB_ROW);
+    ck_assert(stmt->scan == NULL);
+    ck_assert(chidb_finalize(stmt) == CHIDB_OK);
+
+    for(int i = 0; i < 3000; i++)
+        free((char *) rows[i]);
+
+    ck_assert(chidb_close(db) == CHIDB_OK);
+    delete_tmp_file(fname);
+}
+END_TEST
+
+struct scan_thread
+{
+    chidb *db;
+    int nrows;      // Fewest rows seen by a scan
+    bool ok;        // Every row seen was the right one
+};
+
+/* Scans the table over and over, from a thread of its own */
+static void *scan_table(void *arg)
+{
+    struct scan_thread *t = arg;
+    chidb_stmt *stmt;
+
+    t->nrows = -1;
+    t->ok = chidb_prepare(t->db, "SELECT id, v FROM s;", &stmt) == CHIDB_OK;
+
+    for(int i = 0; i < 10 && t->ok; i++)
+    {
+        int n = 0, rc;
+
+        while((rc = chidb_step(stmt)) == CHIDB_ROW)
+        {
+            if(chidb_column_int(stmt, 1) != 2 * chidb_column_int(stmt, 0))
+                t->ok = false;
+            n++;
+        }
+        if(rc != CHIDB_DONE || chidb_reset(stmt) != CHIDB_OK)
+            t->ok = false;
+        if(t->nrows < 0 || n < t->nrows)
+            t->nrows = n;
+    }
+
+    if(t->ok)
+        t->ok = chidb_finalize(stmt) == CHIDB_OK;
+
+    return NULL;
+}
+
+/* Inserts rows 1001 to 1200, from a thread of its own */
+static void *insert_table(void *arg)
+{
+    struct scan_thread *t = arg;
+    chidb_stmt *stmt;
+
+    t->ok = chidb_prepare(t->db, "INSERT INTO s VALUES (?, ?);", &stmt) == CHIDB_OK;
+    for(int i = 1001; i <= 1200 && t->ok; i++)
+    {
+        t->ok = chidb_bind_int(stmt, 1, i) == CHIDB_OK
+                && chidb_bind_int(stmt, 2, 2 * i) == CHIDB_OK
+                && chidb_step(stmt) == CHIDB_DONE
+                && chidb_reset(stmt) == CHIDB_OK;
+    }
+    if(t->ok)
+        t->ok = chidb_finalize(stmt) == CHIDB_OK;
+
+    return NULL;
+}
+
+START_TEST (test_threadsafe)
+{
+    chidb *db;
+    char row[32];
+    const char *rows[1000];
+    struct scan_thread threads[5];
+    pthread_t tid[5];
+
+    char *fname = create_tmp_file();
+    ck_assert(chidb_open(fname, &db) == CHIDB_OK);
+    exec_sql(db, "CREATE TABLE s(id INTEGER PRIMARY KEY, v INTEGER);");
+    for(int i = 0; i < 1000; i++)
+    {
+        sprintf(row, "%i|%i", 1 + i, 2 * (1 + i));
+        rows[i] = strdup(row);
+    }
+    ck_assert(chidb_insert_rows(db, "s", rows, 1000) == CHIDB_OK);
+
+    /* Few enough frames that the threads keep evicting each other's pages */
+    ck_assert(chidb_Pager_setCacheSize(db->bt->pager, 8) == CHIDB_OK);
+    ck_assert(chidb_set_threadsafe(db, 1) == CHIDB_OK);
+
+    for(int i = 0; i < 5; i++)
+    {
+        threads[i].db = db;
+        ck_assert(pthread_create(&tid[i], NULL, i < 4 ? scan_table : insert_table, &threads[i]) == 0);
+    }
+    for(int i = 0; i < 5; i++)
+    {
+        ck_assert(pthread_join(tid[i], NULL) == 0);
+        ck_assert(threads[i].ok);
+    }
+    for(int i = 0; i < 4; i++)
+        ck_assert(threads[i].nrows >= 1000 && threads[i].nrows <= 1200);
+
+    check_inserted(db, 1, 1200);
+
+    for(int i = 0; i < 1000; i++)
+        free((char *) rows[i]);
+
+    ck_assert(chidb_close(db) == CHIDB_OK);
+    delete_tmp_file(fname);
+}
+END_TEST
+
+/* Inserts five rows, one commit each, from a thread of its own */
+static void *insert_five(void *arg)
+{
+    struct scan_thread *t = arg;
+    chidb_stmt *stmt;
+
+    t->ok = chidb_prepare(t->db, "INSERT INTO s VALUES (?, ?);", &stmt) == CHIDB_OK;
+    for(int i = t->nrows; i < t->nrows + 5 && t->ok; i++)
+    {
+        t->ok = chidb_bind_int(stmt, 1, i) == CHIDB_OK
+                && chidb_bind_int(stmt, 2, 2 * i) == CHIDB_OK
+                && chidb_step(stmt) == CHIDB_DONE
+                && chidb_reset(stmt) == CHIDB_OK;
+    }
+    if(t->ok)
+        t->ok = chidb_finalize(stmt) == CHIDB_OK;
+
+    return NULL;
+}
+
+START_TEST (test_group_commit)
+{
+    chidb *db;
+    Pager *pager;
+    struct scan_thread threads[4];
+    pthread_t tid[4];
+
+    char *fname = create_tmp_file();
+    ck_assert(chidb_open(fname, &db) == CHIDB_OK);
+    exec_sql(db, "CREATE TABLE s(id INTEGER PRIMARY KEY, v INTEGER);");
+    ck_assert(chidb_set_journal_mode(db, CHIDB_JOURNAL_WAL) == CHIDB_OK);
+    ck_assert(chidb_set_commit_delay(db, -1) == CHIDB_EMISUSE);
+    ck_assert(chidb_set_commit_delay(db, 20000) == CHIDB_OK);
+    ck_assert(chidb_set_threadsafe(db, 1) == CHIDB_OK);
+    pager = db->bt->pager;
+
+    for(int i = 0; i < 4; i++)
+    {
+        threads[i].db = db;
+        threads[i].nrows = 1 + 5 * i;
+        ck_assert(pthread_create(&tid[i], NULL, insert_five, &threads[i]) == 0);
+    }
+    for(int i = 0; i < 4; i++)
+    {
+        ck_assert(pthread_join(tid[i], NULL) == 0);
+        ck_assert(threads[i].ok);
+    }
+
+    /* Every commit is durable, and some shared a sync */
+    ck_assert(pager->commit_seq == 20);
+    ck_assert(pager->synced_seq == 20);
+    ck_assert(pager->group_syncs < 20);
+
+    check_inserted(db, 1, 20);
+
+    ck_assert(chidb_close(db) == CHIDB_OK);
+    delete_tmp_file(fname);
+}
+END_TEST
+
+/* Prepares statements that all need parsing (no two are the same) */
+static void *prepare_many(void *arg)
+{
+    struct scan_thread *t = arg;
+    chidb_stmt *stmt;
+    char sql[64];
+
+    t->ok = true;
+    for(int i = 0; i < 2000 && t->ok; i++)
+    {
+        int id = 1 + i % 50;
+
+        sprintf(sql, "SELECT v FROM s WHERE id = %i AND v > %i;", id, -i);
+        t->ok = chidb_prepare(t->db, sql, &stmt) == CHIDB_OK
+                && chidb_step(stmt) == CHIDB_ROW
+                && chidb_column_int(stmt, 0) == 2 * id
+                && chidb_step(stmt) == CHIDB_DONE
+                && chidb_finalize(stmt) == CHIDB_OK;
+    }
+
+    return NULL;
+}
+
+START_TEST (test_parse_threads)
+{
+    char *fnames[4];
+    struct scan_thread threads[4];
+    pthread_t tid[4];
+
+    /* Each thread has a database of its own, so only the parser is shared */
+    for(int i = 0; i < 4; i++)
+    {
+        fnames[i] = create_tmp_file();
+        ck_assert(chidb_open(fnames[i], &threads[i].db) == CHIDB_OK);
+        exec_sql(threads[i].db, "CREATE TABLE s(id INTEGER PRIMARY KEY, v INTEGER);");
+        for(int j = 1; j <= 50; j++)
+        {
+            char sql[64];
+
+            sprintf(sql, "INSERT INTO s VALUES (%i, %i);", j, 2 * j);
+            exec_sql(threads[i].db, sql);
+        }
+    }
+
+    for(int i = 0; i < 4; i++)
+        ck_assert(pthread_create(&tid[i], NULL, prepare_many, &threads[i]) == 0);
+    for(int i = 0; i < 4; i++)
+    {
+        ck_assert(pthread_join(tid[i], NULL) == 0);
+        ck_assert(threads[i].ok);
+    }
+
+    for(int i = 0; i < 4; i++)
+    {
+        ck_assert(chidb_close(threads[i].db) == CHIDB_OK);
+        delete_tmp_file(fnames[i]);
+    }
+}
+END_TEST
+
+START_TEST (test_explain_analyze)
+{
+    chidb *db;
+    chidb_stmt *stmt;
+    int rc, n = 0, nexts = -1, rows = -1;
+    int64_t pages = 0;
+
+    char *fname = create_tmp_file();
+    ck_assert(chidb_open(fname, &db) == CHIDB_OK);
+
+    exec_sql(db, "CREATE TABLE t(id INTEGER PRIMARY KEY, v INTEGER);");
+    ck_assert(chidb_prepare(db, "INSERT INTO t VALUES (?, ?);", &stmt) == CHIDB_OK);
+    for(int i = 1; i <= 2000; i++)
+    {
+        ck_assert(chidb_bind_int(stmt, 1, i) == CHIDB_OK);
+        ck_assert(chidb_bind_int(stmt, 2, i * 2) == CHIDB_OK);
+        ck_assert(chidb_step(stmt) == CHIDB_DONE);
+        ck_assert(chidb_reset(stmt) == CHIDB_OK);
+    }
+    ck_assert(chidb_finalize(stmt) == CHIDB_OK);
+
+    /* Plain EXPLAIN does not get the extra columns */
+    ck_assert(chidb_prepare(db, "EXPLAIN SELECT * FROM t;", &stmt) == CHIDB_OK);
+    ck_assert_int_eq(chidb_column_count(stmt), 6);
+    ck_assert(chidb_column_name(stmt, 6) == NULL);
+    ck_assert(chidb_finalize(stmt) == CHIDB_OK);
+
+    ck_assert(chidb_prepare(db, "EXPLAIN ANALYZE SELECT * FROM t;", &stmt) == CHIDB_OK);
+    ck_assert_int_eq(chidb_column_count(stmt), 10);
+    ck_assert_str_eq(chidb_column_name(stmt, 6), "count");
+    ck_assert_str_eq(chidb_column_name(stmt, 7), "time_ns");
+    ck_assert_str_eq(chidb_column_name(stmt, 8), "pages");
+    ck_assert_str_eq(chidb_column_name(stmt, 9), "cursor");
+
+    while((rc = chidb_step(stmt)) == CHIDB_ROW)
+    {
+        const char *opcode = chidb_column_text(stmt, 1);
+
+        ck_assert_int_eq(chidb_column_int(stmt, 0), n++);
+        if(!strcmp(opcode, "Next"))
+            nexts = chidb_column_int64(stmt, 6);
+        else if(!strcmp(opcode, "ResultRow"))
+            rows = chidb_column_int64(stmt, 6);
+
+        if(chidb_column_type(stmt, 9) == SQL_NULL)
+            ck_assert_int_eq(chidb_column_int64(stmt, 8), 0);
+        else
+        {
+            ck_assert_int_eq(chidb_column_int(stmt, 9), 0);
+            pages += chidb_column_int64(stmt, 8);
+        }
+    }
+    ck_assert(rc == CHIDB_DONE);
+    ck_assert_int_eq(n, stmt->endOp);
+    ck_assert_int_eq(rows, 2000);
+    ck_assert_int_eq(nexts, 2000);
+
+    /* Every leaf of the table is read at least once */
+    ck_assert_int_ge(pages, 2000 * 8 / 1024);
+    ck_assert(chidb_finalize(stmt) == CHIDB_OK);
+
+    /* The program really runs */
+    ck_assert(chidb_prepare(db, "EXPLAIN ANALYZE INSERT INTO t VALUES (2001, 0);", &stmt) == CHIDB_OK);
+    while((rc = chidb_step(stmt)) == CHIDB_ROW)
+        ;
+    ck_assert(rc == CHIDB_DONE);
+    ck_assert(chidb_finalize(stmt) == CHIDB_OK);
+    ck_assert(chidb_prepare(db, "EXPLAIN ANALYZE INSERT INTO t VALUES (2001, 0);", &stmt) == CHIDB_OK);
+    ck_assert(chidb_step(stmt) == CHIDB_ECONSTRAINT);
+    ck_assert(chidb_finalize(stmt) == CHIDB_OK);
+
+    ck_assert(chidb_prepare(db, "EXPLAIN ANALYZE EXPLAIN SELECT * FROM t;", &stmt) == CHIDB_EINVALIDSQL);
+
+    ck_assert(chidb_close(db) == CHIDB_OK);
+    delete_tmp_file(fname);
+}
+END_TEST
+
+START_TEST (test_counters)
+{
+    chidb *db;
+    chidb_stmt *stmt;
+    chidb_counters_t c;
+    int rc, n = 0;
+
+    char *fname = create_tmp_file();
+    ck_assert(chidb_open(fname, &db) == CHIDB_OK);
+
+    exec_sql(db, "CREATE TABLE t(id INTEGER PRIMARY KEY, v INTEGER);");
+    ck_assert(chidb_prepare(db, "INSERT INTO t VALUES (?, ?);", &stmt) == CHIDB_OK);
+    for(int i = 1; i <= 2000; i++)
+    {
+        ck_assert(chidb_bind_int(stmt, 1, i) == CHIDB_OK);
+        ck_assert(chidb_bind_int(stmt, 2, i * 2) == CHIDB_OK);
+        ck_assert(chidb_step(stmt) == CHIDB_DONE);
+        ck_assert(chidb_reset(stmt) == CHIDB_OK);
+    }
+    ck_assert(chidb_finalize(stmt) == CHIDB_OK);
+
+    ck_assert(chidb_stats(db, &c, 1) == CHIDB_OK);
+    ck_assert_int_ge(c.records_packed, 2000);
+    ck_assert_int_gt(c.splits, 0);
+    ck_assert_int_gt(c.pages_allocated, c.splits);
+    ck_assert_int_gt(c.page_writes, 0);
+    ck_assert_int_eq(c.bytes_written, c.page_writes * db->bt->pager->page_size);
+    ck_assert_int_eq(c.cache_hits + c.cache_misses, c.page_reads);
+
+    /* Reset */
+    ck_assert(chidb_stats(db, &c, 0) == CHIDB_OK);
+    ck_assert_int_eq(c.page_reads, 0);
+    ck_assert_int_eq(c.page_writes, 0);
+    ck_assert_int_eq(c.splits, 0);
+    ck_assert_int_eq(c.records_packed, 0);
+
+    ck_assert(chidb_prepare(db, "SELECT * FROM t;", &stmt) == CHIDB_OK);
+    while((rc = chidb_step(stmt)) == CHIDB_ROW)
+        n++;
+    ck_assert(rc == CHIDB_DONE);
+    ck_assert_int_eq(n, 2000);
+    ck_assert(chidb_finalize(stmt) == CHIDB_OK);
+
+    ck_assert(chidb_stats(db, &c, 1) == CHIDB_OK);
+    ck_assert_int_ge(c.cursor_steps, 2000);
+    ck_assert_int_ge(c.records_unpacked, 2000);
+    ck_assert_int_gt(c.page_reads, 2000 * 8 / 1024);
+    ck_assert_int_eq(c.cache_hits + c.cache_misses, c.page_reads);
+    ck_assert_int_eq(c.page_writes, 0);
+    ck_assert_int_eq(c.splits, 0);
+
+    ck_assert(chidb_prepare(db, "SELECT v FROM t WHERE id = 1000;", &stmt) == CHIDB_OK);
+    ck_assert(chidb_step(stmt) == CHIDB_ROW);
+    ck_assert_int_eq(chidb_column_int(stmt, 0), 2000);
+    ck_assert(chidb_finalize(stmt) == CHIDB_OK);
+
+    ck_assert(chidb_stats(db, &c, 0) == CHIDB_OK);
+    ck_assert_int_eq(c.cursor_seeks, 1);
+    ck_assert_int_le(c.cursor_steps, 1);
+
+    ck_assert(chidb_close(db) == CHIDB_OK);
+    delete_tmp_file(fname);
+}
+END_TEST
+
+START_TEST (test_latency)
+{
+    chidb *db;
+    chidb_stmt *stmt;
+    chidb_latency_t l[CHIDB_LATENCY_KINDS][CHIDB_LATENCY_PHASES], h;
+    int rc;
+
+    char *fname = create_tmp_file();
+    ck_assert(chidb_open(fname, &db) == CHIDB_OK);
+
+    exec_sql(db, "CREATE TABLE t(id INTEGER PRIMARY KEY, v INTEGER);");
+    ck_assert(chidb_prepare(db, "INSERT INTO t VALUES (?, 1);", &stmt) == CHIDB_OK);
+    for(int i = 1; i <= 100; i++)
+    {
+        ck_assert(chidb_bind_int(stmt, 1, i) == CHIDB_OK);
+        ck_assert(chidb_step(stmt) == CHIDB_DONE);
+        ck_assert(chidb_reset(stmt) == CHIDB_OK);
+    }
+    ck_assert(chidb_finalize(stmt) == CHIDB_OK);
+
+    /* Prepared again, from the statement cache */
+    for(int i = 0; i < 2; i++)
+    {
+        ck_assert(chidb_prepare(db, "SELECT * FROM t;", &stmt) == CHIDB_OK);
+        while((rc = chidb_step(stmt)) == CHIDB_ROW)
+            ;
+        ck_assert(rc == CHIDB_DONE);
+        ck_assert(chidb_finalize(stmt) == CHIDB_OK);
+    }
+
+    ck_assert(chidb_latency_snapshot(db, l, 1) == CHIDB_OK);
+    ck_assert_int_eq(l[CHIDB_LATENCY_CREATE][CHIDB_LATENCY_PREPARE].count, 1);
+    ck_assert_int_eq(l[CHIDB_LATENCY_CREATE][CHIDB_LATENCY_FIRST_ROW].count, 1);
+    ck_assert_int_eq(l[CHIDB_LATENCY_INSERT][CHIDB_LATENCY_PREPARE].count, 1);
+    ck_assert_int_eq(l[CHIDB_LATENCY_INSERT][CHIDB_LATENCY_FIRST_ROW].count, 100);
+    ck_assert_int_eq(l[CHIDB_LATENCY_INSERT][CHIDB_LATENCY_NEXT_ROW].count, 0);
+    ck_assert_int_eq(l[CHIDB_LATENCY_INSERT][CHIDB_LATENCY_FINALIZE].count, 1);
+    ck_assert_int_eq(l[CHIDB_LATENCY_SELECT][CHIDB_LATENCY_PREPARE].count, 2);
+    ck_assert_int_eq(l[CHIDB_LATENCY_SELECT][CHIDB_LATENCY_FIRST_ROW].count, 2);
+    ck_assert_int_eq(l[CHIDB_LATENCY_SELECT][CHIDB_LATENCY_NEXT_ROW].count, 200);
+    ck_assert_int_eq(l[CHIDB_LATENCY_SELECT][CHIDB_LATENCY_FINALIZE].count, 2);
+    ck_assert_int_eq(l[CHIDB_LATENCY_OTHER][CHIDB_LATENCY_PREPARE].count, 0);
+
+    for(int k = 0; k < CHIDB_LATENCY_KINDS; k++)
+        for(int p = 0; p < CHIDB_LATENCY_PHASES; p++)
+        {
+            chidb_latency_t *x = &l[k][p];
+            uint64_t n = 0;
+
+            for(int b = 0; b < CHIDB_LATENCY_BUCKETS; b++)
+                n += x->buckets[b];
+            ck_assert_int_eq(n, x->count);
+            ck_assert_int_le(x->max_ns, x->total_ns);
+            ck_assert_int_le(chidb_latency_percentile(x, 50), chidb_latency_percentile(x, 99));
+            ck_assert_int_le(chidb_latency_percentile(x, 99), x->max_ns);
+        }
+
+    /* Reset */
+    ck_assert(chidb_latency_snapshot(db, l, 0) == CHIDB_OK);
+    ck_assert_int_eq(l[CHIDB_LATENCY_SELECT][CHIDB_LATENCY_NEXT_ROW].count, 0);
+    ck_assert_int_eq(l[CHIDB_LATENCY_SELECT][CHIDB_LATENCY_NEXT_ROW].max_ns, 0);
+
+    /* 3 ns, and one of 24 and 25 ns (which share a bucket) */
+    memset(&h, 0, sizeof(h));
+    h.count = 2;
+    h.max_ns = 30;
+    h.buckets[3] = 1;
+    h.buckets[20] = 1;
+    ck_assert_int_eq(chidb_latency_percentile(&h, 0), 3);
+    ck_assert_int_eq(chidb_latency_percentile(&h, 50), 3);
+    ck_assert_int_eq(chidb_latency_percentile(&h, 99), 25);
+    h.max_ns = 24;
+    ck_assert_int_eq(chidb_latency_percentile(&h, 100), 24);
+
+    ck_assert(chidb_close(db) == CHIDB_OK);
+    delete_tmp_file(fname);
+}
+END_TEST
+
+START_TEST (test_memory_limit)
+{
+    chidb *db;
+    chidb_stmt *stmt;
+    chidb_memory_status_t m;
+    char prev[64] = "";
+    int rc, n = 0, nrows;
+
+    char *fname = create_copy("1table-largebtree.cdb", "memory-limit.cdb");
+    ck_assert(chidb_open(fname, &db) == CHIDB_OK);
+    ck_assert(chidb_set_result_cache(db, 1 << 20) == CHIDB_OK);
+
+    /* Prepared again, from the statement cache, its rows are kept */
+    for(int i = 0; i < 2; i++)
+    {
+        ck_assert(chidb_prepare(db, "SELECT code, textcode FROM numbers;", &stmt) == CHIDB_OK);
+        for(nrows = 0; (rc = chidb_step(stmt)) == CHIDB_ROW; nrows++)
+            ;
+        ck_assert_int_eq(rc, CHIDB_DONE);
+        ck_assert(chidb_finalize(stmt) == CHIDB_OK);
+    }
+
+    ck_assert(chidb_memory_status(db, &m, 0) == CHIDB_OK);
+    ck_assert_int_eq(m.limit, 0);
+    ck_assert_int_gt(m.page_cache, 0);
+    ck_assert_int_gt(m.results, 0);
+    ck_assert_int_eq(m.sorters + m.hash_tables, 0);
+    ck_assert_int_eq(m.used, m.page_cache + m.results);
+    ck_assert_int_ge(m.peak, m.used);
+
+    /* The buffer pool gets half of the limit, and the results are dropped
+     * to fit in the rest */
+    ck_assert(chidb_set_memory_limit(db, 64 * 1024) == CHIDB_OK);
+    ck_assert(chidb_memory_status(db, &m, 1) == CHIDB_OK);
+    ck_assert_int_le(m.page_cache, 32 * 1024);
+    ck_assert_int_le(m.used, 64 * 1024);
+    ck_assert_int_eq(m.peak, m.used);
+
+    /* The rows being sorted take more than is left, so they are spilled */
+    ck_assert(chidb_prepare(db, "SELECT textcode FROM numbers ORDER BY textcode;", &stmt) == CHIDB_OK);
+    while((rc = chidb_step(stmt)) == CHIDB_ROW)
+    {
+        const char *text = chidb_column_text(stmt, 0);
+
+        ck_assert(strcmp(prev, text) <= 0);
+        snprintf(prev, sizeof(prev), "%s", text);
+        if(n++ == 0)
+        {
+            ck_assert(chidb_memory_status(db, &m, 0) == CHIDB_OK);
+            ck_assert_int_gt(m.sorters, 0);
+        }
+    }
+    ck_assert_int_eq(rc, CHIDB_DONE);
+    ck_assert_int_eq(n, nrows);
+    ck_assert(chidb_finalize(stmt) == CHIDB_OK);
+    ck_assert(chidb_memory_status(db, &m, 0) == CHIDB_OK);
+    ck_assert_int_eq(m.sorters, 0);
+    ck_assert_int_le(m.peak, 64 * 1024);
+
+    /* A hash table can't spill */
+    ck_assert(chidb_prepare(db, "SELECT altcode, COUNT(*) FROM numbers GROUP BY altcode;", &stmt) == CHIDB_OK);
+    while((rc = chidb_step(stmt)) == CHIDB_ROW)
+        ;
+    ck_assert_int_eq(rc, CHIDB_ENOMEM);
+    ck_assert(chidb_finalize(stmt) == CHIDB_OK);
+    ck_assert(chidb_memory_status(db, &m, 0) == CHIDB_OK);
+    ck_assert_int_eq(m.hash_tables, 0);
+    ck_assert_int_le(m.peak, 64 * 1024);
+
+    ck_assert(chidb_set_memory_limit(db, 0) == CHIDB_OK);
+    ck_assert(chidb_prepare(db, "SELECT altcode, COUNT(*) FROM numbers GROUP BY altcode;", &stmt) == CHIDB_OK);
+    for(n = 0; (rc = chidb_step(stmt)) == CHIDB_ROW; n++)
+        ;
+    ck_assert_int_eq(rc, CHIDB_DONE);
+    ck_assert_int_eq(n, nrows);
+    ck_assert(chidb_finalize(stmt) == CHIDB_OK);
+
+    /* The buffer pool can be made larger again, but not past half of a limit */
+    ck_assert(chidb_set_cache_size(db, -1) == CHIDB_EMISUSE);
+    ck_assert(chidb_set_cache_size(db, 1024) == CHIDB_OK);
+    ck_assert(chidb_prepare(db, "SELECT code, textcode FROM numbers;", &stmt) == CHIDB_OK);
+    for(n = 0; (rc = chidb_step(stmt)) == CHIDB_ROW; n++)
+        ;
+    ck_assert_int_eq(rc, CHIDB_DONE);
+    ck_assert_int_eq(n, nrows);
+    ck_assert(chidb_finalize(stmt) == CHIDB_OK);
+    ck_assert(chidb_memory_status(db, &m, 0) == CHIDB_OK);
+    ck_assert_int_gt(m.page_cache, 32 * 1024);
+    ck_assert(chidb_set_memory_limit(db, 64 * 1024) == CHIDB_OK);
+    ck_assert(chidb_set_cache_size(db, 64) == CHIDB_EMISUSE);
+    ck_assert(chidb_set_cache_size(db, 16) == CHIDB_OK);
+
+    ck_assert(chidb_close(db) == CHIDB_OK);
+    delete_copy(fname);
+}
+END_TEST
+
+START_TEST (test_step_batch)
+{
+    chidb *db;
+    chidb_stmt *stmt;
+    chidb_batch *batch = NULL;
+    int rc, n = 0, nbatches = 0;
+
+    char *fname = create_tmp_file();
+    ck_assert(chidb_open(fname, &db) == CHIDB_OK);
+
+    /* Every third row has a NULL name */
+    exec_sql(db, "CREATE TABLE t(id INTEGER PRIMARY KEY, name TEXT, g INTEGER);");
+    ck_assert(chidb_prepare(db, "INSERT INTO t VALUES (?, ?, ?);", &stmt) == CHIDB_OK);
+    for(int i = 1; i <= 1000; i++)
+    {
+        char *t = long_text(i, 1 + i % 50);
+
+        ck_assert(chidb_bind_int(stmt, 1, i) == CHIDB_OK);
+        if(i % 3 != 0)
+            ck_assert(chidb_bind_text(stmt, 2, t) == CHIDB_OK);
+        ck_assert(chidb_bind_int(stmt, 3, i % 10) == CHIDB_OK);
+        ck_assert(chidb_step(stmt) == CHIDB_DONE);
+        ck_assert(chidb_reset(stmt) == CHIDB_OK);
+        ck_assert(chidb_clear_bindings(stmt) == CHIDB_OK);
+        free(t);
+    }
+    ck_assert(chidb_finalize(stmt) == CHIDB_OK);
+
+    ck_assert(chidb_prepare(db, "SELECT id, name, g FROM t;", &stmt) == CHIDB_OK);
+    while((rc = chidb_step_batch(stmt, 64, &batch)) == CHIDB_ROW)
+    {
+        ck_assert_int_eq(batch->ncols, 3);
+        ck_assert_int_le(batch->nrows, 64);
+        nbatches++;
+
+        for(int r = 0; r < batch->nrows; r++)
+        {
+            int id = ++n;
+            chidb_batch_column *name = &batch->cols[1];
+
+            ck_assert(!CHIDB_BATCH_IS_SET(batch->cols[0].nulls, r));
+            ck_assert_int_eq(batch->cols[0].ints[r], id);
+            ck_assert_int_eq(batch->cols[2].ints[r], id % 10);
+
+            if(id % 3 == 0)
+            {
+                ck_assert(CHIDB_BATCH_IS_SET(name->nulls, r));
+                ck_assert(!CHIDB_BATCH_IS_SET(name->texts, r));
+            }
+            else
+            {
+                char *t = long_text(id, 1 + id % 50);
+
+                ck_assert(!CHIDB_BATCH_IS_SET(name->nulls, r));
+                ck_assert(CHIDB_BATCH_IS_SET(name->texts, r));
+                ck_assert_int_eq(name->lengths[r], strlen(t));
+                ck_assert_str_eq(batch->text + name->offsets[r], t);
+                free(t);
+            }
+        }
+    }
+    ck_assert(rc == CHIDB_DONE);
+    ck_assert_int_eq(n, 1000);
+    ck_assert_int_eq(nbatches, (1000 + 63) / 64);
+    ck_assert_int_eq(batch->nrows, 0);
+
+    /* Running the statement again */
+    ck_assert(chidb_reset(stmt) == CHIDB_OK);
+    ck_assert(chidb_step_batch(stmt, 5000, &batch) == CHIDB_ROW);
+    ck_assert_int_eq(batch->nrows, 1000);
+    ck_assert(chidb_step_batch(stmt, 5000, &batch) == CHIDB_DONE);
+    ck_assert(chidb_step_batch(stmt, 0, &batch) == CHIDB_EMISUSE);
+    ck_assert(chidb_finalize(stmt) == CHIDB_OK);
+
+    /* The same batch, for a statement with other columns */
+    ck_assert(chidb_prepare(db, "SELECT g FROM t WHERE id > 990;", &stmt) == CHIDB_OK);
+    ck_assert(chidb_step_batch(stmt, 100, &batch) == CHIDB_ROW);
+    ck_assert_int_eq(batch->ncols, 1);
+    ck_assert_int_eq(batch->nrows, 10);
+    ck_assert_int_eq(batch->cols[0].ints[9], 0);
+    ck_assert(chidb_finalize(stmt) == CHIDB_OK);
+
+    ck_assert(chidb_prepare(db, "EXPLAIN SELECT g FROM t;", &stmt) == CHIDB_OK);
+    ck_assert(chidb_step_batch(stmt, 100, &batch) == CHIDB_EMISUSE);
+    ck_assert(chidb_finalize(stmt) == CHIDB_OK);
+
+    chidb_batch_free(batch);
+    ck_assert(chidb_close(db) == CHIDB_OK);
+    delete_tmp_file(fname);
+}
+END_TEST
+
+START_TEST (test_step_async)
+{
+    chidb *db;
+    chidb_stmt *stmt;
+    chidb_io_token token;
+    int rc, n = 0, pending = 0;
+
+    char *fname = create_tmp_file();
+    ck_assert(chidb_open(fname, &db) == CHIDB_OK);
+
+    exec_sql(db, "CREATE TABLE t(id INTEGER PRIMARY KEY, name TEXT);");
+    ck_assert(chidb_prepare(db, "INSERT INTO t VALUES (?, ?);", &stmt) == CHIDB_OK);
+    for(int i = 1; i <= 2000; i++)
+    {
+        char *t = long_text(i, 1 + i % 50);
+
+        ck_assert(chidb_bind_int(stmt, 1, i) == CHIDB_OK);
+        ck_assert(chidb_bind_text(stmt, 2, t) == CHIDB_OK);
+        ck_assert(chidb_step(stmt) == CHIDB_DONE);
+        ck_assert(chidb_reset(stmt) == CHIDB_OK);
+        free(t);
+    }
+    ck_assert(chidb_finalize(stmt) == CHIDB_OK);
+    ck_assert(chidb_close(db) == CHIDB_OK);
+
+    /* Nothing is cached once the file is opened again */
+    ck_assert(chidb_open(fname, &db) == CHIDB_OK);
+    if(chidb_set_io_backend(db, CHIDB_IO_URING) != CHIDB_OK)
+    {
+        /* No io_uring on this system */
+        ck_assert(chidb_close(db) == CHIDB_OK);
+        delete_tmp_file(fname);
+        return;
+    }
+
+    /* A seek waits for every page on the way down to the row */
+    ck_assert(chidb_prepare(db, "SELECT name FROM t WHERE id = 1234;", &stmt) == CHIDB_OK);
+    while((rc = chidb_step_async(stmt, &token)) == CHIDB_PENDING)
+    {
+        pending++;
+        if(chidb_io_poll(db, token, 0) == CHIDB_PENDING)
+            ck_assert(chidb_io_poll(db, token, 1) == CHIDB_OK);
+        ck_assert(chidb_io_poll(db, token, 0) == CHIDB_OK);
+    }
+    ck_assert(rc == CHIDB_ROW);
+    ck_assert_int_gt(pending, 0);
+    char *t = long_text(1234, 1 + 1234 % 50);
+    ck_assert_str_eq(chidb_column_text(stmt, 0), t);
+    free(t);
+    ck_assert(chidb_step_async(stmt, &token) == CHIDB_DONE);
+    ck_assert(chidb_finalize(stmt) == CHIDB_OK);
+
+    /* A scan is resumed where it stopped, at each leaf it reaches */
+    pending = 0;
+    ck_assert(chidb_prepare(db, "SELECT id, name FROM t;", &stmt) == CHIDB_OK);
+    while((rc = chidb_step_async(stmt, &token)) != CHIDB_DONE)
+    {
+        if(rc == CHIDB_PENDING)
+        {
+            pending++;
+            ck_assert(chidb_io_poll(db, token, 1) == CHIDB_OK);
+            continue;
+        }
+        ck_assert(rc == CHIDB_ROW);
+        n++;
+
+        char *t = long_text(n, 1 + n % 50);
+        ck_assert_int_eq(chidb_column_int(stmt, 0), n);
+        ck_assert_str_eq(chidb_column_text(stmt, 1), t);
+        free(t);
+    }
+    ck_assert_int_eq(n, 2000);
+    ck_assert_int_gt(pending, 0);
+    ck_assert(chidb_finalize(stmt) == CHIDB_OK);
+
+    /* Writes wait for the disk */
+    ck_assert(chidb_prepare(db, "INSERT INTO t VALUES (?, ?);", &stmt) == CHIDB_OK);
+    ck_assert(chidb_bind_int(stmt, 1, 5000) == CHIDB_OK);
+    ck_assert(chidb_bind_text(stmt, 2, "x") == CHIDB_OK);
+    ck_assert(chidb_step_async(stmt, &token) == CHIDB_DONE);
+    ck_assert(chidb_finalize(stmt) == CHIDB_OK);
+
+    ck_assert(chidb_close(db) == CHIDB_OK);
+    delete_tmp_file(fname);
+}
+END_TEST
+
+/* Adds up the first column of the rows of a script (see test_exec) */
+static int exec_sum(void *arg, chidb_stmt *stmt, int row)
+{
+    int64_t *sum = arg;
+
+    *sum += chidb_column_int(stmt, 0);
+    return row < 100 ? CHIDB_OK : CHIDB_EMISUSE;
+}
+
+START_TEST (test_exec)
+{
+    chidb *db;
+    int64_t sum = 0;
+
+    char *fname = create_tmp_file();
+    ck_assert(chidb_open(fname, &db) == CHIDB_OK);
+
+    ck_assert(chidb_exec(db, "CREATE TABLE t(id INTEGER PRIMARY KEY, v INTEGER);\n"
+                             "INSERT INTO t VALUES (1, 10);\n"
+                             "  ;\n"
+                             "INSERT INTO t VALUES (2, 20); SELECT v FROM t;\n"
+                             "SELECT id FROM t WHERE id = 2", exec_sum, &sum) == CHIDB_OK);
+    ck_assert_int_eq(sum, 32);
+    ck_assert(!db->bt->pager->in_txn);
+    ck_assert_int_eq(count_rows(db, "SELECT id FROM t;", Op_Rewind, true), 2);
+
+    /* A failed statement rolls back the ones before it */
+    ck_assert(chidb_exec(db, "INSERT INTO t VALUES (3, 30); INSERT INTO t VALUES (1, 10); INSERT INTO t VALUES (4, 40);",
+                         NULL, NULL) == CHIDB_ECONSTRAINT);
+    ck_assert(!db->bt->pager->in_txn);
+    ck_assert_int_eq(count_rows(db, "SELECT id FROM t;", Op_Rewind, true), 2);
+    ck_assert(chidb_exec(db, "INSERT INTO t VALUES (3, 30); SELEKT v FROM t;", NULL, NULL) == CHIDB_EINVALIDSQL);
+    ck_assert_int_eq(count_rows(db, "SELECT id FROM t;", Op_Rewind, true), 2);
+
+    /* So does the callback stopping the script */
+    for(int i = 3; i <= 200; i++)
+    {
+        char sql[64];
+        sprintf(sql, "INSERT INTO t VALUES (%i, %i);", i, 10 * i);
+        exec_sql(db, sql);
+    }
+    sum = 0;
+    ck_assert(chidb_exec(db, "DELETE FROM t WHERE id = 1; SELECT id FROM t;", exec_sum, &sum) == CHIDB_EMISUSE);
+    ck_assert_int_eq(sum, 102 * 103 / 2 - 1);
+    ck_assert_int_eq(count_rows(db, "SELECT id FROM t;", Op_Rewind, true), 200);
+
+    /* The script's own transactions, and statements that cannot run in one */
+    ck_assert(chidb_exec(db, "INSERT INTO t VALUES (201, 0); BEGIN; INSERT INTO t VALUES (202, 0); ROLLBACK;"
+                             "INSERT INTO t VALUES (203, 0); VACUUM; INSERT INTO t VALUES (204, 0);", NULL, NULL) == CHIDB_OK);
+    ck_assert(!db->bt->pager->in_txn);
+    ck_assert_int_eq(count_rows(db, "SELECT id FROM t;", Op_Rewind, true), 203);
+
+    /* A transaction that is already open is left open */
+    exec_sql(db, "BEGIN;");
+    ck_assert(chidb_exec(db, "INSERT INTO t VALUES (205, 0);", NULL, NULL) == CHIDB_OK);
+    ck_assert(db->bt->pager->in_txn);
+    exec_sql(db, "ROLLBACK;");
+    ck_assert_int_eq(count_rows(db, "SELECT id FROM t;", Op_Rewind, true), 203);
+
+    ck_assert(chidb_close(db) == CHIDB_OK);
+    delete_tmp_file(fname);
+}
+END_TEST
+
+/* Counts the rows of t that "SELECT id FROM t WHERE v <op> k" returns,
+ * and adds up their ids */
+static void filter_rows(chidb *db, const char *op, int k, int *n, int64_t *sum)
+{
+    chidb_stmt *stmt;
+    char sql[64];
+    int rc;
+
+    snprintf(sql, sizeof(sql), "SELECT id FROM t WHERE v %s ?;", op);
+    ck_assert(chidb_prepare(db, sql, &stmt) == CHIDB_OK);
+    ck_assert(chidb_bind_int(stmt, 1, k) == CHIDB_OK);
+
+    *n = 0;
+    *sum = 0;
+    while((rc = chidb_step(stmt)) == CHIDB_ROW)
+    {
+        (*n)++;
+        *sum += chidb_column_int(stmt, 0);
+    }
+    ck_assert(rc == CHIDB_DONE);
+    ck_assert(chidb_finalize(stmt) == CHIDB_OK);
+}
+
+START_TEST (test_filter_column)
+{
+    chidb *db;
+    chidb_stmt *stmt;
+    chidb_counters_t c;
+    const char *ops[] = {"=", "<", ">", "<=", ">="};
+    char big[1500];
+    int n, nrows = 3000;
+    int64_t sum;
+
+    char *fname = create_tmp_file();
+    ck_assert(chidb_open(fname, &db) == CHIDB_OK);
+
+    /* Every tenth v is NULL, and every hundredth entry has a name too
+     * long for its page, which leaves v in an overflow page */
+    memset(big, 'x', sizeof(big) - 1);
+    big[sizeof(big) - 1] = '\0';
+    exec_sql(db, "CREATE TABLE t(id INTEGER PRIMARY KEY, name TEXT, v INTEGER);");
+    ck_assert(chidb_prepare(db, "INSERT INTO t VALUES (?, ?, ?);", &stmt) == CHIDB_OK);
+    for(int i = 1; i <= nrows; i++)
+    {
+        ck_assert(chidb_bind_int(stmt, 1, i) == CHIDB_OK);
+        ck_assert(chidb_bind_text(stmt, 2, i % 100 == 0 ? big : "abc") == CHIDB_OK);
+        if(i % 10 != 0)
+            ck_assert(chidb_bind_int(stmt, 3, i % 7) == CHIDB_OK);
+        ck_assert(chidb_step(stmt) == CHIDB_DONE);
+        ck_assert(chidb_reset(stmt) == CHIDB_OK);
+        ck_assert(chidb_clear_bindings(stmt) == CHIDB_OK);
+    }
+    ck_assert(chidb_finalize(stmt) == CHIDB_OK);
+
+    ck_assert(chidb_prepare(db, "SELECT id FROM t WHERE v = 3;", &stmt) == CHIDB_OK);
+    ck_assert_int_eq(stmt->ops[4].opcode, Op_FilterColumn);
+    ck_assert(chidb_finalize(stmt) == CHIDB_OK);
+
+    /* Same rows as comparing one entry at a time: a NULL never
+     * compares, so those rows are always returned */
+    for(int o = 0; o < 5; o++)
+    {
+        for(int k = -1; k <= 7; k++)
+        {
+            int en = 0;
+            int64_t esum = 0;
+
+            for(int i = 1; i <= nrows; i++)
+            {
+                int v = i % 7;
+                bool match = i % 10 == 0
+                    || (o == 0 && v == k) || (o == 1 && v < k) || (o == 2 && v > k)
+                    || (o == 3 && v <= k) || (o == 4 && v >= k);
+                if(match)
+                {
+                    en++;
+                    esum += i;
+                }
+            }
+
+            filter_rows(db, ops[o], k, &n, &sum);
+            ck_assert_int_eq(n, en);
+            ck_assert_int_eq(sum, esum);
+        }
+    }
+
+    /* Only the rows that match are decoded */
+    ck_assert(chidb_stats(db, &c, 1) == CHIDB_OK);
+    filter_rows(db, "=", 100, &n, &sum);
+    ck_assert_int_eq(n, nrows / 10);
+    ck_assert(chidb_stats(db, &c, 0) == CHIDB_OK);
+    ck_assert_int_le(c.records_unpacked, nrows / 10);
+
+    ck_assert(chidb_close(db) == CHIDB_OK);
+    delete_tmp_file(fname);
+}
+END_TEST
+
+/* Counts the rows of t that "SELECT id FROM t WHERE <where>" returns,
+ * and adds up their ids */
+static void where_rows(chidb *db, const char *where, int *n, int64_t *sum)
+{
+    chidb_stmt *stmt;
+    char sql[128];
+    int rc;
+
+    snprintf(sql, sizeof(sql), "SELECT id FROM t WHERE %s;", where);
+    ck_assert(chidb_prepare(db, sql, &stmt) == CHIDB_OK);
+
+    *n = 0;
+    *sum = 0;
+    while((rc = chidb_step(stmt)) == CHIDB_ROW)
+    {
+        (*n)++;
+        *sum += chidb_column_int(stmt, 0);
+    }
+    ck_assert(rc == CHIDB_DONE);
+    ck_assert(chidb_finalize(stmt) == CHIDB_OK);
+}
+
+/* The WHERE conditions test_where runs, and whether row i matches them
+ * (a is i % 5, and b is i % 11, or NULL for every 13th row) */
+static const char *where_conds[] = {
+    "a = 2 AND b > 5",
+    "a = 1 OR id < 100",
+    "NOT (a = 1 OR a = 2)",
+    "a != 3 AND id <= 500",
+    "a IN (0, 4)",
+    "a < b",
+    "3 > a",
+    "id > 1500 AND a = 0",
+    "a = 1 AND (id < 100 OR id > 1900)",
+    "b >= 4 AND id >= 200 AND a != 0 AND b <= 8",
+};
+
+static bool where_match(int q, int i)
+{
+    int a = i % 5, b = i % 11;
+    bool null = i % 13 == 0;    // a comparison with b always holds
+
+    switch(q)
+    {
+        case 0: return a == 2 && (null || b > 5);
+        case 1: return a == 1 || i < 100;
+        case 2: return a != 1 && a != 2;
+        case 3: return a != 3 && i <= 500;
+        case 4: return a == 0 || a == 4;
+        case 5: return null || a < b;
+        case 6: return a < 3;
+        case 7: return i > 1500 && a == 0;
+        case 8: return a == 1 && (i < 100 || i > 1900);
+        default: return (null || (b >= 4 && b <= 8)) && i >= 200 && a != 0;
+    }
+}
+
+START_TEST (test_where)
+{
+    chidb *db;
+    chidb_stmt *stmt;
+    int n, nrows = 2000, i, q;
+    int64_t sum;
+    bool seek = false;
+
+    char *fname = create_tmp_file();
+    ck_assert(chidb_open(fname, &db) == CHIDB_OK);
+
+    exec_sql(db, "CREATE TABLE t(id INTEGER PRIMARY KEY, a INTEGER, b INTEGER);");
+    ck_assert(chidb_prepare(db, "INSERT INTO t VALUES (?, ?, ?);", &stmt) == CHIDB_OK);
+    for(i = 1; i <= nrows; i++)
+    {
+        ck_assert(chidb_bind_int(stmt, 1, i) == CHIDB_OK);
+        ck_assert(chidb_bind_int(stmt, 2, i % 5) == CHIDB_OK);
+        if(i % 13 != 0)
+            ck_assert(chidb_bind_int(stmt, 3, i % 11) == CHIDB_OK);
+        ck_assert(chidb_step(stmt) == CHIDB_DONE);
+        ck_assert(chidb_reset(stmt) == CHIDB_OK);
+        ck_assert(chidb_clear_bindings(stmt) == CHIDB_OK);
+    }
+    ck_assert(chidb_finalize(stmt) == CHIDB_OK);
+
+    for(q = 0; q < (int) (sizeof(where_conds) / sizeof(where_conds[0])); q++)
+    {
+        int en = 0;
+        int64_t esum = 0;
+
+        for(i = 1; i <= nrows; i++)
+            if(where_match(q, i))
+            {
+                en++;
+                esum += i;
+            }
+
+        where_rows(db, where_conds[q], &n, &sum);
+        ck_assert_int_eq(n, en);
+        ck_assert_int_eq(sum, esum);
+    }
+
+    /* The more selective condition is tested first, and the one on the
+     * primary key is where the rows are sought from */
+    ck_assert(chidb_prepare(db, "SELECT id FROM t WHERE b > 5 AND a = 2;", &stmt) == CHIDB_OK);
+    for(i = 0; i < (int) stmt->endOp; i++)
+        if(stmt->ops[i].opcode == Op_Column || stmt->ops[i].opcode == Op_FilterColumn)
+            break;
+    ck_assert_int_eq(stmt->ops[i].p2, 1);
+    ck_assert(chidb_finalize(stmt) == CHIDB_OK);
+
+    ck_assert(chidb_prepare(db, "SELECT id FROM t WHERE a = 0 AND id > 1500;", &stmt) == CHIDB_OK);
+    for(i = 0; i < (int) stmt->endOp; i++)
+        seek = seek || stmt->ops[i].opcode == Op_SeekGt;
+    ck_assert(seek);
+    ck_assert(chidb_finalize(stmt) == CHIDB_OK);
+
+    /* Aggregates get registers of their own */
+    ck_assert(chidb_prepare(db, "SELECT COUNT(*) FROM t WHERE a = 1 OR a = 3;", &stmt) == CHIDB_OK);
+    ck_assert(chidb_step(stmt) == CHIDB_ROW);
+    ck_assert_int_eq(chidb_column_int(stmt, 0), nrows * 2 / 5);
+    ck_assert(chidb_finalize(stmt) == CHIDB_OK);
+
+    ck_assert(chidb_prepare(db, "SELECT id FROM t WHERE a = 1 AND c = 2;", &stmt) == CHIDB_EINVALIDSQL);
+
+    exec_sql(db, "DELETE FROM t WHERE a = 4 AND (id > 1000 OR b = 0);");
+    where_rows(db, "id > 0", &n, &sum);
+    for(i = 1; i <= nrows; i++)
+        if(i % 5 == 4 && (i > 1000 || i % 13 == 0 || i % 11 == 0))
+            n++;
+    ck_assert_int_eq(n, nrows);
+
+    ck_assert(chidb_close(db) == CHIDB_OK);
+    delete_tmp_file(fname);
+}
+END_TEST
+
+/* Counts the instructions of a program that read column col of a table */
+static int column_reads(chidb_stmt *stmt, int col)
+{
+    int n = 0;
+
+    for(uint32_t i = 0; i < stmt->endOp; i++)
+        n += (stmt->ops[i].opcode == Op_Column || stmt->ops[i].opcode == Op_FilterColumn)
+            && stmt->ops[i].p2 == col;
+    return n;
+}
+
+/* Counts the constants a program loads after it starts its scan */
+static int loop_loads(chidb_stmt *stmt)
+{
+    uint32_t i = 0;
+    int n = 0;
+
+    while(i < stmt->endOp && stmt->ops[i].opcode != Op_Rewind)
+        i++;
+    for(; i < stmt->endOp; i++)
+        n += stmt->ops[i].opcode == Op_Integer || stmt->ops[i].opcode == Op_String
+            || stmt->ops[i].opcode == Op_Null || stmt->ops[i].opcode == Op_Param;
+    return n;
+}
+
+START_TEST (test_peephole)
+{
+    chidb *db;
+    chidb_stmt *stmt;
+    const char *names[] = {"x", "yy", "zzz"};
+    int n, nrows = 1000, i, rc;
+    int64_t sum;
+
+    char *fname = create_tmp_file();
+    ck_assert(chidb_open(fname, &db) == CHIDB_OK);
+
+    exec_sql(db, "CREATE TABLE t(id INTEGER PRIMARY KEY, a INTEGER, name TEXT);");
+    ck_assert(chidb_prepare(db, "INSERT INTO t VALUES (?, ?, ?);", &stmt) == CHIDB_OK);
+    for(i = 1; i <= nrows; i++)
+    {
+        ck_assert(chidb_bind_int(stmt, 1, i) == CHIDB_OK);
+        ck_assert(chidb_bind_int(stmt, 2, i % 7) == CHIDB_OK);
+        ck_assert(chidb_bind_text(stmt, 3, names[i % 3]) == CHIDB_OK);
+        ck_assert(chidb_step(stmt) == CHIDB_DONE);
+        ck_assert(chidb_reset(stmt) == CHIDB_OK);
+    }
+    ck_assert(chidb_finalize(stmt) == CHIDB_OK);
+
+    /* The column of the WHERE is read once, and copied for the others */
+    ck_assert(chidb_prepare(db, "SELECT a, name, a FROM t WHERE a > 2 AND a < 5;", &stmt) == CHIDB_OK);
+    ck_assert_int_eq(column_reads(stmt, 1), 1);
+    ck_assert(uses_op(stmt, Op_FilterColumn));
+    ck_assert(uses_op(stmt, Op_SCopy));
+    n = 0;
+    while((rc = chidb_step(stmt)) == CHIDB_ROW)
+    {
+        int a = chidb_column_int(stmt, 0);
+
+        ck_assert(a > 2 && a < 5);
+        ck_assert_int_eq(chidb_column_int(stmt, 2), a);
+        n++;
+    }
+    ck_assert(rc == CHIDB_DONE);
+    ck_assert_int_eq(n, 286);
+    ck_assert(chidb_finalize(stmt) == CHIDB_OK);
+
+    /* Text is copied too, on every path through an OR */
+    ck_assert(chidb_prepare(db, "SELECT name, id, name FROM t WHERE name = ? OR a = 1;", &stmt) == CHIDB_OK);
+    ck_assert_int_eq(column_reads(stmt, 2), 1);
+    ck_assert(chidb_bind_text(stmt, 1, "yy") == CHIDB_OK);
+    n = 0;
+    while((rc = chidb_step(stmt)) == CHIDB_ROW)
+    {
+        int id = chidb_column_int(stmt, 1);
+
+        ck_assert(id % 3 == 1 || id % 7 == 1);
+        ck_assert_str_eq(chidb_column_text(stmt, 0), names[id % 3]);
+        ck_assert_str_eq(chidb_column_text(stmt, 2), names[id % 3]);
+        n++;
+    }
+    ck_assert(rc == CHIDB_DONE);
+    for(i = 1; i <= nrows; i++)
+        n -= i % 3 == 1 || i % 7 == 1;
+    ck_assert_int_eq(n, 0);
+    ck_assert(chidb_finalize(stmt) == CHIDB_OK);
+
+    /* The constant COUNT adds for each row is loaded before the scan */
+    ck_assert(chidb_prepare(db, "SELECT a, COUNT(*) FROM t GROUP BY a;", &stmt) == CHIDB_OK);
+    ck_assert_int_eq(loop_loads(stmt), 0);
+    n = 0;
+    while((rc = chidb_step(stmt)) == CHIDB_ROW)
+    {
+        int a = chidb_column_int(stmt, 0);
+
+        ck_assert_int_eq(chidb_column_int(stmt, 1), nrows / 7 + (a >= 1 && a <= nrows % 7));
+        n++;
+    }
+    ck_assert(rc == CHIDB_DONE);
+    ck_assert_int_eq(n, 7);
+    ck_assert(chidb_finalize(stmt) == CHIDB_OK);
+
+    exec_sql(db, "DELETE FROM t WHERE a = 3 OR (a > 2 AND a < 4) OR id > 990;");
+    where_rows(db, "id > 0", &n, &sum);
+    for(i = 1; i <= nrows; i++)
+        n += i % 7 == 3 || i > 990;
+    ck_assert_int_eq(n, nrows);
+
+    ck_assert(chidb_close(db) == CHIDB_OK);
+    delete_tmp_file(fname);
+}
+END_TEST
+
+/* Runs "SELECT id FROM t WHERE a > 2 AND a <= ?" with ? = k, and checks
+ * the rows against those of test_compiled's table */
+static void check_compiled(chidb_stmt *stmt, int nrows, int k)
+{
+    int n = 0, rc;
+    int64_t sum = 0;
+
+    ck_assert(chidb_reset(stmt) == CHIDB_OK);
+    ck_assert(chidb_bind_int(stmt, 1, k) == CHIDB_OK);
+    while((rc = chidb_step(stmt)) == CHIDB_ROW)
+    {
+        n++;
+        sum += chidb_column_int(stmt, 0);
+    }
+    ck_assert(rc == CHIDB_DONE);
+
+    for(int i = 1; i <= nrows; i++)
+    {
+        int a = i % 9;
+
+        // a comparison with NULL always holds
+        if(i % 10 == 0 || (a > 2 && a <= k))
+        {
+            n--;
+            sum -= i;
+        }
+    }
+    ck_assert_int_eq(n, 0);
+    ck_assert_int_eq(sum, 0);
+}
+
+START_TEST (test_compiled)
+{
+    chidb *db;
+    chidb_stmt *stmt;
+    const char *sql = "SELECT id FROM t WHERE a > 2 AND a <= ?;";
+    int nrows = 500, k;
+    bool imm = false;
+
+    char *fname = create_tmp_file();
+    ck_assert(chidb_open(fname, &db) == CHIDB_OK);
+
+    exec_sql(db, "CREATE TABLE t(id INTEGER PRIMARY KEY, a INTEGER);");
+    ck_assert(chidb_prepare(db, "INSERT INTO t VALUES (?, ?);", &stmt) == CHIDB_OK);
+    for(int i = 1; i <= nrows; i++)
+    {
+        ck_assert(chidb_bind_int(stmt, 1, i) == CHIDB_OK);
+        if(i % 10 != 0)
+            ck_assert(chidb_bind_int(stmt, 2, i % 9) == CHIDB_OK);
+        ck_assert(chidb_step(stmt) == CHIDB_DONE);
+        ck_assert(chidb_reset(stmt) == CHIDB_OK);
+        ck_assert(chidb_clear_bindings(stmt) == CHIDB_OK);
+    }
+    ck_assert(chidb_finalize(stmt) == CHIDB_OK);
+
+    /* The program is compiled once it has been run a few times, and
+     * returns the same rows */
+    ck_assert(chidb_prepare(db, sql, &stmt) == CHIDB_OK);
+    check_compiled(stmt, nrows, 5);
+    ck_assert(stmt->code == NULL);
+    for(k = 0; k < 10; k++)
+        check_compiled(stmt, nrows, k);
+    ck_assert(stmt->code != NULL);
+
+    /* The comparison with 2 compares with the constant, not the one with
+     * the parameter, which can change between runs */
+    for(uint32_t i = 0; i < stmt->endOp; i++)
+    {
+        if(stmt->ops[i].opcode >= Op_Eq && stmt->ops[i].opcode <= Op_Ge)
+            imm = imm || stmt->code[i].imm == 2;
+    }
+    ck_assert(imm);
+    ck_assert(chidb_finalize(stmt) == CHIDB_OK);
+
+    /* A program prepared from the statement cache over and over is
+     * compiled too */
+    for(k = 0; k < 5; k++)
+    {
+        ck_assert(chidb_prepare(db, sql, &stmt) == CHIDB_OK);
+        ck_assert(stmt->program != NULL);
+        check_compiled(stmt, nrows, k);
+        if(k < 2)
+            ck_assert(stmt->code == NULL);
+        ck_assert(chidb_finalize(stmt) == CHIDB_OK);
+    }
+    ck_assert(chidb_prepare(db, sql, &stmt) == CHIDB_OK);
+    check_compiled(stmt, nrows, 7);
+    ck_assert(stmt->code != NULL);
+    ck_assert(chidb_finalize(stmt) == CHIDB_OK);
+
+    ck_assert(chidb_close(db) == CHIDB_OK);
+    delete_tmp_file(fname);
+}
+END_TEST
+
+START_TEST (test_prog)
+{
+    chidb *db;
+    chidb_stmt *stmt;
+    chidb_dbm_prog_t prog;
+    int32_t next, done;
+    uint32_t loop;
+    int64_t sum = 0;
+    int rc;
+
+    char *fname = create_tmp_file();
+    ck_assert(chidb_open(fname, &db) == CHIDB_OK);
+    exec_sql(db, "CREATE TABLE t(id INTEGER PRIMARY KEY, a INTEGER);");
+    for(int i = 1; i <= 10; i++)
+    {
+        char sql[64];
+
+        sprintf(sql, "INSERT INTO t VALUES (%i, %i);", i, i * i);
+        exec_sql(db, sql);
+    }
+
+    /* SELECT a FROM t WHERE id > 5, with forward jumps to labels */
+    chidb_dbm_prog_init(&prog);
+    next = chidb_dbm_prog_label(&prog);
+    done = chidb_dbm_prog_label(&prog);
+    chidb_dbm_prog_emit(&prog, Op_Integer, chidb_get_root(db, "t"), 0, 0, NULL);
+    chidb_dbm_prog_emit(&prog, Op_Integer, 5, 1, 0, NULL);
+    chidb_dbm_prog_emit(&prog, Op_OpenRead, 0, 0, 2, NULL);
+    chidb_dbm_prog_emit(&prog, Op_Rewind, 0, done, 0, NULL);
+    loop = chidb_dbm_prog_here(&prog);
+    chidb_dbm_prog_emit(&prog, Op_Key, 0, 2, 0, NULL);
+    chidb_dbm_prog_emit(&prog, Op_Le, 1, next, 2, NULL);
+    chidb_dbm_prog_emit(&prog, Op_Column, 0, 1, 3, NULL);
+    chidb_dbm_prog_emit(&prog, Op_ResultRow, 3, 1, 0, NULL);
+    chidb_dbm_prog_place(&prog, next);
+    chidb_dbm_prog_emit(&prog, Op_Next, 0, loop, 0, NULL);
+    chidb_dbm_prog_place(&prog, done);
+    chidb_dbm_prog_emit(&prog, Op_Close, 0, 0, 0, NULL);
+
+    stmt = malloc(sizeof(chidb_stmt));
+    ck_assert(chidb_stmt_init(stmt, db) == CHIDB_OK);
+    ck_assert(chidb_dbm_prog_finish(&prog, stmt) == CHIDB_OK);
+    ck_assert_int_eq(stmt->endOp, 10);
+    ck_assert_int_eq(stmt->ops[3].p2, 9);
+    ck_assert_int_eq(stmt->ops[5].p2, 8);
+    stmt->nCols = 1;
+    ck_assert(chidb_stmt_verify(stmt) == CHIDB_OK);
+    while((rc = chidb_stmt_exec(stmt)) == CHIDB_ROW)
+        sum += stmt->reg[3].value.i;
+    ck_assert(rc == CHIDB_DONE);
+    ck_assert_int_eq(sum, 36 + 49 + 64 + 81 + 100);
+    chidb_stmt_free(stmt);
+
+    /* A jump to a label that is never placed */
+    chidb_dbm_prog_init(&prog);
+    chidb_dbm_prog_emit(&prog, Op_Integer, 1, 0, 0, NULL);
+    chidb_dbm_prog_emit(&prog, Op_IfPos, 0, chidb_dbm_prog_label(&prog), 0, NULL);
+    stmt = malloc(sizeof(chidb_stmt));
+    ck_assert(chidb_stmt_init(stmt, db) == CHIDB_OK);
+    ck_assert(chidb_dbm_prog_finish(&prog, stmt) == CHIDB_PROBLEM);
+    chidb_stmt_free(stmt);
+
+    ck_assert(chidb_close(db) == CHIDB_OK);
+    delete_tmp_file(fname);
+}
+END_TEST
 
 int main (void)
 {
@@ -152,6 +4281,112 @@ int main (void)
         exit(1);
     }
 
+    s = suite_create ("dbm-api");
+    TCase *tc = tcase_create ("Parameter binding");
+    tcase_add_test (tc, test_bind);
+    suite_add_tcase (s, tc);
+    tc = tcase_create ("Statement cache");
+    tcase_add_test (tc, test_stmt_cache);
+    tcase_add_test (tc, test_program_file);
+    tcase_add_test (tc, test_result_cache);
+    tcase_add_test (tc, test_compiled);
+    suite_add_tcase (s, tc);
+
+    tc = tcase_create ("Programs");
+    tcase_add_test (tc, test_prog);
+    suite_add_tcase (s, tc);
+    tc = tcase_create ("Schema catalog");
+    tcase_add_test (tc, test_catalog);
+    tcase_add_test (tc, test_catalog_many_tables);
+    tcase_add_test (tc, test_attach);
+    suite_add_tcase (s, tc);
+    tc = tcase_create ("Access paths");
+    tcase_add_test (tc, test_access_paths);
+    tcase_add_test (tc, test_key_list);
+    tcase_add_test (tc, test_text_index);
+    tcase_add_test (tc, test_bulk_index);
+    suite_add_tcase (s, tc);
+    tc = tcase_create ("Joins");
+    tcase_add_test (tc, test_hash_join);
+    tcase_add_test (tc, test_bloom);
+    tcase_add_test (tc, test_index_join);
+    suite_add_tcase (s, tc);
+    tc = tcase_create ("Sorting");
+    tcase_add_test (tc, test_order_by);
+    suite_add_tcase (s, tc);
+    tc = tcase_create ("Aggregates");
+    tcase_add_test (tc, test_aggregates);
+    suite_add_tcase (s, tc);
+    tc = tcase_create ("Limits");
+    tcase_add_test (tc, test_limit);
+    suite_add_tcase (s, tc);
+
+    tc = tcase_create ("Batches");
+    tcase_add_test (tc, test_step_batch);
+    tcase_add_test (tc, test_step_async);
+    tcase_add_test (tc, test_exec);
+    suite_add_tcase (s, tc);
+
+    tc = tcase_create ("Filters");
+    tcase_add_test (tc, test_filter_column);
+    suite_add_tcase (s, tc);
+    tc = tcase_create ("Where");
+    tcase_add_test (tc, test_where);
+    tcase_add_test (tc, test_peephole);
+    suite_add_tcase (s, tc);
+    tc = tcase_create ("Inserts");
+    tcase_add_test (tc, test_insert_batch);
+    tcase_add_test (tc, test_insert_params);
+    tcase_add_test (tc, test_index_insert);
+    tcase_add_test (tc, test_insert_failed);
+    tcase_add_test (tc, test_import);
+    tcase_add_test (tc, test_wide_keys);
+    tcase_add_test (tc, test_overflow);
+    tcase_add_test (tc, test_arena);
+    suite_add_tcase (s, tc);
+    tc = tcase_create ("Deletes");
+    tcase_add_test (tc, test_delete);
+    tcase_add_test (tc, test_vacuum);
+    suite_add_tcase (s, tc);
+    tc = tcase_create ("Updates");
+    tcase_add_test (tc, test_update);
+    suite_add_tcase (s, tc);
+    tc = tcase_create ("Backups");
+    tcase_add_test (tc, test_backup);
+    suite_add_tcase (s, tc);
+    tc = tcase_create ("In-memory databases");
+    tcase_add_test (tc, test_memory_db);
+    suite_add_tcase (s, tc);
+    tc = tcase_create ("Page sizes");
+    tcase_add_test (tc, test_page_size);
+    suite_add_tcase (s, tc);
+    tc = tcase_create ("Statistics");
+    tcase_add_test (tc, test_analyze);
+    tcase_add_test (tc, test_analyze_distinct);
+    suite_add_tcase (s, tc);
+    tc = tcase_create ("Transactions");
+    tcase_add_test (tc, test_transactions);
+    tcase_add_test (tc, test_wal);
+    suite_add_tcase (s, tc);
+
+    tc = tcase_create ("Explain");
+    tcase_add_test (tc, test_explain_analyze);
+    suite_add_tcase (s, tc);
+
+    tc = tcase_create ("Counters");
+    tcase_add_test (tc, test_counters);
+    tcase_add_test (tc, test_latency);
+    tcase_add_test (tc, test_memory_limit);
+    suite_add_tcase (s, tc);
+
+    tc = tcase_create ("Threads");
+    tcase_add_test (tc, test_threadsafe);
+    tcase_add_test (tc, test_group_commit);
+    tcase_add_test (tc, test_parse_threads);
+    tcase_add_test (tc, test_parallel_scan);
+    suite_add_tcase (s, tc);
+    srunner_add_suite(sr, s);
+
     srunner_run_all (sr, CK_NORMAL);
     number_failed = srunner_ntests_failed (sr);
     srunner_free (sr);
@@ -8,6 +8,8 @@ char *str_values[] = {"foo", "bar", "foobar", "", "scrumptrulescent", "cromulent
 int8_t int8_values[] = {0,1,32,-32,64,-64,127,-128};
 int16_t int16_values[] = {0,1,1000,-1000,20000,-20000,32767,-32768};
 int32_t int32_values[] = {0,1,100000,-100000,2000000,-2000000,2147483647,-2147483648};
+int64_t int48_values[] = {0,1,4294967296LL,-4294967296LL,100000000000LL,-100000000000LL,140737488355327LL,-140737488355328LL};
+int64_t int64_values[] = {0,1,4294967296LL,-4294967296LL,1000000000000000000LL,-1000000000000000000LL,INT64_MAX,INT64_MIN};
 
 START_TEST (test_string)
 {
@@ -80,6 +82,40 @@ START_TEST (test_int32)
 END_TEST
 
 
+START_TEST (test_int48)
+{
+    for(int i=0; i<NVALUES; i++)
+    {
+        DBRecord *dbr;
+        int64_t val;
+        chidb_DBRecord_create(&dbr, "|i6|", int48_values[i]);
+        ck_assert(dbr->nfields == 1);
+        ck_assert_int_eq(chidb_DBRecord_getType(dbr, 0), SQL_INTEGER_6BYTE);
+        chidb_DBRecord_getInt64(dbr, 0, &val);
+        ck_assert(int48_values[i] == val);
+        chidb_DBRecord_destroy(dbr);
+    }
+}
+END_TEST
+
+
+START_TEST (test_int64)
+{
+    for(int i=0; i<NVALUES; i++)
+    {
+        DBRecord *dbr;
+        int64_t val;
+        chidb_DBRecord_create(&dbr, "|i8|", int64_values[i]);
+        ck_assert(dbr->nfields == 1);
+        ck_assert_int_eq(chidb_DBRecord_getType(dbr, 0), SQL_INTEGER_8BYTE);
+        chidb_DBRecord_getInt64(dbr, 0, &val);
+        ck_assert(int64_values[i] == val);
+        chidb_DBRecord_destroy(dbr);
+    }
+}
+END_TEST
+
+
 START_TEST (test_null)
 {
     DBRecord *dbr;
@@ -177,6 +213,152 @@ START_TEST (test_packunpack)
 END_TEST
 
 
+START_TEST (test_unpackheader)
+{
+    DBRecord *dbr1, dbr2;
+    uint32_t types[DBRECORD_MAX_FIELDS], offsets[DBRECORD_MAX_FIELDS];
+    char *s;
+    int8_t i8;
+    int16_t i16;
+    int32_t i32;
+    uint8_t *buf;
+
+    dbr2.types = types;
+    dbr2.offsets = offsets;
+
+    for(int i=0; i<NVALUES; i++)
+    {
+        chidb_DBRecord_create(&dbr1, "|s|0|i1|i2|i4|", str_values[i], int8_values[i], int16_values[i], int32_values[i]);
+        chidb_DBRecord_pack(dbr1, &buf);
+
+        chidb_DBRecord_unpackHeader(&dbr2, buf);
+        ck_assert(dbr2.nfields == 5);
+        ck_assert_int_eq(dbr2.packed_len, dbr1->packed_len);
+
+        /* The fields are read straight from the packed record */
+        ck_assert(dbr2.data == buf + (dbr2.packed_len - dbr2.data_len));
+
+        ck_assert_int_eq(chidb_DBRecord_getType(&dbr2, 0), SQL_TEXT);
+        chidb_DBRecord_getString(&dbr2, 0, &s);
+        ck_assert_str_eq(str_values[i], s);
+        free(s);
+
+        ck_assert_int_eq(chidb_DBRecord_getType(&dbr2, 1), SQL_NULL);
+
+        ck_assert_int_eq(chidb_DBRecord_getType(&dbr2, 2), SQL_INTEGER_1BYTE);
+        chidb_DBRecord_getInt8(&dbr2, 2, &i8);
+        ck_assert_int_eq(int8_values[i], i8);
+
+        ck_assert_int_eq(chidb_DBRecord_getType(&dbr2, 3), SQL_INTEGER_2BYTE);
+        chidb_DBRecord_getInt16(&dbr2, 3, &i16);
+        ck_assert_int_eq(int16_values[i], i16);
+
+        ck_assert_int_eq(chidb_DBRecord_getType(&dbr2, 4), SQL_INTEGER_4BYTE);
+        chidb_DBRecord_getInt32(&dbr2, 4, &i32);
+        ck_assert_int_eq(int32_values[i], i32);
+
+        chidb_DBRecord_destroy(dbr1);
+        free(buf);
+    }
+}
+END_TEST
+
+
+START_TEST (test_unpackheader_wide)
+{
+    DBRecordBuffer dbrb;
+    DBRecord *dbr1, dbr2;
+    uint32_t types[DBRECORD_MAX_FIELDS], offsets[DBRECORD_MAX_FIELDS];
+    uint8_t *buf;
+    int nfields = 120;
+
+    dbr2.types = types;
+    dbr2.offsets = offsets;
+
+    /* Long runs of single-byte types, broken up by text now and then */
+    chidb_DBRecord_create_empty(&dbrb, nfields);
+    for(int i=0; i<nfields; i++)
+    {
+        switch(i % 13)
+        {
+            case 0: chidb_DBRecord_appendNull(&dbrb); break;
+            case 1: case 7: chidb_DBRecord_appendInt8(&dbrb, int8_values[i % NVALUES]); break;
+            case 2: case 8: chidb_DBRecord_appendInt16(&dbrb, int16_values[i % NVALUES]); break;
+            case 3: case 9: chidb_DBRecord_appendInt32(&dbrb, int32_values[i % NVALUES]); break;
+            case 4: case 10: chidb_DBRecord_appendInt48(&dbrb, int48_values[i % NVALUES]); break;
+            case 5: case 11: chidb_DBRecord_appendInt64(&dbrb, int64_values[i % NVALUES]); break;
+            default: chidb_DBRecord_appendString(&dbrb, str_values[i % NVALUES]); break;
+        }
+    }
+    chidb_DBRecord_finalize(&dbrb, &dbr1);
+    chidb_DBRecord_pack(dbr1, &buf);
+
+    chidb_DBRecord_unpackHeader(&dbr2, buf);
+    ck_assert_int_eq(dbr2.nfields, nfields);
+    ck_assert_int_eq(dbr2.data_len, dbr1->data_len);
+    ck_assert_int_eq(dbr2.packed_len, dbr1->packed_len);
+    for(int i=0; i<nfields; i++)
+    {
+        ck_assert_int_eq(dbr2.types[i], dbr1->types[i]);
+        /* chidb_DBRecord_appendNull leaves a NULL at offset 0 */
+        if(dbr1->types[i] != SQL_NULL)
+            ck_assert_int_eq(dbr2.offsets[i], dbr1->offsets[i]);
+    }
+
+    chidb_DBRecord_destroy(dbr1);
+    free(buf);
+}
+END_TEST
+
+
+START_TEST (test_unpackheader_partial)
+{
+    DBRecordBuffer dbrb;
+    DBRecord *dbr1, dbr2;
+    uint32_t types[DBRECORD_MAX_FIELDS], offsets[DBRECORD_MAX_FIELDS];
+    uint32_t header_pos = 1;
+    uint8_t *buf;
+    int nfields = 120;
+    int steps[] = {2, 3, 17, 40, 119, DBRECORD_MAX_FIELDS};
+
+    dbr2.types = types;
+    dbr2.offsets = offsets;
+    dbr2.nfields = 0;
+    dbr2.data_len = 0;
+
+    chidb_DBRecord_create_empty(&dbrb, nfields);
+    for(int i=0; i<nfields; i++)
+    {
+        if(i % 11 == 5)
+            chidb_DBRecord_appendString(&dbrb, str_values[i % NVALUES]);
+        else
+            chidb_DBRecord_appendInt32(&dbrb, int32_values[i % NVALUES]);
+    }
+    chidb_DBRecord_finalize(&dbrb, &dbr1);
+    chidb_DBRecord_pack(dbr1, &buf);
+
+    /* Decoding a few more fields at a time ends up where decoding all does */
+    for(int s=0; s<sizeof(steps)/sizeof(steps[0]); s++)
+    {
+        int n = steps[s] < nfields ? steps[s] : nfields;
+
+        chidb_DBRecord_unpackHeaderTo(&dbr2, buf, &header_pos, steps[s]);
+        ck_assert_int_eq(dbr2.nfields, n);
+        ck_assert_int_eq(dbr2.data_len, n < nfields ? dbr1->offsets[n] : dbr1->data_len);
+        for(int i=0; i<n; i++)
+        {
+            ck_assert_int_eq(dbr2.types[i], dbr1->types[i]);
+            ck_assert_int_eq(dbr2.offsets[i], dbr1->offsets[i]);
+        }
+    }
+    ck_assert_int_eq(dbr2.packed_len, dbr1->packed_len);
+
+    chidb_DBRecord_destroy(dbr1);
+    free(buf);
+}
+END_TEST
+
+
 Suite* make_dbrecord_suite (void)
 {
     Suite *s = suite_create ("DB Record");
@@ -186,6 +368,8 @@ Suite* make_dbrecord_suite (void)
     tcase_add_test (tc_single, test_int8);
     tcase_add_test (tc_single, test_int16);
     tcase_add_test (tc_single, test_int32);
+    tcase_add_test (tc_single, test_int48);
+    tcase_add_test (tc_single, test_int64);
     tcase_add_test (tc_single, test_null);
     suite_add_tcase (s, tc_single);
 
@@ -195,6 +379,9 @@ Suite* make_dbrecord_suite (void)
 
     TCase *tc_packunpack = tcase_create ("Packing/unpacking a record");
     tcase_add_test (tc_packunpack, test_packunpack);
+    tcase_add_test (tc_packunpack, test_unpackheader);
+    tcase_add_test (tc_packunpack, test_unpackheader_wide);
+    tcase_add_test (tc_packunpack, test_unpackheader_partial);
     suite_add_tcase (s, tc_packunpack);
 
     return s;
@@ -1,7 +1,10 @@
 #include <stdlib.h>
+#include <unistd.h>
 #include <check.h>
 #include "check_common.h"
 #include "libchidb/pager.h"
+#include "libchidb/wal.h"
+#include <sys/stat.h>
 
 #define NVALUES (256)
 #define PAGE_SIZE (1024)
@@ -146,6 +149,886 @@ START_TEST (test_readwrite)
 END_TEST
 
 
+START_TEST (test_cache)
+{
+    int rc;
+    npage_t npage;
+    Pager *pg;
+    MemPage *page, *page2;
+
+    char *fname = create_tmp_file();
+
+    rc = chidb_Pager_open(&pg, fname);
+    ck_assert(rc == CHIDB_OK);
+
+    chidb_Pager_setPageSize(pg, PAGE_SIZE);
+    rc = chidb_Pager_setCacheSize(pg, 2);
+    ck_assert(rc == CHIDB_OK);
+
+    for(int j=1; j<=MAXPAGES; j++)
+        chidb_Pager_allocatePage(pg, &npage);
+
+    /* Two readers of the same page share the cached frame */
+    rc = chidb_Pager_readPage(pg, 1, &page);
+    ck_assert(rc == CHIDB_OK);
+    rc = chidb_Pager_readPage(pg, 1, &page2);
+    ck_assert(rc == CHIDB_OK);
+    ck_assert(page == page2);
+    ck_assert_int_eq(page->pin_count, 2);
+
+    /* Cache size cannot change while pages are pinned */
+    rc = chidb_Pager_setCacheSize(pg, 4);
+    ck_assert(rc == CHIDB_EMISUSE);
+
+    /* Cycle through more pages than there are frames while page 1 is pinned */
+    for(int j=2; j<=MAXPAGES; j++)
+    {
+        rc = chidb_Pager_readPage(pg, j, &page2);
+        ck_assert(rc == CHIDB_OK);
+        ck_assert(page2->npage == j);
+        page2->data[0] = j;
+        chidb_Pager_writePage(pg, page2);
+        chidb_Pager_releaseMemPage(pg, page2);
+    }
+    ck_assert(page->npage == 1);
+
+    /* With every frame pinned, we get a private copy */
+    rc = chidb_Pager_readPage(pg, 2, &page2);
+    ck_assert(rc == CHIDB_OK);
+    MemPage *page3;
+    rc = chidb_Pager_readPage(pg, 3, &page3);
+    ck_assert(rc == CHIDB_OK);
+    ck_assert(!page3->pooled);
+    ck_assert_int_eq(page2->data[0], 2);
+    ck_assert_int_eq(page3->data[0], 3);
+    chidb_Pager_releaseMemPage(pg, page3);
+    chidb_Pager_releaseMemPage(pg, page2);
+
+    chidb_Pager_releaseMemPage(pg, page);
+    chidb_Pager_releaseMemPage(pg, page);
+    ck_assert_int_eq(page->pin_count, 0);
+
+    /* In a larger pool, pages are found by number as frames are reused */
+    rc = chidb_Pager_setCacheSize(pg, 64);
+    ck_assert(rc == CHIDB_OK);
+    for(int j=MAXPAGES+1; j<=300; j++)
+    {
+        chidb_Pager_allocatePage(pg, &npage);
+        rc = chidb_Pager_readPage(pg, npage, &page2);
+        ck_assert(rc == CHIDB_OK);
+        page2->data[0] = j % 256;
+        chidb_Pager_writePage(pg, page2);
+        chidb_Pager_releaseMemPage(pg, page2);
+    }
+    for(int pass=0; pass<2; pass++)
+        for(int j=300; j>300-3*32; j-=3)
+        {
+            uint64_t hits = pg->stats.hits;
+            rc = chidb_Pager_readPage(pg, j, &page2);
+            ck_assert(rc == CHIDB_OK);
+            ck_assert(page2->npage == j);
+            ck_assert_int_eq(page2->data[0], j % 256);
+            chidb_Pager_releaseMemPage(pg, page2);
+            if(pass == 1)
+                ck_assert_msg(pg->stats.hits == hits + 1, "page %i", j);
+        }
+
+    chidb_Pager_close(pg);
+    delete_tmp_file(fname);
+}
+END_TEST
+
+
+START_TEST (test_mmap)
+{
+    int rc;
+    npage_t npage;
+    Pager *pg;
+    MemPage *page;
+
+    char *fname = create_tmp_file();
+
+    rc = chidb_Pager_open(&pg, fname);
+    ck_assert(rc == CHIDB_OK);
+
+    chidb_Pager_setPageSize(pg, PAGE_SIZE);
+
+    /* Only the first half of the pages fit in the mapping */
+    rc = chidb_Pager_setMmapSize(pg, PAGE_SIZE * MAXPAGES / 2);
+    ck_assert(rc == CHIDB_OK);
+
+    for(int j=1; j<=MAXPAGES; j++)
+    {
+        chidb_Pager_allocatePage(pg, &npage);
+        ck_assert(npage == j);
+    }
+
+    for(int j=1; j<=MAXPAGES; j++)
+    {
+        rc = chidb_Pager_readPage(pg, j, &page);
+        ck_assert(rc == CHIDB_OK);
+        ck_assert(page->mapped == (j <= MAXPAGES / 2));
+        for(int k=0; k<NVALUES; k++)
+            page->data[pagepos[k]] = values[k] + j;
+        chidb_Pager_writePage(pg, page);
+        chidb_Pager_releaseMemPage(pg, page);
+    }
+
+    chidb_Pager_close(pg);
+
+    /* Read everything back through the regular read path */
+    rc = chidb_Pager_open(&pg, fname);
+    ck_assert(rc == CHIDB_OK);
+    chidb_Pager_setPageSize(pg, PAGE_SIZE);
+    ck_assert_int_eq(pg->n_pages, MAXPAGES);
+
+    for(int j=1; j<=MAXPAGES; j++)
+    {
+        rc = chidb_Pager_readPage(pg, j, &page);
+        ck_assert(rc == CHIDB_OK);
+        for(int k=0; k<NVALUES; k++)
+            if(page->data[pagepos[k]] != (uint8_t) (values[k] + j))
+            {
+                ck_abort_msg("Incorrect value read from page");
+                break;
+            }
+        chidb_Pager_releaseMemPage(pg, page);
+    }
+
+    chidb_Pager_close(pg);
+    delete_tmp_file(fname);
+}
+END_TEST
+
+
+START_TEST (test_prefetch)
+{
+    int rc;
+    npage_t npage;
+    Pager *pg;
+    MemPage *page;
+    npage_t pages[MAXPAGES + 2];
+
+    char *fname = create_tmp_file();
+
+    rc = chidb_Pager_open(&pg, fname);
+    ck_assert(rc == CHIDB_OK);
+
+    chidb_Pager_setPageSize(pg, PAGE_SIZE);
+
+    /* The run of pages being hinted crosses the end of the mapping */
+    rc = chidb_Pager_setMmapSize(pg, PAGE_SIZE * MAXPAGES / 2);
+    ck_assert(rc == CHIDB_OK);
+
+    for(int j=1; j<=MAXPAGES; j++)
+    {
+        chidb_Pager_allocatePage(pg, &npage);
+        rc = chidb_Pager_readPage(pg, npage, &page);
+        ck_assert(rc == CHIDB_OK);
+        page->data[0] = j;
+        chidb_Pager_writePage(pg, page);
+        chidb_Pager_releaseMemPage(pg, page);
+    }
+
+    /* Page 1 stays cached and pinned while it is hinted */
+    rc = chidb_Pager_readPage(pg, 1, &page);
+    ck_assert(rc == CHIDB_OK);
+
+    /* Invalid page numbers are ignored */
+    pages[0] = 0;
+    for(int j=1; j<=MAXPAGES; j++)
+        pages[j] = j;
+    pages[MAXPAGES + 1] = MAXPAGES + 1;
+    rc = chidb_Pager_prefetch(pg, pages, MAXPAGES + 2);
+    ck_assert(rc == CHIDB_OK);
+    ck_assert_int_eq(page->pin_count, 1);
+    chidb_Pager_releaseMemPage(pg, page);
+
+    /* Hints never change what is read */
+    for(int j=MAXPAGES; j>=1; j--)
+    {
+        rc = chidb_Pager_readPage(pg, j, &page);
+        ck_assert(rc == CHIDB_OK);
+        ck_assert_int_eq(page->data[0], j);
+        chidb_Pager_releaseMemPage(pg, page);
+    }
+
+    chidb_Pager_close(pg);
+    delete_tmp_file(fname);
+}
+END_TEST
+
+
+START_TEST (test_uring)
+{
+    int rc;
+    npage_t npage;
+    Pager *pg;
+    MemPage *page;
+    npage_t pages[MAXPAGES];
+
+    char *fname = create_tmp_file();
+
+    rc = chidb_Pager_open(&pg, fname);
+    ck_assert(rc == CHIDB_OK);
+    chidb_Pager_setPageSize(pg, PAGE_SIZE);
+
+    rc = chidb_Pager_setBackend(pg, CHIDB_IO_URING);
+    if(rc == CHIDB_EIO)
+    {
+        /* No io_uring on this system */
+        chidb_Pager_close(pg);
+        delete_tmp_file(fname);
+        return;
+    }
+    ck_assert(rc == CHIDB_OK);
+
+    /* The pages are written back in a single batch */
+    for(int j=1; j<=MAXPAGES; j++)
+    {
+        chidb_Pager_allocatePage(pg, &npage);
+        rc = chidb_Pager_readPage(pg, npage, &page);
+        ck_assert(rc == CHIDB_OK);
+        for(int k=0; k<NVALUES; k++)
+            page->data[pagepos[k]] = values[k] + j;
+        chidb_Pager_writePage(pg, page);
+        chidb_Pager_releaseMemPage(pg, page);
+    }
+    rc = chidb_Pager_flush(pg);
+    ck_assert(rc == CHIDB_OK);
+    chidb_Pager_close(pg);
+
+    rc = chidb_Pager_open(&pg, fname);
+    ck_assert(rc == CHIDB_OK);
+    chidb_Pager_setPageSize(pg, PAGE_SIZE);
+    chidb_Pager_setCacheSize(pg, MAXPAGES / 2);
+    rc = chidb_Pager_setBackend(pg, CHIDB_IO_URING);
+    ck_assert(rc == CHIDB_OK);
+
+    /* Read-ahead fills the buffer pool in the background */
+    for(int j=0; j<MAXPAGES; j++)
+        pages[j] = j + 1;
+    rc = chidb_Pager_prefetch(pg, pages, MAXPAGES);
+    ck_assert(rc == CHIDB_OK);
+    ck_assert_int_eq(pg->n_pending, MAXPAGES / 2);
+
+    for(int j=1; j<=MAXPAGES; j++)
+    {
+        rc = chidb_Pager_readPage(pg, j, &page);
+        ck_assert(rc == CHIDB_OK);
+        ck_assert(!page->pending);
+        for(int k=0; k<NVALUES; k++)
+            if(page->data[pagepos[k]] != (uint8_t) (values[k] + j))
+            {
+                ck_abort_msg("Incorrect value read from page");
+                break;
+            }
+        chidb_Pager_releaseMemPage(pg, page);
+    }
+    ck_assert_int_eq(pg->n_pending, 0);
+
+    /* Switching back waits for any read still in flight */
+    rc = chidb_Pager_prefetch(pg, pages, MAXPAGES / 2);
+    ck_assert(rc == CHIDB_OK);
+    rc = chidb_Pager_setBackend(pg, CHIDB_IO_STDIO);
+    ck_assert(rc == CHIDB_OK);
+    ck_assert_int_eq(pg->n_pending, 0);
+
+    chidb_Pager_close(pg);
+    delete_tmp_file(fname);
+}
+END_TEST
+
+
+START_TEST (test_writeback)
+{
+    int rc;
+    npage_t npage;
+    Pager *pg, *pg2;
+    MemPage *page, *page2;
+
+    char *fname = create_tmp_file();
+
+    rc = chidb_Pager_open(&pg, fname);
+    ck_assert(rc == CHIDB_OK);
+    chidb_Pager_setPageSize(pg, PAGE_SIZE);
+
+    for(int j=1; j<=MAXPAGES; j++)
+        chidb_Pager_allocatePage(pg, &npage);
+
+    /* Write every page several times; nothing reaches the file yet */
+    for(int n=0; n<3; n++)
+        for(int j=1; j<=MAXPAGES; j++)
+        {
+            chidb_Pager_readPage(pg, j, &page);
+            for(int k=0; k<NVALUES; k++)
+                page->data[pagepos[k]] = values[k] + j + n;
+            rc = chidb_Pager_writePage(pg, page);
+            ck_assert(rc == CHIDB_OK);
+            ck_assert(page->dirty);
+            chidb_Pager_releaseMemPage(pg, page);
+        }
+
+    rc = chidb_Pager_open(&pg2, fname);
+    ck_assert(rc == CHIDB_OK);
+    chidb_Pager_setPageSize(pg2, PAGE_SIZE);
+    ck_assert_int_eq(pg2->n_pages, 0);
+    chidb_Pager_close(pg2);
+
+    rc = chidb_Pager_flush(pg);
+    ck_assert(rc == CHIDB_OK);
+
+    rc = chidb_Pager_open(&pg2, fname);
+    ck_assert(rc == CHIDB_OK);
+    chidb_Pager_setPageSize(pg2, PAGE_SIZE);
+    ck_assert_int_eq(pg2->n_pages, MAXPAGES);
+
+    for(int j=1; j<=MAXPAGES; j++)
+    {
+        chidb_Pager_readPage(pg, j, &page);
+        ck_assert(!page->dirty);
+        chidb_Pager_readPage(pg2, j, &page2);
+        if(memcmp(page->data, page2->data, PAGE_SIZE))
+            ck_abort_msg("Flushed page differs from in-memory page");
+        chidb_Pager_releaseMemPage(pg2, page2);
+        chidb_Pager_releaseMemPage(pg, page);
+    }
+
+    chidb_Pager_close(pg2);
+    chidb_Pager_close(pg);
+    delete_tmp_file(fname);
+}
+END_TEST
+
+
+static void fill_pages(Pager *pg, npage_t first, npage_t last, int n)
+{
+    MemPage *page;
+
+    for(npage_t j=first; j<=last; j++)
+    {
+        chidb_Pager_readPage(pg, j, &page);
+        for(int k=0; k<NVALUES; k++)
+            page->data[pagepos[k]] = values[k] + j + n;
+        ck_assert(chidb_Pager_writePage(pg, page) == CHIDB_OK);
+        chidb_Pager_releaseMemPage(pg, page);
+    }
+}
+
+static void check_pages(Pager *pg, npage_t first, npage_t last, int n)
+{
+    MemPage *page;
+
+    for(npage_t j=first; j<=last; j++)
+    {
+        chidb_Pager_readPage(pg, j, &page);
+        for(int k=0; k<NVALUES; k++)
+            ck_assert_int_eq(page->data[pagepos[k]], (uint8_t) (values[k] + j + n));
+        chidb_Pager_releaseMemPage(pg, page);
+    }
+}
+
+START_TEST (test_transaction)
+{
+    int rc;
+    npage_t npage;
+    Pager *pg, *pg2;
+
+    char *fname = create_tmp_file();
+
+    rc = chidb_Pager_open(&pg, fname);
+    ck_assert(rc == CHIDB_OK);
+    chidb_Pager_setPageSize(pg, PAGE_SIZE);
+
+    for(int j=1; j<=MAXPAGES; j++)
+        chidb_Pager_allocatePage(pg, &npage);
+    fill_pages(pg, 1, MAXPAGES, 0);
+
+    /* Rolling back restores the pages, even those that reached the file,
+     * and drops the pages allocated in the transaction */
+    rc = chidb_Pager_begin(pg);
+    ck_assert(rc == CHIDB_OK);
+    ck_assert(chidb_Pager_begin(pg) == CHIDB_EMISUSE);
+    ck_assert(access(pg->journal_name, F_OK) == 0);
+
+    fill_pages(pg, 1, MAXPAGES / 2, 1);
+    chidb_Pager_allocatePage(pg, &npage);
+    chidb_Pager_allocatePage(pg, &npage);
+    fill_pages(pg, MAXPAGES + 1, MAXPAGES + 2, 1);
+    ck_assert(chidb_Pager_flush(pg) == CHIDB_OK);
+    fill_pages(pg, MAXPAGES / 2, MAXPAGES, 2);
+
+    rc = chidb_Pager_rollback(pg);
+    ck_assert(rc == CHIDB_OK);
+    ck_assert(access(pg->journal_name, F_OK) != 0);
+    ck_assert_int_eq(pg->n_pages, MAXPAGES);
+    check_pages(pg, 1, MAXPAGES, 0);
+    ck_assert(chidb_Pager_rollback(pg) == CHIDB_EMISUSE);
+
+    rc = chidb_Pager_open(&pg2, fname);
+    ck_assert(rc == CHIDB_OK);
+    chidb_Pager_setPageSize(pg2, PAGE_SIZE);
+    ck_assert_int_eq(pg2->n_pages, MAXPAGES);
+    check_pages(pg2, 1, MAXPAGES, 0);
+    chidb_Pager_close(pg2);
+
+    /* Committing writes the pages and deletes the journal */
+    rc = chidb_Pager_begin(pg);
+    ck_assert(rc == CHIDB_OK);
+    fill_pages(pg, 1, MAXPAGES, 3);
+    rc = chidb_Pager_commit(pg);
+    ck_assert(rc == CHIDB_OK);
+    ck_assert(access(pg->journal_name, F_OK) != 0);
+    ck_assert(chidb_Pager_commit(pg) == CHIDB_EMISUSE);
+
+    rc = chidb_Pager_open(&pg2, fname);
+    ck_assert(rc == CHIDB_OK);
+    chidb_Pager_setPageSize(pg2, PAGE_SIZE);
+    check_pages(pg2, 1, MAXPAGES, 3);
+    chidb_Pager_close(pg2);
+
+    chidb_Pager_close(pg);
+    delete_tmp_file(fname);
+}
+END_TEST
+
+
+START_TEST (test_hot_journal)
+{
+    int rc;
+    npage_t npage;
+    Pager *pg, *pg2;
+
+    char *fname = create_tmp_file();
+    char *fname2 = create_tmp_file();
+    char *jname2 = malloc(strlen(fname2) + strlen("-journal") + 1);
+    sprintf(jname2, "%s-journal", fname2);
+
+    rc = chidb_Pager_open(&pg, fname);
+    ck_assert(rc == CHIDB_OK);
+    chidb_Pager_setPageSize(pg, PAGE_SIZE);
+
+    for(int j=1; j<=MAXPAGES; j++)
+        chidb_Pager_allocatePage(pg, &npage);
+    fill_pages(pg, 1, MAXPAGES, 0);
+
+    rc = chidb_Pager_begin(pg);
+    ck_assert(rc == CHIDB_OK);
+    fill_pages(pg, 1, MAXPAGES, 1);
+    chidb_Pager_allocatePage(pg, &npage);
+    fill_pages(pg, MAXPAGES + 1, MAXPAGES + 1, 1);
+    ck_assert(chidb_Pager_flush(pg) == CHIDB_OK);
+
+    /* The copy is what a crash in the middle of the transaction
+     * leaves behind */
+    ck_assert(copy(fname, fname2) != NULL);
+    ck_assert(copy(pg->journal_name, jname2) != NULL);
+
+    rc = chidb_Pager_open(&pg2, fname2);
+    ck_assert(rc == CHIDB_OK);
+    ck_assert(access(jname2, F_OK) != 0);
+    chidb_Pager_setPageSize(pg2, PAGE_SIZE);
+    ck_assert_int_eq(pg2->n_pages, MAXPAGES);
+    check_pages(pg2, 1, MAXPAGES, 0);
+    chidb_Pager_close(pg2);
+
+    /* A journal that is still in use is left alone */
+    rc = chidb_Pager_open(&pg2, fname);
+    ck_assert(rc == CHIDB_OK);
+    ck_assert(access(pg->journal_name, F_OK) == 0);
+    chidb_Pager_close(pg2);
+
+    ck_assert(chidb_Pager_rollback(pg) == CHIDB_OK);
+    chidb_Pager_close(pg);
+
+    free(jname2);
+    delete_tmp_file(fname2);
+    delete_tmp_file(fname);
+}
+END_TEST
+
+
+START_TEST (test_wal)
+{
+    int rc;
+    npage_t npage;
+    Pager *pg, *pg2, *pg3;
+    MemPage *page;
+    struct stat buf;
+
+    char *fname = create_tmp_file();
+
+    rc = chidb_Pager_open(&pg, fname);
+    ck_assert(rc == CHIDB_OK);
+    chidb_Pager_setPageSize(pg, PAGE_SIZE);
+    for(int j=1; j<=MAXPAGES; j++)
+        chidb_Pager_allocatePage(pg, &npage);
+    fill_pages(pg, 1, MAXPAGES, 0);
+    ck_assert(chidb_Pager_flush(pg) == CHIDB_OK);
+    ck_assert(chidb_Pager_setWal(pg, true) == CHIDB_OK);
+
+    rc = chidb_Pager_open(&pg2, fname);
+    ck_assert(rc == CHIDB_OK);
+    chidb_Pager_setPageSize(pg2, PAGE_SIZE);
+    ck_assert(chidb_Pager_setWal(pg2, true) == CHIDB_OK);
+
+    /* A reader keeps its snapshot while the writer commits */
+    check_pages(pg2, 1, MAXPAGES, 0);
+    fill_pages(pg, 1, MAXPAGES, 1);
+    chidb_Pager_allocatePage(pg, &npage);
+    fill_pages(pg, MAXPAGES + 1, MAXPAGES + 1, 1);
+    ck_assert(chidb_Pager_flush(pg) == CHIDB_OK);
+    check_pages(pg2, 1, MAXPAGES, 0);
+    ck_assert_int_eq(pg2->n_pages, MAXPAGES);
+
+    /* The pages are in the log, not in the file */
+    rc = chidb_Pager_open(&pg3, fname);
+    ck_assert(rc == CHIDB_OK);
+    chidb_Pager_setPageSize(pg3, PAGE_SIZE);
+    check_pages(pg3, 1, MAXPAGES, 0);
+    chidb_Pager_close(pg3);
+
+    /* Nor can it write on top of a snapshot that is out of date */
+    chidb_Pager_readPage(pg2, 1, &page);
+    ck_assert(chidb_Pager_writePage(pg2, page) == CHIDB_EBUSY);
+    chidb_Pager_releaseMemPage(pg2, page);
+
+    /* With a new snapshot, the reader sees the commit */
+    ck_assert(chidb_Pager_flush(pg2) == CHIDB_OK);
+    check_pages(pg2, 1, MAXPAGES + 1, 1);
+    ck_assert_int_eq(pg2->n_pages, MAXPAGES + 1);
+    ck_assert(chidb_Pager_flush(pg2) == CHIDB_OK);
+
+    /* Only one writer at a time, and a rolled back transaction leaves
+     * nothing behind */
+    ck_assert(chidb_Pager_begin(pg) == CHIDB_OK);
+    fill_pages(pg, 1, 2, 2);
+    chidb_Pager_readPage(pg2, 1, &page);
+    ck_assert(chidb_Pager_writePage(pg2, page) == CHIDB_EBUSY);
+    chidb_Pager_releaseMemPage(pg2, page);
+    ck_assert(chidb_Pager_flush(pg2) == CHIDB_OK);
+    ck_assert(chidb_Pager_flush(pg) == CHIDB_OK);
+    ck_assert(chidb_Pager_rollback(pg) == CHIDB_OK);
+    check_pages(pg, 1, MAXPAGES + 1, 1);
+    check_pages(pg2, 1, MAXPAGES + 1, 1);
+
+    /* The log cannot be checkpointed while it is being read */
+    ck_assert(chidb_Pager_checkpoint(pg) == CHIDB_EBUSY);
+    ck_assert(chidb_Pager_flush(pg2) == CHIDB_OK);
+    ck_assert(chidb_Pager_checkpoint(pg) == CHIDB_OK);
+    ck_assert(stat(pg->wal->name, &buf) == 0);
+    ck_assert_int_eq(buf.st_size, 16);
+
+    rc = chidb_Pager_open(&pg3, fname);
+    ck_assert(rc == CHIDB_OK);
+    chidb_Pager_setPageSize(pg3, PAGE_SIZE);
+    ck_assert_int_eq(pg3->n_pages, MAXPAGES + 1);
+    check_pages(pg3, 1, MAXPAGES + 1, 1);
+    chidb_Pager_close(pg3);
+
+    /* Once it has been reset, the reader gets the pages from the file,
+     * and can write again */
+    check_pages(pg2, 1, MAXPAGES + 1, 1);
+    fill_pages(pg2, 1, MAXPAGES, 3);
+    ck_assert(chidb_Pager_flush(pg2) == CHIDB_OK);
+    check_pages(pg, 1, MAXPAGES, 3);
+    ck_assert(chidb_Pager_flush(pg) == CHIDB_OK);
+
+    chidb_Pager_close(pg2);
+    char *wname = strdup(pg->wal->name);
+    ck_assert(chidb_Pager_setWal(pg, false) == CHIDB_OK);
+    ck_assert(access(wname, F_OK) != 0);
+    free(wname);
+    chidb_Pager_close(pg);
+
+    rc = chidb_Pager_open(&pg3, fname);
+    ck_assert(rc == CHIDB_OK);
+    chidb_Pager_setPageSize(pg3, PAGE_SIZE);
+    check_pages(pg3, 1, MAXPAGES, 3);
+    chidb_Pager_close(pg3);
+
+    delete_tmp_file(fname);
+}
+END_TEST
+
+
+/* Fills a page with lines of text, which compress well */
+static void text_page(uint8_t *data, npage_t j, int n)
+{
+    char line[64];
+    int off = 0;
+
+    for(int i=0; off < PAGE_SIZE; i++)
+    {
+        int len = snprintf(line, sizeof(line), "Page %u, line %d: the quick brown fox (%d)\n", j, i, n);
+        memcpy(data + off, line, off + len <= PAGE_SIZE ? len : PAGE_SIZE - off);
+        off += len;
+    }
+}
+
+static void fill_text(Pager *pg, npage_t first, npage_t last, int n)
+{
+    MemPage *page;
+
+    for(npage_t j=first; j<=last; j++)
+    {
+        chidb_Pager_readPage(pg, j, &page);
+        text_page(page->data, j, n);
+        ck_assert(chidb_Pager_writePage(pg, page) == CHIDB_OK);
+        chidb_Pager_releaseMemPage(pg, page);
+    }
+}
+
+static void check_text(Pager *pg, npage_t first, npage_t last, int n)
+{
+    MemPage *page;
+    uint8_t data[PAGE_SIZE];
+
+    for(npage_t j=first; j<=last; j++)
+    {
+        ck_assert(chidb_Pager_readPage(pg, j, &page) == CHIDB_OK);
+        text_page(data, j, n);
+        ck_assert(!memcmp(page->data, data, PAGE_SIZE));
+        chidb_Pager_releaseMemPage(pg, page);
+    }
+}
+
+/* Fills a page with bytes that do not compress */
+static void noise_page(uint8_t *data)
+{
+    uint32_t x = 12345;
+
+    for(int k=0; k<PAGE_SIZE; k++)
+    {
+        x = x * 1103515245 + 12345;
+        data[k] = x >> 16;
+    }
+}
+
+#define NTEXTPAGES (64)
+
+START_TEST (test_compress)
+{
+    int rc;
+    npage_t npage;
+    Pager *pg, *pg2;
+    MemPage *page;
+    uint8_t noise[PAGE_SIZE];
+    struct stat buf;
+    off_t size;
+
+    char *fname = create_tmp_file();
+    char *fname2 = create_tmp_file();
+    char *jname2 = malloc(strlen(fname2) + strlen("-journal") + 1);
+    sprintf(jname2, "%s-journal", fname2);
+
+    rc = chidb_Pager_open(&pg, fname);
+    ck_assert(rc == CHIDB_OK);
+    chidb_Pager_setPageSize(pg, PAGE_SIZE);
+    ck_assert(chidb_Pager_setCompression(pg, true) == CHIDB_OK);
+    ck_assert(pg->compressed);
+
+    for(int j=1; j<=NTEXTPAGES; j++)
+        chidb_Pager_allocatePage(pg, &npage);
+    fill_text(pg, 1, NTEXTPAGES, 0);
+    ck_assert(chidb_Pager_flush(pg) == CHIDB_OK);
+
+    ck_assert(stat(fname, &buf) == 0);
+    ck_assert_int_lt(buf.st_size, NTEXTPAGES * PAGE_SIZE / 3);
+
+    /* Only while the file is empty, and never in WAL mode */
+    ck_assert(chidb_Pager_setCompression(pg, false) == CHIDB_EMISUSE);
+    ck_assert(chidb_Pager_setWal(pg, true) == CHIDB_EMISUSE);
+    ck_assert(chidb_Pager_setBackend(pg, CHIDB_IO_STDIO) == CHIDB_EMISUSE);
+
+    /* A page that does not compress is stored as it is */
+    chidb_Pager_allocatePage(pg, &npage);
+    chidb_Pager_readPage(pg, npage, &page);
+    noise_page(page->data);
+    ck_assert(chidb_Pager_writePage(pg, page) == CHIDB_OK);
+    chidb_Pager_releaseMemPage(pg, page);
+    chidb_Pager_close(pg);
+
+    rc = chidb_Pager_open(&pg, fname);
+    ck_assert(rc == CHIDB_OK);
+    ck_assert(pg->compressed);
+    chidb_Pager_setPageSize(pg, PAGE_SIZE);
+    ck_assert_int_eq(pg->n_pages, NTEXTPAGES + 1);
+    check_text(pg, 1, NTEXTPAGES, 0);
+    noise_page(noise);
+    ck_assert(chidb_Pager_readPage(pg, NTEXTPAGES + 1, &page) == CHIDB_OK);
+    ck_assert(!memcmp(page->data, noise, PAGE_SIZE));
+    chidb_Pager_releaseMemPage(pg, page);
+
+    /* The journal is played back through the compressed file, both on
+     * rollback and after a crash */
+    ck_assert(chidb_Pager_begin(pg) == CHIDB_OK);
+    fill_text(pg, 1, NTEXTPAGES / 2, 1);
+    chidb_Pager_allocatePage(pg, &npage);
+    fill_text(pg, npage, npage, 1);
+    ck_assert(chidb_Pager_flush(pg) == CHIDB_OK);
+    ck_assert(copy(fname, fname2) != NULL);
+    ck_assert(copy(pg->journal_name, jname2) != NULL);
+    ck_assert(chidb_Pager_rollback(pg) == CHIDB_OK);
+    ck_assert_int_eq(pg->n_pages, NTEXTPAGES + 1);
+    check_text(pg, 1, NTEXTPAGES, 0);
+
+    rc = chidb_Pager_open(&pg2, fname2);
+    ck_assert(rc == CHIDB_OK);
+    ck_assert(access(jname2, F_OK) != 0);
+    chidb_Pager_setPageSize(pg2, PAGE_SIZE);
+    ck_assert_int_eq(pg2->n_pages, NTEXTPAGES + 1);
+    check_text(pg2, 1, NTEXTPAGES, 0);
+    chidb_Pager_close(pg2);
+
+    /* Pages that are written again reuse the room of their old copies */
+    ck_assert(stat(fname, &buf) == 0);
+    size = buf.st_size;
+    for(int n=2; n<10; n++)
+    {
+        ck_assert(chidb_Pager_begin(pg) == CHIDB_OK);
+        fill_text(pg, 1, NTEXTPAGES, n);
+        ck_assert(chidb_Pager_commit(pg) == CHIDB_OK);
+    }
+    ck_assert(stat(fname, &buf) == 0);
+    ck_assert_int_le(buf.st_size, 2 * size);
+    check_text(pg, 1, NTEXTPAGES, 9);
+
+    ck_assert(chidb_Pager_truncate(pg, 2) == CHIDB_OK);
+    chidb_Pager_close(pg);
+
+    rc = chidb_Pager_open(&pg, fname);
+    ck_assert(rc == CHIDB_OK);
+    chidb_Pager_setPageSize(pg, PAGE_SIZE);
+    ck_assert_int_eq(pg->n_pages, 2);
+    check_text(pg, 1, 2, 9);
+    ck_assert(stat(fname, &buf) == 0);
+    ck_assert_int_lt(buf.st_size, size);
+    chidb_Pager_close(pg);
+
+    free(jname2);
+    delete_tmp_file(fname2);
+    delete_tmp_file(fname);
+}
+END_TEST
+
+
+START_TEST (test_memory)
+{
+    int rc;
+    npage_t npage;
+    Pager *pg, *pg2;
+    MemPage *page;
+
+    rc = chidb_Pager_open(&pg, ":memory:");
+    ck_assert(rc == CHIDB_OK);
+    chidb_Pager_setPageSize(pg, PAGE_SIZE);
+    ck_assert_int_eq(pg->n_pages, 0);
+
+    /* With a small pool, most of the pages are evicted to the backend */
+    ck_assert(chidb_Pager_setCacheSize(pg, 4) == CHIDB_OK);
+    for(int j=1; j<=MAXPAGES; j++)
+        chidb_Pager_allocatePage(pg, &npage);
+    fill_pages(pg, 1, MAXPAGES, 0);
+    ck_assert(chidb_Pager_flush(pg) == CHIDB_OK);
+    check_pages(pg, 1, MAXPAGES, 0);
+    ck_assert(access(":memory:", F_OK) != 0);
+
+    /* Rolling back works the same, with the journal in memory */
+    ck_assert(chidb_Pager_begin(pg) == CHIDB_OK);
+    ck_assert(access(pg->journal_name, F_OK) != 0);
+    fill_pages(pg, 1, MAXPAGES / 2, 1);
+    chidb_Pager_allocatePage(pg, &npage);
+    fill_pages(pg, MAXPAGES + 1, MAXPAGES + 1, 1);
+    ck_assert(chidb_Pager_flush(pg) == CHIDB_OK);
+    ck_assert(chidb_Pager_rollback(pg) == CHIDB_OK);
+    ck_assert_int_eq(pg->n_pages, MAXPAGES);
+    check_pages(pg, 1, MAXPAGES, 0);
+
+    ck_assert(chidb_Pager_begin(pg) == CHIDB_OK);
+    fill_pages(pg, 1, MAXPAGES, 2);
+    ck_assert(chidb_Pager_commit(pg) == CHIDB_OK);
+    check_pages(pg, 1, MAXPAGES, 2);
+
+    /* Pages allocated again after a truncation start out empty */
+    ck_assert(chidb_Pager_truncate(pg, 1) == CHIDB_OK);
+    chidb_Pager_allocatePage(pg, &npage);
+    ck_assert_int_eq(npage, 2);
+    ck_assert(chidb_Pager_getRealDBSize(pg, &npage) == CHIDB_OK);
+    ck_assert_int_eq(npage, 1);
+    ck_assert(chidb_Pager_readPage(pg, 2, &page) == CHIDB_OK);
+    for(int i=0; i<PAGE_SIZE; i++)
+        ck_assert_int_eq(page->data[i], 0);
+    chidb_Pager_releaseMemPage(pg, page);
+
+    /* There is no file to map, log next to, or compress */
+    ck_assert(chidb_Pager_setMmapSize(pg, PAGE_SIZE * MAXPAGES) == CHIDB_OK);
+    ck_assert(pg->map == NULL);
+    ck_assert(chidb_Pager_setWal(pg, true) == CHIDB_EMISUSE);
+    ck_assert(chidb_Pager_setCompression(pg, true) == CHIDB_EMISUSE);
+    ck_assert(chidb_Pager_setBackend(pg, CHIDB_IO_STDIO) == CHIDB_EMISUSE);
+
+    /* Every in-memory Pager is a database of its own */
+    rc = chidb_Pager_open(&pg2, ":memory:");
+    ck_assert(rc == CHIDB_OK);
+    chidb_Pager_setPageSize(pg2, PAGE_SIZE);
+    ck_assert_int_eq(pg2->n_pages, 0);
+    chidb_Pager_close(pg2);
+
+    chidb_Pager_close(pg);
+}
+END_TEST
+
+
+START_TEST (test_preallocation)
+{
+    npage_t npage;
+    uint64_t extents;
+    Pager *pg;
+    struct stat st;
+
+    char *fname = create_tmp_file();
+    ck_assert(chidb_Pager_open(&pg, fname) == CHIDB_OK);
+    chidb_Pager_setPageSize(pg, PAGE_SIZE);
+    ck_assert(chidb_Pager_setPreallocation(pg, MAXPAGES) == CHIDB_OK);
+
+    /* The pages are reserved in a few extents that grow with the file,
+     * but the file is only as large as the pages that were allocated */
+    for(int j=1; j<=1000; j++)
+        chidb_Pager_allocatePage(pg, &npage);
+    fill_pages(pg, 1, 1000, 0);
+    ck_assert(chidb_Pager_flush(pg) == CHIDB_OK);
+    ck_assert(stat(fname, &st) == 0);
+    ck_assert_int_eq(st.st_size, 1000 * PAGE_SIZE);
+    check_pages(pg, 1, 1000, 0);
+
+    /* Unless the file system cannot reserve space, in which case
+     * preallocation is turned off */
+    if (pg->preallocation > 0)
+    {
+        ck_assert(pg->stats.extents > 0 && pg->stats.extents < 30);
+        ck_assert(pg->reserved_pages >= 1000);
+        ck_assert((off_t) st.st_blocks * 512 >= (off_t) pg->reserved_pages * PAGE_SIZE);
+    }
+
+    /* Truncating the file gives up the space reserved past it */
+    ck_assert(chidb_Pager_truncate(pg, 10) == CHIDB_OK);
+    ck_assert(pg->reserved_pages <= 10);
+    ck_assert(stat(fname, &st) == 0);
+    ck_assert_int_eq(st.st_size, 10 * PAGE_SIZE);
+
+    extents = pg->stats.extents;
+    ck_assert(chidb_Pager_setPreallocation(pg, 0) == CHIDB_OK);
+    for(int j=11; j<=20; j++)
+        chidb_Pager_allocatePage(pg, &npage);
+    ck_assert(pg->stats.extents == extents);
+
+    chidb_Pager_close(pg);
+    delete_tmp_file(fname);
+}
+END_TEST
+
+
 Suite* make_pager_suite (void)
 {
     Suite *s = suite_create ("Pager");
@@ -162,6 +1045,44 @@ Suite* make_pager_suite (void)
     tcase_add_test (tc_readwrite, test_readwrite);
     suite_add_tcase (s, tc_readwrite);
 
+    TCase *tc_cache = tcase_create ("Buffer pool");
+    tcase_add_test (tc_cache, test_cache);
+    suite_add_tcase (s, tc_cache);
+
+    TCase *tc_writeback = tcase_create ("Write-back of dirty pages");
+    tcase_add_test (tc_writeback, test_writeback);
+    suite_add_tcase (s, tc_writeback);
+
+    TCase *tc_mmap = tcase_create ("Memory-mapped reads");
+    tcase_add_test (tc_mmap, test_mmap);
+    tcase_add_test (tc_mmap, test_prefetch);
+    suite_add_tcase (s, tc_mmap);
+
+    TCase *tc_uring = tcase_create ("io_uring backend");
+    tcase_add_test (tc_uring, test_uring);
+    suite_add_tcase (s, tc_uring);
+
+    TCase *tc_txn = tcase_create ("Transactions");
+    tcase_add_test (tc_txn, test_transaction);
+    tcase_add_test (tc_txn, test_hot_journal);
+    suite_add_tcase (s, tc_txn);
+
+    TCase *tc_wal = tcase_create ("Write-ahead log");
+    tcase_add_test (tc_wal, test_wal);
+    suite_add_tcase (s, tc_wal);
+
+    TCase *tc_compress = tcase_create ("Compressed files");
+    tcase_add_test (tc_compress, test_compress);
+    suite_add_tcase (s, tc_compress);
+
+    TCase *tc_memory = tcase_create ("In-memory databases");
+    tcase_add_test (tc_memory, test_memory);
+    suite_add_tcase (s, tc_memory);
+
+    TCase *tc_prealloc = tcase_create ("Preallocation");
+    tcase_add_test (tc_prealloc, test_preallocation);
+    suite_add_tcase (s, tc_prealloc);
+
     return s;
 }
 